@@ -7,45 +7,95 @@
 #ifndef __LIBCAMERA_BUFFER_H__
 #define __LIBCAMERA_BUFFER_H__
 
-#include <array>
+#include <memory>
+#include <stddef.h>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
+#include <libcamera/clock.h>
+
 namespace libcamera {
 
 class BufferPool;
+class ObjectArena;
 class Request;
 class Stream;
 
 class Plane final
 {
 public:
+	enum CpuAccess {
+		CpuRead = (1 << 0),
+		CpuWrite = (1 << 1),
+		CpuReadWrite = CpuRead | CpuWrite,
+	};
+
+	enum MapFlag {
+		MapPopulate = (1 << 0),
+		MapSequential = (1 << 1),
+		MapHugePages = (1 << 2),
+	};
+
 	Plane();
+	Plane(const Plane &) = delete;
+	Plane(Plane &&other) noexcept;
 	~Plane();
 
+	Plane &operator=(const Plane &) = delete;
+	Plane &operator=(Plane &&other) noexcept;
+
 	int dmabuf() const { return fd_; }
 	int setDmabuf(int fd, unsigned int length);
+	int setUserPtr(void *mem, unsigned int length);
 
 	void *mem();
 	unsigned int length() const { return length_; }
+	unsigned int offset() const { return offset_; }
+
+	unsigned int mapFlags() const { return mapFlags_; }
+	void setMapFlags(unsigned int flags) { mapFlags_ = flags; }
+
+	int beginCpuAccess(CpuAccess access = CpuRead);
+	int endCpuAccess(CpuAccess access = CpuRead);
 
 private:
+	friend class BufferMemory;
 	friend class Stream;
 
+	struct Mapping;
+
 	int mmap();
 	int munmap();
+	int sync(CpuAccess access, bool end);
 
 	int fd_;
 	unsigned int length_;
-	void *mem_;
+	unsigned int offset_;
+	unsigned int mapFlags_;
+	std::shared_ptr<Mapping> mapping_;
+	void *userptr_;
 };
 
 class BufferMemory final
 {
 public:
 	std::vector<Plane> &planes() { return planes_; }
+	const std::vector<Plane> &planes() const { return planes_; }
+
+	uint64_t size() const;
+	uint64_t mappedSize() const;
+
+	int beginCpuAccess(Plane::CpuAccess access = Plane::CpuRead);
+	int endCpuAccess(Plane::CpuAccess access = Plane::CpuRead);
 
 private:
+	friend class Stream;
+	friend class V4L2VideoDevice;
+
+	bool sharesDmabuf(unsigned int index) const;
+	void shareMappings();
+
 	std::vector<Plane> planes_;
 };
 
@@ -60,10 +110,28 @@ public:
 	unsigned int count() const { return buffers_.size(); }
 	std::vector<BufferMemory> &buffers() { return buffers_; }
 
+	uint64_t size() const;
+	uint64_t mappedSize() const;
+
 private:
 	std::vector<BufferMemory> buffers_;
 };
 
+struct MemoryUsage {
+	MemoryUsage()
+		: allocated(0), imported(0), mapped(0)
+	{
+	}
+
+	MemoryUsage &operator+=(const MemoryUsage &other);
+
+	std::string toString() const;
+
+	uint64_t allocated;
+	uint64_t imported;
+	uint64_t mapped;
+};
+
 class Buffer final
 {
 public:
@@ -71,19 +139,33 @@ public:
 		BufferSuccess,
 		BufferError,
 		BufferCancelled,
+		BufferSkipped,
+	};
+
+	enum Flag {
+		FlagKeyFrame = (1 << 0),
 	};
 
 	Buffer(unsigned int index = -1, const Buffer *metadata = nullptr);
 	Buffer(const Buffer &) = delete;
+	~Buffer();
 	Buffer &operator=(const Buffer &) = delete;
 
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr);
+
 	unsigned int index() const { return index_; }
-	const std::array<int, 3> &dmabufs() const { return dmabuf_; }
+	const std::vector<int> &dmabufs() const { return dmabuf_; }
 	BufferMemory *mem() { return mem_; }
 
+	int fence() const { return fence_; }
+	void setFence(int fd);
+
 	unsigned int bytesused() const { return bytesused_; }
 	uint64_t timestamp() const { return timestamp_; }
+	ClockId clock() const { return clock_; }
 	unsigned int sequence() const { return sequence_; }
+	unsigned int flags() const { return flags_; }
 
 	Status status() const { return status_; }
 	Request *request() const { return request_; }
@@ -96,21 +178,30 @@ private:
 	friend class Stream;
 	friend class V4L2VideoDevice;
 
+	static void *operator new(size_t size, ObjectArena *arena);
+	static void operator delete(void *ptr, ObjectArena *arena);
+
 	void cancel();
+	void closeFence();
 
 	void setRequest(Request *request) { request_ = request; }
 
 	unsigned int index_;
-	std::array<int, 3> dmabuf_;
+	std::vector<int> dmabuf_;
 	BufferMemory *mem_;
+	int fence_;
 
 	unsigned int bytesused_;
 	uint64_t timestamp_;
+	ClockId clock_;
 	unsigned int sequence_;
+	unsigned int flags_;
 
 	Status status_;
 	Request *request_;
 	Stream *stream_;
+	bool recycled_;
+	bool held_;
 };
 
 } /* namespace libcamera */
@@ -7,13 +7,21 @@
 #ifndef __LIBCAMERA_CAMERA_H__
 #define __LIBCAMERA_CAMERA_H__
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
+#include <libcamera/camera_statistics.h>
 #include <libcamera/controls.h>
+#include <libcamera/object.h>
 #include <libcamera/request.h>
 #include <libcamera/signal.h>
 #include <libcamera/stream.h>
@@ -21,6 +29,7 @@
 namespace libcamera {
 
 class Buffer;
+class ObjectArena;
 class PipelineHandler;
 class Request;
 
@@ -66,7 +75,7 @@ protected:
 	std::vector<StreamConfiguration> config_;
 };
 
-class Camera final : public std::enable_shared_from_this<Camera>
+class Camera final : public Object, public std::enable_shared_from_this<Camera>
 {
 public:
 	static std::shared_ptr<Camera> create(PipelineHandler *pipe,
@@ -77,10 +86,17 @@ public:
 	Camera &operator=(const Camera &) = delete;
 
 	const std::string &name() const;
+	unsigned int id() const { return id_; }
 
 	Signal<Request *, Buffer *> bufferCompleted;
+	Signal<Request *, Buffer *, unsigned int> bufferProgressed;
 	Signal<Request *, const std::map<Stream *, Buffer *> &> requestCompleted;
+	Signal<unsigned int, uint64_t> frameStarted;
 	Signal<Camera *> disconnected;
+	Signal<Camera *, int> operationCompleted;
+
+	using RecycleHandler = std::function<void(std::unique_ptr<Buffer>)>;
+	void setRecycleHandler(const RecycleHandler &handler) { recycleHandler_ = handler; }
 
 	int acquire();
 	int release();
@@ -90,15 +106,23 @@ public:
 	const std::set<Stream *> &streams() const;
 	std::unique_ptr<CameraConfiguration> generateConfiguration(const StreamRoles &roles);
 	int configure(CameraConfiguration *config);
+	std::future<int> configureAsync(CameraConfiguration *config);
 
 	int allocateBuffers();
+	std::future<int> allocateBuffersAsync();
 	int freeBuffers();
 
 	Request *createRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
+	int queueRequests(const std::vector<Request *> &requests);
 
 	int start();
-	int stop();
+	std::future<int> startAsync();
+	int stop(std::vector<Request *> *cancelled = nullptr);
+	int standby(std::vector<Request *> *cancelled = nullptr);
+
+	CameraStatistics statistics() const;
+	MemoryUsage memoryUsage() const;
 
 private:
 	enum State {
@@ -107,6 +131,7 @@ private:
 		CameraConfigured,
 		CameraPrepared,
 		CameraRunning,
+		CameraStandby,
 	};
 
 	Camera(PipelineHandler *pipe, const std::string &name);
@@ -115,18 +140,59 @@ private:
 	bool stateBetween(State low, State high) const;
 	bool stateIs(State state) const;
 
+	bool configurationUnchanged(const CameraConfiguration *config) const;
+	int configureStreams(CameraConfiguration *config);
+	int reconfigure(CameraConfiguration *config);
+
+	friend class CameraManager;
 	friend class PipelineHandler;
+	friend class Request;
 	void disconnect();
 
+	int prepareRequest(Request *request);
+	void flushCancelled(std::vector<Request *> *cancelled);
+	std::future<int> runAsync(const std::function<int()> &func);
+	void bufferComplete(Request *request, Buffer *buffer);
+	void bufferProgress(Request *request, Buffer *buffer, unsigned int lines);
 	void requestComplete(Request *request);
+	void frameStart(unsigned int sequence, uint64_t timestamp);
+	void releaseBuffer(Buffer *buffer);
+
+	Signal<Camera *, Request *> requestQueued_;
+	Signal<Camera *, const std::vector<Request *> &> requestsQueued_;
+	Signal<Request *, Buffer *> bufferDone_;
+	Signal<Request *, Buffer *, unsigned int> bufferProgress_;
+	Signal<Request *> requestDone_;
+	Signal<unsigned int, uint64_t> frameStart_;
+	Signal<> unplugged_;
 
 	std::shared_ptr<PipelineHandler> pipe_;
 	std::string name_;
+	unsigned int id_;
 	std::set<Stream *> streams_;
 	std::set<Stream *> activeStreams_;
+	std::vector<Stream *> streamTable_;
 
 	bool disconnected_;
 	State state_;
+	bool warmStandby_;
+	std::atomic<bool> asyncPending_;
+
+	/* Collects the requests cancelled by stop() when requested. */
+	std::vector<Request *> *cancelledRequests_;
+
+	/* Completed requests not processed by the camera's thread yet. */
+	std::mutex completionMutex_;
+	std::deque<Request *> pendingCompletions_;
+
+	/* The request being handed to the application, and if it was queued. */
+	Request *completingRequest_;
+	bool completingRequestQueued_;
+
+	RecycleHandler recycleHandler_;
+	std::shared_ptr<ObjectArena> arena_;
+
+	unsigned int traceSource_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * camera_group.h - Synchronised capture from multiple cameras
+ */
+#ifndef __LIBCAMERA_CAMERA_GROUP_H__
+#define __LIBCAMERA_CAMERA_GROUP_H__
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Buffer;
+class Camera;
+class Request;
+class Stream;
+
+class CameraGroup
+{
+public:
+	CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras,
+		    uint64_t tolerance);
+	CameraGroup(const CameraGroup &) = delete;
+	CameraGroup &operator=(const CameraGroup &) = delete;
+	~CameraGroup();
+
+	const std::vector<std::shared_ptr<Camera>> &cameras() const { return cameras_; }
+	uint64_t tolerance() const { return tolerance_; }
+
+	int start();
+	int stop();
+
+	Signal<const std::vector<Request *> &> framesetCompleted;
+
+private:
+	static constexpr unsigned int MaxQueuedRequests = 4;
+
+	void requestComplete(Request *request,
+			     const std::map<Stream *, Buffer *> &buffers);
+	void matchRequests();
+	void completeFrameset(std::vector<Request *> &frameset);
+	void completeRequest(unsigned int index);
+	void flush();
+
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::map<Camera *, unsigned int> indices_;
+	uint64_t tolerance_;
+	Request *current_;
+
+	/* Completed requests waiting for a match, for each camera. */
+	std::vector<std::deque<Request *>> queues_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_GROUP_H__ */
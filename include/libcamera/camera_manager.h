@@ -9,14 +9,19 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <libcamera/buffer.h>
+
 namespace libcamera {
 
 class Camera;
 class DeviceEnumerator;
 class EventDispatcher;
 class PipelineHandler;
+class PipelineHandlerFactory;
+class Thread;
 
 class CameraManager
 {
@@ -26,6 +31,9 @@ public:
 
 	const std::vector<std::shared_ptr<Camera>> &cameras() const { return cameras_; }
 	std::shared_ptr<Camera> get(const std::string &name);
+	std::shared_ptr<Camera> get(unsigned int id);
+
+	MemoryUsage memoryUsage() const;
 
 	void addCamera(std::shared_ptr<Camera> camera);
 	void removeCamera(Camera *camera);
@@ -36,15 +44,33 @@ public:
 	void setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 	EventDispatcher *eventDispatcher();
 
+	void setThreadAffinity(const std::vector<unsigned int> &cpus);
+	void setThreadScheduling(int policy, int priority);
+
 private:
 	CameraManager();
 	CameraManager(const CameraManager &) = delete;
 	CameraManager &operator=(const CameraManager &) = delete;
 	~CameraManager();
 
+	void configureThread(Thread *thread, PipelineHandlerFactory *factory);
+	void placeThread(Thread *thread, const PipelineHandler *pipe);
+	void matchPipelines();
+
+	/* Destroyed last, pipeline handlers stay bound to their thread. */
+	std::vector<std::unique_ptr<Thread>> threads_;
+	Thread *thread_;
+
+	std::vector<unsigned int> threadCpus_;
+	int threadPolicy_;
+	int threadPriority_;
+
 	std::unique_ptr<DeviceEnumerator> enumerator_;
 	std::vector<std::shared_ptr<PipelineHandler>> pipes_;
 	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::unordered_map<std::string, std::shared_ptr<Camera>> camerasByName_;
+	std::unordered_map<unsigned int, std::shared_ptr<Camera>> camerasById_;
+	unsigned int nextCameraId_;
 
 	static const std::string version_;
 };
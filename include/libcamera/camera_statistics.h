@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * camera_statistics.h - Camera runtime statistics
+ */
+#ifndef __LIBCAMERA_CAMERA_STATISTICS_H__
+#define __LIBCAMERA_CAMERA_STATISTICS_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace libcamera {
+
+class Histogram
+{
+public:
+	static constexpr unsigned int BucketCount = 33;
+
+	Histogram();
+	explicit Histogram(const std::vector<uint64_t> &counts);
+
+	static unsigned int bucket(uint64_t value);
+	static uint64_t lowerBound(unsigned int bucket);
+
+	const std::vector<uint64_t> &counts() const { return counts_; }
+	uint64_t total() const;
+	uint64_t percentile(unsigned int percent) const;
+
+	const std::string toString() const;
+
+private:
+	std::vector<uint64_t> counts_;
+};
+
+struct CameraStatistics {
+	CameraStatistics();
+
+	uint64_t requestsQueued;
+	uint64_t requestsCompleted;
+	uint64_t requestsCancelled;
+	uint64_t buffersCompleted;
+	uint64_t framesDropped;
+	uint64_t requestsDropped;
+
+	Histogram queueDepth;
+	Histogram requestLatency;
+	Histogram startLatency;
+	Histogram firstFrameLatency;
+
+	const std::string toString() const;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_STATISTICS_H__ */
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * clock.h - Timestamp clock domains
+ */
+#ifndef __LIBCAMERA_CLOCK_H__
+#define __LIBCAMERA_CLOCK_H__
+
+#include <array>
+#include <cstdint>
+
+namespace libcamera {
+
+enum ClockId {
+	ClockUnknown,
+	ClockMonotonic,
+	ClockBoottime,
+	ClockRealtime,
+};
+
+class ClockConverter
+{
+public:
+	ClockConverter();
+
+	void update();
+	uint64_t convert(uint64_t timestamp, ClockId from, ClockId to) const;
+
+private:
+	static constexpr unsigned int ClockCount = ClockRealtime + 1;
+
+	/* Offsets of each clock relative to CLOCK_MONOTONIC, in nanoseconds. */
+	std::array<int64_t, ClockCount> offsets_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CLOCK_H__ */
@@ -9,6 +9,9 @@
 #define __LIBCAMERA_CONTROL_IDS_H__
 
 #include <functional>
+#include <stdint.h>
+
+#include <libcamera/geometry.h>
 
 namespace libcamera {
 
@@ -19,8 +22,42 @@ enum ControlId {
 	Saturation,
 	ManualExposure,
 	ManualGain,
+	FrameDuration,
+	SensorTimestamp,
+	ScalerCrop,
 };
 
+static constexpr unsigned int ControlIdCount = ScalerCrop + 1;
+
+template<typename T>
+class Control
+{
+public:
+	constexpr Control(ControlId id)
+		: id_(id)
+	{
+	}
+
+	constexpr ControlId id() const { return id_; }
+
+private:
+	ControlId id_;
+};
+
+namespace controls {
+
+static constexpr Control<bool> AwbEnable(libcamera::AwbEnable);
+static constexpr Control<int> Brightness(libcamera::Brightness);
+static constexpr Control<int> Contrast(libcamera::Contrast);
+static constexpr Control<int> Saturation(libcamera::Saturation);
+static constexpr Control<int> ManualExposure(libcamera::ManualExposure);
+static constexpr Control<int> ManualGain(libcamera::ManualGain);
+static constexpr Control<int> FrameDuration(libcamera::FrameDuration);
+static constexpr Control<int64_t> SensorTimestamp(libcamera::SensorTimestamp);
+static constexpr Control<Rectangle> ScalerCrop(libcamera::ScalerCrop);
+
+} /* namespace controls */
+
 } /* namespace libcamera */
 
 namespace std {
@@ -8,11 +8,17 @@
 #ifndef __LIBCAMERA_CONTROLS_H__
 #define __LIBCAMERA_CONTROLS_H__
 
+#include <array>
+#include <iterator>
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <libcamera/control_ids.h>
+#include <libcamera/geometry.h>
 
 namespace libcamera {
 
@@ -23,6 +29,7 @@ enum ControlValueType {
 	ControlValueBool,
 	ControlValueInteger,
 	ControlValueInteger64,
+	ControlValueRectangle,
 };
 
 class ControlValue
@@ -32,6 +39,7 @@ public:
 	ControlValue(bool value);
 	ControlValue(int value);
 	ControlValue(int64_t value);
+	ControlValue(const Rectangle &value);
 
 	ControlValueType type() const { return type_; };
 	bool isNone() const { return type_ == ControlValueNone; };
@@ -39,10 +47,15 @@ public:
 	void set(bool value);
 	void set(int value);
 	void set(int64_t value);
+	void set(const Rectangle &value);
 
 	bool getBool() const;
 	int getInt() const;
 	int64_t getInt64() const;
+	const Rectangle &getRectangle() const;
+
+	template<typename T>
+	T get() const;
 
 	std::string toString() const;
 
@@ -53,9 +66,34 @@ private:
 		bool bool_;
 		int integer_;
 		int64_t integer64_;
+		Rectangle rectangle_;
 	};
 };
 
+template<>
+inline bool ControlValue::get<bool>() const
+{
+	return bool_;
+}
+
+template<>
+inline int ControlValue::get<int>() const
+{
+	return integer_;
+}
+
+template<>
+inline int64_t ControlValue::get<int64_t>() const
+{
+	return integer64_;
+}
+
+template<>
+inline Rectangle ControlValue::get<Rectangle>() const
+{
+	return rectangle_;
+}
+
 struct ControlIdentifier {
 	ControlId id;
 	const char *name;
@@ -78,9 +116,15 @@ public:
 	std::string toString() const;
 
 private:
+	friend class ControlList;
+
 	const struct ControlIdentifier *ident_;
 	ControlValue min_;
 	ControlValue max_;
+
+	bool bounded_;
+	int64_t lower_;
+	int64_t upper_;
 };
 
 bool operator==(const ControlInfo &lhs, const ControlInfo &rhs);
@@ -99,38 +143,185 @@ static inline bool operator!=(const ControlInfo &lhs, const ControlId &rhs)
 	return !(lhs == rhs);
 }
 
-using ControlInfoMap = std::unordered_map<ControlId, ControlInfo>;
+class ControlInfoMap
+{
+public:
+	using value_type = std::pair<ControlId, ControlInfo>;
+
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = ControlInfoMap::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const value_type *;
+		using reference = const value_type &;
+
+		const_iterator(const ControlInfoMap *map, unsigned int index)
+			: map_(map), index_(index)
+		{
+			skip();
+		}
+
+		reference operator*() const { return map_->entries_[index_]; }
+		pointer operator->() const { return &map_->entries_[index_]; }
+
+		const_iterator &operator++()
+		{
+			index_++;
+			skip();
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator iter = *this;
+			++*this;
+			return iter;
+		}
+
+		bool operator==(const const_iterator &other) const
+		{
+			return index_ == other.index_;
+		}
+		bool operator!=(const const_iterator &other) const
+		{
+			return index_ != other.index_;
+		}
+
+	private:
+		void skip()
+		{
+			while (index_ < ControlIdCount && !map_->present_[index_])
+				index_++;
+		}
+
+		const ControlInfoMap *map_;
+		unsigned int index_;
+	};
+
+	using iterator = const_iterator;
+
+	ControlInfoMap();
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, ControlIdCount); }
+
+	bool empty() const { return size_ == 0; }
+	std::size_t size() const { return size_; }
+	void clear();
+
+	std::pair<const_iterator, bool> insert(const ControlInfo &info);
+
+	const_iterator find(ControlId id) const;
+	std::size_t count(ControlId id) const { return present_[id]; }
+	const ControlInfo &at(ControlId id) const;
+
+private:
+	std::vector<value_type> entries_;
+	std::array<bool, ControlIdCount> present_;
+	std::size_t size_;
+};
 
 class ControlList
 {
 private:
-	using ControlListMap = std::unordered_map<const ControlInfo *, ControlValue>;
+	using ControlListEntry = std::pair<const ControlInfo *, ControlValue>;
+	using ControlListStorage = std::array<ControlListEntry, ControlIdCount>;
+
+	template<typename Entry, typename Storage>
+	class Iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = Entry;
+		using difference_type = std::ptrdiff_t;
+		using pointer = Entry *;
+		using reference = Entry &;
+
+		Iterator(Storage *entries, unsigned int index)
+			: entries_(entries), index_(index)
+		{
+			skip();
+		}
+
+		reference operator*() const { return (*entries_)[index_]; }
+		pointer operator->() const { return &(*entries_)[index_]; }
+
+		Iterator &operator++()
+		{
+			index_++;
+			skip();
+			return *this;
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator iter = *this;
+			++*this;
+			return iter;
+		}
+
+		bool operator==(const Iterator &other) const
+		{
+			return index_ == other.index_;
+		}
+		bool operator!=(const Iterator &other) const
+		{
+			return index_ != other.index_;
+		}
+
+	private:
+		void skip()
+		{
+			while (index_ < entries_->size() && !(*entries_)[index_].first)
+				index_++;
+		}
+
+		Storage *entries_;
+		unsigned int index_;
+	};
 
 public:
 	ControlList(Camera *camera);
 
-	using iterator = ControlListMap::iterator;
-	using const_iterator = ControlListMap::const_iterator;
+	using iterator = Iterator<ControlListEntry, ControlListStorage>;
+	using const_iterator = Iterator<const ControlListEntry, const ControlListStorage>;
 
-	iterator begin() { return controls_.begin(); }
-	iterator end() { return controls_.end(); }
-	const_iterator begin() const { return controls_.begin(); }
-	const_iterator end() const { return controls_.end(); }
+	iterator begin() { return iterator(&controls_, 0); }
+	iterator end() { return iterator(&controls_, ControlIdCount); }
+	const_iterator begin() const { return const_iterator(&controls_, 0); }
+	const_iterator end() const { return const_iterator(&controls_, ControlIdCount); }
 
 	bool contains(ControlId id) const;
 	bool contains(const ControlInfo *info) const;
-	bool empty() const { return controls_.empty(); }
-	std::size_t size() const { return controls_.size(); }
-	void clear() { controls_.clear(); }
+	bool empty() const { return size_ == 0; }
+	std::size_t size() const { return size_; }
+	void clear();
 
 	ControlValue &operator[](ControlId id);
-	ControlValue &operator[](const ControlInfo *info) { return controls_[info]; }
+	ControlValue &operator[](const ControlInfo *info);
 
 	void update(const ControlList &list);
+	bool validate() const;
+
+	template<typename T>
+	T get(const Control<T> &ctrl) const
+	{
+		const ControlListEntry &entry = controls_[ctrl.id()];
+		return entry.first ? entry.second.template get<T>() : T{};
+	}
+
+	template<typename T>
+	void set(const Control<T> &ctrl, const T &value)
+	{
+		(*this)[ctrl.id()] = ControlValue(value);
+	}
 
 private:
 	Camera *camera_;
-	ControlListMap controls_;
+	ControlListStorage controls_;
+	std::size_t size_;
 };
 
 } /* namespace libcamera */
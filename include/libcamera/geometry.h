@@ -8,6 +8,8 @@
 #ifndef __LIBCAMERA_GEOMETRY_H__
 #define __LIBCAMERA_GEOMETRY_H__
 
+#include <iosfwd>
+#include <stdint.h>
 #include <string>
 
 namespace libcamera {
@@ -21,19 +23,26 @@ struct Rectangle {
 	const std::string toString() const;
 };
 
-bool operator==(const Rectangle &lhs, const Rectangle &rhs);
-static inline bool operator!=(const Rectangle &lhs, const Rectangle &rhs)
+constexpr bool operator==(const Rectangle &lhs, const Rectangle &rhs)
+{
+	return lhs.x == rhs.x && lhs.y == rhs.y && lhs.w == rhs.w &&
+	       lhs.h == rhs.h;
+}
+
+constexpr bool operator!=(const Rectangle &lhs, const Rectangle &rhs)
 {
 	return !(lhs == rhs);
 }
 
+std::ostream &operator<<(std::ostream &out, const Rectangle &rect);
+
 struct Size {
-	Size()
+	constexpr Size()
 		: Size(0, 0)
 	{
 	}
 
-	Size(unsigned int w, unsigned int h)
+	constexpr Size(unsigned int w, unsigned int h)
 		: width(w), height(h)
 	{
 	}
@@ -41,58 +50,120 @@ struct Size {
 	unsigned int width;
 	unsigned int height;
 
+	constexpr bool isNull() const { return !width && !height; }
 	const std::string toString() const;
+
+	constexpr Size alignedDownTo(unsigned int hAlignment,
+				     unsigned int vAlignment) const
+	{
+		return {
+			width / hAlignment * hAlignment,
+			height / vAlignment * vAlignment
+		};
+	}
+
+	constexpr Size alignedUpTo(unsigned int hAlignment,
+				   unsigned int vAlignment) const
+	{
+		return {
+			(width + hAlignment - 1) / hAlignment * hAlignment,
+			(height + vAlignment - 1) / vAlignment * vAlignment
+		};
+	}
+
+	constexpr Size boundedTo(const Size &bound) const
+	{
+		return {
+			width < bound.width ? width : bound.width,
+			height < bound.height ? height : bound.height
+		};
+	}
+
+	constexpr Size expandedTo(const Size &expand) const
+	{
+		return {
+			width > expand.width ? width : expand.width,
+			height > expand.height ? height : expand.height
+		};
+	}
 };
 
-bool operator==(const Size &lhs, const Size &rhs);
-bool operator<(const Size &lhs, const Size &rhs);
+constexpr bool operator==(const Size &lhs, const Size &rhs)
+{
+	return lhs.width == rhs.width && lhs.height == rhs.height;
+}
+
+constexpr bool operator<(const Size &lhs, const Size &rhs)
+{
+	/*
+	 * A size smaller in both dimensions is smaller, and a size larger or
+	 * equal in both dimensions isn't. Otherwise compare the areas, then
+	 * the widths. This is written as a single expression for C++11.
+	 */
+	return (lhs.width < rhs.width && lhs.height < rhs.height) ||
+	       (!(lhs.width >= rhs.width && lhs.height >= rhs.height) &&
+		(static_cast<uint64_t>(lhs.width) * lhs.height <
+		 static_cast<uint64_t>(rhs.width) * rhs.height ||
+		 (static_cast<uint64_t>(lhs.width) * lhs.height ==
+		  static_cast<uint64_t>(rhs.width) * rhs.height &&
+		  lhs.width < rhs.width)));
+}
 
-static inline bool operator!=(const Size &lhs, const Size &rhs)
+constexpr bool operator!=(const Size &lhs, const Size &rhs)
 {
 	return !(lhs == rhs);
 }
 
-static inline bool operator<=(const Size &lhs, const Size &rhs)
+constexpr bool operator<=(const Size &lhs, const Size &rhs)
 {
 	return lhs < rhs || lhs == rhs;
 }
 
-static inline bool operator>(const Size &lhs, const Size &rhs)
+constexpr bool operator>(const Size &lhs, const Size &rhs)
 {
 	return !(lhs <= rhs);
 }
 
-static inline bool operator>=(const Size &lhs, const Size &rhs)
+constexpr bool operator>=(const Size &lhs, const Size &rhs)
 {
 	return !(lhs < rhs);
 }
 
+std::ostream &operator<<(std::ostream &out, const Size &size);
+
 class SizeRange
 {
 public:
-	SizeRange()
+	constexpr SizeRange()
+		: hStep(0), vStep(0)
 	{
 	}
 
-	SizeRange(unsigned int width, unsigned int height)
+	constexpr SizeRange(unsigned int width, unsigned int height)
 		: min(width, height), max(width, height), hStep(1), vStep(1)
 	{
 	}
 
-	SizeRange(unsigned int minW, unsigned int minH,
-		  unsigned int maxW, unsigned int maxH)
+	constexpr SizeRange(unsigned int minW, unsigned int minH,
+			    unsigned int maxW, unsigned int maxH)
 		: min(minW, minH), max(maxW, maxH), hStep(1), vStep(1)
 	{
 	}
 
-	SizeRange(unsigned int minW, unsigned int minH,
-		  unsigned int maxW, unsigned int maxH,
-		  unsigned int hstep, unsigned int vstep)
+	constexpr SizeRange(unsigned int minW, unsigned int minH,
+			    unsigned int maxW, unsigned int maxH,
+			    unsigned int hstep, unsigned int vstep)
 		: min(minW, minH), max(maxW, maxH), hStep(hstep), vStep(vstep)
 	{
 	}
 
-	bool contains(const Size &size) const;
+	constexpr bool contains(const Size &size) const
+	{
+		return size.width >= min.width && size.width <= max.width &&
+		       size.height >= min.height && size.height <= max.height &&
+		       (!hStep || !((size.width - min.width) % hStep)) &&
+		       (!vStep || !((size.height - min.height) % vStep));
+	}
 
 	std::string toString() const;
 
@@ -102,12 +173,18 @@ public:
 	unsigned int vStep;
 };
 
-bool operator==(const SizeRange &lhs, const SizeRange &rhs);
-static inline bool operator!=(const SizeRange &lhs, const SizeRange &rhs)
+constexpr bool operator==(const SizeRange &lhs, const SizeRange &rhs)
+{
+	return lhs.min == rhs.min && lhs.max == rhs.max;
+}
+
+constexpr bool operator!=(const SizeRange &lhs, const SizeRange &rhs)
 {
 	return !(lhs == rhs);
 }
 
+std::ostream &operator<<(std::ostream &out, const SizeRange &range);
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_GEOMETRY_H__ */
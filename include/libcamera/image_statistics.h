@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * image_statistics.h - Image statistics computed on the CPU
+ */
+#ifndef __LIBCAMERA_IMAGE_STATISTICS_H__
+#define __LIBCAMERA_IMAGE_STATISTICS_H__
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class BufferMemory;
+
+struct ImageStatistics {
+	static constexpr unsigned int HistogramBins = 256;
+
+	std::array<uint32_t, HistogramBins> histogram;
+	unsigned int samples;
+	double luma;
+	std::array<double, 3> mean;
+};
+
+class ImageStatisticsCalculator
+{
+public:
+	ImageStatisticsCalculator();
+
+	static const std::vector<unsigned int> &formats();
+
+	int configure(unsigned int pixelFormat, const Size &size,
+		      unsigned int stride, unsigned int xStep = 1,
+		      unsigned int yStep = 1);
+	size_t frameSize() const { return frameSize_; }
+
+	int compute(const uint8_t *data, size_t size,
+		    ImageStatistics *stats) const;
+	int compute(BufferMemory *mem, ImageStatistics *stats) const;
+
+private:
+	struct Format;
+
+	static const Format imageFormats_[];
+
+	int computeFrame(const uint8_t *luma, const uint8_t *chroma,
+			 ImageStatistics *stats) const;
+
+	const Format *format_;
+	Size size_;
+	unsigned int stride_;
+	unsigned int xStep_;
+	unsigned int yStep_;
+	size_t frameSize_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IMAGE_STATISTICS_H__ */
@@ -7,14 +7,38 @@
 #ifndef __LIBCAMERA_IPA_INTERFACE_H__
 #define __LIBCAMERA_IPA_INTERFACE_H__
 
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/signal.h>
+
 namespace libcamera {
 
+struct IPABuffer {
+	unsigned int id;
+	BufferMemory memory;
+};
+
+struct IPAOperationData {
+	unsigned int operation;
+	std::vector<uint32_t> data;
+};
+
 class IPAInterface
 {
 public:
 	virtual ~IPAInterface() {}
 
 	virtual int init() = 0;
+
+	virtual void mapBuffers(const std::vector<IPABuffer> &buffers) = 0;
+	virtual void unmapBuffers(const std::vector<unsigned int> &ids) = 0;
+
+	virtual void processEvent(unsigned int frame,
+				  const IPAOperationData &event) = 0;
+
+	Signal<unsigned int, const IPAOperationData &> queueFrameAction;
 };
 
 } /* namespace libcamera */
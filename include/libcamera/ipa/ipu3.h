@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipu3.h - Image Processing Algorithm interface for IPU3
+ */
+#ifndef __LIBCAMERA_IPA_INTERFACE_IPU3_H__
+#define __LIBCAMERA_IPA_INTERFACE_IPU3_H__
+
+namespace libcamera {
+
+enum IPU3Operations {
+	/* Fill the parameters buffer whose ID is in data[0]. */
+	IPU3EventFillParams = 1,
+	/* Process the statistics buffer whose ID is in data[0]. */
+	IPU3EventStatReady = 2,
+	/* The parameters buffer whose ID is in data[0] has been filled. */
+	IPU3ActionParamFilled = 3,
+	/* The statistics buffer whose ID is in data[0] has been processed. */
+	IPU3ActionStatProcessed = 4,
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_INTERFACE_IPU3_H__ */
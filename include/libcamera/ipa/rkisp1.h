@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * rkisp1.h - Image Processing Algorithm interface for RkISP1
+ */
+#ifndef __LIBCAMERA_IPA_INTERFACE_RKISP1_H__
+#define __LIBCAMERA_IPA_INTERFACE_RKISP1_H__
+
+namespace libcamera {
+
+enum RkISP1Operations {
+	/* Fill the parameters buffer whose ID is in data[0]. */
+	RkISP1EventFillParams = 1,
+	/* Process the statistics buffer whose ID is in data[0]. */
+	RkISP1EventStatReady = 2,
+	/* The parameters buffer whose ID is in data[0] has been filled. */
+	RkISP1ActionParamFilled = 3,
+	/* The statistics buffer whose ID is in data[0] has been processed. */
+	RkISP1ActionStatProcessed = 4,
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_INTERFACE_RKISP1_H__ */
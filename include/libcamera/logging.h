@@ -14,12 +14,15 @@ enum LoggingTarget {
 	LoggingTargetSyslog,
 	LoggingTargetFile,
 	LoggingTargetStream,
+	LoggingTargetBinaryFile,
 };
 
 int logSetFile(const char *path);
 int logSetStream(std::ostream *stream);
+int logSetBinaryFile(const char *path);
 int logSetTarget(LoggingTarget target);
 void logSetLevel(const char *category, const char *level);
+void logSetAsynchronous(bool enable);
 
 } /* namespace libcamera */
 
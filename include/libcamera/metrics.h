@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * metrics.h - Runtime metrics
+ */
+#ifndef __LIBCAMERA_METRICS_H__
+#define __LIBCAMERA_METRICS_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/camera_statistics.h>
+
+namespace libcamera {
+
+struct MetricValue {
+	enum Type {
+		TypeCounter,
+		TypeGauge,
+		TypeHistogram,
+	};
+
+	MetricValue();
+
+	std::string name;
+	Type type;
+	int64_t value;
+	Histogram histogram;
+
+	const std::string toString() const;
+};
+
+struct MetricsSnapshot {
+	MetricsSnapshot();
+
+	uint64_t timestamp;
+	std::vector<MetricValue> metrics;
+
+	const MetricValue *find(const std::string &name) const;
+
+	const std::string toString() const;
+};
+
+MetricsSnapshot metricsSnapshot();
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_METRICS_H__ */
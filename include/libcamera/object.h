@@ -7,8 +7,13 @@
 #ifndef __LIBCAMERA_OBJECT_H__
 #define __LIBCAMERA_OBJECT_H__
 
+#include <atomic>
+#include <functional>
+#include <future>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <type_traits>
 
 namespace libcamera {
 
@@ -19,6 +24,13 @@ class SignalBase;
 class SlotBase;
 class Thread;
 
+enum ConnectionType {
+	ConnectionTypeAuto,
+	ConnectionTypeDirect,
+	ConnectionTypeQueued,
+	ConnectionTypeBlocking,
+};
+
 class Object
 {
 public:
@@ -31,18 +43,39 @@ public:
 	Thread *thread() const { return thread_; }
 	void moveToThread(Thread *thread);
 
+	void invoke(const std::function<void()> &func);
+
+	template<typename T, typename R, typename... FuncArgs, typename... Args,
+		 typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
+	std::future<R> invokeMethod(R (T::*func)(FuncArgs...),
+				    ConnectionType type, Args... args)
+	{
+		T *obj = static_cast<T *>(this);
+		auto task = std::make_shared<std::packaged_task<R()>>(
+			std::bind(func, obj, args...));
+		std::future<R> result = task->get_future();
+
+		invokeFunction([task]() { (*task)(); }, type);
+
+		return result;
+	}
+
 private:
 	template<typename... Args>
 	friend class Signal;
 	friend class SlotBase;
 	friend class Thread;
 
+	void invokeFunction(const std::function<void()> &func,
+			    ConnectionType type);
+
 	void connect(SignalBase *signal);
 	void disconnect(SignalBase *signal);
 
 	Thread *thread_;
+	std::mutex signalsMutex_;
 	std::list<SignalBase *> signals_;
-	unsigned int pendingMessages_;
+	std::atomic<unsigned int> pendingMessages_;
 };
 
 }; /* namespace libcamera */
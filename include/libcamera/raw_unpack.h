@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * raw_unpack.h - Packed raw formats unpacking
+ */
+#ifndef __LIBCAMERA_RAW_UNPACK_H__
+#define __LIBCAMERA_RAW_UNPACK_H__
+
+#include <stdint.h>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+unsigned int unpackedRawFormat(unsigned int pixelFormat);
+unsigned int packedRawLineSize(unsigned int pixelFormat, unsigned int width);
+
+int unpackRawLine(unsigned int pixelFormat, const uint8_t *src, uint16_t *dst,
+		  unsigned int width);
+int unpackRawFrame(unsigned int pixelFormat, const uint8_t *src,
+		   unsigned int stride, uint16_t *dst, const Size &size);
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RAW_UNPACK_H__ */
@@ -7,10 +7,11 @@
 #ifndef __LIBCAMERA_REQUEST_H__
 #define __LIBCAMERA_REQUEST_H__
 
+#include <functional>
 #include <map>
 #include <memory>
+#include <stddef.h>
 #include <stdint.h>
-#include <unordered_set>
 
 #include <libcamera/controls.h>
 #include <libcamera/signal.h>
@@ -19,9 +20,9 @@ namespace libcamera {
 
 class Buffer;
 class Camera;
+class ObjectArena;
 class Stream;
 
-
 class Request
 {
 public:
@@ -31,38 +32,66 @@ public:
 		RequestCancelled,
 	};
 
+	enum ReuseFlag {
+		Default = 0,
+		ReuseBuffers = (1 << 0),
+	};
+
+	using CompletionHandler =
+		std::function<void(Request *, const std::map<Stream *, Buffer *> &)>;
+
 	Request(Camera *camera, uint64_t cookie = 0);
 	Request(const Request &) = delete;
 	Request &operator=(const Request &) = delete;
 	~Request();
 
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr);
+
+	void reuse(ReuseFlag flags = Default);
+
 	ControlList &controls() { return controls_; }
+	ControlList &metadata() { return metadata_; }
+	const ControlList &metadata() const { return metadata_; }
 	const std::map<Stream *, Buffer *> &buffers() const { return bufferMap_; }
 	int addBuffer(std::unique_ptr<Buffer> buffer);
 	Buffer *findBuffer(Stream *stream) const;
+	std::unique_ptr<Buffer> recycleBuffer(Stream *stream);
+	std::shared_ptr<Buffer> holdBuffer(Stream *stream);
+
+	void setCompletionHandler(const CompletionHandler &handler) { handler_ = handler; }
 
 	uint64_t cookie() const { return cookie_; }
 	Status status() const { return status_; }
 
-	bool hasPendingBuffers() const { return !pending_.empty(); }
+	bool hasPendingBuffers() const { return pendingBuffers_ != 0; }
 
 private:
 	friend class Camera;
+	friend class CameraGroup;
 	friend class PipelineHandler;
 
+	static void *operator new(size_t size, ObjectArena *arena);
+	static void operator delete(void *ptr, ObjectArena *arena);
+
 	int prepare();
+	int rearm();
 	void complete();
 
 	bool completeBuffer(Buffer *buffer);
 
 	Camera *camera_;
 	ControlList controls_;
+	ControlList metadata_;
 	std::map<Stream *, Buffer *> bufferMap_;
-	std::unordered_set<Buffer *> pending_;
+	unsigned int pendingBuffers_;
+	CompletionHandler handler_;
 
 	const uint64_t cookie_;
 	Status status_;
 	bool cancelled_;
+	bool retained_;
+	bool dropped_;
 };
 
 } /* namespace libcamera */
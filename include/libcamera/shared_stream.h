@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * shared_stream.h - Distribution of stream buffers to multiple consumers
+ */
+#ifndef __LIBCAMERA_SHARED_STREAM_H__
+#define __LIBCAMERA_SHARED_STREAM_H__
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Buffer;
+class EventNotifier;
+class IPCUnixSocket;
+class Stream;
+
+class SharedStream
+{
+public:
+	SharedStream(Stream *stream, unsigned int maxPending = 2);
+	SharedStream(const SharedStream &) = delete;
+	SharedStream &operator=(const SharedStream &) = delete;
+	~SharedStream();
+
+	Stream *stream() const { return stream_; }
+
+	int addConsumer();
+	int listen(const std::string &path);
+	std::size_t consumers() const { return consumers_.size(); }
+	uint64_t droppedFrames() const { return droppedFrames_; }
+
+	void queueBuffer(Buffer *buffer);
+
+	Signal<unsigned int> bufferReleased;
+
+private:
+	struct Consumer;
+
+	void readyRead(IPCUnixSocket *socket);
+	void newConnection(EventNotifier *notifier);
+	void removeConsumer(unsigned int index);
+	void release(unsigned int index);
+
+	Stream *stream_;
+	unsigned int maxPending_;
+	uint64_t droppedFrames_;
+
+	int listenFd_;
+	std::string path_;
+	std::unique_ptr<EventNotifier> listenNotifier_;
+
+	std::vector<std::unique_ptr<Consumer>> consumers_;
+	std::vector<unsigned int> references_;
+};
+
+class SharedStreamConsumer
+{
+public:
+	struct Frame {
+		unsigned int index;
+		unsigned int sequence;
+		uint64_t timestamp;
+		unsigned int bytesused;
+	};
+
+	SharedStreamConsumer();
+	SharedStreamConsumer(const SharedStreamConsumer &) = delete;
+	SharedStreamConsumer &operator=(const SharedStreamConsumer &) = delete;
+	~SharedStreamConsumer();
+
+	int connect(int fd);
+	int connect(const std::string &path);
+	void disconnect();
+	bool isConnected() const { return socket_ != nullptr; }
+	bool isConfigured() const { return configured_; }
+
+	unsigned int pixelFormat() const { return pixelFormat_; }
+	const Size &size() const { return size_; }
+	unsigned int stride() const { return stride_; }
+
+	unsigned int bufferCount() const { return buffers_.size(); }
+	unsigned int planeCount(unsigned int index) const;
+	int dmabuf(unsigned int index, unsigned int plane) const;
+	unsigned int offset(unsigned int index, unsigned int plane) const;
+	unsigned int length(unsigned int index, unsigned int plane) const;
+	const void *map(unsigned int index, unsigned int plane);
+
+	int release(unsigned int index);
+
+	Signal<SharedStreamConsumer *> configured;
+	Signal<SharedStreamConsumer *, const Frame &> frameAvailable;
+
+private:
+	struct Plane {
+		int fd;
+		unsigned int offset;
+		unsigned int length;
+		void *mem;
+	};
+
+	void readyRead(IPCUnixSocket *socket);
+	void channelReceived(EventNotifier *notifier);
+	int configure(const std::vector<uint8_t> &data,
+		      const std::vector<int32_t> &fds);
+	void clearBuffers();
+
+	std::unique_ptr<IPCUnixSocket> socket_;
+	int connectionFd_;
+	std::unique_ptr<EventNotifier> connectionNotifier_;
+	bool configured_;
+
+	unsigned int pixelFormat_;
+	Size size_;
+	unsigned int stride_;
+	std::vector<std::vector<Plane>> buffers_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_SHARED_STREAM_H__ */
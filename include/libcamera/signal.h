@@ -7,7 +7,11 @@
 #ifndef __LIBCAMERA_SIGNAL_H__
 #define __LIBCAMERA_SIGNAL_H__
 
-#include <list>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <tuple>
 #include <type_traits>
 #include <vector>
@@ -33,10 +37,16 @@ public:
 
 	void disconnect(SignalBase *signal);
 
+	bool isQueued() const;
 	void activatePack(void *pack);
 	virtual void invokePack(void *pack) = 0;
 
 protected:
+	friend class EventDispatcherMonitor;
+
+	static void *allocatePack(std::size_t size);
+	static void releasePack(void *pack);
+
 	void *obj_;
 	Object *object_;
 };
@@ -71,7 +81,8 @@ private:
 	{
 		PackType *args = static_cast<PackType *>(pack);
 		invoke(std::get<S>(*args)...);
-		delete args;
+		args->~PackType();
+		SlotBase::releasePack(args);
 	}
 
 public:
@@ -98,10 +109,17 @@ public:
 
 	void activate(Args... args)
 	{
-		if (this->object_)
-			SlotBase::activatePack(new PackType{ args... });
-		else
+		/*
+		 * Only pack the arguments when the slot has to be called
+		 * asynchronously, slots called from the thread of their object
+		 * are called directly.
+		 */
+		if (this->object_ && this->isQueued()) {
+			void *mem = SlotBase::allocatePack(sizeof(PackType));
+			SlotBase::activatePack(new (mem) PackType{ args... });
+		} else {
 			(static_cast<T *>(this->obj_)->*func_)(args...);
+		}
 	}
 
 	void invoke(Args... args)
@@ -135,20 +153,25 @@ public:
 	template<typename T>
 	void disconnect(T *obj)
 	{
-		for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-			SlotBase *slot = *iter;
-			if (slot->match(obj)) {
-				iter = slots_.erase(iter);
-				delete slot;
-			} else {
-				++iter;
-			}
-		}
+		removeSlots([obj](SlotBase *slot) {
+			return slot->match(obj);
+		});
 	}
 
 protected:
+	friend class EventDispatcherMonitor;
 	friend class Object;
-	std::list<SlotBase *> slots_;
+
+	using SlotList = std::vector<std::shared_ptr<SlotBase>>;
+
+	void addSlot(SlotBase *slot);
+	void removeSlots(const std::function<bool(SlotBase *)> &match);
+	std::shared_ptr<const SlotList> removeAllSlots();
+	std::shared_ptr<const SlotList> slots() const;
+
+private:
+	std::mutex mutex_;
+	std::shared_ptr<const SlotList> slots_;
 };
 
 template<typename... Args>
@@ -158,10 +181,12 @@ public:
 	Signal() {}
 	~Signal()
 	{
-		for (SlotBase *slot : slots_) {
+		std::shared_ptr<const SlotList> slots = removeAllSlots();
+		if (!slots)
+			return;
+
+		for (const std::shared_ptr<SlotBase> &slot : *slots)
 			slot->disconnect(this);
-			delete slot;
-		}
 	}
 
 #ifndef __DOXYGEN__
@@ -170,7 +195,7 @@ public:
 	{
 		Object *object = static_cast<Object *>(obj);
 		object->connect(this);
-		slots_.push_back(new SlotMember<T, Args...>(obj, object, func));
+		addSlot(new SlotMember<T, Args...>(obj, object, func));
 	}
 
 	template<typename T, typename std::enable_if<!std::is_base_of<Object, T>::value>::type * = nullptr>
@@ -179,19 +204,17 @@ public:
 #endif
 	void connect(T *obj, void (T::*func)(Args...))
 	{
-		slots_.push_back(new SlotMember<T, Args...>(obj, nullptr, func));
+		addSlot(new SlotMember<T, Args...>(obj, nullptr, func));
 	}
 
 	void connect(void (*func)(Args...))
 	{
-		slots_.push_back(new SlotStatic<Args...>(func));
+		addSlot(new SlotStatic<Args...>(func));
 	}
 
 	void disconnect()
 	{
-		for (SlotBase *slot : slots_)
-			delete slot;
-		slots_.clear();
+		removeAllSlots();
 	}
 
 	template<typename T>
@@ -203,47 +226,41 @@ public:
 	template<typename T>
 	void disconnect(T *obj, void (T::*func)(Args...))
 	{
-		for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-			SlotArgs<Args...> *slot = static_cast<SlotArgs<Args...> *>(*iter);
+		removeSlots([obj, func](SlotBase *slot) {
 			/*
 			 * If the object matches the slot, the slot is
 			 * guaranteed to be a member slot, so we can safely
 			 * cast it to SlotMember<T, Args...> and access its
 			 * func_ member.
 			 */
-			if (slot->match(obj) &&
-			    static_cast<SlotMember<T, Args...> *>(slot)->func_ == func) {
-				iter = slots_.erase(iter);
-				delete slot;
-			} else {
-				++iter;
-			}
-		}
+			return slot->match(obj) &&
+			       static_cast<SlotMember<T, Args...> *>(slot)->func_ == func;
+		});
 	}
 
 	void disconnect(void (*func)(Args...))
 	{
-		for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-			SlotArgs<Args...> *slot = *iter;
-			if (slot->match(nullptr) &&
-			    static_cast<SlotStatic<Args...> *>(slot)->func_ == func) {
-				iter = slots_.erase(iter);
-				delete slot;
-			} else {
-				++iter;
-			}
-		}
+		removeSlots([func](SlotBase *slot) {
+			return slot->match(nullptr) &&
+			       static_cast<SlotStatic<Args...> *>(slot)->func_ == func;
+		});
 	}
 
 	void emit(Args... args)
 	{
 		/*
-		 * Make a copy of the slots list as the slot could call the
-		 * disconnect operation, invalidating the iterator.
+		 * The slots list is never modified in place, connecting and
+		 * disconnecting slots replaces it with a new copy. Slots can
+		 * thus be connected and disconnected concurrently, including
+		 * from the slots themselves, and the snapshot keeps the slots
+		 * alive until they have all been called.
 		 */
-		std::vector<SlotBase *> slots{ slots_.begin(), slots_.end() };
-		for (SlotBase *slot : slots)
-			static_cast<SlotArgs<Args...> *>(slot)->activate(args...);
+		std::shared_ptr<const SlotList> slots = this->slots();
+		if (!slots)
+			return;
+
+		for (const std::shared_ptr<SlotBase> &slot : *slots)
+			static_cast<SlotArgs<Args...> *>(slot.get())->activate(args...);
 	}
 };
 
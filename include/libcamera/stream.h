@@ -7,9 +7,13 @@
 #ifndef __LIBCAMERA_STREAM_H__
 #define __LIBCAMERA_STREAM_H__
 
+#include <array>
+#include <list>
 #include <map>
 #include <memory>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <libcamera/buffer.h>
@@ -26,18 +30,46 @@ public:
 	StreamFormats();
 	StreamFormats(const std::map<unsigned int, std::vector<SizeRange>> &formats);
 
-	std::vector<unsigned int> pixelformats() const;
-	std::vector<Size> sizes(unsigned int pixelformat) const;
+	const std::vector<unsigned int> &pixelformats() const { return pixelformats_; }
+	const std::vector<Size> &sizes(unsigned int pixelformat) const;
 
 	SizeRange range(unsigned int pixelformat) const;
 
 private:
-	std::map<unsigned int, std::vector<SizeRange>> formats_;
+	struct Format {
+		std::vector<Size> sizes;
+		SizeRange range;
+	};
+
+	static std::vector<Size> computeSizes(const std::vector<SizeRange> &ranges);
+	static SizeRange computeRange(const std::vector<SizeRange> &ranges);
+
+	std::map<unsigned int, Format> formats_;
+	std::vector<unsigned int> pixelformats_;
 };
 
 enum MemoryType {
 	InternalMemory,
 	ExternalMemory,
+	UserPtrMemory,
+};
+
+struct FrameDropPolicy {
+	enum Mode {
+		KeepAll,
+		DropOldest,
+		DropNewest,
+		KeepEveryNth,
+	};
+
+	FrameDropPolicy()
+		: mode(KeepAll), maxPending(1), interval(1)
+	{
+	}
+
+	Mode mode;
+	unsigned int maxPending;
+	unsigned int interval;
 };
 
 struct StreamConfiguration {
@@ -45,10 +77,18 @@ struct StreamConfiguration {
 	StreamConfiguration(const StreamFormats &formats);
 
 	unsigned int pixelFormat;
+	uint64_t modifier;
 	Size size;
+	unsigned int stride;
 
 	MemoryType memoryType;
 	unsigned int bufferCount;
+	unsigned int minBufferCount;
+	unsigned int maxBufferCount;
+	unsigned int mapFlags;
+	FrameDropPolicy dropPolicy;
+	unsigned int decimation;
+	unsigned int sliceHeight;
 
 	Stream *stream() const { return stream_; }
 	void setStream(Stream *stream) { stream_ = stream; }
@@ -61,10 +101,13 @@ private:
 	StreamFormats formats_;
 };
 
+std::ostream &operator<<(std::ostream &out, const StreamConfiguration &cfg);
+
 enum StreamRole {
 	StillCapture,
 	VideoRecording,
 	Viewfinder,
+	EmbeddedData,
 };
 
 using StreamRoles = std::vector<StreamRole>;
@@ -75,28 +118,54 @@ public:
 	Stream();
 
 	std::unique_ptr<Buffer> createBuffer(unsigned int index);
-	std::unique_ptr<Buffer> createBuffer(const std::array<int, 3> &fds);
+	std::unique_ptr<Buffer> createBuffer(const std::vector<int> &fds);
 
 	BufferPool &bufferPool() { return bufferPool_; }
 	std::vector<BufferMemory> &buffers() { return bufferPool_.buffers(); }
 	const StreamConfiguration &configuration() const { return configuration_; }
 	MemoryType memoryType() const { return memoryType_; }
+	MemoryUsage memoryUsage() const;
 
 protected:
 	friend class Camera;
+	friend class PipelineHandler;
+	friend class Request;
 
 	int mapBuffer(const Buffer *buffer);
 	void unmapBuffer(const Buffer *buffer);
 
 	void createBuffers(MemoryType memory, unsigned int count);
 	void destroyBuffers();
+	void updateMapFlags();
 
 	BufferPool bufferPool_;
 	StreamConfiguration configuration_;
 	MemoryType memoryType_;
+	bool cpuAccess_;
+	std::shared_ptr<ObjectArena> arena_;
 
 private:
-	std::vector<std::pair<std::array<int, 3>, unsigned int>> bufferCache_;
+	using BufferKey = std::array<uint64_t, 16>;
+
+	struct BufferKeyHash {
+		std::size_t operator()(const BufferKey &key) const;
+	};
+
+	struct BufferCacheEntry {
+		BufferKey key;
+		unsigned int index;
+	};
+
+	using BufferCache = std::list<BufferCacheEntry>;
+
+	static BufferKey bufferKey(const std::vector<int> &dmabufs);
+	void cacheBuffer(const BufferKey &key, unsigned int index);
+	void uncacheBuffer(BufferCache::iterator entry);
+	unsigned int planeLength(unsigned int plane, unsigned int count) const;
+
+	BufferCache bufferCache_;
+	std::unordered_map<BufferKey, BufferCache::iterator, BufferKeyHash> bufferCacheMap_;
+	std::vector<BufferKey> bufferKeys_;
 };
 
 } /* namespace libcamera */
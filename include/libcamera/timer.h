@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_TIMER_H__
 #define __LIBCAMERA_TIMER_H__
 
+#include <chrono>
 #include <cstdint>
 
 #include <libcamera/signal.h>
@@ -20,17 +21,26 @@ public:
 	~Timer();
 
 	void start(unsigned int msec);
+	void start(std::chrono::nanoseconds duration);
+	void start(std::chrono::steady_clock::time_point deadline);
+	void startPeriodic(std::chrono::nanoseconds period);
 	void stop();
 	bool isRunning() const;
+	bool isPeriodic() const { return periodic_; }
 
-	unsigned int interval() const { return interval_; }
+	unsigned int interval() const;
 	uint64_t deadline() const { return deadline_; }
 
 	Signal<Timer *> timeout;
 
 private:
-	unsigned int interval_;
+	friend class TimerQueue;
+
+	void registerDeadline(uint64_t deadline);
+
+	std::chrono::nanoseconds interval_;
 	uint64_t deadline_;
+	bool periodic_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * benchmark.cpp - Cam capture benchmark
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <time.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+/*
+ * The benchmark records timings for every completed request, and computes
+ * statistics only when reporting, to keep the per-frame overhead low. All
+ * times are measured on the CLOCK_MONOTONIC clock, which is also the clock of
+ * the buffer timestamps.
+ *
+ * Two latencies are measured. The capture latency is the time between the
+ * buffer timestamp, when the frame has been captured by the device, and the
+ * completion of the request in the application. The request latency is the
+ * time between queueing the request to the camera and its completion.
+ */
+
+uint64_t Benchmark::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Benchmark::requestQueued(Request *request)
+{
+	queued_[request] = now();
+}
+
+void Benchmark::requestCompleted(Request *request,
+				 const std::map<Stream *, Buffer *> &buffers)
+{
+	uint64_t time = now();
+
+	auto it = queued_.find(request);
+	if (it == queued_.end())
+		return;
+
+	uint64_t queued = it->second;
+	queued_.erase(it);
+
+	if (request->status() == Request::RequestCancelled)
+		return;
+
+	requestLatencies_.push_back(time - queued);
+
+	completions_.push_back(time);
+
+	for (const auto &it : buffers) {
+		uint64_t timestamp = it.second->timestamp();
+		if (timestamp && timestamp <= time)
+			captureLatencies_.push_back(time - timestamp);
+	}
+
+	/* Use the first stream to measure the frame interval and drops. */
+	if (!buffers.empty()) {
+		const Buffer *buffer = buffers.begin()->second;
+		timestamps_.push_back(buffer->timestamp());
+		sequences_.push_back(buffer->sequence());
+	}
+}
+
+static void printPercentiles(std::ostream &out, const char *name,
+			     std::vector<uint64_t> values)
+{
+	out << name << " (us): ";
+
+	if (values.empty()) {
+		out << "no samples" << std::endl;
+		return;
+	}
+
+	std::sort(values.begin(), values.end());
+
+	auto percentile = [&](unsigned int p) {
+		size_t index = (values.size() - 1) * p / 100;
+		return values[index] / 1000.0;
+	};
+
+	out << "min " << percentile(0)
+	    << " p50 " << percentile(50)
+	    << " p90 " << percentile(90)
+	    << " p99 " << percentile(99)
+	    << " max " << percentile(100) << std::endl;
+}
+
+void Benchmark::report(std::ostream &out) const
+{
+	std::ios::fmtflags flags = out.flags();
+	out << std::fixed << std::setprecision(1);
+
+	out << "Benchmark results:" << std::endl;
+
+	size_t frames = completions_.size();
+	if (frames < 2) {
+		out << frames << " frames captured, not enough to compute statistics"
+		    << std::endl;
+		out.flags(flags);
+		return;
+	}
+
+	double duration = (completions_.back() - completions_.front()) / 1e9;
+	out << "frames: " << frames << " in " << std::setprecision(3)
+	    << duration << " s, fps: " << std::setprecision(2)
+	    << (frames - 1) / duration << std::endl;
+
+	/*
+	 * The jitter is the standard deviation of the interval between
+	 * consecutive frames, computed from the buffer timestamps.
+	 */
+	std::vector<uint64_t> intervals;
+	for (size_t i = 1; i < timestamps_.size(); ++i) {
+		if (timestamps_[i] > timestamps_[i - 1])
+			intervals.push_back(timestamps_[i] - timestamps_[i - 1]);
+	}
+
+	/* Frames dropped by the camera show up as gaps in the sequence. */
+	unsigned int dropped = 0;
+	for (size_t i = 1; i < sequences_.size(); ++i) {
+		if (sequences_[i] > sequences_[i - 1])
+			dropped += sequences_[i] - sequences_[i - 1] - 1;
+	}
+
+	out << "frames dropped: " << dropped << " (" << std::setprecision(2)
+	    << dropped * 100.0 / (frames + dropped) << "%)" << std::endl;
+
+	out << std::setprecision(1);
+
+	if (!intervals.empty()) {
+		double mean = 0.0;
+		for (uint64_t interval : intervals)
+			mean += interval;
+		mean /= intervals.size();
+
+		double variance = 0.0;
+		for (uint64_t interval : intervals)
+			variance += (interval - mean) * (interval - mean);
+		variance /= intervals.size();
+
+		out << "frame jitter (us): " << std::sqrt(variance) / 1000.0
+		    << " for a mean interval of " << mean / 1000.0 << std::endl;
+	}
+
+	printPercentiles(out, "frame interval", intervals);
+	printPercentiles(out, "capture latency", captureLatencies_);
+	printPercentiles(out, "request latency", requestLatencies_);
+
+	out.flags(flags);
+}
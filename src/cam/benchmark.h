@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * benchmark.h - Cam capture benchmark
+ */
+#ifndef __CAM_BENCHMARK_H__
+#define __CAM_BENCHMARK_H__
+
+#include <map>
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+class Benchmark
+{
+public:
+	void requestQueued(libcamera::Request *request);
+	void requestCompleted(libcamera::Request *request,
+			      const std::map<libcamera::Stream *, libcamera::Buffer *> &buffers);
+
+	void report(std::ostream &out) const;
+
+private:
+	static uint64_t now();
+
+	std::map<libcamera::Request *, uint64_t> queued_;
+
+	std::vector<uint64_t> completions_;
+	std::vector<uint64_t> timestamps_;
+	std::vector<unsigned int> sequences_;
+	std::vector<uint64_t> captureLatencies_;
+	std::vector<uint64_t> requestLatencies_;
+};
+
+#endif /* __CAM_BENCHMARK_H__ */
@@ -5,61 +5,677 @@
  * buffer_writer.cpp - Buffer writer
  */
 
+#include <algorithm>
+#include <errno.h>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <libcamera/raw_unpack.h>
+
 #include "buffer_writer.h"
 
-BufferWriter::BufferWriter(const std::string &pattern)
-	: pattern_(pattern)
+using namespace libcamera;
+
+/*
+ * Buffers are written to disk by a writer thread, to avoid blocking the
+ * capture loop on storage latency. The requests are held by the writer until
+ * all their buffers have been written, and are then handed back through the
+ * requestWritten signal, emitted from the thread that created the writer.
+ *
+ * At most queueDepth requests are held by the writer at any time. Requests
+ * submitted when the queue is full are rejected, and shall be requeued to the
+ * camera without being written, to keep capture running when the storage can't
+ * sustain the frame rate.
+ */
+BufferWriter::BufferWriter(const std::string &pattern, unsigned int queueDepth)
+	: pattern_(pattern), queueDepth_(queueDepth), appendFd_(-1),
+	  appendOffset_(0), direct_(false), unpack_(false), containerFd_(-1),
+	  containerOffset_(0), preallocated_(0),
+	  preallocate_(true), stop_(false), active_(0), notifier_(nullptr)
 {
+	/* Frames are all appended to the same file when no '#' is present. */
+	if (pattern_.find_first_of('#') == std::string::npos) {
+		appendFd_ = open(pattern_.c_str(), O_CREAT | O_WRONLY | O_APPEND,
+				 S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+				 S_IROTH | S_IWOTH);
+		if (appendFd_ == -1)
+			std::cerr << "failed to open " << pattern_ << ": "
+				  << strerror(errno) << std::endl;
+		else
+			appendOffset_ = lseek(appendFd_, 0, SEEK_END);
+	}
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ == -1) {
+		std::cerr << "failed to create eventfd: " << strerror(errno)
+			  << std::endl;
+	} else {
+		notifier_ = new EventNotifier(eventfd_, EventNotifier::Read);
+		notifier_->activated.connect(this, &BufferWriter::notifierActivated);
+	}
+
+	thread_ = std::thread(&BufferWriter::run, this);
 }
 
-int BufferWriter::write(libcamera::Buffer *buffer, const std::string &streamName)
+/*
+ * The writer shall be flushed before being destroyed, requests that haven't
+ * been handed back yet are otherwise lost.
+ */
+BufferWriter::~BufferWriter()
 {
-	std::string filename;
-	size_t pos;
-	int fd, ret = 0;
-
-	filename = pattern_;
-	pos = filename.find_first_of('#');
-	if (pos != std::string::npos) {
-		std::stringstream ss;
-		ss << streamName << "-" << std::setw(6)
-		   << std::setfill('0') << buffer->sequence();
-		filename.replace(pos, 1, ss.str());
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stop_ = true;
 	}
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-	if (fd == -1)
-		return -errno;
+	cv_.notify_all();
+	thread_.join();
+
+	closeContainer();
+
+	delete notifier_;
+	if (eventfd_ != -1)
+		close(eventfd_);
+	if (appendFd_ != -1)
+		close(appendFd_);
+}
+
+/*
+ * The container file format stores all frames of a capture session in a single
+ * file, written sequentially, with a trailing index for random access. All
+ * values are stored in little endian byte order.
+ *
+ * The file starts with a header, followed by one descriptor per stream:
+ *
+ *   char     magic[4]         "LCCF"
+ *   uint32_t version          ContainerVersion
+ *   uint32_t streams          Number of streams
+ *   uint32_t reserved
+ *
+ *   uint32_t fourcc           Stream pixel format
+ *   uint32_t width, height    Stream size in pixels
+ *   uint32_t stride           Stream line stride in bytes, 0 if unknown
+ *
+ * Each frame is then stored as a record header followed by the data of all
+ * the buffer planes. The plane data is aligned for direct I/O when enabled, by
+ * padding the record header:
+ *
+ *   char     magic[4]         "LCFR"
+ *   uint32_t stream           Index of the frame stream
+ *   uint32_t sequence         Frame sequence number
+ *   uint32_t planes           Number of planes
+ *   uint64_t timestamp        Frame timestamp in nanoseconds
+ *   uint32_t bytesused        Bytes used in the buffer
+ *   uint32_t padding          Bytes of padding before the plane data
+ *   uint32_t length[planes]   Length of each plane in bytes
+ *
+ * When the writer is destroyed the index is appended, with one entry per
+ * frame, followed by a trailer that locates it:
+ *
+ *   uint64_t offset           Offset of the frame record in the file
+ *   uint32_t stream           Index of the frame stream
+ *   uint32_t sequence         Frame sequence number
+ *   uint64_t timestamp        Frame timestamp in nanoseconds
+ *
+ *   char     magic[4]         "LCIX"
+ *   uint32_t entries          Number of index entries
+ *   uint64_t offset           Offset of the index in the file
+ *
+ * A file without a valid trailer, from an interrupted capture, can still be
+ * read sequentially.
+ */
+static constexpr uint32_t ContainerVersion = 1;
+
+/* Disk space is preallocated in chunks ahead of the writes. */
+static constexpr uint64_t PreallocationSize = 64 * 1024 * 1024;
 
-	libcamera::BufferMemory *mem = buffer->mem();
-	for (libcamera::Plane &plane : mem->planes()) {
-		void *data = plane.mem();
-		unsigned int length = plane.length();
+/*
+ * Direct I/O requires the memory, file offset and length to be aligned to the
+ * logical block size of the storage. Use the page size, which covers all common
+ * storage devices, and matches the alignment of buffer mappings.
+ */
+static constexpr uint64_t DirectIOAlignment = 4096;
+
+static uint8_t *put32(uint8_t *data, uint32_t value)
+{
+	for (unsigned int i = 0; i < 4; ++i)
+		data[i] = value >> (i * 8);
+
+	return data + 4;
+}
+
+static uint8_t *put64(uint8_t *data, uint64_t value)
+{
+	for (unsigned int i = 0; i < 8; ++i)
+		data[i] = value >> (i * 8);
+
+	return data + 8;
+}
 
-		ret = ::write(fd, data, length);
+static int writeAll(int fd, const uint8_t *data, size_t length)
+{
+	while (length) {
+		ssize_t ret = ::write(fd, data, length);
 		if (ret < 0) {
-			ret = -errno;
-			std::cerr << "write error: " << strerror(-ret)
-				  << std::endl;
-			break;
-		} else if (ret != (int)length) {
-			std::cerr << "write error: only " << ret
-				  << " bytes written instead of "
-				  << length << std::endl;
-			break;
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		data += ret;
+		length -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Write all frames to a single container file named after the pattern, with
+ * no '#' expansion. This shall be called before any request is written.
+ */
+int BufferWriter::openContainer(const CameraConfiguration *config)
+{
+	if (appendFd_ != -1) {
+		close(appendFd_);
+		appendFd_ = -1;
+	}
+
+	int fd = open(pattern_.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+		      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+		      S_IROTH | S_IWOTH);
+	if (fd == -1) {
+		int ret = -errno;
+		std::cerr << "failed to open " << pattern_ << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	std::vector<uint8_t> header(16 + config->size() * 16);
+	uint8_t *data = header.data();
+
+	memcpy(data, "LCCF", 4);
+	data = put32(data + 4, ContainerVersion);
+	data = put32(data, config->size());
+	data = put32(data, 0);
+
+	streamIndices_.clear();
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		const StreamConfiguration &cfg = config->at(i);
+		unsigned int pixelFormat = cfg.pixelFormat;
+		unsigned int stride = cfg.stride;
+
+		/* Unpacked frames are stored without padding between lines. */
+		if (unpack_ && unpackedRawFormat(pixelFormat)) {
+			pixelFormat = unpackedRawFormat(pixelFormat);
+			stride = cfg.size.width * 2;
 		}
+
+		data = put32(data, pixelFormat);
+		data = put32(data, cfg.size.width);
+		data = put32(data, cfg.size.height);
+		data = put32(data, stride);
+
+		streamIndices_[cfg.stream()] = i;
+	}
+
+	int ret = writeAll(fd, header.data(), header.size());
+	if (ret) {
+		std::cerr << "failed to write container header: "
+			  << strerror(-ret) << std::endl;
+		close(fd);
+		return ret;
+	}
+
+	containerFd_ = fd;
+	containerOffset_ = header.size();
+	preallocated_ = 0;
+	preallocate_ = true;
+	index_.clear();
+
+	return 0;
+}
+
+/*
+ * Queue all buffers of a completed request for writing. Return 0 if the
+ * request has been queued, in which case it will be handed back through the
+ * requestWritten signal, or -EBUSY if the queue is full.
+ */
+int BufferWriter::write(Request *request,
+			const std::map<Stream *, Buffer *> &buffers,
+			const std::map<Stream *, std::string> &streamNames)
+{
+	Job job;
+	job.request = request;
+
+	for (const auto &it : buffers) {
+		Buffer *buffer = it.second;
+		std::string filename;
+		unsigned int stream = 0;
+
+		size_t pos = pattern_.find_first_of('#');
+		if (containerFd_ != -1) {
+			stream = streamIndices_[it.first];
+		} else if (pos != std::string::npos) {
+			std::stringstream ss;
+			ss << streamNames.at(it.first) << "-" << std::setw(6)
+			   << std::setfill('0') << buffer->sequence();
+
+			filename = pattern_;
+			filename.replace(pos, 1, ss.str());
+		}
+
+		/* Packed raw frames are unpacked by the writer thread. */
+		const StreamConfiguration &cfg = it.first->configuration();
+		unsigned int packedFormat = 0;
+		if (unpack_ && unpackedRawFormat(cfg.pixelFormat))
+			packedFormat = cfg.pixelFormat;
+
+		job.files.push_back({ buffer, filename, stream, packedFormat,
+				      cfg.size, cfg.stride });
 	}
 
-	close(fd);
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		if (queue_.size() + active_ >= queueDepth_)
+			return -EBUSY;
+
+		queue_.push_back(std::move(job));
+	}
+
+	cv_.notify_all();
+
+	return 0;
+}
+
+/*
+ * Wait for all queued requests to be written, and hand them back before
+ * returning.
+ */
+void BufferWriter::flush()
+{
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		cv_.wait(locker, [&]() { return queue_.empty() && !active_; });
+	}
+
+	completeJobs();
+}
+
+void BufferWriter::run()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		cv_.wait(locker, [&]() { return stop_ || !queue_.empty(); });
+		if (queue_.empty())
+			return;
+
+		Job job = std::move(queue_.front());
+		queue_.pop_front();
+		active_++;
+
+		locker.unlock();
+
+		for (const File &file : job.files) {
+			if (containerFd_ != -1)
+				writeRecord(file);
+			else
+				writeBuffer(file);
+		}
+
+		locker.lock();
+
+		active_--;
+		completed_.push_back(job.request);
+		cv_.notify_all();
+
+		if (eventfd_ != -1) {
+			uint64_t value = 1;
+			ssize_t ret = ::write(eventfd_, &value, sizeof(value));
+			if (ret != sizeof(value))
+				std::cerr << "failed to signal completion"
+					  << std::endl;
+		}
+	}
+}
+
+/*
+ * Write all planes of a buffer with a single system call, to a new file, or to
+ * the append file if filename is empty.
+ */
+void BufferWriter::writeBuffer(const File &file)
+{
+	const std::string &filename = file.filename;
+	Buffer *buffer = file.buffer;
+	int fd = appendFd_;
+
+	if (!filename.empty()) {
+		fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+			  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+			  S_IROTH | S_IWOTH);
+		if (fd == -1) {
+			std::cerr << "failed to open " << filename << ": "
+				  << strerror(errno) << std::endl;
+			return;
+		}
+	} else if (fd == -1) {
+		return;
+	}
+
+	BufferMemory *mem = buffer->mem();
+	mem->beginCpuAccess(Plane::CpuRead);
+
+	std::vector<struct iovec> iov;
+	size_t length = 0;
+
+	if (unpackBuffer(file)) {
+		length = unpacked_.size() * sizeof(uint16_t);
+		iov.push_back({ unpacked_.data(), length });
+	} else {
+		for (Plane &plane : mem->planes()) {
+			size_t size = planeSize(buffer, plane);
+			iov.push_back({ plane.mem(), size });
+			length += size;
+		}
+	}
+
+	uint64_t offset = fd == appendFd_ ? appendOffset_ : 0;
+	ssize_t ret = writeData(fd, offset, iov);
+	if (ret < 0)
+		std::cerr << "write error: " << strerror(-ret) << std::endl;
+	else if (static_cast<size_t>(ret) != length)
+		std::cerr << "write error: only " << ret
+			  << " bytes written instead of " << length
+			  << std::endl;
+
+	mem->endCpuAccess(Plane::CpuRead);
+
+	if (fd != appendFd_)
+		close(fd);
+	else if (ret > 0)
+		appendOffset_ += ret;
+}
+
+/* Write a buffer as a frame record of the container. */
+void BufferWriter::writeRecord(const File &file)
+{
+	Buffer *buffer = file.buffer;
+	BufferMemory *mem = buffer->mem();
+
+	mem->beginCpuAccess(Plane::CpuRead);
+
+	/* Unpacked frames are stored as a single plane. */
+	std::vector<struct iovec> planes;
+	uint32_t bytesused = buffer->bytesused();
+
+	if (unpackBuffer(file)) {
+		bytesused = unpacked_.size() * sizeof(uint16_t);
+		planes.push_back({ unpacked_.data(), bytesused });
+	} else {
+		for (Plane &plane : mem->planes())
+			planes.push_back({ plane.mem(), planeSize(buffer, plane) });
+	}
+
+	size_t headerSize = 32 + planes.size() * 4;
+	uint32_t padding = 0;
+	if (direct_) {
+		uint64_t end = containerOffset_ + headerSize;
+		padding = (DirectIOAlignment - end % DirectIOAlignment) %
+			  DirectIOAlignment;
+	}
+
+	std::vector<uint8_t> header(headerSize + padding);
+	uint8_t *data = header.data();
+	size_t length = header.size();
+
+	memcpy(data, "LCFR", 4);
+	data = put32(data + 4, file.stream);
+	data = put32(data, buffer->sequence());
+	data = put32(data, planes.size());
+	data = put64(data, buffer->timestamp());
+	data = put32(data, bytesused);
+	data = put32(data, padding);
+
+	std::vector<struct iovec> iov;
+	iov.push_back({ header.data(), header.size() });
+
+	for (const struct iovec &plane : planes) {
+		data = put32(data, plane.iov_len);
+		iov.push_back(plane);
+		length += plane.iov_len;
+	}
+
+	/* Ignore preallocation failures, the file will just be fragmented. */
+	if (preallocate_ && containerOffset_ + length > preallocated_) {
+		uint64_t size = std::max<uint64_t>(PreallocationSize, length);
+
+		if (fallocate(containerFd_, FALLOC_FL_KEEP_SIZE, preallocated_,
+			      containerOffset_ + size - preallocated_))
+			preallocate_ = false;
+		else
+			preallocated_ = containerOffset_ + size;
+	}
+
+	ssize_t ret = writeData(containerFd_, containerOffset_, iov);
+
+	mem->endCpuAccess(Plane::CpuRead);
+
+	if (ret < 0) {
+		std::cerr << "write error: " << strerror(-ret) << std::endl;
+		return;
+	}
+
+	if (static_cast<size_t>(ret) != length) {
+		/*
+		 * Drop the partial record from the file, records must be
+		 * contiguous for the container to be read sequentially.
+		 */
+		std::cerr << "write error: only " << ret
+			  << " bytes written instead of " << length
+			  << std::endl;
+		if (ftruncate(containerFd_, containerOffset_) ||
+		    lseek(containerFd_, containerOffset_, SEEK_SET) < 0)
+			std::cerr << "failed to drop partial record" << std::endl;
+		return;
+	}
+
+	index_.push_back({ containerOffset_, file.stream, buffer->sequence(),
+			   buffer->timestamp() });
+	containerOffset_ += length;
+}
+
+/*
+ * Unpack the first plane of a packed raw buffer to 16-bit samples, stored
+ * without padding between lines. Return false if the buffer isn't unpacked.
+ * The buffer memory shall be accessible by the CPU.
+ */
+/*
+ * Compressed frames only fill part of their buffer. Write the bytes used by
+ * single-plane buffers, and the whole planes of multi-planar buffers whose
+ * bytes used are not reported per plane.
+ */
+size_t BufferWriter::planeSize(Buffer *buffer, Plane &plane)
+{
+	if (buffer->mem()->planes().size() != 1 || !buffer->bytesused())
+		return plane.length();
+
+	return std::min<size_t>(buffer->bytesused(), plane.length());
+}
+
+bool BufferWriter::unpackBuffer(const File &file)
+{
+	if (!file.packedFormat)
+		return false;
+
+	std::vector<Plane> &planes = file.buffer->mem()->planes();
+	if (planes.empty())
+		return false;
+
+	const Size &size = file.size;
+	unsigned int stride = file.stride;
+	if (!stride)
+		stride = packedRawLineSize(file.packedFormat, size.width);
+
+	if (planes[0].length() < static_cast<size_t>(stride) * size.height)
+		return false;
+
+	unpacked_.resize(static_cast<size_t>(size.width) * size.height);
+
+	return !unpackRawFrame(file.packedFormat,
+			       static_cast<const uint8_t *>(planes[0].mem()),
+			       stride, unpacked_.data(), size);
+}
+
+/*
+ * Write data to fd at its current position, which shall be equal to offset.
+ * Return the number of bytes written, or a negative error code.
+ *
+ * Without direct I/O all data is written with a single system call. With
+ * direct I/O, the largest aligned part of each segment is written with
+ * O_DIRECT, avoiding the copy to the page cache, and the rest is written
+ * through the page cache. Direct I/O is disabled for the rest of the capture
+ * if the file system or the buffer memory doesn't support it.
+ */
+ssize_t BufferWriter::writeData(int fd, uint64_t offset,
+				const std::vector<struct iovec> &iov)
+{
+	if (!direct_) {
+		ssize_t ret = ::writev(fd, iov.data(), iov.size());
+		return ret < 0 ? -errno : ret;
+	}
+
+	int flags = fcntl(fd, F_GETFL);
+	bool isDirect = false;
+	ssize_t written = 0;
+
+	for (const struct iovec &segment : iov) {
+		const uint8_t *data = static_cast<const uint8_t *>(segment.iov_base);
+		size_t length = segment.iov_len;
+
+		while (length) {
+			bool direct = direct_ && length >= DirectIOAlignment &&
+				      !(offset % DirectIOAlignment) &&
+				      !(reinterpret_cast<uintptr_t>(data) %
+					DirectIOAlignment);
+			size_t size = direct
+				    ? length - length % DirectIOAlignment
+				    : length;
+
+			if (direct != isDirect) {
+				int mode = direct ? flags | O_DIRECT
+						  : flags & ~O_DIRECT;
+				if (fcntl(fd, F_SETFL, mode) < 0) {
+					if (!direct) {
+						written = -errno;
+						break;
+					}
+
+					std::cerr << "direct I/O not supported: "
+						  << strerror(errno) << std::endl;
+					direct_ = false;
+					continue;
+				}
+
+				isDirect = direct;
+			}
+
+			ssize_t ret = ::write(fd, data, size);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+
+				/*
+				 * Buffer memory that can't be pinned, such as
+				 * some dmabuf mappings, fails with EFAULT.
+				 */
+				if (direct && (errno == EINVAL || errno == EFAULT)) {
+					std::cerr << "direct I/O failed, using buffered I/O: "
+						  << strerror(errno) << std::endl;
+					direct_ = false;
+					continue;
+				}
+
+				written = -errno;
+				break;
+			}
+
+			data += ret;
+			length -= ret;
+			offset += ret;
+			written += ret;
+		}
+
+		if (written < 0)
+			break;
+	}
+
+	if (isDirect)
+		fcntl(fd, F_SETFL, flags);
+
+	return written;
+}
+
+/* Write the container index and trailer, and close the container. */
+void BufferWriter::closeContainer()
+{
+	if (containerFd_ == -1)
+		return;
+
+	std::vector<uint8_t> index(index_.size() * 24 + 16);
+	uint8_t *data = index.data();
+
+	for (const IndexEntry &entry : index_) {
+		data = put64(data, entry.offset);
+		data = put32(data, entry.stream);
+		data = put32(data, entry.sequence);
+		data = put64(data, entry.timestamp);
+	}
+
+	memcpy(data, "LCIX", 4);
+	data = put32(data + 4, index_.size());
+	data = put64(data, containerOffset_);
+
+	int ret = writeAll(containerFd_, index.data(), index.size());
+	if (ret)
+		std::cerr << "failed to write container index: "
+			  << strerror(-ret) << std::endl;
+
+	/* Release the disk space preallocated past the end of the file. */
+	uint64_t size = containerOffset_ + index.size();
+	if (preallocated_ > size && ftruncate(containerFd_, size))
+		std::cerr << "failed to release preallocated space" << std::endl;
+
+	close(containerFd_);
+	containerFd_ = -1;
+}
+
+void BufferWriter::completeJobs()
+{
+	std::vector<Request *> completed;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		completed.swap(completed_);
+	}
+
+	for (Request *request : completed)
+		requestWritten.emit(request);
+}
+
+void BufferWriter::notifierActivated(EventNotifier *notifier)
+{
+	uint64_t value;
+
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value))
+		return;
 
-	return ret;
+	completeJobs();
 }
@@ -7,19 +7,107 @@
 #ifndef __LIBCAMERA_BUFFER_WRITER_H__
 #define __LIBCAMERA_BUFFER_WRITER_H__
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdint.h>
 #include <string>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
 
 #include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/geometry.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
 
 class BufferWriter
 {
 public:
-	BufferWriter(const std::string &pattern = "frame-#.bin");
+	BufferWriter(const std::string &pattern = "frame-#.bin",
+		     unsigned int queueDepth = 1);
+	~BufferWriter();
 
-	int write(libcamera::Buffer *buffer, const std::string &streamName);
+	void setDirectIO(bool enable) { direct_ = enable; }
+	void setUnpack(bool enable) { unpack_ = enable; }
+	int openContainer(const libcamera::CameraConfiguration *config);
+
+	int write(libcamera::Request *request,
+		  const std::map<libcamera::Stream *, libcamera::Buffer *> &buffers,
+		  const std::map<libcamera::Stream *, std::string> &streamNames);
+	void flush();
+
+	libcamera::Signal<libcamera::Request *> requestWritten;
 
 private:
+	struct File {
+		libcamera::Buffer *buffer;
+		std::string filename;
+		unsigned int stream;
+		/* Packed raw format to unpack, 0 to write the buffer as-is. */
+		unsigned int packedFormat;
+		libcamera::Size size;
+		unsigned int stride;
+	};
+
+	struct Job {
+		libcamera::Request *request;
+		std::vector<File> files;
+	};
+
+	struct IndexEntry {
+		uint64_t offset;
+		uint32_t stream;
+		uint32_t sequence;
+		uint64_t timestamp;
+	};
+
+	void run();
+	void writeBuffer(const File &file);
+	void writeRecord(const File &file);
+	bool unpackBuffer(const File &file);
+	static size_t planeSize(libcamera::Buffer *buffer,
+				libcamera::Plane &plane);
+	ssize_t writeData(int fd, uint64_t offset,
+			  const std::vector<struct iovec> &iov);
+	void closeContainer();
+	void completeJobs();
+	void notifierActivated(libcamera::EventNotifier *notifier);
+
 	std::string pattern_;
+	unsigned int queueDepth_;
+	int appendFd_;
+	uint64_t appendOffset_;
+	bool direct_;
+	bool unpack_;
+
+	/* Container output, accessed from the writer thread only once open. */
+	int containerFd_;
+	std::map<const libcamera::Stream *, unsigned int> streamIndices_;
+	uint64_t containerOffset_;
+	uint64_t preallocated_;
+	bool preallocate_;
+	std::vector<IndexEntry> index_;
+
+	/* Unpacked raw frame, accessed from the writer thread only. */
+	std::vector<uint16_t> unpacked_;
+
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool stop_;
+
+	/* Jobs waiting to be written, being written, and written. */
+	std::deque<Job> queue_;
+	unsigned int active_;
+	std::vector<libcamera::Request *> completed_;
+
+	int eventfd_;
+	libcamera::EventNotifier *notifier_;
 };
 
 #endif /* __LIBCAMERA_BUFFER_WRITER_H__ */
@@ -5,6 +5,8 @@
  * capture.cpp - Cam capture
  */
 
+#include <algorithm>
+#include <chrono>
 #include <climits>
 #include <iomanip>
 #include <iostream>
@@ -15,12 +17,20 @@
 
 using namespace libcamera;
 
-Capture::Capture(Camera *camera, CameraConfiguration *config)
-	: camera_(camera), config_(config), writer_(nullptr), last_(0)
+Capture::Capture(Camera *camera, CameraConfiguration *config,
+		 const std::string &prefix)
+	: camera_(camera), config_(config), prefix_(prefix), writer_(nullptr),
+	  benchmark_(nullptr), framesNotWritten_(0), last_(0), captureLimit_(0),
+	  queueCount_(0), captureCount_(0), queueDepth_(0), inFlight_(0)
 {
 }
 
-int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
+/*
+ * Configure the camera and start capturing. The capture runs until stopped,
+ * or until the number of frames given by the capture option has been
+ * captured, in which case the captureDone signal is emitted.
+ */
+int Capture::start(const OptionsParser::Options &options)
 {
 	int ret;
 
@@ -29,10 +39,10 @@ int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
 		return -ENODEV;
 	}
 
-	streamName_.clear();
-	for (unsigned int index = 0; index < config_->size(); ++index) {
-		StreamConfiguration &cfg = config_->at(index);
-		streamName_[cfg.stream()] = "stream" + std::to_string(index);
+	if (options.isSet(OptFile) && options.isSet(OptRecord)) {
+		std::cout << "Can't write frames to files and record them"
+			  << std::endl;
+		return -EINVAL;
 	}
 
 	ret = camera_->configure(config_);
@@ -41,6 +51,14 @@ int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
 		return ret;
 	}
 
+	/* Streams are only assigned to the configuration by configure(). */
+	streamName_.clear();
+	for (unsigned int index = 0; index < config_->size(); ++index) {
+		StreamConfiguration &cfg = config_->at(index);
+		streamName_[cfg.stream()] = prefix_ + "stream" +
+					    std::to_string(index);
+	}
+
 	ret = camera_->allocateBuffers();
 	if (ret) {
 		std::cerr << "Failed to allocate buffers" << std::endl;
@@ -49,26 +67,65 @@ int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
 
 	camera_->requestCompleted.connect(this, &Capture::requestComplete);
 
-	if (options.isSet(OptFile)) {
-		if (!options[OptFile].toString().empty())
-			writer_ = new BufferWriter(options[OptFile]);
+	if (options.isSet(OptFile) || options.isSet(OptRecord)) {
+		/*
+		 * Let the writer hold all buffers but one, to keep capturing
+		 * when the storage can't sustain the frame rate.
+		 */
+		unsigned int nbuffers = UINT_MAX;
+		for (StreamConfiguration &cfg : *config_)
+			nbuffers = std::min(nbuffers, cfg.bufferCount);
+		unsigned int queueDepth = std::max(nbuffers, 2U) - 1;
+
+		if (options.isSet(OptRecord))
+			writer_ = new BufferWriter(options[OptRecord], queueDepth);
+		else if (!options[OptFile].toString().empty())
+			writer_ = new BufferWriter(options[OptFile], queueDepth);
 		else
-			writer_ = new BufferWriter();
-	}
+			writer_ = new BufferWriter("frame-#.bin", queueDepth);
+
+		writer_->setDirectIO(options.isSet(OptDirect));
+		writer_->setUnpack(options.isSet(OptUnpack));
 
-	ret = capture(loop);
+		if (options.isSet(OptRecord)) {
+			ret = writer_->openContainer(config_);
+			if (ret)
+				goto error;
+		}
 
-	if (options.isSet(OptFile)) {
-		delete writer_;
-		writer_ = nullptr;
+		writer_->requestWritten.connect(this, &Capture::requestWritten);
+		framesNotWritten_ = 0;
 	}
 
+	if (options.isSet(OptBenchmark))
+		benchmark_ = new Benchmark();
+
+	captureLimit_ = options[OptCapture].toInteger();
+	queueCount_ = 0;
+	captureCount_ = 0;
+	queueDepth_ = options[OptQueueDepth].toInteger();
+	inFlight_ = 0;
+
+	ret = startCapture();
+	if (ret)
+		goto error;
+
+	return 0;
+
+error:
+	camera_->requestCompleted.disconnect(this, &Capture::requestComplete);
+
+	delete benchmark_;
+	benchmark_ = nullptr;
+	delete writer_;
+	writer_ = nullptr;
+
 	camera_->freeBuffers();
 
 	return ret;
 }
 
-int Capture::capture(EventLoop *loop)
+int Capture::startCapture()
 {
 	int ret;
 
@@ -106,6 +163,18 @@ int Capture::capture(EventLoop *loop)
 		requests.push_back(request);
 	}
 
+	/*
+	 * Limit the number of requests in flight to the requested queue depth.
+	 * The other requests are held by the application, which rotates all
+	 * buffers through the camera.
+	 */
+	if (!queueDepth_ || queueDepth_ > nbuffers) {
+		if (queueDepth_)
+			std::cout << "Queue depth limited to " << nbuffers
+				  << " by the number of buffers" << std::endl;
+		queueDepth_ = nbuffers;
+	}
+
 	ret = camera_->start();
 	if (ret) {
 		std::cout << "Failed to start capture" << std::endl;
@@ -113,7 +182,7 @@ int Capture::capture(EventLoop *loop)
 	}
 
 	for (Request *request : requests) {
-		ret = camera_->queueRequest(request);
+		ret = queueRequest(request);
 		if (ret < 0) {
 			std::cerr << "Can't queue request" << std::endl;
 			camera_->stop();
@@ -121,29 +190,137 @@ int Capture::capture(EventLoop *loop)
 		}
 	}
 
-	std::cout << "Capture until user interrupts by SIGINT" << std::endl;
-	ret = loop->exec();
-	if (ret)
-		std::cout << "Failed to run capture loop" << std::endl;
+	return 0;
+}
+
+void Capture::stop()
+{
+	if (writer_)
+		writer_->flush();
 
-	ret = camera_->stop();
+	int ret = camera_->stop();
 	if (ret)
 		std::cout << "Failed to stop capture" << std::endl;
 
-	return ret;
+	camera_->requestCompleted.disconnect(this, &Capture::requestComplete);
+
+	std::cout << "Camera " << camera_->name() << " statistics:" << std::endl
+		  << camera_->statistics().toString() << std::endl;
+	std::cout << "Buffer memory: " << camera_->memoryUsage().toString()
+		  << std::endl;
+
+	if (framesNotWritten_)
+		std::cout << framesNotWritten_
+			  << " frames not written, storage too slow" << std::endl;
+
+	if (benchmark_)
+		benchmark_->report(std::cout);
+
+	delete benchmark_;
+	benchmark_ = nullptr;
+	delete writer_;
+	writer_ = nullptr;
+
+	for (Request *request : idleRequests_)
+		delete request;
+	idleRequests_.clear();
+
+	for (Request *request : pendingRequests_)
+		delete request;
+	pendingRequests_.clear();
+
+	camera_->freeBuffers();
+}
+
+/*
+ * Queue a request to the camera. Requests are queued in order, and wait in
+ * the pending queue while the number of requests in flight has reached the
+ * queue depth.
+ */
+int Capture::queueRequest(Request *request)
+{
+	pendingRequests_.push_back(request);
+
+	return queuePendingRequests();
+}
+
+/*
+ * Queue pending requests to the camera up to the queue depth. Requests beyond
+ * the capture limit are kept idle until the capture stops. They can't be
+ * deleted here, as this may be called from the request completion handler.
+ */
+int Capture::queuePendingRequests()
+{
+	while (!pendingRequests_.empty() && inFlight_ < queueDepth_) {
+		Request *request = pendingRequests_.front();
+		pendingRequests_.pop_front();
+
+		if (captureLimit_ && queueCount_ >= captureLimit_) {
+			idleRequests_.push_back(request);
+			continue;
+		}
+
+		if (benchmark_)
+			benchmark_->requestQueued(request);
+
+		int ret = camera_->queueRequest(request);
+		if (ret < 0) {
+			idleRequests_.push_back(request);
+			return ret;
+		}
+
+		queueCount_++;
+		inFlight_++;
+	}
+
+	return 0;
 }
 
 void Capture::requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
 {
-	double fps = 0.0;
-	uint64_t now;
+	inFlight_--;
+
+	if (benchmark_)
+		benchmark_->requestCompleted(request, buffers);
 
 	if (request->status() == Request::RequestCancelled)
 		return;
 
-	struct timespec time;
-	clock_gettime(CLOCK_MONOTONIC, &time);
-	now = time.tv_sec * 1000 + time.tv_nsec / 1000000;
+	captureCount_++;
+	if (captureLimit_ && captureCount_ == captureLimit_)
+		captureDone.emit(this);
+
+	/* Printing every frame perturbs the timings, skip it when benchmarking. */
+	if (!benchmark_)
+		printFrame(buffers);
+
+	/*
+	 * Reuse the request and its buffers to queue them again to the camera,
+	 * avoiding allocation of new requests and buffers for every frame.
+	 * When writing to disk, the request is queued once its buffers have
+	 * been written, or immediately if the writer queue is full.
+	 */
+	request->reuse(Request::ReuseBuffers);
+
+	if (writer_) {
+		if (!writer_->write(request, buffers, streamName_)) {
+			queuePendingRequests();
+			return;
+		}
+
+		framesNotWritten_++;
+	}
+
+	queueRequest(request);
+}
+
+void Capture::printFrame(const std::map<Stream *, Buffer *> &buffers)
+{
+	double fps = 0.0;
+	uint64_t now;
+
+	now = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
 	fps = now - last_;
 	fps = last_ && fps ? 1000.0 / fps : 0.0;
 	last_ = now;
@@ -160,36 +337,12 @@ void Capture::requestComplete(Request *request, const std::map<Stream *, Buffer
 		     << " (" << buffer->index() << ")"
 		     << " seq: " << std::setw(6) << std::setfill('0') << buffer->sequence()
 		     << " bytesused: " << buffer->bytesused();
-
-		if (writer_)
-			writer_->write(buffer, name);
 	}
 
 	std::cout << info.str() << std::endl;
+}
 
-	/*
-	 * Create a new request and populate it with one buffer for each
-	 * stream.
-	 */
-	request = camera_->createRequest();
-	if (!request) {
-		std::cerr << "Can't create request" << std::endl;
-		return;
-	}
-
-	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-		Stream *stream = it->first;
-		Buffer *buffer = it->second;
-		unsigned int index = buffer->index();
-
-		std::unique_ptr<Buffer> newBuffer = stream->createBuffer(index);
-		if (!newBuffer) {
-			std::cerr << "Can't create buffer " << index << std::endl;
-			return;
-		}
-
-		request->addBuffer(std::move(newBuffer));
-	}
-
-	camera_->queueRequest(request);
+void Capture::requestWritten(Request *request)
+{
+	queueRequest(request);
 }
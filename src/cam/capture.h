@@ -7,35 +7,61 @@
 #ifndef __CAM_CAPTURE_H__
 #define __CAM_CAPTURE_H__
 
+#include <deque>
 #include <memory>
+#include <vector>
 
 #include <libcamera/camera.h>
 #include <libcamera/request.h>
+#include <libcamera/signal.h>
 #include <libcamera/stream.h>
 
+#include "benchmark.h"
 #include "buffer_writer.h"
-#include "event_loop.h"
 #include "options.h"
 
 class Capture
 {
 public:
 	Capture(libcamera::Camera *camera,
-		libcamera::CameraConfiguration *config);
+		libcamera::CameraConfiguration *config,
+		const std::string &prefix = "");
+
+	int start(const OptionsParser::Options &options);
+	void stop();
+
+	unsigned int captured() const { return captureCount_; }
+
+	libcamera::Signal<Capture *> captureDone;
 
-	int run(EventLoop *loop, const OptionsParser::Options &options);
 private:
-	int capture(EventLoop *loop);
+	int startCapture();
+	int queueRequest(libcamera::Request *request);
+	int queuePendingRequests();
 
 	void requestComplete(libcamera::Request *request,
 			     const std::map<libcamera::Stream *, libcamera::Buffer *> &buffers);
+	void printFrame(const std::map<libcamera::Stream *, libcamera::Buffer *> &buffers);
+	void requestWritten(libcamera::Request *request);
 
 	libcamera::Camera *camera_;
 	libcamera::CameraConfiguration *config_;
+	std::string prefix_;
 
 	std::map<libcamera::Stream *, std::string> streamName_;
 	BufferWriter *writer_;
+	Benchmark *benchmark_;
+	unsigned int framesNotWritten_;
 	uint64_t last_;
+
+	unsigned int captureLimit_;
+	unsigned int queueCount_;
+	unsigned int captureCount_;
+	std::vector<libcamera::Request *> idleRequests_;
+
+	unsigned int queueDepth_;
+	unsigned int inFlight_;
+	std::deque<libcamera::Request *> pendingRequests_;
 };
 
 #endif /* __CAM_CAPTURE_H__ */
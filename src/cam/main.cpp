@@ -5,6 +5,7 @@
  * main.cpp - cam - The libcamera swiss army knife
  */
 
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <signal.h>
@@ -34,24 +35,38 @@ public:
 
 private:
 	int parseOptions(int argc, char *argv[]);
-	int prepareConfig();
+	std::unique_ptr<CameraConfiguration> prepareConfig(Camera *camera);
 	int infoConfiguration();
+	int capture();
 	int run();
 
+	void captureDone(Capture *capture);
+	void durationTimeout(Timer *timer);
+	void metricsTimeout(Timer *timer);
+	void printMetrics();
+
 	static CamApp *app_;
 	OptionsParser::Options options_;
 	CameraManager *cm_;
-	std::shared_ptr<Camera> camera_;
-	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::vector<std::unique_ptr<CameraConfiguration>> configs_;
 	EventLoop *loop_;
+
+	unsigned int capturesRunning_;
+	Timer durationTimer_;
+	Timer metricsTimer_;
+	unsigned int metricsInterval_;
 };
 
 CamApp *CamApp::app_ = nullptr;
 
 CamApp::CamApp()
-	: cm_(nullptr), camera_(nullptr), config_(nullptr), loop_(nullptr)
+	: cm_(nullptr), loop_(nullptr), capturesRunning_(0), metricsInterval_(0)
 {
 	CamApp::app_ = this;
+
+	durationTimer_.timeout.connect(this, &CamApp::durationTimeout);
+	metricsTimer_.timeout.connect(this, &CamApp::metricsTimeout);
 }
 
 CamApp *CamApp::instance()
@@ -76,38 +91,49 @@ int CamApp::init(int argc, char **argv)
 		return ret;
 	}
 
-	if (options_.isSet(OptCamera)) {
-		const std::string &cameraName = options_[OptCamera];
+	loop_ = new EventLoop(cm_->eventDispatcher());
+
+	if (!options_.isSet(OptCamera))
+		return 0;
+
+	for (const OptionValue &value : options_[OptCamera].toArray()) {
+		const std::string &cameraName = value.toString();
+		std::shared_ptr<Camera> camera;
+
 		char *endptr;
 		unsigned long index = strtoul(cameraName.c_str(), &endptr, 10);
 		if (*endptr == '\0' && index > 0 && index <= cm_->cameras().size())
-			camera_ = cm_->cameras()[index - 1];
+			camera = cm_->cameras()[index - 1];
 		else
-			camera_ = cm_->get(cameraName);
+			camera = cm_->get(cameraName);
 
-		if (!camera_) {
-			std::cout << "Camera "
-				  << std::string(options_[OptCamera])
-				  << " not found" << std::endl;
-			cm_->stop();
+		if (!camera) {
+			std::cout << "Camera " << cameraName << " not found"
+				  << std::endl;
+			cleanup();
 			return -ENODEV;
 		}
 
-		if (camera_->acquire()) {
-			std::cout << "Failed to acquire camera" << std::endl;
-			camera_.reset();
-			cm_->stop();
+		if (camera->acquire()) {
+			std::cout << "Failed to acquire camera " << camera->name()
+				  << std::endl;
+			cleanup();
 			return -EINVAL;
 		}
 
-		std::cout << "Using camera " << camera_->name() << std::endl;
+		cameras_.push_back(camera);
 
-		ret = prepareConfig();
-		if (ret)
-			return ret;
-	}
+		std::cout << "Using camera " << camera->name() << std::endl;
 
-	loop_ = new EventLoop(cm_->eventDispatcher());
+		std::unique_ptr<CameraConfiguration> config =
+			prepareConfig(camera.get());
+		if (!config) {
+			cleanup();
+			return -EINVAL;
+		}
+
+		configs_.push_back(std::move(config));
+	}
 
 	return 0;
 }
@@ -117,12 +143,11 @@ void CamApp::cleanup()
 	delete loop_;
 	loop_ = nullptr;
 
-	if (camera_) {
-		camera_->release();
-		camera_.reset();
-	}
+	configs_.clear();
 
-	config_.reset();
+	for (std::shared_ptr<Camera> &camera : cameras_)
+		camera->release();
+	cameras_.clear();
 
 	cm_->stop();
 }
@@ -147,7 +172,7 @@ int CamApp::parseOptions(int argc, char *argv[])
 {
 	KeyValueParser streamKeyValue;
 	streamKeyValue.addOption("role", OptionString,
-				 "Role for the stream (viewfinder, video, still)",
+				 "Role for the stream (viewfinder, video, still, embedded)",
 				 ArgumentRequired);
 	streamKeyValue.addOption("width", OptionInteger, "Width in pixels",
 				 ArgumentRequired);
@@ -155,18 +180,44 @@ int CamApp::parseOptions(int argc, char *argv[])
 				 ArgumentRequired);
 	streamKeyValue.addOption("pixelformat", OptionInteger, "Pixel format",
 				 ArgumentRequired);
+	streamKeyValue.addOption("buffers", OptionInteger, "Number of buffers",
+				 ArgumentRequired);
+	streamKeyValue.addOption("decimation", OptionInteger,
+				 "Capture one frame every <decimation> frames",
+				 ArgumentRequired);
 
 	OptionsParser parser;
 	parser.addOption(OptCamera, OptionString,
-			 "Specify which camera to operate on, by name or by index", "camera",
-			 ArgumentRequired, "camera");
-	parser.addOption(OptCapture, OptionNone,
-			 "Capture until interrupted by user", "capture");
+			 "Specify which camera to operate on, by name or by index\n"
+			 "The option can be repeated to capture from multiple cameras concurrently.",
+			 "camera", ArgumentRequired, "camera", true);
+	parser.addOption(OptCapture, OptionInteger,
+			 "Capture until interrupted by user or until <count> frames captured",
+			 "capture", ArgumentOptional, "count");
+	parser.addOption(OptDuration, OptionInteger,
+			 "Stop capturing after <duration> milliseconds", "duration",
+			 ArgumentRequired, "duration");
+	parser.addOption(OptQueueDepth, OptionInteger,
+			 "Limit the number of requests queued to the camera\n"
+			 "The default queue depth is the number of buffers, and can't exceed it. Buffers not queued are rotated through the queued requests.",
+			 "queue-depth", ArgumentRequired, "depth");
+	parser.addOption(OptBenchmark, OptionNone,
+			 "Benchmark the capture\n"
+			 "Per-frame output is suppressed, and the frame rate, jitter and latency statistics are printed when the capture stops.",
+			 "benchmark");
 	parser.addOption(OptFile, OptionString,
 			 "Write captured frames to disk\n"
 			 "The first '#' character in the file name is expanded to the stream name and frame sequence number.\n"
 			 "The default file name is 'frame-#.bin'.",
 			 "file", ArgumentOptional, "filename");
+	parser.addOption(OptDirect, OptionNone,
+			 "Write frames to disk with direct I/O, bypassing the page cache\n"
+			 "Applies to the --file and --record options. Buffers that can't be written directly are written through the page cache.",
+			 "direct");
+	parser.addOption(OptUnpack, OptionNone,
+			 "Unpack packed raw frames to 16-bit samples when writing them to disk\n"
+			 "Applies to the --file and --record options. Frames in the MIPI CSI-2 and IPU3 packed 10-bit raw formats are written in the corresponding unpacked format, without line padding.",
+			 "unpack");
 	parser.addOption(OptStream, &streamKeyValue,
 			 "Set configuration of a camera stream", "stream", true);
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
@@ -174,6 +225,14 @@ int CamApp::parseOptions(int argc, char *argv[])
 	parser.addOption(OptInfo, OptionNone,
 			 "Display information about stream(s)", "info");
 	parser.addOption(OptList, OptionNone, "List all cameras", "list");
+	parser.addOption(OptMetrics, OptionInteger,
+			 "Print the libcamera runtime metrics\n"
+			 "The metrics are printed when the capture stops, and periodically during capture if an interval in milliseconds is given.",
+			 "metrics", ArgumentOptional, "interval");
+	parser.addOption(OptRecord, OptionString,
+			 "Record captured frames to a single container file\n"
+			 "The container stores the stream formats and per-frame metadata, and ends with an index of all frames.",
+			 "record", ArgumentRequired, "filename");
 
 	options_ = parser.parse(argc, argv);
 	if (!options_.valid())
@@ -187,7 +246,7 @@ int CamApp::parseOptions(int argc, char *argv[])
 	return 0;
 }
 
-int CamApp::prepareConfig()
+std::unique_ptr<CameraConfiguration> CamApp::prepareConfig(Camera *camera)
 {
 	StreamRoles roles;
 
@@ -207,10 +266,12 @@ int CamApp::prepareConfig()
 				roles.push_back(StreamRole::VideoRecording);
 			} else if (opt["role"].toString() == "still") {
 				roles.push_back(StreamRole::StillCapture);
+			} else if (opt["role"].toString() == "embedded") {
+				roles.push_back(StreamRole::EmbeddedData);
 			} else {
 				std::cerr << "Unknown stream role "
 					  << opt["role"].toString() << std::endl;
-				return -EINVAL;
+				return nullptr;
 			}
 		}
 	} else {
@@ -218,11 +279,12 @@ int CamApp::prepareConfig()
 		roles.push_back(StreamRole::VideoRecording);
 	}
 
-	config_ = camera_->generateConfiguration(roles);
-	if (!config_ || config_->size() != roles.size()) {
+	std::unique_ptr<CameraConfiguration> config =
+		camera->generateConfiguration(roles);
+	if (!config || config->size() != roles.size()) {
 		std::cerr << "Failed to get default stream configuration"
 			  << std::endl;
-		return -EINVAL;
+		return nullptr;
 	}
 
 	/* Apply configuration if explicitly requested. */
@@ -233,7 +295,7 @@ int CamApp::prepareConfig()
 		unsigned int i = 0;
 		for (auto const &value : streamOptions) {
 			KeyValueParser::Options opt = value.toKeyValues();
-			StreamConfiguration &cfg = config_->at(i++);
+			StreamConfiguration &cfg = config->at(i++);
 
 			if (opt.isSet("width"))
 				cfg.size.width = opt["width"];
@@ -244,10 +306,16 @@ int CamApp::prepareConfig()
 			/* TODO: Translate 4CC string to ID. */
 			if (opt.isSet("pixelformat"))
 				cfg.pixelFormat = opt["pixelformat"];
+
+			if (opt.isSet("buffers"))
+				cfg.bufferCount = opt["buffers"];
+
+			if (opt.isSet("decimation"))
+				cfg.decimation = opt["decimation"];
 		}
 	}
 
-	switch (config_->validate()) {
+	switch (config->validate()) {
 	case CameraConfiguration::Valid:
 		break;
 	case CameraConfiguration::Adjusted:
@@ -255,24 +323,20 @@ int CamApp::prepareConfig()
 		break;
 	case CameraConfiguration::Invalid:
 		std::cout << "Camera configuration invalid" << std::endl;
-		config_.reset();
-		return -EINVAL;
+		return nullptr;
 	}
 
-	return 0;
+	return config;
 }
 
-int CamApp::infoConfiguration()
+static void printConfiguration(const CameraConfiguration &config)
 {
-	if (!config_) {
-		std::cout << "Cannot print stream information without a camera"
-			  << std::endl;
-		return -EINVAL;
-	}
-
 	unsigned int index = 0;
-	for (const StreamConfiguration &cfg : *config_) {
+	for (const StreamConfiguration &cfg : config) {
 		std::cout << index << ": " << cfg.toString() << std::endl;
+		std::cout << " * Buffers: " << cfg.bufferCount << " (min "
+			  << cfg.minBufferCount << ", max " << cfg.maxBufferCount
+			  << ")" << std::endl;
 
 		const StreamFormats &formats = cfg.formats();
 		for (unsigned int pixelformat : formats.pixelformats()) {
@@ -288,6 +352,22 @@ int CamApp::infoConfiguration()
 
 		index++;
 	}
+}
+
+int CamApp::infoConfiguration()
+{
+	if (configs_.empty()) {
+		std::cout << "Cannot print stream information without a camera"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < configs_.size(); ++i) {
+		if (configs_.size() > 1)
+			std::cout << cameras_[i]->name() << ":" << std::endl;
+
+		printConfiguration(*configs_[i]);
+	}
 
 	return 0;
 }
@@ -312,14 +392,144 @@ int CamApp::run()
 			return ret;
 	}
 
-	if (options_.isSet(OptCapture)) {
-		Capture capture(camera_.get(), config_.get());
-		return capture.run(loop_, options_);
-	}
+	if (options_.isSet(OptCapture))
+		return capture();
+
+	if (options_.isSet(OptMetrics))
+		std::cout << "Metrics:" << std::endl
+			  << metricsSnapshot().toString();
 
 	return 0;
 }
 
+/*
+ * Capture from all cameras concurrently, on the shared event loop, until
+ * interrupted by the user, until the capture duration expires, or until all
+ * cameras have captured the requested number of frames.
+ */
+int CamApp::capture()
+{
+	std::vector<std::unique_ptr<Capture>> captures;
+	double duration = 0.0;
+	int ret = 0;
+
+	if (cameras_.empty()) {
+		std::cout << "Can't capture without a camera" << std::endl;
+		return -ENODEV;
+	}
+
+	if (cameras_.size() > 1) {
+		if (options_.isSet(OptRecord)) {
+			std::cout << "Can't record multiple cameras to a single file"
+				  << std::endl;
+			return -EINVAL;
+		}
+
+		if (options_.isSet(OptFile) &&
+		    !options_[OptFile].toString().empty() &&
+		    options_[OptFile].toString().find('#') == std::string::npos) {
+			std::cout << "Writing frames from multiple cameras requires a '#' in the file name"
+				  << std::endl;
+			return -EINVAL;
+		}
+	}
+
+	for (unsigned int i = 0; i < cameras_.size(); ++i) {
+		/* Name the streams after their camera when capturing from several. */
+		std::string prefix = cameras_.size() > 1
+				   ? "cam" + std::to_string(i) + "-" : "";
+		Capture *capture = new Capture(cameras_[i].get(),
+					       configs_[i].get(), prefix);
+		captures.emplace_back(capture);
+
+		capture->captureDone.connect(this, &CamApp::captureDone);
+
+		ret = capture->start(options_);
+		if (ret) {
+			captures.pop_back();
+			break;
+		}
+	}
+
+	if (!ret) {
+		unsigned int count = options_[OptCapture];
+		if (count)
+			std::cout << "Capture " << count << " frames" << std::endl;
+		else
+			std::cout << "Capture until user interrupts by SIGINT"
+				  << std::endl;
+
+		capturesRunning_ = captures.size();
+
+		if (options_.isSet(OptDuration))
+			durationTimer_.start(options_[OptDuration].toInteger());
+
+		metricsInterval_ = options_[OptMetrics].toInteger();
+		if (metricsInterval_)
+			metricsTimer_.startPeriodic(std::chrono::milliseconds(metricsInterval_));
+
+		struct timespec begin, end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+
+		ret = loop_->exec();
+		if (ret)
+			std::cout << "Failed to run capture loop" << std::endl;
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		durationTimer_.stop();
+		metricsTimer_.stop();
+
+		duration = (end.tv_sec - begin.tv_sec) +
+			   (end.tv_nsec - begin.tv_nsec) / 1e9;
+	}
+
+	for (std::unique_ptr<Capture> &capture : captures)
+		capture->stop();
+
+	/* Report the aggregate throughput of all cameras. */
+	if (!ret && options_.isSet(OptBenchmark) && captures.size() > 1) {
+		unsigned int frames = 0;
+		for (const std::unique_ptr<Capture> &capture : captures)
+			frames += capture->captured();
+
+		std::cout << "Aggregate: " << frames << " frames from "
+			  << captures.size() << " cameras in "
+			  << std::fixed << std::setprecision(3) << duration
+			  << " s, fps: " << std::setprecision(2)
+			  << frames / duration << std::endl;
+	}
+
+	if (options_.isSet(OptMetrics))
+		printMetrics();
+
+	return ret;
+}
+
+void CamApp::captureDone(Capture *capture)
+{
+	if (capturesRunning_ && !--capturesRunning_)
+		loop_->exit();
+}
+
+void CamApp::durationTimeout(Timer *timer)
+{
+	loop_->exit();
+}
+
+void CamApp::metricsTimeout(Timer *timer)
+{
+	printMetrics();
+}
+
+void CamApp::printMetrics()
+{
+	MetricsSnapshot snapshot = metricsSnapshot();
+
+	std::cout << "Metrics at " << snapshot.timestamp / 1000000 << " ms:"
+		  << std::endl << snapshot.toString();
+}
+
 void signalHandler(int signal)
 {
 	std::cout << "Exiting" << std::endl;
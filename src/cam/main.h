@@ -8,13 +8,20 @@
 #define __CAM_MAIN_H__
 
 enum {
+	OptBenchmark = 'b',
 	OptCamera = 'c',
 	OptCapture = 'C',
+	OptDirect = 'D',
+	OptDuration = 'd',
 	OptFile = 'F',
 	OptHelp = 'h',
 	OptInfo = 'I',
 	OptList = 'l',
+	OptMetrics = 'm',
+	OptQueueDepth = 'q',
+	OptRecord = 'R',
 	OptStream = 's',
+	OptUnpack = 'u',
 };
 
 #endif /* __CAM_MAIN_H__ */
@@ -0,0 +1,362 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * main.cpp - camerad - Camera server daemon
+ */
+
+#include <iostream>
+#include <signal.h>
+#include <string.h>
+
+#include <libcamera/libcamera.h>
+
+#include "../cam/event_loop.h"
+#include "../cam/options.h"
+
+using namespace libcamera;
+
+enum {
+	OptCamera = 'c',
+	OptHelp = 'h',
+	OptMaxPending = 'p',
+	OptSocket = 'S',
+	OptStream = 's',
+};
+
+/*
+ * The camera server owns a camera for its whole lifetime, and shares the
+ * frames it captures with clients connecting to a Unix socket. Clients receive
+ * the buffer dmabufs and per-frame metadata through SharedStreamConsumer,
+ * without enumerating or bringing up the camera themselves.
+ */
+class CameraServer
+{
+public:
+	CameraServer();
+
+	static CameraServer *instance();
+
+	int init(int argc, char **argv);
+	void cleanup();
+
+	int exec();
+	void quit();
+
+private:
+	int parseOptions(int argc, char *argv[]);
+	int configure();
+	int queueBuffer(unsigned int index);
+
+	void requestComplete(Request *request,
+			     const std::map<Stream *, Buffer *> &buffers);
+	void bufferReleased(unsigned int index);
+
+	static CameraServer *app_;
+	OptionsParser::Options options_;
+	CameraManager *cm_;
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<SharedStream> shared_;
+	EventLoop *loop_;
+	bool allocated_;
+};
+
+CameraServer *CameraServer::app_ = nullptr;
+
+CameraServer::CameraServer()
+	: cm_(nullptr), loop_(nullptr), allocated_(false)
+{
+	CameraServer::app_ = this;
+}
+
+CameraServer *CameraServer::instance()
+{
+	return CameraServer::app_;
+}
+
+int CameraServer::init(int argc, char **argv)
+{
+	int ret;
+
+	ret = parseOptions(argc, argv);
+	if (ret < 0)
+		return ret;
+
+	cm_ = CameraManager::instance();
+
+	ret = cm_->start();
+	if (ret) {
+		std::cout << "Failed to start camera manager: "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	loop_ = new EventLoop(cm_->eventDispatcher());
+
+	const std::string &cameraName = options_[OptCamera].toString();
+	char *endptr;
+	unsigned long index = strtoul(cameraName.c_str(), &endptr, 10);
+	if (*endptr == '\0' && index > 0 && index <= cm_->cameras().size())
+		camera_ = cm_->cameras()[index - 1];
+	else
+		camera_ = cm_->get(cameraName);
+
+	if (!camera_) {
+		std::cout << "Camera " << cameraName << " not found" << std::endl;
+		cleanup();
+		return -ENODEV;
+	}
+
+	if (camera_->acquire()) {
+		std::cout << "Failed to acquire camera " << camera_->name()
+			  << std::endl;
+		camera_.reset();
+		cleanup();
+		return -EINVAL;
+	}
+
+	std::cout << "Using camera " << camera_->name() << std::endl;
+
+	ret = configure();
+	if (ret) {
+		cleanup();
+		return ret;
+	}
+
+	return 0;
+}
+
+void CameraServer::cleanup()
+{
+	shared_.reset();
+
+	if (camera_) {
+		if (allocated_)
+			camera_->freeBuffers();
+		camera_->release();
+		camera_.reset();
+	}
+
+	config_.reset();
+
+	delete loop_;
+	loop_ = nullptr;
+
+	cm_->stop();
+}
+
+int CameraServer::exec()
+{
+	int ret;
+
+	camera_->requestCompleted.connect(this, &CameraServer::requestComplete);
+
+	ret = camera_->start();
+	if (ret) {
+		std::cout << "Failed to start camera" << std::endl;
+		cleanup();
+		return ret;
+	}
+
+	const StreamConfiguration &cfg = config_->at(0);
+	for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+		ret = queueBuffer(i);
+		if (ret) {
+			std::cout << "Failed to queue request" << std::endl;
+			break;
+		}
+	}
+
+	if (!ret) {
+		std::cout << "Serving " << cfg.toString() << " on "
+			  << options_[OptSocket].toString() << std::endl;
+
+		ret = loop_->exec();
+	}
+
+	camera_->stop();
+	cleanup();
+
+	return ret;
+}
+
+void CameraServer::quit()
+{
+	if (loop_)
+		loop_->exit();
+}
+
+int CameraServer::parseOptions(int argc, char *argv[])
+{
+	KeyValueParser streamKeyValue;
+	streamKeyValue.addOption("width", OptionInteger, "Width in pixels",
+				 ArgumentRequired);
+	streamKeyValue.addOption("height", OptionInteger, "Height in pixels",
+				 ArgumentRequired);
+	streamKeyValue.addOption("pixelformat", OptionInteger, "Pixel format",
+				 ArgumentRequired);
+	streamKeyValue.addOption("buffers", OptionInteger, "Number of buffers",
+				 ArgumentRequired);
+
+	OptionsParser parser;
+	parser.addOption(OptCamera, OptionString,
+			 "Specify which camera to serve, by name or by index",
+			 "camera", ArgumentRequired, "camera");
+	parser.addOption(OptHelp, OptionNone, "Display this help message",
+			 "help");
+	parser.addOption(OptMaxPending, OptionInteger,
+			 "Limit the number of frames held by each client\n"
+			 "Frames are dropped for clients holding that many frames. The default is 2.",
+			 "max-pending", ArgumentRequired, "count");
+	parser.addOption(OptSocket, OptionString,
+			 "Path of the Unix socket clients connect to",
+			 "socket", ArgumentRequired, "path");
+	parser.addOption(OptStream, &streamKeyValue,
+			 "Set configuration of the served stream", "stream");
+
+	options_ = parser.parse(argc, argv);
+	if (!options_.valid())
+		return -EINVAL;
+
+	if (options_.empty() || options_.isSet(OptHelp)) {
+		parser.usage();
+		return options_.empty() ? -EINVAL : -EINTR;
+	}
+
+	if (!options_.isSet(OptCamera) || !options_.isSet(OptSocket)) {
+		std::cout << "A camera and a socket path are required" << std::endl;
+		parser.usage();
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int CameraServer::configure()
+{
+	config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+	if (!config_) {
+		std::cout << "Failed to get default stream configuration"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	StreamConfiguration &cfg = config_->at(0);
+
+	if (options_.isSet(OptStream)) {
+		KeyValueParser::Options opt = options_[OptStream].toKeyValues();
+
+		if (opt.isSet("width"))
+			cfg.size.width = opt["width"];
+
+		if (opt.isSet("height"))
+			cfg.size.height = opt["height"];
+
+		/* TODO: Translate 4CC string to ID. */
+		if (opt.isSet("pixelformat"))
+			cfg.pixelFormat = opt["pixelformat"];
+
+		if (opt.isSet("buffers"))
+			cfg.bufferCount = opt["buffers"];
+	}
+
+	switch (config_->validate()) {
+	case CameraConfiguration::Valid:
+		break;
+	case CameraConfiguration::Adjusted:
+		std::cout << "Camera configuration adjusted" << std::endl;
+		break;
+	case CameraConfiguration::Invalid:
+		std::cout << "Camera configuration invalid" << std::endl;
+		return -EINVAL;
+	}
+
+	int ret = camera_->configure(config_.get());
+	if (ret) {
+		std::cout << "Failed to configure camera" << std::endl;
+		return ret;
+	}
+
+	ret = camera_->allocateBuffers();
+	if (ret) {
+		std::cout << "Failed to allocate buffers" << std::endl;
+		return ret;
+	}
+
+	allocated_ = true;
+
+	unsigned int maxPending = 2;
+	if (options_.isSet(OptMaxPending))
+		maxPending = options_[OptMaxPending].toInteger();
+
+	shared_.reset(new SharedStream(cfg.stream(), maxPending));
+	shared_->bufferReleased.connect(this, &CameraServer::bufferReleased);
+
+	ret = shared_->listen(options_[OptSocket].toString());
+	if (ret) {
+		std::cout << "Failed to listen on "
+			  << options_[OptSocket].toString() << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	return 0;
+}
+
+int CameraServer::queueBuffer(unsigned int index)
+{
+	Request *request = camera_->createRequest();
+	if (!request)
+		return -ENOMEM;
+
+	Stream *stream = config_->at(0).stream();
+	request->addBuffer(stream->createBuffer(index));
+
+	return camera_->queueRequest(request);
+}
+
+void CameraServer::requestComplete(Request *request,
+				   const std::map<Stream *, Buffer *> &buffers)
+{
+	if (request->status() == Request::RequestCancelled)
+		return;
+
+	/*
+	 * The request is deleted when this method returns, the buffer is
+	 * queued again in a new request once all clients have released it.
+	 */
+	shared_->queueBuffer(buffers.begin()->second);
+}
+
+void CameraServer::bufferReleased(unsigned int index)
+{
+	if (queueBuffer(index))
+		std::cout << "Failed to queue buffer " << index << std::endl;
+}
+
+void signalHandler(int signal)
+{
+	std::cout << "Exiting" << std::endl;
+	CameraServer::instance()->quit();
+}
+
+int main(int argc, char **argv)
+{
+	CameraServer server;
+	int ret;
+
+	ret = server.init(argc, argv);
+	if (ret)
+		return ret == -EINTR ? 0 : EXIT_FAILURE;
+
+	struct sigaction sa = {};
+	sa.sa_handler = &signalHandler;
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+
+	if (server.exec())
+		return EXIT_FAILURE;
+
+	return 0;
+}
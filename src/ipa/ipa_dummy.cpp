@@ -6,6 +6,8 @@
  */
 
 #include <iostream>
+#include <map>
+#include <string.h>
 
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/ipa/ipa_module_info.h>
@@ -16,6 +18,15 @@ class IPADummy : public IPAInterface
 {
 public:
 	int init();
+	void mapBuffers(const std::vector<IPABuffer> &buffers);
+	void unmapBuffers(const std::vector<unsigned int> &ids);
+	void processEvent(unsigned int frame, const IPAOperationData &event);
+
+	/* Reply with the first word of the buffer whose ID is in data[0]. */
+	static constexpr unsigned int ReadBuffer = 2;
+
+private:
+	std::map<unsigned int, BufferMemory> buffers_;
 };
 
 int IPADummy::init()
@@ -24,6 +35,52 @@ int IPADummy::init()
 	return 0;
 }
 
+void IPADummy::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	for (const IPABuffer &buffer : buffers) {
+		BufferMemory &memory = buffers_[buffer.id];
+
+		memory.planes().clear();
+		for (const Plane &plane : buffer.memory.planes()) {
+			memory.planes().emplace_back();
+			memory.planes().back().setDmabuf(plane.dmabuf(),
+							 plane.length());
+		}
+	}
+}
+
+void IPADummy::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	for (unsigned int id : ids)
+		buffers_.erase(id);
+}
+
+void IPADummy::processEvent(unsigned int frame, const IPAOperationData &event)
+{
+	if (event.operation != ReadBuffer || event.data.empty()) {
+		/* Echo the event back to the pipeline handler. */
+		queueFrameAction.emit(frame, event);
+		return;
+	}
+
+	IPAOperationData reply;
+	reply.operation = ReadBuffer;
+	reply.data.push_back(event.data[0]);
+
+	auto iter = buffers_.find(event.data[0]);
+	if (iter != buffers_.end() && !iter->second.planes().empty()) {
+		void *mem = iter->second.planes()[0].mem();
+		uint32_t value;
+
+		if (mem) {
+			memcpy(&value, mem, sizeof(value));
+			reply.data.push_back(value);
+		}
+	}
+
+	queueFrameAction.emit(frame, reply);
+}
+
 /*
  * External IPA module interface
  */
@@ -7,6 +7,9 @@
  */
 
 #include <iostream>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
 
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/ipa/ipa_module_info.h>
@@ -17,6 +20,17 @@ class IPADummyIsolate : public IPAInterface
 {
 public:
 	int init();
+	void mapBuffers(const std::vector<IPABuffer> &buffers);
+	void unmapBuffers(const std::vector<unsigned int> &ids);
+	void processEvent(unsigned int frame, const IPAOperationData &event);
+
+	/* Reply with the first word of the buffer whose ID is in data[0]. */
+	static constexpr unsigned int ReadBuffer = 2;
+	/* Terminate abnormally, emulating a crash of the IPA. */
+	static constexpr unsigned int Crash = 3;
+
+private:
+	std::map<unsigned int, BufferMemory> buffers_;
 };
 
 int IPADummyIsolate::init()
@@ -25,6 +39,55 @@ int IPADummyIsolate::init()
 	return 0;
 }
 
+void IPADummyIsolate::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	for (const IPABuffer &buffer : buffers) {
+		BufferMemory &memory = buffers_[buffer.id];
+
+		memory.planes().clear();
+		for (const Plane &plane : buffer.memory.planes()) {
+			memory.planes().emplace_back();
+			memory.planes().back().setDmabuf(plane.dmabuf(),
+							 plane.length());
+		}
+	}
+}
+
+void IPADummyIsolate::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	for (unsigned int id : ids)
+		buffers_.erase(id);
+}
+
+void IPADummyIsolate::processEvent(unsigned int frame, const IPAOperationData &event)
+{
+	if (event.operation == Crash)
+		abort();
+
+	if (event.operation != ReadBuffer || event.data.empty()) {
+		/* Echo the event back to the pipeline handler. */
+		queueFrameAction.emit(frame, event);
+		return;
+	}
+
+	IPAOperationData reply;
+	reply.operation = ReadBuffer;
+	reply.data.push_back(event.data[0]);
+
+	auto iter = buffers_.find(event.data[0]);
+	if (iter != buffers_.end() && !iter->second.planes().empty()) {
+		void *mem = iter->second.planes()[0].mem();
+		uint32_t value;
+
+		if (mem) {
+			memcpy(&value, mem, sizeof(value));
+			reply.data.push_back(value);
+		}
+	}
+
+	queueFrameAction.emit(frame, reply);
+}
+
 /*
  * External IPA module interface
  */
@@ -7,12 +7,19 @@
 
 #include <libcamera/buffer.h>
 
+#include <algorithm>
 #include <errno.h>
+#include <sstream>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <linux/dma-buf.h>
+
 #include "log.h"
+#include "object_arena.h"
+#include "utils.h"
 
 /**
  * \file buffer.h
@@ -43,13 +50,55 @@ LOG_DEFINE_CATEGORY(Buffer)
  * To support CPU access, planes carry the CPU address of their backing memory.
  * Similarly to the dmabuf file handles, the CPU addresses for planes composing
  * an image may or may not be contiguous.
+ *
+ * Planes may alternatively be backed by memory allocated by the application
+ * and identified by its CPU address only, for video devices that capture to
+ * user pointers. Such planes have no dmabuf.
+ */
+
+/**
+ * \struct Plane::Mapping
+ * \brief A CPU mapping of a dmabuf, shared by all planes that use the dmabuf
  */
+struct Plane::Mapping {
+	Mapping(unsigned int len)
+		: length(len), mem(nullptr)
+	{
+	}
+
+	~Mapping()
+	{
+		if (mem && ::munmap(mem, length))
+			LOG(Buffer, Warning)
+				<< "Failed to unmap plane: " << strerror(errno);
+	}
+
+	unsigned int length;
+	void *mem;
+};
 
 Plane::Plane()
-	: fd_(-1), length_(0), mem_(0)
+	: fd_(-1), length_(0), offset_(0), mapFlags_(0), userptr_(nullptr)
 {
 }
 
+/**
+ * \brief Construct a Plane by moving the resources of \a other
+ * \param[in] other The other plane
+ *
+ * The \a other plane is left without memory.
+ */
+Plane::Plane(Plane &&other) noexcept
+	: fd_(other.fd_), length_(other.length_), offset_(other.offset_),
+	  mapFlags_(other.mapFlags_), mapping_(std::move(other.mapping_)),
+	  userptr_(other.userptr_)
+{
+	other.fd_ = -1;
+	other.length_ = 0;
+	other.offset_ = 0;
+	other.userptr_ = nullptr;
+}
+
 Plane::~Plane()
 {
 	munmap();
@@ -58,6 +107,40 @@ Plane::~Plane()
 		close(fd_);
 }
 
+/**
+ * \brief Move the resources of \a other to the plane
+ * \param[in] other The other plane
+ *
+ * The dmabuf previously set on the plane is released, and the \a other plane
+ * is left without memory.
+ *
+ * \return A reference to the plane
+ */
+Plane &Plane::operator=(Plane &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	munmap();
+
+	if (fd_ != -1)
+		close(fd_);
+
+	fd_ = other.fd_;
+	length_ = other.length_;
+	offset_ = other.offset_;
+	mapFlags_ = other.mapFlags_;
+	mapping_ = std::move(other.mapping_);
+	userptr_ = other.userptr_;
+
+	other.fd_ = -1;
+	other.length_ = 0;
+	other.offset_ = 0;
+	other.userptr_ = nullptr;
+
+	return *this;
+}
+
 /**
  * \fn Plane::dmabuf()
  * \brief Get the dmabuf file handle backing the buffer
@@ -69,7 +152,12 @@ Plane::~Plane()
  * \param[in] length The size of the memory region
  *
  * The \a fd dmabuf file handle is duplicated and stored. The caller may close
- * the original file handle.
+ * the original file handle. If the \a length is 0, the size of the whole
+ * dmabuf is used.
+ *
+ * The plane is initially considered to span the dmabuf from its start. Planes
+ * of a BufferMemory that share the same dmabuf are detected once all of them
+ * have been set, and their offset updated accordingly.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -80,6 +168,8 @@ int Plane::setDmabuf(int fd, unsigned int length)
 		return -EINVAL;
 	}
 
+	munmap();
+
 	if (fd_ != -1) {
 		close(fd_);
 		fd_ = -1;
@@ -93,7 +183,52 @@ int Plane::setDmabuf(int fd, unsigned int length)
 		return ret;
 	}
 
+	if (!length) {
+		off_t size = lseek(fd_, 0, SEEK_END);
+		if (size > 0)
+			length = size;
+	}
+
+	length_ = length;
+	offset_ = 0;
+	mapping_ = std::make_shared<Mapping>(length);
+	userptr_ = nullptr;
+
+	return 0;
+}
+
+/**
+ * \brief Set the application memory backing the buffer
+ * \param[in] mem The CPU address of the memory region
+ * \param[in] length The size of the memory region
+ *
+ * Back the plane with memory allocated by the application, to be captured to
+ * by video devices that support user pointers. The memory stays owned by the
+ * application, and shall remain valid as long as the plane uses it. The
+ * dmabuf previously set on the plane, if any, is released.
+ *
+ * The application may select memory that suits its CPU processing, such as
+ * cached memory backed by huge pages.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Plane::setUserPtr(void *mem, unsigned int length)
+{
+	if (!mem || !length) {
+		LOG(Buffer, Error) << "Invalid user memory provided";
+		return -EINVAL;
+	}
+
+	munmap();
+
+	if (fd_ != -1) {
+		close(fd_);
+		fd_ = -1;
+	}
+
 	length_ = length;
+	offset_ = 0;
+	userptr_ = mem;
 
 	return 0;
 }
@@ -102,7 +237,8 @@ int Plane::setDmabuf(int fd, unsigned int length)
  * \brief Map the plane memory data to a CPU accessible address
  *
  * The file descriptor to map the memory from must be set by a call to
- * setDmaBuf() before calling this function.
+ * setDmaBuf() before calling this function. If the plane shares its dmabuf
+ * with other planes, the mapping is shared with all of them.
  *
  * \sa setDmaBuf()
  *
@@ -112,10 +248,18 @@ int Plane::mmap()
 {
 	void *map;
 
-	if (mem_)
+	if (!mapping_)
+		return -EINVAL;
+
+	if (mapping_->mem)
 		return 0;
 
-	map = ::mmap(NULL, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	int flags = MAP_SHARED;
+	if (mapFlags_ & MapPopulate)
+		flags |= MAP_POPULATE;
+
+	map = ::mmap(NULL, mapping_->length, PROT_READ | PROT_WRITE, flags,
+		     fd_, 0);
 	if (map == MAP_FAILED) {
 		int ret = -errno;
 		LOG(Buffer, Error)
@@ -123,47 +267,66 @@ int Plane::mmap()
 		return ret;
 	}
 
-	mem_ = map;
+	mapping_->mem = map;
+
+	/* Advice is a hint, the mapping is usable even if it fails. */
+	if (mapFlags_ & MapSequential &&
+	    madvise(map, mapping_->length, MADV_SEQUENTIAL))
+		LOG(Buffer, Debug)
+			<< "Sequential access advice not supported: "
+			<< strerror(errno);
+
+#ifdef MADV_HUGEPAGE
+	if (mapFlags_ & MapHugePages &&
+	    madvise(map, mapping_->length, MADV_HUGEPAGE))
+		LOG(Buffer, Debug)
+			<< "Huge pages not supported: " << strerror(errno);
+#endif
 
 	return 0;
 }
 
 /**
- * \brief Unmap any existing CPU accessible mapping
+ * \brief Release the CPU accessible mapping
  *
- * Unmap the memory mapped by an earlier call to mmap().
+ * Release the reference to the mapping created by an earlier call to mmap().
+ * The memory is unmapped when the last plane that shares the mapping releases
+ * it.
  *
  * \return 0 on success or a negative error code otherwise
  */
 int Plane::munmap()
 {
-	int ret = 0;
-
-	if (mem_)
-		ret = ::munmap(mem_, length_);
+	mapping_.reset();
 
-	if (ret) {
-		ret = -errno;
-		LOG(Buffer, Warning)
-			<< "Failed to unmap plane: " << strerror(-ret);
-	} else {
-		mem_ = 0;
-	}
-
-	return ret;
+	return 0;
 }
 
 /**
  * \fn Plane::mem()
  * \brief Retrieve the CPU accessible memory address of the Plane
+ *
+ * Planes are not mapped when their dmabuf is set, as many users never access
+ * the buffer memory from the CPU. The memory is instead mapped the first time
+ * this method is called, and stays mapped until the plane is destroyed.
+ *
+ * Planes backed by application memory return the address set with
+ * setUserPtr().
+ *
  * \return The CPU accessible memory address on success or nullptr otherwise.
  */
 void *Plane::mem()
 {
-	if (!mem_)
-		mmap();
+	if (userptr_)
+		return userptr_;
+
+	if (!mapping_)
+		return nullptr;
+
+	if (!mapping_->mem && mmap())
+		return nullptr;
 
-	return mem_;
+	return static_cast<uint8_t *>(mapping_->mem) + offset_;
 }
 
 /**
@@ -172,6 +335,130 @@ void *Plane::mem()
  * \return The length of the memory region
  */
 
+/**
+ * \fn Plane::offset()
+ * \brief Retrieve the offset of the memory region within its dmabuf
+ *
+ * The offset is 0 unless the plane shares its dmabuf with previous planes of
+ * the same BufferMemory.
+ *
+ * \return The offset of the memory region in bytes
+ */
+
+/**
+ * \enum Plane::MapFlag
+ * \brief Hints for the CPU mapping of the plane memory
+ *
+ * The flags are applied when the plane memory is mapped by the first call to
+ * mem(). Advice that isn't supported for the dmabuf is ignored.
+ *
+ * \var Plane::MapPopulate
+ * Populate the page tables when mapping the memory, to avoid page faults on
+ * the first access to every page
+ * \var Plane::MapSequential
+ * Advise the kernel that the memory is accessed sequentially
+ * \var Plane::MapHugePages
+ * Back the mapping with huge pages when possible, to lower the TLB pressure
+ * on large frames
+ */
+
+/**
+ * \fn Plane::mapFlags()
+ * \brief Retrieve the CPU mapping hints of the plane
+ * \return The CPU mapping hints, as a bitmask of Plane::MapFlag values
+ */
+
+/**
+ * \fn Plane::setMapFlags()
+ * \brief Set the CPU mapping hints of the plane
+ * \param[in] flags The CPU mapping hints, as a bitmask of Plane::MapFlag values
+ *
+ * The hints take effect the next time the plane memory is mapped. They don't
+ * affect a mapping that already exists.
+ */
+
+/**
+ * \enum Plane::CpuAccess
+ * \brief The type of CPU access to the plane memory
+ * \var Plane::CpuRead
+ * The CPU reads the plane memory
+ * \var Plane::CpuWrite
+ * The CPU writes the plane memory
+ * \var Plane::CpuReadWrite
+ * The CPU reads and writes the plane memory
+ */
+
+/**
+ * \brief Prepare the plane memory for CPU access
+ * \param[in] access The type of CPU access
+ *
+ * The memory returned by mem() may be cached by the CPU, in which case the CPU
+ * caches need to be synchronised with the memory written or read by devices.
+ * This method shall be called before accessing the plane memory from the CPU,
+ * and be paired with a call to endCpuAccess() with the same \a access once the
+ * CPU access completes. It may block until devices have finished accessing the
+ * memory.
+ *
+ * The synchronisation applies to the whole dmabuf, including other planes that
+ * share the same dmabuf. Planes backed by application memory are kept coherent
+ * by the video device when buffers are queued and dequeued, and need no
+ * synchronisation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Plane::beginCpuAccess(CpuAccess access)
+{
+	return sync(access, false);
+}
+
+/**
+ * \brief Complete CPU access to the plane memory
+ * \param[in] access The type of CPU access
+ *
+ * This method shall be called when the CPU access started by beginCpuAccess()
+ * completes, with the same \a access, before the memory is handed back to a
+ * device.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Plane::endCpuAccess(CpuAccess access)
+{
+	return sync(access, true);
+}
+
+int Plane::sync(CpuAccess access, bool end)
+{
+	struct dma_buf_sync sync = {};
+	int ret;
+
+	if (userptr_)
+		return 0;
+
+	if (fd_ == -1)
+		return -EINVAL;
+
+	if (access & CpuRead)
+		sync.flags |= DMA_BUF_SYNC_READ;
+	if (access & CpuWrite)
+		sync.flags |= DMA_BUF_SYNC_WRITE;
+	sync.flags |= end ? DMA_BUF_SYNC_END : DMA_BUF_SYNC_START;
+
+	/* The ioctl may be interrupted and shall then be restarted. */
+	do {
+		ret = ioctl(fd_, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Buffer, Error)
+			<< "Failed to synchronise plane for CPU access: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
 /**
  * \class BufferMemory
  * \brief A memory buffer to store an image
@@ -187,6 +474,178 @@ void *Plane::mem()
  * \return A reference to a vector holding all Planes within the buffer
  */
 
+/**
+ * \fn BufferMemory::planes() const
+ * \copydoc BufferMemory::planes()
+ */
+
+/**
+ * \brief Prepare the memory of all planes for CPU access
+ * \param[in] access The type of CPU access
+ *
+ * This method is a helper that calls Plane::beginCpuAccess() once for every
+ * dmabuf backing the planes of the buffer.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int BufferMemory::beginCpuAccess(Plane::CpuAccess access)
+{
+	for (unsigned int i = 0; i < planes_.size(); ++i) {
+		if (sharesDmabuf(i))
+			continue;
+
+		int ret = planes_[i].beginCpuAccess(access);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Complete CPU access to the memory of all planes
+ * \param[in] access The type of CPU access
+ *
+ * This method is a helper that calls Plane::endCpuAccess() once for every
+ * dmabuf backing the planes of the buffer.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int BufferMemory::endCpuAccess(Plane::CpuAccess access)
+{
+	int ret = 0;
+
+	/* Complete access on all planes even if one of them fails. */
+	for (unsigned int i = 0; i < planes_.size(); ++i) {
+		if (sharesDmabuf(i))
+			continue;
+
+		int err = planes_[i].endCpuAccess(access);
+		if (!ret)
+			ret = err;
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Retrieve the size of the memory backing the buffer
+ *
+ * The size is computed as the sum of the sizes of the dmabufs and application
+ * memory regions backing the planes. Planes that share a dmabuf are accounted
+ * for once.
+ *
+ * \return The size of the buffer memory in bytes
+ */
+uint64_t BufferMemory::size() const
+{
+	uint64_t size = 0;
+
+	for (unsigned int i = 0; i < planes_.size(); ++i) {
+		if (planes_[i].userptr_)
+			size += planes_[i].length_;
+		else if (planes_[i].mapping_ && !sharesDmabuf(i))
+			size += planes_[i].mapping_->length;
+	}
+
+	return size;
+}
+
+/**
+ * \brief Retrieve the size of the buffer memory mapped to the CPU
+ *
+ * Planes are mapped lazily when their memory is first accessed, see
+ * Plane::mem(). Planes that share a dmabuf share a single mapping, accounted
+ * for once.
+ *
+ * \return The size of the mapped buffer memory in bytes
+ */
+uint64_t BufferMemory::mappedSize() const
+{
+	uint64_t size = 0;
+
+	for (unsigned int i = 0; i < planes_.size(); ++i) {
+		if (planes_[i].mapping_ && planes_[i].mapping_->mem &&
+		    !sharesDmabuf(i))
+			size += planes_[i].mapping_->length;
+	}
+
+	return size;
+}
+
+/*
+ * Check if the plane at \a index shares its dmabuf with a previous plane, as
+ * detected by shareMappings().
+ */
+bool BufferMemory::sharesDmabuf(unsigned int index) const
+{
+	const Plane &plane = planes_[index];
+
+	if (!plane.mapping_)
+		return false;
+
+	for (unsigned int i = 0; i < index; ++i) {
+		if (planes_[i].mapping_ == plane.mapping_)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * \brief Share CPU mappings between planes that use the same dmabuf
+ *
+ * Semi-planar and planar formats are often stored in a single dmabuf, with
+ * planes laid out contiguously one after the other. Detect planes that
+ * reference the same dmabuf object as a previous plane, and make them share
+ * the mapping of the first plane, to map the dmabuf once only. The offset of
+ * each such plane is computed as the end of the previous plane in the same
+ * dmabuf. The plane lengths shall thus be set explicitly. A plane that doesn't
+ * fit in the dmabuf size is left without a mapping, and can't be accessed by
+ * the CPU.
+ *
+ * This method shall be called once the dmabufs of all planes have been set.
+ */
+void BufferMemory::shareMappings()
+{
+	std::vector<std::pair<uint64_t, uint64_t>> ids(planes_.size());
+	std::vector<bool> identified(planes_.size());
+
+	for (unsigned int i = 0; i < planes_.size(); ++i) {
+		Plane &plane = planes_[i];
+
+		if (plane.fd_ == -1)
+			continue;
+
+		identified[i] = utils::dmabuf_identity(plane.fd_, &ids[i]);
+		if (!identified[i])
+			continue;
+
+		/* Find the last previous plane that shares the same dmabuf. */
+		for (unsigned int j = i; j-- > 0; ) {
+			if (!identified[j] || ids[j] != ids[i])
+				continue;
+
+			Plane &prev = planes_[j];
+			off_t size = lseek(plane.fd_, 0, SEEK_END);
+			unsigned int offset = prev.offset_ + prev.length_;
+
+			if (size > 0 && offset + plane.length_ > size) {
+				LOG(Buffer, Error)
+					<< "Plane " << i << " exceeds its dmabuf size";
+				plane.mapping_.reset();
+				break;
+			}
+
+			plane.offset_ = offset;
+			plane.mapping_ = prev.mapping_;
+			plane.mapping_->length = std::max(plane.mapping_->length,
+							  plane.offset_ + plane.length_);
+			break;
+		}
+	}
+}
+
 /**
  * \class BufferPool
  * \brief A pool of buffers
@@ -233,6 +692,93 @@ void BufferPool::destroyBuffers()
  * \return A vector containing all the buffers in the pool.
  */
 
+/**
+ * \brief Retrieve the size of the memory held by the pool
+ * \return The total size of the memory of all buffers in the pool in bytes
+ * \sa BufferMemory::size()
+ */
+uint64_t BufferPool::size() const
+{
+	uint64_t size = 0;
+
+	for (const BufferMemory &mem : buffers_)
+		size += mem.size();
+
+	return size;
+}
+
+/**
+ * \brief Retrieve the size of the pool memory mapped to the CPU
+ * \return The total size of the mapped memory of all buffers in the pool in
+ * bytes
+ * \sa BufferMemory::mappedSize()
+ */
+uint64_t BufferPool::mappedSize() const
+{
+	uint64_t size = 0;
+
+	for (const BufferMemory &mem : buffers_)
+		size += mem.mappedSize();
+
+	return size;
+}
+
+/**
+ * \struct MemoryUsage
+ * \brief Memory footprint of buffers
+ *
+ * The MemoryUsage structure reports the memory held in buffers by a stream, a
+ * camera or all the cameras of the process. Memory allocated by libcamera,
+ * either for buffers exported to applications or for buffers internal to
+ * pipeline handlers, is reported separately from memory imported from
+ * applications. Both can be mapped to the CPU when libcamera accesses the
+ * buffer content, which is reported separately as well.
+ */
+
+/**
+ * \var MemoryUsage::allocated
+ * \brief Size of the memory allocated by libcamera, in bytes
+ */
+
+/**
+ * \var MemoryUsage::imported
+ * \brief Size of the memory imported from applications, in bytes
+ */
+
+/**
+ * \var MemoryUsage::mapped
+ * \brief Size of the allocated and imported memory mapped to the CPU by
+ * libcamera, in bytes
+ */
+
+/**
+ * \brief Accumulate the memory usage of \a other
+ * \param[in] other The memory usage to add
+ * \return A reference to this memory usage
+ */
+MemoryUsage &MemoryUsage::operator+=(const MemoryUsage &other)
+{
+	allocated += other.allocated;
+	imported += other.imported;
+	mapped += other.mapped;
+
+	return *this;
+}
+
+/**
+ * \brief Assemble and return a string describing the memory usage
+ * \return A string describing the memory usage
+ */
+std::string MemoryUsage::toString() const
+{
+	std::stringstream ss;
+
+	ss << allocated << " bytes allocated, " << imported
+	   << " bytes imported, " << mapped << " bytes mapped";
+
+	return ss.str();
+}
+
 /**
  * \class Buffer
  * \brief A buffer handle and dynamic metadata
@@ -259,6 +805,20 @@ void BufferPool::destroyBuffers()
  * \var Buffer::BufferCancelled
  * The buffer has been cancelled due to capture stop. Its other metadata are
  * invalid and shall not be used.
+ * \var Buffer::BufferSkipped
+ * The buffer has been returned without being filled, as the frame has been
+ * skipped to honour the decimation of the stream (see
+ * StreamConfiguration::decimation). Its other metadata are invalid and shall
+ * not be used. The other buffers of the request are not affected.
+ */
+
+/**
+ * \enum Buffer::Flag
+ * Flags describing the content of a buffer
+ * \var Buffer::FlagKeyFrame
+ * The buffer contains a compressed frame that can be decoded independently of
+ * other frames, such as an H.264 IDR frame. Frames of intra-only compressed
+ * formats, such as MJPEG, may not be flagged.
  */
 
 /**
@@ -269,21 +829,81 @@ void BufferPool::destroyBuffers()
  * for a stream with Stream::createBuffer().
  */
 Buffer::Buffer(unsigned int index, const Buffer *metadata)
-	: index_(index), dmabuf_({ -1, -1, -1 }),
+	: index_(index), fence_(-1),
 	  status_(Buffer::BufferSuccess), request_(nullptr),
-	  stream_(nullptr)
+	  stream_(nullptr), recycled_(false), held_(false)
 {
 	if (metadata) {
 		bytesused_ = metadata->bytesused_;
 		sequence_ = metadata->sequence_;
 		timestamp_ = metadata->timestamp_;
+		clock_ = metadata->clock_;
+		flags_ = metadata->flags_;
 	} else {
 		bytesused_ = 0;
 		sequence_ = 0;
 		timestamp_ = 0;
+		clock_ = ClockUnknown;
+		flags_ = 0;
 	}
 }
 
+/**
+ * \brief Destroy the buffer, closing its acquire fence if still set
+ */
+Buffer::~Buffer()
+{
+	closeFence();
+}
+
+/**
+ * \brief Allocate memory for a buffer
+ * \param[in] size The size of the buffer object
+ *
+ * Buffers created by Stream::createBuffer() are carved from the object arena
+ * of the stream, see ObjectArena. Buffers created directly are allocated from
+ * the heap. All buffers are deleted with the delete operator.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *Buffer::operator new(size_t size)
+{
+	return ObjectArena::allocate(nullptr, size);
+}
+
+/**
+ * \brief Allocate memory for a buffer from an object arena
+ * \param[in] size The size of the buffer object
+ * \param[in] arena The object arena
+ * \return A pointer to the allocated memory
+ */
+void *Buffer::operator new(size_t size, ObjectArena *arena)
+{
+	return ObjectArena::allocate(arena, size);
+}
+
+/**
+ * \brief Free the memory of a buffer
+ * \param[in] ptr The buffer memory
+ *
+ * The memory is returned to the object arena it has been allocated from, if
+ * any.
+ */
+void Buffer::operator delete(void *ptr)
+{
+	ObjectArena::release(ptr);
+}
+
+/**
+ * \brief Free the memory of a buffer allocated from an object arena
+ * \param[in] ptr The buffer memory
+ * \param[in] arena The object arena
+ */
+void Buffer::operator delete(void *ptr, ObjectArena *arena)
+{
+	ObjectArena::release(ptr);
+}
+
 /**
  * \fn Buffer::index()
  * \brief Retrieve the Buffer index
@@ -294,8 +914,8 @@ Buffer::Buffer(unsigned int index, const Buffer *metadata)
  * \fn Buffer::dmabufs()
  * \brief Retrieve the dmabuf file descriptors for all buffer planes
  *
- * The dmabufs array contains one dmabuf file descriptor per plane. Unused
- * entries are set to -1.
+ * The dmabufs vector contains one dmabuf file descriptor per plane, for
+ * buffers created from external dmabufs. It is empty for other buffers.
  *
  * \return The dmabuf file descriptors
  */
@@ -306,11 +926,50 @@ Buffer::Buffer(unsigned int index, const Buffer *metadata)
  *
  * The association between the buffer and a BufferMemory instance is valid from
  * the time the request containing this buffer is queued to a camera to the end
- * of that request's completion handler.
+ * of that request's completion handler, or until the buffer is recycled with
+ * Request::recycleBuffer().
  *
  * \return The BufferMemory this buffer is associated with
  */
 
+/**
+ * \fn Buffer::fence()
+ * \brief Retrieve the acquire fence of the buffer
+ *
+ * The fence is cleared once it has signalled, or when the buffer is cancelled.
+ *
+ * \return The acquire fence file descriptor, or -1 if the buffer has no fence
+ * \sa setFence()
+ */
+
+/**
+ * \brief Set the acquire fence of the buffer
+ * \param[in] fd The fence file descriptor, or -1 to clear the fence
+ *
+ * Buffers written by another device, such as a GPU or a display controller,
+ * may be handed to the camera before that device has finished accessing them.
+ * The acquire fence is a sync_file file descriptor that signals when the
+ * buffer memory can be written by the camera. Pipeline handlers only receive
+ * the request containing the buffer, and thus only queue the buffer to the
+ * device, once the fence has signalled. Applications can thus queue requests
+ * without waiting for the other device on the CPU.
+ *
+ * Any file descriptor that becomes readable when signalled can be used as a
+ * fence. Ownership of \a fd is transferred to the buffer, which closes it once
+ * the fence has signalled, when the buffer is cancelled or destroyed, or when
+ * another fence is set. The fence shall be set before the request containing
+ * the buffer is queued.
+ *
+ * No release fence is reported at completion time, as V4L2 devices only
+ * complete buffers once the frame has been written to memory. The buffer can
+ * be handed to other devices as soon as it completes.
+ */
+void Buffer::setFence(int fd)
+{
+	closeFence();
+	fence_ = fd;
+}
+
 /**
  * \fn Buffer::bytesused()
  * \brief Retrieve the number of bytes occupied by the data in the buffer
@@ -321,11 +980,23 @@ Buffer::Buffer(unsigned int index, const Buffer *metadata)
  * \fn Buffer::timestamp()
  * \brief Retrieve the time when the buffer was processed
  *
- * The timestamp is expressed as a number of nanoseconds since the epoch.
+ * The timestamp is expressed as a number of nanoseconds in the clock reported
+ * by clock(). It can be converted to other clocks with a ClockConverter.
  *
  * \return Timestamp when the buffer was processed
  */
 
+/**
+ * \fn Buffer::clock()
+ * \brief Retrieve the clock the buffer timestamp is expressed in
+ *
+ * The clock is reported by the device that captured the buffer, and is
+ * ClockUnknown when the device doesn't report it. Timestamps in an unknown
+ * clock can't be compared with timestamps from other sources.
+ *
+ * \return The clock of the buffer timestamp
+ */
+
 /**
  * \fn Buffer::sequence()
  * \brief Retrieve the buffer sequence number
@@ -337,6 +1008,12 @@ Buffer::Buffer(unsigned int index, const Buffer *metadata)
  * \return Sequence number of the buffer
  */
 
+/**
+ * \fn Buffer::flags()
+ * \brief Retrieve the buffer flags
+ * \return The buffer flags, as a bitmask of Buffer::Flag values
+ */
+
 /**
  * \fn Buffer::status()
  * \brief Retrieve the buffer status
@@ -383,8 +1060,23 @@ void Buffer::cancel()
 {
 	bytesused_ = 0;
 	timestamp_ = 0;
+	clock_ = ClockUnknown;
 	sequence_ = 0;
 	status_ = BufferCancelled;
+
+	closeFence();
+}
+
+/**
+ * \brief Close the acquire fence of the buffer, if any
+ */
+void Buffer::closeFence()
+{
+	if (fence_ < 0)
+		return;
+
+	close(fence_);
+	fence_ = -1;
 }
 
 /**
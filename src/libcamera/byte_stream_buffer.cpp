@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * byte_stream_buffer.cpp - Byte stream buffer
+ */
+
+#include "byte_stream_buffer.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "log.h"
+
+/**
+ * \file byte_stream_buffer.h
+ * \brief Buffer wrapper for sequential reads and writes of binary data
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Serialization)
+
+/**
+ * \class ByteStreamBuffer
+ * \brief Wrap a memory buffer for sequential access to binary data
+ *
+ * The ByteStreamBuffer class wraps a memory buffer and exposes sequential read
+ * and write operations with integrated boundary checks. Read and write
+ * operations shall not be mixed, the access mode is selected at construction
+ * time by passing a const or non-const buffer pointer.
+ *
+ * Reads don't copy data. They return a pointer to the requested data in the
+ * buffer, which stays valid for the lifetime of the underlying memory. This
+ * allows decoding received messages in place. The data shall be suitably
+ * aligned for the type being read.
+ *
+ * Any read or write operation that would overflow the buffer, or read
+ * misaligned data, marks the buffer as overflown. All subsequent operations
+ * then fail, which allows checking for errors only once after a sequence of
+ * operations.
+ */
+
+/**
+ * \brief Construct a read ByteStreamBuffer from the memory area \a base
+ * of \a size
+ * \param[in] base The address of the memory area to wrap
+ * \param[in] size The size of the memory area to wrap
+ */
+ByteStreamBuffer::ByteStreamBuffer(const uint8_t *base, size_t size)
+	: base_(base), size_(size), overflow_(false), read_(base),
+	  write_(nullptr)
+{
+}
+
+/**
+ * \brief Construct a write ByteStreamBuffer from the memory area \a base
+ * of \a size
+ * \param[in] base The address of the memory area to wrap
+ * \param[in] size The size of the memory area to wrap
+ */
+ByteStreamBuffer::ByteStreamBuffer(uint8_t *base, size_t size)
+	: base_(base), size_(size), overflow_(false), read_(nullptr),
+	  write_(base)
+{
+}
+
+/**
+ * \fn ByteStreamBuffer::base()
+ * \brief Retrieve a pointer to the start location of the managed memory buffer
+ * \return A pointer to the managed memory buffer
+ */
+
+/**
+ * \fn ByteStreamBuffer::offset()
+ * \brief Retrieve the offset of the current access location from the base
+ * \return The offset in bytes
+ */
+
+/**
+ * \fn ByteStreamBuffer::size()
+ * \brief Retrieve the size of the managed memory buffer
+ * \return The size of managed memory buffer
+ */
+
+/**
+ * \fn ByteStreamBuffer::overflow()
+ * \brief Check if the buffer has overflown
+ * \return True if the buffer has overflown, false otherwise
+ */
+
+/**
+ * \brief Skip \a size bytes from the buffer
+ * \param[in] size The number of bytes to skip
+ *
+ * This method skips the next \a size bytes from the buffer. In write mode the
+ * skipped bytes are zeroed.
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENOSPC no more space is available in the managed memory buffer
+ */
+int ByteStreamBuffer::skip(size_t size)
+{
+	if (overflow_ || size > size_ - offset()) {
+		overflow_ = true;
+		return -ENOSPC;
+	}
+
+	if (read_) {
+		read_ += size;
+	} else {
+		memset(write_, 0, size);
+		write_ += size;
+	}
+
+	return 0;
+}
+
+/**
+ * \fn template<typename T> const T *ByteStreamBuffer::read(size_t count)
+ * \brief Read data in place from the managed memory buffer
+ * \tparam T Data type
+ * \param[in] count Number of data to read
+ *
+ * This method returns a pointer to \a count consecutive values of type \a T
+ * at the current location in the buffer, and advances the location past the
+ * data. The data isn't copied.
+ *
+ * \return A pointer to the data, or nullptr if the buffer isn't in read mode,
+ * if the read would overflow the buffer, or if the data isn't suitably aligned
+ */
+
+/**
+ * \fn template<typename T> int ByteStreamBuffer::write(const T *t, size_t count)
+ * \brief Write \a count values of type \a T to the managed memory buffer
+ * \tparam T Data type
+ * \param[in] t Pointer to the data to write
+ * \param[in] count Number of data to write
+ *
+ * \return 0 on success, a negative error code otherwise
+ * \retval -ENODATA the buffer is not in write mode
+ * \retval -ENOSPC no more space is available in the managed memory buffer
+ */
+
+const uint8_t *ByteStreamBuffer::readBytes(size_t size, size_t alignment,
+					   size_t count)
+{
+	if (!read_ || overflow_)
+		return nullptr;
+
+	if (count > (size_ - offset()) / size ||
+	    reinterpret_cast<uintptr_t>(read_) % alignment) {
+		LOG(Serialization, Error)
+			<< "Unable to read " << count << " entries of size "
+			<< size << " at offset " << offset() << " of "
+			<< size_;
+		overflow_ = true;
+		return nullptr;
+	}
+
+	const uint8_t *data = read_;
+	read_ += size * count;
+
+	return data;
+}
+
+int ByteStreamBuffer::writeBytes(const uint8_t *data, size_t size)
+{
+	if (!write_)
+		return -ENODATA;
+
+	if (overflow_)
+		return -ENOSPC;
+
+	if (size > size_ - offset()) {
+		LOG(Serialization, Error)
+			<< "Unable to write " << size << " bytes at offset "
+			<< offset() << " of " << size_;
+		overflow_ = true;
+		return -ENOSPC;
+	}
+
+	memcpy(write_, data, size);
+	write_ += size;
+
+	return 0;
+}
+
+} /* namespace libcamera */
@@ -7,13 +7,20 @@
 
 #include <libcamera/camera.h>
 
+#include <algorithm>
 #include <iomanip>
+#include <string.h>
 
+#include <libcamera/camera_manager.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "log.h"
+#include "message.h"
+#include "object_arena.h"
 #include "pipeline_handler.h"
+#include "thread.h"
+#include "tracer.h"
 #include "utils.h"
 
 /**
@@ -281,8 +288,16 @@ std::size_t CameraConfiguration::size() const
  * and the camera released.
  *
  * An application may start and stop a camera multiple times as long as it is
- * not released. The camera may also be reconfigured provided that all
- * resources allocated are freed prior to the reconfiguration.
+ * not released. The camera may also be reconfigured, either after freeing all
+ * resources allocated, or directly while resources are allocated, in which
+ * case the resources are reused when possible.
+ *
+ * Configuring the camera, allocating its buffers and starting it wait for the
+ * pipeline handler to complete the operations on the devices, which may take
+ * a significant amount of time. Applications that manage multiple cameras
+ * from a single thread can use configureAsync(), allocateBuffersAsync() and
+ * startAsync() to bring the cameras up concurrently, and handle completion
+ * through the returned futures or the \ref operationCompleted signal.
  *
  * \subsection Camera States
  *
@@ -298,6 +313,7 @@ std::size_t CameraConfiguration::size() const
  *   node [shape = circle ]; Configured;
  *   node [shape = circle ]; Prepared;
  *   node [shape = circle ]; Running;
+ *   node [shape = circle ]; Standby;
  *
  *   Available -> Available [label = "release()"];
  *   Available -> Acquired [label = "acquire()"];
@@ -310,11 +326,16 @@ std::size_t CameraConfiguration::size() const
  *   Configured -> Prepared [label = "allocateBuffers()"];
  *
  *   Prepared -> Configured [label = "freeBuffers()"];
- *   Prepared -> Prepared [label = "createRequest()"];
+ *   Prepared -> Prepared [label = "configure(), createRequest()"];
  *   Prepared -> Running [label = "start()"];
  *
  *   Running -> Prepared [label = "stop()"];
  *   Running -> Running [label = "createRequest(), queueRequest()"];
+ *   Running -> Standby [label = "standby()"];
+ *
+ *   Standby -> Prepared [label = "stop()"];
+ *   Standby -> Running [label = "start()"];
+ *   Standby -> Standby [label = "createRequest()"];
  * }
  * \enddot
  *
@@ -336,12 +357,21 @@ std::size_t CameraConfiguration::size() const
  * \subsubsection Prepared
  * The camera has been configured and provided with resources and is ready to be
  * started. The application may free the camera's resources to get back to the
- * Configured state or start() it to progress to the Running state.
+ * Configured state or start() it to progress to the Running state. It may also
+ * reconfigure the camera without freeing its resources first.
  *
  * \subsubsection Running
  * The camera is running and ready to process requests queued by the
  * application. The camera remains in this state until it is stopped and moved
- * to the Prepared state.
+ * to the Prepared state, or put in standby and moved to the Standby state.
+ *
+ * \subsubsection Standby
+ * The camera is idle but ready to resume capture quickly. Requests can't be
+ * queued, but the pipeline handler keeps the camera configured with its
+ * resources, and when supported keeps the devices streaming and discards the
+ * frames they capture. The application may start() the camera to resume
+ * capture and get back to the Running state, or stop() it to progress to the
+ * Prepared state.
  */
 
 /**
@@ -380,15 +410,69 @@ const std::string &Camera::name() const
 	return name_;
 }
 
+/**
+ * \fn Camera::id()
+ * \brief Retrieve the numerical identifier of the camera
+ *
+ * The identifier is assigned by the camera manager when the camera is
+ * registered. It is unique for the lifetime of the camera manager and isn't
+ * reused when the camera is unplugged, unlike the camera name.
+ *
+ * \return The camera identifier
+ * \sa CameraManager::get(unsigned int id)
+ */
+
 /**
  * \var Camera::bufferCompleted
  * \brief Signal emitted when a buffer for a request queued to the camera has
  * completed
+ *
+ * The signal is emitted in the thread the camera is bound to, which is the
+ * thread that started the camera manager. Buffers of fast streams can be
+ * queued again before their request completes with Request::recycleBuffer().
+ */
+
+/**
+ * \var Camera::bufferProgressed
+ * \brief Signal emitted when part of a buffer for a request queued to the
+ * camera has been written
+ *
+ * The signal carries the number of lines of the frame written to the buffer so
+ * far, counted from the top of the frame. Those lines can be read while the
+ * rest of the frame is being captured, allowing processing to start before the
+ * buffer completes. The signal is only emitted for streams configured with a
+ * non-zero StreamConfiguration::sliceHeight, every slice height lines, and not
+ * for the last slice, whose completion is reported by the \ref bufferCompleted
+ * signal.
+ *
+ * The signal is emitted in the thread the camera is bound to, before the
+ * bufferCompleted signal for the same buffer.
  */
 
 /**
  * \var Camera::requestCompleted
  * \brief Signal emitted when a request queued to the camera has completed
+ *
+ * The signal is emitted in the thread the camera is bound to, which is the
+ * thread that started the camera manager. It isn't emitted for requests that
+ * have a completion handler set with Request::setCompletionHandler().
+ */
+
+/**
+ * \var Camera::frameStarted
+ * \brief Signal emitted when the capture of a frame starts
+ *
+ * The signal carries the frame sequence number, which matches the sequence
+ * number of the buffers the frame is captured to, and the time the frame
+ * started in nanoseconds in the CLOCK_MONOTONIC clock. It is emitted when the
+ * sensor starts exposing or transmitting the frame, well before the buffers
+ * complete, and allows applications to schedule the processing of the frame
+ * ahead of its completion. Frames are reported whether or not a request is
+ * queued to capture them.
+ *
+ * The signal is emitted in the thread the camera is bound to, for cameras
+ * whose pipeline handler can detect the start of frames only, such as with
+ * V4L2_EVENT_FRAME_SYNC events.
  */
 
 /**
@@ -403,10 +487,57 @@ const std::string &Camera::name() const
  * application API calls by returning errors immediately.
  */
 
+/**
+ * \var Camera::operationCompleted
+ * \brief Signal emitted when an asynchronous camera operation has completed
+ *
+ * This signal is emitted when the operation started by configureAsync(),
+ * allocateBuffersAsync() or startAsync() completes, after the future returned
+ * by the operation has been made ready. The operation result is passed as a
+ * parameter.
+ *
+ * The signal is emitted in the pipeline handler thread. Slots of Object
+ * instances are thus called in the thread of their object, which allows
+ * applications to handle the completion of operations on multiple cameras
+ * from their event loop.
+ */
+
+/**
+ * \typedef Camera::RecycleHandler
+ * \brief Handler for buffers returned by Request::holdBuffer() handles
+ */
+
+/**
+ * \fn Camera::setRecycleHandler()
+ * \brief Set the recycle handler for held buffers
+ * \param[in] handler The recycle handler
+ *
+ * When the last handle to a buffer held with Request::holdBuffer() is
+ * destroyed, the camera creates a new buffer for the same memory and passes it
+ * to the \a handler, in the camera's thread. The handler owns the new buffer,
+ * and typically queues it in a new request. Buffers returned while no handler
+ * is set, or while the camera isn't running, are deleted.
+ */
+
 Camera::Camera(PipelineHandler *pipe, const std::string &name)
-	: pipe_(pipe->shared_from_this()), name_(name), disconnected_(false),
-	  state_(CameraAvailable)
+	: pipe_(pipe->shared_from_this()), name_(name), id_(0), disconnected_(false),
+	  state_(CameraAvailable), warmStandby_(false), asyncPending_(false),
+	  cancelledRequests_(nullptr), completingRequest_(nullptr),
+	  completingRequestQueued_(false), arena_(ObjectArena::create())
 {
+	traceSource_ = Tracer::instance()->registerSource(name);
+
+	/*
+	 * Requests are queued to the pipeline handler thread, and completion
+	 * and disconnection are reported back to the camera's thread.
+	 */
+	requestQueued_.connect(pipe, &PipelineHandler::requestQueued);
+	requestsQueued_.connect(pipe, &PipelineHandler::queueRequests);
+	bufferDone_.connect(this, &Camera::bufferComplete);
+	bufferProgress_.connect(this, &Camera::bufferProgress);
+	requestDone_.connect(this, &Camera::requestComplete);
+	frameStart_.connect(this, &Camera::frameStart);
+	unplugged_.connect(this, &Camera::disconnect);
 }
 
 Camera::~Camera()
@@ -421,6 +552,7 @@ static const char *const camera_state_names[] = {
 	"Configured",
 	"Prepared",
 	"Running",
+	"Standby",
 };
 
 bool Camera::stateBetween(State low, State high) const
@@ -458,9 +590,9 @@ bool Camera::stateIs(State state) const
  *
  * This method is used to notify the camera instance that the underlying
  * hardware has been unplugged. In response to the disconnection the camera
- * instance notifies the application by emitting the #disconnected signal, and
+ * instance notifies the application by emitting the #disconnected signal,
  * ensures that all new calls to the application-facing Camera API return an
- * error immediately.
+ * error immediately, and unregisters itself from the camera manager.
  *
  * \todo Deal with pending requests if the camera is disconnected in a
  * running state.
@@ -472,15 +604,19 @@ void Camera::disconnect()
 	LOG(Camera, Debug) << "Disconnecting camera " << name_;
 
 	/*
-	 * If the camera was running when the hardware was removed force the
-	 * state to Prepared to allow applications to call freeBuffers() and
-	 * release() before deleting the camera.
+	 * If the camera was running or in standby when the hardware was
+	 * removed force the state to Prepared to allow applications to call
+	 * freeBuffers() and release() before deleting the camera.
 	 */
-	if (state_ == CameraRunning)
+	if (state_ == CameraRunning || state_ == CameraStandby)
 		state_ = CameraPrepared;
 
 	disconnected_ = true;
 	disconnected.emit(this);
+
+	/* Keep the camera alive until it has been unregistered. */
+	std::shared_ptr<Camera> camera = shared_from_this();
+	pipe_->manager_->removeCamera(this);
 }
 
 /**
@@ -500,6 +636,10 @@ void Camera::disconnect()
  * Once exclusive access isn't needed anymore, the device should be released
  * with a call to the release() function.
  *
+ * When lazy camera instantiation is enabled with the LIBCAMERA_LAZY_CAMERAS
+ * environment variable, the camera devices are opened when the camera is
+ * acquired and closed when it is released.
+ *
  * This function affects the state of the camera, see \ref camera_operation.
  *
  * \return 0 on success or a negative error code otherwise
@@ -520,6 +660,13 @@ int Camera::acquire()
 		return -EBUSY;
 	}
 
+	int ret = -ENODEV;
+	pipe_->invoke([&]() { ret = pipe_->acquireDevices(this); });
+	if (ret) {
+		pipe_->unlock();
+		return ret;
+	}
+
 	state_ = CameraAcquired;
 
 	return 0;
@@ -541,6 +688,7 @@ int Camera::release()
 	if (!stateBetween(CameraAvailable, CameraConfigured))
 		return -EBUSY;
 
+	pipe_->invoke([&]() { pipe_->releaseDevices(this); });
 	pipe_->unlock();
 
 	state_ = CameraAvailable;
@@ -584,6 +732,12 @@ const std::set<Stream *> &Camera::streams() const
  * empty list of roles is valid, and will generate an empty configuration that
  * can be filled by the caller.
  *
+ * Each stream configuration reports the recommended number of buffers in its
+ * bufferCount field, and the supported range in its minBufferCount and
+ * maxBufferCount fields. When adaptive buffer counts are enabled with the
+ * LIBCAMERA_ADAPTIVE_BUFFERS environment variable, the recommended number of
+ * buffers grows after capture sessions that dropped frames.
+ *
  * \return A CameraConfiguration if the requested roles can be satisfied, or a
  * null pointer otherwise. The ownership of the returned configuration is
  * passed to the caller.
@@ -593,7 +747,12 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
 	if (disconnected_ || roles.size() > streams_.size())
 		return nullptr;
 
-	CameraConfiguration *config = pipe_->generateConfiguration(this, roles);
+	CameraConfiguration *config = nullptr;
+	pipe_->invoke([&]() {
+		config = pipe_->generateConfiguration(this, roles);
+		if (config)
+			pipe_->adjustBufferCount(this, config);
+	});
 	if (!config) {
 		LOG(Camera, Debug)
 			<< "Pipeline handler failed to generate configuration";
@@ -606,7 +765,7 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
 		msg << " empty";
 
 	for (unsigned int index = 0; index < config->size(); ++index)
-		msg << " (" << index << ") " << config->at(index).toString();
+		msg << " (" << index << ") " << config->at(index);
 
 	LOG(Camera, Debug) << msg.str();
 
@@ -634,6 +793,21 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
  * Upon return the StreamConfiguration entries in \a config are associated with
  * Stream instances which can be retrieved with StreamConfiguration::stream().
  *
+ * When the camera is configured in the Prepared state, its buffers are kept
+ * if the new configuration uses the same streams, with the same number of
+ * buffers and memory type, and if the pipeline handler can fit the new
+ * configuration in the existing buffers. This speeds up switching between
+ * configurations, for instance between preview and still capture sizes.
+ * Otherwise the buffers are freed and allocated again, and the buffers memory
+ * and mappings retrieved from the streams become invalid. The camera stays in
+ * the Prepared state on success, and may be left in the Configured state on
+ * failure.
+ *
+ * Configuring the camera again with a configuration identical to the active
+ * one, in the Configured or Prepared state, only associates the stream
+ * configurations with the active streams and leaves the hardware untouched,
+ * unless the pipeline handler has configured another camera in the meantime.
+ *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not in a state where it can be configured
@@ -641,12 +815,10 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
  */
 int Camera::configure(CameraConfiguration *config)
 {
-	int ret;
-
 	if (disconnected_)
 		return -ENODEV;
 
-	if (!stateBetween(CameraAcquired, CameraConfigured))
+	if (!stateBetween(CameraAcquired, CameraPrepared))
 		return -EACCES;
 
 	if (config->validate() != CameraConfiguration::Valid) {
@@ -660,16 +832,77 @@ int Camera::configure(CameraConfiguration *config)
 	for (unsigned int index = 0; index < config->size(); ++index) {
 		StreamConfiguration &cfg = config->at(index);
 		cfg.setStream(nullptr);
-		msg << " (" << index << ") " << cfg.toString();
+		msg << " (" << index << ") " << cfg;
 	}
 
 	LOG(Camera, Info) << msg.str();
 
-	ret = pipe_->configure(this, config);
+	if (stateBetween(CameraConfigured, CameraPrepared) &&
+	    configurationUnchanged(config)) {
+		for (unsigned int index = 0; index < config->size(); ++index) {
+			StreamConfiguration &cfg = config->at(index);
+			Stream *stream = streamTable_[index];
+
+			cfg.setStream(stream);
+			cfg.stride = stream->configuration().stride;
+			stream->configuration_.dropPolicy = cfg.dropPolicy;
+		}
+
+		LOG(Camera, Debug) << "Configuration unchanged";
+		return 0;
+	}
+
+	if (stateIs(CameraPrepared))
+		return reconfigure(config);
+
+	return configureStreams(config);
+}
+
+/*
+ * Check if the configuration is identical to the active configuration, and the
+ * pipeline handler hasn't configured another camera since. The stride is
+ * computed by the pipeline handler and isn't compared.
+ */
+bool Camera::configurationUnchanged(const CameraConfiguration *config) const
+{
+	if (pipe_->configuredCamera_ != this ||
+	    config->size() != streamTable_.size())
+		return false;
+
+	for (unsigned int index = 0; index < config->size(); ++index) {
+		const StreamConfiguration &cfg = config->at(index);
+		const StreamConfiguration &active =
+			streamTable_[index]->configuration();
+
+		if (cfg.pixelFormat != active.pixelFormat ||
+		    cfg.modifier != active.modifier ||
+		    cfg.size != active.size ||
+		    cfg.memoryType != active.memoryType ||
+		    cfg.bufferCount != active.bufferCount ||
+		    cfg.mapFlags != active.mapFlags ||
+		    cfg.decimation != active.decimation ||
+		    cfg.sliceHeight != active.sliceHeight)
+			return false;
+	}
+
+	return true;
+}
+
+int Camera::configureStreams(CameraConfiguration *config)
+{
+	int ret = -ENODEV;
+
+	pipe_->invoke([&]() {
+		ret = pipe_->configure(this, config);
+		pipe_->configuredCamera_ = ret ? nullptr : this;
+	});
 	if (ret)
 		return ret;
 
 	activeStreams_.clear();
+	streamTable_.clear();
+	streamTable_.reserve(config->size());
+
 	for (const StreamConfiguration &cfg : *config) {
 		Stream *stream = cfg.stream();
 		if (!stream)
@@ -678,6 +911,7 @@ int Camera::configure(CameraConfiguration *config)
 
 		stream->configuration_ = cfg;
 		activeStreams_.insert(stream);
+		streamTable_.push_back(stream);
 
 		/*
 		 * Allocate buffer objects in the pool.
@@ -691,6 +925,66 @@ int Camera::configure(CameraConfiguration *config)
 	return 0;
 }
 
+int Camera::reconfigure(CameraConfiguration *config)
+{
+	int ret = -ENODEV;
+
+	pipe_->invoke([&]() {
+		ret = pipe_->reconfigure(this, config);
+		if (!ret)
+			pipe_->configuredCamera_ = this;
+	});
+	if (!ret) {
+		for (const StreamConfiguration &cfg : *config) {
+			Stream *stream = cfg.stream();
+			if (!activeStreams_.count(stream))
+				LOG(Camera, Fatal)
+					<< "Pipeline handler failed to reuse streams";
+
+			stream->configuration_ = cfg;
+			stream->updateMapFlags();
+		}
+
+		LOG(Camera, Debug) << "Reconfigured with existing buffers";
+		return 0;
+	}
+
+	LOG(Camera, Debug)
+		<< "Can't reuse buffers (" << strerror(-ret)
+		<< "), reallocating";
+
+	ret = freeBuffers();
+	if (ret)
+		return ret;
+
+	ret = configureStreams(config);
+	if (ret)
+		return ret;
+
+	return allocateBuffers();
+}
+
+/**
+ * \brief Configure the camera asynchronously
+ * \param[in] config The camera configurations to setup
+ *
+ * This method performs the same operation as configure(), in the pipeline
+ * handler thread, and returns without waiting for its completion. The \a
+ * config shall stay valid until the operation completes.
+ *
+ * Only one asynchronous operation can be in progress for a camera at a time,
+ * and no other method of the camera shall be called until the operation
+ * completes. Completion is reported through the returned future and the
+ * \ref operationCompleted signal.
+ *
+ * \return A future holding the result of configure(), or -EBUSY if another
+ * asynchronous operation is in progress
+ */
+std::future<int> Camera::configureAsync(CameraConfiguration *config)
+{
+	return runAsync([this, config]() { return configure(config); });
+}
+
 /**
  * \brief Allocate buffers for all configured streams
  *
@@ -715,17 +1009,51 @@ int Camera::allocateBuffers()
 		return -EINVAL;
 	}
 
-	int ret = pipe_->allocateBuffers(this, activeStreams_);
+	int ret = -ENODEV;
+	pipe_->invoke([&]() {
+		ret = pipe_->allocateBuffers(this, activeStreams_);
+		if (ret)
+			return;
+
+		for (Stream *stream : activeStreams_)
+			stream->updateMapFlags();
+	});
 	if (ret) {
 		LOG(Camera, Error) << "Failed to allocate buffers";
 		return ret;
 	}
 
+	/*
+	 * Reserve a request per buffer, carved from the arena without
+	 * allocating memory while capturing. The streams reserve their buffer
+	 * objects when configured.
+	 */
+	unsigned int requests = 0;
+	for (Stream *stream : activeStreams_)
+		requests = std::max(requests, stream->configuration().bufferCount);
+
+	arena_->reserve(sizeof(Request), requests);
+
 	state_ = CameraPrepared;
 
 	return 0;
 }
 
+/**
+ * \brief Allocate buffers for all configured streams asynchronously
+ *
+ * This method performs the same operation as allocateBuffers(), in the
+ * pipeline handler thread, and returns without waiting for its completion. The
+ * same rules as for configureAsync() apply.
+ *
+ * \return A future holding the result of allocateBuffers(), or -EBUSY if
+ * another asynchronous operation is in progress
+ */
+std::future<int> Camera::allocateBuffersAsync()
+{
+	return runAsync([this]() { return allocateBuffers(); });
+}
+
 /**
  * \brief Release all buffers from allocated pools in each stream
  *
@@ -749,7 +1077,12 @@ int Camera::freeBuffers()
 
 	state_ = CameraConfigured;
 
-	return pipe_->freeBuffers(this, activeStreams_);
+	int ret = -ENODEV;
+	pipe_->invoke([&]() {
+		ret = pipe_->freeBuffers(this, activeStreams_);
+	});
+
+	return ret;
 }
 
 /**
@@ -767,17 +1100,21 @@ int Camera::freeBuffers()
  * The ownership of the returned request is passed to the caller, which is
  * responsible for either queueing the request or deleting it.
  *
- * This function shall only be called when the camera is in the Prepared
- * or Running state, see \ref camera_operation.
+ * Requests are carved from memory owned by the camera and recycled when they
+ * are deleted, to avoid fragmenting the heap. Memory for a request per buffer
+ * is reserved by allocateBuffers().
+ *
+ * This function shall only be called when the camera is in the Prepared,
+ * Running or Standby state, see \ref camera_operation.
  *
  * \return A pointer to the newly created request, or nullptr on error
  */
 Request *Camera::createRequest(uint64_t cookie)
 {
-	if (disconnected_ || !stateBetween(CameraPrepared, CameraRunning))
+	if (disconnected_ || !stateBetween(CameraPrepared, CameraStandby))
 		return nullptr;
 
-	return new Request(this, cookie);
+	return new (arena_.get()) Request(this, cookie);
 }
 
 /**
@@ -788,18 +1125,31 @@ Request *Camera::createRequest(uint64_t cookie)
  *
  * After allocating the request with createRequest(), the application shall
  * fill it with at least one capture buffer before queuing it. Requests that
- * contain no buffers are invalid and are rejected without being queued.
+ * contain no buffers, or controls whose value is outside of the range reported
+ * by controls(), are invalid and are rejected without being queued.
  *
  * Once the request has been queued, the camera will notify its completion
- * through the \ref requestCompleted signal.
+ * through the request completion handler if set, or through the
+ * \ref requestCompleted signal otherwise.
+ *
+ * The request is processed asynchronously by the pipeline handler. If the
+ * pipeline handler fails to process it, the request completes in the
+ * cancelled state.
+ *
+ * Buffers may carry an acquire fence set with Buffer::setFence(). The request,
+ * and the requests queued after it, are then only processed once all its
+ * fences have signalled. If they don't signal within the fence timeout, the
+ * request completes in the cancelled state.
  *
  * Ownership of the request is transferred to the camera. It will be deleted
- * automatically after it completes.
+ * automatically after it completes, unless it is reset for reuse with
+ * Request::reuse() from the completion handler.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not running so requests can't be queued
- * \retval -EINVAL The request is invalid
+ * \retval -EINVAL The request is invalid, or contains a buffer of a
+ * UserPtrMemory stream not backed by application memory
  * \retval -ENOMEM No buffer memory was available to handle the request
  */
 int Camera::queueRequest(Request *request)
@@ -810,11 +1160,97 @@ int Camera::queueRequest(Request *request)
 	if (!stateIs(CameraRunning))
 		return -EACCES;
 
+	int ret = prepareRequest(request);
+	if (ret)
+		return ret;
+
+	if (request == completingRequest_)
+		completingRequestQueued_ = true;
+
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled())
+		tracer->record(Tracer::QueueRequest, traceSource_, request);
+
+	requestQueued_.emit(this, request);
+
+	return 0;
+}
+
+/**
+ * \brief Queue a batch of requests to the camera
+ * \param[in] requests The requests to queue to the camera
+ *
+ * This method queues all \a requests to the camera for capture, in order. It
+ * behaves as calling queueRequest() for each of them, but checks the camera
+ * state once and hands the whole batch to the pipeline handler in a single
+ * call. This lowers the overhead of filling the pipeline when starting the
+ * camera or after a stall, and allows the pipeline handler to coalesce the
+ * work needed to queue the requests.
+ *
+ * All requests are validated before any of them is queued. If a request is
+ * invalid, no request is queued and their ownership stays with the caller.
+ * Otherwise ownership of all requests is transferred to the camera.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so requests can't be queued
+ * \retval -EINVAL A request is invalid
+ * \retval -ENOMEM No buffer memory was available to handle a request
+ */
+int Camera::queueRequests(const std::vector<Request *> &requests)
+{
+	if (disconnected_)
+		return -ENODEV;
+
+	if (!stateIs(CameraRunning))
+		return -EACCES;
+
+	if (requests.empty())
+		return 0;
+
+	for (Request *request : requests) {
+		int ret = prepareRequest(request);
+		if (ret)
+			return ret;
+	}
+
+	if (std::find(requests.begin(), requests.end(), completingRequest_) !=
+	    requests.end())
+		completingRequestQueued_ = true;
+
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled()) {
+		for (Request *request : requests)
+			tracer->record(Tracer::QueueRequest, traceSource_, request);
+	}
+
+	requestsQueued_.emit(this, requests);
+
+	return 0;
+}
+
+/*
+ * Validate the streams of a request, map its buffers to memory, and prepare it
+ * for completion.
+ */
+int Camera::prepareRequest(Request *request)
+{
+	if (!request->controls().validate()) {
+		LOG(Camera, Error) << "Invalid request controls";
+		return -EINVAL;
+	}
+
+	/*
+	 * Cameras have a handful of streams at most, validate the request
+	 * streams with a linear search of the flat stream table, which avoids
+	 * the pointer chasing of a tree lookup for every buffer.
+	 */
 	for (auto const &it : request->buffers()) {
 		Stream *stream = it.first;
 		Buffer *buffer = it.second;
 
-		if (activeStreams_.find(stream) == activeStreams_.end()) {
+		if (std::find(streamTable_.begin(), streamTable_.end(), stream) ==
+		    streamTable_.end()) {
 			LOG(Camera, Error) << "Invalid request";
 			return -EINVAL;
 		}
@@ -830,6 +1266,12 @@ int Camera::queueRequest(Request *request)
 		}
 
 		buffer->mem_ = &stream->buffers()[buffer->index_];
+
+		if (stream->memoryType() == UserPtrMemory &&
+		    buffer->mem_->planes().empty()) {
+			LOG(Camera, Error) << "Buffer has no user memory";
+			return -EINVAL;
+		}
 	}
 
 	int ret = request->prepare();
@@ -838,7 +1280,7 @@ int Camera::queueRequest(Request *request)
 		return ret;
 	}
 
-	return pipe_->queueRequest(this, request);
+	return 0;
 }
 
 /**
@@ -848,6 +1290,10 @@ int Camera::queueRequest(Request *request)
  * can queue requests to the camera to process and return to the application
  * until the capture session is terminated with \a stop().
  *
+ * When the camera is in standby, this method resumes the capture session. If
+ * the pipeline handler has kept the devices streaming, the first frame is
+ * captured within one frame interval.
+ *
  * This function affects the state of the camera, see \ref camera_operation.
  *
  * \return 0 on success or a negative error code otherwise
@@ -859,68 +1305,394 @@ int Camera::start()
 	if (disconnected_)
 		return -ENODEV;
 
-	if (!stateIs(CameraPrepared))
+	if (state_ != CameraStandby && !stateIs(CameraPrepared))
 		return -EACCES;
 
-	LOG(Camera, Debug) << "Starting capture";
+	bool resume = state_ == CameraStandby && warmStandby_;
+
+	LOG(Camera, Debug) << (resume ? "Resuming" : "Starting") << " capture";
+
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled())
+		tracer->record(Tracer::StartCamera, traceSource_, nullptr);
 
-	int ret = pipe_->start(this);
+	int ret = -ENODEV;
+	uint64_t latency = 0;
+	pipe_->invoke([&]() {
+		StatisticsCollector &stats = pipe_->cameraData(this)->stats_;
+
+		stats.start();
+		ret = resume ? pipe_->resume(this) : pipe_->start(this);
+		if (!ret)
+			latency = stats.started();
+	});
 	if (ret)
 		return ret;
 
+	if (tracer->enabled())
+		tracer->record(Tracer::CameraStarted, traceSource_, nullptr);
+
+	LOG(Camera, Debug) << "Capture started in " << latency << "us";
+
 	state_ = CameraRunning;
+	warmStandby_ = false;
 
 	return 0;
 }
 
+/**
+ * \brief Start capture from camera asynchronously
+ *
+ * This method performs the same operation as start(), in the pipeline handler
+ * thread, and returns without waiting for its completion. The same rules as
+ * for configureAsync() apply.
+ *
+ * \return A future holding the result of start(), or -EBUSY if another
+ * asynchronous operation is in progress
+ */
+std::future<int> Camera::startAsync()
+{
+	return runAsync([this]() { return start(); });
+}
+
 /**
  * \brief Stop capture from camera
+ * \param[in] cancelled Vector to store the cancelled requests, or nullptr
  *
  * This method stops capturing and processing requests immediately. All pending
  * requests are cancelled and complete synchronously in an error state.
  *
+ * When \a cancelled is null, the cancelled requests are notified individually
+ * through the bufferCompleted and requestCompleted signals. Otherwise they are
+ * appended to the \a cancelled vector in completion order, without emitting
+ * any signal, and their ownership is transferred to the caller. This allows
+ * applications that start and stop the camera frequently to flush all
+ * requests at once and queue them again after reusing them when restarting
+ * the camera. Buffer memory stays mapped across stop and start cycles until
+ * freeBuffers() is called.
+ *
+ * Cancelled requests can only be collected when this method is called from
+ * the thread the camera is bound to. When called from a different thread, the
+ * requests are always notified individually.
+ *
+ * The camera can also be stopped from the Standby state, in which case no
+ * request is pending.
+ *
  * This function affects the state of the camera, see \ref camera_operation.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not running so can't be stopped
  */
-int Camera::stop()
+int Camera::stop(std::vector<Request *> *cancelled)
 {
 	if (disconnected_)
 		return -ENODEV;
 
-	if (!stateIs(CameraRunning))
+	if (state_ != CameraStandby && !stateIs(CameraRunning))
 		return -EACCES;
 
 	LOG(Camera, Debug) << "Stopping capture";
 
+	bool streaming = state_ == CameraRunning || warmStandby_;
+
 	state_ = CameraPrepared;
+	warmStandby_ = false;
+
+	pipe_->invoke([&]() {
+		if (streaming)
+			pipe_->stop(this);
+		pipe_->cancelWaitingRequests(this);
+		pipe_->tuneBufferCount(this);
+	});
+
+	flushCancelled(cancelled);
+
+	Tracer::instance()->dump();
+
+	return 0;
+}
+
+/**
+ * \brief Put the camera in standby
+ * \param[in] cancelled Vector to store the cancelled requests, or nullptr
+ *
+ * This method stops processing requests immediately and moves the camera to
+ * the Standby state, from which capture can be resumed with start() with a
+ * lower latency than when starting from the Prepared state. All pending
+ * requests are cancelled and handled as for stop().
+ *
+ * Pipeline handlers that support it keep the devices streaming in standby and
+ * discard the captured frames, at the cost of the power consumed by the
+ * sensor. Otherwise the devices are stopped, but the camera keeps its
+ * configuration and buffers, and resuming capture is equivalent to starting
+ * it.
+ *
+ * This function affects the state of the camera, see \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so can't be put in standby
+ */
+int Camera::standby(std::vector<Request *> *cancelled)
+{
+	if (disconnected_)
+		return -ENODEV;
+
+	if (!stateIs(CameraRunning))
+		return -EACCES;
 
-	pipe_->stop(this);
+	LOG(Camera, Debug) << "Entering standby";
+
+	state_ = CameraStandby;
+
+	pipe_->invoke([&]() {
+		warmStandby_ = !pipe_->standby(this);
+		if (!warmStandby_)
+			pipe_->stop(this);
+		pipe_->cancelWaitingRequests(this);
+	});
+
+	LOG(Camera, Debug)
+		<< "Devices " << (warmStandby_ ? "kept streaming" : "stopped")
+		<< " in standby";
+
+	flushCancelled(cancelled);
 
 	return 0;
 }
 
+/*
+ * Complete the requests cancelled by stop() or standby() before returning,
+ * collecting them in \a cancelled if not null.
+ */
+void Camera::flushCancelled(std::vector<Request *> *cancelled)
+{
+	if (Thread::current() != thread())
+		return;
+
+	cancelledRequests_ = cancelled;
+	thread()->dispatchMessages(this);
+	cancelledRequests_ = nullptr;
+}
+
+/*
+ * Run \a func in the pipeline handler thread, where the pipeline handler
+ * operations it performs don't need to block for a cross-thread invocation.
+ * The camera is kept alive until the operation completes.
+ */
+std::future<int> Camera::runAsync(const std::function<int()> &func)
+{
+	std::shared_ptr<std::promise<int>> result =
+		std::make_shared<std::promise<int>>();
+	std::future<int> future = result->get_future();
+
+	if (asyncPending_.exchange(true)) {
+		result->set_value(-EBUSY);
+		return future;
+	}
+
+	std::shared_ptr<Camera> camera = shared_from_this();
+	pipe_->postMessage(utils::make_unique<InvokeMessage>([camera, func, result]() {
+		int ret = func();
+
+		camera->asyncPending_ = false;
+		result->set_value(ret);
+		camera->operationCompleted.emit(camera.get(), ret);
+	}));
+
+	return future;
+}
+
+/**
+ * \brief Retrieve the runtime statistics of the camera
+ *
+ * The statistics report the number of requests and buffers processed by the
+ * camera, the frames skipped by the device, and the distribution of the request
+ * queue depth and latency. They are updated by libcamera while the camera
+ * operates, and this method may be called at any time, including while the
+ * camera is running.
+ *
+ * \return A snapshot of the camera statistics
+ */
+CameraStatistics Camera::statistics() const
+{
+	return pipe_->cameraData(this)->stats_.statistics();
+}
+
+/**
+ * \brief Retrieve the memory footprint of the camera buffers
+ *
+ * The memory usage accounts for the buffers of all streams of the camera, as
+ * reported by Stream::memoryUsage(), and for the buffers allocated internally
+ * by the pipeline handler for the camera, such as buffers for intermediate
+ * frames or for ISP parameters and statistics.
+ *
+ * \return The memory usage of the camera
+ */
+MemoryUsage Camera::memoryUsage() const
+{
+	MemoryUsage usage;
+
+	pipe_->invoke([&]() {
+		for (const Stream *stream : streams_)
+			usage += stream->memoryUsage();
+
+		usage += pipe_->memoryUsage(this);
+	});
+
+	return usage;
+}
+
+/**
+ * \brief Handle buffer completion and notify application
+ * \param[in] request The request that the buffer belongs to
+ * \param[in] buffer The buffer that has completed
+ *
+ * This function is called in the camera's thread when the pipeline handler has
+ * completed a buffer. It emits the bufferCompleted signal, except for buffers
+ * cancelled by a stop() call that collects the cancelled requests.
+ */
+void Camera::bufferComplete(Request *request, Buffer *buffer)
+{
+	if (cancelledRequests_ && buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	bufferCompleted.emit(request, buffer);
+}
+
+/**
+ * \brief Notify the application of the partial completion of a buffer
+ * \param[in] request The request that the buffer belongs to
+ * \param[in] buffer The buffer being written
+ * \param[in] lines The number of lines written to the buffer
+ *
+ * This function is called in the camera's thread when the pipeline handler has
+ * written a slice of a frame. It emits the bufferProgressed signal.
+ */
+void Camera::bufferProgress(Request *request, Buffer *buffer, unsigned int lines)
+{
+	bufferProgressed.emit(request, buffer, lines);
+}
+
+/**
+ * \brief Notify the application of the start of a frame
+ * \param[in] sequence The frame sequence number
+ * \param[in] timestamp The time the frame started
+ *
+ * This function is called in the camera's thread when the pipeline handler has
+ * detected the start of a frame. It emits the frameStarted signal. Frames
+ * started before the camera is stopped are notified before stop() returns,
+ * along with the completion of their buffers.
+ */
+void Camera::frameStart(unsigned int sequence, uint64_t timestamp)
+{
+	frameStarted.emit(sequence, timestamp);
+}
+
 /**
  * \brief Handle request completion and notify application
  * \param[in] request The request that has completed
  *
- * This function is called by the pipeline handler to notify the camera that
- * the request has completed. It emits the requestCompleted signal and deletes
- * the request.
+ * This function is called in the camera's thread when the pipeline handler has
+ * completed the request. It calls the request completion handler, or emits
+ * the requestCompleted signal if the request has no handler, and deletes the
+ * request, unless the application has reset it for reuse with
+ * Request::reuse() from the handler. Requests dropped by a FrameDropPolicy
+ * are queued again instead.
  */
 void Camera::requestComplete(Request *request)
 {
+	bool dropped;
+
+	{
+		std::lock_guard<std::mutex> locker(completionMutex_);
+		ASSERT(pendingCompletions_.front() == request);
+		pendingCompletions_.pop_front();
+		dropped = request->dropped_;
+	}
+
+	/*
+	 * Requests dropped by a frame drop policy while pending delivery are
+	 * queued again without being delivered, as long as the camera runs.
+	 */
+	if (dropped && stateIs(CameraRunning) && !request->rearm()) {
+		requestQueued_.emit(this, request);
+		return;
+	}
+
+	request->dropped_ = false;
+
 	for (auto it : request->buffers()) {
 		Stream *stream = it.first;
 		Buffer *buffer = it.second;
-		if (stream->memoryType() == ExternalMemory)
+		if (stream->memoryType() == ExternalMemory &&
+		    !buffer->recycled_)
 			stream->unmapBuffer(buffer);
 	}
 
-	requestCompleted.emit(request, request->buffers());
-	delete request;
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled())
+		tracer->record(Tracer::CompleteRequest, traceSource_, request);
+
+	if (cancelledRequests_ && request->status() == Request::RequestCancelled) {
+		cancelledRequests_->push_back(request);
+		return;
+	}
+
+	completingRequest_ = request;
+	completingRequestQueued_ = false;
+
+	if (request->handler_)
+		request->handler_(request, request->buffers());
+	else
+		requestCompleted.emit(request, request->buffers());
+
+	completingRequest_ = nullptr;
+
+	/*
+	 * A request queued again from the handler belongs to the pipeline
+	 * handler, which may already be completing it, and must not be accessed
+	 * anymore.
+	 */
+	if (completingRequestQueued_)
+		return;
+
+	/*
+	 * Completed requests are marked as pending again if the application
+	 * has reused them, in which case their ownership is the application's.
+	 * Requests retained by a CameraGroup are deleted by the group.
+	 */
+	if (request->status() != Request::RequestPending && !request->retained_)
+		delete request;
+}
+
+/**
+ * \brief Return a buffer whose last Request::holdBuffer() handle is destroyed
+ * \param[in] buffer The held buffer
+ *
+ * This function is called in the camera's thread. It deletes the \a buffer and
+ * passes a new buffer for the same memory to the recycle handler.
+ */
+void Camera::releaseBuffer(Buffer *buffer)
+{
+	std::unique_ptr<Buffer> held(buffer);
+	Stream *stream = buffer->stream();
+
+	if (!recycleHandler_ || disconnected_ ||
+	    !stateBetween(CameraRunning, CameraStandby) ||
+	    !activeStreams_.count(stream))
+		return;
+
+	std::unique_ptr<Buffer> recycled;
+	if (stream->memoryType() == ExternalMemory) {
+		recycled = stream->createBuffer(buffer->dmabufs());
+	} else if (buffer->index() < stream->bufferPool().count()) {
+		recycled = stream->createBuffer(buffer->index());
+	}
+
+	if (recycled)
+		recycleHandler_(std::move(recycled));
 }
 
 } /* namespace libcamera */
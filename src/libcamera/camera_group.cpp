@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * camera_group.cpp - Synchronised capture from multiple cameras
+ */
+
+#include <libcamera/camera_group.h>
+
+#include <algorithm>
+
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+#include "log.h"
+
+/**
+ * \file camera_group.h
+ * \brief Synchronised capture from multiple cameras
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CameraGroup)
+
+/**
+ * \class CameraGroup
+ * \brief Capture frames from multiple cameras as matched sets
+ *
+ * The CameraGroup class groups cameras that capture the same scene, such as
+ * the two cameras of a stereo rig. It starts and stops the cameras together,
+ * and pairs the requests completed by all cameras based on their
+ * SensorTimestamp metadata, to deliver sets of frames captured at the same
+ * time through the \ref framesetCompleted signal.
+ *
+ * The cameras shall be configured, have their buffers allocated and requests
+ * queued individually. Once started, applications shall handle completed
+ * requests through the framesetCompleted signal instead of the
+ * Camera::requestCompleted signal of the cameras in the group, and shall not
+ * set completion handlers on the requests, as they bypass the group.
+ */
+
+/**
+ * \var CameraGroup::framesetCompleted
+ * \brief Signal emitted when a set of requests has completed
+ *
+ * The signal carries one entry per camera in the group, in the order of
+ * cameras(). Requests whose frames have been captured within the tolerance of
+ * each other are delivered together. Requests that can't be matched, because
+ * they have been cancelled, don't report a timestamp, or have no counterpart
+ * from all the other cameras, are delivered alone, with the entries for the
+ * other cameras set to nullptr.
+ *
+ * Every request completed by the cameras of the group is delivered exactly
+ * once. As for the Camera::requestCompleted signal, the requests are deleted
+ * after the signal handlers return, unless they are reused with
+ * Request::reuse().
+ */
+
+/**
+ * \brief Create a group of cameras
+ * \param[in] cameras The cameras in the group
+ * \param[in] tolerance The maximum difference between the timestamps of
+ * matching frames, in nanoseconds
+ *
+ * The \a tolerance should be smaller than half of the frame duration, to
+ * avoid matching frames captured in different frame periods.
+ */
+CameraGroup::CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras,
+			 uint64_t tolerance)
+	: cameras_(cameras), tolerance_(tolerance), current_(nullptr),
+	  queues_(cameras.size())
+{
+	for (unsigned int i = 0; i < cameras_.size(); ++i) {
+		Camera *camera = cameras_[i].get();
+
+		indices_[camera] = i;
+		camera->requestCompleted.connect(this, &CameraGroup::requestComplete);
+	}
+}
+
+CameraGroup::~CameraGroup()
+{
+	for (const std::shared_ptr<Camera> &camera : cameras_)
+		camera->requestCompleted.disconnect(this, &CameraGroup::requestComplete);
+
+	for (std::deque<Request *> &queue : queues_) {
+		for (Request *request : queue)
+			delete request;
+	}
+}
+
+/**
+ * \fn CameraGroup::cameras()
+ * \brief Retrieve the cameras in the group
+ * \return The cameras in the group
+ */
+
+/**
+ * \fn CameraGroup::tolerance()
+ * \brief Retrieve the maximum difference between timestamps of matching frames
+ * \return The tolerance in nanoseconds
+ */
+
+/**
+ * \brief Start capture on all cameras in the group
+ *
+ * The cameras are started back to back, to minimise the phase difference
+ * between them. If any camera fails to start, the cameras already started are
+ * stopped.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraGroup::start()
+{
+	for (unsigned int i = 0; i < cameras_.size(); ++i) {
+		int ret = cameras_[i]->start();
+		if (ret) {
+			LOG(CameraGroup, Error)
+				<< "Failed to start camera " << cameras_[i]->name();
+
+			while (i--)
+				cameras_[i]->stop();
+			flush();
+
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Stop capture on all cameras in the group
+ *
+ * All pending requests are cancelled, and the requests that wait for a match
+ * are delivered alone before this method returns.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CameraGroup::stop()
+{
+	int result = 0;
+
+	for (const std::shared_ptr<Camera> &camera : cameras_) {
+		int ret = camera->stop();
+		if (ret && !result)
+			result = ret;
+	}
+
+	flush();
+
+	return result;
+}
+
+void CameraGroup::requestComplete(Request *request,
+				  const std::map<Stream *, Buffer *> &buffers)
+{
+	unsigned int index = indices_[request->camera_];
+
+	current_ = request;
+
+	if (request->status() != Request::RequestComplete ||
+	    !request->metadata().contains(SensorTimestamp)) {
+		std::vector<Request *> frameset(cameras_.size(), nullptr);
+		frameset[index] = request;
+		completeFrameset(frameset);
+	} else {
+		/*
+		 * Retain the request beyond the completion handler until it
+		 * gets matched with requests from the other cameras.
+		 */
+		request->retained_ = true;
+		queues_[index].push_back(request);
+		matchRequests();
+	}
+
+	current_ = nullptr;
+}
+
+/*
+ * Deliver all the framesets that can be formed with the queued requests. The
+ * oldest request of each camera is compared to the most recent of them, and
+ * delivered alone if it is too old to match. Requests are also delivered alone
+ * when too many of them are queued for a camera, as happens when the other
+ * cameras stop producing frames.
+ */
+void CameraGroup::matchRequests()
+{
+	while (true) {
+		bool ready = true;
+		bool overflow = false;
+
+		for (unsigned int i = 0; i < queues_.size(); ++i) {
+			if (queues_[i].empty())
+				ready = false;
+			else if (queues_[i].size() > MaxQueuedRequests) {
+				completeRequest(i);
+				overflow = true;
+				break;
+			}
+		}
+
+		if (overflow)
+			continue;
+		if (!ready)
+			return;
+
+		std::vector<uint64_t> timestamps;
+		for (const std::deque<Request *> &queue : queues_)
+			timestamps.push_back(queue.front()->metadata().get(controls::SensorTimestamp));
+
+		uint64_t latest = *std::max_element(timestamps.begin(),
+						    timestamps.end());
+
+		auto iter = std::find_if(timestamps.begin(), timestamps.end(),
+					 [&](uint64_t timestamp) {
+						 return timestamp + tolerance_ < latest;
+					 });
+		if (iter != timestamps.end()) {
+			completeRequest(iter - timestamps.begin());
+			continue;
+		}
+
+		std::vector<Request *> frameset;
+		for (std::deque<Request *> &queue : queues_) {
+			frameset.push_back(queue.front());
+			queue.pop_front();
+		}
+
+		completeFrameset(frameset);
+	}
+}
+
+/*
+ * Emit the framesetCompleted signal and delete the retained requests that
+ * haven't been reused. The request being completed by the camera is left for
+ * the camera to delete.
+ */
+void CameraGroup::completeFrameset(std::vector<Request *> &frameset)
+{
+	framesetCompleted.emit(frameset);
+
+	for (Request *request : frameset) {
+		if (!request || !request->retained_)
+			continue;
+
+		request->retained_ = false;
+		if (request != current_ &&
+		    request->status() != Request::RequestPending)
+			delete request;
+	}
+}
+
+/* Deliver the oldest queued request of camera \a index alone. */
+void CameraGroup::completeRequest(unsigned int index)
+{
+	std::vector<Request *> frameset(cameras_.size(), nullptr);
+	frameset[index] = queues_[index].front();
+	queues_[index].pop_front();
+
+	completeFrameset(frameset);
+}
+
+/* Deliver all queued requests alone. */
+void CameraGroup::flush()
+{
+	for (unsigned int i = 0; i < queues_.size(); ++i) {
+		while (!queues_[i].empty())
+			completeRequest(i);
+	}
+}
+
+} /* namespace libcamera */
@@ -12,8 +12,10 @@
 
 #include "device_enumerator.h"
 #include "event_dispatcher_poll.h"
+#include "ipa_manager.h"
 #include "log.h"
 #include "pipeline_handler.h"
+#include "pipeline_module_manager.h"
 #include "thread.h"
 #include "utils.h"
 
@@ -51,18 +53,36 @@ LOG_DEFINE_CATEGORY(Camera)
  * references it held to cameras, the camera manager can be stopped with
  * stop().
  *
+ * Every pipeline handler runs in its own internal thread, to isolate the
+ * processing of buffer completion from the application and from the other
+ * pipeline handlers. The Camera API shall be used from the thread that started
+ * the camera manager, in which the Camera signals are emitted. The CPU affinity
+ * and scheduling policy of the pipeline handler threads can be configured with
+ * setThreadAffinity() and setThreadScheduling().
+ *
+ * On NUMA systems, the pipeline handler threads are by default restricted to
+ * the CPUs of the NUMA node of the devices they have matched. Memory allocated
+ * by the pipeline handlers, such as buffers allocated by the devices or by the
+ * dmabuf allocator, is then allocated on the node local to the devices, and
+ * processed by CPUs local to the memory.
+ *
  * \todo Add interface to register a notification callback to the user to be
  * able to inform it new cameras have been hot-plugged or cameras have been
  * removed due to hot-unplug.
  */
 
 CameraManager::CameraManager()
-	: enumerator_(nullptr)
+	: thread_(nullptr), threadPolicy_(-1), threadPriority_(0),
+	  enumerator_(nullptr), nextCameraId_(1)
 {
 }
 
 CameraManager::~CameraManager()
 {
+	for (std::unique_ptr<Thread> &thread : threads_) {
+		thread->exit();
+		thread->wait();
+	}
 }
 
 /**
@@ -82,37 +102,139 @@ int CameraManager::start()
 
 	LOG(Camera, Info) << "libcamera " << version_;
 
+	/*
+	 * Start reading the IPA modules from storage in the background, to
+	 * overlap the I/O with device enumeration.
+	 */
+	IPAManager::instance()->prefetch();
+
 	enumerator_ = DeviceEnumerator::create();
 	if (!enumerator_ || enumerator_->enumerate())
 		return -ENODEV;
 
+	thread_ = Thread::current();
+
+	matchPipelines();
+
+	/*
+	 * Match hot-plugged media devices incrementally. Pipeline handlers
+	 * that have already matched keep their devices busy, and the
+	 * enumerator only searches the devices of the requested driver, so
+	 * the work performed for each hot-plug event doesn't grow with the
+	 * number of devices already in use.
+	 */
+	enumerator_->devicesAdded.connect(this, &CameraManager::matchPipelines);
+
+	return 0;
+}
+
+/*
+ * Offer the media devices that are not in use yet to all pipeline handlers,
+ * creating a new pipeline handler instance for every match.
+ */
+void CameraManager::matchPipelines()
+{
+	/*
+	 * Load the pipeline handlers built as modules for the media devices
+	 * that are present, registering their factories.
+	 */
+	PipelineModuleManager::instance()->loadModules(enumerator_.get());
+
 	/*
 	 * TODO: Try to read handlers and order from configuration
 	 * file and only fallback on all handlers if there is no
 	 * configuration file.
 	 */
 	std::vector<PipelineHandlerFactory *> &factories = PipelineHandlerFactory::factories();
+	unsigned int index = pipes_.size();
 
 	for (PipelineHandlerFactory *factory : factories) {
 		/*
 		 * Try each pipeline handler until it exhaust
-		 * all pipelines it can provide.
+		 * all pipelines it can provide. Skip the creation of
+		 * pipeline handlers when none of the available media
+		 * devices match their patterns.
 		 */
-		while (1) {
+		while (factory->mayMatch(enumerator_.get())) {
+			/*
+			 * Match in the pipeline handler thread, for the
+			 * devices, event notifiers and timers it creates to
+			 * be bound to that thread. The threads are kept until
+			 * the manager is destroyed, as pipeline handlers may
+			 * outlive a stop() call.
+			 */
+			if (index == threads_.size())
+				threads_.push_back(utils::make_unique<Thread>());
+
+			Thread *thread = threads_[index].get();
+			configureThread(thread, factory);
+			thread->start();
+
 			std::shared_ptr<PipelineHandler> pipe = factory->create(this);
-			if (!pipe->match(enumerator_.get()))
+			pipe->moveToThread(thread);
+
+			bool matched = false;
+			pipe->invoke([&]() {
+				matched = pipe->match(enumerator_.get());
+			});
+
+			if (!matched) {
+				thread->exit();
+				thread->wait();
 				break;
+			}
+
+			index++;
 
 			LOG(Camera, Debug)
 				<< "Pipeline handler \"" << factory->name()
 				<< "\" matched";
+			placeThread(thread, pipe.get());
 			pipes_.push_back(std::move(pipe));
 		}
 	}
+}
+
+void CameraManager::configureThread(Thread *thread,
+				    PipelineHandlerFactory *factory)
+{
+	/* Name the thread after the pipeline handler, dropping the prefix. */
+	std::string name = factory->name();
+	if (!name.compare(0, 15, "PipelineHandler"))
+		name.erase(0, 15);
+	thread->setName("pipe-" + name);
 
-	/* TODO: register hot-plug callback here */
+	if (thread->setAffinity(threadCpus_))
+		LOG(Camera, Warning) << "Invalid pipeline thread affinity";
 
-	return 0;
+	if (threadPolicy_ != -1 &&
+	    thread->setScheduling(threadPolicy_, threadPriority_))
+		LOG(Camera, Warning) << "Invalid pipeline thread scheduling";
+}
+
+/*
+ * Restrict the thread of a matched pipeline handler to the CPUs of the NUMA
+ * node of its devices, unless the application has set the threads affinity.
+ * The devices and buffers are only allocated after matching, from the thread,
+ * and the default local memory policy then places them on the same node.
+ */
+void CameraManager::placeThread(Thread *thread, const PipelineHandler *pipe)
+{
+	if (!threadCpus_.empty())
+		return;
+
+	int node = pipe->numaNode();
+	if (node < 0)
+		return;
+
+	std::vector<unsigned int> cpus = utils::numa_node_cpus(node);
+	if (cpus.empty() || thread->setAffinity(cpus)) {
+		LOG(Camera, Warning)
+			<< "Failed to place pipeline thread on NUMA node " << node;
+		return;
+	}
+
+	LOG(Camera, Debug) << "Pipeline thread placed on NUMA node " << node;
 }
 
 /**
@@ -127,7 +249,13 @@ int CameraManager::start()
  */
 void CameraManager::stop()
 {
-	/* TODO: unregister hot-plug callback here */
+	if (enumerator_)
+		enumerator_->devicesAdded.disconnect(this);
+
+	for (std::unique_ptr<Thread> &thread : threads_) {
+		thread->exit();
+		thread->wait();
+	}
 
 	/*
 	 * Release all references to cameras and pipeline handlers to ensure
@@ -136,6 +264,8 @@ void CameraManager::stop()
 	 */
 	pipes_.clear();
 	cameras_.clear();
+	camerasByName_.clear();
+	camerasById_.clear();
 
 	enumerator_.reset(nullptr);
 }
@@ -157,16 +287,55 @@ void CameraManager::stop()
  * Before calling this function the caller is responsible for ensuring that
  * the camera manger is running.
  *
+ * Cameras are looked up in constant time. If multiple cameras share the same
+ * name, the first registered camera is returned.
+ *
  * \return Shared pointer to Camera object or nullptr if camera not found
  */
 std::shared_ptr<Camera> CameraManager::get(const std::string &name)
 {
-	for (std::shared_ptr<Camera> camera : cameras_) {
-		if (camera->name() == name)
-			return camera;
-	}
+	auto iter = camerasByName_.find(name);
+	if (iter == camerasByName_.end())
+		return nullptr;
+
+	return iter->second;
+}
+
+/**
+ * \brief Get a camera based on identifier
+ * \param[in] id Identifier of camera to get
+ *
+ * Before calling this function the caller is responsible for ensuring that
+ * the camera manger is running.
+ *
+ * \return Shared pointer to Camera object or nullptr if camera not found
+ * \sa Camera::id()
+ */
+std::shared_ptr<Camera> CameraManager::get(unsigned int id)
+{
+	auto iter = camerasById_.find(id);
+	if (iter == camerasById_.end())
+		return nullptr;
+
+	return iter->second;
+}
+
+/**
+ * \brief Retrieve the memory footprint of the buffers of all cameras
+ *
+ * The memory usage of the process is the sum of the memory usage of all
+ * available cameras, as reported by Camera::memoryUsage().
+ *
+ * \return The memory usage of all cameras
+ */
+MemoryUsage CameraManager::memoryUsage() const
+{
+	MemoryUsage usage;
 
-	return nullptr;
+	for (const std::shared_ptr<Camera> &camera : cameras_)
+		usage += camera->memoryUsage();
+
+	return usage;
 }
 
 /**
@@ -175,18 +344,22 @@ std::shared_ptr<Camera> CameraManager::get(const std::string &name)
  *
  * This function is called by pipeline handlers to register the cameras they
  * handle with the camera manager. Registered cameras are immediately made
- * available to the system.
+ * available to the system, and are bound to the thread that started the
+ * manager. Each camera is assigned a new identifier.
  */
 void CameraManager::addCamera(std::shared_ptr<Camera> camera)
 {
-	for (std::shared_ptr<Camera> c : cameras_) {
-		if (c->name() == camera->name()) {
-			LOG(Camera, Warning)
-				<< "Registering camera with duplicate name '"
-				<< camera->name() << "'";
-			break;
-		}
-	}
+	if (thread_ && camera->thread() == Thread::current())
+		camera->moveToThread(thread_);
+
+	auto result = camerasByName_.emplace(camera->name(), camera);
+	if (!result.second)
+		LOG(Camera, Warning)
+			<< "Registering camera with duplicate name '"
+			<< camera->name() << "'";
+
+	camera->id_ = nextCameraId_++;
+	camerasById_[camera->id_] = camera;
 
 	cameras_.push_back(std::move(camera));
 }
@@ -201,13 +374,30 @@ void CameraManager::addCamera(std::shared_ptr<Camera> camera)
  */
 void CameraManager::removeCamera(Camera *camera)
 {
+	if (!camerasById_.erase(camera->id()))
+		return;
+
 	for (auto iter = cameras_.begin(); iter != cameras_.end(); ++iter) {
 		if (iter->get() == camera) {
 			LOG(Camera, Debug)
 				<< "Unregistering camera '"
 				<< camera->name() << "'";
 			cameras_.erase(iter);
-			return;
+			break;
+		}
+	}
+
+	auto byName = camerasByName_.find(camera->name());
+	if (byName == camerasByName_.end() || byName->second.get() != camera)
+		return;
+
+	camerasByName_.erase(byName);
+
+	/* Expose the next camera with a duplicate name, if any. */
+	for (const std::shared_ptr<Camera> &c : cameras_) {
+		if (c->name() == camera->name()) {
+			camerasByName_[c->name()] = c;
+			break;
 		}
 	}
 }
@@ -241,7 +431,7 @@ CameraManager *CameraManager::instance()
  * timers with the application event loop. Applications that want to provide
  * their own event dispatcher shall call this function once and only once before
  * the camera manager is started with start(). If no event dispatcher is
- * provided, a default poll-based implementation will be used.
+ * provided, a default epoll-based implementation will be used.
  *
  * The CameraManager takes ownership of the event dispatcher and will delete it
  * when the application terminates.
@@ -255,8 +445,8 @@ void CameraManager::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatch
  * \brief Retrieve the event dispatcher
  *
  * This function retrieves the event dispatcher set with setEventDispatcher().
- * If no dispatcher has been set, a default poll-based implementation is created
- * and returned, and no custom event dispatcher may be installed anymore.
+ * If no dispatcher has been set, a default epoll-based implementation is
+ * created and returned, and no custom event dispatcher may be installed anymore.
  *
  * The returned event dispatcher is valid until the camera manager is destroyed.
  *
@@ -267,4 +457,46 @@ EventDispatcher *CameraManager::eventDispatcher()
 	return Thread::current()->eventDispatcher();
 }
 
+/**
+ * \brief Set the CPU affinity of the pipeline handler threads
+ * \param[in] cpus The CPUs the threads are allowed to run on
+ *
+ * This function restricts the internal threads that run the pipeline handlers
+ * to the \a cpus, identified by their index, for instance to isolate them on
+ * dedicated cores. Threads created by the pipeline handlers, such as IPA
+ * threads, inherit the affinity. An empty list leaves the affinity unchanged.
+ *
+ * Setting the affinity disables the default placement of the threads on the
+ * NUMA node of the devices of their pipeline handler.
+ *
+ * This function shall be called before the camera manager is started with
+ * start().
+ */
+void CameraManager::setThreadAffinity(const std::vector<unsigned int> &cpus)
+{
+	threadCpus_ = cpus;
+}
+
+/**
+ * \brief Set the scheduling policy of the pipeline handler threads
+ * \param[in] policy The scheduling policy (SCHED_OTHER, SCHED_FIFO or
+ * SCHED_RR)
+ * \param[in] priority The static priority, in the range supported by the
+ * \a policy
+ *
+ * This function sets the scheduling policy and priority of the internal
+ * threads that run the pipeline handlers, for instance to prevent them from
+ * being preempted by batch jobs with a real-time policy. Threads created by the
+ * pipeline handlers inherit the policy. Invalid values and insufficient
+ * privileges are reported in the log when the threads are started.
+ *
+ * This function shall be called before the camera manager is started with
+ * start().
+ */
+void CameraManager::setThreadScheduling(int policy, int priority)
+{
+	threadPolicy_ = policy;
+	threadPriority_ = priority;
+}
+
 } /* namespace libcamera */
@@ -10,7 +10,6 @@
 #include <algorithm>
 #include <float.h>
 #include <iomanip>
-#include <limits.h>
 #include <math.h>
 
 #include "formats.h"
@@ -25,6 +24,24 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(CameraSensor);
 
+namespace {
+
+/*
+ * Number of frames after which sensors apply the controls written to them. The
+ * values match the common behaviour of sensors that latch the exposure time and
+ * vertical blanking at the start of a frame and apply them to the next frame,
+ * and apply the analogue gain directly to the next frame.
+ *
+ * \todo Retrieve the delays from a per-sensor database
+ */
+const std::map<unsigned int, unsigned int> defaultControlDelays = {
+	{ V4L2_CID_EXPOSURE, 2 },
+	{ V4L2_CID_ANALOGUE_GAIN, 1 },
+	{ V4L2_CID_VBLANK, 2 },
+};
+
+} /* namespace */
+
 /**
  * \class CameraSensor
  * \brief A camera sensor based on V4L2 subdevices
@@ -34,9 +51,16 @@ LOG_DEFINE_CATEGORY(CameraSensor);
  * information.
  *
  * The implementation is currently limited to sensors that expose a single V4L2
- * subdevice with a single pad, and support the same frame sizes for all
- * supported media bus codes. It will be extended to support more complex
+ * subdevice with one or two source pads, and support the same frame sizes for
+ * all supported media bus codes. It will be extended to support more complex
  * devices as the needs arise.
+ *
+ * The first source pad outputs the image data. The second source pad, when
+ * present, outputs the embedded data that some sensors transmit along with
+ * every frame, typically on a separate CSI-2 data type or virtual channel.
+ * Embedded data carries the sensor state the frame has been captured with,
+ * such as the exposure time and gain, and is exposed through
+ * embeddedDataFormat() and setEmbeddedDataFormat().
  */
 
 /**
@@ -46,7 +70,7 @@ LOG_DEFINE_CATEGORY(CameraSensor);
  * Once constructed the instance must be initialized with init().
  */
 CameraSensor::CameraSensor(const MediaEntity *entity)
-	: entity_(entity)
+	: entity_(entity), imagePad_(0), embeddedPad_(0), embeddedCode_(0)
 {
 	subdev_ = new V4L2Subdevice(entity);
 }
@@ -71,12 +95,24 @@ int CameraSensor::init()
 {
 	int ret;
 
-	if (entity_->pads().size() != 1) {
+	const std::vector<MediaPad *> &pads = entity_->pads();
+	if (pads.empty() || pads.size() > 2) {
 		LOG(CameraSensor, Error)
-			<< "Sensors with more than one pad are not supported";
+			<< "Sensors with " << pads.size()
+			<< " pads are not supported";
 		return -EINVAL;
 	}
 
+	for (const MediaPad *pad : pads) {
+		if (!(pad->flags() & MEDIA_PAD_FL_SOURCE)) {
+			LOG(CameraSensor, Error)
+				<< "Sensors with sink pads are not supported";
+			return -EINVAL;
+		}
+	}
+
+	imagePad_ = pads[0]->index();
+
 	if (entity_->function() != MEDIA_ENT_F_CAM_SENSOR) {
 		LOG(CameraSensor, Error)
 			<< "Invalid sensor function 0x"
@@ -90,7 +126,7 @@ int CameraSensor::init()
 		return ret;
 
 	/* Enumerate and cache media bus codes and sizes. */
-	const ImageFormats formats = subdev_->formats(0);
+	const ImageFormats formats = subdev_->formats(imagePad_);
 	if (formats.isEmpty()) {
 		LOG(CameraSensor, Error) << "No image format found";
 		return -EINVAL;
@@ -119,6 +155,60 @@ int CameraSensor::init()
 	std::sort(mbusCodes_.begin(), mbusCodes_.end());
 	std::sort(sizes_.begin(), sizes_.end());
 
+	/*
+	 * Precompute the modes table used by getFormat(), sorted by increasing
+	 * area to visit the modes with the lowest readout bandwidth first.
+	 */
+	for (const Size &size : sizes_)
+		modes_.push_back({ size, size.width * size.height,
+				   static_cast<float>(size.width) / size.height });
+
+	std::stable_sort(modes_.begin(), modes_.end(),
+			 [](const Mode &a, const Mode &b) {
+				 return a.area < b.area;
+			 });
+
+	if (pads.size() > 1) {
+		embeddedPad_ = pads[1]->index();
+
+		ret = initEmbeddedData();
+		if (ret)
+			return ret;
+	}
+
+	const V4L2ControlInfoMap &infos = controls();
+	for (const auto &delay : defaultControlDelays) {
+		if (infos.find(delay.first) != infos.end())
+			controlDelays_.insert(delay);
+	}
+
+	return 0;
+}
+
+/*
+ * Select the embedded data format from the formats supported by the embedded
+ * data pad. Sensors report a single format in practice, with the size of the
+ * embedded data lines.
+ */
+int CameraSensor::initEmbeddedData()
+{
+	const ImageFormats formats = subdev_->formats(embeddedPad_);
+	if (formats.isEmpty()) {
+		LOG(CameraSensor, Error) << "No embedded data format found";
+		return -EINVAL;
+	}
+
+	embeddedCode_ = formats.formats()[0];
+
+	for (const SizeRange &range : formats.sizes(embeddedCode_)) {
+		if (range.max > embeddedSize_)
+			embeddedSize_ = range.max;
+	}
+
+	LOG(CameraSensor, Debug)
+		<< "Embedded data on pad " << embeddedPad_ << ": "
+		<< embeddedDataFormat().toString();
+
 	return 0;
 }
 
@@ -128,6 +218,12 @@ int CameraSensor::init()
  * \return The sensor media entity
  */
 
+/**
+ * \fn CameraSensor::device()
+ * \brief Retrieve the sensor V4L2 subdevice
+ * \return The sensor V4L2 subdevice
+ */
+
 /**
  * \fn CameraSensor::mbusCodes()
  * \brief Retrieve the media bus codes supported by the camera sensor
@@ -174,6 +270,11 @@ const Size &CameraSensor::resolution() const
  * - The sensor output size shall be as small as possible to lower the required
  *   bandwidth.
  *
+ * The sizes are looked up in a table of sensor modes computed at
+ * initialisation time and sorted by increasing area. The search stops at the
+ * first mode that matches the desired aspect ratio exactly, as no larger mode
+ * can be a better match.
+ *
  * The use of this method is optional, as the above criteria may not match the
  * needs of all pipeline handlers. Pipeline handlers may implement custom
  * sensor format selection when needed.
@@ -190,8 +291,8 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 	V4L2SubdeviceFormat format{};
 
 	for (unsigned int code : mbusCodes) {
-		if (std::any_of(mbusCodes_.begin(), mbusCodes_.end(),
-				[code](unsigned int c) { return c == code; })) {
+		if (std::binary_search(mbusCodes_.begin(), mbusCodes_.end(),
+				       code)) {
 			format.mbus_code = code;
 			break;
 		}
@@ -202,29 +303,28 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 		return format;
 	}
 
-	unsigned int desiredArea = size.width * size.height;
-	unsigned int bestArea = UINT_MAX;
 	float desiredRatio = static_cast<float>(size.width) / size.height;
 	float bestRatio = FLT_MAX;
 	const Size *bestSize = nullptr;
 
-	for (const Size &sz : sizes_) {
-		if (sz.width < size.width || sz.height < size.height)
+	for (const Mode &mode : modes_) {
+		if (mode.size.width < size.width ||
+		    mode.size.height < size.height)
 			continue;
 
-		float ratio = static_cast<float>(sz.width) / sz.height;
-		float ratioDiff = fabsf(ratio - desiredRatio);
-		unsigned int area = sz.width * sz.height;
-		unsigned int areaDiff = area - desiredArea;
-
-		if (ratioDiff > bestRatio)
+		/*
+		 * Modes are visited by increasing area, only a strictly better
+		 * aspect ratio match can justify a larger mode.
+		 */
+		float ratioDiff = fabsf(mode.ratio - desiredRatio);
+		if (ratioDiff >= bestRatio)
 			continue;
 
-		if (ratioDiff < bestRatio || areaDiff < bestArea) {
-			bestRatio = ratioDiff;
-			bestArea = areaDiff;
-			bestSize = &sz;
-		}
+		bestRatio = ratioDiff;
+		bestSize = &mode.size;
+
+		if (ratioDiff == 0.0f)
+			break;
 	}
 
 	if (!bestSize) {
@@ -244,7 +344,49 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
  */
 int CameraSensor::setFormat(V4L2SubdeviceFormat *format)
 {
-	return subdev_->setFormat(0, format);
+	return subdev_->setFormat(imagePad_, format);
+}
+
+/**
+ * \fn CameraSensor::hasEmbeddedData()
+ * \brief Check if the sensor outputs embedded data
+ * \return True if the sensor has an embedded data pad, false otherwise
+ */
+
+/**
+ * \brief Retrieve the default embedded data format
+ *
+ * The default embedded data format uses the first media bus code supported on
+ * the embedded data pad, with the largest supported size.
+ *
+ * \return The default embedded data format, or an empty format if the sensor
+ * doesn't output embedded data
+ */
+V4L2SubdeviceFormat CameraSensor::embeddedDataFormat() const
+{
+	V4L2SubdeviceFormat format{};
+
+	format.mbus_code = embeddedCode_;
+	format.size = embeddedSize_;
+
+	return format;
+}
+
+/**
+ * \brief Set the embedded data output format
+ * \param[inout] format The desired embedded data format
+ *
+ * The format actually applied by the sensor is returned in \a format.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The sensor doesn't output embedded data
+ */
+int CameraSensor::setEmbeddedDataFormat(V4L2SubdeviceFormat *format)
+{
+	if (!hasEmbeddedData())
+		return -ENODEV;
+
+	return subdev_->setFormat(embeddedPad_, format);
 }
 
 /**
@@ -259,14 +401,21 @@ const V4L2ControlInfoMap &CameraSensor::controls() const
 /**
  * \brief Read controls from the sensor
  * \param[inout] ctrls The list of controls to read
+ * \param[in] refresh Read all controls from the sensor, bypassing the cache
  *
  * This method reads the value of all controls contained in \a ctrls, and stores
  * their values in the corresponding \a ctrls entry.
  *
+ * As all control writes go through setControls(), the value of the sensor
+ * controls, such as the exposure time and the analogue gain, is known without
+ * reading it from the sensor. Those values are retrieved from the control cache
+ * of the sensor subdevice, and only volatile controls are read from the sensor,
+ * unless \a refresh is true.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
- * has the V4L2_CTRL_FLAG_DISABLED flag set), is a compound control, or if any
- * other error occurs during validation of the requested controls, no control is
- * read and this method returns -EINVAL.
+ * has the V4L2_CTRL_FLAG_DISABLED flag set), or if any other error occurs
+ * during validation of the requested controls, no control is read and this
+ * method returns -EINVAL.
  *
  * If an error occurs while reading the controls, the index of the first control
  * that couldn't be read is returned. The value of all controls below that index
@@ -279,14 +428,15 @@ const V4L2ControlInfoMap &CameraSensor::controls() const
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int CameraSensor::getControls(V4L2ControlList *ctrls)
+int CameraSensor::getControls(V4L2ControlList *ctrls, bool refresh)
 {
-	return subdev_->getControls(ctrls);
+	return subdev_->getControls(ctrls, refresh);
 }
 
 /**
  * \brief Write controls to the sensor
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to bind the controls to
  *
  * This method writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
@@ -303,15 +453,193 @@ int CameraSensor::getControls(V4L2ControlList *ctrls)
  * are written and their values are updated in \a ctrls, while all other
  * controls are not written and their values are not changed.
  *
+ * If a \a request is specified, the controls are stored in the request and
+ * applied when the request is queued.
+ *
  * \sa V4L2Device::setControls()
  *
  * \return 0 on success or an error code otherwise
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int CameraSensor::setControls(V4L2ControlList *ctrls)
+int CameraSensor::setControls(V4L2ControlList *ctrls, MediaRequest *request)
+{
+	return subdev_->setControls(ctrls, request);
+}
+
+/**
+ * \brief Prepare a set of sensor controls for repeated writes
+ * \param[out] ctrls The prepared controls
+ * \param[in] ids The IDs of the controls
+ *
+ * This method prepares \a ctrls to write the controls identified by \a ids to
+ * the sensor. It is meant for controls written for every frame, and avoids
+ * the overhead of setControls() by preparing the controls once.
+ *
+ * \sa V4L2PreparedControls::prepare()
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL One of the control is not supported by the sensor
+ */
+int CameraSensor::prepareControls(V4L2PreparedControls *ctrls,
+				  const std::vector<unsigned int> &ids)
+{
+	return ctrls->prepare(subdev_, ids);
+}
+
+/**
+ * \fn CameraSensor::controlDelays()
+ * \brief Retrieve the delays of the sensor controls
+ *
+ * The delay of a control is the number of frames between the frame during
+ * which the control is written and the first frame it applies to. Only the
+ * controls supported by the sensor whose delay is known are reported, and are
+ * meant to be written through a DelayedControls instance.
+ *
+ * \return A map of control delays in frames, indexed by V4L2 control ID
+ */
+
+/**
+ * \brief Retrieve the range of frame durations for the current format
+ * \param[out] min The minimum frame duration in nanoseconds
+ * \param[out] max The maximum frame duration in nanoseconds
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support frame duration control
+ */
+int CameraSensor::frameDurationLimits(uint64_t *min, uint64_t *max)
+{
+	Size size;
+	uint64_t lineLength;
+	uint64_t pixelRate;
+
+	int ret = frameTiming(&size, &lineLength, &pixelRate);
+	if (ret)
+		return ret;
+
+	const V4L2ControlInfo &vblank = controls().at(V4L2_CID_VBLANK);
+	*min = (size.height + vblank.min()) * lineLength * 1000000000ULL
+	     / pixelRate;
+	*max = (size.height + vblank.max()) * lineLength * 1000000000ULL
+	     / pixelRate;
+
+	return 0;
+}
+
+/**
+ * \brief Set the frame duration
+ * \param[inout] duration The frame duration in nanoseconds
+ *
+ * Set the duration of the frames output by the sensor by adjusting the
+ * vertical blanking for the current format. The duration is clamped to the
+ * range supported by the sensor, and the duration actually applied is
+ * returned in \a duration.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support frame duration control
+ */
+int CameraSensor::setFrameDuration(uint64_t *duration)
 {
-	return subdev_->setControls(ctrls);
+	int64_t vblank;
+
+	int ret = frameDurationToVblank(*duration, &vblank);
+	if (ret)
+		return ret;
+
+	V4L2ControlList ctrls;
+	ctrls.add(V4L2_CID_VBLANK, vblank);
+	ret = subdev_->setControls(&ctrls);
+	if (ret)
+		return ret < 0 ? ret : -EINVAL;
+
+	return vblankToFrameDuration(ctrls.getByIndex(0)->value(), duration);
+}
+
+/**
+ * \brief Compute the vertical blanking for a frame duration
+ * \param[in] duration The frame duration in nanoseconds
+ * \param[out] vblank The V4L2_CID_VBLANK control value
+ *
+ * This method computes the vertical blanking that setFrameDuration() would
+ * write for \a duration with the current format, without writing it, for the
+ * control to be applied with a frame delay.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support frame duration control
+ */
+int CameraSensor::frameDurationToVblank(uint64_t duration, int64_t *vblank)
+{
+	Size size;
+	uint64_t lineLength;
+	uint64_t pixelRate;
+
+	int ret = frameTiming(&size, &lineLength, &pixelRate);
+	if (ret)
+		return ret;
+
+	const V4L2ControlInfo &info = controls().at(V4L2_CID_VBLANK);
+	int64_t lines = duration * pixelRate / lineLength / 1000000000ULL;
+	*vblank = std::max(info.min(), std::min(info.max(), lines - size.height));
+
+	return 0;
+}
+
+/**
+ * \brief Compute the frame duration for a vertical blanking
+ * \param[in] vblank The V4L2_CID_VBLANK control value
+ * \param[out] duration The frame duration in nanoseconds
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The sensor doesn't support frame duration control
+ */
+int CameraSensor::vblankToFrameDuration(int64_t vblank, uint64_t *duration)
+{
+	Size size;
+	uint64_t lineLength;
+	uint64_t pixelRate;
+
+	int ret = frameTiming(&size, &lineLength, &pixelRate);
+	if (ret)
+		return ret;
+
+	*duration = (size.height + vblank) * lineLength * 1000000000ULL
+		  / pixelRate;
+
+	return 0;
+}
+
+/*
+ * Retrieve the output size, the line length including horizontal blanking and
+ * the pixel rate, that define the frame timings of the sensor.
+ */
+int CameraSensor::frameTiming(Size *size, uint64_t *lineLength,
+			      uint64_t *pixelRate)
+{
+	const V4L2ControlInfoMap &infos = controls();
+	if (infos.find(V4L2_CID_VBLANK) == infos.end() ||
+	    infos.find(V4L2_CID_HBLANK) == infos.end() ||
+	    infos.find(V4L2_CID_PIXEL_RATE) == infos.end())
+		return -ENOTSUP;
+
+	V4L2SubdeviceFormat format;
+	int ret = subdev_->getFormat(imagePad_, &format);
+	if (ret)
+		return ret;
+
+	V4L2ControlList ctrls;
+	ctrls.add(V4L2_CID_HBLANK);
+	ctrls.add(V4L2_CID_PIXEL_RATE);
+	ret = subdev_->getControls(&ctrls);
+	if (ret)
+		return ret < 0 ? ret : -EINVAL;
+
+	*size = format.size;
+	*lineLength = format.size.width + ctrls.getByIndex(0)->value();
+	*pixelRate = ctrls.getByIndex(1)->value();
+	if (!*pixelRate || !*lineLength)
+		return -ENOTSUP;
+
+	return 0;
 }
 
 std::string CameraSensor::logPrefix() const
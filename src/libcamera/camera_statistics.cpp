@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * camera_statistics.cpp - Camera runtime statistics
+ */
+
+#include <libcamera/camera_statistics.h>
+
+#include <algorithm>
+#include <sstream>
+
+/**
+ * \file camera_statistics.h
+ * \brief Camera runtime statistics
+ */
+
+namespace libcamera {
+
+/**
+ * \class Histogram
+ * \brief A histogram with power-of-two buckets
+ *
+ * The Histogram class stores the distribution of a set of unsigned integer
+ * values in BucketCount buckets. Bucket 0 counts the values equal to 0, and
+ * bucket n counts the values in the [2^(n-1), 2^n[ range. Power-of-two buckets
+ * cover a large dynamic range with a fixed and small number of buckets, and
+ * are cheap to compute on the hot path.
+ */
+
+/**
+ * \var Histogram::BucketCount
+ * \brief The number of buckets in the histogram
+ */
+
+/**
+ * \brief Construct an empty histogram
+ */
+Histogram::Histogram()
+	: counts_(BucketCount, 0)
+{
+}
+
+/**
+ * \brief Construct a histogram from bucket counts
+ * \param[in] counts The number of values in each bucket
+ *
+ * The \a counts are truncated or padded with zeros to BucketCount buckets.
+ */
+Histogram::Histogram(const std::vector<uint64_t> &counts)
+	: counts_(counts)
+{
+	counts_.resize(BucketCount, 0);
+}
+
+/**
+ * \brief Compute the bucket a value belongs to
+ * \param[in] value The value
+ * \return The index of the bucket that counts \a value
+ */
+unsigned int Histogram::bucket(uint64_t value)
+{
+	if (!value)
+		return 0;
+
+	unsigned int bucket = 64 - __builtin_clzll(value);
+	return bucket < BucketCount ? bucket : BucketCount - 1;
+}
+
+/**
+ * \brief Retrieve the smallest value counted in a bucket
+ * \param[in] bucket The bucket index
+ * \return The lower bound of the \a bucket
+ */
+uint64_t Histogram::lowerBound(unsigned int bucket)
+{
+	return bucket ? 1ULL << (bucket - 1) : 0;
+}
+
+/**
+ * \fn Histogram::counts()
+ * \brief Retrieve the number of values in each bucket
+ * \return The bucket counts
+ */
+
+/**
+ * \brief Retrieve the total number of values in the histogram
+ * \return The sum of all bucket counts
+ */
+uint64_t Histogram::total() const
+{
+	uint64_t total = 0;
+
+	for (uint64_t count : counts_)
+		total += count;
+
+	return total;
+}
+
+/**
+ * \brief Estimate a percentile of the values in the histogram
+ * \param[in] percent The percentile, between 0 and 100
+ *
+ * The percentile is estimated with the bucket granularity, by returning the
+ * upper bound of the bucket that contains the percentile.
+ *
+ * \return The upper bound of the values below the \a percent percentile, or 0
+ * if the histogram is empty
+ */
+uint64_t Histogram::percentile(unsigned int percent) const
+{
+	uint64_t total = Histogram::total();
+	if (!total)
+		return 0;
+
+	uint64_t target = (total * std::min(percent, 100U) + 99) / 100;
+	uint64_t count = 0;
+
+	for (unsigned int i = 0; i < BucketCount; ++i) {
+		count += counts_[i];
+		if (count >= target && count)
+			return i + 1 < BucketCount ? lowerBound(i + 1) - 1 : UINT64_MAX;
+	}
+
+	return UINT64_MAX;
+}
+
+/**
+ * \brief Assemble and return a string describing the histogram
+ *
+ * Only the non-empty buckets are listed, with their lower bound and count.
+ *
+ * \return A string describing the Histogram
+ */
+const std::string Histogram::toString() const
+{
+	std::stringstream ss;
+	bool first = true;
+
+	for (unsigned int i = 0; i < BucketCount; ++i) {
+		if (!counts_[i])
+			continue;
+
+		if (!first)
+			ss << " ";
+		first = false;
+
+		ss << ">=" << lowerBound(i) << ":" << counts_[i];
+	}
+
+	return ss.str();
+}
+
+/**
+ * \struct CameraStatistics
+ * \brief Runtime statistics of a camera
+ *
+ * The CameraStatistics structure stores a snapshot of the counters and
+ * histograms updated by libcamera while a camera operates. It is retrieved
+ * with Camera::statistics(). The statistics accumulate from the creation of
+ * the camera.
+ */
+
+/**
+ * \brief Construct zeroed statistics
+ */
+CameraStatistics::CameraStatistics()
+	: requestsQueued(0), requestsCompleted(0), requestsCancelled(0),
+	  buffersCompleted(0), framesDropped(0), requestsDropped(0)
+{
+}
+
+/**
+ * \var CameraStatistics::requestsQueued
+ * \brief The number of requests queued to the pipeline handler
+ */
+
+/**
+ * \var CameraStatistics::requestsCompleted
+ * \brief The number of requests completed successfully
+ */
+
+/**
+ * \var CameraStatistics::requestsCancelled
+ * \brief The number of requests completed in a cancelled state
+ */
+
+/**
+ * \var CameraStatistics::buffersCompleted
+ * \brief The number of buffers completed successfully
+ */
+
+/**
+ * \var CameraStatistics::framesDropped
+ * \brief The number of frames skipped by the device
+ *
+ * Skipped frames are detected by gaps in the sequence numbers of the buffers
+ * completed for each stream.
+ */
+
+/**
+ * \var CameraStatistics::requestsDropped
+ * \brief The number of completed requests dropped by a FrameDropPolicy
+ *
+ * Dropped requests are queued again to the camera without being delivered to
+ * the application, and are also counted in requestsCompleted.
+ */
+
+/**
+ * \var CameraStatistics::queueDepth
+ * \brief The distribution of the number of requests in the pipeline handler
+ *
+ * The depth is sampled every time a request is queued to the pipeline handler,
+ * and includes the request being queued.
+ */
+
+/**
+ * \var CameraStatistics::requestLatency
+ * \brief The distribution of the time requests spend in the pipeline handler
+ *
+ * The latency is measured in microseconds, from the time the request is
+ * queued to the pipeline handler until it is completed.
+ */
+
+/**
+ * \var CameraStatistics::startLatency
+ * \brief The distribution of the time spent starting the camera
+ *
+ * The latency is measured in microseconds, for every Camera::start() call,
+ * and covers the pipeline handler start operation, including the
+ * configuration of the devices and the start of the video streams.
+ */
+
+/**
+ * \var CameraStatistics::firstFrameLatency
+ * \brief The distribution of the time to the first frame of each stream
+ *
+ * The latency is measured in microseconds, from the time the camera starts
+ * until the first buffer of each stream completes successfully. It includes
+ * the start latency, the time the application takes to queue requests, and
+ * the time the device takes to capture the first frame. The metrics registry
+ * reports the time to the first frame for each stream separately.
+ */
+
+/**
+ * \brief Assemble and return a string describing the statistics
+ * \return A string describing the CameraStatistics
+ */
+const std::string CameraStatistics::toString() const
+{
+	std::stringstream ss;
+
+	ss << "requests: " << requestsQueued << " queued, "
+	   << requestsCompleted << " completed, "
+	   << requestsCancelled << " cancelled, "
+	   << requestsDropped << " dropped" << std::endl
+	   << "buffers: " << buffersCompleted << " completed, "
+	   << framesDropped << " frames dropped" << std::endl
+	   << "queue depth: " << queueDepth.toString() << std::endl
+	   << "request latency (us): p50 " << requestLatency.percentile(50)
+	   << " p99 " << requestLatency.percentile(99) << " - "
+	   << requestLatency.toString() << std::endl
+	   << "start latency (us): p50 " << startLatency.percentile(50)
+	   << " - " << startLatency.toString() << std::endl
+	   << "first frame latency (us): p50 "
+	   << firstFrameLatency.percentile(50) << " - "
+	   << firstFrameLatency.toString();
+
+	return ss.str();
+}
+
+} /* namespace libcamera */
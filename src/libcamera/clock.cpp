@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * clock.cpp - Timestamp clock domains
+ */
+
+#include <libcamera/clock.h>
+
+#include <time.h>
+
+/**
+ * \file clock.h
+ * \brief Timestamp clock domains and conversion between them
+ */
+
+namespace libcamera {
+
+/**
+ * \enum ClockId
+ * \brief Identify the clock a timestamp is expressed in
+ * \var ClockUnknown
+ * The clock is unknown, the timestamp can't be compared with other clocks
+ * \var ClockMonotonic
+ * The CLOCK_MONOTONIC clock, which doesn't count time spent in suspend
+ * \var ClockBoottime
+ * The CLOCK_BOOTTIME clock, which includes time spent in suspend
+ * \var ClockRealtime
+ * The CLOCK_REALTIME wall clock, which can jump when the system time is set
+ */
+
+namespace {
+
+uint64_t readClock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Sample the offset between \a clock and CLOCK_MONOTONIC. The clock is read
+ * between two reads of the monotonic clock, and the offset computed against
+ * their midpoint to minimise the error.
+ */
+int64_t sampleOffset(clockid_t clock)
+{
+	uint64_t before = readClock(CLOCK_MONOTONIC);
+	uint64_t time = readClock(clock);
+	uint64_t after = readClock(CLOCK_MONOTONIC);
+
+	return time - (before + (after - before) / 2);
+}
+
+} /* namespace */
+
+/**
+ * \class ClockConverter
+ * \brief Convert timestamps between clock domains
+ *
+ * Buffer timestamps are expressed in the clock reported by Buffer::clock(),
+ * usually CLOCK_MONOTONIC. The ClockConverter class converts them to other
+ * clocks, in order to synchronise frames with other sources of events, or
+ * to synchronise cameras whose timestamps are expressed in different clocks.
+ *
+ * The offsets between clocks are sampled by update(), and convert() only
+ * performs arithmetic on the sampled offsets, without any system call. The
+ * offset between CLOCK_MONOTONIC and CLOCK_BOOTTIME only changes when the
+ * system resumes from suspend, while the offset to CLOCK_REALTIME changes when
+ * the system time is set or adjusted. Applications shall call update() after
+ * such events, or periodically when they need to track clock adjustments.
+ */
+
+/**
+ * \brief Construct a ClockConverter and sample the clock offsets
+ */
+ClockConverter::ClockConverter()
+{
+	update();
+}
+
+/**
+ * \brief Sample the offsets between the clocks
+ */
+void ClockConverter::update()
+{
+	offsets_[ClockUnknown] = 0;
+	offsets_[ClockMonotonic] = 0;
+	offsets_[ClockBoottime] = sampleOffset(CLOCK_BOOTTIME);
+	offsets_[ClockRealtime] = sampleOffset(CLOCK_REALTIME);
+}
+
+/**
+ * \brief Convert a timestamp between clocks
+ * \param[in] timestamp The timestamp in nanoseconds
+ * \param[in] from The clock \a timestamp is expressed in
+ * \param[in] to The clock to convert \a timestamp to
+ *
+ * The conversion uses the offsets sampled by the last call to update().
+ *
+ * \return The timestamp in nanoseconds expressed in the \a to clock, or 0 if
+ * \a timestamp is 0 or either clock is unknown
+ */
+uint64_t ClockConverter::convert(uint64_t timestamp, ClockId from,
+				 ClockId to) const
+{
+	if (!timestamp || from == ClockUnknown || to == ClockUnknown)
+		return 0;
+
+	return timestamp - offsets_[from] + offsets_[to];
+}
+
+} /* namespace libcamera */
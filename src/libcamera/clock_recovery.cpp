@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * clock_recovery.cpp - Frame timestamp jitter filtering
+ */
+
+#include "clock_recovery.h"
+
+#include <cmath>
+
+#include "log.h"
+
+/**
+ * \file clock_recovery.h
+ * \brief Frame timestamp jitter filtering
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(ClockRecovery)
+
+/**
+ * \class ClockRecovery
+ * \brief Recover a smooth frame clock from jittery frame timestamps
+ *
+ * Frame timestamps computed on the host, for instance when a USB device's
+ * frames are timestamped as their transfer completes, jitter with the bus and
+ * system scheduling, while the device captures frames at a steady rate.
+ * Consumers that synchronise frames with other media then need deep jitter
+ * buffers to absorb the noise.
+ *
+ * The ClockRecovery class estimates the device frame clock with a linear least
+ * squares fit of the timestamps against the frame sequence numbers over a
+ * sliding window of frames, and replaces each timestamp with the value of the
+ * fit for its sequence number. Sequence gaps caused by dropped frames are
+ * accounted for naturally. The recovered timestamps are strictly increasing.
+ *
+ * The estimation restarts when a timestamp deviates from the fit by more than
+ * half a frame period, which happens when the frame rate changes, and when the
+ * sequence numbers don't increase. Timestamps are returned unmodified until
+ * enough frames have been received to estimate the clock.
+ */
+
+/**
+ * \brief Construct a ClockRecovery instance
+ * \param[in] window The number of frames the clock is estimated over
+ */
+ClockRecovery::ClockRecovery(unsigned int window)
+	: window_(window > MinSamples ? window : MinSamples), firstSequence_(0),
+	  firstTimestamp_(0), lastOutput_(0), period_(0)
+{
+}
+
+/**
+ * \brief Reset the clock estimation
+ *
+ * Pipeline handlers shall reset the clock estimation when starting capture.
+ */
+void ClockRecovery::reset()
+{
+	samples_.clear();
+	lastOutput_ = 0;
+	period_ = 0;
+}
+
+/**
+ * \brief Recover the timestamp of a frame
+ * \param[in] sequence The frame sequence number
+ * \param[in] timestamp The frame timestamp, in nanoseconds
+ *
+ * Frames shall be passed in capture order.
+ *
+ * \return The recovered frame timestamp, in nanoseconds
+ */
+uint64_t ClockRecovery::recover(uint32_t sequence, uint64_t timestamp)
+{
+	if (samples_.empty() ||
+	    static_cast<int32_t>(sequence - firstSequence_) <= samples_.back().x) {
+		restart(sequence, timestamp);
+		return timestamp;
+	}
+
+	Sample sample = {
+		static_cast<int32_t>(sequence - firstSequence_),
+		static_cast<int64_t>(timestamp - firstTimestamp_),
+	};
+
+	double slope;
+	double intercept;
+
+	if (fit(&slope, &intercept)) {
+		double error = sample.y - (slope * sample.x + intercept);
+		if (std::abs(error) > slope / 2) {
+			LOG(ClockRecovery, Debug)
+				<< "Timestamp of frame " << sequence
+				<< " off by " << static_cast<int64_t>(error)
+				<< "ns, restarting clock recovery";
+			restart(sequence, timestamp);
+			return timestamp;
+		}
+	}
+
+	samples_.push_back(sample);
+	if (samples_.size() > window_)
+		samples_.pop_front();
+
+	if (!fit(&slope, &intercept)) {
+		lastOutput_ = timestamp;
+		return timestamp;
+	}
+
+	period_ = std::llround(slope);
+
+	uint64_t output = firstTimestamp_
+			+ std::llround(slope * sample.x + intercept);
+	if (output <= lastOutput_)
+		output = lastOutput_ + 1;
+
+	lastOutput_ = output;
+
+	return output;
+}
+
+/**
+ * \fn ClockRecovery::period()
+ * \brief Retrieve the estimated frame period
+ * \return The estimated frame period in nanoseconds, or 0 if not estimated yet
+ */
+
+void ClockRecovery::restart(uint32_t sequence, uint64_t timestamp)
+{
+	samples_.clear();
+	samples_.push_back({ 0, 0 });
+
+	firstSequence_ = sequence;
+	firstTimestamp_ = timestamp;
+	lastOutput_ = timestamp;
+	period_ = 0;
+}
+
+/*
+ * Compute the least squares fit of the samples, with sequence numbers as the
+ * independent variable. Return false if not enough samples are available.
+ */
+bool ClockRecovery::fit(double *slope, double *intercept) const
+{
+	if (samples_.size() < MinSamples)
+		return false;
+
+	/* Center the samples to preserve the precision of the sums. */
+	double n = samples_.size();
+	double mx = 0, my = 0;
+
+	for (const Sample &s : samples_) {
+		mx += s.x;
+		my += s.y;
+	}
+
+	mx /= n;
+	my /= n;
+
+	double sxx = 0, sxy = 0;
+
+	for (const Sample &s : samples_) {
+		sxx += (s.x - mx) * (s.x - mx);
+		sxy += (s.x - mx) * (s.y - my);
+	}
+
+	if (sxx <= 0)
+		return false;
+
+	*slope = sxy / sxx;
+	*intercept = my - *slope * mx;
+
+	return *slope > 0;
+}
+
+} /* namespace libcamera */
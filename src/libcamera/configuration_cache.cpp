@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * configuration_cache.cpp - Cache of camera configuration validation results
+ */
+
+#include "configuration_cache.h"
+
+#include <algorithm>
+
+#include "metrics_registry.h"
+
+/**
+ * \file configuration_cache.h
+ * \brief Cache of camera configuration validation results
+ */
+
+namespace libcamera {
+
+/**
+ * \class ConfigurationCache
+ * \brief Cache the results of camera configuration validation
+ *
+ * Applications commonly validate identical configurations repeatedly, for
+ * instance when a camera service negotiates the configuration of every client
+ * session, and Camera::configure() validates the configuration again. The
+ * ConfigurationCache class stores the results of the validation of a camera's
+ * configurations, keyed by the parameters of the stream configurations that
+ * the application can set, and returns the adjusted configuration and the
+ * validation status directly when validating an identical configuration.
+ *
+ * Pipeline handlers use the cache by implementing the adjustment of the
+ * configuration in a separate method of their CameraConfiguration subclass,
+ * and by delegating CameraConfiguration::validate() to validate(). The
+ * cached configurations are copies of the subclass instances, they thus also
+ * store the pipeline handler private state computed at validation time, such
+ * as the selected sensor format. The validation of a camera configuration
+ * shall only depend on the stream configurations and on immutable properties
+ * of the camera.
+ *
+ * The cache holds up to MaxEntries configurations, and discards the least
+ * recently used configuration when full. It can be used from multiple
+ * threads concurrently. Cache hits and misses are counted by the
+ * config-cache.hits and config-cache.misses metrics.
+ */
+
+/**
+ * \var ConfigurationCache::MaxEntries
+ * \brief The maximum number of configurations stored in the cache
+ */
+
+ConfigurationCache::ConfigurationCache()
+{
+	MetricsRegistry *registry = MetricsRegistry::instance();
+
+	hitsMetric_ = registry->counter("config-cache.hits");
+	missesMetric_ = registry->counter("config-cache.misses");
+}
+
+/**
+ * \fn ConfigurationCache::validate()
+ * \brief Validate a camera configuration through the cache
+ * \param[in] config The camera configuration to validate
+ * \param[in] adjust The \a config method that validates and adjusts the
+ * configuration
+ *
+ * If an identical configuration has been validated before, copy the validated
+ * configuration to \a config and return the cached status. The stream
+ * associated with the stream configurations and the stream formats are left
+ * untouched. Otherwise validate the configuration with \a adjust and store the
+ * result in the cache.
+ *
+ * Configurations for which \a adjust drops stream configuration entries are
+ * not cached.
+ *
+ * \return The validation status of the configuration
+ */
+
+/**
+ * \brief Discard all cached configurations
+ *
+ * Pipeline handlers shall clear the cache when the properties of the camera
+ * that the validation depends on change.
+ */
+void ConfigurationCache::clear()
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	entries_.clear();
+}
+
+/* Compare the stream configuration parameters that applications can set. */
+static bool sameKey(const StreamConfiguration &lhs, const StreamConfiguration &rhs)
+{
+	return lhs.pixelFormat == rhs.pixelFormat &&
+	       lhs.modifier == rhs.modifier &&
+	       lhs.size == rhs.size &&
+	       lhs.stride == rhs.stride &&
+	       lhs.memoryType == rhs.memoryType &&
+	       lhs.bufferCount == rhs.bufferCount &&
+	       lhs.mapFlags == rhs.mapFlags &&
+	       lhs.decimation == rhs.decimation &&
+	       lhs.sliceHeight == rhs.sliceHeight;
+}
+
+const ConfigurationCache::Entry *
+ConfigurationCache::find(const std::vector<StreamConfiguration> &key)
+{
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		if (it->key.size() != key.size() ||
+		    !std::equal(key.begin(), key.end(), it->key.begin(), sameKey))
+			continue;
+
+		/* Keep the entries sorted from the most recently used. */
+		entries_.splice(entries_.begin(), entries_, it);
+		hitsMetric_->add();
+		return &entries_.front();
+	}
+
+	missesMetric_->add();
+	return nullptr;
+}
+
+void ConfigurationCache::insert(const std::vector<StreamConfiguration> &key,
+				std::unique_ptr<CameraConfiguration> result,
+				CameraConfiguration::Status status)
+{
+	entries_.push_front({ key, std::move(result), status });
+
+	if (entries_.size() > MaxEntries)
+		entries_.pop_back();
+}
+
+/*
+ * Restore the streams and formats of the stream configurations overwritten by
+ * a cached configuration.
+ */
+void ConfigurationCache::restore(CameraConfiguration *config,
+				 const std::vector<StreamConfiguration> &key)
+{
+	for (unsigned int i = 0; i < key.size(); ++i) {
+		StreamConfiguration &cfg = config->at(i);
+		StreamConfiguration result = key[i];
+
+		result.pixelFormat = cfg.pixelFormat;
+		result.modifier = cfg.modifier;
+		result.size = cfg.size;
+		result.stride = cfg.stride;
+		result.memoryType = cfg.memoryType;
+		result.bufferCount = cfg.bufferCount;
+		result.minBufferCount = cfg.minBufferCount;
+		result.maxBufferCount = cfg.maxBufferCount;
+		result.mapFlags = cfg.mapFlags;
+		result.decimation = cfg.decimation;
+		result.sliceHeight = cfg.sliceHeight;
+
+		cfg = result;
+	}
+}
+
+} /* namespace libcamera */
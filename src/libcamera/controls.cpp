@@ -9,6 +9,7 @@
 
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <libcamera/camera.h>
 
@@ -35,6 +36,8 @@ LOG_DEFINE_CATEGORY(Controls)
  * Identifies controls storing an integer value
  * \var ControlValueInteger64
  * Identifies controls storing a 64-bit integer value
+ * \var ControlValueRectangle
+ * Identifies controls storing a rectangle
  */
 
 /**
@@ -77,6 +80,15 @@ ControlValue::ControlValue(int64_t value)
 {
 }
 
+/**
+ * \brief Construct a rectangle ControlValue
+ * \param[in] value Rectangle value to store
+ */
+ControlValue::ControlValue(const Rectangle &value)
+	: type_(ControlValueRectangle), rectangle_(value)
+{
+}
+
 /**
  * \fn ControlValue::type()
  * \brief Retrieve the data type of the value
@@ -119,6 +131,16 @@ void ControlValue::set(int64_t value)
 	integer64_ = value;
 }
 
+/**
+ * \brief Set the value with a rectangle
+ * \param[in] value Rectangle value to store
+ */
+void ControlValue::set(const Rectangle &value)
+{
+	type_ = ControlValueRectangle;
+	rectangle_ = value;
+}
+
 /**
  * \brief Get the boolean value
  *
@@ -161,6 +183,33 @@ int64_t ControlValue::getInt64() const
 	return integer64_;
 }
 
+/**
+ * \brief Get the rectangle value
+ *
+ * The value type must be Rectangle.
+ *
+ * \return The rectangle value
+ */
+const Rectangle &ControlValue::getRectangle() const
+{
+	ASSERT(type_ == ControlValueRectangle);
+
+	return rectangle_;
+}
+
+/**
+ * \fn ControlValue::get()
+ * \brief Get the control value with type \a T
+ *
+ * This method is specialised for the bool, int, int64_t and Rectangle types.
+ * Unlike getBool(), getInt(), getInt64() and getRectangle(), it doesn't check
+ * the value type at runtime, and is meant to be used with the typed Control
+ * descriptors that guarantee type consistency at compile time. The behaviour is
+ * undefined if the value doesn't store a value of type \a T.
+ *
+ * \return The control value
+ */
+
 /**
  * \brief Assemble and return a string describing the value
  * \return A string describing the ControlValue
@@ -176,6 +225,8 @@ std::string ControlValue::toString() const
 		return std::to_string(integer_);
 	case ControlValueInteger64:
 		return std::to_string(integer64_);
+	case ControlValueRectangle:
+		return rectangle_.toString();
 	}
 
 	return "<ValueType Error>";
@@ -228,6 +279,43 @@ std::string ControlValue::toString() const
  * Specify a fixed gain parameter
  */
 
+/**
+ * \var FrameDuration
+ * ControlType: Integer
+ *
+ * Specify the duration of frames in micro-seconds, the camera then captures
+ * frames at the corresponding rate instead of the maximum rate supported by
+ * the configuration. Pipeline handlers may round the duration to a value
+ * supported by the hardware.
+ */
+
+/**
+ * \var SensorTimestamp
+ * ControlType: Integer64
+ *
+ * Report the time, in nanoseconds on the CLOCK_MONOTONIC clock, at which the
+ * frame has been captured. This control is only reported in request metadata.
+ */
+
+/**
+ * \var ScalerCrop
+ * ControlType: Rectangle
+ *
+ * Specify the region of the image sensor output frame to capture, expressed in
+ * pixels relative to the top-left corner of the sensor output frame. The
+ * region is scaled to the size of all the streams, which implements digital
+ * zoom without reconfiguring the camera. The region applies to the request it
+ * is set in and to all subsequent requests, until set again. Configuring the
+ * camera with a different configuration resets the region to the full sensor
+ * output frame.
+ *
+ * The maximum value of the control reports the largest region supported by the
+ * sensor, the region is further limited to the sensor output frame of the
+ * active configuration. Pipeline handlers may adjust the region to the
+ * alignment constraints of the hardware, and report the region applied to the
+ * frame in request metadata.
+ */
+
 /**
  * \struct ControlIdentifier
  * \brief Describe a ControlId with control specific constant meta-data
@@ -253,6 +341,60 @@ std::string ControlValue::toString() const
  */
 extern const std::unordered_map<ControlId, ControlIdentifier> controlTypes;
 
+/**
+ * \var ControlIdCount
+ * \brief The number of control IDs
+ */
+
+/**
+ * \class Control
+ * \brief A ControlId associated with the C++ type of its value
+ *
+ * The Control class associates a ControlId with the type \a T of the control
+ * value at compile time. Control instances are used with ControlList::get()
+ * and ControlList::set() to access control values without runtime type checks.
+ * A Control instance is defined for every control, with the same name as the
+ * ControlId, in the controls namespace.
+ */
+
+/**
+ * \fn Control::Control()
+ * \brief Construct a Control for a ControlId
+ * \param[in] id The control ID
+ */
+
+/**
+ * \fn Control::id()
+ * \brief Retrieve the control ID
+ * \return The control ID
+ */
+
+/**
+ * \namespace libcamera::controls
+ * \brief Typed Control descriptors for all controls
+ *
+ * The controls namespace contains one Control instance for every ControlId,
+ * typed according to the ControlType documented for the control.
+ */
+
+namespace {
+
+bool decodeInteger(const ControlValue &value, int64_t *integer)
+{
+	switch (value.type()) {
+	case ControlValueInteger:
+		*integer = value.getInt();
+		return true;
+	case ControlValueInteger64:
+		*integer = value.getInt64();
+		return true;
+	default:
+		return false;
+	}
+}
+
+} /* namespace */
+
 /**
  * \class ControlInfo
  * \brief Describe the information and capabilities of a Control
@@ -261,6 +403,11 @@ extern const std::unordered_map<ControlId, ControlIdentifier> controlTypes;
  * per camera basis. ControlInfo classes are constructed by pipeline handlers
  * to expose the controls they support and the metadata needed to utilise those
  * controls.
+ *
+ * The minimum and maximum values of integer controls are decoded to 64-bit
+ * integers when the ControlInfo is constructed, regardless of the type of the
+ * ControlValue they are specified with. This allows validating control values
+ * with plain integer comparisons, see ControlList::validate().
  */
 
 /**
@@ -271,7 +418,7 @@ extern const std::unordered_map<ControlId, ControlIdentifier> controlTypes;
  */
 ControlInfo::ControlInfo(ControlId id, const ControlValue &min,
 			 const ControlValue &max)
-	: min_(min), max_(max)
+	: min_(min), max_(max), bounded_(false), lower_(0), upper_(0)
 {
 	auto iter = controlTypes.find(id);
 	if (iter == controlTypes.end()) {
@@ -280,6 +427,11 @@ ControlInfo::ControlInfo(ControlId id, const ControlValue &min,
 	}
 
 	ident_ = &iter->second;
+
+	if (ident_->type == ControlValueInteger ||
+	    ident_->type == ControlValueInteger64)
+		bounded_ = decodeInteger(min_, &lower_) &&
+			   decodeInteger(max_, &upper_);
 }
 
 /**
@@ -370,10 +522,147 @@ bool operator==(const ControlInfo &lhs, const ControlId &rhs)
 }
 
 /**
- * \typedef ControlInfoMap
+ * \class ControlInfoMap
  * \brief A map of ControlId to ControlInfo
+ *
+ * The ControlInfoMap stores the information of the controls supported by a
+ * camera in an array indexed by ControlId, similarly to the ControlList
+ * storage. Looking up a control is a direct access without hashing, and the
+ * ControlInfo instances are stored contiguously. Iteration returns the
+ * controls in ControlId order.
+ *
+ * The ControlInfo instances are never moved, pointers to them stay valid for
+ * the lifetime of the map.
  */
 
+/**
+ * \typedef ControlInfoMap::value_type
+ * \brief The type of the map entries, a pair of control ID and information
+ */
+
+/**
+ * \class ControlInfoMap::const_iterator
+ * \brief Const iterator on the controls contained in the map
+ */
+
+/**
+ * \typedef ControlInfoMap::iterator
+ * \brief Iterator on the controls contained in the map
+ *
+ * The map entries can't be modified through iterators, iterator is thus an
+ * alias of const_iterator.
+ */
+
+/**
+ * \brief Construct an empty ControlInfoMap
+ */
+ControlInfoMap::ControlInfoMap()
+	: size_(0)
+{
+	entries_.reserve(ControlIdCount);
+	for (unsigned int i = 0; i < ControlIdCount; ++i) {
+		ControlId id = static_cast<ControlId>(i);
+		entries_.emplace_back(id, ControlInfo(id));
+	}
+
+	present_.fill(false);
+}
+
+/**
+ * \fn ControlInfoMap::begin()
+ * \brief Retrieve an iterator to the first control in the map
+ * \return An iterator to the first control
+ */
+
+/**
+ * \fn ControlInfoMap::end()
+ * \brief Retrieve an iterator pointing to the past-the-end control in the map
+ * \return An iterator to the element following the last control
+ */
+
+/**
+ * \fn ControlInfoMap::empty()
+ * \brief Check if the map is empty
+ * \return True if the map contains no control, false otherwise
+ */
+
+/**
+ * \fn ControlInfoMap::size()
+ * \brief Retrieve the number of controls in the map
+ * \return The number of controls
+ */
+
+/**
+ * \brief Remove all controls from the map
+ */
+void ControlInfoMap::clear()
+{
+	present_.fill(false);
+	size_ = 0;
+}
+
+/**
+ * \brief Insert control information in the map
+ * \param[in] info The control information
+ *
+ * The control information is inserted only if the map doesn't contain
+ * information for the same control already.
+ *
+ * \return A pair of an iterator to the control information in the map, and a
+ * boolean set to true if \a info has been inserted, or false otherwise
+ */
+std::pair<ControlInfoMap::const_iterator, bool>
+ControlInfoMap::insert(const ControlInfo &info)
+{
+	ControlId id = info.id();
+	bool inserted = !present_[id];
+
+	if (inserted) {
+		entries_[id].second = info;
+		present_[id] = true;
+		size_++;
+	}
+
+	return { const_iterator(this, id), inserted };
+}
+
+/**
+ * \brief Find the information of control \a id
+ * \param[in] id The control ID
+ * \return An iterator to the entry for control \a id, or end() if the control
+ * isn't in the map
+ */
+ControlInfoMap::const_iterator ControlInfoMap::find(ControlId id) const
+{
+	if (!present_[id])
+		return end();
+
+	return const_iterator(this, id);
+}
+
+/**
+ * \fn ControlInfoMap::count()
+ * \brief Count the entries for control \a id
+ * \param[in] id The control ID
+ * \return 1 if the control is in the map, 0 otherwise
+ */
+
+/**
+ * \brief Retrieve the information of control \a id
+ * \param[in] id The control ID
+ *
+ * The control \a id shall be in the map, use find() to look up controls that
+ * may not be supported.
+ *
+ * \return A reference to the information of control \a id
+ */
+const ControlInfo &ControlInfoMap::at(ControlId id) const
+{
+	ASSERT(present_[id]);
+
+	return entries_[id].second;
+}
+
 /**
  * \class ControlList
  * \brief Associate a list of ControlId with their values for a camera
@@ -381,18 +670,43 @@ bool operator==(const ControlInfo &lhs, const ControlId &rhs)
  * A ControlList wraps a map of ControlId to ControlValue and provide
  * additional validation against the control information exposed by a Camera.
  *
+ * Controls are stored in a fixed-size array indexed by ControlId, which makes
+ * accessing a control that is already present in the list, as well as copying
+ * and updating lists, free of memory allocation and hashing. Iteration returns
+ * the controls in ControlId order.
+ *
  * A list is only valid for as long as the camera it refers to is valid. After
  * that calling any method of the ControlList class other than its destructor
  * will cause undefined behaviour.
+ *
+ * Lists that don't refer to a camera accept all controls without validation.
+ * They are used to report request metadata, which may contain controls that
+ * can't be set by applications.
  */
 
 /**
  * \brief Construct a ControlList with a reference to the Camera it applies on
- * \param[in] camera The camera
+ * \param[in] camera The camera, or nullptr for a list of unvalidated controls
  */
 ControlList::ControlList(Camera *camera)
-	: camera_(camera)
+	: camera_(camera), size_(0)
+{
+}
+
+/*
+ * Retrieve the control information used by lists that don't refer to a camera,
+ * which only identifies the control.
+ */
+static const ControlInfo *unvalidatedControlInfo(ControlId id)
 {
+	static const std::vector<ControlInfo> infos = []() {
+		std::vector<ControlInfo> infos;
+		for (unsigned int i = 0; i < ControlIdCount; ++i)
+			infos.emplace_back(static_cast<ControlId>(i));
+		return infos;
+	}();
+
+	return &infos[id];
 }
 
 /**
@@ -442,6 +756,12 @@ ControlList::ControlList(Camera *camera)
  */
 bool ControlList::contains(ControlId id) const
 {
+	if (controls_[id].first)
+		return true;
+
+	if (!camera_)
+		return false;
+
 	const ControlInfoMap &controls = camera_->controls();
 	const auto iter = controls.find(id);
 	if (iter == controls.end()) {
@@ -452,7 +772,7 @@ bool ControlList::contains(ControlId id) const
 		return false;
 	}
 
-	return controls_.find(&iter->second) != controls_.end();
+	return false;
 }
 
 /**
@@ -462,7 +782,7 @@ bool ControlList::contains(ControlId id) const
  */
 bool ControlList::contains(const ControlInfo *info) const
 {
-	return controls_.find(info) != controls_.end();
+	return controls_[info->id()].first == info;
 }
 
 /**
@@ -478,9 +798,15 @@ bool ControlList::contains(const ControlInfo *info) const
  */
 
 /**
- * \fn ControlList::clear()
  * \brief Removes all controls from the list
  */
+void ControlList::clear()
+{
+	for (ControlListEntry &entry : controls_)
+		entry.first = nullptr;
+
+	size_ = 0;
+}
 
 /**
  * \brief Access or insert the control specified by \a id
@@ -496,6 +822,13 @@ bool ControlList::contains(const ControlInfo *info) const
  */
 ControlValue &ControlList::operator[](ControlId id)
 {
+	ControlListEntry &entry = controls_[id];
+	if (entry.first)
+		return entry.second;
+
+	if (!camera_)
+		return (*this)[unvalidatedControlInfo(id)];
+
 	const ControlInfoMap &controls = camera_->controls();
 	const auto iter = controls.find(id);
 	if (iter == controls.end()) {
@@ -507,11 +840,10 @@ ControlValue &ControlList::operator[](ControlId id)
 		return empty;
 	}
 
-	return controls_[&iter->second];
+	return (*this)[&iter->second];
 }
 
 /**
- * \fn ControlList::operator[](const ControlInfo *info)
  * \brief Access or insert the control specified by \a info
  * \param[in] info The control info
  *
@@ -520,6 +852,17 @@ ControlValue &ControlList::operator[](ControlId id)
  *
  * \return A reference to the value of the control identified by \a info
  */
+ControlValue &ControlList::operator[](const ControlInfo *info)
+{
+	ControlListEntry &entry = controls_[info->id()];
+	if (!entry.first) {
+		entry.first = info;
+		entry.second = ControlValue();
+		size_++;
+	}
+
+	return entry.second;
+}
 
 /**
  * \brief Update the list with a union of itself and \a other
@@ -541,12 +884,68 @@ void ControlList::update(const ControlList &other)
 		return;
 	}
 
-	for (auto it : other) {
-		const ControlInfo *info = it.first;
-		const ControlValue &value = it.second;
+	for (const ControlListEntry &entry : other)
+		(*this)[entry.first] = entry.second;
+}
+
+/**
+ * \brief Validate the control values against the camera control information
+ *
+ * Integer controls are checked against the minimum and maximum values of their
+ * ControlInfo, decoded when the ControlInfo is constructed. The whole list is
+ * validated with a single pass over its storage array, without any lookup in
+ * the camera control information. Lists that don't refer to a camera are always
+ * valid.
+ *
+ * \return True if all control values are within their range, false otherwise
+ */
+bool ControlList::validate() const
+{
+	if (!camera_)
+		return true;
+
+	bool valid = true;
+
+	for (const ControlListEntry &entry : controls_) {
+		const ControlInfo *info = entry.first;
+		int64_t value;
+
+		if (!info || !info->bounded_ ||
+		    !decodeInteger(entry.second, &value))
+			continue;
 
-		controls_[info] = value;
+		if (value < info->lower_ || value > info->upper_) {
+			LOG(Controls, Error)
+				<< "Control " << info->name() << " value "
+				<< value << " out of range " << info->toString();
+			valid = false;
+		}
 	}
+
+	return valid;
 }
 
+/**
+ * \fn ControlList::get(const Control<T> &ctrl) const
+ * \brief Get the value of control \a ctrl
+ * \param[in] ctrl The control
+ *
+ * The value type is selected at compile time from the type of the \a ctrl
+ * descriptor, avoiding the runtime type checks of ControlValue accessors.
+ *
+ * \return The control value, or a default-constructed value if the list
+ * doesn't contain the control
+ */
+
+/**
+ * \fn ControlList::set(const Control<T> &ctrl, const T &value)
+ * \brief Set the value of control \a ctrl
+ * \param[in] ctrl The control
+ * \param[in] value The control value
+ *
+ * The control is inserted in the list if it isn't present already. The
+ * behaviour is undefined if the control isn't supported by the camera that
+ * the ControlList refers to.
+ */
+
 } /* namespace libcamera */
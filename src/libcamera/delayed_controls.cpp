@@ -0,0 +1,256 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * delayed_controls.cpp - Sensor controls applied with a frame delay
+ */
+
+#include "delayed_controls.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#include "log.h"
+#include "v4l2_device.h"
+
+/**
+ * \file delayed_controls.h
+ * \brief Sensor controls applied with a frame delay
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DelayedControls)
+
+/**
+ * \class DelayedControls
+ * \brief Queue of controls applied to a device with a per-control frame delay
+ *
+ * Camera sensors latch some of their controls, such as the exposure time, the
+ * analogue gain or the vertical blanking, at frame boundaries, and the new
+ * values only affect the frames captured a fixed number of frames after the
+ * control is written. The delay depends on the control and on the sensor.
+ * Writing the controls as soon as requests are queued thus makes it
+ * impossible to know which values were used to capture a frame, and
+ * algorithms that can't associate frames with the controls that produced them
+ * oscillate and take more frames to converge.
+ *
+ * The DelayedControls class associates controls with frames. Pipeline
+ * handlers push() the controls of every frame in capture order, and call
+ * applyControls() when the capture of a frame starts, typically from a
+ * V4L2Device::frameStart signal handler. Each control is written at the frame
+ * start that makes it apply to the frame it has been pushed for, taking its
+ * delay into account, and the values used to capture a frame are retrieved
+ * with get() when the frame completes.
+ *
+ * The controls pushed for the first frame are applied to the frame with a
+ * sequence number equal to the first frame start sequence plus the largest
+ * control delay. The frames captured before then use the values read from the
+ * device by reset().
+ */
+
+/**
+ * \brief Construct a DelayedControls instance
+ * \param[in] device The device the controls are written to
+ * \param[in] delays The delay of each control, in frames
+ *
+ * Controls in \a delays that are not supported by the \a device are ignored.
+ */
+DelayedControls::DelayedControls(V4L2Device *device,
+				 const std::map<unsigned int, unsigned int> &delays)
+	: device_(device), maxDelay_(0), running_(false), firstSequence_(0),
+	  queueCount_(0), writeCount_(0)
+{
+	const V4L2ControlInfoMap &controls = device_->controls();
+
+	for (const auto &delay : delays) {
+		if (controls.find(delay.first) == controls.end()) {
+			LOG(DelayedControls, Debug)
+				<< "Ignoring unsupported control 0x"
+				<< std::hex << std::setw(8) << delay.first;
+			continue;
+		}
+
+		delays_[delay.first] = delay.second;
+		maxDelay_ = std::max(maxDelay_, delay.second);
+	}
+
+	reset();
+}
+
+/**
+ * \brief Reset the queue to the current device control values
+ *
+ * This method discards all queued controls and reads the current value of the
+ * controls from the device. It shall be called before starting capture, as
+ * the first frame start sequence is recorded by the next call to
+ * applyControls().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DelayedControls::reset()
+{
+	running_ = false;
+	firstSequence_ = 0;
+	queueCount_ = 1;
+	writeCount_ = 0;
+	values_.clear();
+
+	if (delays_.empty())
+		return 0;
+
+	V4L2ControlList ctrls;
+	for (const auto &delay : delays_)
+		ctrls.add(delay.first);
+
+	int ret = device_->getControls(&ctrls);
+	if (ret) {
+		LOG(DelayedControls, Error) << "Failed to read controls";
+		return ret < 0 ? ret : -EINVAL;
+	}
+
+	for (const V4L2Control &ctrl : ctrls)
+		values_[ctrl.id()][0] = { ctrl.value(), false };
+
+	return 0;
+}
+
+/**
+ * \brief Push the controls for the next frame
+ * \param[in] controls The controls to apply
+ *
+ * The \a controls are queued for the frame following the frame of the
+ * previous push() call. Controls not present in \a controls keep their value.
+ * An empty list shall be pushed for frames without control changes.
+ *
+ * \return True if the controls have been queued, false if the list contains a
+ * control without delay information or if the queue is full
+ */
+bool DelayedControls::push(const V4L2ControlList &controls)
+{
+	for (const V4L2Control &ctrl : controls) {
+		if (delays_.find(ctrl.id()) == delays_.end()) {
+			LOG(DelayedControls, Error)
+				<< "Unknown control 0x" << std::hex
+				<< std::setw(8) << ctrl.id();
+			return false;
+		}
+	}
+
+	/* Don't overwrite the values still needed by applyControls(). */
+	if (queueCount_ + maxDelay_ >= writeCount_ + MaxFrames) {
+		LOG(DelayedControls, Error) << "Controls queue full";
+		return false;
+	}
+
+	queue(queueCount_, controls);
+	queueCount_++;
+
+	return true;
+}
+
+void DelayedControls::queue(unsigned int index, const V4L2ControlList &controls)
+{
+	for (auto &ctrl : values_) {
+		ControlRing &ring = ctrl.second;
+		Info &info = ring[index % MaxFrames];
+
+		info.value = ring[(index - 1) % MaxFrames].value;
+		info.updated = false;
+	}
+
+	for (const V4L2Control &ctrl : controls) {
+		Info &info = values_[ctrl.id()][index % MaxFrames];
+
+		info.value = ctrl.value();
+		info.updated = true;
+	}
+}
+
+/**
+ * \brief Retrieve the control values used to capture a frame
+ * \param[in] sequence The frame sequence number
+ *
+ * The \a sequence shall be the sequence number of a frame whose capture has
+ * started, and that is less than 16 frames older than the last started frame.
+ *
+ * \return The value of all the controls when frame \a sequence was captured
+ */
+V4L2ControlList DelayedControls::get(uint32_t sequence)
+{
+	unsigned int frame = running_ ? sequence - firstSequence_ : 0;
+	unsigned int index = frame >= maxDelay_ ? frame - maxDelay_ + 1 : 0;
+	V4L2ControlList ctrls;
+
+	for (const auto &ctrl : values_)
+		ctrls.add(ctrl.first, ctrl.second[index % MaxFrames].value);
+
+	return ctrls;
+}
+
+/**
+ * \brief Write the controls due at the start of a frame
+ * \param[in] sequence The sequence number of the frame whose capture started
+ *
+ * This method shall be called when the capture of a frame starts. It writes
+ * the controls that need to be written during frame \a sequence to apply to
+ * the frame they have been pushed for. If frame start events have been missed,
+ * the controls due at the missed frames are skipped, and frames without
+ * pushed controls keep the previous values.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DelayedControls::applyControls(uint32_t sequence)
+{
+	if (!running_) {
+		firstSequence_ = sequence;
+		running_ = true;
+	}
+
+	writeCount_ = sequence - firstSequence_;
+
+	/*
+	 * The controls pushed in slot i apply to frame i - 1 + maxDelay_, and
+	 * a control with a delay d written during frame w applies to frame
+	 * w + d. Slot w - (maxDelay_ - d) + 1 is thus due at frame w. Make sure
+	 * the slots read below have been filled.
+	 */
+	while (writeCount_ + 1 >= queueCount_) {
+		queue(queueCount_, {});
+		queueCount_++;
+	}
+
+	V4L2ControlList ctrls;
+
+	for (auto &ctrl : values_) {
+		unsigned int delayDiff = maxDelay_ - delays_[ctrl.first];
+		if (writeCount_ < delayDiff)
+			continue;
+
+		Info &info = ctrl.second[(writeCount_ - delayDiff + 1) % MaxFrames];
+		if (!info.updated)
+			continue;
+
+		ctrls.add(ctrl.first, info.value);
+		info.updated = false;
+	}
+
+	writeCount_++;
+
+	if (ctrls.empty())
+		return 0;
+
+	LOG(DelayedControls, Debug)
+		<< "Writing " << ctrls.size() << " controls at frame " << sequence;
+
+	int ret = device_->setControls(&ctrls);
+	if (ret) {
+		LOG(DelayedControls, Error)
+			<< "Failed to write controls at frame " << sequence;
+		return ret < 0 ? ret : -EINVAL;
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
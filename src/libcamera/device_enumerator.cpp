@@ -9,6 +9,8 @@
 #include "device_enumerator_sysfs.h"
 #include "device_enumerator_udev.h"
 
+#include <algorithm>
+#include <future>
 #include <string.h>
 
 #include "log.h"
@@ -99,22 +101,19 @@ bool DeviceMatch::match(const MediaDevice *device) const
 		return false;
 
 	for (const std::string &name : entities_) {
-		bool found = false;
-
-		for (const MediaEntity *entity : device->entities()) {
-			if (name == entity->name()) {
-				found = true;
-				break;
-			}
-		}
-
-		if (!found)
+		if (!device->getEntityByName(name))
 			return false;
 	}
 
 	return true;
 }
 
+/**
+ * \fn DeviceMatch::driver()
+ * \brief Retrieve the driver name of the search pattern
+ * \return The Linux device driver name
+ */
+
 /**
  * \class DeviceEnumerator
  * \brief Enumerate, store and search media devices
@@ -163,10 +162,12 @@ std::unique_ptr<DeviceEnumerator> DeviceEnumerator::create()
 
 DeviceEnumerator::~DeviceEnumerator()
 {
-	for (std::shared_ptr<MediaDevice> media : devices_) {
-		if (media->busy())
-			LOG(DeviceEnumerator, Error)
-				<< "Removing media device while still in use";
+	for (auto const &it : devices_) {
+		for (const std::shared_ptr<MediaDevice> &media : it.second) {
+			if (media->busy())
+				LOG(DeviceEnumerator, Error)
+					<< "Removing media device while still in use";
+		}
 	}
 }
 
@@ -207,7 +208,61 @@ int DeviceEnumerator::addDevice(const std::string &deviceNode)
 {
 	std::shared_ptr<MediaDevice> media = std::make_shared<MediaDevice>(deviceNode);
 
-	int ret = media->populate();
+	return registerDevice(media, media->populate());
+}
+
+/**
+ * \brief Add multiple media devices to the enumerator
+ * \param[in] deviceNodes paths to the media devices to add
+ *
+ * Add all media devices in \a deviceNodes to the enumerator as addDevice()
+ * does. Populating the media graph is the most expensive part of adding a
+ * media device, as it requires opening the device and querying its topology
+ * from the kernel. The media graphs of all devices are thus populated
+ * concurrently in separate threads, and the devices are then stored in the
+ * internal list in the order of \a deviceNodes, from the calling thread. Device
+ * node look up isn't assumed to be thread-safe and is performed from the
+ * calling thread too.
+ *
+ * Media devices that fail to be added are skipped.
+ */
+void DeviceEnumerator::addDevices(const std::vector<std::string> &deviceNodes)
+{
+	if (deviceNodes.empty())
+		return;
+
+	std::vector<std::shared_ptr<MediaDevice>> medias;
+	for (const std::string &deviceNode : deviceNodes)
+		medias.push_back(std::make_shared<MediaDevice>(deviceNode));
+
+	/*
+	 * Populate all media devices but the first one in separate threads,
+	 * and wait for all of them to complete before registering them.
+	 */
+	std::vector<std::future<int>> results;
+	for (auto media = medias.begin() + 1; media != medias.end(); ++media) {
+		MediaDevice *device = media->get();
+		results.push_back(std::async(std::launch::async,
+					     [device]() { return device->populate(); }));
+	}
+
+	int ret = medias.front()->populate();
+	registerDevice(medias.front(), ret);
+
+	for (unsigned int i = 0; i < results.size(); ++i)
+		registerDevice(medias[i + 1], results[i].get());
+}
+
+/*
+ * Complete addition of a \a media device whose media graph has been populated
+ * with the \a populated status, and store it in the internal list.
+ */
+int DeviceEnumerator::registerDevice(std::shared_ptr<MediaDevice> media,
+				     int populated)
+{
+	const std::string &deviceNode = media->deviceNode();
+	int ret = populated;
+
 	if (ret < 0) {
 		LOG(DeviceEnumerator, Info)
 			<< "Unable to populate media device " << deviceNode
@@ -237,7 +292,7 @@ int DeviceEnumerator::addDevice(const std::string &deviceNode)
 	LOG(DeviceEnumerator, Debug)
 		<< "Added device " << deviceNode << ": " << media->driver();
 
-	devices_.push_back(std::move(media));
+	devices_[media->driver()].push_back(std::move(media));
 
 	return 0;
 }
@@ -254,12 +309,19 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
 {
 	std::shared_ptr<MediaDevice> media;
 
-	for (auto iter = devices_.begin(); iter != devices_.end(); ++iter) {
-		if ((*iter)->deviceNode() == deviceNode) {
-			media = std::move(*iter);
-			devices_.erase(iter);
-			break;
-		}
+	for (auto &it : devices_) {
+		std::vector<std::shared_ptr<MediaDevice>> &devices = it.second;
+
+		auto iter = std::find_if(devices.begin(), devices.end(),
+					 [&](const std::shared_ptr<MediaDevice> &dev) {
+						 return dev->deviceNode() == deviceNode;
+					 });
+		if (iter == devices.end())
+			continue;
+
+		media = std::move(*iter);
+		devices.erase(iter);
+		break;
 	}
 
 	if (!media) {
@@ -284,11 +346,19 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
  * it the caller is responsible for acquiring the MediaDevice object and
  * releasing it when done with it.
  *
+ * Media devices are indexed by driver name, only the devices handled by the
+ * driver of the \a dm pattern are considered.
+ *
  * \return pointer to the matching MediaDevice, or nullptr if no match is found
  */
+
 std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
 {
-	for (std::shared_ptr<MediaDevice> media : devices_) {
+	auto it = devices_.find(dm.driver());
+	if (it == devices_.end())
+		return nullptr;
+
+	for (const std::shared_ptr<MediaDevice> &media : it->second) {
 		if (media->busy())
 			continue;
 
@@ -303,6 +373,16 @@ std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
 	return nullptr;
 }
 
+/**
+ * \var DeviceEnumerator::devicesAdded
+ * \brief Signal emitted when media devices are hot-plugged
+ *
+ * The signal is emitted after media devices added to the system after the
+ * initial enumeration have been populated, to let the media devices be
+ * matched with pipeline handlers. It isn't emitted for the media devices found
+ * by enumerate().
+ */
+
 /**
  * \fn DeviceEnumerator::lookupDeviceNode(int major, int minor)
  * \brief Lookup device node path from device number
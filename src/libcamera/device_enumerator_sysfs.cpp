@@ -10,6 +10,8 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <fstream>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -23,6 +25,15 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(DeviceEnumerator)
 
+namespace {
+
+uint64_t deviceKey(unsigned int major, unsigned int minor)
+{
+	return static_cast<uint64_t>(major) << 32 | minor;
+}
+
+} /* namespace */
+
 int DeviceEnumeratorSysfs::init()
 {
 	return 0;
@@ -30,6 +41,7 @@ int DeviceEnumeratorSysfs::init()
 
 int DeviceEnumeratorSysfs::enumerate()
 {
+	std::vector<std::string> devnodes;
 	struct dirent *ent;
 	DIR *dir;
 
@@ -45,12 +57,19 @@ int DeviceEnumeratorSysfs::enumerate()
 			break;
 	}
 
+	/*
+	 * The media class is missing when no media driver is loaded. This
+	 * isn't an error, as cameras not backed by media devices may still be
+	 * available.
+	 */
 	if (!dir) {
-		LOG(DeviceEnumerator, Error)
+		LOG(DeviceEnumerator, Info)
 			<< "No valid sysfs media device directory";
-		return -ENODEV;
+		return 0;
 	}
 
+	std::unordered_set<std::string> nodes = populateDeviceNodes();
+
 	while ((ent = readdir(dir)) != nullptr) {
 		if (strncmp(ent->d_name, "media", 5))
 			continue;
@@ -62,25 +81,102 @@ int DeviceEnumeratorSysfs::enumerate()
 
 		std::string devnode = "/dev/media" + std::to_string(idx);
 
-		/* Verify that the device node exists. */
+		/*
+		 * Verify that the device node exists, using the /dev listing
+		 * when available to avoid stating every node.
+		 */
 		struct stat devstat;
-		if (stat(devnode.c_str(), &devstat) < 0) {
+		if (!nodes.count(ent->d_name) &&
+		    stat(devnode.c_str(), &devstat) < 0) {
 			LOG(DeviceEnumerator, Warning)
 				<< "Device node /dev/media" << idx
 				<< " should exist but doesn't";
 			continue;
 		}
 
-		addDevice(devnode);
+		devnodes.push_back(devnode);
 	}
 
 	closedir(dir);
 
+	addDevices(devnodes);
+
 	return 0;
 }
 
+/*
+ * Build the map of device numbers to device node paths used by
+ * lookupDeviceNode(). Looking up the uevent file of every entity and stating
+ * its device node dominates enumeration time on systems with many devices.
+ * Instead, the /dev directory is listed once, and the /sys/dev/char links are
+ * resolved to find the kernel name of every character device. Devices whose
+ * kernel name doesn't match an entry in /dev are left out of the map, and
+ * looked up through their uevent file.
+ *
+ * Return the names of the character device nodes found in /dev.
+ */
+std::unordered_set<std::string> DeviceEnumeratorSysfs::populateDeviceNodes()
+{
+	std::unordered_set<std::string> nodes;
+	struct dirent *ent;
+	DIR *dir;
+
+	deviceNodes_.clear();
+
+	dir = opendir("/dev");
+	if (!dir)
+		return nodes;
+
+	while ((ent = readdir(dir)) != nullptr) {
+		if (ent->d_type == DT_CHR || ent->d_type == DT_UNKNOWN)
+			nodes.insert(ent->d_name);
+	}
+
+	closedir(dir);
+
+	dir = opendir("/sys/dev/char");
+	if (!dir)
+		return nodes;
+
+	int dirfd = ::dirfd(dir);
+
+	while ((ent = readdir(dir)) != nullptr) {
+		unsigned int major, minor;
+		char end;
+
+		if (sscanf(ent->d_name, "%u:%u%c", &major, &minor, &end) != 2)
+			continue;
+
+		char target[PATH_MAX];
+		ssize_t len = readlinkat(dirfd, ent->d_name, target,
+					 sizeof(target) - 1);
+		if (len < 0)
+			continue;
+		target[len] = '\0';
+
+		const char *name = strrchr(target, '/');
+		name = name ? name + 1 : target;
+
+		if (!nodes.count(name))
+			continue;
+
+		deviceNodes_[deviceKey(major, minor)] = std::string("/dev/") + name;
+	}
+
+	closedir(dir);
+
+	LOG(DeviceEnumerator, Debug)
+		<< "Found " << deviceNodes_.size() << " character device nodes";
+
+	return nodes;
+}
+
 std::string DeviceEnumeratorSysfs::lookupDeviceNode(int major, int minor)
 {
+	auto it = deviceNodes_.find(deviceKey(major, minor));
+	if (it != deviceNodes_.end())
+		return it->second;
+
 	std::string deviceNode;
 	std::string line;
 	std::ifstream ueventFile;
@@ -62,6 +62,7 @@ int DeviceEnumeratorUdev::init()
 
 int DeviceEnumeratorUdev::enumerate()
 {
+	std::vector<std::string> devnodes;
 	struct udev_enumerate *udev_enum = nullptr;
 	struct udev_list_entry *ents, *ent;
 	int ret;
@@ -102,7 +103,7 @@ int DeviceEnumeratorUdev::enumerate()
 			goto done;
 		}
 
-		addDevice(devnode);
+		devnodes.push_back(devnode);
 
 		udev_device_unref(dev);
 	}
@@ -111,6 +112,8 @@ done:
 	if (ret < 0)
 		return ret;
 
+	addDevices(devnodes);
+
 	ret = udev_monitor_enable_receiving(monitor_);
 	if (ret < 0)
 		return ret;
@@ -153,7 +156,8 @@ void DeviceEnumeratorUdev::udevNotify(EventNotifier *notifier)
 		<< action << " device " << udev_device_get_devnode(dev);
 
 	if (action == "add") {
-		addDevice(deviceNode);
+		if (!addDevice(deviceNode))
+			devicesAdded.emit();
 	} else if (action == "remove") {
 		removeDevice(deviceNode);
 	}
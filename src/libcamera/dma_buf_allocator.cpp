@@ -0,0 +1,298 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * dma_buf_allocator.cpp - dmabuf memory allocator
+ */
+
+#include "dma_buf_allocator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
+
+#include <libcamera/buffer.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file dma_buf_allocator.h
+ * \brief dmabuf memory allocator
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Buffer)
+
+namespace {
+
+const char *const dmaHeapNames[] = {
+	"/dev/dma_heap/linux,cma",
+	"/dev/dma_heap/system",
+};
+
+} /* namespace */
+
+/**
+ * \class DmaBufAllocator
+ * \brief Allocate buffer memory as dmabufs independently of video devices
+ *
+ * The DmaBufAllocator class allocates the memory of the buffers in a
+ * BufferPool as dmabufs, from a DMA heap when available, or from memfd-backed
+ * memory through the udmabuf driver otherwise. Pools allocated this way are then
+ * imported by video devices with V4L2VideoDevice::importBuffers(), instead of
+ * relying on the video device driver to allocate and export memory.
+ *
+ * Memory is allocated independently of any video device, and can thus be
+ * shared freely between video devices of different pipelines. Released buffers
+ * are kept in a cache and reused for later allocations of the same size, to
+ * avoid reallocating memory when a camera is reconfigured with the same
+ * format.
+ *
+ * A single allocator instance is shared by all pipeline handlers, and is
+ * retrieved with instance(). The allocator is only usable when a DMA heap or
+ * the udmabuf driver is available, as reported by isValid().
+ */
+
+DmaBufAllocator::DmaBufAllocator()
+	: fd_(-1), udmabuf_(false)
+{
+	for (const char *name : dmaHeapNames) {
+		fd_ = ::open(name, O_RDWR | O_CLOEXEC);
+		if (fd_ != -1) {
+			LOG(Buffer, Debug) << "Using DMA heap " << name;
+			return;
+		}
+	}
+
+	fd_ = ::open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (fd_ != -1) {
+		LOG(Buffer, Debug) << "Using udmabuf";
+		udmabuf_ = true;
+		return;
+	}
+
+	LOG(Buffer, Debug) << "No dmabuf allocator available";
+}
+
+DmaBufAllocator::~DmaBufAllocator()
+{
+	for (CachedBuffer &buffer : cache_)
+		::close(buffer.fd);
+
+	if (fd_ != -1)
+		::close(fd_);
+}
+
+/**
+ * \brief Retrieve the allocator instance
+ * \return The allocator instance
+ */
+DmaBufAllocator *DmaBufAllocator::instance()
+{
+	static DmaBufAllocator allocator;
+	return &allocator;
+}
+
+/**
+ * \fn DmaBufAllocator::isValid()
+ * \brief Check if the allocator can allocate memory
+ * \return True if a DMA heap or the udmabuf driver is available, false
+ * otherwise
+ */
+
+/**
+ * \brief Allocate memory for all buffers of a pool
+ * \param[in] pool The buffer pool
+ * \param[in] planeSizes The size of each plane in bytes
+ *
+ * Allocate one dmabuf for every plane of every buffer in the \a pool, using as
+ * many planes as the number of \a planeSizes entries. The buffers shall have
+ * been created in the pool with BufferPool::createBuffers(), and any plane
+ * previously stored in the buffers is replaced.
+ *
+ * The memory shall be handed back to the allocator with release() once the
+ * pool isn't used anymore.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DmaBufAllocator::allocate(BufferPool *pool,
+			      const std::vector<unsigned int> &planeSizes)
+{
+	if (!isValid())
+		return -ENODEV;
+
+	for (BufferMemory &mem : pool->buffers()) {
+		mem.planes().clear();
+
+		for (unsigned int size : planeSizes) {
+			int fd = allocateDmabuf(size);
+			if (fd < 0) {
+				release(pool);
+				return fd;
+			}
+
+			mem.planes().emplace_back();
+			int ret = mem.planes().back().setDmabuf(fd, size);
+			::close(fd);
+			if (ret) {
+				release(pool);
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Hand the memory of all buffers of a pool back to the allocator
+ * \param[in] pool The buffer pool
+ *
+ * Remove all planes from the buffers in the \a pool. The memory allocated by
+ * allocate() is kept in the allocator to be reused by later allocations, other
+ * memory is simply released. The pool shall not be in use by any video device
+ * when this method is called.
+ */
+void DmaBufAllocator::release(BufferPool *pool)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	for (BufferMemory &mem : pool->buffers()) {
+		for (Plane &plane : mem.planes()) {
+			std::pair<uint64_t, uint64_t> id;
+
+			if (plane.dmabuf() == -1 ||
+			    !utils::dmabuf_identity(plane.dmabuf(), &id) ||
+			    !allocated_.count(id))
+				continue;
+
+			off_t size = lseek(plane.dmabuf(), 0, SEEK_END);
+			int fd = dup(plane.dmabuf());
+			if (size <= 0 || fd == -1) {
+				if (fd != -1)
+					::close(fd);
+				allocated_.erase(id);
+				continue;
+			}
+
+			cache_.push_back({ fd, static_cast<size_t>(size) });
+		}
+
+		mem.planes().clear();
+	}
+
+	/* Release the least recently used buffers above the cache limit. */
+	while (cache_.size() > MaxCachedBuffers) {
+		CachedBuffer &buffer = cache_.front();
+		std::pair<uint64_t, uint64_t> id;
+
+		if (utils::dmabuf_identity(buffer.fd, &id))
+			allocated_.erase(id);
+
+		::close(buffer.fd);
+		cache_.pop_front();
+	}
+}
+
+/*
+ * Allocate a dmabuf of at least \a size bytes, reusing a cached buffer of the
+ * same page-aligned size when available. The caller owns the returned file
+ * descriptor.
+ */
+int DmaBufAllocator::allocateDmabuf(size_t size)
+{
+	long pageSize = sysconf(_SC_PAGESIZE);
+	size = (size + pageSize - 1) / pageSize * pageSize;
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	for (auto iter = cache_.begin(); iter != cache_.end(); ++iter) {
+		if (iter->size != size)
+			continue;
+
+		int fd = iter->fd;
+		cache_.erase(iter);
+		return fd;
+	}
+
+	int fd = udmabuf_ ? allocateUdmabuf(size) : allocateHeap(size);
+	if (fd < 0)
+		return fd;
+
+	std::pair<uint64_t, uint64_t> id;
+	if (utils::dmabuf_identity(fd, &id))
+		allocated_.insert(id);
+
+	return fd;
+}
+
+int DmaBufAllocator::allocateHeap(size_t size)
+{
+	struct dma_heap_allocation_data alloc = {};
+
+	alloc.len = size;
+	alloc.fd_flags = O_RDWR | O_CLOEXEC;
+
+	int ret = ::ioctl(fd_, DMA_HEAP_IOCTL_ALLOC, &alloc);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Buffer, Error)
+			<< "Failed to allocate " << size << " bytes from DMA heap: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	return alloc.fd;
+}
+
+int DmaBufAllocator::allocateUdmabuf(size_t size)
+{
+	int ret;
+
+	int memfd = memfd_create("libcamera-dmabuf", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+	if (memfd < 0) {
+		ret = -errno;
+		LOG(Buffer, Error)
+			<< "Failed to create memfd: " << strerror(-ret);
+		return ret;
+	}
+
+	/* udmabuf requires the memfd to be sealed against shrinking. */
+	if (ftruncate(memfd, size) < 0 ||
+	    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+		ret = -errno;
+		LOG(Buffer, Error)
+			<< "Failed to prepare memfd: " << strerror(-ret);
+		::close(memfd);
+		return ret;
+	}
+
+	struct udmabuf_create create = {};
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = 0;
+	create.size = size;
+
+	ret = ::ioctl(fd_, UDMABUF_CREATE, &create);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Buffer, Error)
+			<< "Failed to allocate " << size << " bytes from udmabuf: "
+			<< strerror(-ret);
+	}
+
+	/* The udmabuf keeps a reference to the memfd pages. */
+	::close(memfd);
+
+	return ret;
+}
+
+} /* namespace libcamera */
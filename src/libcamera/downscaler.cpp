@@ -0,0 +1,443 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * downscaler.cpp - Software frame downscaler
+ */
+
+#include "downscaler.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "formats.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file downscaler.h
+ * \brief Software frame downscaler
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Downscaler)
+
+/**
+ * \class Downscaler
+ * \brief Downscale frames with a box filter
+ *
+ * The Downscaler class produces a reduced size copy of frames in the same
+ * pixel format, for pipelines whose hardware can only produce a single
+ * resolution. Each output pixel is the average of the block of input pixels it
+ * covers, which avoids the aliasing of simple decimation for any scaling
+ * ratio.
+ *
+ * Frames are scaled one line at a time. The input lines covered by an output
+ * line are first summed in a line accumulator, with a loop that compilers
+ * vectorise, and the output line is then computed from precomputed tables of
+ * the accumulator samples covered by each output byte.
+ *
+ * The downscaler is configured with the pixel format and the input and output
+ * sizes with configure(), and then scales frames with scale(). The scale()
+ * method doesn't modify the downscaler, and can thus be called concurrently
+ * from multiple threads to scale several frames in parallel.
+ */
+
+/**
+ * \brief Construct an unconfigured downscaler
+ */
+Downscaler::Downscaler()
+	: pixelFormat_(0), inputFrameSize_(0), frameSize_(0), stride_(0)
+{
+}
+
+/**
+ * \brief Retrieve the pixel formats supported by the downscaler
+ * \return The list of supported V4L2 pixel formats
+ */
+const std::vector<unsigned int> &Downscaler::formats()
+{
+	static const std::vector<unsigned int> formats = {
+		V4L2_PIX_FMT_GREY,
+		V4L2_PIX_FMT_NV12,
+		V4L2_PIX_FMT_YUYV,
+		V4L2_PIX_FMT_RGB24,
+		V4L2_PIX_FMT_BGR24,
+		V4L2_PIX_FMT_ARGB32,
+	};
+
+	return formats;
+}
+
+/**
+ * \brief Retrieve the size alignment of a pixel format
+ * \param[in] pixelFormat The V4L2 pixel format
+ *
+ * Formats with subsampled chroma components require the frame width and height
+ * to be multiples of the chroma subsampling factors.
+ *
+ * \return The horizontal and vertical alignment of the frame size in pixels
+ */
+Size Downscaler::alignment(unsigned int pixelFormat)
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+
+	return info.isValid() ? info.alignment : Size{ 1, 1 };
+}
+
+/**
+ * \brief Configure the downscaler
+ * \param[in] pixelFormat The V4L2 pixel format of the input and output frames
+ * \param[in] inputSize The input frame size
+ * \param[in] inputStride The input line stride in bytes
+ * \param[in] outputSize The output frame size
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a pixelFormat or the sizes are not supported
+ */
+int Downscaler::configure(unsigned int pixelFormat, const Size &inputSize,
+			  unsigned int inputStride, const Size &outputSize)
+{
+	const std::vector<unsigned int> &pixelFormats = formats();
+	if (std::find(pixelFormats.begin(), pixelFormats.end(), pixelFormat) ==
+	    pixelFormats.end()) {
+		LOG(Downscaler, Error)
+			<< "Unsupported format " << PixelFormat(pixelFormat);
+		return -EINVAL;
+	}
+
+	const Size align = alignment(pixelFormat);
+	if (!outputSize.width || !outputSize.height ||
+	    outputSize.width > inputSize.width ||
+	    outputSize.height > inputSize.height ||
+	    inputSize.width % align.width || inputSize.height % align.height ||
+	    outputSize.width % align.width || outputSize.height % align.height) {
+		LOG(Downscaler, Error)
+			<< "Unsupported scaling from " << inputSize.toString()
+			<< " to " << outputSize.toString();
+		return -EINVAL;
+	}
+
+	planes_.clear();
+	pixelFormat_ = pixelFormat;
+
+	/* The pixels of the first plane of all supported formats are whole bytes. */
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+	unsigned int bytesPerPixel = info.planes[0].bytesPerGroup /
+				     info.pixelsPerGroup;
+
+	if (inputStride < inputSize.width * bytesPerPixel) {
+		LOG(Downscaler, Error) << "Invalid input stride " << inputStride;
+		return -EINVAL;
+	}
+
+	/* Output frames are stored without padding between lines. */
+	stride_ = info.stride(outputSize.width);
+
+	inputFrameSize_ = inputStride * inputSize.height;
+	frameSize_ = info.frameSize(outputSize);
+
+	addPlane(0, inputSize.width, inputSize.height, 0, outputSize.width,
+		 outputSize.height, bytesPerPixel,
+		 pixelFormat == V4L2_PIX_FMT_YUYV);
+	planes_.back().inStride = inputStride;
+
+	/* The NV12 chroma plane stores interleaved CbCr pairs. */
+	if (pixelFormat == V4L2_PIX_FMT_NV12) {
+		addPlane(inputFrameSize_, inputSize.width / 2,
+			 inputSize.height / 2, info.planeSize(outputSize, 0),
+			 outputSize.width / 2, outputSize.height / 2, 2, false);
+		planes_.back().inStride = inputStride;
+
+		inputFrameSize_ += inputFrameSize_ / 2;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the size of a scaled frame
+ * \return The size in bytes of a frame in the configured output size
+ */
+size_t Downscaler::frameSize() const
+{
+	return frameSize_;
+}
+
+/**
+ * \brief Retrieve the line stride of a scaled frame
+ *
+ * Scaled frames are stored without padding between lines.
+ *
+ * \return The stride in bytes of the first plane of a scaled frame
+ */
+unsigned int Downscaler::stride() const
+{
+	return stride_;
+}
+
+/**
+ * \brief Downscale a frame
+ * \param[in] src The input frame
+ * \param[in] srcSize The size of the \a src memory in bytes
+ * \param[out] dst The memory to store the scaled frame
+ * \param[in] dstSize The size of the \a dst memory in bytes
+ *
+ * The input frame shall have the size, stride and pixel format the downscaler
+ * has been configured with.
+ *
+ * \return The size of the scaled frame in bytes on success, or a negative
+ * error code otherwise
+ */
+int Downscaler::scale(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		      size_t dstSize) const
+{
+	if (!pixelFormat_ || srcSize < inputFrameSize_ || dstSize < frameSize_)
+		return -EINVAL;
+
+	for (const Plane &plane : planes_)
+		scalePlane(plane, src, dst);
+
+	return frameSize_;
+}
+
+/*
+ * Compute the input lines and samples covered by the output lines and bytes of
+ * a plane. Pixels are made of bytesPerPixel samples that are scaled
+ * independently. For the YUYV format, the luma samples are scaled per pixel
+ * and the chroma samples per pair of pixels.
+ */
+void Downscaler::addPlane(unsigned int inOffset, unsigned int inWidth,
+			  unsigned int inLines, unsigned int outOffset,
+			  unsigned int outWidth, unsigned int outLines,
+			  unsigned int bytesPerPixel, bool yuyv)
+{
+	Plane plane;
+
+	plane.inOffset = inOffset;
+	plane.inLineSize = inWidth * bytesPerPixel;
+	plane.outOffset = outOffset;
+	plane.outStride = outWidth * bytesPerPixel;
+
+	for (unsigned int y = 0; y <= outLines; ++y)
+		plane.rows.push_back(y * inLines / outLines);
+
+	for (unsigned int i = 0; i < plane.outStride; ++i) {
+		unsigned int in = inWidth;
+		unsigned int out = outWidth;
+		unsigned int step = bytesPerPixel;
+		unsigned int index = i / bytesPerPixel;
+		unsigned int sample = i % bytesPerPixel;
+
+		if (yuyv && i % 2) {
+			/* Chroma samples, shared by pairs of pixels. */
+			in /= 2;
+			out /= 2;
+			step = 4;
+			index = i / 4;
+			sample = i % 4;
+		} else if (yuyv) {
+			sample = 0;
+		}
+
+		unsigned int start = index * in / out;
+		unsigned int end = (index + 1) * in / out;
+
+		plane.taps.push_back({ start * step + sample, step, end - start });
+	}
+
+	planes_.push_back(std::move(plane));
+}
+
+void Downscaler::scalePlane(const Plane &plane, const uint8_t *src,
+			    uint8_t *dst) const
+{
+	const unsigned int lineSize = plane.inLineSize;
+	std::vector<uint32_t> sums(lineSize);
+
+	for (unsigned int y = 0; y < plane.rows.size() - 1; ++y) {
+		const unsigned int first = plane.rows[y];
+		const unsigned int lines = plane.rows[y + 1] - first;
+		const uint8_t *in = src + plane.inOffset + first * plane.inStride;
+		uint32_t *acc = sums.data();
+
+		for (unsigned int i = 0; i < lineSize; ++i)
+			acc[i] = in[i];
+
+		for (unsigned int l = 1; l < lines; ++l) {
+			in += plane.inStride;
+			for (unsigned int i = 0; i < lineSize; ++i)
+				acc[i] += in[i];
+		}
+
+		uint8_t *out = dst + plane.outOffset + y * plane.outStride;
+
+		for (const Tap &tap : plane.taps) {
+			const uint32_t *sample = acc + tap.offset;
+			const uint32_t count = tap.count * lines;
+			uint32_t sum = 0;
+
+			for (unsigned int n = 0; n < tap.count; ++n)
+				sum += sample[n * tap.step];
+
+			*out++ = (sum + count / 2) / count;
+		}
+	}
+}
+
+/**
+ * \class DownscaleStage
+ * \brief Produce a downscaled stream from captured frames
+ *
+ * Many devices produce a single stream, while applications commonly need a
+ * low resolution stream for analysis in addition to a full resolution stream
+ * for display or recording. The DownscaleStage class lets pipeline handlers
+ * expose such a secondary stream, scaling captured frames with a Downscaler in
+ * the worker threads of the ProcessingStage.
+ *
+ * Pipeline handlers validate the secondary stream configuration against the
+ * configuration of the captured stream with validate(), configure the stage
+ * with configure(), and link it to the captured and downscaled streams with
+ * PipelineHandler::addProcessingStage().
+ */
+
+DownscaleStage::DownscaleStage()
+	: ProcessingStage("downscale")
+{
+}
+
+DownscaleStage::~DownscaleStage()
+{
+	wait();
+}
+
+/**
+ * \brief Generate a default configuration for a downscaled stream
+ * \param[in] input The configuration of the captured stream
+ *
+ * The default downscaled stream halves the captured size. The stream formats
+ * report the range of sizes the captured frames can be downscaled to.
+ *
+ * \return The downscaled stream configuration, to be validated with
+ * validate()
+ */
+StreamConfiguration DownscaleStage::generateConfiguration(const StreamConfiguration &input)
+{
+	const std::vector<unsigned int> &formats = Downscaler::formats();
+	const Size align = Downscaler::alignment(input.pixelFormat);
+	std::map<unsigned int, std::vector<SizeRange>> sizes;
+
+	if (std::find(formats.begin(), formats.end(), input.pixelFormat) !=
+	    formats.end())
+		sizes[input.pixelFormat] = {
+			SizeRange(align.width, align.height, input.size.width,
+				  input.size.height, align.width, align.height)
+		};
+
+	StreamConfiguration cfg{ StreamFormats(sizes) };
+	cfg.pixelFormat = input.pixelFormat;
+	cfg.size = Size(input.size.width / 2, input.size.height / 2)
+			   .alignedDownTo(align.width, align.height);
+	cfg.bufferCount = input.bufferCount;
+
+	return cfg;
+}
+
+/**
+ * \brief Validate the configuration of a downscaled stream
+ * \param[in] input The configuration of the captured stream
+ * \param[inout] output The configuration of the downscaled stream
+ *
+ * Adjust the pixel format of the downscaled stream to the pixel format of the
+ * captured stream, and its size to the captured size and to the alignment
+ * constraints of the pixel format. Only the pixel format and size of the \a
+ * output configuration are validated, the buffer count is left to the
+ * pipeline handler.
+ *
+ * \return CameraConfiguration::Invalid if the captured stream format can't be
+ * downscaled, CameraConfiguration::Adjusted if \a output has been adjusted, or
+ * CameraConfiguration::Valid otherwise
+ */
+CameraConfiguration::Status DownscaleStage::validate(const StreamConfiguration &input,
+						     StreamConfiguration *output)
+{
+	CameraConfiguration::Status status = CameraConfiguration::Valid;
+
+	const std::vector<unsigned int> &formats = Downscaler::formats();
+	if (input.modifier ||
+	    std::find(formats.begin(), formats.end(), input.pixelFormat) ==
+	    formats.end())
+		return CameraConfiguration::Invalid;
+
+	if (output->pixelFormat != input.pixelFormat) {
+		LOG(Downscaler, Debug)
+			<< "Adjusting pixel format to " << input.pixelFormat;
+		output->pixelFormat = input.pixelFormat;
+		status = CameraConfiguration::Adjusted;
+	}
+
+	if (output->modifier) {
+		LOG(Downscaler, Debug) << "Adjusting modifier to linear";
+		output->modifier = 0;
+		status = CameraConfiguration::Adjusted;
+	}
+
+	const Size align = Downscaler::alignment(input.pixelFormat);
+	const Size size = output->size;
+
+	output->size.width = utils::clamp(size.width, align.width,
+					  input.size.width);
+	output->size.height = utils::clamp(size.height, align.height,
+					   input.size.height);
+	output->size.width -= output->size.width % align.width;
+	output->size.height -= output->size.height % align.height;
+
+	if (output->size != size) {
+		LOG(Downscaler, Debug)
+			<< "Adjusting size from " << size.toString()
+			<< " to " << output->size.toString();
+		status = CameraConfiguration::Adjusted;
+	}
+
+	return status;
+}
+
+/**
+ * \brief Configure the stage
+ * \param[in] input The configuration of the captured stream
+ * \param[in] output The configuration of the downscaled stream
+ *
+ * The configurations shall have been validated with validate(), and the
+ * stride of the \a input configuration shall be set.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DownscaleStage::configure(const StreamConfiguration &input,
+			      const StreamConfiguration &output)
+{
+	return scaler_.configure(input.pixelFormat, input.size, input.stride,
+				 output.size);
+}
+
+/**
+ * \fn DownscaleStage::frameSize()
+ * \brief Retrieve the size of a downscaled frame
+ * \return The size in bytes of a frame of the downscaled stream
+ */
+
+/**
+ * \fn DownscaleStage::stride()
+ * \brief Retrieve the line stride of a downscaled frame
+ * \return The stride in bytes of the first plane of a downscaled frame
+ */
+
+int DownscaleStage::process(const uint8_t *src, size_t srcSize, uint8_t *dst,
+			    size_t dstSize) const
+{
+	return scaler_.scale(src, srcSize, dst, dstSize);
+}
+
+} /* namespace libcamera */
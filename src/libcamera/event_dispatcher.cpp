@@ -102,6 +102,13 @@ EventDispatcher::~EventDispatcher()
  * notifiers and timers and signals the corresponding EventNotifier and Timer
  * objects. If no events are pending, it waits for the first event and processes
  * it before returning.
+ *
+ * Messages posted to objects bound to the current thread are dispatched after
+ * processing events. As posting a message interrupts processEvents(), messages
+ * are delivered without delay. The number of messages dispatched by a single
+ * call is bounded by the thread dispatch budget (see
+ * Thread::setDispatchBudget()), the remaining messages are dispatched by the
+ * next calls after processing the pending events and timers.
  */
 
 /**
@@ -0,0 +1,304 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * event_dispatcher_epoll.cpp - Epoll-based event dispatcher
+ */
+
+#include "event_dispatcher_epoll.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <libcamera/event_notifier.h>
+#include <libcamera/timer.h>
+
+#include "log.h"
+#include "thread.h"
+
+/**
+ * \file event_dispatcher_epoll.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+static const struct {
+	EventNotifier::Type type;
+	uint32_t events;
+	const char *name;
+} notifierEvents[] = {
+	{ EventNotifier::Read, EPOLLIN, "read" },
+	{ EventNotifier::Write, EPOLLOUT, "write" },
+	{ EventNotifier::Exception, EPOLLPRI, "exception" },
+};
+
+/**
+ * \class EventDispatcherEpoll
+ * \brief An epoll-based event dispatcher
+ *
+ * The EventDispatcherEpoll class implements an event dispatcher based on the
+ * Linux epoll API. Unlike EventDispatcherPoll, file descriptors are registered
+ * with the kernel once when their first notifier is registered, and only the
+ * file descriptors that are ready are processed at every wakeup. This makes the
+ * cost of event processing independent of the number of registered notifiers.
+ *
+ * Timers are stored in a TimerQueue, whose timerfd is monitored along with the
+ * event notifiers.
+ */
+
+EventDispatcherEpoll::EventDispatcherEpoll()
+	: processingFd_(-1)
+{
+	/*
+	 * Create the epoll and event fds. Failures are fatal as we can't
+	 * implement an interruptible dispatcher without them.
+	 */
+	epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create epoll fd";
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create eventfd";
+
+	for (int fd : { eventfd_, timers_.fd() }) {
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+
+		if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &event) < 0)
+			LOG(Event, Fatal)
+				<< "Unable to add fd " << fd << " to epoll: "
+				<< strerror(errno);
+	}
+}
+
+EventDispatcherEpoll::~EventDispatcherEpoll()
+{
+	close(eventfd_);
+	close(epollfd_);
+}
+
+void EventDispatcherEpoll::registerEventNotifier(EventNotifier *notifier)
+{
+	EventNotifierSetEpoll &set = notifiers_[notifier->fd()];
+	EventNotifier::Type type = notifier->type();
+
+	if (set.notifiers[type] && set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< "Ignoring duplicate " << notifierEvents[type].name
+			<< " notifier for fd " << notifier->fd();
+		return;
+	}
+
+	set.notifiers[type] = notifier;
+
+	updateNotifierSet(notifier->fd(), set);
+}
+
+void EventDispatcherEpoll::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	if (!set.notifiers[type])
+		return;
+
+	if (set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierEvents[type].name << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	set.notifiers[type] = nullptr;
+
+	updateNotifierSet(notifier->fd(), set);
+
+	/*
+	 * Don't race with event processing if this method is called from an
+	 * event notifier for the file descriptor being processed. The
+	 * notifiers_ entry will be erased by processNotifiers().
+	 */
+	if (notifier->fd() == processingFd_)
+		return;
+
+	if (set.empty())
+		notifiers_.erase(iter);
+}
+
+void EventDispatcherEpoll::registerTimer(Timer *timer)
+{
+	timers_.add(timer);
+}
+
+void EventDispatcherEpoll::unregisterTimer(Timer *timer)
+{
+	timers_.remove(timer);
+}
+
+void EventDispatcherEpoll::processEvents()
+{
+	struct epoll_event events[MaxEvents];
+	int ret;
+
+	timers_.arm();
+
+	/* Wait for events and process notifiers and timers. */
+	monitor_.waitStarted();
+
+	do {
+		ret = epoll_wait(epollfd_, events, MaxEvents, -1);
+	} while (ret == -1 && errno == EINTR);
+
+	monitor_.waitFinished(ret);
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Event, Warning) << "epoll_wait() failed with "
+				    << strerror(-ret);
+	}
+
+	for (int i = 0; i < ret; ++i) {
+		const struct epoll_event &event = events[i];
+
+		if (event.data.fd == eventfd_)
+			processInterrupt();
+		else if (event.data.fd == timers_.fd())
+			timers_.handleEvent();
+		else
+			processNotifiers(event);
+	}
+
+	timers_.processTimers(&monitor_);
+
+	/* Dispatch the messages posted to the thread. */
+	Thread::current()->dispatchMessageBatch();
+
+	monitor_.dispatchFinished();
+}
+
+void EventDispatcherEpoll::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherEpoll::EventNotifierSetEpoll::computeEvents() const
+{
+	uint32_t mask = 0;
+
+	for (const auto &event : notifierEvents) {
+		if (notifiers[event.type])
+			mask |= event.events;
+	}
+
+	return mask;
+}
+
+bool EventDispatcherEpoll::EventNotifierSetEpoll::empty() const
+{
+	return !notifiers[0] && !notifiers[1] && !notifiers[2];
+}
+
+/*
+ * Propagate the events mask of a notifier set to the epoll instance, adding,
+ * modifying or removing the file descriptor as needed.
+ */
+void EventDispatcherEpoll::updateNotifierSet(int fd, EventNotifierSetEpoll &set)
+{
+	uint32_t mask = set.computeEvents();
+	if (mask == set.events)
+		return;
+
+	struct epoll_event event = {};
+	event.events = mask;
+	event.data.fd = fd;
+
+	int op;
+	if (!set.events)
+		op = EPOLL_CTL_ADD;
+	else if (!mask)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+
+	int ret = epoll_ctl(epollfd_, op, fd, &event);
+	if (ret < 0) {
+		/*
+		 * The kernel removes file descriptors from the epoll set when
+		 * they are closed, which can happen before their notifiers are
+		 * unregistered. Don't complain in that case.
+		 */
+		if (op != EPOLL_CTL_DEL || (errno != EBADF && errno != ENOENT)) {
+			LOG(Event, Error)
+				<< "Unable to update epoll events for fd " << fd
+				<< ": " << strerror(errno);
+			return;
+		}
+	}
+
+	set.events = mask;
+}
+
+void EventDispatcherEpoll::processInterrupt()
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherEpoll::processNotifiers(const struct epoll_event &event)
+{
+	int fd = event.data.fd;
+
+	/*
+	 * The notifiers for the file descriptor may have been unregistered by
+	 * a notifier processed in the same iteration.
+	 */
+	auto iter = notifiers_.find(fd);
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+
+	processingFd_ = fd;
+
+	for (const auto &type : notifierEvents) {
+		EventNotifier *notifier = set.notifiers[type.type];
+		if (!notifier)
+			continue;
+
+		if (event.events & type.events)
+			monitor_.emit(notifier->activated, notifier, type.name, fd);
+	}
+
+	processingFd_ = -1;
+
+	/* Erase the notifiers_ entry if it is now empty. */
+	if (set.empty())
+		notifiers_.erase(iter);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * event_dispatcher_monitor.cpp - Event dispatcher instrumentation
+ */
+
+#include "event_dispatcher_monitor.h"
+
+#include <cxxabi.h>
+#include <sstream>
+#include <stdlib.h>
+#include <typeinfo>
+
+#include "log.h"
+#include "metrics_registry.h"
+#include "utils.h"
+
+/**
+ * \file event_dispatcher_monitor.h
+ * \brief Event dispatcher instrumentation
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+/**
+ * \class EventDispatcherMonitor
+ * \brief Measure where the event dispatchers spend their time
+ *
+ * The EventDispatcherMonitor class instruments the event loop of the event
+ * dispatchers, to find out what delays event processing in a thread. For
+ * every iteration of the loop it records the time spent waiting for events,
+ * the time spent dispatching the events, notifiers, timers and messages, and
+ * the number of ready file descriptors, in the event.wait-us,
+ * event.dispatch-us and event.ready-fds histogram metrics.
+ *
+ * Every event notifier and timer callback emitted through emit() is timed.
+ * Callbacks that exceed a threshold are counted in the event.slow-callbacks
+ * metric, and logged in the Event category at the Warning level along with
+ * the notifier file descriptor and the type and address of the objects whose
+ * slots are connected to the signal.
+ *
+ * Monitoring is disabled by default, and is enabled by setting the
+ * LIBCAMERA_EVENT_MONITOR environment variable to the slow callback threshold
+ * in microseconds, or to 0 to only record the metrics. The variable is read
+ * when the event dispatcher is created. When monitoring is disabled the
+ * instrumentation only costs a check of the enabled() state.
+ */
+
+EventDispatcherMonitor::EventDispatcherMonitor()
+	: enabled_(false), slowThreshold_(0), waitStart_(0), dispatchStart_(0),
+	  waitMetric_(nullptr), dispatchMetric_(nullptr),
+	  readyMetric_(nullptr), slowMetric_(nullptr)
+{
+	const char *threshold = utils::secure_getenv("LIBCAMERA_EVENT_MONITOR");
+	if (!threshold)
+		return;
+
+	char *endptr;
+	unsigned long value = strtoul(threshold, &endptr, 10);
+	if (*threshold == '\0' || *endptr != '\0') {
+		LOG(Event, Warning)
+			<< "Invalid slow callback threshold '" << threshold << "'";
+		return;
+	}
+
+	slowThreshold_ = value * 1000;
+
+	MetricsRegistry *registry = MetricsRegistry::instance();
+	waitMetric_ = registry->histogram("event.wait-us");
+	dispatchMetric_ = registry->histogram("event.dispatch-us");
+	readyMetric_ = registry->histogram("event.ready-fds");
+	slowMetric_ = registry->counter("event.slow-callbacks");
+
+	enabled_ = true;
+}
+
+/**
+ * \fn EventDispatcherMonitor::enabled()
+ * \brief Check if monitoring is enabled
+ * \return True if monitoring is enabled, false otherwise
+ */
+
+/**
+ * \fn EventDispatcherMonitor::waitStarted()
+ * \brief Record the start of the wait for events
+ */
+
+/**
+ * \fn EventDispatcherMonitor::waitFinished()
+ * \brief Record the end of the wait for events
+ * \param[in] ready The number of ready file descriptors
+ */
+
+/**
+ * \fn EventDispatcherMonitor::dispatchFinished()
+ * \brief Record the end of the dispatch of the events
+ */
+
+/**
+ * \fn EventDispatcherMonitor::emit()
+ * \brief Emit the callback signal of a notifier or timer
+ * \param[in] signal The signal to emit
+ * \param[in] sender The notifier or timer emitting the signal
+ * \param[in] source A description of the callback source
+ * \param[in] fd The notifier file descriptor, or -1 for timers
+ */
+
+uint64_t EventDispatcherMonitor::now()
+{
+	return utils::monotonic_ns();
+}
+
+void EventDispatcherMonitor::recordWait(int ready)
+{
+	dispatchStart_ = now();
+
+	waitMetric_->add((dispatchStart_ - waitStart_) / 1000);
+	readyMetric_->add(ready > 0 ? ready : 0);
+}
+
+void EventDispatcherMonitor::recordDispatch()
+{
+	dispatchMetric_->add((now() - dispatchStart_) / 1000);
+}
+
+void EventDispatcherMonitor::recordCallback(uint64_t duration,
+					    const SlotList *slots,
+					    const char *source, int fd)
+{
+	if (!slowThreshold_ || duration < slowThreshold_)
+		return;
+
+	slowMetric_->add();
+
+	/* Identify the slots by the type of their object and its address. */
+	std::ostringstream slotNames;
+	for (unsigned int i = 0; slots && i < slots->size(); ++i) {
+		const SlotBase *slot = (*slots)[i].get();
+		const char *name = typeid(*slot).name();
+		int status;
+
+		char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+		slotNames << ", slot " << (demangled ? demangled : name)
+			  << " object " << slot->obj_;
+		free(demangled);
+	}
+
+	LOG(Event, Warning)
+		<< "Slow " << source << " callback"
+		<< (fd >= 0 ? " for fd " + std::to_string(fd) : "")
+		<< ": " << duration / 1000 << "us" << slotNames.str();
+}
+
+} /* namespace libcamera */
@@ -8,7 +8,6 @@
 #include "event_dispatcher_poll.h"
 
 #include <algorithm>
-#include <iomanip>
 #include <poll.h>
 #include <stdint.h>
 #include <string.h>
@@ -19,6 +18,7 @@
 #include <libcamera/timer.h>
 
 #include "log.h"
+#include "thread.h"
 
 /**
  * \file event_dispatcher_poll.h
@@ -112,31 +112,12 @@ void EventDispatcherPoll::unregisterEventNotifier(EventNotifier *notifier)
 
 void EventDispatcherPoll::registerTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if ((*iter)->deadline() > timer->deadline()) {
-			timers_.insert(iter, timer);
-			return;
-		}
-	}
-
-	timers_.push_back(timer);
+	timers_.add(timer);
 }
 
 void EventDispatcherPoll::unregisterTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if (*iter == timer) {
-			timers_.erase(iter);
-			return;
-		}
-
-		/*
-		 * As the timers list is ordered, we can stop as soon as we go
-		 * past the deadline.
-		 */
-		if ((*iter)->deadline() > timer->deadline())
-			break;
-	}
+	timers_.remove(timer);
 }
 
 void EventDispatcherPoll::processEvents()
@@ -145,28 +126,41 @@ void EventDispatcherPoll::processEvents()
 
 	/* Create the pollfd array. */
 	std::vector<struct pollfd> pollfds;
-	pollfds.reserve(notifiers_.size() + 1);
+	pollfds.reserve(notifiers_.size() + 2);
 
 	for (auto notifier : notifiers_)
 		pollfds.push_back({ notifier.first, notifier.second.events(), 0 });
 
+	pollfds.push_back({ timers_.fd(), POLLIN, 0 });
 	pollfds.push_back({ eventfd_, POLLIN, 0 });
 
 	/* Wait for events and process notifiers and timers. */
+	monitor_.waitStarted();
+
 	do {
 		ret = poll(&pollfds);
 	} while (ret == -1 && errno == EINTR);
 
+	monitor_.waitFinished(ret);
+
 	if (ret < 0) {
 		ret = -errno;
 		LOG(Event, Warning) << "poll() failed with " << strerror(-ret);
 	} else if (ret > 0) {
 		processInterrupt(pollfds.back());
 		pollfds.pop_back();
+		if (pollfds.back().revents & POLLIN)
+			timers_.handleEvent();
+		pollfds.pop_back();
 		processNotifiers(pollfds);
 	}
 
-	processTimers();
+	timers_.processTimers(&monitor_);
+
+	/* Dispatch the messages posted to the thread. */
+	Thread::current()->dispatchMessageBatch();
+
+	monitor_.dispatchFinished();
 }
 
 void EventDispatcherPoll::interrupt()
@@ -198,31 +192,13 @@ short EventDispatcherPoll::EventNotifierSetPoll::events() const
 
 int EventDispatcherPoll::poll(std::vector<struct pollfd> *pollfds)
 {
-	/* Compute the timeout. */
-	Timer *nextTimer = !timers_.empty() ? timers_.front() : nullptr;
-	struct timespec timeout;
-
-	if (nextTimer) {
-		clock_gettime(CLOCK_MONOTONIC, &timeout);
-		uint64_t now = timeout.tv_sec * 1000000000ULL + timeout.tv_nsec;
-
-		if (nextTimer->deadline() > now) {
-			uint64_t delta = nextTimer->deadline() - now;
-			timeout.tv_sec = delta / 1000000000ULL;
-			timeout.tv_nsec = delta % 1000000000ULL;
-		} else {
-			timeout.tv_sec = 0;
-			timeout.tv_nsec = 0;
-		}
-
-		LOG(Event, Debug)
-			<< "timeout " << timeout.tv_sec << "."
-			<< std::setfill('0') << std::setw(9)
-			<< timeout.tv_nsec;
-	}
+	/*
+	 * Timers are signalled through the timer queue timerfd, there's thus
+	 * no need to compute a timeout.
+	 */
+	timers_.arm();
 
-	return ppoll(pollfds->data(), pollfds->size(),
-		     nextTimer ? &timeout : nullptr, nullptr);
+	return ppoll(pollfds->data(), pollfds->size(), nullptr, nullptr);
 }
 
 void EventDispatcherPoll::processInterrupt(const struct pollfd &pfd)
@@ -279,7 +255,8 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 			}
 
 			if (pfd.revents & event.events)
-				notifier->activated.emit(notifier);
+				monitor_.emit(notifier->activated, notifier,
+					      notifierType(event.type), pfd.fd);
 		}
 
 		/* Erase the notifiers_ entry if it is now empty. */
@@ -290,22 +267,4 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 	processingEvents_ = false;
 }
 
-void EventDispatcherPoll::processTimers()
-{
-	struct timespec ts;
-	uint64_t now;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-
-	while (!timers_.empty()) {
-		Timer *timer = timers_.front();
-		if (timer->deadline() > now)
-			break;
-
-		timers_.pop_front();
-		timer->stop();
-		timer->timeout.emit(timer);
-	}
-}
-
 } /* namespace libcamera */
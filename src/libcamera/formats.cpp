@@ -7,7 +7,12 @@
 
 #include "formats.h"
 
+#include <algorithm>
+#include <ctype.h>
 #include <errno.h>
+#include <iomanip>
+
+#include <linux/videodev2.h>
 
 /**
  * \file formats.h
@@ -16,6 +21,337 @@
 
 namespace libcamera {
 
+/**
+ * \class PixelFormat
+ * \brief A V4L2 pixel format identified by its fourcc
+ *
+ * Pixel formats are passed around as integer fourcc values. The PixelFormat
+ * class wraps a fourcc in a value type that can be constructed at compile time
+ * from its four characters, formatted to a stream without allocating memory,
+ * and associated with the information describing the format layout.
+ */
+
+/**
+ * \fn PixelFormat::PixelFormat()
+ * \brief Construct an invalid PixelFormat with a zero fourcc
+ */
+
+/**
+ * \fn PixelFormat::PixelFormat(unsigned int fourcc)
+ * \brief Construct a PixelFormat from a fourcc value
+ * \param[in] fourcc The fourcc value, as defined by the V4L2 API
+ */
+
+/**
+ * \fn PixelFormat::PixelFormat(char a, char b, char c, char d)
+ * \brief Construct a PixelFormat from the four characters of its fourcc
+ * \param[in] a The first character of the fourcc
+ * \param[in] b The second character of the fourcc
+ * \param[in] c The third character of the fourcc
+ * \param[in] d The fourth character of the fourcc
+ *
+ * The fourcc value is computed as by the v4l2_fourcc() macro.
+ */
+
+/**
+ * \fn PixelFormat::fourcc()
+ * \brief Retrieve the fourcc value of the pixel format
+ * \return The fourcc value
+ */
+
+/**
+ * \brief Retrieve the information describing the pixel format
+ * \return The pixel format information, see PixelFormatInfo::info()
+ */
+const PixelFormatInfo &PixelFormat::info() const
+{
+	return PixelFormatInfo::info(fourcc_);
+}
+
+/**
+ * \fn bool operator==(const PixelFormat &lhs, const PixelFormat &rhs)
+ * \brief Compare pixel formats for equality
+ * \return True if the two pixel formats have the same fourcc, false otherwise
+ */
+
+/**
+ * \fn bool operator!=(const PixelFormat &lhs, const PixelFormat &rhs)
+ * \brief Compare pixel formats for inequality
+ * \return True if the two pixel formats have different fourccs, false otherwise
+ */
+
+/**
+ * \brief Insert a text representation of a PixelFormat into an output stream
+ * \param[in] out The output stream
+ * \param[in] format The pixel format
+ *
+ * The pixel format is represented by the four characters of its fourcc when
+ * they are all printable, and by its fourcc value in hexadecimal otherwise.
+ * No temporary string is allocated.
+ *
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const PixelFormat &format)
+{
+	unsigned int fourcc = format.fourcc();
+	char name[4];
+	bool printable = true;
+
+	for (unsigned int i = 0; i < sizeof(name); ++i) {
+		name[i] = (fourcc >> (i * 8)) & 0xff;
+		printable &= isprint(name[i]) != 0;
+	}
+
+	if (printable)
+		return out.write(name, sizeof(name));
+
+	std::ios_base::fmtflags flags = out.flags();
+	char fill = out.fill('0');
+	out << "0x" << std::hex << std::setw(8) << fourcc;
+	out.fill(fill);
+	out.flags(flags);
+
+	return out;
+}
+
+namespace {
+
+/*
+ * Formats with chroma subsampling or a colour filter array pattern require
+ * frame sizes to be multiples of the pattern size.
+ */
+constexpr Size Align1x1{ 1, 1 };
+constexpr Size Align2x1{ 2, 1 };
+constexpr Size Align2x2{ 2, 2 };
+
+const PixelFormatInfo pixelFormatInfo[] = {
+	/* Greyscale and RGB formats. */
+	{ V4L2_PIX_FMT_GREY, 8, 1, {{ { 1, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align1x1, false },
+	{ V4L2_PIX_FMT_RGB24, 24, 1, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align1x1, false },
+	{ V4L2_PIX_FMT_BGR24, 24, 1, {{ { 3, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align1x1, false },
+	{ V4L2_PIX_FMT_ARGB32, 32, 1, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align1x1, false },
+
+	/* YUV packed formats. */
+	{ V4L2_PIX_FMT_YUYV, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x1, false },
+	{ V4L2_PIX_FMT_YVYU, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x1, false },
+	{ V4L2_PIX_FMT_UYVY, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x1, false },
+	{ V4L2_PIX_FMT_VYUY, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x1, false },
+
+	/*
+	 * YUV semi-planar and planar formats. The tiled formats are described
+	 * by their linear equivalent, the tiling is handled by the format
+	 * modifier.
+	 */
+	{ V4L2_PIX_FMT_NV12, 12, 2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_NV21, 12, 2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_NV12M, 12, 2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }}, 2, Align2x2, false },
+	{ V4L2_PIX_FMT_NV12MT, 12, 2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }}, 2, Align2x2, false },
+	{ V4L2_PIX_FMT_NV12MT_16X16, 12, 2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }}, 2, Align2x2, false },
+	{ V4L2_PIX_FMT_SUNXI_TILED_NV12, 12, 2, {{ { 2, 1 }, { 2, 2 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_NV16, 16, 2, {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }}, 1, Align2x1, false },
+	{ V4L2_PIX_FMT_NV61, 16, 2, {{ { 2, 1 }, { 2, 1 }, { 0, 0 } }}, 1, Align2x1, false },
+	{ V4L2_PIX_FMT_YUV420, 12, 2, {{ { 2, 1 }, { 1, 2 }, { 1, 2 } }}, 1, Align2x2, false },
+
+	/*
+	 * Bayer formats. Unpacked formats store samples in 16-bit words, MIPI
+	 * packed formats store 4 pixels in 5 bytes, and IPU3 packed formats
+	 * store 25 pixels in 32 bytes.
+	 */
+	{ V4L2_PIX_FMT_SBGGR8, 8, 2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SGBRG8, 8, 2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SGRBG8, 8, 2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SRGGB8, 8, 2, {{ { 2, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SBGGR10, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SGBRG10, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SGRBG10, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SRGGB10, 16, 2, {{ { 4, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SBGGR10P, 10, 4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SGBRG10P, 10, 4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SGRBG10P, 10, 4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_SRGGB10P, 10, 4, {{ { 5, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_IPU3_SBGGR10, 10, 25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_IPU3_SGBRG10, 10, 25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_IPU3_SGRBG10, 10, 25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+	{ V4L2_PIX_FMT_IPU3_SRGGB10, 10, 25, {{ { 32, 1 }, { 0, 0 }, { 0, 0 } }}, 1, Align2x2, false },
+
+	/* Compressed formats, whose frame size depends on the content. */
+	{ V4L2_PIX_FMT_MJPEG, 0, 1, {{ { 0, 0 }, { 0, 0 }, { 0, 0 } }}, 1, Align1x1, true },
+	{ V4L2_PIX_FMT_JPEG, 0, 1, {{ { 0, 0 }, { 0, 0 }, { 0, 0 } }}, 1, Align1x1, true },
+	{ V4L2_PIX_FMT_H264, 0, 1, {{ { 0, 0 }, { 0, 0 }, { 0, 0 } }}, 1, Align1x1, true },
+};
+
+} /* namespace */
+
+/**
+ * \class PixelFormatInfo
+ * \brief Information describing the memory layout of a pixel format
+ *
+ * The PixelFormatInfo class stores the information needed to compute the
+ * layout of the frames of the pixel formats known to libcamera: line strides,
+ * plane and frame sizes, and size constraints. It allows sizing buffers from
+ * a pixel format and frame size alone, without a round trip through a V4L2
+ * device to set the format. The information is stored in a table precomputed
+ * at compile time, and retrieved with info().
+ *
+ * Pixels are stored in groups, the smallest sequence of pixels of a line whose
+ * samples start and end at byte boundaries. The size of a group in bytes is
+ * stored for each colour plane, and includes the horizontal subsampling of
+ * the plane.
+ */
+
+/**
+ * \var PixelFormatInfo::MaxPlanes
+ * \brief The maximum number of colour planes of a pixel format
+ */
+constexpr unsigned int PixelFormatInfo::MaxPlanes;
+
+/**
+ * \struct PixelFormatInfo::Plane
+ * \brief Information describing a colour plane of a pixel format
+ *
+ * \var PixelFormatInfo::Plane::bytesPerGroup
+ * \brief The number of bytes storing a group of pixels in the plane, or 0 if
+ * the plane doesn't exist
+ *
+ * \var PixelFormatInfo::Plane::verticalSubSampling
+ * \brief The vertical subsampling factor of the plane
+ */
+
+/**
+ * \fn PixelFormatInfo::isValid()
+ * \brief Check if the pixel format information is valid
+ * \return True if the pixel format is known, false otherwise
+ */
+
+/**
+ * \var PixelFormatInfo::fourcc
+ * \brief The fourcc of the pixel format, or 0 if the format is unknown
+ */
+
+/**
+ * \var PixelFormatInfo::bitsPerPixel
+ * \brief The average number of bits per pixel over all planes, or 0 for
+ * compressed formats
+ */
+
+/**
+ * \var PixelFormatInfo::pixelsPerGroup
+ * \brief The number of pixels in a group
+ */
+
+/**
+ * \var PixelFormatInfo::planes
+ * \brief The information describing each colour plane
+ */
+
+/**
+ * \var PixelFormatInfo::memoryPlanes
+ * \brief The number of memory planes
+ *
+ * Multiplanar formats store each colour plane in a separate memory plane.
+ * Other formats store all colour planes contiguously in a single memory plane.
+ */
+
+/**
+ * \var PixelFormatInfo::alignment
+ * \brief The horizontal and vertical alignment of frame sizes in pixels
+ */
+
+/**
+ * \var PixelFormatInfo::compressed
+ * \brief True for compressed formats, whose frame size depends on the content
+ */
+
+/**
+ * \brief Retrieve the number of colour planes
+ * \return The number of colour planes, or 0 for compressed and unknown formats
+ */
+unsigned int PixelFormatInfo::numPlanes() const
+{
+	unsigned int count = 0;
+
+	for (const Plane &plane : planes) {
+		if (plane.bytesPerGroup)
+			count++;
+	}
+
+	return count;
+}
+
+/**
+ * \brief Compute the line stride of a colour plane
+ * \param[in] width The frame width in pixels
+ * \param[in] plane The colour plane index
+ * \param[in] align The stride alignment in bytes
+ * \return The line stride in bytes, or 0 if the plane doesn't exist
+ */
+unsigned int PixelFormatInfo::stride(unsigned int width, unsigned int plane,
+				     unsigned int align) const
+{
+	if (plane >= planes.size() || !planes[plane].bytesPerGroup)
+		return 0;
+
+	unsigned int groups = (width + pixelsPerGroup - 1) / pixelsPerGroup;
+	unsigned int stride = groups * planes[plane].bytesPerGroup;
+
+	return (stride + align - 1) / align * align;
+}
+
+/**
+ * \brief Compute the size of a colour plane
+ * \param[in] size The frame size in pixels
+ * \param[in] plane The colour plane index
+ * \param[in] align The stride alignment in bytes
+ * \return The plane size in bytes, or 0 if the plane doesn't exist
+ */
+unsigned int PixelFormatInfo::planeSize(const Size &size, unsigned int plane,
+					unsigned int align) const
+{
+	unsigned int stride = this->stride(size.width, plane, align);
+	if (!stride)
+		return 0;
+
+	unsigned int subSampling = planes[plane].verticalSubSampling;
+	unsigned int height = (size.height + subSampling - 1) / subSampling;
+
+	return stride * height;
+}
+
+/**
+ * \brief Compute the size of a frame
+ * \param[in] size The frame size in pixels
+ * \param[in] align The stride alignment in bytes
+ * \return The frame size in bytes, or 0 for compressed formats
+ */
+unsigned int PixelFormatInfo::frameSize(const Size &size,
+					unsigned int align) const
+{
+	unsigned int total = 0;
+
+	for (unsigned int i = 0; i < planes.size(); ++i)
+		total += planeSize(size, i, align);
+
+	return total;
+}
+
+/**
+ * \brief Retrieve the information describing a pixel format
+ * \param[in] fourcc The pixel format fourcc
+ * \return The pixel format information, or an invalid PixelFormatInfo if the
+ * format is unknown
+ */
+const PixelFormatInfo &PixelFormatInfo::info(unsigned int fourcc)
+{
+	static const PixelFormatInfo invalid{};
+
+	for (const PixelFormatInfo &info : pixelFormatInfo) {
+		if (info.fourcc == fourcc)
+			return info;
+	}
+
+	return invalid;
+}
+
 /**
  * \class ImageFormats
  * \brief Describe V4L2Device and V4L2SubDevice image formats
@@ -29,6 +365,10 @@ namespace libcamera {
  * media bus codes. Both are defined by the V4L2 specification.
  *
  * Sizes are stored as a list of SizeRange.
+ *
+ * Formats are kept sorted in a flat array, with their sizes stored in a
+ * parallel array, to make lookups cheap for the callers that query the formats
+ * on every configuration.
  */
 
 /**
@@ -41,10 +381,13 @@ namespace libcamera {
  */
 int ImageFormats::addFormat(unsigned int format, const std::vector<SizeRange> &sizes)
 {
-	if (data_.find(format) != data_.end())
+	auto it = std::lower_bound(formats_.begin(), formats_.end(), format);
+	if (it != formats_.end() && *it == format)
 		return -EEXIST;
 
-	data_[format] = sizes;
+	unsigned int index = it - formats_.begin();
+	formats_.insert(it, format);
+	sizes_.insert(sizes_.begin() + index, sizes);
 
 	return 0;
 }
@@ -55,24 +398,14 @@ int ImageFormats::addFormat(unsigned int format, const std::vector<SizeRange> &s
  */
 bool ImageFormats::isEmpty() const
 {
-	return data_.empty();
+	return formats_.empty();
 }
 
 /**
+ * \fn ImageFormats::formats()
  * \brief Retrieve a list of all supported image formats
- * \return List of pixel formats or media bus codes
+ * \return List of pixel formats or media bus codes, sorted in ascending order
  */
-std::vector<unsigned int> ImageFormats::formats() const
-{
-	std::vector<unsigned int> formats;
-	formats.reserve(data_.size());
-
-	/* \todo: Should this be cached instead of computed each time? */
-	for (auto const &it : data_)
-		formats.push_back(it.first);
-
-	return formats;
-}
 
 /**
  * \brief Retrieve all sizes for a specific format
@@ -88,20 +421,29 @@ const std::vector<SizeRange> &ImageFormats::sizes(unsigned int format) const
 {
 	static std::vector<SizeRange> empty;
 
-	auto const &it = data_.find(format);
-	if (it == data_.end())
+	auto it = std::lower_bound(formats_.begin(), formats_.end(), format);
+	if (it == formats_.end() || *it != format)
 		return empty;
 
-	return it->second;
+	return sizes_[it - formats_.begin()];
 }
 
 /**
  * \brief Retrieve the map that associates formats to image sizes
+ *
+ * The map is constructed on every call, callers that only need to look up
+ * formats or sizes should use formats() and sizes() instead.
+ *
  * \return The map that associates formats to image sizes
  */
-const std::map<unsigned int, std::vector<SizeRange>> &ImageFormats::data() const
+std::map<unsigned int, std::vector<SizeRange>> ImageFormats::data() const
 {
-	return data_;
+	std::map<unsigned int, std::vector<SizeRange>> data;
+
+	for (unsigned int i = 0; i < formats_.size(); ++i)
+		data[formats_[i]] = sizes_[i];
+
+	return data;
 }
 
 } /* namespace libcamera */
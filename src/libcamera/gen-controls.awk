@@ -63,12 +63,29 @@ function ExitNameSpace(file) {
 	print "} /* namespace libcamera */" > file
 }
 
+function CType(type) {
+	if (type == "Bool")
+		return "bool"
+	if (type == "Integer")
+		return "int"
+	if (type == "Integer64")
+		return "int64_t"
+	if (type == "Rectangle")
+		return "Rectangle"
+	print "Unknown control type " type > "/dev/stderr"
+	exit 1
+}
+
 function GenerateHeader(file) {
 	Header(file, "Control ID list")
 
 	print "#ifndef __LIBCAMERA_CONTROL_IDS_H__" > file
 	print "#define __LIBCAMERA_CONTROL_IDS_H__" > file
 	print "" > file
+	print "#include <stdint.h>" > file
+	print "" > file
+	print "#include <libcamera/geometry.h>" > file
+	print "" > file
 
 	EnterNameSpace(file)
 	print "enum ControlId {" > file
@@ -76,6 +93,33 @@ function GenerateHeader(file) {
 		printf "\t%s,\n", names[i] > file
 	}
 	print "};" > file
+	print "" > file
+	printf "static constexpr unsigned int ControlIdCount = %s + 1;\n", names[id] > file
+	print "" > file
+
+	print "template<typename T>" > file
+	print "class Control" > file
+	print "{" > file
+	print "public:" > file
+	print "\tconstexpr Control(ControlId id)" > file
+	print "\t\t: id_(id)" > file
+	print "\t{" > file
+	print "\t}" > file
+	print "" > file
+	print "\tconstexpr ControlId id() const { return id_; }" > file
+	print "" > file
+	print "private:" > file
+	print "\tControlId id_;" > file
+	print "};" > file
+	print "" > file
+
+	print "namespace controls {" > file
+	print "" > file
+	for (i=1; i <= id; ++i) {
+		printf "static constexpr Control<%s> %s(libcamera::%s);\n", CType(types[i]), names[i], names[i] > file
+	}
+	print "" > file
+	print "} /* namespace controls */" > file
 	ExitNameSpace(file)
 
 	print "" > file
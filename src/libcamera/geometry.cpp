@@ -57,19 +57,31 @@ const std::string Rectangle::toString() const
 {
 	std::stringstream ss;
 
-	ss << "(" << x << "x" << y << ")/" << w << "x" << h;
+	ss << *this;
 
 	return ss.str();
 }
 
 /**
+ * \fn bool operator==(const Rectangle &lhs, const Rectangle &rhs)
  * \brief Compare rectangles for equality
  * \return True if the two rectangles are equal, false otherwise
  */
-bool operator==(const Rectangle &lhs, const Rectangle &rhs)
+
+/**
+ * \brief Insert a text representation of a Rectangle into an output stream
+ * \param[in] out The output stream
+ * \param[in] rect The rectangle
+ *
+ * The stream operators format the geometry types without allocating
+ * temporary strings, and should be preferred over toString() when logging.
+ *
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const Rectangle &rect)
 {
-	return lhs.x == rhs.x && lhs.y == rhs.y &&
-	       lhs.w == rhs.w && lhs.h == rhs.h;
+	out << "(" << rect.x << "x" << rect.y << ")/" << rect.w << "x" << rect.h;
+	return out;
 }
 
 /**
@@ -117,15 +129,55 @@ const std::string Size::toString() const
 }
 
 /**
+ * \fn Size::isNull()
+ * \brief Check if the size is null
+ * \return True if both the width and height are 0, or false otherwise
+ */
+
+/**
+ * \fn Size::alignedDownTo(unsigned int hAlignment, unsigned int vAlignment)
+ * \brief Align the size down horizontally and vertically
+ * \param[in] hAlignment Horizontal alignment
+ * \param[in] vAlignment Vertical alignment
+ * \return A Size whose width and height are equal to the width and height of
+ * this size rounded down to the nearest multiple of \a hAlignment and
+ * \a vAlignment respectively
+ */
+
+/**
+ * \fn Size::alignedUpTo(unsigned int hAlignment, unsigned int vAlignment)
+ * \brief Align the size up horizontally and vertically
+ * \param[in] hAlignment Horizontal alignment
+ * \param[in] vAlignment Vertical alignment
+ * \return A Size whose width and height are equal to the width and height of
+ * this size rounded up to the nearest multiple of \a hAlignment and
+ * \a vAlignment respectively
+ */
+
+/**
+ * \fn Size::boundedTo(const Size &bound)
+ * \brief Bound the size to \a bound
+ * \param[in] bound The maximum size
+ * \return A Size whose width and height are the minimum of the width and
+ * height of this size and the \a bound size
+ */
+
+/**
+ * \fn Size::expandedTo(const Size &expand)
+ * \brief Expand the size to \a expand
+ * \param[in] expand The minimum size
+ * \return A Size whose width and height are the maximum of the width and
+ * height of this size and the \a expand size
+ */
+
+/**
+ * \fn bool operator==(const Size &lhs, const Size &rhs)
  * \brief Compare sizes for equality
  * \return True if the two sizes are equal, false otherwise
  */
-bool operator==(const Size &lhs, const Size &rhs)
-{
-	return lhs.width == rhs.width && lhs.height == rhs.height;
-}
 
 /**
+ * \fn bool operator<(const Size &lhs, const Size &rhs)
  * \brief Compare sizes for smaller than order
  *
  * Sizes are compared on three criteria, in the following order.
@@ -136,23 +188,17 @@ bool operator==(const Size &lhs, const Size &rhs)
  *
  * \return True if \a lhs is smaller than \a rhs, false otherwise
  */
-bool operator<(const Size &lhs, const Size &rhs)
+
+/**
+ * \brief Insert a text representation of a Size into an output stream
+ * \param[in] out The output stream
+ * \param[in] size The size
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const Size &size)
 {
-	if (lhs.width < rhs.width && lhs.height < rhs.height)
-		return true;
-	else if (lhs.width >= rhs.width && lhs.height >= rhs.height)
-		return false;
-
-	uint64_t larea = static_cast<uint64_t>(lhs.width) *
-			 static_cast<uint64_t>(lhs.height);
-	uint64_t rarea = static_cast<uint64_t>(rhs.width) *
-			 static_cast<uint64_t>(rhs.height);
-	if (larea < rarea)
-		return true;
-	else if (larea > rarea)
-		return false;
-
-	return lhs.width < rhs.width;
+	out << size.width << "x" << size.height;
+	return out;
 }
 
 /**
@@ -267,20 +313,11 @@ bool operator<(const Size &lhs, const Size &rhs)
  */
 
 /**
+ * \fn SizeRange::contains(const Size &size)
  * \brief Test if a size is contained in the range
  * \param[in] size Size to check
  * \returns True if \a size is contained in the range
  */
-bool SizeRange::contains(const Size &size) const
-{
-	if (size.width < min.width || size.width > max.width ||
-	    size.height < min.height || size.height > max.height ||
-	    (hStep && (size.width - min.width) % hStep) ||
-	    (vStep && (size.height - min.height) % vStep))
-		return false;
-
-	return true;
-}
 
 /**
  * \brief Assemble and return a string describing the size range
@@ -290,19 +327,28 @@ std::string SizeRange::toString() const
 {
 	std::stringstream ss;
 
-	ss << "(" << min.toString() << ")-(" << max.toString() << ")/(+"
-	   << hStep << ",+" << vStep << ")";
+	ss << *this;
 
 	return ss.str();
 }
 
 /**
+ * \fn bool operator==(const SizeRange &lhs, const SizeRange &rhs)
  * \brief Compare size ranges for equality
  * \return True if the two size ranges are equal, false otherwise
  */
-bool operator==(const SizeRange &lhs, const SizeRange &rhs)
+
+/**
+ * \brief Insert a text representation of a SizeRange into an output stream
+ * \param[in] out The output stream
+ * \param[in] range The size range
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const SizeRange &range)
 {
-	return lhs.min == rhs.min && lhs.max == rhs.max;
+	out << "(" << range.min << ")-(" << range.max << ")/(+"
+	    << range.hStep << ",+" << range.vStep << ")";
+	return out;
 }
 
 /**
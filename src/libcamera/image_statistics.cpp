@@ -0,0 +1,554 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * image_statistics.cpp - Image statistics computed on the CPU
+ */
+
+#include <libcamera/image_statistics.h>
+
+#include <algorithm>
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/raw_unpack.h>
+
+#include "log.h"
+
+/**
+ * \file image_statistics.h
+ * \brief Image statistics computed on the CPU
+ *
+ * Pipelines without hardware statistics, such as UVC and VIMC, need to compute
+ * the statistics used by the auto-exposure and auto-white balance algorithms
+ * in software. The ImageStatisticsCalculator computes a luma histogram and the
+ * mean of the colour channels directly from the frame memory, optionally
+ * subsampling the frame to bound the CPU usage.
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(ImageStatistics)
+
+namespace {
+
+enum Layout {
+	LayoutRGB,
+	LayoutYUYV,
+	LayoutNV,
+	LayoutBayer,
+};
+
+enum Colour {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+/*
+ * Statistics accumulated over a frame. Consecutive luma samples are counted in
+ * four histograms in turn, as incrementing the same bin repeatedly would
+ * otherwise serialise the loop on the memory dependency.
+ */
+struct Accumulator {
+	uint32_t histograms[4][ImageStatistics::HistogramBins];
+	uint64_t sums[3];
+	uint64_t counts[3];
+};
+
+void accumulateRGB(const uint8_t *line, unsigned int width, unsigned int step,
+		   const unsigned int *offsets, Accumulator *acc)
+{
+	const uint8_t *red = line + offsets[Red];
+	const uint8_t *green = line + offsets[Green];
+	const uint8_t *blue = line + offsets[Blue];
+	uint32_t sums[3] = {};
+	unsigned int count = 0;
+
+	for (unsigned int x = 0; x < width; x += step, ++count) {
+		const unsigned int r = red[x * 3];
+		const unsigned int g = green[x * 3];
+		const unsigned int b = blue[x * 3];
+
+		sums[Red] += r;
+		sums[Green] += g;
+		sums[Blue] += b;
+		acc->histograms[count % 4][(77 * r + 150 * g + 29 * b + 128) >> 8]++;
+	}
+
+	for (unsigned int c = 0; c < 3; ++c) {
+		acc->sums[c] += sums[c];
+		acc->counts[c] += count;
+	}
+}
+
+/*
+ * Accumulate the luma samples of a line, spaced by step pixels of size bytes,
+ * converted to full range through the lut.
+ */
+void accumulateLuma(const uint8_t *line, unsigned int width, unsigned int step,
+		    unsigned int size, const uint8_t *lut, Accumulator *acc)
+{
+	uint32_t sum = 0;
+	unsigned int count = 0;
+
+	for (unsigned int x = 0; x < width; x += step, ++count) {
+		const unsigned int y = line[x * size];
+
+		sum += y;
+		acc->histograms[count % 4][lut[y]]++;
+	}
+
+	acc->sums[0] += sum;
+	acc->counts[0] += count;
+}
+
+/* Accumulate chroma pairs spaced by step bytes. */
+void accumulateChroma(const uint8_t *u, const uint8_t *v, unsigned int length,
+		      unsigned int step, Accumulator *acc)
+{
+	uint32_t sums[2] = {};
+	unsigned int count = 0;
+
+	for (unsigned int x = 0; x < length; x += step, ++count) {
+		sums[0] += u[x];
+		sums[1] += v[x];
+	}
+
+	acc->sums[1] += sums[0];
+	acc->sums[2] += sums[1];
+	acc->counts[1] += count;
+	acc->counts[2] += count;
+}
+
+/*
+ * Accumulate the 2x2 quads of two lines of Bayer samples. The positions give
+ * the index of the red, first green, second green and blue samples within a
+ * quad, in raster order.
+ */
+template<typename T>
+void accumulateBayer(const T *line0, const T *line1, unsigned int width,
+		     unsigned int step, const unsigned int *positions,
+		     unsigned int shift, Accumulator *acc)
+{
+	const T *lines[2] = { line0, line1 };
+	const T *red = lines[positions[0] / 2] + positions[0] % 2;
+	const T *green0 = lines[positions[1] / 2] + positions[1] % 2;
+	const T *green1 = lines[positions[2] / 2] + positions[2] % 2;
+	const T *blue = lines[positions[3] / 2] + positions[3] % 2;
+	uint32_t sums[3] = {};
+	unsigned int count = 0;
+
+	for (unsigned int x = 0; x + 1 < width; x += step, ++count) {
+		/* The green value is the sum of the two green samples. */
+		const unsigned int r = red[x];
+		const unsigned int g = green0[x] + green1[x];
+		const unsigned int b = blue[x];
+
+		sums[Red] += r;
+		sums[Green] += g;
+		sums[Blue] += b;
+
+		const unsigned int y = (77 * r + 75 * g + 29 * b + 128) >> 8;
+		acc->histograms[count % 4][y >> shift]++;
+	}
+
+	acc->sums[Red] += sums[Red];
+	acc->sums[Green] += sums[Green];
+	acc->sums[Blue] += sums[Blue];
+	acc->counts[Red] += count;
+	acc->counts[Green] += count * 2;
+	acc->counts[Blue] += count;
+}
+
+/* Conversion of limited range BT.601 luma to full range. */
+struct LimitedRangeLut {
+	LimitedRangeLut()
+	{
+		for (unsigned int i = 0; i < 256; ++i) {
+			int value = (static_cast<int>(i) - 16) * 255 / 219;
+			lut[i] = std::min(std::max(value, 0), 255);
+		}
+	}
+
+	uint8_t lut[256];
+};
+
+} /* namespace */
+
+/*
+ * The offsets are the byte offsets of the red, green and blue components for
+ * RGB formats, of the first luma, blue and red chroma components for packed
+ * YUV formats, and of the blue and red chroma components for semi-planar YUV
+ * formats. For Bayer formats they are the colours of the top-left 2x2 pixels
+ * in raster order.
+ */
+struct ImageStatisticsCalculator::Format {
+	unsigned int fourcc;
+	unsigned int layout;
+	unsigned int bits;
+	bool packed;
+	unsigned int offsets[4];
+};
+
+const ImageStatisticsCalculator::Format ImageStatisticsCalculator::imageFormats_[] = {
+	{ V4L2_PIX_FMT_RGB24, LayoutRGB, 8, false, { 0, 1, 2 } },
+	{ V4L2_PIX_FMT_BGR24, LayoutRGB, 8, false, { 2, 1, 0 } },
+	{ V4L2_PIX_FMT_YUYV, LayoutYUYV, 8, false, { 0, 1, 3 } },
+	{ V4L2_PIX_FMT_YVYU, LayoutYUYV, 8, false, { 0, 3, 1 } },
+	{ V4L2_PIX_FMT_UYVY, LayoutYUYV, 8, false, { 1, 0, 2 } },
+	{ V4L2_PIX_FMT_VYUY, LayoutYUYV, 8, false, { 1, 2, 0 } },
+	{ V4L2_PIX_FMT_NV12, LayoutNV, 8, false, { 0, 1 } },
+	{ V4L2_PIX_FMT_NV21, LayoutNV, 8, false, { 1, 0 } },
+	{ V4L2_PIX_FMT_SBGGR8, LayoutBayer, 8, false, { Blue, Green, Green, Red } },
+	{ V4L2_PIX_FMT_SGBRG8, LayoutBayer, 8, false, { Green, Blue, Red, Green } },
+	{ V4L2_PIX_FMT_SGRBG8, LayoutBayer, 8, false, { Green, Red, Blue, Green } },
+	{ V4L2_PIX_FMT_SRGGB8, LayoutBayer, 8, false, { Red, Green, Green, Blue } },
+	{ V4L2_PIX_FMT_SBGGR10, LayoutBayer, 10, false, { Blue, Green, Green, Red } },
+	{ V4L2_PIX_FMT_SGBRG10, LayoutBayer, 10, false, { Green, Blue, Red, Green } },
+	{ V4L2_PIX_FMT_SGRBG10, LayoutBayer, 10, false, { Green, Red, Blue, Green } },
+	{ V4L2_PIX_FMT_SRGGB10, LayoutBayer, 10, false, { Red, Green, Green, Blue } },
+	{ V4L2_PIX_FMT_SBGGR10P, LayoutBayer, 10, true, { Blue, Green, Green, Red } },
+	{ V4L2_PIX_FMT_SGBRG10P, LayoutBayer, 10, true, { Green, Blue, Red, Green } },
+	{ V4L2_PIX_FMT_SGRBG10P, LayoutBayer, 10, true, { Green, Red, Blue, Green } },
+	{ V4L2_PIX_FMT_SRGGB10P, LayoutBayer, 10, true, { Red, Green, Green, Blue } },
+	{ V4L2_PIX_FMT_IPU3_SBGGR10, LayoutBayer, 10, true, { Blue, Green, Green, Red } },
+	{ V4L2_PIX_FMT_IPU3_SGBRG10, LayoutBayer, 10, true, { Green, Blue, Red, Green } },
+	{ V4L2_PIX_FMT_IPU3_SGRBG10, LayoutBayer, 10, true, { Green, Red, Blue, Green } },
+	{ V4L2_PIX_FMT_IPU3_SRGGB10, LayoutBayer, 10, true, { Red, Green, Green, Blue } },
+};
+
+/**
+ * \struct ImageStatistics
+ * \brief Statistics of an image
+ *
+ * The statistics are normalised to be independent of the image format. The
+ * luma of RGB and Bayer samples is computed with the BT.601 coefficients, and
+ * the luma of YUV samples is converted from limited to full range. Bayer
+ * samples are grouped in 2x2 quads, each contributing a single luma sample.
+ *
+ * \var ImageStatistics::HistogramBins
+ * \brief The number of bins of the luma histogram
+ *
+ * \var ImageStatistics::histogram
+ * \brief The luma histogram, with bins evenly spread over the luma range
+ *
+ * \var ImageStatistics::samples
+ * \brief The number of luma samples counted in the histogram
+ *
+ * \var ImageStatistics::luma
+ * \brief The mean luma value, in the [0.0, 1.0] range
+ *
+ * \var ImageStatistics::mean
+ * \brief The mean of the red, green and blue channels, in the [0.0, 1.0] range
+ *
+ * The mean of the colour channels of YUV formats is computed from the mean of
+ * the luma and chroma components.
+ */
+
+/**
+ * \class ImageStatisticsCalculator
+ * \brief Compute image statistics on the CPU
+ *
+ * The calculator is configured once for a frame format, and then computes the
+ * statistics of frames in that format. Frames can be subsampled horizontally
+ * and vertically to lower the CPU usage, at the expense of the statistics
+ * precision. Computing statistics doesn't modify the calculator, which can be
+ * used concurrently from multiple threads.
+ *
+ * The frames are processed line by line, with the samples of each line
+ * accumulated in 32-bit counters that the compiler vectorises.
+ */
+
+ImageStatisticsCalculator::ImageStatisticsCalculator()
+	: format_(nullptr), stride_(0), xStep_(1), yStep_(1), frameSize_(0)
+{
+}
+
+/**
+ * \brief Retrieve the pixel formats supported by the calculator
+ * \return The V4L2 pixel formats supported by the calculator
+ */
+const std::vector<unsigned int> &ImageStatisticsCalculator::formats()
+{
+	static std::vector<unsigned int> formats;
+
+	if (formats.empty()) {
+		for (const Format &format : imageFormats_)
+			formats.push_back(format.fourcc);
+	}
+
+	return formats;
+}
+
+/**
+ * \brief Configure the calculator for a frame format
+ * \param[in] pixelFormat The V4L2 pixel format of the frames
+ * \param[in] size The frame size in pixels
+ * \param[in] stride The line stride of the frames in bytes
+ * \param[in] xStep The horizontal subsampling step in pixels
+ * \param[in] yStep The vertical subsampling step in lines
+ *
+ * Only one pixel every \a xStep pixels and one line every \a yStep lines are
+ * taken into account. The steps are rounded up to a multiple of 2 when the
+ * format requires so, as for Bayer formats and for the chroma components of
+ * YUV formats.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The format, size, stride or steps are not supported
+ */
+int ImageStatisticsCalculator::configure(unsigned int pixelFormat,
+					 const Size &size, unsigned int stride,
+					 unsigned int xStep, unsigned int yStep)
+{
+	format_ = nullptr;
+
+	auto it = std::find_if(std::begin(imageFormats_), std::end(imageFormats_),
+			       [&](const Format &format) {
+				       return format.fourcc == pixelFormat;
+			       });
+	if (it == std::end(imageFormats_)) {
+		LOG(ImageStatistics, Error)
+			<< "Unsupported pixel format " << pixelFormat;
+		return -EINVAL;
+	}
+
+	if (!size.width || !size.height || !xStep || !yStep) {
+		LOG(ImageStatistics, Error)
+			<< "Invalid size " << size.toString() << " or steps";
+		return -EINVAL;
+	}
+
+	unsigned int lineSize;
+	switch (it->layout) {
+	case LayoutRGB:
+		lineSize = size.width * 3;
+		break;
+	case LayoutYUYV:
+		lineSize = (size.width + 1) / 2 * 4;
+		break;
+	case LayoutNV:
+		lineSize = (size.width + 1) / 2 * 2;
+		break;
+	case LayoutBayer:
+	default:
+		if (it->packed)
+			lineSize = packedRawLineSize(pixelFormat, size.width);
+		else
+			lineSize = size.width * (it->bits > 8 ? 2 : 1);
+		break;
+	}
+
+	if (stride < lineSize) {
+		LOG(ImageStatistics, Error) << "Invalid stride " << stride;
+		return -EINVAL;
+	}
+
+	format_ = &*it;
+	size_ = size;
+	stride_ = stride;
+	xStep_ = xStep;
+	yStep_ = yStep;
+
+	frameSize_ = static_cast<size_t>(stride) * size.height;
+	if (format_->layout == LayoutNV)
+		frameSize_ += static_cast<size_t>(stride) * ((size.height + 1) / 2);
+
+	return 0;
+}
+
+/**
+ * \fn ImageStatisticsCalculator::frameSize()
+ * \brief Retrieve the minimum size of a frame
+ *
+ * Semi-planar YUV frames store the chroma plane right after the luma plane.
+ *
+ * \return The minimum size of a contiguous frame in bytes
+ */
+
+/**
+ * \brief Compute the statistics of a frame stored in contiguous memory
+ * \param[in] data The frame data
+ * \param[in] size The frame data size in bytes
+ * \param[out] stats The statistics
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The calculator isn't configured, or the frame is too small
+ */
+int ImageStatisticsCalculator::compute(const uint8_t *data, size_t size,
+				       ImageStatistics *stats) const
+{
+	if (!format_ || size < frameSize_)
+		return -EINVAL;
+
+	return computeFrame(data, data + static_cast<size_t>(stride_) * size_.height,
+			    stats);
+}
+
+/**
+ * \brief Compute the statistics of a frame stored in buffer memory
+ * \param[in] mem The frame buffer memory
+ * \param[out] stats The statistics
+ *
+ * The chroma plane of semi-planar YUV formats is read from the second plane
+ * when the buffer memory has multiple planes, and from the first plane after
+ * the luma data otherwise. The caller shall have started CPU read access to the
+ * buffer memory.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The calculator isn't configured, or the frame is too small
+ * \retval -ENOMEM The buffer memory can't be mapped
+ */
+int ImageStatisticsCalculator::compute(BufferMemory *mem,
+				       ImageStatistics *stats) const
+{
+	if (!format_ || mem->planes().empty())
+		return -EINVAL;
+
+	std::vector<Plane> &planes = mem->planes();
+	const size_t lumaSize = static_cast<size_t>(stride_) * size_.height;
+	const uint8_t *luma = static_cast<const uint8_t *>(planes[0].mem());
+	const uint8_t *chroma = nullptr;
+
+	if (!luma)
+		return -ENOMEM;
+
+	if (format_->layout == LayoutNV && planes.size() > 1) {
+		if (planes[0].length() < lumaSize ||
+		    planes[1].length() < frameSize_ - lumaSize)
+			return -EINVAL;
+
+		chroma = static_cast<const uint8_t *>(planes[1].mem());
+		if (!chroma)
+			return -ENOMEM;
+	} else {
+		if (planes[0].length() < frameSize_)
+			return -EINVAL;
+
+		chroma = luma + lumaSize;
+	}
+
+	return computeFrame(luma, chroma, stats);
+}
+
+int ImageStatisticsCalculator::computeFrame(const uint8_t *luma,
+					    const uint8_t *chroma,
+					    ImageStatistics *stats) const
+{
+	static const LimitedRangeLut limitedRange;
+	const unsigned int width = size_.width;
+	const unsigned int height = size_.height;
+	const unsigned int *offsets = format_->offsets;
+	/* Chroma and Bayer quads are subsampled by multiples of 2. */
+	const unsigned int xStep2 = (xStep_ + 1) & ~1;
+	const unsigned int yStep2 = (yStep_ + 1) & ~1;
+
+	Accumulator acc = {};
+
+	switch (format_->layout) {
+	case LayoutRGB:
+		for (unsigned int y = 0; y < height; y += yStep_)
+			accumulateRGB(luma + y * stride_, width, xStep_,
+				      offsets, &acc);
+		break;
+
+	case LayoutYUYV:
+		for (unsigned int y = 0; y < height; y += yStep_) {
+			const uint8_t *line = luma + y * stride_;
+
+			accumulateLuma(line + offsets[0], width, xStep_, 2,
+				       limitedRange.lut, &acc);
+			accumulateChroma(line + offsets[1], line + offsets[2],
+					 width / 2 * 4, xStep2 * 2, &acc);
+		}
+		break;
+
+	case LayoutNV:
+		for (unsigned int y = 0; y < height; y += yStep_)
+			accumulateLuma(luma + y * stride_, width, xStep_, 1,
+				       limitedRange.lut, &acc);
+
+		for (unsigned int y = 0; y < height; y += yStep2) {
+			const uint8_t *line = chroma + y / 2 * stride_;
+
+			accumulateChroma(line + offsets[0], line + offsets[1],
+					 width / 2 * 2, xStep2, &acc);
+		}
+		break;
+
+	case LayoutBayer: {
+		const unsigned int shift = format_->bits - 8;
+		unsigned int positions[4];
+		for (unsigned int i = 0, green = 1; i < 4; ++i) {
+			unsigned int colour = offsets[i];
+			positions[colour == Red ? 0 : colour == Blue ? 3 : green++] = i;
+		}
+
+		std::vector<uint16_t> unpacked(format_->packed ? width * 2 : 0);
+
+		for (unsigned int y = 0; y + 1 < height; y += yStep2) {
+			const uint8_t *line0 = luma + y * stride_;
+			const uint8_t *line1 = line0 + stride_;
+
+			if (format_->packed) {
+				unpackRawLine(format_->fourcc, line0,
+					      unpacked.data(), width);
+				unpackRawLine(format_->fourcc, line1,
+					      unpacked.data() + width, width);
+				accumulateBayer(unpacked.data(),
+						unpacked.data() + width, width,
+						xStep2, positions, shift, &acc);
+			} else if (format_->bits > 8) {
+				/* Samples are stored in little-endian 16-bit words. */
+				accumulateBayer(reinterpret_cast<const uint16_t *>(line0),
+						reinterpret_cast<const uint16_t *>(line1),
+						width, xStep2, positions, shift, &acc);
+			} else {
+				accumulateBayer(line0, line1, width, xStep2,
+						positions, shift, &acc);
+			}
+		}
+		break;
+	}
+	}
+
+	stats->samples = 0;
+	stats->histogram.fill(0);
+	uint64_t lumaSum = 0;
+
+	for (unsigned int i = 0; i < ImageStatistics::HistogramBins; ++i) {
+		for (unsigned int j = 0; j < 4; ++j)
+			stats->histogram[i] += acc.histograms[j][i];
+
+		stats->samples += stats->histogram[i];
+		lumaSum += static_cast<uint64_t>(stats->histogram[i]) * i;
+	}
+
+	stats->luma = stats->samples
+		    ? static_cast<double>(lumaSum) / stats->samples / 255 : 0.0;
+
+	double means[3];
+	for (unsigned int c = 0; c < 3; ++c)
+		means[c] = acc.counts[c]
+			 ? static_cast<double>(acc.sums[c]) / acc.counts[c] : 0.0;
+
+	if (format_->layout == LayoutYUYV || format_->layout == LayoutNV) {
+		/* Convert the mean of the limited range BT.601 components. */
+		const double y = 1.164 * (means[0] - 16);
+		const double u = means[1] - 128;
+		const double v = means[2] - 128;
+
+		means[Red] = y + 1.596 * v;
+		means[Green] = y - 0.392 * u - 0.813 * v;
+		means[Blue] = y + 2.017 * u;
+	}
+
+	const double max = (1 << format_->bits) - 1;
+	for (unsigned int c = 0; c < 3; ++c)
+		stats->mean[c] = std::min(std::max(means[c] / max, 0.0), 1.0);
+
+	return 0;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * byte_stream_buffer.h - Byte stream buffer
+ */
+#ifndef __LIBCAMERA_BYTE_STREAM_BUFFER_H__
+#define __LIBCAMERA_BYTE_STREAM_BUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace libcamera {
+
+class ByteStreamBuffer
+{
+public:
+	ByteStreamBuffer(const uint8_t *base, size_t size);
+	ByteStreamBuffer(uint8_t *base, size_t size);
+
+	const uint8_t *base() const { return base_; }
+	size_t offset() const { return read_ ? read_ - base_ : write_ - base_; }
+	size_t size() const { return size_; }
+	bool overflow() const { return overflow_; }
+
+	int skip(size_t size);
+
+	template<typename T>
+	const T *read(size_t count = 1)
+	{
+		return reinterpret_cast<const T *>(readBytes(sizeof(T), alignof(T),
+							     count));
+	}
+
+	template<typename T>
+	int write(const T *t, size_t count = 1)
+	{
+		return writeBytes(reinterpret_cast<const uint8_t *>(t),
+				  sizeof(T) * count);
+	}
+
+private:
+	const uint8_t *readBytes(size_t size, size_t alignment, size_t count);
+	int writeBytes(const uint8_t *data, size_t size);
+
+	const uint8_t *base_;
+	size_t size_;
+	bool overflow_;
+
+	const uint8_t *read_;
+	uint8_t *write_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_BYTE_STREAM_BUFFER_H__ */
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_CAMERA_SENSOR_H__
 #define __LIBCAMERA_CAMERA_SENSOR_H__
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,8 @@
 namespace libcamera {
 
 class MediaEntity;
+class MediaRequest;
+class V4L2PreparedControls;
 class V4L2Subdevice;
 
 struct V4L2SubdeviceFormat;
@@ -34,6 +37,7 @@ public:
 	int init();
 
 	const MediaEntity *entity() const { return entity_; }
+	V4L2Subdevice *device() { return subdev_; }
 	const std::vector<unsigned int> &mbusCodes() const { return mbusCodes_; }
 	const std::vector<Size> &sizes() const { return sizes_; }
 	const Size &resolution() const;
@@ -42,19 +46,52 @@ public:
 				      const Size &size) const;
 	int setFormat(V4L2SubdeviceFormat *format);
 
+	bool hasEmbeddedData() const { return embeddedCode_ != 0; }
+	V4L2SubdeviceFormat embeddedDataFormat() const;
+	int setEmbeddedDataFormat(V4L2SubdeviceFormat *format);
+
 	const V4L2ControlInfoMap &controls() const;
-	int getControls(V4L2ControlList *ctrls);
-	int setControls(V4L2ControlList *ctrls);
+	int getControls(V4L2ControlList *ctrls, bool refresh = false);
+	int setControls(V4L2ControlList *ctrls, MediaRequest *request = nullptr);
+	int prepareControls(V4L2PreparedControls *ctrls,
+			    const std::vector<unsigned int> &ids);
+	const std::map<unsigned int, unsigned int> &controlDelays() const
+	{
+		return controlDelays_;
+	}
+
+	int frameDurationLimits(uint64_t *min, uint64_t *max);
+	int setFrameDuration(uint64_t *duration);
+	int frameDurationToVblank(uint64_t duration, int64_t *vblank);
+	int vblankToFrameDuration(int64_t vblank, uint64_t *duration);
 
 protected:
 	std::string logPrefix() const;
 
 private:
+	struct Mode {
+		Size size;
+		unsigned int area;
+		float ratio;
+	};
+
+	int frameTiming(Size *size, uint64_t *lineLength, uint64_t *pixelRate);
+	int initEmbeddedData();
+
 	const MediaEntity *entity_;
 	V4L2Subdevice *subdev_;
+	unsigned int imagePad_;
+	unsigned int embeddedPad_;
+
+	unsigned int embeddedCode_;
+	Size embeddedSize_;
 
 	std::vector<unsigned int> mbusCodes_;
 	std::vector<Size> sizes_;
+	/* Sensor modes sorted by increasing area. */
+	std::vector<Mode> modes_;
+
+	std::map<unsigned int, unsigned int> controlDelays_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * clock_recovery.h - Frame timestamp jitter filtering
+ */
+#ifndef __LIBCAMERA_CLOCK_RECOVERY_H__
+#define __LIBCAMERA_CLOCK_RECOVERY_H__
+
+#include <deque>
+#include <stdint.h>
+
+namespace libcamera {
+
+class ClockRecovery
+{
+public:
+	ClockRecovery(unsigned int window = 32);
+
+	void reset();
+
+	uint64_t recover(uint32_t sequence, uint64_t timestamp);
+	uint64_t period() const { return period_; }
+
+private:
+	struct Sample {
+		int64_t x;
+		int64_t y;
+	};
+
+	static constexpr unsigned int MinSamples = 4;
+
+	void restart(uint32_t sequence, uint64_t timestamp);
+	bool fit(double *slope, double *intercept) const;
+
+	unsigned int window_;
+	std::deque<Sample> samples_;
+
+	uint32_t firstSequence_;
+	uint64_t firstTimestamp_;
+	uint64_t lastOutput_;
+	uint64_t period_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CLOCK_RECOVERY_H__ */
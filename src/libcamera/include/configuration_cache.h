@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * configuration_cache.h - Cache of camera configuration validation results
+ */
+#ifndef __LIBCAMERA_CONFIGURATION_CACHE_H__
+#define __LIBCAMERA_CONFIGURATION_CACHE_H__
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/stream.h>
+
+#include "utils.h"
+
+namespace libcamera {
+
+class CounterMetric;
+
+class ConfigurationCache
+{
+public:
+	static constexpr unsigned int MaxEntries = 16;
+
+	ConfigurationCache();
+
+	template<typename Config>
+	CameraConfiguration::Status validate(Config *config,
+					     CameraConfiguration::Status (Config::*adjust)())
+	{
+		std::vector<StreamConfiguration> key(config->begin(), config->end());
+
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+
+			const Entry *entry = find(key);
+			if (entry) {
+				*config = static_cast<const Config &>(*entry->result);
+				restore(config, key);
+				return entry->status;
+			}
+		}
+
+		CameraConfiguration::Status status = (config->*adjust)();
+
+		/* Configurations whose entries have been dropped are not cached. */
+		if (config->size() == key.size()) {
+			std::lock_guard<std::mutex> locker(mutex_);
+			insert(key, utils::make_unique<Config>(*config), status);
+		}
+
+		return status;
+	}
+
+	void clear();
+
+private:
+	struct Entry {
+		std::vector<StreamConfiguration> key;
+		std::unique_ptr<CameraConfiguration> result;
+		CameraConfiguration::Status status;
+	};
+
+	const Entry *find(const std::vector<StreamConfiguration> &key);
+	void insert(const std::vector<StreamConfiguration> &key,
+		    std::unique_ptr<CameraConfiguration> result,
+		    CameraConfiguration::Status status);
+	static void restore(CameraConfiguration *config,
+			    const std::vector<StreamConfiguration> &key);
+
+	std::mutex mutex_;
+	std::list<Entry> entries_;
+
+	CounterMetric *hitsMetric_;
+	CounterMetric *missesMetric_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CONFIGURATION_CACHE_H__ */
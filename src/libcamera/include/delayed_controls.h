@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * delayed_controls.h - Sensor controls applied with a frame delay
+ */
+#ifndef __LIBCAMERA_DELAYED_CONTROLS_H__
+#define __LIBCAMERA_DELAYED_CONTROLS_H__
+
+#include <array>
+#include <map>
+#include <stdint.h>
+
+#include "v4l2_controls.h"
+
+namespace libcamera {
+
+class V4L2Device;
+
+class DelayedControls
+{
+public:
+	DelayedControls(V4L2Device *device,
+			const std::map<unsigned int, unsigned int> &delays);
+
+	int reset();
+
+	bool push(const V4L2ControlList &controls);
+	V4L2ControlList get(uint32_t sequence);
+
+	int applyControls(uint32_t sequence);
+
+private:
+	static constexpr unsigned int MaxFrames = 16;
+
+	struct Info {
+		int64_t value;
+		bool updated;
+	};
+
+	using ControlRing = std::array<Info, MaxFrames>;
+
+	void queue(unsigned int index, const V4L2ControlList &controls);
+
+	V4L2Device *device_;
+	std::map<unsigned int, unsigned int> delays_;
+	unsigned int maxDelay_;
+
+	bool running_;
+	uint32_t firstSequence_;
+
+	unsigned int queueCount_;
+	unsigned int writeCount_;
+	std::map<unsigned int, ControlRing> values_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DELAYED_CONTROLS_H__ */
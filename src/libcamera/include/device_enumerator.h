@@ -9,10 +9,13 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/media.h>
 
+#include <libcamera/signal.h>
+
 namespace libcamera {
 
 class MediaDevice;
@@ -26,6 +29,8 @@ public:
 
 	bool match(const MediaDevice *device) const;
 
+	const std::string &driver() const { return driver_; }
+
 private:
 	std::string driver_;
 	std::vector<std::string> entities_;
@@ -43,12 +48,18 @@ public:
 
 	std::shared_ptr<MediaDevice> search(const DeviceMatch &dm);
 
+	Signal<> devicesAdded;
+
 protected:
 	int addDevice(const std::string &deviceNode);
+	void addDevices(const std::vector<std::string> &deviceNodes);
 	void removeDevice(const std::string &deviceNode);
 
 private:
-	std::vector<std::shared_ptr<MediaDevice>> devices_;
+	/* Media devices indexed by driver name. */
+	std::unordered_map<std::string, std::vector<std::shared_ptr<MediaDevice>>> devices_;
+
+	int registerDevice(std::shared_ptr<MediaDevice> media, int populated);
 
 	virtual std::string lookupDeviceNode(int major, int minor) = 0;
 };
@@ -7,7 +7,10 @@
 #ifndef __LIBCAMERA_DEVICE_ENUMERATOR_SYSFS_H__
 #define __LIBCAMERA_DEVICE_ENUMERATOR_SYSFS_H__
 
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "device_enumerator.h"
 
@@ -20,6 +23,9 @@ public:
 	int enumerate();
 
 private:
+	std::unordered_map<uint64_t, std::string> deviceNodes_;
+
+	std::unordered_set<std::string> populateDeviceNodes();
 	std::string lookupDeviceNode(int major, int minor);
 };
 
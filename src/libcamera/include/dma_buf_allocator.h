@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * dma_buf_allocator.h - dmabuf memory allocator
+ */
+#ifndef __LIBCAMERA_DMA_BUF_ALLOCATOR_H__
+#define __LIBCAMERA_DMA_BUF_ALLOCATOR_H__
+
+#include <list>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace libcamera {
+
+class BufferPool;
+
+class DmaBufAllocator
+{
+public:
+	static DmaBufAllocator *instance();
+
+	bool isValid() const { return fd_ != -1; }
+
+	int allocate(BufferPool *pool, const std::vector<unsigned int> &planeSizes);
+	void release(BufferPool *pool);
+
+private:
+	struct CachedBuffer {
+		int fd;
+		size_t size;
+	};
+
+	static constexpr unsigned int MaxCachedBuffers = 32;
+
+	DmaBufAllocator();
+	DmaBufAllocator(const DmaBufAllocator &) = delete;
+	~DmaBufAllocator();
+
+	DmaBufAllocator &operator=(const DmaBufAllocator &) = delete;
+
+	int allocateDmabuf(size_t size);
+	int allocateHeap(size_t size);
+	int allocateUdmabuf(size_t size);
+
+	int fd_;
+	bool udmabuf_;
+
+	std::mutex mutex_;
+	std::list<CachedBuffer> cache_;
+	std::set<std::pair<uint64_t, uint64_t>> allocated_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DMA_BUF_ALLOCATOR_H__ */
@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * downscaler.h - Software frame downscaler
+ */
+#ifndef __LIBCAMERA_DOWNSCALER_H__
+#define __LIBCAMERA_DOWNSCALER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/geometry.h>
+#include <libcamera/stream.h>
+
+#include "processing_stage.h"
+
+namespace libcamera {
+
+class Downscaler
+{
+public:
+	Downscaler();
+
+	static const std::vector<unsigned int> &formats();
+	static Size alignment(unsigned int pixelFormat);
+
+	int configure(unsigned int pixelFormat, const Size &inputSize,
+		      unsigned int inputStride, const Size &outputSize);
+	size_t frameSize() const;
+	unsigned int stride() const;
+
+	int scale(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		  size_t dstSize) const;
+
+private:
+	/* The source samples averaged to produce an output byte. */
+	struct Tap {
+		unsigned int offset;
+		unsigned int step;
+		unsigned int count;
+	};
+
+	struct Plane {
+		unsigned int inOffset;
+		unsigned int inStride;
+		unsigned int inLineSize;
+		unsigned int outOffset;
+		unsigned int outStride;
+		std::vector<unsigned int> rows;
+		std::vector<Tap> taps;
+	};
+
+	void addPlane(unsigned int inOffset, unsigned int inWidth,
+		      unsigned int inLines, unsigned int outOffset,
+		      unsigned int outWidth, unsigned int outLines,
+		      unsigned int bytesPerPixel, bool yuyv);
+	void scalePlane(const Plane &plane, const uint8_t *src,
+			uint8_t *dst) const;
+
+	unsigned int pixelFormat_;
+	size_t inputFrameSize_;
+	size_t frameSize_;
+	unsigned int stride_;
+	std::vector<Plane> planes_;
+};
+
+class DownscaleStage : public ProcessingStage
+{
+public:
+	DownscaleStage();
+	~DownscaleStage();
+
+	static StreamConfiguration generateConfiguration(const StreamConfiguration &input);
+	static CameraConfiguration::Status validate(const StreamConfiguration &input,
+						    StreamConfiguration *output);
+
+	int configure(const StreamConfiguration &input,
+		      const StreamConfiguration &output);
+	size_t frameSize() const { return scaler_.frameSize(); }
+	unsigned int stride() const { return scaler_.stride(); }
+
+protected:
+	int process(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		    size_t dstSize) const override;
+
+private:
+	Downscaler scaler_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DOWNSCALER_H__ */
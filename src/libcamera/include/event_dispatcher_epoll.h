@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * event_dispatcher_epoll.h - Epoll-based event dispatcher
+ */
+#ifndef __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__
+#define __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__
+
+#include <libcamera/event_dispatcher.h>
+
+#include <map>
+#include <stdint.h>
+
+#include "event_dispatcher_monitor.h"
+#include "timer_queue.h"
+
+struct epoll_event;
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherEpoll final : public EventDispatcher
+{
+public:
+	EventDispatcherEpoll();
+	~EventDispatcherEpoll();
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+private:
+	static constexpr unsigned int MaxEvents = 32;
+
+	struct EventNotifierSetEpoll {
+		EventNotifierSetEpoll()
+			: notifiers{ nullptr, nullptr, nullptr }, events(0)
+		{
+		}
+
+		uint32_t computeEvents() const;
+		bool empty() const;
+
+		EventNotifier *notifiers[3];
+		uint32_t events;
+	};
+
+	std::map<int, EventNotifierSetEpoll> notifiers_;
+	TimerQueue timers_;
+	EventDispatcherMonitor monitor_;
+	int epollfd_;
+	int eventfd_;
+
+	int processingFd_;
+
+	void updateNotifierSet(int fd, EventNotifierSetEpoll &set);
+
+	void processInterrupt();
+	void processNotifiers(const struct epoll_event &event);
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__ */
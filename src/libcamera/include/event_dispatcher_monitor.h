@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * event_dispatcher_monitor.h - Event dispatcher instrumentation
+ */
+#ifndef __LIBCAMERA_EVENT_DISPATCHER_MONITOR_H__
+#define __LIBCAMERA_EVENT_DISPATCHER_MONITOR_H__
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class CounterMetric;
+class HistogramMetric;
+
+class EventDispatcherMonitor
+{
+public:
+	EventDispatcherMonitor();
+
+	bool enabled() const { return enabled_; }
+
+	void waitStarted()
+	{
+		if (enabled_)
+			waitStart_ = now();
+	}
+
+	void waitFinished(int ready)
+	{
+		if (enabled_)
+			recordWait(ready);
+	}
+
+	void dispatchFinished()
+	{
+		if (enabled_)
+			recordDispatch();
+	}
+
+	template<typename T>
+	void emit(Signal<T *> &signal, T *sender, const char *source, int fd)
+	{
+		if (!enabled_) {
+			signal.emit(sender);
+			return;
+		}
+
+		/*
+		 * Keep a reference to the slots, the sender may be destroyed
+		 * by the slots.
+		 */
+		std::shared_ptr<const SlotList> slots = signal.slots();
+		uint64_t start = now();
+
+		signal.emit(sender);
+
+		recordCallback(now() - start, slots.get(), source, fd);
+	}
+
+private:
+	using SlotList = std::vector<std::shared_ptr<SlotBase>>;
+
+	static uint64_t now();
+
+	void recordWait(int ready);
+	void recordDispatch();
+	void recordCallback(uint64_t duration, const SlotList *slots,
+			    const char *source, int fd);
+
+	bool enabled_;
+	uint64_t slowThreshold_;
+	uint64_t waitStart_;
+	uint64_t dispatchStart_;
+
+	HistogramMetric *waitMetric_;
+	HistogramMetric *dispatchMetric_;
+	HistogramMetric *readyMetric_;
+	CounterMetric *slowMetric_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_EVENT_DISPATCHER_MONITOR_H__ */
@@ -9,10 +9,12 @@
 
 #include <libcamera/event_dispatcher.h>
 
-#include <list>
 #include <map>
 #include <vector>
 
+#include "event_dispatcher_monitor.h"
+#include "timer_queue.h"
+
 struct pollfd;
 
 namespace libcamera {
@@ -42,7 +44,8 @@ private:
 	};
 
 	std::map<int, EventNotifierSetPoll> notifiers_;
-	std::list<Timer *> timers_;
+	TimerQueue timers_;
+	EventDispatcherMonitor monitor_;
 	int eventfd_;
 
 	bool processingEvents_;
@@ -50,7 +53,6 @@ private:
 	int poll(std::vector<struct pollfd> *pollfds);
 	void processInterrupt(const struct pollfd &pfd);
 	void processNotifiers(const std::vector<struct pollfd> &pollfds);
-	void processTimers();
 };
 
 } /* namespace libcamera */
@@ -8,25 +8,111 @@
 #ifndef __LIBCAMERA_FORMATS_H__
 #define __LIBCAMERA_FORMATS_H__
 
+#include <array>
 #include <map>
+#include <ostream>
+#include <stdint.h>
 #include <vector>
 
 #include <libcamera/geometry.h>
 
 namespace libcamera {
 
+/*
+ * Format modifiers describing the memory layout of frames, with the values of
+ * the DRM format modifiers defined by the kernel in drm_fourcc.h.
+ */
+static constexpr uint64_t FormatModLinear = 0;
+static constexpr uint64_t FormatModSamsung64x32Tile = 0x0400000000000001ULL;
+static constexpr uint64_t FormatModSamsung16x16Tile = 0x0400000000000002ULL;
+static constexpr uint64_t FormatModAllwinnerTiled = 0x0900000000000001ULL;
+
+class PixelFormatInfo;
+
+class PixelFormat
+{
+public:
+	constexpr PixelFormat()
+		: fourcc_(0)
+	{
+	}
+
+	constexpr explicit PixelFormat(unsigned int fourcc)
+		: fourcc_(fourcc)
+	{
+	}
+
+	constexpr PixelFormat(char a, char b, char c, char d)
+		: fourcc_(static_cast<uint8_t>(a) |
+			  static_cast<uint8_t>(b) << 8 |
+			  static_cast<uint8_t>(c) << 16 |
+			  static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24)
+	{
+	}
+
+	constexpr unsigned int fourcc() const { return fourcc_; }
+	const PixelFormatInfo &info() const;
+
+private:
+	unsigned int fourcc_;
+};
+
+constexpr bool operator==(const PixelFormat &lhs, const PixelFormat &rhs)
+{
+	return lhs.fourcc() == rhs.fourcc();
+}
+
+constexpr bool operator!=(const PixelFormat &lhs, const PixelFormat &rhs)
+{
+	return !(lhs == rhs);
+}
+
+std::ostream &operator<<(std::ostream &out, const PixelFormat &format);
+
+class PixelFormatInfo
+{
+public:
+	static constexpr unsigned int MaxPlanes = 3;
+
+	struct Plane {
+		unsigned int bytesPerGroup;
+		unsigned int verticalSubSampling;
+	};
+
+	bool isValid() const { return fourcc != 0; }
+	unsigned int numPlanes() const;
+
+	unsigned int stride(unsigned int width, unsigned int plane = 0,
+			    unsigned int align = 1) const;
+	unsigned int planeSize(const Size &size, unsigned int plane,
+			       unsigned int align = 1) const;
+	unsigned int frameSize(const Size &size, unsigned int align = 1) const;
+
+	static const PixelFormatInfo &info(unsigned int fourcc);
+
+	unsigned int fourcc;
+	unsigned int bitsPerPixel;
+	unsigned int pixelsPerGroup;
+	std::array<Plane, MaxPlanes> planes;
+	unsigned int memoryPlanes;
+	Size alignment;
+	bool compressed;
+};
+
 class ImageFormats
 {
 public:
 	int addFormat(unsigned int format, const std::vector<SizeRange> &sizes);
 
 	bool isEmpty() const;
-	std::vector<unsigned int> formats() const;
+	const std::vector<unsigned int> &formats() const { return formats_; }
 	const std::vector<SizeRange> &sizes(unsigned int format) const;
-	const std::map<unsigned int, std::vector<SizeRange>> &data() const;
+	std::map<unsigned int, std::vector<SizeRange>> data() const;
 
 private:
-	std::map<unsigned int, std::vector<SizeRange>> data_;
+	/* Sorted formats and their sizes, stored at the same index. */
+	std::vector<unsigned int> formats_;
+	std::vector<std::vector<SizeRange>> sizes_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_data_serializer.h - Serialization of data exchanged with IPA modules
+ */
+#ifndef __LIBCAMERA_IPA_DATA_SERIALIZER_H__
+#define __LIBCAMERA_IPA_DATA_SERIALIZER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/controls.h>
+#include <libcamera/ipa/ipa_interface.h>
+
+#include "byte_stream_buffer.h"
+#include "v4l2_controls.h"
+
+namespace libcamera {
+
+enum IPASerializedType {
+	IPASerializedControlList = 1,
+	IPASerializedV4L2ControlList = 2,
+	IPASerializedBuffers = 3,
+};
+
+struct IPASerializedHeader {
+	uint32_t type;
+	uint32_t entries;
+	uint32_t size;
+};
+
+struct IPASerializedControl {
+	uint32_t id;
+	uint32_t type;
+	uint32_t value[4];
+};
+
+struct IPASerializedV4L2Control {
+	uint32_t id;
+	uint32_t value[2];
+	uint32_t payloadOffset;
+	uint32_t payloadSize;
+};
+
+struct IPASerializedBuffer {
+	uint32_t id;
+	uint32_t planes;
+	uint32_t firstPlane;
+};
+
+class IPADataSerializer
+{
+public:
+	using BufferIterator = std::vector<IPABuffer>::const_iterator;
+
+	static size_t binarySize(const ControlList &list);
+	static size_t binarySize(const V4L2ControlList &list);
+	static size_t binarySize(BufferIterator begin, BufferIterator end);
+	static size_t binarySize(const std::vector<IPABuffer> &buffers)
+	{
+		return binarySize(buffers.begin(), buffers.end());
+	}
+
+	static int serialize(const ControlList &list, ByteStreamBuffer &buffer);
+	static int serialize(const V4L2ControlList &list, ByteStreamBuffer &buffer);
+	static int serialize(BufferIterator begin, BufferIterator end,
+			     ByteStreamBuffer &buffer, std::vector<int32_t> *fds);
+	static int serialize(const std::vector<IPABuffer> &buffers,
+			     ByteStreamBuffer &buffer, std::vector<int32_t> *fds)
+	{
+		return serialize(buffers.begin(), buffers.end(), buffer, fds);
+	}
+};
+
+class SerializedControlList
+{
+public:
+	SerializedControlList(ByteStreamBuffer &buffer);
+
+	bool isValid() const { return valid_; }
+	unsigned int size() const { return count_; }
+
+	ControlId id(unsigned int index) const;
+	ControlValue value(unsigned int index) const;
+
+	int apply(ControlList *list) const;
+
+private:
+	bool valid_;
+	unsigned int count_;
+	const IPASerializedControl *entries_;
+};
+
+class SerializedV4L2ControlList
+{
+public:
+	SerializedV4L2ControlList(ByteStreamBuffer &buffer);
+
+	bool isValid() const { return valid_; }
+	unsigned int size() const { return count_; }
+
+	unsigned int id(unsigned int index) const;
+	int64_t value(unsigned int index) const;
+	const uint8_t *payload(unsigned int index) const;
+	size_t payloadSize(unsigned int index) const;
+
+	int apply(V4L2ControlList *list) const;
+
+private:
+	bool valid_;
+	unsigned int count_;
+	const uint8_t *base_;
+	const IPASerializedV4L2Control *entries_;
+};
+
+class SerializedIPABuffers
+{
+public:
+	SerializedIPABuffers(ByteStreamBuffer &buffer);
+
+	bool isValid() const { return valid_; }
+	unsigned int size() const { return count_; }
+
+	unsigned int id(unsigned int index) const;
+	unsigned int planes(unsigned int index) const;
+	unsigned int planeLength(unsigned int index, unsigned int plane) const;
+
+	int apply(const std::vector<int32_t> &fds,
+		  std::vector<IPABuffer> *buffers) const;
+
+private:
+	bool valid_;
+	unsigned int count_;
+	unsigned int planeCount_;
+	const IPASerializedBuffer *entries_;
+	const uint32_t *lengths_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_DATA_SERIALIZER_H__ */
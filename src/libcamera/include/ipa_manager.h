@@ -7,6 +7,9 @@
 #ifndef __LIBCAMERA_IPA_MANAGER_H__
 #define __LIBCAMERA_IPA_MANAGER_H__
 
+#include <map>
+#include <stdint.h>
+#include <string>
 #include <vector>
 
 #include <libcamera/ipa/ipa_interface.h>
@@ -14,6 +17,7 @@
 
 #include "ipa_module.h"
 #include "pipeline_handler.h"
+#include "pub_key.h"
 
 namespace libcamera {
 
@@ -22,17 +26,43 @@ class IPAManager
 public:
 	static IPAManager *instance();
 
+	void prefetch();
+
+	const PubKey &pubKey() const { return pubKey_; }
+
 	std::unique_ptr<IPAInterface> createIPA(PipelineHandler *pipe,
 						uint32_t maxVersion,
 						uint32_t minVersion);
 
 private:
+	static constexpr unsigned int IPAProxyWorkers = 1;
+
+	struct IndexEntry {
+		uint64_t dev;
+		uint64_t ino;
+		uint64_t size;
+		int64_t mtime;
+		int64_t mtimeNsec;
+		struct IPAModuleInfo info;
+	} __attribute__((packed));
+
+	static const std::vector<uint8_t> publicKeyData_;
+	PubKey pubKey_;
+
 	std::vector<IPAModule *> modules_;
 
+	std::map<std::string, IndexEntry> index_;
+	bool indexChanged_;
+
 	IPAManager();
 	~IPAManager();
 
 	int addDir(const char *libDir);
+	IPAModule *createModule(const std::string &path);
+	bool isTrusted(IPAModule *module) const;
+
+	void loadIndex(const std::string &path);
+	void storeIndex(const std::string &path);
 };
 
 } /* namespace libcamera */
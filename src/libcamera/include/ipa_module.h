@@ -14,6 +14,7 @@
 #include <libcamera/ipa/ipa_module_info.h>
 
 #include "pipeline_handler.h"
+#include "pub_key.h"
 
 namespace libcamera {
 
@@ -21,6 +22,7 @@ class IPAModule
 {
 public:
 	explicit IPAModule(const std::string &libPath);
+	IPAModule(const std::string &libPath, const struct IPAModuleInfo &info);
 	~IPAModule();
 
 	bool isValid() const;
@@ -37,12 +39,16 @@ public:
 
 	bool isOpenSource() const;
 
+	bool verifySignature(const PubKey &pubKey);
+	bool isSignatureValid() const { return signatureValid_; }
+
 private:
 	struct IPAModuleInfo info_;
 
 	std::string libPath_;
 	bool valid_;
 	bool loaded_;
+	bool signatureValid_;
 
 	void *dlHandle_;
 	typedef IPAInterface *(*IPAIntfFactory)(void);
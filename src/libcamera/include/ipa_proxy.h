@@ -26,9 +26,9 @@ public:
 
 	bool isValid() const { return valid_; }
 
-protected:
-	std::string resolvePath(const std::string &file) const;
+	static std::string resolvePath(const std::string &file);
 
+protected:
 	bool valid_;
 };
 
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_proxy_linux.h - IPC protocol of the default IPA proxy for Linux
+ */
+#ifndef __LIBCAMERA_IPA_PROXY_LINUX_H__
+#define __LIBCAMERA_IPA_PROXY_LINUX_H__
+
+#include <stdint.h>
+
+namespace libcamera {
+
+enum IPAProxyLinuxCommand {
+	IPAProxyLinuxLoadModule,
+	IPAProxyLinuxMapBuffers,
+	IPAProxyLinuxUnmapBuffers,
+	IPAProxyLinuxProcessEvent,
+	IPAProxyLinuxQueueFrameAction,
+};
+
+/*
+ * Messages start with an IPAProxyLinuxHeader, followed by command-specific
+ * data. IPAProxyLinuxMapBuffers messages carry the buffer descriptors
+ * serialized with IPADataSerializer, and the dmabuf handles of all planes are
+ * passed with the message in the same order.
+ */
+struct IPAProxyLinuxHeader {
+	uint32_t cmd;
+	uint32_t frame;
+	uint32_t operation;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_PROXY_LINUX_H__ */
@@ -10,12 +10,15 @@
 
 #include <cstdint>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <vector>
 
 #include <libcamera/event_notifier.h>
 
 namespace libcamera {
 
+class CounterMetric;
+
 class IPCUnixSocket
 {
 public:
@@ -24,6 +27,8 @@ public:
 		std::vector<int32_t> fds;
 	};
 
+	static constexpr unsigned int MaxFds = 253;
+
 	IPCUnixSocket();
 	~IPCUnixSocket();
 
@@ -32,26 +37,67 @@ public:
 	void close();
 	bool isBound() const;
 
+	int enableSharedMemory(size_t size);
+
 	int send(const Payload &payload);
+	int send(const struct iovec *iov, unsigned int iovcnt,
+		 const int32_t *fds = nullptr, unsigned int num = 0);
 	int receive(Payload *payload);
 
 	Signal<IPCUnixSocket *> readyRead;
 
 private:
+	enum MessageType {
+		MessagePayload,
+		MessageRingPayload,
+		MessageRingSetup,
+		MessageRingAck,
+	};
+
 	struct Header {
 		uint32_t data;
 		uint8_t fds;
+		uint8_t type;
 	};
 
-	int sendData(const void *buffer, size_t length, const int32_t *fds, unsigned int num);
-	int recvData(void *buffer, size_t length, int32_t *fds, unsigned int num);
+	struct Ring;
+
+	int sendMessage(MessageType type, const Payload &payload);
+	int sendMessage(MessageType type, const struct iovec *iov,
+			unsigned int iovcnt, size_t length,
+			const int32_t *fds, unsigned int num);
+	int peekHeader(Header *header);
+	int recvMessage(const Header &header, Payload *payload);
+
+	int sendRing(const struct iovec *iov, unsigned int iovcnt,
+		     size_t length, const int32_t *fds, unsigned int num);
+	int receiveRing(Payload *payload);
+	int setupRing(const Payload &setup);
+	void startRing();
+	void closeRing();
 
 	void dataNotifier(EventNotifier *notifier);
+	void ringNotifier(EventNotifier *notifier);
 
 	int fd_;
 	bool headerReceived_;
 	struct Header header_;
 	EventNotifier *notifier_;
+
+	void *shm_;
+	size_t shmSize_;
+	uint32_t ringSize_;
+	Ring *txRing_;
+	Ring *rxRing_;
+	int txEvent_;
+	int rxEvent_;
+	bool ringPending_;
+	EventNotifier *ringNotifier_;
+
+	CounterMetric *messagesSentMetric_;
+	CounterMetric *messagesReceivedMetric_;
+	CounterMetric *bytesSentMetric_;
+	CounterMetric *bytesReceivedMetric_;
 };
 
 } /* namespace libcamera */
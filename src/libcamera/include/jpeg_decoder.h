@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * jpeg_decoder.h - MJPEG frame decoder
+ */
+#ifndef __LIBCAMERA_JPEG_DECODER_H__
+#define __LIBCAMERA_JPEG_DECODER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+namespace libcamera {
+
+class JpegDecoder
+{
+public:
+	JpegDecoder();
+
+	static bool isSupported();
+	static const std::vector<unsigned int> &formats();
+
+	int configure(const Size &size, unsigned int pixelFormat);
+	size_t frameSize() const;
+	unsigned int stride() const;
+
+	int decode(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		   size_t dstSize) const;
+
+private:
+	Size size_;
+	unsigned int pixelFormat_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_JPEG_DECODER_H__ */
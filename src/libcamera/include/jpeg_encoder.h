@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * jpeg_encoder.h - JPEG still image encoder
+ */
+#ifndef __LIBCAMERA_JPEG_ENCODER_H__
+#define __LIBCAMERA_JPEG_ENCODER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/geometry.h>
+#include <libcamera/stream.h>
+
+#include "processing_stage.h"
+
+namespace libcamera {
+
+class JpegEncoder
+{
+public:
+	JpegEncoder();
+
+	static bool isSupported();
+	static const std::vector<unsigned int> &formats();
+
+	int configure(unsigned int pixelFormat, const Size &size,
+		      unsigned int stride, unsigned int quality);
+	size_t maxFrameSize() const;
+
+	int encode(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		   size_t dstSize) const;
+
+private:
+	Size size_;
+	unsigned int pixelFormat_;
+	unsigned int stride_;
+	unsigned int quality_;
+};
+
+class JpegEncodeStage : public ProcessingStage
+{
+public:
+	JpegEncodeStage();
+	~JpegEncodeStage();
+
+	static StreamConfiguration generateConfiguration(const StreamConfiguration &input);
+	static CameraConfiguration::Status validate(const StreamConfiguration &input,
+						    StreamConfiguration *output);
+
+	int configure(const StreamConfiguration &input,
+		      const StreamConfiguration &output);
+	size_t frameSize() const { return encoder_.maxFrameSize(); }
+
+protected:
+	int process(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		    size_t dstSize) const override;
+
+private:
+	JpegEncoder encoder_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_JPEG_ENCODER_H__ */
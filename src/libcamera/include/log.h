@@ -9,6 +9,8 @@
 
 #include <sstream>
 
+#include "utils.h"
+
 namespace libcamera {
 
 enum LogSeverity {
@@ -30,11 +32,17 @@ public:
 	LogSeverity severity() const { return severity_; }
 	void setSeverity(LogSeverity severity);
 
+	unsigned int rateLimit() const { return rateLimit_; }
+	unsigned int sampling() const { return sampling_; }
+	void setRateLimit(unsigned int rateLimit, unsigned int sampling);
+
 	static const LogCategory &defaultCategory();
 
 private:
 	const char *name_;
 	LogSeverity severity_;
+	unsigned int rateLimit_;
+	unsigned int sampling_;
 };
 
 #define LOG_DECLARE_CATEGORY(name)					\
@@ -60,10 +68,12 @@ public:
 
 	std::ostream &stream() { return msgStream_; }
 
-	const struct timespec &timestamp() const { return timestamp_; }
+	const utils::time_point &timestamp() const { return timestamp_; }
 	LogSeverity severity() const { return severity_; }
 	const LogCategory &category() const { return category_; }
-	const std::string &fileInfo() const { return fileInfo_; }
+	const char *fileName() const { return fileName_; }
+	unsigned int line() const { return line_; }
+	std::string fileInfo() const;
 	const std::string msg() const { return msgStream_.str(); }
 
 private:
@@ -72,8 +82,9 @@ private:
 	std::ostringstream msgStream_;
 	const LogCategory &category_;
 	LogSeverity severity_;
-	struct timespec timestamp_;
-	std::string fileInfo_;
+	utils::time_point timestamp_;
+	const char *fileName_;
+	unsigned int line_;
 };
 
 class Loggable
@@ -98,10 +109,30 @@ LogMessage _log(const char *file, unsigned int line,
 #ifndef __DOXYGEN__
 #define _LOG_CATEGORY(name) logCategory##name
 
-#define _LOG1(severity) \
-	_log(__FILE__, __LINE__, Log##severity).stream()
-#define _LOG2(category, severity) \
-	_log(__FILE__, __LINE__, _LOG_CATEGORY(category)(), Log##severity).stream()
+/*
+ * Turn the stream expression of an enabled message into a void expression, to
+ * make it usable as the third operand of the conditional operator in the
+ * _LOG1() and _LOG2() macros. The & operator has a lower precedence than <<,
+ * and is thus applied after all message parts have been streamed.
+ */
+class LogMessageVoidify
+{
+public:
+	void operator&(std::ostream &) {}
+};
+
+/*
+ * Check the severity before constructing the message, to avoid evaluating the
+ * message and its arguments when it is disabled.
+ */
+#define _LOG1(sev)							\
+	Log##sev < LogCategory::defaultCategory().severity() ? (void)0 : \
+	LogMessageVoidify() &						\
+	_log(__FILE__, __LINE__, Log##sev).stream()
+#define _LOG2(cat, sev)							\
+	Log##sev < _LOG_CATEGORY(cat)().severity() ? (void)0 :		\
+	LogMessageVoidify() &						\
+	_log(__FILE__, __LINE__, _LOG_CATEGORY(cat)(), Log##sev).stream()
 
 /*
  * Expand the LOG() macro to _LOG1() or _LOG2() based on the number of
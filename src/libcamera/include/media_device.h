@@ -7,9 +7,10 @@
 #ifndef __LIBCAMERA_MEDIA_DEVICE_H__
 #define __LIBCAMERA_MEDIA_DEVICE_H__
 
-#include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/media.h>
@@ -20,6 +21,9 @@
 
 namespace libcamera {
 
+class MediaRequest;
+struct TopologyCacheKey;
+
 class MediaDevice
 {
 public:
@@ -50,6 +54,8 @@ public:
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
 	int disableLinks();
 
+	std::unique_ptr<MediaRequest> allocateRequest();
+
 	Signal<MediaDevice *> disconnected;
 
 private:
@@ -66,12 +72,16 @@ private:
 	int open();
 	void close();
 
-	std::map<unsigned int, MediaObject *> objects_;
+	std::unordered_map<unsigned int, MediaObject *> objects_;
 	MediaObject *object(unsigned int id);
 	bool addObject(MediaObject *object);
 	void clear();
 
+	static uint64_t linkKey(const MediaPad *source, const MediaPad *sink);
+
 	std::vector<MediaEntity *> entities_;
+	std::unordered_map<std::string, MediaEntity *> entitiesByName_;
+	std::unordered_map<uint64_t, MediaLink *> linksByPads_;
 
 	struct media_v2_interface *findInterface(const struct media_v2_topology &topology,
 						 unsigned int entityId);
@@ -80,10 +90,39 @@ private:
 	bool populateLinks(const struct media_v2_topology &topology);
 	void fixupEntityFlags(struct media_v2_entity *entity);
 
+	std::string topologyCachePath(const struct media_device_info &info,
+				      const struct media_v2_topology &topology,
+				      TopologyCacheKey *key);
+	bool loadTopology(const struct media_device_info &info,
+			  struct media_v2_topology *topology);
+	void storeTopology(const struct media_device_info &info,
+			   const struct media_v2_topology &topology);
+
 	friend int MediaLink::setEnabled(bool enable);
 	int setupLink(const MediaLink *link, unsigned int flags);
 };
 
+class MediaLinkTransaction
+{
+public:
+	explicit MediaLinkTransaction(MediaDevice *media);
+
+	void disableAll();
+	int setEnabled(MediaLink *link, bool enable);
+	int setEnabled(const std::string &sourceName, unsigned int sourceIdx,
+		       const std::string &sinkName, unsigned int sinkIdx,
+		       bool enable);
+
+	int commit();
+
+private:
+	MediaDevice *media_;
+	bool disableAll_;
+
+	std::vector<MediaLink *> links_;
+	std::unordered_map<MediaLink *, bool> states_;
+};
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_MEDIA_DEVICE_H__ */
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * media_request.h - Media Controller request objects
+ */
+#ifndef __LIBCAMERA_MEDIA_REQUEST_H__
+#define __LIBCAMERA_MEDIA_REQUEST_H__
+
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class EventNotifier;
+class MediaDevice;
+
+class MediaRequest
+{
+public:
+	explicit MediaRequest(int fd);
+	MediaRequest(const MediaRequest &) = delete;
+	~MediaRequest();
+
+	MediaRequest &operator=(const MediaRequest &) = delete;
+
+	int fd() const { return fd_; }
+
+	int queue();
+	int reinit();
+
+	Signal<MediaRequest *> completed;
+
+private:
+	void requestCompleted(EventNotifier *notifier);
+
+	int fd_;
+	EventNotifier *notifier_;
+};
+
+class MediaRequestPool
+{
+public:
+	int allocate(MediaDevice *media, unsigned int count);
+	void release();
+
+	bool empty() const { return requests_.empty(); }
+	MediaRequest *get();
+	void recycle(MediaRequest *request);
+
+private:
+	std::vector<std::unique_ptr<MediaRequest>> requests_;
+	std::queue<MediaRequest *> available_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_MEDIA_REQUEST_H__ */
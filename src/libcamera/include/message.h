@@ -8,9 +8,13 @@
 #define __LIBCAMERA_MESSAGE_H__
 
 #include <atomic>
+#include <cstddef>
+#include <functional>
+#include <future>
 
 namespace libcamera {
 
+class MessageQueue;
 class Object;
 class SlotBase;
 class Thread;
@@ -21,6 +25,7 @@ public:
 	enum Type {
 		None = 0,
 		SignalMessage = 1,
+		InvokeMessage = 2,
 		UserMessage = 1000,
 	};
 
@@ -32,11 +37,16 @@ public:
 
 	static Type registerMessageType();
 
+	static void *operator new(std::size_t size);
+	static void operator delete(void *ptr);
+
 private:
+	friend class MessageQueue;
 	friend class Thread;
 
 	Type type_;
 	Object *receiver_;
+	Message *next_;
 
 	static std::atomic_uint nextUserType_;
 };
@@ -53,6 +63,25 @@ public:
 	void *pack_;
 };
 
+class InvokeMessage : public Message
+{
+public:
+	InvokeMessage(const std::function<void()> &func)
+		: Message(Message::InvokeMessage), func_(func)
+	{
+	}
+
+	std::function<void()> func_;
+	std::promise<void> done_;
+};
+
+class MessagePool
+{
+public:
+	static void *allocate(std::size_t size);
+	static void release(void *ptr);
+};
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_MESSAGE_H__ */
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * metrics_registry.h - Runtime metrics registry
+ */
+#ifndef __LIBCAMERA_METRICS_REGISTRY_H__
+#define __LIBCAMERA_METRICS_REGISTRY_H__
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/camera_statistics.h>
+#include <libcamera/metrics.h>
+
+namespace libcamera {
+
+class Metric
+{
+public:
+	virtual ~Metric() {}
+
+	const std::string &name() const { return name_; }
+	virtual MetricValue value() const = 0;
+
+protected:
+	static constexpr unsigned int ShardCount = 16;
+	static constexpr unsigned int CacheLineSize = 64;
+
+	explicit Metric(const std::string &name);
+
+	static unsigned int shard();
+
+private:
+	std::string name_;
+};
+
+class CounterMetric : public Metric
+{
+public:
+	explicit CounterMetric(const std::string &name);
+
+	void add(uint64_t value = 1)
+	{
+		shards_[shard()].value.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	MetricValue value() const override;
+
+private:
+	struct Shard {
+		std::atomic<uint64_t> value;
+		uint8_t padding[CacheLineSize - sizeof(std::atomic<uint64_t>)];
+	};
+
+	std::array<Shard, ShardCount> shards_;
+};
+
+class GaugeMetric : public Metric
+{
+public:
+	explicit GaugeMetric(const std::string &name);
+
+	void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+	void add(int64_t value) { value_.fetch_add(value, std::memory_order_relaxed); }
+
+	MetricValue value() const override;
+
+private:
+	std::atomic<int64_t> value_;
+};
+
+class HistogramMetric : public Metric
+{
+public:
+	explicit HistogramMetric(const std::string &name);
+
+	void add(uint64_t value)
+	{
+		shards_[shard()].counts[Histogram::bucket(value)]
+			.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	MetricValue value() const override;
+
+private:
+	struct Shard {
+		std::atomic<uint64_t> counts[Histogram::BucketCount];
+		uint8_t padding[CacheLineSize];
+	};
+
+	std::array<Shard, ShardCount> shards_;
+};
+
+class MetricsRegistry
+{
+public:
+	static MetricsRegistry *instance();
+
+	CounterMetric *counter(const std::string &name);
+	GaugeMetric *gauge(const std::string &name);
+	HistogramMetric *histogram(const std::string &name);
+
+	MetricsSnapshot snapshot();
+
+private:
+	MetricsRegistry() {}
+
+	template<typename T>
+	T *get(const std::string &name);
+
+	std::mutex mutex_;
+	std::map<std::string, std::unique_ptr<Metric>> metrics_;
+	std::vector<std::unique_ptr<Metric>> detached_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_METRICS_REGISTRY_H__ */
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * object_arena.h - Arena for frequently allocated objects
+ */
+#ifndef __LIBCAMERA_OBJECT_ARENA_H__
+#define __LIBCAMERA_OBJECT_ARENA_H__
+
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+namespace libcamera {
+
+class ObjectArena : public std::enable_shared_from_this<ObjectArena>
+{
+public:
+	static std::shared_ptr<ObjectArena> create();
+
+	ObjectArena(const ObjectArena &) = delete;
+	ObjectArena &operator=(const ObjectArena &) = delete;
+
+	void reserve(size_t size, unsigned int count);
+	size_t capacity(size_t size);
+
+	static void *allocate(ObjectArena *arena, size_t size);
+	static void release(void *ptr);
+
+private:
+	struct Block;
+
+	struct FreeList {
+		size_t size;
+		Block *head;
+		unsigned int count;
+	};
+
+	static constexpr unsigned int MinChunkBlocks = 8;
+
+	ObjectArena();
+
+	FreeList *freeList(size_t size);
+	void grow(FreeList *list, unsigned int count);
+
+	std::mutex mutex_;
+	std::vector<FreeList> freeLists_;
+	std::vector<std::unique_ptr<char[]>> chunks_;
+	unsigned int allocated_;
+	std::shared_ptr<ObjectArena> self_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_OBJECT_ARENA_H__ */
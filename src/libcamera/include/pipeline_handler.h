@@ -7,15 +7,24 @@
 #ifndef __LIBCAMERA_PIPELINE_HANDLER_H__
 #define __LIBCAMERA_PIPELINE_HANDLER_H__
 
-#include <list>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
 
 #include <libcamera/controls.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/object.h>
 #include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "configuration_cache.h"
+#include "device_enumerator.h"
+#include "resource_manager.h"
+#include "statistics_collector.h"
 
 namespace libcamera {
 
@@ -24,37 +33,63 @@ class BufferPool;
 class Camera;
 class CameraConfiguration;
 class CameraManager;
-class DeviceEnumerator;
-class DeviceMatch;
 class MediaDevice;
 class PipelineHandler;
+class ProcessingStage;
 class Request;
 
 class CameraData
 {
 public:
 	explicit CameraData(PipelineHandler *pipe)
-		: pipe_(pipe)
+		: pipe_(pipe), extraBufferCount_(0), framesDropped_(0),
+		  buffersCompleted_(0), lazy_(false)
 	{
 	}
 	virtual ~CameraData() {}
 
 	Camera *camera_;
 	PipelineHandler *pipe_;
-	std::list<Request *> queuedRequests_;
+	std::deque<Request *> queuedRequests_;
 	ControlInfoMap controlInfo_;
+	StatisticsCollector stats_;
+	mutable ConfigurationCache configCache_;
 
 private:
+	friend class PipelineHandler;
+
+	struct ProcessingLink {
+		Stream *input;
+		Stream *output;
+		ProcessingStage *stage;
+	};
+
+	unsigned int extraBufferCount_;
+	std::map<const Stream *, unsigned int> dropCounters_;
+	std::vector<ProcessingLink> processingLinks_;
+	/* Source buffers being processed, with the number of stages. */
+	std::map<const Buffer *, unsigned int> processing_;
+	/* Requests held back until the acquire fences of their buffers signal. */
+	std::deque<Request *> waitingRequests_;
+	std::unique_ptr<EventNotifier> fenceNotifier_;
+	Timer fenceTimer_;
+	uint64_t framesDropped_;
+	uint64_t buffersCompleted_;
+	bool lazy_;
+
 	CameraData(const CameraData &) = delete;
 	CameraData &operator=(const CameraData &) = delete;
 };
 
-class PipelineHandler : public std::enable_shared_from_this<PipelineHandler>
+class PipelineHandler : public Object,
+			public std::enable_shared_from_this<PipelineHandler>
 {
 public:
 	PipelineHandler(CameraManager *manager);
 	virtual ~PipelineHandler();
 
+	static std::vector<DeviceMatch> deviceMatches();
+
 	virtual bool match(DeviceEnumerator *enumerator) = 0;
 	MediaDevice *acquireMediaDevice(DeviceEnumerator *enumerator,
 					const DeviceMatch &dm);
@@ -67,6 +102,7 @@ public:
 	virtual CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) = 0;
 	virtual int configure(Camera *camera, CameraConfiguration *config) = 0;
+	virtual int reconfigure(Camera *camera, CameraConfiguration *config);
 
 	virtual int allocateBuffers(Camera *camera,
 				    const std::set<Stream *> &streams) = 0;
@@ -75,24 +111,78 @@ public:
 
 	virtual int start(Camera *camera) = 0;
 	virtual void stop(Camera *camera) = 0;
+	virtual int standby(Camera *camera);
+	virtual int resume(Camera *camera);
 
 	virtual int queueRequest(Camera *camera, Request *request);
+	virtual MemoryUsage memoryUsage(const Camera *camera);
+	virtual void queueRequests(Camera *camera,
+				   const std::vector<Request *> &requests);
 
 	bool completeBuffer(Camera *camera, Request *request, Buffer *buffer);
 	void completeRequest(Camera *camera, Request *request);
+	void notifyFrameStart(Camera *camera, unsigned int sequence,
+			      uint64_t timestamp);
+	void notifyBufferProgress(Camera *camera, Request *request,
+				  Buffer *buffer, unsigned int lines);
 
 	const char *name() const { return name_; }
+	int numaNode() const;
 
 protected:
 	void registerCamera(std::shared_ptr<Camera> camera,
 			    std::unique_ptr<CameraData> data);
 	void hotplugMediaDevice(MediaDevice *media);
 
+	virtual int openDevices(Camera *camera);
+	virtual void closeDevices(Camera *camera);
+
 	CameraData *cameraData(const Camera *camera);
 
+	void setBufferMetadata(Buffer *buffer, const Buffer *source,
+			       Buffer::Status status, unsigned int bytesused);
+	void setBufferMetadata(Buffer *buffer, Buffer::Status status,
+			       unsigned int bytesused, unsigned int sequence,
+			       uint64_t timestamp);
+	void setBufferFlags(Buffer *buffer, unsigned int flags);
+	void setCpuAccess(Stream *stream, bool cpuAccess);
+
+	int addProcessingStage(Camera *camera, Stream *input, Stream *output,
+			       ProcessingStage *stage);
+	void clearProcessingStages(Camera *camera);
+
+	void cancelRequest(Camera *camera, Request *request);
+
+	void reserveResources(Camera *camera,
+			      const ResourceManager::Usage &usage);
+
+	static unsigned int spareBufferCount();
+	static bool buffersReusable(const Stream *stream,
+				    const StreamConfiguration &cfg);
+
 	CameraManager *manager_;
+	ResourceManager resources_;
 
 private:
+	void requestQueued(Camera *camera, Request *request);
+	void queueReadyRequest(Camera *camera, Request *request);
+	void waitFences(Camera *camera);
+	void fenceSignalled(EventNotifier *notifier);
+	void fenceExpired(Timer *timer);
+	void cancelWaitingRequests(Camera *camera);
+	static unsigned int fenceTimeout();
+	bool processBuffer(Camera *camera, Request *request, Buffer *buffer);
+	bool finishBuffer(Camera *camera, Request *request, Buffer *buffer);
+	void frameProcessed(Buffer *src, Buffer *dst, int result);
+	bool dropRequest(Camera *camera, Request *request);
+	Request *oldestDroppable(Camera *camera);
+	void adjustBufferCount(Camera *camera, CameraConfiguration *config);
+	void tuneBufferCount(Camera *camera);
+	static bool adaptiveBufferCount();
+	static bool lazyCameras();
+	int acquireDevices(Camera *camera);
+	void releaseDevices(Camera *camera);
+	void resourcesChanged(const Camera *camera);
 	void mediaDeviceDisconnected(MediaDevice *media);
 	virtual void disconnect();
 
@@ -101,19 +191,27 @@ private:
 	std::map<const Camera *, std::unique_ptr<CameraData>> cameraData_;
 
 	const char *name_;
+	const Camera *configuredCamera_;
+
+	std::mutex lockMutex_;
+	unsigned int lockCount_;
 
+	friend class Camera;
 	friend class PipelineHandlerFactory;
 };
 
 class PipelineHandlerFactory
 {
 public:
-	PipelineHandlerFactory(const char *name);
+	PipelineHandlerFactory(const char *name,
+			       const std::vector<DeviceMatch> &deviceMatches);
 	virtual ~PipelineHandlerFactory() { };
 
 	std::shared_ptr<PipelineHandler> create(CameraManager *manager);
 
 	const std::string &name() const { return name_; }
+	const std::vector<DeviceMatch> &deviceMatches() const { return deviceMatches_; }
+	bool mayMatch(DeviceEnumerator *enumerator) const;
 
 	static void registerType(PipelineHandlerFactory *factory);
 	static std::vector<PipelineHandlerFactory *> &factories();
@@ -122,13 +220,16 @@ private:
 	virtual PipelineHandler *createInstance(CameraManager *manager) = 0;
 
 	std::string name_;
+	std::vector<DeviceMatch> deviceMatches_;
 };
 
 #define REGISTER_PIPELINE_HANDLER(handler)				\
 class handler##Factory final : public PipelineHandlerFactory		\
 {									\
 public:									\
-	handler##Factory() : PipelineHandlerFactory(#handler) {}	\
+	handler##Factory()						\
+		: PipelineHandlerFactory(#handler,			\
+					 handler::deviceMatches()) {}	\
 									\
 private:								\
 	PipelineHandler *createInstance(CameraManager *manager)		\
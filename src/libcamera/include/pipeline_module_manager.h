@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * pipeline_module_manager.h - Loadable pipeline handler modules manager
+ */
+#ifndef __LIBCAMERA_PIPELINE_MODULE_MANAGER_H__
+#define __LIBCAMERA_PIPELINE_MODULE_MANAGER_H__
+
+#include <string>
+#include <vector>
+
+namespace libcamera {
+
+class DeviceEnumerator;
+
+class PipelineModuleManager
+{
+public:
+	static PipelineModuleManager *instance();
+
+	unsigned int loadModules(DeviceEnumerator *enumerator);
+
+private:
+	struct Module {
+		std::string name;
+		std::string path;
+		std::vector<std::string> drivers;
+		void *handle;
+		bool failed;
+	};
+
+	std::vector<Module> modules_;
+
+	PipelineModuleManager();
+
+	int addDir(const std::string &libDir);
+	bool load(Module *module);
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PIPELINE_MODULE_MANAGER_H__ */
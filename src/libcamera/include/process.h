@@ -7,6 +7,9 @@
 #ifndef __LIBCAMERA_PROCESS_H__
 #define __LIBCAMERA_PROCESS_H__
 
+#include <list>
+#include <map>
+#include <signal.h>
 #include <string>
 #include <vector>
 
@@ -38,8 +41,14 @@ public:
 	Signal<Process *, enum ExitStatus, int> finished;
 
 private:
+	struct SpawnData;
+
+	static int spawn(void *arg);
+
 	void closeAllFdsExcept(const std::vector<int> &fds);
 	int isolate();
+	void closePidfd();
+	void pidfdReady(EventNotifier *notifier);
 	void died(int wstatus);
 
 	pid_t pid_;
@@ -47,9 +56,50 @@ private:
 	enum ExitStatus exitStatus_;
 	int exitCode_;
 
+	int pidfd_;
+	EventNotifier *pidfdNotifier_;
+
 	friend class ProcessManager;
 };
 
+class ProcessManager
+{
+public:
+	void registerProcess(Process *proc);
+	void unregisterProcess(Process *proc);
+
+	static ProcessManager *instance();
+
+	int writePipe() const;
+
+	const struct sigaction &oldsa() const;
+
+	void prestart(const std::string &path, unsigned int count);
+	Process *acquire(const std::string &path, int *fd);
+
+private:
+	struct SpareProcess {
+		std::string path;
+		Process *process;
+		int fd;
+	};
+
+	void sighandler(EventNotifier *notifier);
+	void installSignalHandler();
+	ProcessManager();
+	~ProcessManager();
+
+	int startSpare(const std::string &path);
+
+	std::list<Process *> processes_;
+	std::list<SpareProcess> spares_;
+	std::map<std::string, unsigned int> spareCounts_;
+
+	struct sigaction oldsa_;
+	EventNotifier *sigEvent_;
+	int pipe_[2];
+};
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_PROCESS_H__ */
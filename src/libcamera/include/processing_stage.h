@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * processing_stage.h - Post-processing stages of captured frames
+ */
+#ifndef __LIBCAMERA_PROCESSING_STAGE_H__
+#define __LIBCAMERA_PROCESSING_STAGE_H__
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/camera_statistics.h>
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+#include "thread_pool.h"
+
+namespace libcamera {
+
+class Buffer;
+class HistogramMetric;
+
+class ProcessingStage : public Object
+{
+public:
+	ProcessingStage(const std::string &name);
+	virtual ~ProcessingStage();
+
+	const std::string &name() const { return name_; }
+	void setSyncCpuAccess(bool enable);
+	void setLatencyMetric(HistogramMetric *metric);
+
+	void queue(Buffer *src, Buffer *dst);
+	void flush();
+
+	Histogram latency() const;
+
+	Signal<Buffer *, Buffer *, int> frameProcessed;
+
+protected:
+	virtual int process(const uint8_t *src, size_t srcSize, uint8_t *dst,
+			    size_t dstSize) const = 0;
+
+	void wait();
+
+private:
+	struct Job {
+		Buffer *src;
+		Buffer *dst;
+		int result;
+		uint64_t queued;
+	};
+
+	void workCompleted(uint64_t serial);
+	void complete(const Job &job);
+
+	std::string name_;
+	std::map<uint64_t, Job> jobs_;
+	uint64_t serial_;
+	bool syncCpuAccess_;
+
+	std::vector<uint64_t> latency_;
+	HistogramMetric *latencyMetric_;
+
+	/* Destroyed first, to stop the workers before the jobs. */
+	ThreadPool pool_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PROCESSING_STAGE_H__ */
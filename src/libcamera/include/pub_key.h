@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * pub_key.h - Public key signature verification
+ */
+#ifndef __LIBCAMERA_PUB_KEY_H__
+#define __LIBCAMERA_PUB_KEY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct gnutls_pubkey_st;
+
+namespace libcamera {
+
+class PubKey
+{
+public:
+	PubKey(const std::vector<uint8_t> &key);
+	~PubKey();
+
+	PubKey(const PubKey &) = delete;
+	PubKey &operator=(const PubKey &) = delete;
+
+	bool isValid() const { return valid_; }
+	bool verify(const void *data, size_t dataSize,
+		    const void *sig, size_t sigSize) const;
+
+private:
+	bool valid_;
+	struct gnutls_pubkey_st *pubkey_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_PUB_KEY_H__ */
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * resource_manager.h - Arbitration of hardware resources shared by cameras
+ */
+#ifndef __LIBCAMERA_RESOURCE_MANAGER_H__
+#define __LIBCAMERA_RESOURCE_MANAGER_H__
+
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+namespace libcamera {
+
+class Camera;
+
+class ResourceManager
+{
+public:
+	using Usage = std::map<std::string, uint64_t>;
+
+	void setCapacity(const std::string &resource, uint64_t capacity);
+	uint64_t capacity(const std::string &resource) const;
+
+	uint64_t available(const std::string &resource,
+			   const Camera *camera = nullptr) const;
+	bool fits(const Usage &usage, const Camera *camera = nullptr) const;
+	bool inUse(const Camera *camera = nullptr) const;
+
+	void reserve(const Camera *camera, const Usage &usage);
+	bool release(const Camera *camera);
+	Usage reserved(const Camera *camera) const;
+
+private:
+	uint64_t available(const std::map<std::string, uint64_t>::const_iterator &it,
+			   const Camera *camera) const;
+
+	mutable std::mutex mutex_;
+	std::map<std::string, uint64_t> capacities_;
+	std::map<const Camera *, Usage> reservations_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RESOURCE_MANAGER_H__ */
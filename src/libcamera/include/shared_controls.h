@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * shared_controls.h - Control lists shared through memory between processes
+ */
+#ifndef __LIBCAMERA_SHARED_CONTROLS_H__
+#define __LIBCAMERA_SHARED_CONTROLS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcamera/controls.h>
+
+namespace libcamera {
+
+class SharedControls
+{
+public:
+	SharedControls();
+	~SharedControls();
+
+	SharedControls(const SharedControls &) = delete;
+	SharedControls &operator=(const SharedControls &) = delete;
+
+	int create(unsigned int slots);
+	int attach(int fd);
+	void close();
+
+	bool isValid() const { return header_ != nullptr; }
+	int fd() const { return fd_; }
+	unsigned int slots() const { return slots_; }
+
+	uint32_t write(uint32_t frame, const ControlList &list);
+	int read(uint32_t frame, ControlList *list,
+		 uint32_t *generation = nullptr) const;
+	uint32_t generation(uint32_t frame) const;
+
+private:
+	struct Header;
+	struct Slot;
+
+	static size_t regionSize(unsigned int slots);
+
+	int map(int fd, size_t size);
+	Slot *slot(uint32_t frame) const;
+
+	int fd_;
+	void *mem_;
+	size_t size_;
+	Header *header_;
+	unsigned int slots_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_SHARED_CONTROLS_H__ */
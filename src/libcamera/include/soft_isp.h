@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * soft_isp.h - Software image signal processor for raw Bayer frames
+ */
+#ifndef __LIBCAMERA_SOFT_ISP_H__
+#define __LIBCAMERA_SOFT_ISP_H__
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+#include "thread_pool.h"
+
+namespace libcamera {
+
+class Plane;
+
+class SoftIsp
+{
+public:
+	struct Gains {
+		unsigned int red;
+		unsigned int green;
+		unsigned int blue;
+	};
+
+	struct Stats {
+		uint64_t sum[3];
+		uint64_t count[3];
+	};
+
+	SoftIsp();
+
+	static const std::vector<unsigned int> &inputFormats();
+	static const std::vector<unsigned int> &outputFormats();
+
+	int configure(unsigned int inputFormat, const Size &size,
+		      unsigned int inputStride, unsigned int outputFormat);
+	const Size &size() const { return size_; }
+	size_t frameSize() const { return frameSize_; }
+	unsigned int stride() const { return stride_; }
+
+	int process(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		    size_t dstSize, const Gains &gains, unsigned int firstLine,
+		    unsigned int lastLine, Stats *stats) const;
+
+	static Gains whiteBalance(const Stats &stats);
+
+private:
+	void unpackLine(const uint8_t *src, unsigned int line,
+			uint16_t *dst) const;
+	void writeLine(const uint16_t *const *rgb, const Gains &gains,
+		       uint8_t *dst) const;
+
+	unsigned int inputFormat_;
+	unsigned int outputFormat_;
+	Size size_;
+	unsigned int inputStride_;
+	unsigned int packing_;
+	unsigned int maxValue_;
+	/* Colour index of the pixels at even and odd lines and columns. */
+	unsigned int pattern_[2][2];
+
+	size_t inputFrameSize_;
+	size_t frameSize_;
+	unsigned int stride_;
+	std::vector<uint8_t> gamma_;
+};
+
+class SoftIspStage : public Object
+{
+public:
+	SoftIspStage();
+
+	int configure(unsigned int inputFormat, const Size &size,
+		      unsigned int inputStride, unsigned int outputFormat);
+	size_t frameSize() const { return isp_.frameSize(); }
+	unsigned int stride() const { return isp_.stride(); }
+
+	void queue(uint64_t cookie, Plane *src, Plane *dst);
+	void flush();
+
+	Signal<uint64_t, int> frameProcessed;
+
+private:
+	struct Frame {
+		uint64_t cookie;
+		Plane *src;
+		Plane *dst;
+		bool mapped;
+		unsigned int pending;
+		std::vector<int> results;
+		std::vector<SoftIsp::Stats> stats;
+	};
+
+	void bandCompleted(uint64_t serial);
+	void completeFrame(Frame *frame);
+
+	SoftIsp isp_;
+	SoftIsp::Gains gains_;
+	std::map<uint64_t, Frame> frames_;
+	uint64_t serial_;
+
+	/* Destroyed first, to stop the workers before the frames. */
+	ThreadPool pool_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_SOFT_ISP_H__ */
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * statistics_collector.h - Camera runtime statistics collection
+ */
+#ifndef __LIBCAMERA_STATISTICS_COLLECTOR_H__
+#define __LIBCAMERA_STATISTICS_COLLECTOR_H__
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <stdint.h>
+
+#include <libcamera/camera_statistics.h>
+
+namespace libcamera {
+
+class Buffer;
+class Camera;
+class CounterMetric;
+class HistogramMetric;
+class Request;
+class Stream;
+
+class StatisticsCollector
+{
+public:
+	StatisticsCollector();
+
+	void registerMetrics(const Camera *camera);
+	void start();
+	uint64_t started();
+
+	void requestQueued(unsigned int depth);
+	void bufferCompleted(const Buffer *buffer);
+	void requestCompleted(const Request *request);
+	void requestDropped();
+
+	CameraStatistics statistics() const;
+
+private:
+	class AtomicHistogram
+	{
+	public:
+		AtomicHistogram();
+
+		void add(uint64_t value);
+		Histogram histogram() const;
+
+	private:
+		std::array<std::atomic<uint64_t>, Histogram::BucketCount> counts_;
+	};
+
+	static void increment(std::atomic<uint64_t> &counter, uint64_t value = 1)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value,
+			      std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> requestsQueued_;
+	std::atomic<uint64_t> requestsCompleted_;
+	std::atomic<uint64_t> requestsCancelled_;
+	std::atomic<uint64_t> buffersCompleted_;
+	std::atomic<uint64_t> framesDropped_;
+	std::atomic<uint64_t> requestsDropped_;
+
+	AtomicHistogram queueDepth_;
+	AtomicHistogram requestLatency_;
+	AtomicHistogram startLatency_;
+	AtomicHistogram firstFrameLatency_;
+
+	CounterMetric *requestsMetric_;
+	CounterMetric *framesDroppedMetric_;
+	HistogramMetric *requestLatencyMetric_;
+	HistogramMetric *startLatencyMetric_;
+	std::map<const Stream *, CounterMetric *> streamFramesMetrics_;
+	std::map<const Stream *, HistogramMetric *> streamFirstFrameMetrics_;
+
+	/* Only accessed from the pipeline handler thread. */
+	std::deque<uint64_t> queueTimes_;
+	std::map<const Stream *, unsigned int> sequences_;
+	uint64_t startTime_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_STATISTICS_COLLECTOR_H__ */
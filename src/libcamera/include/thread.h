@@ -7,9 +7,12 @@
 #ifndef __LIBCAMERA_THREAD_H__
 #define __LIBCAMERA_THREAD_H__
 
+#include <chrono>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <libcamera/signal.h>
 
@@ -36,6 +39,12 @@ public:
 
 	bool isRunning();
 
+	int setName(const std::string &name);
+	int setAffinity(const std::vector<unsigned int> &cpus);
+	int setScheduling(int policy, int priority);
+	void setDispatchBudget(unsigned int messages,
+			       std::chrono::microseconds time = std::chrono::microseconds(0));
+
 	Signal<Thread *> finished;
 
 	static Thread *current();
@@ -43,6 +52,9 @@ public:
 	EventDispatcher *eventDispatcher();
 	void setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 
+	void dispatchMessages(Object *receiver = nullptr);
+	void dispatchMessageBatch();
+
 protected:
 	int exec();
 	virtual void run();
@@ -51,9 +63,10 @@ private:
 	void startThread();
 	void finishThread();
 
+	bool dispatchQueue(unsigned int messages, std::chrono::nanoseconds time);
+
 	void postMessage(std::unique_ptr<Message> msg, Object *receiver);
 	void removeMessages(Object *receiver);
-	void dispatchMessages();
 
 	friend class Object;
 	friend class ThreadData;
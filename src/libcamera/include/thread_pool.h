@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * thread_pool.h - Pool of worker threads
+ */
+#ifndef __LIBCAMERA_THREAD_POOL_H__
+#define __LIBCAMERA_THREAD_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/signal.h>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned int size = 0);
+	~ThreadPool();
+
+	unsigned int size() const { return workers_.size(); }
+
+	void queue(std::function<void()> work, uint64_t cookie = 0);
+	void wait();
+
+	Signal<uint64_t> completed;
+
+private:
+	class Worker;
+
+	struct Work {
+		std::function<void()> func;
+		uint64_t cookie;
+	};
+
+	struct WorkQueue {
+		Mutex mutex;
+		std::deque<Work> work;
+	};
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	void runWorker(unsigned int index);
+	Work take(unsigned int index);
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::unique_ptr<WorkQueue>> queues_;
+
+	Mutex mutex_;
+	std::condition_variable workAvailable_;
+	std::condition_variable idle_;
+	unsigned int next_;
+	unsigned int pending_;
+	unsigned int outstanding_;
+	bool stopping_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_THREAD_POOL_H__ */
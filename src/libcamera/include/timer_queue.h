@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * timer_queue.h - Ordered queue of timers backed by a timerfd
+ */
+#ifndef __LIBCAMERA_TIMER_QUEUE_H__
+#define __LIBCAMERA_TIMER_QUEUE_H__
+
+#include <functional>
+#include <set>
+#include <stdint.h>
+#include <utility>
+
+namespace libcamera {
+
+class EventDispatcherMonitor;
+class Timer;
+
+class TimerQueue
+{
+public:
+	TimerQueue();
+	~TimerQueue();
+
+	int fd() const { return fd_; }
+
+	void add(Timer *timer);
+	void remove(Timer *timer);
+
+	void arm();
+	void handleEvent();
+	void processTimers(EventDispatcherMonitor *monitor);
+
+private:
+	using Entry = std::pair<uint64_t, Timer *>;
+
+	struct EntryCompare {
+		bool operator()(const Entry &lhs, const Entry &rhs) const
+		{
+			if (lhs.first != rhs.first)
+				return lhs.first < rhs.first;
+			return std::less<Timer *>()(lhs.second, rhs.second);
+		}
+	};
+
+	std::set<Entry, EntryCompare> timers_;
+	int fd_;
+	uint64_t armedDeadline_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_TIMER_QUEUE_H__ */
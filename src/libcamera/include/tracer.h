@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * tracer.h - Frame latency tracing
+ */
+#ifndef __LIBCAMERA_TRACER_H__
+#define __LIBCAMERA_TRACER_H__
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace libcamera {
+
+class Buffer;
+class Request;
+
+class Tracer
+{
+public:
+	enum Event {
+		QueueRequest,
+		QueueBuffer,
+		DequeueBuffer,
+		CompleteBuffer,
+		CompleteRequest,
+		StartCamera,
+		StreamOn,
+		CameraStarted,
+	};
+
+	static Tracer *instance();
+
+	bool enabled() const { return !records_.empty(); }
+
+	unsigned int registerSource(const std::string &name);
+
+	void record(Event event, unsigned int source, const Request *request,
+		    const Buffer *buffer = nullptr);
+	void dump();
+
+private:
+	struct Record {
+		uint64_t timestamp;
+		uint64_t cookie;
+		const Request *request;
+		Event event;
+		unsigned int source;
+		unsigned int index;
+		unsigned int sequence;
+	};
+
+	Tracer();
+
+	std::vector<Record> records_;
+	std::atomic<uint64_t> position_;
+
+	std::mutex mutex_;
+	std::vector<std::string> sources_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_TRACER_H__ */
@@ -8,7 +8,12 @@
 #define __LIBCAMERA_UTILS_H__
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 #define ARRAY_SIZE(a)	(sizeof(a) / sizeof(a[0]))
 
@@ -27,6 +32,11 @@ std::unique_ptr<T> make_unique(Args&&... args)
 
 char *secure_getenv(const char *name);
 
+bool dmabuf_identity(int fd, std::pair<uint64_t, uint64_t> *id);
+
+int numa_node(const std::string &deviceNode);
+std::vector<unsigned int> numa_node_cpus(unsigned int node);
+
 template<class InputIt1, class InputIt2>
 unsigned int set_overlap(InputIt1 first1, InputIt1 last1,
 			 InputIt2 first2, InputIt2 last2)
@@ -53,6 +63,35 @@ const T& clamp(const T& v, const T& lo, const T& hi)
 	return std::max(lo, std::min(v, hi));
 }
 
+using clock = std::chrono::steady_clock;
+using duration = std::chrono::steady_clock::duration;
+using time_point = std::chrono::steady_clock::time_point;
+
+struct coarse_clock {
+	using duration = utils::duration;
+	using rep = duration::rep;
+	using period = duration::period;
+	using time_point = utils::time_point;
+
+	static constexpr bool is_steady = true;
+
+	static time_point now() noexcept;
+};
+
+/* Convert a time point to nanoseconds since the clock epoch */
+inline uint64_t time_point_to_ns(const time_point &time)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		time.time_since_epoch()).count();
+}
+
+inline uint64_t monotonic_ns()
+{
+	return time_point_to_ns(clock::now());
+}
+
+std::string time_point_to_string(const time_point &time);
+
 } /* namespace utils */
 
 } /* namespace libcamera */
@@ -8,7 +8,6 @@
 #ifndef __LIBCAMERA_V4L2_CONTROLS_H__
 #define __LIBCAMERA_V4L2_CONTROLS_H__
 
-#include <map>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -25,23 +24,51 @@ public:
 
 	unsigned int id() const { return id_; }
 	unsigned int type() const { return type_; }
+	unsigned int flags() const { return flags_; }
 	size_t size() const { return size_; }
 	const std::string &name() const { return name_; }
 
 	int64_t min() const { return min_; }
 	int64_t max() const { return max_; }
 
+	bool hasPayload() const { return hasPayload_; }
+	bool isInteger64() const { return isInteger64_; }
+
 private:
 	unsigned int id_;
 	unsigned int type_;
+	unsigned int flags_;
 	size_t size_;
 	std::string name_;
 
 	int64_t min_;
 	int64_t max_;
+
+	bool hasPayload_;
+	bool isInteger64_;
 };
 
-using V4L2ControlInfoMap = std::map<unsigned int, V4L2ControlInfo>;
+class V4L2ControlInfoMap
+{
+public:
+	using value_type = std::pair<unsigned int, V4L2ControlInfo>;
+	using const_iterator = std::vector<value_type>::const_iterator;
+
+	V4L2ControlInfoMap &operator=(std::vector<value_type> &&infos);
+
+	const_iterator begin() const { return infos_.begin(); }
+	const_iterator end() const { return infos_.end(); }
+
+	bool empty() const { return infos_.empty(); }
+	std::size_t size() const { return infos_.size(); }
+
+	const_iterator find(unsigned int id) const;
+	std::size_t count(unsigned int id) const { return find(id) != end(); }
+	const V4L2ControlInfo &at(unsigned int id) const;
+
+private:
+	std::vector<value_type> infos_;
+};
 
 class V4L2Control
 {
@@ -52,11 +79,15 @@ public:
 	int64_t value() const { return value_; }
 	void setValue(int64_t value) { value_ = value; }
 
+	std::vector<uint8_t> &payload() { return payload_; }
+	const std::vector<uint8_t> &payload() const { return payload_; }
+
 	unsigned int id() const { return id_; }
 
 private:
 	unsigned int id_;
 	int64_t value_;
+	std::vector<uint8_t> payload_;
 };
 
 class V4L2ControlList
@@ -8,15 +8,22 @@
 #define __LIBCAMERA_V4L2_DEVICE_H__
 
 #include <map>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <linux/videodev2.h>
 
+#include <libcamera/signal.h>
+
 #include "log.h"
 #include "v4l2_controls.h"
 
 namespace libcamera {
 
+class EventNotifier;
+class MediaRequest;
+
 class V4L2Device : protected Loggable
 {
 public:
@@ -25,31 +32,102 @@ public:
 
 	const V4L2ControlInfoMap &controls() const { return controls_; }
 
-	int getControls(V4L2ControlList *ctrls);
-	int setControls(V4L2ControlList *ctrls);
+	int getControls(V4L2ControlList *ctrls, bool refresh = false);
+	int setControls(V4L2ControlList *ctrls, MediaRequest *request = nullptr);
+
+	uint64_t skippedControlReads() const { return skippedControlReads_; }
+	uint64_t skippedControlWrites() const { return skippedControlWrites_; }
 
 	const std::string &deviceNode() const { return deviceNode_; }
 
+	int subscribeEvent(uint32_t type, uint32_t id = 0);
+	int unsubscribeEvent(uint32_t type, uint32_t id = 0);
+
+	Signal<uint32_t, uint64_t> frameStart;
+	Signal<uint32_t, uint32_t> sourceChanged;
+
 protected:
 	V4L2Device(const std::string &deviceNode);
 	~V4L2Device();
 
 	int open(unsigned int flags);
+	int setFd(int fd);
 
 	int ioctl(unsigned long request, void *argp);
 
 	int fd() { return fd_; }
 
 private:
+	friend class V4L2PreparedControls;
+
 	void listControls();
+	void enumerateControls();
+	void seedControlCache();
+	void eventAvailable(EventNotifier *notifier);
+
+	int setExtControls(const V4L2ControlInfo **controlInfo,
+			   struct v4l2_ext_control *v4l2Ctrls,
+			   unsigned int count, MediaRequest *request);
+
+	bool isCached(const V4L2ControlInfo *info, int64_t value) const;
+	void cacheControls(const V4L2ControlInfo **controlInfo,
+			   const struct v4l2_ext_control *v4l2Ctrls,
+			   unsigned int count);
+	void uncacheControls(const V4L2ControlInfo **controlInfo,
+			     unsigned int count);
 	void updateControls(V4L2ControlList *ctrls,
 			    const V4L2ControlInfo **controlInfo,
 			    const struct v4l2_ext_control *v4l2Ctrls,
+			    const unsigned int *indices,
 			    unsigned int count);
 
 	V4L2ControlInfoMap controls_;
+	std::map<unsigned int, int64_t> controlCache_;
 	std::string deviceNode_;
 	int fd_;
+
+	EventNotifier *eventNotifier_;
+	unsigned int subscribedEvents_;
+
+	uint64_t skippedControlReads_;
+	uint64_t skippedControlWrites_;
+};
+
+class V4L2PreparedControls
+{
+public:
+	V4L2PreparedControls();
+
+	int prepare(V4L2Device *device, const std::vector<unsigned int> &ids);
+	bool isValid() const { return device_ != nullptr; }
+
+	std::size_t size() const { return v4l2Ctrls_.size(); }
+	unsigned int id(unsigned int index) const { return v4l2Ctrls_[index].id; }
+
+	int64_t value(unsigned int index) const;
+	void setValue(unsigned int index, int64_t value);
+
+	std::vector<uint8_t> &payload(unsigned int index) { return payloads_[index]; }
+
+	int apply(MediaRequest *request = nullptr);
+
+private:
+	V4L2Device *device_;
+	std::vector<const V4L2ControlInfo *> controlInfo_;
+	std::vector<struct v4l2_ext_control> v4l2Ctrls_;
+	std::vector<std::vector<uint8_t>> payloads_;
+};
+
+class V4L2ControlBatch
+{
+public:
+	void add(V4L2PreparedControls *ctrls) { controls_.push_back(ctrls); }
+	void clear() { controls_.clear(); }
+
+	int apply(MediaRequest *request = nullptr);
+
+private:
+	std::vector<V4L2PreparedControls *> controls_;
 };
 
 } /* namespace libcamera */
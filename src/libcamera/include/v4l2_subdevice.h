@@ -29,6 +29,8 @@ struct V4L2SubdeviceFormat {
 	const std::string toString() const;
 };
 
+std::ostream &operator<<(std::ostream &out, const V4L2SubdeviceFormat &format);
+
 class V4L2Subdevice : public V4L2Device
 {
 public:
@@ -44,7 +46,7 @@ public:
 	int setCrop(unsigned int pad, Rectangle *rect);
 	int setCompose(unsigned int pad, Rectangle *rect);
 
-	ImageFormats formats(unsigned int pad);
+	const ImageFormats &formats(unsigned int pad);
 
 	int getFormat(unsigned int pad, V4L2SubdeviceFormat *format);
 	int setFormat(unsigned int pad, V4L2SubdeviceFormat *format);
@@ -64,6 +66,7 @@ private:
 			 Rectangle *rect);
 
 	const MediaEntity *entity_;
+	std::map<unsigned int, ImageFormats> formats_;
 };
 
 } /* namespace libcamera */
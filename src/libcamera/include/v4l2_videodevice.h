@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_V4L2_VIDEODEVICE_H__
 #define __LIBCAMERA_V4L2_VIDEODEVICE_H__
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -24,7 +25,10 @@ namespace libcamera {
 class Buffer;
 class BufferMemory;
 class BufferPool;
+class CounterMetric;
+class DmaBufAllocator;
 class EventNotifier;
+class HistogramMetric;
 class MediaDevice;
 class MediaEntity;
 
@@ -50,7 +54,8 @@ struct V4L2Capability final : v4l2_capability {
 	bool isMultiplanar() const
 	{
 		return device_caps() & (V4L2_CAP_VIDEO_CAPTURE_MPLANE |
-					V4L2_CAP_VIDEO_OUTPUT_MPLANE);
+					V4L2_CAP_VIDEO_OUTPUT_MPLANE |
+					V4L2_CAP_VIDEO_M2M_MPLANE);
 	}
 	bool isCapture() const
 	{
@@ -71,6 +76,11 @@ struct V4L2Capability final : v4l2_capability {
 					V4L2_CAP_VIDEO_OUTPUT |
 					V4L2_CAP_VIDEO_OUTPUT_MPLANE);
 	}
+	bool isM2M() const
+	{
+		return device_caps() & (V4L2_CAP_VIDEO_M2M |
+					V4L2_CAP_VIDEO_M2M_MPLANE);
+	}
 	bool isMeta() const
 	{
 		return device_caps() & (V4L2_CAP_META_CAPTURE |
@@ -102,17 +112,22 @@ class V4L2DeviceFormat
 {
 public:
 	uint32_t fourcc;
+	uint64_t modifier;
 	Size size;
 
 	struct {
 		uint32_t size;
 		uint32_t bpl;
-	} planes[3];
+	} planes[VIDEO_MAX_PLANES];
 	unsigned int planesCount;
 
+	int computePlanes(unsigned int align = 1);
+
 	const std::string toString() const;
 };
 
+std::ostream &operator<<(std::ostream &out, const V4L2DeviceFormat &format);
+
 class V4L2VideoDevice : public V4L2Device
 {
 public:
@@ -124,6 +139,7 @@ public:
 	V4L2VideoDevice &operator=(const V4L2VideoDevice &) = delete;
 
 	int open();
+	int open(int handle, enum v4l2_buf_type type);
 	void close();
 
 	const char *driverName() const { return caps_.driver(); }
@@ -132,16 +148,42 @@ public:
 
 	int getFormat(V4L2DeviceFormat *format);
 	int setFormat(V4L2DeviceFormat *format);
-	ImageFormats formats();
+	const ImageFormats &formats();
+	std::vector<uint64_t> frameIntervals(unsigned int pixelFormat,
+					     const Size &size);
+	int setFrameInterval(uint64_t *interval);
+
+	void setSpareBufferCount(unsigned int count, bool autoQueue = true)
+	{
+		spareCount_ = count;
+		spareAutoQueue_ = autoQueue;
+	}
+	unsigned int spareBufferCount() const { return spareBuffers_.size(); }
+	const BufferPool *sparePool() const { return sparePool_.get(); }
+	uint64_t spareFrames() const { return spareFrames_; }
 
 	int exportBuffers(BufferPool *pool);
 	int importBuffers(BufferPool *pool);
+	int importUserPtrBuffers(BufferPool *pool);
+	int reimportBuffers(BufferPool *pool);
+	int allocateBuffers(BufferPool *pool, DmaBufAllocator *allocator);
 	int releaseBuffers();
 
-	int queueBuffer(Buffer *buffer);
+	bool supportsRequests() const
+	{
+		return bufferCaps_ & V4L2_BUF_CAP_SUPPORTS_REQUESTS;
+	}
+
+	int queueBuffer(Buffer *buffer, MediaRequest *request = nullptr);
+	int queueSpareBuffer();
 	std::vector<std::unique_ptr<Buffer>> queueAllBuffers();
+	void unqueueBuffer(Buffer *buffer);
 	Signal<Buffer *> bufferReady;
 
+	unsigned int queuedBufferCount() const { return queuedCount_; }
+	uint64_t dequeueBatches() const { return dequeueBatches_; }
+	uint64_t dequeuedBuffers() const { return dequeuedBuffers_; }
+
 	int streamOn();
 	int streamOff();
 
@@ -152,6 +194,8 @@ protected:
 	std::string logPrefix() const;
 
 private:
+	void initQueue();
+
 	int getFormatMeta(V4L2DeviceFormat *format);
 	int setFormatMeta(V4L2DeviceFormat *format);
 
@@ -161,10 +205,15 @@ private:
 	int getFormatSingleplane(V4L2DeviceFormat *format);
 	int setFormatSingleplane(V4L2DeviceFormat *format);
 
+	int cachedFormat(V4L2DeviceFormat *format);
+
 	std::vector<unsigned int> enumPixelformats();
 	std::vector<SizeRange> enumSizes(unsigned int pixelFormat);
 
 	int requestBuffers(unsigned int count);
+	unsigned int createSpareBuffers(unsigned int available);
+	void queueSpareBuffers();
+	BufferMemory *bufferMemory(unsigned int index);
 	int createPlane(BufferMemory *buffer, unsigned int index,
 			unsigned int plane, unsigned int length);
 
@@ -175,11 +224,62 @@ private:
 
 	enum v4l2_buf_type bufferType_;
 	enum v4l2_memory memoryType_;
+	unsigned int bufferCaps_;
+
+	/* The format last set or retrieved, planesCount is 0 if unknown. */
+	V4L2DeviceFormat currentFormat_;
 
 	BufferPool *bufferPool_;
-	std::map<unsigned int, Buffer *> queuedBuffers_;
+	/* Buffers queued to the device, indexed by V4L2 buffer index. */
+	std::vector<Buffer *> queuedBuffers_;
+	unsigned int queuedCount_;
+	bool streaming_;
+
+	/* Spare buffers are indexed after the buffers of bufferPool_. */
+	unsigned int spareCount_;
+	bool spareAutoQueue_;
+	std::unique_ptr<BufferPool> sparePool_;
+	std::vector<std::unique_ptr<Buffer>> spareBuffers_;
+	uint64_t spareFrames_;
 
 	EventNotifier *fdEvent_;
+
+	uint64_t dequeueBatches_;
+	uint64_t dequeuedBuffers_;
+
+	/* Time of the last stream on, reset when the first frame completes. */
+	uint64_t streamOnTime_;
+
+	unsigned int traceSource_;
+
+	CounterMetric *buffersMetric_;
+	HistogramMetric *dequeueLatencyMetric_;
+	HistogramMetric *streamOnMetric_;
+	HistogramMetric *firstFrameMetric_;
+
+	ImageFormats formats_;
+	bool formatsCached_;
+};
+
+class V4L2M2MDevice
+{
+public:
+	V4L2M2MDevice(const std::string &deviceNode);
+	~V4L2M2MDevice();
+
+	int open();
+	void close();
+
+	const std::string &deviceNode() const { return deviceNode_; }
+
+	V4L2VideoDevice *output() { return output_; }
+	V4L2VideoDevice *capture() { return capture_; }
+
+private:
+	std::string deviceNode_;
+
+	V4L2VideoDevice *output_;
+	V4L2VideoDevice *capture_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,773 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_data_serializer.cpp - Serialization of data exchanged with IPA modules
+ */
+
+#include "ipa_data_serializer.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "log.h"
+
+/**
+ * \file ipa_data_serializer.h
+ * \brief Serialization of data exchanged with IPA modules
+ *
+ * Data exchanged with IPA modules isolated in a separate process is passed
+ * through IPC messages. The IPADataSerializer class serializes the data types
+ * used by IPA interfaces to a compact binary format, and the Serialized*
+ * classes decode them in place from received messages.
+ *
+ * Each serialized object starts with an IPASerializedHeader, followed by an
+ * array of fixed-size entries, and optionally by variable-size data
+ * referenced by the entries. All fields are 32-bit integers stored in native
+ * byte order, serialized data thus only needs to be 4-byte aligned to be
+ * decoded without copies. Serialized objects can be concatenated in a single
+ * buffer.
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Serialization)
+
+/**
+ * \enum IPASerializedType
+ * \brief Type of a serialized object
+ * \var IPASerializedControlList
+ * The object is a ControlList
+ * \var IPASerializedV4L2ControlList
+ * The object is a V4L2ControlList
+ * \var IPASerializedBuffers
+ * The object is a vector of IPABuffer descriptors
+ */
+
+/**
+ * \struct IPASerializedHeader
+ * \brief Header of a serialized object
+ * \var IPASerializedHeader::type
+ * The object type, as an IPASerializedType
+ * \var IPASerializedHeader::entries
+ * The number of entries in the object
+ * \var IPASerializedHeader::size
+ * The total size of the serialized object in bytes, including the header
+ */
+
+/**
+ * \struct IPASerializedControl
+ * \brief Serialized ControlList entry
+ * \var IPASerializedControl::id
+ * The control ID
+ * \var IPASerializedControl::type
+ * The control value type, as a ControlValueType
+ * \var IPASerializedControl::value
+ * The control value. Booleans and integers are stored in value[0], 64-bit
+ * integers in value[0] and value[1] in native layout, and rectangles in the
+ * x, y, w, h order
+ */
+
+/**
+ * \struct IPASerializedV4L2Control
+ * \brief Serialized V4L2ControlList entry
+ * \var IPASerializedV4L2Control::id
+ * The V4L2 control ID
+ * \var IPASerializedV4L2Control::value
+ * The 64-bit control value in native layout
+ * \var IPASerializedV4L2Control::payloadOffset
+ * The offset of the control payload from the start of the serialized object
+ * \var IPASerializedV4L2Control::payloadSize
+ * The size of the control payload in bytes, 0 for controls without payload
+ */
+
+/**
+ * \struct IPASerializedBuffer
+ * \brief Serialized IPABuffer descriptor
+ * \var IPASerializedBuffer::id
+ * The buffer ID
+ * \var IPASerializedBuffer::planes
+ * The number of planes in the buffer
+ * \var IPASerializedBuffer::firstPlane
+ * The index of the first plane of the buffer in the plane lengths array that
+ * follows the entries, and in the file descriptors passed along with the
+ * serialized data
+ */
+
+namespace {
+
+size_t paddedSize(size_t size)
+{
+	return (size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+/*
+ * Read the header of an object of \a type from \a buffer, and check that the
+ * whole object fits in the buffer.
+ */
+const IPASerializedHeader *readHeader(ByteStreamBuffer &buffer,
+				      IPASerializedType type)
+{
+	const IPASerializedHeader *header = buffer.read<IPASerializedHeader>();
+	if (!header)
+		return nullptr;
+
+	if (header->type != type || header->size < sizeof(*header) ||
+	    header->size - sizeof(*header) > buffer.size() - buffer.offset()) {
+		LOG(Serialization, Error)
+			<< "Invalid serialized object of type " << header->type
+			<< " and size " << header->size;
+		return nullptr;
+	}
+
+	return header;
+}
+
+int writeHeader(ByteStreamBuffer &buffer, IPASerializedType type,
+		size_t entries, size_t size)
+{
+	IPASerializedHeader header = {
+		type,
+		static_cast<uint32_t>(entries),
+		static_cast<uint32_t>(size),
+	};
+
+	return buffer.write(&header);
+}
+
+} /* namespace */
+
+/**
+ * \class IPADataSerializer
+ * \brief Serialize data exchanged with IPA modules
+ *
+ * The IPADataSerializer class serializes ControlList, V4L2ControlList and
+ * IPABuffer descriptors to a ByteStreamBuffer. The binarySize() methods
+ * compute the size of the serialized data, to allocate the buffer beforehand.
+ * The serialized data can be decoded in place with the SerializedControlList,
+ * SerializedV4L2ControlList and SerializedIPABuffers classes.
+ */
+
+/**
+ * \brief Compute the serialized size of a ControlList
+ * \param[in] list The control list
+ * \return The size of the serialized \a list in bytes
+ */
+size_t IPADataSerializer::binarySize(const ControlList &list)
+{
+	return sizeof(IPASerializedHeader)
+	     + list.size() * sizeof(IPASerializedControl);
+}
+
+/**
+ * \brief Compute the serialized size of a V4L2ControlList
+ * \param[in] list The V4L2 control list
+ * \return The size of the serialized \a list in bytes
+ */
+size_t IPADataSerializer::binarySize(const V4L2ControlList &list)
+{
+	size_t size = sizeof(IPASerializedHeader)
+		    + list.size() * sizeof(IPASerializedV4L2Control);
+
+	for (const V4L2Control &ctrl : list)
+		size += paddedSize(ctrl.payload().size());
+
+	return size;
+}
+
+/**
+ * \typedef IPADataSerializer::BufferIterator
+ * \brief Iterator over IPABuffer descriptors
+ */
+
+/**
+ * \brief Compute the serialized size of a range of IPABuffer descriptors
+ * \param[in] begin The first buffer descriptor
+ * \param[in] end The end of the range of buffer descriptors
+ * \return The size of the serialized buffer descriptors in bytes
+ */
+size_t IPADataSerializer::binarySize(BufferIterator begin, BufferIterator end)
+{
+	size_t size = sizeof(IPASerializedHeader)
+		    + (end - begin) * sizeof(IPASerializedBuffer);
+
+	for (BufferIterator it = begin; it != end; ++it)
+		size += it->memory.planes().size() * sizeof(uint32_t);
+
+	return size;
+}
+
+/**
+ * \fn IPADataSerializer::binarySize(const std::vector<IPABuffer> &buffers)
+ * \brief Compute the serialized size of IPABuffer descriptors
+ * \param[in] buffers The buffer descriptors
+ * \return The size of the serialized \a buffers in bytes
+ */
+
+/**
+ * \brief Serialize a ControlList
+ * \param[in] list The control list
+ * \param[in] buffer The buffer to serialize to
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const ControlList &list,
+				 ByteStreamBuffer &buffer)
+{
+	writeHeader(buffer, IPASerializedControlList, list.size(),
+		    binarySize(list));
+
+	for (const auto &ctrl : list) {
+		const ControlValue &value = ctrl.second;
+		IPASerializedControl entry = {};
+
+		entry.id = ctrl.first->id();
+		entry.type = value.type();
+
+		switch (value.type()) {
+		case ControlValueNone:
+			break;
+
+		case ControlValueBool:
+			entry.value[0] = value.getBool();
+			break;
+
+		case ControlValueInteger:
+			entry.value[0] = value.getInt();
+			break;
+
+		case ControlValueInteger64: {
+			int64_t value64 = value.getInt64();
+			memcpy(entry.value, &value64, sizeof(value64));
+			break;
+		}
+
+		case ControlValueRectangle: {
+			const Rectangle &rect = value.getRectangle();
+			entry.value[0] = rect.x;
+			entry.value[1] = rect.y;
+			entry.value[2] = rect.w;
+			entry.value[3] = rect.h;
+			break;
+		}
+		}
+
+		buffer.write(&entry);
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize a V4L2ControlList
+ * \param[in] list The V4L2 control list
+ * \param[in] buffer The buffer to serialize to
+ *
+ * Control payloads are stored after the control entries, each padded to a
+ * multiple of 4 bytes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const V4L2ControlList &list,
+				 ByteStreamBuffer &buffer)
+{
+	writeHeader(buffer, IPASerializedV4L2ControlList, list.size(),
+		    binarySize(list));
+
+	uint32_t offset = sizeof(IPASerializedHeader)
+			+ list.size() * sizeof(IPASerializedV4L2Control);
+
+	for (const V4L2Control &ctrl : list) {
+		IPASerializedV4L2Control entry = {};
+		int64_t value = ctrl.value();
+
+		entry.id = ctrl.id();
+		memcpy(entry.value, &value, sizeof(value));
+		entry.payloadOffset = offset;
+		entry.payloadSize = ctrl.payload().size();
+
+		buffer.write(&entry);
+
+		offset += paddedSize(entry.payloadSize);
+	}
+
+	for (const V4L2Control &ctrl : list) {
+		const std::vector<uint8_t> &payload = ctrl.payload();
+
+		buffer.write(payload.data(), payload.size());
+		buffer.skip(paddedSize(payload.size()) - payload.size());
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize a range of IPABuffer descriptors
+ * \param[in] begin The first buffer descriptor
+ * \param[in] end The end of the range of buffer descriptors
+ * \param[in] buffer The buffer to serialize to
+ * \param[out] fds The dmabuf file descriptors of the buffers planes
+ *
+ * File descriptors can't be serialized, the dmabuf file descriptors of all
+ * planes are instead appended to \a fds, to be passed along with the
+ * serialized data. They are not duplicated, and stay owned by the buffer
+ * descriptors.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(BufferIterator begin, BufferIterator end,
+				 ByteStreamBuffer &buffer,
+				 std::vector<int32_t> *fds)
+{
+	writeHeader(buffer, IPASerializedBuffers, end - begin,
+		    binarySize(begin, end));
+
+	uint32_t plane = 0;
+
+	for (BufferIterator it = begin; it != end; ++it) {
+		IPASerializedBuffer entry = {
+			it->id,
+			static_cast<uint32_t>(it->memory.planes().size()),
+			plane,
+		};
+
+		buffer.write(&entry);
+
+		plane += entry.planes;
+	}
+
+	for (BufferIterator it = begin; it != end; ++it) {
+		for (const Plane &plane : it->memory.planes()) {
+			uint32_t length = plane.length();
+
+			buffer.write(&length);
+			fds->push_back(plane.dmabuf());
+		}
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \fn IPADataSerializer::serialize(const std::vector<IPABuffer> &buffers,
+ * ByteStreamBuffer &buffer, std::vector<int32_t> *fds)
+ * \brief Serialize IPABuffer descriptors
+ * \param[in] buffers The buffer descriptors
+ * \param[in] buffer The buffer to serialize to
+ * \param[out] fds The dmabuf file descriptors of the buffers planes
+ *
+ * \sa serialize(BufferIterator, BufferIterator, ByteStreamBuffer &,
+ * std::vector<int32_t> *)
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+
+/**
+ * \class SerializedControlList
+ * \brief In-place decoder for a serialized ControlList
+ *
+ * The SerializedControlList class gives access to the controls of a
+ * ControlList serialized with IPADataSerializer, without copying them out of
+ * the buffer holding the serialized data. The buffer memory shall stay valid
+ * for the lifetime of the SerializedControlList.
+ */
+
+/**
+ * \brief Decode a ControlList from \a buffer
+ * \param[in] buffer The buffer holding the serialized data
+ *
+ * Decode the serialized object at the current location of \a buffer, and
+ * advance the location past the object. The result shall be checked with
+ * isValid().
+ */
+SerializedControlList::SerializedControlList(ByteStreamBuffer &buffer)
+	: valid_(false), count_(0), entries_(nullptr)
+{
+	const IPASerializedHeader *header =
+		readHeader(buffer, IPASerializedControlList);
+	if (!header)
+		return;
+
+	size_t size = sizeof(*header) + header->entries * sizeof(*entries_);
+	if (header->size != size) {
+		LOG(Serialization, Error) << "Invalid control list size";
+		return;
+	}
+
+	entries_ = buffer.read<IPASerializedControl>(header->entries);
+	if (!entries_)
+		return;
+
+	for (unsigned int i = 0; i < header->entries; ++i) {
+		if (entries_[i].id >= ControlIdCount ||
+		    entries_[i].type > ControlValueRectangle) {
+			LOG(Serialization, Error)
+				<< "Invalid control " << entries_[i].id;
+			return;
+		}
+	}
+
+	count_ = header->entries;
+	valid_ = true;
+}
+
+/**
+ * \fn SerializedControlList::isValid()
+ * \brief Check if the serialized data has been successfully decoded
+ * \return True if the data is valid, false otherwise
+ */
+
+/**
+ * \fn SerializedControlList::size()
+ * \brief Retrieve the number of controls
+ * \return The number of controls
+ */
+
+/**
+ * \brief Retrieve the ID of the control at \a index
+ * \param[in] index The control index
+ * \return The control ID
+ */
+ControlId SerializedControlList::id(unsigned int index) const
+{
+	return static_cast<ControlId>(entries_[index].id);
+}
+
+/**
+ * \brief Retrieve the value of the control at \a index
+ * \param[in] index The control index
+ * \return The control value
+ */
+ControlValue SerializedControlList::value(unsigned int index) const
+{
+	const IPASerializedControl &entry = entries_[index];
+
+	switch (entry.type) {
+	case ControlValueBool:
+		return ControlValue(static_cast<bool>(entry.value[0]));
+
+	case ControlValueInteger:
+		return ControlValue(static_cast<int>(entry.value[0]));
+
+	case ControlValueInteger64: {
+		int64_t value;
+		memcpy(&value, entry.value, sizeof(value));
+		return ControlValue(value);
+	}
+
+	case ControlValueRectangle: {
+		Rectangle rect;
+		rect.x = static_cast<int>(entry.value[0]);
+		rect.y = static_cast<int>(entry.value[1]);
+		rect.w = entry.value[2];
+		rect.h = entry.value[3];
+		return ControlValue(rect);
+	}
+
+	default:
+		return ControlValue();
+	}
+}
+
+/**
+ * \brief Store the decoded controls in \a list
+ * \param[in] list The control list
+ *
+ * Set all the decoded controls in \a list, replacing the value of the controls
+ * already present in the list.
+ *
+ * \return 0 on success or a negative error code if the data is invalid
+ */
+int SerializedControlList::apply(ControlList *list) const
+{
+	if (!valid_)
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < count_; ++i)
+		(*list)[id(i)] = value(i);
+
+	return 0;
+}
+
+/**
+ * \class SerializedV4L2ControlList
+ * \brief In-place decoder for a serialized V4L2ControlList
+ *
+ * The SerializedV4L2ControlList class gives access to the controls of a
+ * V4L2ControlList serialized with IPADataSerializer, including their payload,
+ * without copying them out of the buffer holding the serialized data. The
+ * buffer memory shall stay valid for the lifetime of the
+ * SerializedV4L2ControlList.
+ */
+
+/**
+ * \brief Decode a V4L2ControlList from \a buffer
+ * \param[in] buffer The buffer holding the serialized data
+ *
+ * Decode the serialized object at the current location of \a buffer, and
+ * advance the location past the object. The result shall be checked with
+ * isValid().
+ */
+SerializedV4L2ControlList::SerializedV4L2ControlList(ByteStreamBuffer &buffer)
+	: valid_(false), count_(0), base_(nullptr), entries_(nullptr)
+{
+	const IPASerializedHeader *header =
+		readHeader(buffer, IPASerializedV4L2ControlList);
+	if (!header)
+		return;
+
+	size_t size = sizeof(*header) + header->entries * sizeof(*entries_);
+	if (header->size < size) {
+		LOG(Serialization, Error) << "Invalid V4L2 control list size";
+		return;
+	}
+
+	entries_ = buffer.read<IPASerializedV4L2Control>(header->entries);
+	if (!entries_ || buffer.skip(header->size - size))
+		return;
+
+	for (unsigned int i = 0; i < header->entries; ++i) {
+		const IPASerializedV4L2Control &entry = entries_[i];
+
+		if (entry.payloadOffset < size ||
+		    entry.payloadOffset > header->size ||
+		    entry.payloadSize > header->size - entry.payloadOffset) {
+			LOG(Serialization, Error)
+				<< "Invalid payload for V4L2 control "
+				<< entry.id;
+			return;
+		}
+	}
+
+	base_ = reinterpret_cast<const uint8_t *>(header);
+	count_ = header->entries;
+	valid_ = true;
+}
+
+/**
+ * \fn SerializedV4L2ControlList::isValid()
+ * \brief Check if the serialized data has been successfully decoded
+ * \return True if the data is valid, false otherwise
+ */
+
+/**
+ * \fn SerializedV4L2ControlList::size()
+ * \brief Retrieve the number of controls
+ * \return The number of controls
+ */
+
+/**
+ * \brief Retrieve the ID of the control at \a index
+ * \param[in] index The control index
+ * \return The V4L2 control ID
+ */
+unsigned int SerializedV4L2ControlList::id(unsigned int index) const
+{
+	return entries_[index].id;
+}
+
+/**
+ * \brief Retrieve the value of the control at \a index
+ * \param[in] index The control index
+ * \return The control value
+ */
+int64_t SerializedV4L2ControlList::value(unsigned int index) const
+{
+	int64_t value;
+	memcpy(&value, entries_[index].value, sizeof(value));
+	return value;
+}
+
+/**
+ * \brief Retrieve the payload of the control at \a index
+ * \param[in] index The control index
+ *
+ * The payload is not copied, the returned pointer points to the buffer holding
+ * the serialized data.
+ *
+ * \return A pointer to the payload, or nullptr if the control has no payload
+ */
+const uint8_t *SerializedV4L2ControlList::payload(unsigned int index) const
+{
+	const IPASerializedV4L2Control &entry = entries_[index];
+	return entry.payloadSize ? base_ + entry.payloadOffset : nullptr;
+}
+
+/**
+ * \brief Retrieve the size of the payload of the control at \a index
+ * \param[in] index The control index
+ * \return The payload size in bytes
+ */
+size_t SerializedV4L2ControlList::payloadSize(unsigned int index) const
+{
+	return entries_[index].payloadSize;
+}
+
+/**
+ * \brief Append the decoded controls to \a list
+ * \param[in] list The V4L2 control list
+ *
+ * The payloads are copied to the controls added to \a list.
+ *
+ * \return 0 on success or a negative error code if the data is invalid
+ */
+int SerializedV4L2ControlList::apply(V4L2ControlList *list) const
+{
+	if (!valid_)
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < count_; ++i) {
+		list->add(id(i));
+
+		V4L2Control *ctrl = list->getByIndex(list->size() - 1);
+		ctrl->setValue(value(i));
+
+		const uint8_t *data = payload(i);
+		if (data)
+			ctrl->payload().assign(data, data + payloadSize(i));
+	}
+
+	return 0;
+}
+
+/**
+ * \class SerializedIPABuffers
+ * \brief In-place decoder for serialized IPABuffer descriptors
+ *
+ * The SerializedIPABuffers class gives access to IPABuffer descriptors
+ * serialized with IPADataSerializer, without copying them out of the buffer
+ * holding the serialized data. The buffer memory shall stay valid for the
+ * lifetime of the SerializedIPABuffers.
+ */
+
+/**
+ * \brief Decode IPABuffer descriptors from \a buffer
+ * \param[in] buffer The buffer holding the serialized data
+ *
+ * Decode the serialized object at the current location of \a buffer, and
+ * advance the location past the object. The result shall be checked with
+ * isValid().
+ */
+SerializedIPABuffers::SerializedIPABuffers(ByteStreamBuffer &buffer)
+	: valid_(false), count_(0), planeCount_(0), entries_(nullptr),
+	  lengths_(nullptr)
+{
+	const IPASerializedHeader *header =
+		readHeader(buffer, IPASerializedBuffers);
+	if (!header)
+		return;
+
+	size_t size = sizeof(*header) + header->entries * sizeof(*entries_);
+	if (header->size < size || (header->size - size) % sizeof(uint32_t)) {
+		LOG(Serialization, Error) << "Invalid buffers size";
+		return;
+	}
+
+	unsigned int planeCount = (header->size - size) / sizeof(uint32_t);
+
+	entries_ = buffer.read<IPASerializedBuffer>(header->entries);
+	lengths_ = buffer.read<uint32_t>(planeCount);
+	if (!entries_ || !lengths_)
+		return;
+
+	for (unsigned int i = 0; i < header->entries; ++i) {
+		const IPASerializedBuffer &entry = entries_[i];
+
+		if (entry.firstPlane > planeCount ||
+		    entry.planes > planeCount - entry.firstPlane) {
+			LOG(Serialization, Error)
+				<< "Invalid planes for buffer " << entry.id;
+			return;
+		}
+	}
+
+	count_ = header->entries;
+	planeCount_ = planeCount;
+	valid_ = true;
+}
+
+/**
+ * \fn SerializedIPABuffers::isValid()
+ * \brief Check if the serialized data has been successfully decoded
+ * \return True if the data is valid, false otherwise
+ */
+
+/**
+ * \fn SerializedIPABuffers::size()
+ * \brief Retrieve the number of buffers
+ * \return The number of buffers
+ */
+
+/**
+ * \brief Retrieve the ID of the buffer at \a index
+ * \param[in] index The buffer index
+ * \return The buffer ID
+ */
+unsigned int SerializedIPABuffers::id(unsigned int index) const
+{
+	return entries_[index].id;
+}
+
+/**
+ * \brief Retrieve the number of planes of the buffer at \a index
+ * \param[in] index The buffer index
+ * \return The number of planes
+ */
+unsigned int SerializedIPABuffers::planes(unsigned int index) const
+{
+	return entries_[index].planes;
+}
+
+/**
+ * \brief Retrieve the length of a plane of the buffer at \a index
+ * \param[in] index The buffer index
+ * \param[in] plane The plane index in the buffer
+ * \return The plane length in bytes
+ */
+unsigned int SerializedIPABuffers::planeLength(unsigned int index,
+					       unsigned int plane) const
+{
+	return lengths_[entries_[index].firstPlane + plane];
+}
+
+/**
+ * \brief Append the decoded buffer descriptors to \a buffers
+ * \param[in] fds The dmabuf file descriptors passed with the serialized data
+ * \param[in] buffers The buffer descriptors
+ *
+ * The file descriptors in \a fds are duplicated by the planes of the buffers
+ * added to \a buffers, the caller keeps ownership of \a fds.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SerializedIPABuffers::apply(const std::vector<int32_t> &fds,
+				std::vector<IPABuffer> *buffers) const
+{
+	if (!valid_)
+		return -EINVAL;
+
+	if (fds.size() != planeCount_) {
+		LOG(Serialization, Error)
+			<< "Expected " << planeCount_ << " file descriptors, got "
+			<< fds.size();
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < count_; ++i) {
+		buffers->emplace_back();
+		IPABuffer &buffer = buffers->back();
+		buffer.id = id(i);
+
+		for (unsigned int j = 0; j < planes(i); ++j) {
+			buffer.memory.planes().emplace_back();
+			int ret = buffer.memory.planes().back().setDmabuf(
+				fds[entries_[i].firstPlane + j],
+				planeLength(i, j));
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
@@ -14,9 +14,76 @@
 
 namespace libcamera {
 
+/**
+ * \struct IPABuffer
+ * \brief Buffer information for the IPA interface
+ *
+ * The IPABuffer structure associates a buffer memory with a numerical ID, to
+ * share buffers, such as parameters and statistics buffers, between pipeline
+ * handlers and IPAs. Buffers are registered once with
+ * IPAInterface::mapBuffers(), and are then referenced by their ID in the data
+ * of per-frame events and actions.
+ */
+
+/**
+ * \var IPABuffer::id
+ * \brief The buffer unique ID
+ *
+ * Buffer IDs are chosen by the pipeline handler to fulfil the following
+ * constraints:
+ *
+ * - IDs shall be positive integers different than zero
+ * - IDs shall be unique among all mapped buffers
+ *
+ * When buffers are unmapped the IDs of the unmapped buffers may be reused.
+ */
+
+/**
+ * \var IPABuffer::memory
+ * \brief The buffer memory description
+ *
+ * The memory field stores the dmabuf handle and size for each plane of the
+ * buffer.
+ */
+
+/**
+ * \struct IPAOperationData
+ * \brief Parameters for IPA operations
+ *
+ * The IPAOperationData structure carries the parameters of the events sent by
+ * pipeline handlers to IPAs with IPAInterface::processEvent(), and of the
+ * actions queued by IPAs to pipeline handlers with the
+ * IPAInterface::queueFrameAction signal. The meaning of the operation code and
+ * of the data is defined by the pipeline handler and its IPA.
+ */
+
+/**
+ * \var IPAOperationData::operation
+ * \brief Operation code, specific to the pipeline handler and its IPA
+ */
+
+/**
+ * \var IPAOperationData::data
+ * \brief Operation data, specific to the pipeline handler and its IPA
+ */
+
 /**
  * \class IPAInterface
  * \brief Interface for IPA implementation
+ *
+ * The IPAInterface is implemented by IPA modules, and used by pipeline handlers
+ * through the IPAManager. Communication between pipeline handlers and IPAs is
+ * asynchronous. Pipeline handlers notify IPAs of per-frame events, such as the
+ * availability of statistics, with processEvent(), and IPAs queue per-frame
+ * actions, such as sensor controls to apply, to the pipeline handler through
+ * the queueFrameAction signal.
+ *
+ * IPAs don't run in the pipeline handler thread. IPAs that can run in the
+ * libcamera process run in a dedicated thread, and other IPAs run in a separate
+ * process. In both cases processEvent() returns immediately, and the event is
+ * processed in parallel with the pipeline handler. The queueFrameAction
+ * signal is delivered to the pipeline handler in the thread that created the
+ * IPA interface.
  */
 
 /**
@@ -24,4 +91,58 @@ namespace libcamera {
  * \brief Initialise the IPAInterface
  */
 
+/**
+ * \fn IPAInterface::mapBuffers()
+ * \brief Map buffers shared between the pipeline handler and the IPA
+ * \param[in] buffers List of buffers to map
+ *
+ * This method informs the IPA module of memory buffers set up by the pipeline
+ * handler that the IPA needs to access. It provides dmabuf file handles for
+ * each buffer, and associates the buffers with unique numerical IDs.
+ *
+ * IPAs shall map the dmabuf file handles to their address space and keep a
+ * cache of the mappings, indexed by the buffer numerical IDs. The IDs are
+ * used in all other IPA interface methods and signals to refer to buffers,
+ * removing the need to pass the file handles with every frame.
+ *
+ * All buffers of a pool should be mapped in a single call, which the isolated
+ * IPA proxy transfers with as few messages as possible.
+ *
+ * Mapping and unmapping are processed by the IPA in order with the events
+ * passed to processEvent(). Buffers may thus be referenced by the events
+ * queued after the call to mapBuffers() and before the call to
+ * unmapBuffers().
+ *
+ * \sa unmapBuffers()
+ */
+
+/**
+ * \fn IPAInterface::unmapBuffers()
+ * \brief Unmap buffers shared by the pipeline to the IPA
+ * \param[in] ids List of buffer IDs to unmap
+ *
+ * This method removes mappings set up with mapBuffers(). Buffers may be
+ * unmapped in batches or all at once.
+ *
+ * \sa mapBuffers()
+ */
+
+/**
+ * \fn IPAInterface::processEvent()
+ * \brief Notify the IPA of a per-frame event
+ * \param[in] frame The frame number the event relates to
+ * \param[in] event The event
+ *
+ * This method is called by pipeline handlers, and returns without waiting for
+ * the IPA to process the \a event.
+ */
+
+/**
+ * \var IPAInterface::queueFrameAction
+ * \brief Queue an action associated with a frame to the pipeline handler
+ *
+ * This signal is emitted by the IPA to request the pipeline handler to perform
+ * an action for the frame identified by its number.
+ */
+
 } /* namespace libcamera */
@@ -7,14 +7,22 @@
 
 #include "ipa_manager.h"
 
+#include <algorithm>
 #include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "ipa_module.h"
 #include "ipa_proxy.h"
 #include "log.h"
 #include "pipeline_handler.h"
+#include "process.h"
 #include "utils.h"
 
 /**
@@ -26,20 +34,74 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPAManager)
 
+namespace {
+
+const char IPAIndexMagic[8] = "lcipa3";
+
+/*
+ * Initiate an asynchronous read of the file at \a path into the page cache,
+ * without waiting for the I/O to complete.
+ */
+void prefetchFile(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	int ret = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	if (ret)
+		LOG(IPAManager, Debug)
+			<< "Failed to prefetch " << path << ": " << strerror(ret);
+
+	close(fd);
+}
+
+} /* namespace */
+
+#ifndef HAVE_IPA_PUBKEY
+const std::vector<uint8_t> IPAManager::publicKeyData_;
+#endif
+
 /**
  * \class IPAManager
  * \brief Manager for IPA modules
+ *
+ * The IPA manager enumerates IPA modules when it is created, and retrieves
+ * their IPAModuleInfo by parsing the ELF symbol table of their shared object.
+ * To avoid parsing all shared objects every time a process starts, the
+ * information of the enumerated modules can be stored in an index file, whose
+ * path is set with the LIBCAMERA_IPA_MODULE_INDEX environment variable. Modules
+ * whose shared object device and inode numbers, size and modification time
+ * match the index are then created from the index without accessing the shared
+ * object, and only new or modified modules are parsed. The index file is
+ * updated when the set of modules changes.
+ *
+ * In all cases the shared object of an IPA module is only loaded when an IPA
+ * interface is created with createIPA() for a matching pipeline handler.
+ *
+ * When libcamera is built with support for signed IPA modules, the IPA
+ * modules built with libcamera are signed with a key generated at build time,
+ * and the manager verifies the signature of an IPA module when an IPA interface
+ * is created for it. Only open-source IPA modules with a valid signature then
+ * run in the libcamera process, other IPA modules are isolated in a separate
+ * process. Without signature support, all open-source IPA modules run in the
+ * libcamera process. The index is writable by the user, and could be modified
+ * along with a module to bypass the verification. The result of the signature
+ * verification is thus never stored in the index, and only the modules in use
+ * are hashed.
  */
 
 IPAManager::IPAManager()
+	: pubKey_(publicKeyData_), indexChanged_(false)
 {
+	const char *indexPath = utils::secure_getenv("LIBCAMERA_IPA_MODULE_INDEX");
+	if (indexPath)
+		loadIndex(indexPath);
+
 	addDir(IPA_MODULE_DIR);
 
 	const char *modulePaths = utils::secure_getenv("LIBCAMERA_IPA_MODULE_PATH");
-	if (!modulePaths)
-		return;
-
-	while (1) {
+	while (modulePaths) {
 		const char *delim = strchrnul(modulePaths, ':');
 		size_t count = delim - modulePaths;
 
@@ -53,6 +115,36 @@ IPAManager::IPAManager()
 
 		modulePaths += count + 1;
 	}
+
+	/* Drop index entries for modules that are not present anymore. */
+	for (auto iter = index_.begin(); iter != index_.end();) {
+		auto module = std::find_if(modules_.begin(), modules_.end(),
+					   [&](IPAModule *m) { return m->path() == iter->first; });
+		if (module != modules_.end()) {
+			++iter;
+			continue;
+		}
+
+		iter = index_.erase(iter);
+		indexChanged_ = true;
+	}
+
+	if (indexPath && indexChanged_)
+		storeIndex(indexPath);
+
+	index_.clear();
+
+	/*
+	 * Keep a proxy worker ready for closed-source IPA modules, to remove
+	 * the worker process startup from the IPA interface creation.
+	 */
+	bool isolated = std::any_of(modules_.begin(), modules_.end(),
+				    [](IPAModule *m) { return !m->isOpenSource(); });
+	if (isolated) {
+		std::string path = IPAProxy::resolvePath("ipa_proxy_linux");
+		if (!path.empty())
+			ProcessManager::instance()->prestart(path, IPAProxyWorkers);
+	}
 }
 
 IPAManager::~IPAManager()
@@ -76,6 +168,33 @@ IPAManager *IPAManager::instance()
 	return &ipaManager;
 }
 
+/**
+ * \brief Prefetch the shared objects of all IPA modules
+ *
+ * IPA modules are enumerated without loading their shared object, which is
+ * read from storage when an IPA interface is created. On slow storage this
+ * adds noticeable latency to the creation of the IPA interface. This method
+ * instructs the kernel to read the shared objects of all enumerated modules
+ * into the page cache in the background, and returns immediately. It is
+ * called when the camera manager starts, allowing the I/O to overlap with
+ * device enumeration.
+ */
+void IPAManager::prefetch()
+{
+	for (const IPAModule *module : modules_)
+		prefetchFile(module->path());
+}
+
+/**
+ * \fn IPAManager::pubKey()
+ * \brief Retrieve the public key used to verify IPA module signatures
+ *
+ * The key is invalid when libcamera is built without support for signed IPA
+ * modules.
+ *
+ * \return The public key of IPA module signatures
+ */
+
 /**
  * \brief Load IPA modules from a directory
  * \param[in] libDir directory to search for IPA modules
@@ -108,12 +227,10 @@ int IPAManager::addDir(const char *libDir)
 		if (strcmp(&ent->d_name[offset], ".so"))
 			continue;
 
-		IPAModule *ipaModule = new IPAModule(std::string(libDir) +
-						     "/" + ent->d_name);
-		if (!ipaModule->isValid()) {
-			delete ipaModule;
+		IPAModule *ipaModule = createModule(std::string(libDir) +
+						    "/" + ent->d_name);
+		if (!ipaModule)
 			continue;
-		}
 
 		modules_.push_back(ipaModule);
 		count++;
@@ -123,6 +240,151 @@ int IPAManager::addDir(const char *libDir)
 	return count;
 }
 
+/*
+ * Create an IPA module for the shared object at \a path, using the module
+ * information from the index when the shared object hasn't changed since it was
+ * indexed. Return nullptr if the module is invalid.
+ */
+IPAModule *IPAManager::createModule(const std::string &path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0)
+		return nullptr;
+
+	IndexEntry entry = {};
+	entry.dev = st.st_dev;
+	entry.ino = st.st_ino;
+	entry.size = st.st_size;
+	entry.mtime = st.st_mtim.tv_sec;
+	entry.mtimeNsec = st.st_mtim.tv_nsec;
+
+	IPAModule *module;
+
+	auto iter = index_.find(path);
+	if (iter != index_.end() &&
+	    iter->second.dev == entry.dev &&
+	    iter->second.ino == entry.ino &&
+	    iter->second.size == entry.size &&
+	    iter->second.mtime == entry.mtime &&
+	    iter->second.mtimeNsec == entry.mtimeNsec) {
+		module = new IPAModule(path, iter->second.info);
+	} else {
+		module = new IPAModule(path);
+		if (module->isValid()) {
+			entry.info = module->info();
+			index_[path] = entry;
+			indexChanged_ = true;
+		}
+	}
+
+	if (!module->isValid()) {
+		delete module;
+		return nullptr;
+	}
+
+	return module;
+}
+
+/*
+ * Load the IPA module index from \a path. A missing or invalid index is
+ * ignored, all modules are then parsed and the index is recreated.
+ */
+void IPAManager::loadIndex(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return;
+
+	char magic[sizeof(IPAIndexMagic)];
+	uint32_t apiVersion;
+	uint32_t count;
+
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char *>(&apiVersion), sizeof(apiVersion));
+	file.read(reinterpret_cast<char *>(&count), sizeof(count));
+	if (!file || memcmp(magic, IPAIndexMagic, sizeof(magic)) ||
+	    apiVersion != IPA_MODULE_API_VERSION) {
+		LOG(IPAManager, Debug) << "Ignoring invalid IPA module index " << path;
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t length;
+		IndexEntry entry;
+
+		file.read(reinterpret_cast<char *>(&length), sizeof(length));
+		if (!file || length > PATH_MAX)
+			break;
+
+		std::string modulePath(length, '\0');
+		file.read(&modulePath[0], length);
+		file.read(reinterpret_cast<char *>(&entry), sizeof(entry));
+		if (!file)
+			break;
+
+		index_[modulePath] = entry;
+	}
+
+	if (!file) {
+		LOG(IPAManager, Debug) << "Truncated IPA module index " << path;
+		index_.clear();
+		return;
+	}
+
+	LOG(IPAManager, Debug)
+		<< "Loaded " << index_.size() << " entries from IPA module index "
+		<< path;
+}
+
+/*
+ * Store the index entries of all valid modules to \a path. The index file is
+ * replaced atomically to avoid readers seeing a partially written file.
+ */
+void IPAManager::storeIndex(const std::string &path)
+{
+	std::string tmpPath = path + "." + std::to_string(getpid());
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+
+	uint32_t apiVersion = IPA_MODULE_API_VERSION;
+	uint32_t count = index_.size();
+
+	file.write(IPAIndexMagic, sizeof(IPAIndexMagic));
+	file.write(reinterpret_cast<const char *>(&apiVersion), sizeof(apiVersion));
+	file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+
+	for (const auto &iter : index_) {
+		const std::string &modulePath = iter.first;
+		uint32_t length = modulePath.size();
+
+		file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+		file.write(modulePath.data(), length);
+		file.write(reinterpret_cast<const char *>(&iter.second),
+			   sizeof(iter.second));
+	}
+
+	file.close();
+
+	if (!file || rename(tmpPath.c_str(), path.c_str()) < 0) {
+		LOG(IPAManager, Warning)
+			<< "Failed to store IPA module index " << path;
+		unlink(tmpPath.c_str());
+	}
+}
+
+/*
+ * Open-source IPA modules are trusted to run in the libcamera process, provided
+ * their signature is valid when libcamera supports signed IPA modules. The
+ * signature is verified against the current content of the shared object every
+ * time, as the module may have been modified since it was enumerated.
+ */
+bool IPAManager::isTrusted(IPAModule *module) const
+{
+	if (!module->isOpenSource())
+		return false;
+
+	return !pubKey_.isValid() || module->verifySignature(pubKey_);
+}
+
 /**
  * \brief Create an IPA interface that matches a given pipeline handler
  * \param[in] pipe The pipeline handler that wants a matching IPA interface
@@ -148,36 +410,35 @@ std::unique_ptr<IPAInterface> IPAManager::createIPA(PipelineHandler *pipe,
 	if (!m)
 		return nullptr;
 
-	if (!m->isOpenSource()) {
-		IPAProxyFactory *pf = nullptr;
-		std::vector<IPAProxyFactory *> &factories = IPAProxyFactory::factories();
-
-		for (IPAProxyFactory *factory : factories) {
-			/* TODO: Better matching */
-			if (!strcmp(factory->name().c_str(), "IPAProxyLinux")) {
-				pf = factory;
-				break;
-			}
-		}
-
-		if (!pf) {
-			LOG(IPAManager, Error) << "Failed to get proxy factory";
-			return nullptr;
-		}
-
-		std::unique_ptr<IPAProxy> proxy = pf->create(m);
-		if (!proxy->isValid()) {
-			LOG(IPAManager, Error) << "Failed to load proxy";
-			return nullptr;
+	/*
+	 * Trusted IPA modules run in a dedicated thread, other modules are
+	 * isolated in a separate process.
+	 */
+	const char *proxyName = isTrusted(m) ? "IPAProxyThread"
+					     : "IPAProxyLinux";
+	IPAProxyFactory *pf = nullptr;
+	std::vector<IPAProxyFactory *> &factories = IPAProxyFactory::factories();
+
+	for (IPAProxyFactory *factory : factories) {
+		/* TODO: Better matching */
+		if (!strcmp(factory->name().c_str(), proxyName)) {
+			pf = factory;
+			break;
 		}
+	}
 
-		return proxy;
+	if (!pf) {
+		LOG(IPAManager, Error) << "Failed to get proxy factory";
+		return nullptr;
 	}
 
-	if (!m->load())
+	std::unique_ptr<IPAProxy> proxy = pf->create(m);
+	if (!proxy->isValid()) {
+		LOG(IPAManager, Error) << "Failed to load proxy";
 		return nullptr;
+	}
 
-	return m->createInstance();
+	return proxy;
 }
 
 } /* namespace libcamera */
@@ -19,6 +19,7 @@
 #include <sys/types.h>
 #include <tuple>
 #include <unistd.h>
+#include <vector>
 
 #include "log.h"
 #include "pipeline_handler.h"
@@ -267,7 +268,7 @@ elfLoadSymbol(void *map, size_t soSize, const char *symbol)
  */
 IPAModule::IPAModule(const std::string &libPath)
 	: libPath_(libPath), valid_(false), loaded_(false),
-	  dlHandle_(nullptr), ipaCreate_(nullptr)
+	  signatureValid_(false), dlHandle_(nullptr), ipaCreate_(nullptr)
 {
 	if (loadIPAModuleInfo() < 0)
 		return;
@@ -275,6 +276,34 @@ IPAModule::IPAModule(const std::string &libPath)
 	valid_ = true;
 }
 
+/**
+ * \brief Construct an IPAModule instance from known module information
+ * \param[in] libPath path to IPA module shared object
+ * \param[in] info The IPA module information
+ *
+ * Create an IPAModule for the shared object at \a libPath using the
+ * IPAModuleInfo \a info previously retrieved from the same shared object,
+ * without parsing the shared object again. This is used by the IPAManager to
+ * create IPA modules from its module index. The caller is responsible for
+ * ensuring that \a info matches the shared object. The signature of the module
+ * isn't verified, see verifySignature().
+ *
+ * The caller shall call the isValid() method after constructing an
+ * IPAModule instance to verify the validity of the IPAModule.
+ */
+IPAModule::IPAModule(const std::string &libPath,
+		     const struct IPAModuleInfo &info)
+	: info_(info), libPath_(libPath), valid_(false), loaded_(false),
+	  signatureValid_(false), dlHandle_(nullptr), ipaCreate_(nullptr)
+{
+	if (info_.moduleAPIVersion != IPA_MODULE_API_VERSION) {
+		LOG(IPAModule, Error) << "IPA module API version mismatch";
+		return;
+	}
+
+	valid_ = true;
+}
+
 IPAModule::~IPAModule()
 {
 	if (dlHandle_)
@@ -497,4 +526,77 @@ bool IPAModule::isOpenSource() const
 	return false;
 }
 
+/**
+ * \brief Verify the signature of the IPA module shared object
+ * \param[in] pubKey The public key the module shall be signed with
+ *
+ * IPA modules built with libcamera are signed with a private key generated at
+ * build time, and the signature is stored in a file named after the module
+ * shared object with a ".sign" suffix. This function verifies the signature
+ * of the whole shared object with \a pubKey, and stores the result, which can
+ * then be retrieved with isSignatureValid().
+ *
+ * Verification hashes the whole shared object. Its result is only valid for
+ * the current content of the shared object, and shall not be stored in a
+ * location that can be modified by the users the check protects against.
+ *
+ * \return True if the signature is valid, false otherwise
+ */
+bool IPAModule::verifySignature(const PubKey &pubKey)
+{
+	signatureValid_ = false;
+
+	if (!pubKey.isValid())
+		return false;
+
+	std::vector<uint8_t> signature;
+	int fd = open((libPath_ + ".sign").c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= 4096) {
+		signature.resize(st.st_size);
+		if (read(fd, signature.data(), signature.size()) != st.st_size)
+			signature.clear();
+	}
+
+	close(fd);
+
+	if (signature.empty())
+		return false;
+
+	fd = open(libPath_.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return false;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	signatureValid_ = pubKey.verify(map, st.st_size, signature.data(),
+					signature.size());
+	munmap(map, st.st_size);
+
+	LOG(IPAModule, Debug)
+		<< "IPA module " << libPath_ << " signature is "
+		<< (signatureValid_ ? "valid" : "invalid");
+
+	return signatureValid_;
+}
+
+/**
+ * \fn IPAModule::isSignatureValid()
+ * \brief Retrieve the result of the signature verification
+ * \return True if the signature of the IPA module has been verified as valid,
+ * false otherwise
+ * \sa verifySignature()
+ */
+
 } /* namespace libcamera */
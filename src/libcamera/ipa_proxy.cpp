@@ -73,7 +73,7 @@ IPAProxy::~IPAProxy()
  * \return The full path to the proxy worker executable, or an empty string if
  * no valid executable path
  */
-std::string IPAProxy::resolvePath(const std::string &file) const
+std::string IPAProxy::resolvePath(const std::string &file)
 {
 	/* Try finding the exec target from the install directory first */
 	std::string proxyFile = "/" + file;
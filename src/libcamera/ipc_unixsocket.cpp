@@ -7,12 +7,19 @@
 
 #include "ipc_unixsocket.h"
 
-#include <poll.h>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <new>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "log.h"
+#include "metrics_registry.h"
 
 /**
  * \file ipc_unixsocket.h
@@ -23,6 +30,57 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPCUnixSocket)
 
+/*
+ * Shared memory ring header, followed by the ring data. The ring is written by
+ * a single producer and read by a single consumer, head and tail are free
+ * running byte counters. As the remote side may not be trusted, the ring size
+ * is never read from shared memory, and the head and tail values are validated
+ * before use.
+ */
+struct IPCUnixSocket::Ring {
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+
+	uint8_t *data() { return reinterpret_cast<uint8_t *>(this + 1); }
+};
+
+namespace {
+
+/* Header of each message stored in a shared memory ring. */
+struct RingRecord {
+	uint32_t length;
+	uint32_t flags;
+};
+
+/* The message payload has been sent through the socket. */
+constexpr uint32_t RecordSocket = 1 << 0;
+
+constexpr uint32_t MinRingSize = 4096;
+
+void ringWrite(uint8_t *data, uint32_t size, uint32_t pos, const void *src,
+	       size_t length)
+{
+	const uint8_t *buffer = static_cast<const uint8_t *>(src);
+	uint32_t offset = pos & (size - 1);
+	size_t first = std::min<size_t>(length, size - offset);
+
+	memcpy(data + offset, buffer, first);
+	memcpy(data, buffer + first, length - first);
+}
+
+void ringRead(const uint8_t *data, uint32_t size, uint32_t pos, void *dst,
+	      size_t length)
+{
+	uint8_t *buffer = static_cast<uint8_t *>(dst);
+	uint32_t offset = pos & (size - 1);
+	size_t first = std::min<size_t>(length, size - offset);
+
+	memcpy(buffer, data + offset, first);
+	memcpy(buffer + first, data, length - first);
+}
+
+} /* namespace */
+
 /**
  * \struct IPCUnixSocket::Payload
  * \brief Container for an IPC payload
@@ -41,6 +99,14 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  * \brief Array of file descriptors to cross IPC boundary
  */
 
+/**
+ * \var IPCUnixSocket::MaxFds
+ * \brief Maximum number of file descriptors sent with a single message
+ *
+ * The limit matches the maximum number of file descriptors the kernel accepts
+ * in a single SCM_RIGHTS control message.
+ */
+
 /**
  * \class IPCUnixSocket
  * \brief IPC mechanism based on Unix sockets
@@ -62,11 +128,28 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  * communication method. The remote side then instantiates a socket, and binds
  * it to the other side by passing the file descriptor to bind(). At that point
  * the channel is operation and communication is bidirectional and symmmetrical.
+ *
+ * By default every message is transported through the socket, which requires
+ * multiple system calls per message. For channels with a high message rate, a
+ * shared memory transport can be enabled on either side with
+ * enableSharedMemory(). Message data is then copied to shared memory rings,
+ * and the remote side is notified through an eventfd. The socket is then only
+ * used to transport file descriptors, and messages whose data doesn't fit in the
+ * ring. The shared memory transport is negotiated over the socket and is
+ * transparent to the users of the IPC, message ordering is preserved.
  */
 
 IPCUnixSocket::IPCUnixSocket()
-	: fd_(-1), headerReceived_(false), notifier_(nullptr)
+	: fd_(-1), headerReceived_(false), notifier_(nullptr), shm_(nullptr),
+	  shmSize_(0), ringSize_(0), txRing_(nullptr), rxRing_(nullptr),
+	  txEvent_(-1), rxEvent_(-1), ringPending_(false),
+	  ringNotifier_(nullptr)
 {
+	MetricsRegistry *registry = MetricsRegistry::instance();
+	messagesSentMetric_ = registry->counter("ipc.messages-sent");
+	messagesReceivedMetric_ = registry->counter("ipc.messages-received");
+	bytesSentMetric_ = registry->counter("ipc.bytes-sent");
+	bytesReceivedMetric_ = registry->counter("ipc.bytes-received");
 }
 
 IPCUnixSocket::~IPCUnixSocket()
@@ -137,6 +220,8 @@ void IPCUnixSocket::close()
 	if (!isBound())
 		return;
 
+	closeRing();
+
 	delete notifier_;
 	notifier_ = nullptr;
 
@@ -155,6 +240,107 @@ bool IPCUnixSocket::isBound() const
 	return fd_ != -1;
 }
 
+/**
+ * \brief Enable the shared memory transport
+ * \param[in] size The minimum size of the shared memory rings in bytes
+ *
+ * This method allocates one shared memory ring for each direction of the IPC
+ * channel, and negotiates their usage with the remote side. Messages sent after
+ * this method returns use the shared memory transport. Messages received from
+ * the remote side switch to the shared memory transport once the remote side
+ * has acknowledged the negotiation.
+ *
+ * The ring size is rounded up to a power of two. Messages that don't fit in the
+ * free space of the ring are transported through the socket.
+ *
+ * The shared memory transport shall be enabled on one side of the IPC channel
+ * only.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTCONN The socket is not connected
+ * \retval -EBUSY The shared memory transport is already enabled
+ */
+int IPCUnixSocket::enableSharedMemory(size_t size)
+{
+	if (!isBound())
+		return -ENOTCONN;
+
+	if (shm_)
+		return -EBUSY;
+
+	uint32_t ringSize = MinRingSize;
+	while (ringSize < size)
+		ringSize <<= 1;
+
+	size_t ringBytes = sizeof(Ring) + ringSize;
+	int ret;
+
+	int memfd = memfd_create("libcamera-ipc", MFD_CLOEXEC);
+	if (memfd < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to create memfd: " << strerror(-ret);
+		return ret;
+	}
+
+	if (ftruncate(memfd, 2 * ringBytes) < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to size memfd: " << strerror(-ret);
+		::close(memfd);
+		return ret;
+	}
+
+	shm_ = mmap(nullptr, 2 * ringBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    memfd, 0);
+	if (shm_ == MAP_FAILED) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to map memfd: " << strerror(-ret);
+		shm_ = nullptr;
+		::close(memfd);
+		return ret;
+	}
+
+	shmSize_ = 2 * ringBytes;
+	ringSize_ = ringSize;
+
+	txEvent_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	rxEvent_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	if (txEvent_ < 0 || rxEvent_ < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to create eventfd: " << strerror(-ret);
+		::close(memfd);
+		closeRing();
+		return ret;
+	}
+
+	/*
+	 * The first ring carries messages from the local side to the remote
+	 * side, the second ring messages in the other direction.
+	 */
+	Ring *tx = new (shm_) Ring();
+	Ring *rx = new (static_cast<uint8_t *>(shm_) + ringBytes) Ring();
+
+	Payload setup;
+	setup.data.resize(sizeof(ringSize));
+	memcpy(setup.data.data(), &ringSize, sizeof(ringSize));
+	setup.fds = { memfd, txEvent_, rxEvent_ };
+
+	ret = sendMessage(MessageRingSetup, setup);
+	::close(memfd);
+	if (ret) {
+		closeRing();
+		return ret;
+	}
+
+	txRing_ = tx;
+	rxRing_ = rx;
+
+	return 0;
+}
+
 /**
  * \brief Send a message payload
  * \param[in] payload Message payload to send
@@ -167,27 +353,55 @@ bool IPCUnixSocket::isBound() const
  */
 int IPCUnixSocket::send(const Payload &payload)
 {
-	int ret;
+	struct iovec iov;
+	iov.iov_base = const_cast<uint8_t *>(payload.data.data());
+	iov.iov_len = payload.data.size();
 
+	return send(&iov, 1, payload.fds.data(), payload.fds.size());
+}
+
+/**
+ * \brief Send a message gathered from multiple buffers
+ * \param[in] iov Array of buffers to gather the message data from
+ * \param[in] iovcnt Number of entries in the \a iov array
+ * \param[in] fds Array of file descriptors to send with the message
+ * \param[in] num Number of entries in the \a fds array
+ *
+ * This method queues a message for transmission to the other end of the IPC
+ * channel, similarly to send(const Payload &). The message data is gathered
+ * from the \a iovcnt buffers described by \a iov, which avoids assembling the
+ * message in a Payload when its data is stored in multiple buffers. The remote
+ * side receives the message as a single Payload.
+ *
+ * At most MaxFds file descriptors can be sent with a single message.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCUnixSocket::send(const struct iovec *iov, unsigned int iovcnt,
+			const int32_t *fds, unsigned int num)
+{
 	if (!isBound())
 		return -ENOTCONN;
 
-	Header hdr;
-	hdr.data = payload.data.size();
-	hdr.fds = payload.fds.size();
+	size_t length = 0;
+	for (unsigned int i = 0; i < iovcnt; ++i)
+		length += iov[i].iov_len;
 
-	if (!hdr.data && !hdr.fds)
+	if ((!length && !num) || num > MaxFds)
 		return -EINVAL;
 
-	ret = ::send(fd_, &hdr, sizeof(hdr), 0);
-	if (ret < 0) {
-		ret = -errno;
-		LOG(IPCUnixSocket, Error)
-			<< "Failed to send: " << strerror(-ret);
-		return ret;
+	int ret;
+	if (txRing_)
+		ret = sendRing(iov, iovcnt, length, fds, num);
+	else
+		ret = sendMessage(MessagePayload, iov, iovcnt, length, fds, num);
+
+	if (!ret) {
+		messagesSentMetric_->add();
+		bytesSentMetric_->add(length);
 	}
 
-	return sendData(payload.data.data(), hdr.data, payload.fds.data(), hdr.fds);
+	return ret;
 }
 
 /**
@@ -199,8 +413,10 @@ int IPCUnixSocket::send(const Payload &payload)
  * immediately with -EAGAIN. The \ref readyRead signal shall be used to receive
  * notification of message availability.
  *
- * \todo Add state machine to make sure we don't block forever and that
- * a header is always followed by a payload.
+ * The data and fds vectors of the \a payload are resized to the size of the
+ * message, reusing their current capacity. Callers that receive messages at a
+ * high rate should reuse the same \a payload for all messages to avoid memory
+ * allocations.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EAGAIN No message payload is available
@@ -209,24 +425,37 @@ int IPCUnixSocket::send(const Payload &payload)
  */
 int IPCUnixSocket::receive(Payload *payload)
 {
+	int ret;
+
 	if (!isBound())
 		return -ENOTCONN;
 
-	if (!headerReceived_)
-		return -EAGAIN;
+	if (ringNotifier_) {
+		if (!ringPending_)
+			return -EAGAIN;
 
-	payload->data.resize(header_.data);
-	payload->fds.resize(header_.fds);
+		ret = receiveRing(payload);
 
-	int ret = recvData(payload->data.data(), header_.data,
-			   payload->fds.data(), header_.fds);
-	if (ret < 0)
-		return ret;
+		ringPending_ = false;
+		ringNotifier_->setEnabled(true);
+	} else {
+		if (!headerReceived_)
+			return -EAGAIN;
 
-	headerReceived_ = false;
-	notifier_->setEnabled(true);
+		ret = recvMessage(header_, payload);
+		if (ret < 0)
+			return ret;
 
-	return 0;
+		headerReceived_ = false;
+		notifier_->setEnabled(true);
+	}
+
+	if (!ret) {
+		messagesReceivedMetric_->add();
+		bytesReceivedMetric_->add(payload->data.size());
+	}
+
+	return ret;
 }
 
 /**
@@ -234,30 +463,56 @@ int IPCUnixSocket::receive(Payload *payload)
  * \brief A Signal emitted when a message is ready to be read
  */
 
-int IPCUnixSocket::sendData(const void *buffer, size_t length,
-			    const int32_t *fds, unsigned int num)
+/*
+ * Send a message through the socket. The header, data and file descriptors are
+ * sent in a single datagram.
+ */
+int IPCUnixSocket::sendMessage(MessageType type, const Payload &payload)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = const_cast<void *>(buffer);
-	iov[0].iov_len = length;
+	struct iovec iov;
+	iov.iov_base = const_cast<uint8_t *>(payload.data.data());
+	iov.iov_len = payload.data.size();
 
-	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
-	memset(buf, 0, sizeof(buf));
+	return sendMessage(type, &iov, 1, iov.iov_len, payload.fds.data(),
+			   payload.fds.size());
+}
 
-	struct cmsghdr *cmsg = (struct cmsghdr *)buf;
-	cmsg->cmsg_len = CMSG_LEN(num * sizeof(uint32_t));
-	cmsg->cmsg_level = SOL_SOCKET;
-	cmsg->cmsg_type = SCM_RIGHTS;
+int IPCUnixSocket::sendMessage(MessageType type, const struct iovec *iov,
+			       unsigned int iovcnt, size_t length,
+			       const int32_t *fds, unsigned int num)
+{
+	Header hdr;
+	hdr.data = length;
+	hdr.fds = num;
+	hdr.type = type;
+
+	struct iovec msgIov[iovcnt + 1];
+	msgIov[0].iov_base = &hdr;
+	msgIov[0].iov_len = sizeof(hdr);
+	std::copy(iov, iov + iovcnt, &msgIov[1]);
+
+	char buf[CMSG_SPACE(hdr.fds * sizeof(uint32_t))];
+	memset(buf, 0, sizeof(buf));
 
 	struct msghdr msg;
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = cmsg;
-	msg.msg_controllen = cmsg->cmsg_len;
+	msg.msg_iov = msgIov;
+	msg.msg_iovlen = iovcnt + 1;
+	msg.msg_control = nullptr;
+	msg.msg_controllen = 0;
 	msg.msg_flags = 0;
-	memcpy(CMSG_DATA(cmsg), fds, num * sizeof(uint32_t));
+
+	if (hdr.fds) {
+		struct cmsghdr *cmsg = (struct cmsghdr *)buf;
+		cmsg->cmsg_len = CMSG_LEN(hdr.fds * sizeof(uint32_t));
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		memcpy(CMSG_DATA(cmsg), fds, hdr.fds * sizeof(uint32_t));
+
+		msg.msg_control = cmsg;
+		msg.msg_controllen = cmsg->cmsg_len;
+	}
 
 	if (sendmsg(fd_, &msg, 0) < 0) {
 		int ret = -errno;
@@ -269,18 +524,52 @@ int IPCUnixSocket::sendData(const void *buffer, size_t length,
 	return 0;
 }
 
-int IPCUnixSocket::recvData(void *buffer, size_t length,
-			    int32_t *fds, unsigned int num)
+/*
+ * Retrieve the header of the next message from the socket, without removing
+ * the message from the socket. Peeking doesn't receive the file descriptors.
+ */
+int IPCUnixSocket::peekHeader(Header *header)
 {
-	struct iovec iov[1];
-	iov[0].iov_base = buffer;
-	iov[0].iov_len = length;
+	int ret = ::recv(fd_, header, sizeof(*header), MSG_PEEK);
+	if (ret < 0) {
+		ret = -errno;
+		if (ret != -EAGAIN)
+			LOG(IPCUnixSocket, Error)
+				<< "Failed to receive header: " << strerror(-ret);
+		return ret;
+	}
 
-	char buf[CMSG_SPACE(num * sizeof(uint32_t))];
+	if (static_cast<size_t>(ret) < sizeof(*header)) {
+		LOG(IPCUnixSocket, Error) << "Truncated message header";
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+/*
+ * Receive the message described by \a header, as retrieved by peekHeader(),
+ * from the socket into \a payload. The whole message is received with a single
+ * system call.
+ */
+int IPCUnixSocket::recvMessage(const Header &header, Payload *payload)
+{
+	Header hdr;
+
+	payload->data.resize(header.data);
+	payload->fds.resize(header.fds);
+
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = payload->data.data();
+	iov[1].iov_len = header.data;
+
+	char buf[CMSG_SPACE(header.fds * sizeof(uint32_t))];
 	memset(buf, 0, sizeof(buf));
 
 	struct cmsghdr *cmsg = (struct cmsghdr *)buf;
-	cmsg->cmsg_len = CMSG_LEN(num * sizeof(uint32_t));
+	cmsg->cmsg_len = CMSG_LEN(header.fds * sizeof(uint32_t));
 	cmsg->cmsg_level = SOL_SOCKET;
 	cmsg->cmsg_type = SCM_RIGHTS;
 
@@ -288,12 +577,13 @@ int IPCUnixSocket::recvData(void *buffer, size_t length,
 	msg.msg_name = nullptr;
 	msg.msg_namelen = 0;
 	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
+	msg.msg_iovlen = 2;
 	msg.msg_control = cmsg;
-	msg.msg_controllen = cmsg->cmsg_len;
+	msg.msg_controllen = header.fds ? cmsg->cmsg_len : 0;
 	msg.msg_flags = 0;
 
-	if (recvmsg(fd_, &msg, 0) < 0) {
+	ssize_t size = recvmsg(fd_, &msg, 0);
+	if (size < 0) {
 		int ret = -errno;
 		if (ret != -EAGAIN)
 			LOG(IPCUnixSocket, Error)
@@ -301,43 +591,283 @@ int IPCUnixSocket::recvData(void *buffer, size_t length,
 		return ret;
 	}
 
-	memcpy(fds, CMSG_DATA(cmsg), num * sizeof(uint32_t));
+	if (static_cast<size_t>(size) != sizeof(hdr) + header.data ||
+	    msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		LOG(IPCUnixSocket, Error) << "Truncated message";
+		return -EPROTO;
+	}
+
+	if (header.fds)
+		memcpy(payload->fds.data(), CMSG_DATA(cmsg),
+		       header.fds * sizeof(uint32_t));
 
 	return 0;
 }
 
-void IPCUnixSocket::dataNotifier(EventNotifier *notifier)
+int IPCUnixSocket::sendRing(const struct iovec *iov, unsigned int iovcnt,
+			    size_t length, const int32_t *fds, unsigned int num)
 {
+	uint32_t head = txRing_->head.load(std::memory_order_relaxed);
+	uint32_t tail = txRing_->tail.load(std::memory_order_acquire);
+	uint32_t used = head - tail;
 	int ret;
 
-	if (!headerReceived_) {
-		/* Receive the header. */
-		ret = ::recv(fd_, &header_, sizeof(header_), 0);
-		if (ret < 0) {
-			ret = -errno;
+	if (used > ringSize_) {
+		LOG(IPCUnixSocket, Error) << "Corrupted transmit ring";
+		return -EPROTO;
+	}
+
+	uint32_t space = ringSize_ - used;
+	RingRecord record = {};
+
+	/*
+	 * File descriptors can only be transported through the socket. Send
+	 * the message through the socket when it contains file descriptors or
+	 * doesn't fit in the ring, and store a record in the ring to preserve
+	 * the message ordering.
+	 */
+	if (num || sizeof(record) + length > space) {
+		if (sizeof(record) > space) {
+			LOG(IPCUnixSocket, Error) << "Transmit ring full";
+			return -ENOBUFS;
+		}
+
+		ret = sendMessage(MessageRingPayload, iov, iovcnt, length,
+				  fds, num);
+		if (ret)
+			return ret;
+
+		record.flags = RecordSocket;
+	} else {
+		record.length = length;
+	}
+
+	ringWrite(txRing_->data(), ringSize_, head, &record, sizeof(record));
+
+	if (record.length) {
+		uint32_t pos = head + sizeof(record);
+
+		for (unsigned int i = 0; i < iovcnt; ++i) {
+			ringWrite(txRing_->data(), ringSize_, pos,
+				  iov[i].iov_base, iov[i].iov_len);
+			pos += iov[i].iov_len;
+		}
+	}
+
+	txRing_->head.store(head + sizeof(record) + record.length,
+			    std::memory_order_release);
+
+	uint64_t value = 1;
+	if (::write(txEvent_, &value, sizeof(value)) < 0) {
+		ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to notify remote side: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int IPCUnixSocket::receiveRing(Payload *payload)
+{
+	uint32_t tail = rxRing_->tail.load(std::memory_order_relaxed);
+	uint32_t head = rxRing_->head.load(std::memory_order_acquire);
+	uint32_t available = head - tail;
+	RingRecord record;
+	int ret = 0;
+
+	if (available > ringSize_ || available < sizeof(record)) {
+		LOG(IPCUnixSocket, Error) << "Corrupted receive ring";
+		return -EPROTO;
+	}
+
+	ringRead(rxRing_->data(), ringSize_, tail, &record, sizeof(record));
+	if (record.length > available - sizeof(record)) {
+		LOG(IPCUnixSocket, Error) << "Corrupted receive ring";
+		return -EPROTO;
+	}
+
+	if (record.flags & RecordSocket) {
+		Header header;
+
+		ret = peekHeader(&header);
+		if (!ret && header.type != MessageRingPayload) {
 			LOG(IPCUnixSocket, Error)
-				<< "Failed to receive header: " << strerror(-ret);
-			return;
+				<< "Unexpected message type "
+				<< static_cast<unsigned int>(header.type);
+			ret = -EPROTO;
 		}
 
-		headerReceived_ = true;
+		if (!ret)
+			ret = recvMessage(header, payload);
+	} else {
+		payload->data.resize(record.length);
+		payload->fds.clear();
+
+		ringRead(rxRing_->data(), ringSize_, tail + sizeof(record),
+			 payload->data.data(), record.length);
+	}
+
+	rxRing_->tail.store(tail + sizeof(record) + record.length,
+			    std::memory_order_release);
+
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Set up the shared memory transport requested by the remote side with
+ * enableSharedMemory(), and acknowledge it.
+ */
+int IPCUnixSocket::setupRing(const Payload &setup)
+{
+	uint32_t ringSize;
+	int ret;
+
+	if (setup.data.size() != sizeof(ringSize) || setup.fds.size() != 3) {
+		ret = -EPROTO;
+		goto error;
+	}
+
+	memcpy(&ringSize, setup.data.data(), sizeof(ringSize));
+	if (ringSize < MinRingSize || ringSize & (ringSize - 1) || shm_) {
+		ret = -EPROTO;
+		goto error;
+	}
+
+	struct stat st;
+	if (fstat(setup.fds[0], &st) < 0 ||
+	    static_cast<size_t>(st.st_size) < 2 * (sizeof(Ring) + ringSize)) {
+		ret = -EPROTO;
+		goto error;
+	}
+
+	shmSize_ = 2 * (sizeof(Ring) + ringSize);
+	shm_ = mmap(nullptr, shmSize_, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    setup.fds[0], 0);
+	if (shm_ == MAP_FAILED) {
+		ret = -errno;
+		shm_ = nullptr;
+		goto error;
 	}
 
+	::close(setup.fds[0]);
+
+	ringSize_ = ringSize;
+	rxRing_ = static_cast<Ring *>(shm_);
+	txRing_ = reinterpret_cast<Ring *>(static_cast<uint8_t *>(shm_) +
+					   sizeof(Ring) + ringSize);
+	rxEvent_ = setup.fds[1];
+	txEvent_ = setup.fds[2];
+
 	/*
-	 * If the payload has arrived, disable the notifier and emit the
-	 * readyRead signal. The notifier will be reenabled by the receive()
-	 * method.
+	 * Acknowledge the setup before sending any message through the ring,
+	 * to let the remote side process all messages previously sent through
+	 * the socket first.
 	 */
-	struct pollfd fds = { fd_, POLLIN, 0 };
-	ret = poll(&fds, 1, 0);
-	if (ret < 0)
+	ret = sendMessage(MessageRingAck, Payload());
+	if (ret) {
+		closeRing();
+		return ret;
+	}
+
+	startRing();
+
+	LOG(IPCUnixSocket, Debug)
+		<< "Shared memory transport enabled with " << ringSize
+		<< " bytes rings";
+
+	return 0;
+
+error:
+	LOG(IPCUnixSocket, Error) << "Invalid shared memory transport setup";
+
+	for (int32_t fd : setup.fds)
+		::close(fd);
+
+	return ret;
+}
+
+/* Start receiving messages through the shared memory ring. */
+void IPCUnixSocket::startRing()
+{
+	notifier_->setEnabled(false);
+
+	ringNotifier_ = new EventNotifier(rxEvent_, EventNotifier::Read);
+	ringNotifier_->activated.connect(this, &IPCUnixSocket::ringNotifier);
+}
+
+void IPCUnixSocket::closeRing()
+{
+	delete ringNotifier_;
+	ringNotifier_ = nullptr;
+
+	if (txEvent_ != -1)
+		::close(txEvent_);
+	if (rxEvent_ != -1)
+		::close(rxEvent_);
+
+	if (shm_)
+		munmap(shm_, shmSize_);
+
+	shm_ = nullptr;
+	shmSize_ = 0;
+	ringSize_ = 0;
+	txRing_ = nullptr;
+	rxRing_ = nullptr;
+	txEvent_ = -1;
+	rxEvent_ = -1;
+	ringPending_ = false;
+}
+
+void IPCUnixSocket::dataNotifier(EventNotifier *notifier)
+{
+	if (peekHeader(&header_) < 0)
 		return;
 
-	if (!(fds.revents & POLLIN))
+	switch (header_.type) {
+	case MessageRingSetup:
+	case MessageRingAck: {
+		Payload payload;
+
+		if (recvMessage(header_, &payload) < 0)
+			return;
+
+		if (header_.type == MessageRingSetup)
+			setupRing(payload);
+		else if (rxRing_ && !ringNotifier_)
+			startRing();
+
 		return;
+	}
+
+	default:
+		break;
+	}
 
+	/*
+	 * Disable the notifier and emit the readyRead signal. The notifier
+	 * will be reenabled by the receive() method.
+	 */
+	headerReceived_ = true;
 	notifier_->setEnabled(false);
 	readyRead.emit(this);
 }
 
+void IPCUnixSocket::ringNotifier(EventNotifier *notifier)
+{
+	uint64_t value;
+
+	if (::read(rxEvent_, &value, sizeof(value)) != sizeof(value))
+		return;
+
+	/*
+	 * Disable the notifier and emit the readyRead signal. Every message
+	 * increments the eventfd semaphore, the notifier will be reenabled by
+	 * the receive() method to process the next message.
+	 */
+	ringNotifier_->setEnabled(false);
+	ringPending_ = true;
+	readyRead.emit(this);
+}
+
 } /* namespace libcamera */
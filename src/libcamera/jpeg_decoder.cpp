@@ -0,0 +1,282 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * jpeg_decoder.cpp - MJPEG frame decoder
+ */
+
+#include "jpeg_decoder.h"
+
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+#endif
+
+#include "formats.h"
+#include "log.h"
+
+/**
+ * \file jpeg_decoder.h
+ * \brief MJPEG frame decoder
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(JPEG)
+
+#ifdef HAVE_LIBJPEG
+
+namespace {
+
+/*
+ * Report libjpeg errors by returning to the decode() call site instead of
+ * terminating the process, as the default libjpeg error handler does.
+ */
+struct JpegErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf env;
+};
+
+void jpegErrorExit(j_common_ptr cinfo)
+{
+	JpegErrorManager *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+	char message[JMSG_LENGTH_MAX];
+
+	cinfo->err->format_message(cinfo, message);
+	LOG(JPEG, Debug) << "Decoding failed: " << message;
+
+	longjmp(err->env, 1);
+}
+
+void jpegOutputMessage(j_common_ptr cinfo)
+{
+}
+
+} /* namespace */
+
+#endif /* HAVE_LIBJPEG */
+
+/**
+ * \class JpegDecoder
+ * \brief Decode MJPEG frames to YUV formats
+ *
+ * Many UVC devices only reach their maximum resolution and frame rate when
+ * capturing MJPEG, due to the bandwidth limitations of the USB bus. The
+ * JpegDecoder class decodes those frames to uncompressed YUV formats that can
+ * be consumed by applications, using the SIMD-accelerated libjpeg-turbo
+ * library.
+ *
+ * The decoder is configured with the frame size and output pixel format with
+ * configure(), and then decodes frames with decode(). The decode() method
+ * doesn't modify the decoder, and can thus be called concurrently from
+ * multiple threads to decode several frames in parallel.
+ *
+ * Decoding is only available when libcamera is compiled with libjpeg support,
+ * as reported by isSupported().
+ */
+
+/**
+ * \brief Construct an unconfigured decoder
+ */
+JpegDecoder::JpegDecoder()
+	: pixelFormat_(0)
+{
+}
+
+/**
+ * \brief Check if MJPEG decoding is supported
+ * \return True if libcamera has been compiled with libjpeg support, false
+ * otherwise
+ */
+bool JpegDecoder::isSupported()
+{
+#ifdef HAVE_LIBJPEG
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * \brief Retrieve the output pixel formats supported by the decoder
+ * \return The list of supported V4L2 output pixel formats
+ */
+const std::vector<unsigned int> &JpegDecoder::formats()
+{
+	static const std::vector<unsigned int> formats = {
+		V4L2_PIX_FMT_NV12,
+		V4L2_PIX_FMT_YUYV,
+	};
+
+	return formats;
+}
+
+/**
+ * \brief Configure the decoder
+ * \param[in] size The frame size
+ * \param[in] pixelFormat The V4L2 output pixel format
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP MJPEG decoding is not supported
+ * \retval -EINVAL The \a size or \a pixelFormat is not supported
+ */
+int JpegDecoder::configure(const Size &size, unsigned int pixelFormat)
+{
+	if (!isSupported())
+		return -ENOTSUP;
+
+	if (size.width % 2 || size.height % 2 || !size.width || !size.height) {
+		LOG(JPEG, Error) << "Unsupported frame size " << size.toString();
+		return -EINVAL;
+	}
+
+	if (pixelFormat != V4L2_PIX_FMT_NV12 &&
+	    pixelFormat != V4L2_PIX_FMT_YUYV) {
+		LOG(JPEG, Error) << "Unsupported output format " << pixelFormat;
+		return -EINVAL;
+	}
+
+	size_ = size;
+	pixelFormat_ = pixelFormat;
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the size of a decoded frame
+ * \return The size in bytes of a frame in the configured output format
+ */
+size_t JpegDecoder::frameSize() const
+{
+	return PixelFormatInfo::info(pixelFormat_).frameSize(size_);
+}
+
+/**
+ * \brief Retrieve the line stride of a decoded frame
+ *
+ * Decoded frames are stored without padding between lines.
+ *
+ * \return The stride in bytes of the first plane of a frame in the configured
+ * output format
+ */
+unsigned int JpegDecoder::stride() const
+{
+	return PixelFormatInfo::info(pixelFormat_).stride(size_.width);
+}
+
+/**
+ * \brief Decode an MJPEG frame
+ * \param[in] src The MJPEG frame
+ * \param[in] srcSize The size of the MJPEG frame in bytes
+ * \param[out] dst The memory to store the decoded frame
+ * \param[in] dstSize The size of the \a dst memory in bytes
+ *
+ * The decoded frame is stored in \a dst in the pixel format the decoder has
+ * been configured with. The frame shall have the configured size.
+ *
+ * \return The size of the decoded frame in bytes on success, or a negative
+ * error code otherwise
+ */
+int JpegDecoder::decode(const uint8_t *src, size_t srcSize, uint8_t *dst,
+			size_t dstSize) const
+{
+#ifdef HAVE_LIBJPEG
+	if (!pixelFormat_ || dstSize < frameSize())
+		return -EINVAL;
+
+	const unsigned int width = size_.width;
+	uint8_t *chroma = dst + width * size_.height;
+
+	/*
+	 * Allocate memory before setjmp(), as destructors are skipped when
+	 * libjpeg reports an error.
+	 */
+	std::vector<uint8_t> row(width * 3);
+	JSAMPROW rowPointer = row.data();
+
+	struct jpeg_decompress_struct cinfo;
+	JpegErrorManager err;
+
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = jpegErrorExit;
+	err.pub.output_message = jpegOutputMessage;
+
+	jpeg_create_decompress(&cinfo);
+
+	if (setjmp(err.env)) {
+		jpeg_destroy_decompress(&cinfo);
+		return -EINVAL;
+	}
+
+	jpeg_mem_src(&cinfo, const_cast<uint8_t *>(src), srcSize);
+	jpeg_read_header(&cinfo, TRUE);
+
+	if (cinfo.image_width != size_.width ||
+	    cinfo.image_height != size_.height) {
+		LOG(JPEG, Debug)
+			<< "Unexpected frame size " << cinfo.image_width << "x"
+			<< cinfo.image_height;
+		jpeg_destroy_decompress(&cinfo);
+		return -EINVAL;
+	}
+
+	/*
+	 * Decode to interleaved YCbCr and subsample the chroma components when
+	 * packing to the output format. Simple upsampling is good enough as
+	 * the chroma is subsampled again, and is much cheaper.
+	 */
+	cinfo.out_color_space = JCS_YCbCr;
+	cinfo.do_fancy_upsampling = FALSE;
+
+	jpeg_start_decompress(&cinfo);
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		unsigned int y = cinfo.output_scanline;
+		const uint8_t *in = row.data();
+
+		jpeg_read_scanlines(&cinfo, &rowPointer, 1);
+
+		if (pixelFormat_ == V4L2_PIX_FMT_YUYV) {
+			uint8_t *out = dst + y * width * 2;
+
+			for (unsigned int x = 0; x < width; x += 2) {
+				out[0] = in[0];
+				out[1] = in[1];
+				out[2] = in[3];
+				out[3] = in[2];
+				in += 6;
+				out += 4;
+			}
+
+			continue;
+		}
+
+		uint8_t *luma = dst + y * width;
+		for (unsigned int x = 0; x < width; ++x)
+			luma[x] = in[x * 3];
+
+		if (y % 2)
+			continue;
+
+		uint8_t *uv = chroma + y / 2 * width;
+		for (unsigned int x = 0; x < width; x += 2) {
+			uv[x] = in[x * 3 + 1];
+			uv[x + 1] = in[x * 3 + 2];
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+
+	return frameSize();
+#else
+	return -ENOTSUP;
+#endif
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,540 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * jpeg_encoder.cpp - JPEG still image encoder
+ */
+
+#include "jpeg_encoder.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <map>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+#endif
+
+#include "log.h"
+
+/**
+ * \file jpeg_encoder.h
+ * \brief JPEG still image encoder
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(JPEG)
+
+namespace {
+
+/* Room for the JPEG headers and tables in encoded frames. */
+constexpr size_t JpegHeaderSize = 4096;
+
+constexpr unsigned int JpegQuality = 95;
+
+#ifdef HAVE_LIBJPEG
+
+/*
+ * Report libjpeg errors by returning to the encode() call site instead of
+ * terminating the process, as the default libjpeg error handler does.
+ */
+struct JpegErrorManager {
+	struct jpeg_error_mgr pub;
+	jmp_buf env;
+};
+
+void jpegErrorExit(j_common_ptr cinfo)
+{
+	JpegErrorManager *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+	char message[JMSG_LENGTH_MAX];
+
+	cinfo->err->format_message(cinfo, message);
+	LOG(JPEG, Debug) << "Encoding failed: " << message;
+
+	longjmp(err->env, 1);
+}
+
+void jpegOutputMessage(j_common_ptr cinfo)
+{
+}
+
+/*
+ * Encode directly to the destination buffer. The buffer can't grow, running
+ * out of space is reported as an error.
+ */
+void jpegInitDestination(j_compress_ptr cinfo)
+{
+}
+
+boolean jpegEmptyOutputBuffer(j_compress_ptr cinfo)
+{
+	ERREXIT(cinfo, JERR_BUFFER_SIZE);
+	return FALSE;
+}
+
+void jpegTermDestination(j_compress_ptr cinfo)
+{
+}
+
+/*
+ * The frame to encode, the memory to store the JPEG image, and the raw data
+ * buffers to pass the frame to libjpeg through.
+ */
+struct JpegFrame {
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t dstSize;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned int quality;
+	bool yuyv;
+
+	unsigned int lumaWidth;
+	unsigned int chromaWidth;
+	unsigned int mcuLines;
+	JSAMPARRAY planes[3];
+};
+
+void jpegWriteFrame(struct jpeg_compress_struct *cinfo, const JpegFrame &frame)
+{
+	const uint8_t *src = frame.src;
+	const unsigned int width = frame.width;
+	const unsigned int height = frame.height;
+	const unsigned int stride = frame.stride;
+	const bool yuyv = frame.yuyv;
+	const unsigned int lumaWidth = frame.lumaWidth;
+	const unsigned int chromaWidth = frame.chromaWidth;
+	const unsigned int mcuLines = frame.mcuLines;
+	JSAMPARRAY planes[3] = { frame.planes[0], frame.planes[1], frame.planes[2] };
+
+	cinfo->image_width = width;
+	cinfo->image_height = height;
+	cinfo->input_components = 3;
+	cinfo->in_color_space = JCS_YCbCr;
+
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, frame.quality, TRUE);
+
+	cinfo->raw_data_in = TRUE;
+	cinfo->comp_info[0].h_samp_factor = 2;
+	cinfo->comp_info[0].v_samp_factor = yuyv ? 1 : 2;
+	cinfo->comp_info[1].h_samp_factor = 1;
+	cinfo->comp_info[1].v_samp_factor = 1;
+	cinfo->comp_info[2].h_samp_factor = 1;
+	cinfo->comp_info[2].v_samp_factor = 1;
+
+	jpeg_start_compress(cinfo, TRUE);
+
+	const uint8_t *chroma = src + stride * height;
+
+	for (unsigned int y = 0; y < height; y += mcuLines) {
+		for (unsigned int i = 0; i < mcuLines; ++i) {
+			const unsigned int line = std::min(y + i, height - 1);
+			uint8_t *outY = planes[0][i];
+
+			if (yuyv) {
+				const uint8_t *in = src + line * stride;
+				uint8_t *outCb = planes[1][i];
+				uint8_t *outCr = planes[2][i];
+
+				for (unsigned int x = 0; x < width / 2; ++x) {
+					outY[x * 2] = in[0];
+					outCb[x] = in[1];
+					outY[x * 2 + 1] = in[2];
+					outCr[x] = in[3];
+					in += 4;
+				}
+
+				memset(outCb + width / 2, outCb[width / 2 - 1],
+				       chromaWidth - width / 2);
+				memset(outCr + width / 2, outCr[width / 2 - 1],
+				       chromaWidth - width / 2);
+			} else {
+				memcpy(outY, src + line * stride, width);
+
+				if (i % 2 == 0) {
+					const uint8_t *in = chroma + line / 2 * stride;
+					uint8_t *outCb = planes[1][i / 2];
+					uint8_t *outCr = planes[2][i / 2];
+
+					for (unsigned int x = 0; x < width / 2; ++x) {
+						outCb[x] = in[x * 2];
+						outCr[x] = in[x * 2 + 1];
+					}
+
+					memset(outCb + width / 2, outCb[width / 2 - 1],
+					       chromaWidth - width / 2);
+					memset(outCr + width / 2, outCr[width / 2 - 1],
+					       chromaWidth - width / 2);
+				}
+			}
+
+			memset(outY + width, outY[width - 1], lumaWidth - width);
+		}
+
+		jpeg_write_raw_data(cinfo, planes, mcuLines);
+	}
+
+	jpeg_finish_compress(cinfo);
+}
+
+/*
+ * Variables held in registers across setjmp() may be clobbered when libjpeg
+ * reports an error. Keep the setjmp() call in this function, which accesses the
+ * frame through memory only, instead of in JpegEncoder::encode().
+ */
+int jpegCompress(const JpegFrame &frame)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_destination_mgr dest;
+	JpegErrorManager err;
+
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = jpegErrorExit;
+	err.pub.output_message = jpegOutputMessage;
+
+	dest.next_output_byte = frame.dst;
+	dest.free_in_buffer = frame.dstSize;
+	dest.init_destination = jpegInitDestination;
+	dest.empty_output_buffer = jpegEmptyOutputBuffer;
+	dest.term_destination = jpegTermDestination;
+
+	jpeg_create_compress(&cinfo);
+	cinfo.dest = &dest;
+
+	if (setjmp(err.env)) {
+		int ret = err.pub.msg_code == JERR_BUFFER_SIZE ? -ENOSPC : -EINVAL;
+		jpeg_destroy_compress(&cinfo);
+		return ret;
+	}
+
+	jpegWriteFrame(&cinfo, frame);
+	jpeg_destroy_compress(&cinfo);
+
+	return frame.dstSize - dest.free_in_buffer;
+}
+
+#endif /* HAVE_LIBJPEG */
+
+} /* namespace */
+
+/**
+ * \class JpegEncoder
+ * \brief Encode YUV frames to JPEG
+ *
+ * Applications capturing still images usually store them in JPEG format. The
+ * JpegEncoder class encodes uncompressed YUV frames to baseline JPEG images,
+ * using the SIMD-accelerated libjpeg-turbo library, to let pipeline handlers
+ * deliver compressed still images directly.
+ *
+ * The frames are passed to libjpeg as raw YCbCr data, which skips the colour
+ * conversion and lets the chroma subsampling of the frames be used as is:
+ * NV12 frames are encoded to 4:2:0 JPEG images, and YUYV frames to 4:2:2 JPEG
+ * images.
+ *
+ * The encoder is configured with the frame format and size and the JPEG
+ * quality with configure(), and then encodes frames with encode(). The encode()
+ * method doesn't modify the encoder, and can thus be called concurrently from
+ * multiple threads to encode several frames in parallel.
+ *
+ * Encoding is only available when libcamera is compiled with libjpeg support,
+ * as reported by isSupported().
+ */
+
+/**
+ * \brief Construct an unconfigured encoder
+ */
+JpegEncoder::JpegEncoder()
+	: pixelFormat_(0), stride_(0), quality_(0)
+{
+}
+
+/**
+ * \brief Check if JPEG encoding is supported
+ * \return True if libcamera has been compiled with libjpeg support, false
+ * otherwise
+ */
+bool JpegEncoder::isSupported()
+{
+#ifdef HAVE_LIBJPEG
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * \brief Retrieve the input pixel formats supported by the encoder
+ * \return The list of supported V4L2 input pixel formats
+ */
+const std::vector<unsigned int> &JpegEncoder::formats()
+{
+	static const std::vector<unsigned int> formats = {
+		V4L2_PIX_FMT_NV12,
+		V4L2_PIX_FMT_YUYV,
+	};
+
+	return formats;
+}
+
+/**
+ * \brief Configure the encoder
+ * \param[in] pixelFormat The V4L2 pixel format of the input frames
+ * \param[in] size The frame size
+ * \param[in] stride The line stride of the input frames in bytes
+ * \param[in] quality The JPEG quality, from 1 to 100
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP JPEG encoding is not supported
+ * \retval -EINVAL The \a pixelFormat, \a size or \a quality is not supported
+ */
+int JpegEncoder::configure(unsigned int pixelFormat, const Size &size,
+			   unsigned int stride, unsigned int quality)
+{
+	if (!isSupported())
+		return -ENOTSUP;
+
+	if (size.width % 2 || size.height % 2 || !size.width || !size.height) {
+		LOG(JPEG, Error) << "Unsupported frame size " << size.toString();
+		return -EINVAL;
+	}
+
+	if (pixelFormat != V4L2_PIX_FMT_NV12 &&
+	    pixelFormat != V4L2_PIX_FMT_YUYV) {
+		LOG(JPEG, Error) << "Unsupported input format " << pixelFormat;
+		return -EINVAL;
+	}
+
+	const unsigned int lineSize = pixelFormat == V4L2_PIX_FMT_YUYV
+				    ? size.width * 2 : size.width;
+	if (stride < lineSize || !quality || quality > 100) {
+		LOG(JPEG, Error) << "Invalid stride or quality";
+		return -EINVAL;
+	}
+
+	size_ = size;
+	pixelFormat_ = pixelFormat;
+	stride_ = stride;
+	quality_ = quality;
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the maximum size of an encoded frame
+ *
+ * The size of JPEG images depends on their content. The maximum size is the
+ * size of the uncompressed samples of the image, which is only exceeded at
+ * very high quality for noise-like content. Frames that don't fit in the
+ * maximum size fail to encode.
+ *
+ * \return The maximum size in bytes of an encoded frame
+ */
+size_t JpegEncoder::maxFrameSize() const
+{
+	const size_t pixels = size_.width * size_.height;
+
+	return (pixelFormat_ == V4L2_PIX_FMT_YUYV ? pixels * 2 : pixels * 3 / 2)
+	       + JpegHeaderSize;
+}
+
+/**
+ * \brief Encode a frame to JPEG
+ * \param[in] src The frame to encode
+ * \param[in] srcSize The size of the frame in bytes
+ * \param[out] dst The memory to store the JPEG image
+ * \param[in] dstSize The size of the \a dst memory in bytes
+ *
+ * The frame shall have the pixel format, size and stride the encoder has been
+ * configured with.
+ *
+ * \return The size of the JPEG image in bytes on success, or a negative error
+ * code otherwise
+ * \retval -ENOSPC The JPEG image doesn't fit in \a dstSize bytes
+ */
+int JpegEncoder::encode(const uint8_t *src, size_t srcSize, uint8_t *dst,
+			size_t dstSize) const
+{
+#ifdef HAVE_LIBJPEG
+	const bool yuyv = pixelFormat_ == V4L2_PIX_FMT_YUYV;
+	const unsigned int width = size_.width;
+	const unsigned int height = size_.height;
+
+	if (!pixelFormat_ ||
+	    srcSize < (yuyv ? stride_ * height : stride_ * height * 3 / 2))
+		return -EINVAL;
+
+	/*
+	 * libjpeg reads raw data by rows of whole MCUs, 16 pixels wide, and 16
+	 * lines high for 4:2:0 or 8 lines high for 4:2:2. Deinterleave the
+	 * samples of each MCU row to planar buffers, replicating the last
+	 * column and line to pad the image edges. Allocate memory here, as
+	 * destructors are skipped when libjpeg reports an error.
+	 */
+	const unsigned int lumaWidth = size_.alignedUpTo(16, 1).width;
+	const unsigned int chromaWidth = lumaWidth / 2;
+	const unsigned int mcuLines = yuyv ? 8 : 16;
+
+	std::vector<uint8_t> luma(lumaWidth * mcuLines);
+	std::vector<uint8_t> cb(chromaWidth * 8);
+	std::vector<uint8_t> cr(chromaWidth * 8);
+	std::vector<JSAMPROW> rows(mcuLines + 8 + 8);
+
+	JpegFrame frame;
+	frame.src = src;
+	frame.dst = dst;
+	frame.dstSize = dstSize;
+	frame.width = width;
+	frame.height = height;
+	frame.stride = stride_;
+	frame.quality = quality_;
+	frame.yuyv = yuyv;
+	frame.lumaWidth = lumaWidth;
+	frame.chromaWidth = chromaWidth;
+	frame.mcuLines = mcuLines;
+	frame.planes[0] = &rows[0];
+	frame.planes[1] = &rows[mcuLines];
+	frame.planes[2] = &rows[mcuLines + 8];
+
+	for (unsigned int i = 0; i < mcuLines; ++i)
+		frame.planes[0][i] = &luma[i * lumaWidth];
+	for (unsigned int i = 0; i < 8; ++i) {
+		frame.planes[1][i] = &cb[i * chromaWidth];
+		frame.planes[2][i] = &cr[i * chromaWidth];
+	}
+
+	return jpegCompress(frame);
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * \class JpegEncodeStage
+ * \brief Produce a JPEG stream from captured frames
+ *
+ * Applications capturing still images commonly store them in JPEG format, and
+ * encoding large frames on the application side adds hundreds of milliseconds
+ * to the capture. The JpegEncodeStage class lets pipeline handlers expose a
+ * stream of JPEG images encoded from the captured frames with a JpegEncoder,
+ * in the worker threads of the ProcessingStage, typically for the
+ * StillCapture role.
+ *
+ * The JPEG images have the size of the captured frames. Pipeline handlers
+ * validate the JPEG stream configuration against the configuration of the
+ * captured stream with validate(), configure the stage with configure(), and
+ * link it to the captured and JPEG streams with
+ * PipelineHandler::addProcessingStage(). The buffers of the JPEG stream shall
+ * be frameSize() bytes large, and the size of each JPEG image is reported by
+ * the bytesused of its buffer.
+ */
+
+JpegEncodeStage::JpegEncodeStage()
+	: ProcessingStage("jpeg")
+{
+}
+
+JpegEncodeStage::~JpegEncodeStage()
+{
+	wait();
+}
+
+/**
+ * \brief Generate a default configuration for a JPEG stream
+ * \param[in] input The configuration of the captured stream
+ * \return The JPEG stream configuration, to be validated with validate()
+ */
+StreamConfiguration JpegEncodeStage::generateConfiguration(const StreamConfiguration &input)
+{
+	std::map<unsigned int, std::vector<SizeRange>> sizes;
+	sizes[V4L2_PIX_FMT_JPEG] = { SizeRange(input.size.width,
+					       input.size.height) };
+
+	StreamConfiguration cfg{ StreamFormats(sizes) };
+	cfg.pixelFormat = V4L2_PIX_FMT_JPEG;
+	cfg.size = input.size;
+	cfg.bufferCount = input.bufferCount;
+
+	return cfg;
+}
+
+/**
+ * \brief Validate the configuration of a JPEG stream
+ * \param[in] input The configuration of the captured stream
+ * \param[inout] output The configuration of the JPEG stream
+ *
+ * Adjust the pixel format of the JPEG stream to V4L2_PIX_FMT_JPEG, and its size
+ * to the captured size. Only the pixel format and size of the \a output
+ * configuration are validated, the buffer count is left to the pipeline
+ * handler.
+ *
+ * \return CameraConfiguration::Invalid if the captured stream format can't be
+ * encoded, CameraConfiguration::Adjusted if \a output has been adjusted, or
+ * CameraConfiguration::Valid otherwise
+ */
+CameraConfiguration::Status JpegEncodeStage::validate(const StreamConfiguration &input,
+						      StreamConfiguration *output)
+{
+	CameraConfiguration::Status status = CameraConfiguration::Valid;
+
+	const std::vector<unsigned int> &formats = JpegEncoder::formats();
+	if (!JpegEncoder::isSupported() || input.modifier ||
+	    std::find(formats.begin(), formats.end(), input.pixelFormat) ==
+	    formats.end())
+		return CameraConfiguration::Invalid;
+
+	if (output->pixelFormat != V4L2_PIX_FMT_JPEG || output->modifier) {
+		LOG(JPEG, Debug) << "Adjusting pixel format to JPEG";
+		output->pixelFormat = V4L2_PIX_FMT_JPEG;
+		output->modifier = 0;
+		status = CameraConfiguration::Adjusted;
+	}
+
+	if (output->size != input.size) {
+		LOG(JPEG, Debug)
+			<< "Adjusting size to " << input.size.toString();
+		output->size = input.size;
+		status = CameraConfiguration::Adjusted;
+	}
+
+	return status;
+}
+
+/**
+ * \brief Configure the stage
+ * \param[in] input The configuration of the captured stream
+ * \param[in] output The configuration of the JPEG stream
+ *
+ * The configurations shall have been validated with validate(), and the
+ * stride of the \a input configuration shall be set.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int JpegEncodeStage::configure(const StreamConfiguration &input,
+			       const StreamConfiguration &output)
+{
+	return encoder_.configure(input.pixelFormat, input.size, input.stride,
+				  JpegQuality);
+}
+
+/**
+ * \fn JpegEncodeStage::frameSize()
+ * \brief Retrieve the size of the buffers of the JPEG stream
+ * \return The maximum size in bytes of a frame of the JPEG stream
+ */
+
+int JpegEncodeStage::process(const uint8_t *src, size_t srcSize, uint8_t *dst,
+			     size_t dstSize) const
+{
+	return encoder_.encode(src, srcSize, dst, dstSize);
+}
+
+} /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #include "log.h"
 
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
@@ -14,12 +15,18 @@
 #include <iomanip>
 #include <iostream>
 #include <list>
+#include <map>
+#include <poll.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
+#include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <libcamera/logging.h>
 
+#include "thread.h"
 #include "utils.h"
 
 /**
@@ -34,6 +41,11 @@
  *
  * The levels are configurable through the LIBCAMERA_LOG_LEVELS environment
  * variable that contains a comma-separated list of 'category:level' pairs.
+ * Each pair may be followed by a rate limit, as 'category:level:rate', to
+ * limit the number of messages output by each call site. The rate is either
+ * the maximum number of messages per second, or '1/n' to output one message
+ * out of every n. The number of suppressed messages is logged before the next
+ * message output by the call site.
  *
  * The category names are strings and can include a wildcard ('*') character at
  * the end to match multiple categories.
@@ -48,7 +60,18 @@
  * file by setting the LIBCAMERA_LOG_FILE environment variable to the name of
  * the file. The file must be writable and is truncated if it exists. If any
  * error occurs when opening the file, the file is ignored and the log is output
- * to stderr.
+ * to stderr. Prefixing the file name with "binary:" writes the log in a compact
+ * binary format, see logSetBinaryFile().
+ *
+ * Log messages are written to the output synchronously by default, in the
+ * thread that logs them. Setting the LIBCAMERA_LOG_ASYNC environment variable
+ * to a non-zero value writes them from a background thread instead, see
+ * logSetAsynchronous().
+ *
+ * Messages are timestamped with the monotonic clock. Setting the
+ * LIBCAMERA_LOG_CLOCK environment variable to "coarse" uses the coarse
+ * monotonic clock instead, which is cheaper to read on some platforms at the
+ * expense of a resolution of a few milliseconds.
  */
 
 /**
@@ -78,17 +101,6 @@ static int log_severity_to_syslog(LogSeverity severity)
 	}
 }
 
-static std::string log_timespec_to_string(const struct timespec &timestamp)
-{
-	std::ostringstream ossTimestamp;
-	ossTimestamp.fill('0');
-	ossTimestamp << "[" << timestamp.tv_sec / (60 * 60) << ":"
-		     << std::setw(2) << (timestamp.tv_sec / 60) % 60 << ":"
-		     << std::setw(2) << timestamp.tv_sec % 60 << "."
-		     << std::setw(9) << timestamp.tv_nsec << "]";
-	return ossTimestamp.str();
-}
-
 static const char *log_severity_name(LogSeverity severity)
 {
 	static const char *const names[] = {
@@ -105,6 +117,50 @@ static const char *log_severity_name(LogSeverity severity)
 		return "UNKWN";
 }
 
+/**
+ * \brief A log message captured for output
+ *
+ * The LogRecord structure stores the information of a LogMessage needed to
+ * output it, detached from the LogMessage instance to allow writing it after
+ * the message has been destroyed. The category and file name are stored as
+ * pointers, as categories are never destroyed and file names are string
+ * literals.
+ */
+struct LogRecord {
+	utils::time_point timestamp;
+	LogSeverity severity;
+	const LogCategory *category;
+	const char *fileName;
+	unsigned int line;
+	std::string msg;
+};
+
+/*
+ * The binary log format starts with a header containing a magic value and a
+ * format version, followed by a sequence of entries. Each entry starts with
+ * an 8-bit type. Category and file name entries map a 16-bit identifier to a
+ * string, they are written once, before the first message that references the
+ * identifier. All values are stored in little-endian byte order.
+ *
+ * - Category: type (8), id (16), length (16), name
+ * - File name: type (8), id (16), length (16), name
+ * - Message: type (8), severity (8), category id (16), file id (16),
+ *   line (32), timestamp in ns (64), length (32), text
+ *
+ * The utils/log/log-decode tool converts binary logs to text.
+ */
+static const char log_binary_magic[4] = { 'L', 'C', 'B', 'L' };
+static const uint32_t log_binary_version = 1;
+
+/* Timestamp messages with the coarse clock, see Logger::parseLogClock(). */
+static std::atomic<bool> log_coarse_clock{ false };
+
+enum LogBinaryEntry {
+	LogBinaryCategory = 1,
+	LogBinaryFile = 2,
+	LogBinaryMessage = 3,
+};
+
 /**
  * \brief Log output
  *
@@ -113,30 +169,53 @@ static const char *log_severity_name(LogSeverity severity)
 class LogOutput
 {
 public:
-	LogOutput(const char *path);
+	LogOutput(const char *path, bool binary = false);
 	LogOutput(std::ostream *stream);
 	LogOutput();
 	~LogOutput();
 
 	bool isValid() const;
 	void write(const LogMessage &msg);
+	void write(const LogRecord &record);
 
 private:
-	void writeSyslog(const LogMessage &msg);
-	void writeStream(const LogMessage &msg);
+	void writeSyslog(const LogRecord &record);
+	void writeStream(const LogRecord &record);
+	void writeBinary(const LogRecord &record);
+
+	template<typename T>
+	void append(T value);
+	void append(const char *str, size_t length);
+	uint16_t identifier(std::unordered_map<const void *, uint16_t> &ids,
+			    LogBinaryEntry type, const void *key,
+			    const char *name);
 
 	std::ostream *stream_;
 	LoggingTarget target_;
+
+	Mutex mutex_;
+	std::string buffer_;
+	std::unordered_map<const void *, uint16_t> categoryIds_;
+	std::unordered_map<const void *, uint16_t> fileIds_;
 };
 
 /**
  * \brief Construct a log output based on a file
  * \param[in] path Full path to log file
+ * \param[in] binary True to write log messages in the binary format
  */
-LogOutput::LogOutput(const char *path)
-	: target_(LoggingTargetFile)
+LogOutput::LogOutput(const char *path, bool binary)
+	: target_(binary ? LoggingTargetBinaryFile : LoggingTargetFile)
 {
-	stream_ = new std::ofstream(path);
+	stream_ = new std::ofstream(path, binary ? std::ios::binary : std::ios::out);
+
+	if (binary) {
+		append(log_binary_magic, sizeof(log_binary_magic));
+		append(log_binary_version);
+		stream_->write(buffer_.data(), buffer_.size());
+		stream_->flush();
+		buffer_.clear();
+	}
 }
 
 /**
@@ -163,6 +242,10 @@ LogOutput::~LogOutput()
 	case LoggingTargetFile:
 		delete stream_;
 		break;
+	case LoggingTargetBinaryFile:
+		stream_->write(buffer_.data(), buffer_.size());
+		delete stream_;
+		break;
 	case LoggingTargetSyslog:
 		closelog();
 		break;
@@ -179,6 +262,7 @@ bool LogOutput::isValid() const
 {
 	switch (target_) {
 	case LoggingTargetFile:
+	case LoggingTargetBinaryFile:
 		return stream_->good();
 	case LoggingTargetStream:
 		return stream_ != nullptr;
@@ -192,38 +276,182 @@ bool LogOutput::isValid() const
  * \param[in] msg Message to write
  */
 void LogOutput::write(const LogMessage &msg)
+{
+	write({ msg.timestamp(), msg.severity(), &msg.category(),
+		msg.fileName(), msg.line(), msg.msg() });
+}
+
+/**
+ * \brief Write a message record to log output
+ * \param[in] record The message record
+ */
+void LogOutput::write(const LogRecord &record)
 {
 	switch (target_) {
 	case LoggingTargetSyslog:
-		writeSyslog(msg);
+		writeSyslog(record);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
-		writeStream(msg);
+		writeStream(record);
+		break;
+	case LoggingTargetBinaryFile:
+		writeBinary(record);
 		break;
 	default:
 		break;
 	}
 }
 
-void LogOutput::writeSyslog(const LogMessage &msg)
+void LogOutput::writeSyslog(const LogRecord &record)
 {
-	std::string str = std::string(log_severity_name(msg.severity())) + " " +
-	      		  msg.category().name() + " " + msg.fileInfo() + " " +
-			  msg.msg();
-	syslog(log_severity_to_syslog(msg.severity()), "%s", str.c_str());
+	std::string str = std::string(log_severity_name(record.severity)) + " " +
+			  record.category->name() + " " +
+			  utils::basename(record.fileName) + ":" +
+			  std::to_string(record.line) + " " + record.msg;
+	syslog(log_severity_to_syslog(record.severity), "%s", str.c_str());
 }
 
-void LogOutput::writeStream(const LogMessage &msg)
+void LogOutput::writeStream(const LogRecord &record)
 {
-	std::string str = std::string(log_timespec_to_string(msg.timestamp()) +
-	      		  log_severity_name(msg.severity()) + " " +
-			  msg.category().name() + " " + msg.fileInfo() + " " +
-			  msg.msg());
+	std::string str = "[" + utils::time_point_to_string(record.timestamp) +
+			  "]" + log_severity_name(record.severity) + " " +
+			  record.category->name() + " " +
+			  utils::basename(record.fileName) + ":" +
+			  std::to_string(record.line) + " " + record.msg;
 	stream_->write(str.c_str(), str.size());
 	stream_->flush();
 }
 
+/*
+ * Write a message in the binary format. Messages are buffered and only flushed
+ * to the file for warnings and more severe messages, to avoid a system call for
+ * every debug message while still capturing the messages that precede a
+ * failure.
+ */
+void LogOutput::writeBinary(const LogRecord &record)
+{
+	MutexLocker locker(mutex_);
+
+	uint16_t category = identifier(categoryIds_, LogBinaryCategory,
+				       record.category,
+				       record.category->name());
+	uint16_t file = identifier(fileIds_, LogBinaryFile, record.fileName,
+				   utils::basename(record.fileName));
+
+	/* Drop the line feed appended to all messages. */
+	size_t length = record.msg.size();
+	if (length && record.msg[length - 1] == '\n')
+		length--;
+
+	append<uint8_t>(LogBinaryMessage);
+	append<uint8_t>(record.severity);
+	append(category);
+	append(file);
+	append<uint32_t>(record.line);
+	append<uint64_t>(utils::time_point_to_ns(record.timestamp));
+	append<uint32_t>(length);
+	append(record.msg.data(), length);
+
+	if (record.severity < LogWarning && buffer_.size() < 4096)
+		return;
+
+	stream_->write(buffer_.data(), buffer_.size());
+	stream_->flush();
+	buffer_.clear();
+}
+
+template<typename T>
+void LogOutput::append(T value)
+{
+	for (unsigned int i = 0; i < sizeof(T); ++i) {
+		buffer_.push_back(static_cast<char>(value & 0xff));
+		value >>= 8;
+	}
+}
+
+void LogOutput::append(const char *str, size_t length)
+{
+	buffer_.append(str, length);
+}
+
+/*
+ * Retrieve the identifier of a category or file name in the binary log,
+ * assigning a new identifier and writing the corresponding entry the first
+ * time the \a key is seen.
+ */
+uint16_t LogOutput::identifier(std::unordered_map<const void *, uint16_t> &ids,
+			       LogBinaryEntry type, const void *key,
+			       const char *name)
+{
+	auto iter = ids.find(key);
+	if (iter != ids.end())
+		return iter->second;
+
+	uint16_t id = ids.size();
+	ids[key] = id;
+
+	uint16_t length = strlen(name);
+	append<uint8_t>(type);
+	append(id);
+	append(length);
+	append(name, length);
+
+	return id;
+}
+
+class Logger;
+
+/**
+ * \brief Asynchronous log writer
+ *
+ * The AsyncLogWriter class writes log messages to the log output from a
+ * background thread, to avoid stalling the threads that log on file or syslog
+ * I/O. Messages are captured by the logging threads as LogRecord instances and
+ * stored in a fixed-size lock-free ring, drained by the writer thread. When the ring is
+ * full, messages are dropped and counted, and the number of dropped messages
+ * is logged when the ring has been drained.
+ *
+ * The ring supports multiple producers and a single consumer. Each record
+ * stores a sequence number that tells whether it is free for the producer that
+ * reserved its position with the head index, or ready for the consumer.
+ */
+class AsyncLogWriter : public Thread
+{
+public:
+	AsyncLogWriter(Logger *logger);
+	~AsyncLogWriter();
+
+	bool queue(LogRecord &&record);
+	void flush();
+
+protected:
+	void run() override;
+
+private:
+	static constexpr unsigned int RingSize = 1024;
+
+	struct Record {
+		std::atomic<uint64_t> sequence;
+		LogRecord record;
+	};
+
+	bool pending() const;
+	void drain();
+	void wake();
+
+	Logger *logger_;
+
+	std::unique_ptr<Record[]> ring_;
+	std::atomic<uint64_t> head_;
+	std::atomic<uint64_t> tail_;
+	std::atomic<uint64_t> dropped_;
+
+	std::atomic<bool> sleeping_;
+	std::atomic<bool> stopping_;
+	int eventfd_;
+};
+
 /**
  * \brief Message logger
  *
@@ -236,29 +464,58 @@ public:
 
 	void write(const LogMessage &msg);
 
-	int logSetFile(const char *path);
+	int logSetFile(const char *path, bool binary = false);
 	int logSetStream(std::ostream *stream);
 	int logSetTarget(LoggingTarget target);
 	void logSetLevel(const char *category, const char *level);
+	void logSetAsynchronous(bool enable);
 
 private:
 	Logger();
+	~Logger();
+
+	friend AsyncLogWriter;
+	std::shared_ptr<LogOutput> output() const;
+
+	struct LevelConfig {
+		std::string category;
+		LogSeverity severity;
+		unsigned int rateLimit;
+		unsigned int sampling;
+	};
+
+	struct CallSite {
+		uint64_t windowStart;
+		unsigned int count;
+		unsigned int suppressed;
+	};
+
+	void write(LogRecord &&record);
+	bool rateLimit(const LogMessage &msg, unsigned int *suppressed);
 
 	void parseLogFile();
+	void parseLogAsync();
+	void parseLogClock();
 	void parseLogLevels();
 	static LogSeverity parseLogLevel(const std::string &level);
+	static bool parseRateLimit(const std::string &rate, unsigned int *rateLimit,
+				   unsigned int *sampling);
 
 	friend LogCategory;
 	void registerCategory(LogCategory *category);
 	void unregisterCategory(LogCategory *category);
 
-	void writeSyslog(const LogMessage &msg);
-	void writeStream(const LogMessage &msg);
-
 	std::unordered_set<LogCategory *> categories_;
-	std::list<std::pair<std::string, LogSeverity>> levels_;
+	std::list<LevelConfig> levels_;
+
+	Mutex callSitesMutex_;
+	std::map<std::pair<const char *, unsigned int>, CallSite> callSites_;
 
 	std::shared_ptr<LogOutput> output_;
+
+	Mutex writerMutex_;
+	std::unique_ptr<AsyncLogWriter> writer_;
+	std::atomic<bool> async_;
 };
 
 /**
@@ -276,6 +533,9 @@ private:
  * \var LoggingTargetStream
  * \brief Log to stream
  * \sa Logger::logSetStream
+ * \var LoggingTargetBinaryFile
+ * \brief Log to file in the binary format
+ * \sa Logger::logSetBinaryFile
  */
 
 /**
@@ -312,6 +572,28 @@ int logSetStream(std::ostream *stream)
 	return Logger::instance()->logSetStream(stream);
 }
 
+/**
+ * \brief Direct logging to a file in the binary format
+ * \param[in] path Full path to the log file
+ *
+ * This function directs the log output to the file identified by \a path, as
+ * logSetFile() does, but writes messages in a compact binary format instead of
+ * text. The timestamp, severity, category and file information of messages
+ * are stored in binary form, which avoids formatting them, and messages are
+ * buffered and only flushed for warnings and more severe messages. This makes
+ * it possible to keep debug logging enabled with a lower CPU overhead for
+ * post-mortem analysis. Binary log files can be converted to text with the
+ * log-decode tool.
+ *
+ * If the function returns an error, the log target is not changed.
+ *
+ * \return Zero on success, or a negative error code otherwise
+ */
+int logSetBinaryFile(const char *path)
+{
+	return Logger::instance()->logSetFile(path, true);
+}
+
 /**
  * \brief Set the logging target
  * \param[in] target Logging destination
@@ -323,8 +605,9 @@ int logSetStream(std::ostream *stream)
  * log target, if any, is closed, and all new log messages will be written to
  * the new log destination.
  *
- * LoggingTargetFile and LoggingTargetStream are not valid values for \a target.
- * Use logSetFile() and logSetStream() instead, respectively.
+ * LoggingTargetFile, LoggingTargetStream and LoggingTargetBinaryFile are not
+ * valid values for \a target. Use logSetFile(), logSetStream() and
+ * logSetBinaryFile() instead, respectively.
  *
  * If the function returns an error, the log file is not changed.
  *
@@ -355,6 +638,172 @@ void logSetLevel(const char *category, const char *level)
 	Logger::instance()->logSetLevel(category, level);
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] enable True to write log messages asynchronously
+ *
+ * By default log messages are written to the log output synchronously, in the
+ * thread that logs them. When asynchronous logging is enabled, messages are
+ * formatted in the logging thread and queued to a background thread that
+ * writes them to the log output. This avoids stalling time-sensitive threads
+ * on file or syslog I/O when verbose logging is enabled.
+ *
+ * Messages are queued in a bounded ring. If the background thread can't keep
+ * up, messages are dropped, and the number of dropped messages is logged once
+ * the ring has been drained. Fatal messages are always written synchronously,
+ * after all queued messages.
+ *
+ * Disabling asynchronous logging waits until all queued messages have been
+ * written.
+ */
+void logSetAsynchronous(bool enable)
+{
+	Logger::instance()->logSetAsynchronous(enable);
+}
+
+AsyncLogWriter::AsyncLogWriter(Logger *logger)
+	: logger_(logger), ring_(new Record[RingSize]), head_(0), tail_(0),
+	  dropped_(0), sleeping_(false), stopping_(false)
+{
+	for (unsigned int i = 0; i < RingSize; ++i)
+		ring_[i].sequence.store(i, std::memory_order_relaxed);
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	setName("log");
+	start();
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+	stopping_.store(true, std::memory_order_release);
+	wake();
+	wait();
+
+	if (eventfd_ >= 0)
+		close(eventfd_);
+}
+
+/**
+ * \brief Queue a message to be written by the writer thread
+ * \param[in] record The message record
+ *
+ * This method may be called from any thread, it doesn't block.
+ *
+ * \return True if the message has been queued, false if it has been dropped
+ */
+bool AsyncLogWriter::queue(LogRecord &&record)
+{
+	uint64_t pos = head_.load(std::memory_order_relaxed);
+	Record *slot;
+
+	while (true) {
+		slot = &ring_[pos % RingSize];
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		int64_t diff = static_cast<int64_t>(sequence - pos);
+
+		if (diff < 0) {
+			/* The record is still used, the ring is full. */
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (!diff && head_.compare_exchange_weak(pos, pos + 1,
+							 std::memory_order_relaxed))
+			break;
+
+		if (diff)
+			pos = head_.load(std::memory_order_relaxed);
+	}
+
+	slot->record = std::move(record);
+	slot->sequence.store(pos + 1, std::memory_order_release);
+
+	/* Wake the writer thread only if it's waiting for messages. */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (sleeping_.load(std::memory_order_relaxed) &&
+	    sleeping_.exchange(false))
+		wake();
+
+	return true;
+}
+
+/**
+ * \brief Wait until all queued messages have been written
+ */
+void AsyncLogWriter::flush()
+{
+	while (pending()) {
+		wake();
+		std::this_thread::yield();
+	}
+}
+
+void AsyncLogWriter::run()
+{
+	while (!stopping_.load(std::memory_order_acquire)) {
+		drain();
+
+		uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+		if (dropped)
+			LOG(Warning) << dropped << " log messages dropped";
+
+		sleeping_.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (pending()) {
+			sleeping_.store(false);
+			continue;
+		}
+
+		/*
+		 * Poll with a timeout to recover from a missed wake up if the
+		 * eventfd couldn't be created.
+		 */
+		struct pollfd pfd = { eventfd_, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) > 0) {
+			uint64_t value;
+			ssize_t ret = read(eventfd_, &value, sizeof(value));
+			(void)ret;
+		}
+
+		sleeping_.store(false);
+	}
+
+	drain();
+}
+
+bool AsyncLogWriter::pending() const
+{
+	return tail_.load(std::memory_order_acquire) !=
+	       head_.load(std::memory_order_acquire);
+}
+
+void AsyncLogWriter::drain()
+{
+	std::shared_ptr<LogOutput> output = logger_->output();
+	uint64_t tail = tail_.load(std::memory_order_relaxed);
+
+	while (true) {
+		Record &slot = ring_[tail % RingSize];
+		if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+			break;
+
+		if (output)
+			output->write(slot.record);
+
+		slot.record.msg.clear();
+		slot.sequence.store(tail + RingSize, std::memory_order_release);
+		tail_.store(++tail, std::memory_order_release);
+	}
+}
+
+void AsyncLogWriter::wake()
+{
+	uint64_t value = 1;
+	ssize_t ret = ::write(eventfd_, &value, sizeof(value));
+	(void)ret;
+}
+
 /**
  * \brief Retrieve the logger instance
  *
@@ -375,24 +824,116 @@ Logger *Logger::instance()
  */
 void Logger::write(const LogMessage &msg)
 {
+	unsigned int suppressed = 0;
+
+	if (!rateLimit(msg, &suppressed))
+		return;
+
+	if (suppressed)
+		write({ msg.timestamp(), msg.severity(), &msg.category(),
+			msg.fileName(), msg.line(),
+			"suppressed " + std::to_string(suppressed) + " messages\n" });
+
+	write({ msg.timestamp(), msg.severity(), &msg.category(),
+		msg.fileName(), msg.line(), msg.msg() });
+}
+
+/*
+ * Write a message record to the log output, or queue it to the asynchronous
+ * writer.
+ */
+void Logger::write(LogRecord &&record)
+{
+	if (async_.load(std::memory_order_acquire)) {
+		if (record.severity != LogFatal) {
+			writer_->queue(std::move(record));
+			return;
+		}
+
+		writer_->flush();
+	}
+
 	std::shared_ptr<LogOutput> output = std::atomic_load(&output_);
 	if (!output)
 		return;
 
-	output->write(msg);
+	output->write(record);
+}
+
+/**
+ * \brief Apply the rate limit of the message category to a message
+ * \param[in] msg The message
+ * \param[out] suppressed The number of messages suppressed at the same call
+ * site since the last message that was output
+ *
+ * Rate limits and sampling apply to each call site individually, identified by
+ * the file name and line of the message. Fatal messages are never suppressed.
+ *
+ * \return True if the message shall be output, false if it shall be suppressed
+ */
+bool Logger::rateLimit(const LogMessage &msg, unsigned int *suppressed)
+{
+	const LogCategory &category = msg.category();
+	unsigned int limit = category.rateLimit();
+	unsigned int sampling = category.sampling();
+
+	if ((!limit && !sampling) || msg.severity() == LogFatal)
+		return true;
+
+	uint64_t now = utils::time_point_to_ns(msg.timestamp());
+
+	MutexLocker locker(callSitesMutex_);
+
+	auto result = callSites_.emplace(std::make_pair(msg.fileName(), msg.line()),
+					 CallSite{ now, 0, 0 });
+	CallSite &site = result.first->second;
+
+	if (limit) {
+		/* Allow up to limit messages per second. */
+		if (now - site.windowStart >= 1000000000ULL) {
+			site.windowStart = now;
+			site.count = 0;
+		}
+
+		if (site.count >= limit) {
+			site.suppressed++;
+			return false;
+		}
+	} else if (site.count % sampling) {
+		/* Output one message out of every sampling messages. */
+		site.count++;
+		site.suppressed++;
+		return false;
+	}
+
+	site.count++;
+	*suppressed = site.suppressed;
+	site.suppressed = 0;
+
+	return true;
+}
+
+/**
+ * \brief Retrieve the current log output
+ * \return The log output, or a null pointer if logging is disabled
+ */
+std::shared_ptr<LogOutput> Logger::output() const
+{
+	return std::atomic_load(&output_);
 }
 
 /**
  * \brief Set the log file
  * \param[in] path Full path to the log file
+ * \param[in] binary True to write log messages in the binary format
  *
- * \sa libcamera::logSetFile()
+ * \sa libcamera::logSetFile(), libcamera::logSetBinaryFile()
  *
  * \return Zero on success, or a negative error code otherwise.
  */
-int Logger::logSetFile(const char *path)
+int Logger::logSetFile(const char *path, bool binary)
 {
-	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(path);
+	std::shared_ptr<LogOutput> output = std::make_shared<LogOutput>(path, binary);
 	if (!output->isValid())
 		return -EINVAL;
 
@@ -464,13 +1005,49 @@ void Logger::logSetLevel(const char *category, const char *level)
 	}
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] enable True to write log messages asynchronously
+ *
+ * The writer thread is created the first time asynchronous logging is enabled,
+ * and is kept until the logger is destroyed, to let threads that are logging
+ * concurrently keep using it.
+ *
+ * \sa libcamera::logSetAsynchronous()
+ */
+void Logger::logSetAsynchronous(bool enable)
+{
+	MutexLocker locker(writerMutex_);
+
+	if (!enable) {
+		async_.store(false, std::memory_order_release);
+		if (writer_)
+			writer_->flush();
+		return;
+	}
+
+	if (!writer_)
+		writer_ = utils::make_unique<AsyncLogWriter>(this);
+
+	async_.store(true, std::memory_order_release);
+}
+
 /**
  * \brief Construct a logger
  */
 Logger::Logger()
+	: async_(false)
 {
 	parseLogFile();
 	parseLogLevels();
+	parseLogAsync();
+	parseLogClock();
+}
+
+Logger::~Logger()
+{
+	async_.store(false, std::memory_order_release);
+	writer_.reset();
 }
 
 /**
@@ -478,8 +1055,10 @@ Logger::Logger()
  *
  * If the LIBCAMERA_LOG_FILE environment variable is set, open the file it
  * points to and redirect the logger output to it. If the environment variable
- * is set to "syslog", then the logger output will be directed to syslog. Errors
- * are silently ignored and don't affect the logger output (set to stderr).
+ * is set to "syslog", then the logger output will be directed to syslog. If it
+ * is prefixed with "binary:", the file name following the prefix is written in
+ * the binary format. Errors are silently ignored and don't affect the logger
+ * output (set to stderr).
  */
 void Logger::parseLogFile()
 {
@@ -494,15 +1073,52 @@ void Logger::parseLogFile()
 		return;
 	}
 
+	if (!strncmp(file, "binary:", 7)) {
+		logSetFile(file + 7, true);
+		return;
+	}
+
 	logSetFile(file);
 }
 
+/**
+ * \brief Parse the asynchronous logging mode from the environment
+ *
+ * If the LIBCAMERA_LOG_ASYNC environment variable is set to a non-zero value,
+ * enable asynchronous logging.
+ */
+void Logger::parseLogAsync()
+{
+	const char *async = utils::secure_getenv("LIBCAMERA_LOG_ASYNC");
+	if (!async || !strtoul(async, nullptr, 10))
+		return;
+
+	logSetAsynchronous(true);
+}
+
+/**
+ * \brief Parse the log timestamp clock from the environment
+ *
+ * If the LIBCAMERA_LOG_CLOCK environment variable is set to "coarse",
+ * timestamp messages with the coarse monotonic clock, which is cheaper to read
+ * but has a resolution of a few milliseconds only.
+ */
+void Logger::parseLogClock()
+{
+	const char *clock = utils::secure_getenv("LIBCAMERA_LOG_CLOCK");
+	if (!clock || strcmp(clock, "coarse"))
+		return;
+
+	log_coarse_clock.store(true, std::memory_order_relaxed);
+}
+
 /**
  * \brief Parse the log levels from the environment
  *
  * The log levels are stored in the LIBCAMERA_LOG_LEVELS environment variable
- * as a list of "category:level" pairs, separated by commas (','). Parse the
- * variable and store the levels to configure all log categories.
+ * as a list of "category:level" pairs, separated by commas (','). Each pair
+ * can optionally be followed by a rate limit, as "category:level:rate". Parse
+ * the variable and store the levels to configure all log categories.
  */
 void Logger::parseLogLevels()
 {
@@ -534,6 +1150,17 @@ void Logger::parseLogLevels()
 			level = std::string(colon + 1, comma - colon - 1);
 		}
 
+		unsigned int rateLimit = 0;
+		unsigned int sampling = 0;
+
+		size_t rate = level.find(':');
+		if (rate != std::string::npos) {
+			if (!parseRateLimit(level.substr(rate + 1), &rateLimit,
+					    &sampling))
+				continue;
+			level.erase(rate);
+		}
+
 		/* Both the category and the level must be specified. */
 		if (category.empty() || level.empty())
 			continue;
@@ -542,10 +1169,38 @@ void Logger::parseLogLevels()
 		if (severity == LogInvalid)
 			continue;
 
-		levels_.push_back({ category, severity });
+		levels_.push_back({ category, severity, rateLimit, sampling });
 	}
 }
 
+/**
+ * \brief Parse a log rate limit string
+ * \param[in] rate The rate limit string
+ * \param[out] rateLimit The maximum number of messages per second
+ * \param[out] sampling The message sampling interval
+ *
+ * Rate limits are specified either as an integer value, the maximum number of
+ * messages per second output by each call site, or as "1/n" to output one
+ * message out of every n messages from each call site. The messages in excess
+ * are suppressed, and the number of suppressed messages is logged before the
+ * next message output by the call site.
+ *
+ * \return True if the rate limit string is valid, false otherwise
+ */
+bool Logger::parseRateLimit(const std::string &rate, unsigned int *rateLimit,
+			    unsigned int *sampling)
+{
+	char *endptr;
+
+	if (!rate.compare(0, 2, "1/")) {
+		*sampling = strtoul(rate.c_str() + 2, &endptr, 10);
+		return *endptr == '\0' && *sampling;
+	}
+
+	*rateLimit = strtoul(rate.c_str(), &endptr, 10);
+	return !rate.empty() && *endptr == '\0';
+}
+
 /**
  * \brief Parse a log level string into a LogSeverity
  * \param[in] level The log level string
@@ -598,22 +1253,23 @@ void Logger::registerCategory(LogCategory *category)
 	categories_.insert(category);
 
 	const std::string &name = category->name();
-	for (const std::pair<std::string, LogSeverity> &level : levels_) {
+	for (const LevelConfig &level : levels_) {
 		bool match = true;
 
-		for (unsigned int i = 0; i < level.first.size(); ++i) {
-			if (level.first[i] == '*')
+		for (unsigned int i = 0; i < level.category.size(); ++i) {
+			if (level.category[i] == '*')
 				break;
 
 			if (i >= name.size() ||
-			    name[i] != level.first[i]) {
+			    name[i] != level.category[i]) {
 				match = false;
 				break;
 			}
 		}
 
 		if (match) {
-			category->setSeverity(level.second);
+			category->setSeverity(level.severity);
+			category->setRateLimit(level.rateLimit, level.sampling);
 			break;
 		}
 	}
@@ -660,7 +1316,8 @@ void Logger::unregisterCategory(LogCategory *category)
  * \param[in] name The category name
  */
 LogCategory::LogCategory(const char *name)
-	: name_(name), severity_(LogSeverity::LogInfo)
+	: name_(name), severity_(LogSeverity::LogInfo), rateLimit_(0),
+	  sampling_(0)
 {
 	Logger::instance()->registerCategory(this);
 }
@@ -694,6 +1351,40 @@ void LogCategory::setSeverity(LogSeverity severity)
 	severity_ = severity;
 }
 
+/**
+ * \fn LogCategory::rateLimit()
+ * \brief Retrieve the rate limit of the log category
+ * \sa setRateLimit()
+ * \return The maximum number of messages per second output by each call site,
+ * or 0 if the messages are not rate-limited
+ */
+
+/**
+ * \fn LogCategory::sampling()
+ * \brief Retrieve the sampling interval of the log category
+ * \sa setRateLimit()
+ * \return The sampling interval, or 0 if the messages are not sampled
+ */
+
+/**
+ * \brief Set the rate limit of the log category
+ * \param[in] rateLimit The maximum number of messages per second output by
+ * each call site, or 0 to disable rate limiting
+ * \param[in] sampling Output one message out of every \a sampling messages
+ * from each call site, or 0 to disable sampling
+ *
+ * Rate limiting and sampling apply to each call site of the LOG() macro
+ * individually, to avoid flooding the log with messages repeated for every
+ * frame. When both are set, the rate limit takes precedence. The number of
+ * suppressed messages is logged before the next message output by a call
+ * site. Fatal messages are never suppressed.
+ */
+void LogCategory::setRateLimit(unsigned int rateLimit, unsigned int sampling)
+{
+	rateLimit_ = rateLimit;
+	sampling_ = sampling;
+}
+
 /**
  * \brief Retrieve the default log category
  *
@@ -769,19 +1460,23 @@ LogMessage::LogMessage(const char *fileName, unsigned int line,
  */
 LogMessage::LogMessage(LogMessage &&other)
 	: msgStream_(std::move(other.msgStream_)), category_(other.category_),
-	  severity_(other.severity_)
+	  severity_(other.severity_), timestamp_(other.timestamp_),
+	  fileName_(other.fileName_), line_(other.line_)
 {
 	other.severity_ = LogInvalid;
 }
 
 void LogMessage::init(const char *fileName, unsigned int line)
 {
-	/* Log the timestamp, severity and file information. */
-	clock_gettime(CLOCK_MONOTONIC, &timestamp_);
-
-	std::ostringstream ossFileInfo;
-	ossFileInfo << utils::basename(fileName) << ":" << line;
-	fileInfo_ = ossFileInfo.str();
+	/*
+	 * Log the timestamp and store the file information, which is only
+	 * formatted when the message is output.
+	 */
+	timestamp_ = log_coarse_clock.load(std::memory_order_relaxed)
+		   ? utils::coarse_clock::now() : utils::clock::now();
+
+	fileName_ = fileName;
+	line_ = line;
 }
 
 LogMessage::~LogMessage()
@@ -828,10 +1523,30 @@ LogMessage::~LogMessage()
  */
 
 /**
- * \fn LogMessage::fileInfo()
+ * \fn LogMessage::fileName()
+ * \brief Retrieve the name of the file the message is logged from
+ * \return The file name of the message
+ */
+
+/**
+ * \fn LogMessage::line()
+ * \brief Retrieve the line number the message is logged from
+ * \return The line number of the message
+ */
+
+/**
  * \brief Retrieve the file info of the log message
+ *
+ * The file info is formatted on demand, as it's only needed when the message
+ * is output.
+ *
  * \return The file info of the message
  */
+std::string LogMessage::fileInfo() const
+{
+	return std::string(utils::basename(fileName_)) + ":" +
+	       std::to_string(line_);
+}
 
 /**
  * \fn LogMessage::msg()
@@ -981,6 +1696,10 @@ LogMessage _log(const char *fileName, unsigned int line,
  * absent the default category is used. The  \a severity controls whether the
  * message is printed or discarded, depending on the log level for the category.
  *
+ * The severity is checked before the message is created. When the message is
+ * discarded, neither the message nor the expressions streamed to it are
+ * evaluated, disabled log statements can thus be used in hot paths.
+ *
  * If the severity is set to Fatal, execution is aborted and the program
  * terminates immediately after printing the message.
  */
@@ -9,6 +9,9 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <fstream>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -19,6 +22,8 @@
 #include <linux/media.h>
 
 #include "log.h"
+#include "media_request.h"
+#include "utils.h"
 
 /**
  * \file media_device.h
@@ -30,6 +35,28 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(MediaDevice)
 
+/*
+ * Header of the topology cache files. The cached topology is only valid for
+ * the same media device, identified by its device information, and the same
+ * topology version in the same boot.
+ */
+struct TopologyCacheKey {
+	char magic[8];
+	char bootId[40];
+	struct media_device_info info;
+	uint64_t version;
+	uint32_t numEntities;
+	uint32_t numInterfaces;
+	uint32_t numPads;
+	uint32_t numLinks;
+};
+
+namespace {
+
+const char TopologyCacheMagic[8] = "lctopo1";
+
+} /* namespace */
+
 /**
  * \class MediaDevice
  * \brief The MediaDevice represents a Media Controller device with its full
@@ -53,6 +80,13 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  * Media device can be claimed for exclusive use with acquire(), released with
  * release() and tested with busy(). This mechanism is aimed at pipeline
  * managers to claim media devices they support during enumeration.
+ *
+ * The media graph topology can optionally be cached on disk to speed up
+ * populate() in processes that are frequently restarted. The cache is enabled
+ * by setting the LIBCAMERA_TOPOLOGY_CACHE environment variable to the path of
+ * a writable directory. The cached topology of a media device is used if the
+ * device information, the topology version and layout reported by the kernel
+ * match the ones of the cache, and is replaced otherwise.
  */
 
 /**
@@ -206,6 +240,7 @@ int MediaDevice::populate()
 	struct media_v2_link *links = nullptr;
 	struct media_v2_pad *pads = nullptr;
 	__u64 version = -1;
+	bool cached = false;
 	int ret;
 
 	clear();
@@ -228,7 +263,9 @@ int MediaDevice::populate()
 	version_ = info.media_version;
 
 	/*
-	 * Keep calling G_TOPOLOGY until the version number stays stable.
+	 * Keep calling G_TOPOLOGY until the version number stays stable. The
+	 * first call only retrieves the topology version and the number of
+	 * objects, which is enough to validate and use the topology cache.
 	 */
 	while (true) {
 		topology.topology_version = 0;
@@ -254,6 +291,15 @@ int MediaDevice::populate()
 		delete[] pads;
 		delete[] links;
 
+		if (!ents && loadTopology(info, &topology)) {
+			ents = reinterpret_cast<struct media_v2_entity *>(topology.ptr_entities);
+			interfaces = reinterpret_cast<struct media_v2_interface *>(topology.ptr_interfaces);
+			links = reinterpret_cast<struct media_v2_link *>(topology.ptr_links);
+			pads = reinterpret_cast<struct media_v2_pad *>(topology.ptr_pads);
+			cached = true;
+			break;
+		}
+
 		ents = new struct media_v2_entity[topology.num_entities]();
 		interfaces = new struct media_v2_interface[topology.num_interfaces]();
 		links = new struct media_v2_link[topology.num_links]();
@@ -262,6 +308,9 @@ int MediaDevice::populate()
 		version = topology.topology_version;
 	}
 
+	if (!cached)
+		storeTopology(info, topology);
+
 	/* Populate entities, pads and links. */
 	if (populateEntities(topology) &&
 	    populatePads(topology) &&
@@ -285,6 +334,132 @@ done:
 	return ret;
 }
 
+/*
+ * Retrieve the path of the topology cache file and fill the cache \a key for
+ * the media device described by \a info and the current \a topology. Return
+ * an empty string if the topology cache is disabled or can't be used.
+ */
+std::string MediaDevice::topologyCachePath(const struct media_device_info &info,
+					   const struct media_v2_topology &topology,
+					   TopologyCacheKey *key)
+{
+	const char *dir = utils::secure_getenv("LIBCAMERA_TOPOLOGY_CACHE");
+	if (!dir || !*dir)
+		return std::string();
+
+	memset(key, 0, sizeof(*key));
+	memcpy(key->magic, TopologyCacheMagic, sizeof(key->magic));
+
+	/*
+	 * Topology versions are only unique within a boot, include the boot
+	 * ID in the cache key.
+	 */
+	std::ifstream bootId("/proc/sys/kernel/random/boot_id");
+	if (!bootId.read(key->bootId, 36))
+		return std::string();
+
+	key->info = info;
+	key->version = topology.topology_version;
+	key->numEntities = topology.num_entities;
+	key->numInterfaces = topology.num_interfaces;
+	key->numPads = topology.num_pads;
+	key->numLinks = topology.num_links;
+
+	return std::string(dir) + "/" + utils::basename(deviceNode_.c_str()) +
+	       ".topology";
+}
+
+/*
+ * Load the topology arrays from the cache if the cache matches the media
+ * device described by \a info and the probed \a topology. On success the
+ * arrays are allocated with new[] and stored in the \a topology pointers.
+ */
+bool MediaDevice::loadTopology(const struct media_device_info &info,
+			       struct media_v2_topology *topology)
+{
+	TopologyCacheKey key;
+	std::string path = topologyCachePath(info, *topology, &key);
+	if (path.empty())
+		return false;
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	TopologyCacheKey cachedKey;
+	if (!file.read(reinterpret_cast<char *>(&cachedKey), sizeof(cachedKey)) ||
+	    memcmp(&key, &cachedKey, sizeof(key))) {
+		LOG(MediaDevice, Debug) << "Stale topology cache " << path;
+		return false;
+	}
+
+	auto ents = new struct media_v2_entity[topology->num_entities]();
+	auto interfaces = new struct media_v2_interface[topology->num_interfaces]();
+	auto links = new struct media_v2_link[topology->num_links]();
+	auto pads = new struct media_v2_pad[topology->num_pads]();
+
+	file.read(reinterpret_cast<char *>(ents),
+		  topology->num_entities * sizeof(*ents));
+	file.read(reinterpret_cast<char *>(interfaces),
+		  topology->num_interfaces * sizeof(*interfaces));
+	file.read(reinterpret_cast<char *>(links),
+		  topology->num_links * sizeof(*links));
+	file.read(reinterpret_cast<char *>(pads),
+		  topology->num_pads * sizeof(*pads));
+
+	if (!file) {
+		LOG(MediaDevice, Debug) << "Truncated topology cache " << path;
+		delete[] ents;
+		delete[] interfaces;
+		delete[] links;
+		delete[] pads;
+		return false;
+	}
+
+	topology->ptr_entities = reinterpret_cast<__u64>(ents);
+	topology->ptr_interfaces = reinterpret_cast<__u64>(interfaces);
+	topology->ptr_links = reinterpret_cast<__u64>(links);
+	topology->ptr_pads = reinterpret_cast<__u64>(pads);
+
+	LOG(MediaDevice, Debug) << "Loaded topology from " << path;
+
+	return true;
+}
+
+/*
+ * Store the \a topology retrieved from the media device described by \a info
+ * in the cache. The cache file is replaced atomically to avoid readers seeing
+ * a partially written file.
+ */
+void MediaDevice::storeTopology(const struct media_device_info &info,
+				const struct media_v2_topology &topology)
+{
+	TopologyCacheKey key;
+	std::string path = topologyCachePath(info, topology, &key);
+	if (path.empty())
+		return;
+
+	std::string tmpPath = path + "." + std::to_string(getpid());
+
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+	file.write(reinterpret_cast<const char *>(topology.ptr_entities),
+		   topology.num_entities * sizeof(struct media_v2_entity));
+	file.write(reinterpret_cast<const char *>(topology.ptr_interfaces),
+		   topology.num_interfaces * sizeof(struct media_v2_interface));
+	file.write(reinterpret_cast<const char *>(topology.ptr_links),
+		   topology.num_links * sizeof(struct media_v2_link));
+	file.write(reinterpret_cast<const char *>(topology.ptr_pads),
+		   topology.num_pads * sizeof(struct media_v2_pad));
+	file.close();
+
+	if (!file || rename(tmpPath.c_str(), path.c_str()) < 0) {
+		LOG(MediaDevice, Debug)
+			<< "Failed to store topology cache " << path;
+		unlink(tmpPath.c_str());
+	}
+}
+
 /**
  * \fn MediaDevice::valid()
  * \brief Query whether the media graph has been populated and is valid
@@ -322,11 +497,11 @@ done:
  */
 MediaEntity *MediaDevice::getEntityByName(const std::string &name) const
 {
-	for (MediaEntity *e : entities_)
-		if (e->name() == name)
-			return e;
+	auto it = entitiesByName_.find(name);
+	if (it == entitiesByName_.end())
+		return nullptr;
 
-	return nullptr;
+	return it->second;
 }
 
 /**
@@ -401,41 +576,71 @@ MediaLink *MediaDevice::link(const MediaEntity *source, unsigned int sourceIdx,
  */
 MediaLink *MediaDevice::link(const MediaPad *source, const MediaPad *sink)
 {
-	for (MediaLink *link : source->links()) {
-		if (link->sink()->id() == sink->id())
-			return link;
-	}
+	auto it = linksByPads_.find(linkKey(source, sink));
+	if (it == linksByPads_.end())
+		return nullptr;
 
-	return nullptr;
+	return it->second;
 }
 
 /**
  * \brief Disable all links in the media device
  *
  * Disable all the media device links, clearing the MEDIA_LNK_FL_ENABLED flag
- * on links which are not flagged as IMMUTABLE.
+ * on links which are not flagged as IMMUTABLE. Links that are already disabled
+ * are skipped.
+ *
+ * \sa MediaLinkTransaction
  *
  * \return 0 on success or a negative error code otherwise
  */
 int MediaDevice::disableLinks()
 {
-	for (MediaEntity *entity : entities_) {
-		for (MediaPad *pad : entity->pads()) {
-			if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
-				continue;
+	MediaLinkTransaction links(this);
+	links.disableAll();
 
-			for (MediaLink *link : pad->links()) {
-				if (link->flags() & MEDIA_LNK_FL_IMMUTABLE)
-					continue;
+	return links.commit();
+}
 
-				int ret = link->setEnabled(false);
-				if (ret)
-					return ret;
-			}
-		}
+/**
+ * \brief Allocate a request
+ *
+ * Allocate a new request on the media device with MEDIA_IOC_REQUEST_ALLOC.
+ * Requests group buffers and controls for multiple devices of the media graph
+ * and apply them atomically when queued. The media device shall be acquired
+ * before requests can be allocated.
+ *
+ * Not all media devices support requests. Failure to allocate a request
+ * because the media device lacks support for the request API is reported with
+ * a debug message only, as callers are expected to fall back to applying
+ * controls synchronously.
+ *
+ * \return The newly allocated request, or nullptr if the media device doesn't
+ * support requests or an error occurred
+ */
+std::unique_ptr<MediaRequest> MediaDevice::allocateRequest()
+{
+	if (fd_ == -1) {
+		LOG(MediaDevice, Error)
+			<< "Media device must be acquired to allocate requests";
+		return nullptr;
 	}
 
-	return 0;
+	int requestFd;
+	int ret = ioctl(fd_, MEDIA_IOC_REQUEST_ALLOC, &requestFd);
+	if (ret < 0) {
+		ret = -errno;
+		if (ret == -ENOTTY)
+			LOG(MediaDevice, Debug)
+				<< "Media device doesn't support requests";
+		else
+			LOG(MediaDevice, Error)
+				<< "Failed to allocate request: "
+				<< strerror(-ret);
+		return nullptr;
+	}
+
+	return utils::make_unique<MediaRequest>(requestFd);
 }
 
 /**
@@ -499,8 +704,8 @@ void MediaDevice::close()
 
 /**
  * \var MediaDevice::objects_
- * \brief Global map of media objects (entities, pads, links) keyed by their
- * object id.
+ * \brief Global hash map of media objects (entities, pads, links) keyed by
+ * their object id.
  */
 
 /**
@@ -556,6 +761,8 @@ void MediaDevice::clear()
 
 	objects_.clear();
 	entities_.clear();
+	entitiesByName_.clear();
+	linksByPads_.clear();
 	valid_ = false;
 }
 
@@ -564,6 +771,27 @@ void MediaDevice::clear()
  * \brief Global list of media entities in the media graph
  */
 
+/**
+ * \var MediaDevice::entitiesByName_
+ * \brief Media entities in the media graph, indexed by name
+ */
+
+/**
+ * \var MediaDevice::linksByPads_
+ * \brief Pad-to-pad links in the media graph, indexed by linkKey()
+ */
+
+/**
+ * \brief Compute the key identifying a link in linksByPads_
+ * \param[in] source The source pad
+ * \param[in] sink The sink pad
+ * \return The key of the link between \a source and \a sink
+ */
+uint64_t MediaDevice::linkKey(const MediaPad *source, const MediaPad *sink)
+{
+	return static_cast<uint64_t>(source->id()) << 32 | sink->id();
+}
+
 /**
  * \brief Find the interface associated with an entity
  * \param[in] topology The media topology as returned by MEDIA_IOC_G_TOPOLOGY
@@ -643,6 +871,7 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 		}
 
 		entities_.push_back(entity);
+		entitiesByName_.emplace(entity->name(), entity);
 	}
 
 	return true;
@@ -721,6 +950,8 @@ bool MediaDevice::populateLinks(const struct media_v2_topology &topology)
 
 		source->addLink(link);
 		sink->addLink(link);
+
+		linksByPads_.emplace(linkKey(source, sink), link);
 	}
 
 	return true;
@@ -800,4 +1031,162 @@ int MediaDevice::setupLink(const MediaLink *link, unsigned int flags)
 	return 0;
 }
 
+/**
+ * \class MediaLinkTransaction
+ * \brief Configure the links of a media device in a single step
+ *
+ * The MediaLinkTransaction class collects the desired state of media links and
+ * applies it with commit(). Only the links whose state differs from their
+ * current state are set up, which avoids the MEDIA_IOC_SETUP_LINK calls for
+ * links that are already in the desired state when a pipeline is
+ * reconfigured.
+ *
+ * Links are disabled before being enabled, to avoid transiently enabling two
+ * links to the same sink pad, which drivers commonly reject.
+ *
+ * The current state of links is the state cached in the MediaLink instances.
+ * Transactions are thus only valid for media devices acquired by the caller.
+ */
+
+/**
+ * \brief Construct an empty transaction for the \a media device
+ * \param[in] media The media device
+ */
+MediaLinkTransaction::MediaLinkTransaction(MediaDevice *media)
+	: media_(media), disableAll_(false)
+{
+}
+
+/**
+ * \brief Disable all links not explicitly enabled in the transaction
+ *
+ * All links that are not flagged as IMMUTABLE and not enabled with
+ * setEnabled() will be disabled when the transaction is committed.
+ */
+void MediaLinkTransaction::disableAll()
+{
+	disableAll_ = true;
+}
+
+/**
+ * \brief Set the desired state of a link
+ * \param[in] link The link
+ * \param[in] enable True to enable the link, false to disable it
+ *
+ * The last state set for a link takes precedence.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The link is immutable and \a enable differs from its state
+ */
+int MediaLinkTransaction::setEnabled(MediaLink *link, bool enable)
+{
+	if (link->flags() & MEDIA_LNK_FL_IMMUTABLE) {
+		bool enabled = link->flags() & MEDIA_LNK_FL_ENABLED;
+		return enabled == enable ? 0 : -EINVAL;
+	}
+
+	auto it = states_.find(link);
+	if (it == states_.end()) {
+		links_.push_back(link);
+		states_[link] = enable;
+	} else {
+		it->second = enable;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Set the desired state of a link identified by entity names and pad
+ * indexes
+ * \param[in] sourceName The source entity name
+ * \param[in] sourceIdx The index of the source pad
+ * \param[in] sinkName The sink entity name
+ * \param[in] sinkIdx The index of the sink pad
+ * \param[in] enable True to enable the link, false to disable it
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The link doesn't exist
+ * \retval -EINVAL The link is immutable
+ */
+int MediaLinkTransaction::setEnabled(const std::string &sourceName,
+				     unsigned int sourceIdx,
+				     const std::string &sinkName,
+				     unsigned int sinkIdx, bool enable)
+{
+	MediaLink *link = media_->link(sourceName, sourceIdx, sinkName, sinkIdx);
+	if (!link) {
+		LOG(MediaDevice, Error)
+			<< "Failed to get link: '" << sourceName << "':"
+			<< sourceIdx << " -> '" << sinkName << "':" << sinkIdx;
+		return -ENODEV;
+	}
+
+	return setEnabled(link, enable);
+}
+
+/**
+ * \brief Apply the desired state of all links in the transaction
+ *
+ * Links are set up in the order they have been added to the transaction,
+ * disabled links first. The transaction isn't atomic, if setting up a link
+ * fails, the links set up before it keep their new state.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaLinkTransaction::commit()
+{
+	std::vector<MediaLink *> disable;
+	std::vector<MediaLink *> enable;
+
+	if (disableAll_) {
+		for (MediaEntity *entity : media_->entities()) {
+			for (MediaPad *pad : entity->pads()) {
+				if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
+					continue;
+
+				for (MediaLink *link : pad->links()) {
+					if (link->flags() & MEDIA_LNK_FL_IMMUTABLE ||
+					    states_.count(link))
+						continue;
+
+					if (link->flags() & MEDIA_LNK_FL_ENABLED)
+						disable.push_back(link);
+				}
+			}
+		}
+	}
+
+	for (MediaLink *link : links_) {
+		bool enabled = link->flags() & MEDIA_LNK_FL_ENABLED;
+		bool state = states_[link];
+
+		if (enabled == state)
+			continue;
+
+		if (state)
+			enable.push_back(link);
+		else
+			disable.push_back(link);
+	}
+
+	for (MediaLink *link : disable) {
+		int ret = link->setEnabled(false);
+		if (ret)
+			return ret;
+	}
+
+	for (MediaLink *link : enable) {
+		int ret = link->setEnabled(true);
+		if (ret)
+			return ret;
+	}
+
+	LOG(MediaDevice, Debug)
+		<< "Link transaction: " << disable.size() << " disabled, "
+		<< enable.size() << " enabled";
+
+	return 0;
+}
+
 } /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #include "media_object.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
@@ -300,7 +301,7 @@ void MediaPad::addLink(MediaLink *link)
 /**
  * \fn MediaEntity::pads()
  * \brief Retrieve all pads of the entity
- * \return The list of the entity's pads
+ * \return The list of the entity's pads, sorted by pad index
  */
 
 /**
@@ -310,6 +311,10 @@ void MediaPad::addLink(MediaLink *link)
  */
 const MediaPad *MediaEntity::getPadByIndex(unsigned int index) const
 {
+	/* Pads are sorted by index, and indices are usually contiguous. */
+	if (index < pads_.size() && pads_[index]->index() == index)
+		return pads_[index];
+
 	for (MediaPad *p : pads_) {
 		if (p->index() == index)
 			return p;
@@ -390,7 +395,11 @@ MediaEntity::~MediaEntity()
  */
 void MediaEntity::addPad(MediaPad *pad)
 {
-	pads_.push_back(pad);
+	auto it = std::upper_bound(pads_.begin(), pads_.end(), pad,
+				   [](const MediaPad *a, const MediaPad *b) {
+					   return a->index() < b->index();
+				   });
+	pads_.insert(it, pad);
 }
 
 } /* namespace libcamera */
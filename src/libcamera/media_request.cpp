@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * media_request.cpp - Media Controller request objects
+ */
+
+#include "media_request.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+
+#include <libcamera/event_notifier.h>
+
+#include "log.h"
+#include "media_device.h"
+
+/**
+ * \file media_request.h
+ * \brief Media Controller request objects
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(MediaDevice)
+
+/**
+ * \class MediaRequest
+ * \brief A request allocated from a media device
+ *
+ * The MediaRequest class wraps a request file descriptor allocated by
+ * MediaDevice::allocateRequest(). Buffers and controls are bound to the
+ * request by passing it to V4L2VideoDevice::queueBuffer() and
+ * V4L2Device::setControls() respectively, and are applied atomically by the
+ * kernel when the request is queued with queue().
+ *
+ * Completion of the request is notified by the completed signal, after which
+ * the request shall be reinitialised with reinit() before being reused.
+ */
+
+/**
+ * \brief Construct a MediaRequest for a request file descriptor
+ * \param[in] fd The request file descriptor
+ *
+ * The MediaRequest takes ownership of the file descriptor and closes it when
+ * destroyed.
+ */
+MediaRequest::MediaRequest(int fd)
+	: fd_(fd)
+{
+	notifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+	notifier_->activated.connect(this, &MediaRequest::requestCompleted);
+	notifier_->setEnabled(false);
+}
+
+MediaRequest::~MediaRequest()
+{
+	delete notifier_;
+	::close(fd_);
+}
+
+/**
+ * \fn MediaRequest::fd()
+ * \brief Retrieve the request file descriptor
+ * \return The request file descriptor
+ */
+
+/**
+ * \brief Queue the request to the kernel
+ *
+ * All buffers and controls bound to the request are applied when the request
+ * is queued. The completed signal is emitted once the kernel has processed the
+ * request.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaRequest::queue()
+{
+	int ret = ioctl(fd_, MEDIA_REQUEST_IOC_QUEUE);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to queue request " << fd_ << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	notifier_->setEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Reinitialise the request for reuse
+ *
+ * Release all the buffers and controls bound to the request to make it ready
+ * for reuse. The request shall not be queued, or shall have completed.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaRequest::reinit()
+{
+	int ret = ioctl(fd_, MEDIA_REQUEST_IOC_REINIT);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to reinitialise request " << fd_ << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \var MediaRequest::completed
+ * \brief Signal emitted when the request has completed
+ */
+
+void MediaRequest::requestCompleted(EventNotifier *notifier)
+{
+	notifier_->setEnabled(false);
+	completed.emit(this);
+}
+
+/**
+ * \class MediaRequestPool
+ * \brief A pool of reusable media requests
+ *
+ * The MediaRequestPool class helps pipeline handlers that apply per-frame
+ * controls through the request API. It allocates a fixed number of requests
+ * from a media device, and recycles the requests automatically when they
+ * complete.
+ */
+
+/**
+ * \brief Allocate \a count requests from the \a media device
+ * \param[in] media The media device
+ * \param[in] count The number of requests to allocate
+ *
+ * Any request previously allocated by the pool is released first. If the
+ * media device doesn't support the request API, the pool is left empty.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The requests could not be allocated
+ */
+int MediaRequestPool::allocate(MediaDevice *media, unsigned int count)
+{
+	release();
+
+	for (unsigned int i = 0; i < count; ++i) {
+		std::unique_ptr<MediaRequest> request = media->allocateRequest();
+		if (!request) {
+			release();
+			return -ENOTSUP;
+		}
+
+		request->completed.connect(this, &MediaRequestPool::recycle);
+		available_.push(request.get());
+		requests_.push_back(std::move(request));
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Release all requests allocated by the pool
+ *
+ * The requests shall not be in use by the caller when the pool is released.
+ */
+void MediaRequestPool::release()
+{
+	available_ = {};
+	requests_.clear();
+}
+
+/**
+ * \fn MediaRequestPool::empty()
+ * \brief Check if the pool contains no request
+ *
+ * An empty pool indicates that no request has been allocated, usually because
+ * the media device doesn't support the request API. The pool isn't considered
+ * empty when all its requests are in use.
+ *
+ * \return True if the pool contains no request, false otherwise
+ */
+
+/**
+ * \brief Retrieve a request ready to be used
+ *
+ * The request is handed back to the pool automatically when it completes.
+ *
+ * \return A pointer to a request, or nullptr if all requests are in use
+ */
+MediaRequest *MediaRequestPool::get()
+{
+	if (available_.empty())
+		return nullptr;
+
+	MediaRequest *request = available_.front();
+	available_.pop();
+
+	return request;
+}
+
+/**
+ * \brief Hand a request back to the pool
+ * \param[in] request The request
+ *
+ * Requests are recycled automatically when they complete. This method shall
+ * only be called to hand back a request that has been retrieved with get() but
+ * couldn't be queued. The request is reinitialised before being made
+ * available.
+ */
+void MediaRequestPool::recycle(MediaRequest *request)
+{
+	if (request->reinit())
+		return;
+
+	available_.push(request);
+}
+
+} /* namespace libcamera */
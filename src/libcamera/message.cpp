@@ -7,6 +7,8 @@
 
 #include "message.h"
 
+#include <new>
+
 #include "log.h"
 
 /**
@@ -45,6 +47,8 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \brief Invalid message type
  * \var Message::SignalMessage
  * \brief Asynchronous signal delivery across threads
+ * \var Message::InvokeMessage
+ * \brief Synchronous function invocation across threads
  * \var Message::UserMessage
  * \brief First value available for user-defined messages
  */
@@ -54,7 +58,7 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \param[in] type The message type
  */
 Message::Message(Message::Type type)
-	: type_(type)
+	: type_(type), receiver_(nullptr), next_(nullptr)
 {
 }
 
@@ -106,6 +110,29 @@ Message::Type Message::registerMessageType()
 	return static_cast<Message::Type>(nextUserType_++);
 }
 
+/**
+ * \brief Allocate memory for a message
+ * \param[in] size The message size in bytes
+ *
+ * Messages are allocated from the MessagePool to avoid heap allocations when
+ * posting messages in steady state.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *Message::operator new(std::size_t size)
+{
+	return MessagePool::allocate(size);
+}
+
+/**
+ * \brief Free memory allocated for a message
+ * \param[in] ptr The memory returned by operator new()
+ */
+void Message::operator delete(void *ptr)
+{
+	MessagePool::release(ptr);
+}
+
 /**
  * \class SignalMessage
  * \brief A message carrying a Signal across threads
@@ -128,4 +155,279 @@ Message::Type Message::registerMessageType()
  * \brief The signal arguments
  */
 
+/**
+ * \class InvokeMessage
+ * \brief A message carrying a function invocation across threads
+ *
+ * The receiver runs the function and then fulfills the \ref done_ promise.
+ * If the message is deleted without being delivered, the promise is broken,
+ * which also wakes up the waiter.
+ */
+
+/**
+ * \fn InvokeMessage::InvokeMessage()
+ * \brief Construct an InvokeMessage
+ * \param[in] func The function to invoke
+ */
+
+/**
+ * \var InvokeMessage::func_
+ * \brief The function to invoke
+ */
+
+/**
+ * \var InvokeMessage::done_
+ * \brief Promise fulfilled once the function has returned
+ */
+
+namespace {
+
+class ThreadMessagePool;
+
+/*
+ * Header prepended to every memory block handed out by the MessagePool. Its
+ * alignment guarantees that the memory following the header is suitably
+ * aligned for any object.
+ */
+struct alignas(alignof(std::max_align_t)) MessageBlock {
+	ThreadMessagePool *pool;
+	MessageBlock *next;
+	unsigned int sizeClass;
+};
+
+/* Marks the returned blocks stack of a pool whose thread has exited. */
+MessageBlock closedPool;
+
+class ThreadMessagePool
+{
+public:
+	static constexpr unsigned int SizeClasses = 4;
+	static constexpr std::size_t MinBlockSize = 64;
+
+	ThreadMessagePool()
+		: refs_(1)
+	{
+		for (unsigned int i = 0; i < SizeClasses; ++i) {
+			free_[i] = nullptr;
+			returned_[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	static int sizeClass(std::size_t size)
+	{
+		for (unsigned int i = 0; i < SizeClasses; ++i) {
+			if (size <= MinBlockSize << i)
+				return i;
+		}
+
+		return -1;
+	}
+
+	static ThreadMessagePool *current();
+
+	MessageBlock *allocate(unsigned int sizeClass);
+	void release(MessageBlock *block);
+	void close();
+
+private:
+	void unref();
+
+	MessageBlock *free_[SizeClasses];
+	std::atomic<MessageBlock *> returned_[SizeClasses];
+	std::atomic<unsigned int> refs_;
+};
+
+class ThreadMessagePoolCleaner
+{
+public:
+	~ThreadMessagePoolCleaner();
+};
+
+thread_local ThreadMessagePool *currentPool = nullptr;
+thread_local bool currentPoolClosed = false;
+thread_local ThreadMessagePoolCleaner currentPoolCleaner;
+
+ThreadMessagePoolCleaner::~ThreadMessagePoolCleaner()
+{
+	if (currentPool)
+		currentPool->close();
+
+	currentPool = nullptr;
+	currentPoolClosed = true;
+}
+
+/*
+ * Retrieve the pool of the current thread, creating it if needed. Return
+ * nullptr if the thread is exiting and its pool has been closed.
+ */
+ThreadMessagePool *ThreadMessagePool::current()
+{
+	if (currentPool || currentPoolClosed)
+		return currentPool;
+
+	/* Make sure the pool gets closed when the thread exits. */
+	(void)&currentPoolCleaner;
+
+	currentPool = new ThreadMessagePool();
+	return currentPool;
+}
+
+/*
+ * Allocate a block from the pool. This method shall only be called from the
+ * thread that owns the pool.
+ */
+MessageBlock *ThreadMessagePool::allocate(unsigned int sizeClass)
+{
+	MessageBlock *block = free_[sizeClass];
+
+	/*
+	 * If the free list is empty, reclaim all the blocks released by other
+	 * threads in one go.
+	 */
+	if (!block)
+		block = returned_[sizeClass].exchange(nullptr, std::memory_order_acquire);
+
+	if (block) {
+		free_[sizeClass] = block->next;
+		return block;
+	}
+
+	block = static_cast<MessageBlock *>(::operator new(MinBlockSize << sizeClass));
+	block->pool = this;
+	block->sizeClass = sizeClass;
+
+	refs_.fetch_add(1, std::memory_order_relaxed);
+
+	return block;
+}
+
+/*
+ * Release a block to the pool. This method may be called from any thread.
+ * Blocks released from the owner thread are added to the free list directly,
+ * while blocks released from other threads are pushed to a lock-free stack.
+ */
+void ThreadMessagePool::release(MessageBlock *block)
+{
+	unsigned int sizeClass = block->sizeClass;
+
+	if (this == currentPool) {
+		block->next = free_[sizeClass];
+		free_[sizeClass] = block;
+		return;
+	}
+
+	MessageBlock *head = returned_[sizeClass].load(std::memory_order_relaxed);
+
+	do {
+		/* The owner thread has exited, free the block. */
+		if (head == &closedPool) {
+			::operator delete(block);
+			unref();
+			return;
+		}
+
+		block->next = head;
+	} while (!returned_[sizeClass].compare_exchange_weak(head, block,
+							     std::memory_order_release,
+							     std::memory_order_relaxed));
+}
+
+/*
+ * Free all the cached blocks when the owner thread exits. Blocks still in use
+ * by other threads will be freed when released, and the pool deleted with the
+ * last of them.
+ */
+void ThreadMessagePool::close()
+{
+	for (unsigned int i = 0; i < SizeClasses; ++i) {
+		MessageBlock *block = free_[i];
+		MessageBlock *returned = returned_[i].exchange(&closedPool,
+							       std::memory_order_acquire);
+
+		free_[i] = nullptr;
+
+		for (MessageBlock *list : { block, returned }) {
+			while (list) {
+				MessageBlock *next = list->next;
+				::operator delete(list);
+				unref();
+				list = next;
+			}
+		}
+	}
+
+	unref();
+}
+
+void ThreadMessagePool::unref()
+{
+	if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete this;
+}
+
+} /* namespace */
+
+/**
+ * \class MessagePool
+ * \brief Per-thread memory pool for messages
+ *
+ * Posting messages, and in particular emitting signals across threads,
+ * allocates memory for the message and its payload in the sending thread and
+ * frees it in the receiving thread. To avoid heap allocations in steady state,
+ * the MessagePool caches memory blocks in small size classes per thread.
+ *
+ * Blocks are allocated from the pool of the calling thread. When released
+ * from the same thread, blocks are added back to the pool immediately. When
+ * released from a different thread, they are returned to the pool they have
+ * been allocated from through a lock-free stack, and are reclaimed by the
+ * owner thread the next time it runs out of cached blocks. Pools are thus
+ * never accessed concurrently except through atomic operations.
+ *
+ * Allocations larger than the largest size class are served from the heap.
+ */
+
+/**
+ * \brief Allocate memory from the pool of the current thread
+ * \param[in] size The size of the memory to allocate in bytes
+ *
+ * The returned memory is suitably aligned for any object type.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *MessagePool::allocate(std::size_t size)
+{
+	ThreadMessagePool *pool = ThreadMessagePool::current();
+	std::size_t total = size + sizeof(MessageBlock);
+	int sizeClass = ThreadMessagePool::sizeClass(total);
+	MessageBlock *block;
+
+	if (pool && sizeClass >= 0) {
+		block = pool->allocate(sizeClass);
+	} else {
+		block = static_cast<MessageBlock *>(::operator new(total));
+		block->pool = nullptr;
+	}
+
+	return block + 1;
+}
+
+/**
+ * \brief Release memory allocated by allocate()
+ * \param[in] ptr The memory to release
+ *
+ * This method may be called from any thread.
+ */
+void MessagePool::release(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	MessageBlock *block = static_cast<MessageBlock *>(ptr) - 1;
+
+	if (block->pool)
+		block->pool->release(block);
+	else
+		::operator delete(block);
+}
+
 }; /* namespace libcamera */
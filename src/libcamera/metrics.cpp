@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * metrics.cpp - Runtime metrics
+ */
+
+#include <libcamera/metrics.h>
+
+#include <sstream>
+
+#include "metrics_registry.h"
+
+/**
+ * \file metrics.h
+ * \brief Runtime metrics
+ *
+ * libcamera maintains a registry of runtime metrics, updated by its internal
+ * components while cameras operate. Metrics are identified by a hierarchical
+ * name, with components separated by dots, such as
+ * "camera.<name>.request-latency-us". The following metrics are reported:
+ *
+ * - camera.<name>.requests: the number of requests completed by the camera
+ * - camera.<name>.request-latency-us: the time requests spend in the pipeline
+ *   handler, in microseconds
+ * - camera.<name>.frames-dropped: the number of frames skipped by the devices
+ * - camera.<name>.stream<n>.frames: the number of buffers completed
+ *   successfully for stream n
+ * - camera.<name>.stage.<stage>.latency-us: the time frames spend in the
+ *   post-processing stage named stage, in microseconds
+ * - v4l2.<node>.buffers: the number of buffers dequeued from a video device
+ * - v4l2.<node>.dequeue-latency-us: the time elapsed between the capture of a
+ *   frame, as timestamped by the driver, and the dequeue of its buffer, in
+ *   microseconds
+ * - ipc.messages-sent, ipc.messages-received, ipc.bytes-sent and
+ *   ipc.bytes-received: the IPC traffic between libcamera and its isolated
+ *   IPA modules
+ * - ipc.round-trip-us: the time elapsed between sending an event to an
+ *   isolated IPA module and receiving the resulting frame action, in
+ *   microseconds
+ *
+ * Applications retrieve the value of all metrics with metricsSnapshot(), and
+ * can dump them periodically by calling it from a Timer. Metrics accumulate
+ * from their creation and are never reset. Metrics of devices and cameras that
+ * are created again, for instance after a hotplug event, are shared with their
+ * previous instances.
+ */
+
+namespace libcamera {
+
+/**
+ * \struct MetricValue
+ * \brief The value of a metric
+ *
+ * The MetricValue structure stores the value of a metric at the time a
+ * MetricsSnapshot is taken.
+ */
+
+/**
+ * \enum MetricValue::Type
+ * \brief The metric type
+ * \var MetricValue::TypeCounter
+ * A monotonically increasing counter
+ * \var MetricValue::TypeGauge
+ * A value that can increase and decrease
+ * \var MetricValue::TypeHistogram
+ * A distribution of values
+ */
+
+/**
+ * \brief Construct a zeroed counter value
+ */
+MetricValue::MetricValue()
+	: type(TypeCounter), value(0)
+{
+}
+
+/**
+ * \var MetricValue::name
+ * \brief The metric name
+ */
+
+/**
+ * \var MetricValue::type
+ * \brief The metric type
+ */
+
+/**
+ * \var MetricValue::value
+ * \brief The value of a counter or gauge, or the number of values in a
+ * histogram
+ */
+
+/**
+ * \var MetricValue::histogram
+ * \brief The distribution of values for histograms, empty for other types
+ */
+
+/**
+ * \brief Assemble and return a string describing the metric value
+ * \return A string describing the MetricValue
+ */
+const std::string MetricValue::toString() const
+{
+	std::stringstream ss;
+
+	ss << name << ": " << value;
+
+	if (type == TypeHistogram && value)
+		ss << " p50 " << histogram.percentile(50)
+		   << " p99 " << histogram.percentile(99)
+		   << " - " << histogram.toString();
+
+	return ss.str();
+}
+
+/**
+ * \struct MetricsSnapshot
+ * \brief A snapshot of all runtime metrics
+ *
+ * The snapshot stores the values of all metrics, sorted by name. Metrics are
+ * updated concurrently with the snapshot, the values of different metrics may
+ * thus not be consistent with each other.
+ */
+
+/**
+ * \brief Construct an empty snapshot
+ */
+MetricsSnapshot::MetricsSnapshot()
+	: timestamp(0)
+{
+}
+
+/**
+ * \var MetricsSnapshot::timestamp
+ * \brief The time at which the snapshot has been taken, in nanoseconds, from
+ * the CLOCK_MONOTONIC clock
+ */
+
+/**
+ * \var MetricsSnapshot::metrics
+ * \brief The metric values, sorted by name
+ */
+
+/**
+ * \brief Find a metric value by name
+ * \param[in] name The metric name
+ * \return A pointer to the metric value, or nullptr if no metric named \a name
+ * is present in the snapshot
+ */
+const MetricValue *MetricsSnapshot::find(const std::string &name) const
+{
+	for (const MetricValue &metric : metrics) {
+		if (metric.name == name)
+			return &metric;
+	}
+
+	return nullptr;
+}
+
+/**
+ * \brief Assemble and return a string describing the snapshot
+ *
+ * The string contains one line per metric.
+ *
+ * \return A string describing the MetricsSnapshot
+ */
+const std::string MetricsSnapshot::toString() const
+{
+	std::stringstream ss;
+
+	for (const MetricValue &metric : metrics)
+		ss << metric.toString() << std::endl;
+
+	return ss.str();
+}
+
+/**
+ * \brief Take a snapshot of all runtime metrics
+ *
+ * This function may be called from any thread.
+ *
+ * \return The snapshot
+ */
+MetricsSnapshot metricsSnapshot()
+{
+	return MetricsRegistry::instance()->snapshot();
+}
+
+} /* namespace libcamera */
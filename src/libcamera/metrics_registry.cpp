@@ -0,0 +1,321 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * metrics_registry.cpp - Runtime metrics registry
+ */
+
+#include "metrics_registry.h"
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file metrics_registry.h
+ * \brief Runtime metrics registry
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Metrics)
+
+/**
+ * \class Metric
+ * \brief Base class for runtime metrics
+ *
+ * The Metric class is the base of the counter, gauge and histogram metrics.
+ * Metrics are created and owned by the MetricsRegistry, and stay valid until
+ * the library is unloaded. Components retrieve the metrics they update when
+ * they are created, and update them on their hot paths without locking.
+ *
+ * To avoid contention between threads, the values of counters and histograms
+ * are split in ShardCount shards, each stored in a separate cache line. Every
+ * thread updates its own shard, and the shards are summed when reading the
+ * metric value. Threads share shards when there are more than ShardCount
+ * threads, shards are thus updated with atomic read-modify-write operations.
+ */
+
+/**
+ * \var Metric::ShardCount
+ * \brief The number of shards of counters and histograms
+ */
+
+/**
+ * \var Metric::CacheLineSize
+ * \brief The size of a CPU cache line, used to separate shards
+ */
+
+/**
+ * \brief Construct a metric
+ * \param[in] name The metric name
+ */
+Metric::Metric(const std::string &name)
+	: name_(name)
+{
+}
+
+/**
+ * \fn Metric::name()
+ * \brief Retrieve the metric name
+ * \return The metric name
+ */
+
+/**
+ * \fn Metric::value()
+ * \brief Retrieve the current value of the metric
+ *
+ * This method may be called from any thread.
+ *
+ * \return The metric value
+ */
+
+/**
+ * \brief Retrieve the shard of the calling thread
+ *
+ * Shards are assigned to threads in a round-robin fashion when they first
+ * update a metric.
+ *
+ * \return The shard index of the calling thread
+ */
+unsigned int Metric::shard()
+{
+	static std::atomic<unsigned int> nextShard(0);
+	static thread_local unsigned int shard =
+		nextShard.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+
+	return shard;
+}
+
+/**
+ * \class CounterMetric
+ * \brief A monotonically increasing counter
+ */
+
+/**
+ * \brief Construct a zeroed counter
+ * \param[in] name The counter name
+ */
+CounterMetric::CounterMetric(const std::string &name)
+	: Metric(name)
+{
+	for (Shard &shard : shards_)
+		shard.value.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * \fn CounterMetric::add()
+ * \brief Increment the counter
+ * \param[in] value The increment
+ *
+ * This method may be called from any thread.
+ */
+
+MetricValue CounterMetric::value() const
+{
+	MetricValue value;
+
+	value.name = name();
+	value.type = MetricValue::TypeCounter;
+
+	for (const Shard &shard : shards_)
+		value.value += shard.value.load(std::memory_order_relaxed);
+
+	return value;
+}
+
+/**
+ * \class GaugeMetric
+ * \brief A value that can increase and decrease
+ *
+ * Gauges store a single value, they are meant to be updated at low frequency.
+ */
+
+/**
+ * \brief Construct a zeroed gauge
+ * \param[in] name The gauge name
+ */
+GaugeMetric::GaugeMetric(const std::string &name)
+	: Metric(name), value_(0)
+{
+}
+
+/**
+ * \fn GaugeMetric::set()
+ * \brief Set the gauge value
+ * \param[in] value The new value
+ *
+ * This method may be called from any thread.
+ */
+
+/**
+ * \fn GaugeMetric::add()
+ * \brief Add a signed value to the gauge
+ * \param[in] value The value to add
+ *
+ * This method may be called from any thread.
+ */
+
+MetricValue GaugeMetric::value() const
+{
+	MetricValue value;
+
+	value.name = name();
+	value.type = MetricValue::TypeGauge;
+	value.value = value_.load(std::memory_order_relaxed);
+
+	return value;
+}
+
+/**
+ * \class HistogramMetric
+ * \brief A distribution of values
+ *
+ * Values are counted in the power-of-two buckets of the Histogram class.
+ */
+
+/**
+ * \brief Construct an empty histogram
+ * \param[in] name The histogram name
+ */
+HistogramMetric::HistogramMetric(const std::string &name)
+	: Metric(name)
+{
+	for (Shard &shard : shards_) {
+		for (std::atomic<uint64_t> &count : shard.counts)
+			count.store(0, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * \fn HistogramMetric::add()
+ * \brief Add a value to the histogram
+ * \param[in] value The value
+ *
+ * This method may be called from any thread.
+ */
+
+MetricValue HistogramMetric::value() const
+{
+	std::vector<uint64_t> counts(Histogram::BucketCount, 0);
+
+	for (const Shard &shard : shards_) {
+		for (unsigned int i = 0; i < Histogram::BucketCount; ++i)
+			counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+	}
+
+	MetricValue value;
+
+	value.name = name();
+	value.type = MetricValue::TypeHistogram;
+	value.histogram = Histogram(counts);
+	value.value = value.histogram.total();
+
+	return value;
+}
+
+/**
+ * \class MetricsRegistry
+ * \brief The registry of all runtime metrics
+ *
+ * The MetricsRegistry creates metrics on demand and stores them by name.
+ * Retrieving a metric that already exists returns the existing instance, which
+ * allows components to accumulate values across their instances.
+ */
+
+/**
+ * \brief Retrieve the metrics registry instance
+ * \return The metrics registry instance
+ */
+MetricsRegistry *MetricsRegistry::instance()
+{
+	static MetricsRegistry registry;
+	return &registry;
+}
+
+template<typename T>
+T *MetricsRegistry::get(const std::string &name)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	std::unique_ptr<Metric> &metric = metrics_[name];
+	if (!metric) {
+		metric = utils::make_unique<T>(name);
+		return static_cast<T *>(metric.get());
+	}
+
+	T *typed = dynamic_cast<T *>(metric.get());
+	if (!typed) {
+		/*
+		 * Return a metric that isn't registered to keep the caller
+		 * functional, its value won't be reported.
+		 */
+		LOG(Metrics, Error)
+			<< "Metric " << name << " registered with another type";
+		detached_.push_back(utils::make_unique<T>(name));
+		return static_cast<T *>(detached_.back().get());
+	}
+
+	return typed;
+}
+
+/**
+ * \brief Retrieve or create a counter
+ * \param[in] name The counter name
+ *
+ * If a metric of another type already exists with the same \a name, an error
+ * is logged and a counter that isn't reported in snapshots is returned.
+ *
+ * \return The counter
+ */
+CounterMetric *MetricsRegistry::counter(const std::string &name)
+{
+	return get<CounterMetric>(name);
+}
+
+/**
+ * \brief Retrieve or create a gauge
+ * \param[in] name The gauge name
+ *
+ * If a metric of another type already exists with the same \a name, an error
+ * is logged and a gauge that isn't reported in snapshots is returned.
+ *
+ * \return The gauge
+ */
+GaugeMetric *MetricsRegistry::gauge(const std::string &name)
+{
+	return get<GaugeMetric>(name);
+}
+
+/**
+ * \brief Retrieve or create a histogram
+ * \param[in] name The histogram name
+ *
+ * If a metric of another type already exists with the same \a name, an error
+ * is logged and a histogram that isn't reported in snapshots is returned.
+ *
+ * \return The histogram
+ */
+HistogramMetric *MetricsRegistry::histogram(const std::string &name)
+{
+	return get<HistogramMetric>(name);
+}
+
+/**
+ * \brief Take a snapshot of all registered metrics
+ * \return The snapshot
+ */
+MetricsSnapshot MetricsRegistry::snapshot()
+{
+	MetricsSnapshot snapshot;
+	snapshot.timestamp = utils::monotonic_ns();
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	snapshot.metrics.reserve(metrics_.size());
+	for (const auto &metric : metrics_)
+		snapshot.metrics.push_back(metric.second->value());
+
+	return snapshot;
+}
+
+} /* namespace libcamera */
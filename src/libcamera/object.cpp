@@ -12,6 +12,7 @@
 #include "log.h"
 #include "message.h"
 #include "thread.h"
+#include "utils.h"
 
 /**
  * \file object.h
@@ -20,6 +21,8 @@
 
 namespace libcamera {
 
+LOG_DECLARE_CATEGORY(Message)
+
 /**
  * \class Object
  * \brief Base object to support automatic signal disconnection
@@ -37,9 +40,27 @@ namespace libcamera {
  * object's thread, regardless of whether the signal is emitted in the same or
  * in another thread.
  *
+ * Methods of an object can be called from any thread with invokeMethod(), which
+ * delivers the call to the object's thread according to a ConnectionType and
+ * returns the result through a std::future.
+ *
  * \sa Message, Signal, Thread
  */
 
+/**
+ * \enum ConnectionType
+ * \brief Method invocation type across threads
+ * \var ConnectionTypeAuto
+ * \brief If the caller runs in the object's thread, invoke the method
+ * directly, otherwise queue it to the object's thread
+ * \var ConnectionTypeDirect
+ * \brief Invoke the method immediately in the caller's thread
+ * \var ConnectionTypeQueued
+ * \brief Queue the method to the object's thread and return immediately
+ * \var ConnectionTypeBlocking
+ * \brief Invoke the method in the object's thread and block until it returns
+ */
+
 Object::Object()
 	: pendingMessages_(0)
 {
@@ -48,7 +69,13 @@ Object::Object()
 
 Object::~Object()
 {
-	for (SignalBase *signal : signals_)
+	std::list<SignalBase *> signals;
+	{
+		std::lock_guard<std::mutex> locker(signalsMutex_);
+		signals.swap(signals_);
+	}
+
+	for (SignalBase *signal : signals)
 		signal->disconnect(this);
 
 	if (pendingMessages_)
@@ -94,6 +121,13 @@ void Object::message(Message *msg)
 		break;
 	}
 
+	case Message::InvokeMessage: {
+		InvokeMessage *imsg = static_cast<InvokeMessage *>(msg);
+		imsg->func_();
+		imsg->done_.set_value();
+		break;
+	}
+
 	default:
 		break;
 	}
@@ -123,13 +157,108 @@ void Object::moveToThread(Thread *thread)
 	thread->moveObject(this);
 }
 
+/**
+ * \brief Invoke a function synchronously in the object's thread
+ * \param[in] func The function
+ *
+ * This method runs \a func in the context of the object's thread and blocks
+ * until it returns. The function is run directly when called from the object's
+ * thread, or when the object's thread isn't running. Otherwise it is delivered
+ * through the thread's message queue, in order with the messages and signals
+ * already posted to the object.
+ *
+ * If the message is dropped before being delivered, for instance because the
+ * object's pending messages are removed, \a func is not run and this method
+ * returns immediately. Callers that read results out of \a func shall
+ * thus initialize them to an error value.
+ *
+ * The object's thread shall not be blocked waiting for the caller's thread, as
+ * this would result in a deadlock.
+ */
+void Object::invoke(const std::function<void()> &func)
+{
+	Thread *thread = this->thread();
+	if (thread == Thread::current() || !thread->isRunning()) {
+		func();
+		return;
+	}
+
+	std::unique_ptr<InvokeMessage> msg =
+		utils::make_unique<InvokeMessage>(func);
+	std::future<void> done = msg->done_.get_future();
+
+	postMessage(std::move(msg));
+
+	try {
+		done.get();
+	} catch (const std::future_error &) {
+		LOG(Message, Warning)
+			<< "Invoked function dropped before delivery";
+	}
+}
+
+/**
+ * \fn Object::invokeMethod()
+ * \brief Invoke a method of the object in the object's thread
+ * \param[in] func The method to invoke
+ * \param[in] type The invocation type
+ * \param[in] args The arguments to pass to the method
+ *
+ * This method invokes \a func on the object with \a args, in the thread and
+ * at the time specified by \a type. The arguments are copied, and stay valid
+ * until the method has been invoked. Queued invocations are delivered through
+ * the thread's message queue, in order with the messages and signals already
+ * posted to the object, and don't require any locking in the method.
+ *
+ * Blocking invocations are run directly when called from the object's thread
+ * or when the object's thread isn't running, as for invoke(). Queued
+ * invocations are only delivered when the object's thread runs its event
+ * loop.
+ *
+ * The value returned by \a func, or the exception it throws, is stored in the
+ * returned future. If the object is destroyed before a queued invocation is
+ * delivered, the method isn't invoked and the future reports a broken promise.
+ *
+ * \return A future holding the return value of the method
+ */
+
+void Object::invokeFunction(const std::function<void()> &func,
+			    ConnectionType type)
+{
+	switch (type) {
+	case ConnectionTypeAuto:
+		if (thread() == Thread::current()) {
+			func();
+			break;
+		}
+
+		postMessage(utils::make_unique<InvokeMessage>(func));
+		break;
+
+	case ConnectionTypeDirect:
+		func();
+		break;
+
+	case ConnectionTypeQueued:
+		postMessage(utils::make_unique<InvokeMessage>(func));
+		break;
+
+	case ConnectionTypeBlocking:
+		invoke(func);
+		break;
+	}
+}
+
 void Object::connect(SignalBase *signal)
 {
+	std::lock_guard<std::mutex> locker(signalsMutex_);
 	signals_.push_back(signal);
 }
 
 void Object::disconnect(SignalBase *signal)
 {
+	std::lock_guard<std::mutex> locker(signalsMutex_);
+
 	for (auto iter = signals_.begin(); iter != signals_.end(); ) {
 		if (*iter == signal)
 			iter = signals_.erase(iter);
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * object_arena.cpp - Arena for frequently allocated objects
+ */
+
+#include "object_arena.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+/**
+ * \file object_arena.h
+ * \brief Arena for frequently allocated objects
+ */
+
+namespace libcamera {
+
+/*
+ * Every object is preceded by a block header that identifies the arena it has
+ * been allocated from, or no arena for objects allocated from the heap. The
+ * header is aligned to keep the object suitably aligned for any type.
+ */
+struct alignas(alignof(std::max_align_t)) ObjectArena::Block {
+	ObjectArena *arena;
+	Block *next;
+	size_t size;
+};
+
+/**
+ * \class ObjectArena
+ * \brief Recycle the memory of frequently allocated objects
+ *
+ * Objects such as requests and buffers are allocated and freed for every
+ * frame. When allocated from the global heap, they fragment the memory of
+ * long-running processes, and contend on the allocator lock with all other
+ * threads. The ObjectArena class instead carves objects from chunks of memory
+ * it owns, and recycles the memory of freed objects for objects of the same
+ * size through free lists. Memory is only returned to the system when the
+ * arena is destroyed.
+ *
+ * The arena is meant to be used from the operator new and operator delete of
+ * the classes whose instances it allocates. Objects are allocated with
+ * allocate() from an arena, or from the heap when no arena is given, and freed
+ * with release(), which identifies the arena the object belongs to. Objects
+ * allocated from an arena can thus be freed with the delete operator by code
+ * that doesn't know about the arena.
+ *
+ * Arenas are shared with std::shared_ptr<>, and are created with create().
+ * An arena stays alive until all the objects allocated from it are released,
+ * even if its owner releases its reference first.
+ *
+ * The arena is thread-safe. Sharing an arena only between the objects of a
+ * single camera avoids contention between cameras.
+ */
+
+constexpr unsigned int ObjectArena::MinChunkBlocks;
+
+ObjectArena::ObjectArena()
+	: allocated_(0)
+{
+}
+
+/**
+ * \brief Create an empty arena
+ * \return The arena
+ */
+std::shared_ptr<ObjectArena> ObjectArena::create()
+{
+	return std::shared_ptr<ObjectArena>(new ObjectArena());
+}
+
+/**
+ * \brief Reserve memory for objects of a given size
+ * \param[in] size The size of the objects
+ * \param[in] count The number of objects
+ *
+ * Ensure that the arena can hold at least \a count objects of \a size bytes
+ * without allocating memory. The arena grows on demand when more objects are
+ * allocated, reserving memory upfront moves the allocation cost out of the
+ * capture path.
+ */
+void ObjectArena::reserve(size_t size, unsigned int count)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	FreeList *list = freeList(size);
+	if (list->count < count)
+		grow(list, count - list->count);
+}
+
+/**
+ * \brief Retrieve the number of objects of a given size the arena can hold
+ * \param[in] size The size of the objects
+ * \return The number of objects of \a size bytes, allocated or free
+ */
+size_t ObjectArena::capacity(size_t size)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	return freeList(size)->count;
+}
+
+/**
+ * \brief Allocate memory for an object
+ * \param[in] arena The arena to allocate from, or nullptr for the heap
+ * \param[in] size The size of the object
+ * \return A pointer to memory suitably aligned for an object of \a size bytes
+ */
+void *ObjectArena::allocate(ObjectArena *arena, size_t size)
+{
+	if (!arena) {
+		Block *block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+		block->arena = nullptr;
+		block->size = size;
+		return block + 1;
+	}
+
+	std::lock_guard<std::mutex> locker(arena->mutex_);
+
+	FreeList *list = arena->freeList(size);
+	if (!list->head)
+		arena->grow(list, std::max(MinChunkBlocks, list->count));
+
+	Block *block = list->head;
+	list->head = block->next;
+
+	/* Keep the arena alive as long as it has allocated objects. */
+	if (!arena->allocated_++)
+		arena->self_ = arena->shared_from_this();
+
+	return block + 1;
+}
+
+/**
+ * \brief Release memory allocated with allocate()
+ * \param[in] ptr The memory to release
+ *
+ * Memory allocated from an arena is returned to the arena for later reuse.
+ * Memory allocated from the heap is freed.
+ */
+void ObjectArena::release(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	Block *block = static_cast<Block *>(ptr) - 1;
+	ObjectArena *arena = block->arena;
+	if (!arena) {
+		::operator delete(block);
+		return;
+	}
+
+	/* The arena may be destroyed when the last reference is dropped. */
+	std::shared_ptr<ObjectArena> self;
+
+	std::lock_guard<std::mutex> locker(arena->mutex_);
+
+	FreeList *list = arena->freeList(block->size);
+	block->next = list->head;
+	list->head = block;
+
+	if (!--arena->allocated_)
+		self = std::move(arena->self_);
+}
+
+ObjectArena::FreeList *ObjectArena::freeList(size_t size)
+{
+	for (FreeList &list : freeLists_) {
+		if (list.size == size)
+			return &list;
+	}
+
+	freeLists_.push_back({ size, nullptr, 0 });
+	return &freeLists_.back();
+}
+
+void ObjectArena::grow(FreeList *list, unsigned int count)
+{
+	const size_t stride = sizeof(Block)
+			    + (list->size + alignof(Block) - 1) / alignof(Block)
+			    * alignof(Block);
+
+	chunks_.emplace_back(new char[stride * count]);
+	char *mem = chunks_.back().get();
+
+	for (unsigned int i = 0; i < count; ++i) {
+		Block *block = reinterpret_cast<Block *>(mem + stride * i);
+		block->arena = this;
+		block->size = list->size;
+		block->next = list->head;
+		list->head = block;
+	}
+
+	list->count += count;
+}
+
+} /* namespace libcamera */
@@ -6,21 +6,34 @@
  */
 
 #include <algorithm>
+#include <functional>
+#include <future>
 #include <iomanip>
+#include <limits.h>
 #include <memory>
+#include <queue>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 #include <linux/media-bus-format.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/ipa/ipa_interface.h>
+#include <libcamera/ipa/ipu3.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "camera_sensor.h"
+#include "delayed_controls.h"
 #include "device_enumerator.h"
+#include "dma_buf_allocator.h"
+#include "ipa_manager.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
+#include "resource_manager.h"
 #include "utils.h"
 #include "v4l2_controls.h"
 #include "v4l2_subdevice.h"
@@ -30,14 +43,37 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPU3)
 
+/*
+ * Hardware resources shared by the cameras. The two ImgU pipes are processed
+ * by the same ISP, whose throughput is expressed in input pixels per second.
+ * The CIO2 and the ImgU transfer the raw and processed frames to and from
+ * memory, whose bandwidth is expressed in bytes per second.
+ *
+ * \todo Measure the capacities on the hardware, the values are estimates.
+ */
+static const char *const IPU3ResourceImgU = "imgu";
+static const char *const IPU3ResourceMemory = "memory";
+
+static constexpr uint64_t IPU3_IMGU_PIXEL_RATE = 600000000ULL;
+static constexpr uint64_t IPU3_MEMORY_BANDWIDTH = 3000000000ULL;
+
 class ImgUDevice
 {
 public:
 	static constexpr unsigned int PAD_INPUT = 0;
+	static constexpr unsigned int PAD_PARAM = 1;
 	static constexpr unsigned int PAD_OUTPUT = 2;
 	static constexpr unsigned int PAD_VF = 3;
 	static constexpr unsigned int PAD_STAT = 4;
 
+	/*
+	 * Unused outputs are fed with a few minimal size buffers.
+	 * \todo Verify the minimum viewfinder size supported by the hardware.
+	 */
+	static constexpr unsigned int DUMMY_BUFFER_COUNT = 2;
+	static constexpr unsigned int VF_MIN_WIDTH = 64;
+	static constexpr unsigned int VF_MIN_HEIGHT = 32;
+
 	/* ImgU output descriptor: group data specific to an ImgU output. */
 	struct ImgUOutput {
 		V4L2VideoDevice *dev;
@@ -46,11 +82,19 @@ public:
 		BufferPool *pool;
 	};
 
+	/* Intermediate frame sizes of the ImgU processing pipe. */
+	struct PipeConfig {
+		Size iif;
+		Size bds;
+		Size gdc;
+	};
+
 	ImgUDevice()
 		: imgu_(nullptr), input_(nullptr)
 	{
 		output_.dev = nullptr;
 		viewfinder_.dev = nullptr;
+		param_.dev = nullptr;
 		stat_.dev = nullptr;
 	}
 
@@ -60,14 +104,20 @@ public:
 		delete input_;
 		delete output_.dev;
 		delete viewfinder_.dev;
+		delete param_.dev;
 		delete stat_.dev;
 	}
 
+	static PipeConfig calculatePipeConfig(const Size &input,
+					      const Size &output,
+					      const Size &viewfinder);
+
 	int init(MediaDevice *media, unsigned int index);
-	int configureInput(const Size &size,
+	int configureInput(const PipeConfig &pipe,
 			   V4L2DeviceFormat *inputFormat);
 	int configureOutput(ImgUOutput *output,
 			    const StreamConfiguration &cfg);
+	int setInputCrop(const Rectangle &crop);
 
 	int importInputBuffers(BufferPool *pool);
 	int importOutputBuffers(ImgUOutput *output, BufferPool *pool);
@@ -77,10 +127,7 @@ public:
 	int start();
 	int stop();
 
-	int linkSetup(const std::string &source, unsigned int sourcePad,
-		      const std::string &sink, unsigned int sinkPad,
-		      bool enable);
-	int enableLinks(bool enable);
+	int enableLinks(MediaLinkTransaction *links, bool enable);
 
 	unsigned int index_;
 	std::string name_;
@@ -90,10 +137,15 @@ public:
 	V4L2VideoDevice *input_;
 	ImgUOutput output_;
 	ImgUOutput viewfinder_;
+	ImgUOutput param_;
 	ImgUOutput stat_;
-	/* \todo Add param video device for 3A tuning */
+
+	/* Pipe configuration and input feeder crop applied to the ImgU. */
+	PipeConfig pipe_;
+	Rectangle crop_;
 
 	BufferPool vfPool_;
+	BufferPool paramPool_;
 	BufferPool statPool_;
 	BufferPool outPool_;
 };
@@ -102,9 +154,11 @@ class CIO2Device
 {
 public:
 	static constexpr unsigned int CIO2_BUFFER_COUNT = 4;
+	static constexpr unsigned int CIO2_MIN_QUEUED = 2;
 
 	CIO2Device()
-		: output_(nullptr), csi2_(nullptr), sensor_(nullptr)
+		: output_(nullptr), csi2_(nullptr), sensor_(nullptr),
+		  bufferCount_(CIO2_BUFFER_COUNT), frameStartEvents_(false)
 	{
 	}
 
@@ -116,13 +170,14 @@ public:
 	}
 
 	int init(const MediaDevice *media, unsigned int index);
-	int configure(const Size &size,
+	int configure(const V4L2SubdeviceFormat &sensorFormat,
 		      V4L2DeviceFormat *outputFormat);
 
 	BufferPool *exportBuffers();
 	void freeBuffers();
 
-	int start(std::vector<std::unique_ptr<Buffer>> *buffer);
+	int queueBuffers(std::vector<std::unique_ptr<Buffer>> *buffers);
+	int start();
 	int stop();
 
 	static int mediaBusToFormat(unsigned int code);
@@ -132,40 +187,173 @@ public:
 	CameraSensor *sensor_;
 
 	BufferPool pool_;
+	unsigned int bufferCount_;
+	/* True if the CSI-2 receiver reports frame start events. */
+	bool frameStartEvents_;
+};
+
+/*
+ * Most V4L2 ioctls block until the driver completes them. The IPU3JobSet class
+ * runs operations that target independent devices concurrently, to shorten the
+ * configuration, buffer allocation and start-up sequences, and times each of
+ * them to identify the steps that delay the first frame.
+ *
+ * Jobs run in separate threads, they shall thus not queue buffers or enable
+ * event notifiers, which must be done from the pipeline handler thread.
+ */
+class IPU3JobSet
+{
+public:
+	void add(const std::string &name, std::function<int()> func)
+	{
+		jobs_.push_back({ name, func, 0 });
+	}
+
+	int run(const std::string &operation);
+
+private:
+	struct Job {
+		std::string name;
+		std::function<int()> func;
+		uint64_t duration;
+	};
+
+	static int runJob(Job *job);
+
+	std::vector<Job> jobs_;
+};
+
+class RawBufferRing
+{
+public:
+	enum State {
+		Capturing,
+		Waiting,
+		Processing,
+		StateCount,
+	};
+
+	RawBufferRing()
+		: head_(0), counts_{}
+	{
+	}
+
+	void reset(std::vector<std::unique_ptr<Buffer>> buffers);
+	void clear();
+
+	void setState(Buffer *buffer, State state);
+	void push(Buffer *buffer);
+	Buffer *pop(State state);
+
+	unsigned int size() const { return buffers_.size(); }
+	unsigned int count(State state) const { return counts_[state]; }
+	std::string toString() const;
+
+private:
+	std::vector<std::unique_ptr<Buffer>> buffers_;
+	std::vector<State> states_;
+	/* Circular FIFO of the waiting buffers, starting at head_. */
+	std::vector<Buffer *> waiting_;
+	unsigned int head_;
+	unsigned int counts_[StateCount];
 };
 
 class IPU3Stream : public Stream
 {
 public:
 	IPU3Stream()
-		: active_(false), device_(nullptr)
+		: active_(false), device_(nullptr), decimation_(1), nextFrame_(0)
 	{
 	}
 
 	bool active_;
 	std::string name_;
 	ImgUDevice::ImgUOutput *device_;
+
+	/* Produce one frame every decimation_ frames, starting at nextFrame_. */
+	unsigned int decimation_;
+	unsigned int nextFrame_;
 };
 
 class IPU3CameraData : public CameraData
 {
 public:
 	IPU3CameraData(PipelineHandler *pipe)
-		: CameraData(pipe)
+		: CameraData(pipe), imgu_(nullptr), altImgu_(nullptr),
+		  nextImgu_(nullptr), frameCount_(0), resources_(nullptr)
 	{
 	}
 
+	std::vector<ImgUDevice *> imgus() const;
+	ImgUDevice::ImgUOutput *imguOutput(ImgUDevice *imgu,
+					   const IPU3Stream *stream);
+
 	void imguOutputBufferReady(Buffer *buffer);
 	void imguInputBufferReady(Buffer *buffer);
 	void cio2BufferReady(Buffer *buffer);
+	void cio2FrameStart(uint32_t sequence, uint64_t timestamp);
+
+	void imguParamBufferReady(Buffer *buffer);
+	void imguStatBufferReady(Buffer *buffer);
+	void queueFrameAction(unsigned int frame,
+			      const IPAOperationData &action);
+
+	void processRawFrame();
+	void resetRawPipeline();
+
+	void mapMetaBuffers();
+	void unmapMetaBuffers();
+	void queueStatBuffers();
+
+	Rectangle adjustCrop(const Rectangle &crop) const;
 
 	CIO2Device cio2_;
 	ImgUDevice *imgu_;
+	/* Second ImgU processing alternate frames, or nullptr if unused. */
+	ImgUDevice *altImgu_;
+	ImgUDevice *nextImgu_;
 
 	IPU3Stream outStream_;
 	IPU3Stream vfStream_;
+	/* Number of frames requested from the ImgU since the camera started. */
+	unsigned int frameCount_;
 
-	std::vector<std::unique_ptr<Buffer>> rawBuffers_;
+	/*
+	 * Scaler crop region requested for the camera, and the bounds of the
+	 * region for the current configuration.
+	 */
+	Rectangle crop_;
+	Size inputSize_;
+	Size minCropSize_;
+
+	RawBufferRing rawBuffers_;
+	/* ImgU selected for each queued request waiting for a raw frame. */
+	std::queue<ImgUDevice *> pendingRequests_;
+
+	std::unique_ptr<IPAInterface> ipa_;
+	std::unique_ptr<DelayedControls> delayedCtrls_;
+
+	/*
+	 * Parameters and statistics buffers of all the ImgU instances, shared
+	 * with the IPA. The IPA buffer ID of each buffer is its index plus one.
+	 */
+	struct MetaBuffer {
+		ImgUDevice *imgu;
+		V4L2VideoDevice *dev;
+		std::unique_ptr<Buffer> buffer;
+		/* Raw frame waiting for the parameters to be filled. */
+		Buffer *raw;
+		/* The buffer is in use by the ImgU or the IPA. */
+		bool busy;
+	};
+
+	std::vector<MetaBuffer> metaBuffers_;
+
+	/* Resources shared with the other cameras of the pipeline handler. */
+	const ResourceManager *resources_;
+
+private:
+	MetaBuffer *findMetaBuffer(Buffer *buffer);
 };
 
 class IPU3CameraConfiguration : public CameraConfiguration
@@ -178,10 +366,21 @@ public:
 	const V4L2SubdeviceFormat &sensorFormat() { return sensorFormat_; }
 	const std::vector<const IPU3Stream *> &streams() { return streams_; }
 
+	ResourceManager::Usage resourceUsage() const;
+
 private:
 	static constexpr unsigned int IPU3_BUFFER_COUNT = 4;
+	static constexpr unsigned int IPU3_MIN_BUFFER_COUNT = 2;
+	static constexpr unsigned int IPU3_MAX_BUFFER_COUNT = 32;
+	/* \todo Account for the frame duration instead of a nominal rate. */
+	static constexpr unsigned int IPU3_FRAME_RATE = 30;
 
+	Status adjust();
 	void adjustStream(StreamConfiguration &cfg, bool scale);
+	Status fitResources(const std::vector<unsigned int> &mbusCodes);
+	void planConfiguration(const std::vector<unsigned int> &mbusCodes);
+	uint64_t planCost(const Size &sensorSize,
+			  const std::vector<const IPU3Stream *> &streams) const;
 
 	/*
 	 * The IPU3CameraData instance is guaranteed to be valid as long as the
@@ -209,6 +408,7 @@ public:
 	CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) override;
 	int configure(Camera *camera, CameraConfiguration *config) override;
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
 
 	int allocateBuffers(Camera *camera,
 			    const std::set<Stream *> &streams) override;
@@ -219,7 +419,9 @@ public:
 	void stop(Camera *camera) override;
 
 	int queueRequest(Camera *camera, Request *request) override;
+	MemoryUsage memoryUsage(const Camera *camera) override;
 
+	static std::vector<DeviceMatch> deviceMatches();
 	bool match(DeviceEnumerator *enumerator) override;
 
 private:
@@ -229,6 +431,9 @@ private:
 			PipelineHandler::cameraData(camera));
 	}
 
+	int configureImgU(IPU3CameraData *data, ImgUDevice *imgu,
+			  IPU3CameraConfiguration *config,
+			  const V4L2DeviceFormat &cio2Format);
 	int registerCameras();
 
 	ImgUDevice imgu0_;
@@ -247,8 +452,9 @@ IPU3CameraConfiguration::IPU3CameraConfiguration(Camera *camera,
 
 void IPU3CameraConfiguration::adjustStream(StreamConfiguration &cfg, bool scale)
 {
-	/* The only pixel format the driver supports is NV12. */
+	/* The only pixel format the driver supports is linear NV12. */
 	cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+	cfg.modifier = 0;
 
 	if (scale) {
 		/*
@@ -290,28 +496,190 @@ void IPU3CameraConfiguration::adjustStream(StreamConfiguration &cfg, bool scale)
 		cfg.size.height &= ~3;
 	}
 
-	cfg.bufferCount = IPU3_BUFFER_COUNT;
+	cfg.minBufferCount = IPU3_MIN_BUFFER_COUNT;
+	cfg.maxBufferCount = IPU3_MAX_BUFFER_COUNT;
+
+	if (!cfg.decimation)
+		cfg.decimation = 1;
+
+	if (!cfg.bufferCount)
+		cfg.bufferCount = IPU3_BUFFER_COUNT;
+	else if (cfg.bufferCount < IPU3_MIN_BUFFER_COUNT)
+		cfg.bufferCount = IPU3_MIN_BUFFER_COUNT;
+	else if (cfg.bufferCount > IPU3_MAX_BUFFER_COUNT)
+		cfg.bufferCount = IPU3_MAX_BUFFER_COUNT;
 }
 
 CameraConfiguration::Status IPU3CameraConfiguration::validate()
+{
+	return data_->configCache_.validate(this, &IPU3CameraConfiguration::adjust);
+}
+
+CameraConfiguration::Status IPU3CameraConfiguration::adjust()
 {
 	const CameraSensor *sensor = data_->cio2_.sensor_;
+	const std::vector<unsigned int> mbusCodes = {
+		MEDIA_BUS_FMT_SBGGR10_1X10,
+		MEDIA_BUS_FMT_SGBRG10_1X10,
+		MEDIA_BUS_FMT_SGRBG10_1X10,
+		MEDIA_BUS_FMT_SRGGB10_1X10,
+	};
 	Status status = Valid;
 
 	if (config_.empty())
 		return Invalid;
 
+	/* The video devices only capture to driver or dmabuf memory. */
+	for (const StreamConfiguration &cfg : config_) {
+		if (cfg.memoryType == UserPtrMemory)
+			return Invalid;
+	}
+
 	/* Cap the number of entries to the available streams. */
 	if (config_.size() > 2) {
 		config_.resize(2);
 		status = Adjusted;
 	}
 
+	planConfiguration(mbusCodes);
+	if (!sensorFormat_.size.width || !sensorFormat_.size.height)
+		sensorFormat_.size = sensor->resolution();
+
+	/* Verify and update all configuration entries. */
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		StreamConfiguration &cfg = config_[i];
+		const unsigned int pixelFormat = cfg.pixelFormat;
+		const uint64_t modifier = cfg.modifier;
+		const Size size = cfg.size;
+		const unsigned int bufferCount = cfg.bufferCount;
+		const unsigned int decimation = cfg.decimation;
+		bool scale = streams_[i] == &data_->vfStream_;
+
+		adjustStream(config_[i], scale);
+
+		if (cfg.pixelFormat != pixelFormat || cfg.modifier != modifier ||
+		    cfg.size != size || cfg.bufferCount != bufferCount ||
+		    cfg.decimation != decimation) {
+			LOG(IPU3, Debug)
+				<< "Stream " << i << " configuration adjusted to "
+				<< cfg;
+			status = Adjusted;
+		}
+	}
+
+	switch (fitResources(mbusCodes)) {
+	case Valid:
+		break;
+	case Adjusted:
+		status = Adjusted;
+		break;
+	case Invalid:
+		return Invalid;
+	}
+
+	return status;
+}
+
+/*
+ * Compute the resources used by the configuration. The ImgU processes the raw
+ * frames, written to memory by the CIO2 with 25 pixels packed in 32 bytes and
+ * read back by the ImgU, and writes the NV12 frames of all streams.
+ */
+ResourceManager::Usage IPU3CameraConfiguration::resourceUsage() const
+{
+	const Size &input = sensorFormat_.size;
+	const uint64_t pixels = static_cast<uint64_t>(input.width) * input.height;
+	uint64_t bytes = 2 * pixels * 32 / 25;
+
+	for (const StreamConfiguration &cfg : config_)
+		bytes += static_cast<uint64_t>(cfg.size.width) * cfg.size.height * 3 / 2;
+
+	return {
+		{ IPU3ResourceImgU, pixels * IPU3_FRAME_RATE },
+		{ IPU3ResourceMemory, bytes * IPU3_FRAME_RATE },
+	};
+}
+
+/*
+ * Fit the configuration in the resources left available by the other cameras
+ * of the pipeline handler, by selecting smaller sensor modes and shrinking the
+ * streams accordingly, preserving their aspect ratio. The ImgU can't upscale,
+ * the streams are bounded by the sensor size.
+ */
+CameraConfiguration::Status
+IPU3CameraConfiguration::fitResources(const std::vector<unsigned int> &mbusCodes)
+{
+	if (data_->resources_->fits(resourceUsage(), camera_.get()))
+		return Valid;
+
+	const CameraSensor *sensor = data_->cio2_.sensor_;
+	std::vector<Size> sizes = sensor->sizes();
+	std::sort(sizes.begin(), sizes.end(), [](const Size &a, const Size &b) {
+		return static_cast<uint64_t>(a.width) * a.height >
+		       static_cast<uint64_t>(b.width) * b.height;
+	});
+
+	const Size current = sensorFormat_.size;
+
+	for (const Size &size : sizes) {
+		if (static_cast<uint64_t>(size.width) * size.height >=
+		    static_cast<uint64_t>(current.width) * current.height)
+			continue;
+
+		sensorFormat_ = sensor->getFormat(mbusCodes, size);
+
+		for (unsigned int i = 0; i < config_.size(); ++i) {
+			StreamConfiguration &cfg = config_[i];
+			bool scale = streams_[i] == &data_->vfStream_;
+
+			if (cfg.size.width > size.width) {
+				cfg.size.height = cfg.size.height * size.width
+						/ cfg.size.width;
+				cfg.size.width = size.width;
+			}
+
+			if (cfg.size.height > size.height) {
+				cfg.size.width = cfg.size.width * size.height
+					       / cfg.size.height;
+				cfg.size.height = size.height;
+			}
+
+			adjustStream(cfg, scale);
+		}
+
+		if (data_->resources_->fits(resourceUsage(), camera_.get())) {
+			LOG(IPU3, Debug)
+				<< "Sensor size reduced to " << size.toString()
+				<< " to fit in the available resources";
+			return Adjusted;
+		}
+	}
+
+	LOG(IPU3, Error)
+		<< "Configuration doesn't fit in the resources available";
+
+	return Invalid;
+}
+
+/*
+ * Select the sensor format and assign the ImgU output and viewfinder streams
+ * to the configuration entries, by evaluating all combinations of sensor modes
+ * large enough for the requested sizes and of stream assignments against the
+ * cost model implemented by planCost(), and picking the cheapest one.
+ *
+ * The ImgU input feeder only crops small margins of the input frames (see
+ * ImgUDevice::calculatePipeConfig()), the only input candidates are thus the
+ * sensor modes.
+ */
+void IPU3CameraConfiguration::planConfiguration(const std::vector<unsigned int> &mbusCodes)
+{
+	const CameraSensor *sensor = data_->cio2_.sensor_;
+
 	/*
-	 * Select the sensor format by collecting the maximum width and height
-	 * and picking the closest larger match, as the IPU3 can downscale
-	 * only. If no resolution is requested for any stream, or if no sensor
-	 * resolution is large enough, pick the largest one.
+	 * The IPU3 can downscale only, consider the sensor modes at least as
+	 * large as all requested sizes. If no resolution is requested for any
+	 * stream, or if no sensor resolution is large enough, use the largest
+	 * one.
 	 */
 	Size size = {};
 
@@ -322,64 +690,99 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 			size.height = cfg.size.height;
 	}
 
-	if (!size.width || !size.height)
-		size = sensor->resolution();
+	std::vector<Size> sensorSizes;
+	if (size.width && size.height) {
+		for (const Size &sensorSize : sensor->sizes()) {
+			if (sensorSize.width >= size.width &&
+			    sensorSize.height >= size.height)
+				sensorSizes.push_back(sensorSize);
+		}
+	}
 
-	sensorFormat_ = sensor->getFormat({ MEDIA_BUS_FMT_SBGGR10_1X10,
-					    MEDIA_BUS_FMT_SGBRG10_1X10,
-					    MEDIA_BUS_FMT_SGRBG10_1X10,
-					    MEDIA_BUS_FMT_SRGGB10_1X10 },
-					  size);
-	if (!sensorFormat_.size.width || !sensorFormat_.size.height)
-		sensorFormat_.size = sensor->resolution();
+	if (sensorSizes.empty())
+		sensorSizes.push_back(sensor->resolution());
+
+	std::vector<std::vector<const IPU3Stream *>> assignments;
+	if (config_.size() == 1)
+		assignments = { { &data_->outStream_ },
+				{ &data_->vfStream_ } };
+	else
+		assignments = { { &data_->outStream_, &data_->vfStream_ },
+				{ &data_->vfStream_, &data_->outStream_ } };
+
+	uint64_t bestCost = UINT64_MAX;
+	Size bestSize;
+
+	for (const Size &sensorSize : sensorSizes) {
+		for (const std::vector<const IPU3Stream *> &streams : assignments) {
+			uint64_t cost = planCost(sensorSize, streams);
+			if (cost >= bestCost)
+				continue;
+
+			bestCost = cost;
+			bestSize = sensorSize;
+			streams_ = streams;
+		}
+	}
 
-	/*
-	 * Verify and update all configuration entries, and assign a stream to
-	 * each of them. The viewfinder stream can scale, while the output
-	 * stream can crop only, so select the output stream when the requested
-	 * resolution is equal to the sensor resolution, and the viewfinder
-	 * stream otherwise.
-	 */
-	std::set<const IPU3Stream *> availableStreams = {
-		&data_->outStream_,
-		&data_->vfStream_,
-	};
+	sensorFormat_ = sensor->getFormat(mbusCodes, bestSize);
 
-	streams_.clear();
-	streams_.reserve(config_.size());
+	for (unsigned int i = 0; i < streams_.size(); ++i)
+		LOG(IPU3, Debug)
+			<< "Assigned '" << streams_[i]->name_ << "' to stream "
+			<< i << " with sensor size " << bestSize.toString()
+			<< " (cost " << bestCost << ")";
+}
 
-	for (unsigned int i = 0; i < config_.size(); ++i) {
-		StreamConfiguration &cfg = config_[i];
-		const unsigned int pixelFormat = cfg.pixelFormat;
-		const Size size = cfg.size;
-		const IPU3Stream *stream;
+/*
+ * Estimate the cost of a configuration candidate, in pixels transferred per
+ * frame. The CIO2 writes the raw frames to memory and the ImgU reads them back,
+ * and the ImgU then writes the processed frames. The output stream can't scale
+ * and thus produces frames of the sensor size.
+ *
+ * The viewfinder stream scales the input frames, and crops them when the
+ * aspect ratios differ, losing part of the field of view. The lost pixels are
+ * weighted to favour sensor modes that match the requested aspect ratio.
+ *
+ * Candidates that would adjust the requested size of a stream are penalised to
+ * be picked only when no candidate honours all requested sizes.
+ */
+uint64_t IPU3CameraConfiguration::planCost(const Size &sensorSize,
+					   const std::vector<const IPU3Stream *> &streams) const
+{
+	static constexpr uint64_t fieldOfViewWeight = 4;
+	static constexpr uint64_t adjustPenalty = 16;
 
-		if (cfg.size == sensorFormat_.size)
-			stream = &data_->outStream_;
-		else
-			stream = &data_->vfStream_;
+	const uint64_t sensorArea = static_cast<uint64_t>(sensorSize.width)
+				  * sensorSize.height;
+	uint64_t cost = 2 * sensorArea;
 
-		if (availableStreams.find(stream) == availableStreams.end())
-			stream = *availableStreams.begin();
+	for (unsigned int i = 0; i < streams.size(); ++i) {
+		const Size &size = config_[i].size;
 
-		LOG(IPU3, Debug)
-			<< "Assigned '" << stream->name_ << "' to stream " << i;
+		if (streams[i] == &data_->outStream_) {
+			cost += sensorArea;
+			if (size.width && size.height && size != sensorSize)
+				cost += adjustPenalty * sensorArea;
+			continue;
+		}
 
-		bool scale = stream == &data_->vfStream_;
-		adjustStream(config_[i], scale);
+		if (!size.width || !size.height)
+			continue;
 
-		if (cfg.pixelFormat != pixelFormat || cfg.size != size) {
-			LOG(IPU3, Debug)
-				<< "Stream " << i << " configuration adjusted to "
-				<< cfg.toString();
-			status = Adjusted;
-		}
+		cost += static_cast<uint64_t>(size.width) * size.height;
 
-		streams_.push_back(stream);
-		availableStreams.erase(stream);
+		/* Compare the aspect ratios with integer arithmetic. */
+		uint64_t sensorRatio = static_cast<uint64_t>(sensorSize.width) * size.height;
+		uint64_t streamRatio = static_cast<uint64_t>(size.width) * sensorSize.height;
+		uint64_t lost = sensorArea
+			      - sensorArea * std::min(sensorRatio, streamRatio)
+			      / std::max(sensorRatio, streamRatio);
+
+		cost += fieldOfViewWeight * lost;
 	}
 
-	return status;
+	return cost;
 }
 
 PipelineHandlerIPU3::PipelineHandlerIPU3(CameraManager *manager)
@@ -460,9 +863,7 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 			 * alignment constraints.
 			 */
 			const Size &res = data->cio2_.sensor_->resolution();
-			unsigned int width = std::min(1280U, res.width);
-			unsigned int height = std::min(720U, res.height);
-			cfg.size = { width & ~7, height & ~3 };
+			cfg.size = res.boundedTo({ 1280, 720 }).alignedDownTo(8, 4);
 
 			break;
 		}
@@ -496,7 +897,7 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	IPU3Stream *outStream = &data->outStream_;
 	IPU3Stream *vfStream = &data->vfStream_;
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
+	IPU3JobSet jobs;
 	int ret;
 
 	/*
@@ -525,34 +926,40 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	 * pre-configure all the camera and then start/stop them alternatively
 	 * without going through any re-configuration (a sequence that is
 	 * allowed by the Camera state machine) would now fail on the IPU3.
+	 *
+	 * The other camera may however be configured and running concurrently
+	 * on the other ImgU pipe. Only disable the links when no other camera
+	 * holds resources of the ImgU.
 	 */
-	ret = imguMediaDev_->disableLinks();
-	if (ret)
-		return ret;
+	ResourceManager::Usage usage = config->resourceUsage();
+	if (!resources_.fits(usage, camera)) {
+		LOG(IPU3, Error)
+			<< "Configuration exceeds the resources available";
+		return -EBUSY;
+	}
+
+	MediaLinkTransaction links(imguMediaDev_);
+	if (!resources_.inUse(camera))
+		links.disableAll();
 
 	/*
 	 * \todo: Enable links selectively based on the requested streams.
 	 * As of now, enable all links unconditionally.
 	 */
-	ret = data->imgu_->enableLinks(true);
-	if (ret)
-		return ret;
+	for (ImgUDevice *imgu : data->imgus()) {
+		ret = imgu->enableLinks(&links, true);
+		if (ret)
+			return ret;
+	}
 
 	/*
-	 * Pass the requested stream size to the CIO2 unit and get back the
-	 * adjusted format to be propagated to the ImgU output devices.
+	 * Only the links whose state changes are set up, reconfiguring a camera
+	 * with the same ImgU instances doesn't touch the media graph.
 	 */
-	const Size &sensorSize = config->sensorFormat().size;
-	V4L2DeviceFormat cio2Format = {};
-	ret = cio2->configure(sensorSize, &cio2Format);
-	if (ret)
-		return ret;
-
-	ret = imgu->configureInput(sensorSize, &cio2Format);
+	ret = links.commit();
 	if (ret)
 		return ret;
 
-	/* Apply the format to the configured streams output devices. */
 	outStream->active_ = false;
 	vfStream->active_ = false;
 
@@ -567,38 +974,267 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 		StreamConfiguration &cfg = (*config)[i];
 
 		stream->active_ = true;
+		stream->decimation_ = cfg.decimation;
 		cfg.setStream(stream);
+	}
 
-		ret = imgu->configureOutput(stream->device_, cfg);
-		if (ret)
-			return ret;
+	/*
+	 * The ImgU processes a frame only when a buffer is queued to all its
+	 * outputs. Frames skipped on decimated streams are written to spare
+	 * buffers, queued explicitly when requests are queued. Each request
+	 * in flight may need a spare buffer.
+	 *
+	 * The outputs not used by the configuration have no buffers of their
+	 * own, and capture all frames into a few spare buffers queued and
+	 * recycled automatically.
+	 */
+	unsigned int spareCount = 0;
+	for (const StreamConfiguration &cfg : *config)
+		spareCount += cfg.bufferCount;
+
+	for (ImgUDevice *imgu : data->imgus()) {
+		for (IPU3Stream *stream : { outStream, vfStream }) {
+			V4L2VideoDevice *dev = data->imguOutput(imgu, stream)->dev;
+
+			if (!stream->active_) {
+				dev->setSpareBufferCount(ImgUDevice::DUMMY_BUFFER_COUNT);
+				continue;
+			}
+
+			bool decimated = stream->decimation_ > 1;
+			dev->setSpareBufferCount(decimated ? spareCount : 0, false);
+		}
 	}
 
 	/*
-	 * As we need to set format also on the non-active streams, use
-	 * the configuration of the active one for that purpose (there should
-	 * be at least one active stream in the configuration request).
+	 * Reset the scaler crop region to the full sensor output. The ImgU can
+	 * only downscale, the region can't be smaller than the largest stream.
 	 */
-	if (!outStream->active_) {
-		ret = imgu->configureOutput(outStream->device_, config->at(0));
+	data->inputSize_ = config->sensorFormat().size;
+	data->minCropSize_ = {};
+	for (const StreamConfiguration &cfg : *config)
+		data->minCropSize_ = data->minCropSize_.expandedTo(cfg.size);
+
+	/*
+	 * The CIO2 output format is fully determined by the sensor format
+	 * selected at validation time. Compute it upfront to configure the
+	 * CIO2 unit and all the ImgU instances used by the camera concurrently,
+	 * and verify after configuration that the CIO2 didn't adjust it.
+	 */
+	const V4L2SubdeviceFormat &sensorFormat = config->sensorFormat();
+	V4L2DeviceFormat cio2Format = {};
+	cio2Format.fourcc = CIO2Device::mediaBusToFormat(sensorFormat.mbus_code);
+	cio2Format.size = sensorFormat.size;
+	cio2Format.planesCount = 1;
+
+	V4L2DeviceFormat cio2Output = {};
+	jobs.add("CIO2", [cio2, &sensorFormat, &cio2Output]() {
+		return cio2->configure(sensorFormat, &cio2Output);
+	});
+
+	for (ImgUDevice *imgu : data->imgus()) {
+		jobs.add(imgu->name_, [this, data, imgu, config, &cio2Format]() {
+			return configureImgU(data, imgu, config, cio2Format);
+		});
+	}
+
+	ret = jobs.run("Configuration");
+	if (ret)
+		return ret;
+
+	if (cio2Output.fourcc != cio2Format.fourcc ||
+	    cio2Output.size != cio2Format.size) {
+		LOG(IPU3, Error)
+			<< "CIO2 output format " << cio2Output
+			<< " doesn't match ImgU input format "
+			<< cio2Format;
+		return -EINVAL;
+	}
+
+	/*
+	 * The scaler crop region starts with the input feeder crop computed
+	 * for the configuration, matching the aspect ratio of the outputs.
+	 */
+	data->crop_ = data->imgus().front()->crop_;
+
+	/*
+	 * All ImgU instances are configured identically, report the stride
+	 * of the output devices of the first one.
+	 */
+	ImgUDevice *imgu = data->imgus().front();
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		ImgUDevice::ImgUOutput *output =
+			data->imguOutput(imgu, config->streams()[i]);
+		V4L2DeviceFormat outputFormat = {};
+
+		ret = output->dev->getFormat(&outputFormat);
 		if (ret)
 			return ret;
+
+		(*config)[i].stride = outputFormat.planes[0].bpl;
+	}
+
+	reserveResources(camera, usage);
+
+	return 0;
+}
+
+int PipelineHandlerIPU3::reconfigure(Camera *camera, CameraConfiguration *c)
+{
+	IPU3CameraConfiguration *config =
+		static_cast<IPU3CameraConfiguration *>(c);
+	IPU3CameraData *data = cameraData(camera);
+	IPU3Stream *outStream = &data->outStream_;
+	IPU3Stream *vfStream = &data->vfStream_;
+	CIO2Device *cio2 = &data->cio2_;
+	IPU3JobSet jobs;
+	int ret;
+
+	/*
+	 * The buffers can only be reused if the configuration uses the same
+	 * streams as the current one.
+	 */
+	unsigned int activeStreams = outStream->active_ + vfStream->active_;
+	if (config->size() != activeStreams)
+		return -ENOTSUP;
+
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		const IPU3Stream *stream = config->streams()[i];
+
+		if (!stream->active_ || !buffersReusable(stream, config->at(i)))
+			return -ENOTSUP;
 	}
 
-	if (!vfStream->active_) {
-		ret = imgu->configureOutput(vfStream->device_, config->at(0));
+	/*
+	 * Release the buffers of the video devices whose format depends on the
+	 * configuration. The parameters and statistics buffers are kept.
+	 */
+	std::vector<V4L2VideoDevice *> devices = { cio2->output_ };
+	for (ImgUDevice *imgu : data->imgus()) {
+		devices.push_back(imgu->input_);
+		devices.push_back(imgu->output_.dev);
+		devices.push_back(imgu->viewfinder_.dev);
+	}
+
+	for (V4L2VideoDevice *dev : devices) {
+		ret = dev->releaseBuffers();
 		if (ret)
 			return ret;
 	}
 
+	ret = configure(camera, config);
+	if (ret)
+		return ret;
+
+	/*
+	 * Import the buffers back, the raw buffers being shared between the
+	 * CIO2 output and the ImgU inputs. The non-active outputs use their
+	 * internal pools.
+	 */
+	jobs.add("CIO2", [data, cio2]() {
+		int ret = cio2->output_->reimportBuffers(&cio2->pool_);
+
+		for (ImgUDevice *imgu : data->imgus()) {
+			if (ret)
+				break;
+
+			ret = imgu->input_->reimportBuffers(&cio2->pool_);
+		}
+
+		return ret;
+	});
+
+	for (ImgUDevice *imgu : data->imgus()) {
+		for (IPU3Stream *stream : { outStream, vfStream }) {
+			ImgUDevice::ImgUOutput *output =
+				data->imguOutput(imgu, stream);
+			BufferPool *pool = stream->active_ ? &stream->bufferPool()
+							   : output->pool;
+
+			jobs.add(imgu->name_ + " " + output->name,
+				 [output, pool]() {
+					 return output->dev->reimportBuffers(pool);
+				 });
+		}
+	}
+
+	return jobs.run("Reconfiguration");
+}
+
+int PipelineHandlerIPU3::configureImgU(IPU3CameraData *data, ImgUDevice *imgu,
+				       IPU3CameraConfiguration *config,
+				       const V4L2DeviceFormat &cio2Format)
+{
+	const Size &sensorSize = config->sensorFormat().size;
+	V4L2DeviceFormat inputFormat = cio2Format;
+	IPU3Stream *outStream = &data->outStream_;
+	IPU3Stream *vfStream = &data->vfStream_;
+	IPU3JobSet jobs;
+	int ret;
+
+	/*
+	 * The output frames are produced by the GDC, a non-active output is
+	 * thus configured with the size of the first stream. A non-active
+	 * viewfinder is configured with its minimum size.
+	 */
+	StreamConfiguration dummyCfg[2] = {};
+	dummyCfg[0].size = config->at(0).size;
+	dummyCfg[1].size = { ImgUDevice::VF_MIN_WIDTH, ImgUDevice::VF_MIN_HEIGHT };
+
+	Size outputSizes[2] = { dummyCfg[0].size, dummyCfg[1].size };
+	for (unsigned int i = 0; i < config->size(); ++i)
+		outputSizes[config->streams()[i] == vfStream] = config->at(i).size;
+
+	ImgUDevice::PipeConfig pipe =
+		ImgUDevice::calculatePipeConfig(sensorSize, outputSizes[0],
+						outputSizes[1]);
+
+	ret = imgu->configureInput(pipe, &inputFormat);
+	if (ret)
+		return ret;
+
+	/*
+	 * Configure the output video devices concurrently once the input is
+	 * configured. Apply the format to the configured streams output
+	 * devices first.
+	 */
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		ImgUDevice::ImgUOutput *output =
+			data->imguOutput(imgu, config->streams()[i]);
+		const StreamConfiguration &cfg = config->at(i);
+
+		jobs.add(imgu->name_ + " " + output->name,
+			 [imgu, output, &cfg]() {
+				 return imgu->configureOutput(output, cfg);
+			 });
+	}
+
+	/* The format must also be set on the non-active outputs. */
+	for (IPU3Stream *stream : { outStream, vfStream }) {
+		if (stream->active_)
+			continue;
+
+		ImgUDevice::ImgUOutput *output = data->imguOutput(imgu, stream);
+		const StreamConfiguration &cfg = dummyCfg[stream == vfStream];
+
+		jobs.add(imgu->name_ + " " + output->name,
+			 [imgu, output, &cfg]() {
+				 return imgu->configureOutput(output, cfg);
+			 });
+	}
+
 	/*
 	 * Apply the largest available format to the stat node.
 	 * \todo Revise this when we'll actually use the stat node.
 	 */
 	StreamConfiguration statCfg = {};
-	statCfg.size = cio2Format.size;
+	statCfg.size = inputFormat.size;
+
+	jobs.add(imgu->name_ + " stat", [imgu, &statCfg]() {
+		return imgu->configureOutput(&imgu->stat_, statCfg);
+	});
 
-	ret = imgu->configureOutput(&imgu->stat_, statCfg);
+	ret = jobs.run(imgu->name_ + " configuration");
 	if (ret)
 		return ret;
 
@@ -632,70 +1268,108 @@ int PipelineHandlerIPU3::allocateBuffers(Camera *camera,
 	IPU3Stream *vfStream = &data->vfStream_;
 	CIO2Device *cio2 = &data->cio2_;
 	ImgUDevice *imgu = data->imgu_;
+	ImgUDevice *altImgu = data->altImgu_;
+	IPU3JobSet jobs;
 	unsigned int bufferCount;
-	int ret;
+	int ret = 0;
 
-	/* Share buffers between CIO2 output and ImgU input. */
-	BufferPool *pool = cio2->exportBuffers();
-	if (!pool)
-		return -ENOMEM;
+	/*
+	 * Buffer allocation and export is performed by the kernel
+	 * synchronously for every video device. As the video devices are
+	 * independent, except for the CIO2 output and ImgU input that share
+	 * buffers, allocate buffers on all of them concurrently.
+	 */
 
-	ret = imgu->importInputBuffers(pool);
-	if (ret)
-		goto error;
+	/* Share buffers between CIO2 output and ImgU inputs. */
+	jobs.add("CIO2", [data, cio2]() {
+		BufferPool *pool = cio2->exportBuffers();
+		if (!pool)
+			return -ENOMEM;
+
+		for (ImgUDevice *imgu : data->imgus()) {
+			int ret = imgu->importInputBuffers(pool);
+			if (ret)
+				return ret;
+		}
+
+		return 0;
+	});
 
 	/*
-	 * Use for the stat's internal pool the same number of buffer as
-	 * for the input pool.
-	 * \todo To be revised when we'll actually use the stat node.
+	 * Allocate buffers for each active stream. When a second ImgU is used,
+	 * the stream buffers are shared by both ImgU instances and must be
+	 * imported after being exported from the first one.
 	 */
-	bufferCount = pool->count();
-	imgu->stat_.pool->createBuffers(bufferCount);
-	ret = imgu->exportOutputBuffers(&imgu->stat_, imgu->stat_.pool);
-	if (ret)
-		goto error;
-
-	/* Allocate buffers for each active stream. */
 	for (Stream *s : streams) {
 		IPU3Stream *stream = static_cast<IPU3Stream *>(s);
 		ImgUDevice::ImgUOutput *dev = stream->device_;
-
-		if (stream->memoryType() == InternalMemory)
-			ret = imgu->exportOutputBuffers(dev, &stream->bufferPool());
-		else
-			ret = imgu->importOutputBuffers(dev, &stream->bufferPool());
-		if (ret)
-			goto error;
+		ImgUDevice::ImgUOutput *altDev =
+			altImgu ? data->imguOutput(altImgu, stream) : nullptr;
+
+		jobs.add(stream->name_, [imgu, altImgu, stream, dev, altDev]() {
+			BufferPool *pool = &stream->bufferPool();
+			int ret;
+
+			if (stream->memoryType() == InternalMemory)
+				ret = imgu->exportOutputBuffers(dev, pool);
+			else
+				ret = imgu->importOutputBuffers(dev, pool);
+			if (ret || !altImgu)
+				return ret;
+
+			return altImgu->importOutputBuffers(altDev, pool);
+		});
 	}
 
-	/*
-	 * Allocate buffers also on non-active outputs; use the same number
-	 * of buffers as the active ones.
-	 */
-	if (!outStream->active_) {
-		bufferCount = vfStream->configuration().bufferCount;
-		outStream->device_->pool->createBuffers(bufferCount);
-		ret = imgu->exportOutputBuffers(outStream->device_,
-						outStream->device_->pool);
-		if (ret)
-			goto error;
-	}
+	for (ImgUDevice *dev : data->imgus()) {
+		/*
+		 * Use for the stat's internal pool the same number of buffer
+		 * as for the input pool.
+		 * \todo To be revised when we'll actually use the stat node.
+		 */
+		bufferCount = cio2->bufferCount_;
+		dev->stat_.pool->createBuffers(bufferCount);
+		jobs.add(dev->name_ + " stat", [dev]() {
+			return dev->exportOutputBuffers(&dev->stat_,
+							dev->stat_.pool);
+		});
+
+		/* Use one parameters buffer per raw buffer. */
+		dev->param_.pool->createBuffers(bufferCount);
+		jobs.add(dev->name_ + " param", [dev]() {
+			return dev->exportOutputBuffers(&dev->param_,
+							dev->param_.pool);
+		});
 
-	if (!vfStream->active_) {
-		bufferCount = outStream->configuration().bufferCount;
-		vfStream->device_->pool->createBuffers(bufferCount);
-		ret = imgu->exportOutputBuffers(vfStream->device_,
-						vfStream->device_->pool);
-		if (ret)
-			goto error;
+		/*
+		 * Non-active outputs only use the spare buffers set up at
+		 * configuration time, export an empty pool to allocate them.
+		 */
+		for (IPU3Stream *stream : { outStream, vfStream }) {
+			if (stream->active_)
+				continue;
+
+			ImgUDevice::ImgUOutput *output =
+				data->imguOutput(dev, stream);
+
+			output->pool->createBuffers(0);
+			jobs.add(dev->name_ + " " + output->name,
+				 [dev, output]() {
+				return dev->exportOutputBuffers(output,
+								output->pool);
+			});
+		}
 	}
 
-	return 0;
+	ret = jobs.run("Buffer allocation");
+	if (ret) {
+		freeBuffers(camera, streams);
+		return ret;
+	}
 
-error:
-	freeBuffers(camera, streams);
+	data->mapMetaBuffers();
 
-	return ret;
+	return 0;
 }
 
 int PipelineHandlerIPU3::freeBuffers(Camera *camera,
@@ -703,8 +1377,12 @@ int PipelineHandlerIPU3::freeBuffers(Camera *camera,
 {
 	IPU3CameraData *data = cameraData(camera);
 
+	data->unmapMetaBuffers();
+
+	/* Release the ImgU inputs first, as they import the CIO2 buffers. */
+	for (ImgUDevice *imgu : data->imgus())
+		imgu->freeBuffers();
 	data->cio2_.freeBuffers();
-	data->imgu_->freeBuffers();
 
 	return 0;
 }
@@ -713,30 +1391,52 @@ int PipelineHandlerIPU3::start(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
+	std::vector<std::unique_ptr<Buffer>> buffers;
+	IPU3JobSet jobs;
 	int ret;
 
 	/*
-	 * Start the ImgU video devices, buffers will be queued to the
-	 * ImgU output and viewfinder when requests will be queued.
+	 * Queue the raw buffers to the CIO2 from the pipeline handler thread,
+	 * as queuing buffers enables event notifiers bound to the thread.
 	 */
-	ret = cio2->start(&data->rawBuffers_);
+	ret = cio2->queueBuffers(&buffers);
 	if (ret)
 		goto error;
 
-	ret = imgu->start();
+	data->rawBuffers_.reset(std::move(buffers));
+
+	if (cio2->frameStartEvents_)
+		data->delayedCtrls_->reset();
+
+	/*
+	 * Start the CIO2 and ImgU video devices concurrently, buffers will be
+	 * queued to the ImgU output and viewfinder when requests will be
+	 * queued.
+	 */
+	jobs.add("CIO2", [cio2]() { return cio2->start(); });
+	for (ImgUDevice *imgu : data->imgus())
+		jobs.add(imgu->name_, [imgu]() { return imgu->start(); });
+
+	ret = jobs.run("Start");
 	if (ret) {
-		imgu->stop();
+		for (ImgUDevice *imgu : data->imgus())
+			imgu->stop();
 		cio2->stop();
 		goto error;
 	}
 
+	data->nextImgu_ = data->imgu_;
+	data->frameCount_ = 0;
+	data->outStream_.nextFrame_ = 0;
+	data->vfStream_.nextFrame_ = 0;
+	data->queueStatBuffers();
+
 	return 0;
 
 error:
 	LOG(IPU3, Error) << "Failed to start camera " << camera->name();
 
-	data->rawBuffers_.clear();
+	data->resetRawPipeline();
 	return ret;
 }
 
@@ -746,36 +1446,163 @@ void PipelineHandlerIPU3::stop(Camera *camera)
 	int ret;
 
 	ret = data->cio2_.stop();
-	ret |= data->imgu_->stop();
+	for (ImgUDevice *imgu : data->imgus())
+		ret |= imgu->stop();
 	if (ret)
 		LOG(IPU3, Warning) << "Failed to stop camera "
 				   << camera->name();
 
-	data->rawBuffers_.clear();
+	data->resetRawPipeline();
 }
 
 int PipelineHandlerIPU3::queueRequest(Camera *camera, Request *request)
 {
+	IPU3CameraData *data = cameraData(camera);
+	std::vector<Buffer *> skipped;
 	int error = 0;
 
-	for (auto it : request->buffers()) {
-		IPU3Stream *stream = static_cast<IPU3Stream *>(it.first);
-		Buffer *buffer = it.second;
+	/* Alternate requests between the ImgU instances in use. */
+	ImgUDevice *imgu = data->nextImgu_;
+	if (data->altImgu_)
+		data->nextImgu_ = imgu == data->imgu_ ? data->altImgu_
+						      : data->imgu_;
+
+	/*
+	 * Queue a buffer to all active outputs. The request buffers of
+	 * decimated streams are only filled when enough frames have been
+	 * skipped since the last one, spare buffers are queued instead to skip
+	 * the frame. If no spare buffer is available, the frame isn't skipped.
+	 */
+	unsigned int frame = data->frameCount_++;
+
+	for (IPU3Stream *stream : { &data->outStream_, &data->vfStream_ }) {
+		if (!stream->active_)
+			continue;
+
+		V4L2VideoDevice *dev = data->imguOutput(imgu, stream)->dev;
+		Buffer *buffer = request->findBuffer(stream);
+		bool decimated = stream->decimation_ > 1;
+		int ret;
+
+		if (decimated && (!buffer || frame < stream->nextFrame_)) {
+			ret = dev->queueSpareBuffer();
+			if (!ret) {
+				if (buffer)
+					skipped.push_back(buffer);
+				continue;
+			}
+
+			if (!buffer) {
+				error = ret;
+				continue;
+			}
+		}
+
+		if (!buffer)
+			continue;
 
-		int ret = stream->device_->dev->queueBuffer(buffer);
+		ret = dev->queueBuffer(buffer);
 		if (ret < 0)
 			error = ret;
+		else if (decimated)
+			stream->nextFrame_ = frame + stream->decimation_;
+	}
+
+	/*
+	 * Apply the frame duration through the sensor vertical blanking. When
+	 * the CSI-2 receiver reports frame start events, the sensor controls
+	 * are queued for the frame the request will be captured in, and written
+	 * at the CIO2 frame start that accounts for the sensor control delays.
+	 * Controls are pushed for every request to keep the queue aligned with
+	 * frames.
+	 */
+	CIO2Device *cio2 = &data->cio2_;
+	V4L2ControlList sensorCtrls;
+	if (request->controls().contains(FrameDuration)) {
+		uint64_t duration = request->controls().get(controls::FrameDuration)
+				  * 1000ULL;
+		int64_t vblank;
+
+		if (!cio2->frameStartEvents_) {
+			if (cio2->sensor_->setFrameDuration(&duration))
+				LOG(IPU3, Warning) << "Failed to set frame duration";
+		} else if (!cio2->sensor_->frameDurationToVblank(duration, &vblank)) {
+			sensorCtrls.add(V4L2_CID_VBLANK, vblank);
+		}
 	}
 
+	if (cio2->frameStartEvents_ && !data->delayedCtrls_->push(sensorCtrls))
+		LOG(IPU3, Warning) << "Failed to queue sensor controls";
+
+	/*
+	 * Apply the scaler crop region through the ImgU input feeder, and
+	 * report the region used to process the request.
+	 *
+	 * \todo Apply the control synchronously with the frame it belongs to.
+	 */
+	if (request->controls().contains(ScalerCrop)) {
+		const Rectangle &crop = request->controls().get(controls::ScalerCrop);
+		data->crop_ = data->adjustCrop(crop);
+	}
+
+	if (imgu->setInputCrop(data->crop_))
+		LOG(IPU3, Warning) << "Failed to set crop " << data->crop_.toString();
+
+	request->metadata().set(controls::ScalerCrop, imgu->crop_);
+
+	/* Feed the ImgU with a raw frame to produce the request buffers. */
+	data->pendingRequests_.push(imgu);
+	data->processRawFrame();
+
 	PipelineHandler::queueRequest(camera, request);
 
+	/*
+	 * Complete the buffers of skipped frames right away, the request
+	 * completes with its other buffers.
+	 */
+	for (Buffer *buffer : skipped) {
+		setBufferMetadata(buffer, nullptr, Buffer::BufferSkipped, 0);
+		if (completeBuffer(camera, request, buffer))
+			completeRequest(camera, request);
+	}
+
 	return error;
 }
 
-bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
+/*
+ * The CIO2 raw frames, the ImgU parameters and statistics buffers, and the
+ * ImgU output spare buffers for unused outputs and skipped frames are allocated
+ * internally.
+ */
+MemoryUsage PipelineHandlerIPU3::memoryUsage(const Camera *camera)
 {
-	int ret;
+	IPU3CameraData *data = cameraData(camera);
+	std::vector<const BufferPool *> pools = { &data->cio2_.pool_ };
+
+	if (data->imgu_) {
+		for (const ImgUDevice *imgu : data->imgus()) {
+			pools.insert(pools.end(), { &imgu->paramPool_,
+						    &imgu->statPool_ });
+
+			for (const V4L2VideoDevice *dev : { imgu->output_.dev,
+							    imgu->viewfinder_.dev }) {
+				if (dev->sparePool())
+					pools.push_back(dev->sparePool());
+			}
+		}
+	}
 
+	MemoryUsage usage;
+	for (const BufferPool *pool : pools) {
+		usage.allocated += pool->size();
+		usage.mapped += pool->mappedSize();
+	}
+
+	return usage;
+}
+
+std::vector<DeviceMatch> PipelineHandlerIPU3::deviceMatches()
+{
 	DeviceMatch cio2_dm("ipu3-cio2");
 	cio2_dm.add("ipu3-csi2 0");
 	cio2_dm.add("ipu3-cio2 0");
@@ -800,11 +1627,19 @@ bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
 	imgu_dm.add("ipu3-imgu 1 viewfinder");
 	imgu_dm.add("ipu3-imgu 1 3a stat");
 
-	cio2MediaDev_ = acquireMediaDevice(enumerator, cio2_dm);
+	return { cio2_dm, imgu_dm };
+}
+
+bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
+{
+	const std::vector<DeviceMatch> matches = deviceMatches();
+	int ret;
+
+	cio2MediaDev_ = acquireMediaDevice(enumerator, matches[0]);
 	if (!cio2MediaDev_)
 		return false;
 
-	imguMediaDev_ = acquireMediaDevice(enumerator, imgu_dm);
+	imguMediaDev_ = acquireMediaDevice(enumerator, matches[1]);
 	if (!imguMediaDev_)
 		return false;
 
@@ -820,8 +1655,13 @@ bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
 		return ret;
 
 	ret = registerCameras();
+	if (ret)
+		return false;
 
-	return ret == 0;
+	resources_.setCapacity(IPU3ResourceImgU, IPU3_IMGU_PIXEL_RATE);
+	resources_.setCapacity(IPU3ResourceMemory, IPU3_MEMORY_BANDWIDTH);
+
+	return true;
 }
 
 /**
@@ -851,6 +1691,7 @@ int PipelineHandlerIPU3::registerCameras()
 	 * image sensor is connected to it and the sensor can produce images
 	 * in a compatible format.
 	 */
+	IPU3CameraData *firstData = nullptr;
 	unsigned int numCameras = 0;
 	for (unsigned int id = 0; id < 4 && numCameras < 2; ++id) {
 		std::unique_ptr<IPU3CameraData> data =
@@ -865,6 +1706,10 @@ int PipelineHandlerIPU3::registerCameras()
 		if (ret)
 			continue;
 
+		data->delayedCtrls_ =
+			utils::make_unique<DelayedControls>(cio2->sensor_->device(),
+							    cio2->sensor_->controlDelays());
+
 		/**
 		 * \todo Dynamically assign ImgU and output devices to each
 		 * stream and camera; as of now, limit support to two cameras
@@ -872,6 +1717,7 @@ int PipelineHandlerIPU3::registerCameras()
 		 * second.
 		 */
 		data->imgu_ = numCameras ? &imgu1_ : &imgu0_;
+		data->resources_ = &resources_;
 		data->outStream_.device_ = &data->imgu_->output_;
 		data->outStream_.name_ = "output";
 		data->vfStream_.device_ = &data->imgu_->viewfinder_;
@@ -887,6 +1733,8 @@ int PipelineHandlerIPU3::registerCameras()
 		 */
 		data->cio2_.output_->bufferReady.connect(data.get(),
 					&IPU3CameraData::cio2BufferReady);
+		data->cio2_.csi2_->frameStart.connect(data.get(),
+					&IPU3CameraData::cio2FrameStart);
 		data->imgu_->input_->bufferReady.connect(data.get(),
 					&IPU3CameraData::imguInputBufferReady);
 		data->imgu_->output_.dev->bufferReady.connect(data.get(),
@@ -894,6 +1742,42 @@ int PipelineHandlerIPU3::registerCameras()
 		data->imgu_->viewfinder_.dev->bufferReady.connect(data.get(),
 					&IPU3CameraData::imguOutputBufferReady);
 
+		data->imgu_->param_.dev->bufferReady.connect(data.get(),
+					&IPU3CameraData::imguParamBufferReady);
+		data->imgu_->stat_.dev->bufferReady.connect(data.get(),
+					&IPU3CameraData::imguStatBufferReady);
+
+		/*
+		 * The IPA is optional, statistics are then discarded and the
+		 * ImgU uses its default parameters.
+		 */
+		data->ipa_ = IPAManager::instance()->createIPA(this, 0, 0);
+		if (data->ipa_) {
+			data->ipa_->queueFrameAction.connect(data.get(),
+					&IPU3CameraData::queueFrameAction);
+			data->ipa_->init();
+		}
+
+		if (!numCameras)
+			firstData = data.get();
+
+		/* Expose the frame duration control when the sensor supports it. */
+		uint64_t minDuration;
+		uint64_t maxDuration;
+		if (!cio2->sensor_->frameDurationLimits(&minDuration, &maxDuration)) {
+			int min = minDuration / 1000;
+			int max = std::min<uint64_t>(maxDuration / 1000, INT_MAX);
+
+			data->controlInfo_.insert(ControlInfo(FrameDuration, min,
+							      max));
+		}
+
+		/* The scaler crop region is bounded by the sensor resolution. */
+		const Size &resolution = cio2->sensor_->resolution();
+		Rectangle maxCrop = { 0, 0, resolution.width, resolution.height };
+		data->controlInfo_.insert(ControlInfo(ScalerCrop, Rectangle{},
+						      maxCrop));
+
 		/* Create and register the Camera instance. */
 		std::string cameraName = cio2->sensor_->entity()->name() + " "
 				       + std::to_string(id);
@@ -901,71 +1785,459 @@ int PipelineHandlerIPU3::registerCameras()
 								cameraName,
 								streams);
 
-		registerCamera(std::move(camera), std::move(data));
+		registerCamera(std::move(camera), std::move(data));
+
+		LOG(IPU3, Info)
+			<< "Registered Camera[" << numCameras << "] \""
+			<< cameraName << "\""
+			<< " connected to CSI-2 receiver " << id;
+
+		numCameras++;
+	}
+
+	/*
+	 * When a single camera is present, the second ImgU can optionally
+	 * process alternate frames to double the ISP throughput.
+	 */
+	const char *dual = utils::secure_getenv("LIBCAMERA_IPU3_DUAL_IMGU");
+	if (numCameras == 1 && dual && !strcmp(dual, "1")) {
+		firstData->altImgu_ = &imgu1_;
+
+		imgu1_.input_->bufferReady.connect(firstData,
+					&IPU3CameraData::imguInputBufferReady);
+		imgu1_.output_.dev->bufferReady.connect(firstData,
+					&IPU3CameraData::imguOutputBufferReady);
+		imgu1_.viewfinder_.dev->bufferReady.connect(firstData,
+					&IPU3CameraData::imguOutputBufferReady);
+		imgu1_.param_.dev->bufferReady.connect(firstData,
+					&IPU3CameraData::imguParamBufferReady);
+		imgu1_.stat_.dev->bufferReady.connect(firstData,
+					&IPU3CameraData::imguStatBufferReady);
+
+		LOG(IPU3, Info) << "Using both ImgU instances for "
+				<< firstData->cio2_.sensor_->entity()->name();
+	}
+
+	return numCameras ? 0 : -ENODEV;
+}
+
+/**
+ * \brief Retrieve the ImgU instances used by the camera
+ *
+ * The first ImgU is always used. When a second ImgU is used, frames are
+ * processed alternatively by the two instances, which are configured
+ * identically.
+ *
+ * \return The list of ImgU instances used by the camera
+ */
+std::vector<ImgUDevice *> IPU3CameraData::imgus() const
+{
+	if (altImgu_)
+		return { imgu_, altImgu_ };
+
+	return { imgu_ };
+}
+
+/**
+ * \brief Retrieve the ImgU output that produces a stream
+ * \param[in] imgu The ImgU instance
+ * \param[in] stream The stream
+ * \return The output of \a imgu that produces frames for \a stream
+ */
+ImgUDevice::ImgUOutput *IPU3CameraData::imguOutput(ImgUDevice *imgu,
+						   const IPU3Stream *stream)
+{
+	return stream == &outStream_ ? &imgu->output_ : &imgu->viewfinder_;
+}
+
+/* -----------------------------------------------------------------------------
+ * Buffer Ready slots
+ */
+
+/**
+ * \brief Handle buffers completion at the ImgU input
+ * \param[in] buffer The completed buffer
+ *
+ * Buffers completed from the ImgU input are immediately queued back to the
+ * CIO2 unit to continue frame capture.
+ */
+void IPU3CameraData::imguInputBufferReady(Buffer *buffer)
+{
+	/* \todo Handle buffer failures when state is set to BufferError. */
+	if (buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	rawBuffers_.setState(buffer, RawBufferRing::Capturing);
+	cio2_.output_->queueBuffer(buffer);
+}
+
+/**
+ * \brief Handle buffers completion at the ImgU output
+ * \param[in] buffer The completed buffer
+ *
+ * Buffers completed from the ImgU output are directed to the application.
+ */
+void IPU3CameraData::imguOutputBufferReady(Buffer *buffer)
+{
+	Request *request = buffer->request();
+
+	if (!pipe_->completeBuffer(camera_, request, buffer))
+		/* Request not completed yet, return here. */
+		return;
+
+	/* Mark the request as complete. */
+	pipe_->completeRequest(camera_, request);
+}
+
+/**
+ * \brief Handle buffers completion at the CIO2 output
+ * \param[in] buffer The completed buffer
+ *
+ * Buffers completed from the CIO2 are queued to the ImgU unit for further
+ * processing when a request is waiting for a frame. Otherwise they are held
+ * until the application queues a request. To keep the CIO2 from starving when
+ * requests are late, at least CIO2_MIN_QUEUED buffers are kept queued to the
+ * CIO2 by dropping the oldest held frames.
+ */
+void IPU3CameraData::cio2BufferReady(Buffer *buffer)
+{
+	/* \todo Handle buffer failures when state is set to BufferError. */
+	if (buffer->status() == Buffer::BufferCancelled)
+		return;
+
+	rawBuffers_.push(buffer);
+
+	if (rawBuffers_.count(RawBufferRing::Waiting) >
+	    rawBuffers_.size() - CIO2Device::CIO2_MIN_QUEUED) {
+		Buffer *oldest = rawBuffers_.pop(RawBufferRing::Capturing);
+
+		LOG(IPU3, Debug)
+			<< "Dropping raw frame " << oldest->sequence();
+
+		cio2_.output_->queueBuffer(oldest);
+	}
+
+	processRawFrame();
+
+	LOG(IPU3, Debug) << "Raw buffers " << rawBuffers_.toString();
+}
+
+/**
+ * \brief Handle the start of a frame on the CIO2 CSI-2 receiver
+ * \param[in] sequence The frame sequence number
+ * \param[in] timestamp The time the frame started
+ *
+ * The CSI-2 receiver signals the frame start short packet of every frame, with
+ * the sequence number of the CIO2 buffer the frame is captured to. The sensor
+ * controls due for the frame are written to the sensor.
+ */
+void IPU3CameraData::cio2FrameStart(uint32_t sequence, uint64_t timestamp)
+{
+	delayedCtrls_->applyControls(sequence);
+
+	pipe_->notifyFrameStart(camera_, sequence, timestamp);
+}
+
+/**
+ * \brief Queue the oldest raw frame to the ImgU if a request is waiting for it
+ *
+ * The ImgU processes one raw frame for each request, as it can only produce
+ * images when buffers are queued to its outputs. Raw frames and requests are
+ * matched in order, decoupling the ImgU processing from the CIO2 frame rate.
+ */
+void IPU3CameraData::processRawFrame()
+{
+	if (pendingRequests_.empty() || !rawBuffers_.count(RawBufferRing::Waiting))
+		return;
+
+	Buffer *buffer = rawBuffers_.pop(RawBufferRing::Processing);
+
+	ImgUDevice *imgu = pendingRequests_.front();
+	pendingRequests_.pop();
+
+	/*
+	 * Let the IPA fill the parameters for the frame before processing it.
+	 * If no parameters buffer is available, process the frame with the
+	 * parameters currently applied to the ImgU.
+	 */
+	MetaBuffer *params = nullptr;
+	if (ipa_) {
+		for (MetaBuffer &meta : metaBuffers_) {
+			if (meta.dev == imgu->param_.dev && !meta.busy) {
+				params = &meta;
+				break;
+			}
+		}
+	}
+
+	if (!params) {
+		imgu->input_->queueBuffer(buffer);
+		return;
+	}
+
+	params->raw = buffer;
+	params->busy = true;
 
-		LOG(IPU3, Info)
-			<< "Registered Camera[" << numCameras << "] \""
-			<< cameraName << "\""
-			<< " connected to CSI-2 receiver " << id;
+	IPAOperationData event;
+	event.operation = IPU3EventFillParams;
+	event.data.push_back(params - metaBuffers_.data() + 1);
+	ipa_->processEvent(buffer->sequence(), event);
+}
 
-		numCameras++;
-	}
+/**
+ * \brief Drop all raw buffers and pending requests
+ *
+ * The parameters and statistics buffers are all marked as free, actions queued
+ * by the IPA for them are then ignored.
+ */
+void IPU3CameraData::resetRawPipeline()
+{
+	rawBuffers_.clear();
+	pendingRequests_ = {};
+	nextImgu_ = imgu_;
 
-	return numCameras ? 0 : -ENODEV;
+	for (MetaBuffer &meta : metaBuffers_) {
+		meta.raw = nullptr;
+		meta.busy = false;
+	}
 }
 
-/* -----------------------------------------------------------------------------
- * Buffer Ready slots
+/**
+ * \brief Handle buffers completion at the ImgU parameters input
+ * \param[in] buffer The completed buffer
+ *
+ * Parameters buffers completed by the ImgU can be filled again for the next
+ * frames.
  */
+void IPU3CameraData::imguParamBufferReady(Buffer *buffer)
+{
+	MetaBuffer *meta = findMetaBuffer(buffer);
+	if (meta)
+		meta->busy = false;
+}
 
 /**
- * \brief Handle buffers completion at the ImgU input
+ * \brief Handle buffers completion at the ImgU statistics output
  * \param[in] buffer The completed buffer
  *
- * Buffers completed from the ImgU input are immediately queued back to the
- * CIO2 unit to continue frame capture.
+ * Statistics buffers are passed to the IPA, and queued back to the ImgU once
+ * the IPA has processed them. Without an IPA they are queued back immediately.
  */
-void IPU3CameraData::imguInputBufferReady(Buffer *buffer)
+void IPU3CameraData::imguStatBufferReady(Buffer *buffer)
 {
-	/* \todo Handle buffer failures when state is set to BufferError. */
 	if (buffer->status() == Buffer::BufferCancelled)
 		return;
 
-	cio2_.output_->queueBuffer(buffer);
+	MetaBuffer *meta = findMetaBuffer(buffer);
+	if (!meta)
+		return;
+
+	if (!ipa_) {
+		meta->dev->queueBuffer(buffer);
+		return;
+	}
+
+	meta->busy = true;
+
+	IPAOperationData event;
+	event.operation = IPU3EventStatReady;
+	event.data.push_back(meta - metaBuffers_.data() + 1);
+	ipa_->processEvent(buffer->sequence(), event);
 }
 
 /**
- * \brief Handle buffers completion at the ImgU output
- * \param[in] buffer The completed buffer
- *
- * Buffers completed from the ImgU output are directed to the application.
+ * \brief Handle actions queued by the IPA
+ * \param[in] frame The frame number the action relates to
+ * \param[in] action The action
  */
-void IPU3CameraData::imguOutputBufferReady(Buffer *buffer)
+void IPU3CameraData::queueFrameAction(unsigned int frame,
+				      const IPAOperationData &action)
 {
-	Request *request = buffer->request();
+	if (action.data.empty() || !action.data[0] ||
+	    action.data[0] > metaBuffers_.size()) {
+		LOG(IPU3, Warning)
+			<< "Invalid buffer for IPA action " << action.operation;
+		return;
+	}
 
-	if (!pipe_->completeBuffer(camera_, request, buffer))
-		/* Request not completed yet, return here. */
+	MetaBuffer &meta = metaBuffers_[action.data[0] - 1];
+
+	/* Ignore actions for buffers released since the event was sent. */
+	if (!meta.busy)
 		return;
 
-	/* Mark the request as complete. */
-	pipe_->completeRequest(camera_, request);
+	switch (action.operation) {
+	case IPU3ActionParamFilled:
+		if (!meta.raw)
+			break;
+
+		meta.dev->queueBuffer(meta.buffer.get());
+		meta.imgu->input_->queueBuffer(meta.raw);
+		meta.raw = nullptr;
+		break;
+
+	case IPU3ActionStatProcessed:
+		meta.busy = false;
+		meta.dev->queueBuffer(meta.buffer.get());
+		break;
+
+	default:
+		LOG(IPU3, Warning)
+			<< "Unknown IPA action " << action.operation;
+		break;
+	}
 }
 
 /**
- * \brief Handle buffers completion at the CIO2 output
- * \param[in] buffer The completed buffer
+ * \brief Create the parameters and statistics buffers and map them to the IPA
  *
- * Buffers completed from the CIO2 are immediately queued to the ImgU unit
- * for further processing.
+ * This function shall be called after the parameters and statistics buffers
+ * have been allocated on all the ImgU instances used by the camera.
  */
-void IPU3CameraData::cio2BufferReady(Buffer *buffer)
+void IPU3CameraData::mapMetaBuffers()
 {
-	/* \todo Handle buffer failures when state is set to BufferError. */
-	if (buffer->status() == Buffer::BufferCancelled)
-		return;
+	std::vector<IPABuffer> ipaBuffers;
+
+	for (ImgUDevice *imgu : imgus()) {
+		for (ImgUDevice::ImgUOutput *output : { &imgu->param_, &imgu->stat_ }) {
+			std::vector<BufferMemory> &memories = output->pool->buffers();
+
+			for (unsigned int i = 0; i < memories.size(); ++i) {
+				metaBuffers_.push_back({ imgu, output->dev,
+							 utils::make_unique<Buffer>(i),
+							 nullptr, false });
+
+				ipaBuffers.emplace_back();
+				IPABuffer &ipaBuffer = ipaBuffers.back();
+				ipaBuffer.id = metaBuffers_.size();
+
+				for (const Plane &plane : memories[i].planes()) {
+					ipaBuffer.memory.planes().emplace_back();
+					ipaBuffer.memory.planes().back().setDmabuf(plane.dmabuf(),
+										   plane.length());
+				}
+			}
+		}
+	}
+
+	if (ipa_)
+		ipa_->mapBuffers(ipaBuffers);
+}
+
+/**
+ * \brief Unmap the parameters and statistics buffers from the IPA and free them
+ */
+void IPU3CameraData::unmapMetaBuffers()
+{
+	if (ipa_ && !metaBuffers_.empty()) {
+		std::vector<unsigned int> ids;
+		for (unsigned int id = 1; id <= metaBuffers_.size(); ++id)
+			ids.push_back(id);
+
+		ipa_->unmapBuffers(ids);
+	}
+
+	metaBuffers_.clear();
+}
+
+/**
+ * \brief Queue all the statistics buffers to the ImgU instances
+ */
+void IPU3CameraData::queueStatBuffers()
+{
+	for (MetaBuffer &meta : metaBuffers_) {
+		if (meta.dev == meta.imgu->stat_.dev)
+			meta.dev->queueBuffer(meta.buffer.get());
+	}
+}
+
+/**
+ * \brief Adjust a scaler crop region to the ImgU constraints
+ * \param[in] crop The requested scaler crop region
+ *
+ * Clamp the size of the region between the largest stream size and the sensor
+ * output size, align it to the ImgU input feeder requirements, and move the
+ * region inside the sensor output frame.
+ *
+ * \return The adjusted scaler crop region
+ */
+Rectangle IPU3CameraData::adjustCrop(const Rectangle &crop) const
+{
+	Rectangle rect;
+
+	rect.w = utils::clamp(crop.w, minCropSize_.width, inputSize_.width) & ~7;
+	rect.h = utils::clamp(crop.h, minCropSize_.height, inputSize_.height) & ~3;
+	rect.x = utils::clamp<int>(crop.x, 0, inputSize_.width - rect.w) & ~1;
+	rect.y = utils::clamp<int>(crop.y, 0, inputSize_.height - rect.h) & ~1;
+
+	return rect;
+}
+
+IPU3CameraData::MetaBuffer *IPU3CameraData::findMetaBuffer(Buffer *buffer)
+{
+	for (MetaBuffer &meta : metaBuffers_) {
+		if (meta.buffer.get() == buffer)
+			return &meta;
+	}
+
+	return nullptr;
+}
+
+/* -----------------------------------------------------------------------------
+ * Concurrent jobs
+ */
 
-	imgu_->input_->queueBuffer(buffer);
+int IPU3JobSet::runJob(Job *job)
+{
+	uint64_t start = utils::monotonic_ns();
+	int ret = job->func();
+	job->duration = utils::monotonic_ns() - start;
+
+	return ret;
+}
+
+/**
+ * \brief Run all jobs concurrently and wait for their completion
+ * \param[in] operation The operation name, for logging purpose
+ *
+ * Run all jobs but the first one in separate threads, and the first one in the
+ * calling thread. All jobs are run to completion before errors are checked,
+ * and the job set is then emptied.
+ *
+ * \return 0 on success or the error code of the first failed job otherwise
+ */
+int IPU3JobSet::run(const std::string &operation)
+{
+	if (jobs_.empty())
+		return 0;
+
+	uint64_t start = utils::monotonic_ns();
+
+	std::vector<std::future<int>> results;
+	for (auto job = jobs_.begin() + 1; job != jobs_.end(); ++job)
+		results.push_back(std::async(std::launch::async, runJob, &*job));
+
+	int ret = runJob(&jobs_.front());
+
+	for (std::future<int> &result : results) {
+		int err = result.get();
+		if (!ret)
+			ret = err;
+	}
+
+	uint64_t duration = utils::monotonic_ns() - start;
+
+	for (const Job &job : jobs_)
+		LOG(IPU3, Debug)
+			<< operation << ": " << job.name << " took "
+			<< job.duration / 1000 << "us";
+
+	LOG(IPU3, Debug)
+		<< operation << " took " << duration / 1000 << "us";
+
+	jobs_.clear();
+
+	return ret;
 }
 
 /* -----------------------------------------------------------------------------
@@ -1036,16 +2308,109 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 	stat_.name = "stat";
 	stat_.pool = &statPool_;
 
+	param_.dev = V4L2VideoDevice::fromEntityName(media,
+						     name_ + " parameters");
+	ret = param_.dev->open();
+	if (ret)
+		return ret;
+
+	param_.pad = PAD_PARAM;
+	param_.name = "param";
+	param_.pool = &paramPool_;
+
 	return 0;
 }
 
+/**
+ * \brief Compute the ImgU pipe configuration for the input and output sizes
+ * \param[in] input The ImgU input frame size
+ * \param[in] output The ImgU output frame size
+ * \param[in] viewfinder The ImgU viewfinder frame size
+ *
+ * The ImgU processes the input frames through the input feeder (IF), which
+ * crops them, the bayer downscaler (BDS), and the geometric distortion
+ * correction (GDC) unit, whose output is written to the output and scaled down
+ * by the viewfinder. The processing time and memory bandwidth of the pipe grow
+ * with the intermediate sizes, which are selected as the smallest sizes that
+ * produce the outputs without upscaling:
+ *
+ * - The GDC output is the smallest size that contains both outputs.
+ * - The IF crops the input to the aspect ratio of the GDC output, within the
+ *   limits of the IF, to let the BDS scale both directions uniformly.
+ * - The BDS applies the largest scale factor, in its supported range and
+ *   steps, for which its output still contains the GDC output.
+ *
+ * \return The ImgU pipe configuration
+ */
+ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(const Size &input,
+						       const Size &output,
+						       const Size &viewfinder)
+{
+	/*
+	 * The input feeder crop alignments match the ones of the scaler crop
+	 * region, and the BDS scale factor is expressed in 1/32 steps.
+	 */
+	static constexpr unsigned int IF_ALIGN_W = 8;
+	static constexpr unsigned int IF_ALIGN_H = 4;
+	static constexpr unsigned int IF_CROP_MAX_W = 40;
+	static constexpr unsigned int IF_CROP_MAX_H = 540;
+	static constexpr unsigned int BDS_ALIGN_W = 2;
+	static constexpr unsigned int BDS_ALIGN_H = 4;
+	static constexpr unsigned int BDS_SF_DEN = 32;
+	static constexpr unsigned int BDS_SF_MAX = 80;
+
+	PipeConfig pipe;
+
+	pipe.gdc = output.expandedTo(viewfinder).boundedTo(input);
+	if (!pipe.gdc.width || !pipe.gdc.height) {
+		pipe.iif = pipe.bds = pipe.gdc = input;
+		return pipe;
+	}
+
+	const uint64_t inputRatio = static_cast<uint64_t>(input.width) * pipe.gdc.height;
+	const uint64_t gdcRatio = static_cast<uint64_t>(pipe.gdc.width) * input.height;
+
+	pipe.iif = input;
+	if (inputRatio > gdcRatio) {
+		unsigned int width = gdcRatio / pipe.gdc.height;
+		pipe.iif.width = std::max(width, input.width - std::min(input.width, IF_CROP_MAX_W));
+	} else if (inputRatio < gdcRatio) {
+		unsigned int height = inputRatio / pipe.gdc.width;
+		pipe.iif.height = std::max(height, input.height - std::min(input.height, IF_CROP_MAX_H));
+	}
+
+	pipe.iif = pipe.iif.alignedDownTo(IF_ALIGN_W, IF_ALIGN_H).expandedTo(pipe.gdc);
+
+	pipe.bds = pipe.iif;
+	for (unsigned int sf = BDS_SF_MAX; sf > BDS_SF_DEN; --sf) {
+		Size bds{ pipe.iif.width * BDS_SF_DEN / sf,
+			  pipe.iif.height * BDS_SF_DEN / sf };
+		bds = bds.alignedDownTo(BDS_ALIGN_W, BDS_ALIGN_H);
+
+		if (bds.width >= pipe.gdc.width && bds.height >= pipe.gdc.height) {
+			pipe.bds = bds;
+			break;
+		}
+	}
+
+	LOG(IPU3, Debug)
+		<< "ImgU pipe configuration: IF " << pipe.iif.toString()
+		<< ", BDS " << pipe.bds.toString()
+		<< ", GDC " << pipe.gdc.toString();
+
+	return pipe;
+}
+
 /**
  * \brief Configure the ImgU unit input
- * \param[in] size The ImgU input frame size
+ * \param[in] pipe The ImgU pipe configuration
  * \param[in] inputFormat The format to be applied to ImgU input
+ *
+ * The input feeder crop is centered in the input frame.
+ *
  * \return 0 on success or a negative error code otherwise
  */
-int ImgUDevice::configureInput(const Size &size,
+int ImgUDevice::configureInput(const PipeConfig &pipe,
 			       V4L2DeviceFormat *inputFormat)
 {
 	/* Configure the ImgU input video device with the requested sizes. */
@@ -1053,7 +2418,7 @@ int ImgUDevice::configureInput(const Size &size,
 	if (ret)
 		return ret;
 
-	LOG(IPU3, Debug) << "ImgU input format = " << inputFormat->toString();
+	LOG(IPU3, Debug) << "ImgU input format = " << *inputFormat;
 
 	/*
 	 * \todo The IPU3 driver implementation shall be changed to use the
@@ -1066,31 +2431,76 @@ int ImgUDevice::configureInput(const Size &size,
 	 * V4L2 specification.
 	 */
 	Rectangle rect = {
-		.x = 0,
-		.y = 0,
-		.w = inputFormat->size.width,
-		.h = inputFormat->size.height,
+		.x = static_cast<int>((inputFormat->size.width - pipe.iif.width) / 2) & ~1,
+		.y = static_cast<int>((inputFormat->size.height - pipe.iif.height) / 2) & ~1,
+		.w = pipe.iif.width,
+		.h = pipe.iif.height,
 	};
 	ret = imgu_->setCrop(PAD_INPUT, &rect);
 	if (ret)
 		return ret;
 
-	ret = imgu_->setCompose(PAD_INPUT, &rect);
+	LOG(IPU3, Debug) << "ImgU input feeder rectangle = " << rect.toString();
+
+	Rectangle bds = { 0, 0, pipe.bds.width, pipe.bds.height };
+	ret = imgu_->setCompose(PAD_INPUT, &bds);
 	if (ret)
 		return ret;
 
-	LOG(IPU3, Debug) << "ImgU input feeder and BDS rectangle = "
-			 << rect.toString();
+	LOG(IPU3, Debug) << "ImgU BDS rectangle = " << bds.toString();
+
+	pipe_ = pipe;
+	crop_ = rect;
 
 	V4L2SubdeviceFormat imguFormat = {};
 	imguFormat.mbus_code = MEDIA_BUS_FMT_FIXED;
-	imguFormat.size = size;
+	imguFormat.size = pipe.gdc;
 
 	ret = imgu_->setFormat(PAD_INPUT, &imguFormat);
 	if (ret)
 		return ret;
 
-	LOG(IPU3, Debug) << "ImgU GDC format = " << imguFormat.toString();
+	LOG(IPU3, Debug) << "ImgU GDC format = " << imguFormat;
+
+	return 0;
+}
+
+/**
+ * \brief Crop the ImgU input frame
+ * \param[in] crop The input feeder crop rectangle
+ *
+ * Set the input feeder rectangle to \a crop, and scale the BDS rectangle by
+ * the same factor as the pipe configuration, without downscaling below the GDC
+ * size. The GDC then scales the cropped region to the configured output sizes.
+ * The rectangles are only updated when \a crop differs from the rectangle
+ * currently applied, and can be changed while streaming.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int ImgUDevice::setInputCrop(const Rectangle &crop)
+{
+	if (crop == crop_)
+		return 0;
+
+	Rectangle rect = crop;
+	int ret = imgu_->setCrop(PAD_INPUT, &rect);
+	if (ret)
+		return ret;
+
+	Size size{ rect.w * pipe_.bds.width / pipe_.iif.width,
+		   rect.h * pipe_.bds.height / pipe_.iif.height };
+	size = size.alignedDownTo(2, 4).expandedTo(pipe_.gdc)
+		   .boundedTo({ rect.w, rect.h });
+
+	Rectangle bds = { 0, 0, size.width, size.height };
+	ret = imgu_->setCompose(PAD_INPUT, &bds);
+	if (ret)
+		return ret;
+
+	crop_ = rect;
+
+	LOG(IPU3, Debug) << "ImgU input feeder rectangle = " << rect.toString()
+			 << ", BDS rectangle = " << bds.toString();
 
 	return 0;
 }
@@ -1129,7 +2539,7 @@ int ImgUDevice::configureOutput(ImgUOutput *output,
 		return ret;
 
 	LOG(IPU3, Debug) << "ImgU " << output->name << " format = "
-			 << outputFormat.toString();
+			 << outputFormat;
 
 	return 0;
 }
@@ -1210,6 +2620,10 @@ void ImgUDevice::freeBuffers()
 	if (ret)
 		LOG(IPU3, Error) << "Failed to release ImgU stat buffers";
 
+	ret = param_.dev->releaseBuffers();
+	if (ret)
+		LOG(IPU3, Error) << "Failed to release ImgU param buffers";
+
 	ret = viewfinder_.dev->releaseBuffers();
 	if (ret)
 		LOG(IPU3, Error) << "Failed to release ImgU viewfinder buffers";
@@ -1242,6 +2656,12 @@ int ImgUDevice::start()
 		return ret;
 	}
 
+	ret = param_.dev->streamOn();
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to start ImgU param";
+		return ret;
+	}
+
 	ret = input_->streamOn();
 	if (ret) {
 		LOG(IPU3, Error) << "Failed to start ImgU input";
@@ -1258,64 +2678,51 @@ int ImgUDevice::stop()
 	ret = output_.dev->streamOff();
 	ret |= viewfinder_.dev->streamOff();
 	ret |= stat_.dev->streamOff();
+	ret |= param_.dev->streamOff();
 	ret |= input_->streamOff();
 
 	return ret;
 }
 
-/**
- * \brief Enable or disable a single link on the ImgU instance
- *
- * This method assumes the media device associated with the ImgU instance
- * is open.
- *
- * \return 0 on success or a negative error code otherwise
- */
-int ImgUDevice::linkSetup(const std::string &source, unsigned int sourcePad,
-			  const std::string &sink, unsigned int sinkPad,
-			  bool enable)
-{
-	MediaLink *link = media_->link(source, sourcePad, sink, sinkPad);
-	if (!link) {
-		LOG(IPU3, Error)
-			<< "Failed to get link: '" << source << "':"
-			<< sourcePad << " -> '" << sink << "':" << sinkPad;
-		return -ENODEV;
-	}
-
-	return link->setEnabled(enable);
-}
-
 /**
  * \brief Enable or disable all media links in the ImgU instance to prepare
  * for capture operations
+ * \param[in] links The transaction to add the links to
+ * \param[in] enable True to enable the links, false to disable them
+ *
+ * The links are set up when the \a links transaction is committed.
  *
  * \todo This method will probably be removed or changed once links will be
  * enabled or disabled selectively.
  *
  * \return 0 on success or a negative error code otherwise
  */
-int ImgUDevice::enableLinks(bool enable)
+int ImgUDevice::enableLinks(MediaLinkTransaction *links, bool enable)
 {
 	std::string viewfinderName = name_ + " viewfinder";
 	std::string outputName = name_ + " output";
 	std::string statName = name_ + " 3a stat";
+	std::string paramName = name_ + " parameters";
 	std::string inputName = name_ + " input";
 	int ret;
 
-	ret = linkSetup(inputName, 0, name_, PAD_INPUT, enable);
+	ret = links->setEnabled(inputName, 0, name_, PAD_INPUT, enable);
 	if (ret)
 		return ret;
 
-	ret = linkSetup(name_, PAD_OUTPUT, outputName, 0, enable);
+	ret = links->setEnabled(paramName, 0, name_, PAD_PARAM, enable);
 	if (ret)
 		return ret;
 
-	ret = linkSetup(name_, PAD_VF, viewfinderName, 0, enable);
+	ret = links->setEnabled(name_, PAD_OUTPUT, outputName, 0, enable);
 	if (ret)
 		return ret;
 
-	return linkSetup(name_, PAD_STAT, statName, 0, enable);
+	ret = links->setEnabled(name_, PAD_VF, viewfinderName, 0, enable);
+	if (ret)
+		return ret;
+
+	return links->setEnabled(name_, PAD_STAT, statName, 0, enable);
 }
 
 /*------------------------------------------------------------------------------
@@ -1396,6 +2803,14 @@ int CIO2Device::init(const MediaDevice *media, unsigned int index)
 	if (ret)
 		return ret;
 
+	/*
+	 * The CSI-2 receiver reports the start of frames to notify
+	 * applications early and to apply sensor controls synchronously.
+	 * Not all kernels support it, sensor controls are then applied when
+	 * requests are queued.
+	 */
+	frameStartEvents_ = !csi2_->subscribeEvent(V4L2_EVENT_FRAME_SYNC);
+
 	std::string cio2Name = "ipu3-cio2 " + std::to_string(index);
 	output_ = V4L2VideoDevice::fromEntityName(media, cio2Name);
 	ret = output_->open();
@@ -1407,25 +2822,20 @@ int CIO2Device::init(const MediaDevice *media, unsigned int index)
 
 /**
  * \brief Configure the CIO2 unit
- * \param[in] size The requested CIO2 output frame size
+ * \param[in] format The sensor format selected at validation time
  * \param[out] outputFormat The CIO2 unit output image format
  * \return 0 on success or a negative error code otherwise
  */
-int CIO2Device::configure(const Size &size,
+int CIO2Device::configure(const V4L2SubdeviceFormat &format,
 			  V4L2DeviceFormat *outputFormat)
 {
-	V4L2SubdeviceFormat sensorFormat;
+	V4L2SubdeviceFormat sensorFormat = format;
 	int ret;
 
 	/*
 	 * Apply the selected format to the sensor, the CSI-2 receiver and
 	 * the CIO2 output device.
 	 */
-	sensorFormat = sensor_->getFormat({ MEDIA_BUS_FMT_SBGGR10_1X10,
-					    MEDIA_BUS_FMT_SGBRG10_1X10,
-					    MEDIA_BUS_FMT_SGRBG10_1X10,
-					    MEDIA_BUS_FMT_SRGGB10_1X10 },
-					  size);
 	ret = sensor_->setFormat(&sensorFormat);
 	if (ret)
 		return ret;
@@ -1442,7 +2852,7 @@ int CIO2Device::configure(const Size &size,
 	if (ret)
 		return ret;
 
-	LOG(IPU3, Debug) << "CIO2 output format " << outputFormat->toString();
+	LOG(IPU3, Debug) << "CIO2 output format " << *outputFormat;
 
 	return 0;
 }
@@ -1450,16 +2860,35 @@ int CIO2Device::configure(const Size &size,
 /**
  * \brief Allocate CIO2 memory buffers and export them in a BufferPool
  *
- * Allocate memory buffers in the CIO2 video device and export them to
- * a buffer pool that can be imported by another device.
+ * Allocate memory buffers for the CIO2 video device and export them to
+ * a buffer pool that can be imported by another device. Memory is allocated
+ * with the dmabuf allocator when available, and by the CIO2 driver otherwise.
+ *
+ * The number of buffers sets the depth of the raw frames pipeline between the
+ * CIO2 and the ImgU. It defaults to CIO2_BUFFER_COUNT and can be overridden
+ * with the LIBCAMERA_IPU3_RAW_BUFFERS environment variable.
  *
  * \return The buffer pool with export buffers on success or nullptr otherwise
  */
 BufferPool *CIO2Device::exportBuffers()
 {
-	pool_.createBuffers(CIO2_BUFFER_COUNT);
+	bufferCount_ = CIO2_BUFFER_COUNT;
+
+	const char *count = utils::secure_getenv("LIBCAMERA_IPU3_RAW_BUFFERS");
+	if (count) {
+		unsigned long value = strtoul(count, nullptr, 10);
+		if (value > CIO2_MIN_QUEUED && value <= VIDEO_MAX_FRAME)
+			bufferCount_ = value;
+		else
+			LOG(IPU3, Warning)
+				<< "Invalid raw buffers count " << count;
+	}
 
-	int ret = output_->exportBuffers(&pool_);
+	pool_.createBuffers(bufferCount_);
+
+	int ret = output_->allocateBuffers(&pool_, DmaBufAllocator::instance());
+	if (ret)
+		ret = output_->exportBuffers(&pool_);
 	if (ret) {
 		LOG(IPU3, Error) << "Failed to export CIO2 buffers";
 		return nullptr;
@@ -1472,14 +2901,21 @@ void CIO2Device::freeBuffers()
 {
 	if (output_->releaseBuffers())
 		LOG(IPU3, Error) << "Failed to release CIO2 buffers";
+
+	DmaBufAllocator::instance()->release(&pool_);
 }
 
-int CIO2Device::start(std::vector<std::unique_ptr<Buffer>> *buffers)
+int CIO2Device::queueBuffers(std::vector<std::unique_ptr<Buffer>> *buffers)
 {
 	*buffers = output_->queueAllBuffers();
 	if (buffers->empty())
 		return -EINVAL;
 
+	return 0;
+}
+
+int CIO2Device::start()
+{
 	return output_->streamOn();
 }
 
@@ -1490,18 +2926,123 @@ int CIO2Device::stop()
 
 int CIO2Device::mediaBusToFormat(unsigned int code)
 {
-	switch (code) {
-	case MEDIA_BUS_FMT_SBGGR10_1X10:
-		return V4L2_PIX_FMT_IPU3_SBGGR10;
-	case MEDIA_BUS_FMT_SGBRG10_1X10:
-		return V4L2_PIX_FMT_IPU3_SGBRG10;
-	case MEDIA_BUS_FMT_SGRBG10_1X10:
-		return V4L2_PIX_FMT_IPU3_SGRBG10;
-	case MEDIA_BUS_FMT_SRGGB10_1X10:
-		return V4L2_PIX_FMT_IPU3_SRGGB10;
-	default:
-		return -EINVAL;
+	static constexpr struct {
+		unsigned int code;
+		unsigned int fourcc;
+	} formats[] = {
+		{ MEDIA_BUS_FMT_SBGGR10_1X10, V4L2_PIX_FMT_IPU3_SBGGR10 },
+		{ MEDIA_BUS_FMT_SGBRG10_1X10, V4L2_PIX_FMT_IPU3_SGBRG10 },
+		{ MEDIA_BUS_FMT_SGRBG10_1X10, V4L2_PIX_FMT_IPU3_SGRBG10 },
+		{ MEDIA_BUS_FMT_SRGGB10_1X10, V4L2_PIX_FMT_IPU3_SRGGB10 },
+	};
+
+	for (const auto &entry : formats) {
+		if (entry.code == code)
+			return entry.fourcc;
 	}
+
+	return -EINVAL;
+}
+
+/* -----------------------------------------------------------------------------
+ * Raw Buffer Ring
+ */
+
+/**
+ * \class RawBufferRing
+ * \brief Track the raw buffers shared by the CIO2 and the ImgU
+ *
+ * Raw buffers are captured by the CIO2, wait for a request, and are then
+ * processed by the ImgU before being queued back to the CIO2. The ring owns
+ * the raw buffers and tracks the state of each of them in a single place,
+ * indexed by buffer index, with the waiting buffers stored in a circular FIFO.
+ * The number of buffers in each state gives the occupancy of the raw pipeline.
+ */
+
+/**
+ * \brief Take ownership of the raw \a buffers, all queued to the CIO2
+ * \param[in] buffers The raw buffers
+ */
+void RawBufferRing::reset(std::vector<std::unique_ptr<Buffer>> buffers)
+{
+	buffers_ = std::move(buffers);
+	states_.assign(buffers_.size(), Capturing);
+	waiting_.assign(buffers_.size(), nullptr);
+	head_ = 0;
+
+	counts_[Capturing] = buffers_.size();
+	counts_[Waiting] = 0;
+	counts_[Processing] = 0;
+}
+
+/**
+ * \brief Release all the raw buffers
+ */
+void RawBufferRing::clear()
+{
+	reset({});
+}
+
+/**
+ * \brief Update the state of a raw \a buffer
+ * \param[in] buffer The raw buffer
+ * \param[in] state The new state
+ *
+ * Buffers shall be moved to the Waiting state with push() only.
+ */
+void RawBufferRing::setState(Buffer *buffer, State state)
+{
+	State &current = states_[buffer->index()];
+
+	counts_[current]--;
+	counts_[state]++;
+	current = state;
+}
+
+/**
+ * \brief Add a captured raw \a buffer to the waiting buffers
+ * \param[in] buffer The raw buffer
+ */
+void RawBufferRing::push(Buffer *buffer)
+{
+	unsigned int tail = (head_ + counts_[Waiting]) % waiting_.size();
+
+	waiting_[tail] = buffer;
+	setState(buffer, Waiting);
+}
+
+/**
+ * \brief Remove the oldest raw buffer from the waiting buffers
+ * \param[in] state The new state of the buffer
+ *
+ * At least one buffer shall be waiting when calling this function.
+ *
+ * \return The oldest waiting raw buffer
+ */
+Buffer *RawBufferRing::pop(State state)
+{
+	Buffer *buffer = waiting_[head_];
+
+	waiting_[head_] = nullptr;
+	head_ = (head_ + 1) % waiting_.size();
+	setState(buffer, state);
+
+	return buffer;
+}
+
+/**
+ * \brief Assemble a string describing the raw pipeline occupancy
+ * \return A string describing the number of buffers in each state
+ */
+std::string RawBufferRing::toString() const
+{
+	std::stringstream ss;
+
+	ss << "capturing " << counts_[Capturing]
+	   << ", waiting " << counts_[Waiting]
+	   << ", processing " << counts_[Processing];
+
+	return ss.str();
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerIPU3);
@@ -0,0 +1,744 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * replay.cpp - Pipeline handler replaying captured sessions
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/controls.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "dma_buf_allocator.h"
+#include "log.h"
+#include "pipeline_handler.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Replay)
+
+static constexpr unsigned int REPLAY_BUFFER_COUNT = 4;
+static constexpr unsigned int REPLAY_MAX_BUFFER_COUNT = 32;
+static constexpr unsigned int REPLAY_CONTAINER_VERSION = 1;
+
+/* A recorded frame, located by the offset of its plane data in the file. */
+struct ReplayFrame {
+	unsigned int stream;
+	unsigned int sequence;
+	uint64_t timestamp;
+	unsigned int bytesused;
+	uint64_t offset;
+	unsigned int length;
+};
+
+/* The frames of all streams captured for the same sequence number. */
+struct ReplayCapture {
+	uint64_t timestamp;
+	std::vector<ReplayFrame> frames;
+};
+
+struct ReplayStream {
+	Stream stream;
+	unsigned int pixelFormat;
+	Size size;
+	unsigned int stride;
+	unsigned int bufferSize;
+};
+
+class ReplayCameraData : public CameraData
+{
+public:
+	ReplayCameraData(PipelineHandler *pipe)
+		: CameraData(pipe), fd_(-1), speed_(1.0), memfd_(false),
+		  configured_(0), position_(0), start_(0)
+	{
+	}
+
+	~ReplayCameraData()
+	{
+		if (fd_ != -1)
+			close(fd_);
+	}
+
+	int load(const std::string &path);
+	int readFrame(const ReplayFrame &frame, Plane *plane) const;
+	uint64_t deadline(unsigned int position) const;
+
+	int fd_;
+	std::vector<std::unique_ptr<ReplayStream>> streams_;
+	std::vector<ReplayCapture> captures_;
+
+	/* Replay speed factor, 0 to replay frames as fast as requests allow. */
+	double speed_;
+	bool memfd_;
+	unsigned int configured_;
+
+	Timer timer_;
+	std::queue<Request *> pendingRequests_;
+
+	unsigned int position_;
+	uint64_t start_;
+};
+
+class ReplayCameraConfiguration : public CameraConfiguration
+{
+public:
+	ReplayCameraConfiguration(Camera *camera, ReplayCameraData *data);
+
+	Status validate() override;
+
+private:
+	Status adjust();
+
+	/*
+	 * The ReplayCameraData instance is guaranteed to be valid as long as
+	 * the corresponding Camera instance is valid. In order to borrow a
+	 * reference to the camera data, store a new reference to the camera.
+	 */
+	std::shared_ptr<Camera> camera_;
+	const ReplayCameraData *data_;
+};
+
+class PipelineHandlerReplay : public PipelineHandler
+{
+public:
+	PipelineHandlerReplay(CameraManager *manager);
+	~PipelineHandlerReplay();
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int allocateBuffers(Camera *camera,
+			    const std::set<Stream *> &streams) override;
+	int freeBuffers(Camera *camera,
+			const std::set<Stream *> &streams) override;
+
+	int start(Camera *camera) override;
+	void stop(Camera *camera) override;
+
+	int queueRequest(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+private:
+	ReplayCameraData *cameraData(const Camera *camera)
+	{
+		return static_cast<ReplayCameraData *>(
+			PipelineHandler::cameraData(camera));
+	}
+
+	int allocateStreamBuffers(ReplayCameraData *data, ReplayStream *stream);
+
+	void frameTimeout(Timer *timer);
+	void scheduleFrame(ReplayCameraData *data);
+
+	static std::mutex mutex_;
+	static bool created_;
+
+	bool matched_;
+
+	Camera *activeCamera_;
+};
+
+static uint32_t get32(const uint8_t *data)
+{
+	uint32_t value = 0;
+	for (unsigned int i = 0; i < 4; ++i)
+		value |= static_cast<uint32_t>(data[i]) << (i * 8);
+
+	return value;
+}
+
+static uint64_t get64(const uint8_t *data)
+{
+	return get32(data) | static_cast<uint64_t>(get32(data + 4)) << 32;
+}
+
+static int readAll(int fd, void *data, size_t length, uint64_t offset)
+{
+	uint8_t *mem = static_cast<uint8_t *>(data);
+
+	while (length) {
+		ssize_t ret = pread(fd, mem, length, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (!ret)
+			return -ENODATA;
+
+		mem += ret;
+		offset += ret;
+		length -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse the container written by the cam application, see the BufferWriter
+ * class for a description of the format. The frame records are scanned
+ * sequentially, which also supports files without an index from interrupted
+ * captures.
+ */
+int ReplayCameraData::load(const std::string &path)
+{
+	fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd_ < 0) {
+		int ret = -errno;
+		LOG(Replay, Error)
+			<< "Failed to open " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	uint8_t header[16];
+	int ret = readAll(fd_, header, sizeof(header), 0);
+	if (ret || memcmp(header, "LCCF", 4) ||
+	    get32(header + 4) != REPLAY_CONTAINER_VERSION) {
+		LOG(Replay, Error) << "Invalid container " << path;
+		return -EINVAL;
+	}
+
+	const unsigned int count = get32(header + 8);
+	if (!count) {
+		LOG(Replay, Error) << "Container " << path << " has no stream";
+		return -EINVAL;
+	}
+
+	std::vector<uint8_t> descriptors(count * 16);
+	ret = readAll(fd_, descriptors.data(), descriptors.size(), 16);
+	if (ret) {
+		LOG(Replay, Error) << "Truncated container " << path;
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const uint8_t *data = descriptors.data() + i * 16;
+		ReplayStream *stream = new ReplayStream();
+
+		stream->pixelFormat = get32(data);
+		stream->size = { get32(data + 4), get32(data + 8) };
+		stream->stride = get32(data + 12);
+		stream->bufferSize = 0;
+
+		streams_.emplace_back(stream);
+	}
+
+	uint64_t offset = 16 + descriptors.size();
+
+	while (true) {
+		uint8_t record[32];
+		if (readAll(fd_, record, sizeof(record), offset) ||
+		    memcmp(record, "LCFR", 4))
+			break;
+
+		ReplayFrame frame;
+		frame.stream = get32(record + 4);
+		frame.sequence = get32(record + 8);
+		frame.timestamp = get64(record + 16);
+		frame.bytesused = get32(record + 24);
+
+		const unsigned int planes = get32(record + 12);
+		std::vector<uint8_t> lengths(planes * 4);
+		if (frame.stream >= count ||
+		    readAll(fd_, lengths.data(), lengths.size(), offset + 32))
+			break;
+
+		frame.offset = offset + 32 + lengths.size() + get32(record + 28);
+		frame.length = 0;
+		for (unsigned int i = 0; i < planes; ++i)
+			frame.length += get32(lengths.data() + i * 4);
+
+		/* Skip the last record if it has been truncated. */
+		uint8_t last;
+		if (frame.length &&
+		    readAll(fd_, &last, 1, frame.offset + frame.length - 1))
+			break;
+
+		offset = frame.offset + frame.length;
+
+		ReplayStream *stream = streams_[frame.stream].get();
+		stream->bufferSize = std::max(stream->bufferSize, frame.length);
+
+		/* Records of the same request are written consecutively. */
+		if (captures_.empty() ||
+		    captures_.back().frames[0].sequence != frame.sequence)
+			captures_.push_back({ frame.timestamp, {} });
+
+		captures_.back().frames.push_back(frame);
+	}
+
+	if (captures_.empty()) {
+		LOG(Replay, Error) << "Container " << path << " has no frame";
+		return -EINVAL;
+	}
+
+	LOG(Replay, Debug)
+		<< "Loaded " << captures_.size() << " captures of "
+		<< count << " streams from " << path;
+
+	return 0;
+}
+
+/* Read the data of a recorded frame to the plane. */
+int ReplayCameraData::readFrame(const ReplayFrame &frame, Plane *plane) const
+{
+	void *mem = plane->mem();
+	if (!mem || plane->length() < frame.length)
+		return -EINVAL;
+
+	/* memfd buffers don't support dma-buf synchronisation. */
+	if (!memfd_)
+		plane->beginCpuAccess(Plane::CpuWrite);
+
+	int ret = readAll(fd_, mem, frame.length, frame.offset);
+
+	if (!memfd_)
+		plane->endCpuAccess(Plane::CpuWrite);
+
+	return ret;
+}
+
+/*
+ * Compute the deadline of a capture, keeping the recorded interval from the
+ * first capture, scaled by the replay speed.
+ */
+uint64_t ReplayCameraData::deadline(unsigned int position) const
+{
+	const uint64_t elapsed = captures_[position].timestamp -
+				 captures_[0].timestamp;
+
+	return start_ + static_cast<uint64_t>(elapsed / speed_);
+}
+
+ReplayCameraConfiguration::ReplayCameraConfiguration(Camera *camera, ReplayCameraData *data)
+	: CameraConfiguration()
+{
+	camera_ = camera->shared_from_this();
+	data_ = data;
+}
+
+CameraConfiguration::Status ReplayCameraConfiguration::validate()
+{
+	return data_->configCache_.validate(this, &ReplayCameraConfiguration::adjust);
+}
+
+/*
+ * The recorded streams are replayed as-is. The configuration entries map to
+ * the recorded streams in order, and are adjusted to their format.
+ */
+CameraConfiguration::Status ReplayCameraConfiguration::adjust()
+{
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	if (config_.size() > data_->streams_.size()) {
+		config_.resize(data_->streams_.size());
+		status = Adjusted;
+	}
+
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		StreamConfiguration &cfg = config_[i];
+		const ReplayStream *stream = data_->streams_[i].get();
+
+		if (cfg.pixelFormat != stream->pixelFormat ||
+		    cfg.size != stream->size || cfg.modifier) {
+			LOG(Replay, Debug)
+				<< "Adjusting stream " << i << " to recorded format";
+			cfg.pixelFormat = stream->pixelFormat;
+			cfg.size = stream->size;
+			cfg.modifier = 0;
+			status = Adjusted;
+		}
+
+		const unsigned int bufferCount = cfg.bufferCount;
+
+		cfg.minBufferCount = 1;
+		cfg.maxBufferCount = REPLAY_MAX_BUFFER_COUNT;
+
+		if (!cfg.bufferCount)
+			cfg.bufferCount = REPLAY_BUFFER_COUNT;
+		cfg.bufferCount = std::min(REPLAY_MAX_BUFFER_COUNT, cfg.bufferCount);
+
+		if (cfg.bufferCount != bufferCount)
+			status = Adjusted;
+	}
+
+	return status;
+}
+
+std::mutex PipelineHandlerReplay::mutex_;
+bool PipelineHandlerReplay::created_ = false;
+
+PipelineHandlerReplay::PipelineHandlerReplay(CameraManager *manager)
+	: PipelineHandler(manager), matched_(false), activeCamera_(nullptr)
+{
+}
+
+PipelineHandlerReplay::~PipelineHandlerReplay()
+{
+	if (!matched_)
+		return;
+
+	std::lock_guard<std::mutex> locker(mutex_);
+	created_ = false;
+}
+
+CameraConfiguration *PipelineHandlerReplay::generateConfiguration(Camera *camera,
+	const StreamRoles &roles)
+{
+	ReplayCameraData *data = cameraData(camera);
+	CameraConfiguration *config = new ReplayCameraConfiguration(camera, data);
+
+	/* Roles are assigned to the recorded streams in order. */
+	const unsigned int count = std::min<size_t>(roles.size(),
+						    data->streams_.size());
+	for (unsigned int i = 0; i < count; ++i) {
+		const ReplayStream *stream = data->streams_[i].get();
+		StreamConfiguration cfg{};
+
+		cfg.pixelFormat = stream->pixelFormat;
+		cfg.size = stream->size;
+		cfg.bufferCount = REPLAY_BUFFER_COUNT;
+
+		config->addConfiguration(cfg);
+	}
+
+	if (roles.empty())
+		return config;
+
+	if (config->validate() == CameraConfiguration::Invalid) {
+		delete config;
+		return nullptr;
+	}
+
+	return config;
+}
+
+int PipelineHandlerReplay::configure(Camera *camera, CameraConfiguration *config)
+{
+	ReplayCameraData *data = cameraData(camera);
+
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		StreamConfiguration &cfg = config->at(i);
+		ReplayStream *stream = data->streams_[i].get();
+
+		cfg.stride = stream->stride;
+		cfg.setStream(&stream->stream);
+	}
+
+	data->configured_ = config->size();
+
+	return 0;
+}
+
+int PipelineHandlerReplay::allocateBuffers(Camera *camera,
+					   const std::set<Stream *> &streams)
+{
+	ReplayCameraData *data = cameraData(camera);
+
+	for (unsigned int i = 0; i < data->configured_; ++i) {
+		ReplayStream *stream = data->streams_[i].get();
+
+		if (!streams.count(&stream->stream) ||
+		    stream->stream.memoryType() != InternalMemory)
+			continue;
+
+		int ret = allocateStreamBuffers(data, stream);
+		if (ret) {
+			freeBuffers(camera, streams);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int PipelineHandlerReplay::allocateStreamBuffers(ReplayCameraData *data,
+						 ReplayStream *stream)
+{
+	BufferPool &pool = stream->stream.bufferPool();
+	const unsigned int size = std::max(stream->bufferSize, 1U);
+
+	std::vector<unsigned int> planeSizes = { size };
+	int ret = DmaBufAllocator::instance()->allocate(&pool, planeSizes);
+	if (ret != -ENODEV) {
+		if (ret)
+			LOG(Replay, Error) << "Failed to allocate frame buffers";
+
+		data->memfd_ = false;
+		return ret;
+	}
+
+	/* Fall back to memfd as for virtual cameras. */
+	LOG(Replay, Debug) << "Using memfd for frame buffers";
+
+	for (BufferMemory &mem : pool.buffers()) {
+		mem.planes().clear();
+
+		int fd = memfd_create("libcamera-replay", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, size) < 0) {
+			ret = -errno;
+			LOG(Replay, Error)
+				<< "Failed to allocate frame buffers: "
+				<< strerror(-ret);
+			if (fd >= 0)
+				close(fd);
+			return ret;
+		}
+
+		mem.planes().emplace_back();
+		ret = mem.planes().back().setDmabuf(fd, size);
+		close(fd);
+		if (ret)
+			return ret;
+	}
+
+	data->memfd_ = true;
+
+	return 0;
+}
+
+int PipelineHandlerReplay::freeBuffers(Camera *camera,
+				       const std::set<Stream *> &streams)
+{
+	for (Stream *stream : streams) {
+		if (stream->memoryType() == InternalMemory)
+			DmaBufAllocator::instance()->release(&stream->bufferPool());
+	}
+
+	return 0;
+}
+
+/*
+ * Every capture session replays the recording from its first frame. The replay
+ * clock starts when the first request is queued, for the first frame not to be
+ * dropped depending on how fast the application queues requests.
+ */
+int PipelineHandlerReplay::start(Camera *camera)
+{
+	ReplayCameraData *data = cameraData(camera);
+
+	activeCamera_ = camera;
+
+	const char *speed = utils::secure_getenv("LIBCAMERA_REPLAY_SPEED");
+	data->speed_ = speed ? std::max(0.0, strtod(speed, nullptr)) : 1.0;
+
+	data->position_ = 0;
+	data->start_ = 0;
+
+	return 0;
+}
+
+void PipelineHandlerReplay::stop(Camera *camera)
+{
+	ReplayCameraData *data = cameraData(camera);
+
+	data->timer_.stop();
+	activeCamera_ = nullptr;
+
+	while (!data->pendingRequests_.empty()) {
+		Request *request = data->pendingRequests_.front();
+		data->pendingRequests_.pop();
+
+		for (auto const &it : request->buffers()) {
+			Buffer *buffer = it.second;
+			setBufferMetadata(buffer, nullptr, Buffer::BufferCancelled, 0);
+			completeBuffer(camera, request, buffer);
+		}
+
+		completeRequest(camera, request);
+	}
+}
+
+int PipelineHandlerReplay::queueRequest(Camera *camera, Request *request)
+{
+	ReplayCameraData *data = cameraData(camera);
+
+	for (const auto &it : request->buffers()) {
+		Stream *stream = it.first;
+		auto iter = std::find_if(data->streams_.begin(),
+					 data->streams_.begin() + data->configured_,
+					 [stream](const std::unique_ptr<ReplayStream> &s) {
+						 return &s->stream == stream;
+					 });
+		if (iter == data->streams_.begin() + data->configured_) {
+			LOG(Replay, Error)
+				<< "Attempt to queue request with invalid stream";
+			return -ENOENT;
+		}
+
+		/* Frames are read in place, in the first plane of the buffer. */
+		const std::vector<Plane> &planes = it.second->mem()->planes();
+		if (planes.empty() || planes[0].length() < (*iter)->bufferSize) {
+			LOG(Replay, Error) << "Buffer too small for recorded frames";
+			return -EINVAL;
+		}
+	}
+
+	data->pendingRequests_.push(request);
+
+	PipelineHandler::queueRequest(camera, request);
+
+	/*
+	 * Start the replay with the first request, and resume it when replaying
+	 * as fast as possible.
+	 */
+	if (activeCamera_ && !data->timer_.isRunning()) {
+		if (!data->start_)
+			data->start_ = utils::monotonic_ns();
+		scheduleFrame(data);
+	}
+
+	return 0;
+}
+
+bool PipelineHandlerReplay::match(DeviceEnumerator *enumerator)
+{
+	/*
+	 * A replay camera is created on demand for the container file set by
+	 * the LIBCAMERA_REPLAY_FILE environment variable. The replay speed is
+	 * set when starting capture, as a factor of the recorded frame rate, by
+	 * LIBCAMERA_REPLAY_SPEED, with 0 replaying frames as fast as requests
+	 * are queued.
+	 */
+	const char *path = utils::secure_getenv("LIBCAMERA_REPLAY_FILE");
+	if (!path)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		if (created_)
+			return false;
+
+		created_ = true;
+		matched_ = true;
+	}
+
+	std::unique_ptr<ReplayCameraData> data =
+		utils::make_unique<ReplayCameraData>(this);
+
+	if (data->load(path))
+		return false;
+
+	data->timer_.timeout.connect(this, &PipelineHandlerReplay::frameTimeout);
+
+	/* Frames are read from the file by the CPU. */
+	std::set<Stream *> streams;
+	for (const std::unique_ptr<ReplayStream> &stream : data->streams_) {
+		setCpuAccess(&stream->stream, true);
+		streams.insert(&stream->stream);
+	}
+
+	std::shared_ptr<Camera> camera = Camera::create(this, "Replay", streams);
+	registerCamera(std::move(camera), std::move(data));
+
+	return true;
+}
+
+/*
+ * Arm the timer with the deadline of the next capture. When replaying as fast
+ * as possible the capture is replayed from the next event loop iteration, if
+ * a request is available.
+ */
+void PipelineHandlerReplay::scheduleFrame(ReplayCameraData *data)
+{
+	if (data->position_ >= data->captures_.size()) {
+		LOG(Replay, Debug) << "End of recording";
+		return;
+	}
+
+	if (!data->speed_) {
+		if (!data->pendingRequests_.empty())
+			data->timer_.start(0);
+		return;
+	}
+
+	data->timer_.start(std::chrono::steady_clock::time_point(
+		std::chrono::nanoseconds(data->deadline(data->position_))));
+}
+
+void PipelineHandlerReplay::frameTimeout(Timer *timer)
+{
+	if (!activeCamera_)
+		return;
+
+	Camera *camera = activeCamera_;
+	ReplayCameraData *data = cameraData(camera);
+	const ReplayCapture &capture = data->captures_[data->position_++];
+
+	/* Captures are dropped when no request is available, as by sensors. */
+	if (data->pendingRequests_.empty()) {
+		LOG(Replay, Debug)
+			<< "Dropping capture " << capture.frames[0].sequence;
+		scheduleFrame(data);
+		return;
+	}
+
+	Request *request = data->pendingRequests_.front();
+	data->pendingRequests_.pop();
+
+	/*
+	 * Buffers are completed with the recorded sequence and timestamp, for
+	 * the replay to be deterministic. Buffers of streams missing from the
+	 * recorded capture are completed in error.
+	 */
+	for (auto const &it : request->buffers()) {
+		Buffer *buffer = it.second;
+		const ReplayFrame *frame = nullptr;
+
+		for (const ReplayFrame &f : capture.frames) {
+			if (&data->streams_[f.stream]->stream == it.first) {
+				frame = &f;
+				break;
+			}
+		}
+
+		if (!frame ||
+		    data->readFrame(*frame, &buffer->mem()->planes()[0])) {
+			setBufferMetadata(buffer, Buffer::BufferError, 0,
+					  capture.frames[0].sequence,
+					  capture.timestamp);
+		} else {
+			setBufferMetadata(buffer, Buffer::BufferSuccess,
+					  frame->bytesused, frame->sequence,
+					  frame->timestamp);
+		}
+
+		completeBuffer(camera, request, buffer);
+	}
+
+	request->metadata().set(controls::SensorTimestamp,
+				static_cast<int64_t>(capture.timestamp));
+
+	completeRequest(camera, request);
+
+	scheduleFrame(data);
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerReplay);
+
+} /* namespace libcamera */
@@ -8,17 +8,23 @@
 #include <algorithm>
 #include <array>
 #include <iomanip>
+#include <limits.h>
+#include <list>
 #include <memory>
 #include <vector>
 
 #include <linux/media-bus-format.h>
 
 #include <libcamera/camera.h>
+#include <libcamera/ipa/ipa_interface.h>
+#include <libcamera/ipa/rkisp1.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "camera_sensor.h"
+#include "delayed_controls.h"
 #include "device_enumerator.h"
+#include "ipa_manager.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
@@ -30,11 +36,45 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(RkISP1)
 
+/* Parameters or statistics buffer shared with the IPA. */
+struct RkISP1MetaBuffer {
+	V4L2VideoDevice *dev;
+	std::unique_ptr<Buffer> buffer;
+	/* The buffer is in use by the ISP or the IPA. */
+	bool busy;
+};
+
+/* Buffers and completion state of a frame queued with a request. */
+struct RkISP1Frame {
+	unsigned int frame;
+	Request *request;
+	Buffer *video;
+	RkISP1MetaBuffer *param;
+	RkISP1MetaBuffer *stat;
+	bool videoDone;
+	bool statDone;
+};
+
+class RkISP1Stream : public Stream
+{
+public:
+	RkISP1Stream()
+		: active_(false), video_(nullptr)
+	{
+	}
+
+	bool active_;
+	std::string name_;
+	V4L2VideoDevice *video_;
+	/* Largest output size supported by the path. */
+	Size maxSize_;
+};
+
 class RkISP1CameraData : public CameraData
 {
 public:
 	RkISP1CameraData(PipelineHandler *pipe)
-		: CameraData(pipe), sensor_(nullptr)
+		: CameraData(pipe), sensor_(nullptr), frame_(0), spareFrames_(0)
 	{
 	}
 
@@ -43,8 +83,46 @@ public:
 		delete sensor_;
 	}
 
-	Stream stream_;
+	unsigned int bufferId(const RkISP1MetaBuffer *meta) const
+	{
+		return meta - metaBuffers_.data() + 1;
+	}
+
+	RkISP1MetaBuffer *freeMetaBuffer(V4L2VideoDevice *dev);
+	RkISP1Frame *findFrame(const RkISP1MetaBuffer *meta);
+	RkISP1Frame *findFrame(const Request *request);
+
+	Rectangle adjustCrop(const Rectangle &crop) const;
+
+	RkISP1Stream mainPathStream_;
+	RkISP1Stream selfPathStream_;
 	CameraSensor *sensor_;
+
+	/*
+	 * Scaler crop region requested for the camera, the region applied to
+	 * the ISP input, and the size of the ISP input frame.
+	 */
+	Rectangle crop_;
+	Rectangle ispCrop_;
+	Size inputSize_;
+
+	/* Sensor controls applied at frame start, with the sensor delays. */
+	std::unique_ptr<DelayedControls> delayedCtrls_;
+
+	std::unique_ptr<IPAInterface> ipa_;
+
+	/*
+	 * Parameters and statistics buffers shared with the IPA. The IPA
+	 * buffer ID of each buffer is its index plus one.
+	 */
+	std::vector<RkISP1MetaBuffer> metaBuffers_;
+
+	/* Frames queued to the ISP, in queue order. */
+	std::list<RkISP1Frame> frames_;
+	unsigned int frame_;
+
+	/* Frames captured into spare buffers before the camera was started. */
+	uint64_t spareFrames_;
 };
 
 class RkISP1CameraConfiguration : public CameraConfiguration
@@ -55,9 +133,15 @@ public:
 	Status validate() override;
 
 	const V4L2SubdeviceFormat &sensorFormat() { return sensorFormat_; }
+	const std::vector<const RkISP1Stream *> &streams() { return streams_; }
 
 private:
 	static constexpr unsigned int RKISP1_BUFFER_COUNT = 4;
+	static constexpr unsigned int RKISP1_MIN_BUFFER_COUNT = 2;
+	static constexpr unsigned int RKISP1_MAX_BUFFER_COUNT = 32;
+
+	Status adjust();
+	void adjustStream(StreamConfiguration &cfg, const RkISP1Stream *stream);
 
 	/*
 	 * The RkISP1CameraData instance is guaranteed to be valid as long as the
@@ -68,6 +152,7 @@ private:
 	const RkISP1CameraData *data_;
 
 	V4L2SubdeviceFormat sensorFormat_;
+	std::vector<const RkISP1Stream *> streams_;
 };
 
 class PipelineHandlerRkISP1 : public PipelineHandler
@@ -89,7 +174,9 @@ public:
 	void stop(Camera *camera) override;
 
 	int queueRequest(Camera *camera, Request *request) override;
+	MemoryUsage memoryUsage(const Camera *camera) override;
 
+	static std::vector<DeviceMatch> deviceMatches();
 	bool match(DeviceEnumerator *enumerator) override;
 
 private:
@@ -99,16 +186,32 @@ private:
 			PipelineHandler::cameraData(camera));
 	}
 
+	static constexpr unsigned int RKISP1_META_BUFFER_COUNT = 4;
+	static constexpr unsigned int RKISP1_SPARE_BUFFER_COUNT = 1;
+
 	int initLinks();
 	int createCamera(MediaEntity *sensor);
+	void tryCompleteFrame(RkISP1CameraData *data, RkISP1Frame *frame);
+	void frameStart(uint32_t sequence, uint64_t timestamp);
 	void bufferReady(Buffer *buffer);
+	void paramReady(Buffer *buffer);
+	void statReady(Buffer *buffer);
+	void queueFrameAction(unsigned int frame,
+			      const IPAOperationData &action);
 
 	MediaDevice *media_;
 	V4L2Subdevice *dphy_;
 	V4L2Subdevice *isp_;
-	V4L2VideoDevice *video_;
+	V4L2VideoDevice *mainPath_;
+	V4L2VideoDevice *selfPath_;
+	V4L2VideoDevice *param_;
+	V4L2VideoDevice *stat_;
+
+	BufferPool paramPool_;
+	BufferPool statPool_;
 
 	Camera *activeCamera_;
+	bool frameStartEvents_;
 };
 
 RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
@@ -119,7 +222,8 @@ RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 	data_ = data;
 }
 
-CameraConfiguration::Status RkISP1CameraConfiguration::validate()
+void RkISP1CameraConfiguration::adjustStream(StreamConfiguration &cfg,
+					     const RkISP1Stream *stream)
 {
 	static const std::array<unsigned int, 8> formats{
 		V4L2_PIX_FMT_YUYV,
@@ -132,29 +236,89 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 		V4L2_PIX_FMT_GREY,
 	};
 
+	/* Adjust the pixel format. */
+	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
+	    formats.end()) {
+		LOG(RkISP1, Debug) << "Adjusting format to NV12";
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+	}
+
+	/* The ISP doesn't support tiled or compressed formats. */
+	if (cfg.modifier) {
+		LOG(RkISP1, Debug) << "Adjusting modifier to linear";
+		cfg.modifier = 0;
+	}
+
+	/*
+	 * Provide a suitable default that matches the sensor aspect
+	 * ratio and clamp the size to the bounds of the path.
+	 *
+	 * \todo: Check the hardware alignment constraints.
+	 */
+	if (!cfg.size.width || !cfg.size.height) {
+		cfg.size.width = 1280;
+		cfg.size.height = 1280 * sensorFormat_.size.height
+				/ sensorFormat_.size.width;
+	}
+
+	cfg.size = cfg.size.boundedTo(stream->maxSize_).expandedTo({ 32, 16 });
+
+	cfg.minBufferCount = RKISP1_MIN_BUFFER_COUNT;
+	cfg.maxBufferCount = RKISP1_MAX_BUFFER_COUNT;
+
+	if (!cfg.bufferCount)
+		cfg.bufferCount = RKISP1_BUFFER_COUNT;
+	else if (cfg.bufferCount < RKISP1_MIN_BUFFER_COUNT)
+		cfg.bufferCount = RKISP1_MIN_BUFFER_COUNT;
+	else if (cfg.bufferCount > RKISP1_MAX_BUFFER_COUNT)
+		cfg.bufferCount = RKISP1_MAX_BUFFER_COUNT;
+}
+
+CameraConfiguration::Status RkISP1CameraConfiguration::validate()
+{
+	return data_->configCache_.validate(this, &RkISP1CameraConfiguration::adjust);
+}
+
+CameraConfiguration::Status RkISP1CameraConfiguration::adjust()
+{
 	const CameraSensor *sensor = data_->sensor_;
 	Status status = Valid;
 
 	if (config_.empty())
 		return Invalid;
 
+	/* The video devices only capture to driver or dmabuf memory. */
+	for (const StreamConfiguration &cfg : config_) {
+		if (cfg.memoryType == UserPtrMemory)
+			return Invalid;
+	}
+
 	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 1) {
-		config_.resize(1);
+	if (config_.size() > 2) {
+		config_.resize(2);
 		status = Adjusted;
 	}
 
-	StreamConfiguration &cfg = config_[0];
+	/*
+	 * Select the sensor format from the largest requested size, the ISP
+	 * can then downscale on both paths.
+	 */
+	Size size = {};
+	unsigned int largest = 0;
 
-	/* Adjust the pixel format. */
-	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
-	    formats.end()) {
-		LOG(RkISP1, Debug) << "Adjusting format to NV12";
-		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
-		status = Adjusted;
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		const Size &cfgSize = config_[i].size;
+
+		if (cfgSize.width > size.width)
+			size.width = cfgSize.width;
+		if (cfgSize.height > size.height)
+			size.height = cfgSize.height;
+
+		if (cfgSize.width * cfgSize.height >
+		    config_[largest].size.width * config_[largest].size.height)
+			largest = i;
 	}
 
-	/* Select the sensor format. */
 	sensorFormat_ = sensor->getFormat({ MEDIA_BUS_FMT_SBGGR12_1X12,
 					    MEDIA_BUS_FMT_SGBRG12_1X12,
 					    MEDIA_BUS_FMT_SGRBG12_1X12,
@@ -167,48 +331,61 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 					    MEDIA_BUS_FMT_SGBRG8_1X8,
 					    MEDIA_BUS_FMT_SGRBG8_1X8,
 					    MEDIA_BUS_FMT_SRGGB8_1X8 },
-					  cfg.size);
+					  size);
 	if (!sensorFormat_.size.width || !sensorFormat_.size.height)
 		sensorFormat_.size = sensor->resolution();
 
 	/*
-	 * Provide a suitable default that matches the sensor aspect
-	 * ratio and clamp the size to the hardware bounds.
-	 *
-	 * \todo: Check the hardware alignment constraints.
+	 * Verify and update all configuration entries, and assign a stream to
+	 * each of them. The self path is limited to smaller resolutions than
+	 * the main path, so assign the main path to the largest stream and the
+	 * self path to the other one.
 	 */
-	const Size size = cfg.size;
+	streams_.clear();
+	streams_.reserve(config_.size());
+
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		StreamConfiguration &cfg = config_[i];
+		const unsigned int pixelFormat = cfg.pixelFormat;
+		const uint64_t modifier = cfg.modifier;
+		const Size cfgSize = cfg.size;
+		const unsigned int bufferCount = cfg.bufferCount;
+		const RkISP1Stream *stream = i == largest
+					   ? &data_->mainPathStream_
+					   : &data_->selfPathStream_;
 
-	if (!cfg.size.width || !cfg.size.height) {
-		cfg.size.width = 1280;
-		cfg.size.height = 1280 * sensorFormat_.size.height
-				/ sensorFormat_.size.width;
-	}
+		LOG(RkISP1, Debug)
+			<< "Assigned '" << stream->name_ << "' to stream " << i;
 
-	cfg.size.width = std::max(32U, std::min(4416U, cfg.size.width));
-	cfg.size.height = std::max(16U, std::min(3312U, cfg.size.height));
+		adjustStream(cfg, stream);
 
-	if (cfg.size != size) {
-		LOG(RkISP1, Debug)
-			<< "Adjusting size from " << size.toString()
-			<< " to " << cfg.size.toString();
-		status = Adjusted;
-	}
+		if (cfg.pixelFormat != pixelFormat || cfg.modifier != modifier ||
+		    cfg.size != cfgSize || cfg.bufferCount != bufferCount) {
+			LOG(RkISP1, Debug)
+				<< "Stream " << i << " configuration adjusted to "
+				<< cfg;
+			status = Adjusted;
+		}
 
-	cfg.bufferCount = RKISP1_BUFFER_COUNT;
+		streams_.push_back(stream);
+	}
 
 	return status;
 }
 
 PipelineHandlerRkISP1::PipelineHandlerRkISP1(CameraManager *manager)
 	: PipelineHandler(manager), dphy_(nullptr), isp_(nullptr),
-	  video_(nullptr)
+	  mainPath_(nullptr), selfPath_(nullptr), param_(nullptr),
+	  stat_(nullptr), activeCamera_(nullptr), frameStartEvents_(false)
 {
 }
 
 PipelineHandlerRkISP1::~PipelineHandlerRkISP1()
 {
-	delete video_;
+	delete stat_;
+	delete param_;
+	delete selfPath_;
+	delete mainPath_;
 	delete isp_;
 	delete dphy_;
 }
@@ -226,11 +403,41 @@ CameraConfiguration *PipelineHandlerRkISP1::generateConfiguration(Camera *camera
 	if (roles.empty())
 		return config;
 
-	StreamConfiguration cfg{};
-	cfg.pixelFormat = V4L2_PIX_FMT_NV12;
-	cfg.size = data->sensor_->resolution();
+	if (roles.size() > 2) {
+		LOG(RkISP1, Error) << "Too many stream roles requested";
+		delete config;
+		return nullptr;
+	}
+
+	for (const StreamRole role : roles) {
+		StreamConfiguration cfg{};
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
 
-	config->addConfiguration(cfg);
+		switch (role) {
+		case StreamRole::StillCapture:
+		case StreamRole::VideoRecording:
+			cfg.size = data->sensor_->resolution();
+			break;
+
+		case StreamRole::Viewfinder: {
+			/*
+			 * Default to a viewfinder size suitable for the self
+			 * path, limited by the sensor resolution.
+			 */
+			const Size &res = data->sensor_->resolution();
+			cfg.size = res.boundedTo({ 1280, 720 });
+			break;
+		}
+
+		default:
+			LOG(RkISP1, Error)
+				<< "Requested stream role not supported: " << role;
+			delete config;
+			return nullptr;
+		}
+
+		config->addConfiguration(cfg);
+	}
 
 	config->validate();
 
@@ -242,45 +449,51 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	RkISP1CameraConfiguration *config =
 		static_cast<RkISP1CameraConfiguration *>(c);
 	RkISP1CameraData *data = cameraData(camera);
-	StreamConfiguration &cfg = config->at(0);
 	CameraSensor *sensor = data->sensor_;
 	int ret;
 
 	/*
 	 * Configure the sensor links: enable the link corresponding to this
-	 * camera and disable all the other sensor links.
+	 * camera and disable all the other sensor links. Enable the self path
+	 * link if the self path stream is used. Only the links whose state
+	 * changes are set up when the transaction is committed.
 	 */
+	MediaLinkTransaction links(media_);
 	const MediaPad *pad = dphy_->entity()->getPadByIndex(0);
 
 	for (MediaLink *link : pad->links()) {
 		bool enable = link->source()->entity() == sensor->entity();
 
-		if (!!(link->flags() & MEDIA_LNK_FL_ENABLED) == enable)
-			continue;
-
-		LOG(RkISP1, Debug)
-			<< (enable ? "Enabling" : "Disabling")
-			<< " link from sensor '"
-			<< link->source()->entity()->name()
-			<< "' to CSI-2 receiver";
-
-		ret = link->setEnabled(enable);
+		ret = links.setEnabled(link, enable);
 		if (ret < 0)
 			return ret;
 	}
 
+	bool useSelfPath = false;
+	for (const RkISP1Stream *stream : config->streams())
+		useSelfPath |= stream == &data->selfPathStream_;
+
+	ret = links.setEnabled("rkisp1-isp-subdev", 2, "rkisp1_selfpath", 0,
+			       useSelfPath);
+	if (ret < 0)
+		return ret;
+
+	ret = links.commit();
+	if (ret < 0)
+		return ret;
+
 	/*
 	 * Configure the format on the sensor output and propagate it through
 	 * the pipeline.
 	 */
 	V4L2SubdeviceFormat format = config->sensorFormat();
-	LOG(RkISP1, Debug) << "Configuring sensor with " << format.toString();
+	LOG(RkISP1, Debug) << "Configuring sensor with " << format;
 
 	ret = sensor->setFormat(&format);
 	if (ret < 0)
 		return ret;
 
-	LOG(RkISP1, Debug) << "Sensor configured with " << format.toString();
+	LOG(RkISP1, Debug) << "Sensor configured with " << format;
 
 	ret = dphy_->setFormat(0, &format);
 	if (ret < 0)
@@ -294,23 +507,44 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	if (ret < 0)
 		return ret;
 
-	V4L2DeviceFormat outputFormat = {};
-	outputFormat.fourcc = cfg.pixelFormat;
-	outputFormat.size = cfg.size;
-	outputFormat.planesCount = 2;
+	/* Setting the format resets the ISP input crop to the full frame. */
+	data->inputSize_ = format.size;
+	data->crop_ = { 0, 0, format.size.width, format.size.height };
+	data->ispCrop_ = data->crop_;
 
-	ret = video_->setFormat(&outputFormat);
-	if (ret)
-		return ret;
+	/*
+	 * Enable the self path link only when the self path is in use. The
+	 * main path is always used.
+	 */
+	data->mainPathStream_.active_ = false;
+	data->selfPathStream_.active_ = false;
 
-	if (outputFormat.size != cfg.size ||
-	    outputFormat.fourcc != cfg.pixelFormat) {
-		LOG(RkISP1, Error)
-			<< "Unable to configure capture in " << cfg.toString();
-		return -EINVAL;
-	}
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		StreamConfiguration &cfg = config->at(i);
+		RkISP1Stream *stream =
+			const_cast<RkISP1Stream *>(config->streams()[i]);
+
+		V4L2DeviceFormat outputFormat = {};
+		outputFormat.fourcc = cfg.pixelFormat;
+		outputFormat.size = cfg.size;
+		outputFormat.planesCount = 2;
+
+		ret = stream->video_->setFormat(&outputFormat);
+		if (ret)
+			return ret;
 
-	cfg.setStream(&data->stream_);
+		if (outputFormat.size != cfg.size ||
+		    outputFormat.fourcc != cfg.pixelFormat) {
+			LOG(RkISP1, Error)
+				<< "Unable to configure " << stream->name_
+				<< " in " << cfg;
+			return -EINVAL;
+		}
+
+		cfg.stride = outputFormat.planes[0].bpl;
+		cfg.setStream(stream);
+		stream->active_ = true;
+	}
 
 	return 0;
 }
@@ -318,31 +552,169 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 int PipelineHandlerRkISP1::allocateBuffers(Camera *camera,
 					   const std::set<Stream *> &streams)
 {
-	Stream *stream = *streams.begin();
+	RkISP1CameraData *data = cameraData(camera);
+	int ret;
+
+	/*
+	 * The ISP paths capture directly to the request buffers. Keep their
+	 * queues primed with spare buffers when the application doesn't queue
+	 * requests fast enough, the frames captured in the spare buffers are
+	 * dropped and reported in the camera statistics.
+	 */
+	unsigned int spareCount = std::max<unsigned int>(spareBufferCount(),
+							 RKISP1_SPARE_BUFFER_COUNT);
+
+	for (Stream *s : streams) {
+		RkISP1Stream *stream = static_cast<RkISP1Stream *>(s);
+
+		stream->video_->setSpareBufferCount(spareCount);
+
+		if (stream->memoryType() == InternalMemory)
+			ret = stream->video_->exportBuffers(&stream->bufferPool());
+		else
+			ret = stream->video_->importBuffers(&stream->bufferPool());
+		if (ret) {
+			LOG(RkISP1, Error)
+				<< "Failed to allocate buffers for "
+				<< stream->name_;
+			freeBuffers(camera, streams);
+			return ret;
+		}
+	}
 
-	if (stream->memoryType() == InternalMemory)
-		return video_->exportBuffers(&stream->bufferPool());
-	else
-		return video_->importBuffers(&stream->bufferPool());
+	/*
+	 * Provide a parameters and statistics buffer for each request that can
+	 * be queued, to avoid starving the deeper queues.
+	 */
+	unsigned int metaCount = RKISP1_META_BUFFER_COUNT;
+	for (Stream *s : streams)
+		metaCount = std::max(metaCount, s->configuration().bufferCount);
+
+	paramPool_.createBuffers(metaCount);
+	ret = param_->exportBuffers(&paramPool_);
+	if (ret) {
+		LOG(RkISP1, Error) << "Failed to allocate parameters buffers";
+		freeBuffers(camera, streams);
+		return ret;
+	}
+
+	statPool_.createBuffers(metaCount);
+	ret = stat_->exportBuffers(&statPool_);
+	if (ret) {
+		LOG(RkISP1, Error) << "Failed to allocate statistics buffers";
+		freeBuffers(camera, streams);
+		return ret;
+	}
+
+	/* Share the parameters and statistics buffers with the IPA. */
+	std::vector<IPABuffer> ipaBuffers;
+
+	for (BufferPool *pool : { &paramPool_, &statPool_ }) {
+		V4L2VideoDevice *dev = pool == &paramPool_ ? param_ : stat_;
+		std::vector<BufferMemory> &memories = pool->buffers();
+
+		for (unsigned int i = 0; i < memories.size(); ++i) {
+			data->metaBuffers_.push_back({ dev,
+						       utils::make_unique<Buffer>(i),
+						       false });
+
+			ipaBuffers.emplace_back();
+			IPABuffer &ipaBuffer = ipaBuffers.back();
+			ipaBuffer.id = data->metaBuffers_.size();
+
+			for (const Plane &plane : memories[i].planes()) {
+				ipaBuffer.memory.planes().emplace_back();
+				ipaBuffer.memory.planes().back().setDmabuf(plane.dmabuf(),
+									   plane.length());
+			}
+		}
+	}
+
+	if (data->ipa_)
+		data->ipa_->mapBuffers(ipaBuffers);
+
+	return 0;
 }
 
 int PipelineHandlerRkISP1::freeBuffers(Camera *camera,
 				       const std::set<Stream *> &streams)
 {
-	if (video_->releaseBuffers())
-		LOG(RkISP1, Error) << "Failed to release buffers";
+	RkISP1CameraData *data = cameraData(camera);
+
+	if (data->ipa_ && !data->metaBuffers_.empty()) {
+		std::vector<unsigned int> ids;
+		for (unsigned int id = 1; id <= data->metaBuffers_.size(); ++id)
+			ids.push_back(id);
+
+		data->ipa_->unmapBuffers(ids);
+	}
+
+	data->metaBuffers_.clear();
+
+	if (param_->releaseBuffers())
+		LOG(RkISP1, Error) << "Failed to release parameters buffers";
+
+	if (stat_->releaseBuffers())
+		LOG(RkISP1, Error) << "Failed to release statistics buffers";
+
+	for (Stream *s : streams) {
+		RkISP1Stream *stream = static_cast<RkISP1Stream *>(s);
+
+		if (stream->video_->releaseBuffers())
+			LOG(RkISP1, Error)
+				<< "Failed to release buffers for "
+				<< stream->name_;
+	}
 
 	return 0;
 }
 
 int PipelineHandlerRkISP1::start(Camera *camera)
 {
+	RkISP1CameraData *data = cameraData(camera);
 	int ret;
 
-	ret = video_->streamOn();
-	if (ret)
+	data->frame_ = 0;
+	data->spareFrames_ = mainPath_->spareFrames() + selfPath_->spareFrames();
+
+	if (frameStartEvents_)
+		data->delayedCtrls_->reset();
+
+	ret = param_->streamOn();
+	if (ret) {
+		LOG(RkISP1, Error)
+			<< "Failed to start parameters " << camera->name();
+		return ret;
+	}
+
+	ret = stat_->streamOn();
+	if (ret) {
+		param_->streamOff();
+		LOG(RkISP1, Error)
+			<< "Failed to start statistics " << camera->name();
+		return ret;
+	}
+
+	ret = mainPath_->streamOn();
+	if (ret) {
+		param_->streamOff();
+		stat_->streamOff();
 		LOG(RkISP1, Error)
 			<< "Failed to start camera " << camera->name();
+		return ret;
+	}
+
+	if (data->selfPathStream_.active_) {
+		ret = selfPath_->streamOn();
+		if (ret) {
+			mainPath_->streamOff();
+			param_->streamOff();
+			stat_->streamOff();
+			LOG(RkISP1, Error)
+				<< "Failed to start self path " << camera->name();
+			return ret;
+		}
+	}
 
 	activeCamera_ = camera;
 
@@ -351,67 +723,184 @@ int PipelineHandlerRkISP1::start(Camera *camera)
 
 void PipelineHandlerRkISP1::stop(Camera *camera)
 {
+	RkISP1CameraData *data = cameraData(camera);
 	int ret;
 
-	ret = video_->streamOff();
+	ret = 0;
+	if (data->selfPathStream_.active_)
+		ret |= selfPath_->streamOff();
+	ret |= mainPath_->streamOff();
+	ret |= stat_->streamOff();
+	ret |= param_->streamOff();
 	if (ret)
 		LOG(RkISP1, Warning)
 			<< "Failed to stop camera " << camera->name();
 
+	uint64_t dropped = mainPath_->spareFrames() + selfPath_->spareFrames()
+			 - data->spareFrames_;
+	if (dropped)
+		LOG(RkISP1, Info)
+			<< dropped << " frames dropped due to request starvation";
+
+	/*
+	 * All buffers have been cancelled, complete the requests still waiting
+	 * for the IPA and ignore the actions it will queue for them.
+	 */
+	for (RkISP1Frame &frame : data->frames_)
+		completeRequest(camera, frame.request);
+	data->frames_.clear();
+
+	for (RkISP1MetaBuffer &meta : data->metaBuffers_)
+		meta.busy = false;
+
 	activeCamera_ = nullptr;
 }
 
 int PipelineHandlerRkISP1::queueRequest(Camera *camera, Request *request)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	Stream *stream = &data->stream_;
+	Buffer *video = nullptr;
 
-	Buffer *buffer = request->findBuffer(stream);
-	if (!buffer) {
-		LOG(RkISP1, Error)
-			<< "Attempt to queue request with invalid stream";
-		return -ENOENT;
+	for (auto const &it : request->buffers()) {
+		RkISP1Stream *stream = static_cast<RkISP1Stream *>(it.first);
+		Buffer *buffer = it.second;
+
+		if (!stream->active_) {
+			LOG(RkISP1, Error)
+				<< "Attempt to queue request with invalid stream";
+			return -ENOENT;
+		}
+
+		int ret = stream->video_->queueBuffer(buffer);
+		if (ret < 0)
+			return ret;
+
+		if (!video)
+			video = buffer;
 	}
 
-	int ret = video_->queueBuffer(buffer);
-	if (ret < 0)
-		return ret;
+	/*
+	 * Apply the frame duration through the sensor vertical blanking. When
+	 * the ISP reports frame start events, the sensor controls are queued
+	 * for the frame the request will be captured in, and written at the
+	 * frame start that accounts for the sensor control delays. Controls
+	 * are pushed for every request to keep the queue aligned with frames.
+	 */
+	V4L2ControlList sensorCtrls;
+	if (request->controls().contains(FrameDuration)) {
+		uint64_t duration = request->controls().get(controls::FrameDuration)
+				  * 1000ULL;
+		int64_t vblank;
+
+		if (!frameStartEvents_) {
+			if (data->sensor_->setFrameDuration(&duration))
+				LOG(RkISP1, Warning) << "Failed to set frame duration";
+		} else if (!data->sensor_->frameDurationToVblank(duration, &vblank)) {
+			sensorCtrls.add(V4L2_CID_VBLANK, vblank);
+		}
+	}
+
+	if (frameStartEvents_ && !data->delayedCtrls_->push(sensorCtrls))
+		LOG(RkISP1, Warning) << "Failed to queue sensor controls";
+
+	/*
+	 * Apply the scaler crop region through the ISP input crop, and report
+	 * the region used to process the request.
+	 *
+	 * \todo Apply the control synchronously with the frame it belongs to.
+	 */
+	if (request->controls().contains(ScalerCrop)) {
+		const Rectangle &crop = request->controls().get(controls::ScalerCrop);
+		data->crop_ = data->adjustCrop(crop);
+	}
+
+	if (data->crop_ != data->ispCrop_) {
+		Rectangle rect = data->crop_;
+		if (!isp_->setCrop(0, &rect))
+			data->ispCrop_ = rect;
+		else
+			LOG(RkISP1, Warning)
+				<< "Failed to set crop " << data->crop_.toString();
+	}
+
+	request->metadata().set(controls::ScalerCrop, data->ispCrop_);
+
+	/*
+	 * Capture statistics for the frame, and let the IPA fill parameters
+	 * for it. Frames are processed without statistics or new parameters
+	 * when no buffer is available.
+	 */
+	RkISP1Frame frame = {};
+	frame.frame = data->frame_++;
+	frame.request = request;
+	frame.video = video;
+	frame.stat = data->freeMetaBuffer(stat_);
+	frame.param = data->ipa_ ? data->freeMetaBuffer(param_) : nullptr;
+
+	if (frame.stat) {
+		frame.stat->busy = true;
+		stat_->queueBuffer(frame.stat->buffer.get());
+	}
+
+	if (frame.param) {
+		frame.param->busy = true;
+
+		IPAOperationData event;
+		event.operation = RkISP1EventFillParams;
+		event.data.push_back(data->bufferId(frame.param));
+		data->ipa_->processEvent(frame.frame, event);
+	}
+
+	data->frames_.push_back(frame);
 
 	PipelineHandler::queueRequest(camera, request);
 
 	return 0;
 }
 
+/*
+ * The ISP parameters and statistics buffers, and the spare buffers of the ISP
+ * paths, are allocated internally.
+ */
+MemoryUsage PipelineHandlerRkISP1::memoryUsage(const Camera *camera)
+{
+	std::vector<const BufferPool *> pools = { &paramPool_, &statPool_ };
+	MemoryUsage usage;
+
+	for (const V4L2VideoDevice *dev : { mainPath_, selfPath_ }) {
+		if (dev->sparePool())
+			pools.push_back(dev->sparePool());
+	}
+
+	for (const BufferPool *pool : pools) {
+		usage.allocated += pool->size();
+		usage.mapped += pool->mappedSize();
+	}
+
+	return usage;
+}
+
 /* -----------------------------------------------------------------------------
  * Match and Setup
  */
 
 int PipelineHandlerRkISP1::initLinks()
 {
-	MediaLink *link;
+	MediaLinkTransaction links(media_);
 	int ret;
 
-	ret = media_->disableLinks();
-	if (ret < 0)
-		return ret;
+	links.disableAll();
 
-	link = media_->link("rockchip-sy-mipi-dphy", 1, "rkisp1-isp-subdev", 0);
-	if (!link)
-		return -ENODEV;
-
-	ret = link->setEnabled(true);
+	ret = links.setEnabled("rockchip-sy-mipi-dphy", 1, "rkisp1-isp-subdev", 0,
+			       true);
 	if (ret < 0)
 		return ret;
 
-	link = media_->link("rkisp1-isp-subdev", 2, "rkisp1_mainpath", 0);
-	if (!link)
-		return -ENODEV;
-
-	ret = link->setEnabled(true);
+	ret = links.setEnabled("rkisp1-isp-subdev", 2, "rkisp1_mainpath", 0, true);
 	if (ret < 0)
 		return ret;
 
-	return 0;
+	return links.commit();
 }
 
 int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
@@ -426,7 +915,49 @@ int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
 	if (ret)
 		return ret;
 
-	std::set<Stream *> streams{ &data->stream_ };
+	data->delayedCtrls_ =
+		utils::make_unique<DelayedControls>(data->sensor_->device(),
+						    data->sensor_->controlDelays());
+
+	/* Expose the frame duration control when the sensor supports it. */
+	uint64_t minDuration;
+	uint64_t maxDuration;
+	if (!data->sensor_->frameDurationLimits(&minDuration, &maxDuration)) {
+		int min = minDuration / 1000;
+		int max = std::min<uint64_t>(maxDuration / 1000, INT_MAX);
+
+		data->controlInfo_.insert(ControlInfo(FrameDuration, min, max));
+	}
+
+	/* The scaler crop region is bounded by the sensor resolution. */
+	const Size &resolution = data->sensor_->resolution();
+	Rectangle maxCrop = { 0, 0, resolution.width, resolution.height };
+	data->controlInfo_.insert(ControlInfo(ScalerCrop, Rectangle{},
+					      maxCrop));
+
+	/*
+	 * The IPA is optional, statistics are then discarded and the ISP
+	 * keeps its current parameters.
+	 */
+	data->ipa_ = IPAManager::instance()->createIPA(this, 0, 0);
+	if (data->ipa_) {
+		data->ipa_->queueFrameAction.connect(this,
+				&PipelineHandlerRkISP1::queueFrameAction);
+		data->ipa_->init();
+	}
+
+	data->mainPathStream_.name_ = "main";
+	data->mainPathStream_.video_ = mainPath_;
+	data->mainPathStream_.maxSize_ = { 4416, 3312 };
+
+	data->selfPathStream_.name_ = "self";
+	data->selfPathStream_.video_ = selfPath_;
+	data->selfPathStream_.maxSize_ = { 1920, 1920 };
+
+	std::set<Stream *> streams{
+		&data->mainPathStream_,
+		&data->selfPathStream_,
+	};
 	std::shared_ptr<Camera> camera =
 		Camera::create(this, sensor->name(), streams);
 	registerCamera(std::move(camera), std::move(data));
@@ -434,10 +965,8 @@ int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
 	return 0;
 }
 
-bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
+std::vector<DeviceMatch> PipelineHandlerRkISP1::deviceMatches()
 {
-	const MediaPad *pad;
-
 	DeviceMatch dm("rkisp1");
 	dm.add("rkisp1-isp-subdev");
 	dm.add("rkisp1_selfpath");
@@ -446,7 +975,14 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	dm.add("rkisp1-input-params");
 	dm.add("rockchip-sy-mipi-dphy");
 
-	media_ = acquireMediaDevice(enumerator, dm);
+	return { dm };
+}
+
+bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
+{
+	const MediaPad *pad;
+
+	media_ = acquireMediaDevice(enumerator, deviceMatches()[0]);
 	if (!media_)
 		return false;
 
@@ -459,12 +995,36 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	if (isp_->open() < 0)
 		return false;
 
-	/* Locate and open the capture video node. */
-	video_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_mainpath");
-	if (video_->open() < 0)
+	/* Sensor controls are applied at frame start when supported. */
+	frameStartEvents_ = !isp_->subscribeEvent(V4L2_EVENT_FRAME_SYNC);
+	if (frameStartEvents_)
+		isp_->frameStart.connect(this, &PipelineHandlerRkISP1::frameStart);
+
+	/* Locate and open the capture video nodes. */
+	mainPath_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_mainpath");
+	if (mainPath_->open() < 0)
+		return false;
+
+	mainPath_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
+
+	selfPath_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_selfpath");
+	if (selfPath_->open() < 0)
+		return false;
+
+	selfPath_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
+
+	/* Locate and open the parameters and statistics video nodes. */
+	param_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1-input-params");
+	if (param_->open() < 0)
 		return false;
 
-	video_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
+	param_->bufferReady.connect(this, &PipelineHandlerRkISP1::paramReady);
+
+	stat_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1-statistics");
+	if (stat_->open() < 0)
+		return false;
+
+	stat_->bufferReady.connect(this, &PipelineHandlerRkISP1::statReady);
 
 	/* Configure default links. */
 	if (initLinks() < 0) {
@@ -490,13 +1050,204 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
  * Buffer Handling
  */
 
+RkISP1MetaBuffer *RkISP1CameraData::freeMetaBuffer(V4L2VideoDevice *dev)
+{
+	for (RkISP1MetaBuffer &meta : metaBuffers_) {
+		if (meta.dev == dev && !meta.busy)
+			return &meta;
+	}
+
+	return nullptr;
+}
+
+RkISP1Frame *RkISP1CameraData::findFrame(const RkISP1MetaBuffer *meta)
+{
+	for (RkISP1Frame &frame : frames_) {
+		if (frame.param == meta || frame.stat == meta)
+			return &frame;
+	}
+
+	return nullptr;
+}
+
+RkISP1Frame *RkISP1CameraData::findFrame(const Request *request)
+{
+	for (RkISP1Frame &frame : frames_) {
+		if (frame.request == request)
+			return &frame;
+	}
+
+	return nullptr;
+}
+
+/*
+ * Clamp the size of a scaler crop region to the ISP input limits, align it to
+ * the Bayer pattern, and move it inside the ISP input frame.
+ */
+Rectangle RkISP1CameraData::adjustCrop(const Rectangle &crop) const
+{
+	static const Size minSize = { 32, 32 };
+	Rectangle rect;
+
+	rect.w = utils::clamp(crop.w, minSize.width, inputSize_.width) & ~1;
+	rect.h = utils::clamp(crop.h, minSize.height, inputSize_.height) & ~1;
+	rect.x = utils::clamp<int>(crop.x, 0, inputSize_.width - rect.w) & ~1;
+	rect.y = utils::clamp<int>(crop.y, 0, inputSize_.height - rect.h) & ~1;
+
+	return rect;
+}
+
+/*
+ * Complete the request of a frame once both its image and its statistics have
+ * been processed.
+ */
+void PipelineHandlerRkISP1::tryCompleteFrame(RkISP1CameraData *data,
+					     RkISP1Frame *frame)
+{
+	if (!frame->videoDone || (frame->stat && !frame->statDone))
+		return;
+
+	Request *request = frame->request;
+
+	data->frames_.remove_if([frame](const RkISP1Frame &f) {
+		return &f == frame;
+	});
+
+	completeRequest(activeCamera_, request);
+}
+
+void PipelineHandlerRkISP1::frameStart(uint32_t sequence, uint64_t timestamp)
+{
+	if (!activeCamera_)
+		return;
+
+	RkISP1CameraData *data = cameraData(activeCamera_);
+	data->delayedCtrls_->applyControls(sequence);
+
+	notifyFrameStart(activeCamera_, sequence, timestamp);
+}
+
 void PipelineHandlerRkISP1::bufferReady(Buffer *buffer)
 {
 	ASSERT(activeCamera_);
+	RkISP1CameraData *data = cameraData(activeCamera_);
 	Request *request = buffer->request();
 
-	completeBuffer(activeCamera_, request, buffer);
-	completeRequest(activeCamera_, request);
+	if (!completeBuffer(activeCamera_, request, buffer))
+		return;
+
+	RkISP1Frame *frame = data->findFrame(request);
+	if (!frame) {
+		completeRequest(activeCamera_, request);
+		return;
+	}
+
+	/* Report the frame duration the frame has been captured with. */
+	if (frameStartEvents_ && buffer == frame->video &&
+	    buffer->status() == Buffer::BufferSuccess) {
+		V4L2ControlList sensorCtrls =
+			data->delayedCtrls_->get(buffer->sequence());
+		V4L2Control *vblank = sensorCtrls[V4L2_CID_VBLANK];
+		uint64_t duration;
+
+		if (vblank &&
+		    !data->sensor_->vblankToFrameDuration(vblank->value(), &duration))
+			request->metadata().set(controls::FrameDuration,
+						static_cast<int>(duration / 1000));
+	}
+
+	frame->videoDone = true;
+	tryCompleteFrame(data, frame);
+}
+
+void PipelineHandlerRkISP1::paramReady(Buffer *buffer)
+{
+	ASSERT(activeCamera_);
+	RkISP1CameraData *data = cameraData(activeCamera_);
+
+	for (RkISP1MetaBuffer &meta : data->metaBuffers_) {
+		if (meta.buffer.get() == buffer)
+			meta.busy = false;
+	}
+}
+
+void PipelineHandlerRkISP1::statReady(Buffer *buffer)
+{
+	ASSERT(activeCamera_);
+	RkISP1CameraData *data = cameraData(activeCamera_);
+
+	RkISP1MetaBuffer *meta = nullptr;
+	for (RkISP1MetaBuffer &m : data->metaBuffers_) {
+		if (m.buffer.get() == buffer)
+			meta = &m;
+	}
+
+	RkISP1Frame *frame = meta ? data->findFrame(meta) : nullptr;
+	if (!frame)
+		return;
+
+	/*
+	 * The statistics and image of a frame are captured by the ISP from the
+	 * same input frame, and thus carry the same sequence number.
+	 */
+	if (buffer->status() != Buffer::BufferCancelled &&
+	    frame->videoDone && frame->video->sequence() != buffer->sequence())
+		LOG(RkISP1, Warning)
+			<< "Statistics sequence " << buffer->sequence()
+			<< " doesn't match frame sequence "
+			<< frame->video->sequence();
+
+	if (buffer->status() == Buffer::BufferCancelled || !data->ipa_) {
+		meta->busy = false;
+		frame->statDone = true;
+		tryCompleteFrame(data, frame);
+		return;
+	}
+
+	IPAOperationData event;
+	event.operation = RkISP1EventStatReady;
+	event.data.push_back(data->bufferId(meta));
+	data->ipa_->processEvent(frame->frame, event);
+}
+
+void PipelineHandlerRkISP1::queueFrameAction(unsigned int frame,
+					     const IPAOperationData &action)
+{
+	if (!activeCamera_)
+		return;
+
+	RkISP1CameraData *data = cameraData(activeCamera_);
+
+	if (action.data.empty() || !action.data[0] ||
+	    action.data[0] > data->metaBuffers_.size()) {
+		LOG(RkISP1, Warning)
+			<< "Invalid buffer for IPA action " << action.operation;
+		return;
+	}
+
+	RkISP1MetaBuffer *meta = &data->metaBuffers_[action.data[0] - 1];
+	RkISP1Frame *info = data->findFrame(meta);
+
+	/* Ignore actions for frames completed since the event was sent. */
+	if (!info)
+		return;
+
+	switch (action.operation) {
+	case RkISP1ActionParamFilled:
+		param_->queueBuffer(meta->buffer.get());
+		break;
+
+	case RkISP1ActionStatProcessed:
+		meta->busy = false;
+		info->statDone = true;
+		tryCompleteFrame(data, info);
+		break;
+
+	default:
+		LOG(RkISP1, Warning)
+			<< "Unknown IPA action " << action.operation;
+		break;
+	}
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerRkISP1);
@@ -6,7 +6,10 @@
  */
 
 #include <algorithm>
+#include <fstream>
 #include <iomanip>
+#include <mutex>
+#include <queue>
 #include <tuple>
 
 #include <libcamera/camera.h>
@@ -14,10 +17,18 @@
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "clock_recovery.h"
 #include "device_enumerator.h"
+#include "dma_buf_allocator.h"
+#include "downscaler.h"
+#include "formats.h"
+#include "jpeg_decoder.h"
 #include "log.h"
 #include "media_device.h"
+#include "media_request.h"
 #include "pipeline_handler.h"
+#include "soft_isp.h"
+#include "thread_pool.h"
 #include "utils.h"
 #include "v4l2_controls.h"
 #include "v4l2_videodevice.h"
@@ -26,11 +37,86 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(UVC)
 
+static constexpr unsigned int UVC_BUFFER_COUNT = 4;
+static constexpr unsigned int UVC_MIN_BUFFER_COUNT = 2;
+static constexpr unsigned int UVC_MAX_BUFFER_COUNT = 32;
+
+/*
+ * Track the isochronous bandwidth reserved by the UVC cameras streaming on each
+ * USB bus, as it is shared by all devices on the bus. Cameras are handled by
+ * separate pipeline handler instances running in different threads, accesses
+ * are thus serialised with a mutex.
+ */
+class UVCBusBandwidth
+{
+public:
+	static uint64_t reserved(const std::string &bus)
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		return reserved_[bus];
+	}
+
+	static uint64_t reserve(const std::string &bus, uint64_t bandwidth)
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		return reserved_[bus] += bandwidth;
+	}
+
+	static void release(const std::string &bus, uint64_t bandwidth)
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		reserved_[bus] -= bandwidth;
+	}
+
+private:
+	static std::mutex mutex_;
+	static std::map<std::string, uint64_t> reserved_;
+};
+
+std::mutex UVCBusBandwidth::mutex_;
+std::map<std::string, uint64_t> UVCBusBandwidth::reserved_;
+
+/*
+ * The uvcvideo driver doesn't flag H.264 key frames. Find the first slice of
+ * the frame in the Annex B byte stream, and check if it belongs to an IDR
+ * picture. Only the NAL unit headers are inspected.
+ */
+static bool h264KeyFrame(const uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i + 3 < size; ++i) {
+		if (data[i] || data[i + 1] || data[i + 2] != 1)
+			continue;
+
+		unsigned int type = data[i + 3] & 0x1f;
+		if (type == 5)
+			return true;
+		if (type == 1)
+			return false;
+
+		i += 3;
+	}
+
+	return false;
+}
+
+/* An MJPEG capture buffer and the request it is decoded for. */
+struct UVCDecodeJob {
+	std::unique_ptr<Buffer> capture;
+	Request *request;
+	uint64_t serial;
+	int result;
+};
+
 class UVCCameraData : public CameraData
 {
 public:
 	UVCCameraData(PipelineHandler *pipe)
-		: CameraData(pipe), video_(nullptr)
+		: CameraData(pipe), media_(nullptr), video_(nullptr),
+		  appliedControls_(nullptr), rawFormat_(0), decode_(false),
+		  process_(false), serial_(0),
+		  downscale_(false), streaming_(false), spareFrames_(0),
+		  busCapacity_(0), bandwidth_(0),
+		  bandwidthReserved_(false)
 	{
 	}
 
@@ -40,18 +126,91 @@ public:
 	}
 
 	int init(MediaEntity *entity);
-	void bufferReady(Buffer *buffer);
+	UVCDecodeJob *freeJob();
+
+	uint64_t bandwidth(unsigned int pixelFormat, const Size &size);
+	uint64_t availableBandwidth() const;
 
+	MediaDevice *media_;
+	MediaRequestPool mediaRequests_;
 	V4L2VideoDevice *video_;
 	Stream stream_;
+
+	/* Controls applied to the device, reported in the request metadata. */
+	ControlList appliedControls_;
+
+	/*
+	 * Pixel formats and sizes, including the formats decoded from MJPEG
+	 * and the formats processed from raw Bayer frames in rawFormat_.
+	 */
+	std::map<unsigned int, std::vector<SizeRange>> formats_;
+	std::set<unsigned int> decodedFormats_;
+	std::set<unsigned int> processedFormats_;
+	unsigned int rawFormat_;
+
+	/*
+	 * When the configured format is decoded from MJPEG or processed from
+	 * raw frames, frames are captured to internal buffers and converted to
+	 * the application buffers in worker threads. MJPEG frames are decoded
+	 * in a pool of worker threads, and raw frames are processed by the
+	 * software ISP.
+	 */
+	bool decode_;
+	bool process_;
+	JpegDecoder decoder_;
+	std::unique_ptr<ThreadPool> decodePool_;
+	std::unique_ptr<SoftIspStage> isp_;
+	BufferPool capturePool_;
+	std::vector<UVCDecodeJob> jobs_;
+	std::queue<Request *> waitingRequests_;
+	uint64_t serial_;
+
+	/*
+	 * Secondary stream downscaled in software from the captured or
+	 * decoded frames.
+	 */
+	Stream scaledStream_;
+	std::unique_ptr<DownscaleStage> downscaler_;
+	bool downscale_;
+
+	/* Streaming is started when the first request is queued. */
+	bool streaming_;
+
+	/* Frames captured in spare buffers when the camera was started. */
+	uint64_t spareFrames_;
+
+	/* Frame clock recovered from the driver timestamps. */
+	ClockRecovery clockRecovery_;
+
+	/*
+	 * The USB bus the camera is connected to and its capacity in bytes per
+	 * second, and the bandwidth required by the configured format and
+	 * reserved while streaming.
+	 */
+	std::string bus_;
+	uint64_t busCapacity_;
+	uint64_t bandwidth_;
+	bool bandwidthReserved_;
 };
 
 class UVCCameraConfiguration : public CameraConfiguration
 {
 public:
-	UVCCameraConfiguration();
+	UVCCameraConfiguration(Camera *camera, UVCCameraData *data);
 
 	Status validate() override;
+
+private:
+	Status adjust();
+	static bool adjustBufferCount(StreamConfiguration *cfg);
+
+	/*
+	 * The UVCCameraData instance is guaranteed to be valid as long as the
+	 * corresponding Camera instance is valid. In order to borrow a
+	 * reference to the camera data, store a new reference to the camera.
+	 */
+	std::shared_ptr<Camera> camera_;
+	const UVCCameraData *data_;
 };
 
 class PipelineHandlerUVC : public PipelineHandler
@@ -62,6 +221,7 @@ public:
 	CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) override;
 	int configure(Camera *camera, CameraConfiguration *config) override;
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
 
 	int allocateBuffers(Camera *camera,
 			    const std::set<Stream *> &streams) override;
@@ -72,34 +232,61 @@ public:
 	void stop(Camera *camera) override;
 
 	int queueRequest(Camera *camera, Request *request) override;
+	MemoryUsage memoryUsage(const Camera *camera) override;
 
+	static std::vector<DeviceMatch> deviceMatches();
 	bool match(DeviceEnumerator *enumerator) override;
 
 private:
-	int processControls(UVCCameraData *data, Request *request);
+	int openDevices(Camera *camera) override;
+	void closeDevices(Camera *camera) override;
+
+	int processControls(UVCCameraData *data, Request *request,
+			    MediaRequest *mediaRequest);
+	int queueCapture(UVCCameraData *data, Request *request, Buffer *buffer);
+
+	void bufferReady(Buffer *buffer);
+	void decodeCompleted(uint64_t serial);
+	void frameProcessed(uint64_t serial, int result);
+	void completeJob(Camera *camera, UVCCameraData *data,
+			 UVCDecodeJob *job, Buffer::Status status,
+			 unsigned int bytesused);
+	void completeFrame(Camera *camera, Request *request, Buffer *buffer);
 
 	UVCCameraData *cameraData(const Camera *camera)
 	{
 		return static_cast<UVCCameraData *>(
 			PipelineHandler::cameraData(camera));
 	}
+
+	Camera *activeCamera_;
 };
 
-UVCCameraConfiguration::UVCCameraConfiguration()
+UVCCameraConfiguration::UVCCameraConfiguration(Camera *camera, UVCCameraData *data)
 	: CameraConfiguration()
 {
+	camera_ = camera->shared_from_this();
+	data_ = data;
 }
 
 CameraConfiguration::Status UVCCameraConfiguration::validate()
+{
+	return data_->configCache_.validate(this, &UVCCameraConfiguration::adjust);
+}
+
+CameraConfiguration::Status UVCCameraConfiguration::adjust()
 {
 	Status status = Valid;
 
 	if (config_.empty())
 		return Invalid;
 
-	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 1) {
-		config_.resize(1);
+	/*
+	 * Cap the number of entries to the available streams. The second
+	 * stream is downscaled from the first one.
+	 */
+	if (config_.size() > 2) {
+		config_.resize(2);
 		status = Adjusted;
 	}
 
@@ -108,7 +295,7 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 	const unsigned int pixelFormat = cfg.pixelFormat;
 	const Size size = cfg.size;
 
-	const std::vector<unsigned int> pixelFormats = formats.pixelformats();
+	const std::vector<unsigned int> &pixelFormats = formats.pixelformats();
 	auto iter = std::find(pixelFormats.begin(), pixelFormats.end(), pixelFormat);
 	if (iter == pixelFormats.end()) {
 		cfg.pixelFormat = pixelFormats.front();
@@ -118,6 +305,13 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
+	/* Only linear formats are supported. */
+	if (cfg.modifier) {
+		LOG(UVC, Debug) << "Adjusting modifier to linear";
+		cfg.modifier = 0;
+		status = Adjusted;
+	}
+
 	const std::vector<Size> &formatSizes = formats.sizes(cfg.pixelFormat);
 	cfg.size = formatSizes.front();
 	for (const Size &formatsSize : formatSizes) {
@@ -134,13 +328,47 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
-	cfg.bufferCount = 4;
+	if (adjustBufferCount(&cfg))
+		status = Adjusted;
+
+	if (config_.size() == 1)
+		return status;
+
+	/* Drop the downscaled stream if the frames can't be scaled. */
+	Status scaled = DownscaleStage::validate(config_[0], &config_[1]);
+	if (scaled == Invalid) {
+		LOG(UVC, Debug) << "Dropping downscaled stream";
+		config_.resize(1);
+		return Adjusted;
+	}
+
+	if (adjustBufferCount(&config_[1]) || scaled == Adjusted)
+		status = Adjusted;
 
 	return status;
 }
 
+bool UVCCameraConfiguration::adjustBufferCount(StreamConfiguration *cfg)
+{
+	const unsigned int bufferCount = cfg->bufferCount;
+
+	cfg->minBufferCount = UVC_MIN_BUFFER_COUNT;
+	cfg->maxBufferCount = UVC_MAX_BUFFER_COUNT;
+
+	if (!cfg->bufferCount)
+		cfg->bufferCount = UVC_BUFFER_COUNT;
+	cfg->bufferCount = std::max(UVC_MIN_BUFFER_COUNT,
+				    std::min(UVC_MAX_BUFFER_COUNT, cfg->bufferCount));
+
+	if (cfg->bufferCount == bufferCount)
+		return false;
+
+	LOG(UVC, Debug) << "Adjusting buffer count to " << cfg->bufferCount;
+	return true;
+}
+
 PipelineHandlerUVC::PipelineHandlerUVC(CameraManager *manager)
-	: PipelineHandler(manager)
+	: PipelineHandler(manager), activeCamera_(nullptr)
 {
 }
 
@@ -148,21 +376,60 @@ CameraConfiguration *PipelineHandlerUVC::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
 	UVCCameraData *data = cameraData(camera);
-	CameraConfiguration *config = new UVCCameraConfiguration();
+	CameraConfiguration *config = new UVCCameraConfiguration(camera, data);
 
 	if (roles.empty())
 		return config;
 
-	ImageFormats v4l2formats = data->video_->formats();
-	StreamFormats formats(v4l2formats.data());
+	StreamFormats formats(data->formats_);
 	StreamConfiguration cfg(formats);
 
 	cfg.pixelFormat = formats.pixelformats().front();
 	cfg.size = formats.sizes(cfg.pixelFormat).back();
-	cfg.bufferCount = 4;
+	cfg.bufferCount = UVC_BUFFER_COUNT;
+
+	/*
+	 * When the default configuration doesn't fit in the bandwidth left on
+	 * the USB bus by the other streaming cameras, pick the largest
+	 * configuration that fits, preferring the default pixel format.
+	 */
+	uint64_t available = data->availableBandwidth();
+	if (data->bandwidth(cfg.pixelFormat, cfg.size) > available) {
+		const unsigned int pixelFormat = cfg.pixelFormat;
+		unsigned int bestArea = 0;
+
+		for (unsigned int format : formats.pixelformats()) {
+			for (const Size &size : formats.sizes(format)) {
+				unsigned int area = size.width * size.height;
+
+				if (area < bestArea ||
+				    (area == bestArea && format != pixelFormat))
+					continue;
+
+				if (data->bandwidth(format, size) > available)
+					continue;
+
+				cfg.pixelFormat = format;
+				cfg.size = size;
+				bestArea = area;
+			}
+		}
+
+		if (bestArea)
+			LOG(UVC, Debug)
+				<< "Selected " << cfg
+				<< " to fit in the USB bandwidth";
+		else
+			LOG(UVC, Warning)
+				<< "No configuration fits in the USB bandwidth";
+	}
 
 	config->addConfiguration(cfg);
 
+	/* Additional roles are served by a downscaled stream. */
+	if (roles.size() > 1)
+		config->addConfiguration(DownscaleStage::generateConfiguration(cfg));
+
 	config->validate();
 
 	return config;
@@ -174,85 +441,367 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 	StreamConfiguration &cfg = config->at(0);
 	int ret;
 
+	/*
+	 * Capture MJPEG or raw frames for the formats that the device can't
+	 * produce.
+	 */
+	bool decode = data->decodedFormats_.count(cfg.pixelFormat);
+	bool process = data->processedFormats_.count(cfg.pixelFormat);
+	unsigned int fourcc = decode ? V4L2_PIX_FMT_MJPEG
+			    : process ? data->rawFormat_ : cfg.pixelFormat;
+
 	V4L2DeviceFormat format = {};
-	format.fourcc = cfg.pixelFormat;
+	format.fourcc = fourcc;
 	format.size = cfg.size;
 
 	ret = data->video_->setFormat(&format);
 	if (ret)
 		return ret;
 
-	if (format.size != cfg.size ||
-	    format.fourcc != cfg.pixelFormat)
+	if (format.size != cfg.size || format.fourcc != fourcc)
 		return -EINVAL;
 
+	if (decode) {
+		ret = data->decoder_.configure(cfg.size, cfg.pixelFormat);
+		if (ret)
+			return ret;
+
+		if (!data->decodePool_) {
+			data->decodePool_ = utils::make_unique<ThreadPool>();
+			data->decodePool_->completed.connect(this,
+				&PipelineHandlerUVC::decodeCompleted);
+		}
+
+		LOG(UVC, Debug)
+			<< "Decoding MJPEG to " << cfg << " with "
+			<< data->decodePool_->size() << " threads";
+	}
+
+	if (process) {
+		if (!data->isp_) {
+			data->isp_ = utils::make_unique<SoftIspStage>();
+			data->isp_->frameProcessed.connect(this,
+				&PipelineHandlerUVC::frameProcessed);
+		}
+
+		ret = data->isp_->configure(fourcc, cfg.size,
+					    format.planes[0].bpl, cfg.pixelFormat);
+		if (ret)
+			return ret;
+
+		LOG(UVC, Debug)
+			<< "Processing raw frames to " << cfg;
+	}
+
+	data->decode_ = decode || process;
+	data->process_ = process;
+
+	if (decode)
+		cfg.stride = data->decoder_.stride();
+	else if (process)
+		cfg.stride = data->isp_->stride();
+	else
+		cfg.stride = format.planes[0].bpl;
+
+	data->bandwidth_ = data->bandwidth(cfg.pixelFormat, cfg.size);
+	if (data->bandwidth_ > data->availableBandwidth())
+		LOG(UVC, Warning)
+			<< "Configuration " << cfg
+			<< " exceeds the bandwidth available on the USB bus";
+
 	cfg.setStream(&data->stream_);
 
+	/* Decoded and processed frames are written by the CPU. */
+	setCpuAccess(&data->stream_, data->decode_);
+
+	data->downscale_ = false;
+	clearProcessingStages(camera);
+
+	if (config->size() == 1)
+		return 0;
+
+	if (!data->downscaler_)
+		data->downscaler_ = utils::make_unique<DownscaleStage>();
+
+	StreamConfiguration &scaled = config->at(1);
+	ret = data->downscaler_->configure(cfg, scaled);
+	if (ret)
+		return ret;
+
+	ret = addProcessingStage(camera, &data->stream_, &data->scaledStream_,
+				 data->downscaler_.get());
+	if (ret)
+		return ret;
+
+	data->downscale_ = true;
+
+	/* The downscaler reads the captured frames with the CPU. */
+	setCpuAccess(&data->stream_, true);
+	setCpuAccess(&data->scaledStream_, true);
+
+	scaled.stride = data->downscaler_->stride();
+	scaled.setStream(&data->scaledStream_);
+
 	return 0;
 }
 
+int PipelineHandlerUVC::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	UVCCameraData *data = cameraData(camera);
+	const StreamConfiguration &cfg = config->at(0);
+	int ret;
+
+	/*
+	 * MJPEG decoding and raw processing capture to separate buffers sized
+	 * for the captured frames, and buffers of downscaled streams are sized
+	 * for the scaled frames, reallocate all buffers when either is
+	 * involved.
+	 */
+	if (data->decode_ || data->downscale_ || config->size() > 1 ||
+	    data->decodedFormats_.count(cfg.pixelFormat) ||
+	    data->processedFormats_.count(cfg.pixelFormat) ||
+	    !buffersReusable(&data->stream_, cfg))
+		return -ENOTSUP;
+
+	/*
+	 * Release the buffers from the video device to change its format, and
+	 * import them back. The media requests only depend on the number of
+	 * buffers and are kept.
+	 */
+	ret = data->video_->releaseBuffers();
+	if (ret)
+		return ret;
+
+	ret = configure(camera, config);
+	if (ret)
+		return ret;
+
+	return data->video_->reimportBuffers(&data->stream_.bufferPool());
+}
+
 int PipelineHandlerUVC::allocateBuffers(Camera *camera,
 					const std::set<Stream *> &streams)
 {
 	UVCCameraData *data = cameraData(camera);
-	Stream *stream = *streams.begin();
+	Stream *stream = &data->stream_;
 	const StreamConfiguration &cfg = stream->configuration();
+	int ret;
 
 	LOG(UVC, Debug) << "Requesting " << cfg.bufferCount << " buffers";
 
-	if (stream->memoryType() == InternalMemory)
-		return data->video_->exportBuffers(&stream->bufferPool());
-	else
-		return data->video_->importBuffers(&stream->bufferPool());
+	data->video_->setSpareBufferCount(spareBufferCount());
+
+	Stream *scaled = &data->scaledStream_;
+	if (data->downscale_ && scaled->memoryType() == InternalMemory) {
+		std::vector<unsigned int> planeSizes = {
+			static_cast<unsigned int>(data->downscaler_->frameSize()),
+		};
+
+		ret = DmaBufAllocator::instance()->allocate(&scaled->bufferPool(),
+							    planeSizes);
+		if (ret) {
+			LOG(UVC, Error) << "Failed to allocate scaled frame buffers";
+			return ret;
+		}
+	}
+
+	if (data->decode_) {
+		/*
+		 * Capture to internal MJPEG or raw buffers, and allocate
+		 * memory for the converted frames separately when needed.
+		 */
+		data->capturePool_.createBuffers(cfg.bufferCount);
+		ret = data->video_->exportBuffers(&data->capturePool_);
+		if (ret)
+			return ret;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i)
+			data->jobs_.push_back({ utils::make_unique<Buffer>(i),
+						nullptr, 0, 0 });
+
+		if (stream->memoryType() == InternalMemory) {
+			size_t frameSize = data->process_ ? data->isp_->frameSize()
+							  : data->decoder_.frameSize();
+			std::vector<unsigned int> planeSizes = {
+				static_cast<unsigned int>(frameSize),
+			};
+
+			ret = DmaBufAllocator::instance()->allocate(&stream->bufferPool(),
+								    planeSizes);
+			if (ret) {
+				LOG(UVC, Error) << "Failed to allocate frame buffers";
+				freeBuffers(camera, streams);
+				return ret;
+			}
+		}
+
+		if (data->video_->supportsRequests() &&
+		    !data->mediaRequests_.allocate(data->media_, cfg.bufferCount))
+			LOG(UVC, Debug) << "Using media requests for per-frame controls";
+
+		return 0;
+	}
+
+	/*
+	 * Allocate internal memory with the dmabuf allocator when available,
+	 * to avoid reallocating memory in the driver when the camera is
+	 * reconfigured, and fall back to exporting buffers from the driver.
+	 */
+	if (stream->memoryType() == InternalMemory) {
+		ret = data->video_->allocateBuffers(&stream->bufferPool(),
+						    DmaBufAllocator::instance());
+		if (ret)
+			ret = data->video_->exportBuffers(&stream->bufferPool());
+	} else if (stream->memoryType() == UserPtrMemory) {
+		ret = data->video_->importUserPtrBuffers(&stream->bufferPool());
+	} else {
+		ret = data->video_->importBuffers(&stream->bufferPool());
+	}
+	if (ret) {
+		freeBuffers(camera, streams);
+		return ret;
+	}
+
+	/*
+	 * Bind controls and buffers through media requests when supported,
+	 * and fall back to setting controls synchronously otherwise.
+	 */
+	if (data->video_->supportsRequests() &&
+	    !data->mediaRequests_.allocate(data->media_, cfg.bufferCount))
+		LOG(UVC, Debug) << "Using media requests for per-frame controls";
+
+	return 0;
 }
 
 int PipelineHandlerUVC::freeBuffers(Camera *camera,
 				    const std::set<Stream *> &streams)
 {
 	UVCCameraData *data = cameraData(camera);
-	return data->video_->releaseBuffers();
+
+	Stream *stream = &data->stream_;
+	Stream *scaled = &data->scaledStream_;
+
+	data->mediaRequests_.release();
+	data->jobs_.clear();
+
+	int ret = data->video_->releaseBuffers();
+	data->capturePool_.destroyBuffers();
+
+	if (stream->memoryType() == InternalMemory)
+		DmaBufAllocator::instance()->release(&stream->bufferPool());
+	if (data->downscale_ && scaled->memoryType() == InternalMemory)
+		DmaBufAllocator::instance()->release(&scaled->bufferPool());
+
+	return ret;
 }
 
 int PipelineHandlerUVC::start(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
-	return data->video_->streamOn();
+
+	data->streaming_ = false;
+	data->spareFrames_ = data->video_->spareFrames();
+	data->clockRecovery_.reset();
+
+	if (!data->bus_.empty()) {
+		UVCBusBandwidth::reserve(data->bus_, data->bandwidth_);
+		data->bandwidthReserved_ = true;
+	}
+
+	activeCamera_ = camera;
+
+	return 0;
 }
 
 void PipelineHandlerUVC::stop(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
 	data->video_->streamOff();
+	data->streaming_ = false;
+
+	uint64_t dropped = data->video_->spareFrames() - data->spareFrames_;
+	if (dropped)
+		LOG(UVC, Info)
+			<< dropped << " frames dropped due to request starvation";
+
+	if (data->bandwidthReserved_) {
+		UVCBusBandwidth::release(data->bus_, data->bandwidth_);
+		data->bandwidthReserved_ = false;
+	}
+
+	if (data->decode_) {
+		/*
+		 * Wait for the frames being converted and complete them.
+		 * Completion notifications still queued for those frames are
+		 * ignored, as the serial numbers they carry don't match any
+		 * job anymore.
+		 */
+		if (data->process_)
+			data->isp_->flush();
+		else
+			data->decodePool_->wait();
+
+		for (UVCDecodeJob &job : data->jobs_) {
+			if (job.request)
+				completeJob(camera, data, &job,
+					    job.result < 0 ? Buffer::BufferError
+							   : Buffer::BufferSuccess,
+					    job.result < 0 ? 0 : job.result);
+		}
+
+		/* Cancel the requests that were waiting for a capture buffer. */
+		while (!data->waitingRequests_.empty()) {
+			Request *request = data->waitingRequests_.front();
+			data->waitingRequests_.pop();
+
+			Buffer *buffer = request->findBuffer(&data->stream_);
+			setBufferMetadata(buffer, nullptr, Buffer::BufferCancelled, 0);
+			completeFrame(camera, request, buffer);
+		}
+	}
+
+	/* Complete the frames being downscaled. */
+	if (data->downscale_)
+		data->downscaler_->flush();
+
+	activeCamera_ = nullptr;
 }
 
-int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
+int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request,
+					 MediaRequest *mediaRequest)
 {
-	V4L2ControlList controls;
+	V4L2ControlList v4l2Ctrls;
 
-	for (auto it : request->controls()) {
+	const ControlList &ctrls = request->controls();
+
+	for (const auto &it : ctrls) {
 		const ControlInfo *ci = it.first;
-		ControlValue &value = it.second;
 
 		switch (ci->id()) {
 		case Brightness:
-			controls.add(V4L2_CID_BRIGHTNESS, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_BRIGHTNESS,
+				      ctrls.get(controls::Brightness));
 			break;
 
 		case Contrast:
-			controls.add(V4L2_CID_CONTRAST, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_CONTRAST,
+				      ctrls.get(controls::Contrast));
 			break;
 
 		case Saturation:
-			controls.add(V4L2_CID_SATURATION, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_SATURATION,
+				      ctrls.get(controls::Saturation));
 			break;
 
 		case ManualExposure:
-			controls.add(V4L2_CID_EXPOSURE_AUTO, 1);
-			controls.add(V4L2_CID_EXPOSURE_ABSOLUTE, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_EXPOSURE_AUTO, 1);
+			v4l2Ctrls.add(V4L2_CID_EXPOSURE_ABSOLUTE,
+				      ctrls.get(controls::ManualExposure));
 			break;
 
 		case ManualGain:
-			controls.add(V4L2_CID_GAIN, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_GAIN,
+				      ctrls.get(controls::ManualGain));
 			break;
 
 		default:
@@ -260,21 +809,69 @@ int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
 		}
 	}
 
-	for (const V4L2Control &ctrl : controls)
+	for (const V4L2Control &ctrl : v4l2Ctrls)
 		LOG(UVC, Debug)
 			<< "Setting control 0x"
 			<< std::hex << std::setw(8) << ctrl.id() << std::dec
 			<< " to " << ctrl.value();
 
-	int ret = data->video_->setControls(&controls);
+	int ret = data->video_->setControls(&v4l2Ctrls, mediaRequest);
 	if (ret) {
 		LOG(UVC, Error) << "Failed to set controls: " << ret;
 		return ret < 0 ? ret : -EINVAL;
 	}
 
+	/*
+	 * The device retains control values across frames, report all the
+	 * controls applied so far without reading them back from the device.
+	 */
+	for (const auto &it : ctrls) {
+		switch (it.first->id()) {
+		case Brightness:
+		case Contrast:
+		case Saturation:
+		case ManualExposure:
+		case ManualGain:
+			data->appliedControls_[it.first->id()] = it.second;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	ControlList &metadata = request->metadata();
+	for (const auto &it : data->appliedControls_)
+		metadata[it.first->id()] = it.second;
+
 	return ret;
 }
 
+int PipelineHandlerUVC::queueCapture(UVCCameraData *data, Request *request,
+				     Buffer *buffer)
+{
+	/*
+	 * If media requests are not supported or all of them are in use, the
+	 * controls are applied synchronously.
+	 */
+	MediaRequest *mediaRequest = data->mediaRequests_.get();
+
+	int ret = processControls(data, request, mediaRequest);
+	if (ret >= 0)
+		ret = data->video_->queueBuffer(buffer, mediaRequest);
+	if (ret >= 0 && mediaRequest)
+		ret = mediaRequest->queue();
+	if (ret < 0) {
+		if (mediaRequest) {
+			data->mediaRequests_.recycle(mediaRequest);
+			data->video_->unqueueBuffer(buffer);
+		}
+		return ret;
+	}
+
+	return 0;
+}
+
 int PipelineHandlerUVC::queueRequest(Camera *camera, Request *request)
 {
 	UVCCameraData *data = cameraData(camera);
@@ -286,29 +883,97 @@ int PipelineHandlerUVC::queueRequest(Camera *camera, Request *request)
 		return -ENOENT;
 	}
 
-	int ret = processControls(data, request);
-	if (ret < 0)
-		return ret;
+	if (!data->downscale_ && request->findBuffer(&data->scaledStream_)) {
+		LOG(UVC, Error)
+			<< "Attempt to queue request with unconfigured stream";
+
+		return -ENOENT;
+	}
+
+	/*
+	 * UVC devices can't change the frame interval while streaming.
+	 * Streaming is thus started when the first request is queued, after
+	 * applying its frame duration.
+	 */
+	const ControlList &ctrls = request->controls();
+	if (ctrls.contains(FrameDuration)) {
+		uint64_t interval = ctrls.get(controls::FrameDuration) * 1000ULL;
+
+		if (!data->streaming_) {
+			if (data->video_->setFrameInterval(&interval))
+				LOG(UVC, Warning) << "Failed to set frame duration";
+			else
+				LOG(UVC, Debug)
+					<< "Frame interval set to " << interval
+					<< "ns";
+		} else {
+			LOG(UVC, Warning)
+				<< "Frame duration can't be changed while streaming";
+		}
+	}
+
+	int ret = 0;
+
+	if (!data->decode_) {
+		ret = queueCapture(data, request, buffer);
+	} else {
+		/*
+		 * Capture the frame to a free MJPEG buffer, or wait for one to
+		 * be released if they are all in use.
+		 */
+		UVCDecodeJob *job = data->freeJob();
+		if (job) {
+			ret = queueCapture(data, request, job->capture.get());
+			if (ret >= 0)
+				job->request = request;
+		} else {
+			data->waitingRequests_.push(request);
+		}
+	}
 
-	ret = data->video_->queueBuffer(buffer);
 	if (ret < 0)
 		return ret;
 
+	if (!data->streaming_) {
+		ret = data->video_->streamOn();
+		if (ret)
+			return ret;
+
+		data->streaming_ = true;
+	}
+
 	PipelineHandler::queueRequest(camera, request);
 
 	return 0;
 }
 
+/* MJPEG frames are captured to internal buffers when decoding. */
+MemoryUsage PipelineHandlerUVC::memoryUsage(const Camera *camera)
+{
+	UVCCameraData *data = cameraData(camera);
+	MemoryUsage usage;
+
+	usage.allocated = data->capturePool_.size();
+	usage.mapped = data->capturePool_.mappedSize();
+
+	return usage;
+}
+
+std::vector<DeviceMatch> PipelineHandlerUVC::deviceMatches()
+{
+	return { DeviceMatch("uvcvideo") };
+}
+
 bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 {
 	MediaDevice *media;
-	DeviceMatch dm("uvcvideo");
 
-	media = acquireMediaDevice(enumerator, dm);
+	media = acquireMediaDevice(enumerator, deviceMatches()[0]);
 	if (!media)
 		return false;
 
 	std::unique_ptr<UVCCameraData> data = utils::make_unique<UVCCameraData>(this);
+	data->media_ = media;
 
 	/* Locate and initialise the camera data with the default video node. */
 	for (MediaEntity *entity : media->entities()) {
@@ -324,8 +989,10 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 		return false;
 	}
 
+	data->video_->bufferReady.connect(this, &PipelineHandlerUVC::bufferReady);
+
 	/* Create and register the camera. */
-	std::set<Stream *> streams{ &data->stream_ };
+	std::set<Stream *> streams{ &data->stream_, &data->scaledStream_ };
 	std::shared_ptr<Camera> camera = Camera::create(this, media->model(), streams);
 	registerCamera(std::move(camera), std::move(data));
 
@@ -335,6 +1002,21 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 	return true;
 }
 
+/*
+ * The formats and controls are retrieved when initialising the camera data, the
+ * video device is only needed when the camera is acquired. When the device is
+ * closed, bandwidth estimation falls back to 30fps.
+ */
+int PipelineHandlerUVC::openDevices(Camera *camera)
+{
+	return cameraData(camera)->video_->open();
+}
+
+void PipelineHandlerUVC::closeDevices(Camera *camera)
+{
+	cameraData(camera)->video_->close();
+}
+
 int UVCCameraData::init(MediaEntity *entity)
 {
 	int ret;
@@ -345,9 +1027,88 @@ int UVCCameraData::init(MediaEntity *entity)
 	if (ret)
 		return ret;
 
-	video_->bufferReady.connect(this, &UVCCameraData::bufferReady);
+	/*
+	 * Identify the USB bus from the bus information, formatted as
+	 * usb-<controller>-<port path>. Devices on the same controller share
+	 * the bus bandwidth, except for SuperSpeed devices that use a separate
+	 * bus. Periodic transfers are limited to 80% of the bandwidth of
+	 * high-speed and full-speed buses, and 90% for SuperSpeed buses.
+	 */
+	std::string busName = video_->busName();
+	size_t pos = busName.rfind('-');
+	if (busName.compare(0, 4, "usb-") == 0 && pos > 4) {
+		unsigned int speed = 480;
+
+		std::string node = video_->deviceNode();
+		std::string path = "/sys/class/video4linux/"
+				 + node.substr(node.rfind('/') + 1)
+				 + "/device/../speed";
+		std::ifstream file(path);
+		if (file)
+			file >> speed;
+
+		if (speed >= 5000) {
+			bus_ = busName.substr(0, pos) + "-ss";
+			busCapacity_ = speed * 1000000ULL / 10 * 9 / 10;
+		} else {
+			bus_ = busName.substr(0, pos);
+			busCapacity_ = speed * 1000000ULL / 8 * 8 / 10;
+		}
+
+		LOG(UVC, Debug)
+			<< "Camera on USB bus " << bus_ << " with "
+			<< busCapacity_ << " bytes/s periodic bandwidth";
+	}
+
+	/*
+	 * Expose the formats that can be decoded from MJPEG in addition to
+	 * the formats natively supported by the device.
+	 */
+	formats_ = video_->formats().data();
+
+	auto mjpeg = formats_.find(V4L2_PIX_FMT_MJPEG);
+	if (mjpeg != formats_.end() && JpegDecoder::isSupported()) {
+		std::vector<SizeRange> sizes = mjpeg->second;
+
+		for (unsigned int format : JpegDecoder::formats()) {
+			if (formats_.count(format))
+				continue;
+
+			formats_[format] = sizes;
+			decodedFormats_.insert(format);
+		}
+	}
+
+	/*
+	 * Expose the formats that the software ISP can produce from the
+	 * preferred raw Bayer format of the device.
+	 */
+	for (unsigned int format : SoftIsp::inputFormats()) {
+		auto raw = formats_.find(format);
+		if (raw == formats_.end())
+			continue;
+
+		std::vector<SizeRange> sizes = raw->second;
+		rawFormat_ = format;
+
+		for (unsigned int output : SoftIsp::outputFormats()) {
+			if (formats_.count(output))
+				continue;
+
+			formats_[output] = sizes;
+			processedFormats_.insert(output);
+		}
+
+		break;
+	}
+
+	/*
+	 * Initialise the supported controls. The frame duration is rounded by
+	 * the device to the closest supported frame interval, expose a range
+	 * between 1ms and 1s.
+	 */
+	controlInfo_.insert(ControlInfo(FrameDuration, 1000, 1000000));
 
-	/* Initialise the supported controls. */
 	const V4L2ControlInfoMap &controls = video_->controls();
 	for (const auto &ctrl : controls) {
 		unsigned int v4l2Id = ctrl.first;
@@ -374,20 +1135,243 @@ int UVCCameraData::init(MediaEntity *entity)
 			continue;
 		}
 
-		controlInfo_.emplace(std::piecewise_construct,
-				     std::forward_as_tuple(id),
-				     std::forward_as_tuple(id, info.min(), info.max()));
+		controlInfo_.insert(ControlInfo(id, info.min(), info.max()));
 	}
 
 	return 0;
 }
 
-void UVCCameraData::bufferReady(Buffer *buffer)
+/*
+ * Estimate the USB bandwidth in bytes per second required to capture frames of
+ * \a size in \a pixelFormat at the highest frame rate supported by the device.
+ */
+uint64_t UVCCameraData::bandwidth(unsigned int pixelFormat, const Size &size)
+{
+	unsigned int format = pixelFormat;
+	if (decodedFormats_.count(pixelFormat))
+		format = V4L2_PIX_FMT_MJPEG;
+	else if (processedFormats_.count(pixelFormat))
+		format = rawFormat_;
+
+	/*
+	 * The size of compressed frames depends on the scene. Assume a 4:1
+	 * compression ratio compared to YUYV, and YUYV for unknown formats.
+	 */
+	const PixelFormatInfo &info = PixelFormatInfo::info(format);
+	unsigned int bitsPerPixel;
+
+	if (!info.isValid())
+		bitsPerPixel = 16;
+	else if (info.compressed)
+		bitsPerPixel = 4;
+	else
+		bitsPerPixel = info.bitsPerPixel;
+
+	/* Default to 30fps when the device doesn't report frame intervals. */
+	std::vector<uint64_t> intervals = video_->frameIntervals(format, size);
+	uint64_t interval = intervals.empty()
+			  ? 33333333
+			  : *std::min_element(intervals.begin(), intervals.end());
+	if (!interval)
+		interval = 33333333;
+
+	uint64_t frameSize = static_cast<uint64_t>(size.width) * size.height *
+			     bitsPerPixel / 8;
+
+	return frameSize * 1000000000ULL / interval;
+}
+
+/*
+ * Compute the bandwidth left on the USB bus by the other cameras. The bandwidth
+ * is unlimited for devices whose bus can't be identified.
+ */
+uint64_t UVCCameraData::availableBandwidth() const
+{
+	if (bus_.empty())
+		return UINT64_MAX;
+
+	uint64_t reserved = UVCBusBandwidth::reserved(bus_);
+	if (bandwidthReserved_)
+		reserved -= bandwidth_;
+
+	return reserved < busCapacity_ ? busCapacity_ - reserved : 0;
+}
+
+UVCDecodeJob *UVCCameraData::freeJob()
+{
+	for (UVCDecodeJob &job : jobs_) {
+		if (!job.request)
+			return &job;
+	}
+
+	return nullptr;
+}
+
+void PipelineHandlerUVC::bufferReady(Buffer *buffer)
+{
+	ASSERT(activeCamera_);
+	UVCCameraData *data = cameraData(activeCamera_);
+	UVCDecodeJob *job = data->decode_ ? &data->jobs_[buffer->index()] : nullptr;
+	Request *request = job ? job->request : buffer->request();
+
+	/*
+	 * Report the capture time with the USB scheduling jitter filtered out,
+	 * the buffer timestamp keeps the time reported by the driver.
+	 */
+	if (buffer->status() == Buffer::BufferSuccess &&
+	    buffer->clock() == ClockMonotonic) {
+		uint64_t timestamp = data->clockRecovery_.recover(buffer->sequence(),
+								   buffer->timestamp());
+		request->metadata().set(controls::SensorTimestamp,
+					static_cast<int64_t>(timestamp));
+	}
+
+	if (!job) {
+		if (buffer->status() == Buffer::BufferSuccess &&
+		    data->stream_.configuration().pixelFormat == V4L2_PIX_FMT_H264 &&
+		    !(buffer->flags() & Buffer::FlagKeyFrame)) {
+			Plane &plane = buffer->mem()->planes()[0];
+			const void *mem = plane.mem();
+
+			plane.beginCpuAccess(Plane::CpuRead);
+			if (mem && h264KeyFrame(static_cast<const uint8_t *>(mem),
+						std::min<size_t>(buffer->bytesused(),
+								 plane.length())))
+				setBufferFlags(buffer, Buffer::FlagKeyFrame);
+			plane.endCpuAccess(Plane::CpuRead);
+		}
+
+		completeFrame(activeCamera_, request, buffer);
+		return;
+	}
+
+	if (buffer->status() != Buffer::BufferSuccess) {
+		completeJob(activeCamera_, data, job, buffer->status(), 0);
+		return;
+	}
+
+	Plane *src = &data->capturePool_.buffers()[buffer->index()].planes()[0];
+	Plane *dst = &job->request->findBuffer(&data->stream_)->mem()->planes()[0];
+
+	job->serial = ++data->serial_;
+
+	if (data->process_) {
+		data->isp_->queue(job->serial, src, dst);
+		return;
+	}
+
+	/* Decode the frame in a worker thread. */
+	const JpegDecoder *decoder = &data->decoder_;
+	unsigned int bytesused = buffer->bytesused();
+	int *result = &job->result;
+
+	data->decodePool_->queue([src, dst, decoder, bytesused, result]() {
+		void *in = src->mem();
+		void *out = dst->mem();
+		if (!in || !out) {
+			*result = -ENOMEM;
+			return;
+		}
+
+		src->beginCpuAccess(Plane::CpuRead);
+		dst->beginCpuAccess(Plane::CpuWrite);
+
+		*result = decoder->decode(static_cast<const uint8_t *>(in),
+					  bytesused,
+					  static_cast<uint8_t *>(out),
+					  dst->length());
+
+		dst->endCpuAccess(Plane::CpuWrite);
+		src->endCpuAccess(Plane::CpuRead);
+	}, job->serial);
+}
+
+void PipelineHandlerUVC::decodeCompleted(uint64_t serial)
 {
-	Request *request = buffer->request();
+	if (!activeCamera_)
+		return;
+
+	UVCCameraData *data = cameraData(activeCamera_);
+
+	for (UVCDecodeJob &job : data->jobs_) {
+		if (!job.request || job.serial != serial)
+			continue;
+
+		if (job.result < 0)
+			LOG(UVC, Warning)
+				<< "Failed to decode frame "
+				<< job.capture->sequence() << ": " << job.result;
 
-	pipe_->completeBuffer(camera_, request, buffer);
-	pipe_->completeRequest(camera_, request);
+		completeJob(activeCamera_, data, &job,
+			    job.result < 0 ? Buffer::BufferError
+					   : Buffer::BufferSuccess,
+			    job.result < 0 ? 0 : job.result);
+		return;
+	}
+}
+
+void PipelineHandlerUVC::frameProcessed(uint64_t serial, int result)
+{
+	if (!activeCamera_)
+		return;
+
+	UVCCameraData *data = cameraData(activeCamera_);
+
+	for (UVCDecodeJob &job : data->jobs_) {
+		if (!job.request || job.serial != serial)
+			continue;
+
+		completeJob(activeCamera_, data, &job,
+			    result < 0 ? Buffer::BufferError
+				       : Buffer::BufferSuccess,
+			    result < 0 ? 0 : result);
+		return;
+	}
+}
+
+/*
+ * Complete the request of a decode job, and reuse the capture buffer for the
+ * next waiting request while streaming.
+ */
+void PipelineHandlerUVC::completeJob(Camera *camera, UVCCameraData *data,
+				     UVCDecodeJob *job, Buffer::Status status,
+				     unsigned int bytesused)
+{
+	Request *request = job->request;
+	Buffer *buffer = request->findBuffer(&data->stream_);
+
+	job->request = nullptr;
+
+	setBufferMetadata(buffer, job->capture.get(), status, bytesused);
+	completeFrame(camera, request, buffer);
+
+	if (!data->streaming_ || data->waitingRequests_.empty())
+		return;
+
+	request = data->waitingRequests_.front();
+	data->waitingRequests_.pop();
+
+	int ret = queueCapture(data, request, job->capture.get());
+	if (ret < 0) {
+		buffer = request->findBuffer(&data->stream_);
+		setBufferMetadata(buffer, nullptr, Buffer::BufferError, 0);
+		completeFrame(camera, request, buffer);
+		return;
+	}
+
+	job->request = request;
+}
+
+/*
+ * Complete a captured or decoded frame and its request. The request completes
+ * once the downscaled frame is ready when it contains a buffer for the
+ * downscaled stream.
+ */
+void PipelineHandlerUVC::completeFrame(Camera *camera, Request *request,
+				       Buffer *buffer)
+{
+	if (completeBuffer(camera, request, buffer))
+		completeRequest(camera, request);
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerUVC);
@@ -8,8 +8,11 @@
 #include <algorithm>
 #include <array>
 #include <iomanip>
+#include <map>
 #include <tuple>
 
+#include <linux/media-bus-format.h>
+
 #include <libcamera/camera.h>
 #include <libcamera/controls.h>
 #include <libcamera/ipa/ipa_interface.h>
@@ -19,46 +22,102 @@
 
 #include "camera_sensor.h"
 #include "device_enumerator.h"
+#include "dma_buf_allocator.h"
+#include "downscaler.h"
 #include "ipa_manager.h"
 #include "log.h"
 #include "media_device.h"
+#include "media_request.h"
 #include "pipeline_handler.h"
 #include "utils.h"
 #include "v4l2_controls.h"
+#include "v4l2_subdevice.h"
 #include "v4l2_videodevice.h"
 
 namespace libcamera {
 
 LOG_DEFINE_CATEGORY(VIMC)
 
+static constexpr unsigned int VIMC_BUFFER_COUNT = 4;
+static constexpr unsigned int VIMC_MIN_BUFFER_COUNT = 2;
+static constexpr unsigned int VIMC_MAX_BUFFER_COUNT = 32;
+
+/* Bayer formats captured from Raw Capture 0, and the matching sensor codes. */
+static const std::map<unsigned int, unsigned int> rawFormats = {
+	{ V4L2_PIX_FMT_SBGGR8, MEDIA_BUS_FMT_SBGGR8_1X8 },
+	{ V4L2_PIX_FMT_SGBRG8, MEDIA_BUS_FMT_SGBRG8_1X8 },
+	{ V4L2_PIX_FMT_SGRBG8, MEDIA_BUS_FMT_SGRBG8_1X8 },
+	{ V4L2_PIX_FMT_SRGGB8, MEDIA_BUS_FMT_SRGGB8_1X8 },
+};
+
+static bool isRawFormat(unsigned int pixelFormat)
+{
+	return rawFormats.find(pixelFormat) != rawFormats.end();
+}
+
 class VimcCameraData : public CameraData
 {
 public:
 	VimcCameraData(PipelineHandler *pipe)
-		: CameraData(pipe)
+		: CameraData(pipe), media_(nullptr), video_(nullptr),
+		  sensor_(nullptr), downscale_(false), rawVideo_(nullptr),
+		  rawSensor_(nullptr), raw_(false), spareFrames_(0)
 	{
 	}
 
 	~VimcCameraData()
 	{
+		delete rawSensor_;
+		delete rawVideo_;
 		delete sensor_;
 		delete video_;
 	}
 
 	int init(MediaDevice *media);
-	void bufferReady(Buffer *buffer);
 
+	MediaDevice *media_;
+	MediaRequestPool mediaRequests_;
 	V4L2VideoDevice *video_;
 	CameraSensor *sensor_;
 	Stream stream_;
+
+	/* Secondary stream downscaled in software from the captured frames. */
+	Stream scaledStream_;
+	std::unique_ptr<DownscaleStage> downscaler_;
+	bool downscale_;
+
+	/*
+	 * Secondary stream captured in Bayer formats from the Raw Capture 0
+	 * node. The node is fed by Sensor A, whose test pattern is generated
+	 * independently of Sensor B, the sensor of the camera.
+	 */
+	V4L2VideoDevice *rawVideo_;
+	V4L2Subdevice *rawSensor_;
+	Stream rawStream_;
+	bool raw_;
+
+	uint64_t spareFrames_;
 };
 
 class VimcCameraConfiguration : public CameraConfiguration
 {
 public:
-	VimcCameraConfiguration();
+	VimcCameraConfiguration(Camera *camera, VimcCameraData *data);
 
 	Status validate() override;
+
+private:
+	Status adjust();
+	static Status adjustRaw(StreamConfiguration *cfg);
+	static bool adjustBufferCount(StreamConfiguration *cfg);
+
+	/*
+	 * The VimcCameraData instance is guaranteed to be valid as long as the
+	 * corresponding Camera instance is valid. In order to borrow a
+	 * reference to the camera data, store a new reference to the camera.
+	 */
+	std::shared_ptr<Camera> camera_;
+	const VimcCameraData *data_;
 };
 
 class PipelineHandlerVimc : public PipelineHandler
@@ -69,6 +128,7 @@ public:
 	CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) override;
 	int configure(Camera *camera, CameraConfiguration *config) override;
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
 
 	int allocateBuffers(Camera *camera,
 			    const std::set<Stream *> &streams) override;
@@ -80,10 +140,23 @@ public:
 
 	int queueRequest(Camera *camera, Request *request) override;
 
+	static std::vector<DeviceMatch> deviceMatches();
 	bool match(DeviceEnumerator *enumerator) override;
 
 private:
-	int processControls(VimcCameraData *data, Request *request);
+	int openDevices(Camera *camera) override;
+	void closeDevices(Camera *camera) override;
+
+	int configureRaw(VimcCameraData *data, StreamConfiguration &cfg);
+	int configureScaled(VimcCameraData *data,
+			    const StreamConfiguration &input,
+			    StreamConfiguration &cfg);
+
+	int processControls(VimcCameraData *data, Request *request,
+			    MediaRequest *mediaRequest);
+
+	void bufferReady(Buffer *buffer);
+	void rawBufferReady(Buffer *buffer);
 
 	VimcCameraData *cameraData(const Camera *camera)
 	{
@@ -92,14 +165,22 @@ private:
 	}
 
 	std::unique_ptr<IPAInterface> ipa_;
+	Camera *activeCamera_;
 };
 
-VimcCameraConfiguration::VimcCameraConfiguration()
+VimcCameraConfiguration::VimcCameraConfiguration(Camera *camera, VimcCameraData *data)
 	: CameraConfiguration()
 {
+	camera_ = camera->shared_from_this();
+	data_ = data;
 }
 
 CameraConfiguration::Status VimcCameraConfiguration::validate()
+{
+	return data_->configCache_.validate(this, &VimcCameraConfiguration::adjust);
+}
+
+CameraConfiguration::Status VimcCameraConfiguration::adjust()
 {
 	static const std::array<unsigned int, 3> formats{
 		V4L2_PIX_FMT_BGR24,
@@ -112,9 +193,19 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 	if (config_.empty())
 		return Invalid;
 
-	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 1) {
-		config_.resize(1);
+	/* The video devices only capture to driver or dmabuf memory. */
+	for (const StreamConfiguration &cfg : config_) {
+		if (cfg.memoryType == UserPtrMemory)
+			return Invalid;
+	}
+
+	/*
+	 * Cap the number of entries to the available streams. Additional
+	 * entries in Bayer formats are captured from Raw Capture 0, and the
+	 * other one is downscaled from the first entry.
+	 */
+	if (config_.size() > 3) {
+		config_.resize(3);
 		status = Adjusted;
 	}
 
@@ -128,11 +219,17 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
+	/* Only linear formats are supported. */
+	if (cfg.modifier) {
+		LOG(VIMC, Debug) << "Adjusting modifier to linear";
+		cfg.modifier = 0;
+		status = Adjusted;
+	}
+
 	/* Clamp the size based on the device limits. */
 	const Size size = cfg.size;
 
-	cfg.size.width = std::max(16U, std::min(4096U, cfg.size.width));
-	cfg.size.height = std::max(16U, std::min(2160U, cfg.size.height));
+	cfg.size = cfg.size.boundedTo({ 4096, 2160 }).expandedTo({ 16, 16 });
 
 	if (cfg.size != size) {
 		LOG(VIMC, Debug)
@@ -140,20 +237,111 @@ CameraConfiguration::Status VimcCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
-	cfg.bufferCount = 4;
+	if (adjustBufferCount(&cfg))
+		status = Adjusted;
+
+	bool raw = false;
+	bool scaled = false;
+
+	for (auto it = config_.begin() + 1; it != config_.end();) {
+		bool isRaw = isRawFormat(it->pixelFormat);
+
+		/* Drop the entries that no stream is left to serve. */
+		if ((isRaw && raw) || (!isRaw && scaled)) {
+			LOG(VIMC, Debug) << "Dropping duplicated stream";
+			it = config_.erase(it);
+			status = Adjusted;
+			continue;
+		}
+
+		Status entry;
+		if (isRaw) {
+			entry = adjustRaw(&*it);
+			raw = true;
+		} else {
+			/* Drop the downscaled stream if the frames can't be scaled. */
+			entry = DownscaleStage::validate(config_[0], &*it);
+			if (entry == Invalid) {
+				LOG(VIMC, Debug) << "Dropping downscaled stream";
+				it = config_.erase(it);
+				status = Adjusted;
+				continue;
+			}
+
+			scaled = true;
+		}
+
+		if (adjustBufferCount(&*it) || entry == Adjusted)
+			status = Adjusted;
+
+		++it;
+	}
+
+	return status;
+}
+
+/*
+ * The sensor limits the size of the Bayer frames to 4096x2160 and aligns it to
+ * even values.
+ */
+CameraConfiguration::Status VimcCameraConfiguration::adjustRaw(StreamConfiguration *cfg)
+{
+	Status status = Valid;
+
+	if (cfg->modifier) {
+		LOG(VIMC, Debug) << "Adjusting modifier to linear";
+		cfg->modifier = 0;
+		status = Adjusted;
+	}
+
+	const Size size = cfg->size;
+
+	cfg->size = cfg->size.boundedTo({ 4096, 2160 }).expandedTo({ 16, 16 });
+	cfg->size.width &= ~1;
+	cfg->size.height &= ~1;
+
+	if (cfg->size != size) {
+		LOG(VIMC, Debug)
+			<< "Adjusting raw size to " << cfg->size.toString();
+		status = Adjusted;
+	}
 
 	return status;
 }
 
+/*
+ * Honour the requested number of buffers within the limits of vb2, to allow
+ * benchmarking the pipeline with different queue depths.
+ */
+bool VimcCameraConfiguration::adjustBufferCount(StreamConfiguration *cfg)
+{
+	const unsigned int bufferCount = cfg->bufferCount;
+
+	cfg->minBufferCount = VIMC_MIN_BUFFER_COUNT;
+	cfg->maxBufferCount = VIMC_MAX_BUFFER_COUNT;
+
+	if (!cfg->bufferCount)
+		cfg->bufferCount = VIMC_BUFFER_COUNT;
+	cfg->bufferCount = std::max(VIMC_MIN_BUFFER_COUNT,
+				    std::min(VIMC_MAX_BUFFER_COUNT, cfg->bufferCount));
+
+	if (cfg->bufferCount == bufferCount)
+		return false;
+
+	LOG(VIMC, Debug) << "Adjusting buffer count to " << cfg->bufferCount;
+	return true;
+}
+
 PipelineHandlerVimc::PipelineHandlerVimc(CameraManager *manager)
-	: PipelineHandler(manager)
+	: PipelineHandler(manager), activeCamera_(nullptr)
 {
 }
 
 CameraConfiguration *PipelineHandlerVimc::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
-	CameraConfiguration *config = new VimcCameraConfiguration();
+	VimcCameraData *data = cameraData(camera);
+	CameraConfiguration *config = new VimcCameraConfiguration(camera, data);
 
 	if (roles.empty())
 		return config;
@@ -161,10 +349,34 @@ CameraConfiguration *PipelineHandlerVimc::generateConfiguration(Camera *camera,
 	StreamConfiguration cfg{};
 	cfg.pixelFormat = V4L2_PIX_FMT_RGB24;
 	cfg.size = { 640, 480 };
-	cfg.bufferCount = 4;
+	cfg.bufferCount = VIMC_BUFFER_COUNT;
 
 	config->addConfiguration(cfg);
 
+	/*
+	 * Additional viewfinder roles are preferably served by a downscaled
+	 * stream, and the other roles by a Bayer stream captured from Raw
+	 * Capture 0, falling back to the other stream when already in use.
+	 */
+	bool raw = false;
+	bool scaled = false;
+
+	for (auto it = roles.begin() + 1; it != roles.end(); ++it) {
+		bool useRaw = *it != StreamRole::Viewfinder;
+		if (useRaw ? raw : scaled)
+			useRaw = !useRaw;
+
+		if (useRaw && !raw) {
+			StreamConfiguration rawCfg = cfg;
+			rawCfg.pixelFormat = V4L2_PIX_FMT_SGRBG8;
+			config->addConfiguration(rawCfg);
+			raw = true;
+		} else if (!useRaw && !scaled) {
+			config->addConfiguration(DownscaleStage::generateConfiguration(cfg));
+			scaled = true;
+		}
+	}
+
 	config->validate();
 
 	return config;
@@ -188,64 +400,288 @@ int PipelineHandlerVimc::configure(Camera *camera, CameraConfiguration *config)
 	    format.fourcc != cfg.pixelFormat)
 		return -EINVAL;
 
+	cfg.stride = format.planes[0].bpl;
 	cfg.setStream(&data->stream_);
 
+	data->downscale_ = false;
+	data->raw_ = false;
+	clearProcessingStages(camera);
+
+	for (unsigned int i = 1; i < config->size(); ++i) {
+		StreamConfiguration &extra = config->at(i);
+
+		if (isRawFormat(extra.pixelFormat))
+			ret = configureRaw(data, extra);
+		else
+			ret = configureScaled(data, cfg, extra);
+		if (ret)
+			return ret;
+	}
+
+	/* The downscaler reads the captured frames with the CPU. */
+	setCpuAccess(&data->stream_, data->downscale_);
+	setCpuAccess(&data->scaledStream_, true);
+
+	return 0;
+}
+
+int PipelineHandlerVimc::configureRaw(VimcCameraData *data,
+				      StreamConfiguration &cfg)
+{
+	int ret;
+
+	/* The capture node only accepts the bus format of the sensor. */
+	V4L2SubdeviceFormat sensorFormat = {};
+	sensorFormat.mbus_code = rawFormats.at(cfg.pixelFormat);
+	sensorFormat.size = cfg.size;
+
+	ret = data->rawSensor_->setFormat(0, &sensorFormat);
+	if (ret)
+		return ret;
+
+	if (sensorFormat.size != cfg.size ||
+	    sensorFormat.mbus_code != rawFormats.at(cfg.pixelFormat))
+		return -EINVAL;
+
+	V4L2DeviceFormat format = {};
+	format.fourcc = cfg.pixelFormat;
+	format.size = cfg.size;
+
+	ret = data->rawVideo_->setFormat(&format);
+	if (ret)
+		return ret;
+
+	if (format.size != cfg.size ||
+	    format.fourcc != cfg.pixelFormat)
+		return -EINVAL;
+
+	data->raw_ = true;
+
+	cfg.stride = format.planes[0].bpl;
+	cfg.setStream(&data->rawStream_);
+
+	return 0;
+}
+
+int PipelineHandlerVimc::configureScaled(VimcCameraData *data,
+					 const StreamConfiguration &input,
+					 StreamConfiguration &cfg)
+{
+	if (!data->downscaler_)
+		data->downscaler_ = utils::make_unique<DownscaleStage>();
+
+	int ret = data->downscaler_->configure(input, cfg);
+	if (ret)
+		return ret;
+
+	ret = addProcessingStage(data->camera_, &data->stream_,
+				 &data->scaledStream_, data->downscaler_.get());
+	if (ret)
+		return ret;
+
+	data->downscale_ = true;
+
+	cfg.stride = data->downscaler_->stride();
+	cfg.setStream(&data->scaledStream_);
+
 	return 0;
 }
 
+int PipelineHandlerVimc::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	VimcCameraData *data = cameraData(camera);
+	int ret;
+
+	/*
+	 * Buffers of downscaled streams are sized for the scaled frames, and
+	 * only the main stream is reconfigured in place.
+	 */
+	if (data->downscale_ || data->raw_ || config->size() > 1 ||
+	    !buffersReusable(&data->stream_, config->at(0)))
+		return -ENOTSUP;
+
+	/*
+	 * Release the buffers from the video device to change its format, and
+	 * import them back. The media requests only depend on the number of
+	 * buffers and are kept.
+	 */
+	ret = data->video_->releaseBuffers();
+	if (ret)
+		return ret;
+
+	ret = configure(camera, config);
+	if (ret)
+		return ret;
+
+	return data->video_->reimportBuffers(&data->stream_.bufferPool());
+}
+
 int PipelineHandlerVimc::allocateBuffers(Camera *camera,
 					 const std::set<Stream *> &streams)
 {
 	VimcCameraData *data = cameraData(camera);
-	Stream *stream = *streams.begin();
+	Stream *stream = &data->stream_;
 	const StreamConfiguration &cfg = stream->configuration();
+	int ret;
 
 	LOG(VIMC, Debug) << "Requesting " << cfg.bufferCount << " buffers";
 
-	if (stream->memoryType() == InternalMemory)
-		return data->video_->exportBuffers(&stream->bufferPool());
-	else
-		return data->video_->importBuffers(&stream->bufferPool());
+	Stream *scaled = &data->scaledStream_;
+	if (data->downscale_ && scaled->memoryType() == InternalMemory) {
+		std::vector<unsigned int> planeSizes = {
+			static_cast<unsigned int>(data->downscaler_->frameSize()),
+		};
+
+		ret = DmaBufAllocator::instance()->allocate(&scaled->bufferPool(),
+							    planeSizes);
+		if (ret) {
+			LOG(VIMC, Error) << "Failed to allocate scaled frame buffers";
+			return ret;
+		}
+	}
+
+	/*
+	 * Allocate internal memory with the dmabuf allocator when available,
+	 * to avoid reallocating memory in the driver when the camera is
+	 * reconfigured, and fall back to exporting buffers from the driver.
+	 */
+	data->video_->setSpareBufferCount(spareBufferCount());
+
+	if (stream->memoryType() == InternalMemory) {
+		ret = data->video_->allocateBuffers(&stream->bufferPool(),
+						    DmaBufAllocator::instance());
+		if (ret)
+			ret = data->video_->exportBuffers(&stream->bufferPool());
+	} else {
+		ret = data->video_->importBuffers(&stream->bufferPool());
+	}
+	if (ret) {
+		freeBuffers(camera, streams);
+		return ret;
+	}
+
+	Stream *raw = &data->rawStream_;
+	if (data->raw_) {
+		data->rawVideo_->setSpareBufferCount(spareBufferCount());
+
+		if (raw->memoryType() == InternalMemory) {
+			ret = data->rawVideo_->allocateBuffers(&raw->bufferPool(),
+							       DmaBufAllocator::instance());
+			if (ret)
+				ret = data->rawVideo_->exportBuffers(&raw->bufferPool());
+		} else {
+			ret = data->rawVideo_->importBuffers(&raw->bufferPool());
+		}
+		if (ret) {
+			freeBuffers(camera, streams);
+			return ret;
+		}
+	}
+
+	/*
+	 * Bind controls and buffers through media requests when supported,
+	 * and fall back to setting controls synchronously otherwise.
+	 */
+	if (data->video_->supportsRequests() &&
+	    !data->mediaRequests_.allocate(data->media_, cfg.bufferCount))
+		LOG(VIMC, Debug) << "Using media requests for per-frame controls";
+
+	return 0;
 }
 
 int PipelineHandlerVimc::freeBuffers(Camera *camera,
 				     const std::set<Stream *> &streams)
 {
 	VimcCameraData *data = cameraData(camera);
-	return data->video_->releaseBuffers();
+
+	Stream *stream = &data->stream_;
+	Stream *scaled = &data->scaledStream_;
+	Stream *raw = &data->rawStream_;
+
+	data->mediaRequests_.release();
+
+	int ret = data->video_->releaseBuffers();
+	if (data->raw_) {
+		int err = data->rawVideo_->releaseBuffers();
+		if (!ret)
+			ret = err;
+	}
+
+	if (stream->memoryType() == InternalMemory)
+		DmaBufAllocator::instance()->release(&stream->bufferPool());
+	if (data->downscale_ && scaled->memoryType() == InternalMemory)
+		DmaBufAllocator::instance()->release(&scaled->bufferPool());
+	if (data->raw_ && raw->memoryType() == InternalMemory)
+		DmaBufAllocator::instance()->release(&raw->bufferPool());
+
+	return ret;
 }
 
 int PipelineHandlerVimc::start(Camera *camera)
 {
 	VimcCameraData *data = cameraData(camera);
-	return data->video_->streamOn();
+	data->spareFrames_ = data->video_->spareFrames();
+
+	int ret = data->video_->streamOn();
+	if (ret)
+		return ret;
+
+	if (data->raw_) {
+		ret = data->rawVideo_->streamOn();
+		if (ret) {
+			data->video_->streamOff();
+			return ret;
+		}
+	}
+
+	activeCamera_ = camera;
+
+	return 0;
 }
 
 void PipelineHandlerVimc::stop(Camera *camera)
 {
 	VimcCameraData *data = cameraData(camera);
 	data->video_->streamOff();
+	if (data->raw_)
+		data->rawVideo_->streamOff();
+
+	uint64_t dropped = data->video_->spareFrames() - data->spareFrames_;
+	if (dropped)
+		LOG(VIMC, Info)
+			<< dropped << " frames dropped due to request starvation";
+
+	/* Complete the frames being downscaled. */
+	if (data->downscale_)
+		data->downscaler_->flush();
+
+	activeCamera_ = nullptr;
 }
 
-int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
+int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request,
+					  MediaRequest *mediaRequest)
 {
-	V4L2ControlList controls;
+	V4L2ControlList v4l2Ctrls;
+
+	const ControlList &ctrls = request->controls();
 
-	for (auto it : request->controls()) {
+	for (const auto &it : ctrls) {
 		const ControlInfo *ci = it.first;
-		ControlValue &value = it.second;
 
 		switch (ci->id()) {
 		case Brightness:
-			controls.add(V4L2_CID_BRIGHTNESS, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_BRIGHTNESS,
+				      ctrls.get(controls::Brightness));
 			break;
 
 		case Contrast:
-			controls.add(V4L2_CID_CONTRAST, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_CONTRAST,
+				      ctrls.get(controls::Contrast));
 			break;
 
 		case Saturation:
-			controls.add(V4L2_CID_SATURATION, value.getInt());
+			v4l2Ctrls.add(V4L2_CID_SATURATION,
+				      ctrls.get(controls::Saturation));
 			break;
 
 		default:
@@ -253,13 +689,13 @@ int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
 		}
 	}
 
-	for (const V4L2Control &ctrl : controls)
+	for (const V4L2Control &ctrl : v4l2Ctrls)
 		LOG(VIMC, Debug)
 			<< "Setting control 0x"
 			<< std::hex << std::setw(8) << ctrl.id() << std::dec
 			<< " to " << ctrl.value();
 
-	int ret = data->sensor_->setControls(&controls);
+	int ret = data->sensor_->setControls(&v4l2Ctrls, mediaRequest);
 	if (ret) {
 		LOG(VIMC, Error) << "Failed to set controls: " << ret;
 		return ret < 0 ? ret : -EINVAL;
@@ -279,20 +715,43 @@ int PipelineHandlerVimc::queueRequest(Camera *camera, Request *request)
 		return -ENOENT;
 	}
 
-	int ret = processControls(data, request);
-	if (ret < 0)
-		return ret;
+	Buffer *rawBuffer = request->findBuffer(&data->rawStream_);
+	if ((!data->downscale_ && request->findBuffer(&data->scaledStream_)) ||
+	    (!data->raw_ && rawBuffer)) {
+		LOG(VIMC, Error)
+			<< "Attempt to queue request with unconfigured stream";
+
+		return -ENOENT;
+	}
 
-	ret = data->video_->queueBuffer(buffer);
-	if (ret < 0)
+	/*
+	 * If media requests are not supported or all of them are in use, the
+	 * controls are applied synchronously.
+	 */
+	MediaRequest *mediaRequest = data->mediaRequests_.get();
+
+	int ret = processControls(data, request, mediaRequest);
+	if (ret >= 0)
+		ret = data->video_->queueBuffer(buffer, mediaRequest);
+	/* The Bayer frames don't depend on the controls of the camera. */
+	if (ret >= 0 && rawBuffer)
+		ret = data->rawVideo_->queueBuffer(rawBuffer);
+	if (ret >= 0 && mediaRequest)
+		ret = mediaRequest->queue();
+	if (ret < 0) {
+		if (mediaRequest) {
+			data->mediaRequests_.recycle(mediaRequest);
+			data->video_->unqueueBuffer(buffer);
+		}
 		return ret;
+	}
 
 	PipelineHandler::queueRequest(camera, request);
 
 	return 0;
 }
 
-bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
+std::vector<DeviceMatch> PipelineHandlerVimc::deviceMatches()
 {
 	DeviceMatch dm("vimc");
 
@@ -306,7 +765,12 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 	dm.add("RGB/YUV Input");
 	dm.add("Scaler");
 
-	MediaDevice *media = acquireMediaDevice(enumerator, dm);
+	return { dm };
+}
+
+bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
+{
+	MediaDevice *media = acquireMediaDevice(enumerator, deviceMatches()[0]);
 	if (!media)
 		return false;
 
@@ -322,8 +786,12 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 	if (data->init(media))
 		return false;
 
+	data->video_->bufferReady.connect(this, &PipelineHandlerVimc::bufferReady);
+	data->rawVideo_->bufferReady.connect(this, &PipelineHandlerVimc::rawBufferReady);
+
 	/* Create and register the camera. */
-	std::set<Stream *> streams{ &data->stream_ };
+	std::set<Stream *> streams{ &data->stream_, &data->scaledStream_,
+				    &data->rawStream_ };
 	std::shared_ptr<Camera> camera = Camera::create(this, "VIMC Sensor B",
 							streams);
 	registerCamera(std::move(camera), std::move(data));
@@ -331,22 +799,59 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 	return true;
 }
 
+/*
+ * The sensor formats and controls are retrieved when initialising the camera
+ * data, only the capture video devices are closed when the camera isn't in
+ * use.
+ */
+int PipelineHandlerVimc::openDevices(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+
+	int ret = data->video_->open();
+	if (ret)
+		return ret;
+
+	ret = data->rawVideo_->open();
+	if (ret)
+		data->video_->close();
+
+	return ret;
+}
+
+void PipelineHandlerVimc::closeDevices(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+
+	data->rawVideo_->close();
+	data->video_->close();
+}
+
 int VimcCameraData::init(MediaDevice *media)
 {
 	int ret;
 
+	media_ = media;
+
 	/* Create and open the video device and the camera sensor. */
 	video_ = new V4L2VideoDevice(media->getEntityByName("Raw Capture 1"));
 	if (video_->open())
 		return -ENODEV;
 
-	video_->bufferReady.connect(this, &VimcCameraData::bufferReady);
-
 	sensor_ = new CameraSensor(media->getEntityByName("Sensor B"));
 	ret = sensor_->init();
 	if (ret)
 		return ret;
 
+	rawVideo_ = new V4L2VideoDevice(media->getEntityByName("Raw Capture 0"));
+	if (rawVideo_->open())
+		return -ENODEV;
+
+	rawSensor_ = new V4L2Subdevice(media->getEntityByName("Sensor A"));
+	ret = rawSensor_->open();
+	if (ret)
+		return ret;
+
 	/* Initialise the supported controls. */
 	const V4L2ControlInfoMap &controls = sensor_->controls();
 	for (const auto &ctrl : controls) {
@@ -368,20 +873,29 @@ int VimcCameraData::init(MediaDevice *media)
 			continue;
 		}
 
-		controlInfo_.emplace(std::piecewise_construct,
-				     std::forward_as_tuple(id),
-				     std::forward_as_tuple(id, info.min(), info.max()));
+		controlInfo_.insert(ControlInfo(id, info.min(), info.max()));
 	}
 
 	return 0;
 }
 
-void VimcCameraData::bufferReady(Buffer *buffer)
+void PipelineHandlerVimc::bufferReady(Buffer *buffer)
+{
+	ASSERT(activeCamera_);
+	Request *request = buffer->request();
+
+	/* The request completes once the downscaled frame is ready. */
+	if (completeBuffer(activeCamera_, request, buffer))
+		completeRequest(activeCamera_, request);
+}
+
+void PipelineHandlerVimc::rawBufferReady(Buffer *buffer)
 {
+	ASSERT(activeCamera_);
 	Request *request = buffer->request();
 
-	pipe_->completeBuffer(camera_, request, buffer);
-	pipe_->completeRequest(camera_, request);
+	if (completeBuffer(activeCamera_, request, buffer))
+		completeRequest(activeCamera_, request);
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerVimc);
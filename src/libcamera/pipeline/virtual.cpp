@@ -0,0 +1,1073 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * virtual.cpp - Pipeline handler for virtual cameras
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <errno.h>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/controls.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "dma_buf_allocator.h"
+#include "downscaler.h"
+#include "formats.h"
+#include "jpeg_encoder.h"
+#include "log.h"
+#include "pipeline_handler.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Virtual)
+
+static constexpr unsigned int VIRTUAL_BUFFER_COUNT = 4;
+static constexpr unsigned int VIRTUAL_MAX_BUFFER_COUNT = 32;
+static constexpr unsigned int VIRTUAL_FRAME_DURATION = 33333;
+static constexpr unsigned int VIRTUAL_EMBEDDED_DATA_FORMAT = v4l2_fourcc('S', 'E', 'N', 'S');
+static constexpr unsigned int VIRTUAL_EMBEDDED_DATA_SIZE = 64;
+
+/*
+ * The virtual sensor outputs embedded data as a single line of
+ * VIRTUAL_EMBEDDED_DATA_SIZE bytes, made of 32-bit tag and value pairs in
+ * native endianness and terminated by a zero tag, similarly to the register
+ * dumps output by real sensors. Times are expressed in microseconds and the
+ * analogue gain in 8.8 fixed point format.
+ */
+enum VirtualEmbeddedDataTag : uint32_t {
+	EmbeddedDataEnd = 0,
+	EmbeddedDataSequence = 1,
+	EmbeddedDataFrameDuration = 2,
+	EmbeddedDataExposureTime = 3,
+	EmbeddedDataAnalogueGain = 4,
+};
+
+class VirtualCameraData : public CameraData
+{
+public:
+	VirtualCameraData(PipelineHandler *pipe)
+		: CameraData(pipe), pixelFormat_(0), modifier_(0),
+		  embeddedData_(false),
+		  memfd_(false), downscale_(false), encode_(false),
+		  sliceHeight_(0), sequence_(0),
+		  frameDuration_(VIRTUAL_FRAME_DURATION * 1000ULL),
+		  nextFrame_(0)
+	{
+	}
+
+	unsigned int frameSize() const;
+	unsigned int bufferSize(const Stream *stream) const;
+	void generateFrame(Plane *plane, unsigned int first,
+			   unsigned int count) const;
+	void generateEmbeddedData(Plane *plane) const;
+	Rectangle adjustCrop(const Rectangle &crop) const;
+
+	Stream stream_;
+	Stream embeddedStream_;
+	Size size_;
+	unsigned int pixelFormat_;
+	uint64_t modifier_;
+	bool embeddedData_;
+	bool memfd_;
+
+	/* Secondary image stream downscaled in software from the frames. */
+	Stream scaledStream_;
+	std::unique_ptr<DownscaleStage> downscaler_;
+	bool downscale_;
+	/* Still image stream encoded to JPEG from the frames. */
+	Stream jpegStream_;
+	std::unique_ptr<JpegEncodeStage> encoder_;
+	bool encode_;
+	/* Scaler crop region, relative to the frame size. */
+	Rectangle crop_;
+	/* Number of lines of the slices frames are written in, 0 for whole frames. */
+	unsigned int sliceHeight_;
+
+	Timer timer_;
+	std::queue<Request *> pendingRequests_;
+
+	unsigned int sequence_;
+	uint64_t frameDuration_;
+	uint64_t nextFrame_;
+};
+
+class VirtualCameraConfiguration : public CameraConfiguration
+{
+public:
+	VirtualCameraConfiguration(Camera *camera, VirtualCameraData *data);
+
+	Status validate() override;
+
+private:
+	Status adjust();
+	bool validateStream(StreamConfiguration *cfg);
+	bool validateBufferCount(StreamConfiguration *cfg);
+
+	/*
+	 * The VirtualCameraData instance is guaranteed to be valid as long as
+	 * the corresponding Camera instance is valid. In order to borrow a
+	 * reference to the camera data, store a new reference to the camera.
+	 */
+	std::shared_ptr<Camera> camera_;
+	const VirtualCameraData *data_;
+};
+
+class PipelineHandlerVirtual : public PipelineHandler
+{
+public:
+	PipelineHandlerVirtual(CameraManager *manager);
+	~PipelineHandlerVirtual();
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+	int reconfigure(Camera *camera, CameraConfiguration *config) override;
+
+	int allocateBuffers(Camera *camera,
+			    const std::set<Stream *> &streams) override;
+	int freeBuffers(Camera *camera,
+			const std::set<Stream *> &streams) override;
+
+	int start(Camera *camera) override;
+	void stop(Camera *camera) override;
+	int standby(Camera *camera) override;
+
+	int queueRequest(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+private:
+	VirtualCameraData *cameraData(const Camera *camera)
+	{
+		return static_cast<VirtualCameraData *>(
+			PipelineHandler::cameraData(camera));
+	}
+
+	int configureJpeg(Camera *camera, const StreamConfiguration &input,
+			  StreamConfiguration &cfg);
+	int allocateStreamBuffers(VirtualCameraData *data, Stream *stream);
+
+	void cancelRequests(Camera *camera);
+	void frameTimeout(Timer *timer);
+	void scheduleFrame(VirtualCameraData *data);
+
+	static std::mutex mutex_;
+	static std::set<unsigned int> indices_;
+
+	unsigned int index_;
+	bool matched_;
+
+	Camera *activeCamera_;
+};
+
+unsigned int VirtualCameraData::frameSize() const
+{
+	return PixelFormatInfo::info(pixelFormat_).frameSize(size_);
+}
+
+unsigned int VirtualCameraData::bufferSize(const Stream *stream) const
+{
+	if (stream == &embeddedStream_)
+		return VIRTUAL_EMBEDDED_DATA_SIZE;
+	if (stream == &scaledStream_)
+		return downscaler_->frameSize();
+	if (stream == &jpegStream_)
+		return encoder_->frameSize();
+
+	return frameSize();
+}
+
+/*
+ * Fill the plane with a horizontal luma gradient scrolling with the frame
+ * sequence number, and neutral chroma. Every byte of the frame is written to
+ * load the memory bus as a real capture device would.
+ *
+ * The gradient is generated for the scaler crop region, scaled to the frame
+ * size.
+ *
+ * With the Samsung 16x16 tile modifier the luma and chroma planes are stored
+ * as 16x16 tiles in raster order, each tile holding 16 consecutive lines of 16
+ * bytes.
+ *
+ * Only the \a count lines starting at line \a first are written, with their
+ * chroma samples, to write frames in slices. For NV12 the slices are aligned
+ * to 2 lines, or to 32 lines with tiles, to cover whole chroma lines and
+ * tiles.
+ */
+void VirtualCameraData::generateFrame(Plane *plane, unsigned int first,
+				      unsigned int count) const
+{
+	uint8_t *mem = static_cast<uint8_t *>(plane->mem());
+	if (!mem)
+		return;
+
+	const unsigned int width = size_.width;
+	const unsigned int height = size_.height;
+	const unsigned int last = first + count;
+	const unsigned int offset = sequence_ * 4;
+
+	/* Compute the luma of each column of the scaler crop region. */
+	std::vector<uint8_t> luma(width);
+	for (unsigned int x = 0; x < width; ++x)
+		luma[x] = (crop_.x + x * crop_.w / width + offset) & 0xff;
+
+	/* memfd buffers don't support dma-buf synchronisation. */
+	if (!memfd_)
+		plane->beginCpuAccess(Plane::CpuWrite);
+
+	if (pixelFormat_ == V4L2_PIX_FMT_YUYV) {
+		for (unsigned int y = first; y < last; ++y) {
+			uint8_t *line = mem + y * width * 2;
+
+			for (unsigned int x = 0; x < width; ++x) {
+				line[x * 2] = luma[x];
+				line[x * 2 + 1] = 128;
+			}
+		}
+	} else if (modifier_ == FormatModSamsung16x16Tile) {
+		const unsigned int tileStride = width * 16;
+
+		for (unsigned int y = first; y < last; ++y) {
+			uint8_t *line = mem + y / 16 * tileStride + y % 16 * 16;
+
+			for (unsigned int x = 0; x < width; ++x)
+				line[x / 16 * 256 + x % 16] = luma[x];
+		}
+
+		memset(mem + width * height + first / 2 * width, 128,
+		       count / 2 * width);
+	} else {
+		for (unsigned int y = first; y < last; ++y) {
+			uint8_t *line = mem + y * width;
+
+			memcpy(line, luma.data(), width);
+		}
+
+		memset(mem + width * height + first / 2 * width, 128,
+		       count / 2 * width);
+	}
+
+	if (!memfd_)
+		plane->endCpuAccess(Plane::CpuWrite);
+}
+
+/*
+ * Fill the plane with the sensor state for the current frame. The virtual
+ * sensor integrates light for the whole frame duration, with unity gain.
+ */
+void VirtualCameraData::generateEmbeddedData(Plane *plane) const
+{
+	uint32_t *mem = static_cast<uint32_t *>(plane->mem());
+	if (!mem)
+		return;
+
+	const uint32_t duration = frameDuration_ / 1000;
+	const uint32_t data[] = {
+		EmbeddedDataSequence, sequence_,
+		EmbeddedDataFrameDuration, duration,
+		EmbeddedDataExposureTime, duration,
+		EmbeddedDataAnalogueGain, 0x100,
+		EmbeddedDataEnd, 0,
+	};
+
+	static_assert(sizeof(data) <= VIRTUAL_EMBEDDED_DATA_SIZE,
+		      "Embedded data doesn't fit in the buffer");
+
+	if (!memfd_)
+		plane->beginCpuAccess(Plane::CpuWrite);
+
+	memcpy(mem, data, sizeof(data));
+
+	if (!memfd_)
+		plane->endCpuAccess(Plane::CpuWrite);
+}
+
+/* Clamp the scaler crop region inside the frame. The region can't be empty. */
+Rectangle VirtualCameraData::adjustCrop(const Rectangle &crop) const
+{
+	Rectangle rect;
+
+	rect.w = utils::clamp(crop.w, 1U, size_.width);
+	rect.h = utils::clamp(crop.h, 1U, size_.height);
+	rect.x = utils::clamp<int>(crop.x, 0, size_.width - rect.w);
+	rect.y = utils::clamp<int>(crop.y, 0, size_.height - rect.h);
+
+	return rect;
+}
+
+VirtualCameraConfiguration::VirtualCameraConfiguration(Camera *camera, VirtualCameraData *data)
+	: CameraConfiguration()
+{
+	camera_ = camera->shared_from_this();
+	data_ = data;
+}
+
+CameraConfiguration::Status VirtualCameraConfiguration::validate()
+{
+	return data_->configCache_.validate(this, &VirtualCameraConfiguration::adjust);
+}
+
+CameraConfiguration::Status VirtualCameraConfiguration::adjust()
+{
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	/*
+	 * Cap the number of entries to the available streams, keeping the
+	 * first two image streams, the first JPEG stream following an image
+	 * stream and the first embedded data stream. The second image stream
+	 * is downscaled from the first one, and the JPEG stream is encoded
+	 * from it. Embedded data can only be captured along with images.
+	 */
+	unsigned int images = 0;
+	bool embedded = false;
+	bool jpeg = false;
+
+	for (auto it = config_.begin(); it != config_.end();) {
+		bool isJpeg = it->pixelFormat == V4L2_PIX_FMT_JPEG && images;
+		bool found = it->pixelFormat == VIRTUAL_EMBEDDED_DATA_FORMAT
+			   ? embedded : isJpeg ? jpeg : images == 2;
+		if (found) {
+			it = config_.erase(it);
+			status = Adjusted;
+			continue;
+		}
+
+		if (it->pixelFormat == VIRTUAL_EMBEDDED_DATA_FORMAT)
+			embedded = true;
+		else if (isJpeg)
+			jpeg = true;
+		else
+			images++;
+		++it;
+	}
+
+	if (!images)
+		return Invalid;
+
+	const StreamConfiguration *image = nullptr;
+
+	for (auto it = config_.begin(); it != config_.end();) {
+		StreamConfiguration &cfg = *it;
+
+		if (cfg.pixelFormat == VIRTUAL_EMBEDDED_DATA_FORMAT || !image) {
+			if (validateStream(&cfg))
+				status = Adjusted;
+			if (cfg.pixelFormat != VIRTUAL_EMBEDDED_DATA_FORMAT)
+				image = &cfg;
+			++it;
+			continue;
+		}
+
+		/* Processed frames are written at once. */
+		if (cfg.sliceHeight) {
+			cfg.sliceHeight = 0;
+			status = Adjusted;
+		}
+
+		/* Drop the JPEG stream if the frames can't be encoded. */
+		if (cfg.pixelFormat == V4L2_PIX_FMT_JPEG) {
+			Status encoded = JpegEncodeStage::validate(*image, &cfg);
+			if (encoded == Invalid) {
+				LOG(Virtual, Debug) << "Dropping JPEG stream";
+				it = config_.erase(it);
+				status = Adjusted;
+				continue;
+			}
+
+			if (validateBufferCount(&cfg) || encoded == Adjusted)
+				status = Adjusted;
+			++it;
+			continue;
+		}
+
+		/* Drop the downscaled stream if the frames can't be scaled. */
+		Status scaled = DownscaleStage::validate(*image, &cfg);
+		if (scaled == Invalid) {
+			LOG(Virtual, Debug) << "Dropping downscaled stream";
+			it = config_.erase(it);
+			status = Adjusted;
+			continue;
+		}
+
+		if (validateBufferCount(&cfg) || scaled == Adjusted)
+			status = Adjusted;
+		++it;
+	}
+
+	return status;
+}
+
+/*
+ * Adjust a stream configuration to the capabilities of the virtual sensor.
+ * Return true if the configuration has been adjusted.
+ */
+bool VirtualCameraConfiguration::validateStream(StreamConfiguration *config)
+{
+	static const std::array<unsigned int, 2> formats{
+		V4L2_PIX_FMT_NV12,
+		V4L2_PIX_FMT_YUYV,
+	};
+
+	StreamConfiguration &cfg = *config;
+	bool adjusted = false;
+
+	if (cfg.pixelFormat == VIRTUAL_EMBEDDED_DATA_FORMAT) {
+		const Size size{ VIRTUAL_EMBEDDED_DATA_SIZE, 1 };
+		if (cfg.size != size || cfg.modifier || cfg.sliceHeight) {
+			cfg.size = size;
+			cfg.modifier = 0;
+			cfg.sliceHeight = 0;
+			adjusted = true;
+		}
+
+		return validateBufferCount(&cfg) || adjusted;
+	}
+
+	/* Adjust the pixel format. */
+	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
+	    formats.end()) {
+		LOG(Virtual, Debug) << "Adjusting format to NV12";
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		adjusted = true;
+	}
+
+	/* NV12 can be produced linear or with 16x16 tiles. */
+	if (cfg.modifier &&
+	    (cfg.pixelFormat != V4L2_PIX_FMT_NV12 ||
+	     cfg.modifier != FormatModSamsung16x16Tile)) {
+		LOG(Virtual, Debug) << "Adjusting modifier to linear";
+		cfg.modifier = 0;
+		adjusted = true;
+	}
+
+	/*
+	 * Clamp the size to even dimensions up to 1080p, or to a multiple of
+	 * the tile size for tiled formats.
+	 */
+	const Size size = cfg.size;
+	const unsigned int align = cfg.modifier ? 16 : 2;
+
+	cfg.size = cfg.size.boundedTo({ 1920, 1080 })
+			   .expandedTo({ 32, 32 })
+			   .alignedDownTo(align, align);
+
+	if (cfg.size != size) {
+		LOG(Virtual, Debug)
+			<< "Adjusting size to " << cfg.size.toString();
+		adjusted = true;
+	}
+
+	/*
+	 * Frames are written in slices covering whole chroma lines, or whole
+	 * chroma tiles for tiled formats. A slice spanning the whole frame is
+	 * reported at completion only.
+	 */
+	if (cfg.sliceHeight) {
+		const unsigned int sliceHeight = cfg.sliceHeight;
+		const unsigned int sliceAlign = cfg.modifier ? 32
+					      : cfg.pixelFormat == V4L2_PIX_FMT_NV12 ? 2 : 1;
+
+		cfg.sliceHeight = (cfg.sliceHeight + sliceAlign - 1) / sliceAlign * sliceAlign;
+		if (cfg.sliceHeight >= cfg.size.height)
+			cfg.sliceHeight = 0;
+
+		if (cfg.sliceHeight != sliceHeight) {
+			LOG(Virtual, Debug)
+				<< "Adjusting slice height to " << cfg.sliceHeight;
+			adjusted = true;
+		}
+	}
+
+	return validateBufferCount(&cfg) || adjusted;
+}
+
+bool VirtualCameraConfiguration::validateBufferCount(StreamConfiguration *cfg)
+{
+	const unsigned int bufferCount = cfg->bufferCount;
+
+	cfg->minBufferCount = 1;
+	cfg->maxBufferCount = VIRTUAL_MAX_BUFFER_COUNT;
+
+	if (!cfg->bufferCount)
+		cfg->bufferCount = VIRTUAL_BUFFER_COUNT;
+	cfg->bufferCount = std::min(VIRTUAL_MAX_BUFFER_COUNT, cfg->bufferCount);
+
+	if (cfg->bufferCount == bufferCount)
+		return false;
+
+	LOG(Virtual, Debug) << "Adjusting buffer count to " << cfg->bufferCount;
+	return true;
+}
+
+std::mutex PipelineHandlerVirtual::mutex_;
+std::set<unsigned int> PipelineHandlerVirtual::indices_;
+
+PipelineHandlerVirtual::PipelineHandlerVirtual(CameraManager *manager)
+	: PipelineHandler(manager), index_(0), matched_(false),
+	  activeCamera_(nullptr)
+{
+}
+
+PipelineHandlerVirtual::~PipelineHandlerVirtual()
+{
+	if (!matched_)
+		return;
+
+	std::lock_guard<std::mutex> locker(mutex_);
+	indices_.erase(index_);
+}
+
+CameraConfiguration *PipelineHandlerVirtual::generateConfiguration(Camera *camera,
+	const StreamRoles &roles)
+{
+	VirtualCameraData *data = cameraData(camera);
+	CameraConfiguration *config = new VirtualCameraConfiguration(camera, data);
+
+	if (roles.empty())
+		return config;
+
+	StreamConfiguration image{};
+	unsigned int images = 0;
+	bool embedded = false;
+	bool jpeg = false;
+
+	for (const StreamRole role : roles) {
+		StreamConfiguration cfg{};
+		cfg.bufferCount = VIRTUAL_BUFFER_COUNT;
+
+		if (role == StreamRole::EmbeddedData) {
+			if (embedded)
+				continue;
+
+			cfg.pixelFormat = VIRTUAL_EMBEDDED_DATA_FORMAT;
+			cfg.size = { VIRTUAL_EMBEDDED_DATA_SIZE, 1 };
+			embedded = true;
+		} else if (role == StreamRole::StillCapture && images && !jpeg &&
+			   JpegEncoder::isSupported()) {
+			/* Still images are encoded from the first image stream. */
+			cfg = JpegEncodeStage::generateConfiguration(image);
+			jpeg = true;
+		} else {
+			if (images == 2)
+				continue;
+
+			/* The second image stream is downscaled. */
+			cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+			cfg.size = images ? Size(640, 360) : Size(1280, 720);
+			if (!images)
+				image = cfg;
+			images++;
+		}
+
+		config->addConfiguration(cfg);
+	}
+
+	if (config->validate() == CameraConfiguration::Invalid) {
+		delete config;
+		return nullptr;
+	}
+
+	return config;
+}
+
+int PipelineHandlerVirtual::configure(Camera *camera, CameraConfiguration *config)
+{
+	VirtualCameraData *data = cameraData(camera);
+	const StreamConfiguration *image = nullptr;
+	StreamConfiguration *scaled = nullptr;
+	StreamConfiguration *jpeg = nullptr;
+
+	data->embeddedData_ = false;
+	data->downscale_ = false;
+	data->encode_ = false;
+	clearProcessingStages(camera);
+
+	for (StreamConfiguration &cfg : *config) {
+		if (cfg.pixelFormat == VIRTUAL_EMBEDDED_DATA_FORMAT) {
+			data->embeddedData_ = true;
+			cfg.setStream(&data->embeddedStream_);
+			continue;
+		}
+
+		if (image) {
+			if (cfg.pixelFormat == V4L2_PIX_FMT_JPEG)
+				jpeg = &cfg;
+			else
+				scaled = &cfg;
+			continue;
+		}
+
+		image = &cfg;
+
+		data->size_ = cfg.size;
+		data->pixelFormat_ = cfg.pixelFormat;
+		data->modifier_ = cfg.modifier;
+		data->crop_ = { 0, 0, cfg.size.width, cfg.size.height };
+		data->sliceHeight_ = cfg.sliceHeight;
+
+		/* Frames are generated without padding between lines. */
+		cfg.stride = PixelFormatInfo::info(cfg.pixelFormat).stride(cfg.size.width);
+
+		cfg.setStream(&data->stream_);
+	}
+
+	if (jpeg) {
+		int ret = configureJpeg(camera, *image, *jpeg);
+		if (ret)
+			return ret;
+	}
+
+	if (!scaled)
+		return 0;
+
+	if (!data->downscaler_)
+		data->downscaler_ = utils::make_unique<DownscaleStage>();
+
+	int ret = data->downscaler_->configure(*image, *scaled);
+	if (ret)
+		return ret;
+
+	ret = addProcessingStage(camera, &data->stream_, &data->scaledStream_,
+				 data->downscaler_.get());
+	if (ret)
+		return ret;
+
+	data->downscale_ = true;
+
+	scaled->stride = data->downscaler_->stride();
+	scaled->setStream(&data->scaledStream_);
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::configureJpeg(Camera *camera,
+					  const StreamConfiguration &input,
+					  StreamConfiguration &cfg)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	if (!data->encoder_)
+		data->encoder_ = utils::make_unique<JpegEncodeStage>();
+
+	int ret = data->encoder_->configure(input, cfg);
+	if (ret)
+		return ret;
+
+	ret = addProcessingStage(camera, &data->stream_, &data->jpegStream_,
+				 data->encoder_.get());
+	if (ret)
+		return ret;
+
+	data->encode_ = true;
+
+	/* JPEG images are compressed and have no line stride. */
+	cfg.stride = 0;
+	cfg.setStream(&data->jpegStream_);
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	/*
+	 * The buffers can only be reused for the same set of streams. Buffers
+	 * of downscaled and JPEG streams are sized for the processed frames,
+	 * and are always reallocated.
+	 */
+	if (data->downscale_ || data->encode_ ||
+	    config->size() != 1U + data->embeddedData_)
+		return -ENOTSUP;
+
+	bool image = false;
+	for (const StreamConfiguration &cfg : *config) {
+		bool embedded = cfg.pixelFormat == VIRTUAL_EMBEDDED_DATA_FORMAT;
+		if (!embedded && image)
+			return -ENOTSUP;
+
+		const Stream *stream = embedded ? &data->embeddedStream_
+						: &data->stream_;
+		if (!buffersReusable(stream, cfg))
+			return -ENOTSUP;
+
+		image |= !embedded;
+	}
+
+	int ret = configure(camera, config);
+	if (ret)
+		return ret;
+
+	/* Frames are generated in place, any large enough buffer fits. */
+	for (const StreamConfiguration &cfg : *config) {
+		Stream *stream = cfg.stream();
+
+		if (stream->memoryType() != InternalMemory)
+			continue;
+
+		for (const BufferMemory &mem : stream->bufferPool().buffers()) {
+			if (mem.planes().empty() ||
+			    mem.planes()[0].length() < data->bufferSize(stream))
+				return -ENOSPC;
+		}
+	}
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::allocateBuffers(Camera *camera,
+					    const std::set<Stream *> &streams)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	for (Stream *stream : streams) {
+		if (stream->memoryType() != InternalMemory)
+			continue;
+
+		int ret = allocateStreamBuffers(data, stream);
+		if (ret) {
+			freeBuffers(camera, streams);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::allocateStreamBuffers(VirtualCameraData *data,
+						  Stream *stream)
+{
+	const unsigned int size = data->bufferSize(stream);
+
+	std::vector<unsigned int> planeSizes = { size };
+	int ret = DmaBufAllocator::instance()->allocate(&stream->bufferPool(),
+							planeSizes);
+	if (ret != -ENODEV) {
+		if (ret)
+			LOG(Virtual, Error) << "Failed to allocate frame buffers";
+
+		data->memfd_ = false;
+		return ret;
+	}
+
+	/*
+	 * Fall back to memfd when no dmabuf allocator is available, to support
+	 * systems without dma-buf heaps or udmabuf. The buffers can then only
+	 * be accessed by the CPU.
+	 */
+	LOG(Virtual, Debug) << "Using memfd for frame buffers";
+
+	for (BufferMemory &mem : stream->bufferPool().buffers()) {
+		mem.planes().clear();
+
+		int fd = memfd_create("libcamera-virtual", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, size) < 0) {
+			ret = -errno;
+			LOG(Virtual, Error)
+				<< "Failed to allocate frame buffers: "
+				<< strerror(-ret);
+			if (fd >= 0)
+				close(fd);
+			return ret;
+		}
+
+		mem.planes().emplace_back();
+		ret = mem.planes().back().setDmabuf(fd, size);
+		close(fd);
+		if (ret)
+			return ret;
+	}
+
+	data->memfd_ = true;
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::freeBuffers(Camera *camera,
+					const std::set<Stream *> &streams)
+{
+	for (Stream *stream : streams) {
+		if (stream->memoryType() == InternalMemory)
+			DmaBufAllocator::instance()->release(&stream->bufferPool());
+	}
+
+	return 0;
+}
+
+int PipelineHandlerVirtual::start(Camera *camera)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	activeCamera_ = camera;
+
+	/* memfd buffers don't support dma-buf synchronisation. */
+	if (data->downscale_)
+		data->downscaler_->setSyncCpuAccess(!data->memfd_);
+	if (data->encode_)
+		data->encoder_->setSyncCpuAccess(!data->memfd_);
+
+	data->sequence_ = 0;
+	data->nextFrame_ = utils::monotonic_ns();
+	scheduleFrame(data);
+
+	return 0;
+}
+
+void PipelineHandlerVirtual::stop(Camera *camera)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	data->timer_.stop();
+
+	/* Complete the frames being downscaled and encoded. */
+	if (data->downscale_)
+		data->downscaler_->flush();
+	if (data->encode_)
+		data->encoder_->flush();
+
+	activeCamera_ = nullptr;
+
+	cancelRequests(camera);
+}
+
+/*
+ * The virtual sensor keeps generating frames in standby. They are dropped as no
+ * request can be queued, and capture resumes with the next frame.
+ */
+int PipelineHandlerVirtual::standby(Camera *camera)
+{
+	cancelRequests(camera);
+
+	return 0;
+}
+
+void PipelineHandlerVirtual::cancelRequests(Camera *camera)
+{
+	VirtualCameraData *data = cameraData(camera);
+
+	while (!data->pendingRequests_.empty()) {
+		Request *request = data->pendingRequests_.front();
+		data->pendingRequests_.pop();
+
+		for (auto const &it : request->buffers()) {
+			Buffer *buffer = it.second;
+
+			/* Processed buffers complete along with their source. */
+			if (buffer->request() != request)
+				continue;
+
+			setBufferMetadata(buffer, nullptr, Buffer::BufferCancelled, 0);
+			completeBuffer(camera, request, buffer);
+		}
+
+		completeRequest(camera, request);
+	}
+}
+
+int PipelineHandlerVirtual::queueRequest(Camera *camera, Request *request)
+{
+	VirtualCameraData *data = cameraData(camera);
+	Buffer *buffer = request->findBuffer(&data->stream_);
+	if (!buffer) {
+		LOG(Virtual, Error)
+			<< "Attempt to queue request with invalid stream";
+
+		return -ENOENT;
+	}
+
+	if ((!data->embeddedData_ && request->findBuffer(&data->embeddedStream_)) ||
+	    (!data->downscale_ && request->findBuffer(&data->scaledStream_)) ||
+	    (!data->encode_ && request->findBuffer(&data->jpegStream_))) {
+		LOG(Virtual, Error)
+			<< "Attempt to queue request with unconfigured stream";
+
+		return -ENOENT;
+	}
+
+	/* Frames are generated in place in the application memory. */
+	for (const auto &it : request->buffers()) {
+		const std::vector<Plane> &planes = it.second->mem()->planes();
+
+		if (it.first->memoryType() == UserPtrMemory &&
+		    (planes.empty() ||
+		     planes[0].length() < data->bufferSize(it.first))) {
+			LOG(Virtual, Error) << "Invalid buffer user memory";
+			return -EINVAL;
+		}
+	}
+
+	/* The frame duration takes effect from the next frame. */
+	const ControlList &ctrls = request->controls();
+	if (ctrls.contains(FrameDuration)) {
+		int duration = ctrls.get(controls::FrameDuration);
+		duration = std::max(1000, std::min(1000000, duration));
+		data->frameDuration_ = duration * 1000ULL;
+	}
+
+	data->pendingRequests_.push(request);
+
+	PipelineHandler::queueRequest(camera, request);
+
+	return 0;
+}
+
+bool PipelineHandlerVirtual::match(DeviceEnumerator *enumerator)
+{
+	/*
+	 * Virtual cameras are only created on demand, with the number of
+	 * cameras set by the LIBCAMERA_VIRTUAL_CAMERAS environment variable.
+	 * Each camera is handled by a separate pipeline handler instance, as
+	 * for cameras backed by separate media devices.
+	 */
+	const char *count = utils::secure_getenv("LIBCAMERA_VIRTUAL_CAMERAS");
+	if (!count)
+		return false;
+
+	unsigned int cameras = strtoul(count, nullptr, 10);
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+
+		if (indices_.size() >= cameras)
+			return false;
+
+		while (indices_.count(index_))
+			index_++;
+
+		indices_.insert(index_);
+		matched_ = true;
+	}
+
+	std::unique_ptr<VirtualCameraData> data =
+		utils::make_unique<VirtualCameraData>(this);
+
+	data->timer_.timeout.connect(this, &PipelineHandlerVirtual::frameTimeout);
+
+	data->controlInfo_.insert(ControlInfo(FrameDuration, 1000, 1000000));
+
+	Rectangle maxCrop = { 0, 0, 1920, 1080 };
+	data->controlInfo_.insert(ControlInfo(ScalerCrop, Rectangle{},
+					      maxCrop));
+
+	/* Create and register the camera, frames are generated in software. */
+	std::set<Stream *> streams{ &data->stream_, &data->embeddedStream_,
+				    &data->scaledStream_, &data->jpegStream_ };
+	for (Stream *stream : streams)
+		setCpuAccess(stream, true);
+
+	std::shared_ptr<Camera> camera =
+		Camera::create(this, "Virtual " + std::to_string(index_), streams);
+	registerCamera(std::move(camera), std::move(data));
+
+	return true;
+}
+
+/*
+ * Schedule the next frame based on the frame deadline rather than the timer
+ * expiration time, to avoid accumulating the timer latency. The timer is armed
+ * with the absolute deadline, as the frame duration isn't a whole number of
+ * milliseconds.
+ */
+void PipelineHandlerVirtual::scheduleFrame(VirtualCameraData *data)
+{
+	uint64_t now = utils::monotonic_ns();
+
+	data->nextFrame_ += data->frameDuration_;
+	if (data->nextFrame_ < now)
+		data->nextFrame_ = now + data->frameDuration_;
+
+	data->timer_.start(std::chrono::steady_clock::time_point(
+		std::chrono::nanoseconds(data->nextFrame_)));
+}
+
+void PipelineHandlerVirtual::frameTimeout(Timer *timer)
+{
+	if (!activeCamera_)
+		return;
+
+	Camera *camera = activeCamera_;
+	VirtualCameraData *data = cameraData(camera);
+	uint64_t timestamp = utils::monotonic_ns();
+
+	notifyFrameStart(camera, data->sequence_, timestamp);
+
+	/* Frames are dropped when no request is available. */
+	if (!data->pendingRequests_.empty()) {
+		Request *request = data->pendingRequests_.front();
+		data->pendingRequests_.pop();
+
+		/* The scaler crop region applies from the frame of the request. */
+		const ControlList &ctrls = request->controls();
+		if (ctrls.contains(ScalerCrop))
+			data->crop_ = data->adjustCrop(ctrls.get(controls::ScalerCrop));
+
+		Buffer *buffer = request->findBuffer(&data->stream_);
+		Plane *plane = &buffer->mem()->planes()[0];
+		const unsigned int height = data->size_.height;
+		const unsigned int slice = data->sliceHeight_ ? data->sliceHeight_
+					 : height;
+
+		/* Report the slices written before the buffer completes. */
+		for (unsigned int line = 0; line < height; line += slice) {
+			unsigned int count = std::min(slice, height - line);
+
+			data->generateFrame(plane, line, count);
+			if (line + count < height)
+				notifyBufferProgress(camera, request, buffer,
+						     line + count);
+		}
+
+		setBufferMetadata(buffer, Buffer::BufferSuccess,
+				  data->frameSize(), data->sequence_, timestamp);
+
+		Buffer *embedded = request->findBuffer(&data->embeddedStream_);
+		if (embedded) {
+			data->generateEmbeddedData(&embedded->mem()->planes()[0]);
+
+			setBufferMetadata(embedded, Buffer::BufferSuccess,
+					  VIRTUAL_EMBEDDED_DATA_SIZE,
+					  data->sequence_, timestamp);
+			completeBuffer(camera, request, embedded);
+		}
+
+		ControlList &metadata = request->metadata();
+		metadata.set(controls::SensorTimestamp,
+			     static_cast<int64_t>(timestamp));
+		metadata.set(controls::FrameDuration,
+			     static_cast<int>(data->frameDuration_ / 1000));
+		metadata.set(controls::ScalerCrop, data->crop_);
+
+		/* The request completes once the downscaled frame is ready. */
+		if (completeBuffer(camera, request, buffer))
+			completeRequest(camera, request);
+	}
+
+	data->sequence_++;
+
+	scheduleFrame(data);
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerVirtual);
+
+} /* namespace libcamera */
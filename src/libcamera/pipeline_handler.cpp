@@ -7,6 +7,12 @@
 
 #include "pipeline_handler.h"
 
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
@@ -14,6 +20,9 @@
 #include "device_enumerator.h"
 #include "log.h"
 #include "media_device.h"
+#include "metrics_registry.h"
+#include "processing_stage.h"
+#include "tracer.h"
 #include "utils.h"
 
 /**
@@ -83,6 +92,9 @@ LOG_DEFINE_CATEGORY(Pipeline)
  *
  * The list of queued request is used to track requests queued in order to
  * ensure completion of all requests when the pipeline handler is stopped.
+ * Requests are stored in queueing order, and are only added to the back and
+ * removed from the front of the list. The list is stored in a std::deque to
+ * avoid memory allocation for every request queued.
  *
  * \sa PipelineHandler::queueRequest(), PipelineHandler::stop(),
  * PipelineHandler::completeRequest()
@@ -96,6 +108,24 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * creating the camera, and shall not be modified afterwards.
  */
 
+/**
+ * \var CameraData::stats_
+ * \brief The runtime statistics of the camera
+ *
+ * The statistics are updated by the PipelineHandler base class when requests
+ * and buffers are queued and completed, and are reported to applications
+ * through Camera::statistics().
+ */
+
+/**
+ * \var CameraData::configCache_
+ * \brief The cache of the camera configuration validation results
+ *
+ * Pipeline handlers validate their camera configurations through the cache, see
+ * ConfigurationCache. The cache is mutable as camera configurations only hold
+ * a const pointer to the camera data.
+ */
+
 /**
  * \class PipelineHandler
  * \brief Create and manage cameras based on a set of media devices
@@ -107,6 +137,12 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * They implement std::enable_shared_from_this<> in order to create new
  * std::shared_ptr<> in code paths originating from member functions of the
  * PipelineHandler class where only the 'this' pointer is available.
+ *
+ * Each pipeline handler instance is bound to its own thread, created by the
+ * camera manager, in which all its methods are called. The Camera class
+ * forwards the application calls to that thread, and pipeline handlers report
+ * buffer and request completion from it, without waiting for the application
+ * to process completion.
  */
 
 /**
@@ -119,7 +155,7 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * respective factories.
  */
 PipelineHandler::PipelineHandler(CameraManager *manager)
-	: manager_(manager)
+	: manager_(manager), configuredCamera_(nullptr), lockCount_(0)
 {
 }
 
@@ -129,6 +165,27 @@ PipelineHandler::~PipelineHandler()
 		media->release();
 };
 
+/**
+ * \brief Retrieve the media devices patterns matched by the pipeline handler
+ *
+ * Pipeline handlers declare the patterns of the media devices they need by
+ * hiding this static function in their class. The patterns are retrieved once
+ * when the pipeline handler class is registered, and let the camera manager
+ * skip the creation of pipeline handler instances when no available media
+ * device matches one of the patterns. The patterns shall thus list all the
+ * media devices that match() acquires, and match() may use them to search the
+ * media devices.
+ *
+ * Pipeline handlers that don't declare any pattern, as the default
+ * implementation, are always instantiated and their match() function called.
+ *
+ * \return The patterns of the media devices needed by the pipeline handler
+ */
+std::vector<DeviceMatch> PipelineHandler::deviceMatches()
+{
+	return {};
+}
+
 /**
  * \fn PipelineHandler::match(DeviceEnumerator *enumerator)
  * \brief Match media devices and create camera instances
@@ -195,19 +252,34 @@ MediaDevice *PipelineHandler::acquireMediaDevice(DeviceEnumerator *enumerator,
  * This method shall not be called from pipeline handler implementation, as the
  * Camera class handles locking directly.
  *
+ * The media devices are locked when the first camera of the pipeline handler
+ * is acquired, and unlocked when the last one is released. Cameras created by
+ * the same pipeline handler can thus be used concurrently by the process, the
+ * pipeline handler arbitrating the hardware resources they share.
+ *
  * \return True if the devices could be locked, false otherwise
  * \sa unlock()
  * \sa MediaDevice::lock()
  */
 bool PipelineHandler::lock()
 {
-	for (std::shared_ptr<MediaDevice> &media : mediaDevices_) {
-		if (!media->lock()) {
-			unlock();
+	std::lock_guard<std::mutex> locker(lockMutex_);
+
+	if (lockCount_) {
+		lockCount_++;
+		return true;
+	}
+
+	for (auto it = mediaDevices_.begin(); it != mediaDevices_.end(); ++it) {
+		if (!(*it)->lock()) {
+			for (auto media = mediaDevices_.begin(); media != it; ++media)
+				(*media)->unlock();
 			return false;
 		}
 	}
 
+	lockCount_ = 1;
+
 	return true;
 }
 
@@ -221,6 +293,11 @@ bool PipelineHandler::lock()
  */
 void PipelineHandler::unlock()
 {
+	std::lock_guard<std::mutex> locker(lockMutex_);
+
+	if (!lockCount_ || --lockCount_)
+		return;
+
 	for (std::shared_ptr<MediaDevice> &media : mediaDevices_)
 		media->unlock();
 }
@@ -279,6 +356,36 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * \return 0 on success or a negative error code otherwise
  */
 
+/**
+ * \brief Reconfigure a camera while keeping its buffers allocated
+ * \param[in] camera The camera to reconfigure
+ * \param[in] config The camera configurations to setup
+ *
+ * Apply the configuration \a config to \a camera, as configure() does, but
+ * while buffers are allocated for the streams. This allows switching between
+ * configurations, such as preview and still capture sizes, without releasing
+ * and reallocating memory. The intended caller of this interface is the Camera
+ * class, when an application configures a camera in the Prepared state.
+ *
+ * Pipeline handlers shall only reuse the buffers when \a config uses the same
+ * streams as the current configuration, with the same number of buffers and
+ * memory type, as checked by buffersReusable(), and when the buffers are large
+ * enough for the new configuration. In all other cases this method shall fail,
+ * and the Camera class then frees the buffers, configures the camera and
+ * allocates buffers again. Failures may leave the camera partially configured.
+ *
+ * The default implementation doesn't support reusing buffers and returns
+ * -ENOTSUP.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOTSUP The configuration can't reuse the buffers
+ * \retval -ENOSPC The buffers are too small for the configuration
+ */
+int PipelineHandler::reconfigure(Camera *camera, CameraConfiguration *config)
+{
+	return -ENOTSUP;
+}
+
 /**
  * \fn PipelineHandler::allocateBuffers()
  * \brief Allocate buffers for a stream
@@ -328,8 +435,47 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  *
  * This method stops capturing and processing requests immediately. All pending
  * requests are cancelled and complete immediately in an error state.
+ *
+ * This method is also called to stop a camera that has been put in standby
+ * with standby(), in which case no request is pending.
  */
 
+/**
+ * \brief Put a camera in standby
+ * \param[in] camera The camera to put in standby
+ *
+ * This method stops processing requests immediately, cancelling all pending
+ * requests as stop() does, but keeps the devices streaming and discards the
+ * frames they capture, to resume capture with resume() within one frame
+ * interval.
+ *
+ * Pipeline handlers that can keep their devices streaming without requests
+ * shall override this method. The base implementation returns -ENOTSUP, in
+ * which case the camera is stopped with stop() and restarted with start().
+ *
+ * \return 0 on success or a negative error code otherwise, in which case the
+ * camera shall be left running
+ */
+int PipelineHandler::standby(Camera *camera)
+{
+	return -ENOTSUP;
+}
+
+/**
+ * \brief Resume capture from a camera in standby
+ * \param[in] camera The camera to resume
+ *
+ * This method resumes processing requests after a successful call to
+ * standby(). The base implementation does nothing, as the devices have been
+ * kept streaming.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::resume(Camera *camera)
+{
+	return 0;
+}
+
 /**
  * \fn PipelineHandler::queueRequest()
  * \brief Queue a request to the camera
@@ -348,16 +494,250 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * Requests completion shall be signaled by the pipeline handler using the
  * completeRequest() method.
  *
+ * Requests are queued asynchronously by the Camera class. If this method
+ * returns an error, the request is completed with all its buffers cancelled.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int PipelineHandler::queueRequest(Camera *camera, Request *request)
 {
 	CameraData *data = cameraData(camera);
 	data->queuedRequests_.push_back(request);
+	data->stats_.requestQueued(data->queuedRequests_.size());
 
 	return 0;
 }
 
+/**
+ * \brief Queue a batch of requests to the camera
+ * \param[in] camera The camera to queue the requests to
+ * \param[in] requests The requests to queue, in order
+ *
+ * This method queues the requests queued by the application with
+ * Camera::queueRequests() in a single call. The base implementation queues
+ * them individually with queueRequest(), and completes the requests that fail
+ * to be queued in an error state.
+ *
+ * Pipeline handlers may override this method to coalesce the work needed to
+ * queue the requests, such as programming the device once for the whole
+ * batch. They shall then track the queued requests with
+ * PipelineHandler::queueRequest() as for individual requests, and complete the
+ * requests they fail to queue with cancelRequest().
+ */
+void PipelineHandler::queueRequests(Camera *camera,
+				    const std::vector<Request *> &requests)
+{
+	for (Request *request : requests)
+		requestQueued(camera, request);
+}
+
+/**
+ * \brief Slot for the Camera request queued signal
+ *
+ * Queue the request to the pipeline handler, and complete it in an error state
+ * if it can't be queued. Requests containing buffers with an acquire fence
+ * (see Buffer::setFence()) are held back until all their fences have
+ * signalled. Requests are queued to the pipeline handler in order, the
+ * requests queued after a request waiting for its fences are thus held back
+ * too.
+ */
+void PipelineHandler::requestQueued(Camera *camera, Request *request)
+{
+	CameraData *data = cameraData(camera);
+
+	if (data->waitingRequests_.empty()) {
+		bool fenced = false;
+		for (auto it : request->buffers())
+			fenced |= it.second->fence() >= 0;
+
+		if (!fenced) {
+			queueReadyRequest(camera, request);
+			return;
+		}
+	}
+
+	data->waitingRequests_.push_back(request);
+	if (data->waitingRequests_.size() == 1)
+		waitFences(camera);
+}
+
+void PipelineHandler::queueReadyRequest(Camera *camera, Request *request)
+{
+	int ret = queueRequest(camera, request);
+	if (!ret)
+		return;
+
+	LOG(Pipeline, Error) << "Failed to queue request: " << strerror(-ret);
+
+	cancelRequest(camera, request);
+}
+
+/*
+ * Queue the waiting requests whose fences have signalled, until a request with
+ * a pending fence is found. Fences are waited for one at a time, the request
+ * is cancelled if they don't all signal before the fence timeout.
+ */
+void PipelineHandler::waitFences(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	data->fenceNotifier_.reset();
+
+	while (!data->waitingRequests_.empty()) {
+		Request *request = data->waitingRequests_.front();
+
+		for (auto it : request->buffers()) {
+			Buffer *buffer = it.second;
+			if (buffer->fence() < 0)
+				continue;
+
+			struct pollfd pfd = { buffer->fence(), POLLIN, 0 };
+			int ret = poll(&pfd, 1, 0);
+			if (ret < 0 || pfd.revents) {
+				if (pfd.revents & (POLLERR | POLLNVAL))
+					LOG(Pipeline, Warning)
+						<< "Invalid fence for buffer "
+						<< buffer->index();
+				buffer->closeFence();
+				continue;
+			}
+
+			data->fenceNotifier_ =
+				utils::make_unique<EventNotifier>(buffer->fence(),
+								  EventNotifier::Read);
+			data->fenceNotifier_->activated.connect(this, &PipelineHandler::fenceSignalled);
+
+			if (!data->fenceTimer_.isRunning())
+				data->fenceTimer_.start(fenceTimeout());
+			return;
+		}
+
+		data->fenceTimer_.stop();
+		data->waitingRequests_.pop_front();
+		queueReadyRequest(camera, request);
+	}
+}
+
+/*
+ * Slot for the event notifier of the fence being waited for. The notifier is
+ * deleted by waitFences(), which is safe from within its activated signal.
+ */
+void PipelineHandler::fenceSignalled(EventNotifier *notifier)
+{
+	for (const auto &it : cameraData_) {
+		CameraData *data = it.second.get();
+		if (data->fenceNotifier_.get() != notifier)
+			continue;
+
+		waitFences(data->camera_);
+		return;
+	}
+}
+
+void PipelineHandler::fenceExpired(Timer *timer)
+{
+	for (const auto &it : cameraData_) {
+		CameraData *data = it.second.get();
+		if (&data->fenceTimer_ != timer)
+			continue;
+
+		Request *request = data->waitingRequests_.front();
+		data->waitingRequests_.pop_front();
+		data->fenceNotifier_.reset();
+
+		LOG(Pipeline, Error)
+			<< "Fence wait timeout, cancelling request "
+			<< request->cookie();
+
+		cancelRequest(data->camera_, request);
+		waitFences(data->camera_);
+		return;
+	}
+}
+
+/*
+ * Cancel the requests waiting for their fences. This is called by the Camera
+ * class when the pipeline handler stops, after the pipeline handler has
+ * cancelled the requests queued to it, to preserve the completion order.
+ */
+void PipelineHandler::cancelWaitingRequests(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	data->fenceTimer_.stop();
+	data->fenceNotifier_.reset();
+
+	while (!data->waitingRequests_.empty()) {
+		Request *request = data->waitingRequests_.front();
+		data->waitingRequests_.pop_front();
+		cancelRequest(camera, request);
+	}
+}
+
+/**
+ * \brief Retrieve the maximum time to wait for the acquire fences of a request
+ *
+ * The fence timeout defaults to 1000ms, and can be overridden with the
+ * LIBCAMERA_FENCE_TIMEOUT environment variable, in milliseconds.
+ *
+ * \return The fence timeout in milliseconds
+ */
+unsigned int PipelineHandler::fenceTimeout()
+{
+	const char *timeout = utils::secure_getenv("LIBCAMERA_FENCE_TIMEOUT");
+	if (!timeout)
+		return 1000;
+
+	return strtoul(timeout, nullptr, 10);
+}
+
+/**
+ * \brief Complete a request that failed to be queued
+ * \param[in] camera The camera the request belongs to
+ * \param[in] request The request to cancel
+ *
+ * Cancel all the buffers of \a request that haven't completed yet, and complete
+ * the request in an error state.
+ */
+void PipelineHandler::cancelRequest(Camera *camera, Request *request)
+{
+	CameraData *data = cameraData(camera);
+	if (std::find(data->queuedRequests_.begin(), data->queuedRequests_.end(),
+		      request) == data->queuedRequests_.end()) {
+		data->queuedRequests_.push_back(request);
+		data->stats_.requestQueued(data->queuedRequests_.size());
+	}
+
+	for (auto it : request->buffers()) {
+		Buffer *buffer = it.second;
+
+		if (buffer->request() != request)
+			continue;
+
+		buffer->cancel();
+		completeBuffer(camera, request, buffer);
+	}
+
+	completeRequest(camera, request);
+}
+
+/**
+ * \brief Retrieve the memory footprint of the buffers internal to a camera
+ * \param[in] camera The camera
+ *
+ * Pipeline handlers that allocate buffers internally for \a camera, such as
+ * buffers for intermediate frames or for ISP parameters and statistics, shall
+ * override this method to report their memory. The memory of the camera
+ * streams is accounted for by the Camera class and shall not be included. The
+ * base implementation reports no memory.
+ *
+ * \return The memory usage of the buffers internal to the camera
+ */
+MemoryUsage PipelineHandler::memoryUsage(const Camera *camera)
+{
+	return MemoryUsage();
+}
+
 /**
  * \brief Complete a buffer for a request
  * \param[in] camera The camera the request belongs to
@@ -371,14 +751,396 @@ int PipelineHandler::queueRequest(Camera *camera, Request *request)
  * pipeline handlers a chance to perform any operation that may still be
  * needed. They shall complete requests explicitly with completeRequest().
  *
+ * When processing stages are linked to the stream of \a buffer with
+ * addProcessingStage(), the \a buffer is first processed by the stages into
+ * the buffers of their output streams that \a request contains, and is only
+ * completed, along with the processed buffers, when all stages are done. The
+ * request is then completed automatically if no other buffer is pending.
+ * Pipeline handlers that use processing stages shall thus only complete the
+ * request themselves when this method returns true.
+ *
+ * The application is notified asynchronously, in the thread the camera is
+ * bound to.
+ *
  * \return True if all buffers contained in the request have completed, false
  * otherwise
  */
 bool PipelineHandler::completeBuffer(Camera *camera, Request *request,
 				     Buffer *buffer)
 {
-	camera->bufferCompleted.emit(request, buffer);
-	return request->completeBuffer(buffer);
+	if (processBuffer(camera, request, buffer))
+		return false;
+
+	return finishBuffer(camera, request, buffer);
+}
+
+/*
+ * Queue the buffer to the processing stages linked to its stream. Return true
+ * if the buffer is being processed, in which case it will be completed by
+ * frameProcessed().
+ */
+bool PipelineHandler::processBuffer(Camera *camera, Request *request,
+				    Buffer *buffer)
+{
+	CameraData *data = cameraData(camera);
+	unsigned int count = 0;
+
+	for (const CameraData::ProcessingLink &link : data->processingLinks_) {
+		if (link.input != buffer->stream())
+			continue;
+
+		Buffer *dst = request->findBuffer(link.output);
+		if (!dst || dst->request() != request)
+			continue;
+
+		/* Propagate the failure of the source to the output. */
+		if (buffer->status() != Buffer::BufferSuccess) {
+			setBufferMetadata(dst, buffer, buffer->status(), 0);
+			completeBuffer(camera, request, dst);
+			continue;
+		}
+
+		link.stage->queue(buffer, dst);
+		count++;
+	}
+
+	if (!count)
+		return false;
+
+	data->processing_[buffer] = count;
+	return true;
+}
+
+bool PipelineHandler::finishBuffer(Camera *camera, Request *request,
+				   Buffer *buffer)
+{
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled())
+		tracer->record(Tracer::CompleteBuffer, camera->traceSource_,
+			       request, buffer);
+
+	cameraData(camera)->stats_.bufferCompleted(buffer);
+
+	/*
+	 * Complete the buffer before notifying the application, to allow
+	 * recycling it from the bufferCompleted signal handler.
+	 */
+	bool complete = request->completeBuffer(buffer);
+	camera->bufferDone_.emit(request, buffer);
+
+	return complete;
+}
+
+void PipelineHandler::frameProcessed(Buffer *src, Buffer *dst, int result)
+{
+	for (auto &it : cameraData_) {
+		CameraData *data = it.second.get();
+
+		auto iter = data->processing_.find(src);
+		if (iter == data->processing_.end())
+			continue;
+
+		Camera *camera = data->camera_;
+		Request *request = src->request();
+
+		setBufferMetadata(dst, src,
+				  result < 0 ? Buffer::BufferError : Buffer::BufferSuccess,
+				  result < 0 ? 0 : result);
+
+		/* The output may be processed further by chained stages. */
+		bool complete = completeBuffer(camera, request, dst);
+
+		/*
+		 * Look the source up again, as completing the output may have
+		 * modified the map.
+		 */
+		iter = data->processing_.find(src);
+		if (--iter->second == 0) {
+			data->processing_.erase(iter);
+			complete = finishBuffer(camera, request, src);
+		}
+
+		if (complete)
+			completeRequest(camera, request);
+
+		return;
+	}
+}
+/**
+ * \brief Set the metadata of a buffer produced by the pipeline handler
+ * \param[in] buffer The buffer whose metadata to set
+ * \param[in] source The buffer \a buffer has been produced from, or nullptr
+ * \param[in] status The buffer completion status
+ * \param[in] bytesused The number of bytes written to \a buffer
+ *
+ * Buffer metadata are normally filled by the video device that captures the
+ * buffer. Pipeline handlers that produce the content of application buffers in
+ * software, for instance by converting captured frames to another format,
+ * shall instead set the metadata with this method before completing the
+ * buffer. The sequence number, timestamp and timestamp clock are copied from
+ * the \a source buffer if available, and are reset otherwise. The buffer flags
+ * are reset, as they describe the content of the \a source buffer.
+ */
+void PipelineHandler::setBufferMetadata(Buffer *buffer, const Buffer *source,
+					Buffer::Status status,
+					unsigned int bytesused)
+{
+	setBufferMetadata(buffer, status, bytesused,
+			  source ? source->sequence_ : 0,
+			  source ? source->timestamp_ : 0);
+	buffer->clock_ = source ? source->clock_ : ClockUnknown;
+}
+
+/**
+ * \brief Set the metadata of a buffer generated by the pipeline handler
+ * \param[in] buffer The buffer whose metadata to set
+ * \param[in] status The buffer completion status
+ * \param[in] bytesused The number of bytes written to \a buffer
+ * \param[in] sequence The frame sequence number
+ * \param[in] timestamp The frame timestamp in nanoseconds
+ *
+ * This method is used by pipeline handlers that generate frames without any
+ * source buffer to copy the sequence number and timestamp from. The \a
+ * timestamp shall be expressed in the CLOCK_MONOTONIC clock.
+ */
+void PipelineHandler::setBufferMetadata(Buffer *buffer, Buffer::Status status,
+					unsigned int bytesused,
+					unsigned int sequence,
+					uint64_t timestamp)
+{
+	buffer->status_ = status;
+	buffer->bytesused_ = bytesused;
+	buffer->sequence_ = sequence;
+	buffer->timestamp_ = timestamp;
+	buffer->clock_ = timestamp ? ClockMonotonic : ClockUnknown;
+	buffer->flags_ = 0;
+}
+
+/**
+ * \brief Set the flags of a buffer
+ * \param[in] buffer The buffer whose flags to set
+ * \param[in] flags The buffer flags, as a bitmask of Buffer::Flag values
+ *
+ * This method is used by pipeline handlers that compute the buffer flags when
+ * the video device doesn't report them, for instance by parsing the compressed
+ * frames captured to the \a buffer.
+ */
+void PipelineHandler::setBufferFlags(Buffer *buffer, unsigned int flags)
+{
+	buffer->flags_ = flags;
+}
+
+/**
+ * \brief Set whether the pipeline handler accesses the stream buffers with the
+ * CPU
+ * \param[in] stream The stream
+ * \param[in] cpuAccess True if the stream buffers are accessed with the CPU
+ *
+ * The dmabufs of buffers queued to streams that use ExternalMemory are queued
+ * directly to the video devices, and are not mapped to the CPU. Pipeline
+ * handlers that process the buffers of a \a stream in software shall request
+ * CPU access, either when creating the stream or in their configure()
+ * implementation, to make the buffer memory planes available through
+ * Buffer::mem(). CPU access is disabled by default, and only affects streams
+ * that use ExternalMemory.
+ */
+void PipelineHandler::setCpuAccess(Stream *stream, bool cpuAccess)
+{
+	stream->cpuAccess_ = cpuAccess;
+}
+
+/**
+ * \brief Link a processing stage to the streams of a camera
+ * \param[in] camera The camera
+ * \param[in] input The stream whose frames are processed
+ * \param[in] output The stream receiving the processed frames
+ * \param[in] stage The processing stage
+ *
+ * Once linked, every buffer of the \a input stream completed with
+ * completeBuffer() is processed by the \a stage into the buffer of the \a
+ * output stream contained in the same request, if any. Both buffers are then
+ * completed when the processing is done, and the request is completed if it has
+ * no other pending buffer. The \a input stream may be the output stream of
+ * another stage, in which case the stages are chained.
+ *
+ * Links are typically set up by pipeline handlers in their configure()
+ * implementation, after removing the links of the previous configuration with
+ * clearProcessingStages(). The \a stage shall be bound to the pipeline handler
+ * thread, and shall outlive the link.
+ *
+ * The latency of the \a stage is recorded in the
+ * camera.<name>.stage.<stage>.latency-us metric.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The stage or the output stream is already linked
+ */
+int PipelineHandler::addProcessingStage(Camera *camera, Stream *input,
+					Stream *output, ProcessingStage *stage)
+{
+	CameraData *data = cameraData(camera);
+
+	for (const CameraData::ProcessingLink &link : data->processingLinks_) {
+		if (link.stage == stage || link.output == output)
+			return -EBUSY;
+	}
+
+	data->processingLinks_.push_back({ input, output, stage });
+
+	stage->frameProcessed.connect(this, &PipelineHandler::frameProcessed);
+	stage->setLatencyMetric(MetricsRegistry::instance()->histogram(
+		"camera." + camera->name() + ".stage." + stage->name() +
+		".latency-us"));
+
+	return 0;
+}
+
+/**
+ * \brief Remove all the processing stages linked to the streams of a camera
+ * \param[in] camera The camera
+ *
+ * The stages shall not have any frame being processed, which pipeline handlers
+ * ensure by flushing them when stopping the camera.
+ */
+void PipelineHandler::clearProcessingStages(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	for (const CameraData::ProcessingLink &link : data->processingLinks_) {
+		link.stage->frameProcessed.disconnect(this);
+		link.stage->setLatencyMetric(nullptr);
+	}
+
+	data->processingLinks_.clear();
+	data->processing_.clear();
+}
+
+/**
+ * \brief Check if the buffers of a stream can be reused with a new configuration
+ * \param[in] stream The stream
+ * \param[in] cfg The new stream configuration
+ *
+ * Buffers can only be reused when the number of buffers and the memory type of
+ * the stream are unchanged. This method doesn't check the buffer sizes, which
+ * is the responsibility of the pipeline handler.
+ *
+ * \return True if the buffers of \a stream may be reused for \a cfg, false
+ * otherwise
+ */
+bool PipelineHandler::buffersReusable(const Stream *stream,
+				      const StreamConfiguration &cfg)
+{
+	const StreamConfiguration &current = stream->configuration();
+
+	return cfg.bufferCount == current.bufferCount &&
+	       cfg.memoryType == current.memoryType;
+}
+
+/**
+ * \brief Retrieve the number of spare buffers for application-facing devices
+ *
+ * Video devices that capture directly to application buffers stall or drop
+ * frames when the application doesn't queue requests fast enough. Pipeline
+ * handlers can prevent this by giving those devices spare buffers with
+ * V4L2VideoDevice::setSpareBufferCount(), in which case the frames captured
+ * while the application starves the pipeline are dropped and counted.
+ *
+ * Spare buffers are optional and disabled by default. They are enabled by
+ * setting the LIBCAMERA_SPARE_BUFFERS environment variable to the number of
+ * spare buffers per stream.
+ *
+ * \return The number of spare buffers per stream
+ */
+unsigned int PipelineHandler::spareBufferCount()
+{
+	const char *count = utils::secure_getenv("LIBCAMERA_SPARE_BUFFERS");
+	if (!count)
+		return 0;
+
+	return strtoul(count, nullptr, 10);
+}
+
+/**
+ * \brief Check if adaptive buffer counts are enabled
+ *
+ * When adaptive buffer counts are enabled by setting the
+ * LIBCAMERA_ADAPTIVE_BUFFERS environment variable to a non-zero value, the
+ * number of buffers recommended for a camera grows when capture sessions
+ * experience frame drops.
+ *
+ * \return True if adaptive buffer counts are enabled, false otherwise
+ */
+bool PipelineHandler::adaptiveBufferCount()
+{
+	const char *adaptive = utils::secure_getenv("LIBCAMERA_ADAPTIVE_BUFFERS");
+	if (!adaptive)
+		return false;
+
+	return strtoul(adaptive, nullptr, 10) != 0;
+}
+
+/**
+ * \brief Apply the adaptive buffer count to a generated configuration
+ * \param[in] camera The camera the configuration has been generated for
+ * \param[in] config The generated configuration
+ *
+ * Increase the buffer count of all streams in \a config by the number of extra
+ * buffers computed by tuneBufferCount(), within the maximum number of buffers
+ * supported by each stream. The extra buffer count is then lowered to the
+ * largest increase that could be applied, to stop growing once all streams
+ * reach their limit.
+ */
+void PipelineHandler::adjustBufferCount(Camera *camera,
+					CameraConfiguration *config)
+{
+	CameraData *data = cameraData(camera);
+
+	if (!data->extraBufferCount_ || config->empty())
+		return;
+
+	unsigned int extra = 0;
+
+	for (StreamConfiguration &cfg : *config) {
+		unsigned int count = cfg.bufferCount + data->extraBufferCount_;
+		if (cfg.maxBufferCount)
+			count = std::min(count, cfg.maxBufferCount);
+
+		extra = std::max(extra, count - cfg.bufferCount);
+		cfg.bufferCount = count;
+	}
+
+	data->extraBufferCount_ = extra;
+}
+
+/**
+ * \brief Tune the number of buffers for a camera at the end of a capture session
+ * \param[in] camera The camera that has been stopped
+ *
+ * When adaptive buffer counts are enabled, increase the number of buffers
+ * recommended for the \a camera by one if more than 1% of the frames have been
+ * dropped during the capture session. The buffer queue thus grows in small
+ * steps, only when drops show that the application starves the device, and
+ * only applies to configurations generated afterwards.
+ */
+void PipelineHandler::tuneBufferCount(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+	CameraStatistics stats = data->stats_.statistics();
+
+	uint64_t dropped = stats.framesDropped - data->framesDropped_;
+	uint64_t completed = stats.buffersCompleted - data->buffersCompleted_;
+
+	data->framesDropped_ = stats.framesDropped;
+	data->buffersCompleted_ = stats.buffersCompleted;
+
+	if (!adaptiveBufferCount() || dropped * 100 <= completed)
+		return;
+
+	data->extraBufferCount_++;
+
+	LOG(Pipeline, Info)
+		<< dropped << " frames dropped out of "
+		<< dropped + completed << ", increasing buffer count by "
+		<< data->extraBufferCount_;
 }
 
 /**
@@ -387,17 +1149,37 @@ bool PipelineHandler::completeBuffer(Camera *camera, Request *request,
  * \param[in] request The request that has completed
  *
  * The pipeline handler shall call this method to notify the \a camera that the
- * request has completed. The request is deleted and shall not be accessed once
- * this method returns.
+ * request has completed. The request is deleted asynchronously in the thread
+ * the camera is bound to, and shall not be accessed once this method returns.
  *
  * This method ensures that requests will be returned to the application in
  * submission order, the pipeline handler may call it on any complete request
  * without any ordering constraint.
+ *
+ * The SensorTimestamp metadata is set to the earliest monotonic buffer
+ * timestamp, unless already reported by the pipeline handler.
  */
 void PipelineHandler::completeRequest(Camera *camera, Request *request)
 {
 	request->complete();
 
+	ControlList &metadata = request->metadata();
+	if (!metadata.contains(SensorTimestamp)) {
+		uint64_t timestamp = 0;
+		for (const auto &it : request->buffers()) {
+			if (it.second->clock() != ClockMonotonic)
+				continue;
+
+			uint64_t ts = it.second->timestamp();
+			if (ts && (!timestamp || ts < timestamp))
+				timestamp = ts;
+		}
+
+		if (timestamp)
+			metadata.set(controls::SensorTimestamp,
+				     static_cast<int64_t>(timestamp));
+	}
+
 	CameraData *data = cameraData(camera);
 
 	while (!data->queuedRequests_.empty()) {
@@ -407,8 +1189,167 @@ void PipelineHandler::completeRequest(Camera *camera, Request *request)
 
 		ASSERT(!request->hasPendingBuffers());
 		data->queuedRequests_.pop_front();
-		camera->requestComplete(request);
+		data->stats_.requestCompleted(request);
+
+		/* Queue dropped requests again right away. */
+		if (dropRequest(camera, request)) {
+			request->rearm();
+			requestQueued(camera, request);
+			continue;
+		}
+
+		camera->requestDone_.emit(request);
+	}
+}
+
+/**
+ * \brief Signal the start of the capture of a frame
+ * \param[in] camera The camera capturing the frame
+ * \param[in] sequence The frame sequence number
+ * \param[in] timestamp The time the frame started, in nanoseconds
+ *
+ * Pipeline handlers shall call this method when the sensor starts exposing or
+ * transmitting a frame, typically from the V4L2Device::frameStart signal of
+ * the device reporting V4L2_EVENT_FRAME_SYNC events. The \a sequence shall
+ * match the sequence number of the buffers the frame is captured to, and the
+ * \a timestamp shall be expressed in the CLOCK_MONOTONIC clock. The
+ * application is notified through the Camera::frameStarted signal.
+ */
+void PipelineHandler::notifyFrameStart(Camera *camera, unsigned int sequence,
+				       uint64_t timestamp)
+{
+	camera->frameStart_.emit(sequence, timestamp);
+}
+
+/**
+ * \brief Signal the partial completion of a buffer
+ * \param[in] camera The camera the request belongs to
+ * \param[in] request The request the buffer belongs to
+ * \param[in] buffer The buffer being written
+ * \param[in] lines The number of lines written to the buffer
+ *
+ * Pipeline handlers that support partial frame completion shall call this
+ * method every StreamConfiguration::sliceHeight lines written to the buffers
+ * of streams configured with a non-zero slice height, before completing the
+ * buffer with completeBuffer(). The \a lines written shall be visible to the
+ * CPU when this method is called. The application is notified through the
+ * Camera::bufferProgressed signal.
+ */
+void PipelineHandler::notifyBufferProgress(Camera *camera, Request *request,
+					   Buffer *buffer, unsigned int lines)
+{
+	camera->bufferProgress_.emit(request, buffer, lines);
+}
+
+/*
+ * Find the oldest request pending delivery that can be dropped, which is a
+ * completed request only containing buffers of streams using the DropOldest
+ * policy. The caller shall hold the camera's completion lock.
+ */
+Request *PipelineHandler::oldestDroppable(Camera *camera)
+{
+	for (Request *request : camera->pendingCompletions_) {
+		if (request->dropped_ ||
+		    request->status() != Request::RequestComplete ||
+		    request->retained_)
+			continue;
+
+		bool droppable = true;
+		for (const auto &it : request->buffers()) {
+			const FrameDropPolicy &policy =
+				it.first->configuration().dropPolicy;
+			if (policy.mode != FrameDropPolicy::DropOldest ||
+			    it.second->recycled_)
+				droppable = false;
+		}
+
+		if (droppable)
+			return request;
+	}
+
+	return nullptr;
+}
+
+/**
+ * \brief Apply the frame drop policies of the streams to a completed request
+ * \param[in] camera The camera the request belongs to
+ * \param[in] request The completed request
+ *
+ * Decide whether the completed \a request shall be dropped according to the
+ * FrameDropPolicy of its streams, and record it as pending delivery to the
+ * application otherwise. When the request is delivered, the oldest request
+ * pending delivery may be marked as dropped instead, in which case the camera
+ * queues it again when processing its completion.
+ *
+ * \return True if the request shall be dropped, false if it shall be delivered
+ */
+bool PipelineHandler::dropRequest(Camera *camera, Request *request)
+{
+	CameraData *data = cameraData(camera);
+
+	std::lock_guard<std::mutex> locker(camera->completionMutex_);
+
+	unsigned int pending = 0;
+	for (const Request *r : camera->pendingCompletions_) {
+		if (!r->dropped_)
+			pending++;
+	}
+
+	bool drop = request->status() == Request::RequestComplete &&
+		    !request->retained_;
+	bool dropOldest = drop;
+
+	for (const auto &it : request->buffers()) {
+		const Stream *stream = it.first;
+		const FrameDropPolicy &policy = stream->configuration().dropPolicy;
+		unsigned int maxPending = std::max(policy.maxPending, 1U);
+
+		if (it.second->recycled_)
+			drop = dropOldest = false;
+
+		switch (policy.mode) {
+		case FrameDropPolicy::KeepAll:
+			drop = dropOldest = false;
+			break;
+
+		case FrameDropPolicy::DropOldest:
+			drop = false;
+			if (pending < maxPending)
+				dropOldest = false;
+			break;
+
+		case FrameDropPolicy::DropNewest:
+			dropOldest = false;
+			if (pending < maxPending)
+				drop = false;
+			break;
+
+		case FrameDropPolicy::KeepEveryNth: {
+			unsigned int &count = data->dropCounters_[stream];
+			if (count++ % std::max(policy.interval, 1U) == 0)
+				drop = false;
+			dropOldest = false;
+			break;
+		}
+		}
+	}
+
+	if (drop) {
+		data->stats_.requestDropped();
+		return true;
 	}
+
+	if (dropOldest) {
+		Request *oldest = oldestDroppable(camera);
+		if (oldest) {
+			oldest->dropped_ = true;
+			data->stats_.requestDropped();
+		}
+	}
+
+	camera->pendingCompletions_.push_back(request);
+
+	return false;
 }
 
 /**
@@ -420,11 +1361,22 @@ void PipelineHandler::completeRequest(Camera *camera, Request *request)
  * handle with the camera manager. It associates the pipeline-specific \a data
  * with the camera, for later retrieval with cameraData(). Ownership of \a data
  * is transferred to the PipelineHandler.
+ *
+ * When lazy camera instantiation is enabled, the camera devices are closed with
+ * closeDevices() once the camera is registered, see openDevices().
  */
 void PipelineHandler::registerCamera(std::shared_ptr<Camera> camera,
 				     std::unique_ptr<CameraData> data)
 {
 	data->camera_ = camera.get();
+	data->stats_.registerMetrics(camera.get());
+	data->fenceTimer_.timeout.connect(this, &PipelineHandler::fenceExpired);
+
+	if (lazyCameras()) {
+		closeDevices(camera.get());
+		data->lazy_ = true;
+	}
+
 	cameraData_[camera.get()] = std::move(data);
 	cameras_.push_back(camera);
 	manager_->addCamera(std::move(camera));
@@ -447,6 +1399,143 @@ void PipelineHandler::hotplugMediaDevice(MediaDevice *media)
 	media->disconnected.connect(this, &PipelineHandler::mediaDeviceDisconnected);
 }
 
+/**
+ * \brief Open the devices of a camera
+ * \param[in] camera The camera
+ *
+ * Pipeline handlers open all the devices they need when matching, to retrieve
+ * the static properties of the cameras they register. Keeping all the devices
+ * open for all cameras wastes file descriptors and keeps drivers powered when
+ * applications only use some of the cameras. When lazy camera instantiation
+ * is enabled by setting the LIBCAMERA_LAZY_CAMERAS environment variable to a
+ * non-zero value, the devices of a camera are closed with closeDevices() once
+ * the camera is registered, and reopened with this method when the camera is
+ * acquired.
+ *
+ * Pipeline handlers that support lazy instantiation shall reimplement this
+ * method and closeDevices(). They shall store all the static information
+ * needed by generateConfiguration(), by CameraConfiguration::validate() and by
+ * controls() when matching, as the devices may be closed when those are
+ * called. Devices shared between cameras shall be kept open. The default
+ * implementation keeps all devices open.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::openDevices(Camera *camera)
+{
+	return 0;
+}
+
+/**
+ * \brief Close the devices of a camera
+ * \param[in] camera The camera
+ *
+ * Close the devices of \a camera opened by openDevices() or when matching.
+ * This method is only called when lazy camera instantiation is enabled, when
+ * the camera is registered and when it is released.
+ *
+ * \sa openDevices()
+ */
+void PipelineHandler::closeDevices(Camera *camera)
+{
+}
+
+/**
+ * \brief Check if lazy camera instantiation is enabled
+ *
+ * Lazy camera instantiation is enabled by setting the LIBCAMERA_LAZY_CAMERAS
+ * environment variable to a non-zero value.
+ *
+ * \return True if lazy camera instantiation is enabled, false otherwise
+ */
+bool PipelineHandler::lazyCameras()
+{
+	const char *lazy = utils::secure_getenv("LIBCAMERA_LAZY_CAMERAS");
+	if (!lazy)
+		return false;
+
+	return strtoul(lazy, nullptr, 10) != 0;
+}
+
+/**
+ * \brief Open the devices of a camera being acquired
+ * \param[in] camera The camera
+ *
+ * This method is called by the Camera class in the pipeline handler thread when
+ * the camera is acquired.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::acquireDevices(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+	if (!data->lazy_)
+		return 0;
+
+	int ret = openDevices(camera);
+	if (ret) {
+		LOG(Pipeline, Error)
+			<< "Failed to open devices for camera " << camera->name();
+		closeDevices(camera);
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Close the devices of a camera being released
+ * \param[in] camera The camera
+ *
+ * This method is called by the Camera class in the pipeline handler thread when
+ * the camera is released.
+ */
+void PipelineHandler::releaseDevices(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+	if (data->lazy_)
+		closeDevices(camera);
+
+	if (resources_.release(camera))
+		resourcesChanged(camera);
+}
+
+/**
+ * \brief Reserve the hardware resources used by a camera
+ * \param[in] camera The camera
+ * \param[in] usage The resources usage
+ *
+ * Pipeline handlers that arbitrate resources shared by their cameras call this
+ * method when configuring \a camera, to replace the resources reserved by the
+ * camera with the \a usage of its new configuration. The resources are
+ * released when the camera is released.
+ *
+ * As the validation of the configuration of the other cameras depends on the
+ * resources left available, their configuration cache is cleared.
+ *
+ * \sa ResourceManager
+ */
+void PipelineHandler::reserveResources(Camera *camera,
+				       const ResourceManager::Usage &usage)
+{
+	if (resources_.reserved(camera) == usage)
+		return;
+
+	resources_.reserve(camera, usage);
+	resourcesChanged(camera);
+}
+
+/*
+ * Discard the cached configurations of the cameras other than \a camera, whose
+ * validation depends on the resources reserved by \a camera.
+ */
+void PipelineHandler::resourcesChanged(const Camera *camera)
+{
+	for (const auto &it : cameraData_) {
+		if (it.first != camera)
+			it.second->configCache_.clear();
+	}
+}
+
 /**
  * \brief Slot for the MediaDevice disconnected signal
  */
@@ -474,13 +1563,16 @@ void PipelineHandler::mediaDeviceDisconnected(MediaDevice *media)
  */
 void PipelineHandler::disconnect()
 {
+	/*
+	 * The cameras process the disconnection and unregister from the
+	 * camera manager in their own thread.
+	 */
 	for (std::weak_ptr<Camera> ptr : cameras_) {
 		std::shared_ptr<Camera> camera = ptr.lock();
 		if (!camera)
 			continue;
 
-		camera->disconnect();
-		manager_->removeCamera(camera.get());
+		camera->unplugged_.emit();
 	}
 
 	cameras_.clear();
@@ -509,12 +1601,50 @@ CameraData *PipelineHandler::cameraData(const Camera *camera)
  * constant for the whole lifetime of the pipeline handler.
  */
 
+/**
+ * \var PipelineHandler::resources_
+ * \brief The hardware resources shared by the cameras of the pipeline handler
+ *
+ * Pipeline handlers whose cameras share hardware resources set the resources
+ * capacity when matching devices, and check the resources usage of camera
+ * configurations against the capacity left by the other cameras when
+ * validating them. The usage of configured cameras is reserved with
+ * reserveResources().
+ */
+
 /**
  * \fn PipelineHandler::name()
  * \brief Retrieve the pipeline handler name
  * \return The pipeline handler name
  */
 
+/**
+ * \brief Retrieve the NUMA node of the media devices of the pipeline handler
+ *
+ * The NUMA node is only valid once the media devices have been acquired by
+ * match(). Pipeline handlers whose media devices are spread across multiple
+ * nodes have no NUMA node.
+ *
+ * \return The NUMA node of the media devices, or -1 if unknown
+ */
+int PipelineHandler::numaNode() const
+{
+	int node = -1;
+
+	for (const std::shared_ptr<MediaDevice> &media : mediaDevices_) {
+		int mediaNode = utils::numa_node(media->deviceNode());
+		if (mediaNode < 0)
+			continue;
+
+		if (node >= 0 && node != mediaNode)
+			return -1;
+
+		node = mediaNode;
+	}
+
+	return node;
+}
+
 /**
  * \class PipelineHandlerFactory
  * \brief Registration of PipelineHandler classes and creation of instances
@@ -530,14 +1660,19 @@ CameraData *PipelineHandler::cameraData(const Camera *camera)
 /**
  * \brief Construct a pipeline handler factory
  * \param[in] name Name of the pipeline handler class
+ * \param[in] deviceMatches Patterns of the media devices needed by the
+ * pipeline handler class
  *
  * Creating an instance of the factory registers is with the global list of
  * factories, accessible through the factories() function.
  *
  * The factory \a name is used for debug purpose and shall be unique.
+ *
+ * \sa PipelineHandler::deviceMatches()
  */
-PipelineHandlerFactory::PipelineHandlerFactory(const char *name)
-	: name_(name)
+PipelineHandlerFactory::PipelineHandlerFactory(const char *name,
+					       const std::vector<DeviceMatch> &deviceMatches)
+	: name_(name), deviceMatches_(deviceMatches)
 {
 	registerType(this);
 }
@@ -562,6 +1697,37 @@ std::shared_ptr<PipelineHandler> PipelineHandlerFactory::create(CameraManager *m
  * \return The factory name
  */
 
+/**
+ * \fn PipelineHandlerFactory::deviceMatches()
+ * \brief Retrieve the patterns of the media devices needed by the pipeline
+ * handler class
+ * \return The media devices patterns, or an empty list if the pipeline handler
+ * class doesn't declare any
+ */
+
+/**
+ * \brief Check if a pipeline handler instance may match media devices
+ * \param[in] enumerator The enumerator providing all media devices found in the
+ * system
+ *
+ * This function checks the media devices \a enumerator holds against the
+ * patterns declared by the pipeline handler class, without creating a pipeline
+ * handler instance. The enumerator indexes media devices by driver name, the
+ * check thus only inspects the devices of the drivers the patterns name.
+ *
+ * \return False if the pipeline handler class declares media devices patterns
+ * and no available media device matches one of them, true otherwise
+ */
+bool PipelineHandlerFactory::mayMatch(DeviceEnumerator *enumerator) const
+{
+	for (const DeviceMatch &dm : deviceMatches_) {
+		if (!enumerator->search(dm))
+			return false;
+	}
+
+	return true;
+}
+
 /**
  * \brief Add a pipeline handler class to the registry
  * \param[in] factory Factory to use to construct the pipeline handler
@@ -612,7 +1778,8 @@ std::vector<PipelineHandlerFactory *> &PipelineHandlerFactory::factories()
  * \param[in] handler Class name of PipelineHandler derived class to register
  *
  * Register a PipelineHandler subclass with the factory and make it available to
- * try and match devices.
+ * try and match devices. The media devices patterns of the subclass are
+ * retrieved from its static deviceMatches() function.
  */
 
 } /* namespace libcamera */
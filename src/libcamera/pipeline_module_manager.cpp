@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * pipeline_module_manager.cpp - Loadable pipeline handler modules manager
+ */
+
+#include "pipeline_module_manager.h"
+
+#include <algorithm>
+#include <dlfcn.h>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+
+#include "device_enumerator.h"
+#include "log.h"
+#include "pipeline_handler.h"
+#include "utils.h"
+
+/**
+ * \file pipeline_module_manager.h
+ * \brief Loadable pipeline handler modules manager
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(PipelineModule)
+
+/**
+ * \class PipelineModuleManager
+ * \brief Manager for pipeline handlers built as loadable modules
+ *
+ * Pipeline handlers are normally compiled in libcamera, and register their
+ * factory when the library is loaded. They can alternatively be built as
+ * shared objects, loaded only on systems where the media devices they handle
+ * are present, to save the memory and load time of the unused pipeline
+ * handlers.
+ *
+ * The modules are listed in a pipelines.index text file stored in the modules
+ * directory, with one line per module containing the shared object file name
+ * followed by the names of the media device drivers the pipeline handler needs,
+ * separated by spaces. Empty lines and lines starting with a '#' are ignored.
+ *
+ * The manager reads the index from the PIPELINE_MODULE_DIR directory, and from
+ * the directories listed in the LIBCAMERA_PIPELINE_MODULE_PATH environment
+ * variable, separated by ':'. Directories from the environment take precedence
+ * over the system directory for modules with the same file name.
+ *
+ * Modules are loaded by loadModules() when media devices of all the drivers
+ * they need are available. Loading a module registers its pipeline handler
+ * factories with the PipelineHandlerFactory registry. Modules are never
+ * unloaded, as their factories stay registered.
+ */
+
+PipelineModuleManager::PipelineModuleManager()
+{
+	const char *modulePaths = utils::secure_getenv("LIBCAMERA_PIPELINE_MODULE_PATH");
+	while (modulePaths) {
+		const char *delim = strchrnul(modulePaths, ':');
+		size_t count = delim - modulePaths;
+
+		if (count)
+			addDir(std::string(modulePaths, count));
+
+		if (*delim == '\0')
+			break;
+
+		modulePaths += count + 1;
+	}
+
+	addDir(PIPELINE_MODULE_DIR);
+}
+
+/**
+ * \brief Retrieve the pipeline module manager instance
+ *
+ * The PipelineModuleManager is a singleton and can't be constructed manually.
+ * This function shall instead be used to retrieve the single global instance
+ * of the manager.
+ *
+ * \return The pipeline module manager instance
+ */
+PipelineModuleManager *PipelineModuleManager::instance()
+{
+	static PipelineModuleManager manager;
+	return &manager;
+}
+
+/**
+ * \brief Load the modules whose media devices are available
+ * \param[in] enumerator The enumerator providing all media devices found in the
+ * system
+ *
+ * Load all the modules not loaded yet for which \a enumerator holds available
+ * media devices of all the drivers listed in the index. This function shall be
+ * called before matching pipeline handlers, every time media devices are added
+ * to the \a enumerator.
+ *
+ * \return The number of modules loaded by this call
+ */
+unsigned int PipelineModuleManager::loadModules(DeviceEnumerator *enumerator)
+{
+	unsigned int count = 0;
+
+	for (Module &module : modules_) {
+		if (module.handle || module.failed)
+			continue;
+
+		bool present = std::all_of(module.drivers.begin(), module.drivers.end(),
+					   [&](const std::string &driver) {
+						   return enumerator->search(DeviceMatch(driver)) != nullptr;
+					   });
+		if (!present)
+			continue;
+
+		if (load(&module))
+			count++;
+	}
+
+	return count;
+}
+
+/*
+ * Add the modules listed in the index of \a libDir, skipping the modules whose
+ * file name has already been indexed. A missing index is ignored.
+ */
+int PipelineModuleManager::addDir(const std::string &libDir)
+{
+	std::ifstream file(libDir + "/pipelines.index");
+	if (!file) {
+		LOG(PipelineModule, Debug)
+			<< "No pipeline module index in " << libDir;
+		return 0;
+	}
+
+	unsigned int count = 0;
+	std::string line;
+
+	while (std::getline(file, line)) {
+		std::istringstream entry(line);
+		Module module{};
+
+		if (!(entry >> module.name) || module.name[0] == '#')
+			continue;
+
+		std::string driver;
+		while (entry >> driver)
+			module.drivers.push_back(driver);
+
+		auto iter = std::find_if(modules_.begin(), modules_.end(),
+					 [&](const Module &m) { return m.name == module.name; });
+		if (iter != modules_.end())
+			continue;
+
+		module.path = libDir + "/" + module.name;
+		modules_.push_back(std::move(module));
+		count++;
+	}
+
+	LOG(PipelineModule, Debug)
+		<< "Indexed " << count << " pipeline modules in " << libDir;
+
+	return count;
+}
+
+bool PipelineModuleManager::load(Module *module)
+{
+	unsigned int factories = PipelineHandlerFactory::factories().size();
+
+	module->handle = dlopen(module->path.c_str(), RTLD_NOW);
+	if (!module->handle) {
+		LOG(PipelineModule, Error)
+			<< "Failed to open pipeline module shared object: "
+			<< dlerror();
+
+		/* Don't try to load the module again. */
+		module->failed = true;
+		return false;
+	}
+
+	LOG(PipelineModule, Debug)
+		<< "Loaded " << module->name << " with "
+		<< PipelineHandlerFactory::factories().size() - factories
+		<< " pipeline handlers";
+
+	return true;
+}
+
+} /* namespace libcamera */
@@ -9,12 +9,18 @@
 
 #include <algorithm>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <iostream>
 #include <list>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -38,32 +44,17 @@ LOG_DEFINE_CATEGORY(Process)
  * \class ProcessManager
  * \brief Manager of processes
  *
- * The ProcessManager singleton keeps track of all created Process instances,
- * and manages the signal handling involved in terminating processes.
+ * The ProcessManager singleton keeps track of the Process instances whose
+ * termination can't be monitored through a pidfd, and manages the signal
+ * handling involved in terminating those processes.
+ *
+ * The manager also maintains a pool of spare processes, started ahead of time
+ * with prestart() and handed out by acquire(), to remove the process startup
+ * latency from the time critical paths. Spare processes are connected to
+ * their user through a socket pair. They receive their end of the socket as
+ * their only argument, and are expected to wait for instructions on the
+ * socket before doing any work.
  */
-class ProcessManager
-{
-public:
-	void registerProcess(Process *proc);
-
-	static ProcessManager *instance();
-
-	int writePipe() const;
-
-	const struct sigaction &oldsa() const;
-
-private:
-	void sighandler(EventNotifier *notifier);
-	ProcessManager();
-	~ProcessManager();
-
-	std::list<Process *> processes_;
-
-	struct sigaction oldsa_;
-	EventNotifier *sigEvent_;
-	int pipe_[2];
-};
-
 namespace {
 
 void sigact(int signal, siginfo_t *info, void *ucontext)
@@ -82,6 +73,54 @@ void sigact(int signal, siginfo_t *info, void *ucontext)
 	}
 }
 
+/*
+ * Close all file descriptors except the ones in the sorted \a fds vector with
+ * the close_range() system call. Return 0 on success or a negative error code
+ * otherwise, -ENOSYS when the system call isn't supported.
+ */
+int closeFdRanges(const std::vector<int> &fds)
+{
+#ifdef SYS_close_range
+	unsigned int first = 0;
+
+	for (int fd : fds) {
+		if (fd < 0 || static_cast<unsigned int>(fd) < first)
+			continue;
+
+		if (static_cast<unsigned int>(fd) > first &&
+		    syscall(SYS_close_range, first, fd - 1, 0) < 0)
+			return -errno;
+
+		first = fd + 1;
+	}
+
+	if (syscall(SYS_close_range, first, ~0U, 0) < 0)
+		return -errno;
+
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+/*
+ * Open a pidfd for the process \a pid. Return the pidfd on success or a
+ * negative error code otherwise, -ENOSYS when pidfds aren't supported.
+ */
+int pidfdOpen(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	int fd = syscall(SYS_pidfd_open, pid, 0);
+	if (fd < 0)
+		return -errno;
+
+	/* pidfds are always created with the close-on-exec flag set. */
+	return fd;
+#else
+	return -ENOSYS;
+#endif
+}
+
 } /* namespace */
 
 void ProcessManager::sighandler(EventNotifier *notifier)
@@ -113,17 +152,48 @@ void ProcessManager::sighandler(EventNotifier *notifier)
  * \brief Register process with process manager
  * \param[in] proc Process to register
  *
- * This method registers the \a proc with the process manager. It
- * shall be called by the parent process after successfully forking, in
- * order to let the parent signal process termination.
+ * This method registers the \a proc with the process manager. It shall be
+ * called by the parent process after successfully forking, when the
+ * termination of the child can't be monitored through a pidfd, in order to
+ * let the parent signal process termination through the SIGCHLD handler. The
+ * handler is installed when the first process is registered.
  */
 void ProcessManager::registerProcess(Process *proc)
 {
+	installSignalHandler();
+
 	processes_.push_back(proc);
 }
 
-ProcessManager::ProcessManager()
+/**
+ * \brief Unregister process from process manager
+ * \param[in] proc Process to unregister
+ *
+ * This method removes the \a proc from the process manager. It shall be called
+ * when a process is destroyed before its termination has been signalled, as the
+ * process manager would otherwise access the destroyed instance.
+ */
+void ProcessManager::unregisterProcess(Process *proc)
+{
+	processes_.remove(proc);
+}
+
+/*
+ * Install the SIGCHLD handler, used to monitor the children whose termination
+ * can't be monitored through a pidfd. The handler is only installed when
+ * needed, to avoid interfering with the signal handling of the application.
+ */
+void ProcessManager::installSignalHandler()
 {
+	if (sigEvent_)
+		return;
+
+	if (pipe2(pipe_, O_CLOEXEC | O_DIRECT | O_NONBLOCK))
+		LOG(Process, Fatal)
+			<< "Failed to initialize pipe for signal handling";
+	sigEvent_ = new EventNotifier(pipe_[0], EventNotifier::Read);
+	sigEvent_->activated.connect(this, &ProcessManager::sighandler);
+
 	sigaction(SIGCHLD, NULL, &oldsa_);
 
 	struct sigaction sa;
@@ -135,15 +205,29 @@ ProcessManager::ProcessManager()
 
 	sigaction(SIGCHLD, &sa, NULL);
 
-	if (pipe2(pipe_, O_CLOEXEC | O_DIRECT | O_NONBLOCK))
-		LOG(Process, Fatal)
-			<< "Failed to initialize pipe for signal handling";
-	sigEvent_ = new EventNotifier(pipe_[0], EventNotifier::Read);
-	sigEvent_->activated.connect(this, &ProcessManager::sighandler);
+	/*
+	 * The process being registered may have terminated before the handler
+	 * was installed, check the registered processes once.
+	 */
+	char data = 0;
+	(void)write(pipe_[1], &data, sizeof(data));
+}
+
+ProcessManager::ProcessManager()
+	: sigEvent_(nullptr), pipe_{ -1, -1 }
+{
 }
 
 ProcessManager::~ProcessManager()
 {
+	for (SpareProcess &spare : spares_) {
+		delete spare.process;
+		close(spare.fd);
+	}
+
+	if (!sigEvent_)
+		return;
+
 	sigaction(SIGCHLD, &oldsa_, NULL);
 	delete sigEvent_;
 	close(pipe_[0]);
@@ -189,6 +273,122 @@ const struct sigaction &ProcessManager::oldsa() const
 	return oldsa_;
 }
 
+/**
+ * \brief Keep spare processes ready for an executable
+ * \param[in] path Path to the executable
+ * \param[in] count Number of spare processes to keep ready
+ *
+ * Start processes for the executable at \a path until \a count spare
+ * processes are available, and replace the spare processes handed out by
+ * acquire() from then on. A \a count of zero stops replacing spare processes.
+ */
+void ProcessManager::prestart(const std::string &path, unsigned int count)
+{
+	spareCounts_[path] = count;
+
+	unsigned int spares = std::count_if(spares_.begin(), spares_.end(),
+					    [&](const SpareProcess &spare) {
+						    return spare.path == path;
+					    });
+
+	for (; spares < count; ++spares) {
+		if (startSpare(path) < 0)
+			break;
+	}
+}
+
+/**
+ * \brief Acquire a spare process for an executable
+ * \param[in] path Path to the executable
+ * \param[out] fd The caller's end of the socket connected to the process
+ *
+ * Hand a running spare process for the executable at \a path over to the
+ * caller, starting a new process if no spare process is available. The caller
+ * takes ownership of both the returned process and the socket file descriptor
+ * stored in \a fd. The socket is a non-blocking datagram Unix socket, suitable
+ * for IPCUnixSocket::bind().
+ *
+ * When spare processes are kept ready for \a path with prestart(), a
+ * replacement process is started before this method returns. Only the fork is
+ * performed synchronously, the execution and initialization of the
+ * replacement run concurrently with the caller.
+ *
+ * \return The process, or nullptr if no process could be started
+ */
+Process *ProcessManager::acquire(const std::string &path, int *fd)
+{
+	Process *process = nullptr;
+
+	for (auto iter = spares_.begin(); iter != spares_.end();) {
+		if (iter->path != path) {
+			++iter;
+			continue;
+		}
+
+		SpareProcess spare = *iter;
+		iter = spares_.erase(iter);
+
+		/* Discard spare processes that have died in the meantime. */
+		if (!spare.process->running_) {
+			delete spare.process;
+			close(spare.fd);
+			continue;
+		}
+
+		process = spare.process;
+		*fd = spare.fd;
+		break;
+	}
+
+	if (!process) {
+		if (startSpare(path) < 0)
+			return nullptr;
+
+		SpareProcess spare = spares_.back();
+		spares_.pop_back();
+
+		process = spare.process;
+		*fd = spare.fd;
+	}
+
+	auto count = spareCounts_.find(path);
+	if (count != spareCounts_.end())
+		prestart(path, count->second);
+
+	return process;
+}
+
+/*
+ * Start a spare process for the executable at \a path and add it to the pool.
+ */
+int ProcessManager::startSpare(const std::string &path)
+{
+	int sockets[2];
+	int ret;
+
+	ret = socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, sockets);
+	if (ret) {
+		ret = -errno;
+		LOG(Process, Error)
+			<< "Failed to create socket pair: " << strerror(-ret);
+		return ret;
+	}
+
+	Process *process = new Process();
+	ret = process->start(path, { std::to_string(sockets[1]) },
+			     { sockets[1] });
+	close(sockets[1]);
+	if (ret) {
+		delete process;
+		close(sockets[0]);
+		return ret;
+	}
+
+	spares_.push_back({ path, process, sockets[0] });
+
+	return 0;
+}
+
 
 /**
  * \class Process
@@ -210,98 +410,244 @@ const struct sigaction &ProcessManager::oldsa() const
  */
 
 Process::Process()
-	: pid_(-1), running_(false), exitStatus_(NotExited), exitCode_(0)
+	: pid_(-1), running_(false), exitStatus_(NotExited), exitCode_(0),
+	  pidfd_(-1), pidfdNotifier_(nullptr)
 {
 }
 
 Process::~Process()
 {
-	kill();
-	/* \todo wait for child process to exit */
+	if (running_) {
+		/*
+		 * Reap the child process, its termination won't be signalled
+		 * anymore.
+		 */
+		kill();
+		waitpid(pid_, nullptr, 0);
+
+		if (pidfd_ < 0)
+			ProcessManager::instance()->unregisterProcess(this);
+	}
+
+	closePidfd();
 }
 
+/*
+ * Data shared between Process::start() and the child it spawns. The child
+ * runs in the address space of the parent until it calls execve(), and
+ * reports errors through the error field.
+ */
+struct Process::SpawnData {
+	Process *process;
+	const char *path;
+	char *const *argv;
+	char *const *envp;
+	const std::vector<int> *fds;
+	sigset_t sigmask;
+	int error;
+};
+
 /**
- * \brief Fork and exec a process, and close fds
+ * \brief Spawn a process, and close fds
  * \param[in] path Path to executable
  * \param[in] args Arguments to pass to executable (optional)
  * \param[in] fds Vector of file descriptors to keep open (optional)
  *
- * Fork a process, and exec the executable specified by path. Prior to
- * exec'ing, but after forking, all file descriptors except for those
+ * Spawn a process, and exec the executable specified by path. Prior to
+ * exec'ing, but after spawning, all file descriptors except for those
  * specified in fds will be closed.
  *
+ * The child is created with clone() in the address space of the parent, which
+ * is suspended until the child calls exec(). This avoids duplicating the page
+ * tables of the parent, whose cost grows with the amount of mapped memory,
+ * such as frame buffers.
+ *
  * All indexes of args will be incremented by 1 before being fed to exec(),
  * so args[0] should not need to be equal to path.
  *
- * \return Zero on successful fork, exec, and closing the file descriptors,
+ * \return Zero on successful spawn, exec, and closing the file descriptors,
  * or a negative error code otherwise
  */
 int Process::start(const std::string &path,
 		   const std::vector<std::string> &args,
 		   const std::vector<int> &fds)
 {
+	static constexpr size_t StackSize = 64 * 1024;
 	int ret;
 
 	if (running_)
 		return 0;
 
-	int childPid = fork();
-	if (childPid == -1) {
+	/*
+	 * The child shares the memory of the parent and must not allocate
+	 * memory or modify global state, prepare everything it needs.
+	 */
+	std::vector<const char *> argv;
+	argv.push_back(path.c_str());
+	for (const std::string &arg : args)
+		argv.push_back(arg.c_str());
+	argv.push_back(nullptr);
+
+	std::vector<const char *> envp;
+	for (char **env = environ; *env; ++env) {
+		if (strncmp(*env, "LIBCAMERA_LOG_FILE=", 19))
+			envp.push_back(*env);
+	}
+	envp.push_back(nullptr);
+
+	std::vector<int> keepFds(fds);
+	std::sort(keepFds.begin(), keepFds.end());
+
+	void *stack = mmap(nullptr, StackSize, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED) {
 		ret = -errno;
-		LOG(Process, Error) << "Failed to fork: " << strerror(-ret);
+		LOG(Process, Error)
+			<< "Failed to allocate child stack: " << strerror(-ret);
 		return ret;
-	} else if (childPid) {
-		pid_ = childPid;
-		ProcessManager::instance()->registerProcess(this);
+	}
 
-		running_ = true;
+	SpawnData data;
+	data.process = this;
+	data.path = path.c_str();
+	data.argv = const_cast<char *const *>(argv.data());
+	data.envp = const_cast<char *const *>(envp.data());
+	data.fds = &keepFds;
+	data.error = 0;
+
+	closePidfd();
+
+	/*
+	 * Block all signals to prevent signal handlers from running in the
+	 * child while it shares the memory of the parent.
+	 */
+	sigset_t sigmask;
+	sigfillset(&sigmask);
+	pthread_sigmask(SIG_SETMASK, &sigmask, &data.sigmask);
+
+	int childPid = clone(&Process::spawn, static_cast<char *>(stack) + StackSize,
+			     CLONE_VM | CLONE_VFORK | SIGCHLD, &data);
+	ret = childPid == -1 ? -errno : 0;
+
+	pthread_sigmask(SIG_SETMASK, &data.sigmask, nullptr);
+	munmap(stack, StackSize);
+
+	if (ret) {
+		LOG(Process, Error) << "Failed to spawn: " << strerror(-ret);
+		return ret;
+	}
 
-		return 0;
+	if (data.error) {
+		ret = -data.error;
+		waitpid(childPid, nullptr, 0);
+		LOG(Process, Error)
+			<< "Failed to execute " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	pid_ = childPid;
+	running_ = true;
+
+	/*
+	 * Monitor the termination of the child through a pidfd, which becomes
+	 * readable when the child exits, and fall back to the SIGCHLD handler
+	 * of the process manager when pidfds aren't supported. The child can't
+	 * be reaped before the pidfd is opened, opening it after spawning the
+	 * child is thus not racy.
+	 */
+	pidfd_ = pidfdOpen(pid_);
+	if (pidfd_ >= 0) {
+		pidfdNotifier_ = new EventNotifier(pidfd_, EventNotifier::Read);
+		pidfdNotifier_->activated.connect(this, &Process::pidfdReady);
 	} else {
-		if (isolate())
-			_exit(EXIT_FAILURE);
+		ProcessManager::instance()->registerProcess(this);
+	}
+
+	return 0;
+}
+
+/*
+ * Entry point of the child process, running in the address space of the
+ * parent until execve() succeeds.
+ */
+int Process::spawn(void *arg)
+{
+	SpawnData *data = static_cast<SpawnData *>(arg);
 
-		closeAllFdsExcept(fds);
+	/*
+	 * Reset the signal handlers before unblocking signals, as the
+	 * handlers of the parent can't run in the child. The signal handlers
+	 * are private to the child, as CLONE_SIGHAND isn't set.
+	 */
+	for (int sig = 1; sig < NSIG; ++sig) {
+		struct sigaction sa;
 
-		unsetenv("LIBCAMERA_LOG_FILE");
+		if (sigaction(sig, nullptr, &sa) < 0)
+			continue;
 
-		const char **argv = new const char *[args.size() + 2];
-		unsigned int len = args.size();
-		argv[0] = path.c_str();
-		for (unsigned int i = 0; i < len; i++)
-			argv[i+1] = args[i].c_str();
-		argv[len+1] = nullptr;
+		if (!(sa.sa_flags & SA_SIGINFO) && sa.sa_handler == SIG_IGN)
+			continue;
 
-		execv(path.c_str(), (char **)argv);
+		sa.sa_handler = SIG_DFL;
+		sa.sa_flags = 0;
+		sigaction(sig, &sa, nullptr);
+	}
 
-		exit(EXIT_FAILURE);
+	pthread_sigmask(SIG_SETMASK, &data->sigmask, nullptr);
+
+	if (data->process->isolate()) {
+		data->error = errno;
+		_exit(EXIT_FAILURE);
 	}
+
+	data->process->closeAllFdsExcept(*data->fds);
+
+	execve(data->path, data->argv, data->envp);
+
+	data->error = errno;
+	_exit(EXIT_FAILURE);
 }
 
+/*
+ * Close all file descriptors except the ones in the sorted \a fds vector. This
+ * runs in the child before exec, and shall not allocate memory.
+ */
 void Process::closeAllFdsExcept(const std::vector<int> &fds)
 {
-	std::vector<int> v(fds);
-	sort(v.begin(), v.end());
+	/*
+	 * Close the ranges of descriptors between the ones to keep with
+	 * close_range(), independently of the RLIMIT_NOFILE limit. Fall back
+	 * to closing the open descriptors listed in /proc/self/fd when the
+	 * system call isn't available.
+	 */
+	if (!closeFdRanges(fds))
+		return;
 
-	DIR *dir = opendir("/proc/self/fd");
-	if (!dir)
+	int dfd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd < 0)
 		return;
 
-	int dfd = dirfd(dir);
+	alignas(struct dirent64) char buffer[1024];
+	long size;
 
-	struct dirent *ent;
-	while ((ent = readdir(dir)) != nullptr) {
-		char *endp;
-		int fd = strtoul(ent->d_name, &endp, 10);
-		if (*endp)
-			continue;
+	while ((size = syscall(SYS_getdents64, dfd, buffer, sizeof(buffer))) > 0) {
+		for (long offset = 0; offset < size;) {
+			struct dirent64 *ent =
+				reinterpret_cast<struct dirent64 *>(buffer + offset);
+			offset += ent->d_reclen;
+
+			char *endp;
+			int fd = strtoul(ent->d_name, &endp, 10);
+			if (*endp)
+				continue;
 
-		if (fd >= 0 && fd != dfd &&
-		    !std::binary_search(v.begin(), v.end(), fd))
-			close(fd);
+			if (fd >= 0 && fd != dfd &&
+			    !std::binary_search(fds.begin(), fds.end(), fd))
+				close(fd);
+		}
 	}
 
-	closedir(dir);
+	close(dfd);
 }
 
 int Process::isolate()
@@ -309,8 +655,33 @@ int Process::isolate()
 	return unshare(CLONE_NEWUSER | CLONE_NEWNET);
 }
 
+void Process::closePidfd()
+{
+	if (pidfd_ < 0)
+		return;
+
+	delete pidfdNotifier_;
+	pidfdNotifier_ = nullptr;
+
+	close(pidfd_);
+	pidfd_ = -1;
+}
+
+void Process::pidfdReady(EventNotifier *notifier)
+{
+	int wstatus;
+	pid_t pid = waitpid(pid_, &wstatus, WNOHANG);
+	if (pid != pid_)
+		return;
+
+	/* The pidfd stays readable, stop monitoring it. */
+	notifier->setEnabled(false);
+
+	died(wstatus);
+}
+
 /**
- * \brief SIGCHLD handler
+ * \brief Process termination handler
  * \param[in] wstatus The status as output by waitpid()
  *
  * This method is called when the process associated with Process terminates.
@@ -360,7 +731,8 @@ void Process::died(int wstatus)
  */
 void Process::kill()
 {
-	::kill(pid_, SIGKILL);
+	if (pid_ > 0)
+		::kill(pid_, SIGKILL);
 }
 
 } /* namespace libcamera */
@@ -0,0 +1,253 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * processing_stage.cpp - Post-processing stages of captured frames
+ */
+
+#include "processing_stage.h"
+
+#include <errno.h>
+
+#include <libcamera/buffer.h>
+
+#include "log.h"
+#include "metrics_registry.h"
+#include "utils.h"
+
+/**
+ * \file processing_stage.h
+ * \brief Post-processing stages of captured frames
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Processing)
+
+/**
+ * \class ProcessingStage
+ * \brief Produce frames of a stream by processing frames of another stream
+ *
+ * Applications commonly need frames in a different size, orientation or format
+ * than the device produces. Instead of every application converting frames
+ * with additional copies, pipeline handlers can expose the converted frames as
+ * additional streams, produced by processing stages from the captured frames.
+ *
+ * The ProcessingStage class is the base class of the processing stages. It
+ * runs the processing of the frames on a pool of worker threads owned by the
+ * stage, and notifies completion with the \ref frameProcessed signal in the
+ * thread the stage is bound to. Derived classes implement the processing of a
+ * single frame in process(), which is called concurrently from the worker
+ * threads.
+ *
+ * Stages read the source frame in place from its buffer, and write the
+ * processed frame directly to the buffer of the output stream, allocated by
+ * the pipeline handler from the output stream pool. No intermediate copy of the
+ * frames is made. The source buffer is read until the \ref frameProcessed
+ * signal is emitted, and shall only be completed after that signal.
+ *
+ * Pipeline handlers don't queue frames to stages directly, but link the stages
+ * to the streams they process with PipelineHandler::addProcessingStage(). The
+ * frames completed for the input stream are then processed by the stages
+ * automatically. Stages can be chained, the output stream of a stage being the
+ * input stream of another.
+ *
+ * The time spent by each frame in the stage, from queue() to completion, is
+ * recorded in a histogram reported by latency(), and in the metric set with
+ * setLatencyMetric().
+ */
+
+/**
+ * \brief Create a processing stage
+ * \param[in] name The stage name, used in log messages and metrics
+ */
+ProcessingStage::ProcessingStage(const std::string &name)
+	: name_(name), serial_(0), syncCpuAccess_(true),
+	  latency_(Histogram::BucketCount), latencyMetric_(nullptr)
+{
+	pool_.completed.connect(this, &ProcessingStage::workCompleted);
+}
+
+/**
+ * \brief Destroy the processing stage
+ *
+ * Derived classes shall call wait() in their destructor, as the worker threads
+ * may otherwise still call process() on a partly destroyed stage.
+ */
+ProcessingStage::~ProcessingStage()
+{
+}
+
+/**
+ * \fn ProcessingStage::name()
+ * \brief Retrieve the stage name
+ * \return The stage name
+ */
+
+/**
+ * \brief Enable or disable CPU access synchronisation of the frame buffers
+ * \param[in] enable True to synchronise CPU access, false otherwise
+ *
+ * CPU access to the buffers is synchronised by default as required for
+ * dmabufs. Buffers that don't support dmabuf synchronisation, such as memfd
+ * buffers, shall disable it.
+ */
+void ProcessingStage::setSyncCpuAccess(bool enable)
+{
+	syncCpuAccess_ = enable;
+}
+
+/**
+ * \brief Set the metric recording the stage latency
+ * \param[in] metric The histogram metric, or nullptr to disable the metric
+ *
+ * The metric records the latency of every processed frame in microseconds.
+ */
+void ProcessingStage::setLatencyMetric(HistogramMetric *metric)
+{
+	latencyMetric_ = metric;
+}
+
+/**
+ * \brief Queue a frame for processing
+ * \param[in] src The source frame buffer
+ * \param[in] dst The processed frame buffer
+ *
+ * The frame is processed asynchronously in a worker thread, and the \ref
+ * frameProcessed signal is emitted when done.
+ */
+void ProcessingStage::queue(Buffer *src, Buffer *dst)
+{
+	uint64_t serial = ++serial_;
+	Job *job = &jobs_[serial];
+
+	job->src = src;
+	job->dst = dst;
+	job->result = 0;
+	job->queued = utils::monotonic_ns();
+
+	bool sync = syncCpuAccess_;
+
+	pool_.queue([this, job, sync]() {
+		Plane *in = &job->src->mem()->planes()[0];
+		Plane *out = &job->dst->mem()->planes()[0];
+		void *inMem = in->mem();
+		void *outMem = out->mem();
+		if (!inMem || !outMem) {
+			job->result = -ENOMEM;
+			return;
+		}
+
+		if (sync) {
+			in->beginCpuAccess(Plane::CpuRead);
+			out->beginCpuAccess(Plane::CpuWrite);
+		}
+
+		job->result = process(static_cast<const uint8_t *>(inMem),
+				      in->length(),
+				      static_cast<uint8_t *>(outMem),
+				      out->length());
+
+		if (sync) {
+			out->endCpuAccess(Plane::CpuWrite);
+			in->endCpuAccess(Plane::CpuRead);
+		}
+	}, serial);
+}
+
+/**
+ * \brief Complete all the queued frames
+ *
+ * Wait for the frames being processed, and emit the \ref frameProcessed signal
+ * for all of them synchronously. Completion notifications still queued for
+ * those frames are then ignored.
+ */
+void ProcessingStage::flush()
+{
+	pool_.wait();
+
+	std::map<uint64_t, Job> jobs;
+	jobs.swap(jobs_);
+
+	for (const auto &it : jobs)
+		complete(it.second);
+}
+
+/**
+ * \brief Retrieve the latency of the processed frames
+ *
+ * The latency is measured in microseconds from the time a frame is queued to
+ * the time its processing is completed, and includes the time spent waiting
+ * for a worker thread. This function shall be called from the thread the stage
+ * is bound to.
+ *
+ * \return The histogram of the latency of all frames processed by the stage
+ */
+Histogram ProcessingStage::latency() const
+{
+	return Histogram(latency_);
+}
+
+/**
+ * \var ProcessingStage::frameProcessed
+ * \brief Signal emitted when a frame has been processed
+ *
+ * The signal carries the source and processed frame buffers, and the size of
+ * the processed frame in bytes, or a negative error code if processing failed.
+ */
+
+/**
+ * \fn ProcessingStage::process()
+ * \brief Process a frame
+ * \param[in] src The source frame data
+ * \param[in] srcSize The size of the source frame buffer in bytes
+ * \param[out] dst The processed frame data
+ * \param[in] dstSize The size of the processed frame buffer in bytes
+ *
+ * This function is called from the worker threads of the stage, concurrently
+ * for different frames, and shall not modify the stage state.
+ *
+ * \return The size of the processed frame in bytes, or a negative error code
+ * otherwise
+ */
+
+/**
+ * \brief Wait for all the queued frames to be processed
+ *
+ * The frames are processed, but their completion isn't notified. This is meant
+ * to be called by the destructor of derived classes.
+ */
+void ProcessingStage::wait()
+{
+	pool_.wait();
+}
+
+void ProcessingStage::workCompleted(uint64_t serial)
+{
+	auto it = jobs_.find(serial);
+	if (it == jobs_.end())
+		return;
+
+	Job job = it->second;
+	jobs_.erase(it);
+
+	if (job.result < 0)
+		LOG(Processing, Warning)
+			<< "Stage " << name_ << " failed to process frame "
+			<< job.src->sequence() << ": " << job.result;
+
+	complete(job);
+}
+
+void ProcessingStage::complete(const Job &job)
+{
+	uint64_t latency = (utils::monotonic_ns() - job.queued) / 1000;
+
+	latency_[Histogram::bucket(latency)]++;
+	if (latencyMetric_)
+		latencyMetric_->add(latency);
+
+	frameProcessed.emit(job.src, job.dst, job.result);
+}
+
+} /* namespace libcamera */
@@ -5,16 +5,24 @@
  * ipa_proxy_linux.cpp - Default Image Processing Algorithm proxy for Linux
  */
 
+#include <algorithm>
+#include <map>
+#include <string.h>
 #include <vector>
 
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/ipa/ipa_module_info.h>
 
+#include "byte_stream_buffer.h"
+#include "ipa_data_serializer.h"
 #include "ipa_module.h"
 #include "ipa_proxy.h"
+#include "ipa_proxy_linux.h"
 #include "ipc_unixsocket.h"
 #include "log.h"
+#include "metrics_registry.h"
 #include "process.h"
+#include "utils.h"
 
 namespace libcamera {
 
@@ -28,12 +36,44 @@ public:
 
 	int init();
 
+	void mapBuffers(const std::vector<IPABuffer> &buffers);
+	void unmapBuffers(const std::vector<unsigned int> &ids);
+	void processEvent(unsigned int frame, const IPAOperationData &event);
+
 private:
+	static constexpr size_t IPCRingSize = 256 * 1024;
+	static constexpr unsigned int MaxPendingEvents = 16;
+	static constexpr unsigned int MaxRestarts = 3;
+
+	int startWorker();
+	void mapBuffers(IPADataSerializer::BufferIterator begin,
+			IPADataSerializer::BufferIterator end);
+	void workerFinished(Process *proc, enum Process::ExitStatus exitStatus,
+			    int exitCode);
+
+	int send(IPAProxyLinuxCommand cmd, uint32_t frame, uint32_t operation,
+		 const std::vector<uint32_t> &data,
+		 const std::vector<int32_t> &fds = std::vector<int32_t>());
+	void sendBuffers(IPADataSerializer::BufferIterator begin,
+			 IPADataSerializer::BufferIterator end);
 	void readyRead(IPCUnixSocket *ipc);
 
+	std::string workerPath_;
+	std::string modulePath_;
 	Process *proc_;
+	Process *exitedProc_;
+	unsigned int restarts_;
+
+	/* Buffers mapped in the worker, replayed when it is restarted. */
+	std::vector<IPABuffer> buffers_;
 
 	IPCUnixSocket *socket_;
+	IPCUnixSocket::Payload message_;
+
+	/* Time at which the first event for each frame has been sent. */
+	std::map<unsigned int, uint64_t> pendingEvents_;
+	HistogramMetric *roundTripMetric_;
+	CounterMetric *restartsMetric_;
 };
 
 int IPAProxyLinux::init()
@@ -44,51 +84,311 @@ int IPAProxyLinux::init()
 }
 
 IPAProxyLinux::IPAProxyLinux(IPAModule *ipam)
+	: modulePath_(ipam->path()), proc_(nullptr), exitedProc_(nullptr),
+	  restarts_(0), socket_(nullptr)
 {
+	MetricsRegistry *registry = MetricsRegistry::instance();
+	roundTripMetric_ = registry->histogram("ipc.round-trip-us");
+	restartsMetric_ = registry->counter("ipa.worker-restarts");
+
 	LOG(IPAProxy, Debug)
 		<< "initializing dummy proxy: loading IPA from "
 		<< ipam->path();
 
-	std::vector<int> fds;
-	std::vector<std::string> args;
-	args.push_back(ipam->path());
-	const std::string path = resolvePath("ipa_proxy_linux");
-	if (path.empty()) {
+	workerPath_ = resolvePath("ipa_proxy_linux");
+	if (workerPath_.empty()) {
 		LOG(IPAProxy, Error)
 			<< "Failed to get proxy worker path";
 		return;
 	}
 
+	if (startWorker())
+		return;
+
+	valid_ = true;
+}
+
+IPAProxyLinux::~IPAProxyLinux()
+{
+	delete exitedProc_;
+	delete proc_;
+	delete socket_;
+}
+
+/*
+ * Start a worker process, instruct it to load the IPA module, and replay the
+ * buffer mappings of the previous worker if any.
+ */
+int IPAProxyLinux::startWorker()
+{
+	/*
+	 * Use a pre-started worker when available, and instruct it to load
+	 * the IPA module.
+	 */
+	int fd;
+	proc_ = ProcessManager::instance()->acquire(workerPath_, &fd);
+	if (!proc_) {
+		LOG(IPAProxy, Error)
+			<< "Failed to start proxy worker process";
+		return -ENOEXEC;
+	}
+
+	proc_->finished.connect(this, &IPAProxyLinux::workerFinished);
+
 	socket_ = new IPCUnixSocket();
-	int fd = socket_->create();
-	if (fd < 0) {
+	socket_->bind(fd);
+	socket_->readyRead.connect(this, &IPAProxyLinux::readyRead);
+
+	IPAProxyLinuxHeader header = { IPAProxyLinuxLoadModule, 0, 0 };
+	struct iovec iov[2] = {
+		{ &header, sizeof(header) },
+		{ const_cast<char *>(modulePath_.c_str()), modulePath_.size() },
+	};
+
+	int ret = socket_->send(iov, 2);
+	if (ret) {
+		LOG(IPAProxy, Error)
+			<< "Failed to send IPA module path to proxy worker";
+		return ret;
+	}
+
+	/*
+	 * Exchange per-frame parameters and statistics through shared memory,
+	 * falling back to the socket if shared memory isn't available.
+	 */
+	ret = socket_->enableSharedMemory(IPCRingSize);
+	if (ret)
+		LOG(IPAProxy, Warning)
+			<< "Failed to enable shared memory IPC transport";
+
+	mapBuffers(buffers_.begin(), buffers_.end());
+
+	return 0;
+}
+
+/*
+ * Restart the worker when it terminates unexpectedly, to recover from IPA
+ * crashes without reopening the camera. The events sent to the previous
+ * worker are lost, the IPA resumes with the next frame. Give up when the
+ * worker keeps terminating without producing any frame action.
+ */
+void IPAProxyLinux::workerFinished(Process *proc,
+				   enum Process::ExitStatus exitStatus,
+				   int exitCode)
+{
+	if (exitStatus == Process::SignalExit)
+		LOG(IPAProxy, Error) << "IPA proxy worker crashed";
+	else
 		LOG(IPAProxy, Error)
-			<< "Failed to create socket";
+			<< "IPA proxy worker exited with code " << exitCode;
+
+	/*
+	 * The process can't be deleted from its own signal handler, keep it
+	 * until the next restart.
+	 */
+	delete exitedProc_;
+	exitedProc_ = proc;
+	proc_ = nullptr;
+
+	delete socket_;
+	socket_ = nullptr;
+	pendingEvents_.clear();
+
+	if (restarts_ >= MaxRestarts) {
+		LOG(IPAProxy, Error)
+			<< "IPA proxy worker restarted " << restarts_
+			<< " times without progress, giving up";
+		valid_ = false;
 		return;
 	}
-	socket_->readyRead.connect(this, &IPAProxyLinux::readyRead);
-	args.push_back(std::to_string(fd));
-	fds.push_back(fd);
 
-	proc_ = new Process();
-	int ret = proc_->start(path, args, fds);
+	restarts_++;
+	restartsMetric_->add();
+
+	LOG(IPAProxy, Warning) << "Restarting IPA proxy worker";
+
+	if (startWorker())
+		valid_ = false;
+}
+
+void IPAProxyLinux::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	if (!valid_)
+		return;
+
+	/*
+	 * Keep duplicates of the buffers, to replay the mappings if the worker
+	 * needs to be restarted.
+	 */
+	size_t first = buffers_.size();
+
+	for (const IPABuffer &buffer : buffers) {
+		buffers_.emplace_back();
+		IPABuffer &dup = buffers_.back();
+
+		dup.id = buffer.id;
+		for (const Plane &plane : buffer.memory.planes()) {
+			dup.memory.planes().emplace_back();
+			dup.memory.planes().back().setDmabuf(plane.dmabuf(),
+							     plane.length());
+		}
+	}
+
+	mapBuffers(buffers_.begin() + first, buffers_.end());
+}
+
+/*
+ * Transfer the buffers in as few messages as possible, splitting them only
+ * when the number of dmabuf handles exceeds the IPC limit.
+ */
+void IPAProxyLinux::mapBuffers(IPADataSerializer::BufferIterator begin,
+			       IPADataSerializer::BufferIterator end)
+{
+	auto first = begin;
+	unsigned int planes = 0;
+
+	for (auto it = begin; it != end; ++it) {
+		unsigned int count = it->memory.planes().size();
+
+		if (count > IPCUnixSocket::MaxFds) {
+			LOG(IPAProxy, Error)
+				<< "Buffer " << it->id << " has too many planes";
+			sendBuffers(first, it);
+			first = it + 1;
+			planes = 0;
+			continue;
+		}
+
+		if (planes + count > IPCUnixSocket::MaxFds) {
+			sendBuffers(first, it);
+			first = it;
+			planes = 0;
+		}
+
+		planes += count;
+	}
+
+	sendBuffers(first, end);
+}
+
+void IPAProxyLinux::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	if (!valid_)
+		return;
+
+	for (unsigned int id : ids) {
+		auto it = std::find_if(buffers_.begin(), buffers_.end(),
+				       [id](const IPABuffer &buffer) {
+					       return buffer.id == id;
+				       });
+		if (it != buffers_.end())
+			buffers_.erase(it);
+	}
+
+	std::vector<uint32_t> data(ids.begin(), ids.end());
+	if (send(IPAProxyLinuxUnmapBuffers, 0, 0, data))
+		LOG(IPAProxy, Error) << "Failed to unmap buffers";
+}
+
+void IPAProxyLinux::processEvent(unsigned int frame,
+				 const IPAOperationData &event)
+{
+	if (!valid_)
+		return;
+
+	int ret = send(IPAProxyLinuxProcessEvent, frame, event.operation,
+		       event.data);
 	if (ret) {
 		LOG(IPAProxy, Error)
-			<< "Failed to start proxy worker process";
+			<< "Failed to send event for frame " << frame;
 		return;
 	}
 
-	valid_ = true;
+	/*
+	 * Record the time of the first event for the frame to measure the
+	 * round trip to the frame action. Frames for which no action is
+	 * queued are discarded once too many events are pending.
+	 */
+	pendingEvents_.emplace(frame, utils::monotonic_ns());
+	if (pendingEvents_.size() > MaxPendingEvents)
+		pendingEvents_.erase(pendingEvents_.begin());
 }
 
-IPAProxyLinux::~IPAProxyLinux()
+int IPAProxyLinux::send(IPAProxyLinuxCommand cmd, uint32_t frame,
+			uint32_t operation, const std::vector<uint32_t> &data,
+			const std::vector<int32_t> &fds)
 {
-	delete proc_;
-	delete socket_;
+	IPAProxyLinuxHeader header = { cmd, frame, operation };
+	struct iovec iov[2] = {
+		{ &header, sizeof(header) },
+		{ const_cast<uint32_t *>(data.data()),
+		  data.size() * sizeof(uint32_t) },
+	};
+
+	return socket_->send(iov, 2, fds.data(), fds.size());
+}
+
+void IPAProxyLinux::sendBuffers(IPADataSerializer::BufferIterator begin,
+				IPADataSerializer::BufferIterator end)
+{
+	if (begin == end)
+		return;
+
+	std::vector<uint8_t> data(IPADataSerializer::binarySize(begin, end));
+	ByteStreamBuffer buffer(data.data(), data.size());
+	std::vector<int32_t> fds;
+
+	IPADataSerializer::serialize(begin, end, buffer, &fds);
+
+	IPAProxyLinuxHeader header = { IPAProxyLinuxMapBuffers, 0, 0 };
+	struct iovec iov[2] = {
+		{ &header, sizeof(header) },
+		{ data.data(), data.size() },
+	};
+
+	if (socket_->send(iov, 2, fds.data(), fds.size()))
+		LOG(IPAProxy, Error) << "Failed to map buffers";
 }
 
 void IPAProxyLinux::readyRead(IPCUnixSocket *ipc)
 {
+	int ret = ipc->receive(&message_);
+	if (ret) {
+		LOG(IPAProxy, Error) << "Failed to receive message: " << ret;
+		return;
+	}
+
+	IPAProxyLinuxHeader header;
+	size_t size = message_.data.size();
+
+	if (size < sizeof(header) ||
+	    (size - sizeof(header)) % sizeof(uint32_t)) {
+		LOG(IPAProxy, Error) << "Invalid message size " << size;
+		return;
+	}
+
+	memcpy(&header, message_.data.data(), sizeof(header));
+	if (header.cmd != IPAProxyLinuxQueueFrameAction) {
+		LOG(IPAProxy, Error) << "Unknown command " << header.cmd;
+		return;
+	}
+
+	IPAOperationData action;
+	action.operation = header.operation;
+	action.data.resize((size - sizeof(header)) / sizeof(uint32_t));
+	memcpy(action.data.data(), message_.data.data() + sizeof(header),
+	       size - sizeof(header));
+
+	auto pending = pendingEvents_.find(header.frame);
+	if (pending != pendingEvents_.end()) {
+		roundTripMetric_->add((utils::monotonic_ns() - pending->second) / 1000);
+		pendingEvents_.erase(pendingEvents_.begin(), ++pending);
+	}
+
+	/* The worker made progress, reset the crash loop detection. */
+	restarts_ = 0;
+
+	queueFrameAction.emit(header.frame, action);
 }
 
 REGISTER_IPA_PROXY(IPAProxyLinux)
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_proxy_thread.cpp - Proxy running an Image Processing Algorithm in a thread
+ */
+
+#include <errno.h>
+#include <memory>
+#include <vector>
+
+#include <libcamera/ipa/ipa_interface.h>
+#include <libcamera/ipa/ipa_module_info.h>
+#include <libcamera/object.h>
+
+#include "ipa_module.h"
+#include "ipa_proxy.h"
+#include "log.h"
+#include "thread.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAProxy)
+
+class IPAProxyThread : public IPAProxy, public Object
+{
+public:
+	IPAProxyThread(IPAModule *ipam);
+	~IPAProxyThread();
+
+	int init();
+
+	void mapBuffers(const std::vector<IPABuffer> &buffers);
+	void unmapBuffers(const std::vector<unsigned int> &ids);
+	void processEvent(unsigned int frame, const IPAOperationData &event);
+
+private:
+	/*
+	 * Owner of the IPA in the IPA thread. All calls to the IPA are
+	 * marshalled as messages to this object, and delivered to the IPA in
+	 * order by the thread event loop.
+	 */
+	class ThreadProxy : public Object
+	{
+	public:
+		void setIPA(std::unique_ptr<IPAInterface> ipa)
+		{
+			ipa_ = std::move(ipa);
+		}
+
+		int init()
+		{
+			return ipa_->init();
+		}
+
+		void stop()
+		{
+			/* Destroy the IPA in the thread it runs in. */
+			ipa_.reset();
+		}
+
+		void mapBuffers(std::shared_ptr<std::vector<IPABuffer>> buffers)
+		{
+			ipa_->mapBuffers(*buffers);
+		}
+
+		void unmapBuffers(const std::vector<unsigned int> &ids)
+		{
+			ipa_->unmapBuffers(ids);
+		}
+
+		void processEvent(unsigned int frame, const IPAOperationData &event)
+		{
+			ipa_->processEvent(frame, event);
+		}
+
+	private:
+		std::unique_ptr<IPAInterface> ipa_;
+	};
+
+	void forwardFrameAction(unsigned int frame,
+				const IPAOperationData &action);
+
+	Thread thread_;
+	ThreadProxy proxy_;
+};
+
+IPAProxyThread::IPAProxyThread(IPAModule *ipam)
+{
+	if (!ipam->load())
+		return;
+
+	std::unique_ptr<IPAInterface> ipa = ipam->createInstance();
+	if (!ipa)
+		return;
+
+	/*
+	 * Frame actions are emitted by the IPA in its thread, and are
+	 * delivered to this object in the thread that created the proxy.
+	 */
+	ipa->queueFrameAction.connect(this, &IPAProxyThread::forwardFrameAction);
+
+	proxy_.setIPA(std::move(ipa));
+	proxy_.moveToThread(&thread_);
+
+	thread_.setName("ipa");
+	thread_.start();
+
+	valid_ = true;
+}
+
+IPAProxyThread::~IPAProxyThread()
+{
+	if (!thread_.isRunning())
+		return;
+
+	/*
+	 * Destroy the IPA once all the calls queued so far have been
+	 * delivered, before stopping the thread.
+	 */
+	proxy_.invokeMethod(&ThreadProxy::stop, ConnectionTypeBlocking);
+
+	thread_.exit();
+	thread_.wait();
+}
+
+int IPAProxyThread::init()
+{
+	if (!valid_)
+		return -ENODEV;
+
+	/* Initialize the IPA in its thread and wait for the result. */
+	return proxy_.invokeMethod(&ThreadProxy::init,
+				   ConnectionTypeBlocking).get();
+}
+
+void IPAProxyThread::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	if (!valid_)
+		return;
+
+	/*
+	 * Pass a copy of the buffers to the IPA thread, in order with the
+	 * events. The copy holds duplicates of the dmabuf handles, which the
+	 * IPA can keep regardless of the lifetime of the caller's buffers.
+	 */
+	std::shared_ptr<std::vector<IPABuffer>> copy =
+		std::make_shared<std::vector<IPABuffer>>(buffers.size());
+
+	for (unsigned int i = 0; i < buffers.size(); ++i) {
+		const IPABuffer &buffer = buffers[i];
+		IPABuffer &dup = (*copy)[i];
+
+		dup.id = buffer.id;
+		for (const Plane &plane : buffer.memory.planes()) {
+			dup.memory.planes().emplace_back();
+			dup.memory.planes().back().setDmabuf(plane.dmabuf(),
+							     plane.length());
+		}
+	}
+
+	proxy_.invokeMethod(&ThreadProxy::mapBuffers, ConnectionTypeQueued,
+			    copy);
+}
+
+void IPAProxyThread::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	if (!valid_)
+		return;
+
+	proxy_.invokeMethod(&ThreadProxy::unmapBuffers, ConnectionTypeQueued,
+			    ids);
+}
+
+void IPAProxyThread::processEvent(unsigned int frame,
+				  const IPAOperationData &event)
+{
+	if (!valid_)
+		return;
+
+	proxy_.invokeMethod(&ThreadProxy::processEvent, ConnectionTypeQueued,
+			    frame, event);
+}
+
+void IPAProxyThread::forwardFrameAction(unsigned int frame,
+					const IPAOperationData &action)
+{
+	queueFrameAction.emit(frame, action);
+}
+
+REGISTER_IPA_PROXY(IPAProxyThread)
+
+} /* namespace libcamera */
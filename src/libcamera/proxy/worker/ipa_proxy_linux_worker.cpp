@@ -5,8 +5,12 @@
  * ipa_proxy_linux_worker.cpp - Default Image Processing Algorithm proxy worker for Linux
  */
 
+#include <errno.h>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <libcamera/camera_manager.h>
@@ -14,7 +18,10 @@
 #include <libcamera/ipa/ipa_interface.h>
 #include <libcamera/logging.h>
 
+#include "byte_stream_buffer.h"
+#include "ipa_data_serializer.h"
 #include "ipa_module.h"
+#include "ipa_proxy_linux.h"
 #include "ipc_unixsocket.h"
 #include "log.h"
 #include "utils.h"
@@ -23,19 +30,165 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(IPAProxyLinuxWorker)
 
-void readyRead(IPCUnixSocket *ipc)
+class IPAProxyLinuxWorker
+{
+public:
+	IPAProxyLinuxWorker(IPCUnixSocket *socket)
+		: socket_(socket)
+	{
+		socket_->readyRead.connect(this, &IPAProxyLinuxWorker::readyRead);
+	}
+
+private:
+	void readyRead(IPCUnixSocket *ipc);
+	void queueFrameAction(unsigned int frame, const IPAOperationData &action);
+
+	int loadModule(const std::string &path);
+	void mapBuffers(const uint8_t *data, size_t size,
+			const std::vector<int32_t> &fds);
+
+	std::unique_ptr<IPAModule> ipam_;
+	std::unique_ptr<IPAInterface> ipa_;
+	IPCUnixSocket *socket_;
+
+	IPCUnixSocket::Payload message_;
+	IPAOperationData event_;
+};
+
+int IPAProxyLinuxWorker::loadModule(const std::string &path)
+{
+	LOG(IPAProxyLinuxWorker, Debug) << "Loading IPA module " << path;
+
+	ipam_ = utils::make_unique<IPAModule>(path);
+	if (!ipam_->isValid() || !ipam_->load()) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "IPAModule " << path << " should be valid but isn't";
+		return -EINVAL;
+	}
+
+	ipa_ = ipam_->createInstance();
+	if (!ipa_) {
+		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA interface";
+		return -EINVAL;
+	}
+
+	ipa_->queueFrameAction.connect(this, &IPAProxyLinuxWorker::queueFrameAction);
+
+	LOG(IPAProxyLinuxWorker, Debug) << "Proxy worker successfully started";
+
+	return 0;
+}
+
+void IPAProxyLinuxWorker::readyRead(IPCUnixSocket *ipc)
 {
-	IPCUnixSocket::Payload message;
 	int ret;
 
-	ret = ipc->receive(&message);
+	ret = ipc->receive(&message_);
 	if (ret) {
 		LOG(IPAProxyLinuxWorker, Error)
 			<< "Receive message failed: " << ret;
 		return;
 	}
 
-	LOG(IPAProxyLinuxWorker, Debug) << "Received a message!";
+	IPAProxyLinuxHeader header;
+	size_t size = message_.data.size();
+
+	if (size < sizeof(header)) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Invalid message size " << size;
+		return;
+	}
+
+	memcpy(&header, message_.data.data(), sizeof(header));
+
+	/* The first message names the IPA module to load. */
+	if (!ipa_) {
+		if (header.cmd != IPAProxyLinuxLoadModule) {
+			LOG(IPAProxyLinuxWorker, Error)
+				<< "No IPA module loaded";
+			return;
+		}
+
+		const char *data = reinterpret_cast<const char *>(message_.data.data());
+		std::string path(data + sizeof(header), size - sizeof(header));
+		if (loadModule(path))
+			exit(EXIT_FAILURE);
+
+		return;
+	}
+
+	if ((size - sizeof(header)) % sizeof(uint32_t)) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Invalid message size " << size;
+		return;
+	}
+
+	event_.operation = header.operation;
+	event_.data.resize((size - sizeof(header)) / sizeof(uint32_t));
+	memcpy(event_.data.data(), message_.data.data() + sizeof(header),
+	       size - sizeof(header));
+
+	switch (header.cmd) {
+	case IPAProxyLinuxMapBuffers:
+		mapBuffers(message_.data.data() + sizeof(header),
+			   size - sizeof(header), message_.fds);
+		break;
+
+	case IPAProxyLinuxUnmapBuffers: {
+		std::vector<unsigned int> ids(event_.data.begin(),
+					      event_.data.end());
+		ipa_->unmapBuffers(ids);
+		break;
+	}
+
+	case IPAProxyLinuxProcessEvent:
+		ipa_->processEvent(header.frame, event_);
+		break;
+
+	default:
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Unknown command " << header.cmd;
+		break;
+	}
+
+	/* The IPA duplicates the dmabuf handles it needs to keep. */
+	for (int32_t fd : message_.fds)
+		close(fd);
+}
+
+void IPAProxyLinuxWorker::mapBuffers(const uint8_t *data, size_t size,
+				     const std::vector<int32_t> &fds)
+{
+	/* Decode the buffer descriptors in place from the message. */
+	ByteStreamBuffer buffer(data, size);
+	SerializedIPABuffers serialized(buffer);
+	std::vector<IPABuffer> buffers;
+
+	if (serialized.apply(fds, &buffers)) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Invalid buffer mapping message";
+		return;
+	}
+
+	ipa_->mapBuffers(buffers);
+}
+
+void IPAProxyLinuxWorker::queueFrameAction(unsigned int frame,
+					   const IPAOperationData &action)
+{
+	IPAProxyLinuxHeader header = {
+		IPAProxyLinuxQueueFrameAction, frame, action.operation
+	};
+	struct iovec iov[2] = {
+		{ &header, sizeof(header) },
+		{ const_cast<uint32_t *>(action.data.data()),
+		  action.data.size() * sizeof(uint32_t) },
+	};
+
+	int ret = socket_->send(iov, 2);
+	if (ret)
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "Failed to send frame action: " << ret;
 }
 
 int main(int argc, char **argv)
@@ -47,38 +200,27 @@ int main(int argc, char **argv)
 	logSetFile(logPath.c_str());
 #endif
 
-	if (argc < 3) {
+	if (argc < 2) {
 		LOG(IPAProxyLinuxWorker, Debug)
 			<< "Tried to start worker with no args";
 		return EXIT_FAILURE;
 	}
 
-	int fd = std::stoi(argv[2]);
+	/*
+	 * Workers are started ahead of time, and receive the path of the IPA
+	 * module to load over the IPC socket.
+	 */
+	int fd = std::stoi(argv[1]);
 	LOG(IPAProxyLinuxWorker, Debug)
-		<< "Starting worker for IPA module " << argv[1]
-		<< " with IPC fd = " << fd;
-
-	std::unique_ptr<IPAModule> ipam = utils::make_unique<IPAModule>(argv[1]);
-	if (!ipam->isValid() || !ipam->load()) {
-		LOG(IPAProxyLinuxWorker, Error)
-			<< "IPAModule " << argv[1] << " should be valid but isn't";
-		return EXIT_FAILURE;
-	}
+		<< "Starting worker with IPC fd = " << fd;
 
 	IPCUnixSocket socket;
 	if (socket.bind(fd) < 0) {
 		LOG(IPAProxyLinuxWorker, Error) << "IPC socket binding failed";
 		return EXIT_FAILURE;
 	}
-	socket.readyRead.connect(&readyRead);
 
-	std::unique_ptr<IPAInterface> ipa = ipam->createInstance();
-	if (!ipa) {
-		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA interface";
-		return EXIT_FAILURE;
-	}
-
-	LOG(IPAProxyLinuxWorker, Debug) << "Proxy worker successfully started";
+	IPAProxyLinuxWorker worker(&socket);
 
 	/* \todo upgrade listening loop */
 	EventDispatcher *dispatcher = CameraManager::instance()->eventDispatcher();
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * pub_key.cpp - Public key signature verification
+ */
+
+#include "pub_key.h"
+
+#ifdef HAVE_GNUTLS
+#include <gnutls/abstract.h>
+#endif
+
+/**
+ * \file pub_key.h
+ * \brief Public key signature verification
+ */
+
+namespace libcamera {
+
+/**
+ * \class PubKey
+ * \brief Public key wrapper for signature verification
+ *
+ * The PubKey class wraps a public key and implements signature verification.
+ * It only supports RSA keys and the RSA-SHA256 signature algorithm, and relies
+ * on GnuTLS. When libcamera is compiled without GnuTLS, all keys are invalid.
+ */
+
+/**
+ * \brief Construct a PubKey from key data
+ * \param[in] key Key data encoded in DER format
+ */
+PubKey::PubKey(const std::vector<uint8_t> &key)
+	: valid_(false), pubkey_(nullptr)
+{
+#ifdef HAVE_GNUTLS
+	if (key.empty())
+		return;
+
+	int ret = gnutls_pubkey_init(&pubkey_);
+	if (ret < 0)
+		return;
+
+	const gnutls_datum_t gnuTlsKey{
+		const_cast<unsigned char *>(key.data()),
+		static_cast<unsigned int>(key.size())
+	};
+	ret = gnutls_pubkey_import(pubkey_, &gnuTlsKey, GNUTLS_X509_FMT_DER);
+	if (ret < 0)
+		return;
+
+	valid_ = true;
+#endif
+}
+
+PubKey::~PubKey()
+{
+#ifdef HAVE_GNUTLS
+	if (pubkey_)
+		gnutls_pubkey_deinit(pubkey_);
+#endif
+}
+
+/**
+ * \fn bool PubKey::isValid() const
+ * \brief Check if the public key is valid
+ * \return True if the public key is valid, false otherwise
+ */
+
+/**
+ * \brief Verify signature on data
+ * \param[in] data The signed data
+ * \param[in] dataSize The size of \a data in bytes
+ * \param[in] sig The signature
+ * \param[in] sigSize The size of \a sig in bytes
+ *
+ * Verify that the signature \a sig matches the signed \a data for the public
+ * key. The signature algorithm is hardcoded to RSA-SHA256.
+ *
+ * \return True if the signature is valid, false otherwise
+ */
+bool PubKey::verify(const void *data, size_t dataSize,
+		    const void *sig, size_t sigSize) const
+{
+	if (!valid_)
+		return false;
+
+#ifdef HAVE_GNUTLS
+	const gnutls_datum_t gnuTlsData{
+		const_cast<unsigned char *>(static_cast<const unsigned char *>(data)),
+		static_cast<unsigned int>(dataSize)
+	};
+
+	const gnutls_datum_t gnuTlsSig{
+		const_cast<unsigned char *>(static_cast<const unsigned char *>(sig)),
+		static_cast<unsigned int>(sigSize)
+	};
+
+	int ret = gnutls_pubkey_verify_data2(pubkey_, GNUTLS_SIGN_RSA_SHA256, 0,
+					     &gnuTlsData, &gnuTlsSig);
+	return ret >= 0;
+#else
+	return false;
+#endif
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * raw_unpack.cpp - Packed raw formats unpacking
+ */
+
+#include <libcamera/raw_unpack.h>
+
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+/**
+ * \file raw_unpack.h
+ * \brief Unpack packed raw Bayer formats to 16-bit samples
+ *
+ * Raw Bayer frames are often stored in packed formats to save memory
+ * bandwidth, such as the MIPI CSI-2 10-bit packing, or the IPU3 CIO2 packing
+ * that stores 25 pixels in 32 bytes. Those formats are impractical for
+ * processing and for storage in raw image files. The functions in this file
+ * unpack them to the corresponding unpacked formats, which store each sample
+ * in the 10 least significant bits of a 16-bit word.
+ *
+ * The functions are designed to unpack frames at capture rate, and process
+ * full blocks of pixels with constant shifts that compilers vectorise.
+ */
+
+namespace libcamera {
+
+namespace {
+
+struct PackedFormat {
+	unsigned int packed;
+	unsigned int unpacked;
+	bool ipu3;
+};
+
+const PackedFormat packedFormats[] = {
+	{ V4L2_PIX_FMT_SBGGR10P, V4L2_PIX_FMT_SBGGR10, false },
+	{ V4L2_PIX_FMT_SGBRG10P, V4L2_PIX_FMT_SGBRG10, false },
+	{ V4L2_PIX_FMT_SGRBG10P, V4L2_PIX_FMT_SGRBG10, false },
+	{ V4L2_PIX_FMT_SRGGB10P, V4L2_PIX_FMT_SRGGB10, false },
+	{ V4L2_PIX_FMT_IPU3_SBGGR10, V4L2_PIX_FMT_SBGGR10, true },
+	{ V4L2_PIX_FMT_IPU3_SGBRG10, V4L2_PIX_FMT_SGBRG10, true },
+	{ V4L2_PIX_FMT_IPU3_SGRBG10, V4L2_PIX_FMT_SGRBG10, true },
+	{ V4L2_PIX_FMT_IPU3_SRGGB10, V4L2_PIX_FMT_SRGGB10, true },
+};
+
+const PackedFormat *packedFormat(unsigned int pixelFormat)
+{
+	for (const PackedFormat &format : packedFormats) {
+		if (format.packed == pixelFormat)
+			return &format;
+	}
+
+	return nullptr;
+}
+
+/*
+ * The MIPI CSI-2 packing stores the 8 MSBs of four pixels in four bytes,
+ * followed by a byte with their 2 LSBs.
+ */
+void unpackMipi10(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	unsigned int x = 0;
+
+	for (; x + 4 <= width; x += 4, src += 5) {
+		const unsigned int lsbs = src[4];
+
+		dst[x + 0] = (src[0] << 2) | (lsbs & 3);
+		dst[x + 1] = (src[1] << 2) | ((lsbs >> 2) & 3);
+		dst[x + 2] = (src[2] << 2) | ((lsbs >> 4) & 3);
+		dst[x + 3] = (src[3] << 2) | ((lsbs >> 6) & 3);
+	}
+
+	for (unsigned int i = 0; x < width; ++x, ++i)
+		dst[x] = (src[i] << 2) | ((src[4] >> (i * 2)) & 3);
+}
+
+/*
+ * The IPU3 packing stores 25 pixels in a 32 bytes block, as a little-endian
+ * stream of 10-bit samples followed by 6 bits of padding. Groups of 4 pixels
+ * are byte-aligned, and are unpacked with constant shifts and masks that the
+ * compiler vectorises.
+ */
+inline void unpackIpu3Group(const uint8_t *src, uint16_t *dst)
+{
+	dst[0] = src[0] | ((src[1] & 0x03) << 8);
+	dst[1] = (src[1] >> 2) | ((src[2] & 0x0f) << 6);
+	dst[2] = (src[2] >> 4) | ((src[3] & 0x3f) << 4);
+	dst[3] = (src[3] >> 6) | (src[4] << 2);
+}
+
+void unpackIpu3(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	unsigned int x = 0;
+
+	for (; x + 25 <= width; x += 25, src += 32) {
+		for (unsigned int i = 0; i < 6; ++i)
+			unpackIpu3Group(src + i * 5, dst + x + i * 4);
+
+		dst[x + 24] = src[30] | ((src[31] & 0x03) << 8);
+	}
+
+	/* The last block is partially filled. */
+	for (unsigned int i = 0; x < width; ++x, ++i) {
+		const unsigned int bit = i * 10;
+		const uint8_t *bytes = src + bit / 8;
+
+		dst[x] = ((bytes[0] | (bytes[1] << 8)) >> (bit % 8)) & 0x3ff;
+	}
+}
+
+} /* namespace */
+
+/**
+ * \brief Retrieve the unpacked format corresponding to a packed raw format
+ * \param[in] pixelFormat The V4L2 pixel format of the packed frames
+ * \return The V4L2 pixel format of the unpacked frames, or 0 if \a pixelFormat
+ * isn't a supported packed raw format
+ */
+unsigned int unpackedRawFormat(unsigned int pixelFormat)
+{
+	const PackedFormat *format = packedFormat(pixelFormat);
+	return format ? format->unpacked : 0;
+}
+
+/**
+ * \brief Compute the minimum line size of a packed raw format
+ * \param[in] pixelFormat The V4L2 pixel format of the packed frames
+ * \param[in] width The frame width in pixels
+ * \return The size in bytes of a line of \a width pixels, or 0 if \a
+ * pixelFormat isn't a supported packed raw format
+ */
+unsigned int packedRawLineSize(unsigned int pixelFormat, unsigned int width)
+{
+	const PackedFormat *format = packedFormat(pixelFormat);
+	if (!format)
+		return 0;
+
+	return format->ipu3 ? (width + 24) / 25 * 32 : (width + 3) / 4 * 5;
+}
+
+/**
+ * \brief Unpack a line of a packed raw frame
+ * \param[in] pixelFormat The V4L2 pixel format of the packed frame
+ * \param[in] src The packed line, at least packedRawLineSize() bytes long
+ * \param[out] dst The unpacked samples, \a width entries long
+ * \param[in] width The line width in pixels
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a pixelFormat isn't a supported packed raw format
+ */
+int unpackRawLine(unsigned int pixelFormat, const uint8_t *src, uint16_t *dst,
+		  unsigned int width)
+{
+	const PackedFormat *format = packedFormat(pixelFormat);
+	if (!format)
+		return -EINVAL;
+
+	if (format->ipu3)
+		unpackIpu3(src, dst, width);
+	else
+		unpackMipi10(src, dst, width);
+
+	return 0;
+}
+
+/**
+ * \brief Unpack a packed raw frame
+ * \param[in] pixelFormat The V4L2 pixel format of the packed frame
+ * \param[in] src The packed frame
+ * \param[in] stride The line stride of the packed frame in bytes
+ * \param[out] dst The unpacked frame, stored without padding between lines
+ * \param[in] size The frame size in pixels
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a pixelFormat isn't a supported packed raw format, or
+ * the \a stride is too small for the frame width
+ */
+int unpackRawFrame(unsigned int pixelFormat, const uint8_t *src,
+		   unsigned int stride, uint16_t *dst, const Size &size)
+{
+	const PackedFormat *format = packedFormat(pixelFormat);
+	if (!format || stride < packedRawLineSize(pixelFormat, size.width))
+		return -EINVAL;
+
+	for (unsigned int y = 0; y < size.height; ++y) {
+		if (format->ipu3)
+			unpackIpu3(src, dst, size.width);
+		else
+			unpackMipi10(src, dst, size.width);
+
+		src += stride;
+		dst += size.width;
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
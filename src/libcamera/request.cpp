@@ -14,6 +14,7 @@
 #include <libcamera/stream.h>
 
 #include "log.h"
+#include "object_arena.h"
 
 /**
  * \file request.h
@@ -55,8 +56,10 @@ LOG_DEFINE_CATEGORY(Request)
  *
  */
 Request::Request(Camera *camera, uint64_t cookie)
-	: camera_(camera), controls_(camera), cookie_(cookie),
-	  status_(RequestPending), cancelled_(false)
+	: camera_(camera), controls_(camera), metadata_(nullptr),
+	  pendingBuffers_(0),
+	  cookie_(cookie), status_(RequestPending), cancelled_(false),
+	  retained_(false), dropped_(false)
 {
 }
 
@@ -64,10 +67,146 @@ Request::~Request()
 {
 	for (auto it : bufferMap_) {
 		Buffer *buffer = it.second;
-		delete buffer;
+		if (!buffer->held_)
+			delete buffer;
 	}
 }
 
+/**
+ * \brief Allocate memory for a request
+ * \param[in] size The size of the request object
+ *
+ * Requests created by Camera::createRequest() are carved from the object arena
+ * of the camera, see ObjectArena. Requests created directly are allocated from
+ * the heap. All requests are deleted with the delete operator.
+ *
+ * \return A pointer to the allocated memory
+ */
+void *Request::operator new(size_t size)
+{
+	return ObjectArena::allocate(nullptr, size);
+}
+
+/**
+ * \brief Allocate memory for a request from an object arena
+ * \param[in] size The size of the request object
+ * \param[in] arena The object arena
+ * \return A pointer to the allocated memory
+ */
+void *Request::operator new(size_t size, ObjectArena *arena)
+{
+	return ObjectArena::allocate(arena, size);
+}
+
+/**
+ * \brief Free the memory of a request
+ * \param[in] ptr The request memory
+ *
+ * The memory is returned to the object arena it has been allocated from, if
+ * any.
+ */
+void Request::operator delete(void *ptr)
+{
+	ObjectArena::release(ptr);
+}
+
+/**
+ * \brief Free the memory of a request allocated from an object arena
+ * \param[in] ptr The request memory
+ * \param[in] arena The object arena
+ */
+void Request::operator delete(void *ptr, ObjectArena *arena)
+{
+	ObjectArena::release(ptr);
+}
+
+/**
+ * \enum Request::ReuseFlag
+ * Flags to control the behaviour of Request::reuse()
+ * \var Request::Default
+ * Don't reuse buffers
+ * \var Request::ReuseBuffers
+ * Reuse the buffers that were previously added by addBuffer()
+ */
+
+/**
+ * \brief Reset the request for reuse
+ * \param[in] flags Indicate whether or not to reuse the buffers
+ *
+ * Reset the status and controls associated with the request, to allow it to
+ * be reused and queued again to the camera without being recreated. Unless
+ * \a flags contains ReuseBuffers, the buffers contained in the request are
+ * deleted, and new buffers shall be added with addBuffer() before the request
+ * is queued. Buffers recycled with recycleBuffer() are always deleted, and
+ * buffers held with holdBuffer() are always removed from the request.
+ *
+ * Requests are normally deleted by the camera once their completion handler
+ * returns. Calling this method from the requestCompleted signal handler
+ * transfers ownership of the request back to the application, which shall
+ * then either queue the request again or delete it once the handler has
+ * returned. Reusing a request and its buffers from the completion handler
+ * allows a steady-state capture loop without any allocation of requests or
+ * buffers.
+ *
+ * This method shall not be called on a request that has been queued and has
+ * not completed yet.
+ */
+void Request::reuse(ReuseFlag flags)
+{
+	ASSERT(!hasPendingBuffers());
+
+	if (!(flags & ReuseBuffers)) {
+		for (auto it : bufferMap_) {
+			Buffer *buffer = it.second;
+			if (!buffer->held_)
+				delete buffer;
+		}
+
+		bufferMap_.clear();
+	} else {
+		/*
+		 * Recycled buffers have been queued again in other requests, and
+		 * held buffers are owned by their handles.
+		 */
+		for (auto it = bufferMap_.begin(); it != bufferMap_.end();) {
+			Buffer *buffer = it->second;
+			if (buffer->recycled_ || buffer->held_) {
+				if (!buffer->held_)
+					delete buffer;
+				it = bufferMap_.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	controls_.clear();
+	metadata_.clear();
+	status_ = RequestPending;
+	cancelled_ = false;
+}
+
+/**
+ * \typedef Request::CompletionHandler
+ * \brief Function called when a request completes
+ */
+
+/**
+ * \fn Request::setCompletionHandler()
+ * \brief Set the function to call when the request completes
+ * \param[in] handler The completion handler
+ *
+ * Requests that have a completion handler are delivered to the handler only,
+ * instead of being broadcast to all receivers of the Camera::requestCompleted
+ * signal. This avoids the cost of dispatching every request to receivers that
+ * only handle a subset of the requests, when multiple consumers share a
+ * camera. The handler is called in the thread the camera is bound to, and the
+ * same ownership rules as for the requestCompleted signal apply.
+ *
+ * The handler is preserved by reuse(), and is removed by setting an empty
+ * handler.
+ */
+
 /**
  * \fn Request::controls()
  * \brief Retrieve the request's ControlList
@@ -84,6 +223,19 @@ Request::~Request()
  * \return A reference to the ControlList in this request
  */
 
+/**
+ * \fn Request::metadata()
+ * \brief Retrieve the request's metadata
+ *
+ * Pipeline handlers report information about the frames captured for the
+ * request, such as the sensor timestamp or the frame duration, in the request
+ * metadata when completing the request. The metadata is filled from data
+ * already available to the pipeline handler, and is valid in the request
+ * completion handler. It is cleared when the request is reused.
+ *
+ * \return A reference to the metadata ControlList in this request
+ */
+
 /**
  * \fn Request::buffers()
  * \brief Retrieve the request's streams to buffers map
@@ -151,6 +303,92 @@ Buffer *Request::findBuffer(Stream *stream) const
 	return it->second;
 }
 
+/**
+ * \brief Recycle the completed buffer for \a stream before the request completes
+ * \param[in] stream The stream whose buffer to recycle
+ *
+ * Requests complete when all their buffers have completed, which delays
+ * buffers of fast streams, such as a viewfinder, until the slowest stream of
+ * the request completes. This method allows consuming a buffer as soon as it
+ * is reported by the Camera::bufferCompleted signal, and queuing its memory
+ * again in a new request without waiting for the request to complete.
+ *
+ * The returned buffer references the same memory as the completed buffer for
+ * \a stream. The completed buffer stays in the request with its metadata, but
+ * its memory shall not be accessed anymore. It is deleted when the request is
+ * reused or destroyed.
+ *
+ * \return A buffer referencing the memory of the completed buffer, or nullptr
+ * if the request has no completed buffer for \a stream or if the buffer has
+ * already been recycled
+ */
+std::unique_ptr<Buffer> Request::recycleBuffer(Stream *stream)
+{
+	Buffer *buffer = findBuffer(stream);
+	if (!buffer || buffer->request() || buffer->recycled_) {
+		LOG(Request, Error) << "No completed buffer to recycle";
+		return nullptr;
+	}
+
+	std::unique_ptr<Buffer> recycled;
+	if (stream->memoryType() == ExternalMemory) {
+		recycled = stream->createBuffer(buffer->dmabufs());
+		stream->unmapBuffer(buffer);
+	} else {
+		recycled = stream->createBuffer(buffer->index());
+	}
+
+	buffer->recycled_ = true;
+
+	return recycled;
+}
+
+/**
+ * \brief Hold the completed buffer for \a stream beyond the request lifetime
+ * \param[in] stream The stream whose buffer to hold
+ *
+ * Buffers are owned by their request, and are deleted when the request is
+ * deleted or reused. This method allows consuming a completed buffer after
+ * the request completion handler returns, for instance by handing it over to
+ * an encoder thread, while the request is deleted or reused for the next
+ * frame.
+ *
+ * The buffer, with its metadata, is removed from the request and is owned by
+ * the returned handle. The handle can be copied to share the buffer between
+ * multiple consumers, in any thread. When the last copy of the handle is
+ * destroyed, the buffer is returned to the camera, which creates a new buffer
+ * for the same memory and passes it to the recycle handler set with
+ * Camera::setRecycleHandler(), in the camera's thread. The recycle handler
+ * implements the application's recycling policy, typically queuing the buffer
+ * again in a new request.
+ *
+ * This method shall only be called once the request has completed, from the
+ * request completion handler or later. The buffer stays listed in buffers()
+ * until the request is reused or deleted. All handles shall be dropped, and
+ * their buffers returned, before the camera buffers are freed.
+ *
+ * \return A handle to the completed buffer, or nullptr if the request hasn't
+ * completed, has no buffer for \a stream, or if the buffer has already been
+ * recycled or held
+ */
+std::shared_ptr<Buffer> Request::holdBuffer(Stream *stream)
+{
+	Buffer *buffer = findBuffer(stream);
+	if (status_ == RequestPending || !buffer || buffer->recycled_ ||
+	    buffer->held_) {
+		LOG(Request, Error) << "No completed buffer to hold";
+		return nullptr;
+	}
+
+	buffer->held_ = true;
+
+	std::shared_ptr<Camera> camera = camera_->shared_from_this();
+	return std::shared_ptr<Buffer>(buffer, [camera](Buffer *b) {
+		camera->invokeMethod(&Camera::releaseBuffer,
+				     ConnectionTypeAuto, b);
+	});
+}
+
 /**
  * \fn Request::cookie()
  * \brief Retrieve the cookie set when the request was created
@@ -196,12 +434,33 @@ int Request::prepare()
 	for (auto const &pair : bufferMap_) {
 		Buffer *buffer = pair.second;
 		buffer->setRequest(this);
-		pending_.insert(buffer);
 	}
 
+	pendingBuffers_ = bufferMap_.size();
+
 	return 0;
 }
 
+/**
+ * \brief Prepare a completed request to be queued again
+ *
+ * Reset the status and metadata of a completed request, keeping its buffers
+ * and controls, to queue it again. This is used for requests dropped by a
+ * FrameDropPolicy, which are queued again without being delivered to the
+ * application.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Request::rearm()
+{
+	metadata_.clear();
+	status_ = RequestPending;
+	cancelled_ = false;
+	dropped_ = false;
+
+	return prepare();
+}
+
 /**
  * \brief Complete a queued request
  *
@@ -219,21 +478,23 @@ void Request::complete()
  * \brief Complete a buffer for the request
  * \param[in] buffer The buffer that has completed
  *
- * A request tracks the status of all buffers it contains through a set of
- * pending buffers. This function removes the \a buffer from the set to mark it
- * as complete. All buffers associate with the request shall be marked as
- * complete by calling this function once and once only before reporting the
- * request as complete with the complete() method.
+ * A request tracks the status of all buffers it contains through a count of
+ * pending buffers, a buffer being pending as long as it is associated with
+ * the request. This function dissociates the \a buffer from the request to
+ * mark it as complete. All buffers associate with the request shall be marked
+ * as complete by calling this function once and once only before reporting
+ * the request as complete with the complete() method.
  *
  * \return True if all buffers contained in the request have completed, false
  * otherwise
  */
 bool Request::completeBuffer(Buffer *buffer)
 {
-	int ret = pending_.erase(buffer);
-	ASSERT(ret == 1);
+	ASSERT(buffer->request() == this);
+	ASSERT(pendingBuffers_ > 0);
 
 	buffer->setRequest(nullptr);
+	pendingBuffers_--;
 
 	if (buffer->status() == Buffer::BufferCancelled)
 		cancelled_ = true;
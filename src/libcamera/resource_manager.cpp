@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * resource_manager.cpp - Arbitration of hardware resources shared by cameras
+ */
+
+#include "resource_manager.h"
+
+#include <limits>
+
+/**
+ * \file resource_manager.h
+ * \brief Arbitration of hardware resources shared by cameras
+ */
+
+namespace libcamera {
+
+/**
+ * \class ResourceManager
+ * \brief Track the capacity of hardware resources consumed by cameras
+ *
+ * Cameras handled by the same pipeline handler often share hardware resources
+ * of limited capacity, such as the throughput of an ISP or the bandwidth of a
+ * memory bus. A camera configured without accounting for the other cameras can
+ * then fail to start, or starve the cameras already running.
+ *
+ * The ResourceManager class stores the capacity of named resources, and the
+ * usage reserved by each configured camera. Pipeline handlers set the capacity
+ * of their resources when matching devices, reserve the usage of a camera when
+ * configuring it, and check in CameraConfiguration::validate() that the usage
+ * of a configuration fits in the capacity left by the other cameras, adjusting
+ * the configuration otherwise.
+ *
+ * Resources are identified by a name private to the pipeline handler, and
+ * usage is expressed in a unit specific to each resource. Resources whose
+ * capacity isn't set are unlimited. The class can be used from multiple
+ * threads concurrently.
+ */
+
+/**
+ * \typedef ResourceManager::Usage
+ * \brief Usage of resources, indexed by resource name
+ */
+
+/**
+ * \brief Set the capacity of a resource
+ * \param[in] resource The resource name
+ * \param[in] capacity The total capacity of the resource
+ */
+void ResourceManager::setCapacity(const std::string &resource, uint64_t capacity)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	capacities_[resource] = capacity;
+}
+
+/**
+ * \brief Retrieve the capacity of a resource
+ * \param[in] resource The resource name
+ * \return The total capacity of the \a resource, or the maximum value of
+ * uint64_t if the resource is unlimited
+ */
+uint64_t ResourceManager::capacity(const std::string &resource) const
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	auto it = capacities_.find(resource);
+	if (it == capacities_.end())
+		return std::numeric_limits<uint64_t>::max();
+
+	return it->second;
+}
+
+/**
+ * \brief Retrieve the capacity of a resource available to a camera
+ * \param[in] resource The resource name
+ * \param[in] camera The camera, or nullptr
+ *
+ * The capacity available to \a camera is the capacity of the \a resource not
+ * reserved by other cameras. The reservation of \a camera itself is ignored,
+ * as it is replaced when the camera is configured again.
+ *
+ * \return The capacity of the \a resource available to \a camera, or the
+ * maximum value of uint64_t if the resource is unlimited
+ */
+uint64_t ResourceManager::available(const std::string &resource,
+				    const Camera *camera) const
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	return available(capacities_.find(resource), camera);
+}
+
+/**
+ * \brief Check if resources usage fits in the capacity available to a camera
+ * \param[in] usage The resources usage
+ * \param[in] camera The camera, or nullptr
+ *
+ * \return True if the \a usage of all resources fits in the capacity available
+ * to \a camera, false otherwise
+ * \sa available()
+ */
+bool ResourceManager::fits(const Usage &usage, const Camera *camera) const
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	for (const auto &it : usage) {
+		if (it.second > available(capacities_.find(it.first), camera))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * \brief Check if resources are reserved by cameras other than \a camera
+ * \param[in] camera The camera, or nullptr
+ * \return True if any camera other than \a camera has reserved resources,
+ * false otherwise
+ */
+bool ResourceManager::inUse(const Camera *camera) const
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	for (const auto &reservation : reservations_) {
+		if (reservation.first != camera)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * \brief Reserve resources for a camera
+ * \param[in] camera The camera
+ * \param[in] usage The resources usage
+ *
+ * Replace the resources reserved by \a camera with \a usage. The reservation
+ * isn't checked against the available capacity, callers shall check it with
+ * fits() beforehand.
+ */
+void ResourceManager::reserve(const Camera *camera, const Usage &usage)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	reservations_[camera] = usage;
+}
+
+/**
+ * \brief Release the resources reserved by a camera
+ * \param[in] camera The camera
+ * \return True if \a camera had reserved resources, false otherwise
+ */
+bool ResourceManager::release(const Camera *camera)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+	return reservations_.erase(camera);
+}
+
+/**
+ * \brief Retrieve the resources reserved by a camera
+ * \param[in] camera The camera
+ * \return The resources usage reserved by \a camera
+ */
+ResourceManager::Usage ResourceManager::reserved(const Camera *camera) const
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	auto it = reservations_.find(camera);
+	if (it == reservations_.end())
+		return {};
+
+	return it->second;
+}
+
+uint64_t ResourceManager::available(const std::map<std::string, uint64_t>::const_iterator &it,
+				    const Camera *camera) const
+{
+	if (it == capacities_.end())
+		return std::numeric_limits<uint64_t>::max();
+
+	uint64_t used = 0;
+	for (const auto &reservation : reservations_) {
+		if (reservation.first == camera)
+			continue;
+
+		auto usage = reservation.second.find(it->first);
+		if (usage != reservation.second.end())
+			used += usage->second;
+	}
+
+	return used < it->second ? it->second - used : 0;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,390 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * shared_controls.cpp - Control lists shared through memory between processes
+ */
+
+#include "shared_controls.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "byte_stream_buffer.h"
+#include "ipa_data_serializer.h"
+#include "log.h"
+
+/**
+ * \file shared_controls.h
+ * \brief Control lists shared through memory between processes
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SharedControls)
+
+namespace {
+
+constexpr uint32_t SharedControlsMagic = 0x6373636c; /* "lcsc" */
+constexpr unsigned int MaxReadRetries = 64;
+
+} /* namespace */
+
+struct SharedControls::Header {
+	uint32_t magic;
+	uint32_t slots;
+	std::atomic<uint32_t> generation;
+	uint32_t reserved;
+};
+
+struct SharedControls::Slot {
+	static constexpr size_t DataSize = sizeof(IPASerializedHeader)
+					 + ControlIdCount * sizeof(IPASerializedControl);
+
+	std::atomic<uint32_t> sequence;
+	std::atomic<uint32_t> frame;
+	std::atomic<uint32_t> generation;
+	uint32_t reserved;
+	uint8_t data[DataSize];
+};
+
+/**
+ * \class SharedControls
+ * \brief Exchange per-frame control lists through shared memory
+ *
+ * Per-frame controls and metadata exchanged between a pipeline handler and
+ * an IPA module isolated in a separate process would otherwise need to be
+ * serialized in every IPC message. The SharedControls class instead stores
+ * control lists in a memory region shared by the two processes, which only
+ * need to signal each other with the frame number and generation of the
+ * lists they have written.
+ *
+ * The region is created by one process with create(), and its file
+ * descriptor, retrieved with fd(), is passed once to the other process which
+ * maps it with attach(). The region is divided in slots, each holding the
+ * control list of one frame, indexed by the frame number modulo the number of
+ * slots. Slots are written with write(), which stores the list in place and
+ * returns a generation number incremented for every write, and read with
+ * read().
+ *
+ * Each region supports a single writer. Bidirectional exchanges, such as
+ * controls sent to the IPA and metadata sent back by the IPA, use one region
+ * per direction. Readers never block the writer: every slot is protected by
+ * a sequence counter, and reads racing with a write of the same slot are
+ * retried. Readers shall consume a slot before the writer wraps around the
+ * region, a slot overwritten by a later frame can't be read anymore.
+ */
+
+SharedControls::SharedControls()
+	: fd_(-1), mem_(nullptr), size_(0), header_(nullptr), slots_(0)
+{
+}
+
+SharedControls::~SharedControls()
+{
+	close();
+}
+
+/**
+ * \brief Create a shared memory region
+ * \param[in] slots The number of control list slots in the region
+ *
+ * The region is backed by a sealed memfd, whose size can't be modified by
+ * the processes sharing it.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SharedControls::create(unsigned int slots)
+{
+	int ret;
+
+	if (!slots)
+		return -EINVAL;
+
+	close();
+
+	int fd = memfd_create("libcamera-controls",
+			      MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		ret = -errno;
+		LOG(SharedControls, Error)
+			<< "Failed to create memfd: " << strerror(-ret);
+		return ret;
+	}
+
+	size_t size = regionSize(slots);
+	if (ftruncate(fd, size) < 0 ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		ret = -errno;
+		LOG(SharedControls, Error)
+			<< "Failed to size memfd: " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	ret = map(fd, size);
+	if (ret)
+		return ret;
+
+	/* The memfd is zeroed, slots with a zero generation are empty. */
+	header_->magic = SharedControlsMagic;
+	header_->slots = slots;
+	slots_ = slots;
+
+	return 0;
+}
+
+/**
+ * \brief Attach to a shared memory region created by another process
+ * \param[in] fd The file descriptor of the region
+ *
+ * The file descriptor \a fd is duplicated, the caller retains its ownership.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SharedControls::attach(int fd)
+{
+	struct stat st;
+	int ret;
+
+	close();
+
+	fd = dup(fd);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		ret = -errno;
+		LOG(SharedControls, Error)
+			<< "Invalid shared controls fd: " << strerror(-ret);
+		if (fd >= 0)
+			::close(fd);
+		return ret;
+	}
+
+	if (static_cast<size_t>(st.st_size) < sizeof(Header)) {
+		LOG(SharedControls, Error) << "Shared controls region too small";
+		::close(fd);
+		return -EINVAL;
+	}
+
+	ret = map(fd, st.st_size);
+	if (ret)
+		return ret;
+
+	/*
+	 * Cache the number of slots, the other process could modify the
+	 * header after it has been validated.
+	 */
+	slots_ = header_->slots;
+	if (header_->magic != SharedControlsMagic || !slots_ ||
+	    regionSize(slots_) > size_) {
+		LOG(SharedControls, Error) << "Invalid shared controls region";
+		close();
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Unmap the shared memory region and close its file descriptor
+ */
+void SharedControls::close()
+{
+	if (mem_)
+		munmap(mem_, size_);
+	if (fd_ >= 0)
+		::close(fd_);
+
+	fd_ = -1;
+	mem_ = nullptr;
+	size_ = 0;
+	header_ = nullptr;
+	slots_ = 0;
+}
+
+/**
+ * \fn SharedControls::isValid()
+ * \brief Check if the shared memory region is mapped
+ * \return True if the region is mapped, false otherwise
+ */
+
+/**
+ * \fn SharedControls::fd()
+ * \brief Retrieve the file descriptor of the shared memory region
+ *
+ * The file descriptor stays owned by the SharedControls instance. It shall be
+ * passed to the other process, which attaches to the region with attach().
+ *
+ * \return The file descriptor, or -1 if the region isn't mapped
+ */
+
+/**
+ * \fn SharedControls::slots()
+ * \brief Retrieve the number of control list slots in the region
+ * \return The number of slots, or 0 if the region isn't mapped
+ */
+
+/**
+ * \brief Write the control list for a frame
+ * \param[in] frame The frame number
+ * \param[in] list The control list
+ *
+ * Store \a list in place in the slot of \a frame, overwriting the list of the
+ * frame previously stored in the slot. The list is visible to readers once
+ * this method returns, and the writer should then signal the reader with the
+ * \a frame number and the returned generation.
+ *
+ * \return The generation of the written list, or 0 if the region isn't mapped
+ */
+uint32_t SharedControls::write(uint32_t frame, const ControlList &list)
+{
+	if (!header_)
+		return 0;
+
+	Slot *s = slot(frame);
+
+	/* An odd sequence number marks the slot as being written. */
+	uint32_t sequence = s->sequence.load(std::memory_order_relaxed);
+	s->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	ByteStreamBuffer buffer(s->data, sizeof(s->data));
+	IPADataSerializer::serialize(list, buffer);
+
+	/* Skip generation 0 on wrap-around, it marks empty slots. */
+	uint32_t generation;
+	do {
+		generation = header_->generation.fetch_add(1, std::memory_order_relaxed)
+			   + 1;
+	} while (!generation);
+
+	s->frame.store(frame, std::memory_order_relaxed);
+	s->generation.store(generation, std::memory_order_relaxed);
+	s->sequence.store(sequence + 2, std::memory_order_release);
+
+	return generation;
+}
+
+/**
+ * \brief Read the control list for a frame
+ * \param[in] frame The frame number
+ * \param[inout] list The control list to update
+ * \param[out] generation The generation of the list read (optional)
+ *
+ * Read the list stored for \a frame and set its controls in \a list. The
+ * list is decoded in place from the shared memory.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV the region isn't mapped
+ * \retval -ENOENT no list is stored for \a frame
+ * \retval -EAGAIN the slot kept being written while reading
+ */
+int SharedControls::read(uint32_t frame, ControlList *list,
+			 uint32_t *generation) const
+{
+	if (!header_)
+		return -ENODEV;
+
+	const Slot *s = slot(frame);
+
+	for (unsigned int retry = 0; retry < MaxReadRetries; ++retry) {
+		uint32_t sequence = s->sequence.load(std::memory_order_acquire);
+		if (sequence & 1) {
+			sched_yield();
+			continue;
+		}
+
+		uint32_t slotFrame = s->frame.load(std::memory_order_relaxed);
+		uint32_t slotGeneration = s->generation.load(std::memory_order_relaxed);
+		bool found = slotGeneration && slotFrame == frame;
+
+		ControlList controls(nullptr);
+		bool valid = false;
+
+		if (found) {
+			ByteStreamBuffer buffer(s->data, sizeof(s->data));
+			SerializedControlList serialized(buffer);
+			valid = serialized.apply(&controls) == 0;
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (s->sequence.load(std::memory_order_relaxed) != sequence)
+			continue;
+
+		if (!found)
+			return -ENOENT;
+
+		/* A consistent slot can't hold invalid data. */
+		if (!valid)
+			return -EINVAL;
+
+		for (const auto &ctrl : controls)
+			(*list)[ctrl.first->id()] = ctrl.second;
+
+		if (generation)
+			*generation = slotGeneration;
+
+		return 0;
+	}
+
+	return -EAGAIN;
+}
+
+/**
+ * \brief Retrieve the generation of the control list stored for a frame
+ * \param[in] frame The frame number
+ *
+ * This method allows checking if the list for \a frame has been updated
+ * without reading it.
+ *
+ * \return The generation of the list, or 0 if no list is stored for \a frame
+ */
+uint32_t SharedControls::generation(uint32_t frame) const
+{
+	if (!header_)
+		return 0;
+
+	const Slot *s = slot(frame);
+	if (s->frame.load(std::memory_order_relaxed) != frame)
+		return 0;
+
+	return s->generation.load(std::memory_order_relaxed);
+}
+
+size_t SharedControls::regionSize(unsigned int slots)
+{
+	return sizeof(Header) + slots * sizeof(Slot);
+}
+
+int SharedControls::map(int fd, size_t size)
+{
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0);
+	if (mem == MAP_FAILED) {
+		int ret = -errno;
+		LOG(SharedControls, Error)
+			<< "Failed to map shared controls: " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	fd_ = fd;
+	mem_ = mem;
+	size_ = size;
+	header_ = static_cast<Header *>(mem);
+
+	return 0;
+}
+
+SharedControls::Slot *SharedControls::slot(uint32_t frame) const
+{
+	Slot *slots = reinterpret_cast<Slot *>(header_ + 1);
+	return &slots[frame % slots_];
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,926 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * shared_stream.cpp - Distribution of stream buffers to multiple consumers
+ */
+
+#include <libcamera/shared_stream.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/stream.h>
+
+#include "ipc_unixsocket.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file shared_stream.h
+ * \brief Distribution of stream buffers to multiple consumers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SharedStream)
+
+namespace {
+
+enum MessageType : uint32_t {
+	MessageSetup,
+	MessageFrame,
+	MessageRelease,
+};
+
+/*
+ * The setup message is followed, for each buffer, by the number of planes and
+ * the offset and length of each plane. The dmabuf file descriptors of all
+ * planes are transferred with the message, in the same order.
+ */
+struct SetupMessage {
+	uint32_t type;
+	uint32_t pixelFormat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t bufferCount;
+};
+
+struct FrameMessage {
+	uint32_t type;
+	uint32_t index;
+	uint32_t sequence;
+	uint32_t bytesused;
+	uint64_t timestamp;
+};
+
+struct ReleaseMessage {
+	uint32_t type;
+	uint32_t index;
+};
+
+void appendData(std::vector<uint8_t> *data, const void *value, size_t size)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(value);
+	data->insert(data->end(), bytes, bytes + size);
+}
+
+bool readData(const std::vector<uint8_t> &data, size_t *offset, void *value,
+	      size_t size)
+{
+	if (data.size() - *offset < size)
+		return false;
+
+	memcpy(value, data.data() + *offset, size);
+	*offset += size;
+	return true;
+}
+
+bool messageType(const std::vector<uint8_t> &data, uint32_t *type)
+{
+	size_t offset = 0;
+	return readData(data, &offset, type, sizeof(*type));
+}
+
+int socketAddress(const std::string &path, struct sockaddr_un *addr)
+{
+	if (path.empty() || path.size() >= sizeof(addr->sun_path))
+		return -ENAMETOOLONG;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, path.c_str(), path.size());
+
+	return 0;
+}
+
+} /* namespace */
+
+/**
+ * \class SharedStream
+ * \brief Distribute the buffers of a stream to multiple consumers
+ *
+ * A camera can only be acquired by a single application. The SharedStream
+ * class allows the application that owns the camera to share the frames it
+ * captures on a stream with other processes, such as a recorder and an
+ * analytics service, without copying the frames.
+ *
+ * Each consumer is connected to the owner through a dedicated IPC channel,
+ * created by addConsumer(). The owner passes the returned file descriptor to
+ * the consumer process through any out-of-band communication method, and the
+ * consumer connects to the channel with SharedStreamConsumer::connect(). The
+ * dmabuf file descriptors of all the stream buffers are transferred once when
+ * the consumer is added, and frames are then announced with a small message
+ * that references the buffer by index.
+ *
+ * Buffers are reference-counted. The owner hands completed buffers to
+ * queueBuffer(), which announces them to all consumers. Every consumer
+ * releases the buffers it is done with, and the \ref bufferReleased signal is
+ * emitted with the buffer index when the last reference to a buffer is
+ * dropped. The owner shall not queue the buffer memory to the camera again
+ * until then.
+ *
+ * Each consumer can hold up to a maximum number of buffers. Frames are not
+ * announced to a consumer that holds that many buffers already, so that a slow
+ * consumer only drops frames and doesn't stall the owner or the other
+ * consumers. Consumers whose channel fails are disconnected, and their buffers
+ * are released.
+ *
+ * Consumers running in unrelated processes can instead connect to a Unix
+ * socket created with listen(). This allows a long-lived process to own the
+ * camera and serve frames to short-lived clients, which then don't need to
+ * enumerate and bring up the camera themselves. The owner accepts connections
+ * from its event loop, adds a consumer for each of them, and passes the channel
+ * file descriptor back to the client over the connection.
+ *
+ * The stream shall use internal memory, and its buffers shall be allocated
+ * before consumers are added. Consumers shall be disconnected, by destroying
+ * the SharedStream, before the stream buffers are freed.
+ */
+
+struct SharedStream::Consumer {
+	IPCUnixSocket socket;
+	std::vector<bool> held;
+	unsigned int pending = 0;
+};
+
+/**
+ * \brief Construct a SharedStream for \a stream
+ * \param[in] stream The stream whose buffers are shared
+ * \param[in] maxPending The maximum number of buffers held by each consumer
+ */
+SharedStream::SharedStream(Stream *stream, unsigned int maxPending)
+	: stream_(stream), maxPending_(maxPending), droppedFrames_(0),
+	  listenFd_(-1)
+{
+}
+
+/**
+ * \brief Destroy the SharedStream and disconnect all consumers
+ *
+ * Buffers held by consumers are not released through the \ref bufferReleased
+ * signal. The socket created by listen(), if any, is removed.
+ */
+SharedStream::~SharedStream()
+{
+	if (listenFd_ == -1)
+		return;
+
+	listenNotifier_.reset();
+	::close(listenFd_);
+	unlink(path_.c_str());
+}
+
+/**
+ * \fn SharedStream::stream()
+ * \brief Retrieve the stream whose buffers are shared
+ * \return The stream
+ */
+
+/**
+ * \brief Add a consumer to the stream
+ *
+ * This method creates an IPC channel for a new consumer, and sends the stream
+ * format and the dmabuf file descriptors of all stream buffers through it. The
+ * returned file descriptor shall be passed to the consumer, which connects to
+ * the channel with SharedStreamConsumer::connect(). The consumer receives the
+ * frames queued with queueBuffer() after this call.
+ *
+ * \return The file descriptor of the consumer side of the channel on success,
+ * or a negative error code otherwise
+ * \retval -EINVAL The stream doesn't use internal memory or has no buffers
+ * \retval -E2BIG The stream buffers have too many planes to be transferred
+ */
+int SharedStream::addConsumer()
+{
+	std::vector<BufferMemory> &buffers = stream_->buffers();
+	if (stream_->memoryType() != InternalMemory || buffers.empty()) {
+		LOG(SharedStream, Error) << "Stream has no buffers to share";
+		return -EINVAL;
+	}
+
+	const StreamConfiguration &cfg = stream_->configuration();
+	IPCUnixSocket::Payload setup;
+
+	SetupMessage msg = {};
+	msg.type = MessageSetup;
+	msg.pixelFormat = cfg.pixelFormat;
+	msg.width = cfg.size.width;
+	msg.height = cfg.size.height;
+	msg.stride = cfg.stride;
+	msg.bufferCount = buffers.size();
+	appendData(&setup.data, &msg, sizeof(msg));
+
+	for (const BufferMemory &mem : buffers) {
+		uint32_t planes = mem.planes().size();
+		appendData(&setup.data, &planes, sizeof(planes));
+
+		for (const Plane &plane : mem.planes()) {
+			uint32_t info[2] = { plane.offset(), plane.length() };
+			appendData(&setup.data, info, sizeof(info));
+			setup.fds.push_back(plane.dmabuf());
+		}
+	}
+
+	if (setup.fds.size() > IPCUnixSocket::MaxFds) {
+		LOG(SharedStream, Error)
+			<< "Too many planes to share: " << setup.fds.size();
+		return -E2BIG;
+	}
+
+	std::unique_ptr<Consumer> consumer = utils::make_unique<Consumer>();
+	int fd = consumer->socket.create();
+	if (fd < 0)
+		return fd;
+
+	int ret = consumer->socket.send(setup);
+	if (ret) {
+		LOG(SharedStream, Error) << "Failed to send stream setup";
+		::close(fd);
+		return ret;
+	}
+
+	consumer->held.resize(buffers.size());
+	consumer->socket.readyRead.connect(this, &SharedStream::readyRead);
+	consumers_.push_back(std::move(consumer));
+
+	if (references_.size() < buffers.size())
+		references_.resize(buffers.size());
+
+	return fd;
+}
+
+/**
+ * \brief Accept consumers on a Unix socket
+ * \param[in] path The file system path of the socket
+ *
+ * This method creates a Unix stream socket bound to \a path, and listens for
+ * connections from consumers using SharedStreamConsumer::connect(). A consumer
+ * is added with addConsumer() for each connection, and the channel file
+ * descriptor is sent to the client, after which the connection is closed.
+ * Connections are accepted from the event loop of the thread the SharedStream
+ * is used from.
+ *
+ * Access to the stream is controlled by the file system permissions of the
+ * socket. A stale socket left at \a path by a previous owner is replaced.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The SharedStream is already listening
+ * \retval -ENAMETOOLONG The \a path is empty or too long
+ */
+int SharedStream::listen(const std::string &path)
+{
+	if (listenFd_ != -1)
+		return -EBUSY;
+
+	struct sockaddr_un addr;
+	int ret = socketAddress(path, &addr);
+	if (ret)
+		return ret;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ret = -errno;
+		LOG(SharedStream, Error)
+			<< "Failed to create socket: " << strerror(-ret);
+		return ret;
+	}
+
+	unlink(path.c_str());
+
+	if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) ||
+	    ::listen(fd, 16)) {
+		ret = -errno;
+		LOG(SharedStream, Error)
+			<< "Failed to listen on " << path << ": " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	listenFd_ = fd;
+	path_ = path;
+	listenNotifier_ = utils::make_unique<EventNotifier>(fd, EventNotifier::Read);
+	listenNotifier_->activated.connect(this, &SharedStream::newConnection);
+
+	return 0;
+}
+
+/**
+ * \fn SharedStream::consumers()
+ * \brief Retrieve the number of connected consumers
+ * \return The number of consumers
+ */
+
+/**
+ * \fn SharedStream::droppedFrames()
+ * \brief Retrieve the number of frames not delivered to consumers
+ *
+ * A frame is dropped for a consumer that holds the maximum number of buffers
+ * when the frame is queued. The count is the sum over all consumers.
+ *
+ * \return The number of dropped frames
+ */
+
+/**
+ * \brief Share a completed buffer with the consumers
+ * \param[in] buffer The buffer, from the shared stream
+ *
+ * The \a buffer is announced to all consumers that don't hold the maximum
+ * number of buffers. Buffers that didn't complete successfully are not
+ * announced. The \ref bufferReleased signal is emitted once all consumers have
+ * released the buffer, synchronously from this method if no consumer received
+ * it.
+ */
+void SharedStream::queueBuffer(Buffer *buffer)
+{
+	unsigned int index = buffer->index();
+
+	if (index >= references_.size())
+		references_.resize(index + 1);
+
+	if (buffer->status() == Buffer::BufferSuccess) {
+		FrameMessage msg = {};
+		msg.type = MessageFrame;
+		msg.index = index;
+		msg.sequence = buffer->sequence();
+		msg.bytesused = buffer->bytesused();
+		msg.timestamp = buffer->timestamp();
+
+		IPCUnixSocket::Payload frame;
+		appendData(&frame.data, &msg, sizeof(msg));
+
+		for (unsigned int i = 0; i < consumers_.size();) {
+			Consumer *consumer = consumers_[i].get();
+
+			if (consumer->pending >= maxPending_ ||
+			    index >= consumer->held.size()) {
+				droppedFrames_++;
+				++i;
+				continue;
+			}
+
+			if (consumer->socket.send(frame)) {
+				LOG(SharedStream, Warning)
+					<< "Disconnecting unreachable consumer";
+				removeConsumer(i);
+				continue;
+			}
+
+			consumer->held[index] = true;
+			consumer->pending++;
+			references_[index]++;
+			++i;
+		}
+	}
+
+	if (!references_[index])
+		bufferReleased.emit(index);
+}
+
+/**
+ * \var SharedStream::bufferReleased
+ * \brief A Signal emitted when all consumers have released a buffer
+ *
+ * The signal carries the index of the released buffer in the stream. The
+ * Buffer instances passed to queueBuffer() belong to their request and may be
+ * deleted before the buffer is released, so a new Buffer shall be created with
+ * Stream::createBuffer() to queue the buffer memory to the camera again.
+ */
+
+void SharedStream::readyRead(IPCUnixSocket *socket)
+{
+	IPCUnixSocket::Payload payload;
+	int ret = socket->receive(&payload);
+	if (ret)
+		return;
+
+	unsigned int i;
+	for (i = 0; i < consumers_.size(); ++i) {
+		if (&consumers_[i]->socket == socket)
+			break;
+	}
+
+	if (i == consumers_.size())
+		return;
+
+	Consumer *consumer = consumers_[i].get();
+	ReleaseMessage msg;
+	size_t offset = 0;
+
+	if (!readData(payload.data, &offset, &msg, sizeof(msg)) ||
+	    msg.type != MessageRelease) {
+		LOG(SharedStream, Error) << "Invalid message from consumer";
+		return;
+	}
+
+	if (msg.index >= consumer->held.size() || !consumer->held[msg.index]) {
+		LOG(SharedStream, Error)
+			<< "Consumer released unheld buffer " << msg.index;
+		return;
+	}
+
+	consumer->held[msg.index] = false;
+	consumer->pending--;
+	release(msg.index);
+}
+
+void SharedStream::newConnection(EventNotifier *notifier)
+{
+	int connection = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+	if (connection < 0)
+		return;
+
+	int fd = addConsumer();
+	if (fd < 0) {
+		::close(connection);
+		return;
+	}
+
+	/*
+	 * Send the channel file descriptor with a single byte of data, as
+	 * ancillary data can't be transferred alone on stream sockets.
+	 */
+	char byte = 0;
+	struct iovec iov = { &byte, 1 };
+	char buf[CMSG_SPACE(sizeof(int))] = {};
+
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(connection, &msg, MSG_NOSIGNAL) < 0)
+		LOG(SharedStream, Warning)
+			<< "Failed to send channel to client: " << strerror(errno);
+	else
+		LOG(SharedStream, Debug) << "Client connected";
+
+	/*
+	 * The consumer is removed on the first frame if the client didn't
+	 * receive the channel.
+	 */
+	::close(fd);
+	::close(connection);
+}
+
+void SharedStream::removeConsumer(unsigned int index)
+{
+	std::unique_ptr<Consumer> consumer = std::move(consumers_[index]);
+	consumers_.erase(consumers_.begin() + index);
+
+	for (unsigned int i = 0; i < consumer->held.size(); ++i) {
+		if (consumer->held[i])
+			release(i);
+	}
+}
+
+void SharedStream::release(unsigned int index)
+{
+	if (--references_[index])
+		return;
+
+	bufferReleased.emit(index);
+}
+
+/**
+ * \class SharedStreamConsumer
+ * \brief Receive the buffers of a stream shared by another process
+ *
+ * The SharedStreamConsumer class is the consumer side of a SharedStream. It
+ * connects to the IPC channel created by SharedStream::addConsumer() with
+ * connect(), and receives the stream format and the dmabuf file descriptors
+ * of all stream buffers, after which the \ref configured signal is emitted.
+ *
+ * Frames are then announced through the \ref frameAvailable signal. The frame
+ * content is accessed through the buffer dmabufs, or through a read-only
+ * memory mapping returned by map(). Consumers shall not modify the buffers, as
+ * they are shared with the other consumers. Every frame shall be released with
+ * release() once the consumer is done with it, as the owner of the stream
+ * can't capture to the buffer until all consumers have released it, and stops
+ * announcing frames to consumers that hold too many buffers.
+ *
+ * The signals are emitted from the event loop of the thread the consumer is
+ * used from, which shall be running.
+ */
+
+/**
+ * \struct SharedStreamConsumer::Frame
+ * \brief Description of a frame announced to a consumer
+ *
+ * \var SharedStreamConsumer::Frame::index
+ * \brief The index of the buffer containing the frame
+ *
+ * \var SharedStreamConsumer::Frame::sequence
+ * \brief The frame sequence number
+ *
+ * \var SharedStreamConsumer::Frame::timestamp
+ * \brief The frame timestamp, in nanoseconds
+ *
+ * \var SharedStreamConsumer::Frame::bytesused
+ * \brief The number of bytes occupied by the frame data
+ */
+
+SharedStreamConsumer::SharedStreamConsumer()
+	: connectionFd_(-1), configured_(false), pixelFormat_(0), stride_(0)
+{
+}
+
+SharedStreamConsumer::~SharedStreamConsumer()
+{
+	disconnect();
+}
+
+/**
+ * \brief Connect to a shared stream
+ * \param[in] fd The file descriptor returned by SharedStream::addConsumer()
+ *
+ * The consumer takes ownership of \a fd.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SharedStreamConsumer::connect(int fd)
+{
+	if (socket_)
+		return -EBUSY;
+
+	socket_ = utils::make_unique<IPCUnixSocket>();
+	int ret = socket_->bind(fd);
+	if (ret) {
+		socket_.reset();
+		return ret;
+	}
+
+	socket_->readyRead.connect(this, &SharedStreamConsumer::readyRead);
+
+	return 0;
+}
+
+/**
+ * \brief Connect to a shared stream through a Unix socket
+ * \param[in] path The path of the socket passed to SharedStream::listen()
+ *
+ * This method connects to the socket at \a path and returns immediately. The
+ * channel to the shared stream is received from the event loop of the calling
+ * thread, after which the consumer is connected and the \ref configured
+ * signal is emitted.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The consumer is already connected or connecting
+ * \retval -ENAMETOOLONG The \a path is empty or too long
+ */
+int SharedStreamConsumer::connect(const std::string &path)
+{
+	if (socket_ || connectionFd_ != -1)
+		return -EBUSY;
+
+	struct sockaddr_un addr;
+	int ret = socketAddress(path, &addr);
+	if (ret)
+		return ret;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) {
+		ret = -errno;
+		LOG(SharedStream, Error)
+			<< "Failed to connect to " << path << ": " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	connectionFd_ = fd;
+	connectionNotifier_ = utils::make_unique<EventNotifier>(fd, EventNotifier::Read);
+	connectionNotifier_->activated.connect(this, &SharedStreamConsumer::channelReceived);
+
+	return 0;
+}
+
+/**
+ * \brief Disconnect from the shared stream
+ *
+ * All buffers are unmapped and their file descriptors closed. The owner of
+ * the stream releases the buffers held by the consumer when it detects the
+ * disconnection.
+ */
+void SharedStreamConsumer::disconnect()
+{
+	if (connectionFd_ != -1) {
+		connectionNotifier_.reset();
+		::close(connectionFd_);
+		connectionFd_ = -1;
+	}
+
+	clearBuffers();
+	socket_.reset();
+}
+
+/**
+ * \fn SharedStreamConsumer::isConnected()
+ * \brief Check if the consumer is connected to a shared stream
+ * \return True if the consumer is connected, false otherwise
+ */
+
+/**
+ * \fn SharedStreamConsumer::isConfigured()
+ * \brief Check if the stream format and buffers have been received
+ * \return True if the consumer is configured, false otherwise
+ */
+
+/**
+ * \fn SharedStreamConsumer::pixelFormat()
+ * \brief Retrieve the stream pixel format
+ * \return The V4L2 pixel format (V4L2_PIX_FMT_*) of the stream
+ */
+
+/**
+ * \fn SharedStreamConsumer::size()
+ * \brief Retrieve the stream frame size
+ * \return The frame size in pixels
+ */
+
+/**
+ * \fn SharedStreamConsumer::stride()
+ * \brief Retrieve the stream line stride
+ * \return The line stride in bytes
+ */
+
+/**
+ * \fn SharedStreamConsumer::bufferCount()
+ * \brief Retrieve the number of buffers of the stream
+ * \return The number of buffers
+ */
+
+/**
+ * \brief Retrieve the number of planes of a buffer
+ * \param[in] index The buffer index
+ * \return The number of planes of buffer \a index
+ */
+unsigned int SharedStreamConsumer::planeCount(unsigned int index) const
+{
+	return index < buffers_.size() ? buffers_[index].size() : 0;
+}
+
+/**
+ * \brief Retrieve the dmabuf file descriptor of a buffer plane
+ * \param[in] index The buffer index
+ * \param[in] plane The plane index
+ *
+ * The file descriptor is owned by the consumer, and stays valid until the
+ * consumer is disconnected.
+ *
+ * \return The dmabuf file descriptor, or -1 if the plane doesn't exist
+ */
+int SharedStreamConsumer::dmabuf(unsigned int index, unsigned int plane) const
+{
+	if (plane >= planeCount(index))
+		return -1;
+
+	return buffers_[index][plane].fd;
+}
+
+/**
+ * \brief Retrieve the offset of a buffer plane in its dmabuf
+ * \param[in] index The buffer index
+ * \param[in] plane The plane index
+ * \return The plane offset in bytes
+ */
+unsigned int SharedStreamConsumer::offset(unsigned int index,
+					  unsigned int plane) const
+{
+	if (plane >= planeCount(index))
+		return 0;
+
+	return buffers_[index][plane].offset;
+}
+
+/**
+ * \brief Retrieve the length of a buffer plane
+ * \param[in] index The buffer index
+ * \param[in] plane The plane index
+ * \return The plane length in bytes
+ */
+unsigned int SharedStreamConsumer::length(unsigned int index,
+					  unsigned int plane) const
+{
+	if (plane >= planeCount(index))
+		return 0;
+
+	return buffers_[index][plane].length;
+}
+
+/**
+ * \brief Map a buffer plane for reading
+ * \param[in] index The buffer index
+ * \param[in] plane The plane index
+ *
+ * The plane is mapped read-only on the first call, and the mapping is kept
+ * until the consumer is disconnected.
+ *
+ * \return A pointer to the plane data, or nullptr on error
+ */
+const void *SharedStreamConsumer::map(unsigned int index, unsigned int plane)
+{
+	if (plane >= planeCount(index))
+		return nullptr;
+
+	Plane &p = buffers_[index][plane];
+	if (!p.mem) {
+		void *mem = mmap(nullptr, p.offset + p.length, PROT_READ,
+				 MAP_SHARED, p.fd, 0);
+		if (mem == MAP_FAILED) {
+			LOG(SharedStream, Error)
+				<< "Failed to map buffer " << index << ": "
+				<< strerror(errno);
+			return nullptr;
+		}
+
+		p.mem = mem;
+	}
+
+	return static_cast<const uint8_t *>(p.mem) + p.offset;
+}
+
+/**
+ * \brief Release a buffer
+ * \param[in] index The index of the buffer announced by \ref frameAvailable
+ * \return 0 on success or a negative error code otherwise
+ */
+int SharedStreamConsumer::release(unsigned int index)
+{
+	if (!socket_)
+		return -ENOTCONN;
+
+	ReleaseMessage msg = {};
+	msg.type = MessageRelease;
+	msg.index = index;
+
+	IPCUnixSocket::Payload payload;
+	appendData(&payload.data, &msg, sizeof(msg));
+
+	return socket_->send(payload);
+}
+
+/**
+ * \var SharedStreamConsumer::configured
+ * \brief A Signal emitted when the stream format and buffers are received
+ */
+
+/**
+ * \var SharedStreamConsumer::frameAvailable
+ * \brief A Signal emitted when a frame is announced by the owner
+ */
+
+void SharedStreamConsumer::readyRead(IPCUnixSocket *socket)
+{
+	IPCUnixSocket::Payload payload;
+	int ret = socket->receive(&payload);
+	if (ret)
+		return;
+
+	uint32_t type;
+	if (!messageType(payload.data, &type)) {
+		LOG(SharedStream, Error) << "Invalid message from owner";
+		return;
+	}
+
+	switch (type) {
+	case MessageSetup:
+		if (configure(payload.data, payload.fds)) {
+			LOG(SharedStream, Error) << "Invalid stream setup";
+			for (int32_t fd : payload.fds)
+				::close(fd);
+			return;
+		}
+
+		configured.emit(this);
+		break;
+
+	case MessageFrame: {
+		FrameMessage msg;
+		size_t offset = 0;
+
+		if (!readData(payload.data, &offset, &msg, sizeof(msg)) ||
+		    msg.index >= buffers_.size()) {
+			LOG(SharedStream, Error) << "Invalid frame message";
+			return;
+		}
+
+		Frame frame;
+		frame.index = msg.index;
+		frame.sequence = msg.sequence;
+		frame.timestamp = msg.timestamp;
+		frame.bytesused = msg.bytesused;
+
+		frameAvailable.emit(this, frame);
+		break;
+	}
+
+	default:
+		LOG(SharedStream, Error) << "Unknown message type " << type;
+		break;
+	}
+}
+
+void SharedStreamConsumer::channelReceived(EventNotifier *notifier)
+{
+	char byte;
+	struct iovec iov = { &byte, 1 };
+	char buf[CMSG_SPACE(sizeof(int))] = {};
+
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	ssize_t size = recvmsg(connectionFd_, &msg, MSG_CMSG_CLOEXEC);
+
+	connectionNotifier_.reset();
+	::close(connectionFd_);
+	connectionFd_ = -1;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (size <= 0 || !cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+		LOG(SharedStream, Error) << "Connection refused by owner";
+		return;
+	}
+
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+
+	if (connect(fd))
+		::close(fd);
+}
+
+int SharedStreamConsumer::configure(const std::vector<uint8_t> &data,
+				    const std::vector<int32_t> &fds)
+{
+	SetupMessage msg;
+	size_t offset = 0;
+
+	if (!readData(data, &offset, &msg, sizeof(msg)))
+		return -EINVAL;
+
+	std::vector<std::vector<Plane>> buffers(msg.bufferCount);
+	unsigned int fd = 0;
+
+	for (std::vector<Plane> &planes : buffers) {
+		uint32_t count;
+		if (!readData(data, &offset, &count, sizeof(count)))
+			return -EINVAL;
+
+		for (unsigned int i = 0; i < count; ++i) {
+			uint32_t info[2];
+			if (!readData(data, &offset, info, sizeof(info)) ||
+			    fd >= fds.size())
+				return -EINVAL;
+
+			planes.push_back({ fds[fd++], info[0], info[1], nullptr });
+		}
+	}
+
+	if (fd != fds.size())
+		return -EINVAL;
+
+	clearBuffers();
+
+	pixelFormat_ = msg.pixelFormat;
+	size_ = { msg.width, msg.height };
+	stride_ = msg.stride;
+	buffers_ = std::move(buffers);
+	configured_ = true;
+
+	return 0;
+}
+
+void SharedStreamConsumer::clearBuffers()
+{
+	for (std::vector<Plane> &planes : buffers_) {
+		for (Plane &plane : planes) {
+			if (plane.mem)
+				munmap(plane.mem, plane.offset + plane.length);
+			::close(plane.fd);
+		}
+	}
+
+	buffers_.clear();
+	configured_ = false;
+}
+
+} /* namespace libcamera */
@@ -55,6 +55,12 @@ namespace libcamera {
  * loop, after the Signal::emit() method returns, with a copy of the signal's
  * arguments. The emitter shall thus ensure that any pointer or reference
  * passed through the signal will remain valid after the signal is emitted.
+ *
+ * Signals are thread-safe. Slots can be connected and disconnected from any
+ * thread, including while the signal is being emitted from another thread.
+ * Emission operates on a snapshot of the connected slots: a slot connected
+ * during an emission will only be called by the next emissions, and a slot
+ * disconnected during an emission may still be called by that emission.
  */
 
 void SlotBase::disconnect(SignalBase *signal)
@@ -63,17 +69,71 @@ void SlotBase::disconnect(SignalBase *signal)
 		object_->disconnect(signal);
 }
 
+void *SlotBase::allocatePack(std::size_t size)
+{
+	return MessagePool::allocate(size);
+}
+
+void SlotBase::releasePack(void *pack)
+{
+	MessagePool::release(pack);
+}
+
+bool SlotBase::isQueued() const
+{
+	return Thread::current() != object_->thread();
+}
+
 void SlotBase::activatePack(void *pack)
 {
-	Object *obj = static_cast<Object *>(object_);
-
-	if (Thread::current() == obj->thread()) {
-		invokePack(pack);
-	} else {
-		std::unique_ptr<Message> msg =
-			utils::make_unique<SignalMessage>(this, pack);
-		obj->postMessage(std::move(msg));
+	std::unique_ptr<Message> msg =
+		utils::make_unique<SignalMessage>(this, pack);
+	object_->postMessage(std::move(msg));
+}
+
+void SignalBase::addSlot(SlotBase *slot)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	std::shared_ptr<const SlotList> slots = std::atomic_load(&slots_);
+	std::shared_ptr<SlotList> newSlots = slots
+					    ? std::make_shared<SlotList>(*slots)
+					    : std::make_shared<SlotList>();
+	newSlots->emplace_back(slot);
+
+	std::atomic_store(&slots_, std::shared_ptr<const SlotList>(newSlots));
+}
+
+void SignalBase::removeSlots(const std::function<bool(SlotBase *)> &match)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	std::shared_ptr<const SlotList> slots = std::atomic_load(&slots_);
+	if (!slots)
+		return;
+
+	std::shared_ptr<SlotList> newSlots = std::make_shared<SlotList>();
+	for (const std::shared_ptr<SlotBase> &slot : *slots) {
+		if (!match(slot.get()))
+			newSlots->push_back(slot);
 	}
+
+	if (newSlots->size() == slots->size())
+		return;
+
+	std::atomic_store(&slots_, std::shared_ptr<const SlotList>(newSlots));
+}
+
+std::shared_ptr<const SignalBase::SlotList> SignalBase::removeAllSlots()
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	return std::atomic_exchange(&slots_, std::shared_ptr<const SlotList>());
+}
+
+std::shared_ptr<const SignalBase::SlotList> SignalBase::slots() const
+{
+	return std::atomic_load(&slots_);
 }
 
 /**
@@ -0,0 +1,693 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * soft_isp.cpp - Software image signal processor for raw Bayer frames
+ */
+
+#include "soft_isp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/raw_unpack.h>
+
+#include "formats.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file soft_isp.h
+ * \brief Software image signal processor for raw Bayer frames
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SoftIsp)
+
+namespace {
+
+enum Colour {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+/* Colour of the top-left 2x2 pixels of each Bayer order, in raster order. */
+constexpr unsigned int BGGR[4] = { Blue, Green, Green, Red };
+constexpr unsigned int GBRG[4] = { Green, Blue, Red, Green };
+constexpr unsigned int GRBG[4] = { Green, Red, Blue, Green };
+constexpr unsigned int RGGB[4] = { Red, Green, Green, Blue };
+
+/* Storage of the raw samples in memory. */
+enum Packing {
+	Packing8,
+	Packing16,
+	PackingMipi10,
+	PackingIpu3,
+};
+
+struct RawFormat {
+	unsigned int fourcc;
+	Packing packing;
+	const unsigned int *order;
+};
+
+/*
+ * Supported raw formats, in order of preference when a device supports
+ * several of them.
+ */
+const RawFormat rawFormats[] = {
+	{ V4L2_PIX_FMT_SBGGR10, Packing16, BGGR },
+	{ V4L2_PIX_FMT_SGBRG10, Packing16, GBRG },
+	{ V4L2_PIX_FMT_SGRBG10, Packing16, GRBG },
+	{ V4L2_PIX_FMT_SRGGB10, Packing16, RGGB },
+	{ V4L2_PIX_FMT_SBGGR10P, PackingMipi10, BGGR },
+	{ V4L2_PIX_FMT_SGBRG10P, PackingMipi10, GBRG },
+	{ V4L2_PIX_FMT_SGRBG10P, PackingMipi10, GRBG },
+	{ V4L2_PIX_FMT_SRGGB10P, PackingMipi10, RGGB },
+	{ V4L2_PIX_FMT_IPU3_SBGGR10, PackingIpu3, BGGR },
+	{ V4L2_PIX_FMT_IPU3_SGBRG10, PackingIpu3, GBRG },
+	{ V4L2_PIX_FMT_IPU3_SGRBG10, PackingIpu3, GRBG },
+	{ V4L2_PIX_FMT_IPU3_SRGGB10, PackingIpu3, RGGB },
+	{ V4L2_PIX_FMT_SBGGR8, Packing8, BGGR },
+	{ V4L2_PIX_FMT_SGBRG8, Packing8, GBRG },
+	{ V4L2_PIX_FMT_SGRBG8, Packing8, GRBG },
+	{ V4L2_PIX_FMT_SRGGB8, Packing8, RGGB },
+};
+
+/* Bands smaller than this are not worth the cost of a worker dispatch. */
+constexpr unsigned int MinBandLines = 32;
+
+/* Unity gain, in the Q8 fixed-point format of SoftIsp::Gains. */
+constexpr unsigned int UnityGain = 256;
+
+inline unsigned int applyGain(unsigned int value, unsigned int gain,
+			      unsigned int max)
+{
+	return std::min(max, (value * gain + UnityGain / 2) / UnityGain);
+}
+
+} /* namespace */
+
+/**
+ * \class SoftIsp
+ * \brief Process raw Bayer frames to RGB and YUV formats
+ *
+ * Devices that only produce raw Bayer frames, or whose hardware ISP is
+ * unavailable, can't produce frames directly usable by applications. The
+ * SoftIsp class implements a minimal image processing pipeline in software:
+ * it interpolates the missing colour components with a bilinear demosaicing
+ * filter, applies white balance gains and a gamma curve, and converts the
+ * result to the output pixel format.
+ *
+ * Frames are processed in bands of lines with process(), which doesn't modify
+ * the processor. Bands can thus be processed concurrently from multiple
+ * threads, and process() reports statistics of the band that white balance
+ * gains for the next frames can be computed from with whiteBalance().
+ *
+ * The per-line loops are written without data-dependent branches so that
+ * compilers vectorise them.
+ */
+
+/**
+ * \struct SoftIsp::Gains
+ * \brief Colour gains applied to the demosaiced frames
+ *
+ * Gains are expressed in Q8 fixed-point format, a value of 256 being a unity
+ * gain.
+ *
+ * \var SoftIsp::Gains::red
+ * \brief The gain of the red component
+ * \var SoftIsp::Gains::green
+ * \brief The gain of the green component
+ * \var SoftIsp::Gains::blue
+ * \brief The gain of the blue component
+ */
+
+/**
+ * \struct SoftIsp::Stats
+ * \brief Statistics of the raw samples of a band
+ *
+ * \var SoftIsp::Stats::sum
+ * \brief The sum of the raw samples of each colour, indexed by red, green and
+ * blue
+ * \var SoftIsp::Stats::count
+ * \brief The number of raw samples of each colour, indexed by red, green and
+ * blue
+ */
+
+/**
+ * \brief Construct an unconfigured processor
+ */
+SoftIsp::SoftIsp()
+	: inputFormat_(0), outputFormat_(0), inputStride_(0),
+	  packing_(Packing8), maxValue_(0), pattern_{},
+	  inputFrameSize_(0), frameSize_(0), stride_(0)
+{
+}
+
+/**
+ * \brief Retrieve the raw pixel formats supported by the processor
+ *
+ * The formats are listed in order of preference, formats with the highest
+ * precision first.
+ *
+ * \return The list of supported V4L2 input pixel formats
+ */
+const std::vector<unsigned int> &SoftIsp::inputFormats()
+{
+	static const std::vector<unsigned int> formats = []() {
+		std::vector<unsigned int> list;
+		for (const RawFormat &format : rawFormats)
+			list.push_back(format.fourcc);
+		return list;
+	}();
+
+	return formats;
+}
+
+/**
+ * \brief Retrieve the pixel formats the processor can produce
+ * \return The list of supported V4L2 output pixel formats
+ */
+const std::vector<unsigned int> &SoftIsp::outputFormats()
+{
+	static const std::vector<unsigned int> formats = {
+		V4L2_PIX_FMT_RGB24,
+		V4L2_PIX_FMT_BGR24,
+		V4L2_PIX_FMT_YUYV,
+	};
+
+	return formats;
+}
+
+/**
+ * \brief Configure the processor
+ * \param[in] inputFormat The V4L2 pixel format of the raw frames
+ * \param[in] size The frame size
+ * \param[in] inputStride The raw frames line stride in bytes
+ * \param[in] outputFormat The V4L2 pixel format of the processed frames
+ *
+ * Configuring the processor resets the gamma curve for the precision of the
+ * raw format.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The formats, size or stride are not supported
+ */
+int SoftIsp::configure(unsigned int inputFormat, const Size &size,
+		       unsigned int inputStride, unsigned int outputFormat)
+{
+	const RawFormat *raw = nullptr;
+	for (const RawFormat &format : rawFormats) {
+		if (format.fourcc == inputFormat) {
+			raw = &format;
+			break;
+		}
+	}
+
+	const std::vector<unsigned int> &formats = outputFormats();
+	if (!raw || std::find(formats.begin(), formats.end(), outputFormat) ==
+		    formats.end()) {
+		LOG(SoftIsp, Error)
+			<< "Unsupported conversion from " << inputFormat
+			<< " to " << outputFormat;
+		return -EINVAL;
+	}
+
+	/* Bayer patterns and the YUYV format require even sizes. */
+	if (size.width < 2 || size.height < 2 || size.width % 2 ||
+	    size.height % 2) {
+		LOG(SoftIsp, Error) << "Unsupported size " << size.toString();
+		return -EINVAL;
+	}
+
+	unsigned int lineSize = PixelFormatInfo::info(inputFormat).stride(size.width);
+	if (inputStride < lineSize) {
+		LOG(SoftIsp, Error) << "Invalid input stride " << inputStride;
+		return -EINVAL;
+	}
+
+	inputFormat_ = inputFormat;
+	outputFormat_ = outputFormat;
+	size_ = size;
+	inputStride_ = inputStride;
+	packing_ = raw->packing;
+	maxValue_ = packing_ == Packing8 ? 255 : 1023;
+
+	for (unsigned int i = 0; i < 4; ++i)
+		pattern_[i / 2][i % 2] = raw->order[i];
+
+	const PixelFormatInfo &info = PixelFormatInfo::info(outputFormat);
+	stride_ = info.stride(size.width);
+	inputFrameSize_ = inputStride * size.height;
+	frameSize_ = info.frameSize(size);
+
+	/* Map the linear raw values to 8-bit values with a 2.2 gamma. */
+	gamma_.resize(maxValue_ + 1);
+	for (unsigned int i = 0; i <= maxValue_; ++i)
+		gamma_[i] = std::lround(255.0 * std::pow(static_cast<double>(i) /
+							 maxValue_, 1 / 2.2));
+
+	return 0;
+}
+
+/**
+ * \fn SoftIsp::size()
+ * \brief Retrieve the configured frame size
+ * \return The frame size
+ */
+
+/**
+ * \fn SoftIsp::frameSize()
+ * \brief Retrieve the size of a processed frame
+ * \return The size in bytes of a frame in the configured output format
+ */
+
+/**
+ * \fn SoftIsp::stride()
+ * \brief Retrieve the line stride of a processed frame
+ *
+ * Processed frames are stored without padding between lines.
+ *
+ * \return The stride in bytes of a processed frame
+ */
+
+/**
+ * \brief Process a band of a raw frame
+ * \param[in] src The raw frame
+ * \param[in] srcSize The size of the \a src memory in bytes
+ * \param[out] dst The memory to store the processed frame
+ * \param[in] dstSize The size of the \a dst memory in bytes
+ * \param[in] gains The white balance gains
+ * \param[in] firstLine The first line of the band
+ * \param[in] lastLine The line following the last line of the band
+ * \param[out] stats The statistics of the raw samples of the band
+ *
+ * Process lines \a firstLine to \a lastLine (excluded) of the \a src frame,
+ * which shall have the size, stride and pixel format the processor has been
+ * configured with, and store them in \a dst.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SoftIsp::process(const uint8_t *src, size_t srcSize, uint8_t *dst,
+		     size_t dstSize, const Gains &gains, unsigned int firstLine,
+		     unsigned int lastLine, Stats *stats) const
+{
+	if (!inputFormat_ || srcSize < inputFrameSize_ || dstSize < frameSize_ ||
+	    firstLine >= lastLine || lastLine > size_.height)
+		return -EINVAL;
+
+	const unsigned int width = size_.width;
+	const unsigned int height = size_.height;
+
+	/*
+	 * Three unpacked lines around the processed line, with a one pixel
+	 * border on each side, and the three interpolated components of the
+	 * processed line.
+	 */
+	std::vector<uint16_t> buffer((width + 2) * 3 + width * 3);
+	uint16_t *lines[3];
+	uint16_t *rgb[3];
+
+	for (unsigned int i = 0; i < 3; ++i) {
+		lines[i] = &buffer[(width + 2) * i];
+		rgb[i] = &buffer[(width + 2) * 3 + width * i];
+	}
+
+	/* Lines outside of the frame are mirrored, preserving the pattern. */
+	auto unpack = [&](unsigned int index, int line) {
+		if (line < 0)
+			line = 1;
+		else if (line >= static_cast<int>(height))
+			line = height - 2;
+
+		uint16_t *samples = lines[index];
+		unpackLine(src, line, samples + 1);
+		samples[0] = samples[2];
+		samples[width + 1] = samples[width - 1];
+	};
+
+	*stats = {};
+
+	unpack(0, static_cast<int>(firstLine) - 1);
+	unpack(1, firstLine);
+
+	for (unsigned int y = firstLine; y < lastLine; ++y) {
+		if (y != firstLine)
+			std::rotate(lines, lines + 1, lines + 3);
+		unpack(2, y + 1);
+
+		const uint16_t *prev = lines[0] + 1;
+		const uint16_t *cur = lines[1] + 1;
+		const uint16_t *next = lines[2] + 1;
+		const unsigned int *colours = pattern_[y % 2];
+
+		for (unsigned int parity = 0; parity < 2; ++parity) {
+			unsigned int colour = colours[parity];
+			uint32_t sum = 0;
+
+			for (unsigned int x = parity; x < width; x += 2)
+				sum += cur[x];
+
+			stats->sum[colour] += sum;
+			stats->count[colour] += width / 2;
+
+			if (colour == Green) {
+				/*
+				 * The other colour of the line is on the left
+				 * and right, the third one above and below.
+				 */
+				uint16_t *green = rgb[Green];
+				uint16_t *side = rgb[colours[!parity]];
+				uint16_t *vert = rgb[Red + Blue - colours[!parity]];
+
+				for (int x = parity; x < static_cast<int>(width); x += 2) {
+					green[x] = cur[x];
+					side[x] = (cur[x - 1] + cur[x + 1] + 1) / 2;
+					vert[x] = (prev[x] + next[x] + 1) / 2;
+				}
+			} else {
+				/*
+				 * Green is on the four sides, the third colour
+				 * on the four corners.
+				 */
+				uint16_t *own = rgb[colour];
+				uint16_t *green = rgb[Green];
+				uint16_t *diag = rgb[Red + Blue - colour];
+
+				for (int x = parity; x < static_cast<int>(width); x += 2) {
+					own[x] = cur[x];
+					green[x] = (cur[x - 1] + cur[x + 1] +
+						    prev[x] + next[x] + 2) / 4;
+					diag[x] = (prev[x - 1] + prev[x + 1] +
+						   next[x - 1] + next[x + 1] + 2) / 4;
+				}
+			}
+		}
+
+		writeLine(rgb, gains, dst + y * stride_);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Compute white balance gains from frame statistics
+ * \param[in] stats The statistics of a frame
+ *
+ * The gains are computed with the grey world algorithm, assuming that the
+ * average colour of the scene is grey. The gains are relative to the green
+ * component and limited to the [0.25, 8.0] range.
+ *
+ * \return The white balance gains
+ */
+SoftIsp::Gains SoftIsp::whiteBalance(const Stats &stats)
+{
+	Gains gains = { UnityGain, UnityGain, UnityGain };
+
+	if (!stats.count[Green] || !stats.sum[Green])
+		return gains;
+
+	double green = static_cast<double>(stats.sum[Green]) / stats.count[Green];
+
+	auto gain = [&](Colour colour) {
+		if (!stats.count[colour] || !stats.sum[colour])
+			return UnityGain * 8;
+
+		double average = static_cast<double>(stats.sum[colour]) /
+				 stats.count[colour];
+		unsigned int value = std::lround(UnityGain * green / average);
+		return utils::clamp(value, UnityGain / 4, UnityGain * 8);
+	};
+
+	gains.red = gain(Red);
+	gains.blue = gain(Blue);
+
+	return gains;
+}
+
+void SoftIsp::unpackLine(const uint8_t *src, unsigned int line,
+			 uint16_t *dst) const
+{
+	const uint8_t *in = src + line * inputStride_;
+	const unsigned int width = size_.width;
+
+	switch (packing_) {
+	case Packing8:
+		for (unsigned int x = 0; x < width; ++x)
+			dst[x] = in[x];
+		break;
+
+	case Packing16:
+		for (unsigned int x = 0; x < width; ++x)
+			dst[x] = (in[x * 2] | (in[x * 2 + 1] << 8)) & maxValue_;
+		break;
+
+	case PackingMipi10:
+	case PackingIpu3:
+		unpackRawLine(inputFormat_, in, dst, width);
+		break;
+	}
+}
+
+void SoftIsp::writeLine(const uint16_t *const *rgb, const Gains &gains,
+			uint8_t *dst) const
+{
+	const unsigned int width = size_.width;
+	const uint8_t *gamma = gamma_.data();
+	const unsigned int max = maxValue_;
+
+	switch (outputFormat_) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24: {
+		unsigned int r = outputFormat_ == V4L2_PIX_FMT_RGB24 ? 0 : 2;
+
+		for (unsigned int x = 0; x < width; ++x) {
+			dst[x * 3 + r] = gamma[applyGain(rgb[Red][x], gains.red, max)];
+			dst[x * 3 + 1] = gamma[applyGain(rgb[Green][x], gains.green, max)];
+			dst[x * 3 + 2 - r] = gamma[applyGain(rgb[Blue][x], gains.blue, max)];
+		}
+		break;
+	}
+
+	case V4L2_PIX_FMT_YUYV:
+		/* BT.601 limited range, with chroma averaged over pixel pairs. */
+		for (unsigned int x = 0; x < width; x += 2) {
+			int r[2], g[2], b[2];
+
+			for (unsigned int i = 0; i < 2; ++i) {
+				r[i] = gamma[applyGain(rgb[Red][x + i], gains.red, max)];
+				g[i] = gamma[applyGain(rgb[Green][x + i], gains.green, max)];
+				b[i] = gamma[applyGain(rgb[Blue][x + i], gains.blue, max)];
+
+				dst[x * 2 + i * 2] =
+					((66 * r[i] + 129 * g[i] + 25 * b[i] + 128) >> 8) + 16;
+			}
+
+			int rs = r[0] + r[1];
+			int gs = g[0] + g[1];
+			int bs = b[0] + b[1];
+
+			dst[x * 2 + 1] = ((-38 * rs - 74 * gs + 112 * bs + 256) >> 9) + 128;
+			dst[x * 2 + 3] = ((112 * rs - 94 * gs - 18 * bs + 256) >> 9) + 128;
+		}
+		break;
+	}
+}
+
+/**
+ * \class SoftIspStage
+ * \brief Process raw frames in a pool of worker threads
+ *
+ * The SoftIspStage class lets pipeline handlers produce processed frames from
+ * devices that only capture raw Bayer frames. Each frame is split in bands of
+ * lines processed in parallel by a SoftIsp in a pool of worker threads, and
+ * the \ref frameProcessed signal is emitted in the thread the stage is bound
+ * to when all bands of a frame have been processed.
+ *
+ * White balance is automatic: the gains applied to each frame are computed
+ * from the statistics of the last processed frame.
+ *
+ * The stage reads the raw frame until the \ref frameProcessed signal is
+ * emitted, the raw buffer shall thus not be requeued before that signal.
+ * Frames being processed when the camera is stopped are completed with
+ * flush().
+ */
+
+SoftIspStage::SoftIspStage()
+	: gains_{ UnityGain, UnityGain, UnityGain }, serial_(0)
+{
+	pool_.completed.connect(this, &SoftIspStage::bandCompleted);
+}
+
+/**
+ * \brief Configure the stage
+ * \param[in] inputFormat The V4L2 pixel format of the raw frames
+ * \param[in] size The frame size
+ * \param[in] inputStride The raw frames line stride in bytes
+ * \param[in] outputFormat The V4L2 pixel format of the processed frames
+ *
+ * Configuring the stage resets the white balance gains.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int SoftIspStage::configure(unsigned int inputFormat, const Size &size,
+			    unsigned int inputStride, unsigned int outputFormat)
+{
+	gains_ = { UnityGain, UnityGain, UnityGain };
+
+	return isp_.configure(inputFormat, size, inputStride, outputFormat);
+}
+
+/**
+ * \fn SoftIspStage::frameSize()
+ * \brief Retrieve the size of a processed frame
+ * \return The size in bytes of a processed frame
+ */
+
+/**
+ * \fn SoftIspStage::stride()
+ * \brief Retrieve the line stride of a processed frame
+ * \return The stride in bytes of a processed frame
+ */
+
+/**
+ * \brief Queue a raw frame for processing
+ * \param[in] cookie Cookie reported by the \ref frameProcessed signal
+ * \param[in] src The plane storing the raw frame
+ * \param[in] dst The plane to store the processed frame
+ *
+ * The frame is processed asynchronously in worker threads, and the \ref
+ * frameProcessed signal is emitted when done.
+ */
+void SoftIspStage::queue(uint64_t cookie, Plane *src, Plane *dst)
+{
+	uint64_t serial = ++serial_;
+	Frame *frame = &frames_[serial];
+
+	frame->cookie = cookie;
+	frame->src = src;
+	frame->dst = dst;
+
+	const uint8_t *in = static_cast<const uint8_t *>(src->mem());
+	uint8_t *out = static_cast<uint8_t *>(dst->mem());
+
+	frame->mapped = in && out;
+	if (!frame->mapped) {
+		/* Report the error through the worker to complete in order. */
+		frame->pending = 1;
+		frame->results = { -ENOMEM };
+		frame->stats.resize(1);
+		pool_.queue([]() {}, serial);
+		return;
+	}
+
+	src->beginCpuAccess(Plane::CpuRead);
+	dst->beginCpuAccess(Plane::CpuWrite);
+
+	const unsigned int height = isp_.size().height;
+	const unsigned int bands =
+		utils::clamp(height / MinBandLines, 1U, std::max(pool_.size(), 1U));
+
+	frame->pending = bands;
+	frame->results.assign(bands, 0);
+	frame->stats.assign(bands, SoftIsp::Stats{});
+
+	const SoftIsp *isp = &isp_;
+	const SoftIsp::Gains gains = gains_;
+	size_t inSize = src->length();
+	size_t outSize = dst->length();
+
+	for (unsigned int i = 0; i < bands; ++i) {
+		/* Keep the bands aligned on the Bayer pattern. */
+		unsigned int first = height * i / bands & ~1U;
+		unsigned int last = i == bands - 1 ? height
+				  : height * (i + 1) / bands & ~1U;
+		int *result = &frame->results[i];
+		SoftIsp::Stats *stats = &frame->stats[i];
+
+		pool_.queue([=]() {
+			*result = isp->process(in, inSize, out, outSize, gains,
+					       first, last, stats);
+		}, serial);
+	}
+}
+
+/**
+ * \brief Complete all the queued frames
+ *
+ * Wait for the frames being processed, and emit the \ref frameProcessed
+ * signal for all of them synchronously. Completion notifications still queued
+ * for those frames are then ignored.
+ */
+void SoftIspStage::flush()
+{
+	pool_.wait();
+
+	std::map<uint64_t, Frame> frames;
+	frames.swap(frames_);
+
+	for (auto &it : frames)
+		completeFrame(&it.second);
+}
+
+/**
+ * \var SoftIspStage::frameProcessed
+ * \brief Signal emitted when a frame has been processed
+ *
+ * The signal carries the cookie the frame has been queued with, and the size
+ * of the processed frame in bytes, or a negative error code if processing
+ * failed.
+ */
+
+void SoftIspStage::bandCompleted(uint64_t serial)
+{
+	auto it = frames_.find(serial);
+	if (it == frames_.end())
+		return;
+
+	if (--it->second.pending)
+		return;
+
+	Frame frame = std::move(it->second);
+	frames_.erase(it);
+
+	completeFrame(&frame);
+}
+
+void SoftIspStage::completeFrame(Frame *frame)
+{
+	if (frame->mapped) {
+		frame->dst->endCpuAccess(Plane::CpuWrite);
+		frame->src->endCpuAccess(Plane::CpuRead);
+	}
+
+	int result = isp_.frameSize();
+	SoftIsp::Stats stats = {};
+
+	for (unsigned int i = 0; i < frame->results.size(); ++i) {
+		if (frame->results[i] < 0) {
+			result = frame->results[i];
+			break;
+		}
+
+		for (unsigned int c = 0; c < 3; ++c) {
+			stats.sum[c] += frame->stats[i].sum[c];
+			stats.count[c] += frame->stats[i].count[c];
+		}
+	}
+
+	if (result < 0)
+		LOG(SoftIsp, Warning) << "Failed to process frame: " << result;
+	else
+		gains_ = SoftIsp::whiteBalance(stats);
+
+	frameProcessed.emit(frame->cookie, result);
+}
+
+} /* namespace libcamera */
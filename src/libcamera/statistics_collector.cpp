@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * statistics_collector.cpp - Camera runtime statistics collection
+ */
+
+#include "statistics_collector.h"
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/request.h>
+
+#include "metrics_registry.h"
+#include "utils.h"
+
+/**
+ * \file statistics_collector.h
+ * \brief Camera runtime statistics collection
+ */
+
+namespace libcamera {
+
+/**
+ * \class StatisticsCollector
+ * \brief Collect the runtime statistics of a camera
+ *
+ * The StatisticsCollector class updates the counters and histograms reported
+ * to applications through Camera::statistics(). It is updated by the
+ * PipelineHandler base class on the request and buffer hot paths, from the
+ * pipeline handler thread only.
+ *
+ * As there is a single writer, counters are updated with relaxed atomic loads
+ * and stores instead of read-modify-write operations, which avoids bus locking.
+ * Readers in other threads are guaranteed to see consistent values for each
+ * counter, but not a consistent snapshot across counters.
+ *
+ * Once registerMetrics() has been called, the collector additionally updates
+ * the camera metrics in the MetricsRegistry.
+ */
+
+StatisticsCollector::AtomicHistogram::AtomicHistogram()
+{
+	for (std::atomic<uint64_t> &count : counts_)
+		count.store(0, std::memory_order_relaxed);
+}
+
+void StatisticsCollector::AtomicHistogram::add(uint64_t value)
+{
+	increment(counts_[Histogram::bucket(value)]);
+}
+
+Histogram StatisticsCollector::AtomicHistogram::histogram() const
+{
+	std::vector<uint64_t> counts;
+
+	for (const std::atomic<uint64_t> &count : counts_)
+		counts.push_back(count.load(std::memory_order_relaxed));
+
+	return Histogram(counts);
+}
+
+StatisticsCollector::StatisticsCollector()
+	: requestsQueued_(0), requestsCompleted_(0), requestsCancelled_(0),
+	  buffersCompleted_(0), framesDropped_(0), requestsDropped_(0),
+	  requestsMetric_(nullptr), framesDroppedMetric_(nullptr),
+	  requestLatencyMetric_(nullptr), startLatencyMetric_(nullptr),
+	  startTime_(0)
+{
+}
+
+/**
+ * \brief Register the camera metrics
+ * \param[in] camera The camera whose statistics are collected
+ *
+ * Metrics are named after the camera, and the streams of the camera are
+ * numbered in the order of the Camera::streams() set.
+ */
+void StatisticsCollector::registerMetrics(const Camera *camera)
+{
+	MetricsRegistry *registry = MetricsRegistry::instance();
+	const std::string prefix = "camera." + camera->name() + ".";
+
+	requestsMetric_ = registry->counter(prefix + "requests");
+	framesDroppedMetric_ = registry->counter(prefix + "frames-dropped");
+	requestLatencyMetric_ = registry->histogram(prefix + "request-latency-us");
+	startLatencyMetric_ = registry->histogram(prefix + "start-latency-us");
+
+	unsigned int index = 0;
+	for (const Stream *stream : camera->streams()) {
+		std::string name = prefix + "stream" + std::to_string(index++);
+		streamFramesMetrics_[stream] = registry->counter(name + ".frames");
+		streamFirstFrameMetrics_[stream] =
+			registry->histogram(name + ".first-frame-us");
+	}
+}
+
+/**
+ * \brief Reset the per-stream state when the camera starts
+ *
+ * Buffer sequence numbers restart from 0 when the camera starts, sequence gaps
+ * are thus only tracked within a capture session. The start time is recorded
+ * to measure the start latency and the time to the first frame of each stream.
+ */
+void StatisticsCollector::start()
+{
+	sequences_.clear();
+	startTime_ = utils::monotonic_ns();
+}
+
+/**
+ * \brief Record the completion of the pipeline handler start operation
+ * \return The time spent starting the pipeline handler, in microseconds
+ */
+uint64_t StatisticsCollector::started()
+{
+	uint64_t latency = (utils::monotonic_ns() - startTime_) / 1000;
+
+	startLatency_.add(latency);
+	if (startLatencyMetric_)
+		startLatencyMetric_->add(latency);
+
+	return latency;
+}
+
+/**
+ * \brief Record a request being queued to the pipeline handler
+ * \param[in] depth The number of requests in the pipeline handler, including
+ * the request being queued
+ */
+void StatisticsCollector::requestQueued(unsigned int depth)
+{
+	increment(requestsQueued_);
+	queueDepth_.add(depth);
+	queueTimes_.push_back(utils::monotonic_ns());
+}
+
+/**
+ * \brief Record a buffer completion
+ * \param[in] buffer The completed buffer
+ */
+void StatisticsCollector::bufferCompleted(const Buffer *buffer)
+{
+	if (buffer->status() != Buffer::BufferSuccess)
+		return;
+
+	increment(buffersCompleted_);
+
+	auto metric = streamFramesMetrics_.find(buffer->stream());
+	if (metric != streamFramesMetrics_.end())
+		metric->second->add();
+
+	auto iter = sequences_.find(buffer->stream());
+	if (iter == sequences_.end()) {
+		sequences_[buffer->stream()] = buffer->sequence();
+
+		/* The first buffer of the stream since the camera started. */
+		uint64_t latency = (utils::monotonic_ns() - startTime_) / 1000;
+
+		firstFrameLatency_.add(latency);
+		auto first = streamFirstFrameMetrics_.find(buffer->stream());
+		if (first != streamFirstFrameMetrics_.end())
+			first->second->add(latency);
+
+		return;
+	}
+
+	if (buffer->sequence() > iter->second + 1) {
+		unsigned int dropped = buffer->sequence() - iter->second - 1;
+
+		increment(framesDropped_, dropped);
+		if (framesDroppedMetric_)
+			framesDroppedMetric_->add(dropped);
+	}
+
+	iter->second = buffer->sequence();
+}
+
+/**
+ * \brief Record a request completion
+ * \param[in] request The completed request
+ *
+ * Requests shall be recorded in the order they have been queued.
+ */
+void StatisticsCollector::requestCompleted(const Request *request)
+{
+	if (request->status() == Request::RequestCancelled)
+		increment(requestsCancelled_);
+	else
+		increment(requestsCompleted_);
+
+	if (requestsMetric_)
+		requestsMetric_->add();
+
+	if (queueTimes_.empty())
+		return;
+
+	uint64_t latency = (utils::monotonic_ns() - queueTimes_.front()) / 1000;
+	queueTimes_.pop_front();
+
+	requestLatency_.add(latency);
+	if (requestLatencyMetric_)
+		requestLatencyMetric_->add(latency);
+}
+
+/**
+ * \brief Record a completed request dropped by a frame drop policy
+ */
+void StatisticsCollector::requestDropped()
+{
+	increment(requestsDropped_);
+}
+
+/**
+ * \brief Retrieve a snapshot of the statistics
+ *
+ * This method may be called from any thread.
+ *
+ * \return The camera statistics
+ */
+CameraStatistics StatisticsCollector::statistics() const
+{
+	CameraStatistics stats;
+
+	stats.requestsQueued = requestsQueued_.load(std::memory_order_relaxed);
+	stats.requestsCompleted = requestsCompleted_.load(std::memory_order_relaxed);
+	stats.requestsCancelled = requestsCancelled_.load(std::memory_order_relaxed);
+	stats.buffersCompleted = buffersCompleted_.load(std::memory_order_relaxed);
+	stats.framesDropped = framesDropped_.load(std::memory_order_relaxed);
+	stats.requestsDropped = requestsDropped_.load(std::memory_order_relaxed);
+	stats.queueDepth = queueDepth_.histogram();
+	stats.requestLatency = requestLatency_.histogram();
+	stats.startLatency = startLatency_.histogram();
+	stats.firstFrameLatency = firstFrameLatency_.histogram();
+
+	return stats;
+}
+
+} /* namespace libcamera */
@@ -15,7 +15,10 @@
 
 #include <libcamera/request.h>
 
+#include "formats.h"
 #include "log.h"
+#include "object_arena.h"
+#include "utils.h"
 
 /**
  * \file stream.h
@@ -81,8 +84,10 @@ LOG_DEFINE_CATEGORY(Stream)
  * size shall be considered to be supported until it has been verified using
  * CameraConfiguration::validate().
  *
- * \todo Review the usage patterns of this class, and cache the computed
- * pixelformats(), sizes() and range() if this would improve performances.
+ * The pixel formats, the lists of discrete sizes and the ranges are computed
+ * when the StreamFormats is constructed, and the accessors don't allocate
+ * memory, as pipeline handlers and applications call them repeatedly when
+ * negotiating configurations.
  */
 
 StreamFormats::StreamFormats()
@@ -94,23 +99,23 @@ StreamFormats::StreamFormats()
  * \param[in] formats A map of pixel formats to a sizes description
  */
 StreamFormats::StreamFormats(const std::map<unsigned int, std::vector<SizeRange>> &formats)
-	: formats_(formats)
 {
+	pixelformats_.reserve(formats.size());
+
+	for (const auto &it : formats) {
+		Format &format = formats_[it.first];
+		format.sizes = computeSizes(it.second);
+		format.range = computeRange(it.second);
+
+		pixelformats_.push_back(it.first);
+	}
 }
 
 /**
+ * \fn StreamFormats::pixelformats()
  * \brief Retrieve the list of supported pixel formats
  * \return The list of supported pixel formats
  */
-std::vector<unsigned int> StreamFormats::pixelformats() const
-{
-	std::vector<unsigned int> formats;
-
-	for (auto const &it : formats_)
-		formats.push_back(it.first);
-
-	return formats;
-}
 
 /**
  * \brief Retrieve the list of frame sizes supported for \a pixelformat
@@ -126,7 +131,39 @@ std::vector<unsigned int> StreamFormats::pixelformats() const
  *
  * \return A list of frame sizes or an empty list on error
  */
-std::vector<Size> StreamFormats::sizes(unsigned int pixelformat) const
+const std::vector<Size> &StreamFormats::sizes(unsigned int pixelformat) const
+{
+	static const std::vector<Size> empty;
+
+	auto const it = formats_.find(pixelformat);
+	if (it == formats_.end())
+		return empty;
+
+	return it->second.sizes;
+}
+
+/**
+ * \brief Retrieve the range of minimum and maximum sizes
+ * \param[in] pixelformat Pixel format to retrieve range for
+ *
+ * If the size described for \a pixelformat is a range, that range is returned
+ * directly. If the sizes described are a list of discrete sizes, a range is
+ * created from the minimum and maximum sizes in the list. The step values of
+ * the range are set to 0 to indicate that the range is generated and that not
+ * all image sizes contained in the range might be supported.
+ *
+ * \return A range of valid image sizes or an empty range on error
+ */
+SizeRange StreamFormats::range(unsigned int pixelformat) const
+{
+	auto const it = formats_.find(pixelformat);
+	if (it == formats_.end())
+		return {};
+
+	return it->second.range;
+}
+
+std::vector<Size> StreamFormats::computeSizes(const std::vector<SizeRange> &ranges)
 {
 	/*
 	 * Sizes to try and extract from ranges.
@@ -134,7 +171,7 @@ std::vector<Size> StreamFormats::sizes(unsigned int pixelformat) const
 	 * from v4l2 documentation and source code as well as lists of
 	 * common frame sizes.
 	 */
-	static const std::array<Size, 53> rangeDiscreteSizes = {
+	static constexpr std::array<Size, 53> rangeDiscreteSizes = {
 		Size(160, 120),
 		Size(240, 160),
 		Size(320, 240),
@@ -191,13 +228,7 @@ std::vector<Size> StreamFormats::sizes(unsigned int pixelformat) const
 	};
 	std::vector<Size> sizes;
 
-	/* Make sure pixel format exists. */
-	auto const &it = formats_.find(pixelformat);
-	if (it == formats_.end())
-		return {};
-
 	/* Try creating a list of discrete sizes. */
-	const std::vector<SizeRange> &ranges = it->second;
 	bool discrete = true;
 	for (const SizeRange &range : ranges) {
 		if (range.min != range.max) {
@@ -227,29 +258,11 @@ std::vector<Size> StreamFormats::sizes(unsigned int pixelformat) const
 	return sizes;
 }
 
-/**
- * \brief Retrieve the range of minimum and maximum sizes
- * \param[in] pixelformat Pixel format to retrieve range for
- *
- * If the size described for \a pixelformat is a range, that range is returned
- * directly. If the sizes described are a list of discrete sizes, a range is
- * created from the minimum and maximum sizes in the list. The step values of
- * the range are set to 0 to indicate that the range is generated and that not
- * all image sizes contained in the range might be supported.
- *
- * \return A range of valid image sizes or an empty range on error
- */
-SizeRange StreamFormats::range(unsigned int pixelformat) const
+SizeRange StreamFormats::computeRange(const std::vector<SizeRange> &ranges)
 {
-	auto const it = formats_.find(pixelformat);
-	if (it == formats_.end())
-		return {};
-
-	const std::vector<SizeRange> &ranges = it->second;
 	if (ranges.size() == 1)
 		return ranges[0];
 
-	LOG(Stream, Debug) << "Building range from discrete sizes";
 	SizeRange range(UINT_MAX, UINT_MAX, 0, 0);
 	for (const SizeRange &limit : ranges) {
 		if (limit.min < range.min)
@@ -274,6 +287,64 @@ SizeRange StreamFormats::range(unsigned int pixelformat) const
  * \var MemoryType::ExternalMemory
  * The Stream uses memory allocated externally by application and imported in
  * the library.
+ * \var MemoryType::UserPtrMemory
+ * The Stream uses memory allocated by the application and identified by its
+ * CPU address. The application backs the planes of the buffers in the stream's
+ * buffer pool with its memory using Plane::setUserPtr() before queueing them,
+ * and frames are captured to the memory directly. This avoids copying frames
+ * out of uncached device memory when they are processed by the CPU.
+ */
+
+/**
+ * \struct FrameDropPolicy
+ * \brief Policy to bound the latency of a stream when the application is slow
+ *
+ * Completed requests are delivered to the application through the camera's
+ * thread. When the application doesn't process them as fast as the camera
+ * produces them, the completed requests accumulate, and the latency between
+ * capture and processing grows. A frame drop policy bounds the latency by
+ * dropping completed requests. Dropped requests are not delivered to the
+ * application, but are queued again to the camera right away with the same
+ * buffers and controls, so that their buffers are immediately available to
+ * capture new frames.
+ *
+ * Requests are pending delivery from the time the pipeline handler completes
+ * them until the camera's thread processes their completion. A request
+ * containing buffers for multiple streams is only dropped if the policies of
+ * all its streams drop it. Requests that are cancelled, or whose buffers have
+ * been recycled with Request::recycleBuffer() from the Camera::bufferCompleted
+ * signal, are never dropped. The number of dropped requests is reported by
+ * CameraStatistics::requestsDropped.
+ *
+ * \var FrameDropPolicy::Mode
+ * \brief The frame drop policy mode
+ *
+ * \var FrameDropPolicy::KeepAll
+ * Deliver all completed requests to the application. This is the default.
+ * \var FrameDropPolicy::DropOldest
+ * When \a maxPending requests are pending delivery, drop the oldest of them
+ * and deliver the newly completed request
+ * \var FrameDropPolicy::DropNewest
+ * When \a maxPending requests are pending delivery, drop the newly completed
+ * request
+ * \var FrameDropPolicy::KeepEveryNth
+ * Deliver one of every \a interval completed requests and drop the others,
+ * regardless of the number of requests pending delivery
+ *
+ * \var FrameDropPolicy::mode
+ * \brief The policy mode
+ *
+ * \var FrameDropPolicy::maxPending
+ * \brief The maximum number of requests pending delivery for the DropOldest
+ * and DropNewest modes
+ *
+ * \var FrameDropPolicy::interval
+ * \brief The decimation interval for the KeepEveryNth mode
+ */
+
+/**
+ * \fn FrameDropPolicy::FrameDropPolicy()
+ * \brief Construct a policy that delivers all completed requests
  */
 
 /**
@@ -289,7 +360,9 @@ SizeRange StreamFormats::range(unsigned int pixelformat) const
  * handlers provied StreamFormats.
  */
 StreamConfiguration::StreamConfiguration()
-	: pixelFormat(0), memoryType(InternalMemory), stream_(nullptr)
+	: pixelFormat(0), modifier(0), stride(0), memoryType(InternalMemory),
+	  bufferCount(0), minBufferCount(0), maxBufferCount(0), mapFlags(0),
+	  decimation(1), sliceHeight(0), stream_(nullptr)
 {
 }
 
@@ -297,8 +370,9 @@ StreamConfiguration::StreamConfiguration()
  * \brief Construct a configuration with stream formats
  */
 StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
-	: pixelFormat(0), memoryType(InternalMemory), stream_(nullptr),
-	  formats_(formats)
+	: pixelFormat(0), modifier(0), stride(0), memoryType(InternalMemory),
+	  bufferCount(0), minBufferCount(0), maxBufferCount(0), mapFlags(0),
+	  decimation(1), sliceHeight(0), stream_(nullptr), formats_(formats)
 {
 }
 
@@ -307,6 +381,20 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * \brief Stream size in pixels
  */
 
+/**
+ * \var StreamConfiguration::stride
+ * \brief Image stride for the stream, in bytes
+ *
+ * The stride value reports the number of bytes between the beginning of two
+ * consecutive lines of the image, including any padding added by the device
+ * for alignment purposes. For multi-planar formats, it reports the stride of
+ * the first plane, the stride of the other planes is derived from the format
+ * as specified by V4L2.
+ *
+ * This field is set by the pipeline handler when configuring the camera, and
+ * is ignored by Camera::configure(). A value of 0 means the stride is unknown.
+ */
+
 /**
  * \var StreamConfiguration::pixelFormat
  * \brief Stream pixel format
@@ -315,6 +403,22 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * format described in V4L2 using the V4L2_PIX_FMT_* definitions.
  */
 
+/**
+ * \var StreamConfiguration::modifier
+ * \brief Stream pixel format modifier
+ *
+ * The format modifier describes the memory layout of the frames, such as
+ * tiling or compression, with the values of the DRM format modifiers defined
+ * in drm_fourcc.h. The pixelFormat then describes the frame content
+ * independently of the layout. Tiled and compressed layouts reduce the memory
+ * bandwidth of devices that consume the frames, such as GPUs and video
+ * encoders, but can't be easily accessed by the CPU.
+ *
+ * The default value of 0 (DRM_FORMAT_MOD_LINEAR) selects a linear layout.
+ * Pipeline handlers adjust the modifier to a linear layout in validate() when
+ * they can't produce the requested layout for the pixel format.
+ */
+
 /**
  * \var StreamConfiguration::memoryType
  * \brief The memory type the stream shall use
@@ -323,6 +427,88 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
 /**
  * \var StreamConfiguration::bufferCount
  * \brief Requested number of buffers to allocate for the stream
+ *
+ * The pipeline handler sets the bufferCount to the recommended number of
+ * buffers for the stream when generating the configuration. Applications may
+ * change it to trade memory for latency, within the [minBufferCount,
+ * maxBufferCount] range. A value of 0 selects the recommended number of
+ * buffers.
+ */
+
+/**
+ * \var StreamConfiguration::minBufferCount
+ * \brief Minimum number of buffers supported by the stream
+ *
+ * This field is set by the pipeline handler when generating and validating the
+ * configuration. A value of 0 indicates that the limit is unknown.
+ */
+
+/**
+ * \var StreamConfiguration::maxBufferCount
+ * \brief Maximum number of buffers supported by the stream
+ *
+ * This field is set by the pipeline handler when generating and validating the
+ * configuration. A value of 0 indicates that the limit is unknown.
+ */
+
+/**
+ * \var StreamConfiguration::mapFlags
+ * \brief Hints for the CPU mappings of the stream buffers
+ *
+ * This field is a bitmask of Plane::MapFlag values applied to all planes of
+ * the stream buffers, both for internal and external memory. The buffers are
+ * mapped to the CPU when libcamera or the application access their memory
+ * through Plane::mem(). Populating the page tables at map time avoids page
+ * faults on the first frame, and huge pages reduce the TLB pressure on large
+ * frames. The default value of 0 maps the buffers lazily with small pages.
+ */
+
+/**
+ * \var StreamConfiguration::dropPolicy
+ * \brief The policy applied to completed requests the application can't keep
+ * up with
+ *
+ * The policy can be changed by configuring the camera again without any other
+ * change to the configuration, which doesn't reconfigure the device.
+ *
+ * \sa FrameDropPolicy
+ */
+
+/**
+ * \var StreamConfiguration::decimation
+ * \brief The number of frames captured by the camera for each frame produced
+ * on the stream
+ *
+ * Streams that don't need the full frame rate of the camera, such as an
+ * analysis stream captured alongside a video recording, can be decimated to
+ * produce one frame every \a decimation frames. Pipeline handlers that support
+ * decimation skip the other frames in hardware, and fill the stream buffer of
+ * a request only when at least \a decimation frames have been captured since
+ * the last frame produced on the stream. Buffers of requests for skipped
+ * frames are completed with the Buffer::BufferSkipped status, and requests
+ * don't need to contain a buffer for decimated streams.
+ *
+ * The default value of 1 produces all frames. Pipeline handlers that don't
+ * support decimation ignore this field, and produce a frame for every request
+ * that contains a buffer for the stream.
+ */
+
+/**
+ * \var StreamConfiguration::sliceHeight
+ * \brief The number of lines of the slices of a frame reported as they are
+ * written
+ *
+ * Applications that process frames line by line can start processing a frame
+ * before its buffer completes. When the slice height is not zero, pipeline
+ * handlers that support partial frame completion report the number of lines
+ * written to a buffer through the Camera::bufferProgressed signal, every
+ * \a sliceHeight lines, before the buffer completes. Pipeline handlers adjust
+ * the slice height to the granularity at which they write frames, and reset it
+ * to 0 for streams whose frames are written at once.
+ *
+ * The default value of 0 disables partial frame completion. Pipeline handlers
+ * that don't support it ignore this field, and only report the completion of
+ * the whole buffer.
  */
 
 /**
@@ -368,13 +554,38 @@ std::string StreamConfiguration::toString() const
 {
 	std::stringstream ss;
 
-	ss.fill(0);
-	ss << size.toString() << "-0x" << std::hex << std::setw(8)
-	   << pixelFormat;
+	ss << *this;
 
 	return ss.str();
 }
 
+/**
+ * \brief Insert a text representation of a StreamConfiguration into an output
+ * stream
+ * \param[in] out The output stream
+ * \param[in] cfg The stream configuration
+ *
+ * The configuration is formatted as its size followed by its pixel format, and
+ * its format modifier if any. The stream operator doesn't allocate temporary
+ * strings, and should be preferred over toString() when logging.
+ *
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const StreamConfiguration &cfg)
+{
+	out << cfg.size << "-" << PixelFormat(cfg.pixelFormat);
+
+	if (cfg.modifier) {
+		std::ios_base::fmtflags flags = out.flags();
+		char fill = out.fill('0');
+		out << "-0x" << std::hex << std::setw(16) << cfg.modifier;
+		out.fill(fill);
+		out.flags(flags);
+	}
+
+	return out;
+}
+
 /**
  * \enum StreamRole
  * \brief Identify the role a stream is intended to play
@@ -394,6 +605,13 @@ std::string StreamConfiguration::toString() const
  * The stream is intended to capture video for the purpose of display on the
  * local screen. Trade-offs between quality and usage of system resources are
  * acceptable.
+ * \var EmbeddedData
+ * The stream is intended to capture the embedded data output by the camera
+ * sensor along with every frame. Embedded data describes the sensor state,
+ * such as the exposure time and gain, the frame has been captured with. It
+ * shall be requested along with an image stream. The pixel format identifies
+ * the sensor-specific embedded data layout, and the size reports the number
+ * of bytes per line and the number of lines.
  */
 
 /**
@@ -423,6 +641,7 @@ std::string StreamConfiguration::toString() const
  * \brief Construct a stream with default parameters
  */
 Stream::Stream()
+	: cpuAccess_(false)
 {
 }
 
@@ -434,15 +653,15 @@ Stream::Stream()
  * the stream's buffers pool by its \a index. The index shall be lower than the
  * number of buffers in the pool.
  *
- * This method is only valid for streams that use the InternalMemory type. It
- * will return a null pointer when called on streams using the ExternalMemory
- * type.
+ * This method is only valid for streams that use the InternalMemory or
+ * UserPtrMemory types. It will return a null pointer when called on streams
+ * using the ExternalMemory type.
  *
  * \return A newly created Buffer on success or nullptr otherwise
  */
 std::unique_ptr<Buffer> Stream::createBuffer(unsigned int index)
 {
-	if (memoryType_ != InternalMemory) {
+	if (memoryType_ == ExternalMemory) {
 		LOG(Stream, Error) << "Invalid stream memory type";
 		return nullptr;
 	}
@@ -452,7 +671,7 @@ std::unique_ptr<Buffer> Stream::createBuffer(unsigned int index)
 		return nullptr;
 	}
 
-	Buffer *buffer = new Buffer();
+	Buffer *buffer = new (arena_.get()) Buffer();
 	buffer->index_ = index;
 	buffer->stream_ = this;
 
@@ -465,9 +684,10 @@ std::unique_ptr<Buffer> Stream::createBuffer(unsigned int index)
  * \param[in] fds The dmabuf file descriptors for each plane
  *
  * This method creates a Buffer instance that references buffer memory
- * allocated outside of libcamera through dmabuf file descriptors. The \a
- * dmabuf array shall contain a file descriptor for each plane in the buffer,
- * and unused entries shall be set to -1.
+ * allocated outside of libcamera through dmabuf file descriptors. The \a fds
+ * vector shall contain a file descriptor for each plane in the buffer. Planes
+ * may share the same dmabuf object, in which case a single CPU mapping is used
+ * for all of them. An entry set to -1 marks the end of the planes list.
  *
  * The buffer is created without a valid index, as it does not yet map to any of
  * the stream's BufferMemory instances. An index will be assigned at the time
@@ -483,14 +703,14 @@ std::unique_ptr<Buffer> Stream::createBuffer(unsigned int index)
  *
  * \return A newly created Buffer on success or nullptr otherwise
  */
-std::unique_ptr<Buffer> Stream::createBuffer(const std::array<int, 3> &fds)
+std::unique_ptr<Buffer> Stream::createBuffer(const std::vector<int> &fds)
 {
 	if (memoryType_ != ExternalMemory) {
 		LOG(Stream, Error) << "Invalid stream memory type";
 		return nullptr;
 	}
 
-	Buffer *buffer = new Buffer();
+	Buffer *buffer = new (arena_.get()) Buffer();
 	buffer->dmabuf_ = fds;
 	buffer->stream_ = this;
 
@@ -526,6 +746,30 @@ std::unique_ptr<Buffer> Stream::createBuffer(const std::array<int, 3> &fds)
  * \return The memory type used by the stream
  */
 
+/**
+ * \brief Retrieve the memory footprint of the stream buffers
+ *
+ * The memory of streams that use InternalMemory is reported as allocated. For
+ * streams that use ExternalMemory, the dmabufs imported from the application
+ * and cached in the stream buffer pool for CPU access are reported as
+ * imported, as is the application memory of streams that use UserPtrMemory.
+ *
+ * \return The memory usage of the stream
+ */
+MemoryUsage Stream::memoryUsage() const
+{
+	MemoryUsage usage;
+
+	if (memoryType_ == InternalMemory)
+		usage.allocated = bufferPool_.size();
+	else
+		usage.imported = bufferPool_.size();
+
+	usage.mapped = bufferPool_.mappedSize();
+
+	return usage;
+}
+
 /**
  * \brief Map a Buffer to a buffer memory index
  * \param[in] buffer The buffer to map to a buffer memory index
@@ -537,9 +781,28 @@ std::unique_ptr<Buffer> Stream::createBuffer(const std::array<int, 3> &fds)
  * The buffer memory to use, once the \a buffer reaches the video device,
  * is selected using the index assigned to the \a buffer and to minimize
  * relocations in the V4L2 back-end, this operation provides a best-effort
- * caching mechanism that associates to the dmabuf file descriptors contained
- * in the \a buffer the index of the buffer memory that was lastly queued with
- * those file descriptors set.
+ * caching mechanism that associates to the dmabuf objects referenced by the
+ * \a buffer the index of the buffer memory that was lastly queued with those
+ * dmabuf objects.
+ *
+ * Dmabuf objects are identified by the device and inode numbers of their file
+ * descriptors, as file descriptor numbers may be closed and reused to refer to
+ * a different dmabuf, and the same dmabuf may be referenced by different file
+ * descriptor numbers. When the \a buffer hits the cache the buffer memory is
+ * reused as-is. Otherwise the least recently used buffer memory is selected.
+ * The lookup is performed in constant time.
+ *
+ * Video devices queue the \a buffer dmabufs directly and don't need CPU access
+ * to the memory. The buffer memory planes are thus only populated with the
+ * \a buffer dmabufs, preserving their CPU mappings on cache hits, when the
+ * pipeline handler has requested CPU access to the stream buffers with
+ * PipelineHandler::setCpuAccess(). Otherwise the buffer memory has no plane,
+ * and the imported dmabufs are never mapped by libcamera.
+ *
+ * When the \a buffer has one dmabuf per colour plane of the stream pixel
+ * format, the length of each plane is computed from the stream configuration,
+ * and planes that share a dmabuf are laid out contiguously in it. A single
+ * dmabuf spans the whole frame.
  *
  * If the Stream uses internally allocated memory, the index of the memory
  * buffer to use will match the one request at Stream::createBuffer(unsigned int)
@@ -556,39 +819,48 @@ int Stream::mapBuffer(const Buffer *buffer)
 	if (bufferCache_.empty())
 		return -ENOMEM;
 
-	const std::array<int, 3> &dmabufs = buffer->dmabufs();
+	const std::vector<int> &dmabufs = buffer->dmabufs();
+	BufferKey key = bufferKey(dmabufs);
 
 	/*
-	 * Try to find a previously mapped buffer in the cache. If we miss, use
-	 * the oldest entry in the cache.
+	 * Try to find a previously mapped buffer in the cache. If we hit, the
+	 * buffer memory planes refer to the same dmabuf objects and can be
+	 * reused.
 	 */
-	auto map = std::find_if(bufferCache_.begin(), bufferCache_.end(),
-				[&](std::pair<std::array<int, 3>, unsigned int> &entry) {
-					return entry.first == dmabufs;
-				});
-	if (map == bufferCache_.end())
-		map = bufferCache_.begin();
+	auto hit = key != BufferKey{} ? bufferCacheMap_.find(key)
+				      : bufferCacheMap_.end();
+	if (hit != bufferCacheMap_.end()) {
+		unsigned int index = hit->second->index;
+		uncacheBuffer(hit->second);
+		return index;
+	}
 
 	/*
-	 * Update the dmabuf file descriptors of the entry. We can't assume that
-	 * identical file descriptor numbers refer to the same dmabuf object as
-	 * it may have been closed and its file descriptor reused. We thus need
-	 * to update the plane's internally cached mmap()ed memory.
+	 * If we miss, use the least recently used entry in the cache and
+	 * update the dmabuf file descriptors of its buffer memory.
 	 */
-	unsigned int index = map->second;
+	unsigned int index = bufferCache_.front().index;
+	uncacheBuffer(bufferCache_.begin());
+
+	bufferKeys_[index] = key;
+
+	if (!cpuAccess_)
+		return index;
+
 	BufferMemory *mem = &bufferPool_.buffers()[index];
 	mem->planes().clear();
 
-	for (unsigned int i = 0; i < dmabufs.size(); ++i) {
-		if (dmabufs[i] == -1)
-			break;
+	unsigned int count = std::find(dmabufs.begin(), dmabufs.end(), -1)
+			   - dmabufs.begin();
 
+	for (unsigned int i = 0; i < count; ++i) {
 		mem->planes().emplace_back();
-		mem->planes().back().setDmabuf(dmabufs[i], 0);
+		mem->planes().back().setDmabuf(dmabufs[i], planeLength(i, count));
+		mem->planes().back().setMapFlags(configuration_.mapFlags);
 	}
 
-	/* Remove the buffer from the cache and return its index. */
-	bufferCache_.erase(map);
+	mem->shareMappings();
+
 	return index;
 }
 
@@ -603,7 +875,8 @@ void Stream::unmapBuffer(const Buffer *buffer)
 {
 	ASSERT(memoryType_ == ExternalMemory);
 
-	bufferCache_.emplace_back(buffer->dmabufs(), buffer->index());
+	unsigned int index = buffer->index();
+	cacheBuffer(bufferKeys_[index], index);
 }
 
 /**
@@ -622,8 +895,17 @@ void Stream::createBuffers(MemoryType memory, unsigned int count)
 	memoryType_ = memory;
 	bufferPool_.createBuffers(count);
 
-	/* Streams with internal memory usage do not need buffer mapping. */
-	if (memoryType_ == InternalMemory)
+	/*
+	 * Carve the Buffer instances of the stream from a slab sized for the
+	 * buffer pool, so that creating and deleting them for every frame
+	 * doesn't allocate memory. Buffers still referencing the previous slab
+	 * keep it alive until they're deleted.
+	 */
+	arena_ = ObjectArena::create();
+	arena_->reserve(sizeof(Buffer), count);
+
+	/* Only streams with external memory need buffer mapping. */
+	if (memoryType_ != ExternalMemory)
 		return;
 
 	/*
@@ -631,8 +913,92 @@ void Stream::createBuffers(MemoryType memory, unsigned int count)
 	 * cache.
 	 */
 	bufferCache_.clear();
+	bufferCacheMap_.clear();
+	bufferKeys_.assign(count, BufferKey{});
 	for (unsigned int i = 0; i < bufferPool_.count(); ++i)
-		bufferCache_.emplace_back(std::array<int, 3>{ -1, -1, -1 }, i);
+		cacheBuffer(BufferKey{}, i);
+}
+
+std::size_t Stream::BufferKeyHash::operator()(const BufferKey &key) const
+{
+	std::size_t hash = 0;
+
+	for (uint64_t value : key)
+		hash = hash * 31 + std::hash<uint64_t>()(value);
+
+	return hash;
+}
+
+/*
+ * Compute the identity of the dmabuf objects referenced by a buffer, as a list
+ * of device and inode numbers. An empty key is returned when the identity
+ * can't be computed, which disables caching for the buffer.
+ */
+Stream::BufferKey Stream::bufferKey(const std::vector<int> &dmabufs)
+{
+	BufferKey key{};
+
+	if (dmabufs.size() > key.size() / 2)
+		return BufferKey{};
+
+	for (unsigned int i = 0; i < dmabufs.size(); ++i) {
+		if (dmabufs[i] == -1)
+			break;
+
+		std::pair<uint64_t, uint64_t> id;
+		if (!utils::dmabuf_identity(dmabufs[i], &id))
+			return BufferKey{};
+
+		key[i * 2] = id.first;
+		key[i * 2 + 1] = id.second;
+	}
+
+	return key;
+}
+
+/* Add a buffer memory entry to the cache as the most recently used entry. */
+void Stream::cacheBuffer(const BufferKey &key, unsigned int index)
+{
+	auto entry = bufferCache_.insert(bufferCache_.end(), { key, index });
+
+	if (key != BufferKey{})
+		bufferCacheMap_[key] = entry;
+}
+
+/* Remove a buffer memory entry from the cache. */
+void Stream::uncacheBuffer(BufferCache::iterator entry)
+{
+	auto iter = bufferCacheMap_.find(entry->key);
+	if (iter != bufferCacheMap_.end() && iter->second == entry)
+		bufferCacheMap_.erase(iter);
+
+	bufferCache_.erase(entry);
+}
+
+/*
+ * Compute the length of the imported \a plane, out of \a count planes, from
+ * the layout of the configured pixel format. Return 0 to span the whole dmabuf
+ * when the layout is unknown.
+ */
+unsigned int Stream::planeLength(unsigned int plane, unsigned int count) const
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(configuration_.pixelFormat);
+	if (count < 2 || !info.isValid() || info.compressed ||
+	    count != info.numPlanes())
+		return 0;
+
+	const Size &size = configuration_.size;
+	unsigned int stride = configuration_.stride
+			    ? configuration_.stride : info.stride(size.width);
+
+	/* The strides of the colour planes scale with their bytes per group. */
+	const PixelFormatInfo::Plane &layout = info.planes[plane];
+	stride = stride * layout.bytesPerGroup / info.planes[0].bytesPerGroup;
+
+	unsigned int height = (size.height + layout.verticalSubSampling - 1)
+			    / layout.verticalSubSampling;
+
+	return stride * height;
 }
 
 /**
@@ -646,6 +1012,21 @@ void Stream::destroyBuffers()
 	bufferPool_.destroyBuffers();
 }
 
+/**
+ * \brief Apply the configured CPU mapping hints to the stream buffers
+ *
+ * Set the mapping hints of all planes in the stream buffer pool to the
+ * StreamConfiguration::mapFlags of the stream configuration. The hints apply
+ * to the mappings created after this call.
+ */
+void Stream::updateMapFlags()
+{
+	for (BufferMemory &mem : bufferPool_.buffers()) {
+		for (Plane &plane : mem.planes())
+			plane.setMapFlags(configuration_.mapFlags);
+	}
+}
+
 /**
  * \var Stream::bufferPool_
  * \brief The pool of buffers associated with the stream
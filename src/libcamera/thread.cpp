@@ -8,13 +8,19 @@
 #include "thread.h"
 
 #include <atomic>
-#include <list>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <vector>
 
 #include <libcamera/event_dispatcher.h>
 
+#include "event_dispatcher_epoll.h"
 #include "event_dispatcher_poll.h"
 #include "log.h"
 #include "message.h"
+#include "utils.h"
 
 /**
  * \file thread.h
@@ -29,20 +35,174 @@ class ThreadMain;
 
 /**
  * \brief A queue of posted messages
+ *
+ * Messages are posted by any thread to a lock-free LIFO stack, without
+ * allocating memory. The stack is drained in one operation by collect(), which
+ * appends the posted messages in posting order to a FIFO list from which
+ * messages are dispatched. The list is linked through the messages themselves
+ * and is protected by the \ref mutex_.
  */
 class MessageQueue
 {
 public:
+	MessageQueue()
+		: posted_(nullptr), head_(nullptr), tail_(nullptr)
+	{
+	}
+
+	~MessageQueue()
+	{
+		MutexLocker locker(mutex_);
+
+		collect();
+		while (Message *msg = pop())
+			delete msg;
+	}
+
+	bool push(Message *msg);
+	void collect();
+	Message *pop();
+	std::vector<Message *> take(Object *receiver);
+
+	/**
+	 * \brief Stack of posted messages, newest first
+	 */
+	std::atomic<Message *> posted_;
+	/**
+	 * \brief First message of the list of collected messages
+	 */
+	Message *head_;
 	/**
-	 * \brief List of queued Message instances
+	 * \brief Last message of the list of collected messages
 	 */
-	std::list<std::unique_ptr<Message>> list_;
+	Message *tail_;
 	/**
-	 * \brief Protects the \ref list_
+	 * \brief Protects the \ref head_ and \ref tail_ list
 	 */
 	Mutex mutex_;
 };
 
+/**
+ * \brief Post a message to the queue
+ * \param[in] msg The message
+ *
+ * This method may be called from any thread without holding the \ref mutex_.
+ * The queue takes ownership of the message.
+ *
+ * Only the first message posted after the queue has been collected needs to
+ * wake up the thread, as all posted messages are collected together. The
+ * return value tells the caller whether it has to.
+ *
+ * \return True if the message is the first one posted since the last
+ * collection, false otherwise
+ */
+bool MessageQueue::push(Message *msg)
+{
+	Message *head = posted_.load(std::memory_order_relaxed);
+
+	do {
+		msg->next_ = head;
+	} while (!posted_.compare_exchange_weak(head, msg,
+						std::memory_order_release,
+						std::memory_order_relaxed));
+
+	return !head;
+}
+
+/**
+ * \brief Move all posted messages to the end of the list
+ *
+ * The caller shall hold the \ref mutex_.
+ */
+void MessageQueue::collect()
+{
+	Message *msg = posted_.exchange(nullptr, std::memory_order_acquire);
+	if (!msg)
+		return;
+
+	/* Reverse the stack to restore the posting order. */
+	Message *last = msg;
+	Message *first = nullptr;
+
+	while (msg) {
+		Message *next = msg->next_;
+		msg->next_ = first;
+		first = msg;
+		msg = next;
+	}
+
+	if (tail_)
+		tail_->next_ = first;
+	else
+		head_ = first;
+
+	tail_ = last;
+}
+
+/**
+ * \brief Remove the first message from the list
+ *
+ * The caller shall hold the \ref mutex_.
+ *
+ * \return The first message of the list, or nullptr if the list is empty
+ */
+Message *MessageQueue::pop()
+{
+	Message *msg = head_;
+	if (!msg)
+		return nullptr;
+
+	head_ = msg->next_;
+	if (!head_)
+		tail_ = nullptr;
+
+	msg->next_ = nullptr;
+	return msg;
+}
+
+/**
+ * \brief Remove all messages for the \a receiver from the queue
+ * \param[in] receiver The receiver
+ *
+ * The caller shall hold the \ref mutex_. Ownership of the messages is
+ * transferred to the caller.
+ *
+ * \return The messages for the \a receiver, in posting order
+ */
+std::vector<Message *> MessageQueue::take(Object *receiver)
+{
+	std::vector<Message *> messages;
+	Message *prev = nullptr;
+	Message *msg;
+
+	collect();
+
+	msg = head_;
+	while (msg) {
+		Message *next = msg->next_;
+
+		if (msg->receiver_ != receiver) {
+			prev = msg;
+			msg = next;
+			continue;
+		}
+
+		if (prev)
+			prev->next_ = next;
+		else
+			head_ = next;
+		if (tail_ == msg)
+			tail_ = prev;
+
+		msg->next_ = nullptr;
+		messages.push_back(msg);
+
+		msg = next;
+	}
+
+	return messages;
+}
+
 /**
  * \brief Thread-local internal data
  */
@@ -50,7 +210,9 @@ class ThreadData
 {
 public:
 	ThreadData()
-		: thread_(nullptr), running_(false), dispatcher_(nullptr)
+		: thread_(nullptr), running_(false), policy_(-1), priority_(0),
+		  dispatcher_(nullptr), budgetMessages_(DefaultBudgetMessages),
+		  budgetTime_(0)
 	{
 	}
 
@@ -60,19 +222,92 @@ private:
 	friend class Thread;
 	friend class ThreadMain;
 
+	static constexpr unsigned int DefaultBudgetMessages = 128;
+
+	void setDispatcher(EventDispatcher *dispatcher);
+
+	int applyName();
+	int applyAffinity();
+	int applyScheduling();
+
 	Thread *thread_;
 	bool running_;
 
+	pthread_t handle_;
+	std::string name_;
+	std::vector<unsigned int> cpus_;
+	int policy_;
+	int priority_;
+
 	Mutex mutex_;
 
 	std::atomic<EventDispatcher *> dispatcher_;
 
+	std::atomic<unsigned int> budgetMessages_;
+	std::atomic<int64_t> budgetTime_;
+
 	std::atomic<bool> exit_;
 	int exitCode_;
 
 	MessageQueue messages_;
 };
 
+/**
+ * \brief Install the event dispatcher
+ * \param[in] dispatcher The event dispatcher
+ *
+ * Messages posted before the dispatcher is installed don't interrupt it. Wake
+ * the dispatcher up in that case, to avoid blocking on events while messages
+ * are pending. The fence pairs with the one in Thread::postMessage(), ensuring
+ * that either the dispatcher sees the message, or the poster sees the
+ * dispatcher.
+ */
+void ThreadData::setDispatcher(EventDispatcher *dispatcher)
+{
+	dispatcher_.store(dispatcher, std::memory_order_release);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (messages_.posted_.load(std::memory_order_relaxed))
+		dispatcher->interrupt();
+}
+
+/*
+ * Apply the thread attributes to the running thread. The caller shall hold the
+ * mutex_.
+ */
+int ThreadData::applyName()
+{
+	if (name_.empty())
+		return 0;
+
+	return -pthread_setname_np(handle_, name_.c_str());
+}
+
+int ThreadData::applyAffinity()
+{
+	if (cpus_.empty())
+		return 0;
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	for (unsigned int cpu : cpus_)
+		CPU_SET(cpu, &cpuset);
+
+	return -pthread_setaffinity_np(handle_, sizeof(cpuset), &cpuset);
+}
+
+int ThreadData::applyScheduling()
+{
+	if (policy_ == -1)
+		return 0;
+
+	struct sched_param param = {};
+	param.sched_priority = priority_;
+
+	return -pthread_setschedparam(handle_, policy_, &param);
+}
+
 /**
  * \brief Thread wrapper for the main thread
  */
@@ -82,6 +317,7 @@ public:
 	ThreadMain()
 	{
 		data_->running_ = true;
+		data_->handle_ = pthread_self();
 	}
 
 protected:
@@ -131,8 +367,13 @@ ThreadData *ThreadData::current()
  *
  * Thread instances by default run an event loop until the exit() method is
  * called. A custom event dispatcher may be installed with
- * setEventDispatcher(), otherwise a poll-based event dispatcher is used. This
+ * setEventDispatcher(), otherwise an epoll-based event dispatcher is used. This
  * behaviour can be overriden by overloading the run() method.
+ *
+ * The name, CPU affinity and scheduling policy of the thread can be set with
+ * setName(), setAffinity() and setScheduling(), before or after the thread is
+ * started. Threads created by a thread inherit its CPU affinity and scheduling
+ * policy.
  */
 
 /**
@@ -165,6 +406,7 @@ void Thread::start()
 	data_->exit_.store(false, std::memory_order_relaxed);
 
 	thread_ = std::thread(&Thread::startThread, this);
+	data_->handle_ = thread_.native_handle();
 }
 
 void Thread::startThread()
@@ -191,6 +433,29 @@ void Thread::startThread()
 
 	currentThreadData = data_;
 
+	/*
+	 * Apply the thread attributes before running, in the context of the
+	 * thread to ensure they are effective when run() is called.
+	 */
+	{
+		MutexLocker locker(data_->mutex_);
+
+		int ret = data_->applyName();
+		if (ret)
+			LOG(Thread, Warning)
+				<< "Failed to set thread name: " << strerror(-ret);
+
+		ret = data_->applyAffinity();
+		if (ret)
+			LOG(Thread, Warning)
+				<< "Failed to set thread affinity: " << strerror(-ret);
+
+		ret = data_->applyScheduling();
+		if (ret)
+			LOG(Thread, Warning)
+				<< "Failed to set thread scheduling: " << strerror(-ret);
+	}
+
 	run();
 }
 
@@ -202,6 +467,9 @@ void Thread::startThread()
  * called within the thread from the run() method and shall not be called
  * outside of the thread.
  *
+ * Messages posted to the thread are delivered by the event dispatcher within
+ * the dispatch budget, see setDispatchBudget().
+ *
  * \return The exit code passed to the exit() method
  */
 int Thread::exec()
@@ -212,10 +480,8 @@ int Thread::exec()
 
 	locker.unlock();
 
-	while (!data_->exit_.load(std::memory_order_acquire)) {
-		dispatchMessages();
+	while (!data_->exit_.load(std::memory_order_acquire))
 		dispatcher->processEvents();
-	}
 
 	locker.lock();
 
@@ -295,6 +561,114 @@ bool Thread::isRunning()
 	return data_->running_;
 }
 
+/**
+ * \brief Set the thread name
+ * \param[in] name The thread name
+ *
+ * The name identifies the thread in debugging and monitoring tools. It is
+ * truncated to 15 characters, the limit imposed by the kernel. If the thread
+ * isn't running, the name is applied when the thread is started.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Thread::setName(const std::string &name)
+{
+	MutexLocker locker(data_->mutex_);
+
+	data_->name_ = name.substr(0, 15);
+	if (!data_->running_)
+		return 0;
+
+	return data_->applyName();
+}
+
+/**
+ * \brief Set the CPU affinity of the thread
+ * \param[in] cpus The CPUs the thread is allowed to run on
+ *
+ * Restrict the thread to run on the \a cpus, identified by their index. An
+ * empty list leaves the affinity unchanged. If the thread isn't running, the
+ * affinity is applied when the thread is started.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL A CPU index is invalid
+ */
+int Thread::setAffinity(const std::vector<unsigned int> &cpus)
+{
+	for (unsigned int cpu : cpus) {
+		if (cpu >= CPU_SETSIZE)
+			return -EINVAL;
+	}
+
+	MutexLocker locker(data_->mutex_);
+
+	data_->cpus_ = cpus;
+	if (!data_->running_)
+		return 0;
+
+	return data_->applyAffinity();
+}
+
+/**
+ * \brief Set the scheduling policy and priority of the thread
+ * \param[in] policy The scheduling policy (SCHED_OTHER, SCHED_FIFO or
+ * SCHED_RR)
+ * \param[in] priority The static priority, in the range supported by the
+ * \a policy
+ *
+ * Real-time policies usually require the CAP_SYS_NICE capability or an
+ * appropriate RLIMIT_RTPRIO limit. If the thread isn't running, the policy is
+ * applied when the thread is started, and failures are only logged.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The policy or priority is invalid
+ * \retval -EPERM The caller isn't allowed to set the policy
+ */
+int Thread::setScheduling(int policy, int priority)
+{
+	if (policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR)
+		return -EINVAL;
+
+	if (priority < sched_get_priority_min(policy) ||
+	    priority > sched_get_priority_max(policy))
+		return -EINVAL;
+
+	MutexLocker locker(data_->mutex_);
+
+	data_->policy_ = policy;
+	data_->priority_ = priority;
+	if (!data_->running_)
+		return 0;
+
+	return data_->applyScheduling();
+}
+
+/**
+ * \brief Set the budget of messages dispatched per event loop iteration
+ * \param[in] messages The maximum number of messages, 0 for no limit
+ * \param[in] time The maximum time spent dispatching messages, 0 for no limit
+ *
+ * The event dispatcher delivers the messages posted to the thread with
+ * dispatchMessageBatch() after processing events and timers. To keep the
+ * latency of event processing bounded under bursts of messages, the number
+ * of messages delivered per event loop iteration and the time spent
+ * delivering them are limited by the budget. The remaining messages are
+ * delivered by the next iterations, interleaved with events and timers.
+ *
+ * The time budget is checked after every message, a single message that
+ * takes longer than the budget is always delivered. The default budget is 128
+ * messages without a time limit.
+ *
+ * This method may be called from any thread.
+ */
+void Thread::setDispatchBudget(unsigned int messages,
+			       std::chrono::microseconds time)
+{
+	data_->budgetMessages_.store(messages, std::memory_order_relaxed);
+	data_->budgetTime_.store(std::chrono::nanoseconds(time).count(),
+				 std::memory_order_relaxed);
+}
+
 /**
  * \var Thread::finished
  * \brief Signal the end of thread execution
@@ -318,7 +692,7 @@ Thread *Thread::current()
  * event notification and timers with the loop. Users that want to provide
  * their own event dispatcher shall call this method once and only once before
  * the thread is started with start(). If no event dispatcher is provided, a
- * default poll-based implementation will be used.
+ * default epoll-based implementation will be used.
  *
  * The Thread takes ownership of the event dispatcher and will delete it when
  * the thread is destroyed.
@@ -330,16 +704,19 @@ void Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
 		return;
 	}
 
-	data_->dispatcher_.store(dispatcher.release(),
-				 std::memory_order_relaxed);
+	data_->setDispatcher(dispatcher.release());
 }
 
 /**
  * \brief Retrieve the event dispatcher
  *
  * This method retrieves the event dispatcher set with setEventDispatcher().
- * If no dispatcher has been set, a default poll-based implementation is created
- * and returned, and no custom event dispatcher may be installed anymore.
+ * If no dispatcher has been set, a default implementation is created and
+ * returned, and no custom event dispatcher may be installed anymore.
+ *
+ * The default implementation is based on epoll. The poll-based implementation
+ * can be selected instead by setting the LIBCAMERA_EVENT_DISPATCHER
+ * environment variable to "poll".
  *
  * The returned event dispatcher is valid until the thread is destroyed.
  *
@@ -347,9 +724,17 @@ void Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
  */
 EventDispatcher *Thread::eventDispatcher()
 {
-	if (!data_->dispatcher_.load(std::memory_order_relaxed))
-		data_->dispatcher_.store(new EventDispatcherPoll(),
-					 std::memory_order_release);
+	if (!data_->dispatcher_.load(std::memory_order_relaxed)) {
+		EventDispatcher *dispatcher;
+
+		const char *type = utils::secure_getenv("LIBCAMERA_EVENT_DISPATCHER");
+		if (type && !strcmp(type, "poll"))
+			dispatcher = new EventDispatcherPoll();
+		else
+			dispatcher = new EventDispatcherEpoll();
+
+		data_->setDispatcher(dispatcher);
+	}
 
 	return data_->dispatcher_.load(std::memory_order_relaxed);
 }
@@ -367,6 +752,10 @@ EventDispatcher *Thread::eventDispatcher()
  * running its event loop the message will not be delivered until the event
  * loop gets started.
  *
+ * Wakeups are coalesced: only the message that finds the queue empty
+ * interrupts the event dispatcher, the messages posted until the thread
+ * collects the queue are delivered by the same wakeup.
+ *
  * If the \a receiver is not bound to this thread the behaviour is undefined.
  *
  * \sa exec()
@@ -377,10 +766,12 @@ void Thread::postMessage(std::unique_ptr<Message> msg, Object *receiver)
 
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
-	data_->messages_.list_.push_back(std::move(msg));
 	receiver->pendingMessages_++;
-	locker.unlock();
+	if (!data_->messages_.push(msg.release()))
+		return;
+
+	/* Pairs with the fence in ThreadData::setDispatcher(). */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
 
 	EventDispatcher *dispatcher =
 		data_->dispatcher_.load(std::memory_order_acquire);
@@ -398,24 +789,19 @@ void Thread::removeMessages(Object *receiver)
 {
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
+	MessageQueue &queue = data_->messages_;
+
+	MutexLocker locker(queue.mutex_);
 	if (!receiver->pendingMessages_)
 		return;
 
+	/*
+	 * Move the messages to the pending deletion list to delete them after
+	 * releasing the lock.
+	 */
 	std::vector<std::unique_ptr<Message>> toDelete;
-	for (std::unique_ptr<Message> &msg : data_->messages_.list_) {
-		if (!msg)
-			continue;
-		if (msg->receiver_ != receiver)
-			continue;
-
-		/*
-		 * Move the message to the pending deletion list to delete it
-		 * after releasing the lock. The messages list element will
-		 * contain a null pointer, and will be removed when dispatching
-		 * messages.
-		 */
-		toDelete.push_back(std::move(msg));
+	for (Message *msg : queue.take(receiver)) {
+		toDelete.emplace_back(msg);
 		receiver->pendingMessages_--;
 	}
 
@@ -427,26 +813,105 @@ void Thread::removeMessages(Object *receiver)
 
 /**
  * \brief Dispatch all posted messages for this thread
+ * \param[in] receiver Dispatch messages for this receiver only, or all messages
+ * if null
+ *
+ * All the messages posted before this method is called are dispatched.
+ * Messages posted while dispatching will be dispatched by the next call.
+ *
+ * When a \a receiver is specified, its messages are dispatched immediately in
+ * posting order, and messages for other receivers are left in the queue. This
+ * method shall be called from the thread's context.
  */
-void Thread::dispatchMessages()
+void Thread::dispatchMessages(Object *receiver)
 {
-	MutexLocker locker(data_->messages_.mutex_);
+	MessageQueue &queue = data_->messages_;
 
-	while (!data_->messages_.list_.empty()) {
-		std::unique_ptr<Message> msg = std::move(data_->messages_.list_.front());
-		data_->messages_.list_.pop_front();
-		if (!msg)
-			continue;
+	MutexLocker locker(queue.mutex_);
 
-		Object *receiver = msg->receiver_;
+	if (receiver) {
 		ASSERT(data_ == receiver->thread()->data_);
 
+		std::vector<Message *> messages = queue.take(receiver);
 		locker.unlock();
-		receiver->message(msg.get());
+
+		for (Message *next : messages) {
+			std::unique_ptr<Message> msg(next);
+			receiver->message(msg.get());
+			receiver->pendingMessages_--;
+		}
+
+		return;
+	}
+
+	locker.unlock();
+
+	dispatchQueue(0, std::chrono::nanoseconds(0));
+}
+
+/**
+ * \brief Dispatch the posted messages within the thread dispatch budget
+ *
+ * This method dispatches the messages posted to the thread, in posting order,
+ * until the budget set by setDispatchBudget() is exhausted. If messages remain
+ * in the queue, the thread's event dispatcher is interrupted to deliver them
+ * in the next event loop iteration, after processing the pending events and
+ * timers.
+ *
+ * This method is called by the event dispatchers at the end of every event
+ * loop iteration, and shall be called from the thread's context.
+ */
+void Thread::dispatchMessageBatch()
+{
+	unsigned int messages = data_->budgetMessages_.load(std::memory_order_relaxed);
+	std::chrono::nanoseconds time(data_->budgetTime_.load(std::memory_order_relaxed));
+
+	if (!dispatchQueue(messages, time))
+		return;
+
+	EventDispatcher *dispatcher =
+		data_->dispatcher_.load(std::memory_order_relaxed);
+	if (dispatcher)
+		dispatcher->interrupt();
+}
+
+/*
+ * Dispatch the posted messages, stopping after the given number of messages or
+ * time if not zero. Return true if messages remain in the queue.
+ */
+bool Thread::dispatchQueue(unsigned int messages, std::chrono::nanoseconds time)
+{
+	MessageQueue &queue = data_->messages_;
+	std::chrono::steady_clock::time_point start;
+	unsigned int count = 0;
+
+	if (time.count())
+		start = std::chrono::steady_clock::now();
+
+	MutexLocker locker(queue.mutex_);
+
+	queue.collect();
+
+	while (Message *next = queue.pop()) {
+		std::unique_ptr<Message> msg(next);
+
+		Object *object = msg->receiver_;
+		ASSERT(data_ == object->thread()->data_);
+
+		locker.unlock();
+		object->message(msg.get());
 		locker.lock();
 
-		receiver->pendingMessages_--;
+		object->pendingMessages_--;
+
+		if (messages && ++count >= messages)
+			break;
+
+		if (time.count() && std::chrono::steady_clock::now() - start >= time)
+			break;
 	}
+
+	return queue.head_ != nullptr;
 }
 
 /**
@@ -462,19 +927,32 @@ void Thread::moveObject(Object *object)
 	MutexLocker lockerTo(targetData->mutex_, std::defer_lock);
 	std::lock(lockerFrom, lockerTo);
 
-	/* Move pending messages to the message queue of the new thread. */
+	/*
+	 * Move pending messages to the message queue of the new thread, and
+	 * wake it up if the queue was empty.
+	 */
+	bool wakeup = false;
+
 	if (object->pendingMessages_) {
-		for (std::unique_ptr<Message> &msg : currentData->messages_.list_) {
-			if (!msg)
-				continue;
-			if (msg->receiver_ != object)
-				continue;
+		MessageQueue &from = currentData->messages_;
+		MessageQueue &to = targetData->messages_;
 
-			targetData->messages_.list_.push_back(std::move(msg));
-		}
+		MutexLocker queueLocker(from.mutex_);
+
+		for (Message *msg : from.take(object))
+			wakeup |= to.push(msg);
 	}
 
 	object->thread_ = this;
+
+	if (wakeup) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		EventDispatcher *dispatcher =
+			targetData->dispatcher_.load(std::memory_order_acquire);
+		if (dispatcher)
+			dispatcher->interrupt();
+	}
 }
 
 }; /* namespace libcamera */
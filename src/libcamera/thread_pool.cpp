@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * thread_pool.cpp - Pool of worker threads
+ */
+
+#include "thread_pool.h"
+
+#include "utils.h"
+
+/**
+ * \file thread_pool.h
+ * \brief Pool of worker threads
+ */
+
+namespace libcamera {
+
+/* A pool worker, running work items instead of an event loop. */
+class ThreadPool::Worker : public Thread
+{
+public:
+	Worker(ThreadPool *pool, unsigned int index)
+		: pool_(pool), index_(index)
+	{
+	}
+
+protected:
+	void run() override
+	{
+		pool_->runWorker(index_);
+	}
+
+private:
+	ThreadPool *pool_;
+	unsigned int index_;
+};
+
+/**
+ * \class ThreadPool
+ * \brief Run CPU-intensive work items on a group of worker threads
+ *
+ * The ThreadPool class spreads work items, such as format conversion, software
+ * image processing algorithms or file writing, across a fixed number of worker
+ * Thread instances. Work items are queued with queue() and are distributed to
+ * the workers in a round-robin fashion. Each worker has its own work queue, and
+ * a worker that runs out of work steals the most recently queued items from the
+ * other workers, which keeps all workers busy when work items have uneven
+ * durations.
+ *
+ * Completion of every work item is reported through the \ref completed signal,
+ * emitted from the worker thread that ran the item. As for any signal, slots of
+ * Object instances are invoked in the thread the object is bound to, completion
+ * is thus reported in the caller's thread when the receiver is an Object
+ * living in that thread. Other slots are invoked directly in the worker
+ * thread.
+ *
+ * Work items run concurrently and in no particular order, they shall thus
+ * protect the data they share with other work items. Workers don't run an
+ * event loop, objects shall not be moved to their threads.
+ */
+
+/**
+ * \brief Create a thread pool and start its workers
+ * \param[in] size The number of worker threads, or 0 to create one worker for
+ * each CPU core
+ */
+ThreadPool::ThreadPool(unsigned int size)
+	: next_(0), pending_(0), outstanding_(0), stopping_(false)
+{
+	if (!size)
+		size = std::thread::hardware_concurrency();
+	if (!size)
+		size = 1;
+
+	for (unsigned int i = 0; i < size; ++i) {
+		queues_.push_back(utils::make_unique<WorkQueue>());
+		workers_.push_back(utils::make_unique<Worker>(this, i));
+	}
+
+	for (unsigned int i = 0; i < workers_.size(); ++i) {
+		workers_[i]->setName("pool-" + std::to_string(i));
+		workers_[i]->start();
+	}
+}
+
+/**
+ * \brief Destroy the thread pool
+ *
+ * All work items queued to the pool are run before the workers are stopped.
+ * The \ref completed signal is emitted for every item, receivers shall thus
+ * not be destroyed before the pool.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		MutexLocker locker(mutex_);
+		stopping_ = true;
+	}
+
+	workAvailable_.notify_all();
+
+	for (std::unique_ptr<Worker> &worker : workers_)
+		worker->wait();
+}
+
+/**
+ * \fn ThreadPool::size()
+ * \brief Retrieve the number of worker threads
+ * \return The number of worker threads
+ */
+
+/**
+ * \brief Queue a work item
+ * \param[in] work The work item
+ * \param[in] cookie Cookie reported by the \ref completed signal
+ *
+ * The work item is run in one of the worker threads as soon as a worker is
+ * available. This method may be called from any thread, including from work
+ * items.
+ */
+void ThreadPool::queue(std::function<void()> work, uint64_t cookie)
+{
+	MutexLocker locker(mutex_);
+
+	WorkQueue *queue = queues_[next_].get();
+	next_ = (next_ + 1) % queues_.size();
+
+	{
+		MutexLocker queueLocker(queue->mutex);
+		queue->work.push_back({ std::move(work), cookie });
+	}
+
+	pending_++;
+	outstanding_++;
+
+	locker.unlock();
+	workAvailable_.notify_one();
+}
+
+/**
+ * \brief Wait for all queued work items to complete
+ *
+ * This method blocks until all work items queued to the pool have been run and
+ * their completion has been signalled. It shall not be called from a work
+ * item.
+ */
+void ThreadPool::wait()
+{
+	MutexLocker locker(mutex_);
+	idle_.wait(locker, [&]() { return !outstanding_; });
+}
+
+/**
+ * \var ThreadPool::completed
+ * \brief Signal emitted when a work item has completed
+ *
+ * The signal carries the cookie passed to queue() for the work item.
+ */
+
+void ThreadPool::runWorker(unsigned int index)
+{
+	while (true) {
+		{
+			MutexLocker locker(mutex_);
+			workAvailable_.wait(locker, [&]() {
+				return pending_ || stopping_;
+			});
+
+			if (!pending_)
+				return;
+
+			/* Reserve one of the queued work items. */
+			pending_--;
+		}
+
+		Work work = take(index);
+		work.func();
+		completed.emit(work.cookie);
+
+		MutexLocker locker(mutex_);
+		if (!--outstanding_) {
+			locker.unlock();
+			idle_.notify_all();
+		}
+	}
+}
+
+/*
+ * Take a work item reserved by the caller, from the front of the worker's own
+ * queue if available, or steal it from the back of the other workers' queues.
+ * As work items are pushed to the queues before being accounted as pending, a
+ * reserved item is always present in one of the queues.
+ */
+ThreadPool::Work ThreadPool::take(unsigned int index)
+{
+	while (true) {
+		WorkQueue *own = queues_[index].get();
+		{
+			MutexLocker locker(own->mutex);
+			if (!own->work.empty()) {
+				Work work = std::move(own->work.front());
+				own->work.pop_front();
+				return work;
+			}
+		}
+
+		for (unsigned int i = 1; i < queues_.size(); ++i) {
+			WorkQueue *queue = queues_[(index + i) % queues_.size()].get();
+
+			MutexLocker locker(queue->mutex);
+			if (!queue->work.empty()) {
+				Work work = std::move(queue->work.back());
+				queue->work.pop_back();
+				return work;
+			}
+		}
+	}
+}
+
+} /* namespace libcamera */
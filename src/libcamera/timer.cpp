@@ -7,12 +7,13 @@
 
 #include <libcamera/timer.h>
 
-#include <time.h>
+#include <algorithm>
 
 #include <libcamera/camera_manager.h>
 #include <libcamera/event_dispatcher.h>
 
 #include "log.h"
+#include "utils.h"
 
 /**
  * \file timer.h
@@ -25,21 +26,26 @@ LOG_DEFINE_CATEGORY(Timer)
 
 /**
  * \class Timer
- * \brief Single-shot timer interface
+ * \brief Single-shot and periodic timer interface
  *
- * The Timer class models a single-shot timer that is started with start() and
- * emits the \ref timeout signal when it times out.
+ * The Timer class models a timer that is started with start() and emits the
+ * \ref timeout signal when it times out. Single-shot timers run until they
+ * time out, and can then be started again with start(). Periodic timers,
+ * started with startPeriodic(), time out repeatedly until they are stopped.
  *
- * Once started the timer will run until it times out. It can be stopped with
- * stop(), and once it times out or is stopped, can be started again with
- * start().
+ * Timers are backed by a timerfd armed with absolute deadlines on the
+ * CLOCK_MONOTONIC clock, which is also the clock of std::chrono::steady_clock,
+ * and have a nanosecond resolution. Their precision is only limited by the
+ * wakeup latency of the event dispatcher.
+ *
+ * A running timer can be stopped with stop().
  */
 
 /**
  * \brief Construct a timer
  */
 Timer::Timer()
-	: interval_(0), deadline_(0)
+	: interval_(0), deadline_(0), periodic_(false)
 {
 }
 
@@ -56,15 +62,83 @@ Timer::~Timer()
  */
 void Timer::start(unsigned int msec)
 {
-	struct timespec tp;
-	clock_gettime(CLOCK_MONOTONIC, &tp);
+	start(std::chrono::milliseconds(msec));
+}
+
+/**
+ * \brief Start or restart the timer with a timeout of \a duration
+ * \param[in] duration The timer duration
+ *
+ * If the timer is already running it will be stopped and restarted.
+ */
+void Timer::start(std::chrono::nanoseconds duration)
+{
+	interval_ = std::max(duration, std::chrono::nanoseconds(0));
+	periodic_ = false;
 
-	interval_ = msec;
-	deadline_ = tp.tv_sec * 1000000000ULL + tp.tv_nsec + msec * 1000000ULL;
+	registerDeadline(utils::monotonic_ns() + interval_.count());
+}
+
+/**
+ * \brief Start or restart the timer with an absolute \a deadline
+ * \param[in] deadline The time at which the timer shall time out
+ *
+ * Deadlines in the past cause the timer to time out immediately. If the timer
+ * is already running it will be stopped and restarted.
+ */
+void Timer::start(std::chrono::steady_clock::time_point deadline)
+{
+	int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		deadline.time_since_epoch()).count();
+	uint64_t now = utils::monotonic_ns();
+	uint64_t target = std::max<int64_t>(time, 1);
+
+	interval_ = std::chrono::nanoseconds(target > now ? target - now : 0);
+	periodic_ = false;
+
+	registerDeadline(target);
+}
+
+/**
+ * \brief Start or restart the timer with a periodic timeout of \a period
+ * \param[in] period The timer period
+ *
+ * The timer times out every \a period from the time it is started, until it is
+ * stopped. The deadlines are computed from the previous deadline, and not from
+ * the time the timeout signal is emitted, to avoid accumulating drift. If the
+ * dispatch of the timeout is delayed beyond the next deadlines, the missed
+ * expirations are skipped.
+ *
+ * If the timer is already running it will be stopped and restarted.
+ */
+void Timer::startPeriodic(std::chrono::nanoseconds period)
+{
+	if (period.count() <= 0) {
+		LOG(Timer, Error) << "Invalid timer period " << period.count();
+		return;
+	}
+
+	interval_ = period;
+	periodic_ = true;
+
+	registerDeadline(utils::monotonic_ns() + period.count());
+}
+
+void Timer::registerDeadline(uint64_t deadline)
+{
+	/*
+	 * Event dispatchers index timers by deadline, stop the timer before
+	 * updating it.
+	 */
+	if (isRunning())
+		stop();
+
+	deadline_ = deadline;
 
 	LOG(Timer, Debug)
 		<< "Starting timer " << this << " with interval "
-		<< msec << ": deadline " << deadline_;
+		<< interval_.count() << "ns: deadline " << deadline_
+		<< (periodic_ ? " (periodic)" : "");
 
 	CameraManager::instance()->eventDispatcher()->registerTimer(this);
 }
@@ -94,10 +168,24 @@ bool Timer::isRunning() const
 }
 
 /**
- * \fn Timer::interval()
+ * \fn Timer::isPeriodic()
+ * \brief Check if the timer is periodic
+ * \return True if the timer has been started with startPeriodic(), false
+ * otherwise
+ */
+
+/**
  * \brief Retrieve the timer interval
- * \return The timer interval in milliseconds
+ *
+ * The interval is the duration of single-shot timers, measured from the time
+ * they are started, or the period of periodic timers.
+ *
+ * \return The timer interval in milliseconds, rounded up
  */
+unsigned int Timer::interval() const
+{
+	return (interval_.count() + 999999) / 1000000;
+}
 
 /**
  * \fn Timer::deadline()
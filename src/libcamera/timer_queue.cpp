@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * timer_queue.cpp - Ordered queue of timers backed by a timerfd
+ */
+
+#include "timer_queue.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <libcamera/timer.h>
+
+#include "event_dispatcher_monitor.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file timer_queue.h
+ * \brief Ordered queue of timers backed by a timerfd
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+/**
+ * \class TimerQueue
+ * \brief Ordered queue of timers for event dispatchers
+ *
+ * The TimerQueue class stores the timers registered with an event dispatcher
+ * sorted by deadline, and provides a timerfd armed with the deadline of the
+ * first timer to expire. Event dispatchers monitor the timerfd along with the
+ * event notifiers' file descriptors instead of computing a timeout for every
+ * wait.
+ *
+ * Timers are indexed by their deadline, making insertion and removal
+ * logarithmic in the number of registered timers. A timer's deadline shall
+ * thus not be modified while the timer is in the queue.
+ */
+
+/**
+ * \brief Construct a timer queue
+ *
+ * Failure to create the timerfd is fatal, as the event dispatchers can't
+ * implement timers without it.
+ */
+TimerQueue::TimerQueue()
+	: armedDeadline_(0)
+{
+	fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd_ < 0)
+		LOG(Event, Fatal) << "Unable to create timerfd";
+}
+
+TimerQueue::~TimerQueue()
+{
+	close(fd_);
+}
+
+/**
+ * \fn TimerQueue::fd()
+ * \brief Retrieve the timerfd file descriptor
+ *
+ * The file descriptor becomes readable when the first timer in the queue
+ * expires. Event dispatchers shall then call handleEvent().
+ *
+ * \return The timerfd file descriptor
+ */
+
+/**
+ * \brief Add a \a timer to the queue
+ * \param[in] timer The timer
+ */
+void TimerQueue::add(Timer *timer)
+{
+	timers_.emplace(timer->deadline(), timer);
+}
+
+/**
+ * \brief Remove a \a timer from the queue
+ * \param[in] timer The timer
+ *
+ * If the \a timer isn't in the queue this method performs no operation.
+ */
+void TimerQueue::remove(Timer *timer)
+{
+	timers_.erase(Entry(timer->deadline(), timer));
+}
+
+/**
+ * \brief Arm the timerfd with the deadline of the first timer in the queue
+ *
+ * This method shall be called by the event dispatcher before waiting for
+ * events. The timerfd is disarmed if the queue is empty, and is only
+ * reprogrammed when the first deadline changes.
+ */
+void TimerQueue::arm()
+{
+	uint64_t deadline = !timers_.empty() ? timers_.begin()->first : 0;
+	if (deadline == armedDeadline_)
+		return;
+
+	struct itimerspec its = {};
+	its.it_value.tv_sec = deadline / 1000000000ULL;
+	its.it_value.tv_nsec = deadline % 1000000000ULL;
+
+	int ret = timerfd_settime(fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+	if (ret < 0) {
+		LOG(Event, Error)
+			<< "Unable to arm timerfd: " << strerror(errno);
+		return;
+	}
+
+	armedDeadline_ = deadline;
+
+	LOG(Event, Debug) << "timerfd deadline " << deadline;
+}
+
+/**
+ * \brief Handle a timerfd event
+ *
+ * This method shall be called by the event dispatcher when the timerfd is
+ * readable. It clears the event and ensures the timerfd will be rearmed by the
+ * next call to arm().
+ */
+void TimerQueue::handleEvent()
+{
+	uint64_t expirations;
+	ssize_t ret = read(fd_, &expirations, sizeof(expirations));
+	if (ret != sizeof(expirations) && !(ret < 0 && errno == EAGAIN)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process timerfd (" << ret << ")";
+	}
+
+	armedDeadline_ = 0;
+}
+
+/**
+ * \brief Stop all expired timers and emit their timeout signal
+ * \param[in] monitor The monitor of the event dispatcher owning the queue
+ */
+void TimerQueue::processTimers(EventDispatcherMonitor *monitor)
+{
+	uint64_t now = utils::monotonic_ns();
+
+	while (!timers_.empty()) {
+		Timer *timer = timers_.begin()->second;
+		if (timer->deadline() > now)
+			break;
+
+		timers_.erase(timers_.begin());
+
+		if (timer->isPeriodic()) {
+			/*
+			 * Advance the deadline by a whole number of periods,
+			 * skipping the missed expirations, to avoid
+			 * accumulating the dispatch latency.
+			 */
+			uint64_t period = timer->interval_.count();
+			timer->deadline_ += ((now - timer->deadline_) / period + 1) * period;
+			timers_.emplace(timer->deadline_, timer);
+		} else {
+			timer->stop();
+		}
+
+		monitor->emit(timer->timeout, timer, "timer", -1);
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * tracer.cpp - Frame latency tracing
+ */
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <stdlib.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/request.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file tracer.h
+ * \brief Frame latency tracing
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Trace)
+
+/**
+ * \class Tracer
+ * \brief Record the processing stages of frames through the pipeline
+ *
+ * The Tracer class records timestamped events at the main stages of request
+ * and buffer processing in a ring buffer, to attribute the capture latency to
+ * the individual stages of the pipeline. Events are associated with the
+ * request they relate to, and identify their source, either a camera or a
+ * video device.
+ *
+ * Tracing is disabled by default, and is enabled by setting the
+ * LIBCAMERA_TRACE environment variable to the number of events to store in the
+ * ring buffer. When the ring buffer is full the oldest events are overwritten.
+ * The recorded events are dumped through the Trace log category, at the Info
+ * level, when a camera is stopped. For every event the dump reports the time
+ * elapsed since the request has been queued, and since the previous event for
+ * the same request.
+ *
+ * When tracing is disabled recording an event only costs a check of the
+ * enabled() state, which callers shall perform before calling record().
+ *
+ * Events can be recorded from any thread. Dumping the events while events are
+ * being recorded may however produce inconsistent records.
+ */
+
+/**
+ * \enum Tracer::Event
+ * \brief The frame processing stages
+ * \var Tracer::QueueRequest
+ * A request has been queued to a camera by the application
+ * \var Tracer::QueueBuffer
+ * A buffer has been queued to a video device with VIDIOC_QBUF
+ * \var Tracer::DequeueBuffer
+ * A buffer has been dequeued from a video device with VIDIOC_DQBUF
+ * \var Tracer::CompleteBuffer
+ * A buffer has been completed by the pipeline handler
+ * \var Tracer::CompleteRequest
+ * A request has been completed by the pipeline handler
+ * \var Tracer::StartCamera
+ * A camera is being started by the application
+ * \var Tracer::StreamOn
+ * A video device has been started with VIDIOC_STREAMON
+ * \var Tracer::CameraStarted
+ * The pipeline handler has completed starting a camera
+ */
+
+static const char *eventNames[] = {
+	"queue-request",
+	"qbuf",
+	"dqbuf",
+	"complete-buffer",
+	"complete-request",
+	"start",
+	"streamon",
+	"started",
+};
+
+Tracer::Tracer()
+	: position_(0)
+{
+	const char *size = utils::secure_getenv("LIBCAMERA_TRACE");
+	if (!size)
+		return;
+
+	char *endptr;
+	unsigned long count = strtoul(size, &endptr, 10);
+	if (*endptr != '\0' || !count) {
+		LOG(Trace, Warning)
+			<< "Invalid trace buffer size '" << size << "'";
+		return;
+	}
+
+	records_.resize(count);
+}
+
+/**
+ * \brief Retrieve the tracer instance
+ * \return The tracer instance
+ */
+Tracer *Tracer::instance()
+{
+	static Tracer tracer;
+	return &tracer;
+}
+
+/**
+ * \fn Tracer::enabled()
+ * \brief Check if tracing is enabled
+ * \return True if tracing is enabled, false otherwise
+ */
+
+/**
+ * \brief Register an event source
+ * \param[in] name The source name
+ *
+ * Sources with identical names share the same identifier.
+ *
+ * \return The source identifier to pass to record()
+ */
+unsigned int Tracer::registerSource(const std::string &name)
+{
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	auto iter = std::find(sources_.begin(), sources_.end(), name);
+	if (iter != sources_.end())
+		return iter - sources_.begin();
+
+	sources_.push_back(name);
+	return sources_.size() - 1;
+}
+
+/**
+ * \brief Record an event
+ * \param[in] event The event
+ * \param[in] source The event source identifier, as returned by
+ * registerSource()
+ * \param[in] request The request the event relates to, if any
+ * \param[in] buffer The buffer the event relates to, if any
+ *
+ * Tracing shall be enabled when calling this method.
+ */
+void Tracer::record(Event event, unsigned int source, const Request *request,
+		    const Buffer *buffer)
+{
+	uint64_t position = position_++;
+	Record &record = records_[position % records_.size()];
+
+	record.timestamp = utils::monotonic_ns();
+	record.cookie = request ? request->cookie() : 0;
+	record.request = request;
+	record.event = event;
+	record.source = source;
+	record.index = buffer ? buffer->index() : -1;
+	record.sequence = buffer ? buffer->sequence() : 0;
+}
+
+/**
+ * \brief Dump all recorded events to the log and clear the ring buffer
+ */
+void Tracer::dump()
+{
+	if (!enabled())
+		return;
+
+	uint64_t end = position_.exchange(0);
+	uint64_t begin = end > records_.size() ? end - records_.size() : 0;
+
+	std::lock_guard<std::mutex> locker(mutex_);
+
+	/* Timestamp of the queue and last events for every request. */
+	std::map<const Request *, std::pair<uint64_t, uint64_t>> requests;
+	/* Timestamp of the last camera start event. */
+	uint64_t start = 0;
+
+	LOG(Trace, Info) << "Dumping " << end - begin << " trace events";
+
+	for (uint64_t position = begin; position < end; ++position) {
+		const Record &record = records_[position % records_.size()];
+		std::stringstream msg;
+
+		msg << record.timestamp / 1000 << " "
+		    << sources_[record.source] << " "
+		    << eventNames[record.event];
+
+		if (record.index != static_cast<unsigned int>(-1))
+			msg << " buffer " << record.index
+			    << " seq " << record.sequence;
+
+		if (record.event == StartCamera)
+			start = record.timestamp;
+		else if ((record.event == StreamOn ||
+			  record.event == CameraStarted) && start)
+			msg << " +" << (record.timestamp - start) / 1000 << "us";
+
+		if (record.request) {
+			msg << " request " << record.request
+			    << " cookie " << record.cookie;
+
+			if (record.event == QueueRequest)
+				requests[record.request] = { record.timestamp,
+							     record.timestamp };
+
+			auto iter = requests.find(record.request);
+			if (iter != requests.end()) {
+				std::pair<uint64_t, uint64_t> &times = iter->second;
+
+				msg << " +" << (record.timestamp - times.first) / 1000
+				    << "us (+"
+				    << (record.timestamp - times.second) / 1000
+				    << "us)";
+
+				times.second = record.timestamp;
+
+				if (record.event == CompleteRequest)
+					requests.erase(iter);
+			}
+		}
+
+		LOG(Trace, Info) << msg.str();
+	}
+}
+
+} /* namespace libcamera */
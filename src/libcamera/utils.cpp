@@ -7,8 +7,16 @@
 
 #include "utils.h"
 
+#include <fstream>
+#include <iomanip>
+#include <limits.h>
+#include <sstream>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
 #include <unistd.h>
 
 /**
@@ -68,6 +76,206 @@ char *secure_getenv(const char *name)
 #endif
 }
 
+/**
+ * \brief Retrieve the identity of a dmabuf object
+ * \param[in] fd A dmabuf file descriptor
+ * \param[out] id The dmabuf identity
+ *
+ * Different file descriptors may refer to the same dmabuf object, and a file
+ * descriptor number may be closed and reused to refer to a different object.
+ * This function identifies the dmabuf object referenced by \a fd by its device
+ * and inode numbers.
+ *
+ * Kernels older than v5.3 back all dmabufs with the same anonymous inode, which
+ * can't be used to identify them. This case is detected by comparing with the
+ * identity of the anonymous inode backing an eventfd.
+ *
+ * \return True if the identity has been retrieved, or false if the dmabuf
+ * object can't be identified
+ */
+bool dmabuf_identity(int fd, std::pair<uint64_t, uint64_t> *id)
+{
+	static const std::pair<uint64_t, uint64_t> anonInode = []() {
+		std::pair<uint64_t, uint64_t> anon{ 0, 0 };
+		struct stat st;
+
+		int efd = eventfd(0, EFD_CLOEXEC);
+		if (efd < 0)
+			return anon;
+
+		if (!fstat(efd, &st))
+			anon = { st.st_dev, st.st_ino };
+
+		close(efd);
+		return anon;
+	}();
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return false;
+
+	std::pair<uint64_t, uint64_t> identity{ st.st_dev, st.st_ino };
+	if (identity == anonInode)
+		return false;
+
+	*id = identity;
+	return true;
+}
+
+/**
+ * \brief Retrieve the NUMA node of the device backing a device node
+ * \param[in] deviceNode The path to a character device node
+ *
+ * The NUMA node is read from sysfs, from the closest parent of the device that
+ * reports one. Devices behind a USB or PCIe bus report the node of their host
+ * controller.
+ *
+ * \return The NUMA node of the device, or -1 if it can't be retrieved or the
+ * system has no NUMA topology
+ */
+int numa_node(const std::string &deviceNode)
+{
+	struct stat st;
+	if (stat(deviceNode.c_str(), &st) < 0 || !S_ISCHR(st.st_mode))
+		return -1;
+
+	std::string sysfs = "/sys/dev/char/" + std::to_string(major(st.st_rdev))
+			  + ":" + std::to_string(minor(st.st_rdev)) + "/device";
+
+	char path[PATH_MAX];
+	if (!realpath(sysfs.c_str(), path))
+		return -1;
+
+	std::string dir(path);
+	while (dir.size() > 1) {
+		std::ifstream file(dir + "/numa_node");
+		int node;
+
+		if (file >> node)
+			return node >= 0 ? node : -1;
+
+		dir.erase(dir.rfind('/'));
+	}
+
+	return -1;
+}
+
+/**
+ * \brief Retrieve the CPUs of a NUMA node
+ * \param[in] node The NUMA node
+ *
+ * \return The CPUs of the NUMA \a node, identified by their index, or an empty
+ * list if the node doesn't exist
+ */
+std::vector<unsigned int> numa_node_cpus(unsigned int node)
+{
+	std::ifstream file("/sys/devices/system/node/node" +
+			   std::to_string(node) + "/cpulist");
+	std::vector<unsigned int> cpus;
+	std::string range;
+
+	/* The list is made of comma-separated CPUs and ranges of CPUs. */
+	while (std::getline(file, range, ',')) {
+		unsigned int first, last;
+		char sep;
+
+		std::istringstream ss(range);
+		if (!(ss >> first))
+			break;
+
+		last = first;
+		if (ss >> sep && (sep != '-' || !(ss >> last)))
+			break;
+
+		for (unsigned int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+/**
+ * \typedef clock
+ * \brief The libcamera clock for timestamps and timeouts
+ *
+ * The std::chrono::steady_clock reads the CLOCK_MONOTONIC clock, which is also
+ * the clock of buffer timestamps. It is read through the vDSO without a system
+ * call.
+ */
+
+/**
+ * \typedef duration
+ * \brief The libcamera duration related to libcamera::utils::clock
+ */
+
+/**
+ * \typedef time_point
+ * \brief The libcamera time point related to libcamera::utils::clock
+ */
+
+/**
+ * \struct coarse_clock
+ * \brief A faster, lower resolution variant of libcamera::utils::clock
+ *
+ * The coarse_clock reads the CLOCK_MONOTONIC_COARSE clock, which is updated
+ * once per scheduler tick and is cheaper to read than CLOCK_MONOTONIC. Its
+ * time points share the epoch of libcamera::utils::clock, and can be compared
+ * with them within the resolution of the coarse clock, usually a few
+ * milliseconds. It is meant for timestamps whose resolution matters less than
+ * the cost of reading them.
+ */
+
+constexpr bool coarse_clock::is_steady;
+
+/**
+ * \brief Retrieve the current time of the coarse clock
+ * \return The current time
+ */
+coarse_clock::time_point coarse_clock::now() noexcept
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return time_point(std::chrono::seconds(ts.tv_sec) +
+			  std::chrono::nanoseconds(ts.tv_nsec));
+}
+
+/**
+ * \fn libcamera::utils::time_point_to_ns(const time_point &time)
+ * \brief Convert a time point to nanoseconds
+ * \param[in] time The time point
+ * \return The number of nanoseconds between the clock epoch and \a time
+ */
+
+/**
+ * \fn libcamera::utils::monotonic_ns()
+ * \brief Retrieve the current time of libcamera::utils::clock in nanoseconds
+ *
+ * This function is a shortcut for code that stores timestamps as integers, such
+ * as buffer timestamps and timer deadlines.
+ *
+ * \return The number of nanoseconds since the clock epoch
+ */
+
+/**
+ * \brief Convert a time point to a string representation
+ * \param[in] time The time point
+ * \return A string representing the time point in hours:minutes:seconds.nanoseconds
+ */
+std::string time_point_to_string(const time_point &time)
+{
+	uint64_t nsecs = time_point_to_ns(time);
+	uint64_t secs = nsecs / 1000000000;
+
+	std::ostringstream ossTimestamp;
+	ossTimestamp.fill('0');
+	ossTimestamp << secs / (60 * 60) << ":"
+		     << std::setw(2) << (secs / 60) % 60 << ":"
+		     << std::setw(2) << secs % 60 << "."
+		     << std::setw(9) << nsecs % 1000000000;
+	return ossTimestamp.str();
+}
+
 /**
  * \fn libcamera::utils::make_unique(Args &&... args)
  * \brief Constructs an object of type T and wraps it in a std::unique_ptr.
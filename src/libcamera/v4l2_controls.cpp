@@ -7,6 +7,10 @@
 
 #include "v4l2_controls.h"
 
+#include <algorithm>
+
+#include "log.h"
+
 /**
  * \file v4l2_controls.h
  * \brief Support for V4L2 Controls using the V4L2 Extended Controls APIs
@@ -30,19 +34,19 @@
  * variable inside the control, or they might as well deal with more complex
  * data types, such as arrays of matrices, stored in a contiguous memory
  * locations associated with the control and called 'the payload'. Such controls
- * are called 'compound controls' and are currently not supported by the
- * libcamera V4L2 control framework.
+ * are identified by the V4L2_CTRL_FLAG_HAS_PAYLOAD flag, and include compound
+ * controls, arrays and strings.
  *
  * libcamera implements support for controls using the V4L2 Extended Control
- * API, which allows future handling of controls with payloads of arbitrary
- * sizes.
+ * API, which handles controls with payloads of arbitrary sizes. The payload of
+ * a control is stored in the V4L2Control instance, and is transferred to and
+ * from the device in place, along with all other controls of the list, with a
+ * single ioctl call.
  *
  * The libcamera V4L2 Controls framework operates on lists of controls, wrapped
  * by the V4L2ControlList class, to match the V4L2 extended controls API. The
  * interface to set and get control is implemented by the V4L2Device class, and
  * this file only provides the data type definitions.
- *
- * \todo Add support for compound controls
  */
 
 namespace libcamera {
@@ -72,10 +76,14 @@ V4L2ControlInfo::V4L2ControlInfo(const struct v4l2_query_ext_ctrl &ctrl)
 {
 	id_ = ctrl.id;
 	type_ = ctrl.type;
+	flags_ = ctrl.flags;
 	name_ = static_cast<const char *>(ctrl.name);
 	size_ = ctrl.elem_size * ctrl.elems;
 	min_ = ctrl.minimum;
 	max_ = ctrl.maximum;
+
+	hasPayload_ = ctrl.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD;
+	isInteger64_ = !hasPayload_ && ctrl.type == V4L2_CTRL_TYPE_INTEGER64;
 }
 
 /**
@@ -90,6 +98,12 @@ V4L2ControlInfo::V4L2ControlInfo(const struct v4l2_query_ext_ctrl &ctrl)
  * \return The V4L2 control type
  */
 
+/**
+ * \fn V4L2ControlInfo::flags()
+ * \brief Retrieve the control flags as defined by V4L2_CTRL_FLAG_*
+ * \return The V4L2 control flags
+ */
+
 /**
  * \fn V4L2ControlInfo::size()
  * \brief Retrieve the control value data size (in bytes)
@@ -115,10 +129,139 @@ V4L2ControlInfo::V4L2ControlInfo(const struct v4l2_query_ext_ctrl &ctrl)
  */
 
 /**
- * \typedef V4L2ControlInfoMap
+ * \fn V4L2ControlInfo::hasPayload()
+ * \brief Check if the control value is stored in a payload
+ *
+ * Controls with a payload have the V4L2_CTRL_FLAG_HAS_PAYLOAD flag set. They
+ * include compound, array and string controls, whose value is stored in
+ * V4L2Control::payload().
+ *
+ * \return True if the control has a payload, false otherwise
+ */
+
+/**
+ * \fn V4L2ControlInfo::isInteger64()
+ * \brief Check if the control value is a 64-bit integer
+ *
+ * The value of 64-bit integer controls is transferred through the value64
+ * field of struct v4l2_ext_control, and the value of all other controls
+ * without a payload through the value field.
+ *
+ * \return True if the control value is a 64-bit integer, false otherwise
+ */
+
+/**
+ * \class V4L2ControlInfoMap
  * \brief A map of control ID to V4L2ControlInfo
+ *
+ * The V4L2ControlInfoMap stores the information of the controls supported by
+ * a device in an array sorted by control ID. Controls are looked up with a
+ * binary search on contiguous memory, which is cheaper than walking a tree
+ * for the small number of controls exposed by devices, and is performed for
+ * every control read or written.
+ *
+ * The map is populated once when the device is opened, and isn't modified
+ * afterwards. Pointers and references to its entries thus stay valid for the
+ * lifetime of the device.
+ */
+
+/**
+ * \typedef V4L2ControlInfoMap::value_type
+ * \brief The type of the map entries, a pair of control ID and information
+ */
+
+/**
+ * \typedef V4L2ControlInfoMap::const_iterator
+ * \brief Const iterator on the map entries, in control ID order
+ */
+
+/**
+ * \brief Replace the contents of the map
+ * \param[in] infos The control information entries
+ *
+ * The entries in \a infos are sorted by control ID. Control IDs shall be
+ * unique.
+ *
+ * \return A reference to the map
+ */
+V4L2ControlInfoMap &V4L2ControlInfoMap::operator=(std::vector<value_type> &&infos)
+{
+	infos_ = std::move(infos);
+
+	std::sort(infos_.begin(), infos_.end(),
+		  [](const value_type &a, const value_type &b) {
+			  return a.first < b.first;
+		  });
+
+	return *this;
+}
+
+/**
+ * \fn V4L2ControlInfoMap::begin()
+ * \brief Retrieve an iterator to the first entry of the map
+ * \return A const iterator to the first entry
+ */
+
+/**
+ * \fn V4L2ControlInfoMap::end()
+ * \brief Retrieve an iterator pointing to the past-the-end entry of the map
+ * \return A const iterator to the element following the last entry
+ */
+
+/**
+ * \fn V4L2ControlInfoMap::empty()
+ * \brief Check if the map is empty
+ * \return True if the map contains no entry, false otherwise
+ */
+
+/**
+ * \fn V4L2ControlInfoMap::size()
+ * \brief Retrieve the number of entries in the map
+ * \return The number of entries
  */
 
+/**
+ * \brief Find the information of control \a id
+ * \param[in] id The V4L2 control ID
+ * \return An iterator to the entry for control \a id, or end() if the control
+ * isn't in the map
+ */
+V4L2ControlInfoMap::const_iterator V4L2ControlInfoMap::find(unsigned int id) const
+{
+	auto iter = std::lower_bound(infos_.begin(), infos_.end(), id,
+				     [](const value_type &info, unsigned int id) {
+					     return info.first < id;
+				     });
+	if (iter == infos_.end() || iter->first != id)
+		return infos_.end();
+
+	return iter;
+}
+
+/**
+ * \fn V4L2ControlInfoMap::count()
+ * \brief Count the entries for control \a id
+ * \param[in] id The V4L2 control ID
+ * \return 1 if the control is in the map, 0 otherwise
+ */
+
+/**
+ * \brief Retrieve the information of control \a id
+ * \param[in] id The V4L2 control ID
+ *
+ * The control \a id shall be in the map, use find() to look up controls that
+ * may not be supported.
+ *
+ * \return A reference to the information of control \a id
+ */
+const V4L2ControlInfo &V4L2ControlInfoMap::at(unsigned int id) const
+{
+	const_iterator iter = find(id);
+	ASSERT(iter != infos_.end());
+
+	return iter->second;
+}
+
 /**
  * \class V4L2Control
  * \brief A V4L2 control value
@@ -163,6 +306,26 @@ V4L2ControlInfo::V4L2ControlInfo(const struct v4l2_query_ext_ctrl &ctrl)
  * device when calling V4L2Device::setControls().
  */
 
+/**
+ * \fn V4L2Control::payload()
+ * \brief Retrieve the payload of the control
+ *
+ * The payload stores the value of controls that have the
+ * V4L2_CTRL_FLAG_HAS_PAYLOAD flag set, such as compound and array controls,
+ * whose value() is then unused. The payload size shall match the
+ * V4L2ControlInfo::size() of the control when writing it. When reading a
+ * control, V4L2Device::getControls() resizes the payload as needed. Callers
+ * that read or write the same controls repeatedly should reuse the
+ * V4L2ControlList to avoid reallocating the payload storage.
+ *
+ * \return A reference to the control payload
+ */
+
+/**
+ * \fn V4L2Control::payload() const
+ * \copydoc V4L2Control::payload()
+ */
+
 /**
  * \fn V4L2Control::id()
  * \brief Retrieve the control ID this instance refers to
@@ -12,7 +12,10 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <libcamera/event_notifier.h>
+
 #include "log.h"
+#include "media_request.h"
 #include "v4l2_controls.h"
 
 /**
@@ -24,6 +27,54 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(V4L2)
 
+namespace {
+
+int64_t extValue(const struct v4l2_ext_control &v4l2Ctrl,
+		 const V4L2ControlInfo *info)
+{
+	if (info->isInteger64())
+		return v4l2Ctrl.value64;
+
+	return v4l2Ctrl.value;
+}
+
+void setExtValue(struct v4l2_ext_control *v4l2Ctrl,
+		 const V4L2ControlInfo *info, int64_t value)
+{
+	if (info->isInteger64())
+		v4l2Ctrl->value64 = value;
+	else
+		v4l2Ctrl->value = value;
+}
+
+/*
+ * Point the extended control to the payload storage, for controls that have a
+ * payload. The payload is then transferred in place by the ioctl.
+ */
+void setExtPayload(struct v4l2_ext_control *v4l2Ctrl,
+		   std::vector<uint8_t> *payload)
+{
+	v4l2Ctrl->size = payload->size();
+	v4l2Ctrl->ptr = payload->data();
+}
+
+/*
+ * Controls that may change on the device without being written, or whose
+ * write has side effects, can't be cached. Controls with a payload are not
+ * cached either, as comparing payloads would cost as much as writing them.
+ */
+bool isCacheable(const V4L2ControlInfo *info)
+{
+	return info->type() != V4L2_CTRL_TYPE_BUTTON &&
+	       !(info->flags() & (V4L2_CTRL_FLAG_VOLATILE |
+				  V4L2_CTRL_FLAG_HAS_PAYLOAD |
+				  V4L2_CTRL_FLAG_WRITE_ONLY |
+				  V4L2_CTRL_FLAG_READ_ONLY |
+				  V4L2_CTRL_FLAG_EXECUTE_ON_WRITE));
+}
+
+} /* namespace */
+
 /**
  * \class V4L2Device
  * \brief Base class for V4L2VideoDevice and V4L2Subdevice
@@ -33,6 +84,10 @@ LOG_DEFINE_CATEGORY(V4L2)
  * class with methods to open and close the device node associated with the
  * device and to perform IOCTL system calls on it.
  *
+ * V4L2 events can be subscribed to with subscribeEvent(). Frame start and source
+ * change events are then reported through the \ref frameStart and
+ * \ref sourceChanged signals, in the thread the device is used from.
+ *
  * The V4L2Device class cannot be instantiated directly, as its constructor
  * is protected. Users should instead create instances of one the derived
  * classes to model either a V4L2 video device or a V4L2 subdevice.
@@ -46,7 +101,9 @@ LOG_DEFINE_CATEGORY(V4L2)
  * at open() time, and the \a logTag to prefix log messages with.
  */
 V4L2Device::V4L2Device(const std::string &deviceNode)
-	: deviceNode_(deviceNode), fd_(-1)
+	: deviceNode_(deviceNode), fd_(-1), eventNotifier_(nullptr),
+	  subscribedEvents_(0), skippedControlReads_(0),
+	  skippedControlWrites_(0)
 {
 }
 
@@ -55,6 +112,7 @@ V4L2Device::V4L2Device(const std::string &deviceNode)
  */
 V4L2Device::~V4L2Device()
 {
+	delete eventNotifier_;
 }
 
 /**
@@ -88,6 +146,36 @@ int V4L2Device::open(unsigned int flags)
 	return 0;
 }
 
+/**
+ * \brief Set the file descriptor of a V4L2 device
+ * \param[in] fd The file descriptor handle
+ *
+ * This method allows a device to provide an already opened file descriptor
+ * referring to the V4L2 device node, instead of opening it with open(). This
+ * can be used for V4L2 M2M devices where a single video device node is used for
+ * both the output and capture devices, or when receiving an open file
+ * descriptor in a context that doesn't have permission to open the device node
+ * itself.
+ *
+ * This method and the open() method are mutually exclusive, only one of the two
+ * shall be used for a V4L2Device instance. The V4L2Device takes ownership of
+ * the \a fd, which is closed by close().
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The device is already open
+ */
+int V4L2Device::setFd(int fd)
+{
+	if (isOpen())
+		return -EBUSY;
+
+	fd_ = fd;
+
+	listControls();
+
+	return 0;
+}
+
 /**
  * \brief Close the device node
  *
@@ -98,10 +186,17 @@ void V4L2Device::close()
 	if (!isOpen())
 		return;
 
+	/* Closing the device unsubscribes from all events. */
+	delete eventNotifier_;
+	eventNotifier_ = nullptr;
+	subscribedEvents_ = 0;
+
 	if (::close(fd_) < 0)
 		LOG(V4L2, Error) << "Failed to close V4L2 device: "
 				 << strerror(errno);
 	fd_ = -1;
+
+	controlCache_.clear();
 }
 
 /**
@@ -119,25 +214,40 @@ void V4L2Device::close()
 /**
  * \brief Read controls from the device
  * \param[inout] ctrls The list of controls to read
+ * \param[in] refresh Read all controls from the device, bypassing the cache
  *
  * This method reads the value of all controls contained in \a ctrls, and stores
  * their values in the corresponding \a ctrls entry.
  *
+ * The device keeps a cache of the value of controls that can only change when
+ * written by libcamera. The value of those controls is retrieved from the
+ * cache, and the VIDIOC_G_EXT_CTRLS call is skipped altogether if all controls
+ * are cached. The number of skipped calls is reported by skippedControlReads().
+ * Controls that may change on their own, such as volatile controls, are always
+ * read from the device. Callers that need to read the device state, for
+ * instance when another process may have modified controls, shall set
+ * \a refresh to true, which also updates the cache.
+ *
+ * Controls with a payload, such as compound and array controls, are read in
+ * place in the payload of the corresponding \a ctrls entry, which is resized
+ * to the control size if needed. All controls are read with a single
+ * VIDIOC_G_EXT_CTRLS call.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
- * has the V4L2_CTRL_FLAG_DISABLED flag set), is a compound control, or if any
- * other error occurs during validation of the requested controls, no control is
- * read and this method returns -EINVAL.
+ * has the V4L2_CTRL_FLAG_DISABLED flag set), or if any other error occurs
+ * during validation of the requested controls, no control is read and this
+ * method returns -EINVAL.
  *
  * If an error occurs while reading the controls, the index of the first control
  * that couldn't be read is returned. The value of all controls below that index
- * are updated in \a ctrls, while the value of all the other controls are not
- * changed.
+ * and of all cached controls are updated in \a ctrls, while the value of all
+ * the other controls are not changed.
  *
  * \return 0 on success or an error code otherwise
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::getControls(V4L2ControlList *ctrls)
+int V4L2Device::getControls(V4L2ControlList *ctrls, bool refresh)
 {
 	unsigned int count = ctrls->size();
 	if (count == 0)
@@ -145,10 +255,15 @@ int V4L2Device::getControls(V4L2ControlList *ctrls)
 
 	const V4L2ControlInfo *controlInfo[count];
 	struct v4l2_ext_control v4l2Ctrls[count];
+	unsigned int indices[count];
+	unsigned int read = 0;
+	int64_t cachedValues[count];
+	unsigned int cachedIndices[count];
+	unsigned int cached = 0;
 	memset(v4l2Ctrls, 0, sizeof(v4l2Ctrls));
 
 	for (unsigned int i = 0; i < count; ++i) {
-		const V4L2Control *ctrl = ctrls->getByIndex(i);
+		V4L2Control *ctrl = ctrls->getByIndex(i);
 		const auto iter = controls_.find(ctrl->id());
 		if (iter == controls_.end()) {
 			LOG(V4L2, Error)
@@ -157,34 +272,64 @@ int V4L2Device::getControls(V4L2ControlList *ctrls)
 		}
 
 		const V4L2ControlInfo *info = &iter->second;
-		controlInfo[i] = info;
-		v4l2Ctrls[i].id = info->id();
+
+		/* Cached controls are updated once all controls are validated. */
+		if (!refresh) {
+			const auto cache = controlCache_.find(info->id());
+			if (cache != controlCache_.end()) {
+				cachedValues[cached] = cache->second;
+				cachedIndices[cached] = i;
+				cached++;
+				continue;
+			}
+		}
+
+		controlInfo[read] = info;
+		indices[read] = i;
+		v4l2Ctrls[read].id = info->id();
+
+		if (info->hasPayload()) {
+			ctrl->payload().resize(info->size());
+			setExtPayload(&v4l2Ctrls[read], &ctrl->payload());
+		}
+
+		read++;
 	}
 
-	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
-	v4l2ExtCtrls.controls = v4l2Ctrls;
-	v4l2ExtCtrls.count = count;
+	int ret = 0;
 
-	int ret = ioctl(VIDIOC_G_EXT_CTRLS, &v4l2ExtCtrls);
-	if (ret) {
-		unsigned int errorIdx = v4l2ExtCtrls.error_idx;
+	if (read) {
+		struct v4l2_ext_controls v4l2ExtCtrls = {};
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+		v4l2ExtCtrls.controls = v4l2Ctrls;
+		v4l2ExtCtrls.count = read;
 
-		/* Generic validation error. */
-		if (errorIdx == 0 || errorIdx >= count) {
-			LOG(V4L2, Error) << "Unable to read controls: "
-					 << strerror(ret);
-			return -EINVAL;
+		ret = ioctl(VIDIOC_G_EXT_CTRLS, &v4l2ExtCtrls);
+		if (ret) {
+			unsigned int errorIdx = v4l2ExtCtrls.error_idx;
+
+			/* Generic validation error. */
+			if (errorIdx == 0 || errorIdx >= read) {
+				LOG(V4L2, Error) << "Unable to read controls: "
+						 << strerror(-ret);
+				return -EINVAL;
+			}
+
+			/* A specific control failed. */
+			LOG(V4L2, Error) << "Unable to read control " << errorIdx
+					 << ": " << strerror(-ret);
+			read = errorIdx - 1;
+			ret = indices[errorIdx];
 		}
 
-		/* A specific control failed. */
-		LOG(V4L2, Error) << "Unable to read control " << errorIdx
-				 << ": " << strerror(ret);
-		count = errorIdx - 1;
-		ret = errorIdx;
+		updateControls(ctrls, controlInfo, v4l2Ctrls, indices, read);
+		cacheControls(controlInfo, v4l2Ctrls, read);
+	} else {
+		skippedControlReads_++;
 	}
 
-	updateControls(ctrls, controlInfo, v4l2Ctrls, count);
+	for (unsigned int i = 0; i < cached; ++i)
+		ctrls->getByIndex(cachedIndices[i])->setValue(cachedValues[i]);
 
 	return ret;
 }
@@ -192,16 +337,33 @@ int V4L2Device::getControls(V4L2ControlList *ctrls)
 /**
  * \brief Write controls to the device
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to bind the controls to
  *
  * This method writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
+ * If a \a request is specified, the controls are not applied immediately but
+ * stored in the request, and are applied atomically with all other controls
+ * and buffers bound to the request when it is queued. The values stored in
+ * \a ctrls are then the values stored in the request.
+ *
+ * The device keeps a cache of the last value applied to each control. Controls
+ * that are already set to the requested value are not written, and the
+ * VIDIOC_S_EXT_CTRLS call is skipped altogether if no control needs to be
+ * written. The number of skipped calls is reported by skippedControlWrites().
+ * Controls bound to a \a request are always written.
+ *
+ * Controls with a payload, such as compound and array controls, are written
+ * from the payload of the corresponding \a ctrls entry, along with all other
+ * controls in a single VIDIOC_S_EXT_CTRLS call. They are never cached, and are
+ * thus written every time.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
- * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, is a
- * compound control, or if any other error occurs during validation of
- * the requested controls, no control is written and this method returns
- * -EINVAL.
+ * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, has a payload whose
+ * size doesn't match the control size, or if any other error occurs during
+ * validation of the requested controls, no control is written and this method
+ * returns -EINVAL.
  *
  * If an error occurs while writing the controls, the index of the first
  * control that couldn't be written is returned. All controls below that index
@@ -212,7 +374,7 @@ int V4L2Device::getControls(V4L2ControlList *ctrls)
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::setControls(V4L2ControlList *ctrls)
+int V4L2Device::setControls(V4L2ControlList *ctrls, MediaRequest *request)
 {
 	unsigned int count = ctrls->size();
 	if (count == 0)
@@ -220,10 +382,12 @@ int V4L2Device::setControls(V4L2ControlList *ctrls)
 
 	const V4L2ControlInfo *controlInfo[count];
 	struct v4l2_ext_control v4l2Ctrls[count];
+	unsigned int indices[count];
+	unsigned int written = 0;
 	memset(v4l2Ctrls, 0, sizeof(v4l2Ctrls));
 
 	for (unsigned int i = 0; i < count; ++i) {
-		const V4L2Control *ctrl = ctrls->getByIndex(i);
+		V4L2Control *ctrl = ctrls->getByIndex(i);
 		const auto iter = controls_.find(ctrl->id());
 		if (iter == controls_.end()) {
 			LOG(V4L2, Error)
@@ -232,52 +396,80 @@ int V4L2Device::setControls(V4L2ControlList *ctrls)
 		}
 
 		const V4L2ControlInfo *info = &iter->second;
-		controlInfo[i] = info;
-		v4l2Ctrls[i].id = info->id();
 
-		/* Set the v4l2_ext_control value for the write operation. */
-		switch (info->type()) {
-		case V4L2_CTRL_TYPE_INTEGER64:
-			v4l2Ctrls[i].value64 = ctrl->value();
-			break;
-		default:
-			/*
-			 * \todo To be changed when support for string and
-			 * compound controls will be added.
-			 */
-			v4l2Ctrls[i].value = ctrl->value();
-			break;
+		if (info->hasPayload()) {
+			if (ctrl->payload().size() != info->size()) {
+				LOG(V4L2, Error)
+					<< "Control '" << ctrl->id()
+					<< "' payload size " << ctrl->payload().size()
+					<< " doesn't match control size "
+					<< info->size();
+				return -EINVAL;
+			}
+
+			controlInfo[written] = info;
+			indices[written] = i;
+			v4l2Ctrls[written].id = info->id();
+			setExtPayload(&v4l2Ctrls[written], &ctrl->payload());
+			written++;
+			continue;
 		}
-	}
 
-	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
-	v4l2ExtCtrls.controls = v4l2Ctrls;
-	v4l2ExtCtrls.count = count;
+		/*
+		 * Skip controls already set to the requested value. Controls
+		 * bound to a request are always written, as they must be
+		 * stored in the request.
+		 */
+		if (!request && isCached(info, ctrl->value()))
+			continue;
 
-	int ret = ioctl(VIDIOC_S_EXT_CTRLS, &v4l2ExtCtrls);
-	if (ret) {
-		unsigned int errorIdx = v4l2ExtCtrls.error_idx;
+		controlInfo[written] = info;
+		indices[written] = i;
+		v4l2Ctrls[written].id = info->id();
+		setExtValue(&v4l2Ctrls[written], info, ctrl->value());
+		written++;
+	}
 
-		/* Generic validation error. */
-		if (errorIdx == 0 || errorIdx >= count) {
-			LOG(V4L2, Error) << "Unable to read controls: "
-					 << strerror(ret);
-			return -EINVAL;
-		}
+	if (!written) {
+		skippedControlWrites_++;
+		return 0;
+	}
 
-		/* A specific control failed. */
-		LOG(V4L2, Error) << "Unable to read control " << errorIdx
-				 << ": " << strerror(ret);
-		count = errorIdx - 1;
-		ret = errorIdx;
+	int ret = setExtControls(controlInfo, v4l2Ctrls, written, request);
+	if (ret < 0)
+		return ret;
+	if (ret) {
+		written = ret - 1;
+		ret = indices[ret];
 	}
 
-	updateControls(ctrls, controlInfo, v4l2Ctrls, count);
+	updateControls(ctrls, controlInfo, v4l2Ctrls, indices, written);
 
 	return ret;
 }
 
+/**
+ * \fn V4L2Device::skippedControlReads()
+ * \brief Retrieve the number of control reads served by the control cache
+ *
+ * A control read is skipped when all controls passed to getControls() are
+ * retrieved from the control cache.
+ *
+ * \return The number of VIDIOC_G_EXT_CTRLS calls skipped since the device has
+ * been created
+ */
+
+/**
+ * \fn V4L2Device::skippedControlWrites()
+ * \brief Retrieve the number of control writes skipped by the control cache
+ *
+ * A control write is skipped when all controls passed to setControls() or
+ * V4L2PreparedControls::apply() are already set to the requested value.
+ *
+ * \return The number of VIDIOC_S_EXT_CTRLS calls skipped since the device has
+ * been created
+ */
+
 /**
  * \brief Perform an IOCTL system call on the device node
  * \param[in] request The IOCTL request code
@@ -296,6 +488,136 @@ int V4L2Device::ioctl(unsigned long request, void *argp)
 	return 0;
 }
 
+/**
+ * \brief Subscribe to a V4L2 event
+ * \param[in] type The event type (V4L2_EVENT_*)
+ * \param[in] id The event source ID, such as the pad number for
+ * V4L2_EVENT_SOURCE_CHANGE
+ *
+ * Once subscribed, V4L2_EVENT_FRAME_SYNC events are reported through the
+ * \ref frameStart signal, and V4L2_EVENT_SOURCE_CHANGE events through the
+ * \ref sourceChanged signal. Other event types are dequeued and ignored.
+ *
+ * Events are delivered when the device becomes ready for exceptional
+ * conditions, through an EventNotifier created on the first subscription. The
+ * signals are thus emitted in the thread the device is used from, as soon as
+ * the event loop of that thread processes the event.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The device doesn't support the event
+ */
+int V4L2Device::subscribeEvent(uint32_t type, uint32_t id)
+{
+	struct v4l2_event_subscription sub = {};
+	sub.type = type;
+	sub.id = id;
+
+	int ret = ioctl(VIDIOC_SUBSCRIBE_EVENT, &sub);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to subscribe to event " << type << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	if (!eventNotifier_) {
+		eventNotifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+		eventNotifier_->activated.connect(this, &V4L2Device::eventAvailable);
+	}
+
+	subscribedEvents_++;
+
+	return 0;
+}
+
+/**
+ * \brief Unsubscribe from a V4L2 event
+ * \param[in] type The event type (V4L2_EVENT_*)
+ * \param[in] id The event source ID
+ *
+ * The events already queued by the device for the subscription are discarded.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2Device::unsubscribeEvent(uint32_t type, uint32_t id)
+{
+	struct v4l2_event_subscription sub = {};
+	sub.type = type;
+	sub.id = id;
+
+	int ret = ioctl(VIDIOC_UNSUBSCRIBE_EVENT, &sub);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to unsubscribe from event " << type << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	if (subscribedEvents_ && !--subscribedEvents_) {
+		delete eventNotifier_;
+		eventNotifier_ = nullptr;
+	}
+
+	return 0;
+}
+
+/**
+ * \var V4L2Device::frameStart
+ * \brief A Signal emitted when capture of a frame starts
+ *
+ * This signal is emitted for V4L2_EVENT_FRAME_SYNC events, once subscribed to
+ * with subscribeEvent(). The frame sequence number and the event timestamp, in
+ * nanoseconds in the CLOCK_MONOTONIC clock, are passed as parameters. Pipeline
+ * handlers can use it to apply controls at the start of the frame they belong
+ * to.
+ */
+
+/**
+ * \var V4L2Device::sourceChanged
+ * \brief A Signal emitted when the source connected to the device changes
+ *
+ * This signal is emitted for V4L2_EVENT_SOURCE_CHANGE events, once subscribed
+ * to with subscribeEvent(). The event source ID and the V4L2_EVENT_SRC_CH_*
+ * changes flags are passed as parameters.
+ */
+
+/*
+ * Dequeue all pending events. The kernel reports the number of events still
+ * queued after the dequeued one, which avoids an additional ioctl to detect
+ * the end of the queue.
+ */
+void V4L2Device::eventAvailable(EventNotifier *notifier)
+{
+	struct v4l2_event event;
+
+	do {
+		event = {};
+		int ret = ioctl(VIDIOC_DQEVENT, &event);
+		if (ret < 0) {
+			if (ret != -ENOENT)
+				LOG(V4L2, Error)
+					<< "Failed to dequeue event: "
+					<< strerror(-ret);
+			return;
+		}
+
+		switch (event.type) {
+		case V4L2_EVENT_FRAME_SYNC:
+			frameStart.emit(event.u.frame_sync.frame_sequence,
+					event.timestamp.tv_sec * 1000000000ULL +
+					event.timestamp.tv_nsec);
+			break;
+
+		case V4L2_EVENT_SOURCE_CHANGE:
+			sourceChanged.emit(event.id, event.u.src_change.changes);
+			break;
+
+		default:
+			break;
+		}
+	} while (event.pending);
+}
+
 /**
  * \fn V4L2Device::deviceNode()
  * \brief Retrieve the device node path
@@ -314,9 +636,26 @@ int V4L2Device::ioctl(unsigned long request, void *argp)
  */
 void V4L2Device::listControls()
 {
+	/*
+	 * The supported controls don't change when the device is reopened.
+	 * Keep the existing information, which may be referenced by prepared
+	 * controls.
+	 */
+	if (controls_.empty())
+		enumerateControls();
+
+	seedControlCache();
+}
+
+/*
+ * \brief Query the information about all controls supported by the device
+ */
+void V4L2Device::enumerateControls()
+{
+	std::vector<V4L2ControlInfoMap::value_type> infos;
 	struct v4l2_query_ext_ctrl ctrl = {};
 
-	/* \todo Add support for menu and compound controls. */
+	/* \todo Add support for menu controls. */
 	while (1) {
 		ctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
 		if (ioctl(VIDIOC_QUERY_EXT_CTRL, &ctrl))
@@ -336,48 +675,435 @@ void V4L2Device::listControls()
 		case V4L2_CTRL_TYPE_BITMASK:
 		case V4L2_CTRL_TYPE_INTEGER_MENU:
 			break;
-		/* \todo Support compound controls. */
 		default:
+			/* Compound and string controls carry a payload. */
+			if (info.hasPayload())
+				break;
+
 			LOG(V4L2, Debug) << "Control type '" << info.type()
 					 << "' not supported";
 			continue;
 		}
 
-		controls_.emplace(ctrl.id, info);
+		infos.emplace_back(ctrl.id, info);
+	}
+
+	controls_ = std::move(infos);
+}
+
+/*
+ * \brief Seed the control cache with the current control values
+ */
+void V4L2Device::seedControlCache()
+{
+	std::vector<const V4L2ControlInfo *> controlInfo;
+	std::vector<struct v4l2_ext_control> v4l2Ctrls;
+
+	for (const auto &ctrl : controls_) {
+		const V4L2ControlInfo *info = &ctrl.second;
+		if (!isCacheable(info))
+			continue;
+
+		struct v4l2_ext_control v4l2Ctrl = {};
+		v4l2Ctrl.id = info->id();
+
+		controlInfo.push_back(info);
+		v4l2Ctrls.push_back(v4l2Ctrl);
+	}
+
+	if (v4l2Ctrls.empty())
+		return;
+
+	struct v4l2_ext_controls v4l2ExtCtrls = {};
+	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	v4l2ExtCtrls.controls = v4l2Ctrls.data();
+	v4l2ExtCtrls.count = v4l2Ctrls.size();
+
+	if (ioctl(VIDIOC_G_EXT_CTRLS, &v4l2ExtCtrls)) {
+		LOG(V4L2, Debug) << "Unable to seed the control cache";
+		return;
+	}
+
+	cacheControls(controlInfo.data(), v4l2Ctrls.data(), v4l2Ctrls.size());
+}
+
+/*
+ * \brief Write an array of extended controls to the device
+ * \param[in] controlInfo The information of the controls in \a v4l2Ctrls
+ * \param[inout] v4l2Ctrls The extended controls
+ * \param[in] count The number of controls in \a v4l2Ctrls
+ * \param[in] request The media request to bind the controls to
+ *
+ * The values applied by the driver are stored in \a v4l2Ctrls, and in the
+ * control cache.
+ *
+ * \return 0 on success, -EINVAL on a validation error, or the index of the
+ * control that failed
+ */
+int V4L2Device::setExtControls(const V4L2ControlInfo **controlInfo,
+			       struct v4l2_ext_control *v4l2Ctrls,
+			       unsigned int count, MediaRequest *request)
+{
+	struct v4l2_ext_controls v4l2ExtCtrls = {};
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
+	v4l2ExtCtrls.controls = v4l2Ctrls;
+	v4l2ExtCtrls.count = count;
+
+	int ret = ioctl(VIDIOC_S_EXT_CTRLS, &v4l2ExtCtrls);
+
+	/*
+	 * Controls bound to a request will only be applied when the request
+	 * is queued, and controls may have been partially applied on error.
+	 * Drop them from the cache in both cases.
+	 */
+	if (ret || request)
+		uncacheControls(controlInfo, count);
+	else
+		cacheControls(controlInfo, v4l2Ctrls, count);
+
+	if (ret) {
+		unsigned int errorIdx = v4l2ExtCtrls.error_idx;
+
+		/* Generic validation error. */
+		if (errorIdx == 0 || errorIdx >= count) {
+			LOG(V4L2, Error) << "Unable to set controls: "
+					 << strerror(-ret);
+			return -EINVAL;
+		}
+
+		/* A specific control failed. */
+		LOG(V4L2, Error) << "Unable to set control " << errorIdx
+				 << ": " << strerror(-ret);
+		return errorIdx;
+	}
+
+	return 0;
+}
+
+/*
+ * \brief Check if a control is cached with the specified value
+ * \param[in] info The control information
+ * \param[in] value The control value
+ * \return True if the control is known to be set to \a value on the device,
+ * false otherwise
+ */
+bool V4L2Device::isCached(const V4L2ControlInfo *info, int64_t value) const
+{
+	const auto iter = controlCache_.find(info->id());
+	return iter != controlCache_.end() && iter->second == value;
+}
+
+/*
+ * \brief Store the values of controls in the control cache
+ * \param[in] controlInfo The information of the controls in \a v4l2Ctrls
+ * \param[in] v4l2Ctrls The extended controls
+ * \param[in] count The number of controls in \a v4l2Ctrls
+ *
+ * Controls whose value may change without being written by libcamera, such as
+ * volatile controls, are never cached. Writing a control that affects the
+ * value of other controls invalidates the whole cache.
+ */
+void V4L2Device::cacheControls(const V4L2ControlInfo **controlInfo,
+			       const struct v4l2_ext_control *v4l2Ctrls,
+			       unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i) {
+		const V4L2ControlInfo *info = controlInfo[i];
+
+		if (info->flags() & V4L2_CTRL_FLAG_UPDATE) {
+			controlCache_.clear();
+			return;
+		}
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const V4L2ControlInfo *info = controlInfo[i];
+
+		if (!isCacheable(info))
+			continue;
+
+		controlCache_[info->id()] = extValue(v4l2Ctrls[i], info);
+	}
+}
+
+/*
+ * \brief Remove controls from the control cache
+ * \param[in] controlInfo The information of the controls to remove
+ * \param[in] count The number of controls in \a controlInfo
+ */
+void V4L2Device::uncacheControls(const V4L2ControlInfo **controlInfo,
+				 unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i) {
+		if (controlInfo[i]->flags() & V4L2_CTRL_FLAG_UPDATE) {
+			controlCache_.clear();
+			return;
+		}
+
+		controlCache_.erase(controlInfo[i]->id());
 	}
 }
 
 /*
- * \brief Update the value of the first \a count V4L2 controls in \a ctrls using
- * values in \a v4l2Ctrls
+ * \brief Update the value of V4L2 controls in \a ctrls using values in
+ * \a v4l2Ctrls
  * \param[inout] ctrls List of V4L2 controls to update
  * \param[in] controlInfo List of V4L2 control information
  * \param[in] v4l2Ctrls List of V4L2 extended controls as returned by the driver
+ * \param[in] indices The index in \a ctrls of each control in \a v4l2Ctrls
  * \param[in] count The number of controls to update
  */
 void V4L2Device::updateControls(V4L2ControlList *ctrls,
 				const V4L2ControlInfo **controlInfo,
 				const struct v4l2_ext_control *v4l2Ctrls,
+				const unsigned int *indices,
 				unsigned int count)
 {
 	for (unsigned int i = 0; i < count; ++i) {
 		const struct v4l2_ext_control *v4l2Ctrl = &v4l2Ctrls[i];
 		const V4L2ControlInfo *info = controlInfo[i];
-		V4L2Control *ctrl = ctrls->getByIndex(i);
+		V4L2Control *ctrl = ctrls->getByIndex(indices[i]);
 
-		switch (info->type()) {
-		case V4L2_CTRL_TYPE_INTEGER64:
-			ctrl->setValue(v4l2Ctrl->value64);
-			break;
-		default:
-			/*
-			 * \todo To be changed when support for string and
-			 * compound controls will be added.
-			 */
-			ctrl->setValue(v4l2Ctrl->value);
-			break;
+		/* Payloads have been read in place. */
+		if (info->hasPayload())
+			continue;
+
+		ctrl->setValue(extValue(*v4l2Ctrl, info));
+	}
+}
+
+/**
+ * \class V4L2PreparedControls
+ * \brief A fixed set of controls prepared for repeated writes to a device
+ *
+ * Writing a V4L2ControlList with V4L2Device::setControls() looks up every
+ * control in the device control information and builds the array of
+ * v4l2_ext_control structures for every call. Pipeline handlers that write the
+ * same set of controls for every frame, such as the exposure time and gain
+ * computed by an image processing algorithm, can instead prepare the set of
+ * controls once with prepare(), and then only update the control values with
+ * setValue() before writing them with apply().
+ *
+ * Controls are accessed by their index in the list of control IDs passed to
+ * prepare().
+ *
+ * The payload storage of controls that have a payload, such as compound and
+ * array controls, is allocated by prepare(). The payload is filled in place
+ * through payload(), and all controls are written with a single ioctl without
+ * any copy or allocation.
+ */
+
+V4L2PreparedControls::V4L2PreparedControls()
+	: device_(nullptr)
+{
+}
+
+/**
+ * \brief Prepare a set of controls for a device
+ * \param[in] device The device to write the controls to
+ * \param[in] ids The IDs of the controls
+ *
+ * All the controls shall be supported by the \a device. The values of all
+ * controls are initialised to 0, and the payloads of controls that have one
+ * are allocated with the control size and zeroed.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL One of the control is not supported by the device
+ */
+int V4L2PreparedControls::prepare(V4L2Device *device,
+				  const std::vector<unsigned int> &ids)
+{
+	device_ = nullptr;
+	controlInfo_.clear();
+	v4l2Ctrls_.clear();
+	payloads_.clear();
+
+	const V4L2ControlInfoMap &controls = device->controls();
+
+	for (unsigned int id : ids) {
+		const auto iter = controls.find(id);
+		if (iter == controls.end()) {
+			LOG(V4L2, Error) << "Control '" << id << "' not found";
+			controlInfo_.clear();
+			v4l2Ctrls_.clear();
+			payloads_.clear();
+			return -EINVAL;
 		}
+
+		const V4L2ControlInfo *info = &iter->second;
+		struct v4l2_ext_control v4l2Ctrl = {};
+		v4l2Ctrl.id = id;
+
+		controlInfo_.push_back(info);
+		v4l2Ctrls_.push_back(v4l2Ctrl);
+		payloads_.emplace_back(info->hasPayload() ? info->size() : 0);
+	}
+
+	for (unsigned int i = 0; i < v4l2Ctrls_.size(); ++i) {
+		if (controlInfo_[i]->hasPayload())
+			setExtPayload(&v4l2Ctrls_[i], &payloads_[i]);
 	}
+
+	device_ = device;
+
+	return 0;
+}
+
+/**
+ * \fn V4L2PreparedControls::isValid()
+ * \brief Check if the controls have been successfully prepared
+ * \return True if the controls have been prepared, false otherwise
+ */
+
+/**
+ * \fn V4L2PreparedControls::size()
+ * \brief Retrieve the number of controls
+ * \return The number of controls
+ */
+
+/**
+ * \fn V4L2PreparedControls::id()
+ * \brief Retrieve the ID of the control at \a index
+ * \param[in] index The control index
+ * \return The control ID
+ */
+
+/**
+ * \brief Retrieve the value of the control at \a index
+ * \param[in] index The control index
+ *
+ * After a successful call to apply(), the value is the value applied by the
+ * device, which may differ from the value set with setValue(). The value of
+ * controls that have a payload is stored in payload() instead.
+ *
+ * \return The control value
+ */
+int64_t V4L2PreparedControls::value(unsigned int index) const
+{
+	return extValue(v4l2Ctrls_[index], controlInfo_[index]);
+}
+
+/**
+ * \brief Set the value of the control at \a index
+ * \param[in] index The control index
+ * \param[in] value The control value
+ *
+ * The value is written to the device by the next call to apply().
+ */
+void V4L2PreparedControls::setValue(unsigned int index, int64_t value)
+{
+	if (controlInfo_[index]->hasPayload())
+		return;
+
+	setExtValue(&v4l2Ctrls_[index], controlInfo_[index], value);
+}
+
+/**
+ * \fn V4L2PreparedControls::payload()
+ * \brief Retrieve the payload of the control at \a index
+ * \param[in] index The control index
+ *
+ * The payload is allocated by prepare() with the size of the control, and is
+ * empty for controls that don't have a payload. Its content may be modified,
+ * but it shall not be resized.
+ *
+ * \return A reference to the control payload
+ */
+
+/**
+ * \brief Write all controls to the device
+ * \param[in] request The media request to bind the controls to
+ *
+ * All controls are written with a single VIDIOC_S_EXT_CTRLS call, and their
+ * values are updated with the values applied by the device. The call is
+ * skipped when all controls are known to be set to their value already. If a \a request is
+ * specified, the controls are stored in the request, and applied when the
+ * request is queued.
+ *
+ * \sa V4L2Device::setControls()
+ *
+ * \return 0 on success or an error code otherwise
+ * \retval -EINVAL The controls haven't been prepared or are not accessible
+ * \retval i The index of the control that failed
+ */
+int V4L2PreparedControls::apply(MediaRequest *request)
+{
+	if (!device_)
+		return -EINVAL;
+
+	if (v4l2Ctrls_.empty())
+		return 0;
+
+	/* Skip the write if all controls are already set to their value. */
+	if (!request) {
+		unsigned int i;
+
+		for (i = 0; i < v4l2Ctrls_.size(); ++i) {
+			if (controlInfo_[i]->hasPayload() ||
+			    !device_->isCached(controlInfo_[i], value(i)))
+				break;
+		}
+
+		if (i == v4l2Ctrls_.size()) {
+			device_->skippedControlWrites_++;
+			return 0;
+		}
+	}
+
+	return device_->setExtControls(controlInfo_.data(), v4l2Ctrls_.data(),
+				       v4l2Ctrls_.size(), request);
+}
+
+/**
+ * \class V4L2ControlBatch
+ * \brief A group of prepared controls for multiple devices
+ *
+ * Pipelines often need to write controls to several devices for every frame,
+ * such as the exposure time and gain to the camera sensor, and processing
+ * parameters to an ISP subdevice. The V4L2ControlBatch class groups prepared
+ * controls for different devices, to write all of them with a single call
+ * to apply(). When a media request is used, all controls are bound to the
+ * same request and are applied atomically with the buffers of the frame.
+ *
+ * The batch only references the prepared controls, which shall remain valid
+ * for as long as they are part of the batch.
+ */
+
+/**
+ * \fn V4L2ControlBatch::add()
+ * \brief Add prepared controls to the batch
+ * \param[in] ctrls The prepared controls
+ */
+
+/**
+ * \fn V4L2ControlBatch::clear()
+ * \brief Remove all prepared controls from the batch
+ */
+
+/**
+ * \brief Write all controls in the batch to their devices
+ * \param[in] request The media request to bind the controls to
+ *
+ * The prepared controls are written in the order they have been added to the
+ * batch. Writing stops at the first error.
+ *
+ * \return 0 on success or an error code otherwise, as returned by
+ * V4L2PreparedControls::apply()
+ */
+int V4L2ControlBatch::apply(MediaRequest *request)
+{
+	for (V4L2PreparedControls *ctrls : controls_) {
+		int ret = ctrls->apply(request);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
 }
 
 } /* namespace libcamera */
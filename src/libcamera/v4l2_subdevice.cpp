@@ -77,12 +77,36 @@ const std::string V4L2SubdeviceFormat::toString() const
 {
 	std::stringstream ss;
 
-	ss.fill(0);
-	ss << size.toString() << "-0x" << std::hex << std::setw(4) << mbus_code;
+	ss << *this;
 
 	return ss.str();
 }
 
+/**
+ * \brief Insert a text representation of a V4L2SubdeviceFormat into an output
+ * stream
+ * \param[in] out The output stream
+ * \param[in] format The format
+ *
+ * The stream operator doesn't allocate temporary strings, and should be
+ * preferred over toString() when logging.
+ *
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const V4L2SubdeviceFormat &format)
+{
+	std::ios_base::fmtflags flags = out.flags();
+	char fill = out.fill('0');
+
+	out << format.size << "-0x" << std::hex << std::setw(4)
+	    << format.mbus_code;
+
+	out.fill(fill);
+	out.flags(flags);
+
+	return out;
+}
+
 /**
  * \class V4L2Subdevice
  * \brief A V4L2 subdevice as exposed by the Linux kernel
@@ -155,31 +179,41 @@ int V4L2Subdevice::setCompose(unsigned int pad, Rectangle *rect)
  * Enumerate all media bus codes and frame sizes supported by the subdevice on
  * a \a pad.
  *
+ * The formats supported on a pad may depend on the format of the other pads.
+ * They are cached per pad, and the cache is invalidated every time a format is
+ * set on the subdevice.
+ *
  * \return A list of the supported device formats
  */
-ImageFormats V4L2Subdevice::formats(unsigned int pad)
+const ImageFormats &V4L2Subdevice::formats(unsigned int pad)
 {
-	ImageFormats formats;
+	static const ImageFormats empty;
 
 	if (pad >= entity_->pads().size()) {
 		LOG(V4L2, Error) << "Invalid pad: " << pad;
-		return {};
+		return empty;
 	}
 
+	auto it = formats_.find(pad);
+	if (it != formats_.end())
+		return it->second;
+
+	ImageFormats formats;
+
 	for (unsigned int code : enumPadCodes(pad)) {
 		std::vector<SizeRange> sizes = enumPadSizes(pad, code);
 		if (sizes.empty())
-			return {};
+			return empty;
 
 		if (formats.addFormat(code, sizes)) {
 			LOG(V4L2, Error)
 				<< "Could not add sizes for media bus code "
 				<< code << " on pad " << pad;
-			return {};
+			return empty;
 		}
 	}
 
-	return formats;
+	return formats_[pad] = std::move(formats);
 }
 
 /**
@@ -241,6 +275,9 @@ int V4L2Subdevice::setFormat(unsigned int pad, V4L2SubdeviceFormat *format)
 	format->size.height = subdevFmt.format.height;
 	format->mbus_code = subdevFmt.format.code;
 
+	/* The formats supported on the other pads may have changed. */
+	formats_.clear();
+
 	return 0;
 }
 
@@ -7,6 +7,7 @@
 
 #include "v4l2_videodevice.h"
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <sstream>
@@ -20,9 +21,15 @@
 #include <libcamera/buffer.h>
 #include <libcamera/event_notifier.h>
 
+#include "dma_buf_allocator.h"
+#include "formats.h"
 #include "log.h"
 #include "media_device.h"
 #include "media_object.h"
+#include "media_request.h"
+#include "metrics_registry.h"
+#include "tracer.h"
+#include "utils.h"
 
 /**
  * \file v4l2_videodevice.h
@@ -32,6 +39,55 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(V4L2)
 
+namespace {
+
+/*
+ * The V4L2 tiled formats, expressed as the linear format and the format
+ * modifier describing their layout.
+ */
+const struct {
+	uint32_t v4l2Fourcc;
+	uint32_t fourcc;
+	uint64_t modifier;
+} tiledFormats[] = {
+	{ V4L2_PIX_FMT_NV12MT, V4L2_PIX_FMT_NV12M, FormatModSamsung64x32Tile },
+	{ V4L2_PIX_FMT_NV12MT_16X16, V4L2_PIX_FMT_NV12M, FormatModSamsung16x16Tile },
+	{ V4L2_PIX_FMT_SUNXI_TILED_NV12, V4L2_PIX_FMT_NV12, FormatModAllwinnerTiled },
+};
+
+uint32_t toV4L2Fourcc(uint32_t fourcc, uint64_t modifier)
+{
+	if (modifier == FormatModLinear)
+		return fourcc;
+
+	for (const auto &format : tiledFormats) {
+		if (format.fourcc == fourcc && format.modifier == modifier)
+			return format.v4l2Fourcc;
+	}
+
+	LOG(V4L2, Debug)
+		<< "Unsupported modifier 0x" << std::hex << modifier
+		<< ", using linear layout";
+
+	return fourcc;
+}
+
+void fromV4L2Fourcc(uint32_t v4l2Fourcc, uint32_t *fourcc, uint64_t *modifier)
+{
+	for (const auto &format : tiledFormats) {
+		if (format.v4l2Fourcc == v4l2Fourcc) {
+			*fourcc = format.fourcc;
+			*modifier = format.modifier;
+			return;
+		}
+	}
+
+	*fourcc = v4l2Fourcc;
+	*modifier = FormatModLinear;
+}
+
+} /* namespace */
+
 /**
  * \struct V4L2Capability
  * \brief struct v4l2_capability object wrapper and helpers
@@ -192,8 +248,8 @@ LOG_DECLARE_CATEGORY(V4L2)
  * per-plane stride length of images represented with planar image formats are
  * configured using the opportune number of entries of the
  * V4L2DeviceFormat::planes array, as prescribed by the image format
- * definition (semi-planar formats use 2 entries, while planar formats use the
- * whole 3 entries). The number of valid entries of the
+ * definition (semi-planar formats use 2 entries, while planar formats use 3
+ * entries or more, up to VIDEO_MAX_PLANES). The number of valid entries of the
  * V4L2DeviceFormat::planes array is defined by the
  * V4L2DeviceFormat::planesCount value.
  */
@@ -211,6 +267,18 @@ LOG_DECLARE_CATEGORY(V4L2)
  * that identifies the image format pixel encoding scheme.
  */
 
+/**
+ * \var V4L2DeviceFormat::modifier
+ * \brief The format modifier describing the memory layout
+ *
+ * The V4L2 API expresses tiled memory layouts with dedicated fourcc codes,
+ * such as V4L2_PIX_FMT_NV12MT. The V4L2VideoDevice class translates them to
+ * the \ref fourcc of the linear format and the corresponding DRM format
+ * modifier, to match the StreamConfiguration. A value of 0 denotes a linear
+ * layout. Requesting a modifier that the V4L2 API can't express sets the
+ * linear format.
+ */
+
 /**
  * \var V4L2DeviceFormat::planes
  * \brief The per-plane memory size information
@@ -226,6 +294,47 @@ LOG_DECLARE_CATEGORY(V4L2)
  * \brief The number of valid data planes
  */
 
+/**
+ * \brief Compute the planes layout from the pixel format and size
+ * \param[in] align The line stride alignment in bytes
+ *
+ * Fill the \ref planes and \ref planesCount from the \ref fourcc and
+ * \ref size, using the information from PixelFormatInfo. This allows sizing
+ * buffers for a format before, or without, applying it to a video device. The
+ * line strides are aligned to \a align bytes, devices may however require
+ * larger strides or plane sizes, which are reported by
+ * V4L2VideoDevice::setFormat().
+ *
+ * Formats with multiple memory planes use one entry of the \ref planes array
+ * per colour plane, while the colour planes of other formats are stored
+ * contiguously in the first entry, whose line stride is the stride of the
+ * first colour plane.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \ref fourcc is unknown or compressed
+ */
+int V4L2DeviceFormat::computePlanes(unsigned int align)
+{
+	const PixelFormatInfo &info = PixelFormatInfo::info(fourcc);
+	if (!info.isValid() || info.compressed)
+		return -EINVAL;
+
+	if (info.memoryPlanes == 1) {
+		planesCount = 1;
+		planes[0].bpl = info.stride(size.width, 0, align);
+		planes[0].size = info.frameSize(size, align);
+		return 0;
+	}
+
+	planesCount = info.numPlanes();
+	for (unsigned int i = 0; i < planesCount; ++i) {
+		planes[i].bpl = info.stride(size.width, i, align);
+		planes[i].size = info.planeSize(size, i, align);
+	}
+
+	return 0;
+}
+
 /**
  * \brief Assemble and return a string describing the format
  * \return A string describing the V4L2DeviceFormat
@@ -234,12 +343,37 @@ const std::string V4L2DeviceFormat::toString() const
 {
 	std::stringstream ss;
 
-	ss.fill(0);
-	ss << size.toString() << "-0x" << std::hex << std::setw(8) << fourcc;
+	ss << *this;
 
 	return ss.str();
 }
 
+/**
+ * \brief Insert a text representation of a V4L2DeviceFormat into an output
+ * stream
+ * \param[in] out The output stream
+ * \param[in] format The format
+ *
+ * The stream operator doesn't allocate temporary strings, and should be
+ * preferred over toString() when logging.
+ *
+ * \return The output stream \a out
+ */
+std::ostream &operator<<(std::ostream &out, const V4L2DeviceFormat &format)
+{
+	out << format.size << "-" << PixelFormat(format.fourcc);
+
+	if (format.modifier) {
+		std::ios_base::fmtflags flags = out.flags();
+		char fill = out.fill('0');
+		out << "-0x" << std::hex << std::setw(16) << format.modifier;
+		out.fill(fill);
+		out.flags(flags);
+	}
+
+	return out;
+}
+
 /**
  * \class V4L2VideoDevice
  * \brief V4L2VideoDevice object and API
@@ -259,6 +393,18 @@ const std::string V4L2DeviceFormat::toString() const
  * automatically dequeues completed buffers and emits the \ref bufferReady
  * signal.
  *
+ * Capture devices may stall or drop frames when they run out of queued buffers,
+ * which happens when the application doesn't queue requests fast enough. To
+ * avoid this, spare buffers can be requested with setSpareBufferCount() before
+ * allocating or importing buffers. The spare buffers are internal to the video
+ * device, and are queued automatically while streaming to keep at least as
+ * many buffers queued as there are spare buffers. Frames captured into spare
+ * buffers are dropped without emitting the \ref bufferReady signal, and are
+ * counted in spareFrames(). Devices whose frames must be matched with buffers
+ * queued to other devices, such as the outputs of a memory-to-memory ISP, can
+ * instead queue spare buffers explicitly with queueSpareBuffer() to skip
+ * individual frames.
+ *
  * Upon destruction any device left open will be closed, and any resources
  * released.
  */
@@ -268,8 +414,23 @@ const std::string V4L2DeviceFormat::toString() const
  * \param[in] deviceNode The file-system path to the video device node
  */
 V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
-	: V4L2Device(deviceNode), bufferPool_(nullptr), fdEvent_(nullptr)
+	: V4L2Device(deviceNode), bufferCaps_(0), currentFormat_{},
+	  bufferPool_(nullptr),
+	  queuedCount_(0), streaming_(false), spareCount_(0),
+	  spareAutoQueue_(true), spareFrames_(0), fdEvent_(nullptr), dequeueBatches_(0),
+	  dequeuedBuffers_(0), streamOnTime_(0), formatsCached_(false)
 {
+	traceSource_ = Tracer::instance()->registerSource(deviceNode);
+
+	MetricsRegistry *registry = MetricsRegistry::instance();
+	buffersMetric_ = registry->counter("v4l2." + deviceNode + ".buffers");
+	dequeueLatencyMetric_ =
+		registry->histogram("v4l2." + deviceNode + ".dequeue-latency-us");
+	streamOnMetric_ =
+		registry->histogram("v4l2." + deviceNode + ".streamon-us");
+	firstFrameMetric_ =
+		registry->histogram("v4l2." + deviceNode + ".first-frame-us");
+
 	/*
 	 * We default to an MMAP based CAPTURE video device, however this will
 	 * be updated based upon the device capabilities.
@@ -323,36 +484,126 @@ int V4L2VideoDevice::open()
 		return -EINVAL;
 	}
 
-	/*
-	 * Set buffer type and wait for read notifications on CAPTURE video
-	 * devices (POLLIN), and write notifications for OUTPUT video devices
-	 * (POLLOUT).
-	 */
+	/* Set the buffer type from the device capabilities. */
 	if (caps_.isVideoCapture()) {
-		fdEvent_ = new EventNotifier(fd(), EventNotifier::Read);
 		bufferType_ = caps_.isMultiplanar()
 			    ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
 			    : V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	} else if (caps_.isVideoOutput()) {
-		fdEvent_ = new EventNotifier(fd(), EventNotifier::Write);
 		bufferType_ = caps_.isMultiplanar()
 			    ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
 			    : V4L2_BUF_TYPE_VIDEO_OUTPUT;
 	} else if (caps_.isMetaCapture()) {
-		fdEvent_ = new EventNotifier(fd(), EventNotifier::Read);
 		bufferType_ = V4L2_BUF_TYPE_META_CAPTURE;
 	} else if (caps_.isMetaOutput()) {
-		fdEvent_ = new EventNotifier(fd(), EventNotifier::Write);
 		bufferType_ = V4L2_BUF_TYPE_META_OUTPUT;
 	} else {
 		LOG(V4L2, Error) << "Device is not a supported type";
 		return -EINVAL;
 	}
 
+	initQueue();
+
+	return 0;
+}
+
+/**
+ * \brief Open a V4L2 video device from an opened file handle and query its
+ * capabilities
+ * \param[in] handle The file descriptor to set
+ * \param[in] type The device type to operate on
+ *
+ * This methods opens a video device from the existing file descriptor \a
+ * handle. Like open(), this method queries the capabilities of the device, but
+ * handles it according to the given device \a type instead of determining its
+ * type from the capabilities. This can be used to force a given device type for
+ * memory-to-memory devices, which expose both an output and a capture queue on
+ * the same device node.
+ *
+ * The file descriptor \a handle is duplicated, and the caller is responsible
+ * for closing the \a handle when it has no further use for it. The close()
+ * method will close the duplicated file descriptor, leaving \a handle
+ * untouched.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::open(int handle, enum v4l2_buf_type type)
+{
+	int ret;
+
+	int newFd = dup(handle);
+	if (newFd < 0) {
+		ret = -errno;
+		LOG(V4L2, Error) << "Failed to duplicate file handle: "
+				 << strerror(-ret);
+		return ret;
+	}
+
+	ret = V4L2Device::setFd(newFd);
+	if (ret < 0) {
+		LOG(V4L2, Error) << "Failed to set file handle: "
+				 << strerror(-ret);
+		::close(newFd);
+		return ret;
+	}
+
+	ret = ioctl(VIDIOC_QUERYCAP, &caps_);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Failed to query device capabilities: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	if (!caps_.isM2M()) {
+		LOG(V4L2, Error) << "Device is not an M2M device";
+		return -EINVAL;
+	}
+
+	if (!caps_.hasStreaming()) {
+		LOG(V4L2, Error) << "Device does not support streaming I/O";
+		return -EINVAL;
+	}
+
+	switch (type) {
+	case V4L2_BUF_TYPE_VIDEO_OUTPUT:
+		bufferType_ = caps_.isMultiplanar()
+			    ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
+			    : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		break;
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
+		bufferType_ = caps_.isMultiplanar()
+			    ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+			    : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		break;
+	default:
+		LOG(V4L2, Error) << "Unsupported buffer type " << type;
+		return -EINVAL;
+	}
+
+	LOG(V4L2, Debug)
+		<< "Opened device " << caps_.bus_info() << ": "
+		<< caps_.driver() << ": " << caps_.card();
+
+	initQueue();
+
+	return 0;
+}
+
+/*
+ * Wait for read notifications on CAPTURE video devices (POLLIN), and write
+ * notifications for OUTPUT video devices (POLLOUT).
+ */
+void V4L2VideoDevice::initQueue()
+{
+	fdEvent_ = new EventNotifier(fd(), V4L2_TYPE_IS_OUTPUT(bufferType_)
+					   ? EventNotifier::Write
+					   : EventNotifier::Read);
 	fdEvent_->activated.connect(this, &V4L2VideoDevice::bufferAvailable);
 	fdEvent_->setEnabled(false);
 
-	return 0;
+	dequeueBatches_ = 0;
+	dequeuedBuffers_ = 0;
 }
 
 /**
@@ -365,6 +616,11 @@ void V4L2VideoDevice::close()
 
 	releaseBuffers();
 	delete fdEvent_;
+	fdEvent_ = nullptr;
+
+	formats_ = {};
+	formatsCached_ = false;
+	currentFormat_ = {};
 
 	V4L2Device::close();
 }
@@ -399,12 +655,19 @@ std::string V4L2VideoDevice::logPrefix() const
  */
 int V4L2VideoDevice::getFormat(V4L2DeviceFormat *format)
 {
+	int ret;
+
 	if (caps_.isMeta())
-		return getFormatMeta(format);
+		ret = getFormatMeta(format);
 	else if (caps_.isMultiplanar())
-		return getFormatMultiplane(format);
+		ret = getFormatMultiplane(format);
 	else
-		return getFormatSingleplane(format);
+		ret = getFormatSingleplane(format);
+
+	if (!ret)
+		currentFormat_ = *format;
+
+	return ret;
 }
 
 /**
@@ -418,12 +681,31 @@ int V4L2VideoDevice::getFormat(V4L2DeviceFormat *format)
  */
 int V4L2VideoDevice::setFormat(V4L2DeviceFormat *format)
 {
+	int ret;
+
 	if (caps_.isMeta())
-		return setFormatMeta(format);
+		ret = setFormatMeta(format);
 	else if (caps_.isMultiplanar())
-		return setFormatMultiplane(format);
+		ret = setFormatMultiplane(format);
 	else
-		return setFormatSingleplane(format);
+		ret = setFormatSingleplane(format);
+
+	currentFormat_ = ret ? V4L2DeviceFormat{} : *format;
+
+	return ret;
+}
+
+/*
+ * Retrieve the format of the device, as cached by the last call to
+ * getFormat() or setFormat(), to avoid a VIDIOC_G_FMT round trip.
+ */
+int V4L2VideoDevice::cachedFormat(V4L2DeviceFormat *format)
+{
+	if (!currentFormat_.planesCount)
+		return getFormat(format);
+
+	*format = currentFormat_;
+	return 0;
 }
 
 int V4L2VideoDevice::getFormatMeta(V4L2DeviceFormat *format)
@@ -442,6 +724,7 @@ int V4L2VideoDevice::getFormatMeta(V4L2DeviceFormat *format)
 	format->size.width = 0;
 	format->size.height = 0;
 	format->fourcc = pix->dataformat;
+	format->modifier = 0;
 	format->planesCount = 1;
 	format->planes[0].bpl = pix->buffersize;
 	format->planes[0].size = pix->buffersize;
@@ -471,6 +754,7 @@ int V4L2VideoDevice::setFormatMeta(V4L2DeviceFormat *format)
 	format->size.width = 0;
 	format->size.height = 0;
 	format->fourcc = format->fourcc;
+	format->modifier = 0;
 	format->planesCount = 1;
 	format->planes[0].bpl = pix->buffersize;
 	format->planes[0].size = pix->buffersize;
@@ -493,7 +777,7 @@ int V4L2VideoDevice::getFormatMultiplane(V4L2DeviceFormat *format)
 
 	format->size.width = pix->width;
 	format->size.height = pix->height;
-	format->fourcc = pix->pixelformat;
+	fromV4L2Fourcc(pix->pixelformat, &format->fourcc, &format->modifier);
 	format->planesCount = pix->num_planes;
 
 	for (unsigned int i = 0; i < format->planesCount; ++i) {
@@ -513,7 +797,7 @@ int V4L2VideoDevice::setFormatMultiplane(V4L2DeviceFormat *format)
 	v4l2Format.type = bufferType_;
 	pix->width = format->size.width;
 	pix->height = format->size.height;
-	pix->pixelformat = format->fourcc;
+	pix->pixelformat = toV4L2Fourcc(format->fourcc, format->modifier);
 	pix->num_planes = format->planesCount;
 	pix->field = V4L2_FIELD_NONE;
 
@@ -534,7 +818,7 @@ int V4L2VideoDevice::setFormatMultiplane(V4L2DeviceFormat *format)
 	 */
 	format->size.width = pix->width;
 	format->size.height = pix->height;
-	format->fourcc = pix->pixelformat;
+	fromV4L2Fourcc(pix->pixelformat, &format->fourcc, &format->modifier);
 	format->planesCount = pix->num_planes;
 	for (unsigned int i = 0; i < format->planesCount; ++i) {
 		format->planes[i].bpl = pix->plane_fmt[i].bytesperline;
@@ -559,7 +843,7 @@ int V4L2VideoDevice::getFormatSingleplane(V4L2DeviceFormat *format)
 
 	format->size.width = pix->width;
 	format->size.height = pix->height;
-	format->fourcc = pix->pixelformat;
+	fromV4L2Fourcc(pix->pixelformat, &format->fourcc, &format->modifier);
 	format->planesCount = 1;
 	format->planes[0].bpl = pix->bytesperline;
 	format->planes[0].size = pix->sizeimage;
@@ -576,7 +860,7 @@ int V4L2VideoDevice::setFormatSingleplane(V4L2DeviceFormat *format)
 	v4l2Format.type = bufferType_;
 	pix->width = format->size.width;
 	pix->height = format->size.height;
-	pix->pixelformat = format->fourcc;
+	pix->pixelformat = toV4L2Fourcc(format->fourcc, format->modifier);
 	pix->bytesperline = format->planes[0].bpl;
 	pix->field = V4L2_FIELD_NONE;
 	ret = ioctl(VIDIOC_S_FMT, &v4l2Format);
@@ -591,7 +875,7 @@ int V4L2VideoDevice::setFormatSingleplane(V4L2DeviceFormat *format)
 	 */
 	format->size.width = pix->width;
 	format->size.height = pix->height;
-	format->fourcc = pix->pixelformat;
+	fromV4L2Fourcc(pix->pixelformat, &format->fourcc, &format->modifier);
 	format->planesCount = 1;
 	format->planes[0].bpl = pix->bytesperline;
 	format->planes[0].size = pix->sizeimage;
@@ -603,27 +887,38 @@ int V4L2VideoDevice::setFormatSingleplane(V4L2DeviceFormat *format)
  * \brief Enumerate all pixel formats and frame sizes
  *
  * Enumerate all pixel formats and frame sizes supported by the video device.
+ * The formats are enumerated the first time this method is called and cached
+ * until the device is closed.
  *
  * \return A list of the supported video device formats
  */
-ImageFormats V4L2VideoDevice::formats()
+const ImageFormats &V4L2VideoDevice::formats()
 {
+	if (formatsCached_)
+		return formats_;
+
 	ImageFormats formats;
 
 	for (unsigned int pixelformat : enumPixelformats()) {
 		std::vector<SizeRange> sizes = enumSizes(pixelformat);
-		if (sizes.empty())
-			return {};
+		if (sizes.empty()) {
+			formats = {};
+			break;
+		}
 
 		if (formats.addFormat(pixelformat, sizes)) {
 			LOG(V4L2, Error)
 				<< "Could not add sizes for pixel format "
 				<< pixelformat;
-			return {};
+			formats = {};
+			break;
 		}
 	}
 
-	return formats;
+	formats_ = std::move(formats);
+	formatsCached_ = isOpen();
+
+	return formats_;
 }
 
 std::vector<unsigned int> V4L2VideoDevice::enumPixelformats()
@@ -653,6 +948,116 @@ std::vector<unsigned int> V4L2VideoDevice::enumPixelformats()
 	return formats;
 }
 
+/**
+ * \brief Enumerate the frame intervals for a pixel format and frame size
+ * \param[in] pixelFormat The pixel format
+ * \param[in] size The frame size
+ *
+ * Enumerate the frame intervals supported by the video device for the
+ * \a pixelFormat and \a size. Devices that support a continuous or stepwise
+ * range of intervals report the minimum and maximum interval only.
+ *
+ * \return The list of supported frame intervals in nanoseconds, or an empty
+ * list if the device doesn't report frame intervals
+ */
+std::vector<uint64_t> V4L2VideoDevice::frameIntervals(unsigned int pixelFormat,
+						      const Size &size)
+{
+	std::vector<uint64_t> intervals;
+	int ret;
+
+	for (unsigned int index = 0;; index++) {
+		struct v4l2_frmivalenum frameInterval = {};
+		frameInterval.index = index;
+		frameInterval.pixel_format = pixelFormat;
+		frameInterval.width = size.width;
+		frameInterval.height = size.height;
+
+		ret = ioctl(VIDIOC_ENUM_FRAMEINTERVALS, &frameInterval);
+		if (ret)
+			break;
+
+		const struct v4l2_fract *min;
+		const struct v4l2_fract *max;
+
+		switch (frameInterval.type) {
+		case V4L2_FRMIVAL_TYPE_DISCRETE:
+			min = max = &frameInterval.discrete;
+			break;
+		case V4L2_FRMIVAL_TYPE_CONTINUOUS:
+		case V4L2_FRMIVAL_TYPE_STEPWISE:
+			min = &frameInterval.stepwise.min;
+			max = &frameInterval.stepwise.max;
+			break;
+		default:
+			LOG(V4L2, Error)
+				<< "Unknown VIDIOC_ENUM_FRAMEINTERVALS type "
+				<< frameInterval.type;
+			return {};
+		}
+
+		if (!min->denominator || !max->denominator)
+			continue;
+
+		intervals.push_back(min->numerator * 1000000000ULL /
+				    min->denominator);
+		if (max != min)
+			intervals.push_back(max->numerator * 1000000000ULL /
+					    max->denominator);
+
+		if (frameInterval.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+			break;
+	}
+
+	if (ret && ret != -EINVAL) {
+		LOG(V4L2, Error)
+			<< "Unable to enumerate frame intervals: "
+			<< strerror(-ret);
+		return {};
+	}
+
+	return intervals;
+}
+
+/**
+ * \brief Set the frame interval
+ * \param[inout] interval The frame interval in nanoseconds
+ *
+ * Set the interval between frames captured by the device with VIDIOC_S_PARM.
+ * The device may adjust the interval to a supported value, the interval
+ * actually applied is returned in \a interval.
+ *
+ * Most devices don't allow changing the frame interval while streaming.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::setFrameInterval(uint64_t *interval)
+{
+	struct v4l2_streamparm parm = {};
+	int ret;
+
+	if (!*interval)
+		return -EINVAL;
+
+	parm.type = bufferType_;
+	parm.parm.capture.timeperframe.numerator = *interval / 1000;
+	parm.parm.capture.timeperframe.denominator = 1000000;
+
+	ret = ioctl(VIDIOC_S_PARM, &parm);
+	if (ret) {
+		LOG(V4L2, Error)
+			<< "Unable to set frame interval: " << strerror(-ret);
+		return ret;
+	}
+
+	const struct v4l2_fract &timeperframe = parm.parm.capture.timeperframe;
+	if (timeperframe.denominator)
+		*interval = timeperframe.numerator * 1000000000ULL /
+			    timeperframe.denominator;
+
+	return 0;
+}
+
 std::vector<SizeRange> V4L2VideoDevice::enumSizes(unsigned int pixelFormat)
 {
 	std::vector<SizeRange> sizes;
@@ -728,6 +1133,8 @@ int V4L2VideoDevice::requestBuffers(unsigned int count)
 		return ret;
 	}
 
+	bufferCaps_ = rb.capabilities;
+
 	LOG(V4L2, Debug) << rb.count << " buffers requested.";
 
 	return rb.count;
@@ -737,6 +1144,15 @@ int V4L2VideoDevice::requestBuffers(unsigned int count)
  * \brief Request buffers to be allocated from the video device and stored in
  * the buffer pool provided.
  * \param[out] pool BufferPool to populate with buffers
+ *
+ * The buffers are exported as dmabufs but not mapped to CPU memory. Mapping is
+ * deferred to the first access to the memory of each plane through
+ * Plane::mem().
+ *
+ * This method only accesses the video device and the \a pool. It may thus be
+ * called concurrently for different video devices, to lower the latency of
+ * buffer allocation in pipelines that contain multiple video devices.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int V4L2VideoDevice::exportBuffers(BufferPool *pool)
@@ -747,7 +1163,7 @@ int V4L2VideoDevice::exportBuffers(BufferPool *pool)
 
 	memoryType_ = V4L2_MEMORY_MMAP;
 
-	ret = requestBuffers(pool->count());
+	ret = requestBuffers(pool->count() + spareCount_);
 	if (ret < 0)
 		return ret;
 
@@ -759,11 +1175,14 @@ int V4L2VideoDevice::exportBuffers(BufferPool *pool)
 		return -ENOMEM;
 	}
 
+	bufferPool_ = pool;
+	unsigned int spares = createSpareBuffers(allocatedBuffers);
+
 	/* Map the buffers. */
-	for (i = 0; i < pool->count(); ++i) {
+	for (i = 0; i < pool->count() + spares; ++i) {
 		struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
 		struct v4l2_buffer buf = {};
-		BufferMemory &buffer = pool->buffers()[i];
+		BufferMemory &buffer = *bufferMemory(i);
 
 		buf.index = i;
 		buf.type = bufferType_;
@@ -794,15 +1213,17 @@ int V4L2VideoDevice::exportBuffers(BufferPool *pool)
 			LOG(V4L2, Error) << "Failed to create plane";
 			break;
 		}
+
+		buffer.shareMappings();
 	}
 
 	if (ret) {
-		requestBuffers(0);
+		releaseBuffers();
 		pool->destroyBuffers();
 		return ret;
 	}
 
-	bufferPool_ = pool;
+	queuedBuffers_.assign(pool->count() + spares, nullptr);
 
 	return 0;
 }
@@ -850,7 +1271,7 @@ int V4L2VideoDevice::importBuffers(BufferPool *pool)
 
 	memoryType_ = V4L2_MEMORY_DMABUF;
 
-	ret = requestBuffers(pool->count());
+	ret = requestBuffers(pool->count() + spareCount_);
 	if (ret < 0)
 		return ret;
 
@@ -865,6 +1286,200 @@ int V4L2VideoDevice::importBuffers(BufferPool *pool)
 	LOG(V4L2, Debug) << "provided pool of " << pool->count() << " buffers";
 	bufferPool_ = pool;
 
+	unsigned int spares = createSpareBuffers(allocatedBuffers);
+	queuedBuffers_.assign(pool->count() + spares, nullptr);
+
+	return 0;
+}
+
+/**
+ * \brief Import the \a pool of buffers backed by application memory
+ * \param[in] pool BufferPool of buffers to import
+ *
+ * Set the video device to capture to user pointers. The planes of the \a pool
+ * buffers are backed by application memory with Plane::setUserPtr(), which
+ * may be done at any time before the buffers are queued. The device then
+ * captures to the application memory directly, without any CPU mapping of
+ * device memory.
+ *
+ * Spare buffers are not created, as no memory is available for them.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::importUserPtrBuffers(BufferPool *pool)
+{
+	int ret;
+
+	memoryType_ = V4L2_MEMORY_USERPTR;
+
+	ret = requestBuffers(pool->count());
+	if (ret < 0)
+		return ret;
+
+	if (static_cast<unsigned int>(ret) < pool->count()) {
+		LOG(V4L2, Error)
+			<< "Not enough buffers provided by V4L2VideoDevice";
+		requestBuffers(0);
+		return -ENOMEM;
+	}
+
+	bufferPool_ = pool;
+
+	unsigned int spares = createSpareBuffers(ret);
+	queuedBuffers_.assign(pool->count() + spares, nullptr);
+
+	return 0;
+}
+
+/**
+ * \brief Import a pool of buffers previously used with the video device
+ * \param[in] pool BufferPool of buffers to import
+ *
+ * Changing the format of a video device requires releasing its buffers first.
+ * This method imports back the buffers of a \a pool that has been exported
+ * from, allocated for or imported in the video device before its buffers were
+ * released with releaseBuffers(), after the format has been changed. The
+ * memory and CPU mappings of the buffers are reused as-is, avoiding memory
+ * reallocation.
+ *
+ * Buffers exported by the device keep their memory as long as their dmabufs
+ * are open, and are imported back as dmabufs. Buffers with no plane, such as
+ * external memory buffers whose dmabufs are provided when they are queued, are
+ * not checked. Buffers backed by application memory are imported back as user
+ * pointers.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOSPC The buffers are too small for the current format
+ */
+int V4L2VideoDevice::reimportBuffers(BufferPool *pool)
+{
+	V4L2DeviceFormat format = {};
+	bool userptr = memoryType_ == V4L2_MEMORY_USERPTR;
+	int ret;
+
+	ret = cachedFormat(&format);
+	if (ret)
+		return ret;
+
+	for (const BufferMemory &mem : pool->buffers()) {
+		const std::vector<Plane> &planes = mem.planes();
+
+		if (planes.empty())
+			continue;
+
+		if (planes.size() != format.planesCount)
+			return -ENOSPC;
+
+		for (unsigned int i = 0; i < planes.size(); ++i) {
+			if ((!userptr && planes[i].dmabuf() == -1) ||
+			    planes[i].length() < format.planes[i].size)
+				return -ENOSPC;
+		}
+	}
+
+	return userptr ? importUserPtrBuffers(pool) : importBuffers(pool);
+}
+
+/*
+ * Create the spare buffers in the V4L2 buffer slots available after the
+ * buffers of bufferPool_, as allocated by VIDIOC_REQBUFS. With MMAP memory the
+ * driver allocates the spare buffers memory, which is exported by the caller.
+ * With DMABUF memory, the spare buffers are allocated with the dmabuf
+ * allocator. With USERPTR memory, no spare buffer is created. Return the number
+ * of spare buffers created.
+ */
+unsigned int V4L2VideoDevice::createSpareBuffers(unsigned int available)
+{
+	unsigned int count = std::min(spareCount_,
+				      available - bufferPool_->count());
+
+	spareBuffers_.clear();
+	sparePool_ = utils::make_unique<BufferPool>();
+
+	if (!count || memoryType_ == V4L2_MEMORY_USERPTR)
+		return 0;
+
+	sparePool_->createBuffers(count);
+
+	if (memoryType_ == V4L2_MEMORY_DMABUF) {
+		V4L2DeviceFormat format = {};
+		std::vector<unsigned int> planeSizes;
+
+		int ret = cachedFormat(&format);
+		for (unsigned int i = 0; !ret && i < format.planesCount; ++i)
+			planeSizes.push_back(format.planes[i].size);
+
+		if (!ret)
+			ret = DmaBufAllocator::instance()->allocate(sparePool_.get(),
+								    planeSizes);
+		if (ret) {
+			LOG(V4L2, Warning)
+				<< "Failed to allocate spare buffers: "
+				<< strerror(-ret);
+			sparePool_->destroyBuffers();
+			return 0;
+		}
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+		spareBuffers_.emplace_back(new Buffer(bufferPool_->count() + i));
+
+	LOG(V4L2, Debug) << "Created " << count << " spare buffers";
+
+	return count;
+}
+
+BufferMemory *V4L2VideoDevice::bufferMemory(unsigned int index)
+{
+	if (index < bufferPool_->count())
+		return &bufferPool_->buffers()[index];
+
+	return &sparePool_->buffers()[index - bufferPool_->count()];
+}
+
+/**
+ * \brief Allocate buffers with a dmabuf allocator and import them
+ * \param[in] pool BufferPool to populate with buffers
+ * \param[in] allocator The dmabuf allocator
+ *
+ * Allocate memory for all buffers of the \a pool with the \a allocator,
+ * sized according to the current format of the video device, and import the
+ * buffers in the video device. This offers an alternative to exportBuffers()
+ * that doesn't require the driver to allocate memory, and allows sharing the
+ * memory with other devices.
+ *
+ * On failure the pool memory is handed back to the allocator, and the caller
+ * may fall back to exportBuffers().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::allocateBuffers(BufferPool *pool,
+				     DmaBufAllocator *allocator)
+{
+	V4L2DeviceFormat format = {};
+	int ret;
+
+	if (!allocator->isValid())
+		return -ENODEV;
+
+	ret = cachedFormat(&format);
+	if (ret)
+		return ret;
+
+	std::vector<unsigned int> planeSizes;
+	for (unsigned int i = 0; i < format.planesCount; ++i)
+		planeSizes.push_back(format.planes[i].size);
+
+	ret = allocator->allocate(pool, planeSizes);
+	if (ret)
+		return ret;
+
+	ret = importBuffers(pool);
+	if (ret) {
+		allocator->release(pool);
+		return ret;
+	}
+
 	return 0;
 }
 
@@ -875,23 +1490,49 @@ int V4L2VideoDevice::releaseBuffers()
 {
 	LOG(V4L2, Debug) << "Releasing bufferPool";
 
+	if (sparePool_) {
+		if (memoryType_ == V4L2_MEMORY_DMABUF)
+			DmaBufAllocator::instance()->release(sparePool_.get());
+		sparePool_.reset();
+	}
+	spareBuffers_.clear();
+
 	bufferPool_ = nullptr;
+	queuedBuffers_.clear();
+	queuedCount_ = 0;
 
 	return requestBuffers(0);
 }
 
+/**
+ * \fn V4L2VideoDevice::supportsRequests()
+ * \brief Check if the video device supports queueing buffers with requests
+ *
+ * Support for requests is reported by the driver when buffers are allocated or
+ * imported. This method shall thus only be called after exportBuffers() or
+ * importBuffers().
+ *
+ * \return True if buffers can be bound to media requests, false otherwise
+ */
+
 /**
  * \brief Queue a buffer into the video device
  * \param[in] buffer The buffer to be queued
+ * \param[in] request The media request to bind the buffer to
  *
  * For capture video devices the \a buffer will be filled with data by the
  * device. For output video devices the \a buffer shall contain valid data and
  * will be processed by the device. Once the device has finished processing the
  * buffer, it will be available for dequeue.
  *
+ * If a \a request is specified, the buffer is bound to the request and only
+ * handed to the driver when the request is queued, atomically with the
+ * controls bound to the same request. The device shall support requests, as
+ * reported by supportsRequests().
+ *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::queueBuffer(Buffer *buffer)
+int V4L2VideoDevice::queueBuffer(Buffer *buffer, MediaRequest *request)
 {
 	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
 	struct v4l2_buffer buf = {};
@@ -903,20 +1544,92 @@ int V4L2VideoDevice::queueBuffer(Buffer *buffer)
 	buf.field = V4L2_FIELD_NONE;
 
 	bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
-	BufferMemory *mem = &bufferPool_->buffers()[buf.index];
+	BufferMemory *mem = bufferMemory(buf.index);
 	const std::vector<Plane> &planes = mem->planes();
+	unsigned int numPlanes = planes.size();
+	const std::vector<int> &dmabufs = buffer->dmabufs();
+
+	if (buf.memory == V4L2_MEMORY_DMABUF && !dmabufs.empty()) {
+		/*
+		 * Queue the dmabufs of buffers imported from the application
+		 * directly, without mapping their memory.
+		 */
+		numPlanes = std::find(dmabufs.begin(), dmabufs.end(), -1)
+			  - dmabufs.begin();
+		if (!numPlanes || numPlanes > VIDEO_MAX_PLANES) {
+			LOG(V4L2, Error)
+				<< "Invalid number of dmabufs for buffer "
+				<< buf.index;
+			return -EINVAL;
+		}
 
-	if (buf.memory == V4L2_MEMORY_DMABUF) {
 		if (multiPlanar) {
-			for (unsigned int p = 0; p < planes.size(); ++p)
+			for (unsigned int p = 0; p < numPlanes; ++p)
+				v4l2Planes[p].m.fd = dmabufs[p];
+		} else {
+			buf.m.fd = dmabufs[0];
+		}
+	} else if (buf.memory == V4L2_MEMORY_DMABUF) {
+		/*
+		 * Reject imported buffers too small for the current format
+		 * without a round trip to the driver. Buffers whose planes
+		 * don't map to the format planes are left to the driver.
+		 */
+		if (planes.size() == currentFormat_.planesCount) {
+			for (unsigned int p = 0; p < planes.size(); ++p) {
+				if (planes[p].length() >= currentFormat_.planes[p].size)
+					continue;
+
+				LOG(V4L2, Error)
+					<< "Buffer " << buf.index << " plane " << p
+					<< " too small for format " << currentFormat_;
+				return -EINVAL;
+			}
+		}
+
+		if (multiPlanar) {
+			for (unsigned int p = 0; p < planes.size(); ++p) {
 				v4l2Planes[p].m.fd = planes[p].dmabuf();
+				v4l2Planes[p].data_offset = planes[p].offset();
+			}
 		} else {
 			buf.m.fd = planes[0].dmabuf();
 		}
+	} else if (buf.memory == V4L2_MEMORY_USERPTR) {
+		if (planes.empty() || planes.size() > VIDEO_MAX_PLANES) {
+			LOG(V4L2, Error)
+				<< "Buffer " << buf.index << " has no user memory";
+			return -EINVAL;
+		}
+
+		for (unsigned int p = 0; p < planes.size(); ++p) {
+			Plane &plane = mem->planes()[p];
+			bool valid = plane.dmabuf() == -1 && plane.mem();
+
+			if (valid && planes.size() == currentFormat_.planesCount)
+				valid = plane.length() >= currentFormat_.planes[p].size;
+
+			if (!valid) {
+				LOG(V4L2, Error)
+					<< "Buffer " << buf.index << " plane " << p
+					<< " user memory invalid for format "
+					<< currentFormat_;
+				return -EINVAL;
+			}
+
+			unsigned long userptr = reinterpret_cast<unsigned long>(plane.mem());
+			if (multiPlanar) {
+				v4l2Planes[p].m.userptr = userptr;
+				v4l2Planes[p].length = plane.length();
+			} else {
+				buf.m.userptr = userptr;
+				buf.length = plane.length();
+			}
+		}
 	}
 
 	if (multiPlanar) {
-		buf.length = planes.size();
+		buf.length = numPlanes;
 		buf.m.planes = v4l2Planes;
 	}
 
@@ -927,6 +1640,11 @@ int V4L2VideoDevice::queueBuffer(Buffer *buffer)
 		buf.timestamp.tv_usec = (buffer->timestamp_ / 1000) % 1000000;
 	}
 
+	if (request) {
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request->fd();
+	}
+
 	LOG(V4L2, Debug) << "Queueing buffer " << buf.index;
 
 	ret = ioctl(VIDIOC_QBUF, &buf);
@@ -937,14 +1655,41 @@ int V4L2VideoDevice::queueBuffer(Buffer *buffer)
 		return ret;
 	}
 
-	if (queuedBuffers_.empty())
+	if (!queuedCount_)
 		fdEvent_->setEnabled(true);
 
 	queuedBuffers_[buf.index] = buffer;
+	queuedCount_++;
+
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled())
+		tracer->record(Tracer::QueueBuffer, traceSource_,
+			       buffer->request(), buffer);
 
 	return 0;
 }
 
+/**
+ * \brief Queue a spare buffer into the video device
+ *
+ * Queue the first spare buffer not currently queued to the device. The frame
+ * captured into the spare buffer is dropped and counted in spareFrames(). This
+ * allows skipping individual frames on a capture device when the spare buffers
+ * are not queued automatically, see setSpareBufferCount().
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENOBUFS All spare buffers are queued, or the device has none
+ */
+int V4L2VideoDevice::queueSpareBuffer()
+{
+	for (std::unique_ptr<Buffer> &buffer : spareBuffers_) {
+		if (!queuedBuffers_[buffer->index()])
+			return queueBuffer(buffer.get());
+	}
+
+	return -ENOBUFS;
+}
+
 /**
  * \brief Queue all buffers into the video device
  *
@@ -972,7 +1717,7 @@ std::vector<std::unique_ptr<Buffer>> V4L2VideoDevice::queueAllBuffers()
 {
 	int ret;
 
-	if (!queuedBuffers_.empty())
+	if (queuedCount_)
 		return {};
 
 	if (V4L2_TYPE_IS_OUTPUT(bufferType_))
@@ -991,11 +1736,40 @@ std::vector<std::unique_ptr<Buffer>> V4L2VideoDevice::queueAllBuffers()
 	return buffers;
 }
 
+/**
+ * \brief Forget a buffer bound to a media request that couldn't be queued
+ * \param[in] buffer The buffer
+ *
+ * Buffers queued with a media request are only handed to the driver when the
+ * request is queued. If the request can't be queued, the caller shall
+ * reinitialise it, which releases the buffers bound to the request, and call
+ * this method to record that \a buffer isn't queued to the device anymore. The
+ * bufferReady signal isn't emitted for \a buffer.
+ *
+ * Calling this method for a buffer not queued to the device has no effect.
+ */
+void V4L2VideoDevice::unqueueBuffer(Buffer *buffer)
+{
+	unsigned int index = buffer->index();
+	if (index >= queuedBuffers_.size() || queuedBuffers_[index] != buffer)
+		return;
+
+	LOG(V4L2, Debug) << "Unqueueing buffer " << index;
+
+	queuedBuffers_[index] = nullptr;
+	queuedCount_--;
+
+	if (!queuedCount_)
+		fdEvent_->setEnabled(false);
+}
+
 /**
  * \brief Dequeue the next available buffer from the video device
  *
  * This method dequeues the next available buffer from the device. If no buffer
- * is available to be dequeued it will return nullptr immediately.
+ * is available to be dequeued it will return nullptr immediately. As the
+ * device is opened in non-blocking mode, this case is reported by the
+ * VIDIOC_DQBUF ioctl with -EAGAIN and is not considered as an error.
  *
  * \return A pointer to the dequeued buffer on success, or nullptr otherwise
  */
@@ -1015,28 +1789,60 @@ Buffer *V4L2VideoDevice::dequeueBuffer()
 
 	ret = ioctl(VIDIOC_DQBUF, &buf);
 	if (ret < 0) {
-		LOG(V4L2, Error)
-			<< "Failed to dequeue buffer: " << strerror(-ret);
+		if (ret != -EAGAIN)
+			LOG(V4L2, Error)
+				<< "Failed to dequeue buffer: " << strerror(-ret);
 		return nullptr;
 	}
 
-	ASSERT(buf.index < bufferPool_->count());
+	ASSERT(buf.index < queuedBuffers_.size());
 
-	auto it = queuedBuffers_.find(buf.index);
-	Buffer *buffer = it->second;
-	queuedBuffers_.erase(it);
+	Buffer *buffer = queuedBuffers_[buf.index];
+	queuedBuffers_[buf.index] = nullptr;
+	queuedCount_--;
 
-	if (queuedBuffers_.empty())
+	if (!queuedCount_)
 		fdEvent_->setEnabled(false);
 
 	buffer->index_ = buf.index;
 	buffer->bytesused_ = buf.bytesused;
 	buffer->timestamp_ = buf.timestamp.tv_sec * 1000000000ULL
 			   + buf.timestamp.tv_usec * 1000ULL;
+	buffer->clock_ = (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+			 V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+		       ? ClockMonotonic : ClockUnknown;
 	buffer->sequence_ = buf.sequence;
+	buffer->flags_ = buf.flags & V4L2_BUF_FLAG_KEYFRAME
+		       ? Buffer::FlagKeyFrame : 0;
 	buffer->status_ = buf.flags & V4L2_BUF_FLAG_ERROR
 			? Buffer::BufferError : Buffer::BufferSuccess;
 
+	buffersMetric_->add();
+
+	/*
+	 * Measure the dequeue latency when the driver timestamps buffers with
+	 * the monotonic clock.
+	 */
+	uint64_t now = utils::monotonic_ns();
+	if (buffer->clock_ == ClockMonotonic && buffer->timestamp_ &&
+	    now >= buffer->timestamp_)
+		dequeueLatencyMetric_->add((now - buffer->timestamp_) / 1000);
+
+	/* Measure the time to the first frame after starting the stream. */
+	if (streamOnTime_) {
+		uint64_t latency = (now - streamOnTime_) / 1000;
+		streamOnTime_ = 0;
+
+		firstFrameMetric_->add(latency);
+		LOG(V4L2, Debug) << "First frame dequeued " << latency
+				 << "us after stream on";
+	}
+
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled())
+		tracer->record(Tracer::DequeueBuffer, traceSource_,
+			       buffer->request(), buffer);
+
 	return buffer;
 }
 
@@ -1044,24 +1850,121 @@ Buffer *V4L2VideoDevice::dequeueBuffer()
  * \brief Slot to handle completed buffer events from the V4L2 video device
  * \param[in] notifier The event notifier
  *
- * When this slot is called, a Buffer has become available from the device, and
- * will be emitted through the bufferReady Signal.
+ * When this slot is called, one or more Buffers have become available from the
+ * device. All of them are dequeued in a single pass, until the device reports
+ * that no more buffer is ready, and each of them is emitted through the
+ * bufferReady Signal. This avoids going through a full event loop iteration
+ * for every buffer when the device completes buffers faster than the event
+ * loop processes them.
  *
  * For Capture video devices the Buffer will contain valid data.
  * For Output video devices the Buffer can be considered empty.
  */
 void V4L2VideoDevice::bufferAvailable(EventNotifier *notifier)
 {
-	Buffer *buffer = dequeueBuffer();
-	if (!buffer)
-		return;
+	unsigned int count = 0;
 
-	LOG(V4L2, Debug) << "Buffer " << buffer->index() << " is available";
+	/*
+	 * Stop as soon as no buffer is queued, as the bufferReady slots may
+	 * have stopped the stream, in which case all the remaining buffers
+	 * have already been returned.
+	 */
+	while (queuedCount_) {
+		Buffer *buffer = dequeueBuffer();
+		if (!buffer)
+			break;
+
+		LOG(V4L2, Debug) << "Buffer " << buffer->index() << " is available";
+
+		count++;
+
+		if (buffer->index() >= bufferPool_->count()) {
+			LOG(V4L2, Debug) << "Dropping frame captured in spare buffer";
+			spareFrames_++;
+			continue;
+		}
+
+		/* Notify anyone listening to the device. */
+		bufferReady.emit(buffer);
+	}
 
-	/* Notify anyone listening to the device. */
-	bufferReady.emit(buffer);
+	queueSpareBuffers();
+
+	if (!count)
+		return;
+
+	dequeueBatches_++;
+	dequeuedBuffers_ += count;
 }
 
+/**
+ * \fn V4L2VideoDevice::setSpareBufferCount()
+ * \brief Set the number of spare buffers for the video device
+ * \param[in] count The number of spare buffers
+ * \param[in] autoQueue Queue the spare buffers automatically while streaming
+ *
+ * The spare buffers are created by the next call to exportBuffers(),
+ * importBuffers() or allocateBuffers(), if the driver can provide enough
+ * buffers. The \a count shall be lower than the number of buffers in the pool,
+ * as frames are dropped whenever a spare buffer is queued before the buffers
+ * of the pool.
+ *
+ * When \a autoQueue is false, the spare buffers are only queued by
+ * queueSpareBuffer(), and \a count may be as large as the number of buffers in
+ * the pool.
+ *
+ * Devices whose frames are not consumed, but which must be fed with buffers
+ * for other devices to operate, can use an empty pool with automatically
+ * queued spare buffers. All frames are then captured into the spare buffers,
+ * which are recycled internally.
+ */
+
+/**
+ * \fn V4L2VideoDevice::spareBufferCount()
+ * \brief Retrieve the number of spare buffers created for the video device
+ * \return The number of spare buffers
+ */
+
+/**
+ * \fn V4L2VideoDevice::sparePool()
+ * \brief Retrieve the pool of the spare buffers memory
+ * \return The spare buffers pool, or nullptr if no buffers have been allocated
+ */
+
+/**
+ * \fn V4L2VideoDevice::spareFrames()
+ * \brief Retrieve the number of frames captured into spare buffers
+ *
+ * Frames are captured into spare buffers when no buffer from the pool is
+ * queued to the device, for instance when the application doesn't queue
+ * requests fast enough. Those frames are dropped.
+ *
+ * \return The number of frames dropped since the device was opened
+ */
+
+/**
+ * \fn V4L2VideoDevice::dequeueBatches()
+ * \brief Retrieve the number of buffer dequeue batches
+ *
+ * A dequeue batch is a group of buffers dequeued from the device in response
+ * to a single buffer event notification. The average batch depth can be
+ * computed by dividing dequeuedBuffers() by dequeueBatches().
+ *
+ * \return The number of buffer dequeue batches since the device was opened
+ */
+
+/**
+ * \fn V4L2VideoDevice::queuedBufferCount()
+ * \brief Retrieve the number of buffers currently queued to the device
+ * \return The number of buffers queued to the device and not yet dequeued
+ */
+
+/**
+ * \fn V4L2VideoDevice::dequeuedBuffers()
+ * \brief Retrieve the number of buffers dequeued in response to buffer events
+ * \return The number of buffers dequeued since the device was opened
+ */
+
 /**
  * \var V4L2VideoDevice::bufferReady
  * \brief A Signal emitted when a buffer completes
@@ -1075,6 +1978,8 @@ int V4L2VideoDevice::streamOn()
 {
 	int ret;
 
+	uint64_t start = utils::monotonic_ns();
+
 	ret = ioctl(VIDIOC_STREAMON, &bufferType_);
 	if (ret < 0) {
 		LOG(V4L2, Error)
@@ -1082,9 +1987,44 @@ int V4L2VideoDevice::streamOn()
 		return ret;
 	}
 
+	streamOnTime_ = utils::monotonic_ns();
+
+	uint64_t latency = (streamOnTime_ - start) / 1000;
+	streamOnMetric_->add(latency);
+	LOG(V4L2, Debug) << "Stream on took " << latency << "us";
+
+	Tracer *tracer = Tracer::instance();
+	if (tracer->enabled())
+		tracer->record(Tracer::StreamOn, traceSource_, nullptr);
+
+	streaming_ = true;
+	queueSpareBuffers();
+
 	return 0;
 }
 
+/*
+ * Queue spare buffers until the number of queued buffers reaches the number of
+ * spare buffers, to keep the device fed while the application doesn't queue
+ * buffers.
+ */
+void V4L2VideoDevice::queueSpareBuffers()
+{
+	if (!streaming_ || !spareAutoQueue_)
+		return;
+
+	for (std::unique_ptr<Buffer> &buffer : spareBuffers_) {
+		if (queuedCount_ >= spareBuffers_.size())
+			break;
+
+		if (queuedBuffers_[buffer->index()])
+			continue;
+
+		if (queueBuffer(buffer.get()))
+			break;
+	}
+}
+
 /**
  * \brief Stop the video stream
  *
@@ -1106,17 +2046,25 @@ int V4L2VideoDevice::streamOff()
 		return ret;
 	}
 
-	/* Send back all queued buffers. */
-	for (auto it : queuedBuffers_) {
-		unsigned int index = it.first;
-		Buffer *buffer = it.second;
+	streaming_ = false;
+
+	/* Send back all queued buffers, except for the spare buffers. */
+	for (unsigned int index = 0; index < queuedBuffers_.size(); ++index) {
+		Buffer *buffer = queuedBuffers_[index];
+		if (!buffer)
+			continue;
+
+		queuedBuffers_[index] = nullptr;
+		queuedCount_--;
+
+		if (index >= bufferPool_->count())
+			continue;
 
 		buffer->index_ = index;
 		buffer->cancel();
 		bufferReady.emit(buffer);
 	}
 
-	queuedBuffers_.clear();
 	fdEvent_->setEnabled(false);
 
 	return 0;
@@ -1143,4 +2091,107 @@ V4L2VideoDevice *V4L2VideoDevice::fromEntityName(const MediaDevice *media,
 	return new V4L2VideoDevice(mediaEntity);
 }
 
+/**
+ * \class V4L2M2MDevice
+ * \brief Memory-to-Memory video device
+ *
+ * Hardware scalers, format converters and codecs are commonly exposed as V4L2
+ * memory-to-memory devices. Frames queued to the output queue of the device are
+ * processed by the hardware into buffers of its capture queue. Both queues are
+ * accessed through the same file handle, while a V4L2VideoDevice handles a
+ * single queue.
+ *
+ * The V4L2M2MDevice manages two V4L2VideoDevice instances on the same file
+ * handle, one for the output queue and one for the capture queue, accessed
+ * with output() and capture(). Each instance is otherwise used as any other
+ * video device, to set formats, to allocate or import buffers, and to queue
+ * buffers and receive them with the V4L2VideoDevice::bufferReady signal.
+ *
+ * Importing the buffers captured by another video device in the output queue
+ * with V4L2VideoDevice::importBuffers() chains the devices with dmabufs,
+ * without copying the frames.
+ */
+
+/**
+ * \brief Create a new V4L2M2MDevice from the \a deviceNode
+ * \param[in] deviceNode The file-system path to the video device node
+ */
+V4L2M2MDevice::V4L2M2MDevice(const std::string &deviceNode)
+	: deviceNode_(deviceNode)
+{
+	output_ = new V4L2VideoDevice(deviceNode);
+	capture_ = new V4L2VideoDevice(deviceNode);
+}
+
+V4L2M2MDevice::~V4L2M2MDevice()
+{
+	delete capture_;
+	delete output_;
+}
+
+/**
+ * \brief Open a V4L2 Memory to Memory device
+ *
+ * Open the device node and prepare the two V4L2VideoDevice instances to handle
+ * their respective buffer queues.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2M2MDevice::open()
+{
+	int ret;
+
+	/*
+	 * The output and capture V4L2VideoDevice instances use the same file
+	 * handle for the same device node. The local file handle can be closed
+	 * as V4L2VideoDevice::open() duplicates it.
+	 */
+	int fd = ::open(deviceNode_.c_str(), O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		ret = -errno;
+		LOG(V4L2, Error)
+			<< "Failed to open V4L2 M2M device: " << strerror(-ret);
+		return ret;
+	}
+
+	ret = output_->open(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+	if (!ret)
+		ret = capture_->open(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+
+	::close(fd);
+
+	if (ret)
+		close();
+
+	return ret;
+}
+
+/**
+ * \brief Close the memory-to-memory device, releasing any resources acquired
+ * by open()
+ */
+void V4L2M2MDevice::close()
+{
+	capture_->close();
+	output_->close();
+}
+
+/**
+ * \fn V4L2M2MDevice::deviceNode()
+ * \brief Retrieve the device node path
+ * \return The device node path
+ */
+
+/**
+ * \fn V4L2M2MDevice::output()
+ * \brief Retrieve the output V4L2VideoDevice instance
+ * \return The V4L2VideoDevice for the output queue
+ */
+
+/**
+ * \fn V4L2M2MDevice::capture()
+ * \brief Retrieve the capture V4L2VideoDevice instance
+ * \return The V4L2VideoDevice for the capture queue
+ */
+
 } /* namespace libcamera */
@@ -5,11 +5,21 @@
  * format_convert.cpp - qcam - Convert buffer to RGB
  */
 
+#include <algorithm>
 #include <errno.h>
 
 #include <linux/videodev2.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <QImage>
+#include <QRunnable>
+#include <QThread>
 
 #include "format_converter.h"
 
@@ -27,29 +37,71 @@
 #define CLIP(x)			CLAMP(x,0,255)
 #endif
 
+/*
+ * Convert a band of rows of a frame in a worker thread of the converter thread
+ * pool.
+ */
+class ConversionBand : public QRunnable
+{
+public:
+	ConversionBand(FormatConverter *converter, const MappedFrame &frame,
+		       unsigned char *dst, unsigned int first, unsigned int last)
+		: converter_(converter), frame_(frame), dst_(dst), first_(first),
+		  last_(last)
+	{
+	}
+
+	void run() override
+	{
+		converter_->convertRows(frame_, dst_, first_, last_);
+	}
+
+private:
+	FormatConverter *converter_;
+	MappedFrame frame_;
+	unsigned char *dst_;
+	unsigned int first_;
+	unsigned int last_;
+};
+
+FormatConverter::FormatConverter()
+{
+	/* The thread calling convert() converts one of the bands itself. */
+	pool_.setMaxThreadCount(std::max(QThread::idealThreadCount() - 1, 1));
+}
+
+/*
+ * Configure the converter for frames of the given format and size. The stride
+ * is the number of bytes between two consecutive lines of the first plane. A
+ * zero stride selects lines without padding.
+ */
 int FormatConverter::configure(unsigned int format, unsigned int width,
-			       unsigned int height)
+			       unsigned int height, unsigned int stride)
 {
 	switch (format) {
 	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV12M:
 		formatFamily_ = NV;
 		horzSubSample_ = 2;
 		vertSubSample_ = 2;
 		nvSwap_ = false;
 		break;
 	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV21M:
 		formatFamily_ = NV;
 		horzSubSample_ = 2;
 		vertSubSample_ = 2;
 		nvSwap_ = true;
 		break;
 	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV16M:
 		formatFamily_ = NV;
 		horzSubSample_ = 2;
 		vertSubSample_ = 1;
 		nvSwap_ = false;
 		break;
 	case V4L2_PIX_FMT_NV61:
+	case V4L2_PIX_FMT_NV61M:
 		formatFamily_ = NV;
 		horzSubSample_ = 2;
 		vertSubSample_ = 1;
@@ -115,28 +167,79 @@ int FormatConverter::configure(unsigned int format, unsigned int width,
 		return -EINVAL;
 	};
 
+	if (!stride) {
+		switch (formatFamily_) {
+		case NV:
+			stride = width;
+			break;
+		case RGB:
+			stride = width * bpp_;
+			break;
+		case YUV:
+			stride = width * 2;
+			break;
+		case MJPEG:
+			break;
+		}
+	}
+
 	format_ = format;
 	width_ = width;
 	height_ = height;
+	stride_ = stride;
+
+	selectRowConverters();
 
 	return 0;
 }
 
-void FormatConverter::convert(const unsigned char *src, size_t size,
-			      QImage *dst)
+/*
+ * Convert a frame to the dst image. Uncompressed frames are split in bands of
+ * rows converted concurrently by the threads of the converter thread pool and
+ * the calling thread, which returns once all bands have been converted.
+ */
+void FormatConverter::convert(const MappedFrame &frame, QImage *dst)
+{
+	if (formatFamily_ == MJPEG) {
+		dst->loadFromData(frame.planes[0], frame.size, "JPEG");
+		return;
+	}
+
+	unsigned int bands = std::min<unsigned int>(pool_.maxThreadCount() + 1,
+						    height_ / MinBandHeight);
+	bands = std::max(bands, 1U);
+
+	/* Keep bands aligned to vertically subsampled chroma rows. */
+	unsigned int bandHeight = ((height_ + bands - 1) / bands + 1) & ~1U;
+	unsigned int first = 0;
+
+	for (; first + bandHeight < height_; first += bandHeight)
+		pool_.start(new ConversionBand(this, frame, dst->bits(), first,
+					       first + bandHeight));
+
+	convertRows(frame, dst->bits(), first, height_);
+
+	pool_.waitForDone();
+}
+
+/*
+ * Convert rows [first, last[ of a frame. dst points to the beginning of the
+ * destination image.
+ */
+void FormatConverter::convertRows(const MappedFrame &frame, unsigned char *dst,
+				  unsigned int first, unsigned int last)
 {
 	switch (formatFamily_) {
-	case MJPEG:
-		dst->loadFromData(src, size, "JPEG");
-		break;
 	case YUV:
-		convertYUV(src, dst->bits());
+		convertYUV(frame, dst, first, last);
 		break;
 	case RGB:
-		convertRGB(src, dst->bits());
+		convertRGB(frame, dst, first, last);
 		break;
 	case NV:
-		convertNV(src, dst->bits());
+		convertNV(frame, dst, first, last);
+		break;
+	case MJPEG:
 		break;
 	};
 }
@@ -151,23 +254,374 @@ static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
 	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
 }
 
-void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst)
+/*
+ * The SIMD kernels below implement the same integer arithmetic as
+ * yuv_to_rgb(), with 32-bit intermediate values, and produce identical results.
+ * They convert 8 (SSE2 and NEON) or 16 (AVX2) pixels per iteration, from luma
+ * values and pairs of Cb and Cr values shared by two horizontally adjacent
+ * pixels.
+ *
+ * The x86 kernels compute the chroma contributions with a multiply-add of the
+ * interleaved 16-bit Cb and Cr values with pairs of 16-bit coefficients, packed
+ * in 32-bit values with the Cb coefficient in the low half.
+ */
+#define CHROMA_COEFFS(cb, cr)	static_cast<int>((static_cast<unsigned int>(cr) << 16) | \
+					 (static_cast<unsigned int>(cb) & 0xffff))
+
+#if defined(__SSE2__)
+
+/*
+ * Compute one BGRA component of 8 pixels from their luma contribution, stored
+ * in two vectors of 4 32-bit values, and the chroma contribution of the 4 pixel
+ * pairs.
+ */
+static inline __m128i yuv_component_sse2(__m128i y0, __m128i y1, __m128i c)
+{
+	__m128i v0 = _mm_add_epi32(y0, _mm_unpacklo_epi32(c, c));
+	__m128i v1 = _mm_add_epi32(y1, _mm_unpackhi_epi32(c, c));
+	__m128i v = _mm_packs_epi32(_mm_srai_epi32(v0, RGBSHIFT),
+				    _mm_srai_epi32(v1, RGBSHIFT));
+
+	return _mm_packus_epi16(v, v);
+}
+
+/*
+ * Convert 8 pixels to BGRA. The luma values are stored as 16-bit values in y,
+ * and the Cb and Cr values of the 4 pixel pairs as interleaved 16-bit values
+ * in cbcr.
+ */
+static inline void yuv_to_bgra_sse2(__m128i y, __m128i cbcr,
+				    unsigned char *dst)
+{
+	__m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i de = _mm_sub_epi16(cbcr, _mm_set1_epi16(128));
+
+	__m128i lo = _mm_mullo_epi16(c, _mm_set1_epi16(298));
+	__m128i hi = _mm_mulhi_epi16(c, _mm_set1_epi16(298));
+	__m128i y0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi),
+				   _mm_set1_epi32(128));
+	__m128i y1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi),
+				   _mm_set1_epi32(128));
+
+	__m128i rc = _mm_madd_epi16(de, _mm_set1_epi32(CHROMA_COEFFS(0, 409)));
+	__m128i gc = _mm_madd_epi16(de, _mm_set1_epi32(CHROMA_COEFFS(-100, -208)));
+	__m128i bc = _mm_madd_epi16(de, _mm_set1_epi32(CHROMA_COEFFS(516, 0)));
+
+	__m128i r = yuv_component_sse2(y0, y1, rc);
+	__m128i g = yuv_component_sse2(y0, y1, gc);
+	__m128i b = yuv_component_sse2(y0, y1, bc);
+
+	__m128i bg = _mm_unpacklo_epi8(b, g);
+	__m128i ra = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+			 _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+			 _mm_unpackhi_epi16(bg, ra));
+}
+
+static inline __m128i swap_chroma_sse2(__m128i cbcr)
+{
+	return _mm_or_si128(_mm_slli_epi32(cbcr, 16), _mm_srli_epi32(cbcr, 16));
+}
+
+static unsigned int convert_nv_row_sse2(const unsigned char *src_y,
+					const unsigned char *src_c,
+					unsigned char *dst, unsigned int width,
+					bool swap)
 {
-	unsigned int c_stride = width_ * (2 / horzSubSample_);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i y = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_y + x));
+		__m128i cbcr = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src_c + x));
+
+		y = _mm_unpacklo_epi8(y, zero);
+		cbcr = _mm_unpacklo_epi8(cbcr, zero);
+		if (swap)
+			cbcr = swap_chroma_sse2(cbcr);
+
+		yuv_to_bgra_sse2(y, cbcr, dst + x * 4);
+	}
+
+	return x;
+}
+
+static unsigned int convert_yuv_row_sse2(const unsigned char *src,
+					 unsigned char *dst, unsigned int width,
+					 bool yFirst, bool swap)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2));
+		__m128i even = _mm_and_si128(data, mask);
+		__m128i odd = _mm_srli_epi16(data, 8);
+
+		__m128i y = yFirst ? even : odd;
+		__m128i cbcr = yFirst ? odd : even;
+		if (swap)
+			cbcr = swap_chroma_sse2(cbcr);
+
+		yuv_to_bgra_sse2(y, cbcr, dst + x * 4);
+	}
+
+	return x;
+}
+
+#endif /* __SSE2__ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET
+static inline __m256i yuv_component_avx2(__m256i y0, __m256i y1, __m256i c)
+{
+	__m256i v0 = _mm256_add_epi32(y0, _mm256_unpacklo_epi32(c, c));
+	__m256i v1 = _mm256_add_epi32(y1, _mm256_unpackhi_epi32(c, c));
+	__m256i v = _mm256_packs_epi32(_mm256_srai_epi32(v0, RGBSHIFT),
+				       _mm256_srai_epi32(v1, RGBSHIFT));
+
+	return _mm256_packus_epi16(v, v);
+}
+
+/*
+ * Convert 16 pixels to BGRA. The AVX2 unpack and pack instructions operate on
+ * 128-bit lanes independently, the first 8 pixels are thus processed in the low
+ * lane and the last 8 pixels in the high lane, and the lanes are reordered
+ * when storing the result.
+ */
+AVX2_TARGET
+static inline void yuv_to_bgra_avx2(__m256i y, __m256i cbcr,
+				    unsigned char *dst)
+{
+	__m256i c = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+	__m256i de = _mm256_sub_epi16(cbcr, _mm256_set1_epi16(128));
+
+	__m256i lo = _mm256_mullo_epi16(c, _mm256_set1_epi16(298));
+	__m256i hi = _mm256_mulhi_epi16(c, _mm256_set1_epi16(298));
+	__m256i y0 = _mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi),
+				      _mm256_set1_epi32(128));
+	__m256i y1 = _mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi),
+				      _mm256_set1_epi32(128));
+
+	__m256i rc = _mm256_madd_epi16(de, _mm256_set1_epi32(CHROMA_COEFFS(0, 409)));
+	__m256i gc = _mm256_madd_epi16(de, _mm256_set1_epi32(CHROMA_COEFFS(-100, -208)));
+	__m256i bc = _mm256_madd_epi16(de, _mm256_set1_epi32(CHROMA_COEFFS(516, 0)));
+
+	__m256i r = yuv_component_avx2(y0, y1, rc);
+	__m256i g = yuv_component_avx2(y0, y1, gc);
+	__m256i b = yuv_component_avx2(y0, y1, bc);
+
+	__m256i bg = _mm256_unpacklo_epi8(b, g);
+	__m256i ra = _mm256_unpacklo_epi8(r, _mm256_set1_epi8(-1));
+	__m256i bgra0 = _mm256_unpacklo_epi16(bg, ra);
+	__m256i bgra1 = _mm256_unpackhi_epi16(bg, ra);
+
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst),
+			    _mm256_permute2x128_si256(bgra0, bgra1, 0x20));
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32),
+			    _mm256_permute2x128_si256(bgra0, bgra1, 0x31));
+}
+
+AVX2_TARGET
+static inline __m256i swap_chroma_avx2(__m256i cbcr)
+{
+	return _mm256_or_si256(_mm256_slli_epi32(cbcr, 16),
+			       _mm256_srli_epi32(cbcr, 16));
+}
+
+AVX2_TARGET
+static unsigned int convert_nv_row_avx2(const unsigned char *src_y,
+					const unsigned char *src_c,
+					unsigned char *dst, unsigned int width,
+					bool swap)
+{
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src_y + x));
+		__m128i cbcr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src_c + x));
+
+		__m256i y16 = _mm256_cvtepu8_epi16(y);
+		__m256i cbcr16 = _mm256_cvtepu8_epi16(cbcr);
+		if (swap)
+			cbcr16 = swap_chroma_avx2(cbcr16);
+
+		yuv_to_bgra_avx2(y16, cbcr16, dst + x * 4);
+	}
+
+	return x;
+}
+
+AVX2_TARGET
+static unsigned int convert_yuv_row_avx2(const unsigned char *src,
+					 unsigned char *dst, unsigned int width,
+					 bool yFirst, bool swap)
+{
+	const __m256i mask = _mm256_set1_epi16(0x00ff);
+	unsigned int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x * 2));
+		__m256i even = _mm256_and_si256(data, mask);
+		__m256i odd = _mm256_srli_epi16(data, 8);
+
+		__m256i y = yFirst ? even : odd;
+		__m256i cbcr = yFirst ? odd : even;
+		if (swap)
+			cbcr = swap_chroma_avx2(cbcr);
+
+		yuv_to_bgra_avx2(y, cbcr, dst + x * 4);
+	}
+
+	return x;
+}
+
+#endif /* __x86_64__ || __i386__ */
+
+#if defined(__ARM_NEON)
+
+static inline uint8x8_t yuv_component_neon(int32x4_t y0, int32x4_t y1,
+					   int32x4_t c)
+{
+	int32x4x2_t cc = vzipq_s32(c, c);
+	int16x4_t v0 = vqshrn_n_s32(vaddq_s32(y0, cc.val[0]), RGBSHIFT);
+	int16x4_t v1 = vqshrn_n_s32(vaddq_s32(y1, cc.val[1]), RGBSHIFT);
+
+	return vqmovun_s16(vcombine_s16(v0, v1));
+}
+
+/*
+ * Convert 8 pixels to BGRA. The luma values are stored in y, and the Cb and Cr
+ * values of the 4 pixel pairs are interleaved in cbcr.
+ */
+static inline void yuv_to_bgra_neon(uint8x8_t y, uint8x8_t cbcr, bool swap,
+				    unsigned char *dst)
+{
+	int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y)),
+				vdupq_n_s16(16));
+	int16x8_t de = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(cbcr)),
+				 vdupq_n_s16(128));
+	int16x8x2_t uzp = vuzpq_s16(de, de);
+	int16x4_t d = vget_low_s16(uzp.val[swap ? 1 : 0]);
+	int16x4_t e = vget_low_s16(uzp.val[swap ? 0 : 1]);
+
+	int32x4_t y0 = vmlal_n_s16(vdupq_n_s32(128), vget_low_s16(c), 298);
+	int32x4_t y1 = vmlal_n_s16(vdupq_n_s32(128), vget_high_s16(c), 298);
+
+	int32x4_t rc = vmull_n_s16(e, 409);
+	int32x4_t gc = vmlal_n_s16(vmull_n_s16(d, -100), e, -208);
+	int32x4_t bc = vmull_n_s16(d, 516);
+
+	uint8x8x4_t bgra;
+	bgra.val[0] = yuv_component_neon(y0, y1, bc);
+	bgra.val[1] = yuv_component_neon(y0, y1, gc);
+	bgra.val[2] = yuv_component_neon(y0, y1, rc);
+	bgra.val[3] = vdup_n_u8(0xff);
+
+	vst4_u8(dst, bgra);
+}
+
+static unsigned int convert_nv_row_neon(const unsigned char *src_y,
+					const unsigned char *src_c,
+					unsigned char *dst, unsigned int width,
+					bool swap)
+{
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8)
+		yuv_to_bgra_neon(vld1_u8(src_y + x), vld1_u8(src_c + x), swap,
+				 dst + x * 4);
+
+	return x;
+}
+
+static unsigned int convert_yuv_row_neon(const unsigned char *src,
+					 unsigned char *dst, unsigned int width,
+					 bool yFirst, bool swap)
+{
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		uint8x8x2_t data = vld2_u8(src + x * 2);
+
+		yuv_to_bgra_neon(data.val[yFirst ? 0 : 1],
+				 data.val[yFirst ? 1 : 0], swap, dst + x * 4);
+	}
+
+	return x;
+}
+
+#endif /* __ARM_NEON */
+
+/*
+ * Select the fastest row conversion kernels supported by the CPU. The AVX2
+ * support is detected at runtime, while SSE2 and NEON are used when they are
+ * available on the compilation target.
+ */
+void FormatConverter::selectRowConverters()
+{
+	nvRowConverter_ = nullptr;
+	yuvRowConverter_ = nullptr;
+
+#if defined(__ARM_NEON)
+	nvRowConverter_ = convert_nv_row_neon;
+	yuvRowConverter_ = convert_yuv_row_neon;
+#endif
+
+#if defined(__SSE2__)
+	nvRowConverter_ = convert_nv_row_sse2;
+	yuvRowConverter_ = convert_yuv_row_sse2;
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		nvRowConverter_ = convert_nv_row_avx2;
+		yuvRowConverter_ = convert_yuv_row_avx2;
+	}
+#endif
+
+	/* The kernels only support horizontally subsampled chroma. */
+	if (formatFamily_ == NV && horzSubSample_ != 2)
+		nvRowConverter_ = nullptr;
+}
+
+void FormatConverter::convertNV(const MappedFrame &frame, unsigned char *dst,
+				unsigned int first, unsigned int last)
+{
+	unsigned int c_stride = stride_ * (2 / horzSubSample_);
 	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
 	unsigned int cb_pos = nvSwap_ ? 1 : 0;
 	unsigned int cr_pos = nvSwap_ ? 0 : 1;
-	const unsigned char *src_c = src + width_ * height_;
+	const unsigned char *src = frame.planes[0];
+	const unsigned char *src_c = frame.planes[1] ? frame.planes[1]
+			       : src + stride_ * height_;
 	int r, g, b;
 
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * width_;
+	dst += first * width_ * 4;
+
+	for (unsigned int y = first; y < last; y++) {
+		const unsigned char *src_y = src + y * stride_;
 		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
 					      c_stride + cb_pos;
 		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
 					      c_stride + cr_pos;
+		unsigned int x = 0;
+
+		if (nvRowConverter_) {
+			x = nvRowConverter_(src_y, src_cb - cb_pos, dst,
+					    width_, nvSwap_);
+			src_y += x;
+			src_cb += x;
+			src_cr += x;
+			dst += x * 4;
+		}
 
-		for (unsigned int x = 0; x < width_; x += 2) {
+		for (; x < width_; x += 2) {
 			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
 			dst[0] = b;
 			dst[1] = g;
@@ -191,12 +645,17 @@ void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst)
 	}
 }
 
-void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertRGB(const MappedFrame &frame, unsigned char *dst,
+				 unsigned int first, unsigned int last)
 {
+	const unsigned char *src = frame.planes[0];
 	unsigned int x, y;
 	int r, g, b;
 
-	for (y = 0; y < height_; y++) {
+	src += first * stride_;
+	dst += first * width_ * 4;
+
+	for (y = first; y < last; y++) {
 		for (x = 0; x < width_; x++) {
 			r = src[bpp_ * x + r_pos_];
 			g = src[bpp_ * x + g_pos_];
@@ -208,13 +667,15 @@ void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
 			dst[4 * x + 3] = 0xff;
 		}
 
-		src += width_ * bpp_;
+		src += stride_;
 		dst += width_ * 4;
 	}
 }
 
-void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst)
+void FormatConverter::convertYUV(const MappedFrame &frame, unsigned char *dst,
+				 unsigned int first, unsigned int last)
 {
+	const unsigned char *src = frame.planes[0];
 	unsigned int src_x, src_y, dst_x, dst_y;
 	unsigned int src_stride;
 	unsigned int dst_stride;
@@ -222,11 +683,22 @@ void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst)
 	int r, g, b, y, cr, cb;
 
 	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = width_ * 2;
+	src_stride = stride_;
 	dst_stride = width_ * 4;
 
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
+	for (src_y = first, dst_y = first; dst_y < last; src_y++, dst_y++) {
+		src_x = 0;
+		dst_x = 0;
+
+		if (yuvRowConverter_) {
+			dst_x = yuvRowConverter_(src + src_y * src_stride,
+						 dst + dst_y * dst_stride,
+						 width_, y_pos_ == 0,
+						 cb_pos_ > cr_pos);
+			src_x = dst_x / 2;
+		}
+
+		for (; dst_x < width_; ) {
 			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
 			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
 
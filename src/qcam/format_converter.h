@@ -9,17 +9,38 @@
 
 #include <stddef.h>
 
+#include <QThreadPool>
+
 class QImage;
 
+/*
+ * A frame mapped in memory. Formats stored in a single memory plane only use
+ * the first plane pointer, the other planes are then located after the first
+ * one, as specified by V4L2.
+ */
+struct MappedFrame {
+	static constexpr unsigned int MaxPlanes = 2;
+
+	const unsigned char *planes[MaxPlanes];
+	size_t size;
+};
+
 class FormatConverter
 {
 public:
+	FormatConverter();
+
 	int configure(unsigned int format, unsigned int width,
-		      unsigned int height);
+		      unsigned int height, unsigned int stride);
 
-	void convert(const unsigned char *src, size_t size, QImage *dst);
+	void convert(const MappedFrame &frame, QImage *dst);
 
 private:
+	friend class ConversionBand;
+
+	/* The minimum number of rows converted by a worker thread. */
+	static constexpr unsigned int MinBandHeight = 64;
+
 	enum FormatFamily {
 		MJPEG,
 		NV,
@@ -27,13 +48,35 @@ private:
 		YUV,
 	};
 
-	void convertNV(const unsigned char *src, unsigned char *dst);
-	void convertRGB(const unsigned char *src, unsigned char *dst);
-	void convertYUV(const unsigned char *src, unsigned char *dst);
+	/*
+	 * Row conversion kernels, returning the number of pixels they have
+	 * converted. The remaining pixels of the row are converted by the
+	 * scalar code.
+	 */
+	using NVRowConverter = unsigned int (*)(const unsigned char *src_y,
+						const unsigned char *src_c,
+						unsigned char *dst,
+						unsigned int width, bool swap);
+	using YUVRowConverter = unsigned int (*)(const unsigned char *src,
+						 unsigned char *dst,
+						 unsigned int width,
+						 bool yFirst, bool swap);
+
+	void selectRowConverters();
+
+	void convertRows(const MappedFrame &frame, unsigned char *dst,
+			 unsigned int first, unsigned int last);
+	void convertNV(const MappedFrame &frame, unsigned char *dst,
+		       unsigned int first, unsigned int last);
+	void convertRGB(const MappedFrame &frame, unsigned char *dst,
+			unsigned int first, unsigned int last);
+	void convertYUV(const MappedFrame &frame, unsigned char *dst,
+			unsigned int first, unsigned int last);
 
 	unsigned int format_;
 	unsigned int width_;
 	unsigned int height_;
+	unsigned int stride_;
 
 	enum FormatFamily formatFamily_;
 
@@ -51,6 +94,11 @@ private:
 	/* YUV parameters */
 	unsigned int y_pos_;
 	unsigned int cb_pos_;
+
+	NVRowConverter nvRowConverter_;
+	YUVRowConverter yuvRowConverter_;
+
+	QThreadPool pool_;
 };
 
 #endif /* __QCAM_FORMAT_CONVERTER_H__ */
@@ -37,6 +37,12 @@ OptionsParser::Options parseOptions(int argc, char *argv[])
 			 ArgumentRequired, "camera");
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
 			 "help");
+	parser.addOption(OptLatestFrame, OptionNone,
+			 "Keep the newest frame for display when the viewfinder is busy",
+			 "latest-frame");
+	parser.addOption(OptRenderer, OptionString,
+			 "Select the viewfinder renderer (qt, gles)",
+			 "renderer", ArgumentRequired, "renderer");
 	parser.addOption(OptSize, &sizeParser, "Set the stream size",
 			 "size", true);
 
@@ -8,6 +8,7 @@
 #include <iomanip>
 #include <iostream>
 #include <string>
+#include <utility>
 
 #include <QCoreApplication>
 #include <QInputDialog>
@@ -17,12 +18,21 @@
 #include <libcamera/version.h>
 
 #include "main_window.h"
-#include "viewfinder.h"
+#include "viewfinder_gl.h"
+#include "viewfinder_qt.h"
 
 using namespace libcamera;
 
+static void endCpuAccess(Buffer *buffer)
+{
+	for (Plane &plane : buffer->mem()->planes())
+		plane.endCpuAccess(Plane::CpuRead);
+}
+
 MainWindow::MainWindow(const OptionsParser::Options &options)
-	: options_(options), isCapturing_(false)
+	: options_(options), isCapturing_(false), renderRequest_(nullptr),
+	  renderBuffer_(nullptr), pendingRequest_(nullptr),
+	  pendingBuffer_(nullptr)
 {
 	int ret;
 
@@ -30,9 +40,27 @@ MainWindow::MainWindow(const OptionsParser::Options &options)
 	setWindowTitle(title_);
 	connect(&titleTimer_, SIGNAL(timeout()), this, SLOT(updateTitle()));
 
-	viewfinder_ = new ViewFinder(this);
-	setCentralWidget(viewfinder_);
-	viewfinder_->setFixedSize(500, 500);
+	QWidget *widget;
+	std::string renderer = options_.isSet(OptRenderer)
+			     ? static_cast<std::string>(options_[OptRenderer])
+			     : "qt";
+	if (renderer == "gles") {
+		ViewFinderGL *viewfinder = new ViewFinderGL(this);
+		viewfinder_ = viewfinder;
+		widget = viewfinder;
+	} else {
+		if (renderer != "qt")
+			std::cout << "Unknown renderer " << renderer
+				  << ", using qt" << std::endl;
+
+		ViewFinderQt *viewfinder = new ViewFinderQt(this);
+		viewfinder_ = viewfinder;
+		widget = viewfinder;
+	}
+
+	connect(widget, SIGNAL(renderComplete()), this, SLOT(renderComplete()));
+	setCentralWidget(widget);
+	widget->setFixedSize(500, 500);
 	adjustSize();
 
 	ret = openCamera();
@@ -153,7 +181,7 @@ int MainWindow::startCapture()
 
 	Stream *stream = cfg.stream();
 	ret = viewfinder_->setFormat(cfg.pixelFormat, cfg.size.width,
-				     cfg.size.height);
+				     cfg.size.height, cfg.stride);
 	if (ret < 0) {
 		std::cout << "Failed to set viewfinder format" << std::endl;
 		return ret;
@@ -228,6 +256,19 @@ void MainWindow::stopCapture()
 	if (!isCapturing_)
 		return;
 
+	/* Drop the frame being rendered, if any. */
+	viewfinder_->stop();
+	if (renderRequest_) {
+		endCpuAccess(renderBuffer_);
+		delete renderRequest_;
+		renderRequest_ = nullptr;
+		renderBuffer_ = nullptr;
+	}
+
+	delete pendingRequest_;
+	pendingRequest_ = nullptr;
+	pendingBuffer_ = nullptr;
+
 	int ret = camera_->stop();
 	if (ret)
 		std::cout << "Failed to stop capture" << std::endl;
@@ -262,26 +303,32 @@ void MainWindow::requestComplete(Request *request,
 		  << " fps: " << std::fixed << std::setprecision(2) << fps
 		  << std::endl;
 
-	display(buffer);
-
-	request = camera_->createRequest();
-	if (!request) {
-		std::cerr << "Can't create request" << std::endl;
+	/*
+	 * Reuse the request and its buffers to queue them again to the camera,
+	 * avoiding allocation of new requests and buffers for every frame. The
+	 * request is queued once the viewfinder has rendered its buffer, or
+	 * immediately if the frame isn't displayed because the viewfinder is
+	 * still busy with the previous frame.
+	 *
+	 * In latest frame mode, the newest frame completed while the viewfinder
+	 * is busy is kept instead, and displayed as soon as the viewfinder is
+	 * ready. The frame it replaces is stale and is requeued immediately,
+	 * which bounds the display latency to one frame being rendered and one
+	 * frame waiting.
+	 */
+	request->reuse(Request::ReuseBuffers);
+
+	if (!display(buffer)) {
+		renderRequest_ = request;
+		renderBuffer_ = buffer;
 		return;
 	}
 
-	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-		Stream *stream = it->first;
-		Buffer *buffer = it->second;
-		unsigned int index = buffer->index();
-
-		std::unique_ptr<Buffer> newBuffer = stream->createBuffer(index);
-		if (!newBuffer) {
-			std::cerr << "Can't create buffer " << index << std::endl;
+	if (options_.isSet(OptLatestFrame) && renderRequest_) {
+		std::swap(request, pendingRequest_);
+		pendingBuffer_ = buffer;
+		if (!request)
 			return;
-		}
-
-		request->addBuffer(std::move(newBuffer));
 	}
 
 	camera_->queueRequest(request);
@@ -290,12 +337,57 @@ void MainWindow::requestComplete(Request *request,
 int MainWindow::display(Buffer *buffer)
 {
 	BufferMemory *mem = buffer->mem();
-	if (mem->planes().size() != 1)
+	if (mem->planes().size() > MappedFrame::MaxPlanes)
 		return -EINVAL;
 
-	Plane &plane = mem->planes().front();
-	unsigned char *raw = static_cast<unsigned char *>(plane.mem());
-	viewfinder_->display(raw, buffer->bytesused());
+	/*
+	 * Pass the planes to the viewfinder as they are mapped, the line
+	 * padding and plane layout are described by the format.
+	 */
+	MappedFrame frame = {};
+	unsigned int i = 0;
 
-	return 0;
+	for (Plane &plane : mem->planes()) {
+		plane.beginCpuAccess(Plane::CpuRead);
+		frame.planes[i++] = static_cast<unsigned char *>(plane.mem());
+	}
+
+	frame.size = buffer->bytesused();
+
+	int ret = viewfinder_->render(frame);
+	if (ret)
+		endCpuAccess(buffer);
+
+	return ret;
+}
+
+void MainWindow::renderComplete()
+{
+	if (!renderRequest_)
+		return;
+
+	endCpuAccess(renderBuffer_);
+
+	Request *request = renderRequest_;
+	renderRequest_ = nullptr;
+	renderBuffer_ = nullptr;
+
+	camera_->queueRequest(request);
+
+	/* Display the frame that completed while rendering, if any. */
+	if (!pendingRequest_)
+		return;
+
+	request = pendingRequest_;
+	Buffer *buffer = pendingBuffer_;
+	pendingRequest_ = nullptr;
+	pendingBuffer_ = nullptr;
+
+	if (!display(buffer)) {
+		renderRequest_ = request;
+		renderBuffer_ = buffer;
+		return;
+	}
+
+	camera_->queueRequest(request);
 }
@@ -27,6 +27,8 @@ class ViewFinder;
 enum {
 	OptCamera = 'c',
 	OptHelp = 'h',
+	OptLatestFrame = 'l',
+	OptRenderer = 'r',
 	OptSize = 's',
 };
 
@@ -40,6 +42,7 @@ public:
 
 private Q_SLOTS:
 	void updateTitle();
+	void renderComplete();
 
 private:
 	int openCamera();
@@ -67,6 +70,14 @@ private:
 	uint32_t framesCaptured_;
 
 	ViewFinder *viewfinder_;
+
+	/* The request whose buffer is being rendered by the viewfinder. */
+	Request *renderRequest_;
+	Buffer *renderBuffer_;
+
+	/* The newest request waiting for the viewfinder, in latest frame mode. */
+	Request *pendingRequest_;
+	Buffer *pendingBuffer_;
 };
 
 #endif /* __QCAM_MAIN_WINDOW__ */
@@ -2,33 +2,30 @@
 /*
  * Copyright (C) 2019, Google Inc.
  *
- * viewfinder.h - qcam - Viewfinder
+ * viewfinder.h - qcam - Viewfinder base class
  */
 #ifndef __QCAM_VIEWFINDER_H__
 #define __QCAM_VIEWFINDER_H__
 
-#include <QLabel>
-
 #include "format_converter.h"
 
-class QImage;
-
-class ViewFinder : public QLabel
+/*
+ * Viewfinder implementations are QWidget subclasses that also implement this
+ * interface. They emit a renderComplete() signal once a frame passed to
+ * render() has been displayed, after which the frame data isn't accessed
+ * anymore. Only one frame is rendered at a time, frames submitted while a
+ * frame is being rendered are rejected with -EBUSY. stop() drops the frame
+ * being rendered, if any, without emitting renderComplete().
+ */
+class ViewFinder
 {
 public:
-	ViewFinder(QWidget *parent);
-
-	int setFormat(unsigned int format, unsigned int width,
-		      unsigned int height);
-	void display(const unsigned char *rgb, size_t size);
-
-private:
-	unsigned int format_;
-	unsigned int width_;
-	unsigned int height_;
+	virtual ~ViewFinder() {}
 
-	FormatConverter converter_;
-	QImage *image_;
+	virtual int setFormat(unsigned int format, unsigned int width,
+			      unsigned int height, unsigned int stride) = 0;
+	virtual int render(const MappedFrame &frame) = 0;
+	virtual void stop() = 0;
 };
 
-#endif /* __QCAM_VIEWFINDER__ */
+#endif /* __QCAM_VIEWFINDER_H__ */
@@ -0,0 +1,387 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * viewfinder_gl.cpp - qcam - Viewfinder rendering with OpenGL (ES)
+ */
+
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#include <QDebug>
+
+#include "viewfinder_gl.h"
+
+/*
+ * Frames are uploaded to textures without any CPU processing, and converted to
+ * RGB by a fragment shader. Planar NV formats use a luminance texture for the
+ * Y plane and a luminance-alpha texture for the interleaved chroma plane.
+ * Packed YUV formats use an RGBA texture with one texel per pair of pixels.
+ * Textures span the full stride of the frame, and the padding at the end of
+ * lines is cropped by scaling the horizontal texture coordinates.
+ *
+ * The shaders implement the BT.601 limited range conversion of the CPU format
+ * converter, and only use GLSL ES 1.00 features to run on both OpenGL ES 2.0
+ * and desktop OpenGL.
+ */
+
+static const char *vertexShader = R"(
+attribute vec4 vertexIn;
+attribute vec2 textureIn;
+varying vec2 textureOut;
+
+uniform float stride_factor;
+
+void main(void)
+{
+	gl_Position = vertexIn;
+	textureOut = vec2(textureIn.x * stride_factor, textureIn.y);
+}
+)";
+
+static const char *fragmentShaderCommon = R"(
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+
+const vec3 yuvOffset = vec3(16.0 / 255.0, 0.5, 0.5);
+const mat3 yuv2rgb = mat3(1.164, 1.164, 1.164,
+			  0.0, -0.392, 2.017,
+			  1.596, -0.813, 0.0);
+)";
+
+static const char *fragmentShaderNV = R"(
+uniform sampler2D tex_y;
+uniform sampler2D tex_uv;
+
+void main(void)
+{
+	vec4 uv = texture2D(tex_uv, textureOut);
+	vec3 yuv;
+
+	yuv.x = texture2D(tex_y, textureOut).r;
+#if defined(YUV_PATTERN_UV)
+	yuv.yz = uv.ra;
+#else
+	yuv.yz = uv.ar;
+#endif
+
+	gl_FragColor = vec4(yuv2rgb * (yuv - yuvOffset), 1.0);
+}
+)";
+
+static const char *fragmentShaderPacked = R"(
+uniform sampler2D tex_y;
+uniform float tex_width;
+
+void main(void)
+{
+	vec4 texel = texture2D(tex_y, textureOut);
+	float odd = step(0.5, fract(textureOut.x * tex_width * 0.5));
+	vec3 yuv;
+
+	yuv.x = mix(texel.YUV_Y0, texel.YUV_Y1, odd);
+	yuv.y = texel.YUV_U;
+	yuv.z = texel.YUV_V;
+
+	gl_FragColor = vec4(yuv2rgb * (yuv - yuvOffset), 1.0);
+}
+)";
+
+/* Full viewport quad, as a triangle strip of x, y, s, t vertices. */
+static const GLfloat vertices[] = {
+	-1.0f, -1.0f, 0.0f, 1.0f,
+	 1.0f, -1.0f, 1.0f, 1.0f,
+	-1.0f,  1.0f, 0.0f, 0.0f,
+	 1.0f,  1.0f, 1.0f, 0.0f,
+};
+
+ViewFinderGL::ViewFinderGL(QWidget *parent)
+	: QOpenGLWidget(parent), format_(0), width_(0), height_(0), stride_(0),
+	  packed_(false), horzSubSample_(1), vertSubSample_(1),
+	  programValid_(false), textures_{ 0, 0 }, texturesValid_(false),
+	  frame_{}, framePending_(false)
+{
+}
+
+ViewFinderGL::~ViewFinderGL()
+{
+	if (!textures_[0])
+		return;
+
+	makeCurrent();
+	glDeleteTextures(2, textures_);
+	vertexBuffer_.destroy();
+	doneCurrent();
+}
+
+int ViewFinderGL::setFormat(unsigned int format, unsigned int width,
+			    unsigned int height, unsigned int stride)
+{
+	switch (format) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV12M:
+		horzSubSample_ = 2;
+		vertSubSample_ = 2;
+		fragmentDefines_ = "#define YUV_PATTERN_UV\n";
+		break;
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV21M:
+		horzSubSample_ = 2;
+		vertSubSample_ = 2;
+		fragmentDefines_ = "#define YUV_PATTERN_VU\n";
+		break;
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV16M:
+		horzSubSample_ = 2;
+		vertSubSample_ = 1;
+		fragmentDefines_ = "#define YUV_PATTERN_UV\n";
+		break;
+	case V4L2_PIX_FMT_NV61:
+	case V4L2_PIX_FMT_NV61M:
+		horzSubSample_ = 2;
+		vertSubSample_ = 1;
+		fragmentDefines_ = "#define YUV_PATTERN_VU\n";
+		break;
+	case V4L2_PIX_FMT_NV24:
+		horzSubSample_ = 1;
+		vertSubSample_ = 1;
+		fragmentDefines_ = "#define YUV_PATTERN_UV\n";
+		break;
+	case V4L2_PIX_FMT_NV42:
+		horzSubSample_ = 1;
+		vertSubSample_ = 1;
+		fragmentDefines_ = "#define YUV_PATTERN_VU\n";
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		fragmentDefines_ = "#define YUV_Y0 r\n#define YUV_U g\n"
+				   "#define YUV_Y1 b\n#define YUV_V a\n";
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		fragmentDefines_ = "#define YUV_Y0 r\n#define YUV_V g\n"
+				   "#define YUV_Y1 b\n#define YUV_U a\n";
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		fragmentDefines_ = "#define YUV_U r\n#define YUV_Y0 g\n"
+				   "#define YUV_V b\n#define YUV_Y1 a\n";
+		break;
+	case V4L2_PIX_FMT_VYUY:
+		fragmentDefines_ = "#define YUV_V r\n#define YUV_Y0 g\n"
+				   "#define YUV_U b\n#define YUV_Y1 a\n";
+		break;
+	default:
+		return -EINVAL;
+	};
+
+	packed_ = format == V4L2_PIX_FMT_YUYV || format == V4L2_PIX_FMT_YVYU ||
+		  format == V4L2_PIX_FMT_UYVY || format == V4L2_PIX_FMT_VYUY;
+
+	if (!stride)
+		stride = packed_ ? width * 2 : width;
+
+	/* Packed textures store two pixels per texel. */
+	if (packed_ && stride % 4)
+		return -EINVAL;
+
+	format_ = format;
+	width_ = width;
+	height_ = height;
+	stride_ = stride;
+
+	programValid_ = false;
+	texturesValid_ = false;
+	framePending_ = false;
+
+	setFixedSize(width, height);
+	updateGeometry();
+
+	return 0;
+}
+
+/*
+ * Schedule a repaint to render the frame. The frame is uploaded to textures
+ * when the widget is painted, after which renderComplete is emitted.
+ */
+int ViewFinderGL::render(const MappedFrame &frame)
+{
+	if (framePending_)
+		return -EBUSY;
+
+	frame_ = frame;
+	framePending_ = true;
+	update();
+
+	return 0;
+}
+
+void ViewFinderGL::stop()
+{
+	framePending_ = false;
+}
+
+void ViewFinderGL::initializeGL()
+{
+	initializeOpenGLFunctions();
+
+	glGenTextures(2, textures_);
+	for (GLuint texture : textures_) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	vertexBuffer_.create();
+	vertexBuffer_.bind();
+	vertexBuffer_.allocate(vertices, sizeof(vertices));
+	vertexBuffer_.release();
+
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+bool ViewFinderGL::createProgram()
+{
+	program_.removeAllShaders();
+
+	QString fragmentSource = fragmentDefines_ + fragmentShaderCommon +
+				 (packed_ ? fragmentShaderPacked : fragmentShaderNV);
+
+	if (!program_.addShaderFromSourceCode(QOpenGLShader::Vertex,
+					      vertexShader) ||
+	    !program_.addShaderFromSourceCode(QOpenGLShader::Fragment,
+					      fragmentSource)) {
+		qWarning() << "Failed to compile shaders:" << program_.log();
+		return false;
+	}
+
+	program_.bindAttributeLocation("vertexIn", 0);
+	program_.bindAttributeLocation("textureIn", 1);
+
+	if (!program_.link()) {
+		qWarning() << "Failed to link shader program:" << program_.log();
+		return false;
+	}
+
+	/* The stride in pixels, covered by the texture width. */
+	unsigned int stridePixels = packed_ ? stride_ / 2 : stride_;
+
+	program_.bind();
+	program_.setUniformValue("stride_factor",
+				 static_cast<GLfloat>(width_) / stridePixels);
+	program_.setUniformValue("tex_y", 0);
+	if (packed_)
+		program_.setUniformValue("tex_width",
+					 static_cast<GLfloat>(stridePixels));
+	else
+		program_.setUniformValue("tex_uv", 1);
+	program_.release();
+
+	programValid_ = true;
+	return true;
+}
+
+void ViewFinderGL::uploadTextures()
+{
+	struct Plane {
+		GLenum format;
+		unsigned int width;
+		unsigned int height;
+		const unsigned char *data;
+	};
+
+	Plane planes[2];
+	unsigned int count;
+
+	if (packed_) {
+		planes[0] = { GL_RGBA, stride_ / 4, height_, frame_.planes[0] };
+		count = 1;
+	} else {
+		const unsigned char *chroma = frame_.planes[1]
+					    ? frame_.planes[1]
+					    : frame_.planes[0] + stride_ * height_;
+
+		planes[0] = { GL_LUMINANCE, stride_, height_, frame_.planes[0] };
+		planes[1] = { GL_LUMINANCE_ALPHA, stride_ / horzSubSample_,
+			      height_ / vertSubSample_, chroma };
+		count = 2;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const Plane &plane = planes[i];
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, textures_[i]);
+
+		/* Reallocate the textures only when the format changes. */
+		if (texturesValid_)
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, plane.width,
+					plane.height, plane.format,
+					GL_UNSIGNED_BYTE, plane.data);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, plane.format,
+				     plane.width, plane.height, 0, plane.format,
+				     GL_UNSIGNED_BYTE, plane.data);
+	}
+
+	texturesValid_ = true;
+}
+
+void ViewFinderGL::paintGL()
+{
+	bool rendered = false;
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (!format_)
+		return;
+
+	if (!programValid_ && !createProgram())
+		return;
+
+	if (framePending_) {
+		uploadTextures();
+		framePending_ = false;
+		rendered = true;
+	}
+
+	if (texturesValid_) {
+		program_.bind();
+		vertexBuffer_.bind();
+
+		program_.enableAttributeArray(0);
+		program_.enableAttributeArray(1);
+		program_.setAttributeBuffer(0, GL_FLOAT, 0, 2,
+					    4 * sizeof(GLfloat));
+		program_.setAttributeBuffer(1, GL_FLOAT, 2 * sizeof(GLfloat),
+					    2, 4 * sizeof(GLfloat));
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, textures_[i]);
+		}
+
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+		vertexBuffer_.release();
+		program_.release();
+	}
+
+	if (rendered)
+		Q_EMIT renderComplete();
+}
+
+void ViewFinderGL::resizeGL(int w, int h)
+{
+	glViewport(0, 0, w, h);
+}
+
+QSize ViewFinderGL::sizeHint() const
+{
+	return QSize(width_, height_);
+}
@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * viewfinder_gl.h - qcam - Viewfinder rendering with OpenGL (ES)
+ */
+#ifndef __QCAM_VIEWFINDER_GL_H__
+#define __QCAM_VIEWFINDER_GL_H__
+
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLWidget>
+#include <QSize>
+
+#include "viewfinder.h"
+
+class ViewFinderGL : public QOpenGLWidget, public ViewFinder,
+		     protected QOpenGLFunctions
+{
+	Q_OBJECT
+
+public:
+	ViewFinderGL(QWidget *parent);
+	~ViewFinderGL();
+
+	int setFormat(unsigned int format, unsigned int width,
+		      unsigned int height, unsigned int stride) override;
+	int render(const MappedFrame &frame) override;
+	void stop() override;
+
+Q_SIGNALS:
+	void renderComplete();
+
+protected:
+	void initializeGL() override;
+	void paintGL() override;
+	void resizeGL(int w, int h) override;
+	QSize sizeHint() const override;
+
+private:
+	bool createProgram();
+	void uploadTextures();
+
+	unsigned int format_;
+	unsigned int width_;
+	unsigned int height_;
+	unsigned int stride_;
+
+	/* Shader parameters, selected by setFormat() */
+	QString fragmentDefines_;
+	bool packed_;
+	unsigned int horzSubSample_;
+	unsigned int vertSubSample_;
+
+	QOpenGLShaderProgram program_;
+	bool programValid_;
+	QOpenGLBuffer vertexBuffer_;
+	GLuint textures_[2];
+	bool texturesValid_;
+
+	/* The frame waiting to be rendered, if any. */
+	MappedFrame frame_;
+	bool framePending_;
+};
+
+#endif /* __QCAM_VIEWFINDER_GL_H__ */
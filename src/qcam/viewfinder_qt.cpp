@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * viewfinder_qt.cpp - qcam - Viewfinder rendering with CPU format conversion
+ */
+
+#include <errno.h>
+
+#include <QImage>
+#include <QMetaObject>
+#include <QPixmap>
+
+#include "format_converter.h"
+#include "viewfinder_qt.h"
+
+ViewFinderQt::ViewFinderQt(QWidget *parent)
+	: QLabel(parent), format_(0), width_(0), height_(0), image_(nullptr),
+	  busy_(false), generation_(0)
+{
+	worker_.moveToThread(&thread_);
+	thread_.start();
+}
+
+ViewFinderQt::~ViewFinderQt()
+{
+	thread_.quit();
+	thread_.wait();
+
+	delete image_;
+}
+
+/*
+ * Convert a frame in the worker thread, to avoid blocking the GUI thread, and
+ * display it from the GUI thread once converted.
+ */
+int ViewFinderQt::render(const MappedFrame &frame)
+{
+	if (busy_)
+		return -EBUSY;
+
+	busy_ = true;
+
+	unsigned int generation = generation_;
+	QMetaObject::invokeMethod(&worker_, [=]() {
+		converter_.convert(frame, image_);
+		QMetaObject::invokeMethod(this, [=]() {
+			renderDone(generation);
+		}, Qt::QueuedConnection);
+	}, Qt::QueuedConnection);
+
+	return 0;
+}
+
+/* Wait for the frame being rendered, if any, to be converted, and drop it. */
+void ViewFinderQt::stop()
+{
+	QMetaObject::invokeMethod(&worker_, []() {},
+				  Qt::BlockingQueuedConnection);
+
+	generation_++;
+	busy_ = false;
+}
+
+void ViewFinderQt::renderDone(unsigned int generation)
+{
+	if (generation != generation_)
+		return;
+
+	busy_ = false;
+
+	QPixmap pixmap = QPixmap::fromImage(*image_);
+	setPixmap(pixmap);
+
+	Q_EMIT renderComplete();
+}
+
+int ViewFinderQt::setFormat(unsigned int format, unsigned int width,
+			    unsigned int height, unsigned int stride)
+{
+	int ret;
+
+	stop();
+
+	ret = converter_.configure(format, width, height, stride);
+	if (ret < 0)
+		return ret;
+
+	format_ = format;
+	width_ = width;
+	height_ = height;
+
+	setFixedSize(width, height);
+
+	delete image_;
+	image_ = new QImage(width, height, QImage::Format_RGB32);
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * viewfinder_qt.h - qcam - Viewfinder rendering with CPU format conversion
+ */
+#ifndef __QCAM_VIEWFINDER_QT_H__
+#define __QCAM_VIEWFINDER_QT_H__
+
+#include <QLabel>
+#include <QObject>
+#include <QThread>
+
+#include "format_converter.h"
+#include "viewfinder.h"
+
+class QImage;
+
+class ViewFinderQt : public QLabel, public ViewFinder
+{
+	Q_OBJECT
+
+public:
+	ViewFinderQt(QWidget *parent);
+	~ViewFinderQt();
+
+	int setFormat(unsigned int format, unsigned int width,
+		      unsigned int height, unsigned int stride) override;
+	int render(const MappedFrame &frame) override;
+	void stop() override;
+
+Q_SIGNALS:
+	void renderComplete();
+
+private:
+	void renderDone(unsigned int generation);
+
+	unsigned int format_;
+	unsigned int width_;
+	unsigned int height_;
+
+	FormatConverter converter_;
+	QImage *image_;
+
+	/* Frames are converted in the worker thread. */
+	QThread thread_;
+	QObject worker_;
+	bool busy_;
+	unsigned int generation_;
+};
+
+#endif /* __QCAM_VIEWFINDER_QT_H__ */
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * benchmark.cpp - libcamera microbenchmark base class
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+
+#include "benchmark.h"
+
+/*
+ * Each benchmark program runs a suite of related measurements, and prints one
+ * JSON object per line and per measurement on the standard output, to be
+ * collected and compared across releases:
+ *
+ *   {"suite": "signal", "benchmark": "emit-direct", "operations": 1234,
+ *    "median_ns": 12.3, "min_ns": 11.9, "p99_ns": 14.0, "max_ns": 14.0}
+ *
+ * The durations are expressed in nanoseconds per operation. The median is the
+ * most stable figure to track regressions, the 99th percentile is meaningful
+ * for benchmarks that report one sample per operation, such as latencies. An optional command line argument
+ * restricts the measurements to the benchmarks whose name contains it.
+ */
+
+constexpr unsigned int Benchmark::SampleCount;
+constexpr std::chrono::milliseconds Benchmark::MinSampleTime;
+
+Benchmark::Benchmark(const std::string &suite)
+	: suite_(suite)
+{
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+int Benchmark::execute(int argc, char *argv[])
+{
+	int ret;
+
+	if (argc > 2) {
+		std::cerr << "usage: " << argv[0] << " [filter]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (argc == 2)
+		filter_ = argv[1];
+
+	ret = setenv("LIBCAMERA_IPA_MODULE_PATH", "src/ipa", 1);
+	if (ret)
+		return errno;
+
+	ret = setenv("LIBCAMERA_PIPELINE_MODULE_PATH", "src/libcamera", 1);
+	if (ret)
+		return errno;
+
+	ret = init();
+	if (ret)
+		return ret;
+
+	ret = run();
+
+	cleanup();
+
+	return ret;
+}
+
+/* Check if the benchmark name matches the command line filter. */
+bool Benchmark::enabled(const std::string &name) const
+{
+	return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+/* Report a measurement, with samples expressed in nanoseconds per operation. */
+void Benchmark::report(const std::string &name, uint64_t operations,
+		       std::vector<double> samples)
+{
+	if (samples.empty())
+		return;
+
+	std::sort(samples.begin(), samples.end());
+
+	double median = samples[samples.size() / 2];
+	if (!(samples.size() % 2))
+		median = (median + samples[samples.size() / 2 - 1]) / 2;
+
+	std::cout << std::fixed << std::setprecision(1)
+		  << "{\"suite\": \"" << suite_ << "\", "
+		  << "\"benchmark\": \"" << name << "\", "
+		  << "\"operations\": " << operations << ", "
+		  << "\"median_ns\": " << median << ", "
+		  << "\"min_ns\": " << samples.front() << ", "
+		  << "\"p99_ns\": " << samples[(samples.size() - 1) * 99 / 100] << ", "
+		  << "\"max_ns\": " << samples.back() << "}" << std::endl;
+}
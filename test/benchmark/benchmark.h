@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * benchmark.h - libcamera microbenchmark base class
+ */
+#ifndef __TEST_BENCHMARK_BENCHMARK_H__
+#define __TEST_BENCHMARK_BENCHMARK_H__
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class Benchmark
+{
+public:
+	Benchmark(const std::string &suite);
+	virtual ~Benchmark();
+
+	int execute(int argc, char *argv[]);
+
+protected:
+	virtual int init() { return 0; }
+	virtual int run() = 0;
+	virtual void cleanup() { }
+
+	bool enabled(const std::string &name) const;
+
+	/*
+	 * Measure the time taken by func, which performs the given number of
+	 * operations per call. The call count is calibrated for each sample to
+	 * last at least MinSampleTime.
+	 */
+	template<typename Func>
+	void measure(const std::string &name, Func func,
+		     unsigned int operations = 1)
+	{
+		if (!enabled(name))
+			return;
+
+		uint64_t iterations = 1;
+		while (time(func, iterations) < MinSampleTime &&
+		       iterations < (1ULL << 32))
+			iterations *= 2;
+
+		std::vector<double> samples;
+		for (unsigned int i = 0; i < SampleCount; ++i) {
+			std::chrono::nanoseconds duration = time(func, iterations);
+			samples.push_back(static_cast<double>(duration.count()) /
+					  (iterations * operations));
+		}
+
+		report(name, iterations * operations * SampleCount, samples);
+	}
+
+	void report(const std::string &name, uint64_t operations,
+		    std::vector<double> samples);
+
+	/* Prevent the compiler from optimising away the computation of value. */
+	template<typename T>
+	static void doNotOptimize(const T &value)
+	{
+		asm volatile("" : : "r"(&value) : "memory");
+	}
+
+	static constexpr unsigned int SampleCount = 7;
+	static constexpr std::chrono::milliseconds MinSampleTime{ 20 };
+
+private:
+	template<typename Func>
+	static std::chrono::nanoseconds time(Func &func, uint64_t iterations)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint64_t i = 0; i < iterations; ++i)
+			func();
+
+		return std::chrono::steady_clock::now() - start;
+	}
+
+	std::string suite_;
+	std::string filter_;
+};
+
+#define BENCHMARK_REGISTER(klass)					\
+int main(int argc, char *argv[])					\
+{									\
+	return klass().execute(argc, argv);				\
+}
+
+#endif /* __TEST_BENCHMARK_BENCHMARK_H__ */
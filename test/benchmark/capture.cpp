@@ -0,0 +1,343 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * capture.cpp - End-to-end capture benchmark
+ */
+
+#include <chrono>
+#include <errno.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+namespace {
+
+uint64_t processCpuTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Capture a fixed number of frames from a camera, timing each request. */
+class CaptureSession
+{
+public:
+	CaptureSession(std::shared_ptr<Camera> camera)
+		: camera_(camera), acquired_(false), allocated_(false)
+	{
+	}
+
+	~CaptureSession()
+	{
+		camera_->requestCompleted.disconnect(this, &CaptureSession::requestComplete);
+
+		if (allocated_)
+			camera_->freeBuffers();
+		if (acquired_)
+			camera_->release();
+	}
+
+	int configure()
+	{
+		if (camera_->acquire())
+			return -EBUSY;
+		acquired_ = true;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1)
+			return -EINVAL;
+
+		int ret = camera_->configure(config_.get());
+		if (ret)
+			return ret;
+
+		ret = camera_->allocateBuffers();
+		if (ret)
+			return ret;
+		allocated_ = true;
+
+		/* Run the camera at its highest frame rate when supported. */
+		const ControlInfoMap &controls = camera_->controls();
+		auto iter = controls.find(FrameDuration);
+		frameDuration_ = iter != controls.end() ? iter->second.min().getInt() : 0;
+
+		camera_->requestCompleted.connect(this, &CaptureSession::requestComplete);
+
+		return 0;
+	}
+
+	int start(unsigned int frames)
+	{
+		Stream *stream = config_->at(0).stream();
+
+		frames_ = frames;
+		captured_ = 0;
+		failed_ = 0;
+		queueTimes_.clear();
+		latencies_.clear();
+		latencies_.reserve(frames);
+
+		int ret = camera_->start();
+		if (ret)
+			return ret;
+
+		for (unsigned int i = 0; i < config_->at(0).bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request)
+				return -ENOMEM;
+
+			ret = request->addBuffer(stream->createBuffer(i));
+			if (ret)
+				return ret;
+
+			ret = queueRequest(request);
+			if (ret)
+				return ret;
+		}
+
+		return 0;
+	}
+
+	int stop()
+	{
+		return camera_->stop();
+	}
+
+	bool done() const { return captured_ >= frames_ || failed_; }
+
+	std::shared_ptr<Camera> camera() const { return camera_; }
+	unsigned int captured() const { return captured_; }
+	unsigned int failed() const { return failed_; }
+	const std::vector<double> &latencies() const { return latencies_; }
+
+private:
+	int queueRequest(Request *request)
+	{
+		if (frameDuration_)
+			request->controls().set(controls::FrameDuration, frameDuration_);
+
+		queueTimes_[request] = std::chrono::steady_clock::now();
+		return camera_->queueRequest(request);
+	}
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		auto iter = queueTimes_.find(request);
+		if (iter == queueTimes_.end())
+			return;
+
+		std::chrono::nanoseconds latency = now - iter->second;
+		queueTimes_.erase(iter);
+
+		/* Requests cancelled when stopping the camera are not counted. */
+		if (request->status() == Request::RequestCancelled)
+			return;
+
+		if (request->status() != Request::RequestComplete) {
+			failed_++;
+			return;
+		}
+
+		latencies_.push_back(latency.count());
+		captured_++;
+
+		if (captured_ + queueTimes_.size() >= frames_)
+			return;
+
+		/* Reuse the request to avoid measuring allocation overheads. */
+		request->reuse(Request::ReuseBuffers);
+		if (queueRequest(request))
+			failed_++;
+	}
+
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+	bool acquired_;
+	bool allocated_;
+	int frameDuration_;
+
+	unsigned int frames_;
+	unsigned int captured_;
+	unsigned int failed_;
+	std::map<Request *, std::chrono::steady_clock::time_point> queueTimes_;
+	std::vector<double> latencies_;
+};
+
+} /* namespace */
+
+/*
+ * Capture frames concurrently from 1 to N cameras of each pipeline handler,
+ * and report for each configuration:
+ *
+ * - <pipeline>-<N>-frame: the wall clock time per frame captured across all
+ *   cameras, the inverse of the aggregate frame rate
+ * - <pipeline>-<N>-cpu: the process CPU time per frame, which is dominated by
+ *   libcamera as the benchmark doesn't touch the frame contents
+ * - <pipeline>-<N>-latency: the distribution of the time between queuing a
+ *   request and its completion
+ *
+ * The number of virtual cameras defaults to 4 and can be overridden with the
+ * LIBCAMERA_VIRTUAL_CAMERAS environment variable. Pipelines without any camera
+ * are skipped.
+ */
+class CaptureBenchmark : public Benchmark
+{
+public:
+	CaptureBenchmark()
+		: Benchmark("capture"), cm_(nullptr)
+	{
+	}
+
+protected:
+	static constexpr unsigned int Frames = 100;
+
+	int init()
+	{
+		setenv("LIBCAMERA_VIRTUAL_CAMERAS", "4", 0);
+
+		cm_ = CameraManager::instance();
+		int ret = cm_->start();
+		if (ret) {
+			std::cerr << "Failed to start camera manager" << std::endl;
+			return ret;
+		}
+
+		for (const std::shared_ptr<Camera> &camera : cm_->cameras()) {
+			if (camera->name().find("Virtual ") == 0)
+				pipelines_["virtual"].push_back(camera);
+			else if (camera->name().find("VIMC ") == 0)
+				pipelines_["vimc"].push_back(camera);
+		}
+
+		return 0;
+	}
+
+	int run()
+	{
+		for (const auto &pipeline : pipelines_) {
+			const std::vector<std::shared_ptr<Camera>> &cameras = pipeline.second;
+
+			for (unsigned int count = 1; count <= cameras.size(); ++count) {
+				std::vector<std::shared_ptr<Camera>> group(cameras.begin(),
+									   cameras.begin() + count);
+				int ret = measureCapture(pipeline.first + "-" + std::to_string(count),
+							 group);
+				if (ret)
+					return ret;
+			}
+		}
+
+		return 0;
+	}
+
+	void cleanup()
+	{
+		pipelines_.clear();
+
+		if (cm_)
+			cm_->stop();
+	}
+
+private:
+	int measureCapture(const std::string &name,
+			   const std::vector<std::shared_ptr<Camera>> &cameras)
+	{
+		if (!enabled(name))
+			return 0;
+
+		std::vector<std::unique_ptr<CaptureSession>> sessions;
+		for (const std::shared_ptr<Camera> &camera : cameras) {
+			sessions.emplace_back(new CaptureSession(camera));
+
+			int ret = sessions.back()->configure();
+			if (ret) {
+				std::cerr << "Failed to configure " << camera->name()
+					  << std::endl;
+				return ret;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+		std::vector<double> frameTimes;
+		std::vector<double> cpuTimes;
+		std::vector<double> latencies;
+
+		for (unsigned int i = 0; i < SampleCount; ++i) {
+			uint64_t cpuStart = processCpuTime();
+			auto start = std::chrono::steady_clock::now();
+
+			for (std::unique_ptr<CaptureSession> &session : sessions) {
+				if (session->start(Frames)) {
+					std::cerr << "Failed to start "
+						  << session->camera()->name() << std::endl;
+					return -EIO;
+				}
+			}
+
+			/* Allow for a 20fps minimum frame rate before timing out. */
+			Timer timer;
+			timer.start(Frames * 50 + 1000);
+
+			bool done = false;
+			while (!done && timer.isRunning()) {
+				dispatcher->processEvents();
+
+				done = true;
+				for (std::unique_ptr<CaptureSession> &session : sessions)
+					done &= session->done();
+			}
+
+			std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - start;
+			uint64_t cpuTime = processCpuTime() - cpuStart;
+
+			unsigned int captured = 0;
+			for (std::unique_ptr<CaptureSession> &session : sessions) {
+				session->stop();
+
+				if (session->captured() < Frames || session->failed()) {
+					std::cerr << "Failed to capture " << Frames
+						  << " frames from "
+						  << session->camera()->name() << " (got "
+						  << session->captured() << ", "
+						  << session->failed() << " failed)"
+						  << std::endl;
+					return -ETIMEDOUT;
+				}
+
+				captured += session->captured();
+				latencies.insert(latencies.end(),
+						 session->latencies().begin(),
+						 session->latencies().end());
+			}
+
+			frameTimes.push_back(static_cast<double>(duration.count()) / captured);
+			cpuTimes.push_back(static_cast<double>(cpuTime) / captured);
+		}
+
+		uint64_t frames = Frames * cameras.size() * SampleCount;
+		report(name + "-frame", frames, frameTimes);
+		report(name + "-cpu", frames, cpuTimes);
+		report(name + "-latency", frames, latencies);
+
+		return 0;
+	}
+
+	CameraManager *cm_;
+	std::map<std::string, std::vector<std::shared_ptr<Camera>>> pipelines_;
+};
+
+BENCHMARK_REGISTER(CaptureBenchmark)
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * controls.cpp - Control list benchmark
+ */
+
+#include <libcamera/controls.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class ControlsBenchmark : public Benchmark
+{
+public:
+	ControlsBenchmark()
+		: Benchmark("controls")
+	{
+	}
+
+protected:
+	int run()
+	{
+		/* Build a list of typical per-frame controls. */
+		measure("build", []() {
+			ControlList list(nullptr);
+
+			list.set(controls::ManualExposure, 10000);
+			list.set(controls::ManualGain, 128);
+			list.set(controls::Brightness, 0);
+			list.set(controls::ScalerCrop, Rectangle{ 0, 0, 1920, 1080 });
+		});
+
+		ControlList source(nullptr);
+		source.set(controls::ManualExposure, 20000);
+		source.set(controls::ManualGain, 256);
+		source.set(controls::AwbEnable, true);
+
+		ControlList target(nullptr);
+		target.set(controls::ManualExposure, 10000);
+		target.set(controls::Brightness, 0);
+
+		measure("update", [&]() { target.update(source); });
+
+		measure("get", [&]() {
+			doNotOptimize(target.get(controls::ManualExposure));
+		});
+
+		measure("iterate", [&]() {
+			for (auto &entry : target)
+				doNotOptimize(entry);
+		});
+
+		return 0;
+	}
+};
+
+BENCHMARK_REGISTER(ControlsBenchmark)
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * event_dispatcher.cpp - Event dispatcher wakeup benchmark
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <libcamera/event_dispatcher.h>
+
+#include "benchmark.h"
+#include "event_dispatcher_epoll.h"
+#include "event_dispatcher_poll.h"
+#include "thread.h"
+
+using namespace libcamera;
+
+/* Process events in a loop, recording the time of each wakeup. */
+class WakeupThread : public Thread
+{
+public:
+	WakeupThread(std::unique_ptr<EventDispatcher> dispatcher)
+		: stop_(false), wakeups_(0)
+	{
+		setEventDispatcher(std::move(dispatcher));
+	}
+
+	void stop()
+	{
+		stop_.store(true);
+		eventDispatcher()->interrupt();
+		wait();
+	}
+
+	unsigned int wakeups() const { return wakeups_.load(std::memory_order_acquire); }
+	std::chrono::steady_clock::time_point woken() const { return woken_; }
+
+protected:
+	void run()
+	{
+		EventDispatcher *dispatcher = eventDispatcher();
+
+		while (!stop_.load()) {
+			dispatcher->processEvents();
+
+			woken_ = std::chrono::steady_clock::now();
+			wakeups_.fetch_add(1, std::memory_order_release);
+		}
+	}
+
+private:
+	std::atomic<bool> stop_;
+	std::atomic<unsigned int> wakeups_;
+	std::chrono::steady_clock::time_point woken_;
+};
+
+class EventDispatcherBenchmark : public Benchmark
+{
+public:
+	EventDispatcherBenchmark()
+		: Benchmark("event-dispatcher")
+	{
+	}
+
+protected:
+	static constexpr unsigned int Wakeups = 500;
+
+	/*
+	 * Measure the latency between interrupting a dispatcher blocked in
+	 * processEvents() and the return of processEvents() in its thread.
+	 */
+	void measureWakeup(const std::string &name,
+			   std::unique_ptr<EventDispatcher> dispatcher)
+	{
+		if (!enabled(name))
+			return;
+
+		WakeupThread thread(std::move(dispatcher));
+		EventDispatcher *target = thread.eventDispatcher();
+		std::vector<double> samples;
+
+		thread.start();
+
+		for (unsigned int i = 0; i < Wakeups; ++i) {
+			/* Give the thread time to block in the dispatcher. */
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+			unsigned int wakeups = thread.wakeups();
+			auto start = std::chrono::steady_clock::now();
+
+			target->interrupt();
+
+			while (thread.wakeups() == wakeups)
+				std::this_thread::yield();
+
+			std::chrono::nanoseconds latency = thread.woken() - start;
+			samples.push_back(latency.count());
+		}
+
+		thread.stop();
+
+		report(name, Wakeups, samples);
+	}
+
+	int run()
+	{
+		measureWakeup("wakeup-poll", std::unique_ptr<EventDispatcher>(new EventDispatcherPoll()));
+		measureWakeup("wakeup-epoll", std::unique_ptr<EventDispatcher>(new EventDispatcherEpoll()));
+
+		return 0;
+	}
+};
+
+BENCHMARK_REGISTER(EventDispatcherBenchmark)
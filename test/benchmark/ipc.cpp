@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipc.cpp - IPC Unix socket benchmark
+ */
+
+#include <iostream>
+
+#include <libcamera/event_dispatcher.h>
+
+#include "benchmark.h"
+#include "ipc_unixsocket.h"
+#include "thread.h"
+
+using namespace libcamera;
+
+/* Echo all messages received on the socket back to the sender. */
+class EchoThread : public Thread
+{
+public:
+	EchoThread(int fd)
+		: fd_(fd)
+	{
+	}
+
+protected:
+	void run()
+	{
+		IPCUnixSocket ipc;
+
+		if (ipc.bind(fd_)) {
+			std::cerr << "Failed to bind IPC socket" << std::endl;
+			return;
+		}
+
+		ipc.readyRead.connect(this, &EchoThread::readyRead);
+
+		exec();
+
+		ipc.close();
+	}
+
+private:
+	void readyRead(IPCUnixSocket *ipc)
+	{
+		IPCUnixSocket::Payload payload;
+
+		if (!ipc->receive(&payload))
+			ipc->send(payload);
+	}
+
+	int fd_;
+};
+
+class IPCBenchmark : public Benchmark
+{
+public:
+	IPCBenchmark()
+		: Benchmark("ipc"), replied_(false)
+	{
+	}
+
+protected:
+	int init()
+	{
+		int fd = ipc_.create();
+		if (fd < 0) {
+			std::cerr << "Failed to create IPC socket" << std::endl;
+			return fd;
+		}
+
+		ipc_.readyRead.connect(this, &IPCBenchmark::readyRead);
+
+		echo_ = new EchoThread(fd);
+		echo_->start();
+
+		return 0;
+	}
+
+	int run()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		for (unsigned int size : { 64U, 4096U, 65536U }) {
+			IPCUnixSocket::Payload payload;
+			payload.data.resize(size);
+
+			measure("round-trip-" + std::to_string(size), [&]() {
+				ipc_.send(payload);
+
+				while (!replied_)
+					dispatcher->processEvents();
+				replied_ = false;
+			});
+		}
+
+		return 0;
+	}
+
+	void cleanup()
+	{
+		echo_->exit(0);
+		echo_->wait();
+		delete echo_;
+
+		ipc_.close();
+	}
+
+private:
+	void readyRead(IPCUnixSocket *ipc)
+	{
+		IPCUnixSocket::Payload payload;
+
+		if (!ipc->receive(&payload))
+			replied_ = true;
+	}
+
+	IPCUnixSocket ipc_;
+	EchoThread *echo_;
+	bool replied_;
+};
+
+BENCHMARK_REGISTER(IPCBenchmark)
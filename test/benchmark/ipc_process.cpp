@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipc_process.cpp - IPC benchmark between a parent and a child process
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <string.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "benchmark.h"
+#include "ipc_unixsocket.h"
+#include "process.h"
+#include "thread.h"
+
+using namespace libcamera;
+
+namespace {
+
+/*
+ * Echo all messages received on the socket back to the sender, until an empty
+ * message is received. This runs in the child process.
+ */
+class EchoProcess
+{
+public:
+	EchoProcess()
+		: exit_(false)
+	{
+		ipc_.readyRead.connect(this, &EchoProcess::readyRead);
+	}
+
+	int run(int fd)
+	{
+		if (ipc_.bind(fd)) {
+			std::cerr << "Failed to bind IPC socket" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		while (!exit_)
+			dispatcher->processEvents();
+
+		ipc_.close();
+
+		return EXIT_SUCCESS;
+	}
+
+private:
+	void readyRead(IPCUnixSocket *ipc)
+	{
+		IPCUnixSocket::Payload payload;
+
+		if (ipc->receive(&payload))
+			return;
+
+		if (payload.data.empty() && payload.fds.empty()) {
+			exit_ = true;
+			return;
+		}
+
+		ipc->send(payload);
+
+		for (int32_t fd : payload.fds)
+			::close(fd);
+	}
+
+	IPCUnixSocket ipc_;
+	bool exit_;
+};
+
+} /* namespace */
+
+/*
+ * Measure the cost of the IPC with an isolated process, as used by the IPA
+ * proxy, for the socket and shared memory transports. The round-trip
+ * benchmarks report the latency of a message echoed by the child, optionally
+ * carrying file descriptors, and the stream benchmarks the time per message
+ * with up to Window messages in flight, the inverse of the throughput.
+ */
+class IPCProcessBenchmark : public Benchmark
+{
+public:
+	IPCProcessBenchmark(const char *path)
+		: Benchmark("ipc-process"), path_(path), fd_(-1), pending_(0),
+		  finished_(false)
+	{
+	}
+
+protected:
+	static constexpr unsigned int Window = 8;
+	static constexpr unsigned int Batch = 64;
+
+	int init()
+	{
+		int fd = ipc_.create();
+		if (fd < 0) {
+			std::cerr << "Failed to create IPC socket" << std::endl;
+			return fd;
+		}
+
+		ipc_.readyRead.connect(this, &IPCProcessBenchmark::readyRead);
+		proc_.finished.connect(this, &IPCProcessBenchmark::procFinished);
+
+		int ret = proc_.start(path_, { "child", std::to_string(fd) }, { fd });
+		::close(fd);
+		if (ret) {
+			std::cerr << "Failed to start child process" << std::endl;
+			return ret;
+		}
+
+		/* A file descriptor to be passed with messages. */
+		fd_ = eventfd(0, EFD_CLOEXEC);
+		if (fd_ < 0) {
+			ret = -errno;
+			std::cerr << "Failed to create eventfd" << std::endl;
+			return ret;
+		}
+
+		return 0;
+	}
+
+	int run()
+	{
+		measureTransport("socket-");
+
+		int ret = ipc_.enableSharedMemory(256 * 1024);
+		if (ret) {
+			std::cerr << "Failed to enable shared memory" << std::endl;
+			return ret;
+		}
+
+		measureTransport("shm-");
+
+		return 0;
+	}
+
+	void cleanup()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		if (ipc_.isBound()) {
+			ipc_.send(IPCUnixSocket::Payload{});
+
+			Timer timeout;
+			timeout.start(1000);
+			while (!finished_ && timeout.isRunning())
+				dispatcher->processEvents();
+
+			ipc_.close();
+		}
+
+		if (fd_ >= 0)
+			::close(fd_);
+	}
+
+private:
+	void measureTransport(const std::string &prefix)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		for (unsigned int size : { 64U, 4096U, 65536U }) {
+			IPCUnixSocket::Payload payload;
+			payload.data.resize(size);
+
+			measure(prefix + "round-trip-" + std::to_string(size), [&]() {
+				ipc_.send(payload);
+				pending_++;
+
+				while (pending_)
+					dispatcher->processEvents();
+			});
+		}
+
+		for (unsigned int count : { 1U, 4U, 16U }) {
+			IPCUnixSocket::Payload payload;
+			payload.data.resize(64);
+			payload.fds.assign(count, fd_);
+
+			measure(prefix + "round-trip-64-fds-" + std::to_string(count), [&]() {
+				ipc_.send(payload);
+				pending_++;
+
+				while (pending_)
+					dispatcher->processEvents();
+			});
+		}
+
+		for (unsigned int size : { 64U, 4096U }) {
+			IPCUnixSocket::Payload payload;
+			payload.data.resize(size);
+
+			measure(prefix + "stream-" + std::to_string(size), [&]() {
+				for (unsigned int i = 0; i < Batch; ++i) {
+					while (pending_ >= Window)
+						dispatcher->processEvents();
+
+					ipc_.send(payload);
+					pending_++;
+				}
+
+				while (pending_)
+					dispatcher->processEvents();
+			}, Batch);
+		}
+	}
+
+	void readyRead(IPCUnixSocket *ipc)
+	{
+		IPCUnixSocket::Payload payload;
+
+		if (ipc->receive(&payload))
+			return;
+
+		for (int32_t fd : payload.fds)
+			::close(fd);
+
+		pending_--;
+	}
+
+	void procFinished(Process *proc, enum Process::ExitStatus status, int code)
+	{
+		finished_ = true;
+	}
+
+	std::string path_;
+	Process proc_;
+	IPCUnixSocket ipc_;
+	int fd_;
+	unsigned int pending_;
+	bool finished_;
+};
+
+/*
+ * Can't use BENCHMARK_REGISTER() as the same binary acts as both the parent
+ * and the child process.
+ */
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && !strcmp(argv[1], "child"))
+		return EchoProcess().run(std::stoi(argv[2]));
+
+	return IPCProcessBenchmark("/proc/self/exe").execute(argc, argv);
+}
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * message.cpp - Message posting benchmark
+ */
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <libcamera/object.h>
+
+#include "benchmark.h"
+#include "message.h"
+#include "thread.h"
+#include "utils.h"
+
+using namespace libcamera;
+
+class BenchmarkMessage : public Message
+{
+public:
+	BenchmarkMessage()
+		: Message(type())
+	{
+	}
+
+	static Message::Type type()
+	{
+		static Message::Type type = registerMessageType();
+		return type;
+	}
+};
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: received_(0)
+	{
+	}
+
+	unsigned int received() const { return received_.load(std::memory_order_acquire); }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != BenchmarkMessage::type()) {
+			Object::message(msg);
+			return;
+		}
+
+		received_.store(received_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+private:
+	std::atomic<unsigned int> received_;
+};
+
+class MessageBenchmark : public Benchmark
+{
+public:
+	MessageBenchmark()
+		: Benchmark("message")
+	{
+	}
+
+protected:
+	static constexpr unsigned int Batch = 1000;
+
+	int run()
+	{
+		/* Post and dispatch messages within the current thread. */
+		Receiver local;
+		Thread *current = Thread::current();
+
+		measure("post-dispatch", [&]() {
+			for (unsigned int i = 0; i < Batch; ++i)
+				local.postMessage(utils::make_unique<BenchmarkMessage>());
+
+			current->dispatchMessages(&local);
+		}, Batch);
+
+		/*
+		 * Post messages to a receiver bound to another thread, waiting
+		 * for each batch to be delivered.
+		 */
+		Thread thread;
+		Receiver remote;
+
+		remote.moveToThread(&thread);
+		thread.start();
+
+		unsigned int target = 0;
+		measure("post-cross-thread", [&]() {
+			for (unsigned int i = 0; i < Batch; ++i)
+				remote.postMessage(utils::make_unique<BenchmarkMessage>());
+
+			target += Batch;
+			while (remote.received() < target)
+				std::this_thread::yield();
+		}, Batch);
+
+		/* Post a single message at a time, waiting for its delivery. */
+		measure("post-cross-thread-single", [&]() {
+			remote.postMessage(utils::make_unique<BenchmarkMessage>());
+
+			target++;
+			while (remote.received() < target)
+				std::this_thread::yield();
+		});
+
+		thread.exit(0);
+		thread.wait();
+
+		return 0;
+	}
+};
+
+BENCHMARK_REGISTER(MessageBenchmark)
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * signal.cpp - Signal emission benchmark
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+#include "benchmark.h"
+#include "thread.h"
+
+using namespace libcamera;
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: received_(0)
+	{
+	}
+
+	void slot(int value)
+	{
+		received_.store(received_.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+	unsigned int received() const { return received_.load(std::memory_order_acquire); }
+
+private:
+	std::atomic<unsigned int> received_;
+};
+
+class SignalBenchmark : public Benchmark
+{
+public:
+	SignalBenchmark()
+		: Benchmark("signal")
+	{
+	}
+
+protected:
+	static constexpr unsigned int QueuedBatch = 1000;
+
+	int run()
+	{
+		/* Direct delivery to receivers bound to the current thread. */
+		Receiver receivers[4];
+		Signal<int> single;
+		Signal<int> multiple;
+
+		single.connect(&receivers[0], &Receiver::slot);
+		for (Receiver &receiver : receivers)
+			multiple.connect(&receiver, &Receiver::slot);
+
+		measure("emit-direct", [&]() { single.emit(0); });
+		measure("emit-direct-4-slots", [&]() { multiple.emit(0); });
+
+		/*
+		 * Queued delivery to a receiver bound to another thread. Each
+		 * call emits a batch of signals and waits for their delivery.
+		 */
+		Thread thread;
+		Receiver remote;
+		Signal<int> queued;
+
+		remote.moveToThread(&thread);
+		queued.connect(&remote, &Receiver::slot);
+		thread.start();
+
+		unsigned int target = 0;
+		measure("emit-queued", [&]() {
+			for (unsigned int i = 0; i < QueuedBatch; ++i)
+				queued.emit(0);
+
+			target += QueuedBatch;
+			while (remote.received() < target)
+				std::this_thread::yield();
+		}, QueuedBatch);
+
+		thread.exit(0);
+		thread.wait();
+
+		return 0;
+	}
+};
+
+BENCHMARK_REGISTER(SignalBenchmark)
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * stream_formats.cpp - Stream formats benchmark
+ */
+
+#include <map>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/stream.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+class StreamFormatsBenchmark : public Benchmark
+{
+public:
+	StreamFormatsBenchmark()
+		: Benchmark("stream-formats")
+	{
+	}
+
+protected:
+	int run()
+	{
+		/* Formats as reported by a UVC webcam, and by a scaler. */
+		const std::map<unsigned int, std::vector<SizeRange>> formats = {
+			{ V4L2_PIX_FMT_YUYV, {
+				SizeRange(640, 480), SizeRange(1280, 720),
+				SizeRange(1920, 1080), SizeRange(320, 240),
+			} },
+			{ V4L2_PIX_FMT_MJPEG, {
+				SizeRange(640, 480), SizeRange(1280, 720),
+				SizeRange(1920, 1080), SizeRange(3840, 2160),
+			} },
+			{ V4L2_PIX_FMT_NV12, {
+				SizeRange(32, 16, 4096, 2160, 2, 2),
+			} },
+		};
+
+		measure("construct", [&]() {
+			StreamFormats streamFormats(formats);
+			doNotOptimize(streamFormats);
+		});
+
+		StreamFormats streamFormats(formats);
+
+		measure("pixelformats", [&]() {
+			doNotOptimize(streamFormats.pixelformats());
+		});
+
+		measure("sizes", [&]() {
+			doNotOptimize(streamFormats.sizes(V4L2_PIX_FMT_NV12));
+		});
+
+		measure("range", [&]() {
+			doNotOptimize(streamFormats.range(V4L2_PIX_FMT_MJPEG));
+		});
+
+		/* Look up a requested size in the discrete sizes. */
+		const Size request(1280, 720);
+		measure("contains", [&]() {
+			for (const Size &size : streamFormats.sizes(V4L2_PIX_FMT_YUYV))
+				doNotOptimize(size == request);
+		});
+
+		return 0;
+	}
+};
+
+BENCHMARK_REGISTER(StreamFormatsBenchmark)
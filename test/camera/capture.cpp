@@ -34,7 +34,13 @@ protected:
 
 		completeRequestsCount_++;
 
-		/* Create a new request. */
+		/* Reuse every other request, and create a new one otherwise. */
+		if (completeRequestsCount_ % 2) {
+			request->reuse(Request::ReuseBuffers);
+			camera_->queueRequest(request);
+			return;
+		}
+
 		Stream *stream = buffers.begin()->first;
 		Buffer *buffer = buffers.begin()->second;
 		std::unique_ptr<Buffer> newBuffer = stream->createBuffer(buffer->index());
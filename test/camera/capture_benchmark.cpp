@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * capture_benchmark.cpp - Capture performance benchmark on vimc
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits.h>
+#include <map>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * The benchmark is configured through environment variables, to allow
+ * running it with different parameters without rebuilding:
+ *
+ * - LIBCAMERA_BENCHMARK_BUFFERS: number of buffers per stream (default 4)
+ * - LIBCAMERA_BENCHMARK_STREAMS: number of streams (default 1)
+ * - LIBCAMERA_BENCHMARK_FRAMES: number of frames to capture (default 300)
+ */
+unsigned int benchmarkParameter(const char *name, unsigned int defaultValue)
+{
+	const char *value = getenv(name);
+	if (!value)
+		return defaultValue;
+
+	unsigned int number = strtoul(value, nullptr, 10);
+	return number ? number : defaultValue;
+}
+
+uint64_t processCpuTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+class CaptureBenchmark : public CameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		auto now = chrono::steady_clock::now();
+
+		if (request->status() != Request::RequestComplete) {
+			failedRequests_++;
+			return;
+		}
+
+		auto iter = queueTimes_.find(request);
+		if (iter != queueTimes_.end()) {
+			latencies_.push_back(now - iter->second);
+			queueTimes_.erase(iter);
+		}
+
+		completeRequestsCount_++;
+		if (completeRequestsCount_ + inFlight() >= frames_)
+			return;
+
+		/* Reuse the request to avoid measuring allocation overheads. */
+		request->reuse(Request::ReuseBuffers);
+		queueRequest(request);
+	}
+
+	int queueRequest(Request *request)
+	{
+		queueTimes_[request] = chrono::steady_clock::now();
+		return camera_->queueRequest(request);
+	}
+
+	unsigned int inFlight() const
+	{
+		return queueTimes_.size();
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		buffers_ = benchmarkParameter("LIBCAMERA_BENCHMARK_BUFFERS", 4);
+		streams_ = benchmarkParameter("LIBCAMERA_BENCHMARK_STREAMS", 1);
+		frames_ = benchmarkParameter("LIBCAMERA_BENCHMARK_FRAMES", 300);
+
+		StreamRoles roles(streams_, StreamRole::VideoRecording);
+		config_ = camera_->generateConfiguration(roles);
+		if (!config_ || config_->empty()) {
+			cout << "Failed to generate default configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		for (StreamConfiguration &cfg : *config_)
+			cfg.bufferCount = buffers_;
+
+		if (config_->validate() == CameraConfiguration::Invalid) {
+			cout << "Failed to validate configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The pipeline handler may adjust the number of streams and
+		 * buffers, create as many requests as the smallest buffer
+		 * count.
+		 */
+		unsigned int bufferCount = UINT_MAX;
+		for (const StreamConfiguration &cfg : *config_)
+			bufferCount = std::min(bufferCount, cfg.bufferCount);
+
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			for (const StreamConfiguration &cfg : *config_) {
+				Stream *stream = cfg.stream();
+				if (request->addBuffer(stream->createBuffer(i))) {
+					cout << "Failed to associate buffer with request"
+					     << endl;
+					return TestFail;
+				}
+			}
+
+			requests.push_back(request);
+		}
+
+		completeRequestsCount_ = 0;
+		failedRequests_ = 0;
+		latencies_.clear();
+		latencies_.reserve(frames_);
+
+		camera_->requestCompleted.connect(this, &CaptureBenchmark::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		uint64_t cpuStart = processCpuTime();
+		auto start = chrono::steady_clock::now();
+
+		for (Request *request : requests) {
+			if (queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Allow for a 20fps minimum frame rate before timing out. */
+		EventDispatcher *dispatcher = CameraManager::instance()->eventDispatcher();
+
+		Timer timer;
+		timer.start(frames_ * 50 + 1000);
+		while (timer.isRunning() && completeRequestsCount_ < frames_ &&
+		       !failedRequests_)
+			dispatcher->processEvents();
+
+		chrono::duration<double> duration = chrono::steady_clock::now() - start;
+		uint64_t cpuTime = processCpuTime() - cpuStart;
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		if (failedRequests_ || completeRequestsCount_ < frames_) {
+			cout << "Failed to capture " << frames_ << " frames (got "
+			     << completeRequestsCount_ << ", " << failedRequests_
+			     << " failed)" << endl;
+			return TestFail;
+		}
+
+		std::sort(latencies_.begin(), latencies_.end());
+		chrono::duration<double, micro> total(0);
+		for (const auto &latency : latencies_)
+			total += latency;
+
+		auto latencyUs = [](const chrono::steady_clock::duration &latency) {
+			return chrono::duration_cast<chrono::microseconds>(latency).count();
+		};
+
+		cout << "Captured " << completeRequestsCount_ << " frames with "
+		     << config_->size() << " stream(s) and " << bufferCount
+		     << " buffers in " << duration.count() << "s ("
+		     << completeRequestsCount_ / duration.count() << " fps)"
+		     << endl;
+		cout << "CPU time per frame: "
+		     << cpuTime / completeRequestsCount_ / 1000 << "us" << endl;
+		cout << "Request latency: min " << latencyUs(latencies_.front())
+		     << "us, mean " << total.count() / latencies_.size()
+		     << "us, p99 " << latencyUs(latencies_[latencies_.size() * 99 / 100])
+		     << "us, max " << latencyUs(latencies_.back()) << "us" << endl;
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+
+	unsigned int buffers_;
+	unsigned int streams_;
+	unsigned int frames_;
+
+	unsigned int completeRequestsCount_;
+	unsigned int failedRequests_;
+	std::map<Request *, chrono::steady_clock::time_point> queueTimes_;
+	std::vector<chrono::steady_clock::duration> latencies_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CaptureBenchmark);
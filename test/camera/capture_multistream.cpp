@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * capture_multistream.cpp - Test capture with multiple streams on vimc
+ */
+
+#include <algorithm>
+#include <iostream>
+
+#include "camera_test.h"
+
+using namespace std;
+
+namespace {
+
+/*
+ * Capture the main, Bayer and downscaled streams of the vimc camera, and
+ * verify that requests only complete once all their buffers are complete.
+ */
+class CaptureMultiStream : public CameraTest
+{
+protected:
+	unsigned int completeBuffersCount_;
+	unsigned int completeRequestsCount_;
+	bool incomplete_;
+
+	void bufferComplete(Request *request, Buffer *buffer)
+	{
+		if (buffer->status() != Buffer::BufferSuccess)
+			return;
+
+		completeBuffersCount_++;
+	}
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		for (const auto &it : buffers) {
+			if (it.second->status() != Buffer::BufferSuccess)
+				incomplete_ = true;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		int ret = CameraTest::init();
+		if (ret)
+			return ret;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording,
+							   StreamRole::StillCapture,
+							   StreamRole::Viewfinder });
+		if (!config_ || config_->size() != 3) {
+			cout << "Failed to generate multi-stream configuration" << endl;
+			CameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set multi-stream configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		unsigned int bufferCount = config_->at(0).bufferCount;
+		for (const StreamConfiguration &cfg : *config_)
+			bufferCount = std::min(bufferCount, cfg.bufferCount);
+
+		std::vector<Request *> requests;
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			if (!request) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			for (const StreamConfiguration &cfg : *config_) {
+				Stream *stream = cfg.stream();
+				if (request->addBuffer(stream->createBuffer(i))) {
+					cout << "Failed to associate buffer with request"
+					     << endl;
+					return TestFail;
+				}
+			}
+
+			requests.push_back(request);
+		}
+
+		completeRequestsCount_ = 0;
+		completeBuffersCount_ = 0;
+		incomplete_ = false;
+
+		camera_->bufferCompleted.connect(this, &CaptureMultiStream::bufferComplete);
+		camera_->requestCompleted.connect(this, &CaptureMultiStream::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (Request *request : requests) {
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = CameraManager::instance()->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (completeRequestsCount_ <= bufferCount * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << " expected at least "
+			     << bufferCount * 2 << ")" << endl;
+			return TestFail;
+		}
+
+		if (incomplete_ ||
+		    completeBuffersCount_ < completeRequestsCount_ * config_->size()) {
+			cout << "Requests completed before all their buffers"
+			     << endl;
+			return TestFail;
+		}
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CaptureMultiStream);
@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * clock-recovery.cpp - Frame timestamp jitter filtering test
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+
+#include "clock_recovery.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ClockRecoveryTest : public Test
+{
+protected:
+	static constexpr uint64_t Period = 33333333;
+
+	/* Deterministic jitter of up to 2ms, as seen on USB transfers. */
+	static uint64_t jitter(unsigned int frame)
+	{
+		return (frame * 7919 % 13) * 2000000 / 12;
+	}
+
+	int run()
+	{
+		ClockRecovery recovery;
+		uint64_t base = 1000000000;
+		uint64_t last = 0;
+		uint64_t maxError = 0;
+
+		for (unsigned int frame = 0; frame < 200; ++frame) {
+			/* Drop a few frames. */
+			if (frame % 50 == 25)
+				continue;
+
+			uint64_t ideal = base + frame * Period;
+			uint64_t timestamp = recovery.recover(frame,
+							      ideal + jitter(frame));
+
+			if (timestamp <= last) {
+				cout << "Timestamps not increasing at frame "
+				     << frame << endl;
+				return TestFail;
+			}
+			last = timestamp;
+
+			if (frame < 100)
+				continue;
+
+			/* Compare to the mean jitter of 1ms. */
+			uint64_t expected = ideal + 1000000;
+			uint64_t error = timestamp > expected ? timestamp - expected
+							      : expected - timestamp;
+			maxError = std::max(maxError, error);
+		}
+
+		if (maxError > 500000) {
+			cout << "Recovered timestamps off by " << maxError
+			     << "ns" << endl;
+			return TestFail;
+		}
+
+		if (recovery.period() < Period - 100000 ||
+		    recovery.period() > Period + 100000) {
+			cout << "Frame period estimated to " << recovery.period()
+			     << "ns" << endl;
+			return TestFail;
+		}
+
+		/* A frame rate change restarts the estimation. */
+		base = last + 2 * Period;
+		for (unsigned int frame = 200; frame < 300; ++frame) {
+			uint64_t ideal = base + (frame - 200) * 2 * Period;
+			uint64_t timestamp = recovery.recover(frame, ideal);
+
+			if (timestamp <= last) {
+				cout << "Timestamps not increasing at frame "
+				     << frame << endl;
+				return TestFail;
+			}
+			last = timestamp;
+		}
+
+		if (recovery.period() != 2 * Period) {
+			cout << "Frame period change not detected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ClockRecoveryTest)
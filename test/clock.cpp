@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * clock.cpp - Clock conversion test
+ */
+
+#include <iostream>
+#include <time.h>
+
+#include <libcamera/clock.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+uint64_t readClock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+} /* namespace */
+
+class ClockTest : public Test
+{
+protected:
+	/* Tolerance of the conversions, in nanoseconds. */
+	static constexpr uint64_t Tolerance = 10000000;
+
+	int check(const ClockConverter &converter, ClockId to, clockid_t clock,
+		  const char *name)
+	{
+		uint64_t before = readClock(clock);
+		uint64_t converted = converter.convert(readClock(CLOCK_MONOTONIC),
+						       ClockMonotonic, to);
+		uint64_t after = readClock(clock);
+
+		if (converted + Tolerance < before || converted > after + Tolerance) {
+			cout << "Invalid conversion to " << name << ": "
+			     << converted << " not in [" << before << ", "
+			     << after << "]" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		ClockConverter converter;
+
+		if (check(converter, ClockMonotonic, CLOCK_MONOTONIC, "monotonic") ||
+		    check(converter, ClockBoottime, CLOCK_BOOTTIME, "boottime") ||
+		    check(converter, ClockRealtime, CLOCK_REALTIME, "realtime"))
+			return TestFail;
+
+		uint64_t timestamp = readClock(CLOCK_MONOTONIC);
+		uint64_t realtime = converter.convert(timestamp, ClockMonotonic,
+						      ClockRealtime);
+		if (converter.convert(realtime, ClockRealtime, ClockMonotonic) !=
+		    timestamp) {
+			cout << "Conversion is not reversible" << endl;
+			return TestFail;
+		}
+
+		if (converter.convert(timestamp, ClockUnknown, ClockRealtime) ||
+		    converter.convert(0, ClockMonotonic, ClockRealtime)) {
+			cout << "Invalid timestamps shall not be converted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ClockTest)
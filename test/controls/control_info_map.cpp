@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * control_info_map.cpp - ControlInfoMap tests
+ */
+
+#include <iostream>
+
+#include <libcamera/controls.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ControlInfoMapTest : public Test
+{
+protected:
+	int run()
+	{
+		ControlInfoMap map;
+
+		/* Test that the map is initially empty. */
+		if (!map.empty() || map.size() != 0 || map.begin() != map.end()) {
+			cout << "Map should be empty" << endl;
+			return TestFail;
+		}
+
+		if (map.find(Brightness) != map.end() || map.count(Brightness)) {
+			cout << "Map should not contain Brightness control" << endl;
+			return TestFail;
+		}
+
+		/* Insert controls out of order. */
+		auto result = map.insert(ControlInfo(Contrast, 10, 200));
+		if (!result.second || result.first->first != Contrast) {
+			cout << "Failed to insert Contrast control" << endl;
+			return TestFail;
+		}
+
+		map.insert(ControlInfo(Brightness, 0, 255));
+
+		/* Inserting a control twice shall keep the first information. */
+		result = map.insert(ControlInfo(Contrast, 0, 100));
+		if (result.second || map.at(Contrast).max().getInt() != 200) {
+			cout << "Duplicate control shouldn't be inserted" << endl;
+			return TestFail;
+		}
+
+		if (map.size() != 2 || !map.count(Brightness) || !map.count(Contrast) ||
+		    map.count(Saturation)) {
+			cout << "Invalid map contents" << endl;
+			return TestFail;
+		}
+
+		auto iter = map.find(Brightness);
+		if (iter == map.end() || iter->first != Brightness ||
+		    iter->second.max().getInt() != 255) {
+			cout << "Failed to find Brightness control" << endl;
+			return TestFail;
+		}
+
+		/* Iteration shall return the controls in ControlId order. */
+		unsigned int count = 0;
+		for (const auto &entry : map) {
+			if ((count == 0 && entry.first != Brightness) ||
+			    (count == 1 && entry.first != Contrast)) {
+				cout << "Invalid iteration order" << endl;
+				return TestFail;
+			}
+			count++;
+		}
+
+		if (count != 2) {
+			cout << "Invalid number of iterated controls" << endl;
+			return TestFail;
+		}
+
+		/* Pointers to the control information shall stay valid. */
+		const ControlInfo *brightness = &map.at(Brightness);
+		map.insert(ControlInfo(Saturation, 0, 100));
+		if (&map.at(Brightness) != brightness) {
+			cout << "Control information moved on insertion" << endl;
+			return TestFail;
+		}
+
+		map.clear();
+		if (!map.empty() || map.begin() != map.end()) {
+			cout << "Map should be empty after clear" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlInfoMapTest)
@@ -192,6 +192,28 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test the typed accessors, and verify that they operate on
+		 * the same values as the untyped accessors.
+		 */
+		newList.set(controls::Brightness, 42);
+
+		if (newList.get(controls::Brightness) != 42 ||
+		    newList[Brightness].getInt() != 42) {
+			cout << "Failed to set control through typed accessor" << endl;
+			return TestFail;
+		}
+
+		if (newList.get(controls::Saturation) != 255) {
+			cout << "Failed to get control through typed accessor" << endl;
+			return TestFail;
+		}
+
+		if (list.get(controls::Contrast) != 0) {
+			cout << "Missing control should have a default value" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -62,6 +62,15 @@ protected:
 			return TestFail;
 		}
 
+		Rectangle rect = { 16, 8, 640, 480 };
+		value.set(rect);
+		if (value.type() != ControlValueRectangle ||
+		    value.getRectangle() != rect ||
+		    value.get<Rectangle>() != rect) {
+			cerr << "Failed to get Rectangle" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
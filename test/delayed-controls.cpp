@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * delayed-controls.cpp - Delayed controls tests
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+#include "camera_sensor.h"
+#include "delayed_controls.h"
+#include "device_enumerator.h"
+#include "media_device.h"
+#include "v4l2_subdevice.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DelayedControlsTest : public Test
+{
+protected:
+	static constexpr unsigned int Frames = 8;
+	static constexpr uint32_t FirstSequence = 100;
+
+	int init()
+	{
+		enumerator_ = DeviceEnumerator::create();
+		if (!enumerator_) {
+			cerr << "Failed to create device enumerator" << endl;
+			return TestFail;
+		}
+
+		if (enumerator_->enumerate()) {
+			cerr << "Failed to enumerate media devices" << endl;
+			return TestFail;
+		}
+
+		DeviceMatch dm("vimc");
+		media_ = enumerator_->search(dm);
+		if (!media_) {
+			cerr << "Unable to find \'vimc\' media device node" << endl;
+			return TestSkip;
+		}
+
+		sensor_.reset(new CameraSensor(media_->getEntityByName("Sensor A")));
+		if (sensor_->init() < 0) {
+			cerr << "Unable to initialise camera sensor" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int checkDevice(uint32_t sequence, int64_t brightness, int64_t contrast)
+	{
+		V4L2ControlList ctrls;
+		ctrls.add(V4L2_CID_BRIGHTNESS);
+		ctrls.add(V4L2_CID_CONTRAST);
+
+		if (sensor_->getControls(&ctrls, true)) {
+			cerr << "Failed to read controls" << endl;
+			return TestFail;
+		}
+
+		if (ctrls[V4L2_CID_BRIGHTNESS]->value() != brightness ||
+		    ctrls[V4L2_CID_CONTRAST]->value() != contrast) {
+			cerr << "Invalid controls written at frame " << sequence
+			     << ": brightness " << ctrls[V4L2_CID_BRIGHTNESS]->value()
+			     << ", contrast " << ctrls[V4L2_CID_CONTRAST]->value()
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		V4L2ControlList ctrls;
+		ctrls.add(V4L2_CID_BRIGHTNESS);
+		ctrls.add(V4L2_CID_CONTRAST);
+		if (sensor_->getControls(&ctrls)) {
+			cerr << "Failed to read initial controls" << endl;
+			return TestFail;
+		}
+
+		int64_t brightness = ctrls[V4L2_CID_BRIGHTNESS]->value();
+		int64_t contrast = ctrls[V4L2_CID_CONTRAST]->value();
+
+		/* Brightness applies one frame later, contrast two frames later. */
+		DelayedControls delayed(sensor_->device(), {
+			{ V4L2_CID_BRIGHTNESS, 1 },
+			{ V4L2_CID_CONTRAST, 2 },
+		});
+
+		if (delayed.reset()) {
+			cerr << "Failed to reset delayed controls" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 1; i <= Frames; ++i) {
+			V4L2ControlList frame;
+			frame.add(V4L2_CID_BRIGHTNESS, 100 + i);
+			frame.add(V4L2_CID_CONTRAST, 50 + i);
+
+			if (!delayed.push(frame)) {
+				cerr << "Failed to push controls" << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * The controls pushed for frame i apply to frame i + 1. Each
+		 * control shall be written delay frames before that.
+		 */
+		unsigned int last = Frames;
+
+		for (unsigned int frame = 0; frame < Frames + 4; ++frame) {
+			uint32_t sequence = FirstSequence + frame;
+
+			if (delayed.applyControls(sequence)) {
+				cerr << "Failed to apply controls" << endl;
+				return TestFail;
+			}
+
+			int64_t b = frame >= 1 ? 100 + std::min(frame, last) : brightness;
+			int64_t c = 50 + std::min(frame + 1, last);
+
+			if (checkDevice(sequence, b, c) != TestPass)
+				return TestFail;
+
+			V4L2ControlList applied = delayed.get(sequence);
+			b = frame >= 2 ? 100 + std::min(frame - 1, last) : brightness;
+			c = frame >= 2 ? 50 + std::min(frame - 1, last) : contrast;
+
+			if (applied[V4L2_CID_BRIGHTNESS]->value() != b ||
+			    applied[V4L2_CID_CONTRAST]->value() != c) {
+				cerr << "Invalid controls reported for frame "
+				     << sequence << endl;
+				return TestFail;
+			}
+		}
+
+		/* Restore the initial values. */
+		ctrls.clear();
+		ctrls.add(V4L2_CID_BRIGHTNESS, brightness);
+		ctrls.add(V4L2_CID_CONTRAST, contrast);
+		sensor_->setControls(&ctrls);
+
+		return TestPass;
+	}
+
+private:
+	std::unique_ptr<DeviceEnumerator> enumerator_;
+	std::shared_ptr<MediaDevice> media_;
+	std::unique_ptr<CameraSensor> sensor_;
+};
+
+TEST_REGISTER(DelayedControlsTest)
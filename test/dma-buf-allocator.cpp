@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * dma-buf-allocator.cpp - dmabuf allocator test
+ */
+
+#include <iostream>
+#include <string.h>
+
+#include <libcamera/buffer.h>
+
+#include "dma_buf_allocator.h"
+#include "test.h"
+#include "utils.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DmaBufAllocatorTest : public Test
+{
+protected:
+	int init()
+	{
+		allocator_ = DmaBufAllocator::instance();
+		if (!allocator_->isValid()) {
+			cout << "No dmabuf allocator available" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		const std::vector<unsigned int> planeSizes = { 640 * 480, 640 * 240 };
+		BufferPool pool;
+
+		pool.createBuffers(4);
+
+		int ret = allocator_->allocate(&pool, planeSizes);
+		if (ret) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		std::pair<uint64_t, uint64_t> id;
+		if (!utils::dmabuf_identity(pool.buffers()[0].planes()[0].dmabuf(), &id)) {
+			cout << "Failed to identify dmabuf" << endl;
+			return TestFail;
+		}
+
+		for (BufferMemory &mem : pool.buffers()) {
+			if (mem.planes().size() != planeSizes.size()) {
+				cout << "Invalid number of planes" << endl;
+				return TestFail;
+			}
+
+			for (unsigned int i = 0; i < planeSizes.size(); ++i) {
+				Plane &plane = mem.planes()[i];
+
+				if (plane.length() != planeSizes[i]) {
+					cout << "Invalid plane length" << endl;
+					return TestFail;
+				}
+
+				void *data = plane.mem();
+				if (!data) {
+					cout << "Failed to map plane" << endl;
+					return TestFail;
+				}
+
+				memset(data, 0, plane.length());
+			}
+		}
+
+		/* Release the memory and check it gets reused for the same size. */
+		allocator_->release(&pool);
+
+		if (!pool.buffers()[0].planes().empty()) {
+			cout << "Planes not removed on release" << endl;
+			return TestFail;
+		}
+
+		ret = allocator_->allocate(&pool, planeSizes);
+		if (ret) {
+			cout << "Failed to reallocate buffers" << endl;
+			return TestFail;
+		}
+
+		bool reused = false;
+		for (BufferMemory &mem : pool.buffers()) {
+			for (Plane &plane : mem.planes()) {
+				std::pair<uint64_t, uint64_t> other;
+				if (utils::dmabuf_identity(plane.dmabuf(), &other) &&
+				    other == id)
+					reused = true;
+			}
+		}
+
+		allocator_->release(&pool);
+
+		if (!reused) {
+			cout << "Memory not reused" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	DmaBufAllocator *allocator_;
+};
+
+TEST_REGISTER(DmaBufAllocatorTest)
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * downscaler.cpp - Software downscaler test
+ */
+
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "downscaler.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DownscalerTest : public Test
+{
+protected:
+	/* Average a block of samples, spaced by step bytes. */
+	static uint8_t average(const std::vector<uint8_t> &frame, unsigned int offset,
+			       unsigned int stride, unsigned int step,
+			       unsigned int width, unsigned int height)
+	{
+		unsigned int sum = 0;
+
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x)
+				sum += frame[offset + y * stride + x * step];
+		}
+
+		return (sum + width * height / 2) / (width * height);
+	}
+
+	int testRGB()
+	{
+		/* Scale 6x4 RGB24 with a padded stride to 3x2, 2x2 blocks. */
+		const unsigned int stride = 20;
+		std::vector<uint8_t> input(stride * 4);
+		for (unsigned int i = 0; i < input.size(); ++i)
+			input[i] = i * 7;
+
+		Downscaler scaler;
+		if (scaler.configure(V4L2_PIX_FMT_RGB24, { 6, 4 }, stride, { 3, 2 })) {
+			cout << "Failed to configure RGB24 downscaler" << endl;
+			return TestFail;
+		}
+
+		if (scaler.frameSize() != 18 || scaler.stride() != 9) {
+			cout << "Invalid RGB24 frame size" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> output(scaler.frameSize());
+		if (scaler.scale(input.data(), input.size(), output.data(),
+				 output.size()) != 18) {
+			cout << "Failed to scale RGB24 frame" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int y = 0; y < 2; ++y) {
+			for (unsigned int i = 0; i < 9; ++i) {
+				unsigned int x = i / 3;
+				unsigned int offset = y * 2 * stride + x * 6 + i % 3;
+
+				if (output[y * 9 + i] != average(input, offset, stride, 3, 2, 2)) {
+					cout << "Invalid RGB24 sample " << i << " on line "
+					     << y << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testNV12()
+	{
+		/* Scale 12x6 NV12 to 4x2, 3x3 blocks. */
+		std::vector<uint8_t> input(12 * 6 * 3 / 2);
+		for (unsigned int i = 0; i < input.size(); ++i)
+			input[i] = (i * 13) ^ (i >> 3);
+
+		Downscaler scaler;
+		if (scaler.configure(V4L2_PIX_FMT_NV12, { 12, 6 }, 12, { 4, 2 })) {
+			cout << "Failed to configure NV12 downscaler" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> output(scaler.frameSize());
+		if (scaler.scale(input.data(), input.size(), output.data(),
+				 output.size()) != 12) {
+			cout << "Failed to scale NV12 frame" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int y = 0; y < 2; ++y) {
+			for (unsigned int x = 0; x < 4; ++x) {
+				if (output[y * 4 + x] !=
+				    average(input, y * 3 * 12 + x * 3, 12, 1, 3, 3)) {
+					cout << "Invalid NV12 luma" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		/* The 6x3 chroma plane is scaled to 2x1, 3x3 blocks. */
+		for (unsigned int i = 0; i < 4; ++i) {
+			unsigned int offset = 12 * 6 + i / 2 * 6 + i % 2;
+
+			if (output[8 + i] != average(input, offset, 12, 2, 3, 3)) {
+				cout << "Invalid NV12 chroma" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testYUYV()
+	{
+		/* Scale 8x2 YUYV to 4x1 with a constant chroma. */
+		std::vector<uint8_t> input(8 * 2 * 2);
+		for (unsigned int i = 0; i < input.size(); i += 2) {
+			input[i] = i * 4;
+			input[i + 1] = i % 4 ? 200 : 50;
+		}
+
+		Downscaler scaler;
+		if (scaler.configure(V4L2_PIX_FMT_YUYV, { 8, 2 }, 16, { 4, 1 })) {
+			cout << "Failed to configure YUYV downscaler" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> output(scaler.frameSize());
+		if (scaler.scale(input.data(), input.size(), output.data(),
+				 output.size()) != 8) {
+			cout << "Failed to scale YUYV frame" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int x = 0; x < 4; ++x) {
+			if (output[x * 2] != average(input, x * 4, 16, 2, 2, 2)) {
+				cout << "Invalid YUYV luma" << endl;
+				return TestFail;
+			}
+		}
+
+		if (output[1] != 50 || output[3] != 200 ||
+		    output[5] != 50 || output[7] != 200) {
+			cout << "Invalid YUYV chroma" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		Downscaler scaler;
+
+		/* Upscaling and unaligned sizes are rejected. */
+		if (!scaler.configure(V4L2_PIX_FMT_RGB24, { 64, 48 }, 192, { 128, 48 }) ||
+		    !scaler.configure(V4L2_PIX_FMT_NV12, { 64, 48 }, 64, { 31, 24 }) ||
+		    !scaler.configure(V4L2_PIX_FMT_MJPEG, { 64, 48 }, 64, { 32, 24 })) {
+			cout << "Invalid configuration accepted" << endl;
+			return TestFail;
+		}
+
+		if (testRGB() != TestPass)
+			return TestFail;
+
+		if (testNV12() != TestPass)
+			return TestFail;
+
+		if (testYUYV() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(DownscalerTest)
@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * event-dispatcher-monitor.cpp - Event dispatcher instrumentation test
+ */
+
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/logging.h>
+#include <libcamera/metrics.h>
+#include <libcamera/timer.h>
+
+#include "test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+class EventDispatcherMonitorTest : public Test
+{
+protected:
+	void readReady(EventNotifier *notifier)
+	{
+		uint64_t value;
+
+		if (read(notifier->fd(), &value, sizeof(value)) != sizeof(value))
+			cout << "Failed to read eventfd" << endl;
+
+		if (slow_)
+			usleep(5000);
+	}
+
+	void timeout(Timer *timer)
+	{
+		usleep(5000);
+	}
+
+	int init()
+	{
+		/* Report callbacks that take longer than 2ms. */
+		setenv("LIBCAMERA_EVENT_MONITOR", "2000", 1);
+
+		fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (fd_ < 0)
+			return TestFail;
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		EventNotifier notifier(fd_, EventNotifier::Read);
+		notifier.activated.connect(this, &EventDispatcherMonitorTest::readReady);
+
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("Event", "WARN");
+
+		/* A fast callback shall not be reported. */
+		uint64_t value = 1;
+		slow_ = false;
+		if (write(fd_, &value, sizeof(value)) != sizeof(value))
+			return TestFail;
+
+		dispatcher->processEvents();
+
+		if (!log.str().empty()) {
+			logSetStream(&cerr);
+			cout << "Fast callback reported: " << log.str();
+			return TestFail;
+		}
+
+		/* Slow notifier callbacks shall be reported with their slot. */
+		slow_ = true;
+		if (write(fd_, &value, sizeof(value)) != sizeof(value))
+			return TestFail;
+
+		dispatcher->processEvents();
+
+		string output = log.str();
+		string expected = "Slow read callback for fd " + to_string(fd_);
+		if (output.find(expected) == string::npos ||
+		    output.find("EventDispatcherMonitorTest") == string::npos) {
+			logSetStream(&cerr);
+			cout << "Invalid slow notifier report: " << output;
+			return TestFail;
+		}
+
+		/* And so shall slow timer callbacks. */
+		Timer timer;
+		timer.timeout.connect(this, &EventDispatcherMonitorTest::timeout);
+		timer.start(10);
+
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		logSetStream(&cerr);
+
+		output = log.str();
+		if (output.find("Slow timer callback") == string::npos) {
+			cout << "Invalid slow timer report: " << output;
+			return TestFail;
+		}
+
+		MetricsSnapshot snapshot = metricsSnapshot();
+
+		const MetricValue *metric = snapshot.find("event.slow-callbacks");
+		if (!metric || metric->value != 2) {
+			cout << "Invalid slow callbacks count" << endl;
+			return TestFail;
+		}
+
+		for (const char *name : { "event.wait-us", "event.dispatch-us",
+					  "event.ready-fds" }) {
+			metric = snapshot.find(name);
+			if (!metric || metric->histogram.total() < 3) {
+				cout << "Invalid " << name << " histogram" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		close(fd_);
+	}
+
+private:
+	int fd_;
+	bool slow_;
+};
+
+TEST_REGISTER(EventDispatcherMonitorTest)
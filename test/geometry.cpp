@@ -6,6 +6,7 @@
  */
 
 #include <iostream>
+#include <sstream>
 
 #include <libcamera/geometry.h>
 
@@ -109,6 +110,35 @@ protected:
 		if (!compare(Size(200, 100), Size(100, 200), &operator>=, ">=", true))
 			return TestFail;
 
+		/* Test Size alignment and bounds, at compile time. */
+		static_assert(Size(0, 0).isNull() && !Size(0, 1).isNull(),
+			      "Invalid Size::isNull()");
+		static_assert(Size(643, 479).alignedDownTo(16, 8) == Size(640, 472),
+			      "Invalid Size::alignedDownTo()");
+		static_assert(Size(641, 473).alignedUpTo(16, 8) == Size(656, 480),
+			      "Invalid Size::alignedUpTo()");
+		static_assert(Size(1920, 720).boundedTo({ 1280, 1080 }) == Size(1280, 720),
+			      "Invalid Size::boundedTo()");
+		static_assert(Size(1920, 720).expandedTo({ 1280, 1080 }) == Size(1920, 1080),
+			      "Invalid Size::expandedTo()");
+		static_assert(Size(200, 100) < Size(100, 400),
+			      "Invalid Size ordering");
+
+		constexpr SizeRange range(16, 16, 4096, 2160, 16, 8);
+		static_assert(range.contains({ 640, 480 }) &&
+			      !range.contains({ 642, 480 }) &&
+			      !range.contains({ 8192, 480 }),
+			      "Invalid SizeRange::contains()");
+
+		/* Test the stream operators. */
+		std::stringstream ss;
+		ss << Size(640, 480) << " " << range << " "
+		   << Rectangle{ -2, 4, 320, 240 };
+		if (ss.str() != "640x480 (16x16)-(4096x2160)/(+16,+8) (-2x4)/320x240") {
+			cout << "Invalid geometry stream output " << ss.str() << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
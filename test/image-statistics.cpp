@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * image-statistics.cpp - Image statistics test
+ */
+
+#include <cmath>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/image_statistics.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ImageStatisticsTest : public Test
+{
+protected:
+	static bool near(double value, double expected)
+	{
+		return std::abs(value - expected) < 0.01;
+	}
+
+	int testRGB()
+	{
+		/* A flat 6x4 BGR24 frame with a padded stride. */
+		const unsigned int stride = 20;
+		std::vector<uint8_t> frame(stride * 4);
+		for (unsigned int y = 0; y < 4; ++y) {
+			for (unsigned int x = 0; x < 6; ++x) {
+				frame[y * stride + x * 3] = 51;
+				frame[y * stride + x * 3 + 1] = 102;
+				frame[y * stride + x * 3 + 2] = 204;
+			}
+		}
+
+		ImageStatisticsCalculator calculator;
+		if (calculator.configure(V4L2_PIX_FMT_BGR24, { 6, 4 }, stride)) {
+			cout << "Failed to configure BGR24 statistics" << endl;
+			return TestFail;
+		}
+
+		ImageStatistics stats;
+		if (calculator.compute(frame.data(), frame.size(), &stats)) {
+			cout << "Failed to compute BGR24 statistics" << endl;
+			return TestFail;
+		}
+
+		const unsigned int luma = (77 * 204 + 150 * 102 + 29 * 51 + 128) >> 8;
+		if (stats.samples != 24 || stats.histogram[luma] != 24 ||
+		    !near(stats.luma, luma / 255.0)) {
+			cout << "Invalid BGR24 histogram" << endl;
+			return TestFail;
+		}
+
+		if (!near(stats.mean[0], 0.8) || !near(stats.mean[1], 0.4) ||
+		    !near(stats.mean[2], 0.2)) {
+			cout << "Invalid BGR24 means" << endl;
+			return TestFail;
+		}
+
+		/* Subsampling by 4x3 keeps columns 0 and 4 of lines 0 and 3. */
+		calculator.configure(V4L2_PIX_FMT_BGR24, { 6, 4 }, stride, 4, 3);
+		calculator.compute(frame.data(), frame.size(), &stats);
+		if (stats.samples != 4) {
+			cout << "Invalid subsampled BGR24 sample count" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testYUV()
+	{
+		/* Mid-grey YUYV and NV12 frames, in limited range. */
+		std::vector<uint8_t> yuyv(8 * 2 * 2);
+		for (unsigned int i = 0; i < yuyv.size(); i += 2) {
+			yuyv[i] = 126;
+			yuyv[i + 1] = 128;
+		}
+
+		std::vector<uint8_t> nv12(8 * 2 + 8 * 1);
+		for (unsigned int i = 0; i < nv12.size(); ++i)
+			nv12[i] = i < 16 ? 126 : 128;
+
+		const struct {
+			unsigned int format;
+			unsigned int stride;
+			const std::vector<uint8_t> &data;
+		} inputs[] = {
+			{ V4L2_PIX_FMT_YUYV, 16, yuyv },
+			{ V4L2_PIX_FMT_NV12, 8, nv12 },
+		};
+
+		for (const auto &input : inputs) {
+			ImageStatisticsCalculator calculator;
+			ImageStatistics stats;
+
+			if (calculator.configure(input.format, { 8, 2 }, input.stride) ||
+			    calculator.frameSize() != input.data.size() ||
+			    calculator.compute(input.data.data(), input.data.size(),
+					       &stats)) {
+				cout << "Failed to compute format " << input.format
+				     << " statistics" << endl;
+				return TestFail;
+			}
+
+			/* Luma 126 is 128 in full range. */
+			if (stats.samples != 16 || stats.histogram[128] != 16) {
+				cout << "Invalid format " << input.format
+				     << " histogram" << endl;
+				return TestFail;
+			}
+
+			for (double mean : stats.mean) {
+				if (!near(mean, 128 / 255.0)) {
+					cout << "Invalid format " << input.format
+					     << " means" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testBayer()
+	{
+		/* The same RGGB frame in 10-bit unpacked and IPU3 packed formats. */
+		const unsigned int width = 30;
+		const unsigned int height = 4;
+		const unsigned int values[2][2] = { { 800, 400 }, { 400, 200 } };
+		std::vector<uint8_t> unpacked(width * 2 * height);
+		std::vector<uint8_t> ipu3(64 * height);
+
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x) {
+				unsigned int value = values[y % 2][x % 2];
+
+				unpacked[(y * width + x) * 2] = value & 0xff;
+				unpacked[(y * width + x) * 2 + 1] = value >> 8;
+
+				uint8_t *block = &ipu3[y * 64 + x / 25 * 32];
+				unsigned int bit = x % 25 * 10;
+				block[bit / 8] |= (value << (bit % 8)) & 0xff;
+				block[bit / 8 + 1] |= value >> (8 - bit % 8);
+			}
+		}
+
+		const struct {
+			unsigned int format;
+			unsigned int stride;
+			const std::vector<uint8_t> &data;
+		} inputs[] = {
+			{ V4L2_PIX_FMT_SRGGB10, width * 2, unpacked },
+			{ V4L2_PIX_FMT_IPU3_SRGGB10, 64, ipu3 },
+		};
+
+		const unsigned int luma = (77 * 800 + 75 * 800 + 29 * 200 + 128) >> 8 >> 2;
+
+		for (const auto &input : inputs) {
+			ImageStatisticsCalculator calculator;
+			ImageStatistics stats;
+
+			if (calculator.configure(input.format, { width, height },
+						 input.stride) ||
+			    calculator.compute(input.data.data(), input.data.size(),
+					       &stats)) {
+				cout << "Failed to compute format " << input.format
+				     << " statistics" << endl;
+				return TestFail;
+			}
+
+			if (stats.samples != 30 || stats.histogram[luma] != 30) {
+				cout << "Invalid format " << input.format
+				     << " histogram" << endl;
+				return TestFail;
+			}
+
+			if (!near(stats.mean[0], 800 / 1023.0) ||
+			    !near(stats.mean[1], 400 / 1023.0) ||
+			    !near(stats.mean[2], 200 / 1023.0)) {
+				cout << "Invalid format " << input.format
+				     << " means" << endl;
+				return TestFail;
+			}
+
+			/* Odd steps are rounded up to whole quads. */
+			calculator.configure(input.format, { width, height },
+					     input.stride, 3, 3);
+			calculator.compute(input.data.data(), input.data.size(),
+					   &stats);
+			if (stats.samples != 8) {
+				cout << "Invalid subsampled format " << input.format
+				     << " sample count" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		ImageStatisticsCalculator calculator;
+		ImageStatistics stats;
+		std::vector<uint8_t> frame(64 * 48 * 2);
+
+		/* Unsupported formats, short strides and frames are rejected. */
+		if (!calculator.configure(V4L2_PIX_FMT_MJPEG, { 64, 48 }, 128) ||
+		    !calculator.configure(V4L2_PIX_FMT_YUYV, { 64, 48 }, 64) ||
+		    !calculator.configure(V4L2_PIX_FMT_YUYV, { 64, 48 }, 128, 0) ||
+		    !calculator.compute(frame.data(), frame.size(), &stats) ||
+		    calculator.configure(V4L2_PIX_FMT_YUYV, { 64, 48 }, 128) ||
+		    !calculator.compute(frame.data(), frame.size() - 1, &stats)) {
+			cout << "Invalid configuration accepted" << endl;
+			return TestFail;
+		}
+
+		if (testRGB() != TestPass)
+			return TestFail;
+
+		if (testYUV() != TestPass)
+			return TestFail;
+
+		if (testBayer() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ImageStatisticsTest)
@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_data_serializer_test.cpp - Test serialization of IPA data
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/controls.h>
+#include <libcamera/ipa/ipa_interface.h>
+
+#include "byte_stream_buffer.h"
+#include "ipa_data_serializer.h"
+#include "test.h"
+#include "v4l2_controls.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPADataSerializerTest : public Test
+{
+protected:
+	int testControlList()
+	{
+		ControlList list(nullptr);
+		list[Brightness] = 255;
+		list[AwbEnable] = true;
+		list[SensorTimestamp] = static_cast<int64_t>(1) << 40;
+		list[ScalerCrop] = Rectangle{ -4, 8, 640, 480 };
+
+		std::vector<uint8_t> data(IPADataSerializer::binarySize(list));
+		ByteStreamBuffer writer(data.data(), data.size());
+		if (IPADataSerializer::serialize(list, writer) ||
+		    writer.offset() != data.size()) {
+			cerr << "Failed to serialize control list" << endl;
+			return TestFail;
+		}
+
+		const std::vector<uint8_t> &constData = data;
+		ByteStreamBuffer reader(constData.data(), constData.size());
+		SerializedControlList serialized(reader);
+		if (!serialized.isValid() || serialized.size() != list.size() ||
+		    reader.offset() != data.size()) {
+			cerr << "Failed to decode control list" << endl;
+			return TestFail;
+		}
+
+		ControlList result(nullptr);
+		if (serialized.apply(&result) || result.size() != list.size()) {
+			cerr << "Failed to apply control list" << endl;
+			return TestFail;
+		}
+
+		for (const auto &ctrl : list) {
+			ControlId id = ctrl.first->id();
+			if (!result.contains(id) ||
+			    result[id].toString() != ctrl.second.toString()) {
+				cerr << "Control " << id << " mismatch" << endl;
+				return TestFail;
+			}
+		}
+
+		/* A truncated list shall be rejected. */
+		ByteStreamBuffer truncated(constData.data(), constData.size() - 1);
+		if (SerializedControlList(truncated).isValid()) {
+			cerr << "Truncated control list decoded" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testV4L2ControlList()
+	{
+		V4L2ControlList list;
+		list.add(V4L2_CID_EXPOSURE, 1000);
+		list.add(V4L2_CID_PIXEL_RATE, static_cast<int64_t>(1) << 35);
+		list.add(V4L2_CID_ANALOGUE_GAIN, 16);
+		list.getByIndex(2)->payload() = { 1, 2, 3, 4, 5 };
+
+		/* Concatenate two lists to test decoding at an offset. */
+		size_t size = IPADataSerializer::binarySize(list);
+		std::vector<uint8_t> data(size * 2);
+		ByteStreamBuffer writer(data.data(), data.size());
+		if (IPADataSerializer::serialize(list, writer) ||
+		    IPADataSerializer::serialize(list, writer) ||
+		    writer.offset() != data.size()) {
+			cerr << "Failed to serialize V4L2 control list" << endl;
+			return TestFail;
+		}
+
+		const std::vector<uint8_t> &constData = data;
+		ByteStreamBuffer reader(constData.data(), constData.size());
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			SerializedV4L2ControlList serialized(reader);
+			if (!serialized.isValid() || serialized.size() != 3 ||
+			    reader.offset() != size * (i + 1)) {
+				cerr << "Failed to decode V4L2 control list"
+				     << endl;
+				return TestFail;
+			}
+
+			/* The payload shall be decoded in place. */
+			const uint8_t *payload = serialized.payload(2);
+			if (!payload || serialized.payloadSize(2) != 5 ||
+			    payload < constData.data() ||
+			    payload >= constData.data() + constData.size() ||
+			    serialized.payload(0)) {
+				cerr << "Invalid V4L2 control payload" << endl;
+				return TestFail;
+			}
+
+			V4L2ControlList result;
+			if (serialized.apply(&result) || result.size() != 3) {
+				cerr << "Failed to apply V4L2 control list"
+				     << endl;
+				return TestFail;
+			}
+
+			for (unsigned int j = 0; j < 3; ++j) {
+				const V4L2Control *ctrl = list.getByIndex(j);
+				const V4L2Control *res = result.getByIndex(j);
+
+				if (res->id() != ctrl->id() ||
+				    res->value() != ctrl->value() ||
+				    res->payload() != ctrl->payload()) {
+					cerr << "V4L2 control " << ctrl->id()
+					     << " mismatch" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testBuffers()
+	{
+		int fd = memfd_create("buffer", MFD_CLOEXEC);
+		if (fd < 0) {
+			cerr << "Failed to create memfd" << endl;
+			return TestFail;
+		}
+
+		std::vector<IPABuffer> buffers(3);
+		for (unsigned int i = 0; i < buffers.size(); ++i) {
+			buffers[i].id = i + 10;
+
+			for (unsigned int j = 0; j < i + 1; ++j) {
+				buffers[i].memory.planes().emplace_back();
+				buffers[i].memory.planes().back().setDmabuf(fd, 4096 * (j + 1));
+			}
+		}
+
+		close(fd);
+
+		std::vector<uint8_t> data(IPADataSerializer::binarySize(buffers));
+		ByteStreamBuffer writer(data.data(), data.size());
+		std::vector<int32_t> fds;
+		if (IPADataSerializer::serialize(buffers, writer, &fds) ||
+		    fds.size() != 6) {
+			cerr << "Failed to serialize buffers" << endl;
+			return TestFail;
+		}
+
+		const std::vector<uint8_t> &constData = data;
+		ByteStreamBuffer reader(constData.data(), constData.size());
+		SerializedIPABuffers serialized(reader);
+		if (!serialized.isValid() || serialized.size() != 3) {
+			cerr << "Failed to decode buffers" << endl;
+			return TestFail;
+		}
+
+		std::vector<IPABuffer> result;
+		if (serialized.apply(fds, &result) || result.size() != 3) {
+			cerr << "Failed to apply buffers" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < buffers.size(); ++i) {
+			const std::vector<Plane> &planes = result[i].memory.planes();
+
+			if (result[i].id != buffers[i].id || planes.size() != i + 1) {
+				cerr << "Buffer " << i << " mismatch" << endl;
+				return TestFail;
+			}
+
+			for (unsigned int j = 0; j < planes.size(); ++j) {
+				if (planes[j].length() != 4096 * (j + 1) ||
+				    planes[j].dmabuf() < 0) {
+					cerr << "Buffer " << i << " plane " << j
+					     << " mismatch" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		/* Missing file descriptors shall be detected. */
+		fds.pop_back();
+		result.clear();
+		if (!serialized.apply(fds, &result)) {
+			cerr << "Buffers applied with missing fds" << endl;
+			return TestFail;
+		}
+
+		/* Mismatching types shall be rejected. */
+		ByteStreamBuffer wrongType(constData.data(), constData.size());
+		if (SerializedControlList(wrongType).isValid()) {
+			cerr << "Buffers decoded as control list" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret;
+
+		ret = testControlList();
+		if (ret)
+			return ret;
+
+		ret = testV4L2ControlList();
+		if (ret)
+			return ret;
+
+		return testBuffers();
+	}
+};
+
+TEST_REGISTER(IPADataSerializerTest)
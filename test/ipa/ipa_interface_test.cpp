@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_interface_test.cpp - Test the IPA frame event interface through proxies
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <memory>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/ipa/ipa_interface.h>
+#include <libcamera/timer.h>
+
+#include "ipa_module.h"
+#include "ipa_proxy.h"
+#include "metrics_registry.h"
+#include "process.h"
+#include "test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAInterfaceTest : public Test
+{
+protected:
+	int runTest(const char *path, const char *proxyName)
+	{
+		IPAModule module(path);
+		if (!module.isValid()) {
+			cerr << "IPA module " << path << " is invalid" << endl;
+			return TestFail;
+		}
+
+		IPAProxyFactory *pf = nullptr;
+		for (IPAProxyFactory *factory : IPAProxyFactory::factories()) {
+			if (!strcmp(factory->name().c_str(), proxyName)) {
+				pf = factory;
+				break;
+			}
+		}
+
+		if (!pf) {
+			cerr << "Proxy factory " << proxyName << " not found" << endl;
+			return TestFail;
+		}
+
+		std::unique_ptr<IPAProxy> ipa = pf->create(&module);
+		if (!ipa->isValid() || ipa->init()) {
+			cerr << "Failed to create " << proxyName << endl;
+			return TestFail;
+		}
+
+		ipa->queueFrameAction.connect(this, &IPAInterfaceTest::queueFrameAction);
+
+		IPAOperationData event = { 1, { 1, 2, 3 } };
+		if (sendEvent(ipa.get(), 42, event, proxyName))
+			return TestFail;
+
+		if (frame_ != 42 || action_.operation != event.operation ||
+		    action_.data != event.data) {
+			cerr << "Frame action mismatch from " << proxyName << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Map more buffers than can be passed in a single IPC message,
+		 * and read their content back through the IPA.
+		 */
+		std::vector<IPABuffer> buffers(NumBuffers);
+		for (unsigned int i = 0; i < NumBuffers; ++i) {
+			buffers[i].id = i + 100;
+			if (createBuffer(&buffers[i].memory, i * 3 + 7)) {
+				cerr << "Failed to create buffer" << endl;
+				return TestFail;
+			}
+		}
+
+		ipa->mapBuffers(buffers);
+
+		for (unsigned int i : { 0U, NumBuffers - 1 }) {
+			event = { ReadBuffer, { buffers[i].id } };
+			if (sendEvent(ipa.get(), i, event, proxyName))
+				return TestFail;
+
+			std::vector<uint32_t> expected = { buffers[i].id, i * 3 + 7 };
+			if (action_.data != expected) {
+				cerr << "Invalid buffer " << buffers[i].id
+				     << " content read by " << proxyName << endl;
+				return TestFail;
+			}
+		}
+
+		/* Unmapped buffers shall not be accessible anymore. */
+		ipa->unmapBuffers({ buffers[0].id });
+
+		event = { ReadBuffer, { buffers[0].id } };
+		if (sendEvent(ipa.get(), 0, event, proxyName))
+			return TestFail;
+
+		if (action_.data.size() != 1) {
+			cerr << "Unmapped buffer read by " << proxyName << endl;
+			return TestFail;
+		}
+
+		if (!strcmp(proxyName, "IPAProxyLinux"))
+			return testRestart(ipa.get(), buffers);
+
+		return TestPass;
+	}
+
+	/*
+	 * Crash the isolated IPA, and verify that the worker is restarted
+	 * with the buffers that were mapped at the time of the crash.
+	 */
+	int testRestart(IPAProxy *ipa, const std::vector<IPABuffer> &buffers)
+	{
+		CounterMetric *restarts =
+			MetricsRegistry::instance()->counter("ipa.worker-restarts");
+		int64_t count = restarts->value().value;
+
+		ipa->processEvent(0, { Crash, {} });
+
+		Timer timeout;
+		timeout.start(1000);
+		while (restarts->value().value == count && timeout.isRunning())
+			CameraManager::instance()->eventDispatcher()->processEvents();
+
+		if (restarts->value().value == count || !ipa->isValid()) {
+			cerr << "IPA proxy worker not restarted" << endl;
+			return TestFail;
+		}
+
+		unsigned int id = buffers.back().id;
+		IPAOperationData event = { ReadBuffer, { id } };
+		if (sendEvent(ipa, 1, event, "restarted IPAProxyLinux"))
+			return TestFail;
+
+		std::vector<uint32_t> expected = { id, (NumBuffers - 1) * 3 + 7 };
+		if (action_.data != expected) {
+			cerr << "Buffer " << id << " not mapped after restart" << endl;
+			return TestFail;
+		}
+
+		event = { ReadBuffer, { buffers[0].id } };
+		if (sendEvent(ipa, 2, event, "restarted IPAProxyLinux"))
+			return TestFail;
+
+		if (action_.data.size() != 1) {
+			cerr << "Unmapped buffer mapped after restart" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int sendEvent(IPAProxy *ipa, unsigned int frame,
+		      const IPAOperationData &event, const char *proxyName)
+	{
+		actionReceived_ = false;
+		ipa->processEvent(frame, event);
+
+		Timer timeout;
+		timeout.start(1000);
+		while (!actionReceived_ && timeout.isRunning())
+			CameraManager::instance()->eventDispatcher()->processEvents();
+
+		if (!actionReceived_) {
+			cerr << "No frame action received from " << proxyName << endl;
+			return TestFail;
+		}
+
+		if (actionThread_ != Thread::current()) {
+			cerr << "Frame action delivered in the wrong thread" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int createBuffer(BufferMemory *memory, uint32_t value)
+	{
+		int fd = memfd_create("ipa_interface_test", MFD_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+
+		if (ftruncate(fd, 4096) < 0 ||
+		    pwrite(fd, &value, sizeof(value), 0) != sizeof(value)) {
+			close(fd);
+			return -EIO;
+		}
+
+		memory->planes().emplace_back();
+		int ret = memory->planes().back().setDmabuf(fd, 4096);
+		close(fd);
+
+		return ret;
+	}
+
+	int run()
+	{
+		int ret;
+
+		ret = runTest("src/ipa/ipa_dummy.so", "IPAProxyThread");
+		if (ret)
+			return ret;
+
+		ret = runTest("src/ipa/ipa_dummy_isolate.so", "IPAProxyLinux");
+		if (ret)
+			return ret;
+
+		/* Run the isolated IPA again in pre-started workers. */
+		std::string worker = IPAProxy::resolvePath("ipa_proxy_linux");
+		ProcessManager::instance()->prestart(worker, 1);
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			ret = runTest("src/ipa/ipa_dummy_isolate.so", "IPAProxyLinux");
+			if (ret)
+				return ret;
+		}
+
+		ProcessManager::instance()->prestart(worker, 0);
+
+		return TestPass;
+	}
+
+private:
+	/* Operations and buffer count handled by the dummy IPA modules. */
+	static constexpr unsigned int ReadBuffer = 2;
+	static constexpr unsigned int Crash = 3;
+	static constexpr unsigned int NumBuffers = 260;
+
+	void queueFrameAction(unsigned int frame, const IPAOperationData &action)
+	{
+		actionReceived_ = true;
+		actionThread_ = Thread::current();
+		frame_ = frame;
+		action_ = action;
+	}
+
+	bool actionReceived_;
+	Thread *actionThread_;
+	unsigned int frame_;
+	IPAOperationData action_;
+};
+
+TEST_REGISTER(IPAInterfaceTest)
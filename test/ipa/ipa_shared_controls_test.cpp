@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * ipa_shared_controls_test.cpp - Test control lists shared through memory
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <libcamera/controls.h>
+
+#include "shared_controls.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPASharedControlsTest : public Test
+{
+protected:
+	static constexpr unsigned int Slots = 4;
+	static constexpr unsigned int Frames = 16;
+
+	int run() override
+	{
+		SharedControls controls;
+		SharedControls metadata;
+
+		if (controls.create(Slots) || metadata.create(Slots)) {
+			cerr << "Failed to create shared controls" << endl;
+			return TestFail;
+		}
+
+		ControlList list(nullptr);
+		if (controls.read(0, &list) != -ENOENT ||
+		    controls.generation(0) != 0) {
+			cerr << "Empty slot should not be readable" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Emulate an isolated IPA in a child process, attached to the
+		 * regions through their file descriptors. It reads the
+		 * controls of each frame and writes metadata in return.
+		 */
+		int pipes[2][2];
+		if (pipe(pipes[0]) || pipe(pipes[1])) {
+			cerr << "Failed to create pipes" << endl;
+			return TestFail;
+		}
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			cerr << "Failed to fork" << endl;
+			return TestFail;
+		}
+
+		if (!pid) {
+			close(pipes[0][1]);
+			close(pipes[1][0]);
+			_exit(child(controls.fd(), metadata.fd(), pipes[0][0],
+				    pipes[1][1]));
+		}
+
+		close(pipes[0][0]);
+		close(pipes[1][1]);
+
+		int ret = TestPass;
+
+		for (uint32_t frame = 0; frame < Frames; ++frame) {
+			list.clear();
+			list[Brightness] = static_cast<int>(frame * 10);
+			list[ScalerCrop] = Rectangle{ 0, 0, frame, frame * 2 };
+
+			uint32_t generation = controls.write(frame, list);
+			if (!generation || controls.generation(frame) != generation) {
+				cerr << "Invalid generation " << generation << endl;
+				ret = TestFail;
+				break;
+			}
+
+			/* Signal the frame and wait for the metadata. */
+			uint32_t msg[2] = { frame, generation };
+			if (write(pipes[0][1], msg, sizeof(msg)) != sizeof(msg) ||
+			    read(pipes[1][0], msg, sizeof(msg)) != sizeof(msg)) {
+				cerr << "Failed to signal frame " << frame << endl;
+				ret = TestFail;
+				break;
+			}
+
+			ControlList result(nullptr);
+			uint32_t metaGeneration;
+			if (metadata.read(frame, &result, &metaGeneration) ||
+			    metaGeneration != msg[1] ||
+			    result.get(controls::SensorTimestamp) != frame * 1000000LL ||
+			    result.get(controls::Brightness) != static_cast<int>(frame * 10)) {
+				cerr << "Invalid metadata for frame " << frame << endl;
+				ret = TestFail;
+				break;
+			}
+		}
+
+		close(pipes[0][1]);
+
+		int status;
+		waitpid(pid, &status, 0);
+		close(pipes[1][0]);
+
+		if (ret)
+			return ret;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			cerr << "Child failed" << endl;
+			return TestFail;
+		}
+
+		/* Slots overwritten by later frames can't be read anymore. */
+		if (controls.read(0, &list) != -ENOENT) {
+			cerr << "Overwritten slot should not be readable" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	int child(int controlsFd, int metadataFd, int in, int out)
+	{
+		SharedControls controls;
+		SharedControls metadata;
+
+		if (controls.attach(controlsFd) || metadata.attach(metadataFd) ||
+		    controls.slots() != Slots)
+			return EXIT_FAILURE;
+
+		uint32_t msg[2];
+		while (read(in, msg, sizeof(msg)) == sizeof(msg)) {
+			ControlList list(nullptr);
+			uint32_t generation;
+
+			if (controls.read(msg[0], &list, &generation) ||
+			    generation != msg[1])
+				return EXIT_FAILURE;
+
+			Rectangle crop = list.get(controls::ScalerCrop);
+			if (crop.w != msg[0] || crop.h != msg[0] * 2)
+				return EXIT_FAILURE;
+
+			ControlList result(nullptr);
+			result[SensorTimestamp] = static_cast<int64_t>(msg[0]) * 1000000;
+			result[Brightness] = list.get(controls::Brightness);
+
+			msg[1] = metadata.write(msg[0], result);
+			if (write(out, msg, sizeof(msg)) != sizeof(msg))
+				return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+};
+
+TEST_REGISTER(IPASharedControlsTest)
@@ -5,9 +5,15 @@
  * load-so.cpp - loading .so tests
  */
 
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "ipa_manager.h"
 #include "ipa_module.h"
 
 #include "test.h"
@@ -67,8 +73,130 @@ protected:
 		if (count < 0)
 			return TestFail;
 
+		/*
+		 * Test creation of modules from known information. Their
+		 * signature isn't verified.
+		 */
+		IPAModule module("src/ipa/ipa_dummy.so", testInfo);
+		if (!module.isValid() ||
+		    memcmp(&module.info(), &testInfo, sizeof(testInfo))) {
+			cerr << "Failed to create IPA module from information"
+			     << endl;
+			return TestFail;
+		}
+
+		if (module.isSignatureValid()) {
+			cerr << "IPA module signature valid without verification"
+			     << endl;
+			return TestFail;
+		}
+
+		struct IPAModuleInfo invalidInfo = testInfo;
+		invalidInfo.moduleAPIVersion = IPA_MODULE_API_VERSION + 1;
+
+		IPAModule invalid("src/ipa/ipa_dummy.so", invalidInfo);
+		if (invalid.isValid()) {
+			cerr << "IPA module with invalid API version accepted"
+			     << endl;
+			return TestFail;
+		}
+
+		return testModifiedModule(testInfo);
+	}
+
+	/*
+	 * A signed module modified after signing shall fail verification, even
+	 * when its size and modification time are preserved, so that the IPA
+	 * manager isolates it.
+	 */
+	int testModifiedModule(const struct IPAModuleInfo &testInfo)
+	{
+		const PubKey &pubKey = IPAManager::instance()->pubKey();
+		if (!pubKey.isValid()) {
+			cout << "IPA module signatures not supported" << endl;
+			return TestSkip;
+		}
+
+		char dir[] = "/tmp/libcamera-ipa-test-XXXXXX";
+		if (!mkdtemp(dir)) {
+			cerr << "Failed to create temporary directory" << endl;
+			return TestFail;
+		}
+
+		std::string path = std::string(dir) + "/ipa_dummy.so";
+		int ret = verifyModifiedModule(path, testInfo, pubKey);
+
+		unlink(path.c_str());
+		unlink((path + ".sign").c_str());
+		rmdir(dir);
+
+		return ret;
+	}
+
+	int verifyModifiedModule(const std::string &path,
+				 const struct IPAModuleInfo &testInfo,
+				 const PubKey &pubKey)
+	{
+		if (!copyFile("src/ipa/ipa_dummy.so.sign", path + ".sign")) {
+			cout << "Signed IPA module not available" << endl;
+			return TestSkip;
+		}
+
+		if (!copyFile("src/ipa/ipa_dummy.so", path)) {
+			cerr << "Failed to copy IPA module" << endl;
+			return TestFail;
+		}
+
+		IPAModule module(path, testInfo);
+		if (!module.verifySignature(pubKey)) {
+			cerr << "Signed IPA module failed verification" << endl;
+			return TestFail;
+		}
+
+		/* Modify a byte and restore the modification time. */
+		struct stat st;
+		int fd = open(path.c_str(), O_RDWR);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			cerr << "Failed to open IPA module copy" << endl;
+			if (fd >= 0)
+				close(fd);
+			return TestFail;
+		}
+
+		uint8_t byte = 0;
+		off_t offset = st.st_size / 2;
+		bool modified = pread(fd, &byte, 1, offset) == 1;
+		byte ^= 0xff;
+		modified = modified && pwrite(fd, &byte, 1, offset) == 1;
+		close(fd);
+
+		const struct timespec times[2] = { st.st_atim, st.st_mtim };
+		if (!modified || utimensat(AT_FDCWD, path.c_str(), times, 0) < 0) {
+			cerr << "Failed to modify IPA module copy" << endl;
+			return TestFail;
+		}
+
+		IPAModule modifiedModule(path, testInfo);
+		if (modifiedModule.verifySignature(pubKey)) {
+			cerr << "Modified IPA module passed verification" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
+
+	bool copyFile(const std::string &from, const std::string &to)
+	{
+		std::ifstream in(from, std::ios::binary);
+		if (!in)
+			return false;
+
+		std::ofstream out(to, std::ios::binary | std::ios::trunc);
+		out << in.rdbuf();
+		out.close();
+
+		return !!out;
+	}
 };
 
 TEST_REGISTER(IPAModuleTest)
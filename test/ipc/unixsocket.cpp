@@ -349,25 +349,52 @@ protected:
 		return 0;
 	}
 
-	int init()
+	int testLarge()
 	{
-		callResponse_ = nullptr;
+		IPCUnixSocket::Payload message, response;
+		int ret;
+
+		message.data.resize(16384);
+		message.data[0] = CMD_REVERSE;
+		for (unsigned int i = 1; i < message.data.size(); i++)
+			message.data[i] = i;
+
+		ret = call(message, &response);
+		if (ret)
+			return ret;
+
+		std::reverse(response.data.begin() + 1, response.data.end());
+		if (message.data != response.data)
+			return TestFail;
+
 		return 0;
 	}
 
-	int run()
+	int testGather()
 	{
-		int slavefd = ipc_.create();
-		if (slavefd < 0)
-			return TestFail;
+		IPCUnixSocket::Payload response;
+		int ret;
 
-		if (slaveStart(slavefd)) {
-			cerr << "Failed to start slave" << endl;
+		const uint8_t header[] = { CMD_REVERSE, 1, 2 };
+		const uint8_t body[] = { 3, 4, 5, 6 };
+		struct iovec iov[2] = {
+			{ const_cast<uint8_t *>(header), sizeof(header) },
+			{ const_cast<uint8_t *>(body), sizeof(body) },
+		};
+
+		ret = call(iov, 2, &response);
+		if (ret)
+			return ret;
+
+		const std::vector<uint8_t> expected = { CMD_REVERSE, 6, 5, 4, 3, 2, 1 };
+		if (response.data != expected)
 			return TestFail;
-		}
 
-		ipc_.readyRead.connect(this, &UnixSocketTest::readyRead);
+		return 0;
+	}
 
+	int runTests()
+	{
 		/* Test reversing a string, this test sending only data. */
 		if (testReverse()) {
 			cerr << "Reveres array test failed" << endl;
@@ -398,6 +425,60 @@ protected:
 			return TestFail;
 		}
 
+		/* Test gathering message data from multiple buffers. */
+		if (testGather()) {
+			cerr << "Gather test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test a message larger than the shared memory ring. */
+		if (testLarge()) {
+			cerr << "Large message test failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int init()
+	{
+		callResponse_ = nullptr;
+		return 0;
+	}
+
+	int run()
+	{
+		int slavefd = ipc_.create();
+		if (slavefd < 0)
+			return TestFail;
+
+		if (slaveStart(slavefd)) {
+			cerr << "Failed to start slave" << endl;
+			return TestFail;
+		}
+
+		ipc_.readyRead.connect(this, &UnixSocketTest::readyRead);
+
+		if (runTests())
+			return TestFail;
+
+		/* Run the tests again with the shared memory transport. */
+		if (ipc_.enableSharedMemory(4096)) {
+			cerr << "Failed to enable shared memory transport" << endl;
+			return TestFail;
+		}
+
+		if (runTests())
+			return TestFail;
+
+		/* Wrap around the shared memory rings. */
+		for (unsigned int i = 0; i < 1000; i++) {
+			if (testReverse()) {
+				cerr << "Ring wrap around test failed" << endl;
+				return TestFail;
+			}
+		}
+
 		/* Close slave connection. */
 		IPCUnixSocket::Payload close;
 		close.data.push_back(CMD_CLOSE);
@@ -418,16 +499,33 @@ protected:
 private:
 	int call(const IPCUnixSocket::Payload &message, IPCUnixSocket::Payload *response)
 	{
-		Timer timeout;
-		int ret;
+		callDone_ = false;
+		callResponse_ = response;
 
+		int ret = ipc_.send(message);
+		if (ret)
+			return ret;
+
+		return wait();
+	}
+
+	int call(const struct iovec *iov, unsigned int iovcnt,
+		 IPCUnixSocket::Payload *response)
+	{
 		callDone_ = false;
 		callResponse_ = response;
 
-		ret = ipc_.send(message);
+		int ret = ipc_.send(iov, iovcnt);
 		if (ret)
 			return ret;
 
+		return wait();
+	}
+
+	int wait()
+	{
+		Timer timeout;
+
 		timeout.start(200);
 		while (!callDone_) {
 			if (!timeout.isRunning()) {
@@ -29,6 +29,10 @@ int Test::execute()
 	if (ret)
 		return errno;
 
+	ret = setenv("LIBCAMERA_PIPELINE_MODULE_PATH", "src/libcamera", 1);
+	if (ret)
+		return errno;
+
 	ret = init();
 	if (ret)
 		return ret;
@@ -104,6 +104,52 @@ protected:
 		return verifyOutput(iss);
 	}
 
+	int testBinaryFile()
+	{
+		int fd = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd < 0) {
+			cerr << "Failed to open tmp log file" << endl;
+			return TestFail;
+		}
+
+		char path[32];
+		snprintf(path, sizeof(path), "/proc/self/fd/%u", fd);
+
+		if (logSetBinaryFile(path) < 0) {
+			cerr << "Failed to set binary log file" << endl;
+			return TestFail;
+		}
+
+		/* The last message is a warning, which flushes the log. */
+		doLogging();
+
+		char buf[1000];
+		memset(buf, 0, sizeof(buf));
+		lseek(fd, 0, SEEK_SET);
+		ssize_t size = read(fd, buf, sizeof(buf));
+		close(fd);
+
+		if (size < 4 || memcmp(buf, "LCBL", 4)) {
+			cerr << "Invalid binary log header" << endl;
+			return TestFail;
+		}
+
+		string log(buf, size);
+		for (const char *msg : { "good 1", "good 3", "good 5" }) {
+			if (log.find(msg) == string::npos) {
+				cout << "Missing binary log message" << endl;
+				return TestFail;
+			}
+		}
+
+		if (log.find("bad") != string::npos) {
+			cout << "Unexpected binary log message" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int testStream()
 	{
 		stringstream log;
@@ -115,6 +161,66 @@ protected:
 		return verifyOutput(log);
 	}
 
+	int testAsync()
+	{
+		stringstream log;
+		logSetStream(&log);
+
+		logSetAsynchronous(true);
+		doLogging();
+		/* Disabling asynchronous logging flushes the queued messages. */
+		logSetAsynchronous(false);
+
+		return verifyOutput(log);
+	}
+
+	int testRateLimit()
+	{
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("LogAPITest", "DEBUG");
+
+		LogCategory &category =
+			const_cast<LogCategory &>(_LOG_CATEGORY(LogAPITest)());
+
+		/* Output one message out of every three. */
+		category.setRateLimit(0, 3);
+		for (unsigned int i = 0; i < 7; ++i)
+			LOG(LogAPITest, Error) << "sampled " << i;
+
+		/* Output at most two messages per second. */
+		category.setRateLimit(2, 0);
+		for (unsigned int i = 0; i < 5; ++i)
+			LOG(LogAPITest, Error) << "limited " << i;
+
+		category.setRateLimit(0, 0);
+
+		list<string> expected = {
+			"sampled 0",
+			"suppressed 2 messages", "sampled 3",
+			"suppressed 2 messages", "sampled 6",
+			"limited 0", "limited 1",
+		};
+
+		string line;
+		while (getline(log, line)) {
+			if (expected.empty() ||
+			    line.find(expected.front()) == string::npos) {
+				cout << "Incorrect rate-limited log line" << endl;
+				return TestFail;
+			}
+
+			expected.pop_front();
+		}
+
+		if (!expected.empty()) {
+			cout << "Too few rate-limited log lines" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
 	int testTarget()
 	{
 		logSetTarget(LoggingTargetNone);
@@ -136,10 +242,22 @@ protected:
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testBinaryFile();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testStream();
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testAsync();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testRateLimit();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testTarget();
 		if (ret != TestPass)
 			return TestFail;
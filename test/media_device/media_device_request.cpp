@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * media_device_request.cpp - Test allocation and recycling of media requests
+ */
+
+#include <iostream>
+
+#include "media_device_test.h"
+#include "media_request.h"
+
+using namespace libcamera;
+using namespace std;
+
+class MediaDeviceRequest : public MediaDeviceTest
+{
+	int run()
+	{
+		if (!media_->acquire())
+			return TestFail;
+
+		std::unique_ptr<MediaRequest> request = media_->allocateRequest();
+		if (!request) {
+			cout << "Media device doesn't support requests" << endl;
+			media_->release();
+			return TestSkip;
+		}
+
+		if (request->fd() < 0 || request->reinit()) {
+			cout << "Failed to reinitialise request" << endl;
+			return TestFail;
+		}
+
+		request.reset();
+
+		/* Exhaust the pool and hand a request back. */
+		MediaRequestPool pool;
+		if (pool.allocate(media_.get(), 4)) {
+			cout << "Failed to allocate request pool" << endl;
+			return TestFail;
+		}
+
+		MediaRequest *requests[4];
+		for (MediaRequest *&req : requests) {
+			req = pool.get();
+			if (!req) {
+				cout << "Request pool exhausted early" << endl;
+				return TestFail;
+			}
+		}
+
+		if (pool.get()) {
+			cout << "Request pool not exhausted" << endl;
+			return TestFail;
+		}
+
+		pool.recycle(requests[2]);
+		if (pool.get() != requests[2]) {
+			cout << "Request not recycled" << endl;
+			return TestFail;
+		}
+
+		pool.release();
+		if (!pool.empty()) {
+			cout << "Request pool not released" << endl;
+			return TestFail;
+		}
+
+		media_->release();
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MediaDeviceRequest);
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * media_device_topology_cache.cpp - Test the media device topology cache
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "media_device_test.h"
+#include "utils.h"
+
+using namespace libcamera;
+using namespace std;
+
+class MediaDeviceTopologyCacheTest : public MediaDeviceTest
+{
+protected:
+	int init()
+	{
+		char dir[] = "/tmp/libcamera.topology.XXXXXX";
+		if (!mkdtemp(dir)) {
+			cerr << "Failed to create cache directory" << endl;
+			return TestFail;
+		}
+
+		dir_ = dir;
+		setenv("LIBCAMERA_TOPOLOGY_CACHE", dir, 1);
+
+		return MediaDeviceTest::init();
+	}
+
+	int run()
+	{
+		string path = cachePath();
+
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0) {
+			cerr << "Topology cache not created" << endl;
+			return TestFail;
+		}
+
+		/* Populate a new media device from the cache. */
+		MediaDevice media(media_->deviceNode());
+		if (media.populate() || !media.valid()) {
+			cerr << "Failed to populate media device from cache" << endl;
+			return TestFail;
+		}
+
+		if (media.entities().size() != media_->entities().size()) {
+			cerr << "Invalid number of entities" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < media.entities().size(); ++i) {
+			const MediaEntity *entity = media.entities()[i];
+			const MediaEntity *ref = media_->entities()[i];
+
+			if (entity->name() != ref->name() ||
+			    entity->pads().size() != ref->pads().size()) {
+				cerr << "Entity " << ref->name() << " mismatch" << endl;
+				return TestFail;
+			}
+
+			for (unsigned int j = 0; j < entity->pads().size(); ++j) {
+				if (entity->pads()[j]->links().size() !=
+				    ref->pads()[j]->links().size()) {
+					cerr << "Entity " << ref->name()
+					     << " links mismatch" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		/* A corrupted cache shall be ignored. */
+		if (truncate(path.c_str(), 16) < 0) {
+			cerr << "Failed to truncate topology cache" << endl;
+			return TestFail;
+		}
+
+		MediaDevice other(media_->deviceNode());
+		if (other.populate() ||
+		    other.entities().size() != media_->entities().size()) {
+			cerr << "Failed to populate media device with stale cache"
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		unsetenv("LIBCAMERA_TOPOLOGY_CACHE");
+
+		if (media_)
+			unlink(cachePath().c_str());
+		rmdir(dir_.c_str());
+	}
+
+private:
+	string cachePath() const
+	{
+		return dir_ + "/" + utils::basename(media_->deviceNode().c_str()) +
+		       ".topology";
+	}
+
+	string dir_;
+};
+
+TEST_REGISTER(MediaDeviceTopologyCacheTest);
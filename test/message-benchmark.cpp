@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * message-benchmark.cpp - Cross-thread message posting benchmark
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "message.h"
+#include "thread.h"
+#include "test.h"
+#include "utils.h"
+
+using namespace std;
+using namespace libcamera;
+
+static constexpr unsigned int ProducerCount = 4;
+static constexpr unsigned int MessageCount = 50000;
+
+class BenchmarkMessage : public Message
+{
+public:
+	BenchmarkMessage(unsigned int producer, unsigned int sequence)
+		: Message(type()), producer_(producer), sequence_(sequence)
+	{
+	}
+
+	static Message::Type type()
+	{
+		static Message::Type type = registerMessageType();
+		return type;
+	}
+
+	unsigned int producer_;
+	unsigned int sequence_;
+};
+
+class BenchmarkReceiver : public Object
+{
+public:
+	BenchmarkReceiver()
+		: received_(0), outOfOrder_(false), sequences_(ProducerCount, 0)
+	{
+	}
+
+	unsigned int received() const { return received_.load(); }
+	bool outOfOrder() const { return outOfOrder_; }
+
+protected:
+	void message(Message *msg)
+	{
+		BenchmarkMessage *bmsg = static_cast<BenchmarkMessage *>(msg);
+
+		/* Messages from a given producer shall be received in order. */
+		if (bmsg->sequence_ != sequences_[bmsg->producer_])
+			outOfOrder_ = true;
+		sequences_[bmsg->producer_] = bmsg->sequence_ + 1;
+
+		received_++;
+	}
+
+private:
+	std::atomic<unsigned int> received_;
+	bool outOfOrder_;
+	std::vector<unsigned int> sequences_;
+};
+
+/*
+ * Reference implementation of a message queue based on a mutex-protected list,
+ * as used by the Thread class before switching to a lock-free stack. Every push
+ * signals an eventfd to account for the cost of waking up the event loop.
+ */
+class MutexListQueue
+{
+public:
+	MutexListQueue()
+	{
+		eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	}
+
+	~MutexListQueue()
+	{
+		close(eventfd_);
+	}
+
+	void push(std::unique_ptr<Message> msg)
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		list_.push_back(std::move(msg));
+		locker.unlock();
+
+		uint64_t value = 1;
+		if (write(eventfd_, &value, sizeof(value)) != sizeof(value))
+			writeErrors_++;
+	}
+
+	unsigned int drain()
+	{
+		unsigned int count = 0;
+
+		std::unique_lock<std::mutex> locker(mutex_);
+		while (!list_.empty()) {
+			std::unique_ptr<Message> msg = std::move(list_.front());
+			list_.pop_front();
+
+			locker.unlock();
+			msg.reset();
+			count++;
+			locker.lock();
+		}
+
+		return count;
+	}
+
+	unsigned int writeErrors() const { return writeErrors_.load(); }
+
+private:
+	std::list<std::unique_ptr<Message>> list_;
+	std::mutex mutex_;
+	int eventfd_;
+	std::atomic<unsigned int> writeErrors_{ 0 };
+};
+
+class MessageBenchmarkTest : public Test
+{
+protected:
+	int run()
+	{
+		chrono::duration<double> threadDuration;
+		chrono::duration<double> referenceDuration;
+
+		/* Post messages to an object bound to a thread. */
+		BenchmarkReceiver receiver;
+		receiver.moveToThread(&thread_);
+		thread_.start();
+
+		auto start = chrono::steady_clock::now();
+
+		runProducers([&](unsigned int producer, unsigned int sequence) {
+			receiver.postMessage(utils::make_unique<BenchmarkMessage>(producer, sequence));
+		});
+
+		auto timeout = start + chrono::seconds(10);
+		while (receiver.received() < ProducerCount * MessageCount &&
+		       chrono::steady_clock::now() < timeout)
+			this_thread::yield();
+
+		threadDuration = chrono::steady_clock::now() - start;
+
+		thread_.exit(0);
+		thread_.wait();
+
+		if (receiver.received() != ProducerCount * MessageCount) {
+			cout << "Received " << receiver.received() << " messages, expected "
+			     << ProducerCount * MessageCount << endl;
+			return TestFail;
+		}
+
+		if (receiver.outOfOrder()) {
+			cout << "Messages received out of order" << endl;
+			return TestFail;
+		}
+
+		/* Post the same messages to the reference queue. */
+		MutexListQueue queue;
+		std::atomic<bool> done(false);
+		unsigned int drained = 0;
+
+		start = chrono::steady_clock::now();
+
+		std::thread consumer([&]() {
+			while (!done.load())
+				drained += queue.drain();
+			drained += queue.drain();
+		});
+
+		runProducers([&](unsigned int producer, unsigned int sequence) {
+			queue.push(utils::make_unique<BenchmarkMessage>(producer, sequence));
+		});
+
+		done.store(true);
+		consumer.join();
+
+		referenceDuration = chrono::steady_clock::now() - start;
+
+		if (queue.writeErrors()) {
+			cout << "Failed to signal the reference queue eventfd" << endl;
+			return TestFail;
+		}
+
+		if (drained != ProducerCount * MessageCount) {
+			cout << "Reference queue drained " << drained
+			     << " messages, expected "
+			     << ProducerCount * MessageCount << endl;
+			return TestFail;
+		}
+
+		unsigned int total = ProducerCount * MessageCount;
+		cout << "Thread message queue: " << threadDuration.count() << "s, "
+		     << total / threadDuration.count() << " messages/s" << endl;
+		cout << "Mutex/list reference queue: " << referenceDuration.count() << "s, "
+		     << total / referenceDuration.count() << " messages/s" << endl;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	template<typename Func>
+	void runProducers(Func post)
+	{
+		std::vector<std::thread> producers;
+
+		for (unsigned int i = 0; i < ProducerCount; ++i) {
+			producers.emplace_back([i, &post]() {
+				for (unsigned int seq = 0; seq < MessageCount; ++seq)
+					post(i, seq);
+			});
+		}
+
+		for (std::thread &producer : producers)
+			producer.join();
+	}
+
+	Thread thread_;
+};
+
+TEST_REGISTER(MessageBenchmarkTest)
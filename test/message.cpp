@@ -7,7 +7,12 @@
 
 #include <chrono>
 #include <iostream>
+#include <sys/eventfd.h>
 #include <thread>
+#include <unistd.h>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/event_notifier.h>
 
 #include "message.h"
 #include "thread.h"
@@ -37,6 +42,11 @@ public:
 protected:
 	void message(Message *msg)
 	{
+		if (msg->type() != Message::None) {
+			Object::message(msg);
+			return;
+		}
+
 		if (thread() != Thread::current())
 			status_ = InvalidThread;
 		else
@@ -47,6 +57,77 @@ private:
 	Status status_;
 };
 
+class CountingReceiver : public Object
+{
+public:
+	CountingReceiver()
+		: count_(0)
+	{
+	}
+
+	unsigned int count() const { return count_; }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != Message::None) {
+			Object::message(msg);
+			return;
+		}
+
+		count_++;
+	}
+
+private:
+	unsigned int count_;
+};
+
+class FloodReceiver : public Object
+{
+public:
+	FloodReceiver()
+		: count_(0), notifierCount_(-1)
+	{
+	}
+
+	void watch(int fd)
+	{
+		notifier_ = utils::make_unique<EventNotifier>(fd, EventNotifier::Read);
+		notifier_->activated.connect(this, &FloodReceiver::notifierActivated);
+	}
+
+	void unwatch() { notifier_.reset(); }
+
+	unsigned int count() const { return count_; }
+	int notifierCount() const { return notifierCount_; }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != Message::None) {
+			Object::message(msg);
+			return;
+		}
+
+		/* Stall the thread on the first message while the flood is posted. */
+		if (!count_++)
+			this_thread::sleep_for(chrono::milliseconds(50));
+	}
+
+private:
+	void notifierActivated(EventNotifier *notifier)
+	{
+		uint64_t value;
+
+		if (read(notifier->fd(), &value, sizeof(value)) == sizeof(value))
+			notifierCount_ = count_;
+	}
+
+	std::unique_ptr<EventNotifier> notifier_;
+	unsigned int count_;
+	int notifierCount_;
+};
+
 class MessageTest : public Test
 {
 protected:
@@ -83,6 +164,161 @@ protected:
 			break;
 		}
 
+		/* Invoked functions shall run synchronously in the object's thread. */
+		Thread *invokeThread = nullptr;
+		receiver.invoke([&]() {
+			this_thread::sleep_for(chrono::milliseconds(10));
+			invokeThread = Thread::current();
+		});
+
+		if (invokeThread != &thread_) {
+			cout << "Function invoked in incorrect thread" << endl;
+			return TestFail;
+		}
+
+		/* Memory released from the same thread shall be reused. */
+		void *mem = MessagePool::allocate(32);
+		MessagePool::release(mem);
+		if (MessagePool::allocate(32) != mem) {
+			cout << "Message memory not reused" << endl;
+			return TestFail;
+		}
+
+		/* Memory released from a different thread shall be reused. */
+		std::thread releaser([mem]() { MessagePool::release(mem); });
+		releaser.join();
+
+		if (MessagePool::allocate(32) != mem) {
+			cout << "Message memory released from another thread not reused"
+			     << endl;
+			return TestFail;
+		}
+
+		MessagePool::release(mem);
+
+		int ret = testDispatchBudget();
+		if (ret != TestPass)
+			return ret;
+
+		return testExecDispatchBudget();
+	}
+
+	void notifierActivated(EventNotifier *notifier)
+	{
+		uint64_t value;
+
+		if (read(notifier->fd(), &value, sizeof(value)) == sizeof(value))
+			notifierCount_ = counter_.count();
+	}
+
+	/*
+	 * Messages shall be dispatched in batches bounded by the thread budget,
+	 * with pending events processed between batches.
+	 */
+	int testDispatchBudget()
+	{
+		int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (fd < 0)
+			return TestFail;
+
+		Thread *thread = Thread::current();
+		thread->setDispatchBudget(4);
+
+		int ret = dispatchBatches(fd);
+		close(fd);
+
+		return ret;
+	}
+
+	int dispatchBatches(int fd)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		EventNotifier notifier(fd, EventNotifier::Read);
+		notifier.activated.connect(this, &MessageTest::notifierActivated);
+		notifierCount_ = -1;
+
+		for (unsigned int i = 0; i < 10; ++i)
+			counter_.postMessage(utils::make_unique<Message>(Message::None));
+
+		dispatcher->processEvents();
+
+		if (counter_.count() != 4) {
+			cout << "Dispatched " << counter_.count()
+			     << " messages, expected 4" << endl;
+			return TestFail;
+		}
+
+		uint64_t value = 1;
+		if (write(fd, &value, sizeof(value)) != sizeof(value))
+			return TestFail;
+
+		dispatcher->processEvents();
+
+		if (counter_.count() != 8 || notifierCount_ != 4) {
+			cout << "Events not interleaved with messages" << endl;
+			return TestFail;
+		}
+
+		dispatcher->processEvents();
+
+		if (counter_.count() != 10) {
+			cout << "Remaining messages not dispatched" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	/*
+	 * The event loop of threads running exec() shall also dispatch messages
+	 * in batches, and process events between batches.
+	 */
+	int testExecDispatchBudget()
+	{
+		static constexpr unsigned int Flood = 64;
+
+		int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (fd < 0)
+			return TestFail;
+
+		FloodReceiver receiver;
+		receiver.moveToThread(&thread_);
+		receiver.invoke([&]() { receiver.watch(fd); });
+
+		thread_.setDispatchBudget(4);
+
+		for (unsigned int i = 0; i < Flood; ++i)
+			receiver.postMessage(utils::make_unique<Message>(Message::None));
+
+		uint64_t value = 1;
+		if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+			close(fd);
+			return TestFail;
+		}
+
+		/* The invoked function is dispatched after the flood. */
+		unsigned int count;
+		int notifierCount;
+		receiver.invoke([&]() {
+			count = receiver.count();
+			notifierCount = receiver.notifierCount();
+			receiver.unwatch();
+		});
+
+		close(fd);
+
+		if (count != Flood) {
+			cout << "Dispatched " << count << " messages, expected "
+			     << Flood << endl;
+			return TestFail;
+		}
+
+		if (notifierCount < 0 || notifierCount >= static_cast<int>(Flood)) {
+			cout << "Events not interleaved with messages in exec()"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -94,6 +330,8 @@ protected:
 
 private:
 	Thread thread_;
+	CountingReceiver counter_;
+	int notifierCount_;
 };
 
 TEST_REGISTER(MessageTest)
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * metrics.cpp - Runtime metrics test
+ */
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <libcamera/metrics.h>
+
+#include "metrics_registry.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class MetricsTest : public Test
+{
+protected:
+	static constexpr unsigned int ThreadCount = 20;
+	static constexpr unsigned int Iterations = 10000;
+
+	int run()
+	{
+		MetricsRegistry *registry = MetricsRegistry::instance();
+
+		CounterMetric *counter = registry->counter("test.counter");
+		GaugeMetric *gauge = registry->gauge("test.gauge");
+		HistogramMetric *histogram = registry->histogram("test.histogram");
+
+		if (registry->counter("test.counter") != counter) {
+			cout << "Counter not shared" << endl;
+			return TestFail;
+		}
+
+		/* Metrics of another type shall not replace existing metrics. */
+		if (registry->gauge("test.counter") ==
+		    static_cast<Metric *>(counter)) {
+			cout << "Metric registered with two types" << endl;
+			return TestFail;
+		}
+
+		/* Update the metrics from more threads than there are shards. */
+		vector<thread> threads;
+		for (unsigned int i = 0; i < ThreadCount; ++i) {
+			threads.emplace_back([=]() {
+				for (unsigned int j = 0; j < Iterations; ++j) {
+					counter->add();
+					histogram->add(j % 4);
+				}
+			});
+		}
+
+		for (thread &t : threads)
+			t.join();
+
+		gauge->set(10);
+		gauge->add(-3);
+
+		MetricsSnapshot snapshot = metricsSnapshot();
+
+		const MetricValue *value = snapshot.find("test.counter");
+		if (!value || value->type != MetricValue::TypeCounter ||
+		    value->value != ThreadCount * Iterations) {
+			cout << "Invalid counter value" << endl;
+			return TestFail;
+		}
+
+		value = snapshot.find("test.gauge");
+		if (!value || value->type != MetricValue::TypeGauge ||
+		    value->value != 7) {
+			cout << "Invalid gauge value" << endl;
+			return TestFail;
+		}
+
+		value = snapshot.find("test.histogram");
+		if (!value || value->type != MetricValue::TypeHistogram ||
+		    value->value != ThreadCount * Iterations ||
+		    value->histogram.counts()[0] != ThreadCount * Iterations / 4) {
+			cout << "Invalid histogram value" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MetricsTest)
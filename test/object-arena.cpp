@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * object-arena.cpp - Object arena tests
+ */
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include <libcamera/buffer.h>
+
+#include "object_arena.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ObjectArenaTest : public Test
+{
+protected:
+	static constexpr unsigned int Count = 16;
+
+	int testReuse()
+	{
+		std::shared_ptr<ObjectArena> arena = ObjectArena::create();
+
+		arena->reserve(sizeof(Buffer), Count);
+		if (arena->capacity(sizeof(Buffer)) != Count) {
+			cerr << "Invalid arena capacity" << endl;
+			return TestFail;
+		}
+
+		/* Freed memory is reused for the next object of the same size. */
+		void *mem = ObjectArena::allocate(arena.get(), sizeof(Buffer));
+		ObjectArena::release(mem);
+
+		void *reused = ObjectArena::allocate(arena.get(), sizeof(Buffer));
+		if (reused != mem) {
+			cerr << "Memory not reused" << endl;
+			return TestFail;
+		}
+		ObjectArena::release(reused);
+
+		/* The arena grows on demand beyond its reservation. */
+		std::vector<void *> objects;
+		for (unsigned int i = 0; i < Count * 2; ++i)
+			objects.push_back(ObjectArena::allocate(arena.get(), 24));
+
+		if (arena->capacity(24) < Count * 2 ||
+		    arena->capacity(sizeof(Buffer)) != Count) {
+			cerr << "Invalid arena growth" << endl;
+			return TestFail;
+		}
+
+		/* Objects outlive the reference of the arena owner. */
+		arena.reset();
+
+		for (void *object : objects) {
+			if (reinterpret_cast<uintptr_t>(object) % alignof(std::max_align_t)) {
+				cerr << "Misaligned object" << endl;
+				return TestFail;
+			}
+
+			memset(object, 0xa5, 24);
+			ObjectArena::release(object);
+		}
+
+		return TestPass;
+	}
+
+	int testThreads()
+	{
+		std::shared_ptr<ObjectArena> arena = ObjectArena::create();
+		std::vector<std::thread> threads;
+
+		for (unsigned int i = 0; i < 4; ++i) {
+			threads.emplace_back([&arena]() {
+				for (unsigned int j = 0; j < 10000; ++j) {
+					void *mem = ObjectArena::allocate(arena.get(), 64);
+					ObjectArena::release(mem);
+				}
+			});
+		}
+
+		for (std::thread &thread : threads)
+			thread.join();
+
+		if (arena->capacity(64) > 4 * Count) {
+			cerr << "Arena leaked memory" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret;
+
+		ret = testReuse();
+		if (ret)
+			return ret;
+
+		ret = testThreads();
+		if (ret)
+			return ret;
+
+		/* Heap objects are freed with the same operator. */
+		std::unique_ptr<Buffer> buffer(new Buffer(0));
+		buffer.reset();
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ObjectArenaTest)
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * object-invoke.cpp - Cross-thread Object method invocation test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/object.h>
+
+#include "thread.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class InvokedObject : public Object
+{
+public:
+	InvokedObject()
+		: thread_(nullptr), value_(0)
+	{
+	}
+
+	int add(int value)
+	{
+		thread_ = Thread::current();
+		value_ += value;
+		return value_;
+	}
+
+	void reset()
+	{
+		thread_ = nullptr;
+		value_ = 0;
+	}
+
+	void drop(InvokedObject *object)
+	{
+		/* Give the invoker time to post its message. */
+		this_thread::sleep_for(chrono::milliseconds(100));
+		delete object;
+	}
+
+	Thread *thread_;
+	int value_;
+};
+
+class ObjectInvokeTest : public Test
+{
+protected:
+	int run()
+	{
+		InvokedObject object;
+		object.moveToThread(&thread_);
+
+		thread_.start();
+
+		/* Blocking invocations shall run in the object's thread. */
+		future<int> result = object.invokeMethod(&InvokedObject::add,
+							 ConnectionTypeBlocking, 42);
+		if (result.wait_for(chrono::seconds(0)) != future_status::ready) {
+			cout << "Blocking invocation didn't complete" << endl;
+			return TestFail;
+		}
+
+		if (result.get() != 42 || object.thread_ != &thread_) {
+			cout << "Blocking invocation failed" << endl;
+			return TestFail;
+		}
+
+		/* Queued and auto invocations shall run in the object's thread. */
+		for (ConnectionType type : { ConnectionTypeQueued, ConnectionTypeAuto }) {
+			object.invokeMethod(&InvokedObject::reset, ConnectionTypeBlocking);
+
+			result = object.invokeMethod(&InvokedObject::add, type, 3);
+			if (result.wait_for(chrono::seconds(1)) != future_status::ready) {
+				cout << "Queued invocation timed out" << endl;
+				return TestFail;
+			}
+
+			if (result.get() != 3 || object.thread_ != &thread_) {
+				cout << "Queued invocation failed" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Direct invocations shall run in the caller's thread. */
+		result = object.invokeMethod(&InvokedObject::add,
+					     ConnectionTypeDirect, 1);
+		if (result.get() != 4 || object.thread_ != Thread::current()) {
+			cout << "Direct invocation failed" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Synchronous invocations dropped before delivery shall return
+		 * without running the function.
+		 */
+		InvokedObject *target = new InvokedObject();
+		target->moveToThread(&thread_);
+
+		object.invokeMethod(&InvokedObject::drop, ConnectionTypeQueued,
+				    target);
+
+		bool ran = false;
+		std::thread invoker([&]() { target->invoke([&]() { ran = true; }); });
+		invoker.join();
+
+		if (ran) {
+			cout << "Dropped synchronous invocation ran" << endl;
+			return TestFail;
+		}
+
+		thread_.exit(0);
+		thread_.wait();
+
+		/*
+		 * Queued invocations for an object destroyed before they are
+		 * delivered shall report a broken promise.
+		 */
+		InvokedObject *dropped = new InvokedObject();
+		dropped->moveToThread(&thread_);
+
+		result = dropped->invokeMethod(&InvokedObject::add,
+					       ConnectionTypeQueued, 1);
+		delete dropped;
+
+		try {
+			result.get();
+			cout << "Dropped invocation delivered" << endl;
+			return TestFail;
+		} catch (const future_error &e) {
+			if (e.code() != future_errc::broken_promise) {
+				cout << "Invalid dropped invocation error" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+private:
+	Thread thread_;
+};
+
+TEST_REGISTER(ObjectInvokeTest)
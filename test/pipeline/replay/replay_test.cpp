@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * replay_test.cpp - Replay pipeline handler test
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "test.h"
+#include "utils.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Record a capture session in the container format of the cam application,
+ * and verify that the replay camera delivers the recorded frames, sequence
+ * numbers and timestamps, at the recorded pace or as fast as possible.
+ */
+class ReplayTest : public Test
+{
+protected:
+	static constexpr unsigned int Width = 64;
+	static constexpr unsigned int Height = 32;
+	static constexpr unsigned int FrameSize = Width * Height * 3 / 2;
+	static constexpr unsigned int Frames = 8;
+	static constexpr uint64_t FrameInterval = 10000000;
+	static constexpr uint64_t FirstTimestamp = 1000000000;
+
+	static void put32(std::vector<uint8_t> &data, uint32_t value)
+	{
+		for (unsigned int i = 0; i < 4; ++i)
+			data.push_back(value >> (i * 8));
+	}
+
+	static void put64(std::vector<uint8_t> &data, uint64_t value)
+	{
+		put32(data, value);
+		put32(data, value >> 32);
+	}
+
+	/* Record frames with odd sequence numbers, filled with their index. */
+	int record()
+	{
+		std::vector<uint8_t> data{ 'L', 'C', 'C', 'F' };
+		put32(data, 1);
+		put32(data, 1);
+		put32(data, 0);
+
+		put32(data, V4L2_PIX_FMT_NV12);
+		put32(data, Width);
+		put32(data, Height);
+		put32(data, Width);
+
+		for (unsigned int i = 0; i < Frames; ++i) {
+			data.insert(data.end(), { 'L', 'C', 'F', 'R' });
+			put32(data, 0);
+			put32(data, i * 2 + 1);
+			put32(data, 1);
+			put64(data, FirstTimestamp + i * FrameInterval);
+			put32(data, FrameSize);
+			put32(data, 0);
+			put32(data, FrameSize);
+			data.insert(data.end(), FrameSize, i);
+		}
+
+		fd_ = memfd_create("replay_test", MFD_CLOEXEC);
+		if (fd_ < 0 ||
+		    write(fd_, data.data(), data.size()) != static_cast<ssize_t>(data.size()))
+			return TestFail;
+
+		setenv("LIBCAMERA_REPLAY_FILE",
+		       ("/proc/self/fd/" + std::to_string(fd_)).c_str(), 1);
+
+		return TestPass;
+	}
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.begin()->second;
+		const unsigned int index = completed_++;
+		const uint8_t *mem =
+			static_cast<const uint8_t *>(buffer->mem()->planes()[0].mem());
+
+		if (buffer->sequence() != index * 2 + 1 ||
+		    buffer->timestamp() != FirstTimestamp + index * FrameInterval ||
+		    buffer->bytesused() != FrameSize) {
+			error_ = "Invalid metadata for frame " + std::to_string(index);
+			return;
+		}
+
+		for (unsigned int i = 0; i < FrameSize; ++i) {
+			if (mem[i] != index) {
+				error_ = "Invalid data for frame " + std::to_string(index);
+				return;
+			}
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	/* The recorded stream configuration is reported by the camera. */
+	int configure()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || config->size() != 1) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		if (cfg.pixelFormat != V4L2_PIX_FMT_NV12 ||
+		    cfg.size != Size(Width, Height)) {
+			cout << "Recorded format not reported" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		stream_ = cfg.stream();
+		bufferCount_ = cfg.bufferCount;
+
+		return TestPass;
+	}
+
+	/* Replay the recording, and return the replay duration. */
+	int replay(const char *speed, uint64_t *duration)
+	{
+		setenv("LIBCAMERA_REPLAY_SPEED", speed, 1);
+
+		completed_ = 0;
+
+		uint64_t start = utils::monotonic_ns();
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < bufferCount_; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream_->createBuffer(i));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && completed_ < Frames && error_.empty())
+			dispatcher->processEvents();
+
+		*duration = utils::monotonic_ns() - start;
+
+		camera_->stop();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ != Frames) {
+			cout << "Replayed " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int init()
+	{
+		fd_ = -1;
+
+		if (record()) {
+			cout << "Failed to record capture session" << endl;
+			return TestFail;
+		}
+
+		cm_ = CameraManager::instance();
+		if (cm_->start()) {
+			cout << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		camera_ = cm_->get("Replay");
+		if (!camera_) {
+			cout << "Replay camera not found" << endl;
+			return TestFail;
+		}
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire camera" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &ReplayTest::requestComplete);
+
+		return configure();
+	}
+
+	int run()
+	{
+		uint64_t duration;
+		int ret;
+
+		/* The recorded frame rate is reproduced at the original speed. */
+		ret = replay("1", &duration);
+		if (ret)
+			return ret;
+
+		if (duration < (Frames - 1) * FrameInterval) {
+			cout << "Frames replayed too fast" << endl;
+			return TestFail;
+		}
+
+		/* Replaying as fast as possible doesn't drop frames. */
+		ret = replay("0", &duration);
+		if (ret)
+			return ret;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (camera_) {
+			camera_->freeBuffers();
+			camera_->release();
+			camera_.reset();
+		}
+
+		cm_->stop();
+
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+private:
+	CameraManager *cm_;
+	int fd_;
+	std::shared_ptr<Camera> camera_;
+	Stream *stream_;
+	unsigned int bufferCount_;
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(ReplayTest)
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * acquire_fence.cpp - Buffer acquire fence test
+ */
+
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that requests are held back until the acquire fences of their buffers
+ * signal, in order, and cancelled when the fences time out or the camera stops.
+ * Eventfds stand in for sync_file fences, as they become readable when
+ * signalled.
+ */
+class AcquireFenceTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (buffers.begin()->second->fence() != -1)
+			fenceLeaked_ = true;
+
+		completed_.push_back({ request->cookie(), request->status() });
+	}
+
+	Request *createRequest(uint64_t cookie, unsigned int index, int *fence)
+	{
+		Request *request = camera_->createRequest(cookie);
+		std::unique_ptr<Buffer> buffer = stream_->createBuffer(index);
+
+		if (fence) {
+			*fence = eventfd(0, EFD_CLOEXEC);
+			buffer->setFence(dup(*fence));
+		}
+
+		request->addBuffer(std::move(buffer));
+		return request;
+	}
+
+	void runEvents(unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		setenv("LIBCAMERA_FENCE_TIMEOUT", "300", 1);
+
+		return VirtualCameraTest::init();
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers() || camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &AcquireFenceTest::requestComplete);
+		stream_ = config->at(0).stream();
+
+		/* The request queued after a fenced request waits for the fence. */
+		int fence;
+		if (camera_->queueRequest(createRequest(1, 0, &fence)) ||
+		    camera_->queueRequest(createRequest(2, 1, nullptr))) {
+			cout << "Failed to queue requests" << endl;
+			return TestFail;
+		}
+
+		runEvents(150);
+
+		if (!completed_.empty()) {
+			cout << "Request completed before its fence signalled" << endl;
+			return TestFail;
+		}
+
+		uint64_t value = 1;
+		if (write(fence, &value, sizeof(value)) != sizeof(value)) {
+			cout << "Failed to signal fence" << endl;
+			return TestFail;
+		}
+		close(fence);
+
+		runEvents(150);
+
+		if (completed_.size() != 2 ||
+		    completed_[0].first != 1 || completed_[1].first != 2 ||
+		    completed_[0].second != Request::RequestComplete ||
+		    completed_[1].second != Request::RequestComplete) {
+			cout << "Requests not completed after fence signalled" << endl;
+			return TestFail;
+		}
+
+		/* A fence that never signals cancels the request. */
+		completed_.clear();
+		camera_->queueRequest(createRequest(3, 0, &fence));
+
+		runEvents(450);
+		close(fence);
+
+		if (completed_.size() != 1 ||
+		    completed_[0].second != Request::RequestCancelled) {
+			cout << "Request not cancelled on fence timeout" << endl;
+			return TestFail;
+		}
+
+		/* Stopping the camera cancels the requests waiting for fences. */
+		completed_.clear();
+		camera_->queueRequest(createRequest(4, 0, &fence));
+		camera_->queueRequest(createRequest(5, 1, nullptr));
+
+		runEvents(50);
+		camera_->stop();
+		close(fence);
+
+		if (completed_.size() != 2 ||
+		    completed_[0].first != 4 || completed_[1].first != 5 ||
+		    completed_[0].second != Request::RequestCancelled ||
+		    completed_[1].second != Request::RequestCancelled) {
+			cout << "Waiting requests not cancelled on stop" << endl;
+			return TestFail;
+		}
+
+		if (fenceLeaked_) {
+			cout << "Fence not closed at completion" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	Stream *stream_;
+	std::vector<std::pair<uint64_t, Request::Status>> completed_;
+	bool fenceLeaked_ = false;
+};
+
+TEST_REGISTER(AcquireFenceTest)
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * adaptive_buffers.cpp - Adaptive buffer count test
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the recommended number of buffers grows after a capture session
+ * that drops frames when adaptive buffer counts are enabled, and stays within
+ * the limits reported by the pipeline handler.
+ */
+class AdaptiveBuffersTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		/* Starve the camera to make it drop frames. */
+		usleep(25000);
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int capture()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get())) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		Stream *stream = cfg.stream();
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+			request->controls().set(controls::FrameDuration, 10000);
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		return TestPass;
+	}
+
+	unsigned int bufferCount()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config)
+			return 0;
+
+		const StreamConfiguration &cfg = config->at(0);
+		if (cfg.bufferCount < cfg.minBufferCount ||
+		    cfg.bufferCount > cfg.maxBufferCount)
+			return 0;
+
+		return cfg.bufferCount;
+	}
+
+	int init() override
+	{
+		setenv("LIBCAMERA_ADAPTIVE_BUFFERS", "1", 1);
+
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &AdaptiveBuffersTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		unsigned int initial = bufferCount();
+		if (!initial) {
+			cout << "Invalid initial buffer count" << endl;
+			return TestFail;
+		}
+
+		if (capture() != TestPass)
+			return TestFail;
+
+		if (!camera_->statistics().framesDropped) {
+			cout << "No frame dropped" << endl;
+			return TestFail;
+		}
+
+		unsigned int count = bufferCount();
+		if (count != initial + 1) {
+			cout << "Buffer count " << count << ", expected "
+			     << initial + 1 << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(AdaptiveBuffersTest)
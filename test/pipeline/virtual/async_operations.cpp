@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * async_operations.cpp - Virtual cameras asynchronous operations test
+ */
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+class CompletionRecorder : public Object
+{
+public:
+	CompletionRecorder()
+		: completed_(0), failed_(0), invalidThread_(false)
+	{
+	}
+
+	void operationCompleted(Camera *camera, int ret)
+	{
+		if (Thread::current() != thread())
+			invalidThread_ = true;
+
+		if (ret)
+			failed_++;
+		completed_++;
+	}
+
+	unsigned int completed_;
+	unsigned int failed_;
+	bool invalidThread_;
+};
+
+/*
+ * Verify that multiple cameras can be configured, prepared and started
+ * concurrently from a single thread, with completion reported through futures
+ * and through the operationCompleted signal in the application's thread.
+ */
+class AsyncOperationsTest : public VirtualCameraTest
+{
+public:
+	AsyncOperationsTest()
+		: VirtualCameraTest(CameraCount) {}
+
+protected:
+	static constexpr unsigned int CameraCount = 2;
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		cameras_[request->cookie()]->queueRequest(request);
+	}
+
+	/*
+	 * Wait for the futures of an operation on all cameras, and for the
+	 * completion signals to be delivered to the recorder.
+	 */
+	int waitForCompletion(std::vector<std::future<int>> &results,
+			      const char *operation)
+	{
+		for (std::future<int> &result : results) {
+			if (result.wait_for(chrono::seconds(1)) != future_status::ready) {
+				cout << operation << " timed out" << endl;
+				return TestFail;
+			}
+
+			if (result.get()) {
+				cout << operation << " failed" << endl;
+				return TestFail;
+			}
+		}
+
+		results.clear();
+		expected_ += CameraCount;
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+		Timer timer;
+		timer.start(1000);
+		while (recorder_.completed_ != expected_ && timer.isRunning())
+			dispatcher->processEvents();
+
+		if (recorder_.completed_ != expected_ || recorder_.failed_ ||
+		    recorder_.invalidThread_) {
+			cout << operation << " completion not signalled" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::vector<std::unique_ptr<CameraConfiguration>> configs;
+		std::vector<std::future<int>> results;
+
+		for (std::shared_ptr<Camera> &camera : cameras_) {
+			std::unique_ptr<CameraConfiguration> config =
+				camera->generateConfiguration({ StreamRole::VideoRecording });
+			if (!config) {
+				cout << "Failed to generate configuration for "
+				     << camera->name() << endl;
+				return TestFail;
+			}
+
+			camera->operationCompleted.connect(&recorder_, &CompletionRecorder::operationCompleted);
+			camera->requestCompleted.connect(this, &AsyncOperationsTest::requestComplete);
+
+			results.push_back(camera->configureAsync(config.get()));
+			configs.push_back(std::move(config));
+		}
+
+		if (waitForCompletion(results, "Configuration") != TestPass)
+			return TestFail;
+
+		for (std::shared_ptr<Camera> &camera : cameras_)
+			results.push_back(camera->allocateBuffersAsync());
+
+		if (waitForCompletion(results, "Buffer allocation") != TestPass)
+			return TestFail;
+
+		for (std::shared_ptr<Camera> &camera : cameras_)
+			results.push_back(camera->startAsync());
+
+		if (waitForCompletion(results, "Start") != TestPass)
+			return TestFail;
+
+		/* The started cameras shall capture frames. */
+		for (unsigned int i = 0; i < CameraCount; ++i) {
+			Stream *stream = configs[i]->at(0).stream();
+
+			for (unsigned int j = 0; j < configs[i]->at(0).bufferCount; ++j) {
+				Request *request = cameras_[i]->createRequest(i);
+				request->addBuffer(stream->createBuffer(j));
+
+				if (cameras_[i]->queueRequest(request)) {
+					cout << "Failed to queue request" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		for (std::shared_ptr<Camera> &camera : cameras_)
+			camera->stop();
+
+		if (completed_ < CameraCount) {
+			cout << "Only " << completed_ << " requests completed" << endl;
+			return TestFail;
+		}
+
+		/* Operations in invalid states shall report errors. */
+		std::future<int> result = cameras_[0]->allocateBuffersAsync();
+		if (result.get() != -EACCES) {
+			cout << "Invalid operation not rejected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	CompletionRecorder recorder_;
+	unsigned int expected_ = 0;
+	unsigned int completed_ = 0;
+};
+
+TEST_REGISTER(AsyncOperationsTest)
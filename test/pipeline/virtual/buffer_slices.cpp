@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * buffer_slices.cpp - Partial frame completion test
+ */
+
+#include <iostream>
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the slices of the frames are reported as they are written,
+ * before their buffer completes, and that the written lines can be read.
+ */
+class BufferSlicesTest : public VirtualCameraTest
+{
+protected:
+	static constexpr unsigned int Width = 640;
+	static constexpr unsigned int Height = 480;
+	static constexpr unsigned int SliceHeight = 100;
+
+	void bufferProgressed(Request *request, Buffer *buffer, unsigned int lines)
+	{
+		if (lines != lines_ + SliceHeight || lines >= Height) {
+			error_ = "Invalid slice progress";
+			return;
+		}
+
+		/* The lines of the slice match the first line of the frame. */
+		const uint8_t *mem =
+			static_cast<const uint8_t *>(buffer->mem()->planes()[0].mem());
+		if (memcmp(mem, mem + (lines - 1) * Width, Width)) {
+			error_ = "Slice not written";
+			return;
+		}
+
+		lines_ = lines;
+	}
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		/* All slices but the last one are reported before completion. */
+		if (lines_ != Height / SliceHeight * SliceHeight) {
+			error_ = "Missing slices before completion";
+			return;
+		}
+
+		lines_ = 0;
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		cfg.size = { Width, Height };
+
+		/* Slices are aligned to whole NV12 chroma lines. */
+		cfg.sliceHeight = SliceHeight - 1;
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    cfg.sliceHeight != SliceHeight) {
+			cout << "Failed to adjust slice height" << endl;
+			return TestFail;
+		}
+
+		/* A single slice covering the whole frame is disabled. */
+		cfg.sliceHeight = Height;
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    cfg.sliceHeight != 0) {
+			cout << "Failed to disable slices" << endl;
+			return TestFail;
+		}
+
+		cfg.sliceHeight = SliceHeight;
+		if (config->validate() != CameraConfiguration::Valid ||
+		    camera_->configure(config.get()) ||
+		    camera_->allocateBuffers() || camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		camera_->bufferProgressed.connect(this, &BufferSlicesTest::bufferProgressed);
+		camera_->requestCompleted.connect(this, &BufferSlicesTest::requestComplete);
+
+		Stream *stream = cfg.stream();
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(300);
+		while (timer.isRunning() && error_.empty())
+			dispatcher->processEvents();
+
+		camera_->stop();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 3) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unsigned int lines_ = 0;
+	unsigned int completed_ = 0;
+	std::string error_;
+};
+
+TEST_REGISTER(BufferSlicesTest)
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * camera_group.cpp - Virtual cameras synchronised capture test
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that a camera group delivers all completed requests exactly once,
+ * and pairs the frames captured at the same time by different cameras.
+ */
+class CameraGroupTest : public VirtualCameraTest
+{
+public:
+	CameraGroupTest()
+		: VirtualCameraTest(CameraCount) {}
+
+protected:
+	static constexpr unsigned int CameraCount = 2;
+	static constexpr uint64_t Tolerance = 10000000;
+
+	void framesetComplete(const std::vector<Request *> &frameset)
+	{
+		if (frameset.size() != CameraCount) {
+			invalid_ = true;
+			return;
+		}
+
+		unsigned int count = 0;
+		uint64_t first = 0;
+		uint64_t last = 0;
+
+		for (unsigned int i = 0; i < frameset.size(); ++i) {
+			Request *request = frameset[i];
+			if (!request)
+				continue;
+
+			delivered_[i]++;
+			count++;
+
+			if (request->status() != Request::RequestComplete)
+				continue;
+
+			uint64_t timestamp = request->metadata().get(controls::SensorTimestamp);
+			if (!first || timestamp < first)
+				first = timestamp;
+			if (timestamp > last)
+				last = timestamp;
+		}
+
+		if (count == CameraCount) {
+			matched_++;
+			if (last - first > Tolerance)
+				invalid_ = true;
+		}
+
+		for (unsigned int i = 0; i < frameset.size(); ++i) {
+			Request *request = frameset[i];
+			if (!request || request->status() != Request::RequestComplete)
+				continue;
+
+			request->reuse(Request::ReuseBuffers);
+			cameras_[i]->queueRequest(request);
+		}
+	}
+
+	int run()
+	{
+		std::vector<Stream *> streams;
+
+		for (std::shared_ptr<Camera> &camera : cameras_) {
+			std::unique_ptr<CameraConfiguration> config =
+				camera->generateConfiguration({ StreamRole::VideoRecording });
+			if (!config || camera->configure(config.get()) ||
+			    camera->allocateBuffers()) {
+				cout << "Failed to prepare " << camera->name() << endl;
+				return TestFail;
+			}
+
+			streams.push_back(config->at(0).stream());
+			bufferCount_ = config->at(0).bufferCount;
+		}
+
+		CameraGroup group(cameras_, Tolerance);
+		group.framesetCompleted.connect(this, &CameraGroupTest::framesetComplete);
+
+		if (group.start()) {
+			cout << "Failed to start camera group" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < CameraCount; ++i) {
+			for (unsigned int j = 0; j < bufferCount_; ++j) {
+				Request *request = cameras_[i]->createRequest();
+				request->addBuffer(streams[i]->createBuffer(j));
+
+				if (cameras_[i]->queueRequest(request)) {
+					cout << "Failed to queue request" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (group.stop()) {
+			cout << "Failed to stop camera group" << endl;
+			return TestFail;
+		}
+
+		if (invalid_) {
+			cout << "Invalid frameset delivered" << endl;
+			return TestFail;
+		}
+
+		/* All requests shall be delivered exactly once. */
+		for (unsigned int i = 0; i < CameraCount; ++i) {
+			CameraStatistics stats = cameras_[i]->statistics();
+			if (delivered_[i] != stats.requestsCompleted +
+					     stats.requestsCancelled) {
+				cout << "Delivered " << delivered_[i]
+				     << " requests for " << cameras_[i]->name()
+				     << endl << stats.toString() << endl;
+				return TestFail;
+			}
+		}
+
+		/* Frames shall be matched once the cameras run in lockstep. */
+		if (matched_ < 20) {
+			cout << "Only " << matched_ << " framesets matched" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unsigned int bufferCount_ = 0;
+	unsigned int delivered_[CameraCount] = {};
+	unsigned int matched_ = 0;
+	bool invalid_ = false;
+};
+
+TEST_REGISTER(CameraGroupTest)
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * completion_handler.cpp - Per-request completion handler test
+ */
+
+#include <iostream>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that requests with a completion handler are delivered to their
+ * handler only, and that other requests are broadcast through the camera
+ * requestCompleted signal.
+ */
+class CompletionHandlerTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->cookie() == HandledCookie)
+			misrouted_++;
+		broadcast_++;
+	}
+
+	void handledRequestComplete(Request *request,
+				    const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->cookie() != HandledCookie)
+			misrouted_++;
+		handled_++;
+
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		/* The handler shall be preserved when reusing the request. */
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to prepare camera" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &CompletionHandlerTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/* Use a completion handler for all requests but one. */
+		Stream *stream = config->at(0).stream();
+		for (unsigned int i = 0; i < config->at(0).bufferCount; ++i) {
+			Request *request;
+
+			if (i) {
+				request = camera_->createRequest(HandledCookie);
+				request->setCompletionHandler(
+					[this](Request *req, const std::map<Stream *, Buffer *> &buffers) {
+						handledRequestComplete(req, buffers);
+					});
+			} else {
+				request = camera_->createRequest();
+			}
+
+			request->addBuffer(stream->createBuffer(i));
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(500);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+
+		if (misrouted_) {
+			cout << misrouted_ << " requests delivered to the wrong handler"
+			     << endl;
+			return TestFail;
+		}
+
+		if (broadcast_ != 1 || handled_ < 10) {
+			cout << "Unexpected completions: " << broadcast_
+			     << " broadcast, " << handled_ << " handled" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	static constexpr uint64_t HandledCookie = 1;
+
+	unsigned int broadcast_ = 0;
+	unsigned int handled_ = 0;
+	unsigned int misrouted_ = 0;
+};
+
+TEST_REGISTER(CompletionHandlerTest)
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * config_cache.cpp - Configuration validation cache test
+ */
+
+#include <iostream>
+
+#include <libcamera/libcamera.h>
+#include <libcamera/metrics.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that validating identical configurations hits the validation cache,
+ * and that cached results match the results of a full validation.
+ */
+class ConfigCacheTest : public VirtualCameraTest
+{
+protected:
+	int64_t counter(const std::string &name)
+	{
+		MetricsSnapshot snapshot = metricsSnapshot();
+		const MetricValue *value = snapshot.find(name);
+		return value ? value->value : 0;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> first =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		std::unique_ptr<CameraConfiguration> second =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!first || !second) {
+			cout << "Failed to generate configurations" << endl;
+			return TestFail;
+		}
+
+		first->at(0).size = { 641, 481 };
+		second->at(0).size = { 641, 481 };
+
+		int64_t hits = counter("config-cache.hits");
+		int64_t misses = counter("config-cache.misses");
+
+		/* The first validation computes the result. */
+		if (first->validate() != CameraConfiguration::Adjusted ||
+		    first->at(0).size != Size(640, 480)) {
+			cout << "Failed to adjust configuration" << endl;
+			return TestFail;
+		}
+
+		if (counter("config-cache.misses") != misses + 1) {
+			cout << "Validation didn't miss the cache" << endl;
+			return TestFail;
+		}
+
+		/* The second one uses the cached result. */
+		if (second->validate() != CameraConfiguration::Adjusted ||
+		    second->at(0).toString() != first->at(0).toString() ||
+		    second->at(0).bufferCount != first->at(0).bufferCount) {
+			cout << "Invalid cached result" << endl;
+			return TestFail;
+		}
+
+		if (counter("config-cache.hits") != hits + 1) {
+			cout << "Validation didn't hit the cache" << endl;
+			return TestFail;
+		}
+
+		/* The adjusted configuration is valid, and is cached too. */
+		if (second->validate() != CameraConfiguration::Valid ||
+		    first->validate() != CameraConfiguration::Valid ||
+		    counter("config-cache.hits") != hits + 2) {
+			cout << "Failed to validate adjusted configuration" << endl;
+			return TestFail;
+		}
+
+		/* The cached result shall be usable to configure the camera. */
+		if (camera_->configure(second.get())) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		if (!second->at(0).stream()) {
+			cout << "No stream assigned" << endl;
+			return TestFail;
+		}
+
+		/* Validation preserves the assigned streams. */
+		Stream *stream = second->at(0).stream();
+		if (second->validate() != CameraConfiguration::Valid ||
+		    second->at(0).stream() != stream) {
+			cout << "Stream lost by cached validation" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ConfigCacheTest)
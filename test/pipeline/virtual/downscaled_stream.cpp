@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * downscaled_stream.cpp - Software downscaled stream test
+ */
+
+#include <iostream>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the virtual camera produces a secondary stream downscaled from
+ * the captured frames, along with the captured stream.
+ */
+class DownscaledStreamTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.at(stream_);
+		Buffer *scaled = buffers.at(scaledStream_);
+
+		if (scaled->status() != Buffer::BufferSuccess ||
+		    scaled->bytesused() != 160 * 120 * 3 / 2 ||
+		    scaled->sequence() != buffer->sequence()) {
+			error_ = "Invalid downscaled buffer metadata";
+			return;
+		}
+
+		const uint8_t *src =
+			static_cast<const uint8_t *>(buffer->mem()->planes()[0].mem());
+		const uint8_t *dst =
+			static_cast<const uint8_t *>(scaled->mem()->planes()[0].mem());
+
+		/* Each luma sample averages a 4x4 block of the captured frame. */
+		for (unsigned int y = 0; y < 120; ++y) {
+			for (unsigned int x = 0; x < 160; ++x) {
+				unsigned int sum = 0;
+
+				for (unsigned int i = 0; i < 16; ++i)
+					sum += src[(y * 4 + i / 4) * 640 + x * 4 + i % 4];
+
+				if (dst[y * 160 + x] != (sum + 8) / 16) {
+					error_ = "Invalid luma at " +
+						 std::to_string(x) + "x" +
+						 std::to_string(y);
+					return;
+				}
+			}
+		}
+
+		for (unsigned int i = 160 * 120; i < 160 * 120 * 3 / 2; ++i) {
+			if (dst[i] != 128) {
+				error_ = "Invalid chroma";
+				return;
+			}
+		}
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &DownscaledStreamTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording,
+							 StreamRole::Viewfinder });
+		if (!config || config->size() != 2) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		StreamConfiguration &scaledCfg = config->at(1);
+
+		/* The downscaled stream uses the captured format and size. */
+		cfg.size = { 640, 480 };
+		scaledCfg.pixelFormat = V4L2_PIX_FMT_YUYV;
+		scaledCfg.size = { 1280, 720 };
+
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    scaledCfg.pixelFormat != cfg.pixelFormat ||
+		    scaledCfg.size != cfg.size) {
+			cout << "Failed to adjust downscaled stream" << endl;
+			return TestFail;
+		}
+
+		scaledCfg.size = { 161, 121 };
+
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    scaledCfg.size != Size(160, 120)) {
+			cout << "Failed to align downscaled stream" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		if (scaledCfg.stride != 160) {
+			cout << "Invalid downscaled stream stride" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		stream_ = cfg.stream();
+		scaledStream_ = scaledCfg.stream();
+		completed_ = 0;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream_->createBuffer(i));
+			request->addBuffer(scaledStream_->createBuffer(i));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(300);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 3) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		/* The latency of the downscaling stage is reported per frame. */
+		MetricsSnapshot snapshot = metricsSnapshot();
+		const MetricValue *latency =
+			snapshot.find("camera." + camera_->name() +
+				      ".stage.downscale.latency-us");
+		if (!latency || latency->histogram.total() < completed_) {
+			cout << "Stage latency not reported" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	Stream *stream_;
+	Stream *scaledStream_;
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(DownscaledStreamTest)
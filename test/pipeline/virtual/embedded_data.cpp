@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * embedded_data.cpp - Sensor embedded data stream test
+ */
+
+#include <iostream>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the embedded data stream of the virtual camera is captured along
+ * with the image stream, and reports the sensor state each frame has been
+ * captured with.
+ */
+class EmbeddedDataTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *image = request->findBuffer(imageStream_);
+		Buffer *embedded = request->findBuffer(embeddedStream_);
+		if (!image || !embedded) {
+			error_ = "Missing buffer in completed request";
+			return;
+		}
+
+		/* Parse the tag and value pairs, see pipeline/virtual.cpp. */
+		const uint32_t *data =
+			static_cast<const uint32_t *>(embedded->mem()->planes()[0].mem());
+		uint32_t sequence = UINT32_MAX;
+		uint32_t duration = 0;
+
+		for (unsigned int i = 0; i < embedded->bytesused() / 8 && data[i * 2]; ++i) {
+			switch (data[i * 2]) {
+			case 1:
+				sequence = data[i * 2 + 1];
+				break;
+			case 2:
+				duration = data[i * 2 + 1];
+				break;
+			}
+		}
+
+		if (sequence != image->sequence() ||
+		    embedded->sequence() != image->sequence())
+			error_ = "Embedded data sequence mismatch";
+		else if (duration != 10000)
+			error_ = "Invalid frame duration " + std::to_string(duration);
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &EmbeddedDataTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording,
+							 StreamRole::EmbeddedData });
+		if (!config || config->size() != 2) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config.get())) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		imageStream_ = config->at(0).stream();
+		embeddedStream_ = config->at(1).stream();
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		completed_ = 0;
+
+		for (unsigned int i = 0; i < config->at(0).bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(imageStream_->createBuffer(i));
+			request->addBuffer(embeddedStream_->createBuffer(i));
+			request->controls().set(controls::FrameDuration, 10000);
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 5) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	Stream *imageStream_;
+	Stream *embeddedStream_;
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(EmbeddedDataTest)
@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * format_modifier.cpp - Tiled format capture test
+ */
+
+#include <iostream>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "formats.h"
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that format modifiers are validated, and that the virtual camera
+ * captures NV12 frames with the 16x16 tiled layout.
+ */
+class FormatModifierTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.begin()->second;
+		const uint8_t *mem =
+			static_cast<const uint8_t *>(buffer->mem()->planes()[0].mem());
+		const unsigned int offset = buffer->sequence() * 4;
+
+		/* Check the horizontal luma gradient, see pipeline/virtual.cpp. */
+		for (unsigned int y = 0; y < size_.height; ++y) {
+			for (unsigned int x = 0; x < size_.width; ++x) {
+				unsigned int index = y / 16 * size_.width * 16
+						   + x / 16 * 256 + y % 16 * 16
+						   + x % 16;
+				if (mem[index] != ((x + offset) & 0xff)) {
+					error_ = "Invalid luma at " +
+						 std::to_string(x) + "x" +
+						 std::to_string(y);
+					return;
+				}
+			}
+		}
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &FormatModifierTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+
+		/* Modifiers are only supported for NV12. */
+		cfg.pixelFormat = V4L2_PIX_FMT_YUYV;
+		cfg.modifier = FormatModSamsung16x16Tile;
+
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    cfg.modifier != FormatModLinear) {
+			cout << "Failed to adjust YUYV modifier" << endl;
+			return TestFail;
+		}
+
+		/* Unsupported modifiers are adjusted to linear. */
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		cfg.modifier = FormatModSamsung64x32Tile;
+
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    cfg.modifier != FormatModLinear) {
+			cout << "Failed to adjust unsupported modifier" << endl;
+			return TestFail;
+		}
+
+		/* The size of tiled formats is aligned to the tile size. */
+		cfg.modifier = FormatModSamsung16x16Tile;
+		cfg.size = { 648, 486 };
+
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    cfg.modifier != FormatModSamsung16x16Tile ||
+		    cfg.size != Size(640, 480)) {
+			cout << "Failed to validate tiled format" << endl;
+			return TestFail;
+		}
+
+		size_ = cfg.size;
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		completed_ = 0;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 3) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	Size size_;
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(FormatModifierTest)
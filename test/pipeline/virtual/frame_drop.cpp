@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * frame_drop.cpp - Frame drop policy test
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <time.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+uint64_t currentTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+} /* namespace */
+
+/*
+ * Verify that frame drop policies bound the latency of completed requests
+ * delivered to an application slower than the camera, and that dropped
+ * requests are queued again without being delivered.
+ */
+class FrameDropTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.begin()->second;
+		if (delivered_ && buffer->sequence() <= lastSequence_)
+			outOfOrder_ = true;
+		lastSequence_ = buffer->sequence();
+
+		uint64_t age = currentTime() - buffer->timestamp();
+		maxAge_ = std::max(maxAge_, age);
+		delivered_++;
+
+		/* Simulate a consumer three times slower than the camera. */
+		if (slow_)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		if (!running_)
+			return;
+
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			queueFailed_ = true;
+	}
+
+	int capture(const FrameDropPolicy &policy, bool slow)
+	{
+		config_->at(0).dropPolicy = policy;
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		if (!allocated_) {
+			if (camera_->allocateBuffers()) {
+				cout << "Failed to allocate buffers" << endl;
+				return TestFail;
+			}
+			allocated_ = true;
+		}
+
+		slow_ = slow;
+		delivered_ = 0;
+		maxAge_ = 0;
+		dropped_ = camera_->statistics().requestsDropped;
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		running_ = true;
+
+		Stream *stream = config_->at(0).stream();
+		for (unsigned int i = 0; i < config_->at(0).bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+			if (camera_->queueRequest(request)) {
+				delete request;
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		running_ = false;
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		dropped_ = camera_->statistics().requestsDropped - dropped_;
+
+		if (queueFailed_ || outOfOrder_) {
+			cout << "Requests failed to queue or delivered out of order"
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &FrameDropTest::requestComplete);
+
+		FrameDropPolicy policy;
+
+		/* Without a policy, the latency grows with the backlog. */
+		if (capture(policy, true) != TestPass)
+			return TestFail;
+
+		if (dropped_) {
+			cout << "Requests dropped without a policy" << endl;
+			return TestFail;
+		}
+
+		uint64_t keepAllAge = maxAge_;
+
+		/* Dropping the oldest requests delivers the most recent frames. */
+		policy.mode = FrameDropPolicy::DropOldest;
+		policy.maxPending = 1;
+		if (capture(policy, true) != TestPass)
+			return TestFail;
+
+		if (!dropped_ || maxAge_ >= keepAllAge) {
+			cout << "DropOldest: " << dropped_ << " dropped, latency "
+			     << maxAge_ / 1000 << "us vs. " << keepAllAge / 1000
+			     << "us" << endl;
+			return TestFail;
+		}
+
+		/* Dropping the newest requests keeps the backlog bounded. */
+		policy.mode = FrameDropPolicy::DropNewest;
+		if (capture(policy, true) != TestPass)
+			return TestFail;
+
+		if (!dropped_ || !delivered_) {
+			cout << "DropNewest: " << dropped_ << " dropped, "
+			     << delivered_ << " delivered" << endl;
+			return TestFail;
+		}
+
+		/* Decimation applies regardless of the consumer speed. */
+		policy.mode = FrameDropPolicy::KeepEveryNth;
+		policy.interval = 3;
+		if (capture(policy, false) != TestPass)
+			return TestFail;
+
+		if (delivered_ < 5 || dropped_ < delivered_ * 2 - 2 ||
+		    dropped_ > delivered_ * 2 + 2) {
+			cout << "KeepEveryNth: " << dropped_ << " dropped, "
+			     << delivered_ << " delivered" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::unique_ptr<CameraConfiguration> config_;
+	bool allocated_ = false;
+
+	bool running_ = false;
+	bool slow_ = false;
+	unsigned int delivered_ = 0;
+	unsigned int lastSequence_ = 0;
+	uint64_t maxAge_ = 0;
+	uint64_t dropped_ = 0;
+	bool queueFailed_ = false;
+	bool outOfOrder_ = false;
+};
+
+TEST_REGISTER(FrameDropTest)
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * frame_start.cpp - Frame start notification test
+ */
+
+#include <iostream>
+#include <map>
+#include <stdint.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the start of every captured frame is notified before the
+ * buffers it is captured to complete, with the sequence number of the buffers.
+ */
+class FrameStartTest : public VirtualCameraTest
+{
+protected:
+	void frameStarted(unsigned int sequence, uint64_t timestamp)
+	{
+		if (!started_.empty() && sequence <= started_.rbegin()->first)
+			error_ = "Invalid frame start sequence";
+
+		started_[sequence] = timestamp;
+	}
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.begin()->second;
+		auto it = started_.find(buffer->sequence());
+		if (it == started_.end()) {
+			error_ = "Frame start not notified before completion";
+			return;
+		}
+
+		if (it->second > buffer->timestamp()) {
+			error_ = "Frame started after its buffer timestamp";
+			return;
+		}
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers() || camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		camera_->frameStarted.connect(this, &FrameStartTest::frameStarted);
+		camera_->requestCompleted.connect(this, &FrameStartTest::requestComplete);
+
+		Stream *stream = config->at(0).stream();
+
+		for (unsigned int i = 0; i < config->at(0).bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(300);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 3) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		/* No frame start is notified once the camera is stopped. */
+		unsigned int count = started_.size();
+
+		timer.start(100);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (started_.size() != count) {
+			cout << "Frame start notified after stop" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::map<unsigned int, uint64_t> started_;
+	unsigned int completed_ = 0;
+	std::string error_;
+};
+
+TEST_REGISTER(FrameStartTest)
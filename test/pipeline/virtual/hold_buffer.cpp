@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * hold_buffer.cpp - Held buffer lifetime test
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that completed buffers can be held past the lifetime of their
+ * request, shared between consumers in different threads, and that they are
+ * returned to the camera's recycle handler when the last handle is dropped.
+ */
+class HoldBufferTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		std::shared_ptr<Buffer> buffer = request->holdBuffer(stream_);
+		if (!buffer || !buffer->timestamp()) {
+			failed_ = true;
+			return;
+		}
+
+		/* A buffer can only be held once. */
+		if (request->holdBuffer(stream_)) {
+			failed_ = true;
+			return;
+		}
+
+		completed_++;
+
+		/*
+		 * Share the buffer between a preview, which keeps the last frame
+		 * until the next one arrives, and an encoder thread.
+		 */
+		preview_ = buffer;
+
+		std::lock_guard<std::mutex> locker(mutex_);
+		queue_.push_back(buffer);
+		cv_.notify_one();
+	}
+
+	void recycleBuffer(std::unique_ptr<Buffer> buffer)
+	{
+		if (std::this_thread::get_id() != mainThread_)
+			failed_ = true;
+
+		recycled_++;
+
+		Request *request = camera_->createRequest();
+		request->addBuffer(std::move(buffer));
+		if (camera_->queueRequest(request)) {
+			delete request;
+			failed_ = true;
+		}
+	}
+
+	void encode()
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+
+		while (true) {
+			cv_.wait(locker, [&]() { return stop_ || !queue_.empty(); });
+			if (stop_)
+				break;
+
+			std::shared_ptr<Buffer> buffer = std::move(queue_.front());
+			queue_.pop_front();
+
+			locker.unlock();
+
+			if (!buffer->mem()->planes()[0].mem())
+				encodeFailed_ = true;
+			else
+				encoded_++;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			buffer.reset();
+
+			locker.lock();
+		}
+
+		queue_.clear();
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		mainThread_ = std::this_thread::get_id();
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to prepare camera" << endl;
+			return TestFail;
+		}
+
+		stream_ = config->at(0).stream();
+
+		camera_->requestCompleted.connect(this, &HoldBufferTest::requestComplete);
+		camera_->setRecycleHandler([this](std::unique_ptr<Buffer> buffer) {
+			recycleBuffer(std::move(buffer));
+		});
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < config->at(0).bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream_->createBuffer(i));
+			if (camera_->queueRequest(request)) {
+				delete request;
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		std::thread encoder(&HoldBufferTest::encode, this);
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !failed_)
+			dispatcher->processEvents();
+
+		{
+			std::lock_guard<std::mutex> locker(mutex_);
+			stop_ = true;
+			cv_.notify_one();
+		}
+		encoder.join();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		/* Buffers returned while the camera is stopped are dropped. */
+		unsigned int recycled = recycled_;
+		preview_.reset();
+		dispatcher->processEvents();
+
+		if (recycled_ != recycled) {
+			cout << "Buffer recycled to stopped camera" << endl;
+			return TestFail;
+		}
+
+		if (failed_ || encodeFailed_) {
+			cout << "Failed to hold or recycle buffers" << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 20 || encoded_ < 20 || recycled_ < 20) {
+			cout << "Only " << completed_ << " buffers held, "
+			     << encoded_ << " encoded and " << recycled_
+			     << " recycled" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		camera_->setRecycleHandler(nullptr);
+		VirtualCameraTest::cleanup();
+	}
+
+private:
+	Stream *stream_ = nullptr;
+	std::thread::id mainThread_;
+
+	std::shared_ptr<Buffer> preview_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<std::shared_ptr<Buffer>> queue_;
+	bool stop_ = false;
+
+	unsigned int completed_ = 0;
+	unsigned int recycled_ = 0;
+	std::atomic<unsigned int> encoded_{ 0 };
+	std::atomic<bool> encodeFailed_{ false };
+	bool failed_ = false;
+};
+
+TEST_REGISTER(HoldBufferTest)
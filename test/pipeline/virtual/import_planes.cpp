@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * import_planes.cpp - Imported planes sharing a dmabuf test
+ */
+
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the planes of a buffer imported with a single dmabuf for both
+ * colour planes of an NV12 frame are mapped at their offset in the dmabuf, with
+ * their own length.
+ */
+class ImportPlanesTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.begin()->second;
+		std::vector<Plane> &planes = buffer->mem()->planes();
+		if (planes.size() != 2) {
+			error_ = "Invalid number of planes";
+			return;
+		}
+
+		const uint8_t *luma = static_cast<const uint8_t *>(planes[0].mem());
+		const uint8_t *chroma = static_cast<const uint8_t *>(planes[1].mem());
+		if (!luma || chroma != luma + lumaSize_) {
+			error_ = "Chroma plane not mapped after the luma plane";
+			return;
+		}
+
+		if (planes[0].length() != lumaSize_ ||
+		    planes[1].length() != lumaSize_ / 2 ||
+		    planes[1].offset() != lumaSize_) {
+			error_ = "Invalid plane layout";
+			return;
+		}
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &ImportPlanesTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		cfg.size = { 640, 480 };
+		cfg.memoryType = ExternalMemory;
+
+		if (config->validate() != CameraConfiguration::Valid) {
+			cout << "Failed to validate configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		lumaSize_ = cfg.size.width * cfg.size.height;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			int fd = memfd_create("import-planes", MFD_CLOEXEC);
+			if (fd < 0 || ftruncate(fd, lumaSize_ * 3 / 2) < 0) {
+				cout << "Failed to allocate frame buffer" << endl;
+				if (fd >= 0)
+					close(fd);
+				return TestFail;
+			}
+
+			fds_.push_back(fd);
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		completed_ = 0;
+
+		for (int fd : fds_) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer({ fd, fd, -1 }));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 3) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		VirtualCameraTest::cleanup();
+
+		for (int fd : fds_)
+			close(fd);
+	}
+
+private:
+	std::vector<int> fds_;
+	unsigned int lumaSize_;
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(ImportPlanesTest)
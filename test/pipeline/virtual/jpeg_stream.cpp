@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * jpeg_stream.cpp - JPEG still capture stream test
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the virtual camera produces a JPEG stream for the StillCapture
+ * role, encoded from the captured frames.
+ */
+class JpegStreamTest : public VirtualCameraTest
+{
+protected:
+	static constexpr unsigned int Width = 640;
+	static constexpr unsigned int Height = 480;
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.at(stream_);
+		Buffer *jpeg = buffers.at(jpegStream_);
+		const unsigned int size = jpeg->bytesused();
+
+		if (jpeg->status() != Buffer::BufferSuccess || size < 4 ||
+		    jpeg->sequence() != buffer->sequence()) {
+			error_ = "Invalid JPEG buffer metadata";
+			return;
+		}
+
+		const uint8_t *src =
+			static_cast<const uint8_t *>(buffer->mem()->planes()[0].mem());
+		const uint8_t *data =
+			static_cast<const uint8_t *>(jpeg->mem()->planes()[0].mem());
+
+		/* The image is delimited by the SOI and EOI markers. */
+		if (data[0] != 0xff || data[1] != 0xd8 ||
+		    data[size - 2] != 0xff || data[size - 1] != 0xd9) {
+			error_ = "Invalid JPEG image";
+			return;
+		}
+
+		/* The decoded image matches the captured frame. */
+		std::vector<uint8_t> decoded(decoder_.frameSize());
+		if (decoder_.decode(data, size, decoded.data(), decoded.size()) < 0) {
+			error_ = "Failed to decode JPEG image";
+			return;
+		}
+
+		for (unsigned int i = 0; i < Width * Height; ++i) {
+			if (abs(decoded[i] - src[i]) > 8) {
+				error_ = "Invalid JPEG image content";
+				return;
+			}
+		}
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		if (!JpegEncoder::isSupported())
+			return TestSkip;
+
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &JpegStreamTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording,
+							 StreamRole::StillCapture });
+		if (!config || config->size() != 2) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		StreamConfiguration &jpegCfg = config->at(1);
+
+		if (jpegCfg.pixelFormat != V4L2_PIX_FMT_JPEG) {
+			cout << "Still capture role not encoded" << endl;
+			return TestFail;
+		}
+
+		/* The JPEG stream has the captured size. */
+		cfg.size = { Width, Height };
+		jpegCfg.size = { 320, 240 };
+
+		if (config->validate() != CameraConfiguration::Adjusted ||
+		    jpegCfg.size != cfg.size) {
+			cout << "Failed to adjust JPEG stream" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		if (decoder_.configure(cfg.size, V4L2_PIX_FMT_NV12)) {
+			cout << "Failed to configure decoder" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		stream_ = cfg.stream();
+		jpegStream_ = jpegCfg.stream();
+		completed_ = 0;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream_->createBuffer(i));
+			request->addBuffer(jpegStream_->createBuffer(i));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(300);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 3) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	JpegDecoder decoder_;
+	Stream *stream_;
+	Stream *jpegStream_;
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(JpegStreamTest)
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * queue_requests.cpp - Bulk request queuing test
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that batches of requests are queued and complete in order, and that
+ * a batch containing an invalid request is rejected as a whole.
+ */
+class QueueRequestsTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() == Request::RequestComplete) {
+			if (request->cookie() != expected_)
+				outOfOrder_ = true;
+			expected_ = (expected_ + 1) % bufferCount_;
+
+			completed_++;
+		}
+
+		request->reuse(Request::ReuseBuffers);
+		idle_.push_back(request);
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to prepare camera" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &QueueRequestsTest::requestComplete);
+
+		Stream *stream = config->at(0).stream();
+		bufferCount_ = config->at(0).bufferCount;
+
+		for (unsigned int i = 0; i < bufferCount_; ++i) {
+			Request *request = camera_->createRequest(i);
+			request->addBuffer(stream->createBuffer(i));
+			idle_.push_back(request);
+		}
+
+		if (camera_->queueRequests(idle_) != -EACCES) {
+			cout << "Requests queued to stopped camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		/* A batch with an invalid request shall be rejected. */
+		std::vector<Request *> batch = idle_;
+		std::unique_ptr<Request> invalid{ camera_->createRequest() };
+		batch.push_back(invalid.get());
+
+		if (camera_->queueRequests(batch) != -EINVAL) {
+			cout << "Invalid batch not rejected" << endl;
+			return TestFail;
+		}
+
+		/* So shall a batch with a control value out of range. */
+		invalid->addBuffer(stream->createBuffer(0));
+		invalid->controls().set(controls::FrameDuration, 1);
+
+		if (camera_->queueRequests(batch) != -EINVAL) {
+			cout << "Out of range control not rejected" << endl;
+			return TestFail;
+		}
+
+		Timer timer;
+		timer.start(100);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (completed_) {
+			cout << "Requests of invalid batch completed" << endl;
+			return TestFail;
+		}
+
+		/* Requeue completed requests in batches of two. */
+		timer.start(1000);
+		while (timer.isRunning()) {
+			if (idle_.size() >= 2 || idle_.size() == bufferCount_) {
+				std::vector<Request *> requests;
+				requests.swap(idle_);
+
+				if (camera_->queueRequests(requests)) {
+					cout << "Failed to queue requests" << endl;
+					return TestFail;
+				}
+			}
+
+			dispatcher->processEvents();
+		}
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 20) {
+			cout << "Only " << completed_ << " requests completed" << endl;
+			return TestFail;
+		}
+
+		if (outOfOrder_) {
+			cout << "Requests completed out of order" << endl;
+			return TestFail;
+		}
+
+		if (idle_.size() != bufferCount_) {
+			cout << "Requests lost" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		for (Request *request : idle_)
+			delete request;
+
+		VirtualCameraTest::cleanup();
+	}
+
+private:
+	std::vector<Request *> idle_;
+	unsigned int bufferCount_ = 0;
+	unsigned int completed_ = 0;
+	uint64_t expected_ = 0;
+	bool outOfOrder_ = false;
+};
+
+TEST_REGISTER(QueueRequestsTest)
@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * reconfigure.cpp - Prepared camera reconfiguration test
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that a camera can be reconfigured after its buffers have been
+ * allocated, that the buffers are reused when they fit the new configuration,
+ * reallocated otherwise, and that the camera captures frames in all cases.
+ * Configuring an unchanged configuration shall keep the active streams.
+ */
+class ReconfigureTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int configure(const Size &size)
+	{
+		config_->at(0).size = size;
+		if (config_->validate() != CameraConfiguration::Valid) {
+			cout << "Invalid configuration " << size.toString() << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to configure camera to "
+			     << size.toString() << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int capture()
+	{
+		StreamConfiguration &cfg = config_->at(0);
+		Stream *stream = cfg.stream();
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		completed_ = 0;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+			request->controls().set(controls::FrameDuration, 10000);
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+
+		if (completed_ < 5) {
+			cout << "Captured " << completed_ << " frames at "
+			     << cfg.size.toString() << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::vector<int> dmabufs()
+	{
+		std::vector<int> fds;
+
+		for (BufferMemory &mem : config_->at(0).stream()->buffers())
+			fds.push_back(mem.planes().empty() ? -1 : mem.planes()[0].dmabuf());
+
+		return fds;
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &ReconfigureTest::requestComplete);
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_) {
+			cout << "Failed to generate configuration" << endl;
+			VirtualCameraTest::cleanup();
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (configure({ 1280, 720 }) != TestPass)
+			return TestFail;
+
+		if (camera_->allocateBuffers()) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		if (capture() != TestPass)
+			return TestFail;
+
+		/* Switching to a smaller size shall reuse the buffers. */
+		std::vector<int> fds = dmabufs();
+
+		if (configure({ 640, 480 }) != TestPass)
+			return TestFail;
+
+		if (dmabufs() != fds) {
+			cout << "Buffers reallocated when shrinking" << endl;
+			return TestFail;
+		}
+
+		if (capture() != TestPass)
+			return TestFail;
+
+		/* Switching to a larger size shall reallocate the buffers. */
+		if (configure({ 1920, 1080 }) != TestPass)
+			return TestFail;
+
+		for (BufferMemory &mem : config_->at(0).stream()->buffers()) {
+			if (mem.planes().empty() ||
+			    mem.planes()[0].length() < 1920 * 1080) {
+				cout << "Buffers too small after growing" << endl;
+				return TestFail;
+			}
+		}
+
+		if (capture() != TestPass)
+			return TestFail;
+
+		/* An unchanged configuration shall keep the streams and buffers. */
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		config->at(0).size = config_->at(0).size;
+
+		fds = dmabufs();
+
+		if (config->validate() != CameraConfiguration::Valid ||
+		    camera_->configure(config.get())) {
+			cout << "Failed to configure unchanged configuration" << endl;
+			return TestFail;
+		}
+
+		if (config->at(0).stream() != config_->at(0).stream() ||
+		    config->at(0).stride != config_->at(0).stride ||
+		    dmabufs() != fds) {
+			cout << "Unchanged configuration not kept" << endl;
+			return TestFail;
+		}
+
+		if (capture() != TestPass)
+			return TestFail;
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::unique_ptr<CameraConfiguration> config_;
+	unsigned int completed_;
+};
+
+TEST_REGISTER(ReconfigureTest)
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * recycle_buffer.cpp - Early buffer recycling test
+ */
+
+#include <errno.h>
+#include <iostream>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that completed buffers can be queued again in new requests from the
+ * buffer completion handler, before their request completes.
+ */
+class RecycleBufferTest : public VirtualCameraTest
+{
+protected:
+	void bufferComplete(Request *request, Buffer *buffer)
+	{
+		if (buffer->status() != Buffer::BufferSuccess)
+			return;
+
+		std::unique_ptr<Buffer> recycled = request->recycleBuffer(stream_);
+		if (!recycled || recycled->index() != buffer->index()) {
+			failed_ = true;
+			return;
+		}
+
+		/* A buffer can only be recycled once. */
+		if (request->recycleBuffer(stream_)) {
+			failed_ = true;
+			return;
+		}
+
+		Request *next = camera_->createRequest();
+		next->addBuffer(std::move(recycled));
+		int ret = camera_->queueRequest(next);
+		if (ret) {
+			delete next;
+
+			/*
+			 * Buffers completed right before stop() are delivered
+			 * once the camera has left the Running state, and
+			 * queueing them is then rejected with -EACCES.
+			 */
+			if (ret == -EACCES)
+				rejected_++;
+			else
+				failed_ = true;
+			return;
+		}
+
+		recycled_++;
+	}
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		/* The recycled buffer shall keep its metadata. */
+		Buffer *buffer = request->findBuffer(stream_);
+		if (!buffer || !buffer->timestamp())
+			failed_ = true;
+
+		completed_++;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to prepare camera" << endl;
+			return TestFail;
+		}
+
+		stream_ = config->at(0).stream();
+
+		camera_->bufferCompleted.connect(this, &RecycleBufferTest::bufferComplete);
+		camera_->requestCompleted.connect(this, &RecycleBufferTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < config->at(0).bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream_->createBuffer(i));
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(500);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (rejected_) {
+			cout << "Recycled buffers rejected while running" << endl;
+			return TestFail;
+		}
+
+		camera_->stop();
+
+		if (failed_) {
+			cout << "Failed to recycle buffers" << endl;
+			return TestFail;
+		}
+
+		if (recycled_ < 10 || completed_ < recycled_) {
+			cout << "Unexpected completions: " << recycled_
+			     << " recycled, " << completed_ << " completed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	Stream *stream_ = nullptr;
+	unsigned int recycled_ = 0;
+	unsigned int completed_ = 0;
+	unsigned int rejected_ = 0;
+	bool failed_ = false;
+};
+
+TEST_REGISTER(RecycleBufferTest)
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * scaler_crop.cpp - Scaler crop control test
+ */
+
+#include <iostream>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the scaler crop region is adjusted to the frame, applies to the
+ * request it is set in and to all subsequent requests, and is reported in
+ * the request metadata.
+ */
+class ScalerCropTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		const Rectangle expected = { 320, 100, 320, 240 };
+		const Rectangle crop = request->metadata().get(controls::ScalerCrop);
+		if (crop != expected) {
+			error_ = "Invalid crop metadata " + crop.toString();
+			return;
+		}
+
+		Buffer *buffer = buffers.begin()->second;
+		const uint8_t *mem =
+			static_cast<const uint8_t *>(buffer->mem()->planes()[0].mem());
+		const unsigned int offset = buffer->sequence() * 4;
+
+		/* The gradient of the crop region is upscaled 2 times. */
+		for (unsigned int x = 0; x < 640; ++x) {
+			if (mem[x] != ((crop.x + x / 2 + offset) & 0xff)) {
+				error_ = "Invalid luma at " + std::to_string(x);
+				return;
+			}
+		}
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &ScalerCropTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (!camera_->controls().count(ScalerCrop)) {
+			cout << "Scaler crop control not supported" << endl;
+			return TestFail;
+		}
+
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		cfg.size = { 640, 480 };
+
+		if (config->validate() != CameraConfiguration::Valid) {
+			cout << "Failed to validate configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		completed_ = 0;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+
+			/* The region exceeds the frame and is moved inside it. */
+			if (i == 0)
+				request->controls().set(controls::ScalerCrop,
+							Rectangle{ 600, 100, 320, 240 });
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(300);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ <= cfg.bufferCount) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(ScalerCropTest)
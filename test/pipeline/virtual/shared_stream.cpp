@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * shared_stream.cpp - Shared stream test
+ */
+
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Share the stream of a virtual camera with two consumers, one that releases
+ * the frames it receives and one that never does. Verify that the slow
+ * consumer only causes frames to be dropped, and that the frames received by
+ * the other consumer match the captured data. A third consumer connects
+ * through a Unix socket, as clients of a camera server do.
+ */
+class SharedStreamTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completed_++;
+
+		shared_->queueBuffer(buffers.begin()->second);
+	}
+
+	void bufferReleased(unsigned int index)
+	{
+		if (queueBuffer(index))
+			queueFailed_ = true;
+	}
+
+	void frameAvailable(SharedStreamConsumer *consumer,
+			    const SharedStreamConsumer::Frame &frame)
+	{
+		if (consumer == &remote_) {
+			remoteFrames_++;
+			consumer->release(frame.index);
+			return;
+		}
+
+		if (consumer == &slow_) {
+			slowFrames_++;
+			return;
+		}
+
+		fastFrames_++;
+
+		const void *data = consumer->map(frame.index, 0);
+		BufferMemory &mem = stream_->buffers()[frame.index];
+		if (!data || memcmp(data, mem.planes()[0].mem(), 64))
+			dataMismatch_ = true;
+
+		consumer->release(frame.index);
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		config->at(0).bufferCount = 4;
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to prepare camera" << endl;
+			return TestFail;
+		}
+
+		stream_ = config->at(0).stream();
+		shared_.reset(new SharedStream(stream_));
+		shared_->bufferReleased.connect(this, &SharedStreamTest::bufferReleased);
+
+		if (connectConsumer(&fast_) || connectConsumer(&slow_))
+			return TestFail;
+
+		/* Consumers can also connect through a Unix socket. */
+		std::string path = "/tmp/libcamera-test-shared-stream-" +
+				   std::to_string(getpid());
+		if (shared_->listen(path) || remote_.connect(path)) {
+			cout << "Failed to connect consumer through socket" << endl;
+			return TestFail;
+		}
+
+		remote_.frameAvailable.connect(this, &SharedStreamTest::frameAvailable);
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+		Timer timer;
+
+		timer.start(100);
+		while (timer.isRunning() &&
+		       !(fast_.isConfigured() && slow_.isConfigured() &&
+			 remote_.isConfigured()))
+			dispatcher->processEvents();
+
+		if (!fast_.isConfigured() || !slow_.isConfigured() ||
+		    !remote_.isConfigured() || shared_->consumers() != 3 ||
+		    fast_.bufferCount() != config->at(0).bufferCount ||
+		    fast_.size() != config->at(0).size) {
+			cout << "Consumers not configured" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &SharedStreamTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < config->at(0).bufferCount; ++i) {
+			if (queueBuffer(i)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (queueFailed_) {
+			cout << "Failed to requeue released request" << endl;
+			return TestFail;
+		}
+
+		if (slowFrames_ != 2 || shared_->droppedFrames() < 10) {
+			cout << "Slow consumer not throttled: " << slowFrames_
+			     << " frames, " << shared_->droppedFrames()
+			     << " dropped" << endl;
+			return TestFail;
+		}
+
+		if (fastFrames_ < 20 || fastFrames_ + 2 < completed_) {
+			cout << "Fast consumer received " << fastFrames_ << " of "
+			     << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		if (remoteFrames_ < 20) {
+			cout << "Socket consumer received " << remoteFrames_
+			     << " frames" << endl;
+			return TestFail;
+		}
+
+		if (dataMismatch_) {
+			cout << "Shared frame data mismatch" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		fast_.disconnect();
+		slow_.disconnect();
+		remote_.disconnect();
+		shared_.reset();
+
+		VirtualCameraTest::cleanup();
+	}
+
+private:
+	int queueBuffer(unsigned int index)
+	{
+		Request *request = camera_->createRequest();
+		request->addBuffer(stream_->createBuffer(index));
+
+		return camera_->queueRequest(request);
+	}
+
+	int connectConsumer(SharedStreamConsumer *consumer)
+	{
+		int fd = shared_->addConsumer();
+		if (fd < 0 || consumer->connect(fd)) {
+			cout << "Failed to connect consumer" << endl;
+			return -1;
+		}
+
+		consumer->frameAvailable.connect(this, &SharedStreamTest::frameAvailable);
+		return 0;
+	}
+
+	Stream *stream_ = nullptr;
+
+	std::unique_ptr<SharedStream> shared_;
+	SharedStreamConsumer fast_;
+	SharedStreamConsumer slow_;
+	SharedStreamConsumer remote_;
+
+	unsigned int completed_ = 0;
+	unsigned int fastFrames_ = 0;
+	unsigned int slowFrames_ = 0;
+	unsigned int remoteFrames_ = 0;
+	bool queueFailed_ = false;
+	bool dataMismatch_ = false;
+};
+
+TEST_REGISTER(SharedStreamTest)
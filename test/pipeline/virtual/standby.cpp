@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * standby.cpp - Camera standby test
+ */
+
+#include <iostream>
+#include <time.h>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+uint64_t currentTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+} /* namespace */
+
+/*
+ * Verify that a camera put in standby cancels its requests, rejects new ones,
+ * keeps the virtual sensor streaming, and resumes capture within a couple of
+ * frame intervals.
+ */
+class StandbyTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		if (!firstFrame_)
+			firstFrame_ = currentTime();
+
+		completed_++;
+		sequence_ = buffers.begin()->second->sequence();
+
+		/* Requests completing while entering standby can't be queued. */
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			idle_.push_back(request);
+	}
+
+	void processEvents(unsigned int ms)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(ms);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int capture()
+	{
+		uint64_t start = currentTime();
+		firstFrame_ = 0;
+		completed_ = 0;
+		idle_.clear();
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (Request *request : requests_) {
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+		requests_.clear();
+
+		processEvents(200);
+
+		if (!completed_) {
+			cout << "No request completed" << endl;
+			return TestFail;
+		}
+
+		startLatency_ = (firstFrame_ - start) / 1000000;
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to prepare camera" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &StandbyTest::requestComplete);
+
+		Stream *stream = config->at(0).stream();
+		unsigned int bufferCount = config->at(0).bufferCount;
+
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+			requests_.push_back(request);
+		}
+
+		int ret = capture();
+		if (ret != TestPass)
+			return ret;
+
+		for (unsigned int cycle = 0; cycle < 3; ++cycle) {
+			std::vector<Request *> cancelled;
+
+			if (camera_->standby(&cancelled)) {
+				cout << "Failed to put camera in standby" << endl;
+				return TestFail;
+			}
+
+			if (cancelled.size() + idle_.size() != bufferCount) {
+				cout << "Cycle " << cycle << ": " << cancelled.size()
+				     << " requests cancelled" << endl;
+				return TestFail;
+			}
+
+			for (Request *request : cancelled)
+				request->reuse(Request::ReuseBuffers);
+
+			requests_ = cancelled;
+			requests_.insert(requests_.end(), idle_.begin(), idle_.end());
+
+			if (camera_->queueRequest(requests_.front()) != -EACCES) {
+				cout << "Request queued in standby" << endl;
+				return TestFail;
+			}
+
+			unsigned int sequence = sequence_;
+
+			completed_ = 0;
+			processEvents(200);
+
+			if (completed_) {
+				cout << "Request completed in standby" << endl;
+				return TestFail;
+			}
+
+			ret = capture();
+			if (ret != TestPass)
+				return ret;
+
+			/*
+			 * The virtual sensor keeps streaming in standby, frames
+			 * captured meanwhile are discarded.
+			 */
+			if (sequence_ < sequence + 5) {
+				cout << "Sensor stopped in standby" << endl;
+				return TestFail;
+			}
+
+			/* Capture resumes within one frame interval of 33ms. */
+			if (startLatency_ > 66) {
+				cout << "Capture resumed in " << startLatency_
+				     << "ms" << endl;
+				return TestFail;
+			}
+		}
+
+		/* The camera can be stopped from standby. */
+		std::vector<Request *> cancelled;
+		if (camera_->standby(&cancelled) || camera_->stop()) {
+			cout << "Failed to stop camera from standby" << endl;
+			return TestFail;
+		}
+
+		requests_ = cancelled;
+		requests_.insert(requests_.end(), idle_.begin(), idle_.end());
+
+		if (camera_->freeBuffers()) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		for (Request *request : requests_)
+			delete request;
+
+		VirtualCameraTest::cleanup();
+	}
+
+private:
+	std::vector<Request *> requests_;
+	std::vector<Request *> idle_;
+	unsigned int completed_ = 0;
+	unsigned int sequence_ = 0;
+	uint64_t firstFrame_ = 0;
+	uint64_t startLatency_ = 0;
+};
+
+TEST_REGISTER(StandbyTest)
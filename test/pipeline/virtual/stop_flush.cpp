@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * stop_flush.cpp - Bulk request cancellation test
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that stopping the camera can collect all cancelled requests at once,
+ * and that they can be queued again after restarting the camera.
+ */
+class StopFlushTest : public VirtualCameraTest
+{
+protected:
+	void bufferComplete(Request *request, Buffer *buffer)
+	{
+		if (buffer->status() == Buffer::BufferCancelled)
+			notified_++;
+	}
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete) {
+			notified_++;
+			return;
+		}
+
+		completed_++;
+
+		/* Requests completing while stopping can't be queued again. */
+		request->reuse(Request::ReuseBuffers);
+		if (camera_->queueRequest(request))
+			idle_.push_back(request);
+	}
+
+	int capture(std::vector<Request *> *cancelled)
+	{
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (Request *request : requests_) {
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop(cancelled)) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config || camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to prepare camera" << endl;
+			return TestFail;
+		}
+
+		camera_->bufferCompleted.connect(this, &StopFlushTest::bufferComplete);
+		camera_->requestCompleted.connect(this, &StopFlushTest::requestComplete);
+
+		Stream *stream = config->at(0).stream();
+		unsigned int bufferCount = config->at(0).bufferCount;
+
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			Request *request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+			requests_.push_back(request);
+		}
+
+		/*
+		 * Cycle the camera a few times, queuing the requests collected
+		 * when stopping again after restarting.
+		 */
+		for (unsigned int cycle = 0; cycle < 3; ++cycle) {
+			std::vector<Request *> cancelled;
+
+			completed_ = 0;
+			idle_.clear();
+
+			int ret = capture(&cancelled);
+			if (ret != TestPass)
+				return ret;
+
+			if (notified_) {
+				cout << "Cancelled requests notified individually"
+				     << endl;
+				return TestFail;
+			}
+
+			if (!completed_ ||
+			    cancelled.size() + idle_.size() != bufferCount) {
+				cout << "Cycle " << cycle << ": " << completed_
+				     << " requests completed, " << cancelled.size()
+				     << " cancelled" << endl;
+				return TestFail;
+			}
+
+			for (Request *request : cancelled) {
+				if (request->status() != Request::RequestCancelled) {
+					cout << "Invalid cancelled request status" << endl;
+					return TestFail;
+				}
+
+				request->reuse(Request::ReuseBuffers);
+			}
+
+			requests_ = cancelled;
+			requests_.insert(requests_.end(), idle_.begin(), idle_.end());
+			idle_.clear();
+		}
+
+		/* Without a vector, cancelled requests are notified individually. */
+		int ret = capture(nullptr);
+		requests_ = idle_;
+		if (ret != TestPass)
+			return ret;
+
+		if (!notified_) {
+			cout << "Cancelled requests not notified" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		for (Request *request : requests_)
+			delete request;
+
+		VirtualCameraTest::cleanup();
+	}
+
+private:
+	std::vector<Request *> requests_;
+	std::vector<Request *> idle_;
+	unsigned int completed_ = 0;
+	unsigned int notified_ = 0;
+};
+
+TEST_REGISTER(StopFlushTest)
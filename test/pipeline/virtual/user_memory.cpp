@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * user_memory.cpp - Capture to application memory test
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the virtual camera captures frames in place to memory allocated
+ * by the application and backing buffers of a UserPtrMemory stream.
+ */
+class UserMemoryTest : public VirtualCameraTest
+{
+protected:
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.begin()->second;
+		const uint8_t *mem =
+			static_cast<const uint8_t *>(buffer->mem()->planes()[0].mem());
+		if (mem != memory_[buffer->index()].data()) {
+			error_ = "Frame not captured to application memory";
+			return;
+		}
+
+		/* Check the horizontal luma gradient, see pipeline/virtual.cpp. */
+		const unsigned int offset = buffer->sequence() * 4;
+		for (unsigned int x = 0; x < width_; ++x) {
+			if (mem[x] != ((x + offset) & 0xff)) {
+				error_ = "Invalid luma at " + std::to_string(x);
+				return;
+			}
+		}
+
+		completed_++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		int ret = VirtualCameraTest::init();
+		if (ret)
+			return ret;
+
+		camera_->requestCompleted.connect(this, &UserMemoryTest::requestComplete);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		std::unique_ptr<CameraConfiguration> config =
+			camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config) {
+			cout << "Failed to generate configuration" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration &cfg = config->at(0);
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		cfg.size = { 640, 480 };
+		cfg.memoryType = UserPtrMemory;
+
+		if (config->validate() != CameraConfiguration::Valid) {
+			cout << "Failed to validate configuration" << endl;
+			return TestFail;
+		}
+
+		width_ = cfg.size.width;
+
+		if (camera_->configure(config.get()) ||
+		    camera_->allocateBuffers()) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = cfg.stream();
+		const unsigned int frameSize = cfg.size.width * cfg.size.height * 3 / 2;
+
+		/* Buffers without application memory can't be captured to. */
+		Request *request = camera_->createRequest();
+		request->addBuffer(stream->createBuffer(0));
+		if (camera_->start() || !camera_->queueRequest(request)) {
+			cout << "Buffer without memory queued" << endl;
+			return TestFail;
+		}
+		camera_->stop();
+		delete request;
+
+		for (BufferMemory &mem : stream->buffers()) {
+			memory_.emplace_back(frameSize);
+			mem.planes().emplace_back();
+			if (mem.planes().back().setUserPtr(memory_.back().data(),
+							   frameSize)) {
+				cout << "Failed to set user memory" << endl;
+				return TestFail;
+			}
+		}
+
+		if (stream->memoryUsage().imported != frameSize * memory_.size() ||
+		    stream->memoryUsage().mapped) {
+			cout << "Invalid memory usage" << endl;
+			return TestFail;
+		}
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		completed_ = 0;
+
+		for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+			request = camera_->createRequest();
+			request->addBuffer(stream->createBuffer(i));
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(200);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		camera_->stop();
+		camera_->freeBuffers();
+
+		if (!error_.empty()) {
+			cout << error_ << endl;
+			return TestFail;
+		}
+
+		if (completed_ < 3) {
+			cout << "Captured " << completed_ << " frames" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::vector<std::vector<uint8_t>> memory_;
+	unsigned int width_;
+	unsigned int completed_;
+	std::string error_;
+};
+
+TEST_REGISTER(UserMemoryTest)
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * libcamera virtual camera tests
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+
+#include "virtual_camera_test.h"
+
+using namespace libcamera;
+using namespace std;
+
+int VirtualCameraTest::init()
+{
+	setenv("LIBCAMERA_VIRTUAL_CAMERAS", to_string(count_).c_str(), 1);
+
+	cm_ = CameraManager::instance();
+
+	if (cm_->start()) {
+		cout << "Failed to start camera manager" << endl;
+		return TestFail;
+	}
+
+	for (unsigned int i = 0; i < count_; ++i) {
+		std::shared_ptr<Camera> camera =
+			cm_->get("Virtual " + to_string(i));
+		if (!camera) {
+			cout << "Virtual camera " << i << " not found" << endl;
+			return TestFail;
+		}
+
+		if (camera->acquire()) {
+			cout << "Failed to acquire virtual camera " << i << endl;
+			return TestFail;
+		}
+
+		cameras_.push_back(camera);
+	}
+
+	camera_ = cameras_.front();
+
+	return TestPass;
+}
+
+void VirtualCameraTest::cleanup()
+{
+	for (std::shared_ptr<Camera> &camera : cameras_) {
+		camera->freeBuffers();
+		camera->release();
+	}
+
+	cameras_.clear();
+	camera_.reset();
+
+	if (cm_)
+		cm_->stop();
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * virtual_camera_test.h - libcamera virtual camera test base class
+ */
+#ifndef __LIBCAMERA_VIRTUAL_CAMERA_TEST_H__
+#define __LIBCAMERA_VIRTUAL_CAMERA_TEST_H__
+
+#include <memory>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "test.h"
+
+using namespace libcamera;
+
+class VirtualCameraTest : public Test
+{
+public:
+	VirtualCameraTest(unsigned int count = 1)
+		: cm_(nullptr), count_(count) {}
+
+protected:
+	int init();
+	void cleanup();
+
+	CameraManager *cm_;
+	/* The first virtual camera, and all the virtual cameras, acquired. */
+	std::shared_ptr<Camera> camera_;
+	std::vector<std::shared_ptr<Camera>> cameras_;
+
+private:
+	unsigned int count_;
+};
+
+#endif /* __LIBCAMERA_VIRTUAL_CAMERA_TEST_H__ */
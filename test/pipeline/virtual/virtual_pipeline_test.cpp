@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * virtual_pipeline_test.cpp - Virtual cameras pipeline test
+ */
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "virtual_camera_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * Verify that the virtual pipeline handler creates the number of cameras
+ * requested through the LIBCAMERA_VIRTUAL_CAMERAS environment variable, and
+ * that all of them can capture frames concurrently.
+ */
+class VirtualPipelineTest : public VirtualCameraTest
+{
+public:
+	VirtualPipelineTest()
+		: VirtualCameraTest(CameraCount) {}
+
+protected:
+	static constexpr unsigned int CameraCount = 8;
+
+	void requestComplete(Request *request, const std::map<Stream *, Buffer *> &buffers)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		Buffer *buffer = buffers.begin()->second;
+		Stream *stream = buffers.begin()->first;
+		Camera *camera = streamCameras_[stream];
+
+		/* Sequence numbers shall increase monotonically. */
+		auto iter = sequences_.find(camera);
+		if (iter != sequences_.end() && buffer->sequence() <= iter->second)
+			outOfOrder_ = true;
+		sequences_[camera] = buffer->sequence();
+
+		/* The metadata shall report the sensor timestamp. */
+		const ControlList &metadata = request->metadata();
+		if (!metadata.contains(SensorTimestamp) ||
+		    metadata.get(controls::SensorTimestamp) !=
+		    static_cast<int64_t>(buffer->timestamp()))
+			badMetadata_ = true;
+
+		completed_[camera]++;
+
+		request->reuse(Request::ReuseBuffers);
+		camera->queueRequest(request);
+	}
+
+	int run()
+	{
+		unsigned int count = 0;
+		for (const std::shared_ptr<Camera> &camera : cm_->cameras()) {
+			if (camera->name().find("Virtual ") == 0)
+				count++;
+		}
+
+		if (count != CameraCount) {
+			cout << "Found " << count << " virtual cameras, "
+			     << "expected " << CameraCount << endl;
+			return TestFail;
+		}
+
+		outOfOrder_ = false;
+		badMetadata_ = false;
+
+		for (std::shared_ptr<Camera> &camera : cameras_) {
+			if (cm_->get(camera->name()) != camera ||
+			    cm_->get(camera->id()) != camera) {
+				cout << "Failed to look up " << camera->name() << endl;
+				return TestFail;
+			}
+
+			std::unique_ptr<CameraConfiguration> config =
+				camera->generateConfiguration({ StreamRole::VideoRecording });
+			if (!config) {
+				cout << "Failed to generate configuration" << endl;
+				return TestFail;
+			}
+
+			/* Map the buffers with all hints to exercise them. */
+			const unsigned int mapFlags = Plane::MapPopulate |
+						      Plane::MapSequential |
+						      Plane::MapHugePages;
+			config->at(0).mapFlags = mapFlags;
+
+			if (camera->configure(config.get())) {
+				cout << "Failed to configure " << camera->name() << endl;
+				return TestFail;
+			}
+
+			if (config->at(0).stride < config->at(0).size.width) {
+				cout << "Invalid stride " << config->at(0).stride
+				     << " for " << camera->name() << endl;
+				return TestFail;
+			}
+
+			if (camera->allocateBuffers()) {
+				cout << "Failed to allocate buffers" << endl;
+				return TestFail;
+			}
+
+			StreamConfiguration &cfg = config->at(0);
+			Stream *stream = cfg.stream();
+
+			for (const BufferMemory &mem : stream->buffers()) {
+				if (mem.planes()[0].mapFlags() != mapFlags) {
+					cout << "Mapping flags not applied" << endl;
+					return TestFail;
+				}
+			}
+			streamCameras_[stream] = camera.get();
+
+			camera->requestCompleted.connect(this, &VirtualPipelineTest::requestComplete);
+
+			if (camera->start()) {
+				cout << "Failed to start " << camera->name() << endl;
+				return TestFail;
+			}
+
+			for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+				Request *request = camera->createRequest();
+				request->addBuffer(stream->createBuffer(i));
+
+				/* Capture at 100fps. */
+				request->controls().set(controls::FrameDuration, 10000);
+
+				if (camera->queueRequest(request)) {
+					cout << "Failed to queue request" << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(500);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		/* Frames are generated by the CPU in buffers allocated internally. */
+		uint64_t allocated = 0;
+		for (std::shared_ptr<Camera> &camera : cameras_) {
+			MemoryUsage usage = camera->memoryUsage();
+			if (usage.allocated < 4 * 1280 * 720 * 3 / 2 ||
+			    usage.imported || !usage.mapped ||
+			    usage.mapped > usage.allocated) {
+				cout << "Invalid memory usage for " << camera->name()
+				     << ": " << usage.toString() << endl;
+				return TestFail;
+			}
+
+			allocated += usage.allocated;
+		}
+
+		if (cm_->memoryUsage().allocated != allocated) {
+			cout << "Invalid process memory usage" << endl;
+			return TestFail;
+		}
+
+		for (std::shared_ptr<Camera> &camera : cameras_) {
+			camera->stop();
+			camera->freeBuffers();
+
+			if (camera->memoryUsage().allocated) {
+				cout << "Memory not freed for " << camera->name()
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		for (std::shared_ptr<Camera> &camera : cameras_) {
+			if (completed_[camera.get()] < 10) {
+				cout << camera->name() << " captured "
+				     << completed_[camera.get()] << " frames" << endl;
+				return TestFail;
+			}
+
+			/* All queued requests shall be accounted for. */
+			CameraStatistics stats = camera->statistics();
+			if (stats.requestsCompleted != completed_[camera.get()] ||
+			    stats.requestsQueued != stats.requestsCompleted +
+						    stats.requestsCancelled ||
+			    stats.queueDepth.total() != stats.requestsQueued ||
+			    stats.requestLatency.total() != stats.requestsQueued ||
+			    stats.startLatency.total() != 1 ||
+			    !stats.firstFrameLatency.total()) {
+				cout << "Invalid statistics for " << camera->name()
+				     << endl << stats.toString() << endl;
+				return TestFail;
+			}
+		}
+
+		if (outOfOrder_) {
+			cout << "Frames completed out of order" << endl;
+			return TestFail;
+		}
+
+		if (badMetadata_) {
+			cout << "Invalid request metadata" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::map<Stream *, Camera *> streamCameras_;
+	std::map<Camera *, unsigned int> completed_;
+	std::map<Camera *, unsigned int> sequences_;
+	bool outOfOrder_;
+	bool badMetadata_;
+};
+
+TEST_REGISTER(VirtualPipelineTest)
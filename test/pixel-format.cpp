@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * pixel-format.cpp - Pixel format and pixel format information tests
+ */
+
+#include <iostream>
+#include <sstream>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/stream.h>
+
+#include "formats.h"
+#include "test.h"
+#include "v4l2_subdevice.h"
+#include "v4l2_videodevice.h"
+
+using namespace std;
+using namespace libcamera;
+
+class PixelFormatTest : public Test
+{
+protected:
+	template<typename T>
+	static std::string print(const T &value)
+	{
+		std::stringstream ss;
+		ss << value;
+		return ss.str();
+	}
+
+	int testPixelFormat()
+	{
+		static_assert(PixelFormat('N', 'V', '1', '2').fourcc() == V4L2_PIX_FMT_NV12,
+			      "Invalid constexpr fourcc");
+		static_assert(PixelFormat('Y', 'U', 'Y', 'V') == PixelFormat(V4L2_PIX_FMT_YUYV),
+			      "Invalid constexpr comparison");
+
+		if (print(PixelFormat(V4L2_PIX_FMT_NV12)) != "NV12" ||
+		    print(PixelFormat(0x01020304)) != "0x01020304") {
+			cerr << "Invalid pixel format formatting" << endl;
+			return TestFail;
+		}
+
+		/* Formatting shall not leak into the stream state. */
+		std::stringstream ss;
+		ss << PixelFormat(1) << " " << 10;
+		if (ss.str() != "0x00000001 10") {
+			cerr << "Stream state modified: " << ss.str() << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testInfo()
+	{
+		const PixelFormatInfo &nv12 = PixelFormat(V4L2_PIX_FMT_NV12).info();
+		if (!nv12.isValid() || nv12.numPlanes() != 2 ||
+		    nv12.alignment != Size(2, 2) ||
+		    nv12.stride(640) != 640 || nv12.stride(640, 1) != 640 ||
+		    nv12.planeSize({ 640, 480 }, 1) != 640 * 240 ||
+		    nv12.frameSize({ 640, 480 }) != 640 * 480 * 3 / 2) {
+			cerr << "Invalid NV12 information" << endl;
+			return TestFail;
+		}
+
+		const PixelFormatInfo &yuyv = PixelFormatInfo::info(V4L2_PIX_FMT_YUYV);
+		if (yuyv.stride(640) != 1280 ||
+		    yuyv.frameSize({ 640, 480 }) != 640 * 480 * 2 ||
+		    yuyv.alignment != Size(2, 1)) {
+			cerr << "Invalid YUYV information" << endl;
+			return TestFail;
+		}
+
+		const PixelFormatInfo &yuv420 = PixelFormatInfo::info(V4L2_PIX_FMT_YUV420);
+		if (yuv420.numPlanes() != 3 || yuv420.stride(640, 2) != 320 ||
+		    yuv420.stride(600, 0, 64) != 640 ||
+		    yuv420.stride(600, 2, 64) != 320 ||
+		    yuv420.frameSize({ 640, 480 }) != 640 * 480 * 3 / 2) {
+			cerr << "Invalid YUV420 information" << endl;
+			return TestFail;
+		}
+
+		/* Packed raw lines are rounded up to whole pixel groups. */
+		const PixelFormatInfo &mipi = PixelFormatInfo::info(V4L2_PIX_FMT_SRGGB10P);
+		const PixelFormatInfo &ipu3 = PixelFormatInfo::info(V4L2_PIX_FMT_IPU3_SRGGB10);
+		if (mipi.stride(6) != 10 || ipu3.stride(26) != 64) {
+			cerr << "Invalid packed raw stride" << endl;
+			return TestFail;
+		}
+
+		if (!PixelFormatInfo::info(V4L2_PIX_FMT_MJPEG).compressed ||
+		    PixelFormatInfo::info(0).isValid()) {
+			cerr << "Invalid format validity" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testFormats()
+	{
+		StreamConfiguration cfg;
+		cfg.size = { 1280, 720 };
+		cfg.pixelFormat = V4L2_PIX_FMT_NV12;
+		cfg.modifier = 0;
+
+		if (print(cfg) != "1280x720-NV12" || cfg.toString() != print(cfg)) {
+			cerr << "Invalid stream configuration formatting: "
+			     << cfg << endl;
+			return TestFail;
+		}
+
+		V4L2DeviceFormat format = {};
+		format.size = { 640, 480 };
+		format.fourcc = V4L2_PIX_FMT_YUYV;
+		format.modifier = 0x10;
+
+		if (print(format) != "640x480-YUYV-0x0000000000000010") {
+			cerr << "Invalid device format formatting: " << format
+			     << endl;
+			return TestFail;
+		}
+
+		/* Multiplanar formats use one memory plane per colour plane. */
+		format.fourcc = V4L2_PIX_FMT_NV12M;
+		if (format.computePlanes(256) || format.planesCount != 2 ||
+		    format.planes[0].bpl != 768 || format.planes[1].bpl != 768 ||
+		    format.planes[0].size != 768 * 480 ||
+		    format.planes[1].size != 768 * 240) {
+			cerr << "Invalid NV12M planes layout" << endl;
+			return TestFail;
+		}
+
+		format.fourcc = V4L2_PIX_FMT_NV12;
+		if (format.computePlanes() || format.planesCount != 1 ||
+		    format.planes[0].bpl != 640 ||
+		    format.planes[0].size != 640 * 480 * 3 / 2) {
+			cerr << "Invalid NV12 planes layout" << endl;
+			return TestFail;
+		}
+
+		format.fourcc = V4L2_PIX_FMT_MJPEG;
+		if (!format.computePlanes()) {
+			cerr << "Planes layout computed for compressed format"
+			     << endl;
+			return TestFail;
+		}
+
+		V4L2SubdeviceFormat subdevFormat = {};
+		subdevFormat.size = { 640, 480 };
+		subdevFormat.mbus_code = 0x100a;
+
+		if (print(subdevFormat) != "640x480-0x100a") {
+			cerr << "Invalid subdevice format formatting: "
+			     << subdevFormat << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret;
+
+		ret = testPixelFormat();
+		if (ret)
+			return ret;
+
+		ret = testInfo();
+		if (ret)
+			return ret;
+
+		return testFormats();
+	}
+};
+
+TEST_REGISTER(PixelFormatTest)
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * process_spawn_benchmark.cpp - Process spawn latency benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/camera_manager.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "process.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+static constexpr unsigned int SpawnCount = 20;
+static constexpr unsigned int OpenFdCount = 1000;
+
+class ProcessSpawnBenchmark : public Test
+{
+protected:
+	int init()
+	{
+		/*
+		 * Raise the file descriptor limit and open descriptors to be
+		 * closed in the child, to account for the cost of a high
+		 * RLIMIT_NOFILE.
+		 */
+		struct rlimit limit;
+		if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+
+		for (unsigned int i = 0; i < OpenFdCount; ++i) {
+			int fd = dup(STDIN_FILENO);
+			if (fd < 0)
+				break;
+			fds_.push_back(fd);
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		EventDispatcher *dispatcher = CameraManager::instance()->eventDispatcher();
+		vector<double> forkTimes;
+		vector<double> exitTimes;
+
+		for (unsigned int i = 0; i < SpawnCount; ++i) {
+			Process proc;
+			Timer timeout;
+
+			proc.finished.connect(this, &ProcessSpawnBenchmark::procFinished);
+			finished_ = false;
+
+			auto start = chrono::steady_clock::now();
+
+			int ret = proc.start("/proc/self/exe", { "child" });
+			if (ret) {
+				cerr << "Failed to start process" << endl;
+				return TestFail;
+			}
+
+			auto started = chrono::steady_clock::now();
+
+			timeout.start(1000);
+			while (!finished_ && timeout.isRunning())
+				dispatcher->processEvents();
+
+			if (!finished_ || exitStatus_ != Process::NormalExit ||
+			    exitCode_ != 0) {
+				cerr << "Process did not exit normally" << endl;
+				return TestFail;
+			}
+
+			auto end = chrono::steady_clock::now();
+
+			forkTimes.push_back(chrono::duration<double, micro>(started - start).count());
+			exitTimes.push_back(chrono::duration<double, micro>(end - start).count());
+		}
+
+		report("start()", forkTimes);
+		report("start to exit", exitTimes);
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		for (int fd : fds_)
+			close(fd);
+	}
+
+private:
+	void report(const char *name, vector<double> &times)
+	{
+		sort(times.begin(), times.end());
+
+		double total = 0;
+		for (double time : times)
+			total += time;
+
+		cout << name << ": min " << times.front() << "us, median "
+		     << times[times.size() / 2] << "us, max " << times.back()
+		     << "us, mean " << total / times.size() << "us ("
+		     << fds_.size() << " open fds)" << endl;
+	}
+
+	void procFinished(Process *proc, enum Process::ExitStatus exitStatus,
+			  int exitCode)
+	{
+		finished_ = true;
+		exitStatus_ = exitStatus;
+		exitCode_ = exitCode;
+	}
+
+	vector<int> fds_;
+
+	bool finished_;
+	enum Process::ExitStatus exitStatus_;
+	int exitCode_;
+};
+
+/*
+ * Can't use TEST_REGISTER() as single binary needs to act as both
+ * parent and child processes.
+ */
+int main(int argc, char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "child"))
+		return EXIT_SUCCESS;
+
+	return ProcessSpawnBenchmark().execute();
+}
@@ -44,6 +44,13 @@ protected:
 		EventDispatcher *dispatcher = CameraManager::instance()->eventDispatcher();
 		Timer timeout;
 
+		/* Failures to execute the child shall be reported by start(). */
+		Process invalid;
+		if (!invalid.start("/nonexistent")) {
+			cerr << "starting a nonexistent executable succeeded" << endl;
+			return TestFail;
+		}
+
 		int exitCode = 42;
 		vector<std::string> args;
 		args.push_back(to_string(exitCode));
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * raw-unpack.cpp - Packed raw formats unpacking test
+ */
+
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/raw_unpack.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RawUnpackTest : public Test
+{
+protected:
+	static uint16_t sample(unsigned int x, unsigned int y)
+	{
+		return (x * 37 + y * 101) % 1024;
+	}
+
+	int testFrame(unsigned int width, unsigned int height)
+	{
+		/* Pad the packed lines to check the stride handling. */
+		const unsigned int mipiStride = (width + 3) / 4 * 5 + 3;
+		const unsigned int ipu3Stride = (width + 24) / 25 * 32 + 32;
+		std::vector<uint8_t> mipi(mipiStride * height);
+		std::vector<uint8_t> ipu3(ipu3Stride * height);
+
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x) {
+				unsigned int value = sample(x, y);
+
+				uint8_t *group = &mipi[y * mipiStride + x / 4 * 5];
+				group[x % 4] = value >> 2;
+				group[4] |= (value & 3) << (x % 4 * 2);
+
+				uint8_t *block = &ipu3[y * ipu3Stride + x / 25 * 32];
+				unsigned int bit = x % 25 * 10;
+				block[bit / 8] |= (value << (bit % 8)) & 0xff;
+				block[bit / 8 + 1] |= value >> (8 - bit % 8);
+			}
+		}
+
+		const struct {
+			unsigned int format;
+			const std::vector<uint8_t> &data;
+			unsigned int stride;
+		} inputs[] = {
+			{ V4L2_PIX_FMT_SRGGB10P, mipi, mipiStride },
+			{ V4L2_PIX_FMT_IPU3_SRGGB10, ipu3, ipu3Stride },
+		};
+
+		for (const auto &input : inputs) {
+			/* Guard against writes past the end of the frame. */
+			std::vector<uint16_t> output(width * height + 1, 0xffff);
+
+			if (unpackRawFrame(input.format, input.data.data(),
+					   input.stride, output.data(),
+					   { width, height })) {
+				cout << "Failed to unpack format " << input.format
+				     << " at width " << width << endl;
+				return TestFail;
+			}
+
+			for (unsigned int y = 0; y < height; ++y) {
+				for (unsigned int x = 0; x < width; ++x) {
+					if (output[y * width + x] == sample(x, y))
+						continue;
+
+					cout << "Invalid sample (" << x << ", " << y
+					     << ") for format " << input.format
+					     << " at width " << width << endl;
+					return TestFail;
+				}
+			}
+
+			if (output.back() != 0xffff) {
+				cout << "Overflow for format " << input.format
+				     << " at width " << width << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (unpackedRawFormat(V4L2_PIX_FMT_IPU3_SGRBG10) != V4L2_PIX_FMT_SGRBG10 ||
+		    unpackedRawFormat(V4L2_PIX_FMT_SBGGR10P) != V4L2_PIX_FMT_SBGGR10 ||
+		    unpackedRawFormat(V4L2_PIX_FMT_SBGGR10)) {
+			cout << "Invalid unpacked format" << endl;
+			return TestFail;
+		}
+
+		if (packedRawLineSize(V4L2_PIX_FMT_IPU3_SBGGR10, 4224) != 5408 ||
+		    packedRawLineSize(V4L2_PIX_FMT_SBGGR10P, 1922) != 2405) {
+			cout << "Invalid packed line size" << endl;
+			return TestFail;
+		}
+
+		/* Unpacked formats and short strides are rejected. */
+		uint16_t sample;
+		if (!unpackRawLine(V4L2_PIX_FMT_SBGGR10, nullptr, &sample, 1) ||
+		    !unpackRawFrame(V4L2_PIX_FMT_IPU3_SBGGR10, nullptr, 31,
+				    &sample, { 25, 1 })) {
+			cout << "Invalid unpacking accepted" << endl;
+			return TestFail;
+		}
+
+		/* Cover full and partial blocks of both packings. */
+		for (unsigned int width : { 1U, 4U, 7U, 24U, 25U, 50U, 63U, 100U }) {
+			if (testFrame(width, 3) != TestPass)
+				return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(RawUnpackTest)
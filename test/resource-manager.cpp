@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * resource-manager.cpp - Shared hardware resources arbitration test
+ */
+
+#include <iostream>
+#include <limits>
+
+#include "resource_manager.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ResourceManagerTest : public Test
+{
+protected:
+	int run()
+	{
+		ResourceManager resources;
+
+		/* Cameras are only used as keys, fake their addresses. */
+		const Camera *camera0 = reinterpret_cast<const Camera *>(0x1000);
+		const Camera *camera1 = reinterpret_cast<const Camera *>(0x2000);
+
+		resources.setCapacity("isp", 100);
+
+		if (resources.capacity("bus") != numeric_limits<uint64_t>::max() ||
+		    !resources.fits({ { "bus", 1000000 } })) {
+			cout << "Resource without capacity isn't unlimited" << endl;
+			return TestFail;
+		}
+
+		if (resources.fits({ { "isp", 101 } }) ||
+		    !resources.fits({ { "isp", 100 } })) {
+			cout << "Usage not checked against capacity" << endl;
+			return TestFail;
+		}
+
+		resources.reserve(camera0, { { "isp", 60 } });
+
+		if (resources.available("isp", camera1) != 40 ||
+		    resources.fits({ { "isp", 50 } }, camera1) ||
+		    !resources.inUse(camera1)) {
+			cout << "Reservation not accounted for other cameras" << endl;
+			return TestFail;
+		}
+
+		/* The own reservation of a camera is replaced when reserving. */
+		if (resources.available("isp", camera0) != 100 ||
+		    resources.inUse(camera0)) {
+			cout << "Reservation accounted for its own camera" << endl;
+			return TestFail;
+		}
+
+		resources.reserve(camera0, { { "isp", 30 } });
+		resources.reserve(camera1, { { "isp", 70 } });
+
+		if (resources.available("isp") != 0 ||
+		    resources.reserved(camera0).at("isp") != 30) {
+			cout << "Reservation not replaced" << endl;
+			return TestFail;
+		}
+
+		if (!resources.release(camera0) || resources.release(camera0)) {
+			cout << "Failed to release reservation" << endl;
+			return TestFail;
+		}
+
+		if (resources.available("isp") != 30 ||
+		    !resources.reserved(camera0).empty()) {
+			cout << "Reservation not released" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ResourceManagerTest)
@@ -5,6 +5,7 @@
  * signal-threads.cpp - Cross-thread signal delivery test
  */
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <thread>
@@ -54,6 +55,25 @@ private:
 	int value_;
 };
 
+class SignalCounter
+{
+public:
+	SignalCounter()
+		: count_(0)
+	{
+	}
+
+	unsigned int count() const { return count_.load(); }
+
+	void slot(int value)
+	{
+		count_++;
+	}
+
+private:
+	std::atomic<unsigned int> count_;
+};
+
 class SignalThreadsTest : public Test
 {
 protected:
@@ -107,6 +127,46 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Connect and disconnect slots while the signal is emitted from
+		 * another thread.
+		 */
+		SignalCounter emitted;
+		SignalCounter toggled;
+		Signal<int> signal;
+		std::atomic<bool> done(false);
+
+		signal.connect(&emitted, &SignalCounter::slot);
+
+		std::thread emitter([&]() {
+			do {
+				signal.emit(0);
+			} while (!done.load());
+		});
+
+		for (unsigned int i = 0; i < 10000; ++i) {
+			signal.connect(&toggled, &SignalCounter::slot);
+			signal.disconnect(&toggled, &SignalCounter::slot);
+		}
+
+		done.store(true);
+		emitter.join();
+
+		if (!emitted.count()) {
+			cout << "No signal received during concurrent connection"
+			     << endl;
+			return TestFail;
+		}
+
+		signal.emit(0);
+		unsigned int count = toggled.count();
+		signal.emit(0);
+
+		if (toggled.count() != count) {
+			cout << "Signal received by disconnected slot" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * soft-isp.cpp - Software ISP test
+ */
+
+#include <cmath>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "soft_isp.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class SoftIspTest : public Test
+{
+protected:
+	static uint8_t gamma(unsigned int value, unsigned int max)
+	{
+		return lround(255.0 * pow(static_cast<double>(value) / max, 1 / 2.2));
+	}
+
+	static int process(const SoftIsp &isp, const std::vector<uint8_t> &input,
+			   std::vector<uint8_t> *output, const SoftIsp::Gains &gains,
+			   unsigned int bands, SoftIsp::Stats *stats)
+	{
+		const unsigned int height = isp.size().height;
+
+		output->assign(isp.frameSize(), 0);
+		*stats = {};
+
+		for (unsigned int i = 0; i < bands; ++i) {
+			SoftIsp::Stats band;
+			int ret = isp.process(input.data(), input.size(),
+					      output->data(), output->size(), gains,
+					      height * i / bands, height * (i + 1) / bands,
+					      &band);
+			if (ret)
+				return ret;
+
+			for (unsigned int c = 0; c < 3; ++c) {
+				stats->sum[c] += band.sum[c];
+				stats->count[c] += band.count[c];
+			}
+		}
+
+		return 0;
+	}
+
+	int testWhiteBalance()
+	{
+		/* A flat RGGB field with red, green and blue samples. */
+		const unsigned int width = 8;
+		const unsigned int height = 6;
+		const unsigned int values[2][2] = { { 400, 200 }, { 200, 100 } };
+		std::vector<uint8_t> input(width * height * 2);
+
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x) {
+				unsigned int value = values[y % 2][x % 2];
+				input[(y * width + x) * 2] = value & 0xff;
+				input[(y * width + x) * 2 + 1] = value >> 8;
+			}
+		}
+
+		SoftIsp isp;
+		if (isp.configure(V4L2_PIX_FMT_SRGGB10, { width, height },
+				  width * 2, V4L2_PIX_FMT_RGB24)) {
+			cout << "Failed to configure SRGGB10 processing" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> output;
+		SoftIsp::Stats stats;
+		if (process(isp, input, &output, { 256, 256, 256 }, 1, &stats)) {
+			cout << "Failed to process SRGGB10 frame" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < output.size(); i += 3) {
+			if (output[i] != gamma(400, 1023) ||
+			    output[i + 1] != gamma(200, 1023) ||
+			    output[i + 2] != gamma(100, 1023)) {
+				cout << "Invalid demosaiced pixel " << i / 3 << endl;
+				return TestFail;
+			}
+		}
+
+		/* Grey world gains turn the field grey. */
+		SoftIsp::Gains gains = SoftIsp::whiteBalance(stats);
+		if (gains.red != 128 || gains.green != 256 || gains.blue != 512) {
+			cout << "Invalid white balance gains" << endl;
+			return TestFail;
+		}
+
+		if (process(isp, input, &output, gains, 2, &stats)) {
+			cout << "Failed to process SRGGB10 frame" << endl;
+			return TestFail;
+		}
+
+		for (uint8_t value : output) {
+			if (value != gamma(200, 1023)) {
+				cout << "Invalid white balanced frame" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testPacking()
+	{
+		/* Store the same 10-bit frame in all the supported packings. */
+		const unsigned int width = 50;
+		const unsigned int height = 4;
+		std::vector<uint8_t> unpacked(width * height * 2);
+		std::vector<uint8_t> mipi((width + 3) / 4 * 5 * height);
+		std::vector<uint8_t> ipu3((width + 24) / 25 * 32 * height);
+
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x) {
+				unsigned int value = (x * 37 + y * 101) % 1024;
+
+				unpacked[(y * width + x) * 2] = value & 0xff;
+				unpacked[(y * width + x) * 2 + 1] = value >> 8;
+
+				uint8_t *group = &mipi[y * mipi.size() / height + x / 4 * 5];
+				group[x % 4] = value >> 2;
+				group[4] |= (value & 3) << (x % 4 * 2);
+
+				uint8_t *block = &ipu3[y * ipu3.size() / height + x / 25 * 32];
+				unsigned int bit = x % 25 * 10;
+				block[bit / 8] |= (value << (bit % 8)) & 0xff;
+				block[bit / 8 + 1] |= value >> (8 - bit % 8);
+			}
+		}
+
+		const struct {
+			unsigned int format;
+			const std::vector<uint8_t> &data;
+		} inputs[] = {
+			{ V4L2_PIX_FMT_SGRBG10, unpacked },
+			{ V4L2_PIX_FMT_SGRBG10P, mipi },
+			{ V4L2_PIX_FMT_IPU3_SGRBG10, ipu3 },
+		};
+
+		std::vector<uint8_t> reference;
+
+		for (const auto &input : inputs) {
+			SoftIsp isp;
+			if (isp.configure(input.format, { width, height },
+					  input.data.size() / height,
+					  V4L2_PIX_FMT_BGR24)) {
+				cout << "Failed to configure format "
+				     << input.format << endl;
+				return TestFail;
+			}
+
+			std::vector<uint8_t> output;
+			SoftIsp::Stats stats;
+			if (process(isp, input.data, &output, { 256, 256, 256 },
+				    2, &stats)) {
+				cout << "Failed to process format "
+				     << input.format << endl;
+				return TestFail;
+			}
+
+			if (reference.empty()) {
+				reference = output;
+			} else if (output != reference) {
+				cout << "Invalid output for format "
+				     << input.format << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testYUYV()
+	{
+		/* A uniform grey 8-bit frame. */
+		std::vector<uint8_t> input(16 * 4, 128);
+
+		SoftIsp isp;
+		if (isp.configure(V4L2_PIX_FMT_SBGGR8, { 16, 4 }, 16,
+				  V4L2_PIX_FMT_YUYV)) {
+			cout << "Failed to configure SBGGR8 processing" << endl;
+			return TestFail;
+		}
+
+		if (isp.stride() != 32 || isp.frameSize() != 128) {
+			cout << "Invalid YUYV frame size" << endl;
+			return TestFail;
+		}
+
+		std::vector<uint8_t> output;
+		SoftIsp::Stats stats;
+		if (process(isp, input, &output, { 256, 256, 256 }, 1, &stats)) {
+			cout << "Failed to process SBGGR8 frame" << endl;
+			return TestFail;
+		}
+
+		const unsigned int g = gamma(128, 255);
+		const uint8_t luma = ((220 * g + 128) >> 8) + 16;
+
+		for (unsigned int i = 0; i < output.size(); i += 2) {
+			if (output[i] != luma || output[i + 1] != 128) {
+				cout << "Invalid YUYV pixel " << i / 2 << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		SoftIsp isp;
+
+		/* Unsupported formats and odd sizes are rejected. */
+		if (!isp.configure(V4L2_PIX_FMT_YUYV, { 64, 48 }, 128, V4L2_PIX_FMT_RGB24) ||
+		    !isp.configure(V4L2_PIX_FMT_SBGGR8, { 64, 48 }, 64, V4L2_PIX_FMT_NV12) ||
+		    !isp.configure(V4L2_PIX_FMT_SBGGR8, { 63, 48 }, 64, V4L2_PIX_FMT_RGB24) ||
+		    !isp.configure(V4L2_PIX_FMT_SBGGR10, { 64, 48 }, 64, V4L2_PIX_FMT_RGB24)) {
+			cout << "Invalid configuration accepted" << endl;
+			return TestFail;
+		}
+
+		if (testWhiteBalance() != TestPass)
+			return TestFail;
+
+		if (testPacking() != TestPass)
+			return TestFail;
+
+		if (testYUYV() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(SoftIspTest)
@@ -94,6 +94,25 @@ protected:
 			      Size(2560, 2048), Size(3200, 2048), }))
 			return TestFail;
 
+		/* Test the precomputed pixel formats, sizes and ranges. */
+		if (range.pixelformats() != std::vector<unsigned int>{ 1, 2, 3, 4 }) {
+			cout << "Invalid pixel formats" << endl;
+			return TestFail;
+		}
+
+		if (&range.sizes(2) != &range.sizes(2) || !range.sizes(5).empty()) {
+			cout << "Sizes not precomputed" << endl;
+			return TestFail;
+		}
+
+		SizeRange generated = discrete.range(2);
+		if (generated.min != Size(300, 300) ||
+		    generated.max != Size(400, 400) ||
+		    generated.hStep || generated.vStep) {
+			cout << "Invalid range generated from discrete sizes" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
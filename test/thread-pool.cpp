@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * thread-pool.cpp - Thread pool test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <libcamera/camera_manager.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/object.h>
+#include <libcamera/timer.h>
+
+#include "thread.h"
+#include "thread_pool.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class CompletionReceiver : public Object
+{
+public:
+	CompletionReceiver()
+		: count_(0), cookies_(0), invalidThread_(false)
+	{
+	}
+
+	void completed(uint64_t cookie)
+	{
+		if (Thread::current() != thread())
+			invalidThread_ = true;
+
+		count_++;
+		cookies_ += cookie;
+	}
+
+	unsigned int count_;
+	uint64_t cookies_;
+	bool invalidThread_;
+};
+
+class ThreadPoolTest : public Test
+{
+protected:
+	int run()
+	{
+		static constexpr unsigned int NumWork = 100;
+
+		ThreadPool pool(4);
+		if (pool.size() != 4) {
+			cout << "Invalid thread pool size" << endl;
+			return TestFail;
+		}
+
+		CompletionReceiver receiver;
+		pool.completed.connect(&receiver, &CompletionReceiver::completed);
+
+		/*
+		 * Queue work items of uneven durations, and check they all run,
+		 * spread across the workers.
+		 */
+		std::atomic<unsigned int> done(0);
+		std::set<std::thread::id> threads;
+		std::mutex mutex;
+		uint64_t cookies = 0;
+
+		for (unsigned int i = 0; i < NumWork; ++i) {
+			pool.queue([&, i]() {
+				this_thread::sleep_for(chrono::milliseconds(i % 8 ? 1 : 20));
+
+				{
+					std::lock_guard<std::mutex> locker(mutex);
+					threads.insert(this_thread::get_id());
+				}
+
+				done++;
+			}, i + 1);
+
+			cookies += i + 1;
+		}
+
+		pool.wait();
+
+		if (done != NumWork) {
+			cout << "Only " << done << " work items run" << endl;
+			return TestFail;
+		}
+
+		if (threads.size() < 2 || threads.count(this_thread::get_id())) {
+			cout << "Work not spread across workers" << endl;
+			return TestFail;
+		}
+
+		/* Completions are delivered to the receiver in this thread. */
+		Timer timeout;
+		timeout.start(1000);
+		while (receiver.count_ != NumWork && timeout.isRunning())
+			CameraManager::instance()->eventDispatcher()->processEvents();
+
+		if (receiver.count_ != NumWork || receiver.cookies_ != cookies) {
+			cout << "Missing work completions" << endl;
+			return TestFail;
+		}
+
+		if (receiver.invalidThread_) {
+			cout << "Completion delivered in the wrong thread" << endl;
+			return TestFail;
+		}
+
+		/* Work items may queue further work. */
+		done = 0;
+		pool.queue([&]() {
+			for (unsigned int i = 0; i < 10; ++i)
+				pool.queue([&]() { done++; });
+		});
+
+		while (done != 10)
+			this_thread::sleep_for(chrono::milliseconds(1));
+
+		pool.wait();
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ThreadPoolTest)
@@ -7,10 +7,14 @@
 
 #include <chrono>
 #include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <thread>
 
 #include "thread.h"
 #include "test.h"
+#include "utils.h"
 
 using namespace std;
 using namespace libcamera;
@@ -35,6 +39,20 @@ private:
 	unsigned int iterations_;
 };
 
+class AttributesThread : public Thread
+{
+public:
+	char name_[16];
+	cpu_set_t cpus_;
+
+protected:
+	void run()
+	{
+		pthread_getname_np(pthread_self(), name_, sizeof(name_));
+		sched_getaffinity(0, sizeof(cpus_), &cpus_);
+	}
+};
+
 class ThreadTest : public Test
 {
 protected:
@@ -82,6 +100,48 @@ protected:
 
 		delete thread;
 
+		/* Test the thread attributes applied when starting the thread. */
+		AttributesThread attrThread;
+
+		if (attrThread.setName("libcamera-test-thread") ||
+		    attrThread.setAffinity({ 0 }) ||
+		    attrThread.setScheduling(SCHED_OTHER, 0)) {
+			cout << "Failed to set thread attributes" << endl;
+			return TestFail;
+		}
+
+		if (attrThread.setAffinity({ CPU_SETSIZE }) != -EINVAL ||
+		    attrThread.setScheduling(SCHED_OTHER, 1) != -EINVAL) {
+			cout << "Invalid thread attributes accepted" << endl;
+			return TestFail;
+		}
+
+		attrThread.start();
+		attrThread.wait();
+
+		if (strcmp(attrThread.name_, "libcamera-test-")) {
+			cout << "Invalid thread name " << attrThread.name_ << endl;
+			return TestFail;
+		}
+
+		if (CPU_COUNT(&attrThread.cpus_) != 1 ||
+		    !CPU_ISSET(0, &attrThread.cpus_)) {
+			cout << "Invalid thread affinity" << endl;
+			return TestFail;
+		}
+
+		/* Threads can be placed on the CPUs of a NUMA node. */
+		if (utils::numa_node("/dev/null") != -1) {
+			cout << "Invalid NUMA node for memory device" << endl;
+			return TestFail;
+		}
+
+		std::vector<unsigned int> nodeCpus = utils::numa_node_cpus(0);
+		if (!nodeCpus.empty() && attrThread.setAffinity(nodeCpus)) {
+			cout << "Invalid NUMA node CPUs" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -5,7 +5,9 @@
  * timer.cpp - Timer test
  */
 
+#include <chrono>
 #include <iostream>
+#include <vector>
 
 #include <libcamera/camera_manager.h>
 #include <libcamera/event_dispatcher.h>
@@ -52,6 +54,25 @@ private:
 	struct timespec expiration_;
 };
 
+class TimeoutRecorder
+{
+public:
+	TimeoutRecorder(Timer *timer)
+	{
+		timer->timeout.connect(this, &TimeoutRecorder::timeoutHandler);
+	}
+
+	std::vector<chrono::steady_clock::time_point> expirations;
+	std::vector<uint64_t> deadlines;
+
+private:
+	void timeoutHandler(Timer *timer)
+	{
+		expirations.push_back(chrono::steady_clock::now());
+		deadlines.push_back(timer->deadline());
+	}
+};
+
 class TimerTest : public Test
 {
 protected:
@@ -152,6 +173,23 @@ protected:
 			return TestFail;
 		}
 
+		/* Stop a timer that isn't the first one to expire. */
+		timer.start(300);
+		timer2.start(500);
+		timer2.stop();
+
+		dispatcher->processEvents();
+
+		if (timer.isRunning() || timer.jitter() > 50) {
+			cout << "Timer stop test failed" << endl;
+			return TestFail;
+		}
+
+		if (timer2.isRunning()) {
+			cout << "Timer stop test failed" << endl;
+			return TestFail;
+		}
+
 		/*
 		 * Test that dynamically allocated timers are stopped when
 		 * deleted. This will result in a crash on failure.
@@ -163,6 +201,75 @@ protected:
 		timer.start(200);
 		dispatcher->processEvents();
 
+		/* Sub-millisecond duration. */
+		Timer precise;
+		TimeoutRecorder recorder(&precise);
+
+		auto start = chrono::steady_clock::now();
+		precise.start(chrono::microseconds(1500));
+
+		while (precise.isRunning())
+			dispatcher->processEvents();
+
+		if (recorder.expirations.size() != 1 ||
+		    recorder.expirations[0] - start < chrono::microseconds(1500) ||
+		    recorder.expirations[0] - start > chrono::milliseconds(50)) {
+			cout << "Sub-millisecond timer test failed" << endl;
+			return TestFail;
+		}
+
+		/* Absolute deadline. */
+		auto deadline = chrono::steady_clock::now() + chrono::microseconds(2500);
+		precise.start(deadline);
+
+		while (precise.isRunning())
+			dispatcher->processEvents();
+
+		if (recorder.expirations.size() != 2 ||
+		    recorder.expirations[1] < deadline ||
+		    recorder.expirations[1] - deadline > chrono::milliseconds(50)) {
+			cout << "Absolute deadline timer test failed" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Periodic timer, the deadlines shall be spaced by exactly one
+		 * period regardless of the dispatch latency.
+		 */
+		Timer periodic;
+		TimeoutRecorder periodicRecorder(&periodic);
+		constexpr chrono::milliseconds period(10);
+
+		periodic.startPeriodic(period);
+		uint64_t firstDeadline = periodic.deadline();
+
+		while (periodicRecorder.expirations.size() < 10)
+			dispatcher->processEvents();
+
+		if (!periodic.isRunning() || !periodic.isPeriodic() ||
+		    periodic.interval() != 10) {
+			cout << "Periodic timer state test failed" << endl;
+			return TestFail;
+		}
+
+		periodic.stop();
+
+		for (unsigned int i = 0; i < periodicRecorder.deadlines.size(); ++i) {
+			uint64_t expected = firstDeadline +
+					    (i + 1) * chrono::nanoseconds(period).count();
+			if (periodicRecorder.deadlines[i] < expected ||
+			    (periodicRecorder.deadlines[i] - expected) %
+			    chrono::nanoseconds(period).count()) {
+				cout << "Periodic timer drift test failed" << endl;
+				return TestFail;
+			}
+		}
+
+		if (periodic.isRunning()) {
+			cout << "Periodic timer stop test failed" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
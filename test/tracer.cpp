@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * tracer.cpp - Frame latency tracer test
+ */
+
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+
+#include <libcamera/logging.h>
+
+#include "test.h"
+#include "tracer.h"
+
+using namespace std;
+using namespace libcamera;
+
+class TracerTest : public Test
+{
+protected:
+	int init()
+	{
+		/* Enable tracing with a ring buffer of 4 events. */
+		setenv("LIBCAMERA_TRACE", "4", 1);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		Tracer *tracer = Tracer::instance();
+
+		if (!tracer->enabled()) {
+			cout << "Tracing not enabled" << endl;
+			return TestFail;
+		}
+
+		unsigned int source = tracer->registerSource("source");
+		if (tracer->registerSource("other") == source ||
+		    tracer->registerSource("source") != source) {
+			cout << "Invalid source registration" << endl;
+			return TestFail;
+		}
+
+		/* Overflow the ring buffer and check the oldest events are dropped. */
+		for (unsigned int i = 0; i < 6; ++i)
+			tracer->record(Tracer::QueueRequest, source, nullptr);
+
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("Trace", "INFO");
+
+		tracer->dump();
+
+		logSetStream(&cerr);
+
+		string output = log.str();
+		if (output.find("Dumping 4 trace events") == string::npos) {
+			cout << "Invalid trace dump" << endl << output;
+			return TestFail;
+		}
+
+		unsigned int events = 0;
+		size_t pos = 0;
+		while ((pos = output.find("queue-request", pos)) != string::npos) {
+			events++;
+			pos++;
+		}
+
+		if (events != 4) {
+			cout << "Dumped " << events << " events, expected 4" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(TracerTest)
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * libcamera V4L2 Subdevice prepared controls test
+ */
+
+#include <iostream>
+#include <memory>
+
+#include "utils.h"
+#include "v4l2_controls.h"
+#include "v4l2_device.h"
+#include "v4l2_subdevice.h"
+#include "v4l2_subdevice_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+/* Write prepared controls to the "Sensor A" subdevice of vimc media device. */
+
+class PreparedControlsTest : public V4L2SubdeviceTest
+{
+protected:
+	int run() override
+	{
+		MediaEntity *entity = media_->getEntityByName("Sensor A");
+		if (!entity) {
+			cerr << "Unable to find media entity 'Sensor A'" << endl;
+			return TestFail;
+		}
+
+		std::unique_ptr<V4L2Subdevice> sensor =
+			utils::make_unique<V4L2Subdevice>(entity);
+		if (sensor->open()) {
+			cerr << "Unable to open sensor subdevice" << endl;
+			return TestFail;
+		}
+
+		const V4L2ControlInfoMap &info = sensor->controls();
+		if (info.find(V4L2_CID_BRIGHTNESS) == info.end() ||
+		    info.find(V4L2_CID_CONTRAST) == info.end()) {
+			cout << "Sensor doesn't support the test controls" << endl;
+			return TestSkip;
+		}
+
+		V4L2PreparedControls ctrls;
+
+		if (!ctrls.prepare(sensor.get(), { V4L2_CID_BRIGHTNESS, 0 })) {
+			cerr << "Preparing an invalid control should fail" << endl;
+			return TestFail;
+		}
+
+		if (ctrls.isValid()) {
+			cerr << "Failed preparation should invalidate controls" << endl;
+			return TestFail;
+		}
+
+		if (ctrls.prepare(sensor.get(), { V4L2_CID_BRIGHTNESS,
+						  V4L2_CID_CONTRAST })) {
+			cerr << "Failed to prepare controls" << endl;
+			return TestFail;
+		}
+
+		/* Apply the controls through a batch, twice with new values. */
+		V4L2ControlBatch batch;
+		batch.add(&ctrls);
+
+		for (int64_t value : { info.at(V4L2_CID_BRIGHTNESS).min(),
+				       info.at(V4L2_CID_BRIGHTNESS).max() }) {
+			ctrls.setValue(0, value);
+			ctrls.setValue(1, info.at(V4L2_CID_CONTRAST).min());
+
+			if (batch.apply()) {
+				cerr << "Failed to apply controls" << endl;
+				return TestFail;
+			}
+
+			V4L2ControlList list;
+			list.add(V4L2_CID_BRIGHTNESS);
+			list.add(V4L2_CID_CONTRAST);
+
+			if (sensor->getControls(&list)) {
+				cerr << "Failed to read controls" << endl;
+				return TestFail;
+			}
+
+			if (list[V4L2_CID_BRIGHTNESS]->value() != ctrls.value(0) ||
+			    list[V4L2_CID_CONTRAST]->value() != ctrls.value(1)) {
+				cerr << "Controls not applied" << endl;
+				return TestFail;
+			}
+		}
+
+		/*
+		 * Writing the same values again shall be skipped by the control
+		 * cache, both for prepared controls and control lists.
+		 */
+		uint64_t skipped = sensor->skippedControlWrites();
+
+		if (batch.apply()) {
+			cerr << "Failed to apply controls" << endl;
+			return TestFail;
+		}
+
+		V4L2ControlList list;
+		list.add(V4L2_CID_BRIGHTNESS, ctrls.value(0));
+
+		if (sensor->setControls(&list)) {
+			cerr << "Failed to set controls" << endl;
+			return TestFail;
+		}
+
+		if (sensor->skippedControlWrites() != skipped + 2) {
+			cerr << "Redundant control writes not skipped" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Reading the written controls shall be served by the control
+		 * cache, and match the values read from the device.
+		 */
+		skipped = sensor->skippedControlReads();
+
+		V4L2ControlList cached;
+		cached.add(V4L2_CID_BRIGHTNESS);
+		cached.add(V4L2_CID_CONTRAST);
+
+		V4L2ControlList refreshed;
+		refreshed.add(V4L2_CID_BRIGHTNESS);
+		refreshed.add(V4L2_CID_CONTRAST);
+
+		if (sensor->getControls(&cached) ||
+		    sensor->getControls(&refreshed, true)) {
+			cerr << "Failed to read controls" << endl;
+			return TestFail;
+		}
+
+		if (sensor->skippedControlReads() != skipped + 1) {
+			cerr << "Cached control reads not skipped" << endl;
+			return TestFail;
+		}
+
+		if (cached[V4L2_CID_BRIGHTNESS]->value() != refreshed[V4L2_CID_BRIGHTNESS]->value() ||
+		    cached[V4L2_CID_CONTRAST]->value() != refreshed[V4L2_CID_CONTRAST]->value()) {
+			cerr << "Cached control values don't match the device" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(PreparedControlsTest);
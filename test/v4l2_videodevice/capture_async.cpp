@@ -74,10 +74,21 @@ protected:
 
 		std::cout << "Processed " << frames << " frames" << std::endl;
 
+		if (capture_->dequeuedBuffers() != frames ||
+		    capture_->dequeueBatches() > capture_->dequeuedBuffers()) {
+			std::cout << "Invalid dequeue statistics" << std::endl;
+			return TestFail;
+		}
+
 		ret = capture_->streamOff();
 		if (ret)
 			return TestFail;
 
+		if (capture_->queuedBufferCount()) {
+			std::cout << "Buffers still queued after stream off" << std::endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ */
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include <iostream>
+
+#include "v4l2_videodevice_test.h"
+
+/*
+ * Interleave spare buffers queued explicitly with the pool buffers, and verify
+ * that the frames captured into the spare buffers are skipped.
+ */
+class SkipFramesTest : public V4L2VideoDeviceTest
+{
+public:
+	SkipFramesTest()
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0") {}
+
+	void receiveBuffer(Buffer *buffer)
+	{
+		if (buffer->status() == Buffer::BufferSuccess)
+			sequences_.push_back(buffer->sequence());
+	}
+
+protected:
+	int run()
+	{
+		const unsigned int bufferCount = 2;
+
+		EventDispatcher *dispatcher = CameraManager::instance()->eventDispatcher();
+		Timer timeout;
+		int ret;
+
+		pool_.createBuffers(bufferCount);
+
+		capture_->setSpareBufferCount(bufferCount, false);
+
+		ret = capture_->exportBuffers(&pool_);
+		if (ret)
+			return TestFail;
+
+		if (capture_->spareBufferCount() != bufferCount) {
+			std::cout << "Failed to create spare buffers" << std::endl;
+			return TestSkip;
+		}
+
+		capture_->bufferReady.connect(this, &SkipFramesTest::receiveBuffer);
+
+		/* Skip every other frame. */
+		std::vector<std::unique_ptr<Buffer>> buffers;
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			buffers.emplace_back(new Buffer(i));
+
+			if (capture_->queueSpareBuffer() ||
+			    capture_->queueBuffer(buffers.back().get()))
+				return TestFail;
+		}
+
+		if (capture_->queueSpareBuffer() != -ENOBUFS) {
+			std::cout << "Queued more spare buffers than created"
+				  << std::endl;
+			return TestFail;
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		timeout.start(10000);
+		while (timeout.isRunning() && sequences_.size() < bufferCount)
+			dispatcher->processEvents();
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		/* Spare buffers must not be queued automatically. */
+		if (sequences_.size() != bufferCount ||
+		    capture_->spareFrames() != bufferCount) {
+			std::cout << "Captured " << sequences_.size()
+				  << " frames and skipped "
+				  << capture_->spareFrames() << std::endl;
+			return TestFail;
+		}
+
+		if (sequences_[1] - sequences_[0] != 2) {
+			std::cout << "Frame " << sequences_[1] - sequences_[0] - 1
+				  << " not skipped" << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::vector<unsigned int> sequences_;
+};
+
+TEST_REGISTER(SkipFramesTest);
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ */
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include <iostream>
+
+#include "v4l2_videodevice_test.h"
+
+/*
+ * Capture without requeueing buffers, and verify that the device keeps
+ * capturing into the spare buffers, whose frames are dropped.
+ */
+class SpareBuffersTest : public V4L2VideoDeviceTest
+{
+public:
+	SpareBuffersTest()
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames(0) {}
+
+	void receiveBuffer(Buffer *buffer)
+	{
+		if (buffer->status() == Buffer::BufferSuccess)
+			frames++;
+	}
+
+protected:
+	int run()
+	{
+		const unsigned int bufferCount = 4;
+
+		EventDispatcher *dispatcher = CameraManager::instance()->eventDispatcher();
+		Timer timeout;
+		int ret;
+
+		pool_.createBuffers(bufferCount);
+
+		capture_->setSpareBufferCount(1);
+
+		ret = capture_->exportBuffers(&pool_);
+		if (ret)
+			return TestFail;
+
+		if (capture_->spareBufferCount() != 1) {
+			std::cout << "Failed to create spare buffer" << std::endl;
+			return TestSkip;
+		}
+
+		capture_->bufferReady.connect(this, &SpareBuffersTest::receiveBuffer);
+
+		std::vector<std::unique_ptr<Buffer>> buffers;
+		buffers = capture_->queueAllBuffers();
+		if (buffers.empty())
+			return TestFail;
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		timeout.start(10000);
+		while (timeout.isRunning()) {
+			dispatcher->processEvents();
+			if (capture_->spareFrames() > 10)
+				break;
+		}
+
+		if (frames != bufferCount) {
+			std::cout << "Received " << frames << " frames, expected "
+				  << bufferCount << std::endl;
+			return TestFail;
+		}
+
+		if (capture_->spareFrames() <= 10) {
+			std::cout << "Failed to capture to spare buffers" << std::endl;
+			return TestFail;
+		}
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		if (capture_->queuedBufferCount()) {
+			std::cout << "Buffers still queued after stream off" << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unsigned int frames;
+};
+
+TEST_REGISTER(SpareBuffersTest);
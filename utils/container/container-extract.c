@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * container-extract - List and extract frames from cam container files
+ *
+ * Copyright (C) 2019, Google Inc.
+ */
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONTAINER_VERSION	1
+#define INDEX_ENTRY_SIZE	24
+#define TRAILER_SIZE		16
+
+struct frame {
+	uint64_t offset;
+	uint32_t stream;
+	uint32_t sequence;
+	uint64_t timestamp;
+};
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s input-file [frame output-file]\n", basename(argv0));
+	printf("List the streams and frames stored in a cam container file, or\n");
+	printf("extract the data of the frame at the given index to output-file\n");
+}
+
+static int read_bytes(FILE *file, void *data, size_t size)
+{
+	return fread(data, 1, size, file) == size ? 0 : -1;
+}
+
+static uint64_t get_uint(const uint8_t *data, unsigned int size)
+{
+	uint64_t value = 0;
+	unsigned int i;
+
+	for (i = 0; i < size; ++i)
+		value |= (uint64_t)data[i] << (i * 8);
+
+	return value;
+}
+
+/*
+ * Read the frames from the index, or by scanning the records when the index
+ * is missing, which happens when capture has been interrupted.
+ */
+static struct frame *read_frames(FILE *file, uint64_t data_offset,
+				 unsigned int *count)
+{
+	struct frame *frames = NULL;
+	uint8_t trailer[TRAILER_SIZE];
+	uint64_t offset;
+	unsigned int i;
+
+	*count = 0;
+
+	if (!fseeko(file, -TRAILER_SIZE, SEEK_END) &&
+	    !read_bytes(file, trailer, sizeof(trailer)) &&
+	    !memcmp(trailer, "LCIX", 4)) {
+		uint8_t entry[INDEX_ENTRY_SIZE];
+
+		*count = get_uint(trailer + 4, 4);
+		offset = get_uint(trailer + 8, 8);
+
+		frames = calloc(*count ? *count : 1, sizeof(*frames));
+		if (!frames || fseeko(file, offset, SEEK_SET))
+			goto error;
+
+		for (i = 0; i < *count; ++i) {
+			if (read_bytes(file, entry, sizeof(entry)))
+				goto error;
+
+			frames[i].offset = get_uint(entry, 8);
+			frames[i].stream = get_uint(entry + 8, 4);
+			frames[i].sequence = get_uint(entry + 12, 4);
+			frames[i].timestamp = get_uint(entry + 16, 8);
+		}
+
+		return frames;
+	}
+
+	fprintf(stderr, "No index found, scanning frames\n");
+
+	offset = data_offset;
+	while (1) {
+		uint8_t header[32];
+		struct frame *tmp;
+		uint64_t length = 0;
+		unsigned int planes;
+
+		if (fseeko(file, offset, SEEK_SET) ||
+		    read_bytes(file, header, sizeof(header)) ||
+		    memcmp(header, "LCFR", 4))
+			break;
+
+		tmp = realloc(frames, (*count + 1) * sizeof(*frames));
+		if (!tmp)
+			goto error;
+		frames = tmp;
+
+		frames[*count].offset = offset;
+		frames[*count].stream = get_uint(header + 4, 4);
+		frames[*count].sequence = get_uint(header + 8, 4);
+		frames[*count].timestamp = get_uint(header + 16, 8);
+
+		planes = get_uint(header + 12, 4);
+		for (i = 0; i < planes; ++i) {
+			uint8_t size[4];
+
+			if (read_bytes(file, size, sizeof(size)))
+				goto error;
+			length += get_uint(size, 4);
+		}
+
+		offset += sizeof(header) + planes * 4 + get_uint(header + 28, 4)
+			+ length;
+		(*count)++;
+	}
+
+	return frames;
+
+error:
+	free(frames);
+	*count = 0;
+	return NULL;
+}
+
+static int extract_frame(FILE *file, const struct frame *frame,
+			 const char *filename)
+{
+	uint8_t header[32];
+	uint64_t length = 0;
+	unsigned int planes;
+	unsigned int i;
+	FILE *output;
+	char buffer[65536];
+	int ret = -1;
+
+	if (fseeko(file, frame->offset, SEEK_SET) ||
+	    read_bytes(file, header, sizeof(header)) ||
+	    memcmp(header, "LCFR", 4)) {
+		fprintf(stderr, "Invalid frame record\n");
+		return -1;
+	}
+
+	planes = get_uint(header + 12, 4);
+	for (i = 0; i < planes; ++i) {
+		uint8_t size[4];
+
+		if (read_bytes(file, size, sizeof(size))) {
+			fprintf(stderr, "Truncated frame record\n");
+			return -1;
+		}
+		length += get_uint(size, 4);
+	}
+
+	/* Skip the padding that aligns the plane data. */
+	if (fseeko(file, get_uint(header + 28, 4), SEEK_CUR)) {
+		fprintf(stderr, "Truncated frame record\n");
+		return -1;
+	}
+
+	output = fopen(filename, "wb");
+	if (!output) {
+		fprintf(stderr, "Failed to open output file '%s': %s\n",
+			filename, strerror(errno));
+		return -1;
+	}
+
+	while (length) {
+		size_t size = length < sizeof(buffer) ? length : sizeof(buffer);
+
+		if (read_bytes(file, buffer, size)) {
+			fprintf(stderr, "Truncated frame data\n");
+			goto done;
+		}
+
+		if (fwrite(buffer, 1, size, output) != size) {
+			fprintf(stderr, "Failed to write output file: %s\n",
+				strerror(errno));
+			goto done;
+		}
+
+		length -= size;
+	}
+
+	ret = 0;
+
+done:
+	fclose(output);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct frame *frames = NULL;
+	uint8_t header[16];
+	uint64_t version, streams;
+	unsigned int count;
+	unsigned int i;
+	FILE *file;
+	int ret = 1;
+
+	if (argc != 2 && argc != 4) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "Failed to open input file '%s': %s\n",
+			argv[1], strerror(errno));
+		return 1;
+	}
+
+	if (read_bytes(file, header, sizeof(header)) ||
+	    memcmp(header, "LCCF", 4)) {
+		fprintf(stderr, "Invalid container file\n");
+		goto done;
+	}
+
+	version = get_uint(header + 4, 4);
+	if (version != CONTAINER_VERSION) {
+		fprintf(stderr, "Unsupported container version %" PRIu64 "\n",
+			version);
+		goto done;
+	}
+
+	streams = get_uint(header + 8, 4);
+	for (i = 0; i < streams; ++i) {
+		uint8_t stream[16];
+
+		if (read_bytes(file, stream, sizeof(stream))) {
+			fprintf(stderr, "Truncated container header\n");
+			goto done;
+		}
+
+		if (argc == 2)
+			printf("stream%u: %.4s %" PRIu64 "x%" PRIu64 " stride %" PRIu64 "\n",
+			       i, (const char *)stream, get_uint(stream + 4, 4),
+			       get_uint(stream + 8, 4), get_uint(stream + 12, 4));
+	}
+
+	frames = read_frames(file, sizeof(header) + streams * 16, &count);
+	if (!frames) {
+		fprintf(stderr, "Failed to read frames\n");
+		goto done;
+	}
+
+	if (argc == 4) {
+		char *end;
+		unsigned long index = strtoul(argv[2], &end, 10);
+
+		if (*end != '\0' || index >= count) {
+			fprintf(stderr, "Invalid frame index '%s', %u frames\n",
+				argv[2], count);
+			goto done;
+		}
+
+		ret = extract_frame(file, &frames[index], argv[3]) ? 1 : 0;
+		goto done;
+	}
+
+	for (i = 0; i < count; ++i)
+		printf("%u: stream%u seq %06u timestamp %" PRIu64 " offset %" PRIu64 "\n",
+		       i, frames[i].stream, frames[i].sequence,
+		       frames[i].timestamp, frames[i].offset);
+
+	ret = 0;
+
+done:
+	free(frames);
+	fclose(file);
+	return ret;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Generate the public key data matching the IPA modules signing key, from a
+# template
+
+key="$1"
+template="$2"
+output="$3"
+
+data=$(openssl rsa -in "${key}" -pubout -outform DER 2>/dev/null |
+       od -A n -v -t x1 |
+       sed -e 's/ \([0-9a-f][0-9a-f]\)/0x\1, /g' -e 's/^/\t/' -e 's/ $//') || exit 1
+
+awk -v data="${data}" '{ if ($0 == "@IPA_PUB_KEY@") print data; else print }' \
+	"${template}" > "${output}"
@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * log-decode - Decode libcamera binary log files to text
+ *
+ * Copyright (C) 2019, Google Inc.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_BINARY_VERSION	1
+
+enum log_entry_type {
+	LOG_ENTRY_CATEGORY = 1,
+	LOG_ENTRY_FILE = 2,
+	LOG_ENTRY_MESSAGE = 3,
+};
+
+struct string_table {
+	char **strings;
+	unsigned int count;
+};
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s input-file\n", basename(argv0));
+	printf("Decode a libcamera binary log file to text on stdout\n");
+}
+
+static int read_bytes(FILE *file, void *data, size_t size)
+{
+	return fread(data, 1, size, file) == size ? 0 : -1;
+}
+
+static int read_uint(FILE *file, unsigned int size, uint64_t *value)
+{
+	uint8_t data[8];
+	unsigned int i;
+
+	if (read_bytes(file, data, size))
+		return -1;
+
+	*value = 0;
+	for (i = 0; i < size; ++i)
+		*value |= (uint64_t)data[i] << (i * 8);
+
+	return 0;
+}
+
+static char *read_string(FILE *file, size_t length)
+{
+	char *str;
+
+	str = malloc(length + 1);
+	if (!str)
+		return NULL;
+
+	if (read_bytes(file, str, length)) {
+		free(str);
+		return NULL;
+	}
+
+	str[length] = '\0';
+	return str;
+}
+
+static int read_definition(FILE *file, struct string_table *table)
+{
+	uint64_t id;
+	uint64_t length;
+	char *name;
+
+	if (read_uint(file, 2, &id) || read_uint(file, 2, &length))
+		return -1;
+
+	name = read_string(file, length);
+	if (!name)
+		return -1;
+
+	if (id >= table->count) {
+		char **strings;
+
+		strings = realloc(table->strings, (id + 1) * sizeof(*strings));
+		if (!strings) {
+			free(name);
+			return -1;
+		}
+
+		memset(&strings[table->count], 0,
+		       (id + 1 - table->count) * sizeof(*strings));
+		table->strings = strings;
+		table->count = id + 1;
+	}
+
+	free(table->strings[id]);
+	table->strings[id] = name;
+
+	return 0;
+}
+
+static const char *lookup(const struct string_table *table, uint64_t id)
+{
+	if (id >= table->count || !table->strings[id])
+		return "?";
+
+	return table->strings[id];
+}
+
+static int read_message(FILE *file, const struct string_table *categories,
+			const struct string_table *files)
+{
+	static const char *const severities[] = {
+		"  DBG", " INFO", " WARN", "  ERR", "FATAL",
+	};
+	uint64_t severity, category, fileid, line, timestamp, length;
+	uint64_t sec, nsec;
+	char *msg;
+
+	if (read_uint(file, 1, &severity) || read_uint(file, 2, &category) ||
+	    read_uint(file, 2, &fileid) || read_uint(file, 4, &line) ||
+	    read_uint(file, 8, &timestamp) || read_uint(file, 4, &length))
+		return -1;
+
+	msg = read_string(file, length);
+	if (!msg)
+		return -1;
+
+	sec = timestamp / 1000000000;
+	nsec = timestamp % 1000000000;
+
+	printf("[%" PRIu64 ":%02" PRIu64 ":%02" PRIu64 ".%09" PRIu64 "]%s %s %s:%" PRIu64 " %s\n",
+	       sec / 3600, (sec / 60) % 60, sec % 60, nsec,
+	       severity < 5 ? severities[severity] : "UNKWN",
+	       lookup(categories, category), lookup(files, fileid), line, msg);
+
+	free(msg);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct string_table categories = { NULL, 0 };
+	struct string_table files = { NULL, 0 };
+	char magic[4];
+	uint64_t version;
+	unsigned int i;
+	FILE *file;
+	int ret = 1;
+
+	if (argc != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "Failed to open input file '%s': %s\n",
+			argv[1], strerror(errno));
+		return 1;
+	}
+
+	if (read_bytes(file, magic, sizeof(magic)) ||
+	    memcmp(magic, "LCBL", sizeof(magic)) ||
+	    read_uint(file, 4, &version)) {
+		fprintf(stderr, "Invalid binary log file\n");
+		goto done;
+	}
+
+	if (version != LOG_BINARY_VERSION) {
+		fprintf(stderr, "Unsupported binary log version %" PRIu64 "\n",
+			version);
+		goto done;
+	}
+
+	while (1) {
+		uint64_t type;
+		int err;
+
+		if (read_uint(file, 1, &type)) {
+			/* End of file. */
+			ret = 0;
+			break;
+		}
+
+		switch (type) {
+		case LOG_ENTRY_CATEGORY:
+			err = read_definition(file, &categories);
+			break;
+		case LOG_ENTRY_FILE:
+			err = read_definition(file, &files);
+			break;
+		case LOG_ENTRY_MESSAGE:
+			err = read_message(file, &categories, &files);
+			break;
+		default:
+			err = -1;
+			break;
+		}
+
+		if (err) {
+			fprintf(stderr, "Truncated or corrupted binary log file\n");
+			break;
+		}
+	}
+
+done:
+	for (i = 0; i < categories.count; ++i)
+		free(categories.strings[i]);
+	free(categories.strings);
+	for (i = 0; i < files.count; ++i)
+		free(files.strings[i]);
+	free(files.strings);
+
+	fclose(file);
+	return ret;
+}